@@ -0,0 +1,56 @@
+#!/bin/bash -eu
+
+# Build and run the micro-benchmarks: any argument is passed to the
+# janus_bench executable (e.g., -t 500 -f rtcp), and the results are
+# printed as JSON on the standard output, so redirect them to a file
+# to compare different builds, e.g.:
+#
+#	./bench.sh > before.json
+#	(apply some changes)
+#	./bench.sh > after.json
+
+# Load script configuration
+source $(dirname $0)/config.sh
+
+# Set working paths from the environment
+# Fallback to values used for local testing
+SRC=${SRC-$DEFAULT_SRC}
+OUT=${OUT-$DEFAULT_OUT}
+WORK=${WORK-$DEFAULT_WORK}
+JANUSGW=${JANUSGW-$DEFAULT_JANUSGW}
+
+# Set compiler and flags from the environment
+# Fallback to optimized builds without sanitizers
+BENCH_CC=${CC-$DEFAULT_CC}
+BENCH_CFLAGS=${CFLAGS-$DEFAULT_BENCH_CFLAGS}
+BENCH_LDFLAGS=${LDFLAGS-$DEFAULT_BENCH_LDFLAGS}
+
+rm -f $WORK/janus-bench-lib.a $WORK/janus_bench.o
+
+# Build and archive necessary Janus objects
+JANUS_LIB="$WORK/janus-bench-lib.a"
+pushd $SRC/$JANUSGW >&2
+# Use this variable to skip Janus objects building
+SKIP_JANUS_BUILD=${SKIP_JANUS_BUILD-"0"}
+if [ "$SKIP_JANUS_BUILD" -eq "0" ]; then
+	echo "Building Janus objects" >&2
+	./autogen.sh >&2
+	./configure CC="$BENCH_CC" CFLAGS="$BENCH_CFLAGS" $JANUS_CONF_FLAGS >&2
+	pushd src >&2
+	make clean >&2
+	make -j$(nproc) $JANUS_OBJECTS >&2
+	popd >&2
+fi
+pushd src >&2
+ar rcs $JANUS_LIB $JANUS_OBJECTS
+popd >&2
+popd >&2
+
+# Build the benchmarks
+mkdir -p $OUT
+echo "Building benchmarks" >&2
+$BENCH_CC -c $BENCH_CFLAGS $DEPS_CFLAGS -I. -I$SRC/$JANUSGW/src $SRC/$JANUSGW/fuzzers/bench/janus_bench.c -o $WORK/janus_bench.o
+$BENCH_CC $BENCH_LDFLAGS $WORK/janus_bench.o -o $OUT/janus_bench $JANUS_LIB $DEPS_LIB_SHARED
+
+# Run them on the fuzzers corpora
+$OUT/janus_bench -c $SRC/$JANUSGW/fuzzers/corpora "$@"
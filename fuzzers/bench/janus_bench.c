@@ -0,0 +1,364 @@
+/* Micro-benchmarks for the RTP, RTCP and SDP utilities
+ *
+ * This reuses the fuzzers corpora as inputs: each benchmark goes through
+ * all the samples of a corpus over and over, until enough time has passed,
+ * and then reports how long an operation took on average (ns/op) and how
+ * many allocations it needed (allocs/op). The results are printed as JSON,
+ * so that they can be compared across builds to catch regressions.
+ *
+ * Usage: janus_bench [-c corpora folder] [-t min time per benchmark in ms] [-f name filter]
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <jansson.h>
+#include "../../src/debug.h"
+#include "../../src/utils.h"
+#include "../../src/rtp.h"
+#include "../../src/rtcp.h"
+#include "../../src/sdp-utils.h"
+
+int janus_log_level = LOG_NONE;
+gboolean janus_log_timestamps = FALSE;
+gboolean janus_log_colors = FALSE;
+char *janus_log_global_prefix = NULL;
+int lock_debug = 0;
+int refcount_debug = 0;
+
+/* This is to avoid linking with openSSL */
+int RAND_bytes(uint8_t *key, int len) {
+	return 0;
+}
+
+/* Count allocations by interposing malloc and friends: this only works with
+ * glibc, where we can forward to the actual implementation, and catches
+ * GLib allocations as well, since the executable's symbols take precedence */
+static volatile gint allocations = 0;
+static gboolean allocations_counted = FALSE;
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+void *malloc(size_t size) {
+	g_atomic_int_inc(&allocations);
+	return __libc_malloc(size);
+}
+void *calloc(size_t nmemb, size_t size) {
+	g_atomic_int_inc(&allocations);
+	return __libc_calloc(nmemb, size);
+}
+void *realloc(void *ptr, size_t size) {
+	g_atomic_int_inc(&allocations);
+	return __libc_realloc(ptr, size);
+}
+#endif
+
+/* Samples from a corpus */
+typedef struct janus_bench_sample {
+	char *data;
+	int len;
+	/* Something the benchmark prepared in advance, if needed (e.g., a parsed SDP) */
+	void *prepared;
+} janus_bench_sample;
+
+/* A benchmark: the corpus it uses, how to check if a sample is usable, and the operation to measure */
+typedef struct janus_bench {
+	const char *name;
+	const char *corpus;
+	gboolean (*accept)(janus_bench_sample *sample);
+	void (*prepare)(janus_bench_sample *sample);
+	void (*cleanup)(janus_bench_sample *sample);
+	void (*run)(janus_bench_sample *sample);
+} janus_bench;
+
+/* Scratch buffer for operations that modify their input */
+static char scratch[1500];
+
+/* Checks on samples, the same ones the fuzzers do */
+static gboolean janus_bench_accept_rtp(janus_bench_sample *sample) {
+	if(sample->len <= 0 || sample->len > 1472 || !janus_is_rtp(sample->data, sample->len))
+		return FALSE;
+	int plen = 0;
+	return janus_rtp_payload(sample->data, sample->len, &plen) != NULL;
+}
+static gboolean janus_bench_accept_rtcp(janus_bench_sample *sample) {
+	return sample->len >= 8 && sample->len <= 1472 && janus_is_rtcp(sample->data, sample->len);
+}
+static gboolean janus_bench_accept_sdp(janus_bench_sample *sample) {
+	if(sample->len <= 0)
+		return FALSE;
+	char error_str[512];
+	janus_sdp *sdp = janus_sdp_parse(sample->data, error_str, sizeof(error_str));
+	if(sdp == NULL)
+		return FALSE;
+	janus_sdp_destroy(sdp);
+	return TRUE;
+}
+
+/* RTCP */
+static void janus_bench_rtcp_parse(janus_bench_sample *sample) {
+	janus_rtcp_context ctx = { 0 };
+	memcpy(scratch, sample->data, sample->len);
+	janus_rtcp_parse(&ctx, scratch, sample->len);
+}
+static void janus_bench_rtcp_fix_ssrc(janus_bench_sample *sample) {
+	janus_rtcp_context ctx = { 0 };
+	memcpy(scratch, sample->data, sample->len);
+	janus_rtcp_fix_ssrc(&ctx, scratch, sample->len, 1, 2, 2);
+}
+static void janus_bench_rtcp_filter(janus_bench_sample *sample) {
+	int newlen = 0;
+	char *filtered = janus_rtcp_filter(sample->data, sample->len, &newlen);
+	g_free(filtered);
+}
+static void janus_bench_rtcp_filter_inplace(janus_bench_sample *sample) {
+	memcpy(scratch, sample->data, sample->len);
+	janus_rtcp_filter_inplace(scratch, sample->len);
+}
+
+/* RTP extensions */
+static void janus_bench_rtp_ext_audio_level(janus_bench_sample *sample) {
+	gboolean vad = FALSE;
+	int level = 0;
+	janus_rtp_header_extension_parse_audio_level(sample->data, sample->len, 1, &vad, &level);
+}
+static void janus_bench_rtp_ext_mid(janus_bench_sample *sample) {
+	char sdes_item[16];
+	janus_rtp_header_extension_parse_mid(sample->data, sample->len, 1, sdes_item, sizeof(sdes_item));
+}
+static void janus_bench_rtp_ext_rid(janus_bench_sample *sample) {
+	char sdes_item[16];
+	janus_rtp_header_extension_parse_rid(sample->data, sample->len, 1, sdes_item, sizeof(sdes_item));
+}
+static void janus_bench_rtp_ext_transport_wide_cc(janus_bench_sample *sample) {
+	uint16_t transport_seq_num = 0;
+	janus_rtp_header_extension_parse_transport_wide_cc(sample->data, sample->len, 1, &transport_seq_num);
+}
+static void janus_bench_rtp_ext_abs_send_time(janus_bench_sample *sample) {
+	uint32_t abs_ts = 0;
+	janus_rtp_header_extension_parse_abs_send_time(sample->data, sample->len, 1, &abs_ts);
+}
+static void janus_bench_rtp_ext_dependency_desc(janus_bench_sample *sample) {
+	uint8_t dd[256];
+	int dd_len = sizeof(dd);
+	janus_rtp_header_extension_parse_dependency_desc(sample->data, sample->len, 1, dd, &dd_len);
+}
+
+/* Codecs */
+static void janus_bench_vp8_parse_descriptor(janus_bench_sample *sample) {
+	int plen = 0;
+	char *payload = janus_rtp_payload(sample->data, sample->len, &plen);
+	gboolean m = FALSE;
+	uint16_t picid = 0;
+	uint8_t tlzi = 0, tid = 0, ybit = 0, keyidx = 0;
+	janus_vp8_parse_descriptor(payload, plen, &m, &picid, &tlzi, &tid, &ybit, &keyidx);
+}
+static void janus_bench_vp9_parse_svc(janus_bench_sample *sample) {
+	int plen = 0;
+	char *payload = janus_rtp_payload(sample->data, sample->len, &plen);
+	gboolean found = FALSE;
+	janus_vp9_svc_info info;
+	janus_vp9_parse_svc(payload, plen, &found, &info);
+}
+
+/* Simulcast: the sample SSRC is considered as the lowest substream */
+static void janus_bench_simulcast_prepare(janus_bench_sample *sample) {
+	janus_rtp_simulcasting_context *context = g_malloc0(sizeof(janus_rtp_simulcasting_context));
+	janus_rtp_simulcasting_context_reset(context);
+	context->substream_target = 2;
+	context->templayer_target = 2;
+	sample->prepared = context;
+}
+static void janus_bench_simulcast_process_rtp(janus_bench_sample *sample) {
+	janus_rtp_header *header = (janus_rtp_header *)sample->data;
+	uint32_t ssrcs[3] = { ntohl(header->ssrc), 0, 0 };
+	janus_rtp_simulcasting_context_process_rtp((janus_rtp_simulcasting_context *)sample->prepared,
+		sample->data, sample->len, NULL, 0, ssrcs, NULL, JANUS_VIDEOCODEC_VP8, NULL, NULL);
+}
+static void janus_bench_free_prepared(janus_bench_sample *sample) {
+	g_free(sample->prepared);
+	sample->prepared = NULL;
+}
+
+/* SDP */
+static void janus_bench_sdp_parse(janus_bench_sample *sample) {
+	char error_str[512];
+	janus_sdp *sdp = janus_sdp_parse(sample->data, error_str, sizeof(error_str));
+	janus_sdp_destroy(sdp);
+}
+static void janus_bench_sdp_write_prepare(janus_bench_sample *sample) {
+	char error_str[512];
+	sample->prepared = janus_sdp_parse(sample->data, error_str, sizeof(error_str));
+}
+static void janus_bench_sdp_write(janus_bench_sample *sample) {
+	char *sdp = janus_sdp_write((janus_sdp *)sample->prepared);
+	g_free(sdp);
+}
+static void janus_bench_sdp_write_cleanup(janus_bench_sample *sample) {
+	janus_sdp_destroy((janus_sdp *)sample->prepared);
+	sample->prepared = NULL;
+}
+
+static janus_bench benchmarks[] = {
+	{ "rtcp_parse", "rtcp_fuzzer", janus_bench_accept_rtcp, NULL, NULL, janus_bench_rtcp_parse },
+	{ "rtcp_fix_ssrc", "rtcp_fuzzer", janus_bench_accept_rtcp, NULL, NULL, janus_bench_rtcp_fix_ssrc },
+	{ "rtcp_filter", "rtcp_fuzzer", janus_bench_accept_rtcp, NULL, NULL, janus_bench_rtcp_filter },
+	{ "rtcp_filter_inplace", "rtcp_fuzzer", janus_bench_accept_rtcp, NULL, NULL, janus_bench_rtcp_filter_inplace },
+	{ "rtp_ext_audio_level", "rtp_fuzzer", janus_bench_accept_rtp, NULL, NULL, janus_bench_rtp_ext_audio_level },
+	{ "rtp_ext_mid", "rtp_fuzzer", janus_bench_accept_rtp, NULL, NULL, janus_bench_rtp_ext_mid },
+	{ "rtp_ext_rid", "rtp_fuzzer", janus_bench_accept_rtp, NULL, NULL, janus_bench_rtp_ext_rid },
+	{ "rtp_ext_transport_wide_cc", "rtp_fuzzer", janus_bench_accept_rtp, NULL, NULL, janus_bench_rtp_ext_transport_wide_cc },
+	{ "rtp_ext_abs_send_time", "rtp_fuzzer", janus_bench_accept_rtp, NULL, NULL, janus_bench_rtp_ext_abs_send_time },
+	{ "rtp_ext_dependency_desc", "rtp_fuzzer", janus_bench_accept_rtp, NULL, NULL, janus_bench_rtp_ext_dependency_desc },
+	{ "vp8_parse_descriptor", "rtp_fuzzer", janus_bench_accept_rtp, NULL, NULL, janus_bench_vp8_parse_descriptor },
+	{ "vp9_parse_svc", "rtp_fuzzer", janus_bench_accept_rtp, NULL, NULL, janus_bench_vp9_parse_svc },
+	{ "simulcasting_context_process_rtp", "rtp_fuzzer", janus_bench_accept_rtp,
+		janus_bench_simulcast_prepare, janus_bench_free_prepared, janus_bench_simulcast_process_rtp },
+	{ "sdp_parse", "sdp_fuzzer", janus_bench_accept_sdp, NULL, NULL, janus_bench_sdp_parse },
+	{ "sdp_write", "sdp_fuzzer", janus_bench_accept_sdp,
+		janus_bench_sdp_write_prepare, janus_bench_sdp_write_cleanup, janus_bench_sdp_write },
+	{ NULL, NULL, NULL, NULL, NULL, NULL }
+};
+
+/* Load all the samples of a corpus, and keep the ones the benchmark can use */
+static GPtrArray *janus_bench_load_corpus(const char *corpora, janus_bench *bench) {
+	char *folder = g_build_filename(corpora, bench->corpus, NULL);
+	GDir *dir = g_dir_open(folder, 0, NULL);
+	if(dir == NULL) {
+		fprintf(stderr, "Couldn't open corpus folder %s\n", folder);
+		g_free(folder);
+		return NULL;
+	}
+	GPtrArray *samples = g_ptr_array_new();
+	const char *name = NULL;
+	while((name = g_dir_read_name(dir)) != NULL) {
+		if(strstr(name, "LICENSE") != NULL)
+			continue;
+		char *path = g_build_filename(folder, name, NULL);
+		char *contents = NULL;
+		gsize len = 0;
+		if(g_file_get_contents(path, &contents, &len, NULL)) {
+			janus_bench_sample *sample = g_malloc0(sizeof(janus_bench_sample));
+			/* Make sure SDPs are strings, as they'd be coming from Jansson */
+			sample->data = g_realloc(contents, len+1);
+			sample->data[len] = '\0';
+			sample->len = len;
+			if(bench->accept(sample)) {
+				g_ptr_array_add(samples, sample);
+			} else {
+				g_free(sample->data);
+				g_free(sample);
+			}
+		}
+		g_free(path);
+	}
+	g_dir_close(dir);
+	g_free(folder);
+	return samples;
+}
+
+static gint64 janus_bench_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (gint64)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static json_t *janus_bench_run(const char *corpora, janus_bench *bench, gint64 min_time_ns) {
+	json_t *result = json_object();
+	json_object_set_new(result, "name", json_string(bench->name));
+	json_object_set_new(result, "corpus", json_string(bench->corpus));
+	GPtrArray *samples = janus_bench_load_corpus(corpora, bench);
+	if(samples == NULL || samples->len == 0) {
+		json_object_set_new(result, "samples", json_integer(0));
+		json_object_set_new(result, "error", json_string("no usable samples"));
+		if(samples != NULL)
+			g_ptr_array_free(samples, TRUE);
+		return result;
+	}
+	guint i = 0;
+	for(i=0; i<samples->len; i++) {
+		janus_bench_sample *sample = g_ptr_array_index(samples, i);
+		if(bench->prepare)
+			bench->prepare(sample);
+	}
+	/* Warm up, and then go through the corpus until enough time has passed */
+	for(i=0; i<samples->len; i++)
+		bench->run(g_ptr_array_index(samples, i));
+	guint64 ops = 0;
+	gint allocs_before = g_atomic_int_get(&allocations);
+	gint64 start = janus_bench_now(), elapsed = 0;
+	do {
+		int round = 0;
+		for(round=0; round<64; round++) {
+			for(i=0; i<samples->len; i++)
+				bench->run(g_ptr_array_index(samples, i));
+		}
+		ops += 64 * samples->len;
+		elapsed = janus_bench_now() - start;
+	} while(elapsed < min_time_ns);
+	gint allocs = g_atomic_int_get(&allocations) - allocs_before;
+	json_object_set_new(result, "samples", json_integer(samples->len));
+	json_object_set_new(result, "ops", json_integer(ops));
+	json_object_set_new(result, "ns_per_op", json_real((double)elapsed/(double)ops));
+	if(allocations_counted)
+		json_object_set_new(result, "allocs_per_op", json_real((double)allocs/(double)ops));
+	else
+		json_object_set_new(result, "allocs_per_op", json_null());
+	for(i=0; i<samples->len; i++) {
+		janus_bench_sample *sample = g_ptr_array_index(samples, i);
+		if(bench->cleanup)
+			bench->cleanup(sample);
+		g_free(sample->data);
+		g_free(sample);
+	}
+	g_ptr_array_free(samples, TRUE);
+	return result;
+}
+
+int main(int argc, char **argv) {
+	const char *corpora = "corpora", *filter = NULL;
+	int min_time_ms = 200, opt = 0;
+	while((opt = getopt(argc, argv, "c:t:f:h")) != -1) {
+		switch(opt) {
+			case 'c':
+				corpora = optarg;
+				break;
+			case 't':
+				min_time_ms = atoi(optarg);
+				if(min_time_ms <= 0)
+					min_time_ms = 200;
+				break;
+			case 'f':
+				filter = optarg;
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-c corpora folder] [-t min time per benchmark in ms] [-f name filter]\n", argv[0]);
+				return opt == 'h' ? 0 : 1;
+		}
+	}
+#ifdef __GLIBC__
+	allocations_counted = TRUE;
+#endif
+	json_t *results = json_array();
+	janus_bench *bench = NULL;
+	for(bench = benchmarks; bench->name != NULL; bench++) {
+		if(filter != NULL && strstr(bench->name, filter) == NULL)
+			continue;
+		json_array_append_new(results, janus_bench_run(corpora, bench, (gint64)min_time_ms*1000000));
+	}
+	json_t *root = json_object();
+	json_object_set_new(root, "min_time_ms", json_integer(min_time_ms));
+	json_object_set_new(root, "benchmarks", results);
+	char *output = json_dumps(root, JSON_INDENT(2) | JSON_PRESERVE_ORDER);
+	printf("%s\n", output);
+	free(output);
+	json_decref(root);
+	return 0;
+}
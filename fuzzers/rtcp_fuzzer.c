@@ -35,12 +35,14 @@ int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
 	/* Do some copies of input data */
 	uint8_t copy_data0[size], copy_data1[size],
 		copy_data2[size], copy_data3[size],
-			copy_data4[size], copy_data5[size];
-	uint8_t *copy_data[6] = { copy_data0, copy_data1,
+			copy_data4[size], copy_data5[size],
+				copy_data6[size];
+	uint8_t *copy_data[7] = { copy_data0, copy_data1,
 			copy_data2, copy_data3,
-				copy_data4, copy_data5 };
+				copy_data4, copy_data5,
+					copy_data6 };
 	int idx, newlen;
-	for (idx=0; idx < 6; idx++) {
+	for (idx=0; idx < 7; idx++) {
 		memcpy(copy_data[idx], data, size);
 	}
 	idx = 0;
@@ -64,6 +66,7 @@ int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
 	janus_rtcp_fix_ssrc(&ctx0, (char *)copy_data[idx++], size, 1, 2, 2);
 	janus_rtcp_parse(&ctx1, (char *)copy_data[idx++], size);
 	janus_rtcp_remove_nacks((char *)copy_data[idx++], size);
+	janus_rtcp_filter_inplace((char *)copy_data[idx++], size);
 	/* Functions that allocate new memory */
 	char *output_data = janus_rtcp_filter((char *)data, size, &newlen);
 	GQueue *queue = g_queue_new();
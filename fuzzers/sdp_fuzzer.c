@@ -34,9 +34,32 @@ int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
 		return 0;
 	/* Regenerate the SDP blog */
 	char *generated_sdp = janus_sdp_write(parsed_sdp);
+	/* Keep an attribute around, it must outlive the SDP it was parsed from */
+	janus_sdp_attribute *attr = NULL;
+	janus_sdp_mline *m = parsed_sdp->m_lines ? (janus_sdp_mline *)parsed_sdp->m_lines->data : NULL;
+	if(m != NULL && m->attributes != NULL) {
+		attr = (janus_sdp_attribute *)m->attributes->data;
+		janus_refcount_increase(&attr->ref);
+	}
+	janus_sdp_destroy(parsed_sdp);
+	/* What we generate must be parsed back to the same SDP */
+	if(generated_sdp != NULL) {
+		janus_sdp *reparsed_sdp = janus_sdp_parse(generated_sdp, error_str, sizeof(error_str));
+		if(reparsed_sdp != NULL) {
+			char *regenerated_sdp = janus_sdp_write(reparsed_sdp);
+			if(regenerated_sdp == NULL || strcmp(generated_sdp, regenerated_sdp))
+				abort();
+			g_free(regenerated_sdp);
+			janus_sdp_destroy(reparsed_sdp);
+		}
+	}
+	if(attr != NULL) {
+		if(attr->name == NULL || strlen(attr->name) > size)
+			abort();
+		janus_refcount_decrease(&attr->ref);
+	}
 
 	/* Free resources */
-	janus_sdp_destroy(parsed_sdp);
 	g_free(generated_sdp);
 
 	return 0;
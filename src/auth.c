@@ -33,16 +33,42 @@
 #include "mutex.h"
 #include "utils.h"
 
-/* Hash table to contain the tokens to match */
+/* Hash table to contain the tokens to match: they're checked for pretty
+ * much every request, and changed very rarely, hence the read-write lock */
 static GHashTable *tokens = NULL, *allowed_plugins = NULL;
 static gboolean auth_enabled = FALSE;
-static janus_mutex mutex;
+static janus_rwlock tokens_lock;
 static char *auth_secret = NULL;
 
+/* Signed tokens we validated already: clients send the same token with each
+ * request (e.g., keepalives and trickles), so we cache what we parsed out of
+ * them, to avoid splitting them and computing their HMAC over and over. The
+ * cache is a fixed size array, where tokens are placed depending on their hash
+ * and replace what was there: each slot has its own lock, which means checks
+ * for different tokens hardly ever contend. Only tokens with a valid signature
+ * are cached, and entries are dropped as soon as we find out they expired */
+#define JANUS_AUTH_CACHE_SLOTS	512
+typedef struct janus_auth_cache_slot {
+	janus_mutex mutex;
+	char *token;
+	gint64 expiry;
+	/* Data part of the token: expiry, realm and optional descriptors */
+	gchar **data;
+} janus_auth_cache_slot;
+static janus_auth_cache_slot signed_cache[JANUS_AUTH_CACHE_SLOTS];
+
 static void janus_auth_free_token(char *token) {
 	g_free(token);
 }
 
+static void janus_auth_cache_slot_clear(janus_auth_cache_slot *slot) {
+	g_free(slot->token);
+	slot->token = NULL;
+	g_strfreev(slot->data);
+	slot->data = NULL;
+	slot->expiry = 0;
+}
+
 /* Setup */
 void janus_auth_init(gboolean enabled, const char *secret) {
 	if(enabled) {
@@ -59,7 +85,10 @@ void janus_auth_init(gboolean enabled, const char *secret) {
 	} else {
 		JANUS_LOG(LOG_INFO, "Token based authentication disabled\n");
 	}
-	janus_mutex_init(&mutex);
+	janus_rwlock_init(&tokens_lock);
+	int i = 0;
+	for(i=0; i<JANUS_AUTH_CACHE_SLOTS; i++)
+		janus_mutex_init(&signed_cache[i].mutex);
 }
 
 gboolean janus_auth_is_enabled(void) {
@@ -75,7 +104,7 @@ gboolean janus_auth_is_signed_mode(void) {
 }
 
 void janus_auth_deinit(void) {
-	janus_mutex_lock(&mutex);
+	janus_rwlock_write_lock(&tokens_lock);
 	if(tokens != NULL)
 		g_hash_table_destroy(tokens);
 	tokens = NULL;
@@ -84,95 +113,112 @@ void janus_auth_deinit(void) {
 	allowed_plugins = NULL;
 	g_free(auth_secret);
 	auth_secret = NULL;
-	janus_mutex_unlock(&mutex);
+	janus_rwlock_write_unlock(&tokens_lock);
+	int i = 0;
+	for(i=0; i<JANUS_AUTH_CACHE_SLOTS; i++) {
+		janus_mutex_lock(&signed_cache[i].mutex);
+		janus_auth_cache_slot_clear(&signed_cache[i]);
+		janus_mutex_unlock(&signed_cache[i].mutex);
+	}
 }
 
-gboolean janus_auth_check_signature(const char *token, const char *realm) {
-	if (!auth_enabled || auth_secret == NULL)
+/* Constant time comparison that, unlike janus_strcmp_const_time, doesn't
+ * allocate anything: only the length of the tokens may leak, which is fine */
+static gboolean janus_auth_token_equal(const char *token1, const char *token2) {
+	size_t len = strlen(token1);
+	if(strlen(token2) != len)
+		return FALSE;
+	unsigned char result = 0;
+	size_t i = 0;
+	for(i = 0; i < len; i++)
+		result |= (unsigned char)token1[i] ^ (unsigned char)token2[i];
+	return result == 0;
+}
+
+/* Check the fields of a token whose signature is valid */
+static gboolean janus_auth_check_data(gchar **data, gint64 expiry, gint64 now, const char *realm, const char *desc) {
+	if(expiry < 0 || now > expiry)
 		return FALSE;
+	if(strcmp(data[1], realm))
+		return FALSE;
+	if(desc == NULL)
+		return TRUE;
+	int i = 2;
+	for(i = 2; data[i]; i++) {
+		if(!strcmp(desc, data[i]))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/* Validate a signed token, optionally checking it contains a descriptor */
+static gboolean janus_auth_check_signed_token(const char *token, const char *realm, const char *desc) {
+	if(token == NULL || realm == NULL)
+		return FALSE;
+	gint64 real_time = janus_get_real_time() / 1000000;
+	/* Check if we validated this token already */
+	janus_auth_cache_slot *slot = &signed_cache[g_str_hash(token) % JANUS_AUTH_CACHE_SLOTS];
+	janus_mutex_lock(&slot->mutex);
+	if(slot->token != NULL && janus_auth_token_equal(slot->token, token)) {
+		gboolean result = janus_auth_check_data(slot->data, slot->expiry, real_time, realm, desc);
+		if(real_time > slot->expiry)
+			janus_auth_cache_slot_clear(slot);
+		janus_mutex_unlock(&slot->mutex);
+		return result;
+	}
+	janus_mutex_unlock(&slot->mutex);
+	/* We didn't, parse the token and verify the signature */
 	gchar **parts = g_strsplit(token, ":", 2);
 	gchar **data = NULL;
+	gboolean result = FALSE;
 	/* Token should have exactly one data and one hash part */
 	if(!parts[0] || !parts[1] || parts[2])
-		goto fail;
-	data = g_strsplit(parts[0], ",", 3);
+		goto done;
+	data = g_strsplit(parts[0], ",", 0);
 	/* Need at least an expiry timestamp and realm */
 	if(!data[0] || !data[1])
-		goto fail;
-	/* Verify timestamp */
+		goto done;
 	gint64 expiry_time = strtoll(data[0], NULL, 10);
-	gint64 real_time = janus_get_real_time() / 1000000;
 	if(expiry_time < 0 || real_time > expiry_time)
-		goto fail;
-	/* Verify realm */
-	if(strcmp(data[1], realm))
-		goto fail;
+		goto done;
 	/* Verify HMAC-SHA1 */
 	unsigned char signature[EVP_MAX_MD_SIZE] = "";
 	unsigned int len;
 	HMAC(EVP_sha1(), auth_secret, strlen(auth_secret), (const unsigned char*)parts[0], strlen(parts[0]), signature, &len);
 	gchar *base64 = g_base64_encode(signature, len);
-	gboolean result = janus_strcmp_const_time(parts[1], base64);
-	g_strfreev(data);
-	g_strfreev(parts);
+	gboolean valid = janus_strcmp_const_time(parts[1], base64);
 	g_free(base64);
-	return result;
+	if(!valid)
+		goto done;
+	result = janus_auth_check_data(data, expiry_time, real_time, realm, desc);
+	/* The signature is valid, cache the token (even if it's for a different realm or descriptor) */
+	janus_mutex_lock(&slot->mutex);
+	janus_auth_cache_slot_clear(slot);
+	slot->token = g_strdup(token);
+	slot->expiry = expiry_time;
+	slot->data = data;
+	data = NULL;
+	janus_mutex_unlock(&slot->mutex);
 
-fail:
+done:
 	g_strfreev(data);
 	g_strfreev(parts);
-	return FALSE;
+	return result;
+}
+
+gboolean janus_auth_check_signature(const char *token, const char *realm) {
+	if (!auth_enabled || auth_secret == NULL)
+		return FALSE;
+	return janus_auth_check_signed_token(token, realm, NULL);
 }
 
 gboolean janus_auth_check_signature_contains(const char *token, const char *realm, const char *desc) {
 	if (!auth_enabled || auth_secret == NULL) {
 		return TRUE;
 	}
-	if(token == NULL)
+	if(token == NULL || desc == NULL)
 		return FALSE;
-	gchar **parts = g_strsplit(token, ":", 2);
-	gchar **data = NULL;
-	/* Token should have exactly one data and one hash part */
-	if(!parts[0] || !parts[1] || parts[2])
-		goto fail;
-	data = g_strsplit(parts[0], ",", 0);
-	/* Need at least an expiry timestamp and realm */
-	if(!data[0] || !data[1])
-		goto fail;
-	/* Verify timestamp */
-	gint64 expiry_time = strtoll(data[0], NULL, 10);
-	gint64 real_time = janus_get_real_time() / 1000000;
-	if(expiry_time < 0 || real_time > expiry_time)
-		goto fail;
-	/* Verify realm */
-	if(strcmp(data[1], realm))
-		goto fail;
-	/* Find descriptor */
-	gboolean result = FALSE;
-	int i = 2;
-	for(i = 2; data[i]; i++) {
-		if (!strcmp(desc, data[i])) {
-			result = TRUE;
-			break;
-		}
-	}
-	if (!result)
-		goto fail;
-	/* Verify HMAC-SHA1 */
-	unsigned char signature[EVP_MAX_MD_SIZE] = "";
-	unsigned int len;
-	HMAC(EVP_sha1(), auth_secret, strlen(auth_secret), (const unsigned char*)parts[0], strlen(parts[0]), signature, &len);
-	gchar *base64 = g_base64_encode(signature, len);
-	result = janus_strcmp_const_time(parts[1], base64);
-	g_strfreev(data);
-	g_strfreev(parts);
-	g_free(base64);
-	return result;
-
-fail:
-	g_strfreev(data);
-	g_strfreev(parts);
-	return FALSE;
+	return janus_auth_check_signed_token(token, realm, desc);
 }
 
 /* Tokens manipulation */
@@ -183,15 +229,15 @@ gboolean janus_auth_add_token(const char *token) {
 	}
 	if(token == NULL)
 		return FALSE;
-	janus_mutex_lock(&mutex);
+	janus_rwlock_write_lock(&tokens_lock);
 	if(g_hash_table_lookup(tokens, token)) {
 		JANUS_LOG(LOG_VERB, "Token already validated\n");
-		janus_mutex_unlock(&mutex);
+		janus_rwlock_write_unlock(&tokens_lock);
 		return TRUE;
 	}
 	char *new_token = g_strdup(token);
 	g_hash_table_insert(tokens, new_token, new_token);
-	janus_mutex_unlock(&mutex);
+	janus_rwlock_write_unlock(&tokens_lock);
 	return TRUE;
 }
 
@@ -201,12 +247,12 @@ gboolean janus_auth_check_token(const char *token) {
 		return TRUE;
 	if (tokens == NULL)
 		return janus_auth_check_signature(token, "janus");
-	janus_mutex_lock(&mutex);
+	janus_rwlock_read_lock(&tokens_lock);
 	if(token && g_hash_table_lookup(tokens, token)) {
-		janus_mutex_unlock(&mutex);
+		janus_rwlock_read_unlock(&tokens_lock);
 		return TRUE;
 	}
-	janus_mutex_unlock(&mutex);
+	janus_rwlock_read_unlock(&tokens_lock);
 	return FALSE;
 }
 
@@ -214,7 +260,7 @@ GList *janus_auth_list_tokens(void) {
 	/* Always NULL if the mechanism is disabled, of course */
 	if(!auth_enabled || tokens == NULL)
 		return NULL;
-	janus_mutex_lock(&mutex);
+	janus_rwlock_read_lock(&tokens_lock);
 	GList *list = NULL;
 	if(g_hash_table_size(tokens) > 0) {
 		GHashTableIter iter;
@@ -225,7 +271,7 @@ GList *janus_auth_list_tokens(void) {
 			list = g_list_append(list, g_strdup(token));
 		}
 	}
-	janus_mutex_unlock(&mutex);
+	janus_rwlock_read_unlock(&tokens_lock);
 	return list;
 }
 
@@ -234,7 +280,7 @@ gboolean janus_auth_remove_token(const char *token) {
 		JANUS_LOG(LOG_ERR, "Can't remove token, stored-authentication mechanism is disabled\n");
 		return FALSE;
 	}
-	janus_mutex_lock(&mutex);
+	janus_rwlock_write_lock(&tokens_lock);
 	gboolean ok = token && g_hash_table_remove(tokens, token);
 	/* Also clear the allowed plugins mapping */
 	GList *list = g_hash_table_lookup(allowed_plugins, token);
@@ -242,7 +288,7 @@ gboolean janus_auth_remove_token(const char *token) {
 	if(list != NULL)
 		g_list_free(list);
 	/* Done */
-	janus_mutex_unlock(&mutex);
+	janus_rwlock_write_unlock(&tokens_lock);
 	return ok;
 }
 
@@ -254,9 +300,9 @@ gboolean janus_auth_allow_plugin(const char *token, janus_plugin *plugin) {
 	}
 	if(token == NULL || plugin == NULL)
 		return FALSE;
-	janus_mutex_lock(&mutex);
+	janus_rwlock_write_lock(&tokens_lock);
 	if(!g_hash_table_lookup(tokens, token)) {
-		janus_mutex_unlock(&mutex);
+		janus_rwlock_write_unlock(&tokens_lock);
 		return FALSE;
 	}
 	GList *list = g_hash_table_lookup(allowed_plugins, token);
@@ -265,19 +311,19 @@ gboolean janus_auth_allow_plugin(const char *token, janus_plugin *plugin) {
 		list = g_list_append(list, plugin);
 		char *new_token = g_strdup(token);
 		g_hash_table_insert(allowed_plugins, new_token, list);
-		janus_mutex_unlock(&mutex);
+		janus_rwlock_write_unlock(&tokens_lock);
 		return TRUE;
 	}
 	/* We already have a list, update it if needed */
 	if(g_list_find(list, plugin) != NULL) {
 		JANUS_LOG(LOG_VERB, "Plugin access already allowed for token\n");
-		janus_mutex_unlock(&mutex);
+		janus_rwlock_write_unlock(&tokens_lock);
 		return TRUE;
 	}
 	list = g_list_append(list, plugin);
 	char *new_token = g_strdup(token);
 	g_hash_table_insert(allowed_plugins, new_token, list);
-	janus_mutex_unlock(&mutex);
+	janus_rwlock_write_unlock(&tokens_lock);
 	return TRUE;
 }
 
@@ -287,17 +333,17 @@ gboolean janus_auth_check_plugin(const char *token, janus_plugin *plugin) {
 		return TRUE;
 	if (allowed_plugins == NULL)
 		return janus_auth_check_signature_contains(token, "janus", plugin->get_package());
-	janus_mutex_lock(&mutex);
+	janus_rwlock_read_lock(&tokens_lock);
 	if(!g_hash_table_lookup(tokens, token)) {
-		janus_mutex_unlock(&mutex);
+		janus_rwlock_read_unlock(&tokens_lock);
 		return FALSE;
 	}
 	GList *list = g_hash_table_lookup(allowed_plugins, token);
 	if(g_list_find(list, plugin) == NULL) {
-		janus_mutex_unlock(&mutex);
+		janus_rwlock_read_unlock(&tokens_lock);
 		return FALSE;
 	}
-	janus_mutex_unlock(&mutex);
+	janus_rwlock_read_unlock(&tokens_lock);
 	return TRUE;
 }
 
@@ -305,16 +351,16 @@ GList *janus_auth_list_plugins(const char *token) {
 	/* Always NULL if the mechanism is disabled, of course */
 	if(!auth_enabled || allowed_plugins == NULL)
 		return NULL;
-	janus_mutex_lock(&mutex);
+	janus_rwlock_read_lock(&tokens_lock);
 	if(!g_hash_table_lookup(tokens, token)) {
-		janus_mutex_unlock(&mutex);
+		janus_rwlock_read_unlock(&tokens_lock);
 		return FALSE;
 	}
 	GList *list = NULL;
 	GList *plugins_list = g_hash_table_lookup(allowed_plugins, token);
 	if(plugins_list != NULL)
 		list = g_list_copy(plugins_list);
-	janus_mutex_unlock(&mutex);
+	janus_rwlock_read_unlock(&tokens_lock);
 	return list;
 }
 
@@ -323,9 +369,9 @@ gboolean janus_auth_disallow_plugin(const char *token, janus_plugin *plugin) {
 		JANUS_LOG(LOG_ERR, "Can't disallow access to plugin, authentication mechanism is disabled\n");
 		return FALSE;
 	}
-	janus_mutex_lock(&mutex);
+	janus_rwlock_write_lock(&tokens_lock);
 	if(!g_hash_table_lookup(tokens, token)) {
-		janus_mutex_unlock(&mutex);
+		janus_rwlock_write_unlock(&tokens_lock);
 		return FALSE;
 	}
 	GList *list = g_hash_table_lookup(allowed_plugins, token);
@@ -335,6 +381,6 @@ gboolean janus_auth_disallow_plugin(const char *token, janus_plugin *plugin) {
 		char *new_token = g_strdup(token);
 		g_hash_table_insert(allowed_plugins, new_token, list);
 	}
-	janus_mutex_unlock(&mutex);
+	janus_rwlock_write_unlock(&tokens_lock);
 	return TRUE;
 }
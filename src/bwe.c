@@ -0,0 +1,418 @@
+/*! \file    bwe.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Sender side bandwidth estimation
+ * \details  Implementation of a simple sender side bandwidth estimator,
+ * loosely based on Google Congestion Control (GCC). The core keeps track
+ * of when each packet carrying a transport-wide sequence number was sent,
+ * and matches that with the arrival times the recipient reports in its
+ * transport-wide CC feedback: a delay based controller (trendline filter
+ * plus overuse detector) and a loss based controller then come up with
+ * an estimate of the available bandwidth towards the recipient, that
+ * plugins can retrieve to adapt what they send (e.g., simulcast layers).
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include <math.h>
+
+#include "bwe.h"
+#include "debug.h"
+#include "mutex.h"
+#include "rtcp.h"
+#include "utils.h"
+
+/* Limits for the estimate, and where we start from (in bps) */
+#define JANUS_BWE_MIN_BITRATE		50000
+#define JANUS_BWE_MAX_BITRATE		20000000
+#define JANUS_BWE_START_BITRATE		1000000
+/* Packets sent within this time (in us) of each other belong to the same group */
+#define JANUS_BWE_BURST_TIME		5000
+/* Trendline filter parameters */
+#define JANUS_BWE_TRENDLINE_WINDOW		20
+#define JANUS_BWE_TRENDLINE_SMOOTHING	0.9
+#define JANUS_BWE_TRENDLINE_GAIN		4.0
+/* Overuse detector parameters (times in ms) */
+#define JANUS_BWE_OVERUSE_TIME		10.0
+#define JANUS_BWE_THRESHOLD_START	12.5
+#define JANUS_BWE_THRESHOLD_MIN		6.0
+#define JANUS_BWE_THRESHOLD_MAX		600.0
+#define JANUS_BWE_THRESHOLD_K_UP	0.0087
+#define JANUS_BWE_THRESHOLD_K_DOWN	0.039
+/* Rate controller parameters */
+#define JANUS_BWE_DECREASE_FACTOR	0.85
+#define JANUS_BWE_INCREASE_RATE		0.08
+#define JANUS_BWE_DECREASE_INTERVAL	300000
+/* How far above the acknowledged bitrate the estimate can grow: this leaves
+ * room for plugins to try and send more (e.g., a higher simulcast layer) */
+#define JANUS_BWE_APP_LIMITED_FACTOR	3
+#define JANUS_BWE_APP_LIMITED_EXTRA		100000
+/* Loss based controller parameters */
+#define JANUS_BWE_LOSS_HIGH			0.10
+#define JANUS_BWE_LOSS_LOW			0.02
+#define JANUS_BWE_LOSS_MIN_PACKETS	20
+
+typedef enum janus_bwe_usage {
+	janus_bwe_usage_normal = 0,
+	janus_bwe_usage_overuse,
+	janus_bwe_usage_underuse
+} janus_bwe_usage;
+static const char *janus_bwe_usage_str(janus_bwe_usage usage) {
+	switch(usage) {
+		case janus_bwe_usage_normal: return "normal";
+		case janus_bwe_usage_overuse: return "overuse";
+		case janus_bwe_usage_underuse: return "underuse";
+		default: break;
+	}
+	return NULL;
+}
+
+typedef enum janus_bwe_state {
+	janus_bwe_state_hold = 0,
+	janus_bwe_state_increase,
+	janus_bwe_state_decrease
+} janus_bwe_state;
+
+/* Packets we sent */
+typedef struct janus_bwe_sent_packet {
+	gint64 sent;
+	guint16 seq;
+	guint16 size;
+	gboolean valid;
+} janus_bwe_sent_packet;
+
+struct janus_bwe_context {
+	/* Packets we sent, indexed by transport-wide sequence number */
+	janus_bwe_sent_packet history[JANUS_BWE_HISTORY_SIZE];
+	/* Current and previous group of packets */
+	gboolean group, prev_group;
+	gint64 group_first_sent, group_sent, group_arrival;
+	gint64 prev_sent, prev_arrival;
+	/* Trendline filter */
+	double accumulated_delay, smoothed_delay;
+	gint64 first_arrival;
+	guint num_deltas;
+	double window_x[JANUS_BWE_TRENDLINE_WINDOW], window_y[JANUS_BWE_TRENDLINE_WINDOW];
+	guint window_count, window_pos;
+	double trend, prev_trend, modified_trend;
+	/* Overuse detector */
+	double threshold, overuse_time;
+	guint overuse_count;
+	gint64 threshold_updated;
+	janus_bwe_usage usage;
+	/* Bitrate the recipient acknowledged */
+	guint64 acked_bytes;
+	gint64 acked_since;
+	guint32 acked_bitrate;
+	/* Delay based controller */
+	janus_bwe_state state;
+	guint32 delay_estimate;
+	gint64 delay_updated, delay_decreased;
+	/* Loss based controller */
+	guint lost, reported;
+	double loss;
+	guint32 loss_estimate;
+	gint64 loss_updated, loss_decreased;
+	/* Resulting estimate */
+	gboolean started;
+	volatile gint estimate;
+	janus_mutex mutex;
+};
+
+janus_bwe_context *janus_bwe_context_create(void) {
+	janus_bwe_context *bwe = g_malloc0(sizeof(janus_bwe_context));
+	bwe->threshold = JANUS_BWE_THRESHOLD_START;
+	bwe->overuse_time = -1;
+	bwe->delay_estimate = JANUS_BWE_START_BITRATE;
+	bwe->loss_estimate = JANUS_BWE_START_BITRATE;
+	janus_mutex_init(&bwe->mutex);
+	return bwe;
+}
+
+void janus_bwe_context_destroy(janus_bwe_context *bwe) {
+	if(bwe == NULL)
+		return;
+	janus_mutex_destroy(&bwe->mutex);
+	g_free(bwe);
+}
+
+void janus_bwe_context_add_sent(janus_bwe_context *bwe, guint16 seq, gint64 sent, guint size) {
+	if(bwe == NULL)
+		return;
+	janus_mutex_lock(&bwe->mutex);
+	janus_bwe_sent_packet *p = &bwe->history[seq & (JANUS_BWE_HISTORY_SIZE-1)];
+	p->sent = sent;
+	p->seq = seq;
+	p->size = size > G_MAXUINT16 ? G_MAXUINT16 : size;
+	p->valid = TRUE;
+	janus_mutex_unlock(&bwe->mutex);
+}
+
+/* Helper to reset the delay based detection, e.g., in case of time discontinuities */
+static void janus_bwe_context_reset_trendline(janus_bwe_context *bwe) {
+	bwe->group = FALSE;
+	bwe->prev_group = FALSE;
+	bwe->accumulated_delay = 0;
+	bwe->smoothed_delay = 0;
+	bwe->first_arrival = 0;
+	bwe->num_deltas = 0;
+	bwe->window_count = 0;
+	bwe->window_pos = 0;
+	bwe->trend = 0;
+	bwe->prev_trend = 0;
+	bwe->modified_trend = 0;
+	bwe->overuse_time = -1;
+	bwe->overuse_count = 0;
+	bwe->usage = janus_bwe_usage_normal;
+}
+
+/* Overuse detector, with an adaptive threshold */
+static void janus_bwe_context_detect(janus_bwe_context *bwe, double send_delta) {
+	if(bwe->modified_trend > bwe->threshold) {
+		if(bwe->overuse_time < 0)
+			bwe->overuse_time = send_delta/2;
+		else
+			bwe->overuse_time += send_delta;
+		bwe->overuse_count++;
+		if(bwe->overuse_time > JANUS_BWE_OVERUSE_TIME && bwe->overuse_count > 1 && bwe->trend >= bwe->prev_trend) {
+			bwe->overuse_time = 0;
+			bwe->overuse_count = 0;
+			bwe->usage = janus_bwe_usage_overuse;
+		}
+	} else if(bwe->modified_trend < -bwe->threshold) {
+		bwe->overuse_time = -1;
+		bwe->overuse_count = 0;
+		bwe->usage = janus_bwe_usage_underuse;
+	} else {
+		bwe->overuse_time = -1;
+		bwe->overuse_count = 0;
+		bwe->usage = janus_bwe_usage_normal;
+	}
+	bwe->prev_trend = bwe->trend;
+	/* Update the threshold */
+	gint64 now = janus_get_monotonic_time();
+	if(bwe->threshold_updated == 0)
+		bwe->threshold_updated = now;
+	double trend = fabs(bwe->modified_trend);
+	if(trend > bwe->threshold + 15.0) {
+		/* Spike, don't let it affect the threshold */
+		bwe->threshold_updated = now;
+		return;
+	}
+	double k = (trend < bwe->threshold) ? JANUS_BWE_THRESHOLD_K_DOWN : JANUS_BWE_THRESHOLD_K_UP;
+	double elapsed = (double)(now - bwe->threshold_updated)/1000.0;
+	if(elapsed > 100.0)
+		elapsed = 100.0;
+	bwe->threshold += k * (trend - bwe->threshold) * elapsed;
+	if(bwe->threshold < JANUS_BWE_THRESHOLD_MIN)
+		bwe->threshold = JANUS_BWE_THRESHOLD_MIN;
+	else if(bwe->threshold > JANUS_BWE_THRESHOLD_MAX)
+		bwe->threshold = JANUS_BWE_THRESHOLD_MAX;
+	bwe->threshold_updated = now;
+}
+
+/* Trendline filter: estimate how the queuing delay is evolving */
+static void janus_bwe_context_update_trendline(janus_bwe_context *bwe, gint64 send_delta, gint64 arrival_delta, gint64 arrival) {
+	if(arrival_delta > 3*G_USEC_PER_SEC || arrival_delta < -3*G_USEC_PER_SEC) {
+		/* Something weird happened (e.g., the remote reference time changed), start over */
+		janus_bwe_context_reset_trendline(bwe);
+		return;
+	}
+	double delay = (double)(arrival_delta - send_delta)/1000.0;
+	if(bwe->num_deltas < 1000)
+		bwe->num_deltas++;
+	bwe->accumulated_delay += delay;
+	bwe->smoothed_delay = JANUS_BWE_TRENDLINE_SMOOTHING * bwe->smoothed_delay +
+		(1 - JANUS_BWE_TRENDLINE_SMOOTHING) * bwe->accumulated_delay;
+	if(bwe->first_arrival == 0)
+		bwe->first_arrival = arrival;
+	bwe->window_x[bwe->window_pos] = (double)(arrival - bwe->first_arrival)/1000.0;
+	bwe->window_y[bwe->window_pos] = bwe->smoothed_delay;
+	bwe->window_pos = (bwe->window_pos + 1) % JANUS_BWE_TRENDLINE_WINDOW;
+	if(bwe->window_count < JANUS_BWE_TRENDLINE_WINDOW)
+		bwe->window_count++;
+	if(bwe->window_count == JANUS_BWE_TRENDLINE_WINDOW) {
+		/* Linear regression on the window to get the slope */
+		double avg_x = 0, avg_y = 0, num = 0, den = 0;
+		guint i = 0;
+		for(i=0; i<JANUS_BWE_TRENDLINE_WINDOW; i++) {
+			avg_x += bwe->window_x[i];
+			avg_y += bwe->window_y[i];
+		}
+		avg_x /= JANUS_BWE_TRENDLINE_WINDOW;
+		avg_y /= JANUS_BWE_TRENDLINE_WINDOW;
+		for(i=0; i<JANUS_BWE_TRENDLINE_WINDOW; i++) {
+			num += (bwe->window_x[i] - avg_x) * (bwe->window_y[i] - avg_y);
+			den += (bwe->window_x[i] - avg_x) * (bwe->window_x[i] - avg_x);
+		}
+		if(den != 0)
+			bwe->trend = num/den;
+	}
+	bwe->modified_trend = (bwe->num_deltas < 60 ? bwe->num_deltas : 60) * bwe->trend * JANUS_BWE_TRENDLINE_GAIN;
+	janus_bwe_context_detect(bwe, (double)send_delta/1000.0);
+}
+
+/* Callback invoked for each packet in a transport-wide CC feedback */
+static void janus_bwe_context_feedback(uint16_t seq, gboolean received, int64_t arrival, void *user_data) {
+	janus_bwe_context *bwe = (janus_bwe_context *)user_data;
+	janus_bwe_sent_packet *p = &bwe->history[seq & (JANUS_BWE_HISTORY_SIZE-1)];
+	if(!p->valid || p->seq != seq)
+		return;
+	/* Only account for each packet once */
+	p->valid = FALSE;
+	bwe->reported++;
+	if(!received) {
+		bwe->lost++;
+		return;
+	}
+	bwe->acked_bytes += p->size;
+	/* Check which group this packet belongs to */
+	if(!bwe->group) {
+		bwe->group = TRUE;
+		bwe->group_first_sent = p->sent;
+		bwe->group_sent = p->sent;
+		bwe->group_arrival = arrival;
+		return;
+	}
+	if(p->sent < bwe->group_first_sent) {
+		/* Reordered packet from a group we already processed, ignore */
+		return;
+	}
+	gint64 arrival_delta = arrival - bwe->group_arrival;
+	gint64 propagation_delta = arrival_delta - (p->sent - bwe->group_sent);
+	if((p->sent - bwe->group_first_sent) <= JANUS_BWE_BURST_TIME ||
+			(propagation_delta < 0 && arrival_delta <= JANUS_BWE_BURST_TIME)) {
+		/* Same group (or a burst that arrived all at once) */
+		if(p->sent > bwe->group_sent)
+			bwe->group_sent = p->sent;
+		if(arrival > bwe->group_arrival)
+			bwe->group_arrival = arrival;
+		return;
+	}
+	/* New group: compare the one we just completed to the one before it */
+	if(bwe->prev_group) {
+		janus_bwe_context_update_trendline(bwe, bwe->group_sent - bwe->prev_sent,
+			bwe->group_arrival - bwe->prev_arrival, bwe->group_arrival);
+	}
+	bwe->prev_group = bwe->group;
+	bwe->prev_sent = bwe->group_sent;
+	bwe->prev_arrival = bwe->group_arrival;
+	bwe->group_first_sent = p->sent;
+	bwe->group_sent = p->sent;
+	bwe->group_arrival = arrival;
+}
+
+/* Update the estimates after we processed some feedback */
+static void janus_bwe_context_update_estimate(janus_bwe_context *bwe) {
+	gint64 now = janus_get_monotonic_time();
+	if(!bwe->started) {
+		bwe->started = TRUE;
+		bwe->acked_since = now;
+		bwe->delay_updated = now;
+		bwe->loss_updated = now;
+	}
+	/* Update the acknowledged bitrate */
+	if(now - bwe->acked_since >= G_USEC_PER_SEC/2) {
+		bwe->acked_bitrate = (bwe->acked_bytes * 8 * G_USEC_PER_SEC)/(now - bwe->acked_since);
+		bwe->acked_bytes = 0;
+		bwe->acked_since = now;
+	}
+	/* Delay based controller (AIMD) */
+	if(bwe->usage == janus_bwe_usage_overuse) {
+		if(now - bwe->delay_decreased >= JANUS_BWE_DECREASE_INTERVAL) {
+			guint32 base = bwe->acked_bitrate ? bwe->acked_bitrate : bwe->delay_estimate;
+			guint32 decreased = JANUS_BWE_DECREASE_FACTOR * base;
+			if(decreased < bwe->delay_estimate)
+				bwe->delay_estimate = decreased;
+			bwe->delay_decreased = now;
+		}
+		bwe->state = janus_bwe_state_decrease;
+	} else if(bwe->usage == janus_bwe_usage_underuse) {
+		bwe->state = janus_bwe_state_hold;
+	} else {
+		bwe->state = (bwe->state == janus_bwe_state_decrease) ? janus_bwe_state_hold : janus_bwe_state_increase;
+	}
+	if(bwe->state == janus_bwe_state_increase) {
+		gint64 elapsed = now - bwe->delay_updated;
+		if(elapsed > G_USEC_PER_SEC)
+			elapsed = G_USEC_PER_SEC;
+		guint32 increased = bwe->delay_estimate * (1.0 + JANUS_BWE_INCREASE_RATE * (double)elapsed/G_USEC_PER_SEC);
+		if(increased == bwe->delay_estimate)
+			increased++;
+		/* Don't grow indefinitely if we're not actually sending that much */
+		guint32 limit = bwe->acked_bitrate * JANUS_BWE_APP_LIMITED_FACTOR + JANUS_BWE_APP_LIMITED_EXTRA;
+		if(bwe->acked_bitrate > 0 && increased > limit)
+			increased = (bwe->delay_estimate > limit ? bwe->delay_estimate : limit);
+		bwe->delay_estimate = increased;
+	}
+	if(bwe->delay_estimate < JANUS_BWE_MIN_BITRATE)
+		bwe->delay_estimate = JANUS_BWE_MIN_BITRATE;
+	else if(bwe->delay_estimate > JANUS_BWE_MAX_BITRATE)
+		bwe->delay_estimate = JANUS_BWE_MAX_BITRATE;
+	bwe->delay_updated = now;
+	/* Loss based controller */
+	if(bwe->reported >= JANUS_BWE_LOSS_MIN_PACKETS || (bwe->reported > 0 && now - bwe->loss_updated >= G_USEC_PER_SEC)) {
+		bwe->loss = (double)bwe->lost/(double)bwe->reported;
+		if(bwe->loss > JANUS_BWE_LOSS_HIGH) {
+			if(now - bwe->loss_decreased >= JANUS_BWE_DECREASE_INTERVAL) {
+				guint32 current = g_atomic_int_get(&bwe->estimate);
+				if(current == 0)
+					current = bwe->loss_estimate;
+				bwe->loss_estimate = current * (1.0 - 0.5 * bwe->loss);
+				bwe->loss_decreased = now;
+			}
+		} else if(bwe->loss < JANUS_BWE_LOSS_LOW) {
+			gint64 elapsed = now - bwe->loss_updated;
+			if(elapsed > G_USEC_PER_SEC)
+				elapsed = G_USEC_PER_SEC;
+			bwe->loss_estimate = bwe->loss_estimate * (1.0 + JANUS_BWE_INCREASE_RATE * (double)elapsed/G_USEC_PER_SEC);
+		}
+		if(bwe->loss_estimate < JANUS_BWE_MIN_BITRATE)
+			bwe->loss_estimate = JANUS_BWE_MIN_BITRATE;
+		else if(bwe->loss_estimate > JANUS_BWE_MAX_BITRATE)
+			bwe->loss_estimate = JANUS_BWE_MAX_BITRATE;
+		bwe->lost = 0;
+		bwe->reported = 0;
+		bwe->loss_updated = now;
+	}
+	/* The estimate is the lower of the two */
+	guint32 estimate = (bwe->delay_estimate < bwe->loss_estimate) ? bwe->delay_estimate : bwe->loss_estimate;
+	guint32 previous = g_atomic_int_get(&bwe->estimate);
+	g_atomic_int_set(&bwe->estimate, estimate);
+	if(previous != estimate) {
+		JANUS_LOG(LOG_HUGE, "[BWE] Estimate: %"SCNu32" (delay=%"SCNu32", %s; loss=%"SCNu32", %.2f%%; acked=%"SCNu32")\n",
+			estimate, bwe->delay_estimate, janus_bwe_usage_str(bwe->usage),
+			bwe->loss_estimate, bwe->loss * 100, bwe->acked_bitrate);
+	}
+}
+
+void janus_bwe_context_process_rtcp(janus_bwe_context *bwe, char *packet, int len) {
+	if(bwe == NULL || packet == NULL || len < 1)
+		return;
+	janus_mutex_lock(&bwe->mutex);
+	if(janus_rtcp_get_transport_wide_cc(packet, len, janus_bwe_context_feedback, bwe) > 0)
+		janus_bwe_context_update_estimate(bwe);
+	janus_mutex_unlock(&bwe->mutex);
+}
+
+guint32 janus_bwe_context_get_estimate(janus_bwe_context *bwe) {
+	if(bwe == NULL)
+		return 0;
+	return g_atomic_int_get(&bwe->estimate);
+}
+
+void janus_bwe_context_summary(janus_bwe_context *bwe, json_t *info) {
+	if(bwe == NULL || info == NULL)
+		return;
+	janus_mutex_lock(&bwe->mutex);
+	json_object_set_new(info, "estimate", json_integer(g_atomic_int_get(&bwe->estimate)));
+	if(bwe->started) {
+		json_object_set_new(info, "delay-estimate", json_integer(bwe->delay_estimate));
+		json_object_set_new(info, "loss-estimate", json_integer(bwe->loss_estimate));
+		json_object_set_new(info, "acked-bitrate", json_integer(bwe->acked_bitrate));
+		json_object_set_new(info, "usage", json_string(janus_bwe_usage_str(bwe->usage)));
+		json_object_set_new(info, "loss", json_real(bwe->loss));
+	}
+	janus_mutex_unlock(&bwe->mutex);
+}
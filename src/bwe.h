@@ -0,0 +1,57 @@
+/*! \file    bwe.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Sender side bandwidth estimation (headers)
+ * \details  Implementation of a simple sender side bandwidth estimator,
+ * loosely based on Google Congestion Control (GCC). The core keeps track
+ * of when each packet carrying a transport-wide sequence number was sent,
+ * and matches that with the arrival times the recipient reports in its
+ * transport-wide CC feedback: a delay based controller (trendline filter
+ * plus overuse detector) and a loss based controller then come up with
+ * an estimate of the available bandwidth towards the recipient, that
+ * plugins can retrieve to adapt what they send (e.g., simulcast layers).
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef JANUS_BWE_H
+#define JANUS_BWE_H
+
+#include <glib.h>
+#include <jansson.h>
+
+/*! \brief Number of sent packets we keep track of (must be a power of 2) */
+#define JANUS_BWE_HISTORY_SIZE	4096
+
+/*! \brief Opaque bandwidth estimation context */
+typedef struct janus_bwe_context janus_bwe_context;
+
+/*! \brief Create a new bandwidth estimation context
+ * @returns A pointer to a new janus_bwe_context instance */
+janus_bwe_context *janus_bwe_context_create(void);
+/*! \brief Destroy an existing bandwidth estimation context
+ * @param[in] bwe The janus_bwe_context instance to destroy */
+void janus_bwe_context_destroy(janus_bwe_context *bwe);
+
+/*! \brief Keep track of a packet we sent with a transport-wide sequence number
+ * @param[in] bwe The janus_bwe_context instance to update
+ * @param[in] seq The transport-wide sequence number of the packet
+ * @param[in] sent When the packet was sent (monotonic time, in us)
+ * @param[in] size The size of the packet (in bytes) */
+void janus_bwe_context_add_sent(janus_bwe_context *bwe, guint16 seq, gint64 sent, guint size);
+/*! \brief Process an incoming RTCP message, looking for transport-wide CC feedback to update the estimate
+ * @param[in] bwe The janus_bwe_context instance to update
+ * @param[in] packet The RTCP message data
+ * @param[in] len The RTCP message data length in bytes */
+void janus_bwe_context_process_rtcp(janus_bwe_context *bwe, char *packet, int len);
+/*! \brief Get the current bandwidth estimate
+ * @param[in] bwe The janus_bwe_context instance to query
+ * @returns The estimated bitrate (in bps), or 0 if no estimate is available yet */
+guint32 janus_bwe_context_get_estimate(janus_bwe_context *bwe);
+/*! \brief Helper method to get some info on the bandwidth estimation context, for the Admin API
+ * @param[in] bwe The janus_bwe_context instance to query
+ * @param[in] info The JSON object to add the info to */
+void janus_bwe_context_summary(janus_bwe_context *bwe, json_t *info);
+
+#endif
@@ -14,6 +14,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <libgen.h>
+#include <unistd.h>
 
 #include <libconfig.h>
 
@@ -708,3 +709,308 @@ void janus_config_destroy(janus_config *config) {
 	g_free((gpointer)config);
 	config = NULL;
 }
+
+
+/* Journal of changes */
+struct janus_config_journal {
+	/* Configuration this journal is for, and the mutex protecting it */
+	janus_config *config;
+	janus_mutex *mutex;
+	/* Where the configuration is saved */
+	char *folder, *filename;
+	/* Path of the journal file, and the file itself */
+	char *path;
+	FILE *file;
+	/* How many changes are in the journal, and after how many we compact it */
+	guint changes, compact_after;
+	/* Background compaction thread */
+	GThread *compactor;
+	volatile gint compacting;
+};
+
+/* Markers for the records in the journal: since they look like comments to
+ * libconfig, what's in between can be parsed as a configuration file itself */
+#define JANUS_CONFIG_JOURNAL_PUT	"#@put "
+#define JANUS_CONFIG_JOURNAL_REMOVE	"#@remove "
+#define JANUS_CONFIG_JOURNAL_END	"#@end"
+
+/* Helper to apply a journaled category to a configuration */
+static int janus_config_journal_apply(janus_config *config, const char *record) {
+	config_t lcfg;
+	config_init(&lcfg);
+	if(config_read_string(&lcfg, record) == CONFIG_FALSE) {
+		JANUS_LOG(LOG_WARN, "Error parsing journal record at line %d: %s\n",
+			config_error_line(&lcfg), config_error_text(&lcfg));
+		config_destroy(&lcfg);
+		return -1;
+	}
+	janus_config tmp = { .is_jcfg = TRUE, .name = NULL, .list = NULL };
+	int res = janus_config_jcfg_parse(&tmp, NULL, config_root_setting(&lcfg));
+	config_destroy(&lcfg);
+	if(res < 0) {
+		g_list_free_full(tmp.list, (GDestroyNotify)janus_config_container_destroy);
+		return -1;
+	}
+	/* Move the categories to the configuration, replacing the existing ones */
+	GList *l = tmp.list;
+	while(l) {
+		if(janus_config_add(config, NULL, (janus_config_container *)l->data) < 0)
+			janus_config_container_destroy((janus_config_container *)l->data);
+		l = l->next;
+	}
+	g_list_free(tmp.list);
+	return 0;
+}
+
+/* Helper to replay a journal on top of a configuration */
+static int janus_config_journal_replay(janus_config *config, const char *path) {
+	if(!g_file_test(path, G_FILE_TEST_EXISTS))
+		return 0;
+	gchar *contents = NULL;
+	GError *error = NULL;
+	if(!g_file_get_contents(path, &contents, NULL, &error)) {
+		JANUS_LOG(LOG_ERR, "Error reading journal '%s': %s\n", path, error ? error->message : "??");
+		if(error)
+			g_error_free(error);
+		return -1;
+	}
+	int changes = 0;
+	size_t put_len = strlen(JANUS_CONFIG_JOURNAL_PUT), remove_len = strlen(JANUS_CONFIG_JOURNAL_REMOVE);
+	char *line = contents, *next = NULL, *record = NULL;
+	while(*line != '\0') {
+		next = strchr(line, '\n');
+		if(next == NULL) {
+			/* Incomplete line, we were interrupted while writing: ignore it */
+			break;
+		}
+		if(record == NULL) {
+			if(!strncmp(line, JANUS_CONFIG_JOURNAL_PUT, put_len)) {
+				/* The category follows, up to the end marker */
+				record = next+1;
+			} else if(!strncmp(line, JANUS_CONFIG_JOURNAL_REMOVE, remove_len)) {
+				char *name = g_strndup(line+remove_len, next-line-remove_len);
+				janus_config_remove(config, NULL, name);
+				g_free(name);
+				changes++;
+			}
+		} else if(!strncmp(line, JANUS_CONFIG_JOURNAL_END, strlen(JANUS_CONFIG_JOURNAL_END))) {
+			*line = '\0';
+			if(janus_config_journal_apply(config, record) == 0)
+				changes++;
+			record = NULL;
+		}
+		line = next+1;
+	}
+	if(record != NULL)
+		JANUS_LOG(LOG_WARN, "Ignoring incomplete record at the end of journal '%s'\n", path);
+	g_free(contents);
+	return changes;
+}
+
+/* Helper to deep copy a container */
+static janus_config_container *janus_config_container_copy(janus_config_container *container) {
+	janus_config_container *copy = g_malloc0(sizeof(janus_config_container));
+	copy->type = container->type;
+	copy->name = g_strdup(container->name);
+	copy->value = g_strdup(container->value);
+	GList *l = container->list;
+	while(l) {
+		copy->list = g_list_prepend(copy->list, janus_config_container_copy((janus_config_container *)l->data));
+		l = l->next;
+	}
+	copy->list = g_list_reverse(copy->list);
+	return copy;
+}
+
+/* Helper to discard a journal we can't write to anymore */
+static void janus_config_journal_discard(janus_config_journal *journal) {
+	JANUS_LOG(LOG_ERR, "Error writing to journal '%s', discarding it\n", journal->path);
+	if(journal->file != NULL)
+		fclose(journal->file);
+	journal->file = NULL;
+	unlink(journal->path);
+	journal->changes = 0;
+}
+
+/* Compaction: the configuration is copied with the mutex locked, and then
+ * saved in full without it; the journal is then truncated, keeping any
+ * change that was appended in the meanwhile. If we crash before the journal
+ * is truncated, replaying it on the compacted configuration is harmless */
+static int janus_config_journal_compact(janus_config_journal *journal) {
+	janus_mutex_lock(journal->mutex);
+	if(journal->file == NULL) {
+		janus_mutex_unlock(journal->mutex);
+		return -1;
+	}
+	fflush(journal->file);
+	long offset = ftell(journal->file);
+	guint changes = journal->changes;
+	janus_config *copy = janus_config_create(journal->config->name);
+	GList *l = journal->config->list;
+	while(l) {
+		copy->list = g_list_prepend(copy->list, janus_config_container_copy((janus_config_container *)l->data));
+		l = l->next;
+	}
+	copy->list = g_list_reverse(copy->list);
+	janus_mutex_unlock(journal->mutex);
+	/* Save to a temporary file first, and then replace the configuration file */
+	int64_t start = janus_get_monotonic_time();
+	char tmpname[512], tmppath[1024], path[1024];
+	g_snprintf(tmpname, sizeof(tmpname), "%s.compact", journal->filename);
+	g_snprintf(tmppath, sizeof(tmppath), "%s/%s.jcfg", journal->folder, tmpname);
+	g_snprintf(path, sizeof(path), "%s/%s.jcfg", journal->folder, journal->filename);
+	int res = janus_config_save(copy, journal->folder, tmpname);
+	janus_config_destroy(copy);
+	if(res < 0 || rename(tmppath, path) != 0) {
+		JANUS_LOG(LOG_ERR, "Error compacting journal '%s'\n", journal->path);
+		unlink(tmppath);
+		return -1;
+	}
+	/* Truncate the journal, keeping what was added after the copy */
+	janus_mutex_lock(journal->mutex);
+	if(journal->file == NULL) {
+		/* Discarded in the meanwhile */
+		janus_mutex_unlock(journal->mutex);
+		return 0;
+	}
+	fflush(journal->file);
+	gchar *contents = NULL;
+	gsize length = 0;
+	res = 0;
+	if(!g_file_get_contents(journal->path, &contents, &length, NULL) || (gsize)offset > length) {
+		res = -1;
+	} else {
+		g_snprintf(tmppath, sizeof(tmppath), "%s.compact", journal->path);
+		if(!g_file_set_contents(tmppath, contents+offset, length-offset, NULL) || rename(tmppath, journal->path) != 0) {
+			res = -1;
+		} else {
+			fclose(journal->file);
+			journal->file = fopen(journal->path, "at");
+			if(journal->file == NULL)
+				res = -1;
+		}
+	}
+	g_free(contents);
+	if(res < 0) {
+		/* The configuration file has everything at the time of the copy, so
+		 * the only changes we may lose are those that came after it */
+		janus_config_journal_discard(journal);
+		janus_mutex_unlock(journal->mutex);
+		return -1;
+	}
+	journal->changes -= changes;
+	janus_mutex_unlock(journal->mutex);
+	JANUS_LOG(LOG_VERB, "Compacted %u changes from journal '%s' in %"SCNi64"ms\n",
+		changes, journal->path, (janus_get_monotonic_time()-start)/1000);
+	return 0;
+}
+
+static void *janus_config_journal_compactor(void *data) {
+	janus_config_journal *journal = (janus_config_journal *)data;
+	janus_config_journal_compact(journal);
+	g_atomic_int_set(&journal->compacting, 0);
+	return NULL;
+}
+
+/* Helper to check if it's time to compact: must be called with the mutex locked */
+static void janus_config_journal_check(janus_config_journal *journal) {
+	if(journal->changes < journal->compact_after || !g_atomic_int_compare_and_exchange(&journal->compacting, 0, 1))
+		return;
+	/* The previous compaction, if any, is over */
+	if(journal->compactor != NULL)
+		g_thread_join(journal->compactor);
+	GError *error = NULL;
+	journal->compactor = g_thread_try_new("config compactor", janus_config_journal_compactor, journal, &error);
+	if(error != NULL) {
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the compaction thread for '%s'...\n",
+			error->code, error->message ? error->message : "??", journal->path);
+		g_error_free(error);
+		journal->compactor = NULL;
+		g_atomic_int_set(&journal->compacting, 0);
+	}
+}
+
+janus_config_journal *janus_config_journal_open(janus_config *config, janus_mutex *mutex,
+		const char *folder, const char *filename, guint compact_after) {
+	if(config == NULL || !config->is_jcfg || mutex == NULL || folder == NULL || filename == NULL)
+		return NULL;
+	char path[1024];
+	g_snprintf(path, sizeof(path), "%s/%s.journal", folder, filename);
+	int changes = janus_config_journal_replay(config, path);
+	if(changes < 0)
+		return NULL;
+	FILE *file = fopen(path, "at");
+	if(file == NULL) {
+		JANUS_LOG(LOG_ERR, "Couldn't open journal '%s'... error %d (%s)\n", path, errno, g_strerror(errno));
+		return NULL;
+	}
+	if(changes > 0)
+		JANUS_LOG(LOG_INFO, "Replayed %d changes from journal '%s'\n", changes, path);
+	janus_config_journal *journal = g_malloc0(sizeof(janus_config_journal));
+	journal->config = config;
+	journal->mutex = mutex;
+	journal->folder = g_strdup(folder);
+	journal->filename = g_strdup(filename);
+	journal->path = g_strdup(path);
+	journal->file = file;
+	journal->changes = changes;
+	journal->compact_after = compact_after > 0 ? compact_after : JANUS_CONFIG_JOURNAL_COMPACT;
+	janus_mutex_lock(mutex);
+	janus_config_journal_check(journal);
+	janus_mutex_unlock(mutex);
+	return journal;
+}
+
+/* Helper to finalize a record */
+static int janus_config_journal_written(janus_config_journal *journal, gboolean success) {
+	if(!success || fflush(journal->file) != 0 || ferror(journal->file)) {
+		janus_config_journal_discard(journal);
+		return -1;
+	}
+	journal->changes++;
+	janus_config_journal_check(journal);
+	return 0;
+}
+
+int janus_config_journal_put(janus_config_journal *journal, janus_config_container *category) {
+	if(journal == NULL || journal->file == NULL || category == NULL ||
+			category->type != janus_config_type_category || category->name == NULL)
+		return -1;
+	/* Serialize the category on its own */
+	config_t lcfg;
+	config_init(&lcfg);
+	GList single = { .data = category, .next = NULL, .prev = NULL };
+	janus_config_save_list(journal->config, journal->file, 0, FALSE, &single, config_root_setting(&lcfg));
+	gboolean success = fprintf(journal->file, "%s%s\n", JANUS_CONFIG_JOURNAL_PUT, category->name) > 0;
+	if(success) {
+		config_write(&lcfg, journal->file);
+		success = fprintf(journal->file, "%s\n", JANUS_CONFIG_JOURNAL_END) > 0;
+	}
+	config_destroy(&lcfg);
+	return janus_config_journal_written(journal, success);
+}
+
+int janus_config_journal_remove(janus_config_journal *journal, const char *name) {
+	if(journal == NULL || journal->file == NULL || name == NULL)
+		return -1;
+	gboolean success = fprintf(journal->file, "%s%s\n", JANUS_CONFIG_JOURNAL_REMOVE, name) > 0;
+	return janus_config_journal_written(journal, success);
+}
+
+void janus_config_journal_close(janus_config_journal *journal) {
+	if(journal == NULL)
+		return;
+	if(journal->compactor != NULL) {
+		g_thread_join(journal->compactor);
+		journal->compactor = NULL;
+	}
+	/* Compact one last time, so that the next startup doesn't need to replay anything */
+	if(journal->changes > 0)
+		janus_config_journal_compact(journal);
+	if(journal->file != NULL)
+		fclose(journal->file);
+	g_free(journal->folder);
+	g_free(journal->filename);
+	g_free(journal->path);
+	g_free(journal);
+}
@@ -13,6 +13,8 @@
 
 #include <glib.h>
 
+#include "mutex.h"
+
 /*! \brief Configuration element type */
 typedef enum janus_config_type {
 	/*! \brief Anything (just for searches) */
@@ -167,4 +169,55 @@ GList *janus_config_get_categories(janus_config *config, janus_config_container
  * @returns A pointer to the categories GLib linked list of arrays if successful, NULL otherwise */
 GList *janus_config_get_arrays(janus_config *config, janus_config_container *parent);
 
+
+/*! \brief Opaque reference to the changes journal of a configuration
+ * \details When a configuration contains many dynamically managed objects
+ * (e.g., thousands of permanent rooms in a plugin), saving the whole file
+ * every time one of them changes is expensive. A journal allows callers to
+ * append the changes to individual root categories to a \c .journal file
+ * next to the configuration file instead, which is replayed on top of the
+ * configuration when it's opened: after a configurable number of changes,
+ * the journal is compacted in a background thread, i.e., the configuration
+ * is saved in full (atomically) and the journal truncated. Only libconfig
+ * (jcfg) configurations can be journaled. */
+typedef struct janus_config_journal janus_config_journal;
+
+/*! \brief Default number of journaled changes after which the journal is compacted */
+#define JANUS_CONFIG_JOURNAL_COMPACT	1000
+
+/*! \brief Open the changes journal of a configuration, replaying any change it contains
+ * \note The mutex is the one the caller uses to protect the configuration: all
+ * the journal methods except janus_config_journal_close must be called
+ * with the mutex locked, and the compaction thread will lock it as well while
+ * it accesses the configuration.
+ * @param[in] config The configuration to journal changes of
+ * @param[in] mutex The mutex protecting access to the configuration
+ * @param[in] folder The folder the configuration file is saved to
+ * @param[in] filename The configuration file name, without the extension
+ * @param[in] compact_after Number of changes after which the journal is compacted (0 for the default)
+ * @returns A pointer to a valid janus_config_journal instance if successful, NULL otherwise */
+janus_config_journal *janus_config_journal_open(janus_config *config, janus_mutex *mutex,
+	const char *folder, const char *filename, guint compact_after);
+/*! \brief Journal the addition or modification of a root category
+ * \note The category is expected to be already in the configuration in
+ * its updated form. If journaling fails, the journal is discarded, and the
+ * caller should fall back to janus_config_save to save the changes
+ * @param[in] journal The journal to append the change to
+ * @param[in] category The category that was added or modified
+ * @returns 0 if successful, a negative integer otherwise */
+int janus_config_journal_put(janus_config_journal *journal, janus_config_container *category);
+/*! \brief Journal the removal of a root category
+ * \note The category is expected to have been removed from the configuration
+ * already. If journaling fails, the journal is discarded, and the caller
+ * should fall back to janus_config_save to save the changes
+ * @param[in] journal The journal to append the change to
+ * @param[in] name The name of the category that was removed
+ * @returns 0 if successful, a negative integer otherwise */
+int janus_config_journal_remove(janus_config_journal *journal, const char *name);
+/*! \brief Close a journal, compacting it one last time if needed
+ * \note This must be called with the configuration mutex unlocked, and
+ * before the configuration itself is destroyed
+ * @param[in] journal The journal to close */
+void janus_config_journal_close(janus_config_journal *journal);
+
 #endif
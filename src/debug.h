@@ -11,6 +11,7 @@
 #ifndef JANUS_DEBUG_H
 #define JANUS_DEBUG_H
 
+#include <string.h>
 #include <glib.h>
 #include <glib/gprintf.h>
 #include "log.h"
@@ -85,12 +86,14 @@ static const char *janus_log_prefix[] = {
 ///@{
 /*! \brief Simple wrapper to g_print/printf */
 #define JANUS_PRINT janus_vprintf
-/*! \brief Logger based on different levels, which can either be displayed
- * or not according to the configuration of the server.
- * The format must be a string literal. */
-#define JANUS_LOG(level, format, ...) \
+/*! \brief Helper to actually print a log line, whatever the level: don't
+ * use this directly, use JANUS_LOG or one of the other wrappers instead.
+ * Besides the formatted line, the level, the ID of the handle the line
+ * refers to (0 if none) and where the message starts after the prefixes
+ * are passed along as well, for loggers that need structured records */
+#define JANUS_LOG_OUTPUT(level, id, format, ...) \
 do { \
-	if (level > LOG_NONE && level <= LOG_MAX && level <= janus_log_level) { \
+	{ \
 		char janus_log_ts[64] = ""; \
 		char janus_log_src[128] = ""; \
 		if (janus_log_timestamps) { \
@@ -104,14 +107,52 @@ do { \
 			snprintf(janus_log_src, sizeof(janus_log_src), \
 			         "[%s:%s:%d] ", __FILE__, __FUNCTION__, __LINE__); \
 		} \
-		JANUS_PRINT("%s%s%s%s" format, \
-			janus_log_global_prefix ? janus_log_global_prefix : "", \
+		const char *janus_log_gp = janus_log_global_prefix ? janus_log_global_prefix : ""; \
+		const char *janus_log_lp = janus_log_prefix[level | ((int)janus_log_colors << 3)]; \
+		janus_log_printf(level, id, \
+			strlen(janus_log_gp) + strlen(janus_log_ts) + strlen(janus_log_lp) + strlen(janus_log_src), \
+			"%s%s%s%s" format, \
+			janus_log_gp, \
 			janus_log_ts, \
-			janus_log_prefix[level | ((int)janus_log_colors << 3)], \
+			janus_log_lp, \
 			janus_log_src, \
 			##__VA_ARGS__); \
 	} \
 } while (0)
+/*! \brief Logger based on different levels, which can either be displayed
+ * or not according to the configuration of the server.
+ * The format must be a string literal. */
+#define JANUS_LOG(level, format, ...) \
+do { \
+	if (level > LOG_NONE && level <= LOG_MAX && level <= janus_log_level) \
+		JANUS_LOG_OUTPUT(level, 0, format, ##__VA_ARGS__); \
+} while (0)
+/*! \brief Same as JANUS_LOG, but the line is also displayed when the level
+ * is within the one of a specific context (e.g., a handle or a session),
+ * which allows for more verbose logging for a specific user only. The
+ * context level is only evaluated when the global one doesn't match,
+ * while the context ID (e.g., a handle ID) is passed to structured loggers. */
+#define JANUS_LOG_CONTEXT(context_level, context_id, level, format, ...) \
+do { \
+	if (level > LOG_NONE && level <= LOG_MAX && (level <= janus_log_level || level <= (context_level))) \
+		JANUS_LOG_OUTPUT(level, context_id, format, ##__VA_ARGS__); \
+} while (0)
+/*! \brief Same as JANUS_LOG, but rate limited: each call site has its own
+ * token bucket (see \ref janus_log_ratelimit), and when lines are dropped
+ * because of that, the next one that gets printed says how many were.
+ * This is meant for lines in hot paths (e.g., an error for each packet). */
+#define JANUS_LOG_RATELIMITED(level, format, ...) \
+do { \
+	if (level > LOG_NONE && level <= LOG_MAX && level <= janus_log_level) { \
+		static janus_log_ratelimit janus_log_rl = { 0 }; \
+		int janus_log_suppressed = 0; \
+		if (janus_log_ratelimit_allow(&janus_log_rl, &janus_log_suppressed)) { \
+			if (janus_log_suppressed > 0) \
+				JANUS_LOG_OUTPUT(level, 0, "(%d similar lines suppressed)\n", janus_log_suppressed); \
+			JANUS_LOG_OUTPUT(level, 0, format, ##__VA_ARGS__); \
+		} \
+	} \
+} while (0)
 ///@}
 
 #endif
@@ -13,6 +13,7 @@
 #include "dtls-bio.h"
 #include "debug.h"
 #include "ice.h"
+#include "ice-mux.h"
 #include "mutex.h"
 
 /* Starting MTU value for the DTLS BIO agent writer */
@@ -147,7 +148,8 @@ static int janus_dtls_bio_agent_write(BIO *bio, const char *in, int inl) {
 		/* FIXME Just a warning for now, this will need to be solved with proper fragmentation */
 		JANUS_LOG(LOG_WARN, "[%"SCNu64"] The DTLS stack is trying to send a packet of %d bytes, this may be larger than the MTU and get dropped!\n", handle->handle_id, inl);
 	}
-	int bytes = nice_agent_send(handle->agent, pc->stream_id, pc->component_id, inl, in);
+	int bytes = pc->mux ? janus_ice_mux_send(pc->mux, in, inl) :
+		nice_agent_send(handle->agent, pc->stream_id, pc->component_id, inl, in);
 	if(bytes < inl) {
 		JANUS_LOG(LOG_ERR, "[%"SCNu64"] Error sending DTLS message on component %d of stream %d (%d)\n", handle->handle_id, pc->component_id, pc->stream_id, bytes);
 	} else {
@@ -159,7 +161,7 @@ static int janus_dtls_bio_agent_write(BIO *bio, const char *in, int inl) {
 		pc->dtls_out_stats.info[0].packets++;
 		pc->dtls_out_stats.info[0].bytes += bytes;
 		/* If there's a datachannel medium, update the stats there too */
-		janus_ice_peerconnection_medium *medium = g_hash_table_lookup(pc->media_bytype, GINT_TO_POINTER(JANUS_MEDIA_DATA));
+		janus_ice_peerconnection_medium *medium = pc->media_bytype[JANUS_MEDIA_DATA];
 		if(medium) {
 			medium->in_stats.info[0].packets++;
 			medium->in_stats.info[0].bytes += bytes;
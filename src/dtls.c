@@ -17,6 +17,7 @@
 #include "dtls.h"
 #include "rtcp.h"
 #include "events.h"
+#include "metrics.h"
 
 #include <openssl/err.h>
 #include <openssl/bn.h>
@@ -93,6 +94,10 @@ static void janus_dtls_notify_state_change(janus_dtls_srtp *dtls) {
 	json_object_set_new(info, "stream_id", json_integer(pc->stream_id));
 	json_object_set_new(info, "component_id", json_integer(pc->component_id));
 	json_object_set_new(info, "retransmissions", json_integer(dtls->retransmissions));
+	if(dtls->dtls_state == JANUS_DTLS_STATE_CONNECTED && dtls->dtls_started > 0) {
+		json_object_set_new(info, "handshake_ms", json_integer((dtls->dtls_connected - dtls->dtls_started)/1000));
+		json_object_set_new(info, "resumed", dtls->resumed ? json_true() : json_false());
+	}
 	janus_events_notify_handlers(JANUS_EVENT_TYPE_WEBRTC, JANUS_EVENT_SUBTYPE_WEBRTC_DTLS,
 		session->session_id, handle->handle_id, handle->opaque_id, info);
 }
@@ -122,13 +127,47 @@ gboolean janus_dtls_are_selfsigned_certs_ok(void) {
  * that value cannot be modified (it will in OpenSSL v1.1.1) */
 static guint16 dtls_timeout_base = 1000;
 
-static SSL_CTX *ssl_ctx = NULL;
-static X509 *ssl_cert = NULL;
-static EVP_PKEY *ssl_key = NULL;
+/* Whether we allow peers to resume previous DTLS sessions via session tickets */
+static gboolean dtls_session_resumption = FALSE;
+
+/* The certificates we use in handshakes, and the SSL_CTX that uses them:
+ * when rotation is enabled, new credentials are periodically created in
+ * a dedicated thread and swapped with the current ones, which is why each
+ * DTLS stack keeps a reference to the credentials it was created with, so
+ * that the fingerprints we put in its SDP always match its certificates */
+typedef struct janus_dtls_credentials {
+	SSL_CTX *ctx;
+	/* Certificates and keys, in order of preference (ECDSA first) */
+	X509 *certs[JANUS_DTLS_MAX_CERTIFICATES];
+	EVP_PKEY *keys[JANUS_DTLS_MAX_CERTIFICATES];
+	guint count;
+	gchar fingerprints[JANUS_DTLS_MAX_CERTIFICATES][160];
+	/* SSL objects created in advance (or recycled) for new stacks */
+	GQueue *ssl_pool;
+	janus_mutex pool_mutex;
+	janus_refcount ref;
+} janus_dtls_credentials;
+static janus_dtls_credentials *credentials = NULL, *retired_credentials = NULL;
+static janus_mutex credentials_mutex = JANUS_MUTEX_INITIALIZER;
+/* Where certificates come from, which we need to create new credentials */
+static char *cert_pem = NULL, *cert_key = NULL, *cert_pwd = NULL;
+static char *fallback_pem = NULL, *fallback_key = NULL, *fallback_pwd = NULL;
+static gboolean cert_rsa = FALSE, cert_rsa_fallback = FALSE;
+/* Rotation of the credentials */
+static guint cert_rotation = 0;
+static GThread *rotation_thread = NULL;
+static volatile gint rotation_stop = 0;
+/* How many SSL objects we keep ready for new stacks (0 means no pool) */
+static guint ssl_pool_size = 0;
+static volatile gint ssl_pool_hits = 0, ssl_pool_misses = 0, ssl_pool_recycled = 0;
 
-static gchar local_fingerprint[160];
 gchar *janus_dtls_get_local_fingerprint(void) {
-	return (gchar *)local_fingerprint;
+	/* Credentials are kept around for a whole rotation period after they've
+	 * been replaced, so the pointer we return stays valid long enough */
+	janus_mutex_lock(&credentials_mutex);
+	gchar *fingerprint = credentials ? credentials->fingerprints[0] : NULL;
+	janus_mutex_unlock(&credentials_mutex);
+	return fingerprint;
 }
 
 
@@ -394,9 +433,313 @@ const char *janus_get_ssl_version(void) {
 	return OPENSSL_VERSION_TEXT;
 }
 
+/* SRTP profiles we offer/accept, in order of preference: the AEAD profiles
+ * avoid the separate HMAC-SHA1 pass AES-CM needs, and AES-128-GCM is the
+ * cheapest one to compute, so that's the one we prefer when available */
+#ifdef HAVE_SRTP_AESGCM
+#define JANUS_DTLS_SRTP_PROFILES	"SRTP_AEAD_AES_128_GCM:SRTP_AEAD_AES_256_GCM:SRTP_AES128_CM_SHA1_80:SRTP_AES128_CM_SHA1_32"
+#else
+#define JANUS_DTLS_SRTP_PROFILES	"SRTP_AES128_CM_SHA1_80:SRTP_AES128_CM_SHA1_32"
+#endif
+const char *janus_dtls_get_srtp_profiles(void) {
+	return JANUS_DTLS_SRTP_PROFILES;
+}
+const char *janus_dtls_get_srtp_backend(void) {
+	/* libsrtp only implements AES-GCM when built against an external crypto
+	 * library (OpenSSL, NSS or mbedTLS), which also provides AES-NI accelerated
+	 * AES-CM: without it, the built-in (and slower) implementations are used */
+#ifdef HAVE_SRTP_AESGCM
+	return "external";
+#else
+	return "built-in";
+#endif
+}
+
+static void janus_dtls_credentials_free(const janus_refcount *creds_ref) {
+	janus_dtls_credentials *creds = janus_refcount_containerof(creds_ref, janus_dtls_credentials, ref);
+	if(creds->ssl_pool != NULL)
+		g_queue_free_full(creds->ssl_pool, (GDestroyNotify)SSL_free);
+	guint i = 0;
+	for(i=0; i<JANUS_DTLS_MAX_CERTIFICATES; i++) {
+		if(creds->certs[i] != NULL)
+			X509_free(creds->certs[i]);
+		if(creds->keys[i] != NULL)
+			EVP_PKEY_free(creds->keys[i]);
+	}
+	if(creds->ctx != NULL)
+		SSL_CTX_free(creds->ctx);
+	g_free(creds);
+}
+
+static void janus_dtls_configure_resumption(SSL_CTX *ctx) {
+	if(!dtls_session_resumption) {
+		SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+		return;
+	}
+	/* Tickets are encrypted with a key that only lives in this SSL_CTX, which
+	 * means peers can only resume sessions they had with this same instance
+	 * (and since the last rotation of the certificates, if enabled): the
+	 * full handshake is still performed for everybody else */
+	static const unsigned char sid_ctx[] = "janus-dtls";
+	SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+	SSL_CTX_set_session_id_context(ctx, sid_ctx, sizeof(sid_ctx)-1);
+}
+
+/* Create a new SSL_CTX, with either autogenerated or configured certificates */
+static int janus_dtls_credentials_create(janus_dtls_credentials **result) {
+	janus_dtls_credentials *creds = g_malloc0(sizeof(janus_dtls_credentials));
+	janus_refcount_init(&creds->ref, janus_dtls_credentials_free);
+	creds->ssl_pool = g_queue_new();
+	janus_mutex_init(&creds->pool_mutex);
+	int res = 0;
+#if JANUS_USE_OPENSSL_PRE_1_1_API && !defined(HAVE_BORINGSSL)
+#if defined(LIBRESSL_VERSION_NUMBER)
+	creds->ctx = SSL_CTX_new(DTLSv1_method());
+#else
+	creds->ctx = SSL_CTX_new(DTLSv1_2_method());
+#endif
+#else
+	creds->ctx = SSL_CTX_new(DTLS_method());
+#endif
+	if(!creds->ctx) {
+		JANUS_LOG(LOG_FATAL, "Ops, error creating DTLS context?\n");
+		res = -1;
+		goto error;
+	}
+	SSL_CTX_set_verify(creds->ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, janus_dtls_verify_callback);
+	SSL_CTX_set_tlsext_use_srtp(creds->ctx, JANUS_DTLS_SRTP_PROFILES);
+
+	if(!cert_pem && !cert_key) {
+		JANUS_LOG(LOG_INFO, "No cert/key specified, autogenerating some...\n");
+		if(janus_dtls_generate_keys(&creds->certs[0], &creds->keys[0], cert_rsa) != 0) {
+			/* The keys have been freed already */
+			creds->certs[0] = NULL;
+			creds->keys[0] = NULL;
+			JANUS_LOG(LOG_FATAL, "Error generating DTLS key/certificate\n");
+			res = -2;
+			goto error;
+		}
+		creds->count++;
+		if(cert_rsa_fallback && !cert_rsa) {
+			if(janus_dtls_generate_keys(&creds->certs[1], &creds->keys[1], TRUE) != 0) {
+				creds->certs[1] = NULL;
+				creds->keys[1] = NULL;
+				JANUS_LOG(LOG_FATAL, "Error generating DTLS fallback key/certificate\n");
+				res = -2;
+				goto error;
+			}
+			creds->count++;
+		}
+	} else if(!cert_pem || !cert_key) {
+		JANUS_LOG(LOG_FATAL, "DTLS certificate and key must be specified\n");
+		res = -2;
+		goto error;
+	} else {
+		if(janus_dtls_load_keys(cert_pem, cert_key, cert_pwd, &creds->certs[0], &creds->keys[0]) != 0) {
+			res = -3;
+			goto error;
+		}
+		creds->count++;
+		if(fallback_pem && fallback_key) {
+			if(janus_dtls_load_keys(fallback_pem, fallback_key, fallback_pwd, &creds->certs[1], &creds->keys[1]) != 0) {
+				res = -3;
+				goto error;
+			}
+			creds->count++;
+		}
+	}
+	if(creds->count > 1) {
+		int type0 = EVP_PKEY_base_id(creds->keys[0]), type1 = EVP_PKEY_base_id(creds->keys[1]);
+		if(type0 == type1) {
+			/* OpenSSL only keeps one certificate per key type */
+			JANUS_LOG(LOG_WARN, "The DTLS fallback certificate uses the same key type as the main one, ignoring it\n");
+			X509_free(creds->certs[1]);
+			creds->certs[1] = NULL;
+			EVP_PKEY_free(creds->keys[1]);
+			creds->keys[1] = NULL;
+			creds->count--;
+		} else if(type0 == EVP_PKEY_RSA) {
+			/* ECDSA signatures are much cheaper, so prefer the other certificate */
+			X509 *cert = creds->certs[0];
+			EVP_PKEY *key = creds->keys[0];
+			creds->certs[0] = creds->certs[1];
+			creds->keys[0] = creds->keys[1];
+			creds->certs[1] = cert;
+			creds->keys[1] = key;
+		}
+	}
+	/* OpenSSL picks the certificate that is compatible with the negotiated cipher
+	 * suite and signature algorithms, and uses the last one we add as the default:
+	 * as such, we add them in reverse order, so that the preferred one is last */
+	guint i = creds->count;
+	while(i > 0) {
+		i--;
+		if(!SSL_CTX_use_certificate(creds->ctx, creds->certs[i])) {
+			JANUS_LOG(LOG_FATAL, "Certificate error (%s)\n", ERR_reason_error_string(ERR_get_error()));
+			res = -4;
+			goto error;
+		}
+		if(!SSL_CTX_use_PrivateKey(creds->ctx, creds->keys[i])) {
+			JANUS_LOG(LOG_FATAL, "Certificate key error (%s)\n", ERR_reason_error_string(ERR_get_error()));
+			res = -5;
+			goto error;
+		}
+		if(!SSL_CTX_check_private_key(creds->ctx)) {
+			JANUS_LOG(LOG_FATAL, "Certificate check error (%s)\n", ERR_reason_error_string(ERR_get_error()));
+			res = -6;
+			goto error;
+		}
+	}
+	/* When we have more than one certificate, make sure our cipher order
+	 * (where ECDSA suites come before RSA ones) wins when we're servers */
+	if(creds->count > 1)
+		SSL_CTX_set_options(creds->ctx, SSL_OP_CIPHER_SERVER_PREFERENCE);
+	janus_dtls_configure_resumption(creds->ctx);
+
+	for(i = 0; i < creds->count; i++) {
+		unsigned int size;
+		unsigned char fingerprint[EVP_MAX_MD_SIZE];
+		if(X509_digest(creds->certs[i], EVP_sha256(), (unsigned char *)fingerprint, &size) == 0) {
+			JANUS_LOG(LOG_FATAL, "Error converting X509 structure (%s)\n", ERR_reason_error_string(ERR_get_error()));
+			res = -7;
+			goto error;
+		}
+		char *lfp = creds->fingerprints[i];
+		unsigned int j = 0;
+		for(j = 0; j < size; j++) {
+			g_snprintf(lfp, 4, "%.2X:", fingerprint[j]);
+			lfp += 3;
+		}
+		*(lfp-1) = 0;
+	}
+	if(SSL_CTX_set_cipher_list(creds->ctx, dtls_ciphers) == 0) {
+		JANUS_LOG(LOG_FATAL, "Error setting cipher list (%s)\n", ERR_reason_error_string(ERR_get_error()));
+		res = -8;
+		goto error;
+	}
+	*result = creds;
+	return 0;
+
+error:
+	janus_refcount_decrease(&creds->ref);
+	return res;
+}
+
+/* Create a new SSL object, with all the settings that don't depend on the stack using it */
+static SSL *janus_dtls_ssl_new(janus_dtls_credentials *creds) {
+	SSL *ssl = SSL_new(creds->ctx);
+	if(ssl == NULL)
+		return NULL;
+	SSL_set_info_callback(ssl, janus_dtls_callback);
+	/* https://code.google.com/p/chromium/issues/detail?id=406458
+	 * Specify an ECDH group for ECDHE ciphers, otherwise they cannot be
+	 * negotiated when acting as the server. Use NIST's P-256 which is
+	 * commonly supported.
+	 */
+#ifndef OPENSSL_VERSION_MAJOR
+	EC_KEY *ecdh = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+	if(ecdh == NULL) {
+		JANUS_LOG(LOG_ERR, "Error creating ECDH group! (%s)\n", ERR_reason_error_string(ERR_get_error()));
+		SSL_free(ssl);
+		return NULL;
+	}
+	SSL_set_tmp_ecdh(ssl, ecdh);
+	EC_KEY_free(ecdh);
+#else
+	int grp_list[1] = { NID_X9_62_prime256v1 };
+	SSL_set1_groups(ssl, grp_list, 1);
+#endif
+	const long flags = SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION | SSL_OP_SINGLE_ECDH_USE;
+	SSL_set_options(ssl, flags);
+	return ssl;
+}
+
+/* Make sure the pool of the credentials has as many SSL objects as configured */
+static void janus_dtls_ssl_pool_fill(janus_dtls_credentials *creds) {
+	if(creds == NULL || ssl_pool_size == 0)
+		return;
+	janus_mutex_lock(&creds->pool_mutex);
+	while(g_queue_get_length(creds->ssl_pool) < ssl_pool_size) {
+		SSL *ssl = janus_dtls_ssl_new(creds);
+		if(ssl == NULL)
+			break;
+		g_queue_push_tail(creds->ssl_pool, ssl);
+	}
+	janus_mutex_unlock(&creds->pool_mutex);
+}
+
+/* Get an SSL object from the pool of the credentials, or create a new one if it's empty */
+static SSL *janus_dtls_ssl_get(janus_dtls_credentials *creds) {
+	SSL *ssl = NULL;
+	if(ssl_pool_size > 0) {
+		janus_mutex_lock(&creds->pool_mutex);
+		ssl = g_queue_pop_head(creds->ssl_pool);
+		janus_mutex_unlock(&creds->pool_mutex);
+		g_atomic_int_inc(ssl ? &ssl_pool_hits : &ssl_pool_misses);
+	}
+	return ssl ? ssl : janus_dtls_ssl_new(creds);
+}
+
+/* Put an SSL object back in the pool of its credentials, if there's room, or free it */
+static void janus_dtls_ssl_recycle(janus_dtls_credentials *creds, SSL *ssl) {
+	if(creds != NULL && ssl_pool_size > 0) {
+		/* Free the BIOs (which refer to the old stack) and forget the
+		 * session, so that the next handshake starts from scratch */
+		SSL_set_ex_data(ssl, 0, NULL);
+		SSL_set_bio(ssl, NULL, NULL);
+		SSL_set_session(ssl, NULL);
+		if(SSL_clear(ssl) == 1) {
+			janus_mutex_lock(&creds->pool_mutex);
+			if(g_queue_get_length(creds->ssl_pool) < ssl_pool_size) {
+				g_queue_push_tail(creds->ssl_pool, ssl);
+				janus_mutex_unlock(&creds->pool_mutex);
+				g_atomic_int_inc(&ssl_pool_recycled);
+				return;
+			}
+			janus_mutex_unlock(&creds->pool_mutex);
+		}
+	}
+	SSL_free(ssl);
+}
+
+/* Thread periodically replacing the credentials */
+static void *janus_dtls_rotation_thread(void *data) {
+	JANUS_LOG(LOG_VERB, "Joining DTLS certificates rotation thread\n");
+	gint64 next = janus_get_monotonic_time() + (gint64)cert_rotation*G_USEC_PER_SEC;
+	while(!g_atomic_int_get(&rotation_stop)) {
+		if(janus_get_monotonic_time() < next) {
+			g_usleep(G_USEC_PER_SEC/2);
+			continue;
+		}
+		next = janus_get_monotonic_time() + (gint64)cert_rotation*G_USEC_PER_SEC;
+		/* Generating (or loading) the certificates only blocks this thread */
+		janus_dtls_credentials *creds = NULL;
+		if(janus_dtls_credentials_create(&creds) < 0) {
+			JANUS_LOG(LOG_ERR, "Error creating new DTLS certificates, keeping the current ones\n");
+			continue;
+		}
+		/* Prepare the SSL objects for the new credentials here, rather than in new stacks */
+		janus_dtls_ssl_pool_fill(creds);
+		janus_mutex_lock(&credentials_mutex);
+		janus_dtls_credentials *old = retired_credentials;
+		retired_credentials = credentials;
+		credentials = creds;
+		janus_mutex_unlock(&credentials_mutex);
+		/* Stacks created with the old credentials still have a reference */
+		if(old != NULL)
+			janus_refcount_decrease(&old->ref);
+		JANUS_LOG(LOG_INFO, "DTLS certificates rotated, new fingerprint: %s\n", creds->fingerprints[0]);
+	}
+	JANUS_LOG(LOG_VERB, "Leaving DTLS certificates rotation thread\n");
+	return NULL;
+}
+
 /* DTLS-SRTP initialization */
 gint janus_dtls_srtp_init(const char *server_pem, const char *server_key, const char *password,
-		const char *ciphers, guint16 timeout, gboolean rsa_private_key, gboolean accept_selfsigned) {
+		const char *fallback_server_pem, const char *fallback_server_key, const char *fallback_password,
+		const char *ciphers, guint16 timeout, gboolean rsa_private_key, gboolean rsa_fallback, gboolean accept_selfsigned) {
 	const char *crypto_lib = NULL;
 #if JANUS_USE_OPENSSL_PRE_1_1_API && !defined(HAVE_BORINGSSL)
 #if defined(LIBRESSL_VERSION_NUMBER)
@@ -420,78 +763,27 @@ gint janus_dtls_srtp_init(const char *server_pem, const char *server_key, const
 #endif
 	JANUS_LOG(LOG_INFO, "Crypto: %s\n", crypto_lib);
 #ifndef HAVE_SRTP_AESGCM
-	JANUS_LOG(LOG_WARN, "The libsrtp installation does not support AES-GCM profiles\n");
+	JANUS_LOG(LOG_WARN, "The libsrtp installation does not support AES-GCM profiles (built-in crypto?)\n");
 #endif
+	JANUS_LOG(LOG_VERB, "SRTP profiles: %s\n", JANUS_DTLS_SRTP_PROFILES);
 
 	/* Go on and create the DTLS context */
-#if JANUS_USE_OPENSSL_PRE_1_1_API && !defined(HAVE_BORINGSSL)
-#if defined(LIBRESSL_VERSION_NUMBER)
-	ssl_ctx = SSL_CTX_new(DTLSv1_method());
-#else
-	ssl_ctx = SSL_CTX_new(DTLSv1_2_method());
-#endif
-#else
-	ssl_ctx = SSL_CTX_new(DTLS_method());
-#endif
-	if(!ssl_ctx) {
-		JANUS_LOG(LOG_FATAL, "Ops, error creating DTLS context?\n");
-		return -1;
-	}
-	SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, janus_dtls_verify_callback);
-	SSL_CTX_set_tlsext_use_srtp(ssl_ctx,
-#ifdef HAVE_SRTP_AESGCM
-		"SRTP_AEAD_AES_256_GCM:SRTP_AEAD_AES_128_GCM:SRTP_AES128_CM_SHA1_80:SRTP_AES128_CM_SHA1_32");
-#else
-		"SRTP_AES128_CM_SHA1_80:SRTP_AES128_CM_SHA1_32");
-#endif
-
-	if(!server_pem && !server_key) {
-		JANUS_LOG(LOG_INFO, "No cert/key specified, autogenerating some...\n");
-		if(janus_dtls_generate_keys(&ssl_cert, &ssl_key, rsa_private_key) != 0) {
-			JANUS_LOG(LOG_FATAL, "Error generating DTLS key/certificate\n");
-			return -2;
-		}
-	} else if(!server_pem || !server_key) {
-		JANUS_LOG(LOG_FATAL, "DTLS certificate and key must be specified\n");
-		return -2;
-	} else if(janus_dtls_load_keys(server_pem, server_key, password, &ssl_cert, &ssl_key) != 0) {
-		return -3;
-	}
-
-	if(!SSL_CTX_use_certificate(ssl_ctx, ssl_cert)) {
-		JANUS_LOG(LOG_FATAL, "Certificate error (%s)\n", ERR_reason_error_string(ERR_get_error()));
-		return -4;
-	}
-	if(!SSL_CTX_use_PrivateKey(ssl_ctx, ssl_key)) {
-		JANUS_LOG(LOG_FATAL, "Certificate key error (%s)\n", ERR_reason_error_string(ERR_get_error()));
-		return -5;
-	}
-	if(!SSL_CTX_check_private_key(ssl_ctx)) {
-		JANUS_LOG(LOG_FATAL, "Certificate check error (%s)\n", ERR_reason_error_string(ERR_get_error()));
-		return -6;
-	}
-	SSL_CTX_set_options(ssl_ctx, SSL_OP_NO_TICKET);
-
-	unsigned int size;
-	unsigned char fingerprint[EVP_MAX_MD_SIZE];
-	if(X509_digest(ssl_cert, EVP_sha256(), (unsigned char *)fingerprint, &size) == 0) {
-		JANUS_LOG(LOG_FATAL, "Error converting X509 structure (%s)\n", ERR_reason_error_string(ERR_get_error()));
-		return -7;
-	}
-	char *lfp = (char *)&local_fingerprint;
-	unsigned int i = 0;
-	for(i = 0; i < size; i++) {
-		g_snprintf(lfp, 4, "%.2X:", fingerprint[i]);
-		lfp += 3;
-	}
-	*(lfp-1) = 0;
-	JANUS_LOG(LOG_INFO, "Fingerprint of our certificate: %s\n", local_fingerprint);
+	cert_pem = g_strdup(server_pem);
+	cert_key = g_strdup(server_key);
+	cert_pwd = g_strdup(password);
+	fallback_pem = g_strdup(fallback_server_pem);
+	fallback_key = g_strdup(fallback_server_key);
+	fallback_pwd = g_strdup(fallback_password);
+	cert_rsa = rsa_private_key;
+	cert_rsa_fallback = rsa_fallback;
 	if(ciphers)
 		dtls_ciphers = ciphers;
-	if(SSL_CTX_set_cipher_list(ssl_ctx, dtls_ciphers) == 0) {
-		JANUS_LOG(LOG_FATAL, "Error setting cipher list (%s)\n", ERR_reason_error_string(ERR_get_error()));
-		return -8;
-	}
+	int res = janus_dtls_credentials_create(&credentials);
+	if(res < 0)
+		return res;
+	JANUS_LOG(LOG_INFO, "Fingerprint of our certificate: %s\n", credentials->fingerprints[0]);
+	if(credentials->count > 1)
+		JANUS_LOG(LOG_INFO, "Fingerprint of our fallback certificate: %s\n", credentials->fingerprints[1]);
 
 	if(janus_dtls_bio_agent_init() < 0) {
 		JANUS_LOG(LOG_FATAL, "Error initializing BIO agent\n");
@@ -520,17 +812,94 @@ gint janus_dtls_srtp_init(const char *server_pem, const char *server_key, const
 	return 0;
 }
 
+void janus_dtls_set_session_resumption(gboolean enabled) {
+	dtls_session_resumption = enabled;
+	janus_mutex_lock(&credentials_mutex);
+	if(credentials != NULL)
+		janus_dtls_configure_resumption(credentials->ctx);
+	janus_mutex_unlock(&credentials_mutex);
+	if(dtls_session_resumption)
+		JANUS_LOG(LOG_INFO, "DTLS session resumption enabled\n");
+}
+
+gboolean janus_dtls_is_session_resumption_enabled(void) {
+	return dtls_session_resumption;
+}
+
+void janus_dtls_set_ssl_pool(guint size) {
+	ssl_pool_size = size;
+	if(ssl_pool_size == 0)
+		return;
+	janus_mutex_lock(&credentials_mutex);
+	janus_dtls_credentials *creds = credentials;
+	if(creds != NULL)
+		janus_refcount_increase(&creds->ref);
+	janus_mutex_unlock(&credentials_mutex);
+	janus_dtls_ssl_pool_fill(creds);
+	if(creds != NULL)
+		janus_refcount_decrease(&creds->ref);
+	JANUS_LOG(LOG_INFO, "Keeping %u SSL objects ready for new DTLS stacks\n", ssl_pool_size);
+}
+
+json_t *janus_dtls_ssl_pool_info(void) {
+	json_t *info = json_object();
+	json_object_set_new(info, "size", json_integer(ssl_pool_size));
+	guint available = 0;
+	janus_mutex_lock(&credentials_mutex);
+	if(credentials != NULL) {
+		janus_mutex_lock(&credentials->pool_mutex);
+		available = g_queue_get_length(credentials->ssl_pool);
+		janus_mutex_unlock(&credentials->pool_mutex);
+	}
+	janus_mutex_unlock(&credentials_mutex);
+	json_object_set_new(info, "available", json_integer(available));
+	json_object_set_new(info, "hits", json_integer(g_atomic_int_get(&ssl_pool_hits)));
+	json_object_set_new(info, "misses", json_integer(g_atomic_int_get(&ssl_pool_misses)));
+	json_object_set_new(info, "recycled", json_integer(g_atomic_int_get(&ssl_pool_recycled)));
+	return info;
+}
+
+void janus_dtls_set_certificate_rotation(guint period) {
+	if(period == 0 || rotation_thread != NULL)
+		return;
+	if(period < 60) {
+		JANUS_LOG(LOG_WARN, "DTLS certificates rotation period too short (%us), using 60s instead\n", period);
+		period = 60;
+	}
+	cert_rotation = period;
+	GError *error = NULL;
+	rotation_thread = g_thread_try_new("dtls certs", janus_dtls_rotation_thread, NULL, &error);
+	if(error != NULL) {
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the DTLS certificates rotation thread...\n",
+			error->code, error->message ? error->message : "??");
+		g_error_free(error);
+		rotation_thread = NULL;
+		return;
+	}
+	JANUS_LOG(LOG_INFO, "DTLS certificates will be rotated every %u seconds\n", cert_rotation);
+}
+
+const gchar *janus_dtls_srtp_get_fingerprint(janus_dtls_srtp *dtls, guint index) {
+	if(dtls == NULL || dtls->credentials == NULL || index >= dtls->credentials->count)
+		return NULL;
+	return dtls->credentials->fingerprints[index];
+}
+
 static void janus_dtls_srtp_free(const janus_refcount *dtls_ref) {
 	janus_dtls_srtp *dtls = janus_refcount_containerof(dtls_ref, janus_dtls_srtp, ref);
 	/* This stack can be destroyed, free all the resources */
 	dtls->pc = NULL;
 	if(dtls->ssl != NULL) {
-		SSL_free(dtls->ssl);
+		janus_dtls_ssl_recycle(dtls->credentials, dtls->ssl);
 		dtls->ssl = NULL;
 	}
-	/* BIOs are destroyed by SSL_free */
+	/* BIOs are destroyed when the SSL object is freed or recycled */
 	dtls->read_bio = NULL;
 	dtls->write_bio = NULL;
+	if(dtls->credentials != NULL) {
+		janus_refcount_decrease(&dtls->credentials->ref);
+		dtls->credentials = NULL;
+	}
 	if(dtls->srtp_valid) {
 		if(dtls->srtp_in) {
 			srtp_dealloc(dtls->srtp_in);
@@ -547,18 +916,27 @@ static void janus_dtls_srtp_free(const janus_refcount *dtls_ref) {
 }
 
 void janus_dtls_srtp_cleanup(void) {
-	if(ssl_cert != NULL) {
-		X509_free(ssl_cert);
-		ssl_cert = NULL;
-	}
-	if(ssl_key != NULL) {
-		EVP_PKEY_free(ssl_key);
-		ssl_key = NULL;
-	}
-	if(ssl_ctx != NULL) {
-		SSL_CTX_free(ssl_ctx);
-		ssl_ctx = NULL;
-	}
+	if(rotation_thread != NULL) {
+		g_atomic_int_set(&rotation_stop, 1);
+		g_thread_join(rotation_thread);
+		rotation_thread = NULL;
+	}
+	janus_mutex_lock(&credentials_mutex);
+	if(credentials != NULL)
+		janus_refcount_decrease(&credentials->ref);
+	credentials = NULL;
+	if(retired_credentials != NULL)
+		janus_refcount_decrease(&retired_credentials->ref);
+	retired_credentials = NULL;
+	janus_mutex_unlock(&credentials_mutex);
+	g_free(cert_pem);
+	g_free(cert_key);
+	g_free(cert_pwd);
+	g_free(fallback_pem);
+	g_free(fallback_key);
+	g_free(fallback_pwd);
+	cert_pem = cert_key = cert_pwd = NULL;
+	fallback_pem = fallback_key = fallback_pwd = NULL;
 #if JANUS_USE_OPENSSL_PRE_1_1_API && !defined(HAVE_BORINGSSL)
 	g_free(janus_dtls_locks);
 #endif
@@ -581,7 +959,13 @@ janus_dtls_srtp *janus_dtls_srtp_create(void *ice_pc, janus_dtls_role role) {
 	janus_refcount_init(&dtls->ref, janus_dtls_srtp_free);
 	/* Create SSL context, at last */
 	dtls->srtp_valid = 0;
-	dtls->ssl = SSL_new(ssl_ctx);
+	/* Use the current credentials, which we'll keep until we're done */
+	janus_mutex_lock(&credentials_mutex);
+	dtls->credentials = credentials;
+	if(dtls->credentials != NULL)
+		janus_refcount_increase(&dtls->credentials->ref);
+	janus_mutex_unlock(&credentials_mutex);
+	dtls->ssl = dtls->credentials ? janus_dtls_ssl_get(dtls->credentials) : NULL;
 	if(!dtls->ssl) {
 		JANUS_LOG(LOG_ERR, "[%"SCNu64"]     Error creating DTLS session! (%s)\n",
 			handle->handle_id, ERR_reason_error_string(ERR_get_error()));
@@ -589,7 +973,6 @@ janus_dtls_srtp *janus_dtls_srtp_create(void *ice_pc, janus_dtls_role role) {
 		return NULL;
 	}
 	SSL_set_ex_data(dtls->ssl, 0, dtls);
-	SSL_set_info_callback(dtls->ssl, janus_dtls_callback);
 	dtls->read_bio = BIO_new(BIO_s_mem());
 	if(!dtls->read_bio) {
 		JANUS_LOG(LOG_ERR, "[%"SCNu64"]   Error creating read BIO! (%s)\n",
@@ -608,27 +991,6 @@ janus_dtls_srtp *janus_dtls_srtp_create(void *ice_pc, janus_dtls_role role) {
 	SSL_set_bio(dtls->ssl, dtls->read_bio, dtls->write_bio);
 	/* The role may change later, depending on the negotiation */
 	dtls->dtls_role = role;
-	/* https://code.google.com/p/chromium/issues/detail?id=406458
-	 * Specify an ECDH group for ECDHE ciphers, otherwise they cannot be
-	 * negotiated when acting as the server. Use NIST's P-256 which is
-	 * commonly supported.
-	 */
-#ifndef OPENSSL_VERSION_MAJOR
-	EC_KEY *ecdh = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
-	if(ecdh == NULL) {
-		JANUS_LOG(LOG_ERR, "[%"SCNu64"]   Error creating ECDH group! (%s)\n",
-			handle->handle_id, ERR_reason_error_string(ERR_get_error()));
-		janus_refcount_decrease(&dtls->ref);
-		return NULL;
-	}
-	SSL_set_tmp_ecdh(dtls->ssl, ecdh);
-	EC_KEY_free(ecdh);
-#else
-	int grp_list[1] = { NID_X9_62_prime256v1 };
-	SSL_set1_groups(dtls->ssl, grp_list, 1);
-#endif
-	const long flags = SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION | SSL_OP_SINGLE_ECDH_USE;
-	SSL_set_options(dtls->ssl, flags);
 #ifdef HAVE_DTLS_SETTIMEOUT
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"]   Setting DTLS initial timeout: %"SCNu16"ms\n", handle->handle_id, dtls_timeout_base);
 	DTLSv1_set_initial_timeout_duration(dtls->ssl, dtls_timeout_base);
@@ -790,6 +1152,13 @@ void janus_dtls_srtp_incoming_msg(janus_dtls_srtp *dtls, char *buf, uint16_t len
 				JANUS_LOG(LOG_VERB, "[%"SCNu64"]  Fingerprint is a match!\n", handle->handle_id);
 				dtls->dtls_state = JANUS_DTLS_STATE_CONNECTED;
 				dtls->dtls_connected = janus_get_monotonic_time();
+				dtls->resumed = SSL_session_reused(dtls->ssl) ? TRUE : FALSE;
+				if(dtls->dtls_started > 0) {
+					janus_metrics_observe(JANUS_METRICS_DTLS_HANDSHAKE,
+						(guint)((dtls->dtls_connected - dtls->dtls_started)/1000));
+				}
+				JANUS_LOG(LOG_VERB, "[%"SCNu64"]  DTLS handshake took %"SCNi64"ms%s\n", handle->handle_id,
+					(dtls->dtls_connected - dtls->dtls_started)/1000, dtls->resumed ? " (resumed session)" : "");
 				/* Notify event handlers */
 				janus_dtls_notify_state_change(dtls);
 			} else {
@@ -1142,10 +1511,9 @@ gboolean janus_dtls_retry(gpointer stack) {
 	return TRUE;
 
 stoptimer:
-	if(pc->dtlsrt_source != NULL) {
-		g_source_destroy(pc->dtlsrt_source);
-		g_source_unref(pc->dtlsrt_source);
-		pc->dtlsrt_source = NULL;
+	if(pc->dtlsrt_timer != NULL) {
+		janus_timer_destroy(pc->dtlsrt_timer);
+		pc->dtlsrt_timer = NULL;
 	}
 	return FALSE;
 }
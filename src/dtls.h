@@ -17,6 +17,7 @@
 
 #include <inttypes.h>
 #include <glib.h>
+#include <jansson.h>
 
 #include "rtp.h"
 #include "rtpsrtp.h"
@@ -27,25 +28,63 @@
 /*! \brief Helper method to return info on the crypto library and its version
  * @returns A pointer to a static string with the version */
 const char *janus_get_ssl_version(void);
+/*! \brief Helper method to return the SRTP profiles we support, in order of preference
+ * @returns A pointer to a static string with the colon separated list of profiles */
+const char *janus_dtls_get_srtp_profiles(void);
+/*! \brief Helper method to return which crypto implementation libsrtp uses
+ * @returns "external" if libsrtp uses an external crypto library (e.g., OpenSSL), "built-in" otherwise */
+const char *janus_dtls_get_srtp_backend(void);
 
 /*! \brief DTLS stuff initialization
  * @param[in] server_pem Path to the certificate to use
  * @param[in] server_key Path to the key to use
  * @param[in] password Password needed to use the key, if any
+ * @param[in] fallback_server_pem Path to an additional certificate to use, with a different key type (e.g., RSA), if any
+ * @param[in] fallback_server_key Path to the key of the additional certificate, if any
+ * @param[in] fallback_password Password needed to use the key of the additional certificate, if any
  * @param[in] ciphers DTLS ciphers to use (will use hardcoded defaults, if NULL)
  * @param[in] timeout DTLS timeout base, in ms, to use for retransmissions (ignored if not using BoringSSL)
  * @param[in] rsa_private_key Whether RSA certificates should be generated, instead of NIST P-256
+ * @param[in] rsa_fallback Whether an RSA certificate should be generated too, next to the preferred NIST P-256 one
  * @param[in] accept_selfsigned Whether to accept self-signed certificates (default) or enforce validation
  * @returns 0 in case of success, a negative integer on errors */
 gint janus_dtls_srtp_init(const char *server_pem, const char *server_key, const char *password,
-	const char *ciphers, guint16 timeout, gboolean rsa_private_key, gboolean accept_selfsigned);
+	const char *fallback_server_pem, const char *fallback_server_key, const char *fallback_password,
+	const char *ciphers, guint16 timeout, gboolean rsa_private_key, gboolean rsa_fallback, gboolean accept_selfsigned);
 /*! \brief Method to cleanup DTLS stuff before exiting */
 void janus_dtls_srtp_cleanup(void);
-/*! \brief Method to return a string representation (SHA-256) of the certificate fingerprint */
+/*! \brief Method to return a string representation (SHA-256) of the fingerprint of the current preferred certificate
+ * \note When certificates are rotated, this may change over time: the fingerprints to put in
+ * the SDP of a specific PeerConnection should be retrieved with janus_dtls_srtp_get_fingerprint instead */
 gchar *janus_dtls_get_local_fingerprint(void);
+/*! \brief Method to periodically replace the certificates with new ones (generated or reloaded from the same files),
+ * in a dedicated thread: existing PeerConnections keep on using the certificates they were created with
+ * @param[in] period How often the certificates should be replaced, in seconds (0 disables rotation, the minimum is 60) */
+void janus_dtls_set_certificate_rotation(guint period);
 /*! \brief Method to check whether DTLS self-signed certificates are ok (default) or not */
 gboolean janus_dtls_are_selfsigned_certs_ok(void);
-
+/*! \brief Method to enable or disable the resumption of DTLS sessions via session tickets (disabled by default)
+ * \note Resumed sessions skip the certificate exchange and the key agreement, which
+ * makes handshakes of reconnecting peers much cheaper: remote fingerprints are still
+ * checked against the SDP, since the peer certificate is part of the resumed session
+ * @param[in] enabled Whether session resumption should be enabled */
+void janus_dtls_set_session_resumption(gboolean enabled);
+/*! \brief Method to check whether the resumption of DTLS sessions is enabled */
+gboolean janus_dtls_is_session_resumption_enabled(void);
+/*! \brief Method to keep a pool of SSL objects ready for new DTLS stacks
+ * \note Objects are created in advance for the current certificates (and for new
+ * ones when they're rotated), and the SSL objects of stacks that are destroyed are
+ * cleared and put back in the pool when there's room, rather than freed. As such,
+ * this should be called after all the other DTLS settings have been configured
+ * @param[in] size How many SSL objects to keep ready (0 disables the pool) */
+void janus_dtls_set_ssl_pool(guint size);
+/*! \brief Helper method to get info on the pool of SSL objects, for the Admin API
+ * @returns A JSON object with the size of the pool, how many objects are available, and how many were reused */
+json_t *janus_dtls_ssl_pool_info(void);
+
+
+/*! \brief Maximum number of certificates (of different key types) we can use */
+#define JANUS_DTLS_MAX_CERTIFICATES	2
 
 /*! \brief DTLS roles */
 typedef enum janus_dtls_role {
@@ -74,6 +113,10 @@ typedef struct janus_dtls_srtp {
 	gint64 dtls_started;
 	/*! \brief Monotonic time of when the DTLS state has switched to connected */
 	gint64 dtls_connected;
+	/*! \brief Whether the peer resumed a previous DTLS session, rather than performing a full handshake */
+	gboolean resumed;
+	/*! \brief Certificates (and SSL_CTX) this component was created with */
+	struct janus_dtls_credentials *credentials;
 	/*! \brief SSL context used for DTLS for this component */
 	SSL *ssl;
 	/*! \brief Read BIO (incoming DTLS data) */
@@ -127,6 +170,11 @@ int janus_dtls_srtp_create_sctp(janus_dtls_srtp *dtls);
  * @param[in] buf The DTLS message data
  * @param[in] len The DTLS message data length */
 void janus_dtls_srtp_incoming_msg(janus_dtls_srtp *dtls, char *buf, uint16_t len);
+/*! \brief Get the fingerprint of one of the certificates a janus_dtls_srtp instance uses
+ * @param[in] dtls The janus_dtls_srtp instance to query
+ * @param[in] index The index of the certificate, where 0 is the preferred one
+ * @returns The SHA-256 fingerprint of the certificate, or NULL if there's no such certificate */
+const gchar *janus_dtls_srtp_get_fingerprint(janus_dtls_srtp *dtls, guint index);
 /*! \brief Send an alert on a janus_dtls_srtp instance
  * @param[in] dtls The janus_dtls_srtp instance to send the alert on */
 void janus_dtls_srtp_send_alert(janus_dtls_srtp *dtls);
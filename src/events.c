@@ -4,7 +4,14 @@
  * \brief    Event handler notifications
  * \details  Event handler plugins can receive events from the Janus core
  * and other plugins, in order to handle them somehow. This methods
- * provide helpers to notify events to such handlers.
+ * provide helpers to notify events to such handlers. Each handler gets
+ * its own queue and thread, so that a slow handler can't delay the
+ * others: queues can optionally be bounded, in which case events of the
+ * types that are configured as droppable (e.g., media statistics) are
+ * discarded when a handler falls behind, while all other events are
+ * always delivered. Callers on busy paths should check whether any
+ * handler is interested in an event type before preparing the event
+ * (see janus_events_is_interested), rather than leave it to the queues.
  *
  * \ingroup core
  * \ref core
@@ -15,6 +22,15 @@
 #include "events.h"
 #include "utils.h"
 
+/* Event handlers are passed the same event instance, unless they asked
+ * for a copy: this needs a Jansson version that can serialize the same
+ * object from different threads at the same time, which is 2.13 */
+#if JANSSON_VERSION_HEX >= 0x020d00
+#define JANUS_EVENTS_SHARED	TRUE
+#else
+#define JANUS_EVENTS_SHARED	FALSE
+#endif
+
 static struct janus_event_types {
 	int type;
 	const char *label;
@@ -33,34 +49,70 @@ static struct janus_event_types {
 	{ -1, NULL, NULL},
 };
 
+#define JANUS_EVENT_TYPES	(sizeof(event_types_string)/sizeof(event_types_string[0]))
+
 static gboolean eventsenabled = FALSE;
 static char *server = NULL;
 static GHashTable *eventhandlers = NULL;
 
-static GAsyncQueue *events = NULL;
+/* Queue and thread of each event handler */
+typedef struct janus_events_queue {
+	janus_eventhandler *handler;		/* The event handler this queue is for */
+	GAsyncQueue *events;				/* Events waiting to be passed to the handler */
+	GThread *thread;					/* Thread passing events to the handler */
+	volatile gint queued;				/* Number of events in the queue */
+	volatile gint delivered;			/* Number of events passed to the handler so far */
+	volatile gint dropped;				/* Number of events dropped because the queue was full */
+	volatile gint dropped_types[JANUS_EVENT_TYPES];	/* Same as above, per event type */
+} janus_events_queue;
+static janus_events_queue *queues = NULL;
+static guint queues_count = 0;
+static int queue_size = 0;
+static janus_flags droppable_events = 0;
 static json_t exit_event;
 
-static GThread *events_thread;
 void *janus_events_thread(void *data);
 
-int janus_events_init(gboolean enabled, char *server_name, GHashTable *handlers) {
+int janus_events_init(gboolean enabled, char *server_name, GHashTable *handlers, int max_queued, const char *droppable) {
 	eventsenabled = enabled;
 	if(eventsenabled) {
-		events = g_async_queue_new();
 		if(server_name != NULL)
 			server = g_strdup(server_name);
 		eventhandlers = handlers;
-		/* We setup a thread for passing events to the handlers */
-		GError *error = NULL;
-		events_thread = g_thread_try_new("janus events thread", janus_events_thread, NULL, &error);
-		if(error != NULL) {
-			eventsenabled = FALSE;
-			g_free(server);
-			g_async_queue_unref(events);
-			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Events handler thread...\n",
-				error->code, error->message ? error->message : "??");
-			g_error_free(error);
-			return -1;
+		queue_size = max_queued > 0 ? max_queued : 0;
+		janus_flags_reset(&droppable_events);
+		janus_events_edit_events_mask(droppable ? droppable : "media", &droppable_events);
+		if(queue_size > 0)
+			JANUS_LOG(LOG_INFO, "Event handlers can have up to %d queued events\n", queue_size);
+		/* We setup a queue and a thread for passing events to each handler */
+		queues_count = eventhandlers ? g_hash_table_size(eventhandlers) : 0;
+		queues = g_malloc0(MAX(1, queues_count) * sizeof(janus_events_queue));
+		GHashTableIter iter;
+		gpointer value;
+		guint i = 0;
+		if(eventhandlers != NULL) {
+			g_hash_table_iter_init(&iter, eventhandlers);
+			while(g_hash_table_iter_next(&iter, NULL, &value)) {
+				janus_events_queue *q = &queues[i];
+				q->handler = (janus_eventhandler *)value;
+				q->events = g_async_queue_new();
+				/* Name the thread after the handler, e.g., evh sampleevh */
+				const char *package = q->handler->get_package();
+				const char *name = strrchr(package, '.');
+				char tname[16];
+				g_snprintf(tname, sizeof(tname), "evh %s", name ? name+1 : package);
+				GError *error = NULL;
+				q->thread = g_thread_try_new(tname, janus_events_thread, q, &error);
+				if(error != NULL) {
+					JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Events handler thread for %s...\n",
+						error->code, error->message ? error->message : "??", package);
+					g_error_free(error);
+					queues_count = i+1;
+					janus_events_deinit();
+					return -1;
+				}
+				i++;
+			}
 		}
 	}
 	return 0;
@@ -68,29 +120,58 @@ int janus_events_init(gboolean enabled, char *server_name, GHashTable *handlers)
 
 void janus_events_deinit(void) {
 	eventsenabled = FALSE;
-	if(events != NULL) {
-		g_async_queue_push(events, &exit_event);
-	}
-	if(events_thread != NULL) {
-		g_thread_join(events_thread);
-		events_thread = NULL;
+	guint i = 0;
+	for(i=0; i<queues_count; i++) {
+		janus_events_queue *q = &queues[i];
+		if(q->events == NULL)
+			continue;
+		if(q->thread != NULL) {
+			g_async_queue_push(q->events, &exit_event);
+			g_thread_join(q->thread);
+			q->thread = NULL;
+		}
+		/* Cleanup pending events */
+		json_t *event = NULL;
+		while((event = g_async_queue_try_pop(q->events)) != NULL) {
+			if(event != &exit_event)
+				json_decref(event);
+		}
+		g_async_queue_unref(q->events);
+		q->events = NULL;
 	}
-	if(events != NULL)
-		g_async_queue_unref(events);
+	g_free(queues);
+	queues = NULL;
+	queues_count = 0;
 	g_free(server);
+	server = NULL;
 }
 
 gboolean janus_events_is_enabled(void) {
 	return eventsenabled;
 }
 
+gboolean janus_events_is_interested(int type) {
+	if(!eventsenabled)
+		return FALSE;
+	/* Handlers can change their mask at any time, so we check them all: there's
+	 * usually just a few of them, which is still much cheaper than preparing
+	 * an event nobody will receive */
+	janus_flags mask = 0;
+	guint i = 0;
+	for(i=0; i<queues_count; i++)
+		mask |= (gsize)g_atomic_pointer_get(&queues[i].handler->events_mask);
+	return janus_flags_is_set(&mask, type);
+}
+
 void janus_events_notify_handlers(int type, int subtype, guint64 session_id, ...) {
 	/* This method has a variable list of arguments, depending on the event type */
 	va_list args;
 	va_start(args, session_id);
 
-	if(!eventsenabled || eventhandlers == NULL || g_hash_table_size(eventhandlers) == 0) {
-		/* Event handlers disabled, or no event handler plugins available: free resources, if needed */
+	if(!eventsenabled || eventhandlers == NULL || g_hash_table_size(eventhandlers) == 0 ||
+			!janus_events_is_interested(type)) {
+		/* Event handlers disabled, no event handler plugins available, or none
+		 * interested in this type of event: free resources, if needed */
 		if(type == JANUS_EVENT_TYPE_MEDIA || type == JANUS_EVENT_TYPE_WEBRTC) {
 			/* These events allocate a json_t object for their data, skip some arguments and unref it */
 			va_arg(args, guint64);
@@ -140,8 +221,9 @@ void janus_events_notify_handlers(int type, int subtype, guint64 session_id, ...
 	json_object_set_new(event, "timestamp", json_integer(janus_get_real_time()));
 	if(type != JANUS_EVENT_TYPE_CORE && type != JANUS_EVENT_TYPE_EXTERNAL) {
 		/* Core and Admin API originated events don't have a session ID */
-		if(session_id == 0 && (type == JANUS_EVENT_TYPE_PLUGIN || type == JANUS_EVENT_TYPE_TRANSPORT)) {
-			/* ... but plugin/transport events may not have one either */
+		if(session_id == 0 && (type == JANUS_EVENT_TYPE_PLUGIN || type == JANUS_EVENT_TYPE_TRANSPORT ||
+				(type == JANUS_EVENT_TYPE_MEDIA && subtype == JANUS_EVENT_SUBTYPE_MEDIA_STATS_BATCH))) {
+			/* ... but plugin/transport events may not have one either, nor batched stats */
 		} else {
 			json_object_set_new(event, "session_id", json_integer(session_id));
 		}
@@ -207,7 +289,8 @@ void janus_events_notify_handlers(int type, int subtype, guint64 session_id, ...
 		case JANUS_EVENT_TYPE_MEDIA: {
 			/* For WebRTC and media-related events, there's the handle ID and a json_t object with info on what happened */
 			guint64 handle_id = va_arg(args, guint64);
-			json_object_set_new(event, "handle_id", json_integer(handle_id));
+			if(handle_id > 0 || subtype != JANUS_EVENT_SUBTYPE_MEDIA_STATS_BATCH)
+				json_object_set_new(event, "handle_id", json_integer(handle_id));
 			char *opaque_id = va_arg(args, char *);
 			if(opaque_id != NULL)
 				json_object_set_new(event, "opaque_id", json_string(opaque_id));
@@ -270,59 +353,92 @@ void janus_events_notify_handlers(int type, int subtype, guint64 session_id, ...
 		json_decref(event);
 		return;
 	}
-	/* Enqueue the event */
-	g_async_queue_push(events, event);
+	/* Enqueue the event for all interested handlers */
+	gboolean droppable = (queue_size > 0 && janus_flags_is_set(&droppable_events, type));
+	guint i = 0;
+	for(i=0; i<queues_count; i++) {
+		janus_events_queue *q = &queues[i];
+		if(!janus_flags_is_set(&q->handler->events_mask, type))
+			continue;
+		if(droppable && g_atomic_int_get(&q->queued) >= queue_size) {
+			/* This handler is falling behind, and this event is not critical */
+			if(g_atomic_int_add(&q->dropped, 1) == 0) {
+				JANUS_LOG(LOG_WARN, "Too many queued events for %s (%d), dropping events\n",
+					q->handler->get_package(), queue_size);
+			}
+			guint t = 0;
+			for(t=0; event_types_string[t].label != NULL; t++) {
+				if(event_types_string[t].type == type) {
+					g_atomic_int_inc(&q->dropped_types[t]);
+					break;
+				}
+			}
+			continue;
+		}
+		if(queues_count == 1 || (JANUS_EVENTS_SHARED && !q->handler->mutable_events)) {
+			/* Single event handler, or one that won't modify the event: pass this instance directly */
+			json_incref(event);
+			g_atomic_int_inc(&q->queued);
+			g_async_queue_push(q->events, event);
+		} else {
+			/* Multiple event handlers, and this one may modify the event: pass a copy */
+			g_atomic_int_inc(&q->queued);
+			g_async_queue_push(q->events, json_deep_copy(event));
+		}
+	}
+	/* Unref our reference, handlers will have their own */
+	json_decref(event);
 }
 
 void *janus_events_thread(void *data) {
-	JANUS_LOG(LOG_VERB, "Joining Events handler thread\n");
+	janus_events_queue *q = (janus_events_queue *)data;
+	JANUS_LOG(LOG_VERB, "Joining Events handler thread (%s)\n", q->handler->get_package());
 	json_t *event = NULL;
 
 	while(eventsenabled) {
 		/* Any event in queue? */
-		event = g_async_queue_pop(events);
+		event = g_async_queue_pop(q->events);
 		if(event == &exit_event)
 			break;
-
-		/* Notify all interested handlers, increasing the event reference to make sure it's not lost because of errors */
-		int type = json_integer_value(json_object_get(event, "type"));
-		guint count = g_hash_table_size(eventhandlers);
-		GHashTableIter iter;
-		gpointer value;
-		g_hash_table_iter_init(&iter, eventhandlers);
-		json_incref(event);
-		while(g_hash_table_iter_next(&iter, NULL, &value)) {
-			janus_eventhandler *e = value;
-			if(e == NULL)
-				continue;
-			if(!janus_flags_is_set(&e->events_mask, type))
-				continue;
-			if(count == 1) {
-				/* Single event handler: pass this instance directly */
-				e->incoming_event(event);
-			} else {
-				/* Multiple event handlers, that may modify the event: pass a copy */
-				json_t *copy = json_deep_copy(event);
-				e->incoming_event(copy);
-				json_decref(copy);
-			}
-		}
+		g_atomic_int_add(&q->queued, -1);
+		/* Pass the event to the handler, which will add its own reference if it needs it */
+		q->handler->incoming_event(event);
+		g_atomic_int_inc(&q->delivered);
 		json_decref(event);
-
-		/* Unref the final event reference, interested handlers will have their own reference */
-		json_decref(event);
-	}
-
-	/* Cleanup pending events */
-	while((event = g_async_queue_try_pop(events)) != NULL) {
-		if(event != &exit_event)
-			json_decref(event);
 	}
 
-	JANUS_LOG(LOG_VERB, "Leaving Events handler thread\n");
+	JANUS_LOG(LOG_VERB, "Leaving Events handler thread (%s)\n", q->handler->get_package());
 	return NULL;
 }
 
+json_t *janus_events_info(void) {
+	json_t *info = json_object();
+	json_object_set_new(info, "enabled", eventsenabled ? json_true() : json_false());
+	if(queue_size > 0)
+		json_object_set_new(info, "max_queued", json_integer(queue_size));
+	json_t *list = json_array();
+	guint i = 0;
+	for(i=0; i<queues_count; i++) {
+		janus_events_queue *q = &queues[i];
+		json_t *h = json_object();
+		json_object_set_new(h, "package", json_string(q->handler->get_package()));
+		json_object_set_new(h, "queued", json_integer(g_atomic_int_get(&q->queued)));
+		json_object_set_new(h, "delivered", json_integer(g_atomic_int_get(&q->delivered)));
+		json_object_set_new(h, "dropped", json_integer(g_atomic_int_get(&q->dropped)));
+		json_t *types = json_object();
+		guint t = 0;
+		for(t=0; event_types_string[t].label != NULL; t++) {
+			int dropped = g_atomic_int_get(&q->dropped_types[t]);
+			if(dropped > 0)
+				json_object_set_new(types, event_types_string[t].label, json_integer(dropped));
+		}
+		json_object_set_new(h, "dropped_types", types);
+		json_array_append_new(list, h);
+	}
+	json_object_set_new(info, "handlers", list);
+	return info;
+}
+
 /* Helper method to change the events mask */
 void janus_events_edit_events_mask(const char *list, janus_flags *target) {
 	if(!list)
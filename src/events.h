@@ -20,8 +20,10 @@
  * @param[in] enabled Whether broadcasting events should be supported at all
  * @param[in] server_name The name of this server, to be added to all events
  * @param[in] handlers Map of all registered event handlers
+ * @param[in] max_queued Maximum number of events that can be queued for a single handler before droppable events are dropped (0 means no limit)
+ * @param[in] droppable A comma separated string of event types that can be dropped when a handler falls behind (NULL means media events)
  * @returns 0 on success, a negative integer otherwise */
-int janus_events_init(gboolean enabled, char *server_name, GHashTable *handlers);
+int janus_events_init(gboolean enabled, char *server_name, GHashTable *handlers, int max_queued, const char *droppable);
 
 /*! \brief De-initialize the event handlers broadcaster */
 void janus_events_deinit(void);
@@ -30,6 +32,13 @@ void janus_events_deinit(void);
  * @returns TRUE if they're enabled, FALSE if not */
 gboolean janus_events_is_enabled(void);
 
+/*! \brief Quick method to check whether any event handler is interested in a specific type of event
+ * \note This should be used before preparing events on busy paths (e.g., media statistics), so
+ * that no resources are spent on events that no handler subscribed to
+ * @param[in] type Type of the event to check
+ * @returns TRUE if event handlers are enabled and at least one is interested in this type, FALSE otherwise */
+gboolean janus_events_is_interested(int type);
+
 /*! \brief Notify an event to all interested handlers
  * @note According to the type of event to notify, different arguments may
  * be required and used in order to prepare the actual object to pass to handlers.
@@ -38,6 +47,10 @@ gboolean janus_events_is_enabled(void);
  * @param[in] session_id Janus session identifier this event refers to */
 void janus_events_notify_handlers(int type, int subtype, guint64 session_id, ...);
 
+/*! \brief Helper method to get a summary of the queue of each event handler, for the Admin API
+ * @returns A JSON object with the number of queued, delivered and dropped events for each handler */
+json_t *janus_events_info(void);
+
 /*! \brief Helper method to change the mask of events a handler is interested in
  * @note Every time this is called, the mask is reset, which means that to
  * unsubscribe from a single event you have to pass an updated list
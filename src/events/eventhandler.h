@@ -67,6 +67,15 @@ janus_eventhandler *create(void) {
  * The core, in fact, will refer to that mask to check whether your event
  * handler is interested in a specific event or not.
  *
+ * Events are shared: when more than one event handler is interested in
+ * the same event, they're all passed the same read-only instance, which
+ * means that \c incoming_event() must never modify the event it receives
+ * (adding a reference to keep it around is fine, though). Handlers that
+ * really need to modify events can either make their own copy (e.g., a
+ * cheap \c json_copy if they only need to add or replace top level
+ * properties), or set the \c mutable_events property to TRUE, in which
+ * case the core will always pass them a private deep copy of the event.
+ *
  * Unlike other kind of modules (transports, plugins), the \c init() method
  * here only passes the path to the configurations files folder, as event
  * handlers never need to contact the Janus core themselves. This path can be used to read and
@@ -101,7 +110,7 @@ janus_eventhandler *create(void) {
 
 
 /*! \brief Version of the API, to match the one event handler plugins were compiled against */
-#define JANUS_EVENTHANDLER_API_VERSION	3
+#define JANUS_EVENTHANDLER_API_VERSION	4
 
 /*! \brief Initialization of all event handler plugin properties to NULL
  *
@@ -189,6 +198,8 @@ static janus_eventhandler janus_fake_eventhandler_plugin =
 #define JANUS_EVENT_SUBTYPE_MEDIA_SLOWLINK	2
 /*! \brief Media event subtypes: stats */
 #define JANUS_EVENT_SUBTYPE_MEDIA_STATS		3
+/*! \brief Media event subtypes: stats for all handles, batched in a single event */
+#define JANUS_EVENT_SUBTYPE_MEDIA_STATS_BATCH	4
 ///@}
 
 #define JANUS_EVENTHANDLER_INIT(...) {			\
@@ -203,6 +214,7 @@ static janus_eventhandler janus_fake_eventhandler_plugin =
 		.get_package = NULL,					\
 		.incoming_event = NULL,					\
 		.events_mask = JANUS_EVENT_TYPE_NONE,	\
+		.mutable_events = FALSE,				\
 		## __VA_ARGS__ }
 
 
@@ -254,6 +266,8 @@ struct janus_eventhandler {
 	 * working threads, and so you'd most likely end up slowing it down. Just take note of it
 	 * and handle it somewhere else. It's your responsibility to \c json_decref the event
 	 * object once you're done with it: a failure to do so will result in memory leaks.
+	 * \note The event may be shared with other event handlers, so it must NOT be modified,
+	 * unless \c mutable_events is set, in which case the handler gets its own copy.
 	 * @param[in] event Jansson object containing the event details */
 	void (* const incoming_event)(json_t *event);
 
@@ -272,6 +286,8 @@ struct janus_eventhandler {
 
 	/*! \brief Mask of events this handler is interested in, as a janus_flags object */
 	janus_flags events_mask;
+	/*! \brief Whether this handler modifies the events it receives, and so needs a private copy of each */
+	gboolean mutable_events;
 };
 
 /*! \brief The hook that event handler plugins need to implement to be created from the Janus core */
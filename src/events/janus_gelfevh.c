@@ -12,6 +12,10 @@
  * headers. UDP messages will be chunked automatically.
  * There is also compression available for UDP protocol, to save network bandwidth
  * while using a bit more CPU. This is not available for TCP due to GELF limitations
+ * Sockets are non-blocking, and events are handled by a dedicated thread
+ * through a bounded queue, so that a slow GELF server can never stall
+ * the event handler thread: on TCP, messages are coalesced in a bounded
+ * output buffer, and events are dropped when either is full.
  *
  * \ingroup eventhandlers
  * \ref eventhandlers
@@ -31,6 +35,9 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/uio.h>
 #include "../ip-utils.h"
 
 /* Plugin information */
@@ -96,9 +103,11 @@ static janus_mutex evh_mutex;
 /* JSON serialization options */
 static size_t json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
 
-/* Queue of events to handle */
+/* Queue of events to handle: when it's bounded, events are dropped when it's full */
 static GAsyncQueue *events = NULL;
 static json_t exit_event;
+static int max_queued = 10000;
+static volatile gint dropped = 0;
 static void janus_gelfevh_event_free(json_t *event) {
 	if(!event || event == &exit_event)
 		return;
@@ -115,7 +124,13 @@ typedef enum janus_gelfevh_socket_type {
 } janus_gelfevh_socket_type;
 
 static int max_gelf_msg_len = 500;
-static int sockfd;
+static int sockfd = -1;
+static gint64 last_connect = 0;
+/* On TCP, messages are coalesced in a buffer, so that they're sent with as few
+ * writes as possible: when the buffer is full, new events are dropped */
+static GByteArray *tcp_pending = NULL;
+static int max_pending = 1024*1024;
+#define JANUS_GELFEVH_FLUSH_SIZE	65536
 /* Set TCP as Default transport */
 static janus_gelfevh_socket_type transport = JANUS_GELFEVH_SOCKET_TYPE_UDP;
 
@@ -136,24 +151,15 @@ static struct janus_json_parameter tweak_parameters[] = {
 #define JANUS_GELFEVH_ERROR_UNKNOWN_ERROR		499
 
 /* Plugin implementation */
-static char *randstring(size_t length) {
-	static char charset[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
-	char *randomString = NULL;
-	int n;
-	if(length) {
-		randomString = g_malloc(sizeof(char) * (length + 1));
-		if(randomString) {
-			for(n = 0; n < (int)length; n++) {
-				int key = rand() % (int)(sizeof(charset) - 1);
-				randomString[n] = charset[key];
-			}
-			randomString[length] = '\0';
-		}
-	}
-	return randomString;
+static void janus_gelfevh_drop(int count) {
+	if(count <= 0)
+		return;
+	if(g_atomic_int_add(&dropped, count) == 0)
+		JANUS_LOG(LOG_WARN, "GELF backend can't keep up, dropping events\n");
 }
 
 static int janus_gelfevh_connect(void) {
+	last_connect = janus_get_monotonic_time();
 	struct addrinfo *res = NULL;
 	janus_network_address addr;
 	janus_network_address_string_buffer addr_buf;
@@ -184,14 +190,51 @@ static int janus_gelfevh_connect(void) {
 
 	if(connect(sockfd, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0) {
 		JANUS_LOG(LOG_ERR, "Connect to GELF host failed\n");
+		close(sockfd);
+		sockfd = -1;
 		g_free(host);
 		return -1;
 	}
+	/* From now on, we never block on writes */
+	int flags = fcntl(sockfd, F_GETFL, 0);
+	if(flags < 0 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) < 0)
+		JANUS_LOG(LOG_WARN, "Couldn't make GELF socket non-blocking: %d (%s)\n", errno, g_strerror(errno));
 	JANUS_LOG(LOG_INFO, "Connected to GELF backend: [%s:%s]\n", host, port);
 	g_free(host);
 	return 0;
 }
 
+/* Helper to send as much as we can of the TCP buffer, optionally
+ * waiting up to timeout milliseconds for the socket to be writable */
+static int janus_gelfevh_flush(int timeout) {
+	if(tcp_pending == NULL || tcp_pending->len == 0)
+		return 0;
+	if(sockfd < 0) {
+		/* Try to reconnect, but not more than once per second */
+		if(janus_get_monotonic_time() - last_connect < G_USEC_PER_SEC || janus_gelfevh_connect() < 0)
+			return -1;
+	}
+	if(timeout > 0) {
+		struct pollfd pfd = { .fd = sockfd, .events = POLLOUT, .revents = 0 };
+		if(poll(&pfd, 1, timeout) <= 0)
+			return 0;
+	}
+	ssize_t sent = send(sockfd, tcp_pending->data, tcp_pending->len, MSG_NOSIGNAL);
+	if(sent < 0) {
+		if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return 0;
+		/* We can't know how much the server got: we'll start from scratch when we reconnect */
+		JANUS_LOG(LOG_WARN, "Sending TCP message failed, dropping %u buffered bytes: %d (%s)\n",
+			tcp_pending->len, errno, g_strerror(errno));
+		g_byte_array_set_size(tcp_pending, 0);
+		close(sockfd);
+		sockfd = -1;
+		return -1;
+	}
+	g_byte_array_remove_range(tcp_pending, 0, sent);
+	return 0;
+}
+
 static char compressed_text[8192];
 static int janus_gelfevh_send(char *message) {
 	if(!message) {
@@ -199,20 +242,16 @@ static int janus_gelfevh_send(char *message) {
 		return -1;
 	}
 	if(transport == JANUS_GELFEVH_SOCKET_TYPE_TCP) {
-		/* TCP */
-		int out_bytes = 0;
+		/* TCP: messages are null-terminated, we just add them to the buffer */
 		int length = strlen(message) + 1;
-		char *buffer = message;
-		while(length > 0) {
-			out_bytes = send(sockfd, buffer, length, 0);
-			if(out_bytes <= 0) {
-				JANUS_LOG(LOG_WARN, "Sending TCP message failed, dropping event: %d (%s)\n", errno, g_strerror(errno));
-				close(sockfd);
-				return -1;
-			}
-			buffer += out_bytes;
-			length -= out_bytes;
+		if(tcp_pending->len + length > (guint)max_pending) {
+			janus_gelfevh_drop(1);
+			return -1;
 		}
+		g_byte_array_append(tcp_pending, (guint8 *)message, length);
+		/* Only write when there's nothing else to add, or we have enough data already */
+		if(g_async_queue_length(events) <= 0 || tcp_pending->len >= JANUS_GELFEVH_FLUSH_SIZE)
+			janus_gelfevh_flush(0);
 	} else {
 		/* UDP chunking with headers. Check if we need to compress the data */
 		int len = strlen(message);
@@ -240,36 +279,46 @@ static int janus_gelfevh_send(char *message) {
 		if(total == 1) {
 			int n = send(sockfd, buf, len, 0);
 			if(n < 0) {
-				JANUS_LOG(LOG_WARN, "Sending UDP message failed, dropping event: %d (%s)\n", errno, g_strerror(errno));
+				if(errno == EAGAIN || errno == EWOULDBLOCK)
+					janus_gelfevh_drop(1);
+				else
+					JANUS_LOG(LOG_WARN, "Sending UDP message failed, dropping event: %d (%s)\n", errno, g_strerror(errno));
 				return -1;
 			}
 			return 0;
 		} else {
+			/* Each chunk is the GELF header followed by a slice of the message:
+			 * we send them as two iovecs, so that we don't copy the payload */
+			guint8 header[12];
+			header[0] = 0x1e;
+			header[1] = 0x0f;
+			guint32 id[2] = { g_random_int(), g_random_int() };
+			memcpy(header + 2, id, 8);
+			header[11] = (guint8)total;
+			struct iovec iov[2];
+			struct msghdr msg = { 0 };
+			msg.msg_iov = iov;
+			msg.msg_iovlen = 2;
 			int offset = 0;
-			char *rnd = randstring(8);
 			int i;
 			for(i = 0; i < total; i++) {
 				int bytesToSend = ((offset + max_gelf_msg_len) < len) ? max_gelf_msg_len : (len - offset);
-				/* Prepend the necessary headers (imitate TCP) */
-				char chunk[bytesToSend + 12];
-				chunk[0] = 0x1e;
-				chunk[1] = 0x0f;
-				memcpy(chunk + 2, rnd, 8);
-				chunk[10] = (char)i;
-				chunk[11] = (char)total;
-				char *head = chunk;
-				memcpy(head+12, buf, bytesToSend);
-				buf += bytesToSend;
-				int n = send(sockfd, head, bytesToSend + 12, 0);
+				header[10] = (guint8)i;
+				iov[0].iov_base = header;
+				iov[0].iov_len = sizeof(header);
+				iov[1].iov_base = buf + offset;
+				iov[1].iov_len = bytesToSend;
+				int n = sendmsg(sockfd, &msg, 0);
 				if(n < 0) {
-					JANUS_LOG(LOG_WARN, "Sending UDP message failed: %d (%s)\n", errno, g_strerror(errno));
-					g_free(rnd);
+					/* The recipient can't rebuild the message anymore, don't send the rest */
+					if(errno == EAGAIN || errno == EWOULDBLOCK)
+						janus_gelfevh_drop(1);
+					else
+						JANUS_LOG(LOG_WARN, "Sending UDP message failed: %d (%s)\n", errno, g_strerror(errno));
 					return -1;
 				}
 				offset += bytesToSend;
-				memset(chunk, 0, sizeof chunk);
 			}
-			g_free(rnd);
 		}
 	}
 	return 0;
@@ -339,6 +388,21 @@ int janus_gelfevh_init(const char *config_path) {
 				max_gelf_msg_len = atoi(item->value);
 			}
 		}
+		/* How many events can we queue, and how many bytes can we buffer on TCP? */
+		item = janus_config_get(config, config_general, janus_config_type_item, "max_queued");
+		if(item && item->value) {
+			if(atoi(item->value) < 0)
+				JANUS_LOG(LOG_WARN, "Invalid max_queued, using default: %d\n", max_queued);
+			else
+				max_queued = atoi(item->value);
+		}
+		item = janus_config_get(config, config_general, janus_config_type_item, "max_pending");
+		if(item && item->value) {
+			if(atoi(item->value) < JANUS_GELFEVH_FLUSH_SIZE)
+				JANUS_LOG(LOG_WARN, "Invalid max_pending (must be at least %d), using default: %d\n", JANUS_GELFEVH_FLUSH_SIZE, max_pending);
+			else
+				max_pending = atoi(item->value);
+		}
 		/* Which events should we subscribe to? */
 		item = janus_config_get(config, config_general, janus_config_type_item, "events");
 		if(item && item->value)
@@ -384,6 +448,7 @@ done:
 
 	/* Initialize the events queue */
 	events = g_async_queue_new_full((GDestroyNotify) janus_gelfevh_event_free);
+	tcp_pending = g_byte_array_sized_new(JANUS_GELFEVH_FLUSH_SIZE);
 	janus_mutex_init(&evh_mutex);
 
 	g_atomic_int_set(&initialized, 1);
@@ -421,7 +486,12 @@ void janus_gelfevh_destroy(void) {
 	g_atomic_int_set(&initialized, 0);
 	g_atomic_int_set(&stopping, 0);
 
-	close(sockfd);
+	if(tcp_pending != NULL)
+		g_byte_array_free(tcp_pending, TRUE);
+	tcp_pending = NULL;
+	if(sockfd > -1)
+		close(sockfd);
+	sockfd = -1;
 
 	JANUS_LOG(LOG_INFO, "%s destroyed!\n", JANUS_GELFEVH_NAME);
 }
@@ -468,6 +538,11 @@ void janus_gelfevh_incoming_event(json_t *event) {
 	 * and handle it in our own thread: the event contains a monotonic time indicator of
 	 * when the event actually happened on this machine, so that, if relevant, we can compute
 	 * any delay in the actual event processing ourselves. */
+	if(max_queued > 0 && g_async_queue_length(events) >= max_queued) {
+		/* Our thread is falling behind, drop the event */
+		janus_gelfevh_drop(1);
+		return;
+	}
 	json_incref(event);
 	g_async_queue_push(events, event);
 
@@ -574,11 +649,24 @@ static void *janus_gelfevh_handler(void *data) {
 	json_t *event = NULL;
 
 	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
-		event = g_async_queue_pop(events);
+		if(transport == JANUS_GELFEVH_SOCKET_TYPE_TCP && tcp_pending->len > 0) {
+			/* We have data waiting for the socket to be writable: wait
+			 * a bit for that, and then check if there are new events */
+			janus_gelfevh_flush(50);
+			event = g_async_queue_try_pop(events);
+		} else {
+			event = g_async_queue_pop(events);
+		}
 		if(event == NULL)
 			continue;
 		if(event == &exit_event)
 			break;
+		int lost = g_atomic_int_get(&dropped);
+		if(lost > 0 && g_async_queue_length(events) == 0) {
+			/* We caught up, tell how many events we lost in the meanwhile */
+			g_atomic_int_add(&dropped, -lost);
+			JANUS_LOG(LOG_WARN, "Dropped %d events that couldn't be sent to the GELF backend in time\n", lost);
+		}
 
 		/* Handle event */
 		while(TRUE) {
@@ -6,7 +6,12 @@
  * refactoring of the original effort contributed by Olle E. Johansson
  * (see https://github.com/meetecho/janus-gateway/pull/1185), which was
  * based on the MQTT transport by Andrei Nesterov and the RabbitMQ event
- * plugin by Piter Konstantinov.
+ * plugin by Piter Konstantinov. Events are published by a dedicated
+ * thread fed by a bounded queue, optionally grouping the ones that go to
+ * the same topic in JSON arrays: when the broker can't keep up and the
+ * maximum number of inflight messages is reached, the thread waits a
+ * bit before dropping events, while the queue keeps on absorbing new
+ * ones, so that the thread relaying events to handlers never stalls.
  *
  * \ingroup eventhandlers
  * \ref eventhandlers
@@ -76,8 +81,22 @@ static void janus_mqttevh_event_free(json_t *event) {
 	json_decref(event);
 }
 
-/* Queue of events to handle */
+/* Queue of events to handle: when it's bounded, events are dropped when it's full */
 static GAsyncQueue *events = NULL;
+static int max_queued = 10000;
+static volatile gint dropped = 0;
+static void janus_mqttevh_drop(int count) {
+	if(count <= 0)
+		return;
+	if(g_atomic_int_add(&dropped, count) == 0)
+		JANUS_LOG(LOG_WARN, "MQTT broker can't keep up, dropping events\n");
+}
+/* Whether events for the same topic can be grouped in a single message */
+static gboolean group_events = FALSE;
+static int group_max = 100;
+/* How long to wait for inflight messages to be acknowledged before dropping an event */
+#define JANUS_MQTTEVH_INFLIGHT_WAIT		10000
+#define JANUS_MQTTEVH_INFLIGHT_RETRIES	100
 
 /* Plugin creator */
 janus_eventhandler *create(void) {
@@ -308,10 +327,20 @@ static int janus_mqttevh_send_message(void *context, const char *topic, json_t *
 	}
 	JANUS_LOG(LOG_HUGE, "Converted message to JSON for %s\n", topic);
 	/* Ok, lets' get rid of the message */
+	int count = json_is_array(message) ? (int)json_array_size(message) : 1;
 	json_decref(message);
 
 	rc = janus_mqttevh_client_publish_message_wrap(context, topic, ctx->publish.retain, payload);
-	if(rc != MQTTASYNC_SUCCESS) {
+	/* If too many messages are inflight, give the broker some time to acknowledge them */
+	int retries = 0;
+	while(rc == MQTTASYNC_MAX_MESSAGES_INFLIGHT && retries < JANUS_MQTTEVH_INFLIGHT_RETRIES && !g_atomic_int_get(&stopping)) {
+		g_usleep(JANUS_MQTTEVH_INFLIGHT_WAIT);
+		retries++;
+		rc = janus_mqttevh_client_publish_message_wrap(context, topic, ctx->publish.retain, payload);
+	}
+	if(rc == MQTTASYNC_MAX_MESSAGES_INFLIGHT || rc == MQTTASYNC_MAX_BUFFERED_MESSAGES) {
+		janus_mqttevh_drop(count);
+	} else if(rc != MQTTASYNC_SUCCESS) {
 		JANUS_LOG(LOG_WARN, "Can't publish to MQTT topic: %s, return code: %d\n", ctx->publish.topic, rc);
 	}
 
@@ -549,6 +578,9 @@ static int janus_mqttevh_client_publish_message(janus_mqttevh_context *ctx, cons
 			JANUS_LOG(LOG_HUGE, "MQTT EVH message sent to topic %s on %s. Result %d\n", topic, ctx->connect.url, rc);
 			break;
 		case MQTTASYNC_OPERATION_INCOMPLETE:
+		case MQTTASYNC_MAX_MESSAGES_INFLIGHT:
+		case MQTTASYNC_MAX_BUFFERED_MESSAGES:
+			/* The caller will decide what to do with the message */
 			break;
 		default:
 			JANUS_LOG(LOG_WARN, "FAILURE: MQTT EVH message probably not sent to topic %s on %s. Result %d\n", topic, ctx->connect.url, rc);
@@ -579,6 +611,9 @@ static int janus_mqttevh_client_publish_message5(janus_mqttevh_context *ctx, con
 			JANUS_LOG(LOG_HUGE, "MQTT EVH message sent to topic %s on %s. Result %d\n", topic, ctx->connect.url, rc);
 			break;
 		case MQTTASYNC_OPERATION_INCOMPLETE:
+		case MQTTASYNC_MAX_MESSAGES_INFLIGHT:
+		case MQTTASYNC_MAX_BUFFERED_MESSAGES:
+			/* The caller will decide what to do with the message */
 			break;
 		default:
 			JANUS_LOG(LOG_WARN, "FAILURE: MQTT EVH message probably not sent to topic %s on %s. Result %d\n", topic, ctx->connect.url, rc);
@@ -795,6 +830,25 @@ static int janus_mqttevh_init(const char *config_path) {
 		}
 	}
 
+	/* How many events can we queue, and can we group them? */
+	item = janus_config_get(config, config_general, janus_config_type_item, "max_queued");
+	if(item && item->value) {
+		if(atoi(item->value) < 0)
+			JANUS_LOG(LOG_ERR, "Invalid max-queued value: %s (falling back to default)\n", item->value);
+		else
+			max_queued = atoi(item->value);
+	}
+	item = janus_config_get(config, config_general, janus_config_type_item, "grouping");
+	if(item && item->value)
+		group_events = janus_is_true(item->value);
+	item = janus_config_get(config, config_general, janus_config_type_item, "grouping_max");
+	if(item && item->value) {
+		if(atoi(item->value) < 1)
+			JANUS_LOG(LOG_ERR, "Invalid grouping-max value: %s (falling back to default)\n", item->value);
+		else
+			group_max = atoi(item->value);
+	}
+
 	/* Which events should we subscribe to? */
 	item = janus_config_get(config, config_general, janus_config_type_item, "events");
 	if(item && item->value)
@@ -1118,6 +1172,11 @@ static void janus_mqttevh_incoming_event(json_t *event) {
 		/* Janus is closing or the plugin is */
 		return;
 	}
+	if(max_queued > 0 && g_async_queue_length(events) >= max_queued) {
+		/* Our thread is falling behind, drop the event */
+		janus_mqttevh_drop(1);
+		return;
+	}
 	json_incref(event);
 	g_async_queue_push(events, event);
 }
@@ -1167,41 +1226,78 @@ plugin_response:
 }
 
 
+/* Helper to add the event name to an event */
+static json_t *janus_mqttevh_prepare_event(json_t *event) {
+	/* Handle event: just for fun, let's see how long it took for us to take care of this */
+	json_t *created = json_object_get(event, "timestamp");
+	if(created && json_is_integer(created)) {
+		gint64 then = json_integer_value(created);
+		gint64 now = janus_get_monotonic_time();
+		JANUS_LOG(LOG_DBG, "Handled event after %"SCNu64" us\n", now-then);
+	}
+
+	int type = json_integer_value(json_object_get(event, "type"));
+	const char *elabel = janus_events_type_to_label(type);
+	const char *ename = janus_events_type_to_name(type);
+
+	/* Hack to test new functions */
+	if(elabel && ename) {
+		JANUS_LOG(LOG_HUGE, "Event label %s, name %s\n", elabel, ename);
+		/* The event may be shared with other handlers, add the name to a shallow copy */
+		json_t *copy = json_copy(event);
+		json_decref(event);
+		event = copy;
+		json_object_set_new(event, "eventtype", json_string(ename));
+	} else {
+		JANUS_LOG(LOG_WARN, "Can't get event label or name\n");
+	}
+	return event;
+}
+
 /* Thread to handle incoming events and push them out on the MQTT. We
  * will publish events on multiple topics, depending on the event type.
  * If the base topic is configured to "/janus/events", then a handle
  * event will be published to "/janus/events/handle" */
 static void *janus_mqttevh_handler(void *data) {
 	janus_mqttevh_context *ctx = (janus_mqttevh_context *)data;
-	json_t *event = NULL;
+	json_t *event = NULL, *next = NULL;
 	char topicbuf[512];
 	topicbuf[0] = '\0';
 
 	JANUS_LOG(LOG_VERB, "Joining MqttEventHandler handler thread\n");
 
 	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
-		/* Get event from queue */
-		event = g_async_queue_pop(events);
+		/* Get event from queue, unless we already got one when grouping */
+		if(next != NULL) {
+			event = next;
+			next = NULL;
+		} else {
+			event = g_async_queue_pop(events);
+		}
 		if(event == &exit_event) break;
-
-		/* Handle event: just for fun, let's see how long it took for us to take care of this */
-		json_t *created = json_object_get(event, "timestamp");
-		if(created && json_is_integer(created)) {
-			gint64 then = json_integer_value(created);
-			gint64 now = janus_get_monotonic_time();
-			JANUS_LOG(LOG_DBG, "Handled event after %"SCNu64" us\n", now-then);
+		int lost = g_atomic_int_get(&dropped);
+		if(lost > 0 && g_async_queue_length(events) == 0) {
+			/* We caught up, tell how many events we lost in the meanwhile */
+			g_atomic_int_add(&dropped, -lost);
+			JANUS_LOG(LOG_WARN, "Dropped %d events that couldn't be published in time\n", lost);
 		}
 
 		int type = json_integer_value(json_object_get(event, "type"));
-		const char *elabel = janus_events_type_to_label(type);
-		const char *ename = janus_events_type_to_name(type);
-
-		/* Hack to test new functions */
-		if(elabel && ename) {
-			JANUS_LOG(LOG_HUGE, "Event label %s, name %s\n", elabel, ename);
-			json_object_set_new(event, "eventtype", json_string(ename));
-		} else {
-			JANUS_LOG(LOG_WARN, "Can't get event label or name\n");
+		event = janus_mqttevh_prepare_event(event);
+		if(group_events) {
+			/* Group the events we have queued already, as long as they go to the same topic */
+			json_t *group = json_array();
+			json_array_append_new(group, event);
+			while((int)json_array_size(group) < group_max) {
+				next = g_async_queue_try_pop(events);
+				if(next == NULL || next == &exit_event)
+					break;
+				if(ctx->addevent && json_integer_value(json_object_get(next, "type")) != type)
+					break;
+				json_array_append_new(group, janus_mqttevh_prepare_event(next));
+				next = NULL;
+			}
+			event = group;
 		}
 
 		if(!g_atomic_int_get(&stopping)) {
@@ -1213,10 +1309,14 @@ static void *janus_mqttevh_handler(void *data) {
 			} else {
 				janus_mqttevh_send_message(ctx, ctx->publish.topic, event);
 			}
+		} else {
+			json_decref(event);
 		}
 
 		JANUS_LOG(LOG_VERB, "Debug: Thread done publishing MQTT Publish event on %s\n", topicbuf);
 	}
+	if(next != NULL && next != &exit_event)
+		json_decref(next);
 	JANUS_LOG(LOG_VERB, "Leaving MQTTEventHandler handler thread\n");
 	return NULL;
 }
@@ -2,7 +2,14 @@
  * \author Lorenzo Miniero <lorenzo@meetecho.com>
  * \copyright GNU General Public License v3
  * \brief  Janus WebSockets EventHandler plugin
- * \details  This is a trivial WebSockets event handler plugin for Janus
+ * \details  This is a trivial WebSockets event handler plugin for Janus.
+ * Events can be grouped in JSON arrays, either by sending whatever was
+ * queued by the time the connection is writable, or by waiting for a
+ * configurable amount of events or milliseconds, whatever comes first,
+ * which keeps the number of messages low on busy servers. Events are
+ * buffered while reconnecting, and a message that couldn't be sent
+ * completely before the connection was closed is sent again after
+ * reconnecting, so that collector restarts don't cause any loss.
  *
  * \ingroup eventhandlers
  * \ref eventhandlers
@@ -89,7 +96,11 @@ static void janus_wsevh_connect_attempt(lws_sorted_usec_list_t *sul);
 static GQueue *events = NULL;
 static janus_mutex events_mutex = JANUS_MUTEX_INITIALIZER;
 static gboolean group_events = TRUE;
+static volatile gint group_max = 100, group_delay = 0;
+static gint64 events_first = 0;
 static volatile gint events_cap_on_reconnect = 0, dropped = 0;
+/* Message that wasn't (completely) sent when the connection went away */
+static char *unsent = NULL;
 static void janus_wsevh_event_free(json_t *event) {
 	json_decref(event);
 }
@@ -105,6 +116,8 @@ static struct janus_json_parameter request_parameters[] = {
 static struct janus_json_parameter tweak_parameters[] = {
 	{"events", JSON_STRING, 0},
 	{"grouping", JANUS_JSON_BOOL, 0},
+	{"grouping_max", JANUS_JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"grouping_delay", JANUS_JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"events_cap_on_reconnect", JANUS_JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
 };
 /* Error codes (for the tweaking via Admin API */
@@ -160,7 +173,7 @@ static char path[256];
 static int port = 0;
 static struct lws_context *context = NULL;
 #if ((LWS_LIBRARY_VERSION_MAJOR == 3 && LWS_LIBRARY_VERSION_MINOR >= 2) || LWS_LIBRARY_VERSION_MAJOR >= 4)
-static lws_sorted_usec_list_t sul_stagger = { 0 };
+static lws_sorted_usec_list_t sul_stagger = { 0 }, sul_flush = { 0 };
 #endif
 static gint64 disconnected = 0;
 static volatile gint reconnect = 0;
@@ -171,6 +184,7 @@ typedef struct janus_wsevh_client {
 	struct lws *wsi;		/* The libwebsockets client instance */
 	unsigned char *buffer;	/* Buffer containing the message to send */
 	int buflen;				/* Length of the buffer (may be resized after re-allocations) */
+	int msglen;				/* Length of the message currently in the buffer */
 	int bufpending;			/* Data an interrupted previous write couldn't send */
 	int bufoffset;			/* Offset from where the interrupted previous write should resume */
 	janus_mutex mutex;		/* Mutex to lock/unlock this instance */
@@ -191,6 +205,7 @@ static const struct lws_extension exts[] = {
 #endif
 	{ NULL, NULL, NULL }
 };
+static gboolean compress_events = TRUE;
 
 /* WebSockets error management */
 #define CASE_STR(name) case name: return #name
@@ -353,6 +368,33 @@ int janus_wsevh_init(const char *config_path) {
 	if(item && item->value)
 		group_events = janus_is_true(item->value);
 
+	/* How many events can be grouped in a single message, and how long can we wait for them */
+	item = janus_config_get(config, config_general, janus_config_type_item, "grouping_max");
+	if(item && item->value) {
+		int max = atoi(item->value);
+		if(max < 1)
+			JANUS_LOG(LOG_WARN, "Invalid grouping_max value, using default (100)\n");
+		else
+			group_max = max;
+	}
+	item = janus_config_get(config, config_general, janus_config_type_item, "grouping_delay");
+	if(item && item->value) {
+		int delay = atoi(item->value);
+		if(delay < 0)
+			JANUS_LOG(LOG_WARN, "Invalid grouping_delay value, not waiting for events\n");
+		else
+			group_delay = delay;
+	}
+	if(group_events && group_delay > 0) {
+		JANUS_LOG(LOG_INFO, "WebSockets event handler will group up to %d events, waiting up to %dms\n",
+			group_max, group_delay);
+	}
+
+	/* Should we negotiate compression (permessage-deflate)? */
+	item = janus_config_get(config, config_general, janus_config_type_item, "compress");
+	if(item && item->value)
+		compress_events = janus_is_true(item->value);
+
 	/* Do we need to cap the number of queued events when reconnecting */
 	item = janus_config_get(config, config_general, janus_config_type_item, "events_cap_on_reconnect");
 	if(item && item->value)
@@ -460,6 +502,8 @@ void janus_wsevh_destroy(void) {
 
 	g_queue_free_full(events, (GDestroyNotify)janus_wsevh_event_free);
 	events = NULL;
+	free(unsent);
+	unsent = NULL;
 
 	g_atomic_int_set(&initialized, 0);
 	g_atomic_int_set(&stopping, 0);
@@ -509,8 +553,18 @@ void janus_wsevh_incoming_event(json_t *event) {
 	 * when the event actually happened on this machine, so that, if relevant, we can compute
 	 * any delay in the actual event processing ourselves. */
 	json_incref(event);
+	gboolean notify = TRUE;
 	janus_mutex_lock(&events_mutex);
 	g_queue_push_tail(events, event);
+	guint queued = g_queue_get_length(events);
+	if(queued == 1) {
+		/* Start of a new group */
+		events_first = janus_get_monotonic_time();
+	} else if(group_events && g_atomic_int_get(&group_delay) > 0 && queued < (guint)g_atomic_int_get(&group_max)) {
+		/* The thread was already notified when this group started, and will
+		 * send it when either it's large enough or the delay expired */
+		notify = FALSE;
+	}
 	if(g_atomic_int_get(&reconnect)) {
 		/* We're reconnecting: check if there's a cap to how many events to keep in the buffer */
 		guint cap = g_atomic_int_get(&events_cap_on_reconnect);
@@ -525,6 +579,8 @@ void janus_wsevh_incoming_event(json_t *event) {
 		}
 	}
 	janus_mutex_unlock(&events_mutex);
+	if(!notify)
+		return;
 	/* We notify the websocket thread so that it can be handled */
 #if (LWS_LIBRARY_VERSION_MAJOR >= 3)
 		if(context != NULL)
@@ -565,6 +621,10 @@ json_t *janus_wsevh_handle_request(json_t *request) {
 		/* Grouping */
 		if(json_object_get(request, "grouping"))
 			group_events = json_is_true(json_object_get(request, "grouping"));
+		if(json_integer_value(json_object_get(request, "grouping_max")) > 0)
+			g_atomic_int_set(&group_max, json_integer_value(json_object_get(request, "grouping_max")));
+		if(json_object_get(request, "grouping_delay"))
+			g_atomic_int_set(&group_delay, json_integer_value(json_object_get(request, "grouping_delay")));
 		/* Whether we should put a cap on queued events when reconnecting */
 		if(json_object_get(request, "events_cap_on_reconnect"))
 			g_atomic_int_set(&events_cap_on_reconnect, json_integer_value(json_object_get(request, "events_cap_on_reconnect")));
@@ -615,6 +675,16 @@ static void *janus_wsevh_thread(void *data) {
 		/* Loop until we have to stop */
 		if(!g_atomic_int_get(&reconnect)) {
 			lws_service(context, 50);
+			/* Check if there's a group of events waiting for its delay to expire */
+			if(g_atomic_int_get(&group_delay) > 0) {
+				janus_mutex_lock(&events_mutex);
+				gboolean pending = !g_queue_is_empty(events);
+				janus_mutex_unlock(&events_mutex);
+				janus_mutex_lock(&writable_mutex);
+				if(pending && wsi != NULL)
+					lws_callback_on_writable(wsi);
+				janus_mutex_unlock(&writable_mutex);
+			}
 		} else {
 			/* We should reconnect, get rid of the previous context */
 			if(reconnect_delay > 0) {
@@ -640,13 +710,34 @@ static void *janus_wsevh_thread(void *data) {
 }
 #endif
 
+/* Helper function to check how long we should still wait before sending
+ * the queued events, when grouping with a delay (must be called with
+ * the events mutex locked): returns 0 if they can be sent right away */
+static gint64 janus_wsevh_group_wait(void) {
+	int delay = g_atomic_int_get(&group_delay);
+	if(!group_events || delay == 0 || g_queue_is_empty(events))
+		return 0;
+	if(g_queue_get_length(events) >= (guint)g_atomic_int_get(&group_max))
+		return 0;
+	gint64 waited = janus_get_monotonic_time() - events_first;
+	return (waited >= (gint64)delay*1000) ? 0 : ((gint64)delay*1000 - waited);
+}
+
+#if (LWS_LIBRARY_VERSION_MAJOR >= 3 && LWS_LIBRARY_VERSION_MINOR >= 2) || (LWS_LIBRARY_VERSION_MAJOR >= 4)
+/* Scheduled when a group of events is waiting for its delay to expire */
+static void janus_wsevh_flush(lws_sorted_usec_list_t *sul) {
+	if(ws_client != NULL && ws_client->wsi != NULL)
+		lws_callback_on_writable(ws_client->wsi);
+}
+#endif
+
 /* Helper function to pop events from the queue and turn them to string for delivery */
 static char *janus_wsevh_stringify_events(void) {
 	if(!g_atomic_int_get(&initialized) || g_atomic_int_get(&stopping))
 		return NULL;
 	json_t *event = NULL, *output = NULL;
 	char *event_text = NULL;
-	int count = 0, max = group_events ? 100 : 1;
+	int count = 0, max = group_events ? g_atomic_int_get(&group_max) : 1;
 
 	/* Pop the first queued event */
 	janus_mutex_lock(&events_mutex);
@@ -689,6 +780,10 @@ static char *janus_wsevh_stringify_events(void) {
 		if(event == NULL)
 			break;
 	}
+	/* Whatever is left in the queue is late already, so don't wait for more */
+	janus_mutex_lock(&events_mutex);
+	events_first = 0;
+	janus_mutex_unlock(&events_mutex);
 
 	if(!g_atomic_int_get(&stopping)) {
 		/* Since this a simple plugin, it does the same for all events: so just convert to string... */
@@ -716,6 +811,7 @@ static int janus_wsevh_callback(struct lws *wsi, enum lws_callback_reasons reaso
 			ws_client->wsi = wsi;
 			ws_client->buffer = NULL;
 			ws_client->buflen = 0;
+			ws_client->msglen = 0;
 			ws_client->bufpending = 0;
 			ws_client->bufoffset = 0;
 			reconnect_delay = 0;
@@ -778,8 +874,22 @@ static int janus_wsevh_callback(struct lws *wsi, enum lws_callback_reasons reaso
 					janus_mutex_unlock(&ws_client->mutex);
 					return 0;
 				}
-				/* Shoot all the pending messages */
-				char *event = janus_wsevh_stringify_events();
+				/* If we're grouping events with a delay, check if it's time to send them */
+				janus_mutex_lock(&events_mutex);
+				gint64 wait = unsent ? 0 : janus_wsevh_group_wait();
+				janus_mutex_unlock(&events_mutex);
+				if(wait > 0) {
+#if (LWS_LIBRARY_VERSION_MAJOR >= 3 && LWS_LIBRARY_VERSION_MINOR >= 2) || (LWS_LIBRARY_VERSION_MAJOR >= 4)
+					lws_sul_schedule(context, 0, &sul_flush, janus_wsevh_flush, wait);
+#endif
+					janus_mutex_unlock(&ws_client->mutex);
+					return 0;
+				}
+				/* Shoot all the pending messages, starting from the one we couldn't send before reconnecting */
+				char *event = unsent;
+				unsent = NULL;
+				if(event == NULL)
+					event = janus_wsevh_stringify_events();
 				if(event && !g_atomic_int_get(&stopping)) {
 					/* Gotcha! */
 					int buflen = LWS_PRE + strlen(event);
@@ -796,10 +906,17 @@ static int janus_wsevh_callback(struct lws *wsi, enum lws_callback_reasons reaso
 						ws_client->buffer = g_realloc(ws_client->buffer, buflen);
 					}
 					memcpy(ws_client->buffer + LWS_PRE, event, strlen(event));
+					ws_client->msglen = strlen(event);
 					JANUS_LOG(LOG_VERB, "Sending WebSocket message (%zu bytes)...\n", strlen(event));
 					int sent = lws_write(wsi, ws_client->buffer + LWS_PRE, strlen(event), LWS_WRITE_TEXT);
 					JANUS_LOG(LOG_VERB, "  -- Sent %d/%zu bytes\n", sent, strlen(event));
-					if(sent > -1 && sent < (int)strlen(event)) {
+					if(sent < 0) {
+						/* The connection is going away, keep the message for when we reconnect */
+						ws_client->msglen = 0;
+						unsent = event;
+						janus_mutex_unlock(&ws_client->mutex);
+						return 0;
+					} else if(sent < (int)strlen(event)) {
 						/* We couldn't send everything in a single write, we'll complete this in the next round */
 						ws_client->bufpending = strlen(event) - sent;
 						ws_client->bufoffset = LWS_PRE + sent;
@@ -829,10 +946,19 @@ static int janus_wsevh_callback(struct lws *wsi, enum lws_callback_reasons reaso
 				janus_mutex_lock(&ws_client->mutex);
 				JANUS_LOG(LOG_INFO, "Destroying WebSocketsEventHandler client\n");
 				ws_client->wsi = NULL;
+				if(ws_client->bufpending > 0 && ws_client->msglen > 0 && unsent == NULL) {
+					/* We didn't complete the last message: the backend will discard
+					 * the fragment, so we'll send it again after reconnecting (we use
+					 * malloc, as that's what json_dumps uses for messages as well) */
+					unsent = malloc(ws_client->msglen + 1);
+					memcpy(unsent, ws_client->buffer + LWS_PRE, ws_client->msglen);
+					unsent[ws_client->msglen] = '\0';
+				}
 				/* Free the shared buffers */
 				g_free(ws_client->buffer);
 				ws_client->buffer = NULL;
 				ws_client->buflen = 0;
+				ws_client->msglen = 0;
 				ws_client->bufpending = 0;
 				ws_client->bufoffset = 0;
 				janus_mutex_unlock(&ws_client->mutex);
@@ -866,7 +992,7 @@ static void janus_wsevh_connect_attempt(lws_sorted_usec_list_t *sul) {
 	if(!strcasecmp(protocol, "wss"))
 		i.ssl_connection = 1;
 	i.ietf_version_or_minus_one = -1;
-	i.client_exts = exts;
+	i.client_exts = compress_events ? exts : NULL;
 	i.protocol = protocols[0].name;
 	JANUS_LOG(LOG_INFO, "WebSocketsEventHandler: Connecting to backend websocket server %s:%d...\n", address, port);
 	wsi = lws_client_connect_via_info(&i);
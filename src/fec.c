@@ -0,0 +1,174 @@
+/*! \file    fec.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    FlexFEC generation
+ * \details  Implementation of a simple FlexFEC (draft-ietf-payload-flexible-fec-scheme-03,
+ * the version browsers implement) generator. Outgoing video packets are
+ * grouped in sets of consecutive sequence numbers, and when a group is
+ * complete a single XOR based repair packet is generated and sent on a
+ * separate SSRC: this allows the recipient to recover one lost packet
+ * per group without waiting for a retransmission, which is useful on
+ * lossy links with a high RTT where NACKs would end up being too late.
+ * The size of the groups (and so the overhead) can be changed at any
+ * time, e.g., depending on the loss the recipient is reporting.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include "fec.h"
+#include "debug.h"
+#include "rtp.h"
+
+/* Largest media packet payload (anything after the fixed RTP header) we can protect */
+#define JANUS_FEC_MAX_PAYLOAD	1500
+
+struct janus_fec_context {
+	/* SSRC, payload type and sequence number of the FEC packets */
+	guint32 ssrc;
+	int pt;
+	guint16 seq;
+	/* How many media packets each FEC packet protects (0 means disabled) */
+	volatile gint group_size;
+	/* Current group */
+	int count;
+	guint32 media_ssrc;
+	guint16 base_seq, last_seq;
+	guint32 last_ts;
+	guint8 bits[2];
+	guint16 length;
+	guint32 ts;
+	guint16 mask;
+	int payload_len;
+	guint8 payload[JANUS_FEC_MAX_PAYLOAD];
+	/* Stats */
+	volatile gint fec_packets, protected_packets;
+};
+
+static void janus_fec_context_reset(janus_fec_context *fec) {
+	fec->count = 0;
+	fec->bits[0] = 0;
+	fec->bits[1] = 0;
+	fec->length = 0;
+	fec->ts = 0;
+	fec->mask = 0;
+	fec->payload_len = 0;
+}
+
+janus_fec_context *janus_fec_context_create(guint32 ssrc, int pt) {
+	janus_fec_context *fec = g_malloc0(sizeof(janus_fec_context));
+	fec->ssrc = ssrc;
+	fec->pt = pt;
+	fec->seq = g_random_int_range(0, G_MAXUINT16);
+	return fec;
+}
+
+void janus_fec_context_destroy(janus_fec_context *fec) {
+	g_free(fec);
+}
+
+void janus_fec_context_set_group_size(janus_fec_context *fec, int size) {
+	if(fec == NULL)
+		return;
+	if(size < 0)
+		size = 0;
+	else if(size > JANUS_FEC_MAX_GROUP_SIZE)
+		size = JANUS_FEC_MAX_GROUP_SIZE;
+	if(g_atomic_int_get(&fec->group_size) == size)
+		return;
+	g_atomic_int_set(&fec->group_size, size);
+	janus_fec_context_reset(fec);
+}
+
+int janus_fec_context_get_group_size(janus_fec_context *fec) {
+	return fec ? g_atomic_int_get(&fec->group_size) : 0;
+}
+
+int janus_fec_context_protect(janus_fec_context *fec, char *packet, int len, char *buffer, int size) {
+	if(fec == NULL || packet == NULL || len < 12 || buffer == NULL)
+		return -1;
+	int group_size = g_atomic_int_get(&fec->group_size);
+	if(group_size == 0)
+		return 0;
+	janus_rtp_header *rtp = (janus_rtp_header *)packet;
+	guint32 ssrc = ntohl(rtp->ssrc);
+	guint16 seq = ntohs(rtp->seq_number);
+	int plen = len - 12;
+	if(plen > JANUS_FEC_MAX_PAYLOAD) {
+		/* Too large, we'll start a new group after this packet */
+		janus_fec_context_reset(fec);
+		return 0;
+	}
+	/* Groups are made of consecutive packets: if there's a gap
+	 * (e.g., because of a switch in the plugin), start over */
+	if(fec->count > 0 && (ssrc != fec->media_ssrc || seq != (guint16)(fec->last_seq + 1)))
+		janus_fec_context_reset(fec);
+	if(fec->count == 0) {
+		fec->media_ssrc = ssrc;
+		fec->base_seq = seq;
+	}
+	/* XOR the header fields and the payload of this packet into the group */
+	guint16 offset = seq - fec->base_seq;
+	fec->bits[0] ^= (guint8)packet[0];
+	fec->bits[1] ^= (guint8)packet[1];
+	fec->length ^= (guint16)plen;
+	fec->ts ^= ntohl(rtp->timestamp);
+	if(plen > fec->payload_len) {
+		memset(fec->payload + fec->payload_len, 0, plen - fec->payload_len);
+		fec->payload_len = plen;
+	}
+	guint8 *payload = (guint8 *)packet + 12;
+	int i = 0;
+	for(i=0; i<plen; i++)
+		fec->payload[i] ^= payload[i];
+	fec->mask |= (0x4000 >> offset);
+	fec->last_seq = seq;
+	fec->last_ts = ntohl(rtp->timestamp);
+	fec->count++;
+	g_atomic_int_inc(&fec->protected_packets);
+	if(fec->count < group_size)
+		return 0;
+	/* The group is complete, generate the FEC packet */
+	int total = 12 + JANUS_FEC_HEADER_SIZE + fec->payload_len;
+	if(total > size) {
+		JANUS_LOG(LOG_WARN, "Buffer too small for FEC packet (%d < %d)\n", size, total);
+		janus_fec_context_reset(fec);
+		return -1;
+	}
+	memset(buffer, 0, 12 + JANUS_FEC_HEADER_SIZE);
+	janus_rtp_header *header = (janus_rtp_header *)buffer;
+	header->version = 2;
+	header->type = fec->pt;
+	header->seq_number = htons(fec->seq);
+	fec->seq++;
+	header->timestamp = htonl(fec->last_ts);
+	header->ssrc = htonl(fec->ssrc);
+	guint8 *fh = (guint8 *)buffer + 12;
+	/* R and F bits are 0: the mask follows the SN base, with a single SSRC */
+	fh[0] = fec->bits[0] & 0x3F;
+	fh[1] = fec->bits[1];
+	guint16 length = htons(fec->length);
+	memcpy(fh + 2, &length, sizeof(length));
+	guint32 ts = htonl(fec->ts);
+	memcpy(fh + 4, &ts, sizeof(ts));
+	fh[8] = 1;
+	guint32 media_ssrc = htonl(fec->media_ssrc);
+	memcpy(fh + 12, &media_ssrc, sizeof(media_ssrc));
+	guint16 base_seq = htons(fec->base_seq);
+	memcpy(fh + 16, &base_seq, sizeof(base_seq));
+	/* Setting the K bit means the mask ends here (15 bits) */
+	guint16 mask = htons(0x8000 | fec->mask);
+	memcpy(fh + 18, &mask, sizeof(mask));
+	memcpy(fh + JANUS_FEC_HEADER_SIZE, fec->payload, fec->payload_len);
+	janus_fec_context_reset(fec);
+	g_atomic_int_inc(&fec->fec_packets);
+	return total;
+}
+
+void janus_fec_context_summary(janus_fec_context *fec, json_t *info) {
+	if(fec == NULL || info == NULL)
+		return;
+	json_object_set_new(info, "group-size", json_integer(g_atomic_int_get(&fec->group_size)));
+	json_object_set_new(info, "protected-packets", json_integer(g_atomic_int_get(&fec->protected_packets)));
+	json_object_set_new(info, "fec-packets", json_integer(g_atomic_int_get(&fec->fec_packets)));
+}
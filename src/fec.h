@@ -0,0 +1,69 @@
+/*! \file    fec.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    FlexFEC generation (headers)
+ * \details  Implementation of a simple FlexFEC (draft-ietf-payload-flexible-fec-scheme-03,
+ * the version browsers implement) generator. Outgoing video packets are
+ * grouped in sets of consecutive sequence numbers, and when a group is
+ * complete a single XOR based repair packet is generated and sent on a
+ * separate SSRC: this allows the recipient to recover one lost packet
+ * per group without waiting for a retransmission, which is useful on
+ * lossy links with a high RTT where NACKs would end up being too late.
+ * The size of the groups (and so the overhead) can be changed at any
+ * time, e.g., depending on the loss the recipient is reporting.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef JANUS_FEC_H
+#define JANUS_FEC_H
+
+#include <glib.h>
+#include <jansson.h>
+
+/*! \brief Maximum number of media packets a single FEC packet can protect (we only use the first mask) */
+#define JANUS_FEC_MAX_GROUP_SIZE	15
+/*! \brief Size of the FlexFEC header we generate (single SSRC, 16-bit mask) */
+#define JANUS_FEC_HEADER_SIZE		20
+
+/*! \brief Opaque FEC generation context */
+typedef struct janus_fec_context janus_fec_context;
+
+/*! \brief Create a new FEC generation context
+ * @param[in] ssrc The SSRC to use for the FEC packets
+ * @param[in] pt The payload type to use for the FEC packets
+ * @returns A pointer to a new janus_fec_context instance */
+janus_fec_context *janus_fec_context_create(guint32 ssrc, int pt);
+/*! \brief Destroy an existing FEC generation context
+ * @param[in] fec The janus_fec_context instance to destroy */
+void janus_fec_context_destroy(janus_fec_context *fec);
+
+/*! \brief Change how many media packets each FEC packet should protect
+ * \note Changing the size resets the current group
+ * @param[in] fec The janus_fec_context instance to update
+ * @param[in] size The new size of the groups (0 disables FEC generation, at most \ref JANUS_FEC_MAX_GROUP_SIZE) */
+void janus_fec_context_set_group_size(janus_fec_context *fec, int size);
+/*! \brief Get how many media packets each FEC packet is currently protecting
+ * @param[in] fec The janus_fec_context instance to query
+ * @returns The current size of the groups, or 0 if FEC generation is disabled */
+int janus_fec_context_get_group_size(janus_fec_context *fec);
+
+/*! \brief Add an outgoing media packet to the current group, and generate a FEC packet if the group is complete
+ * \note The media packet must be passed unencrypted, and as it will be sent
+ * (that is, with the SSRC and extensions already updated); the FEC packet
+ * will have to be encrypted as any other RTP packet before being sent
+ * @param[in] fec The janus_fec_context instance to use
+ * @param[in] packet The media packet to protect
+ * @param[in] len The length of the media packet
+ * @param[out] buffer The buffer to write the FEC packet to, if one is generated
+ * @param[in] size The size of the buffer
+ * @returns The length of the FEC packet, if one was generated, 0 if not, or -1 in case of errors */
+int janus_fec_context_protect(janus_fec_context *fec, char *packet, int len, char *buffer, int size);
+
+/*! \brief Helper method to get some info on the FEC generation context, for the Admin API
+ * @param[in] fec The janus_fec_context instance to query
+ * @param[in] info The JSON object to add the info to */
+void janus_fec_context_summary(janus_fec_context *fec, json_t *info);
+
+#endif
@@ -0,0 +1,935 @@
+/*! \file    ice-mux.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Shared UDP sockets for ICE Lite PeerConnections
+ * \details  Implementation of a single-port UDP mux for PeerConnections,
+ * that can be used when Janus is configured in ICE Lite mode. Rather than
+ * having libnice bind new sockets for each handle, one or more sockets
+ * (all bound to the same port via SO_REUSEPORT) are created for each local
+ * address at startup, and shared by all PeerConnections. Incoming STUN
+ * connectivity checks are demultiplexed by the local ICE username fragment
+ * and answered right away, while the validated remote addresses are then
+ * used to demultiplex all other traffic (DTLS, RTP, RTCP) by 5-tuple.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#if defined(HAVE_RECVMMSG) || defined(HAVE_SENDMMSG)
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		/* Needed for recvmmsg/sendmmsg */
+#endif
+#endif
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#ifdef HAVE_UDP_GSO
+#include <netinet/udp.h>
+#endif
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <zlib.h>
+#include <openssl/hmac.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+
+#include "ice-mux.h"
+#include "debug.h"
+#include "mutex.h"
+#include "refcount.h"
+#include "utils.h"
+
+/* STUN constants we need to answer connectivity checks */
+#define JANUS_ICE_MUX_STUN_COOKIE			0x2112A442
+#define JANUS_ICE_MUX_STUN_HEADER			20
+#define JANUS_ICE_MUX_STUN_BINDING_REQUEST	0x0001
+#define JANUS_ICE_MUX_STUN_BINDING_SUCCESS	0x0101
+#define JANUS_ICE_MUX_STUN_USERNAME			0x0006
+#define JANUS_ICE_MUX_STUN_INTEGRITY		0x0008
+#define JANUS_ICE_MUX_STUN_XOR_ADDRESS		0x0020
+#define JANUS_ICE_MUX_STUN_USE_CANDIDATE	0x0025
+#define JANUS_ICE_MUX_STUN_FINGERPRINT		0x8028
+#define JANUS_ICE_MUX_STUN_FINGERPRINT_XOR	0x5354554e
+
+/* How many packets we try to read in a single call, and how large they can be */
+#define JANUS_ICE_MUX_BATCH		32
+#define JANUS_ICE_MUX_BUFSIZE	1500
+/* Same thing when receive offload (UDP GRO) is enabled, where reads can be much larger */
+#define JANUS_ICE_MUX_GRO_BATCH		8
+#define JANUS_ICE_MUX_GRO_BUFSIZE	65536
+/* How many datagrams (and bytes) we pass to the kernel in a single segmentation offload (UDP GSO) send */
+#define JANUS_ICE_MUX_GSO_SEGMENTS	64
+#define JANUS_ICE_MUX_GSO_MAX_BYTES	65000
+/* How many remote addresses we accept checks from for the same PeerConnection */
+#define JANUS_ICE_MUX_MAX_ADDRESSES	16
+
+/* Local address the mux sockets are bound to */
+typedef struct janus_ice_mux_address {
+	guint index;
+	gchar *ip;
+	NiceAddress addr;
+	struct sockaddr_storage bound;
+	socklen_t boundlen;
+} janus_ice_mux_address;
+
+/* Shared socket, served by its own thread */
+typedef struct janus_ice_mux_socket {
+	guint id;
+	janus_ice_mux_address *address;
+	int fd;
+	GThread *thread;
+	/* Stats (only updated by the thread of the socket) */
+	guint64 packets, bytes, checks, unknown, coalesced;
+} janus_ice_mux_socket;
+
+/* Key for the 5-tuple table: the index of the local address, and the remote address/port */
+typedef struct janus_ice_mux_key {
+	guint index;
+	guint16 family, port;
+	guint8 addr[16];
+} janus_ice_mux_key;
+static guint janus_ice_mux_key_hash(gconstpointer v) {
+	const guint8 *p = (const guint8 *)v;
+	guint hash = 2166136261u, i = 0;
+	for(i=0; i<sizeof(janus_ice_mux_key); i++)
+		hash = (hash ^ p[i]) * 16777619u;
+	return hash;
+}
+static gboolean janus_ice_mux_key_equal(gconstpointer a, gconstpointer b) {
+	return memcmp(a, b, sizeof(janus_ice_mux_key)) == 0;
+}
+static void janus_ice_mux_key_init(janus_ice_mux_key *key, guint index, struct sockaddr_storage *addr) {
+	memset(key, 0, sizeof(*key));
+	key->index = index;
+	key->family = addr->ss_family;
+	if(addr->ss_family == AF_INET) {
+		struct sockaddr_in *sin = (struct sockaddr_in *)addr;
+		key->port = sin->sin_port;
+		memcpy(key->addr, &sin->sin_addr, sizeof(sin->sin_addr));
+	} else if(addr->ss_family == AF_INET6) {
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)addr;
+		key->port = sin6->sin6_port;
+		memcpy(key->addr, &sin6->sin6_addr, sizeof(sin6->sin6_addr));
+	}
+}
+
+/* PeerConnection registered in the mux */
+struct janus_ice_mux_conn {
+	void *handle;
+	GDestroyNotify notify;
+	gchar *ufrag, *pwd;
+	/* Remote addresses we validated so far (keys owned by the 5-tuple table) */
+	GList *keys;
+	/* Candidate pair the peer nominated, if any */
+	gboolean nominated;
+	janus_ice_mux_socket *socket;
+	struct sockaddr_storage remote;
+	socklen_t remotelen;
+	janus_mutex mutex;
+	volatile gint removed;
+	janus_refcount ref;
+};
+static void janus_ice_mux_conn_free(const janus_refcount *conn_ref) {
+	janus_ice_mux_conn *conn = janus_refcount_containerof(conn_ref, janus_ice_mux_conn, ref);
+	if(conn->notify != NULL)
+		conn->notify(conn->handle);
+	g_free(conn->ufrag);
+	g_free(conn->pwd);
+	g_list_free(conn->keys);
+	janus_mutex_destroy(&conn->mutex);
+	g_free(conn);
+}
+static void janus_ice_mux_conn_unref(gpointer data) {
+	janus_ice_mux_conn *conn = (janus_ice_mux_conn *)data;
+	janus_refcount_decrease(&conn->ref);
+}
+
+/* Mux state */
+static gboolean mux_enabled = FALSE;
+static uint16_t mux_port = 0;
+static GList *mux_addresses = NULL;
+static janus_ice_mux_socket *mux_sockets = NULL;
+static guint mux_sockets_num = 0;
+static volatile gint mux_stopping = 0;
+/* Whether we use receive (GRO) and segmentation (GSO) offload on the sockets */
+static gboolean mux_gro = FALSE;
+static volatile gint mux_gso = 0;
+static volatile gint gso_sends = 0;
+static janus_ice_mux_incoming_callback incoming_cb = NULL;
+static janus_ice_mux_nominated_callback nominated_cb = NULL;
+/* PeerConnections, indexed by local ufrag and by validated 5-tuple */
+static janus_rwlock conns_rwlock;
+static GHashTable *conns_byufrag = NULL, *conns_byaddr = NULL;
+static volatile gint conns_count = 0;
+
+/* STUN helpers */
+static gboolean janus_ice_mux_is_stun(char *buf, int len) {
+	if(len < JANUS_ICE_MUX_STUN_HEADER || (buf[0] & 0xC0) != 0)
+		return FALSE;
+	uint32_t cookie = 0;
+	memcpy(&cookie, buf+4, sizeof(cookie));
+	return ntohl(cookie) == JANUS_ICE_MUX_STUN_COOKIE;
+}
+static int janus_ice_mux_stun_attribute(char *buf, int offset, uint16_t type, const void *value, uint16_t len) {
+	uint16_t t = htons(type), l = htons(len);
+	memcpy(buf+offset, &t, sizeof(t));
+	memcpy(buf+offset+2, &l, sizeof(l));
+	if(value != NULL && len > 0)
+		memcpy(buf+offset+4, value, len);
+	int padded = (len + 3) & ~3;
+	if(padded > len)
+		memset(buf+offset+4+len, 0, padded-len);
+	return offset + 4 + padded;
+}
+static void janus_ice_mux_stun_set_length(char *buf, int length) {
+	uint16_t l = htons(length - JANUS_ICE_MUX_STUN_HEADER);
+	memcpy(buf+2, &l, sizeof(l));
+}
+/* Check the MESSAGE-INTEGRITY of a request, which precedes FINGERPRINT (if any) */
+static gboolean janus_ice_mux_stun_check_integrity(char *buf, int mi_offset, const char *pwd) {
+	char copy[JANUS_ICE_MUX_BUFSIZE];
+	if(mi_offset > (int)sizeof(copy))
+		return FALSE;
+	memcpy(copy, buf, mi_offset);
+	/* The length must cover the MESSAGE-INTEGRITY attribute itself */
+	janus_ice_mux_stun_set_length(copy, mi_offset + 24);
+	unsigned char digest[EVP_MAX_MD_SIZE];
+	unsigned int dlen = 0;
+	if(HMAC(EVP_sha1(), pwd, strlen(pwd), (unsigned char *)copy, mi_offset, digest, &dlen) == NULL || dlen != 20)
+		return FALSE;
+	return CRYPTO_memcmp(digest, buf+mi_offset+4, 20) == 0;
+}
+
+/* Answer a STUN Binding request, if it's for one of the PeerConnections we know */
+static void janus_ice_mux_handle_stun(janus_ice_mux_socket *s, char *buf, int len,
+		struct sockaddr_storage *from, socklen_t fromlen) {
+	uint16_t type = 0, msglen = 0;
+	memcpy(&type, buf, sizeof(type));
+	memcpy(&msglen, buf+2, sizeof(msglen));
+	type = ntohs(type);
+	msglen = ntohs(msglen);
+	if(type != JANUS_ICE_MUX_STUN_BINDING_REQUEST || JANUS_ICE_MUX_STUN_HEADER + msglen > len)
+		return;
+	/* Look for the attributes we care about */
+	char username[513];
+	username[0] = '\0';
+	int offset = JANUS_ICE_MUX_STUN_HEADER, end = JANUS_ICE_MUX_STUN_HEADER + msglen, mi_offset = -1;
+	gboolean use_candidate = FALSE;
+	while(offset + 4 <= end) {
+		uint16_t atype = 0, alen = 0;
+		memcpy(&atype, buf+offset, sizeof(atype));
+		memcpy(&alen, buf+offset+2, sizeof(alen));
+		atype = ntohs(atype);
+		alen = ntohs(alen);
+		if(offset + 4 + alen > end)
+			return;
+		if(mi_offset < 0) {
+			/* Anything after MESSAGE-INTEGRITY is ignored, except FINGERPRINT */
+			if(atype == JANUS_ICE_MUX_STUN_USERNAME && alen < sizeof(username)) {
+				memcpy(username, buf+offset+4, alen);
+				username[alen] = '\0';
+			} else if(atype == JANUS_ICE_MUX_STUN_USE_CANDIDATE) {
+				use_candidate = TRUE;
+			} else if(atype == JANUS_ICE_MUX_STUN_INTEGRITY && alen == 20) {
+				mi_offset = offset;
+			}
+		}
+		offset += 4 + ((alen + 3) & ~3);
+	}
+	if(username[0] == '\0' || mi_offset < 0) {
+		JANUS_LOG(LOG_HUGE, "[ice-mux#%u] Ignoring STUN request without USERNAME or MESSAGE-INTEGRITY\n", s->id);
+		return;
+	}
+	/* The USERNAME is in the "local:remote" format, find the PeerConnection */
+	char *colon = strchr(username, ':');
+	if(colon != NULL)
+		*colon = '\0';
+	janus_rwlock_read_lock(&conns_rwlock);
+	janus_ice_mux_conn *conn = g_hash_table_lookup(conns_byufrag, username);
+	if(conn != NULL)
+		janus_refcount_increase(&conn->ref);
+	janus_rwlock_read_unlock(&conns_rwlock);
+	if(conn == NULL) {
+		JANUS_LOG(LOG_HUGE, "[ice-mux#%u] Ignoring STUN request for unknown ufrag %s\n", s->id, username);
+		s->unknown++;
+		return;
+	}
+	janus_mutex_lock(&conn->mutex);
+	gchar *pwd = g_strdup(conn->pwd);
+	janus_mutex_unlock(&conn->mutex);
+	if(!janus_ice_mux_stun_check_integrity(buf, mi_offset, pwd)) {
+		JANUS_LOG(LOG_HUGE, "[ice-mux#%u] Invalid MESSAGE-INTEGRITY in STUN request for ufrag %s\n", s->id, username);
+		g_free(pwd);
+		janus_refcount_decrease(&conn->ref);
+		return;
+	}
+	s->checks++;
+	/* Prepare the Binding success response */
+	char response[128];
+	uint16_t rtype = htons(JANUS_ICE_MUX_STUN_BINDING_SUCCESS);
+	memcpy(response, &rtype, sizeof(rtype));
+	memcpy(response+4, buf+4, 16);	/* Magic cookie and transaction ID */
+	uint8_t xaddr[20];
+	memset(xaddr, 0, sizeof(xaddr));
+	uint32_t cookie = htonl(JANUS_ICE_MUX_STUN_COOKIE);
+	int i = 0, xlen = 0;
+	if(from->ss_family == AF_INET) {
+		struct sockaddr_in *sin = (struct sockaddr_in *)from;
+		xaddr[1] = 0x01;
+		uint16_t xport = sin->sin_port ^ (uint16_t)(cookie & 0xFFFF);
+		memcpy(xaddr+2, &xport, sizeof(xport));
+		uint32_t xip = sin->sin_addr.s_addr ^ cookie;
+		memcpy(xaddr+4, &xip, sizeof(xip));
+		xlen = 8;
+	} else {
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)from;
+		xaddr[1] = 0x02;
+		uint16_t xport = sin6->sin6_port ^ (uint16_t)(cookie & 0xFFFF);
+		memcpy(xaddr+2, &xport, sizeof(xport));
+		for(i=0; i<16; i++)
+			xaddr[4+i] = sin6->sin6_addr.s6_addr[i] ^ (uint8_t)response[4+i];
+		xlen = 20;
+	}
+	int rlen = janus_ice_mux_stun_attribute(response, JANUS_ICE_MUX_STUN_HEADER,
+		JANUS_ICE_MUX_STUN_XOR_ADDRESS, xaddr, xlen);
+	/* Add MESSAGE-INTEGRITY, using the same credentials */
+	unsigned char digest[EVP_MAX_MD_SIZE];
+	unsigned int dlen = 0;
+	janus_ice_mux_stun_set_length(response, rlen + 24);
+	HMAC(EVP_sha1(), pwd, strlen(pwd), (unsigned char *)response, rlen, digest, &dlen);
+	g_free(pwd);
+	rlen = janus_ice_mux_stun_attribute(response, rlen, JANUS_ICE_MUX_STUN_INTEGRITY, digest, 20);
+	/* Add FINGERPRINT */
+	janus_ice_mux_stun_set_length(response, rlen + 8);
+	uint32_t fp = htonl((uint32_t)crc32(0L, (const Bytef *)response, rlen) ^ JANUS_ICE_MUX_STUN_FINGERPRINT_XOR);
+	rlen = janus_ice_mux_stun_attribute(response, rlen, JANUS_ICE_MUX_STUN_FINGERPRINT, &fp, sizeof(fp));
+	if(sendto(s->fd, response, rlen, 0, (struct sockaddr *)from, fromlen) < 0) {
+		JANUS_LOG(LOG_WARN, "[ice-mux#%u] Error sending STUN response: %d (%s)\n", s->id, errno, g_strerror(errno));
+	}
+	/* The check succeeded, so we can accept traffic from this address */
+	janus_ice_mux_key key;
+	janus_ice_mux_key_init(&key, s->address->index, from);
+	janus_rwlock_read_lock(&conns_rwlock);
+	gboolean known = (g_hash_table_lookup(conns_byaddr, &key) == conn);
+	janus_rwlock_read_unlock(&conns_rwlock);
+	if(!known) {
+		janus_rwlock_write_lock(&conns_rwlock);
+		gpointer old_key = NULL, old_conn = NULL;
+		if(!g_atomic_int_get(&conn->removed) && g_list_length(conn->keys) < JANUS_ICE_MUX_MAX_ADDRESSES) {
+			if(g_hash_table_lookup_extended(conns_byaddr, &key, &old_key, &old_conn)) {
+				/* This address was used by a different PeerConnection, take it over */
+				janus_ice_mux_conn *prev = (janus_ice_mux_conn *)old_conn;
+				prev->keys = g_list_remove(prev->keys, old_key);
+				g_hash_table_remove(conns_byaddr, old_key);
+			}
+			janus_ice_mux_key *new_key = g_memdup(&key, sizeof(key));
+			janus_refcount_increase(&conn->ref);
+			g_hash_table_insert(conns_byaddr, new_key, conn);
+			conn->keys = g_list_prepend(conn->keys, new_key);
+		}
+		janus_rwlock_write_unlock(&conns_rwlock);
+	}
+	/* If the peer nominated this pair, it's where we'll send our traffic to */
+	if(use_candidate && !g_atomic_int_get(&conn->removed)) {
+		gboolean changed = FALSE;
+		janus_mutex_lock(&conn->mutex);
+		if(!conn->nominated || conn->socket->address != s->address ||
+				conn->remotelen != fromlen || memcmp(&conn->remote, from, fromlen)) {
+			conn->nominated = TRUE;
+			conn->socket = s;
+			memcpy(&conn->remote, from, fromlen);
+			conn->remotelen = fromlen;
+			changed = TRUE;
+		}
+		janus_mutex_unlock(&conn->mutex);
+		if(changed && nominated_cb != NULL)
+			nominated_cb(conn->handle);
+	}
+	janus_refcount_decrease(&conn->ref);
+}
+
+/* Process a packet we received on one of the shared sockets */
+static void janus_ice_mux_process(janus_ice_mux_socket *s, char *buf, int len,
+		struct sockaddr_storage *from, socklen_t fromlen) {
+	if(len <= 0)
+		return;
+	s->packets++;
+	s->bytes += len;
+	if(janus_ice_mux_is_stun(buf, len)) {
+		janus_ice_mux_handle_stun(s, buf, len, from, fromlen);
+		return;
+	}
+	/* Not STUN, find the PeerConnection by 5-tuple */
+	janus_ice_mux_key key;
+	janus_ice_mux_key_init(&key, s->address->index, from);
+	janus_rwlock_read_lock(&conns_rwlock);
+	janus_ice_mux_conn *conn = g_hash_table_lookup(conns_byaddr, &key);
+	if(conn != NULL)
+		janus_refcount_increase(&conn->ref);
+	janus_rwlock_read_unlock(&conns_rwlock);
+	if(conn == NULL) {
+		s->unknown++;
+		return;
+	}
+	if(!g_atomic_int_get(&conn->removed) && incoming_cb != NULL)
+		incoming_cb(conn->handle, buf, len);
+	janus_refcount_decrease(&conn->ref);
+}
+
+/* Process what a single read returned: with UDP GRO, the kernel may have
+ * coalesced several datagrams of the same flow, which we split here */
+static void janus_ice_mux_process_read(janus_ice_mux_socket *s, char *buf, int len, int segment,
+		struct sockaddr_storage *from, socklen_t fromlen) {
+	if(segment <= 0 || segment >= len) {
+		janus_ice_mux_process(s, buf, len, from, fromlen);
+		return;
+	}
+	s->coalesced++;
+	int offset = 0;
+	while(offset < len) {
+		int size = (len - offset) < segment ? (len - offset) : segment;
+		janus_ice_mux_process(s, buf + offset, size, from, fromlen);
+		offset += size;
+	}
+}
+#ifdef HAVE_UDP_GSO
+/* Helper to find out the segment size of coalesced datagrams, if any */
+static int janus_ice_mux_gro_segment(struct msghdr *msg) {
+	struct cmsghdr *cmsg = NULL;
+	for(cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if(cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+			int segment = 0;
+			memcpy(&segment, CMSG_DATA(cmsg), sizeof(segment));
+			return segment;
+		}
+	}
+	return 0;
+}
+#endif
+
+/* Thread serving a shared socket */
+static void *janus_ice_mux_thread(void *data) {
+	janus_ice_mux_socket *s = (janus_ice_mux_socket *)data;
+	JANUS_LOG(LOG_VERB, "[ice-mux#%u] Thread started (%s:%"SCNu16")\n", s->id, s->address->ip, mux_port);
+	/* When receive offload is enabled, a single read may return many datagrams */
+	int bufsize = mux_gro ? JANUS_ICE_MUX_GRO_BUFSIZE : JANUS_ICE_MUX_BUFSIZE;
+	int batch = mux_gro ? JANUS_ICE_MUX_GRO_BATCH : JANUS_ICE_MUX_BATCH;
+	char *buffers = g_malloc(batch * bufsize);
+	struct sockaddr_storage addrs[JANUS_ICE_MUX_BATCH];
+	struct iovec iovs[JANUS_ICE_MUX_BATCH];
+	char controls[JANUS_ICE_MUX_BATCH][CMSG_SPACE(sizeof(int))];
+	int i = 0;
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr msgs[JANUS_ICE_MUX_BATCH];
+	memset(msgs, 0, sizeof(msgs));
+	for(i=0; i<batch; i++) {
+		iovs[i].iov_base = buffers + i*bufsize;
+		iovs[i].iov_len = bufsize;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &addrs[i];
+	}
+#else
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	iovs[0].iov_base = buffers;
+	iovs[0].iov_len = bufsize;
+	msg.msg_iov = &iovs[0];
+	msg.msg_iovlen = 1;
+	msg.msg_name = &addrs[0];
+#endif
+	struct pollfd fds[1];
+	while(!g_atomic_int_get(&mux_stopping)) {
+		fds[0].fd = s->fd;
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		int res = poll(fds, 1, 500);
+		if(res == 0)
+			continue;
+		if(res < 0) {
+			if(errno == EINTR)
+				continue;
+			JANUS_LOG(LOG_ERR, "[ice-mux#%u] Error polling: %d (%s)\n", s->id, errno, g_strerror(errno));
+			break;
+		}
+		if(fds[0].revents & POLLERR) {
+			/* Most likely an ICMP error for a previous send, clear it and go on */
+			int error = 0;
+			socklen_t errlen = sizeof(error);
+			getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &error, &errlen);
+			if(!(fds[0].revents & POLLIN))
+				continue;
+		}
+#ifdef HAVE_RECVMMSG
+		for(i=0; i<batch; i++) {
+			msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+			msgs[i].msg_hdr.msg_control = mux_gro ? controls[i] : NULL;
+			msgs[i].msg_hdr.msg_controllen = mux_gro ? sizeof(controls[i]) : 0;
+		}
+		int count = recvmmsg(s->fd, msgs, batch, MSG_DONTWAIT, NULL);
+		if(count < 0) {
+			if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				JANUS_LOG(LOG_WARN, "[ice-mux#%u] Error receiving: %d (%s)\n", s->id, errno, g_strerror(errno));
+			continue;
+		}
+		janus_refresh_cached_monotonic_time();
+		for(i=0; i<count; i++) {
+			int segment = 0;
+#ifdef HAVE_UDP_GSO
+			if(mux_gro)
+				segment = janus_ice_mux_gro_segment(&msgs[i].msg_hdr);
+#endif
+			janus_ice_mux_process_read(s, buffers + i*bufsize, msgs[i].msg_len, segment,
+				&addrs[i], msgs[i].msg_hdr.msg_namelen);
+		}
+		janus_clear_cached_monotonic_time();
+#else
+		janus_refresh_cached_monotonic_time();
+		for(i=0; i<batch; i++) {
+			msg.msg_namelen = sizeof(addrs[0]);
+			msg.msg_control = mux_gro ? controls[0] : NULL;
+			msg.msg_controllen = mux_gro ? sizeof(controls[0]) : 0;
+			int len = recvmsg(s->fd, &msg, MSG_DONTWAIT);
+			if(len < 0)
+				break;
+			int segment = 0;
+#ifdef HAVE_UDP_GSO
+			if(mux_gro)
+				segment = janus_ice_mux_gro_segment(&msg);
+#endif
+			janus_ice_mux_process_read(s, buffers, len, segment, &addrs[0], msg.msg_namelen);
+		}
+		janus_clear_cached_monotonic_time();
+#endif
+	}
+	g_free(buffers);
+	JANUS_LOG(LOG_VERB, "[ice-mux#%u] Thread ended\n", s->id);
+	return NULL;
+}
+
+static void janus_ice_mux_address_free(janus_ice_mux_address *address) {
+	if(address == NULL)
+		return;
+	g_free(address->ip);
+	g_free(address);
+}
+
+int janus_ice_mux_init(GList *addresses, uint16_t port, int sockets, int tos, gboolean offload,
+		janus_ice_mux_incoming_callback incoming, janus_ice_mux_nominated_callback nominated) {
+	if(mux_enabled)
+		return 0;
+	if(addresses == NULL || port == 0 || incoming == NULL) {
+		JANUS_LOG(LOG_ERR, "Invalid arguments for the ICE mux\n");
+		return -1;
+	}
+	if(sockets < 1)
+		sockets = 1;
+#ifndef HAVE_UDP_GSO
+	if(offload) {
+		JANUS_LOG(LOG_WARN, "UDP GRO/GSO not available, ICE mux offload disabled\n");
+		offload = FALSE;
+	}
+#endif
+	mux_gro = offload;
+	g_atomic_int_set(&mux_gso, offload ? 1 : 0);
+	mux_port = port;
+	incoming_cb = incoming;
+	nominated_cb = nominated;
+	janus_rwlock_init(&conns_rwlock);
+	conns_byufrag = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)janus_ice_mux_conn_unref);
+	conns_byaddr = g_hash_table_new_full(janus_ice_mux_key_hash, janus_ice_mux_key_equal,
+		(GDestroyNotify)g_free, (GDestroyNotify)janus_ice_mux_conn_unref);
+	/* Prepare the addresses we'll bind to */
+	guint index = 0;
+	GList *temp = addresses;
+	while(temp) {
+		const char *ip = (const char *)temp->data;
+		temp = temp->next;
+		janus_ice_mux_address *address = g_malloc0(sizeof(janus_ice_mux_address));
+		address->ip = g_strdup(ip);
+		nice_address_init(&address->addr);
+		if(!nice_address_set_from_string(&address->addr, ip)) {
+			JANUS_LOG(LOG_WARN, "Skipping invalid address %s for the ICE mux\n", ip);
+			janus_ice_mux_address_free(address);
+			continue;
+		}
+		nice_address_set_port(&address->addr, port);
+		nice_address_copy_to_sockaddr(&address->addr, (struct sockaddr *)&address->bound);
+		address->boundlen = (address->bound.ss_family == AF_INET6) ?
+			sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+		address->index = index++;
+		mux_addresses = g_list_append(mux_addresses, address);
+	}
+	if(mux_addresses == NULL) {
+		JANUS_LOG(LOG_ERR, "No valid address for the ICE mux\n");
+		janus_ice_mux_deinit();
+		return -1;
+	}
+	/* Create the sockets, all bound to the same port on each address */
+	mux_sockets = g_malloc0(sizeof(janus_ice_mux_socket) * g_list_length(mux_addresses) * sockets);
+	temp = mux_addresses;
+	while(temp) {
+		janus_ice_mux_address *address = (janus_ice_mux_address *)temp->data;
+		temp = temp->next;
+		int n = 0;
+		for(n=0; n<sockets; n++) {
+			int family = address->bound.ss_family;
+			int fd = socket(family, SOCK_DGRAM, IPPROTO_UDP);
+			if(fd < 0) {
+				JANUS_LOG(LOG_ERR, "Error creating ICE mux socket for %s: %d (%s)\n",
+					address->ip, errno, g_strerror(errno));
+				janus_ice_mux_deinit();
+				return -1;
+			}
+			int yes = 1;
+			if(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) < 0 ||
+					setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) < 0) {
+				JANUS_LOG(LOG_WARN, "Error setting SO_REUSEPORT on ICE mux socket: %d (%s)\n", errno, g_strerror(errno));
+			}
+			if(family == AF_INET6 && setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &yes, sizeof(yes)) < 0) {
+				JANUS_LOG(LOG_WARN, "Error setting IPV6_V6ONLY on ICE mux socket: %d (%s)\n", errno, g_strerror(errno));
+			}
+			if(tos > 0) {
+				if(family == AF_INET6) {
+					if(setsockopt(fd, IPPROTO_IPV6, IPV6_TCLASS, &tos, sizeof(tos)) < 0)
+						JANUS_LOG(LOG_WARN, "Error setting IPV6_TCLASS on ICE mux socket: %d (%s)\n", errno, g_strerror(errno));
+				} else if(setsockopt(fd, IPPROTO_IP, IP_TOS, &tos, sizeof(tos)) < 0) {
+					JANUS_LOG(LOG_WARN, "Error setting IP_TOS on ICE mux socket: %d (%s)\n", errno, g_strerror(errno));
+				}
+			}
+#ifdef HAVE_UDP_GSO
+			if(mux_gro && setsockopt(fd, SOL_UDP, UDP_GRO, &yes, sizeof(yes)) < 0) {
+				JANUS_LOG(LOG_WARN, "Error enabling UDP GRO on ICE mux socket, disabling offload: %d (%s)\n", errno, g_strerror(errno));
+				mux_gro = FALSE;
+				g_atomic_int_set(&mux_gso, 0);
+			}
+#endif
+			if(bind(fd, (struct sockaddr *)&address->bound, address->boundlen) < 0) {
+				JANUS_LOG(LOG_ERR, "Error binding ICE mux socket to %s:%"SCNu16": %d (%s)\n",
+					address->ip, port, errno, g_strerror(errno));
+				close(fd);
+				janus_ice_mux_deinit();
+				return -1;
+			}
+			janus_ice_mux_socket *s = &mux_sockets[mux_sockets_num];
+			s->id = mux_sockets_num;
+			s->address = address;
+			s->fd = fd;
+			mux_sockets_num++;
+		}
+	}
+	/* Now that all sockets are there, spawn the threads */
+	guint i = 0;
+	for(i=0; i<mux_sockets_num; i++) {
+		janus_ice_mux_socket *s = &mux_sockets[i];
+		GError *error = NULL;
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "ice mux %u", s->id);
+		s->thread = g_thread_try_new(tname, janus_ice_mux_thread, s, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the ICE mux thread...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			janus_ice_mux_deinit();
+			return -1;
+		}
+	}
+	mux_enabled = TRUE;
+	JANUS_LOG(LOG_INFO, "ICE mux enabled on port %"SCNu16" (%u local addresses, %d sockets each%s)\n",
+		port, g_list_length(mux_addresses), sockets, mux_gro ? ", GRO/GSO offload" : "");
+	return 0;
+}
+
+void janus_ice_mux_deinit(void) {
+	g_atomic_int_set(&mux_stopping, 1);
+	guint i = 0;
+	for(i=0; i<mux_sockets_num; i++) {
+		janus_ice_mux_socket *s = &mux_sockets[i];
+		if(s->thread != NULL) {
+			g_thread_join(s->thread);
+			s->thread = NULL;
+		}
+	}
+	for(i=0; i<mux_sockets_num; i++) {
+		if(mux_sockets[i].fd > -1)
+			close(mux_sockets[i].fd);
+	}
+	g_free(mux_sockets);
+	mux_sockets = NULL;
+	mux_sockets_num = 0;
+	if(conns_byufrag != NULL || conns_byaddr != NULL) {
+		janus_rwlock_write_lock(&conns_rwlock);
+		g_clear_pointer(&conns_byaddr, g_hash_table_destroy);
+		g_clear_pointer(&conns_byufrag, g_hash_table_destroy);
+		janus_rwlock_write_unlock(&conns_rwlock);
+	}
+	g_list_free_full(mux_addresses, (GDestroyNotify)janus_ice_mux_address_free);
+	mux_addresses = NULL;
+	mux_enabled = FALSE;
+}
+
+gboolean janus_ice_mux_is_enabled(void) {
+	return mux_enabled;
+}
+
+json_t *janus_ice_mux_info(void) {
+	if(!mux_enabled)
+		return NULL;
+	json_t *info = json_object();
+	json_object_set_new(info, "port", json_integer(mux_port));
+	json_object_set_new(info, "peerconnections", json_integer(g_atomic_int_get(&conns_count)));
+	json_object_set_new(info, "gro", mux_gro ? json_true() : json_false());
+	json_object_set_new(info, "gso", g_atomic_int_get(&mux_gso) ? json_true() : json_false());
+	if(g_atomic_int_get(&mux_gso))
+		json_object_set_new(info, "gso-sends", json_integer(g_atomic_int_get(&gso_sends)));
+	json_t *list = json_array();
+	guint i = 0;
+	for(i=0; i<mux_sockets_num; i++) {
+		janus_ice_mux_socket *s = &mux_sockets[i];
+		json_t *sock = json_object();
+		json_object_set_new(sock, "id", json_integer(s->id));
+		json_object_set_new(sock, "address", json_string(s->address->ip));
+		json_object_set_new(sock, "packets", json_integer(s->packets));
+		json_object_set_new(sock, "bytes", json_integer(s->bytes));
+		json_object_set_new(sock, "checks", json_integer(s->checks));
+		json_object_set_new(sock, "unknown", json_integer(s->unknown));
+		if(mux_gro)
+			json_object_set_new(sock, "coalesced", json_integer(s->coalesced));
+		json_array_append_new(list, sock);
+	}
+	json_object_set_new(info, "sockets", list);
+	return info;
+}
+
+GSList *janus_ice_mux_get_local_candidates(guint stream_id, guint component_id) {
+	GSList *candidates = NULL;
+	GList *temp = mux_addresses;
+	while(temp) {
+		janus_ice_mux_address *address = (janus_ice_mux_address *)temp->data;
+		temp = temp->next;
+		NiceCandidate *c = nice_candidate_new(NICE_CANDIDATE_TYPE_HOST);
+		c->transport = NICE_CANDIDATE_TRANSPORT_UDP;
+		c->stream_id = stream_id;
+		c->component_id = component_id;
+		c->addr = address->addr;
+		c->base_addr = address->addr;
+		/* Same formula as RFC 8445, type preference for host candidates is 126 */
+		c->priority = (126 << 24) | ((65535 - address->index) << 8) | (256 - component_id);
+		g_snprintf(c->foundation, NICE_CANDIDATE_MAX_FOUNDATION, "%u", address->index + 1);
+		candidates = g_slist_append(candidates, c);
+	}
+	return candidates;
+}
+
+janus_ice_mux_conn *janus_ice_mux_add(void *handle, const char *ufrag, const char *pwd, GDestroyNotify notify) {
+	if(!mux_enabled || handle == NULL || ufrag == NULL || pwd == NULL)
+		return NULL;
+	janus_ice_mux_conn *conn = g_malloc0(sizeof(janus_ice_mux_conn));
+	conn->handle = handle;
+	conn->ufrag = g_strdup(ufrag);
+	conn->pwd = g_strdup(pwd);
+	janus_mutex_init(&conn->mutex);
+	janus_refcount_init(&conn->ref, janus_ice_mux_conn_free);
+	janus_rwlock_write_lock(&conns_rwlock);
+	if(g_hash_table_lookup(conns_byufrag, conn->ufrag) != NULL) {
+		/* Another PeerConnection is using the same ufrag */
+		janus_rwlock_write_unlock(&conns_rwlock);
+		janus_refcount_decrease(&conn->ref);
+		return NULL;
+	}
+	/* Only set the notify function now, as the caller keeps ownership on errors */
+	conn->notify = notify;
+	janus_refcount_increase(&conn->ref);
+	g_hash_table_insert(conns_byufrag, conn->ufrag, conn);
+	janus_rwlock_write_unlock(&conns_rwlock);
+	g_atomic_int_inc(&conns_count);
+	return conn;
+}
+
+gboolean janus_ice_mux_set_credentials(janus_ice_mux_conn *conn, const char *ufrag, const char *pwd) {
+	if(conn == NULL || ufrag == NULL || pwd == NULL || g_atomic_int_get(&conn->removed))
+		return FALSE;
+	gboolean updated = FALSE;
+	janus_rwlock_write_lock(&conns_rwlock);
+	if(g_hash_table_lookup(conns_byufrag, ufrag) == NULL &&
+			g_hash_table_lookup(conns_byufrag, conn->ufrag) == conn) {
+		janus_refcount_increase(&conn->ref);
+		g_hash_table_remove(conns_byufrag, conn->ufrag);
+		janus_mutex_lock(&conn->mutex);
+		g_free(conn->ufrag);
+		conn->ufrag = g_strdup(ufrag);
+		g_free(conn->pwd);
+		conn->pwd = g_strdup(pwd);
+		janus_mutex_unlock(&conn->mutex);
+		g_hash_table_insert(conns_byufrag, conn->ufrag, conn);
+		updated = TRUE;
+	}
+	janus_rwlock_write_unlock(&conns_rwlock);
+	return updated;
+}
+
+void janus_ice_mux_remove(janus_ice_mux_conn *conn) {
+	if(conn == NULL || !g_atomic_int_compare_and_exchange(&conn->removed, 0, 1))
+		return;
+	janus_rwlock_write_lock(&conns_rwlock);
+	if(conns_byaddr != NULL) {
+		GList *temp = conn->keys;
+		while(temp) {
+			gpointer key = temp->data;
+			temp = temp->next;
+			g_hash_table_remove(conns_byaddr, key);
+		}
+	}
+	g_list_free(conn->keys);
+	conn->keys = NULL;
+	if(conns_byufrag != NULL && g_hash_table_lookup(conns_byufrag, conn->ufrag) == conn)
+		g_hash_table_remove(conns_byufrag, conn->ufrag);
+	janus_rwlock_write_unlock(&conns_rwlock);
+	g_atomic_int_add(&conns_count, -1);
+	janus_refcount_decrease(&conn->ref);
+}
+
+gboolean janus_ice_mux_get_selected_pair(janus_ice_mux_conn *conn, NiceAddress *local, NiceAddress *remote) {
+	if(conn == NULL)
+		return FALSE;
+	janus_mutex_lock(&conn->mutex);
+	gboolean nominated = conn->nominated;
+	if(nominated) {
+		if(local != NULL)
+			*local = conn->socket->address->addr;
+		if(remote != NULL) {
+			nice_address_init(remote);
+			nice_address_set_from_sockaddr(remote, (struct sockaddr *)&conn->remote);
+		}
+	}
+	janus_mutex_unlock(&conn->mutex);
+	return nominated;
+}
+
+int janus_ice_mux_send(janus_ice_mux_conn *conn, const char *buf, int len) {
+	if(conn == NULL || buf == NULL || len < 1)
+		return -1;
+	janus_mutex_lock(&conn->mutex);
+	if(!conn->nominated) {
+		janus_mutex_unlock(&conn->mutex);
+		return -2;
+	}
+	int fd = conn->socket->fd;
+	struct sockaddr_storage remote;
+	memcpy(&remote, &conn->remote, conn->remotelen);
+	socklen_t remotelen = conn->remotelen;
+	janus_mutex_unlock(&conn->mutex);
+	return sendto(fd, buf, len, 0, (struct sockaddr *)&remote, remotelen);
+}
+
+int janus_ice_mux_send_messages(janus_ice_mux_conn *conn, NiceOutputMessage *messages, guint count) {
+	if(conn == NULL || messages == NULL || count == 0)
+		return -1;
+	janus_mutex_lock(&conn->mutex);
+	if(!conn->nominated) {
+		janus_mutex_unlock(&conn->mutex);
+		return -2;
+	}
+	int fd = conn->socket->fd;
+	struct sockaddr_storage remote;
+	memcpy(&remote, &conn->remote, conn->remotelen);
+	socklen_t remotelen = conn->remotelen;
+	janus_mutex_unlock(&conn->mutex);
+	guint i = 0, sent = 0;
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr msgs[count];
+	struct iovec iovs[count];
+#ifdef HAVE_UDP_GSO
+	char controls[count][CMSG_SPACE(sizeof(uint16_t))];
+	gboolean gso = g_atomic_int_get(&mux_gso);
+#endif
+	memset(msgs, 0, sizeof(msgs));
+	for(i=0; i<count; i++) {
+		iovs[i].iov_base = (void *)messages[i].buffers[0].buffer;
+		iovs[i].iov_len = messages[i].buffers[0].size;
+	}
+	/* Prepare the messages: with segmentation offload, a run of datagrams of the
+	 * same size (optionally followed by a smaller one) is passed as a single one */
+	guint runs = 0;
+	i = 0;
+	while(i < count) {
+		guint n = 1;
+#ifdef HAVE_UDP_GSO
+		if(gso) {
+			size_t segment = iovs[i].iov_len, total = segment;
+			while(i+n < count && n < JANUS_ICE_MUX_GSO_SEGMENTS && iovs[i+n].iov_len <= segment &&
+					total + iovs[i+n].iov_len <= JANUS_ICE_MUX_GSO_MAX_BYTES) {
+				total += iovs[i+n].iov_len;
+				n++;
+				if(iovs[i+n-1].iov_len < segment)
+					break;
+			}
+		}
+#endif
+		struct msghdr *hdr = &msgs[runs].msg_hdr;
+		hdr->msg_iov = &iovs[i];
+		hdr->msg_iovlen = n;
+		hdr->msg_name = &remote;
+		hdr->msg_namelen = remotelen;
+#ifdef HAVE_UDP_GSO
+		if(n > 1) {
+			hdr->msg_control = controls[runs];
+			hdr->msg_controllen = sizeof(controls[runs]);
+			struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr);
+			cmsg->cmsg_level = SOL_UDP;
+			cmsg->cmsg_type = UDP_SEGMENT;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+			uint16_t segment = iovs[i].iov_len;
+			memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+			g_atomic_int_inc(&gso_sends);
+		}
+#endif
+		runs++;
+		i += n;
+	}
+	guint done = 0;
+	while(done < runs) {
+		int res = sendmmsg(fd, msgs + done, runs - done, 0);
+		if(res <= 0) {
+#ifdef HAVE_UDP_GSO
+			if(gso && (errno == EIO || errno == EINVAL) && g_atomic_int_compare_and_exchange(&mux_gso, 1, 0)) {
+				/* The device doesn't support segmentation offload, stop using it */
+				JANUS_LOG(LOG_WARN, "UDP GSO not supported (%d, %s), disabling it on the ICE mux\n", errno, g_strerror(errno));
+			}
+			if(gso) {
+				/* Send what's left one datagram at a time */
+				guint k = 0;
+				for(k=done; k<runs; k++) {
+					guint j = 0;
+					for(j=0; j<msgs[k].msg_hdr.msg_iovlen; j++) {
+						struct iovec *iov = &msgs[k].msg_hdr.msg_iov[j];
+						if(sendto(fd, iov->iov_base, iov->iov_len, 0, (struct sockaddr *)&remote, remotelen) < 0)
+							return sent > 0 ? (int)sent : -3;
+						sent++;
+					}
+				}
+				return sent;
+			}
+#endif
+			return sent > 0 ? (int)sent : -3;
+		}
+		int k = 0;
+		for(k=0; k<res; k++)
+			sent += msgs[done+k].msg_hdr.msg_iovlen;
+		done += res;
+	}
+	return sent;
+#else
+	for(i=0; i<count; i++) {
+		if(sendto(fd, messages[i].buffers[0].buffer, messages[i].buffers[0].size, 0,
+				(struct sockaddr *)&remote, remotelen) < 0)
+			return sent > 0 ? (int)sent : -3;
+		sent++;
+	}
+	return sent;
+#endif
+}
@@ -0,0 +1,108 @@
+/*! \file    ice-mux.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Shared UDP sockets for ICE Lite PeerConnections (headers)
+ * \details  Implementation of a single-port UDP mux for PeerConnections,
+ * that can be used when Janus is configured in ICE Lite mode. Rather than
+ * having libnice bind new sockets for each handle, one or more sockets
+ * (all bound to the same port via SO_REUSEPORT) are created for each local
+ * address at startup, and shared by all PeerConnections. Incoming STUN
+ * connectivity checks are demultiplexed by the local ICE username fragment
+ * and answered right away, while the validated remote addresses are then
+ * used to demultiplex all other traffic (DTLS, RTP, RTCP) by 5-tuple.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef JANUS_ICE_MUX_H
+#define JANUS_ICE_MUX_H
+
+#include <glib.h>
+#include <jansson.h>
+#include <agent.h>
+
+/*! \brief Opaque reference to a PeerConnection registered in the mux */
+typedef struct janus_ice_mux_conn janus_ice_mux_conn;
+
+/*! \brief Callback the mux invokes when a (non-STUN) packet for a PeerConnection is received
+ * \note The callback is invoked in the thread of the socket that received
+ * the packet, and so should only queue it for processing and return
+ * @param[in] handle The opaque handle the PeerConnection was registered with
+ * @param[in] buf The packet that was received
+ * @param[in] len The length of the packet */
+typedef void (*janus_ice_mux_incoming_callback)(void *handle, char *buf, int len);
+/*! \brief Callback the mux invokes when the peer nominated a (new) candidate pair
+ * \note As for janus_ice_mux_incoming_callback, this is invoked in the thread of the socket
+ * @param[in] handle The opaque handle the PeerConnection was registered with */
+typedef void (*janus_ice_mux_nominated_callback)(void *handle);
+
+/*! \brief Mux initialization
+ * @param[in] addresses List of local addresses (strings) to bind the shared sockets to
+ * @param[in] port The port to bind the shared sockets to on each address
+ * @param[in] sockets How many sockets to create for each address (each will be served by its own thread)
+ * @param[in] tos The TOS value to set on the sockets, if any (0 otherwise)
+ * @param[in] offload Whether UDP receive (GRO) and segmentation (GSO) offload should be used, if available
+ * @param[in] incoming The function to invoke when there's a packet for a PeerConnection
+ * @param[in] nominated The function to invoke when a candidate pair has been nominated
+ * @returns 0 in case of success, a negative integer on errors */
+int janus_ice_mux_init(GList *addresses, uint16_t port, int sockets, int tos, gboolean offload,
+	janus_ice_mux_incoming_callback incoming, janus_ice_mux_nominated_callback nominated);
+/*! \brief Mux de-initialization */
+void janus_ice_mux_deinit(void);
+/*! \brief Method to check whether the mux is enabled
+ * @returns TRUE if the mux is enabled, FALSE otherwise */
+gboolean janus_ice_mux_is_enabled(void);
+/*! \brief Helper method to get some info on the mux, for the Admin API
+ * @returns A JSON object with info on the mux and its sockets */
+json_t *janus_ice_mux_info(void);
+
+/*! \brief Method to get the local candidates to advertise for a PeerConnection using the mux
+ * @param[in] stream_id The libnice stream ID to put in the candidates
+ * @param[in] component_id The libnice component ID to put in the candidates
+ * @returns A list of host NiceCandidate instances, that the caller must free */
+GSList *janus_ice_mux_get_local_candidates(guint stream_id, guint component_id);
+
+/*! \brief Register a PeerConnection in the mux
+ * \note Callbacks may still be running in the socket threads after the
+ * PeerConnection has been removed: the notify function is only invoked when
+ * the mux doesn't use the handle anymore, so that's where it can be released
+ * @param[in] handle The opaque handle to pass to callbacks
+ * @param[in] ufrag The local ICE username fragment, as generated by libnice
+ * @param[in] pwd The local ICE password, as generated by libnice
+ * @param[in] notify A function to invoke on handle when the mux is done with it, if any
+ * @returns A reference to the registered PeerConnection in case of success, NULL otherwise */
+janus_ice_mux_conn *janus_ice_mux_add(void *handle, const char *ufrag, const char *pwd, GDestroyNotify notify);
+/*! \brief Update the local ICE credentials of a registered PeerConnection (e.g., after an ICE restart)
+ * @param[in] conn The registered PeerConnection
+ * @param[in] ufrag The new local ICE username fragment
+ * @param[in] pwd The new local ICE password
+ * @returns TRUE if the credentials were updated, FALSE otherwise (e.g., the ufrag is in use already) */
+gboolean janus_ice_mux_set_credentials(janus_ice_mux_conn *conn, const char *ufrag, const char *pwd);
+/*! \brief Remove a PeerConnection from the mux, and release the reference
+ * @param[in] conn The registered PeerConnection */
+void janus_ice_mux_remove(janus_ice_mux_conn *conn);
+/*! \brief Get the candidate pair the peer nominated for a PeerConnection
+ * @param[in] conn The registered PeerConnection
+ * @param[out] local The local address of the pair
+ * @param[out] remote The remote address of the pair
+ * @returns TRUE if a pair was nominated, FALSE otherwise */
+gboolean janus_ice_mux_get_selected_pair(janus_ice_mux_conn *conn, NiceAddress *local, NiceAddress *remote);
+
+/*! \brief Send a packet to the nominated remote address of a PeerConnection
+ * @param[in] conn The registered PeerConnection
+ * @param[in] buf The packet to send
+ * @param[in] len The length of the packet
+ * @returns The number of bytes sent, or a negative integer on errors */
+int janus_ice_mux_send(janus_ice_mux_conn *conn, const char *buf, int len);
+/*! \brief Send a batch of packets to the nominated remote address of a PeerConnection
+ * \note Only the first buffer of each message is sent, which is how the core prepares them.
+ * When segmentation offload is enabled, consecutive packets of the same size are passed
+ * to the kernel as a single buffer, that is then split in datagrams by the kernel or NIC
+ * @param[in] conn The registered PeerConnection
+ * @param[in] messages The messages to send
+ * @param[in] count How many messages there are
+ * @returns The number of messages sent, or a negative integer on errors */
+int janus_ice_mux_send_messages(janus_ice_mux_conn *conn, NiceOutputMessage *messages, guint count);
+
+#endif
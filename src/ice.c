@@ -38,6 +38,10 @@
 #include "apierror.h"
 #include "ip-utils.h"
 #include "events.h"
+#include "metrics.h"
+#include "ice-mux.h"
+#include "probes.h"
+#include "sched-profile.h"
 
 /* STUN server/port, if any */
 static char *janus_stun_server = NULL;
@@ -205,6 +209,18 @@ typedef struct janus_ice_static_event_loop {
 	GMainLoop *mainloop;
 	GThread *thread;
 	uint16_t handles;
+	/* Measured load: CPU time used by the loop thread (per-mille of a core)
+	 * and packets sent/received per second, sampled by a timer in the loop */
+	GSource *load_source;
+	gint64 cpu_time, load_ts;
+	/* Timer wheel shared by all the handles served by this loop */
+	janus_timer_wheel *timers;
+	volatile gint load, packets, packet_rate;
+	/* Handles assigned since the last sample, that may not be generating load yet */
+	volatile gint pending;
+	/* Agents bound to this loop's context, ready to be used by new handles */
+	GQueue *agents;
+	janus_mutex agents_mutex;
 	volatile gint destroyed;
 	janus_refcount ref;
 } janus_ice_static_event_loop;
@@ -215,12 +231,109 @@ static void janus_ice_static_event_loop_destroy(janus_ice_static_event_loop *loo
 }
 static void janus_ice_static_event_loop_free(const janus_refcount *loop_ref) {
 	janus_ice_static_event_loop *loop = janus_refcount_containerof(loop_ref, janus_ice_static_event_loop, ref);
+	if(loop->agents != NULL)
+		g_queue_free_full(loop->agents, (GDestroyNotify)g_object_unref);
+	janus_timer_wheel_unref(loop->timers);
 	g_free(loop);
 }
 static int static_event_loops = 0;
 static gboolean allow_loop_indication = FALSE;
 static GSList *event_loops = NULL;
 static janus_mutex event_loops_mutex = JANUS_MUTEX_INITIALIZER;
+/* Handles that should share a loop (e.g., the legs of a 1:1 call) can be
+ * attached with the same loop group: the first one gets a loop as usual,
+ * and the others are added to the same one, so that media can be relayed
+ * among them synchronously, rather than queued for another thread */
+typedef struct janus_ice_loop_group {
+	janus_ice_static_event_loop *loop;
+	guint handles;
+} janus_ice_loop_group;
+static GHashTable *loop_groups = NULL;
+/* How often we sample the load of static event loops (ms), and the load
+ * we assume a new handle will add, until we can measure it (per-mille) */
+#define JANUS_ICE_LOOP_LOAD_PERIOD		1000
+#define JANUS_ICE_LOOP_MIN_HANDLE_LOAD	5
+static gint64 janus_ice_static_event_loop_cpu_time(void) {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	struct timespec ts;
+	if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+		return (ts.tv_sec*G_GINT64_CONSTANT(1000000)) + (ts.tv_nsec/G_GINT64_CONSTANT(1000));
+#endif
+	return 0;
+}
+static gboolean janus_ice_static_event_loop_load(gpointer user_data) {
+	/* This is invoked in the loop thread, so we can check its own CPU time */
+	janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)user_data;
+	gint64 now = janus_get_monotonic_time();
+	gint64 cpu_time = janus_ice_static_event_loop_cpu_time();
+	if(loop->load_ts > 0 && now > loop->load_ts) {
+		gint64 elapsed = now - loop->load_ts;
+		gint load = (gint)(((cpu_time - loop->cpu_time) * 1000) / elapsed);
+		/* Smooth the value a bit, so that short spikes are less relevant */
+		g_atomic_int_set(&loop->load, (g_atomic_int_get(&loop->load) + load) / 2);
+		gint packets = g_atomic_int_get(&loop->packets);
+		g_atomic_int_add(&loop->packets, -packets);
+		g_atomic_int_set(&loop->packet_rate, (gint)((gint64)packets * G_USEC_PER_SEC / elapsed));
+		g_atomic_int_set(&loop->pending, 0);
+	}
+	loop->cpu_time = cpu_time;
+	loop->load_ts = now;
+	return G_SOURCE_CONTINUE;
+}
+static inline void janus_ice_static_event_loop_count(janus_ice_handle *handle) {
+	if(handle->static_event_loop != NULL)
+		g_atomic_int_inc(&((janus_ice_static_event_loop *)handle->static_event_loop)->packets);
+}
+/* Agents are bound to the context they're created for, which means they
+ * can only be pooled when using static loops: handles can then take an
+ * agent from the pool of their loop, rather than creating a new one, and
+ * agents of PeerConnections that are closed are put back in the pool */
+static guint agent_pool_size = 0;
+static volatile gint agent_pool_hits = 0, agent_pool_misses = 0, agent_pool_recycled = 0;
+static NiceAgent *janus_ice_agent_pool_get(janus_ice_handle *handle) {
+	janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)handle->static_event_loop;
+	if(agent_pool_size == 0 || loop == NULL)
+		return NULL;
+	janus_mutex_lock(&loop->agents_mutex);
+	NiceAgent *agent = g_queue_pop_head(loop->agents);
+	janus_mutex_unlock(&loop->agents_mutex);
+	g_atomic_int_inc(agent ? &agent_pool_hits : &agent_pool_misses);
+	return agent;
+}
+static gboolean janus_ice_agent_pool_put(janus_ice_handle *handle) {
+	janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)handle->static_event_loop;
+	if(agent_pool_size == 0 || loop == NULL || g_atomic_int_get(&loop->destroyed) ||
+			handle->agent == NULL || !G_IS_OBJECT(handle->agent))
+		return FALSE;
+	janus_mutex_lock(&loop->agents_mutex);
+	gboolean full = (g_queue_get_length(loop->agents) >= agent_pool_size);
+	janus_mutex_unlock(&loop->agents_mutex);
+	if(full)
+		return FALSE;
+	/* Get rid of the stream and of our signal handlers, and the agent is as good as new */
+	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Putting nice agent %p back in the pool of loop #%d\n",
+		handle->handle_id, handle->agent, loop->id);
+	g_signal_handlers_disconnect_by_data(handle->agent, handle);
+	if(handle->stream_id > 0)
+		nice_agent_remove_stream(handle->agent, handle->stream_id);
+	handle->stream_id = 0;
+	janus_mutex_lock(&loop->agents_mutex);
+	g_queue_push_tail(loop->agents, handle->agent);
+	janus_mutex_unlock(&loop->agents_mutex);
+	handle->agent = NULL;
+	g_atomic_int_inc(&agent_pool_recycled);
+	return TRUE;
+}
+static int janus_ice_static_event_loop_score(janus_ice_static_event_loop *loop) {
+	/* Handles added recently may not be sending media yet: account for
+	 * them with the average load of the handles already in this loop */
+	int load = g_atomic_int_get(&loop->load);
+	int pending = g_atomic_int_get(&loop->pending);
+	int handle_load = (loop->handles > pending) ? load / (loop->handles - pending) : 0;
+	if(handle_load < JANUS_ICE_LOOP_MIN_HANDLE_LOAD)
+		handle_load = JANUS_ICE_LOOP_MIN_HANDLE_LOAD;
+	return load + pending * handle_load;
+}
 static void *janus_ice_static_event_loop_thread(void *data) {
 	janus_ice_static_event_loop *loop = data;
 	JANUS_LOG(LOG_VERB, "[loop#%d] Event loop thread started\n", loop->id);
@@ -230,11 +343,23 @@ static void *janus_ice_static_event_loop_thread(void *data) {
 		janus_refcount_decrease(&loop->ref);
 		return NULL;
 	}
+	/* Apply the scheduling profile for event loops, if any */
+	char tname[16];
+	g_snprintf(tname, sizeof(tname), "hloop %d", loop->id);
+	janus_sched_thread_start(JANUS_SCHED_ICE_LOOP, tname);
 	JANUS_LOG(LOG_DBG, "[loop#%d] Looping...\n", loop->id);
+	loop->load_source = g_timeout_source_new(JANUS_ICE_LOOP_LOAD_PERIOD);
+	g_source_set_callback(loop->load_source, janus_ice_static_event_loop_load, loop, NULL);
+	g_source_attach(loop->load_source, loop->mainctx);
 	g_main_loop_run(loop->mainloop);
+	g_source_destroy(loop->load_source);
+	g_source_unref(loop->load_source);
+	loop->load_source = NULL;
+	janus_timer_wheel_stop(loop->timers);
 	/* When the loop quits, we can unref it */
 	g_main_loop_unref(loop->mainloop);
 	g_main_context_unref(loop->mainctx);
+	janus_sched_thread_stop();
 	JANUS_LOG(LOG_VERB, "[loop#%d] Event loop thread ended!\n", loop->id);
 	janus_refcount_decrease(&loop->ref);
 	return NULL;
@@ -245,6 +370,11 @@ int janus_ice_get_static_event_loops(void) {
 gboolean janus_ice_is_loop_indication_allowed(void) {
 	return allow_loop_indication;
 }
+int janus_ice_handle_get_loop_id(janus_ice_handle *handle) {
+	if(handle == NULL || handle->static_event_loop == NULL)
+		return -1;
+	return ((janus_ice_static_event_loop *)handle->static_event_loop)->id;
+}
 void janus_ice_set_static_event_loops(int loops, gboolean allow_api) {
 	if(loops == 0)
 		return;
@@ -259,6 +389,9 @@ void janus_ice_set_static_event_loops(int loops, gboolean allow_api) {
 		loop->id = static_event_loops;
 		loop->mainctx = g_main_context_new();
 		loop->mainloop = g_main_loop_new(loop->mainctx, FALSE);
+		loop->timers = janus_timer_wheel_new(loop->mainctx);
+		loop->agents = g_queue_new();
+		janus_mutex_init(&loop->agents_mutex);
 		janus_refcount_init(&loop->ref, janus_ice_static_event_loop_free);
 		/* Now spawn a thread for this loop */
 		GError *error = NULL;
@@ -267,6 +400,7 @@ void janus_ice_set_static_event_loops(int loops, gboolean allow_api) {
 		janus_refcount_increase(&loop->ref);
 		loop->thread = g_thread_try_new(tname, &janus_ice_static_event_loop_thread, loop, &error);
 		if(error != NULL) {
+			janus_timer_wheel_stop(loop->timers);
 			g_main_loop_unref(loop->mainloop);
 			g_main_context_unref(loop->mainctx);
 			janus_refcount_decrease(&loop->ref);
@@ -296,6 +430,9 @@ json_t *janus_ice_static_event_loops_info(void) {
 		json_t *info = json_object();
 		json_object_set_new(info, "id", json_integer(loop->id));
 		json_object_set_new(info, "handles", json_integer(loop->handles));
+		json_object_set_new(info, "cpu-load", json_real((double)g_atomic_int_get(&loop->load) / 10.0));
+		json_object_set_new(info, "packets-per-second", json_integer(g_atomic_int_get(&loop->packet_rate)));
+		json_object_set_new(info, "timers", json_integer(janus_timer_wheel_count(loop->timers)));
 		json_array_append_new(list, info);
 		l = l->next;
 	}
@@ -316,6 +453,9 @@ void janus_ice_stop_static_event_loops(void) {
 		l = l->next;
 	}
 	g_slist_free_full(event_loops, (GDestroyNotify)janus_ice_static_event_loop_destroy);
+	if(loop_groups != NULL)
+		g_hash_table_destroy(loop_groups);
+	loop_groups = NULL;
 	janus_mutex_unlock(&event_loops_mutex);
 }
 
@@ -434,6 +574,124 @@ gboolean janus_ice_event_get_combine_media_stats(void) {
 	return janus_ice_event_combine_media_stats;
 }
 
+/* Media statistic events can also be sampled (only one every N periods for each
+ * handle), and/or limited to the media for which new losses were reported */
+static int janus_ice_event_stats_sampling = 1;
+void janus_ice_event_set_stats_sampling(int sampling) {
+	janus_ice_event_stats_sampling = sampling > 1 ? sampling : 1;
+}
+int janus_ice_event_get_stats_sampling(void) {
+	return janus_ice_event_stats_sampling;
+}
+static gboolean janus_ice_event_stats_lossy_only = FALSE;
+void janus_ice_event_set_stats_lossy_only(gboolean lossy_only) {
+	janus_ice_event_stats_lossy_only = lossy_only;
+}
+gboolean janus_ice_event_get_stats_lossy_only(void) {
+	return janus_ice_event_stats_lossy_only;
+}
+static gboolean janus_ice_event_stats_check_losses(janus_ice_peerconnection_medium *medium, int vindex) {
+	if(!janus_ice_event_stats_lossy_only)
+		return TRUE;
+	if(medium->rtcp_ctx[vindex] == NULL)
+		return FALSE;
+	/* Only report this stream if we, or the peer, lost packets since the last event */
+	guint32 lost = janus_rtcp_context_get_lost_all(medium->rtcp_ctx[vindex], FALSE) +
+		janus_rtcp_context_get_lost_all(medium->rtcp_ctx[vindex], TRUE);
+	if(lost == medium->event_stats_lost[vindex])
+		return FALSE;
+	medium->event_stats_lost[vindex] = lost;
+	return TRUE;
+}
+
+/* Media statistic events can also be batched for all handles: in that case,
+ * each medium adds a row to a table that we send as a single event per period */
+static gboolean janus_ice_event_batch_media_stats = FALSE;
+static janus_mutex batch_stats_mutex = JANUS_MUTEX_INITIALIZER;
+static json_t *batch_stats_rows = NULL;
+void janus_ice_event_set_batch_media_stats(gboolean batch_media_stats) {
+	janus_ice_event_batch_media_stats = batch_media_stats;
+}
+gboolean janus_ice_event_get_batch_media_stats(void) {
+	return janus_ice_event_batch_media_stats;
+}
+/* Columns of each row: counters (the first JANUS_ICE_BATCH_STATS_COUNTERS
+ * after the identifiers) are deltas since the previous batch, the rest are absolute */
+static const char *janus_ice_batch_stats_fields[] = {
+	"session_id", "handle_id", "mindex", "substream", "media",
+	"packets-received", "packets-sent", "bytes-received", "bytes-sent",
+	"nacks-received", "nacks-sent", "retransmissions-received", "lost", "lost-by-remote",
+	"bytes-received-lastsec", "bytes-sent-lastsec", "jitter-local", "jitter-remote",
+	"rtt", "in-link-quality", "out-link-quality",
+	NULL
+};
+static void janus_ice_event_batch_medium_stats(janus_ice_handle *handle,
+		janus_ice_peerconnection_medium *medium, int vindex) {
+	janus_session *session = (janus_session *)handle->session;
+	janus_rtcp_context *rtcp_ctx = medium->rtcp_ctx[vindex];
+	gint64 counters[JANUS_ICE_BATCH_STATS_COUNTERS] = {
+		medium->in_stats.info[vindex].packets,
+		medium->out_stats.info[vindex].packets,
+		medium->in_stats.info[vindex].bytes,
+		medium->out_stats.info[vindex].bytes,
+		medium->in_stats.info[vindex].nacks,
+		medium->out_stats.info[vindex].nacks,
+		rtcp_ctx ? rtcp_ctx->retransmitted : 0,
+		rtcp_ctx ? janus_rtcp_context_get_lost_all(rtcp_ctx, FALSE) : 0,
+		rtcp_ctx ? janus_rtcp_context_get_lost_all(rtcp_ctx, TRUE) : 0
+	};
+	json_t *row = json_array();
+	json_array_append_new(row, json_integer(session->session_id));
+	json_array_append_new(row, json_integer(handle->handle_id));
+	json_array_append_new(row, json_integer(medium->mindex));
+	json_array_append_new(row, json_integer(vindex));
+	json_array_append_new(row, json_string(janus_media_type_str(medium->type)));
+	int i = 0;
+	for(i=0; i<JANUS_ICE_BATCH_STATS_COUNTERS; i++) {
+		json_array_append_new(row, json_integer(counters[i] - medium->batch_stats[vindex][i]));
+		medium->batch_stats[vindex][i] = counters[i];
+	}
+	json_array_append_new(row, json_integer(medium->in_stats.info[vindex].bytes_lastsec));
+	json_array_append_new(row, json_integer(medium->out_stats.info[vindex].bytes_lastsec));
+	json_array_append_new(row, json_integer(rtcp_ctx ? janus_rtcp_context_get_jitter(rtcp_ctx, FALSE) : 0));
+	json_array_append_new(row, json_integer(rtcp_ctx ? janus_rtcp_context_get_jitter(rtcp_ctx, TRUE) : 0));
+	json_array_append_new(row, json_integer(rtcp_ctx && vindex == 0 ? janus_rtcp_context_get_rtt(rtcp_ctx) : 0));
+	json_array_append_new(row, json_integer(rtcp_ctx ? janus_rtcp_context_get_in_link_quality(rtcp_ctx) : 0));
+	json_array_append_new(row, json_integer(rtcp_ctx ? janus_rtcp_context_get_out_link_quality(rtcp_ctx) : 0));
+	janus_mutex_lock(&batch_stats_mutex);
+	if(batch_stats_rows == NULL)
+		batch_stats_rows = json_array();
+	json_array_append_new(batch_stats_rows, row);
+	janus_mutex_unlock(&batch_stats_mutex);
+}
+gboolean janus_ice_event_flush_media_stats(gpointer user_data) {
+	janus_mutex_lock(&batch_stats_mutex);
+	json_t *rows = batch_stats_rows;
+	batch_stats_rows = NULL;
+	janus_mutex_unlock(&batch_stats_mutex);
+	if(rows == NULL)
+		return G_SOURCE_CONTINUE;
+	if(!janus_events_is_interested(JANUS_EVENT_TYPE_MEDIA)) {
+		json_decref(rows);
+		return G_SOURCE_CONTINUE;
+	}
+	json_t *fields = json_array();
+	int i = 0;
+	while(janus_ice_batch_stats_fields[i] != NULL) {
+		json_array_append_new(fields, json_string(janus_ice_batch_stats_fields[i]));
+		i++;
+	}
+	json_t *info = json_object();
+	json_object_set_new(info, "media", json_string("batch"));
+	json_object_set_new(info, "encoding", json_string("delta"));
+	json_object_set_new(info, "period", json_integer(janus_ice_event_stats_period));
+	json_object_set_new(info, "fields", fields);
+	json_object_set_new(info, "rows", rows);
+	janus_events_notify_handlers(JANUS_EVENT_TYPE_MEDIA, JANUS_EVENT_SUBTYPE_MEDIA_STATS_BATCH,
+		0, 0, NULL, info);
+	return G_SOURCE_CONTINUE;
+}
+
 /* Number of active PeerConnection (for stats) */
 static volatile gint pc_num = 0;
 int janus_ice_get_peerconnection_num(void) {
@@ -478,7 +736,17 @@ typedef struct janus_ice_queued_packet {
 	gboolean control, control_ext;
 	gboolean retransmission;
 	gboolean encrypted;
+	/* Whether we added a transport-wide sequence number, and which one */
+	gboolean twcc;
+	guint16 twcc_seq;
 	gint64 added;
+	/* Whether this packet comes from the pool, which shard, and its recycled buffer */
+	gboolean pooled;
+	guint shard;
+	char *pool_buffer;
+	/* Shared message this packet sends, if any: data, label and protocol belong to it */
+	struct janus_ice_shared_data *shared;
+	struct janus_ice_queued_packet *next;
 } janus_ice_queued_packet;
 /* A few static, fake, messages we use as a trigger: e.g., to start a
  * new DTLS handshake, hangup a PeerConnection or close a handle */
@@ -489,14 +757,27 @@ static janus_ice_queued_packet
 	janus_ice_media_stopped,
 	janus_ice_hangup_peerconnection,
 	janus_ice_detach_handle,
-	janus_ice_data_ready;
+	janus_ice_data_ready,
+	janus_ice_mux_nominated;
+
+/* Check if this is one of the fake messages rather than an actual packet */
+static inline gboolean janus_ice_queued_packet_is_trigger(janus_ice_queued_packet *pkt) {
+	return (pkt == &janus_ice_start_gathering ||
+		pkt == &janus_ice_add_candidates ||
+		pkt == &janus_ice_dtls_handshake ||
+		pkt == &janus_ice_media_stopped ||
+		pkt == &janus_ice_hangup_peerconnection ||
+		pkt == &janus_ice_detach_handle ||
+		pkt == &janus_ice_data_ready ||
+		pkt == &janus_ice_mux_nominated);
+}
 
 /* Janus NACKed packet we're tracking (to avoid duplicates) */
 typedef struct janus_ice_nacked_packet {
 	janus_ice_peerconnection_medium *medium;
 	int vindex;
 	guint16 seq_number;
-	guint source_id;
+	janus_timer *timer;
 } janus_ice_nacked_packet;
 static gboolean janus_ice_nacked_packet_cleanup(gpointer user_data) {
 	janus_ice_nacked_packet *pkt = (janus_ice_nacked_packet *)user_data;
@@ -505,7 +786,8 @@ static gboolean janus_ice_nacked_packet_cleanup(gpointer user_data) {
 		JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Cleaning up NACKed packet %"SCNu16" (SSRC %"SCNu32", vindex %d)...\n",
 			pkt->medium->pc->handle->handle_id, pkt->seq_number, pkt->medium->ssrc_peer[pkt->vindex], pkt->vindex);
 		g_hash_table_remove(pkt->medium->rtx_nacked[pkt->vindex], GUINT_TO_POINTER(pkt->seq_number));
-		g_hash_table_remove(pkt->medium->pending_nacked_cleanup, GUINT_TO_POINTER(pkt->source_id));
+		if(g_hash_table_remove(pkt->medium->pending_nacked_cleanup, pkt->timer))
+			janus_timer_unref(pkt->timer);
 	}
 
 	return G_SOURCE_REMOVE;
@@ -542,19 +824,66 @@ typedef struct janus_ice_outgoing_traffic {
 } janus_ice_outgoing_traffic;
 static gboolean janus_ice_outgoing_rtcp_handle(gpointer user_data);
 static gboolean janus_ice_outgoing_stats_handle(gpointer user_data);
+static janus_ice_queued_packet *janus_ice_rtcp_compound_new(janus_ice_peerconnection_medium *medium, janus_rtcp_compound *compound);
+static void janus_ice_rtcp_compound_flush(janus_ice_handle *handle, janus_ice_queued_packet **pkt, janus_rtcp_compound *compound);
 static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janus_ice_queued_packet *pkt);
+static void janus_ice_send_batch_flush(janus_ice_handle *handle);
+static void janus_ice_free_queued_packet(janus_ice_queued_packet *pkt);
+static void janus_ice_incoming_packet(NiceAgent *agent, guint stream_id, guint component_id, guint len, gchar *buf, gpointer ice);
+static gboolean janus_ice_outgoing_traffic_pace(janus_ice_handle *handle, janus_ice_queued_packet *pkt);
+static void janus_ice_pacer_send(janus_ice_handle *handle, GSource *source);
+static gboolean janus_ice_packet_ring_pending(struct janus_ice_packet_ring *ring);
+static janus_ice_queued_packet *janus_ice_packet_ring_pop(struct janus_ice_packet_ring *ring);
 static gboolean janus_ice_outgoing_traffic_prepare(GSource *source, gint *timeout) {
 	janus_ice_outgoing_traffic *t = (janus_ice_outgoing_traffic *)source;
-	return (g_async_queue_length(t->handle->queued_packets) > 0);
+	return (g_async_queue_length(t->handle->queued_packets) > 0 ||
+		(t->handle->mux_incoming != NULL && g_async_queue_length(t->handle->mux_incoming) > 0) ||
+		(t->handle->packet_ring != NULL && janus_ice_packet_ring_pending(t->handle->packet_ring)));
 }
 static gboolean janus_ice_outgoing_traffic_dispatch(GSource *source, GSourceFunc callback, gpointer user_data) {
 	janus_ice_outgoing_traffic *t = (janus_ice_outgoing_traffic *)source;
 	int ret = G_SOURCE_CONTINUE;
 	janus_ice_queued_packet *pkt = NULL;
+	/* Packets relayed to this handle from within this iteration must be queued */
+	t->handle->dispatching = TRUE;
+	/* Cache the current time for all the packets we'll send in this iteration */
+	janus_refresh_cached_monotonic_time();
+	/* If we're using the ICE mux, we process the packets it received for us first */
+	if(t->handle->mux_incoming != NULL) {
+		while((pkt = g_async_queue_try_pop(t->handle->mux_incoming)) != NULL) {
+			janus_ice_peerconnection *pc = t->handle->pc;
+			if(pc != NULL && pc->mux != NULL) {
+				JANUS_PROBE2(ice_recv_start, t->handle->handle_id, pkt->length);
+				janus_ice_incoming_packet(t->handle->agent, pc->stream_id, 1, pkt->length, pkt->data, pc);
+				JANUS_PROBE1(ice_recv_done, t->handle->handle_id);
+			}
+			janus_ice_free_queued_packet(pkt);
+		}
+	}
 	while((pkt = g_async_queue_try_pop(t->handle->queued_packets)) != NULL) {
+		/* Don't leave packets waiting in the batch if the PeerConnection may change */
+		if(janus_ice_queued_packet_is_trigger(pkt))
+			janus_ice_send_batch_flush(t->handle);
+		else if(janus_ice_outgoing_traffic_pace(t->handle, pkt))
+			continue;
 		if(janus_ice_outgoing_traffic_handle(t->handle, pkt) == G_SOURCE_REMOVE)
 			ret = G_SOURCE_REMOVE;
 	}
+	/* Now the media packets in the lock-free queue, if any */
+	if(ret == G_SOURCE_CONTINUE && t->handle->packet_ring != NULL) {
+		while((pkt = janus_ice_packet_ring_pop(t->handle->packet_ring)) != NULL) {
+			if(janus_ice_outgoing_traffic_pace(t->handle, pkt))
+				continue;
+			if(janus_ice_outgoing_traffic_handle(t->handle, pkt) == G_SOURCE_REMOVE)
+				ret = G_SOURCE_REMOVE;
+		}
+	}
+	/* Send the paced packets we have tokens for, if any */
+	if(ret == G_SOURCE_CONTINUE)
+		janus_ice_pacer_send(t->handle, source);
+	janus_ice_send_batch_flush(t->handle);
+	janus_clear_cached_monotonic_time();
+	t->handle->dispatching = FALSE;
 	return ret;
 }
 static void janus_ice_outgoing_traffic_finalize(GSource *source) {
@@ -651,29 +980,702 @@ int janus_get_dscp(void) {
 }
 
 
-static inline void janus_ice_free_rtp_packet(janus_rtp_packet *pkt) {
-	if(pkt == NULL) {
+/* Buffer of sent packets, for retransmissions: rather than a queue and a
+ * hashtable, which would mean a few allocations per packet, we use a ring
+ * indexed by sequence number, that we make larger when it turns out it
+ * can't hold all the packets of the NACK queue window */
+#define JANUS_ICE_RETRANSMIT_BUFFER_MIN		128
+#define JANUS_ICE_RETRANSMIT_BUFFER_MAX		8192
+typedef struct janus_ice_retransmit_buffer {
+	guint size, mask, count;
+	/* Memory used by the ring and by the packets it contains */
+	gsize memory;
+	guint16 *seqs;
+	janus_rtp_packet *packets;
+} janus_ice_retransmit_buffer;
+static janus_ice_retransmit_buffer *janus_ice_retransmit_buffer_new(guint size) {
+	janus_ice_retransmit_buffer *rb = g_malloc(sizeof(janus_ice_retransmit_buffer));
+	rb->size = size;
+	rb->mask = size-1;
+	rb->count = 0;
+	rb->memory = sizeof(janus_ice_retransmit_buffer) + size * (sizeof(guint16) + sizeof(janus_rtp_packet));
+	rb->seqs = g_malloc0(size * sizeof(guint16));
+	rb->packets = g_malloc0(size * sizeof(janus_rtp_packet));
+	return rb;
+}
+static void janus_ice_retransmit_buffer_free(janus_ice_retransmit_buffer *rb) {
+	if(rb == NULL)
+		return;
+	guint i = 0;
+	for(i=0; i<rb->size && rb->count > 0; i++) {
+		if(rb->packets[i].data != NULL) {
+			g_free(rb->packets[i].data);
+			rb->count--;
+		}
+	}
+	g_free(rb->seqs);
+	g_free(rb->packets);
+	g_free(rb);
+}
+static janus_ice_retransmit_buffer *janus_ice_retransmit_buffer_grow(janus_ice_retransmit_buffer *rb) {
+	janus_ice_retransmit_buffer *bigger = janus_ice_retransmit_buffer_new(rb->size*2);
+	guint i = 0;
+	for(i=0; i<rb->size; i++) {
+		janus_rtp_packet *p = &rb->packets[i];
+		if(p->data == NULL)
+			continue;
+		guint index = rb->seqs[i] & bigger->mask;
+		janus_rtp_packet *slot = &bigger->packets[index];
+		if(slot->data != NULL) {
+			/* Only keep the most recent of the two */
+			if(slot->created >= p->created) {
+				g_free(p->data);
+				continue;
+			}
+			g_free(slot->data);
+			bigger->count--;
+			bigger->memory -= slot->length;
+		}
+		*slot = *p;
+		bigger->seqs[index] = rb->seqs[i];
+		bigger->count++;
+		bigger->memory += p->length;
+	}
+	g_free(rb->seqs);
+	g_free(rb->packets);
+	g_free(rb);
+	return bigger;
+}
+/* Store a packet, taking ownership of its data */
+static void janus_ice_retransmit_buffer_store(janus_ice_retransmit_buffer **rbp,
+		janus_rtp_packet *pkt, guint16 seq, gint64 max_age) {
+	if(*rbp == NULL)
+		*rbp = janus_ice_retransmit_buffer_new(JANUS_ICE_RETRANSMIT_BUFFER_MIN);
+	janus_ice_retransmit_buffer *rb = *rbp;
+	janus_rtp_packet *slot = &rb->packets[seq & rb->mask];
+	if(slot->data != NULL && rb->seqs[seq & rb->mask] != seq &&
+			pkt->created - slot->created < max_age && rb->size < JANUS_ICE_RETRANSMIT_BUFFER_MAX) {
+		/* We'd overwrite a packet we may still need to retransmit, the ring is too small */
+		rb = janus_ice_retransmit_buffer_grow(rb);
+		*rbp = rb;
+		slot = &rb->packets[seq & rb->mask];
+	}
+	if(slot->data != NULL) {
+		g_free(slot->data);
+		rb->count--;
+		rb->memory -= slot->length;
+	}
+	*slot = *pkt;
+	rb->seqs[seq & rb->mask] = seq;
+	rb->count++;
+	rb->memory += pkt->length;
+}
+static janus_rtp_packet *janus_ice_retransmit_buffer_lookup(janus_ice_retransmit_buffer *rb, guint16 seq) {
+	if(rb == NULL)
+		return NULL;
+	janus_rtp_packet *slot = &rb->packets[seq & rb->mask];
+	return (slot->data != NULL && rb->seqs[seq & rb->mask] == seq) ? slot : NULL;
+}
+/* Get rid of packets older than max_age (or all of them, if now is 0) */
+static void janus_ice_retransmit_buffer_cleanup(janus_ice_retransmit_buffer *rb, gint64 now, gint64 max_age) {
+	if(rb == NULL)
 		return;
+	guint i = 0;
+	for(i=0; i<rb->size && rb->count > 0; i++) {
+		janus_rtp_packet *p = &rb->packets[i];
+		if(p->data != NULL && (!now || (now - p->created >= max_age))) {
+			g_free(p->data);
+			p->data = NULL;
+			rb->count--;
+			rb->memory -= p->length;
+		}
 	}
+}
 
-	g_free(pkt->data);
-	g_free(pkt);
+/* Pool of preallocated outgoing packets: most of the packets plugins relay
+ * fit in a fixed size buffer, so rather than doing two allocations (and two
+ * frees) per packet, we recycle packet+buffer pairs. Since packets are
+ * typically queued by plugin threads and released by the loop threads, the
+ * pool is split in a few mutex-protected shards: each thread is associated
+ * to a shard the first time it queues a packet, and packets always go back
+ * to the shard they were taken from, which keeps contention low */
+#define JANUS_ICE_PACKET_POOL_SHARDS	8
+#define JANUS_ICE_PACKET_POOL_BUFSIZE	(1500+SRTP_MAX_TAG_LEN+4)
+/* RTCP packets we queue always have this many spare bytes at the end, so
+ * that when sending we can add the RR a REMB needs, or PLIs for the other
+ * simulcast layers, to the same compound packet without copying it */
+#define JANUS_ICE_RTCP_HEADROOM		32
+/* Maximum size of the compound RTCP packets we assemble ourselves */
+#define JANUS_ICE_RTCP_COMPOUND_SIZE	1200
+#define DEFAULT_PACKET_POOL_SIZE	512
+typedef struct janus_ice_packet_pool_shard {
+	janus_mutex mutex;
+	janus_ice_queued_packet *available;
+	guint count;
+} janus_ice_packet_pool_shard;
+static janus_ice_packet_pool_shard packet_pool[JANUS_ICE_PACKET_POOL_SHARDS];
+static guint packet_pool_size = DEFAULT_PACKET_POOL_SIZE;
+static volatile gint packet_pool_next_shard = 0;
+static GPrivate packet_pool_thread_shard = G_PRIVATE_INIT(NULL);
+void janus_ice_set_packet_pool_size(uint size) {
+	packet_pool_size = size;
+	if(packet_pool_size == 0)
+		JANUS_LOG(LOG_VERB, "Disabling outgoing packets pool\n");
+	else
+		JANUS_LOG(LOG_VERB, "Setting outgoing packets pool size to %u packets per shard\n", packet_pool_size);
+}
+uint janus_ice_get_packet_pool_size(void) {
+	return packet_pool_size;
+}
+static void janus_ice_packet_pool_init(void) {
+	int i = 0;
+	for(i=0; i<JANUS_ICE_PACKET_POOL_SHARDS; i++) {
+		janus_mutex_init(&packet_pool[i].mutex);
+		packet_pool[i].available = NULL;
+		packet_pool[i].count = 0;
+	}
+}
+static void janus_ice_packet_pool_deinit(void) {
+	int i = 0;
+	for(i=0; i<JANUS_ICE_PACKET_POOL_SHARDS; i++) {
+		janus_mutex_lock(&packet_pool[i].mutex);
+		janus_ice_queued_packet *pkt = packet_pool[i].available, *next = NULL;
+		while(pkt) {
+			next = pkt->next;
+			g_free(pkt->pool_buffer);
+			g_free(pkt);
+			pkt = next;
+		}
+		packet_pool[i].available = NULL;
+		packet_pool[i].count = 0;
+		janus_mutex_unlock(&packet_pool[i].mutex);
+	}
+}
+/* Helper to allocate a new queued packet, with room for at least size bytes */
+static janus_ice_queued_packet *janus_ice_queued_packet_new(gint size) {
+	janus_ice_queued_packet *pkt = NULL;
+	if(packet_pool_size == 0 || size > JANUS_ICE_PACKET_POOL_BUFSIZE) {
+		/* Too large for the pool (or no pool at all), allocate it the old way */
+		pkt = g_malloc(sizeof(janus_ice_queued_packet));
+		pkt->data = g_malloc(size);
+		pkt->pooled = FALSE;
+		pkt->shard = 0;
+		pkt->pool_buffer = NULL;
+		pkt->twcc = FALSE;
+		pkt->shared = NULL;
+		pkt->next = NULL;
+		return pkt;
+	}
+	/* Find out which shard this thread is associated with */
+	guint shard = GPOINTER_TO_UINT(g_private_get(&packet_pool_thread_shard));
+	if(shard == 0) {
+		shard = ((guint)g_atomic_int_add(&packet_pool_next_shard, 1) % JANUS_ICE_PACKET_POOL_SHARDS) + 1;
+		g_private_set(&packet_pool_thread_shard, GUINT_TO_POINTER(shard));
+	}
+	shard--;
+	janus_ice_packet_pool_shard *pool = &packet_pool[shard];
+	janus_mutex_lock(&pool->mutex);
+	pkt = pool->available;
+	if(pkt != NULL) {
+		pool->available = pkt->next;
+		pool->count--;
+	}
+	janus_mutex_unlock(&pool->mutex);
+	if(pkt == NULL) {
+		pkt = g_malloc(sizeof(janus_ice_queued_packet));
+		pkt->pool_buffer = NULL;
+	}
+	/* The buffer may have been handed over to a retransmission buffer */
+	if(pkt->pool_buffer == NULL)
+		pkt->pool_buffer = g_malloc(JANUS_ICE_PACKET_POOL_BUFSIZE);
+	pkt->data = pkt->pool_buffer;
+	pkt->pooled = TRUE;
+	pkt->shard = shard;
+	pkt->twcc = FALSE;
+	pkt->shared = NULL;
+	pkt->next = NULL;
+	return pkt;
 }
 
 static void janus_ice_free_queued_packet(janus_ice_queued_packet *pkt) {
-	if(pkt == NULL || pkt == &janus_ice_start_gathering ||
-			pkt == &janus_ice_add_candidates ||
-			pkt == &janus_ice_dtls_handshake ||
-			pkt == &janus_ice_media_stopped ||
-			pkt == &janus_ice_hangup_peerconnection ||
-			pkt == &janus_ice_detach_handle ||
-			pkt == &janus_ice_data_ready) {
+	if(pkt == NULL || janus_ice_queued_packet_is_trigger(pkt))
 		return;
+	if(pkt->shared != NULL) {
+		/* We don't own the data, we just release our reference to the shared message */
+		janus_ice_shared_data_unref(pkt->shared);
+		pkt->shared = NULL;
+		pkt->data = pkt->pooled ? pkt->pool_buffer : NULL;
+		pkt->label = NULL;
+		pkt->protocol = NULL;
 	}
-	g_free(pkt->data);
 	g_free(pkt->label);
 	g_free(pkt->protocol);
-	g_free(pkt);
+	if(!pkt->pooled) {
+		g_free(pkt->data);
+		g_free(pkt);
+		return;
+	}
+	/* The buffer may have been replaced in the meanwhile (e.g., REMB+RR) */
+	if(pkt->data != pkt->pool_buffer)
+		g_free(pkt->data);
+	pkt->data = NULL;
+	janus_ice_packet_pool_shard *pool = &packet_pool[pkt->shard];
+	janus_mutex_lock(&pool->mutex);
+	if(pool->count < packet_pool_size) {
+		pkt->next = pool->available;
+		pool->available = pkt;
+		pool->count++;
+		pkt = NULL;
+	}
+	janus_mutex_unlock(&pool->mutex);
+	/* If the shard was full already, get rid of the packet */
+	if(pkt != NULL) {
+		g_free(pkt->pool_buffer);
+		g_free(pkt);
+	}
+}
+/* Helper to take ownership of the buffer of a queued packet (e.g., to store
+ * it in the retransmission buffer without copying it): the packet will be
+ * given a new buffer the next time it's taken from the pool, if needed */
+static char *janus_ice_queued_packet_steal_data(janus_ice_queued_packet *pkt) {
+	char *data = pkt->data;
+	if(data == pkt->pool_buffer)
+		pkt->pool_buffer = NULL;
+	pkt->data = NULL;
+	return data;
+}
+
+/* Batched sending of outgoing packets: when enabled, rather than invoking
+ * nice_agent_send for each packet, the packets a loop dispatches in a single
+ * iteration are collected and passed to libnice in a single call, which
+ * saves us a lock/unlock on the agent and a lookup of the component for
+ * each of them. Batches are flushed when full, before any event that may
+ * change the state of the PeerConnection, and at the end of the iteration */
+#define JANUS_ICE_MAX_SEND_BATCH	64
+typedef struct janus_ice_send_batch {
+	guint count;
+	char *buffer;
+	GOutputVector vectors[JANUS_ICE_MAX_SEND_BATCH];
+	NiceOutputMessage messages[JANUS_ICE_MAX_SEND_BATCH];
+} janus_ice_send_batch;
+static uint send_batch_size = 0;
+void janus_ice_set_send_batch_size(uint size) {
+	if(size > JANUS_ICE_MAX_SEND_BATCH) {
+		JANUS_LOG(LOG_WARN, "Send batch size too large (%u), limiting to %d\n", size, JANUS_ICE_MAX_SEND_BATCH);
+		size = JANUS_ICE_MAX_SEND_BATCH;
+	}
+	send_batch_size = (size > 1 ? size : 0);
+	if(send_batch_size == 0)
+		JANUS_LOG(LOG_VERB, "Disabling batched sending of packets\n");
+	else
+		JANUS_LOG(LOG_VERB, "Sending outgoing packets in batches of up to %u packets\n", send_batch_size);
+}
+uint janus_ice_get_send_batch_size(void) {
+	return send_batch_size;
+}
+static void janus_ice_send_batch_free(janus_ice_send_batch *batch) {
+	if(batch == NULL)
+		return;
+	g_free(batch->buffer);
+	g_free(batch);
+}
+static void janus_ice_send_batch_flush(janus_ice_handle *handle) {
+	janus_ice_send_batch *batch = handle->send_batch;
+	if(batch == NULL || batch->count == 0)
+		return;
+	janus_ice_peerconnection *pc = handle->pc;
+	if(pc == NULL || handle->agent == NULL) {
+		batch->count = 0;
+		return;
+	}
+	if(pc->mux != NULL) {
+		/* We're using the ICE mux, send the batch on the shared socket */
+		JANUS_PROBE2(batch_send, handle->handle_id, batch->count);
+		int sent = janus_ice_mux_send_messages(pc->mux, batch->messages, batch->count);
+		if(sent < (int)batch->count && sent != -2) {
+			JANUS_LOG(LOG_ERR, "[%"SCNu64"] ... only sent %d packets? (was %u)\n", handle->handle_id, sent, batch->count);
+		}
+		handle->send_batches++;
+		handle->send_batched_packets += batch->count;
+		batch->count = 0;
+		return;
+	}
+	JANUS_PROBE2(batch_send, handle->handle_id, batch->count);
+	GError *error = NULL;
+	gint sent = nice_agent_send_messages_nonblocking(handle->agent, pc->stream_id, pc->component_id,
+		batch->messages, batch->count, NULL, &error);
+	if(error != NULL) {
+		JANUS_LOG(LOG_ERR, "[%"SCNu64"] ... error sending batch of %u packets: %s\n",
+			handle->handle_id, batch->count, error->message ? error->message : "??");
+		g_error_free(error);
+	} else if(sent < (gint)batch->count) {
+		JANUS_LOG(LOG_ERR, "[%"SCNu64"] ... only sent %d packets? (was %u)\n", handle->handle_id, sent, batch->count);
+	}
+	handle->send_batches++;
+	handle->send_batched_packets += batch->count;
+	batch->count = 0;
+}
+/* Helper to send a packet on a PeerConnection, or add it to the current batch */
+static int janus_ice_agent_send(janus_ice_handle *handle, janus_ice_peerconnection *pc, int length, const char *data) {
+	janus_metrics_add(JANUS_METRICS_PACKETS_OUT, 1);
+	janus_metrics_add(JANUS_METRICS_BYTES_OUT, length);
+	JANUS_PROBE2(packet_send, handle->handle_id, length);
+	if(send_batch_size == 0 || length > JANUS_ICE_PACKET_POOL_BUFSIZE) {
+		/* No batching (or packet too large for a batch slot), send right away */
+		janus_ice_send_batch_flush(handle);
+		janus_ice_static_event_loop_count(handle);
+		if(pc->mux != NULL)
+			return janus_ice_mux_send(pc->mux, data, length);
+		return nice_agent_send(handle->agent, pc->stream_id, pc->component_id, length, data);
+	}
+	janus_ice_static_event_loop_count(handle);
+	janus_ice_send_batch *batch = handle->send_batch;
+	if(batch == NULL) {
+		batch = g_malloc0(sizeof(janus_ice_send_batch));
+		batch->buffer = g_malloc(JANUS_ICE_MAX_SEND_BATCH * JANUS_ICE_PACKET_POOL_BUFSIZE);
+		guint i = 0;
+		for(i=0; i<JANUS_ICE_MAX_SEND_BATCH; i++) {
+			batch->vectors[i].buffer = batch->buffer + (i * JANUS_ICE_PACKET_POOL_BUFSIZE);
+			batch->messages[i].buffers = &batch->vectors[i];
+			batch->messages[i].n_buffers = 1;
+		}
+		handle->send_batch = batch;
+	}
+	if(batch->count >= send_batch_size)
+		janus_ice_send_batch_flush(handle);
+	memcpy((char *)batch->vectors[batch->count].buffer, data, length);
+	batch->vectors[batch->count].size = length;
+	batch->count++;
+	return length;
+}
+
+/* Pacing of outgoing video packets: when enabled, rather than sending all
+ * the packets of a frame back-to-back (e.g., 50-100 packets for a keyframe),
+ * video packets wait in a per-handle queue and are released according to a
+ * token bucket, whose rate is driven by the bandwidth estimate (or REMB) we
+ * have for the peer, and whose size is the configurable burst budget. Audio
+ * and retransmissions are never queued, which means they always get priority,
+ * but still consume tokens; packets won't wait in the queue more than
+ * JANUS_ICE_PACER_MAX_DELAY, though, after which they're sent anyway */
+#define DEFAULT_PACING_BURST		40
+#define JANUS_ICE_PACER_MAX_DELAY	250000
+#define JANUS_ICE_PACER_MIN_BUCKET	3000
+#define JANUS_ICE_PACER_DEFAULT_BITRATE	2000000
+#define JANUS_ICE_PACER_FACTOR		2.5
+typedef struct janus_ice_pacer {
+	GQueue *queue;
+	gint64 tokens, tokens_updated;
+	guint32 rate;
+	/* Time packets spent queued before being sent, in the current and last period */
+	gint64 delay_sum, delay_max;
+	guint delay_count;
+	gint64 last_delay_avg, last_delay_max;
+	guint64 paced_packets;
+} janus_ice_pacer;
+static gboolean pacing = FALSE;
+static uint pacing_burst = DEFAULT_PACING_BURST;
+void janus_ice_set_pacing(gboolean enabled, uint burst) {
+	pacing = enabled;
+	pacing_burst = (burst > 0 ? burst : DEFAULT_PACING_BURST);
+	if(!pacing)
+		JANUS_LOG(LOG_VERB, "Disabling pacing of outgoing video packets\n");
+	else
+		JANUS_LOG(LOG_VERB, "Pacing outgoing video packets (burst budget: %ums)\n", pacing_burst);
+}
+gboolean janus_ice_is_pacing_enabled(void) {
+	return pacing;
+}
+uint janus_ice_get_pacing_burst(void) {
+	return pacing_burst;
+}
+
+/* FlexFEC generation for outgoing video */
+#define DEFAULT_FLEXFEC_RTT_THRESHOLD	100
+static gboolean flexfec = FALSE;
+static uint flexfec_rtt_threshold = DEFAULT_FLEXFEC_RTT_THRESHOLD;
+void janus_ice_set_flexfec(gboolean enabled, uint rtt_threshold) {
+	flexfec = enabled;
+	flexfec_rtt_threshold = (rtt_threshold > 0 ? rtt_threshold : DEFAULT_FLEXFEC_RTT_THRESHOLD);
+	if(!flexfec)
+		JANUS_LOG(LOG_VERB, "Disabling FlexFEC for outgoing video\n");
+	else
+		JANUS_LOG(LOG_VERB, "Generating FlexFEC for outgoing video when needed (RTT threshold: %ums)\n", flexfec_rtt_threshold);
+}
+gboolean janus_ice_is_flexfec_enabled(void) {
+	return flexfec;
+}
+uint janus_ice_get_flexfec_rtt_threshold(void) {
+	return flexfec_rtt_threshold;
+}
+static void janus_ice_pacer_free(janus_ice_pacer *pacer) {
+	if(pacer == NULL)
+		return;
+	janus_ice_queued_packet *pkt = NULL;
+	while((pkt = g_queue_pop_head(pacer->queue)) != NULL)
+		janus_ice_free_queued_packet(pkt);
+	g_queue_free(pacer->queue);
+	g_free(pacer);
+}
+/* Check whether a packet should go through the pacer */
+static gboolean janus_ice_pacer_is_paced(janus_ice_queued_packet *pkt) {
+	return (pkt->type == JANUS_ICE_PACKET_VIDEO && !pkt->control && !pkt->encrypted && !pkt->retransmission);
+}
+/* Add new tokens to the bucket, according to the time that passed */
+static void janus_ice_pacer_refill(janus_ice_handle *handle, janus_ice_pacer *pacer, gint64 now) {
+	/* Refresh the pacing rate, using the estimate or the REMB feedback we got, if any */
+	janus_ice_peerconnection *pc = handle->pc;
+	guint32 bitrate = 0;
+	if(pc != NULL) {
+		bitrate = janus_bwe_context_get_estimate(pc->bwe);
+		if(pc->remb_bitrate > 0 && (bitrate == 0 || pc->remb_bitrate < bitrate))
+			bitrate = pc->remb_bitrate;
+	}
+	if(bitrate == 0)
+		bitrate = JANUS_ICE_PACER_DEFAULT_BITRATE;
+	pacer->rate = bitrate * JANUS_ICE_PACER_FACTOR;
+	gint64 bucket = ((gint64)pacer->rate / 8) * pacing_burst / 1000;
+	if(bucket < JANUS_ICE_PACER_MIN_BUCKET)
+		bucket = JANUS_ICE_PACER_MIN_BUCKET;
+	if(pacer->tokens_updated == 0) {
+		pacer->tokens = bucket;
+	} else if(now > pacer->tokens_updated) {
+		pacer->tokens += ((now - pacer->tokens_updated) * (gint64)pacer->rate) / (8 * G_USEC_PER_SEC);
+		if(pacer->tokens > bucket)
+			pacer->tokens = bucket;
+	}
+	/* Don't let priority packets put us too much in debt either */
+	if(pacer->tokens < -bucket)
+		pacer->tokens = -bucket;
+	pacer->tokens_updated = now;
+}
+/* Send as many of the queued packets as the bucket allows, and schedule the next iteration */
+static void janus_ice_pacer_send(janus_ice_handle *handle, GSource *source) {
+	janus_ice_pacer *pacer = handle->pacer;
+	if(pacer == NULL)
+		return;
+	janus_ice_queued_packet *pkt = g_queue_peek_head(pacer->queue);
+	if(pkt == NULL) {
+		g_source_set_ready_time(source, -1);
+		return;
+	}
+	gint64 now = janus_get_cached_monotonic_time();
+	janus_ice_pacer_refill(handle, pacer, now);
+	while((pkt = g_queue_peek_head(pacer->queue)) != NULL) {
+		gint64 delay = now - pkt->added;
+		if(pacer->tokens <= 0 && delay < JANUS_ICE_PACER_MAX_DELAY)
+			break;
+		g_queue_pop_head(pacer->queue);
+		pacer->tokens -= pkt->length;
+		pacer->delay_sum += delay;
+		if(delay > pacer->delay_max)
+			pacer->delay_max = delay;
+		pacer->delay_count++;
+		pacer->paced_packets++;
+		janus_ice_outgoing_traffic_handle(handle, pkt);
+	}
+	if(pkt == NULL) {
+		g_source_set_ready_time(source, -1);
+		return;
+	}
+	/* Wake up when we'll have tokens again, or when the first packet will have waited too long */
+	gint64 wait = (pacer->rate > 0) ? ((1 - pacer->tokens) * 8 * G_USEC_PER_SEC) / pacer->rate : 1000;
+	gint64 deadline = JANUS_ICE_PACER_MAX_DELAY - (now - pkt->added);
+	if(wait > deadline)
+		wait = deadline;
+	if(wait < 1000)
+		wait = 1000;
+	g_source_set_ready_time(source, g_get_monotonic_time() + wait);
+}
+/* Check if a packet needs to be queued in the pacer: if not, it consumes tokens anyway */
+static gboolean janus_ice_outgoing_traffic_pace(janus_ice_handle *handle, janus_ice_queued_packet *pkt) {
+	if(!pacing || pkt == NULL || pkt->data == NULL)
+		return FALSE;
+	if(pkt->type != JANUS_ICE_PACKET_AUDIO && pkt->type != JANUS_ICE_PACKET_VIDEO)
+		return FALSE;
+	janus_ice_pacer *pacer = handle->pacer;
+	if(pacer == NULL) {
+		pacer = g_malloc0(sizeof(janus_ice_pacer));
+		pacer->queue = g_queue_new();
+		handle->pacer = pacer;
+	}
+	if(!janus_ice_pacer_is_paced(pkt)) {
+		/* Audio, RTCP or retransmission, send right away */
+		janus_ice_pacer_refill(handle, pacer, janus_get_cached_monotonic_time());
+		pacer->tokens -= pkt->length;
+		return FALSE;
+	}
+	g_queue_push_tail(pacer->queue, pkt);
+	return TRUE;
+}
+/* Take note of how long packets waited in the pacer, for stats (called once per second) */
+static void janus_ice_pacer_update_stats(janus_ice_pacer *pacer) {
+	if(pacer == NULL)
+		return;
+	pacer->last_delay_avg = pacer->delay_count ? (pacer->delay_sum / pacer->delay_count) : 0;
+	pacer->last_delay_max = pacer->delay_max;
+	pacer->delay_sum = 0;
+	pacer->delay_max = 0;
+	pacer->delay_count = 0;
+}
+json_t *janus_ice_pacer_summary(janus_ice_handle *handle) {
+	janus_ice_pacer *pacer = handle ? handle->pacer : NULL;
+	if(pacer == NULL)
+		return NULL;
+	json_t *info = json_object();
+	json_object_set_new(info, "rate", json_integer(pacer->rate));
+	json_object_set_new(info, "queued", json_integer(g_queue_get_length(pacer->queue)));
+	json_object_set_new(info, "paced-packets", json_integer(pacer->paced_packets));
+	json_object_set_new(info, "queue-delay-avg", json_integer(pacer->last_delay_avg));
+	json_object_set_new(info, "queue-delay-max", json_integer(pacer->last_delay_max));
+	return info;
+}
+
+/* Bounded lock-free queue for outgoing media packets: plugin threads push
+ * RTP/RTCP packets here rather than in the GAsyncQueue, which would take a
+ * mutex on each push and pop. This is a ring of cells with a sequence number
+ * each (Vyukov's bounded queue), where producers and consumers only compete
+ * on atomic counters. Wakeups of the loop are coalesced, as we only need to
+ * wake it up when the queue goes from empty to non-empty. What happens when
+ * the ring is full depends on the configured overflow policy: we can either
+ * drop the packet, or spill it to the (unbounded) GAsyncQueue instead */
+#define DEFAULT_PACKET_QUEUE_SIZE	1024
+#define JANUS_ICE_MAX_PACKET_QUEUE_SIZE	65536
+typedef struct janus_ice_packet_ring_cell {
+	volatile gint sequence;
+	janus_ice_queued_packet *pkt;
+} janus_ice_packet_ring_cell;
+typedef struct janus_ice_packet_ring {
+	guint mask;
+	volatile gint head, tail;
+	volatile gint pending;
+	janus_ice_packet_ring_cell *cells;
+} janus_ice_packet_ring;
+static guint packet_queue_size = DEFAULT_PACKET_QUEUE_SIZE;
+static gboolean packet_queue_spill = FALSE;
+void janus_ice_set_packet_queue(uint size, const char *overflow) {
+	if(size > JANUS_ICE_MAX_PACKET_QUEUE_SIZE) {
+		JANUS_LOG(LOG_WARN, "Packet queue size too large (%u), limiting to %d\n", size, JANUS_ICE_MAX_PACKET_QUEUE_SIZE);
+		size = JANUS_ICE_MAX_PACKET_QUEUE_SIZE;
+	}
+	if(size > 0 && (size & (size-1)) != 0) {
+		/* We need a power of two */
+		guint rounded = 1;
+		while(rounded < size)
+			rounded <<= 1;
+		JANUS_LOG(LOG_WARN, "Packet queue size is not a power of two (%u), rounding to %u\n", size, rounded);
+		size = rounded;
+	}
+	packet_queue_size = size;
+	if(overflow != NULL) {
+		if(!strcasecmp(overflow, "spill")) {
+			packet_queue_spill = TRUE;
+		} else if(!strcasecmp(overflow, "drop")) {
+			packet_queue_spill = FALSE;
+		} else {
+			JANUS_LOG(LOG_WARN, "Unsupported packet queue overflow policy '%s', falling back to 'drop'\n", overflow);
+			packet_queue_spill = FALSE;
+		}
+	}
+	if(packet_queue_size == 0)
+		JANUS_LOG(LOG_VERB, "Disabling lock-free packet queues\n");
+	else
+		JANUS_LOG(LOG_VERB, "Using lock-free packet queues of %u packets (overflow policy: %s)\n",
+			packet_queue_size, packet_queue_spill ? "spill" : "drop");
+}
+uint janus_ice_get_packet_queue_size(void) {
+	return packet_queue_size;
+}
+const char *janus_ice_get_packet_queue_overflow(void) {
+	return packet_queue_spill ? "spill" : "drop";
+}
+static janus_ice_packet_ring *janus_ice_packet_ring_new(guint size) {
+	janus_ice_packet_ring *ring = g_malloc0(sizeof(janus_ice_packet_ring));
+	ring->mask = size-1;
+	ring->cells = g_malloc0(size * sizeof(janus_ice_packet_ring_cell));
+	guint i = 0;
+	for(i=0; i<size; i++)
+		ring->cells[i].sequence = i;
+	return ring;
+}
+static void janus_ice_packet_ring_free(janus_ice_packet_ring *ring) {
+	if(ring == NULL)
+		return;
+	g_free(ring->cells);
+	g_free(ring);
+}
+/* Returns TRUE if the packet was added, FALSE if the ring is full */
+static gboolean janus_ice_packet_ring_push(janus_ice_packet_ring *ring, janus_ice_queued_packet *pkt) {
+	janus_ice_packet_ring_cell *cell = NULL;
+	guint pos = (guint)g_atomic_int_get(&ring->tail);
+	while(TRUE) {
+		cell = &ring->cells[pos & ring->mask];
+		gint diff = (gint)((guint)g_atomic_int_get(&cell->sequence) - pos);
+		if(diff == 0) {
+			if(g_atomic_int_compare_and_exchange(&ring->tail, (gint)pos, (gint)(pos+1)))
+				break;
+		} else if(diff < 0) {
+			/* Full */
+			return FALSE;
+		}
+		pos = (guint)g_atomic_int_get(&ring->tail);
+	}
+	cell->pkt = pkt;
+	g_atomic_int_set(&cell->sequence, (gint)(pos+1));
+	return TRUE;
+}
+/* Returns TRUE if all the packets were added with a single reservation, FALSE
+ * if the ring can't fit all of them (in which case none was added): since the
+ * handle loop is the only consumer, cells are released in order, which means
+ * that if the last cell we need is free, all the ones before it are too */
+static gboolean janus_ice_packet_ring_push_batch(janus_ice_packet_ring *ring, janus_ice_queued_packet **pkts, guint count) {
+	if(count == 0)
+		return TRUE;
+	if(count > ring->mask+1)
+		return FALSE;
+	guint pos = (guint)g_atomic_int_get(&ring->tail);
+	while(TRUE) {
+		janus_ice_packet_ring_cell *last = &ring->cells[(pos+count-1) & ring->mask];
+		gint diff = (gint)((guint)g_atomic_int_get(&last->sequence) - (pos+count-1));
+		if(diff == 0) {
+			if(g_atomic_int_compare_and_exchange(&ring->tail, (gint)pos, (gint)(pos+count)))
+				break;
+		} else if(diff < 0) {
+			/* Not enough room */
+			return FALSE;
+		}
+		pos = (guint)g_atomic_int_get(&ring->tail);
+	}
+	guint i = 0;
+	for(i=0; i<count; i++) {
+		janus_ice_packet_ring_cell *cell = &ring->cells[(pos+i) & ring->mask];
+		cell->pkt = pkts[i];
+		g_atomic_int_set(&cell->sequence, (gint)(pos+i+1));
+	}
+	return TRUE;
+}
+static gboolean janus_ice_packet_ring_pending(janus_ice_packet_ring *ring) {
+	return g_atomic_int_get(&ring->pending) > 0;
+}
+static janus_ice_queued_packet *janus_ice_packet_ring_pop(janus_ice_packet_ring *ring) {
+	janus_ice_packet_ring_cell *cell = NULL;
+	guint pos = (guint)g_atomic_int_get(&ring->head);
+	while(TRUE) {
+		cell = &ring->cells[pos & ring->mask];
+		gint diff = (gint)((guint)g_atomic_int_get(&cell->sequence) - (pos+1));
+		if(diff == 0) {
+			if(g_atomic_int_compare_and_exchange(&ring->head, (gint)pos, (gint)(pos+1)))
+				break;
+		} else if(diff < 0) {
+			/* Empty (or the next packet is still being written) */
+			return NULL;
+		}
+		pos = (guint)g_atomic_int_get(&ring->head);
+	}
+	janus_ice_queued_packet *pkt = cell->pkt;
+	cell->pkt = NULL;
+	g_atomic_int_set(&cell->sequence, (gint)(pos + ring->mask + 1));
+	g_atomic_int_add(&ring->pending, -1);
+	return pkt;
 }
 
 /* Minimum and maximum value, in milliseconds, for the NACK queue/retransmissions (default=200ms/1000ms) */
@@ -713,72 +1715,119 @@ static void janus_cleanup_nack_buffer(gint64 now, janus_ice_peerconnection *pc,
 			continue;
 		if((medium->type == JANUS_MEDIA_AUDIO && !audio) || (medium->type == JANUS_MEDIA_VIDEO && !video))
 			continue;
-		if(medium->retransmit_buffer) {
-			janus_rtp_packet *p = (janus_rtp_packet *)g_queue_peek_head(medium->retransmit_buffer);
-			while(p && (!now || (now - p->created >= (gint64)medium->nack_queue_ms*1000))) {
-				/* Packet is too old, get rid of it */
-				g_queue_pop_head(medium->retransmit_buffer);
-				/* Remove from hashtable too */
-				janus_rtp_header *header = (janus_rtp_header *)p->data;
-				guint16 seq = ntohs(header->seq_number);
-				g_hash_table_remove(medium->retransmit_seqs, GUINT_TO_POINTER(seq));
-				/* Free the packet */
-				janus_ice_free_rtp_packet(p);
-				p = (janus_rtp_packet *)g_queue_peek_head(medium->retransmit_buffer);
-			}
-		}
+		/* Get rid of the packets that are too old */
+		janus_ice_retransmit_buffer_cleanup(medium->retransmit_buffer, now, (gint64)medium->nack_queue_ms*1000);
+		if(medium->retransmit_buffer != NULL)
+			medium->retransmit_memory = medium->retransmit_buffer->memory;
 	}
 }
 
 
 #define SEQ_MISSING_WAIT 12000 /*  12ms */
 #define SEQ_NACKED_WAIT 155000 /* 155ms */
-/* janus_seq_info list functions */
-static void janus_seq_append(janus_seq_info **head, janus_seq_info *new_seq) {
-	if(*head == NULL) {
-		new_seq->prev = new_seq;
-		new_seq->next = new_seq;
-		*head = new_seq;
-	} else {
-		janus_seq_info *last_seq = (*head)->prev;
-		new_seq->prev = last_seq;
-		new_seq->next = *head;
-		(*head)->prev = new_seq;
-		last_seq->next = new_seq;
-	}
-}
-static janus_seq_info *janus_seq_pop_head(janus_seq_info **head) {
-	janus_seq_info *pop_seq = *head;
-	if(pop_seq) {
-		janus_seq_info *new_head = pop_seq->next;
-		if(pop_seq == new_head || new_head == NULL) {
-			*head = NULL;
+/* janus_seq_window functions */
+#define SEQ_WINDOW_MASK (JANUS_SEQ_WINDOW_SIZE-1)
+guint32 janus_ice_pt_map_lookup(const janus_ice_pt_map *map, int pt) {
+	if(map == NULL || pt < 0 || pt > 127)
+		return 0;
+	if(map->by_pt != NULL)
+		return map->by_pt[pt];
+	guint8 i = 0;
+	for(i=0; i<map->count; i++) {
+		if(map->pts[i] == pt)
+			return map->values[i];
+	}
+	return 0;
+}
+
+void janus_ice_pt_map_insert(janus_ice_pt_map *map, int pt, guint32 value) {
+	if(map == NULL || pt < 0 || pt > 127)
+		return;
+	if(map->by_pt != NULL) {
+		if(map->by_pt[pt] == 0 && value > 0)
+			map->count++;
+		else if(map->by_pt[pt] > 0 && value == 0)
+			map->count--;
+		map->by_pt[pt] = value;
+		return;
+	}
+	guint8 i = 0;
+	for(i=0; i<map->count; i++) {
+		if(map->pts[i] != pt)
+			continue;
+		if(value > 0) {
+			map->values[i] = value;
 		} else {
-			*head = new_head;
-			new_head->prev = pop_seq->prev;
-			new_head->prev->next = new_head;
+			/* Move the last mapping where this one was */
+			map->count--;
+			map->pts[i] = map->pts[map->count];
+			map->values[i] = map->values[map->count];
+		}
+		return;
+	}
+	if(value == 0)
+		return;
+	if(map->count < JANUS_ICE_PT_MAP_INLINE) {
+		map->pts[map->count] = pt;
+		map->values[map->count] = value;
+		map->count++;
+		return;
+	}
+	/* No room left inline, switch to an array indexed by payload type */
+	map->by_pt = g_malloc0(128 * sizeof(guint32));
+	for(i=0; i<map->count; i++)
+		map->by_pt[map->pts[i]] = map->values[i];
+	map->by_pt[pt] = value;
+	map->count++;
+}
+
+gboolean janus_ice_pt_map_contains_value(const janus_ice_pt_map *map, guint32 value) {
+	if(map == NULL || value == 0)
+		return FALSE;
+	guint8 i = 0;
+	if(map->by_pt != NULL) {
+		for(i=0; i<128; i++) {
+			if(map->by_pt[i] == value)
+				return TRUE;
 		}
+		return FALSE;
+	}
+	for(i=0; i<map->count; i++) {
+		if(map->values[i] == value)
+			return TRUE;
 	}
-	return pop_seq;
+	return FALSE;
 }
-void janus_seq_list_free(janus_seq_info **head) {
-	if(!*head)
+
+void janus_ice_pt_map_clear(janus_ice_pt_map *map) {
+	if(map == NULL)
 		return;
-	janus_seq_info *cur = *head;
-	do {
-		janus_seq_info *next = cur->next;
-		g_free(cur);
-		cur = next;
-	} while(cur != *head);
-	*head = NULL;
+	g_free(map->by_pt);
+	memset(map, 0, sizeof(*map));
 }
-static int janus_seq_in_range(guint16 seqn, guint16 start, guint16 len) {
-	/* Supports wrapping sequence (easier with int range) */
-	int n = seqn;
-	int nh = (1<<16) + n;
-	int s = start;
-	int e = s + len;
-	return (s <= n && n < e) || (s <= nh && nh < e);
+
+void janus_seq_window_reset(janus_seq_window *window) {
+	if(window == NULL)
+		return;
+	window->started = FALSE;
+	memset(window->missing, 0, sizeof(window->missing));
+}
+static inline void janus_seq_window_set_missing(janus_seq_window *window, guint16 seq, gint64 now) {
+	guint16 index = seq & SEQ_WINDOW_MASK;
+	window->missing[index/64] |= ((guint64)1 << (index%64));
+	window->ts[index] = now;
+	window->state[index] = SEQ_MISSING;
+}
+static inline gboolean janus_seq_window_clear_missing(janus_seq_window *window, guint16 seq) {
+	guint16 index = seq & SEQ_WINDOW_MASK;
+	guint64 bit = ((guint64)1 << (index%64));
+	gboolean was_missing = (window->missing[index/64] & bit) != 0;
+	window->missing[index/64] &= ~bit;
+	return was_missing;
+}
+static gint janus_seq_compare(gconstpointer a, gconstpointer b) {
+	/* Sequence numbers can wrap */
+	return (gint16)(GPOINTER_TO_UINT(a) - GPOINTER_TO_UINT(b));
 }
 
 
@@ -827,6 +1876,14 @@ static void janus_ice_clear_queued_packets(janus_ice_handle *handle) {
 		pkt = g_async_queue_try_pop(handle->queued_packets);
 		janus_ice_free_queued_packet(pkt);
 	}
+	if(handle->packet_ring != NULL) {
+		while((pkt = janus_ice_packet_ring_pop(handle->packet_ring)) != NULL)
+			janus_ice_free_queued_packet(pkt);
+	}
+	if(handle->pacer != NULL) {
+		while((pkt = g_queue_pop_head(handle->pacer->queue)) != NULL)
+			janus_ice_free_queued_packet(pkt);
+	}
 }
 
 
@@ -887,7 +1944,7 @@ static void janus_ice_notify_media(janus_ice_handle *handle, char *mid, gboolean
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Sending event to transport...\n", handle->handle_id);
 	janus_session_notify_event(session, event);
 	/* Notify event handlers as well */
-	if(janus_events_is_enabled()) {
+	if(janus_events_is_interested(JANUS_EVENT_TYPE_MEDIA)) {
 		json_t *info = json_object();
 		json_object_set_new(info, "media", json_string(video ? "video" : "audio"));
 		json_object_set_new(info, "mid", json_string(mid));
@@ -940,7 +1997,7 @@ void janus_ice_notify_hangup(janus_ice_handle *handle, const char *reason) {
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Sending event to transport...; %p\n", handle->handle_id, handle);
 	janus_session_notify_event(session, event);
 	/* Notify event handlers as well */
-	if(janus_events_is_enabled()) {
+	if(janus_events_is_interested(JANUS_EVENT_TYPE_WEBRTC)) {
 		json_t *info = json_object();
 		json_object_set_new(info, "connection", json_string("hangup"));
 		if(reason != NULL)
@@ -976,6 +2033,8 @@ gint janus_ice_trickle_parse(janus_ice_handle *handle, json_t *candidate, const
 	if(!json_is_object(candidate) || json_object_get(candidate, "completed") != NULL) {
 		JANUS_LOG(LOG_VERB, "No more remote candidates for handle %"SCNu64"!\n", handle->handle_id);
 		janus_flags_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALL_TRICKLES);
+		/* No point in waiting for more candidates to batch */
+		janus_ice_flush_remote_candidates(handle);
 	} else {
 		/* Handle remote candidate */
 		json_t *mid = json_object_get(candidate, "sdpMid");
@@ -1083,6 +2142,9 @@ void janus_ice_init(gboolean ice_lite, gboolean ice_tcp, gboolean full_trickle,
 	if(!janus_mdns_enabled)
 		JANUS_LOG(LOG_WARN, "mDNS resolution disabled, .local candidates will be ignored\n");
 
+	/* Prepare the pool of outgoing packets */
+	janus_ice_packet_pool_init();
+
 	/* We keep track of plugin sessions to avoid problems */
 	plugin_sessions = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_plugin_session_dereference);
 	janus_mutex_init(&plugin_sessions_mutex);
@@ -1095,9 +2157,115 @@ void janus_ice_init(gboolean ice_lite, gboolean ice_tcp, gboolean full_trickle,
 }
 
 void janus_ice_deinit(void) {
+	janus_ice_mux_deinit();
 #ifdef HAVE_TURNRESTAPI
 	janus_turnrest_deinit();
 #endif
+	janus_ice_packet_pool_deinit();
+}
+
+/* Helper to get the list of local addresses we should gather candidates for,
+ * that is all the addresses of the interfaces that are up, except those in
+ * the ignore list (or those not in the enforce list, if there's one) */
+static GList *janus_ice_get_local_addresses(void) {
+	GList *addresses = NULL;
+	struct ifaddrs *ifaddr, *ifa;
+	int family, s, n;
+	char host[NI_MAXHOST];
+	if(getifaddrs(&ifaddr) == -1) {
+		JANUS_LOG(LOG_ERR, "Error getting list of interfaces... %d (%s)\n", errno, g_strerror(errno));
+		return NULL;
+	}
+	for(ifa = ifaddr, n = 0; ifa != NULL; ifa = ifa->ifa_next, n++) {
+		if(ifa->ifa_addr == NULL)
+			continue;
+		/* Skip interfaces which are not up and running */
+		if(!((ifa->ifa_flags & IFF_UP) && (ifa->ifa_flags & IFF_RUNNING)))
+			continue;
+		/* Skip loopback interfaces */
+		if(ifa->ifa_flags & IFF_LOOPBACK)
+			continue;
+		family = ifa->ifa_addr->sa_family;
+		if(family != AF_INET && family != AF_INET6)
+			continue;
+		/* We only add IPv6 addresses if support for them has been explicitly enabled */
+		if(family == AF_INET6 && !janus_ipv6_enabled)
+			continue;
+		/* Check the interface name first, we can ignore that as well: enforce list would be checked later */
+		if(janus_ice_enforce_list == NULL && ifa->ifa_name != NULL && janus_ice_is_ignored(ifa->ifa_name))
+			continue;
+		s = getnameinfo(ifa->ifa_addr,
+				(family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6),
+				host, NI_MAXHOST, NULL, 0, NI_NUMERICHOST);
+		if(s != 0) {
+			JANUS_LOG(LOG_ERR, "getnameinfo() failed: %s\n", gai_strerror(s));
+			continue;
+		}
+		/* Skip 0.0.0.0, :: and, unless otherwise configured, local scoped addresses  */
+		if(!strcmp(host, "0.0.0.0") || !strcmp(host, "::") || (!janus_ipv6_linklocal_enabled && !strncmp(host, "fe80:", 5)))
+			continue;
+		/* Check if this IP address is in the ignore/enforce list: the enforce list has the precedence but the ignore list can then discard candidates */
+		if(janus_ice_enforce_list != NULL) {
+			if(ifa->ifa_name != NULL && !janus_ice_is_enforced(ifa->ifa_name) && !janus_ice_is_enforced(host))
+				continue;
+		}
+		if(janus_ice_is_ignored(host))
+			continue;
+		addresses = g_list_append(addresses, g_strdup(host));
+	}
+	freeifaddrs(ifaddr);
+	return addresses;
+}
+
+/* ICE mux callbacks: they're invoked in the threads of the shared sockets,
+ * so we just queue what we need to do in the loop of the handle, where
+ * the packets are processed as if libnice had received them for us */
+static void janus_ice_mux_incoming(void *data, char *buf, int len) {
+	janus_ice_handle *handle = (janus_ice_handle *)data;
+	if(handle == NULL || handle->mux_incoming == NULL || g_atomic_int_get(&handle->destroyed))
+		return;
+	janus_ice_queued_packet *pkt = janus_ice_queued_packet_new(len);
+	memcpy(pkt->data, buf, len);
+	pkt->length = len;
+	pkt->label = NULL;
+	pkt->protocol = NULL;
+	g_async_queue_push(handle->mux_incoming, pkt);
+	if(handle->mainctx != NULL)
+		g_main_context_wakeup(handle->mainctx);
+}
+static void janus_ice_mux_nominated_pair(void *data) {
+	janus_ice_handle *handle = (janus_ice_handle *)data;
+	if(handle == NULL || handle->queued_packets == NULL || g_atomic_int_get(&handle->destroyed))
+		return;
+#if GLIB_CHECK_VERSION(2, 46, 0)
+	g_async_queue_push_front(handle->queued_packets, &janus_ice_mux_nominated);
+#else
+	g_async_queue_push(handle->queued_packets, &janus_ice_mux_nominated);
+#endif
+	if(handle->mainctx != NULL)
+		g_main_context_wakeup(handle->mainctx);
+}
+
+int janus_ice_set_mux(uint16_t port, int sockets, gboolean offload) {
+	if(port == 0)
+		return -1;
+	if(!janus_ice_lite_enabled) {
+		JANUS_LOG(LOG_WARN, "The ICE mux is only available in ICE Lite mode, ignoring\n");
+		return -1;
+	}
+	if(janus_ice_tcp_enabled)
+		JANUS_LOG(LOG_WARN, "ICE-TCP candidates are not gathered when using the ICE mux\n");
+	if(janus_stun_server != NULL || janus_turn_server != NULL)
+		JANUS_LOG(LOG_WARN, "STUN/TURN servers are not used when using the ICE mux\n");
+	GList *addresses = janus_ice_get_local_addresses();
+	int res = janus_ice_mux_init(addresses, port, sockets, dscp_ef > 0 ? (dscp_ef << 2) : 0, offload,
+		janus_ice_mux_incoming, janus_ice_mux_nominated_pair);
+	g_list_free_full(addresses, (GDestroyNotify)g_free);
+	return res;
+}
+
+gboolean janus_ice_is_mux_enabled(void) {
+	return janus_ice_mux_is_enabled();
 }
 
 int janus_ice_test_stun_server(janus_network_address *addr, uint16_t port,
@@ -1376,6 +2544,7 @@ static void *janus_ice_handle_thread(void *data) {
 	}
 	JANUS_LOG(LOG_DBG, "[%"SCNu64"] Looping...\n", handle->handle_id);
 	g_main_loop_run(handle->mainloop);
+	janus_timer_wheel_stop(handle->timers);
 	janus_ice_webrtc_free(handle);
 	handle->thread = NULL;
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Handle thread ended! %p\n", handle->handle_id, handle);
@@ -1386,11 +2555,23 @@ static void *janus_ice_handle_thread(void *data) {
 }
 
 janus_ice_handle *janus_ice_handle_create(void *core_session, const char *opaque_id, const char *token) {
+	return janus_ice_handle_create_with_id(core_session, 0, opaque_id, token);
+}
+
+janus_ice_handle *janus_ice_handle_create_with_id(void *core_session, guint64 handle_id, const char *opaque_id, const char *token) {
 	if(core_session == NULL)
 		return NULL;
 	janus_session *session = (janus_session *)core_session;
 	janus_ice_handle *handle = NULL;
-	guint64 handle_id = 0;
+	if(handle_id > 0) {
+		handle = janus_session_handles_find(session, handle_id);
+		if(handle != NULL) {
+			/* Handle ID already taken */
+			janus_refcount_decrease(&handle->ref);	/* janus_session_handles_find increases it */
+			JANUS_LOG(LOG_ERR, "Handle %"SCNu64" already exists in session %"SCNu64"\n", handle_id, session->session_id);
+			return NULL;
+		}
+	}
 	while(handle_id == 0) {
 		handle_id = janus_random_uint64();
 		handle = janus_session_handles_find(session, handle_id);
@@ -1414,14 +2595,30 @@ janus_ice_handle *janus_ice_handle_create(void *core_session, const char *opaque
 	handle->app = NULL;
 	handle->app_handle = NULL;
 	handle->queued_candidates = g_async_queue_new();
+	g_atomic_int_set(&handle->candidates_scheduled, 0);
 	handle->queued_packets = g_async_queue_new();
+	if(janus_ice_mux_is_enabled())
+		handle->mux_incoming = g_async_queue_new();
+	if(packet_queue_size > 0)
+		handle->packet_ring = janus_ice_packet_ring_new(packet_queue_size);
 	janus_mutex_init(&handle->mutex);
 	janus_flags_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT);
 	janus_session_handles_insert(session, handle);
+#ifdef HAVE_TURNRESTAPI
+	/* If we'll need TURN credentials, start retrieving them already, so
+	 * that they'll likely be there when we set up the PeerConnection */
+	if(!janus_ice_mux_is_enabled() && janus_turnrest_get_backend() != NULL) {
+		char turnrest_username[20];
+		if(opaque_id == NULL)
+			g_snprintf(turnrest_username, sizeof(turnrest_username), "%"SCNu64, session->session_id);
+		janus_turnrest_prefetch(opaque_id ? opaque_id : turnrest_username);
+	}
+#endif
 	return handle;
 }
 
-gint janus_ice_handle_attach_plugin(void *core_session, janus_ice_handle *handle, janus_plugin *plugin, int loop_index) {
+gint janus_ice_handle_attach_plugin(void *core_session, janus_ice_handle *handle, janus_plugin *plugin,
+		int loop_index, const char *loop_group) {
 	if(core_session == NULL)
 		return JANUS_ERROR_SESSION_NOT_FOUND;
 	janus_session *session = (janus_session *)core_session;
@@ -1454,6 +2651,7 @@ gint janus_ice_handle_attach_plugin(void *core_session, janus_ice_handle *handle
 	janus_mutex_lock(&plugin_sessions_mutex);
 	g_hash_table_insert(plugin_sessions, session_handle, session_handle);
 	janus_mutex_unlock(&plugin_sessions_mutex);
+	janus_metrics_plugin_handles(plugin->get_package(), 1);
 	/* Create a new context, loop, and source */
 	if(static_event_loops == 0) {
 		handle->mainctx = g_main_context_new();
@@ -1463,10 +2661,28 @@ gint janus_ice_handle_attach_plugin(void *core_session, janus_ice_handle *handle
 		if(!allow_loop_indication && loop_index > -1) {
 			JANUS_LOG(LOG_WARN, "[%"SCNu64"] Manual allocation of event loops forbidden, ignoring provided loop index %d\n", handle->handle_id, loop_index);
 		}
+		if(!allow_loop_indication && loop_group != NULL) {
+			JANUS_LOG(LOG_WARN, "[%"SCNu64"] Manual allocation of event loops forbidden, ignoring provided loop group %s\n", handle->handle_id, loop_group);
+			loop_group = NULL;
+		}
 		janus_refcount_increase(&handle->ref);
 		janus_mutex_lock(&event_loops_mutex);
 		gboolean automatic_selection = TRUE;
-		if(allow_loop_indication && loop_index != -1) {
+		janus_ice_loop_group *group = NULL;
+		if(loop_group != NULL && loop_groups != NULL)
+			group = g_hash_table_lookup(loop_groups, loop_group);
+		if(group != NULL && loop_index == -1) {
+			/* Other handles in the same group exist already, use the same loop */
+			janus_ice_static_event_loop *loop = group->loop;
+			janus_refcount_increase(&loop->ref);
+			automatic_selection = FALSE;
+			handle->mainctx = loop->mainctx;
+			handle->mainloop = loop->mainloop;
+			handle->static_event_loop = loop;
+			loop->handles++;
+			g_atomic_int_inc(&loop->pending);
+			JANUS_LOG(LOG_VERB, "[%"SCNu64"] Added handle to loop #%d (group %s)\n", handle->handle_id, loop->id, loop_group);
+		} else if(allow_loop_indication && loop_index != -1) {
 			/* The API can drive the selection and an index was provided, check if it exists */
 			janus_ice_static_event_loop *loop = g_slist_nth_data(event_loops, loop_index);
 			if(loop == NULL) {
@@ -1476,13 +2692,17 @@ gint janus_ice_handle_attach_plugin(void *core_session, janus_ice_handle *handle
 				automatic_selection = FALSE;
 				handle->mainctx = loop->mainctx;
 				handle->mainloop = loop->mainloop;
+				handle->static_event_loop = loop;
 				loop->handles++;
+				g_atomic_int_inc(&loop->pending);
 				JANUS_LOG(LOG_VERB, "[%"SCNu64"] Manually added handle to loop #%d\n", handle->handle_id, loop->id);
 			}
 		}
 		if(automatic_selection) {
-			/* Pick an available loop automatically (least loaded) */
-			int handles = -1;
+			/* Pick an available loop automatically: we look at the measured load
+			 * (CPU time of the loop thread), and only use the number of handles
+			 * to choose among loops that are equally loaded */
+			int score = -1;
 			janus_ice_static_event_loop *loop = NULL;
 			GSList *l = event_loops;
 			while(l) {
@@ -1492,24 +2712,43 @@ gint janus_ice_handle_attach_plugin(void *core_session, janus_ice_handle *handle
 					loop = el;
 					break;
 				}
-				if(handles == -1 || el->handles < handles) {
-					handles = el->handles;
+				int el_score = janus_ice_static_event_loop_score(el);
+				if(score == -1 || el_score < score || (el_score == score && el->handles < loop->handles)) {
+					score = el_score;
 					loop = el;
 				}
 				l = l->next;
 			}
 			janus_refcount_increase(&loop->ref);
 			loop->handles++;
+			g_atomic_int_inc(&loop->pending);
 			handle->mainctx = loop->mainctx;
 			handle->mainloop = loop->mainloop;
 			handle->static_event_loop = loop;
 			JANUS_LOG(LOG_VERB, "[%"SCNu64"] Automatically added handle to loop #%d\n", handle->handle_id, loop->id);
 		}
+		if(loop_group != NULL) {
+			/* Keep track of the group this handle belongs to */
+			if(group == NULL) {
+				if(loop_groups == NULL)
+					loop_groups = g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, (GDestroyNotify)g_free);
+				group = g_malloc0(sizeof(janus_ice_loop_group));
+				group->loop = (janus_ice_static_event_loop *)handle->static_event_loop;
+				g_hash_table_insert(loop_groups, g_strdup(loop_group), group);
+			}
+			group->handles++;
+			handle->loop_group = g_strdup(loop_group);
+		}
 		janus_mutex_unlock(&event_loops_mutex);
 	}
 	handle->rtp_source = janus_ice_outgoing_traffic_create(handle, (GDestroyNotify)g_free);
 	g_source_set_priority(handle->rtp_source, G_PRIORITY_DEFAULT);
 	g_source_attach(handle->rtp_source, handle->mainctx);
+	/* Timers are served by a wheel bound to the loop, rather than individual sources */
+	if(handle->static_event_loop != NULL)
+		handle->timers = janus_timer_wheel_ref(((janus_ice_static_event_loop *)handle->static_event_loop)->timers);
+	else
+		handle->timers = janus_timer_wheel_new(handle->mainctx);
 	if(static_event_loops == 0) {
 		/* Now spawn a thread for this loop */
 		GError *terror = NULL;
@@ -1528,14 +2767,14 @@ gint janus_ice_handle_attach_plugin(void *core_session, janus_ice_handle *handle
 		}
 	}
 	/* Notify event handlers */
-	if(janus_events_is_enabled())
+	if(janus_events_is_interested(JANUS_EVENT_TYPE_HANDLE))
 		janus_events_notify_handlers(JANUS_EVENT_TYPE_HANDLE, JANUS_EVENT_SUBTYPE_NONE,
 			session->session_id, handle->handle_id, "attached", plugin->get_package(), handle->opaque_id, handle->token);
 	return 0;
 }
 
 gint janus_ice_handle_destroy(void *core_session, janus_ice_handle *handle) {
-	/* session->mutex has to be locked when calling this function */
+	/* session->handles_lock has to be write locked when calling this function */
 	janus_session *session = (janus_session *)core_session;
 	if(session == NULL)
 		return JANUS_ERROR_SESSION_NOT_FOUND;
@@ -1561,6 +2800,12 @@ gint janus_ice_handle_destroy(void *core_session, janus_ice_handle *handle) {
 		janus_refcount_decrease(&loop->ref);
 		JANUS_LOG(LOG_VERB, "[%"SCNu64"] Manually removed handle from loop #%d\n", handle->handle_id, loop->id);
 	}
+	if(handle->loop_group != NULL && loop_groups != NULL) {
+		/* Get rid of the loop group, if this was the last handle in it */
+		janus_ice_loop_group *group = g_hash_table_lookup(loop_groups, handle->loop_group);
+		if(group != NULL && --group->handles == 0)
+			g_hash_table_remove(loop_groups, handle->loop_group);
+	}
 	janus_mutex_unlock(&event_loops_mutex);
 	janus_plugin *plugin_t = (janus_plugin *)handle->app;
 	if(plugin_t == NULL) {
@@ -1579,6 +2824,7 @@ gint janus_ice_handle_destroy(void *core_session, janus_ice_handle *handle) {
 		handle, handle ? handle->app_handle : NULL,
 		(handle && handle->app_handle) ? handle->app_handle->gateway_handle : NULL,
 		(handle && handle->app_handle) ? handle->app_handle->plugin_handle : NULL);
+	janus_metrics_plugin_handles(plugin_t->get_package(), -1);
 	/* Actually detach handle... */
 	if(g_atomic_int_compare_and_exchange(&handle->app_handle->stopped, 0, 1)) {
 		/* Notify the plugin that the session's over (the plugin will
@@ -1610,6 +2856,18 @@ static void janus_ice_handle_free(const janus_refcount *handle_ref) {
 		janus_ice_clear_queued_packets(handle);
 		g_async_queue_unref(handle->queued_packets);
 	}
+	if(handle->mux_incoming != NULL) {
+		janus_ice_queued_packet *pkt = NULL;
+		while((pkt = g_async_queue_try_pop(handle->mux_incoming)) != NULL)
+			janus_ice_free_queued_packet(pkt);
+		g_async_queue_unref(handle->mux_incoming);
+	}
+	janus_ice_packet_ring_free(handle->packet_ring);
+	handle->packet_ring = NULL;
+	janus_ice_send_batch_free(handle->send_batch);
+	handle->send_batch = NULL;
+	janus_ice_pacer_free(handle->pacer);
+	handle->pacer = NULL;
 	if(static_event_loops == 0 && handle->mainloop != NULL) {
 		g_main_loop_unref(handle->mainloop);
 		handle->mainloop = NULL;
@@ -1620,6 +2878,8 @@ static void janus_ice_handle_free(const janus_refcount *handle_ref) {
 	}
 	janus_mutex_unlock(&handle->mutex);
 	janus_ice_webrtc_free(handle);
+	janus_timer_wheel_unref(handle->timers);
+	handle->timers = NULL;
 	JANUS_LOG(LOG_INFO, "[%"SCNu64"] Handle and related resources freed; %p %p\n", handle->handle_id, handle, handle->session);
 	/* Finally, unref the session and free the handle */
 	if(handle->session != NULL) {
@@ -1628,6 +2888,9 @@ static void janus_ice_handle_free(const janus_refcount *handle_ref) {
 	}
 	g_free(handle->opaque_id);
 	g_free(handle->token);
+	if(handle->restored != NULL)
+		json_decref(handle->restored);
+	g_free(handle->loop_group);
 	g_free(handle);
 }
 
@@ -1701,11 +2964,21 @@ static void janus_ice_webrtc_free(janus_ice_handle *handle) {
 	}
 	handle->agent_created = 0;
 	handle->agent_started = 0;
+	if(handle->send_batch != NULL)
+		handle->send_batch->count = 0;
+	if(handle->pc != NULL && handle->pc->mux != NULL) {
+		/* Stop receiving traffic from the ICE mux */
+		janus_ice_mux_remove(handle->pc->mux);
+		handle->pc->mux = NULL;
+		janus_ice_queued_packet *pkt = NULL;
+		while(handle->mux_incoming != NULL && (pkt = g_async_queue_try_pop(handle->mux_incoming)) != NULL)
+			janus_ice_free_queued_packet(pkt);
+	}
 	if(handle->pc != NULL) {
 		janus_ice_peerconnection_destroy(handle->pc);
 		handle->pc = NULL;
 	}
-	if(handle->agent != NULL) {
+	if(handle->agent != NULL && !janus_ice_agent_pool_put(handle)) {
 #ifdef HAVE_CLOSE_ASYNC
 		if(G_IS_OBJECT(handle->agent)) {
 			JANUS_LOG(LOG_VERB, "[%"SCNu64"] Removing stream %d from agent %p\n",
@@ -1769,16 +3042,19 @@ void janus_ice_peerconnection_destroy(janus_ice_peerconnection *pc) {
 	if(pc == NULL)
 		return;
 	/* Remove all media instances */
+	g_ptr_array_set_size(pc->media_array, 0);
 	g_hash_table_remove_all(pc->media);
 	g_hash_table_remove_all(pc->media_byssrc);
 	g_hash_table_remove_all(pc->media_bymid);
-	g_hash_table_remove_all(pc->media_bytype);
-	/* Get rid of the DTLS stack */
-	if(pc->dtlsrt_source != NULL) {
-		g_source_destroy(pc->dtlsrt_source);
-		g_source_unref(pc->dtlsrt_source);
-		pc->dtlsrt_source = NULL;
+	guint t = 0;
+	for(t=0; t<=JANUS_MEDIA_DATA; t++) {
+		if(pc->media_bytype[t] != NULL)
+			janus_refcount_decrease(&pc->media_bytype[t]->ref);
+		pc->media_bytype[t] = NULL;
 	}
+	/* Get rid of the DTLS stack */
+	janus_timer_destroy(pc->dtlsrt_timer);
+	pc->dtlsrt_timer = NULL;
 	if(pc->dtls != NULL) {
 		janus_dtls_srtp_destroy(pc->dtls);
 		janus_refcount_decrease(&pc->dtls->ref);
@@ -1796,15 +3072,12 @@ static void janus_ice_peerconnection_free(const janus_refcount *pc_ref) {
 	janus_ice_peerconnection *pc = janus_refcount_containerof(pc_ref, janus_ice_peerconnection, ref);
 	/* This PeerConnection can be destroyed, free all the resources */
 	pc->handle = NULL;
+	g_ptr_array_free(pc->media_array, TRUE);
 	g_hash_table_destroy(pc->media);
 	g_hash_table_destroy(pc->media_byssrc);
 	g_hash_table_destroy(pc->media_bymid);
-	g_hash_table_destroy(pc->media_bytype);
-	if(pc->icestate_source != NULL) {
-		g_source_destroy(pc->icestate_source);
-		g_source_unref(pc->icestate_source);
-		pc->icestate_source = NULL;
-	}
+	janus_timer_destroy(pc->icestate_timer);
+	pc->icestate_timer = NULL;
 	g_free(pc->remote_hashing);
 	pc->remote_hashing = NULL;
 	g_free(pc->remote_fingerprint);
@@ -1813,8 +3086,10 @@ static void janus_ice_peerconnection_free(const janus_refcount *pc_ref) {
 	pc->ruser = NULL;
 	g_free(pc->rpass);
 	pc->rpass = NULL;
-	g_slist_free_full(pc->transport_wide_received_seq_nums, (GDestroyNotify)g_free);
-	pc->transport_wide_received_seq_nums = NULL;
+	g_free(pc->transport_wide_cc_ring);
+	pc->transport_wide_cc_ring = NULL;
+	janus_bwe_context_destroy(pc->bwe);
+	pc->bwe = NULL;
 	if(pc->candidates != NULL) {
 		GSList *i = NULL, *candidates = pc->candidates;
 		for(i = candidates; i; i = i->next) {
@@ -1850,24 +3125,22 @@ static void janus_ice_peerconnection_free(const janus_refcount *pc_ref) {
 	pc->remote_candidates = NULL;
 	g_free(pc->selected_pair);
 	pc->selected_pair = NULL;
-	if(pc->payload_types != NULL)
-		g_hash_table_destroy(pc->payload_types);
-	pc->payload_types = NULL;
-	if(pc->clock_rates != NULL)
-		g_hash_table_destroy(pc->clock_rates);
-	pc->clock_rates = NULL;
-	if(pc->rtx_payload_types != NULL)
-		g_hash_table_destroy(pc->rtx_payload_types);
-	pc->rtx_payload_types = NULL;
-	if(pc->rtx_payload_types_rev != NULL)
-		g_hash_table_destroy(pc->rtx_payload_types_rev);
-	pc->rtx_payload_types_rev = NULL;
+	janus_ice_pt_map_clear(&pc->payload_types);
+	janus_ice_pt_map_clear(&pc->clock_rates);
+	janus_ice_pt_map_clear(&pc->rtx_payload_types);
+	janus_ice_pt_map_clear(&pc->rtx_payload_types_rev);
 	if(pc->nacks_queue != NULL)
 		g_queue_free(pc->nacks_queue);
 	g_free(pc);
 	pc = NULL;
 }
 
+void janus_ice_peerconnection_medium_set_clock_rate(janus_ice_peerconnection_medium *medium, int pt, uint32_t clock_rate) {
+	if(medium == NULL || pt < 0 || pt > 127)
+		return;
+	medium->clock_rate_by_pt[pt] = clock_rate;
+}
+
 janus_ice_peerconnection_medium *janus_ice_peerconnection_medium_create(janus_ice_handle *handle, janus_media_type type) {
 	if(handle == NULL || handle->pc == NULL)
 		return NULL;
@@ -1880,10 +3153,14 @@ janus_ice_peerconnection_medium *janus_ice_peerconnection_medium_create(janus_ic
 	janus_refcount_init(&medium->ref, janus_ice_peerconnection_medium_free);
 	janus_refcount_increase(&pc->ref);
 	g_hash_table_insert(pc->media, GINT_TO_POINTER(medium->mindex), medium);
+	if((guint)medium->mindex >= pc->media_array->len)
+		g_ptr_array_set_size(pc->media_array, medium->mindex + 1);
+	g_ptr_array_index(pc->media_array, medium->mindex) = medium;
 	/* If this is audio or video, fill in some other fields too */
 	if(type == JANUS_MEDIA_AUDIO || type == JANUS_MEDIA_VIDEO) {
 		medium->payload_type = -1;
 		medium->rtx_payload_type = -1;
+		medium->fec_payload_type = -1;
 		medium->ssrc = janus_random_uint32();	/* FIXME Should we look for conflicts? */
 		if(janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RFC4588_RTX)) {
 			/* Create an SSRC for RFC4588 as well */
@@ -1902,12 +3179,14 @@ janus_ice_peerconnection_medium *janus_ice_peerconnection_medium_create(janus_ic
 			g_hash_table_insert(pc->media_byssrc, GINT_TO_POINTER(medium->ssrc_rtx), medium);
 			janus_refcount_increase(&medium->ref);
 		}
-		g_hash_table_insert(pc->media_bytype, GINT_TO_POINTER(type), medium);
+	}
+	/* For backwards compatibility, we address media by type too (the latest medium of each type) */
+	if(type <= JANUS_MEDIA_DATA) {
+		if(pc->media_bytype[type] != NULL)
+			janus_refcount_decrease(&pc->media_bytype[type]->ref);
+		pc->media_bytype[type] = medium;
 		janus_refcount_increase(&medium->ref);
 	}
-	/* For backwards compatibility, we address media by type too (e.g., first video stream) */
-	g_hash_table_insert(pc->media_bytype, GINT_TO_POINTER(type), medium);
-	janus_refcount_increase(&medium->ref);
 	return medium;
 }
 
@@ -1943,14 +3222,11 @@ static void janus_ice_peerconnection_medium_free(const janus_refcount *medium_re
 	medium->rid[2] = NULL;
 	g_list_free(medium->payload_types);
 	medium->payload_types = NULL;
-	if(medium->rtx_payload_types != NULL)
-		g_hash_table_destroy(medium->rtx_payload_types);
-	medium->rtx_payload_types = NULL;
-	if(medium->clock_rates != NULL)
-		g_hash_table_destroy(medium->clock_rates);
-	medium->clock_rates = NULL;
+	janus_ice_pt_map_clear(&medium->rtx_payload_types);
 	g_free(medium->codec);
 	medium->codec = NULL;
+	janus_fec_context_destroy(medium->fec);
+	medium->fec = NULL;
 	g_free(medium->rtcp_ctx[0]);
 	medium->rtcp_ctx[0] = NULL;
 	g_free(medium->rtcp_ctx[1]);
@@ -1972,32 +3248,18 @@ static void janus_ice_peerconnection_medium_free(const janus_refcount *medium_re
 			gpointer val;
 			g_hash_table_iter_init(&iter, medium->pending_nacked_cleanup);
 			while(g_hash_table_iter_next(&iter, NULL, &val)) {
-				GSource *source = val;
-				g_source_destroy(source);
+				janus_timer *timer = val;
+				janus_timer_destroy(timer);
 			}
 		}
 		g_hash_table_destroy(medium->pending_nacked_cleanup);
 	}
 	medium->pending_nacked_cleanup = NULL;
-	if(medium->retransmit_buffer != NULL) {
-		janus_rtp_packet *p = NULL;
-		while((p = (janus_rtp_packet *)g_queue_pop_head(medium->retransmit_buffer)) != NULL) {
-			/* Remove from hashtable too */
-			janus_rtp_header *header = (janus_rtp_header *)p->data;
-			guint16 seq = ntohs(header->seq_number);
-			g_hash_table_remove(medium->retransmit_seqs, GUINT_TO_POINTER(seq));
-			/* Free the packet */
-			janus_ice_free_rtp_packet(p);
-		}
-		g_queue_free(medium->retransmit_buffer);
-		g_hash_table_destroy(medium->retransmit_seqs);
-	}
-	if(medium->last_seqs[0])
-		janus_seq_list_free(&medium->last_seqs[0]);
-	if(medium->last_seqs[1])
-		janus_seq_list_free(&medium->last_seqs[1]);
-	if(medium->last_seqs[2])
-		janus_seq_list_free(&medium->last_seqs[2]);
+	janus_ice_retransmit_buffer_free(medium->retransmit_buffer);
+	medium->retransmit_buffer = NULL;
+	g_free(medium->last_seqs[0]);
+	g_free(medium->last_seqs[1]);
+	g_free(medium->last_seqs[2]);
 	g_free(medium);
 	//~ janus_mutex_unlock(&handle->mutex);
 }
@@ -2033,7 +3295,7 @@ janus_slow_link_update(janus_ice_peerconnection_medium *medium, janus_ice_handle
 			JANUS_LOG(LOG_VERB, "[%"SCNu64"] Sending event to transport...; %p\n", handle->handle_id, handle);
 			janus_session_notify_event(session, event);
 			/* Finally, notify event handlers */
-			if(janus_events_is_enabled()) {
+			if(janus_events_is_interested(JANUS_EVENT_TYPE_MEDIA)) {
 				json_t *info = json_object();
 				json_object_set_new(info, "mid", json_string(medium->mid));
 				json_object_set_new(info, "media", json_string(video ? "video" : "audio"));
@@ -2100,10 +3362,9 @@ static gboolean janus_ice_check_failed(gpointer data) {
 	return TRUE;
 
 stoptimer:
-	if(pc && pc->icestate_source != NULL) {
-		g_source_destroy(pc->icestate_source);
-		g_source_unref(pc->icestate_source);
-		pc->icestate_source = NULL;
+	if(pc && pc->icestate_timer != NULL) {
+		janus_timer_destroy(pc->icestate_timer);
+		pc->icestate_timer = NULL;
 	}
 	return FALSE;
 }
@@ -2147,7 +3408,7 @@ static void janus_ice_cb_component_state_changed(NiceAgent *agent, guint stream_
 	guint prev_state = pc->state;
 	pc->state = state;
 	/* Notify event handlers */
-	if(janus_events_is_enabled()) {
+	if(janus_events_is_interested(JANUS_EVENT_TYPE_WEBRTC)) {
 		janus_session *session = (janus_session *)handle->session;
 		json_t *info = json_object();
 		json_object_set_new(info, "ice", json_string(janus_get_ice_state_name(state)));
@@ -2183,12 +3444,10 @@ static void janus_ice_cb_component_state_changed(NiceAgent *agent, guint stream_
 			answer_recv ? "received" : "pending",
 			alert_set ? "set" : "not set");
 		/* In case we haven't started a timer yet, let's do it now */
-		if(pc->icestate_source == NULL && pc->icefailed_detected == 0) {
+		if(pc->icestate_timer == NULL && pc->icefailed_detected == 0) {
 			pc->icefailed_detected = janus_get_monotonic_time();
-			pc->icestate_source = g_timeout_source_new(500);
-			g_source_set_callback(pc->icestate_source, janus_ice_check_failed, pc, NULL);
-			guint id = g_source_attach(pc->icestate_source, handle->mainctx);
-			JANUS_LOG(LOG_VERB, "[%"SCNu64"] Creating ICE state check timer with ID %u\n", handle->handle_id, id);
+			pc->icestate_timer = janus_timer_add(handle->timers, 500, janus_ice_check_failed, pc, NULL);
+			JANUS_LOG(LOG_VERB, "[%"SCNu64"] Creating ICE state check timer\n", handle->handle_id);
 		}
 	}
 }
@@ -2270,7 +3529,7 @@ static void janus_ice_cb_new_selected_pair (NiceAgent *agent, guint stream_id, g
 		g_clear_pointer(&prev_selected_pair, g_free);
 	}
 	/* Notify event handlers */
-	if(newpair && janus_events_is_enabled()) {
+	if(newpair && janus_events_is_interested(JANUS_EVENT_TYPE_WEBRTC)) {
 		janus_session *session = (janus_session *)handle->session;
 		json_t *info = json_object();
 		json_object_set_new(info, "selected-pair", json_string(sp));
@@ -2568,7 +3827,7 @@ candidatedone:
 	return;
 }
 
-static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint component_id, guint len, gchar *buf, gpointer ice) {
+static void janus_ice_incoming_packet(NiceAgent *agent, guint stream_id, guint component_id, guint len, gchar *buf, gpointer ice) {
 	janus_ice_peerconnection *pc = (janus_ice_peerconnection *)ice;
 	if(!pc) {
 		JANUS_LOG(LOG_ERR, "No component %d in stream %d??\n", component_id, stream_id);
@@ -2580,24 +3839,27 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 		return;
 	}
 	janus_session *session = (janus_session *)handle->session;
+	janus_ice_static_event_loop_count(handle);
+	janus_metrics_add(JANUS_METRICS_PACKETS_IN, 1);
+	janus_metrics_add(JANUS_METRICS_BYTES_IN, len);
 	if(!pc->dtls) {	/* Still waiting for the DTLS stack */
-		JANUS_LOG(LOG_VERB, "[%"SCNu64"] Still waiting for the DTLS stack for component %d in stream %d...\n", handle->handle_id, component_id, stream_id);
+		JANUS_ICE_LOG(handle, LOG_VERB, "[%"SCNu64"] Still waiting for the DTLS stack for component %d in stream %d...\n", handle->handle_id, component_id, stream_id);
 		return;
 	}
 	if(janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_STOP) || janus_is_stopping()) {
-		JANUS_LOG(LOG_VERB, "[%"SCNu64"] Forced to stop it here...\n", handle->handle_id);
+		JANUS_ICE_LOG(handle, LOG_VERB, "[%"SCNu64"] Forced to stop it here...\n", handle->handle_id);
 		return;
 	}
 	/* What is this? */
 	if(janus_is_dtls(buf) || (!janus_is_rtp(buf, len) && !janus_is_rtcp(buf, len))) {
 		/* This is DTLS: either handshake stuff, or data coming from SCTP DataChannels */
-		JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Looks like DTLS!\n", handle->handle_id);
+		JANUS_ICE_LOG(handle, LOG_HUGE, "[%"SCNu64"] Looks like DTLS!\n", handle->handle_id);
 		janus_dtls_srtp_incoming_msg(pc->dtls, buf, len);
 		/* Update stats (TODO Do the same for the last second window as well) */
 		pc->dtls_in_stats.info[0].packets++;
 		pc->dtls_in_stats.info[0].bytes += len;
 		/* If there's a datachannel medium, update the stats there too */
-		janus_ice_peerconnection_medium *medium = g_hash_table_lookup(pc->media_bytype, GINT_TO_POINTER(JANUS_MEDIA_DATA));
+		janus_ice_peerconnection_medium *medium = pc->media_bytype[JANUS_MEDIA_DATA];
 		if(medium) {
 			medium->in_stats.info[0].packets++;
 			medium->in_stats.info[0].bytes += len;
@@ -2623,7 +3885,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 						medium = g_hash_table_lookup(pc->media_bymid, sdes_item);
 						if(medium != NULL) {
 							/* Found! Associate this SSRC to this stream */
-							JANUS_LOG(LOG_VERB, "[%"SCNu64"] SSRC %"SCNu32" is associated to mid %s\n",
+							JANUS_ICE_LOG(handle, LOG_VERB, "[%"SCNu64"] SSRC %"SCNu32" is associated to mid %s\n",
 								handle->handle_id, packet_ssrc, medium->mid);
 							gboolean found = FALSE;
 							/* Check if simulcasting is involved */
@@ -2635,15 +3897,15 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 								if(janus_rtp_header_extension_parse_rid(buf, len, pc->rid_ext_id, sdes_item, sizeof(sdes_item)) == 0) {
 									/* Try the RTP stream ID */
 									if(medium->rid[0] != NULL && !strcmp(medium->rid[0], sdes_item)) {
-										JANUS_LOG(LOG_VERB, "[%"SCNu64"]  -- Simulcasting: rid=%s\n", handle->handle_id, sdes_item);
+										JANUS_ICE_LOG(handle, LOG_VERB, "[%"SCNu64"]  -- Simulcasting: rid=%s\n", handle->handle_id, sdes_item);
 										medium->ssrc_peer[0] = packet_ssrc;
 										found = TRUE;
 									} else if(medium->rid[1] != NULL && !strcmp(medium->rid[1], sdes_item)) {
-										JANUS_LOG(LOG_VERB, "[%"SCNu64"]  -- Simulcasting #1: rid=%s\n", handle->handle_id, sdes_item);
+										JANUS_ICE_LOG(handle, LOG_VERB, "[%"SCNu64"]  -- Simulcasting #1: rid=%s\n", handle->handle_id, sdes_item);
 										medium->ssrc_peer[1] = packet_ssrc;
 										found = TRUE;
 									} else if(medium->rid[2] != NULL && !strcmp(medium->rid[2], sdes_item)) {
-										JANUS_LOG(LOG_VERB, "[%"SCNu64"]  -- Simulcasting #2: rid=%s\n", handle->handle_id, sdes_item);
+										JANUS_ICE_LOG(handle, LOG_VERB, "[%"SCNu64"]  -- Simulcasting #2: rid=%s\n", handle->handle_id, sdes_item);
 										medium->ssrc_peer[2] = packet_ssrc;
 										found = TRUE;
 									} else {
@@ -2653,15 +3915,15 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 										janus_rtp_header_extension_parse_rid(buf, len, pc->ridrtx_ext_id, sdes_item, sizeof(sdes_item)) == 0) {
 									/* Try the repaired RTP stream ID */
 									if(medium->rid[0] != NULL && !strcmp(medium->rid[0], sdes_item)) {
-										JANUS_LOG(LOG_VERB, "[%"SCNu64"]  -- Simulcasting: rid=%s (rtx)\n", handle->handle_id, sdes_item);
+										JANUS_ICE_LOG(handle, LOG_VERB, "[%"SCNu64"]  -- Simulcasting: rid=%s (rtx)\n", handle->handle_id, sdes_item);
 										medium->ssrc_peer_rtx[0] = packet_ssrc;
 										found = TRUE;
 									} else if(medium->rid[1] != NULL && !strcmp(medium->rid[1], sdes_item)) {
-										JANUS_LOG(LOG_VERB, "[%"SCNu64"]  -- Simulcasting #1: rid=%s (rtx)\n", handle->handle_id, sdes_item);
+										JANUS_ICE_LOG(handle, LOG_VERB, "[%"SCNu64"]  -- Simulcasting #1: rid=%s (rtx)\n", handle->handle_id, sdes_item);
 										medium->ssrc_peer_rtx[1] = packet_ssrc;
 										found = TRUE;
 									} else if(medium->rid[2] != NULL && !strcmp(medium->rid[2], sdes_item)) {
-										JANUS_LOG(LOG_VERB, "[%"SCNu64"]  -- Simulcasting #2: rid=%s (rtx)\n", handle->handle_id, sdes_item);
+										JANUS_ICE_LOG(handle, LOG_VERB, "[%"SCNu64"]  -- Simulcasting #2: rid=%s (rtx)\n", handle->handle_id, sdes_item);
 										medium->ssrc_peer_rtx[2] = packet_ssrc;
 										found = TRUE;
 									} else {
@@ -2694,28 +3956,28 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 			if(video && medium->ssrc_peer[0] != packet_ssrc) {
 				if(medium->ssrc_peer[1] == packet_ssrc) {
 					/* FIXME Simulcast (1) */
-					JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Simulcast #1 (SSRC %"SCNu32")...\n", handle->handle_id, packet_ssrc);
+					JANUS_ICE_LOG(handle, LOG_HUGE, "[%"SCNu64"] Simulcast #1 (SSRC %"SCNu32")...\n", handle->handle_id, packet_ssrc);
 					vindex = 1;
 				} else if(medium->ssrc_peer[2] == packet_ssrc) {
 					/* FIXME Simulcast (2) */
-					JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Simulcast #2 (SSRC %"SCNu32")...\n", handle->handle_id, packet_ssrc);
+					JANUS_ICE_LOG(handle, LOG_HUGE, "[%"SCNu64"] Simulcast #2 (SSRC %"SCNu32")...\n", handle->handle_id, packet_ssrc);
 					vindex = 2;
 				} else {
 					/* Maybe a video retransmission using RFC4588? */
 					if(medium->ssrc_peer_rtx[0] == packet_ssrc) {
 						rtx = 1;
 						vindex = 0;
-						JANUS_LOG(LOG_HUGE, "[%"SCNu64"] RFC4588 rtx packet on video (SSRC %"SCNu32")...\n",
+						JANUS_ICE_LOG(handle, LOG_HUGE, "[%"SCNu64"] RFC4588 rtx packet on video (SSRC %"SCNu32")...\n",
 							handle->handle_id, packet_ssrc);
 					} else if(medium->ssrc_peer_rtx[1] == packet_ssrc) {
 						rtx = 1;
 						vindex = 1;
-						JANUS_LOG(LOG_HUGE, "[%"SCNu64"] RFC4588 rtx packet on video #%d (SSRC %"SCNu32")...\n",
+						JANUS_ICE_LOG(handle, LOG_HUGE, "[%"SCNu64"] RFC4588 rtx packet on video #%d (SSRC %"SCNu32")...\n",
 							handle->handle_id, vindex, packet_ssrc);
 					} else if(medium->ssrc_peer_rtx[2] == packet_ssrc) {
 						rtx = 1;
 						vindex = 2;
-						JANUS_LOG(LOG_HUGE, "[%"SCNu64"] RFC4588 rtx packet on video #%d (SSRC %"SCNu32")...\n",
+						JANUS_ICE_LOG(handle, LOG_HUGE, "[%"SCNu64"] RFC4588 rtx packet on video #%d (SSRC %"SCNu32")...\n",
 							handle->handle_id, vindex, packet_ssrc);
 					}
 				}
@@ -2729,12 +3991,13 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 					/* Only print the error if it's not a 'replay fail' or 'replay old' (which is probably just the result of us NACKing a packet) */
 					guint32 timestamp = ntohl(header->timestamp);
 					guint16 seq = ntohs(header->seq_number);
-					JANUS_LOG(LOG_ERR, "[%"SCNu64"]     SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n", handle->handle_id, janus_srtp_error_str(res), len, buflen, timestamp, seq);
+					JANUS_LOG_RATELIMITED(LOG_ERR, "[%"SCNu64"]     SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n", handle->handle_id, janus_srtp_error_str(res), len, buflen, timestamp, seq);
+					janus_metrics_add(JANUS_METRICS_SRTP_ERRORS_IN, 1);
 				}
 			} else {
 				if((!video && medium->ssrc_peer[0] == 0) || (vindex == 0 && medium->ssrc_peer[0] == 0)) {
 					medium->ssrc_peer[0] = ntohl(header->ssrc);
-					JANUS_LOG(LOG_VERB, "[%"SCNu64"]     Peer #%d (%s) SSRC: %u\n",
+					JANUS_ICE_LOG(handle, LOG_VERB, "[%"SCNu64"]     Peer #%d (%s) SSRC: %u\n",
 						handle->handle_id, medium->mindex,
 						medium->type == JANUS_MEDIA_VIDEO ? "video" : "audio",
 						medium->ssrc_peer[0]);
@@ -2778,23 +4041,12 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 						/* Get current timestamp */
 						struct timeval now;
 						gettimeofday(&now,0);
-						/* Create <seq num, time> pair */
-						janus_rtcp_transport_wide_cc_stats *stats = g_malloc0(sizeof(janus_rtcp_transport_wide_cc_stats));
-						/* Check if we have a sequence wrap */
-						if(transport_seq_num<0x0FFF && (pc->transport_wide_cc_last_seq_num&0xFFFF)>0xF000) {
-							/* Increase cycles */
-							pc->transport_wide_cc_cycles++;
-						}
-						/* Get extended value */
-						guint32 transport_ext_seq_num = pc->transport_wide_cc_cycles<<16 | transport_seq_num;
-						/* Store last received transport seq num */
-						pc->transport_wide_cc_last_seq_num = transport_seq_num;
-						/* Set stats values */
-						stats->transport_seq_num = transport_ext_seq_num;
-						stats->timestamp = (((guint64)now.tv_sec)*1E6+now.tv_usec);
-						/* Lock and append to received list */
+						/* Lock and track the arrival time in the ring */
 						janus_mutex_lock(&pc->mutex);
-						pc->transport_wide_received_seq_nums = g_slist_prepend(pc->transport_wide_received_seq_nums, stats);
+						if(pc->transport_wide_cc_ring == NULL)
+							pc->transport_wide_cc_ring = g_malloc0(sizeof(janus_rtcp_transport_wide_cc_ring));
+						janus_rtcp_transport_wide_cc_ring_add(pc->transport_wide_cc_ring, transport_seq_num,
+							((guint64)now.tv_sec)*G_USEC_PER_SEC + now.tv_usec);
 						janus_mutex_unlock(&pc->mutex);
 					}
 				}
@@ -2805,12 +4057,12 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 						GPOINTER_TO_INT(g_hash_table_lookup(medium->rtx_nacked[vindex], GUINT_TO_POINTER(seqno))) : 0;
 					if(nstate == 1) {
 						/* Packet was NACKed and this is the first time we receive it: change state to received */
-						JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Received NACKed packet %"SCNu16" (SSRC %"SCNu32", vindex %d)...\n",
+						JANUS_ICE_LOG(handle, LOG_HUGE, "[%"SCNu64"] Received NACKed packet %"SCNu16" (SSRC %"SCNu32", vindex %d)...\n",
 							handle->handle_id, seqno, packet_ssrc, vindex);
 						g_hash_table_insert(medium->rtx_nacked[vindex], GUINT_TO_POINTER(seqno), GUINT_TO_POINTER(2));
 					} else if(nstate == 2) {
 						/* We already received this packet: drop it */
-						JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Detected duplicate packet %"SCNu16" (SSRC %"SCNu32", vindex %d)...\n",
+						JANUS_ICE_LOG(handle, LOG_HUGE, "[%"SCNu64"] Detected duplicate packet %"SCNu16" (SSRC %"SCNu32", vindex %d)...\n",
 							handle->handle_id, seqno, packet_ssrc, vindex);
 						return;
 					} else if(rtx && nstate == 0) {
@@ -2820,7 +4072,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 						 * we receive it, since the first packet cannot be NACKed (NACKs are triggered
 						 * when there's a gap in between two packets, and the first doesn't have a reference)
 						 * Rather than dropping, we should add a better check in the future */
-						JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Got a retransmission for non-NACKed packet %"SCNu16" (SSRC %"SCNu32", vindex %d)...\n",
+						JANUS_ICE_LOG(handle, LOG_HUGE, "[%"SCNu64"] Got a retransmission for non-NACKed packet %"SCNu16" (SSRC %"SCNu32", vindex %d)...\n",
 							handle->handle_id, seqno, packet_ssrc, vindex);
 						return;
 					}
@@ -2835,9 +4087,9 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 				if(medium->payload_type < 0) {
 					medium->payload_type = header->type;
 					if(janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RFC4588_RTX) &&
-							medium->rtx_payload_types && g_hash_table_size(medium->rtx_payload_types) > 0) {
-						medium->rtx_payload_type = GPOINTER_TO_INT(g_hash_table_lookup(medium->rtx_payload_types, GINT_TO_POINTER(medium->payload_type)));
-						JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Retransmissions will have payload type %d\n",
+							medium->rtx_payload_types.count > 0) {
+						medium->rtx_payload_type = janus_ice_pt_map_lookup(&medium->rtx_payload_types, medium->payload_type);
+						JANUS_ICE_LOG(handle, LOG_HUGE, "[%"SCNu64"] Retransmissions will have payload type %d\n",
 							handle->handle_id, medium->rtx_payload_type);
 					}
 					if(medium->codec == NULL) {
@@ -2917,13 +4169,16 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 				janus_plugin *plugin = (janus_plugin *)handle->app;
 				if(plugin && plugin->incoming_rtp && handle->app_handle &&
 						!g_atomic_int_get(&handle->app_handle->stopped) &&
-						!g_atomic_int_get(&handle->destroyed))
+						!g_atomic_int_get(&handle->destroyed)) {
+					JANUS_PROBE3(plugin_rtp_start, handle->handle_id, video, buflen);
 					plugin->incoming_rtp(handle->app_handle, &rtp);
+					JANUS_PROBE1(plugin_rtp_done, handle->handle_id);
+				}
 				/* Restore the header for the stats (plugins may have messed with it) */
 				*header = backup;
 				/* Update stats (overall data received, and data received in the last second) */
 				if(buflen > 0) {
-					gint64 now = janus_get_monotonic_time();
+					gint64 now = janus_get_cached_monotonic_time();
 					if(medium->in_stats.info[vindex].bytes == 0 || medium->in_stats.info[vindex].notified_lastsec) {
 						/* We either received our first packet, or we started receiving it again after missing more than a second */
 						medium->in_stats.info[vindex].notified_lastsec = FALSE;
@@ -2950,7 +4205,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 				janus_rtcp_process_incoming_rtp(rtcp_ctx, buf, buflen,
 						(video && rtx) ? TRUE : FALSE,
 						(video && janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RFC4588_RTX)),
-						retransmissions_disabled, medium->clock_rates
+						retransmissions_disabled, medium->clock_rate_by_pt
 				);
 
 				/* Keep track of RTP sequence numbers, in case we need to NACK them */
@@ -2964,104 +4219,94 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 				if(video && medium->video_is_keyframe) {
 					if(medium->video_is_keyframe(payload, plen)) {
 						if(rtcp_ctx && (int16_t)(new_seqn - rtcp_ctx->max_seq_nr) > 0) {
-							JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Keyframe received with a highest sequence number, resetting NACK queue\n", handle->handle_id);
-							janus_seq_list_free(&medium->last_seqs[vindex]);
+							JANUS_ICE_LOG(handle, LOG_HUGE, "[%"SCNu64"] Keyframe received with a highest sequence number, resetting NACK queue\n", handle->handle_id);
+							janus_seq_window_reset(medium->last_seqs[vindex]);
 						}
 					}
 				}
-				guint16 cur_seqn;
-				int last_seqs_len = 0;
 				janus_mutex_lock(&medium->mutex);
-				janus_seq_info **last_seqs = &medium->last_seqs[vindex];
-				janus_seq_info *cur_seq = *last_seqs;
-				if(cur_seq) {
-					cur_seq = cur_seq->prev;
-					cur_seqn = cur_seq->seq;
-				} else {
+				if(medium->last_seqs[vindex] == NULL)
+					medium->last_seqs[vindex] = g_malloc0(sizeof(janus_seq_window));
+				janus_seq_window *window = medium->last_seqs[vindex];
+				if(!window->started) {
 					/* First seq, set up to add one seq */
-					cur_seqn = new_seqn - (guint16)1; /* Can wrap */
+					window->started = TRUE;
+					window->last = new_seqn - (guint16)1; /* Can wrap */
 				}
-				if(!janus_seq_in_range(new_seqn, cur_seqn, LAST_SEQS_MAX_LEN) &&
-						!janus_seq_in_range(cur_seqn, new_seqn, 1000)) {
+				gint16 diff = (gint16)(new_seqn - window->last);
+				if(diff >= LAST_SEQS_MAX_LEN || diff <= -1000) {
 					/* Jump too big, start fresh */
 					JANUS_LOG(LOG_WARN, "[%"SCNu64"] Big sequence number jump %hu -> %hu (%s stream #%d)\n",
-						handle->handle_id, cur_seqn, new_seqn, video ? "video" : "audio", vindex);
-					janus_seq_list_free(last_seqs);
-					cur_seq = NULL;
-					cur_seqn = new_seqn - (guint16)1;
+						handle->handle_id, window->last, new_seqn, video ? "video" : "audio", vindex);
+					janus_seq_window_reset(window);
+					window->started = TRUE;
+					window->last = new_seqn - (guint16)1;
+					diff = 1;
 				}
 
 				GSList *nacks = NULL;
-				gint64 now = janus_get_monotonic_time();
-
-				if(janus_seq_in_range(new_seqn, cur_seqn, LAST_SEQS_MAX_LEN)) {
-					/* Add new seq objs forward */
-					while(cur_seqn != new_seqn) {
-						cur_seqn += (guint16)1; /* can wrap */
-						janus_seq_info *seq_obj = g_malloc0(sizeof(janus_seq_info));
-						seq_obj->seq = cur_seqn;
-						seq_obj->ts = now;
-						seq_obj->state = (cur_seqn == new_seqn) ? SEQ_RECVED : SEQ_MISSING;
-						janus_seq_append(last_seqs, seq_obj);
-						last_seqs_len++;
-					}
+				gint64 now = janus_get_cached_monotonic_time();
+
+				if(diff > 0) {
+					/* Mark the sequence numbers we skipped as missing */
+					guint16 cur_seqn = window->last;
+					while(++cur_seqn != new_seqn)	/* Can wrap */
+						janus_seq_window_set_missing(window, cur_seqn, now);
+					janus_seq_window_clear_missing(window, new_seqn);
+					window->last = new_seqn;
+				} else if(diff < 0 && -diff < JANUS_SEQ_WINDOW_SIZE &&
+						janus_seq_window_clear_missing(window, new_seqn)) {
+					JANUS_ICE_LOG(handle, LOG_HUGE, "[%"SCNu64"] Received missed sequence number %"SCNu16" (%s stream #%d)\n",
+						handle->handle_id, new_seqn, video ? "video" : "audio", vindex);
 				}
-				if(cur_seq) {
-					/* Scan old seq objs backwards */
-					while(cur_seq != NULL) {
-						last_seqs_len++;
-						if(cur_seq->seq == new_seqn) {
-							JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Received missed sequence number %"SCNu16" (%s stream #%d)\n",
-								handle->handle_id, cur_seq->seq, video ? "video" : "audio", vindex);
-							cur_seq->state = SEQ_RECVED;
-						} else if(cur_seq->state == SEQ_MISSING && now - cur_seq->ts > SEQ_MISSING_WAIT) {
-							JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Missed sequence number %"SCNu16" (%s stream #%d), sending 1st NACK\n",
-								handle->handle_id, cur_seq->seq, video ? "video" : "audio", vindex);
-							nacks = g_slist_prepend(nacks, GUINT_TO_POINTER(cur_seq->seq));
-							cur_seq->state = SEQ_NACKED;
+				/* Check which of the packets still missing we should NACK */
+				guint word = 0;
+				for(word=0; word<JANUS_SEQ_WINDOW_SIZE/64; word++) {
+					guint64 bits = window->missing[word];
+					while(bits) {
+						guint index = word*64 + __builtin_ctzll(bits);
+						bits &= bits-1;
+						guint16 seq = window->last - (guint16)((window->last - index) & SEQ_WINDOW_MASK);
+						if(window->state[index] == SEQ_MISSING && now - window->ts[index] > SEQ_MISSING_WAIT) {
+							JANUS_ICE_LOG(handle, LOG_HUGE, "[%"SCNu64"] Missed sequence number %"SCNu16" (%s stream #%d), sending 1st NACK\n",
+								handle->handle_id, seq, video ? "video" : "audio", vindex);
+							nacks = g_slist_prepend(nacks, GUINT_TO_POINTER(seq));
+							window->state[index] = SEQ_NACKED;
 							if(video && janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RFC4588_RTX)) {
 								/* Keep track of this sequence number, we need to avoid duplicates */
-								JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Tracking NACKed packet %"SCNu16" (SSRC %"SCNu32", vindex %d)...\n",
-									handle->handle_id, cur_seq->seq, packet_ssrc, vindex);
+								JANUS_ICE_LOG(handle, LOG_HUGE, "[%"SCNu64"] Tracking NACKed packet %"SCNu16" (SSRC %"SCNu32", vindex %d)...\n",
+									handle->handle_id, seq, packet_ssrc, vindex);
 								if(medium->rtx_nacked[vindex] == NULL)
 									medium->rtx_nacked[vindex] = g_hash_table_new(NULL, NULL);
-								g_hash_table_insert(medium->rtx_nacked[vindex], GUINT_TO_POINTER(cur_seq->seq), GINT_TO_POINTER(1));
-								/* We don't track it forever, though: add a timed source to remove it in a few seconds */
+								g_hash_table_insert(medium->rtx_nacked[vindex], GUINT_TO_POINTER(seq), GINT_TO_POINTER(1));
+								/* We don't track it forever, though: add a timer to remove it in a few seconds */
 								janus_ice_nacked_packet *np = g_malloc(sizeof(janus_ice_nacked_packet));
 								np->medium = medium;
-								np->seq_number = cur_seq->seq;
+								np->seq_number = seq;
 								np->vindex = vindex;
 								if(medium->pending_nacked_cleanup == NULL)
 									medium->pending_nacked_cleanup = g_hash_table_new(NULL, NULL);
-								GSource *timeout_source = g_timeout_source_new_seconds(5);
-								g_source_set_callback(timeout_source, janus_ice_nacked_packet_cleanup, np, (GDestroyNotify)g_free);
-								np->source_id = g_source_attach(timeout_source, handle->mainctx);
-								g_source_unref(timeout_source);
-								g_hash_table_insert(medium->pending_nacked_cleanup, GUINT_TO_POINTER(np->source_id), timeout_source);
+								np->timer = janus_timer_add(handle->timers, 5000, janus_ice_nacked_packet_cleanup, np, (GDestroyNotify)g_free);
+								g_hash_table_insert(medium->pending_nacked_cleanup, np->timer, np->timer);
 							}
-						} else if(cur_seq->state == SEQ_NACKED  && now - cur_seq->ts > SEQ_NACKED_WAIT) {
-							JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Missed sequence number %"SCNu16" (%s stream #%d), sending 2nd NACK\n",
-								handle->handle_id, cur_seq->seq, video ? "video" : "audio", vindex);
-							nacks = g_slist_prepend(nacks, GUINT_TO_POINTER(cur_seq->seq));
-							cur_seq->state = SEQ_GIVEUP;
-						}
-						if(cur_seq == *last_seqs) {
-							/* Just processed head */
-							break;
+						} else if(window->state[index] == SEQ_NACKED && now - window->ts[index] > SEQ_NACKED_WAIT) {
+							JANUS_ICE_LOG(handle, LOG_HUGE, "[%"SCNu64"] Missed sequence number %"SCNu16" (%s stream #%d), sending 2nd NACK\n",
+								handle->handle_id, seq, video ? "video" : "audio", vindex);
+							nacks = g_slist_prepend(nacks, GUINT_TO_POINTER(seq));
+							/* We give up on this one, no need to keep track of it anymore */
+							window->state[index] = SEQ_GIVEUP;
+							janus_seq_window_clear_missing(window, seq);
 						}
-						cur_seq = cur_seq->prev;
 					}
 				}
-				while(last_seqs_len > LAST_SEQS_MAX_LEN) {
-					janus_seq_info *node = janus_seq_pop_head(last_seqs);
-					g_free(node);
-					last_seqs_len--;
-				}
+				/* NACKs must be ordered when building the RTCP message */
+				if(nacks != NULL && nacks->next != NULL)
+					nacks = g_slist_sort(nacks, janus_seq_compare);
 
 				guint nacks_count = g_slist_length(nacks);
 				if(nacks_count) {
 					/* Generate a NACK and send it */
-					JANUS_LOG(LOG_DBG, "[%"SCNu64"] Now sending NACK for %u missed packets (%s stream #%d)\n",
+					JANUS_ICE_LOG(handle, LOG_DBG, "[%"SCNu64"] Now sending NACK for %u missed packets (%s stream #%d)\n",
 						handle->handle_id, nacks_count, video ? "video" : "audio", vindex);
 					char nackbuf[120];
 					int res = janus_rtcp_nacks(nackbuf, sizeof(nackbuf), nacks);
@@ -3075,10 +4320,11 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 					/* Update stats */
 					medium->nack_sent_recent_cnt += nacks_count;
 					medium->out_stats.info[vindex].nacks += nacks_count;
+					janus_metrics_add(JANUS_METRICS_NACKS_OUT, nacks_count);
 				}
 				if(medium->nack_sent_recent_cnt &&
 						(now - medium->nack_sent_log_ts) > 5*G_USEC_PER_SEC) {
-					JANUS_LOG(LOG_VERB, "[%"SCNu64"] Sent NACKs for %u missing packets (%s stream #%d)\n",
+					JANUS_ICE_LOG(handle, LOG_VERB, "[%"SCNu64"] Sent NACKs for %u missing packets (%s stream #%d)\n",
 						handle->handle_id, medium->nack_sent_recent_cnt, video ? "video" : "audio", vindex);
 					medium->nack_sent_recent_cnt = 0;
 					medium->nack_sent_log_ts = now;
@@ -3091,7 +4337,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 		return;
 	} else if(janus_is_rtcp(buf, len)) {
 		/* This is RTCP */
-		JANUS_LOG(LOG_HUGE, "[%"SCNu64"]  Got an RTCP packet\n", handle->handle_id);
+		JANUS_ICE_LOG(handle, LOG_HUGE, "[%"SCNu64"]  Got an RTCP packet\n", handle->handle_id);
 		if(janus_is_webrtc_encryption_enabled() && (!pc->dtls || !pc->dtls->srtp_valid || !pc->dtls->srtp_in)) {
 			JANUS_LOG(LOG_WARN, "[%"SCNu64"]     Missing valid SRTP session (packet arrived too early?), skipping...\n", handle->handle_id);
 		} else {
@@ -3099,7 +4345,8 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 			srtp_err_status_t res = janus_is_webrtc_encryption_enabled() ?
 				srtp_unprotect_rtcp(pc->dtls->srtp_in, buf, &buflen) : srtp_err_status_ok;
 			if(res != srtp_err_status_ok) {
-				JANUS_LOG(LOG_ERR, "[%"SCNu64"]     SRTCP unprotect error: %s (len=%d-->%d)\n", handle->handle_id, janus_srtp_error_str(res), len, buflen);
+				JANUS_LOG_RATELIMITED(LOG_ERR, "[%"SCNu64"]     SRTCP unprotect error: %s (len=%d-->%d)\n", handle->handle_id, janus_srtp_error_str(res), len, buflen);
+				janus_metrics_add(JANUS_METRICS_SRTP_ERRORS_IN, 1);
 			} else {
 				/* Do we need to dump this packet for debugging? */
 				if(g_atomic_int_get(&handle->dump_packets))
@@ -3109,7 +4356,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 				if(janus_rtcp_has_bye(buf, buflen)) {
 					/* Note: we used to use this as a trigger to close the PeerConnection, but not anymore
 					 * Discussion here, https://groups.google.com/forum/#!topic/meetecho-janus/4XtfbYB7Jvc */
-					JANUS_LOG(LOG_VERB, "[%"SCNu64"] Got RTCP BYE on stream %u (component %u)\n", handle->handle_id, stream_id, component_id);
+					JANUS_ICE_LOG(handle, LOG_VERB, "[%"SCNu64"] Got RTCP BYE on stream %u (component %u)\n", handle->handle_id, stream_id, component_id);
 				}
 				/* Is this audio or video? */
 				int video = 0, vindex = 0;
@@ -3124,7 +4371,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 					medium = g_hash_table_lookup(pc->media_byssrc, GINT_TO_POINTER(rtcp_ssrc));
 					if(medium == NULL) {
 						if(rtcp_ssrc > 0) {
-							JANUS_LOG(LOG_VERB, "[%"SCNu64"] Unknown SSRC, dropping RTCP packet (SSRC %"SCNu32")...\n",
+							JANUS_ICE_LOG(handle, LOG_VERB, "[%"SCNu64"] Unknown SSRC, dropping RTCP packet (SSRC %"SCNu32")...\n",
 								handle->handle_id, rtcp_ssrc);
 						}
 						return;
@@ -3133,6 +4380,17 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 				if(janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RFC4588_RTX)) {
 					janus_rtcp_swap_report_blocks(buf, buflen, medium->ssrc_rtx);
 				}
+				if(medium->ssrc_fec > 0) {
+					/* Same thing for FlexFEC: report blocks about the repair stream
+					 * would mess with our stats, so we skip reports about it alone */
+					janus_rtcp_swap_report_blocks(buf, buflen, medium->ssrc_fec);
+					janus_rtcp_header *rtcp = (janus_rtcp_header *)buf;
+					if((rtcp->type == RTCP_RR || rtcp->type == RTCP_SR) &&
+							janus_rtcp_get_receiver_ssrc(buf, buflen) == medium->ssrc_fec) {
+						JANUS_ICE_LOG(handle, LOG_HUGE, "[%"SCNu64"] Skipping RTCP feedback about our FlexFEC stream\n", handle->handle_id);
+						return;
+					}
+				}
 				video = (medium->type == JANUS_MEDIA_VIDEO);
 				/* If this is video, check if this is simulcast */
 				if(video) {
@@ -3166,14 +4424,17 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 						mavg = min_nack_queue;
 					medium->nack_queue_ms = mavg;
 				}
-				JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Got %s RTCP (%d bytes)\n", handle->handle_id, video ? "video" : "audio", buflen);
+				JANUS_ICE_LOG(handle, LOG_HUGE, "[%"SCNu64"] Got %s RTCP (%d bytes)\n", handle->handle_id, video ? "video" : "audio", buflen);
 				/* See if there's any REMB bitrate to track */
 				uint32_t bitrate = janus_rtcp_get_remb(buf, buflen);
 				if(bitrate > 0)
 					pc->remb_bitrate = bitrate;
+				/* Check if there's transport wide cc feedback we can use to estimate the bandwidth */
+				if(pc->transport_wide_cc_ext_id > 0)
+					janus_bwe_context_process_rtcp(pc->bwe, buf, buflen);
 
 				/* Now let's see if there are any NACKs to handle */
-				gint64 now = janus_get_monotonic_time();
+				gint64 now = janus_get_cached_monotonic_time();
 				if(pc->nacks_queue == NULL)
 					pc->nacks_queue = g_queue_new();
 				GQueue *nacks = pc->nacks_queue;
@@ -3181,28 +4442,28 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 				guint nacks_count = g_queue_get_length(nacks);
 				if(nacks_count && medium->do_nacks) {
 					/* Handle NACK */
-					JANUS_LOG(LOG_HUGE, "[%"SCNu64"]     Just got some NACKS (%d) we should handle...\n", handle->handle_id, nacks_count);
-					GHashTable *retransmit_seqs = medium->retransmit_seqs;
-					GQueue *queue = (retransmit_seqs != NULL ? nacks : NULL);
+					JANUS_ICE_LOG(handle, LOG_HUGE, "[%"SCNu64"]     Just got some NACKS (%d) we should handle...\n", handle->handle_id, nacks_count);
+					janus_ice_retransmit_buffer *retransmit_buffer = medium->retransmit_buffer;
+					GQueue *queue = (retransmit_buffer != NULL ? nacks : NULL);
 					int retransmits_cnt = 0;
 					janus_mutex_lock(&medium->mutex);
 					while(queue != NULL && g_queue_get_length(queue) > 0) {
 						unsigned int seqnr = GPOINTER_TO_UINT(g_queue_pop_tail(queue));
-						JANUS_LOG(LOG_DBG, "[%"SCNu64"]   >> %u\n", handle->handle_id, seqnr);
+						JANUS_ICE_LOG(handle, LOG_DBG, "[%"SCNu64"]   >> %u\n", handle->handle_id, seqnr);
 						int in_rb = 0;
 						/* Check if we have the packet */
-						janus_rtp_packet *p = g_hash_table_lookup(retransmit_seqs, GUINT_TO_POINTER(seqnr));
+						janus_rtp_packet *p = janus_ice_retransmit_buffer_lookup(retransmit_buffer, seqnr);
 						if(p == NULL) {
-							JANUS_LOG(LOG_HUGE, "[%"SCNu64"]   >> >> Can't retransmit packet %u, we don't have it...\n", handle->handle_id, seqnr);
+							JANUS_ICE_LOG(handle, LOG_HUGE, "[%"SCNu64"]   >> >> Can't retransmit packet %u, we don't have it...\n", handle->handle_id, seqnr);
 						} else {
 							/* Should we retransmit this packet? */
 							if((p->last_retransmit > 0) && (now-p->last_retransmit < p->current_backoff)) {
-								JANUS_LOG(LOG_HUGE, "[%"SCNu64"]   >> >> Packet %u was retransmitted just %"SCNi64"us ago, skipping\n", handle->handle_id, seqnr, now-p->last_retransmit);
+								JANUS_ICE_LOG(handle, LOG_HUGE, "[%"SCNu64"]   >> >> Packet %u was retransmitted just %"SCNi64"us ago, skipping\n", handle->handle_id, seqnr, now-p->last_retransmit);
 								g_queue_pop_tail(queue);
 								continue;
 							}
 							in_rb = 1;
-							JANUS_LOG(LOG_HUGE, "[%"SCNu64"]   >> >> Scheduling %u for retransmission due to NACK\n", handle->handle_id, seqnr);
+							JANUS_ICE_LOG(handle, LOG_HUGE, "[%"SCNu64"]   >> >> Scheduling %u for retransmission due to NACK\n", handle->handle_id, seqnr);
 							p->last_retransmit = now;
 							if(p->current_backoff == 0) {
 								p->current_backoff = MIN_NACK_IGNORE;
@@ -3213,9 +4474,8 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 							}
 							retransmits_cnt++;
 							/* Enqueue it */
-							janus_ice_queued_packet *pkt = g_malloc(sizeof(janus_ice_queued_packet));
+							janus_ice_queued_packet *pkt = janus_ice_queued_packet_new(p->length+SRTP_MAX_TAG_LEN);
 							pkt->mindex = medium->mindex;
-							pkt->data = g_malloc(p->length+SRTP_MAX_TAG_LEN);
 							memcpy(pkt->data, p->data, p->length);
 							pkt->length = p->length;
 							pkt->type = video ? JANUS_ICE_PACKET_VIDEO : JANUS_ICE_PACKET_AUDIO;
@@ -3225,7 +4485,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 							pkt->retransmission = TRUE;
 							pkt->label = NULL;
 							pkt->protocol = NULL;
-							pkt->added = janus_get_monotonic_time();
+							pkt->added = janus_get_cached_monotonic_time();
 							/* What to send and how depends on whether we're doing RFC4588 or not */
 							if(!video || !janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RFC4588_RTX)) {
 								/* We're not: just clarify the packet was already encrypted before */
@@ -3261,10 +4521,11 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 					/* Update stats */
 					medium->in_stats.info[vindex].nacks += nacks_count;
 					janus_mutex_unlock(&medium->mutex);
+					janus_metrics_add(JANUS_METRICS_NACKS_IN, nacks_count);
 				}
 				if(medium->retransmit_recent_cnt &&
 						now - medium->retransmit_log_ts > 5*G_USEC_PER_SEC) {
-					JANUS_LOG(LOG_VERB, "[%"SCNu64"] Retransmitted %u packets due to NACK (%s stream #%d)\n",
+					JANUS_ICE_LOG(handle, LOG_VERB, "[%"SCNu64"] Retransmitted %u packets due to NACK (%s stream #%d)\n",
 						handle->handle_id, medium->retransmit_recent_cnt, video ? "video" : "audio", vindex);
 					medium->retransmit_recent_cnt = 0;
 					medium->retransmit_log_ts = now;
@@ -3284,6 +4545,8 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 					return;
 				}
 
+				if(video && janus_rtcp_has_pli(buf, buflen))
+					janus_metrics_add(JANUS_METRICS_PLIS_IN, 1);
 				janus_plugin_rtcp rtcp = { .mindex = medium->mindex, .video = video, .buffer = buf, .length = buflen };
 				janus_plugin *plugin = (janus_plugin *)handle->app;
 				if(plugin && plugin->incoming_rtcp && handle->app_handle &&
@@ -3294,7 +4557,7 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 		}
 		return;
 	} else {
-		JANUS_LOG(LOG_VERB, "[%"SCNu64"] Not RTP and not RTCP... may these be data channels?\n", handle->handle_id);
+		JANUS_ICE_LOG(handle, LOG_VERB, "[%"SCNu64"] Not RTP and not RTCP... may these be data channels?\n", handle->handle_id);
 		janus_dtls_srtp_incoming_msg(pc->dtls, buf, len);
 		/* Update stats (only overall data received) */
 		if(len > 0) {
@@ -3305,6 +4568,16 @@ static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint comp
 	}
 }
 
+static void janus_ice_cb_nice_recv(NiceAgent *agent, guint stream_id, guint component_id, guint len, gchar *buf, gpointer ice) {
+	/* Cache the current time, so that we (and plugins) don't need to query
+	 * the clock over and over again while handling this packet */
+	janus_refresh_cached_monotonic_time();
+	JANUS_PROBE2(ice_recv_start, ice ? ((janus_ice_peerconnection *)ice)->handle->handle_id : 0, len);
+	janus_ice_incoming_packet(agent, stream_id, component_id, len, buf, ice);
+	JANUS_PROBE1(ice_recv_done, ice ? ((janus_ice_peerconnection *)ice)->handle->handle_id : 0);
+	janus_clear_cached_monotonic_time();
+}
+
 void janus_ice_incoming_data(janus_ice_handle *handle, char *label, char *protocol, gboolean textdata, char *buffer, int length) {
 	if(handle == NULL || buffer == NULL || length <= 0)
 		return;
@@ -3316,6 +4589,23 @@ void janus_ice_incoming_data(janus_ice_handle *handle, char *label, char *protoc
 		plugin->incoming_data(handle->app_handle, &data);
 }
 
+void janus_ice_incoming_data_batch(janus_ice_handle *handle, janus_plugin_data *packets, int count) {
+	if(handle == NULL || packets == NULL || count <= 0)
+		return;
+	janus_plugin *plugin = (janus_plugin *)handle->app;
+	if(plugin == NULL || handle->app_handle == NULL ||
+			g_atomic_int_get(&handle->app_handle->stopped) ||
+			g_atomic_int_get(&handle->destroyed))
+		return;
+	if(plugin->incoming_data_batch) {
+		plugin->incoming_data_batch(handle->app_handle, packets, count);
+	} else if(plugin->incoming_data) {
+		int i = 0;
+		for(i=0; i<count; i++)
+			plugin->incoming_data(handle->app_handle, &packets[i]);
+	}
+}
+
 
 /* Helper: encoding local candidates to string/SDP */
 static int janus_ice_candidate_to_string(janus_ice_handle *handle, NiceCandidate *c, char *buffer, int buflen, gboolean log_candidate, gboolean force_private, guint public_ip_index) {
@@ -3467,7 +4757,7 @@ static int janus_ice_candidate_to_string(janus_ice_handle *handle, NiceCandidate
 		/* Save for the summary, in case we need it */
 		pc->local_candidates = g_slist_append(pc->local_candidates, g_strdup(buffer));
 		/* Notify event handlers */
-		if(janus_events_is_enabled()) {
+		if(janus_events_is_interested(JANUS_EVENT_TYPE_WEBRTC)) {
 			janus_session *session = (janus_session *)handle->session;
 			json_t *info = json_object();
 			json_object_set_new(info, "local-candidate", json_string(buffer));
@@ -3480,6 +4770,16 @@ static int janus_ice_candidate_to_string(janus_ice_handle *handle, NiceCandidate
 	return 0;
 }
 
+/* Helper to get the local candidates of a PeerConnection, whether from libnice or the ICE mux */
+static GSList *janus_ice_get_local_candidates(janus_ice_handle *handle, guint stream_id, guint component_id) {
+	janus_ice_peerconnection *pc = handle->pc;
+	if(pc != NULL && pc->mux != NULL) {
+		/* We always use rtcp-mux, so there's a single component */
+		return janus_ice_mux_get_local_candidates(stream_id, 1);
+	}
+	return nice_agent_get_local_candidates(handle->agent, stream_id, component_id);
+}
+
 void janus_ice_candidates_to_sdp(janus_ice_handle *handle, janus_sdp_mline *mline, guint stream_id, guint component_id) {
 	if(!handle || !handle->agent || !mline)
 		return;
@@ -3488,11 +4788,10 @@ void janus_ice_candidates_to_sdp(janus_ice_handle *handle, janus_sdp_mline *mlin
 		JANUS_LOG(LOG_ERR, "[%"SCNu64"]     No stream %d??\n", handle->handle_id, stream_id);
 		return;
 	}
-	NiceAgent *agent = handle->agent;
 	/* Iterate on all */
 	gchar buffer[200];
 	GSList *candidates, *i;
-	candidates = nice_agent_get_local_candidates (agent, stream_id, component_id);
+	candidates = janus_ice_get_local_candidates(handle, stream_id, component_id);
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] We have %d candidates for Stream #%d, Component #%d\n", handle->handle_id, g_slist_length(candidates), stream_id, component_id);
 	gboolean log_candidates = (pc->local_candidates == NULL);
 	for(i = candidates; i; i = i->next) {
@@ -3534,17 +4833,46 @@ void janus_ice_candidates_to_sdp(janus_ice_handle *handle, janus_sdp_mline *mlin
 	g_slist_free(candidates);
 }
 
+/* Trickled candidates typically come in bursts: rather than waking up the
+ * loop and adding them to the agent one by one, we wait a few milliseconds
+ * after the first one, and then add all those we got in the meanwhile in a
+ * single batch (unless we're told there are no more candidates, that is) */
+#define JANUS_ICE_CANDIDATES_DEBOUNCE	10
+
+static void janus_ice_handle_unref(gpointer data) {
+	janus_ice_handle *handle = (janus_ice_handle *)data;
+	janus_refcount_decrease(&handle->ref);
+}
+
+void janus_ice_flush_remote_candidates(janus_ice_handle *handle) {
+	if(handle == NULL || handle->queued_packets == NULL)
+		return;
+#if GLIB_CHECK_VERSION(2, 46, 0)
+	g_async_queue_push_front(handle->queued_packets, &janus_ice_add_candidates);
+#else
+	g_async_queue_push(handle->queued_packets, &janus_ice_add_candidates);
+#endif
+	g_main_context_wakeup(handle->mainctx);
+}
+
+static gboolean janus_ice_candidates_debounced(gpointer user_data) {
+	janus_ice_handle *handle = (janus_ice_handle *)user_data;
+	janus_ice_flush_remote_candidates(handle);
+	return G_SOURCE_REMOVE;
+}
+
 void janus_ice_add_remote_candidate(janus_ice_handle *handle, NiceCandidate *c) {
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Queueing candidate %p\n", handle->handle_id, c);
 	if(handle->queued_candidates != NULL)
 		g_async_queue_push(handle->queued_candidates, c);
-	if(handle->queued_packets != NULL) {
-#if GLIB_CHECK_VERSION(2, 46, 0)
-		g_async_queue_push_front(handle->queued_packets, &janus_ice_add_candidates);
-#else
-		g_async_queue_push(handle->queued_packets, &janus_ice_add_candidates);
-#endif
-		g_main_context_wakeup(handle->mainctx);
+	if(handle->queued_packets != NULL && handle->mainctx != NULL &&
+			g_atomic_int_compare_and_exchange(&handle->candidates_scheduled, 0, 1)) {
+		/* First candidate of a burst, add the batch when the window is over */
+		GSource *source = g_timeout_source_new(JANUS_ICE_CANDIDATES_DEBOUNCE);
+		janus_refcount_increase(&handle->ref);
+		g_source_set_callback(source, janus_ice_candidates_debounced, handle, janus_ice_handle_unref);
+		g_source_attach(source, handle->mainctx);
+		g_source_unref(source);
 	}
 }
 
@@ -3590,6 +4918,222 @@ void janus_ice_setup_remote_candidates(janus_ice_handle *handle, guint stream_id
 	pc->process_started = TRUE;
 }
 
+/* Helper to register a PeerConnection in the ICE mux, or update its credentials
+ * there after an ICE restart: since the short ufrags libnice generates would
+ * likely collide with thousands of PeerConnections sharing the same sockets,
+ * we replace them with longer ones (and try again on the rare collisions) */
+static int janus_ice_mux_register(janus_ice_handle *handle, janus_ice_peerconnection *pc) {
+	gchar *ufrag = NULL, *pwd = NULL;
+	if(!nice_agent_get_local_credentials(handle->agent, pc->stream_id, &ufrag, &pwd)) {
+		JANUS_LOG(LOG_ERR, "[%"SCNu64"] Couldn't get the local ICE credentials for the ICE mux\n", handle->handle_id);
+		return -1;
+	}
+	g_free(ufrag);
+	char mux_ufrag[24];
+	int attempts = 0;
+	for(attempts=0; attempts<3; attempts++) {
+		g_snprintf(mux_ufrag, sizeof(mux_ufrag), "%"SCNu64, janus_random_uint64());
+		if(pc->mux == NULL) {
+			janus_refcount_increase(&handle->ref);
+			pc->mux = janus_ice_mux_add(handle, mux_ufrag, pwd, janus_ice_handle_unref);
+			if(pc->mux == NULL) {
+				janus_refcount_decrease(&handle->ref);
+				continue;
+			}
+		} else if(!janus_ice_mux_set_credentials(pc->mux, mux_ufrag, pwd)) {
+			continue;
+		}
+		if(!nice_agent_set_local_credentials(handle->agent, pc->stream_id, mux_ufrag, pwd)) {
+			JANUS_LOG(LOG_WARN, "[%"SCNu64"] Couldn't update the local ICE credentials for the ICE mux\n", handle->handle_id);
+		}
+		g_free(pwd);
+		return 0;
+	}
+	JANUS_LOG(LOG_ERR, "[%"SCNu64"] Couldn't register the PeerConnection in the ICE mux\n", handle->handle_id);
+	g_free(pwd);
+	return -1;
+}
+
+/* Create a new agent for the provided context: the settings that don't
+ * depend on the PeerConnection are all set here, since pooled agents may
+ * be created before we know which handle will use them */
+static NiceAgent *janus_ice_agent_new(GMainContext *mainctx) {
+	NiceAgent *agent = g_object_new(NICE_TYPE_AGENT,
+		"compatibility", NICE_COMPATIBILITY_RFC5245,
+		"main-context", mainctx,
+		"reliable", FALSE,
+		"full-mode", janus_ice_lite_enabled ? FALSE : TRUE,
+#ifdef HAVE_ICE_NOMINATION
+		"nomination-mode", janus_ice_nomination,
+#endif
+#ifdef HAVE_CONSENT_FRESHNESS
+		"consent-freshness", janus_ice_consent_freshness ? TRUE : FALSE,
+#endif
+		"keepalive-conncheck", janus_ice_keepalive_connchecks ? TRUE : FALSE,
+#ifdef HAVE_LIBNICE_TCP
+		"ice-udp", TRUE,
+		"ice-tcp", janus_ice_tcp_enabled ? TRUE : FALSE,
+#endif
+		NULL);
+	/* Any STUN server to use? */
+	if(janus_stun_server != NULL && janus_stun_port > 0) {
+		g_object_set(G_OBJECT(agent),
+			"stun-server", janus_stun_server,
+			"stun-server-port", janus_stun_port,
+			NULL);
+	}
+	g_object_set(G_OBJECT(agent), "upnp", FALSE, NULL);
+	/* Add all local addresses, except those in the ignore list: if we're
+	 * using the ICE mux, though, there's nothing libnice needs to gather */
+	if(!janus_ice_mux_is_enabled()) {
+		GList *addresses = janus_ice_get_local_addresses(), *temp = addresses;
+		while(temp) {
+			const char *host = (const char *)temp->data;
+			temp = temp->next;
+			/* Ok, add interface to the ICE agent */
+			JANUS_LOG(LOG_VERB, "Adding %s to the addresses to gather candidates for\n", host);
+			NiceAddress addr_local;
+			nice_address_init (&addr_local);
+			if(!nice_address_set_from_string (&addr_local, host)) {
+				JANUS_LOG(LOG_WARN, "Skipping invalid address %s\n", host);
+				continue;
+			}
+			nice_agent_add_local_address (agent, &addr_local);
+		}
+		g_list_free_full(addresses, (GDestroyNotify)g_free);
+	}
+	return agent;
+}
+
+int janus_ice_set_agent_pool(guint size) {
+	if(size == 0)
+		return 0;
+	if(static_event_loops < 1) {
+		JANUS_LOG(LOG_WARN, "Pooling ICE agents is only possible with static event loops, ignoring\n");
+		return -1;
+	}
+	agent_pool_size = size;
+	/* Create the agents for all loops now */
+	janus_mutex_lock(&event_loops_mutex);
+	GSList *l = event_loops;
+	while(l) {
+		janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)l->data;
+		janus_mutex_lock(&loop->agents_mutex);
+		while(g_queue_get_length(loop->agents) < agent_pool_size)
+			g_queue_push_tail(loop->agents, janus_ice_agent_new(loop->mainctx));
+		janus_mutex_unlock(&loop->agents_mutex);
+		l = l->next;
+	}
+	janus_mutex_unlock(&event_loops_mutex);
+	JANUS_LOG(LOG_INFO, "Keeping %u ICE agents ready in each static event loop\n", agent_pool_size);
+	return 0;
+}
+
+json_t *janus_ice_pools_info(void) {
+	json_t *info = json_object();
+	json_t *agents = json_object();
+	json_object_set_new(agents, "size", json_integer(agent_pool_size));
+	guint available = 0;
+	janus_mutex_lock(&event_loops_mutex);
+	GSList *l = event_loops;
+	while(l) {
+		janus_ice_static_event_loop *loop = (janus_ice_static_event_loop *)l->data;
+		janus_mutex_lock(&loop->agents_mutex);
+		available += g_queue_get_length(loop->agents);
+		janus_mutex_unlock(&loop->agents_mutex);
+		l = l->next;
+	}
+	janus_mutex_unlock(&event_loops_mutex);
+	json_object_set_new(agents, "available", json_integer(available));
+	json_object_set_new(agents, "hits", json_integer(g_atomic_int_get(&agent_pool_hits)));
+	json_object_set_new(agents, "misses", json_integer(g_atomic_int_get(&agent_pool_misses)));
+	json_object_set_new(agents, "recycled", json_integer(g_atomic_int_get(&agent_pool_recycled)));
+	json_object_set_new(info, "agents", agents);
+	json_object_set_new(info, "ssl", janus_dtls_ssl_pool_info());
+	/* How long setting up PeerConnections locally takes, pool or not */
+	json_t *setup = json_object();
+	json_object_set_new(setup, "p50", json_integer((json_int_t)janus_metrics_percentile(JANUS_METRICS_HANDLE_SETUP, 50)));
+	json_object_set_new(setup, "p90", json_integer((json_int_t)janus_metrics_percentile(JANUS_METRICS_HANDLE_SETUP, 90)));
+	json_object_set_new(setup, "p99", json_integer((json_int_t)janus_metrics_percentile(JANUS_METRICS_HANDLE_SETUP, 99)));
+	json_object_set_new(info, "setup-us", setup);
+	return info;
+}
+
+/* Rough estimate of what a GHashTable costs, as we can't see its buckets */
+static gsize janus_ice_hash_table_memory(GHashTable *table) {
+	if(table == NULL)
+		return 0;
+	return 96 + g_hash_table_size(table) * (2*sizeof(gpointer) + sizeof(guint));
+}
+static gsize janus_ice_pt_map_memory(const janus_ice_pt_map *map) {
+	return map->by_pt ? 128*sizeof(guint32) : 0;
+}
+json_t *janus_ice_handle_memory(janus_ice_handle *handle) {
+	if(handle == NULL)
+		return NULL;
+	/* Handle, outgoing queues and candidates */
+	gsize handle_bytes = sizeof(janus_ice_handle);
+	if(handle->packet_ring != NULL)
+		handle_bytes += sizeof(janus_ice_packet_ring) +
+			(handle->packet_ring->mask+1) * sizeof(janus_ice_packet_ring_cell);
+	if(handle->queued_packets != NULL) {
+		gint queued = g_async_queue_length(handle->queued_packets);
+		if(queued > 0)
+			handle_bytes += queued * sizeof(janus_ice_queued_packet);
+	}
+	if(handle->queued_candidates != NULL) {
+		gint queued = g_async_queue_length(handle->queued_candidates);
+		if(queued > 0)
+			handle_bytes += queued * sizeof(NiceCandidate);
+	}
+	handle_bytes += g_list_length(handle->pending_trickles) * sizeof(GList);
+	/* PeerConnection and its lookup tables */
+	gsize pc_bytes = 0, media_bytes = 0, retransmit_bytes = 0;
+	janus_ice_peerconnection *pc = handle->pc;
+	if(pc != NULL) {
+		pc_bytes += sizeof(janus_ice_peerconnection);
+		pc_bytes += janus_ice_hash_table_memory(pc->media);
+		pc_bytes += janus_ice_hash_table_memory(pc->media_byssrc);
+		pc_bytes += janus_ice_hash_table_memory(pc->media_bymid);
+		pc_bytes += janus_ice_pt_map_memory(&pc->payload_types);
+		pc_bytes += janus_ice_pt_map_memory(&pc->clock_rates);
+		pc_bytes += janus_ice_pt_map_memory(&pc->rtx_payload_types);
+		pc_bytes += janus_ice_pt_map_memory(&pc->rtx_payload_types_rev);
+		pc_bytes += (g_slist_length(pc->candidates) + g_slist_length(pc->local_candidates) +
+			g_slist_length(pc->remote_candidates)) * sizeof(GSList);
+		if(pc->nacks_queue != NULL)
+			pc_bytes += g_queue_get_length(pc->nacks_queue) * sizeof(GList);
+		/* Media */
+		GHashTableIter iter;
+		gpointer value;
+		if(pc->media != NULL)
+			g_hash_table_iter_init(&iter, pc->media);
+		while(pc->media != NULL && g_hash_table_iter_next(&iter, NULL, &value)) {
+			janus_ice_peerconnection_medium *medium = value;
+			media_bytes += sizeof(janus_ice_peerconnection_medium);
+			media_bytes += g_list_length(medium->payload_types) * sizeof(GList);
+			media_bytes += janus_ice_pt_map_memory(&medium->rtx_payload_types);
+			media_bytes += janus_ice_hash_table_memory(medium->pending_nacked_cleanup);
+			int i = 0;
+			for(i=0; i<3; i++) {
+				if(medium->rtcp_ctx[i] != NULL)
+					media_bytes += sizeof(janus_rtcp_context);
+				if(medium->last_seqs[i] != NULL)
+					media_bytes += sizeof(janus_seq_window);
+				media_bytes += janus_ice_hash_table_memory(medium->rtx_nacked[i]);
+			}
+			retransmit_bytes += medium->retransmit_memory;
+		}
+	}
+	json_t *info = json_object();
+	json_object_set_new(info, "handle", json_integer(handle_bytes));
+	json_object_set_new(info, "peerconnection", json_integer(pc_bytes));
+	json_object_set_new(info, "media", json_integer(media_bytes));
+	json_object_set_new(info, "retransmit-buffers", json_integer(retransmit_bytes));
+	json_object_set_new(info, "total", json_integer(handle_bytes + pc_bytes + media_bytes + retransmit_bytes));
+	return info;
+}
+
 int janus_ice_setup_local(janus_ice_handle *handle, gboolean offer, gboolean trickle, janus_dtls_role dtls_role) {
 	if(!handle || g_atomic_int_get(&handle->destroyed))
 		return -1;
@@ -3598,6 +5142,7 @@ int janus_ice_setup_local(janus_ice_handle *handle, gboolean offer, gboolean tri
 		return -2;
 	}
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Setting ICE locally: got %s\n", handle->handle_id, offer ? "OFFER" : "ANSWER");
+	gint64 setup_start = janus_get_monotonic_time();
 	g_atomic_int_set(&handle->closepc, 0);
 	janus_flags_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_AGENT);
 	janus_flags_clear(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_START);
@@ -3622,35 +5167,15 @@ int janus_ice_setup_local(janus_ice_handle *handle, gboolean offer, gboolean tri
 
 	/* Note: NICE_COMPATIBILITY_RFC5245 is only available in more recent versions of libnice */
 	handle->controlling = janus_ice_lite_enabled ? FALSE : !offer;
-	JANUS_LOG(LOG_INFO, "[%"SCNu64"] Creating ICE agent (ICE %s mode, %s)\n", handle->handle_id,
+	handle->agent = janus_ice_agent_pool_get(handle);
+	JANUS_LOG(LOG_INFO, "[%"SCNu64"] %s ICE agent (ICE %s mode, %s)\n", handle->handle_id,
+		handle->agent ? "Reusing pooled" : "Creating",
 		janus_ice_lite_enabled ? "Lite" : "Full", handle->controlling ? "controlling" : "controlled");
-	handle->agent = g_object_new(NICE_TYPE_AGENT,
-		"compatibility", NICE_COMPATIBILITY_RFC5245,
-		"main-context", handle->mainctx,
-		"reliable", FALSE,
-		"full-mode", janus_ice_lite_enabled ? FALSE : TRUE,
-#ifdef HAVE_ICE_NOMINATION
-		"nomination-mode", janus_ice_nomination,
-#endif
-#ifdef HAVE_CONSENT_FRESHNESS
-		"consent-freshness", janus_ice_consent_freshness ? TRUE : FALSE,
-#endif
-		"keepalive-conncheck", janus_ice_keepalive_connchecks ? TRUE : FALSE,
-#ifdef HAVE_LIBNICE_TCP
-		"ice-udp", TRUE,
-		"ice-tcp", janus_ice_tcp_enabled ? TRUE : FALSE,
-#endif
-		NULL);
+	if(handle->agent == NULL)
+		handle->agent = janus_ice_agent_new(handle->mainctx);
 	handle->agent_created = janus_get_monotonic_time();
 	handle->srtp_errors_count = 0;
 	handle->last_srtp_error = 0;
-	/* Any STUN server to use? */
-	if(janus_stun_server != NULL && janus_stun_port > 0) {
-		g_object_set(G_OBJECT(handle->agent),
-			"stun-server", janus_stun_server,
-			"stun-server-port", janus_stun_port,
-			NULL);
-	}
 	/* Any dynamic TURN credentials to retrieve via REST API? */
 	gboolean have_turnrest_credentials = FALSE;
 #ifdef HAVE_TURNRESTAPI
@@ -3662,8 +5187,8 @@ int janus_ice_setup_local(janus_ice_handle *handle, gboolean offer, gboolean tri
 		janus_session *session = (janus_session *)handle->session;
 		g_snprintf(turnrest_username, sizeof(turnrest_username), "%"SCNu64, session->session_id);
 	}
-	janus_turnrest_response *turnrest_credentials = janus_turnrest_request((const char *)(handle->opaque_id ?
-		handle->opaque_id : turnrest_username));
+	janus_turnrest_response *turnrest_credentials = janus_ice_mux_is_enabled() ? NULL :
+		janus_turnrest_request((const char *)(handle->opaque_id ? handle->opaque_id : turnrest_username));
 	if(turnrest_credentials != NULL) {
 		have_turnrest_credentials = TRUE;
 		JANUS_LOG(LOG_VERB, "[%"SCNu64"] Got credentials from the TURN REST API backend!\n", handle->handle_id);
@@ -3679,7 +5204,6 @@ int janus_ice_setup_local(janus_ice_handle *handle, gboolean offer, gboolean tri
 		}
 	}
 #endif
-	g_object_set(G_OBJECT(handle->agent), "upnp", FALSE, NULL);
 	g_object_set(G_OBJECT(handle->agent), "controlling-mode", handle->controlling, NULL);
 	g_signal_connect (G_OBJECT (handle->agent), "candidate-gathering-done",
 		G_CALLBACK (janus_ice_cb_candidate_gathering_done), handle);
@@ -3706,62 +5230,6 @@ int janus_ice_setup_local(janus_ice_handle *handle, gboolean offer, gboolean tri
 #endif
 		G_CALLBACK (janus_ice_cb_new_remote_candidate), handle);
 
-	/* Add all local addresses, except those in the ignore list */
-	struct ifaddrs *ifaddr, *ifa;
-	int family, s, n;
-	char host[NI_MAXHOST];
-	if(getifaddrs(&ifaddr) == -1) {
-		JANUS_LOG(LOG_ERR, "[%"SCNu64"] Error getting list of interfaces... %d (%s)\n",
-			handle->handle_id, errno, g_strerror(errno));
-	} else {
-		for(ifa = ifaddr, n = 0; ifa != NULL; ifa = ifa->ifa_next, n++) {
-			if(ifa->ifa_addr == NULL)
-				continue;
-			/* Skip interfaces which are not up and running */
-			if(!((ifa->ifa_flags & IFF_UP) && (ifa->ifa_flags & IFF_RUNNING)))
-				continue;
-			/* Skip loopback interfaces */
-			if(ifa->ifa_flags & IFF_LOOPBACK)
-				continue;
-			family = ifa->ifa_addr->sa_family;
-			if(family != AF_INET && family != AF_INET6)
-				continue;
-			/* We only add IPv6 addresses if support for them has been explicitly enabled */
-			if(family == AF_INET6 && !janus_ipv6_enabled)
-				continue;
-			/* Check the interface name first, we can ignore that as well: enforce list would be checked later */
-			if(janus_ice_enforce_list == NULL && ifa->ifa_name != NULL && janus_ice_is_ignored(ifa->ifa_name))
-				continue;
-			s = getnameinfo(ifa->ifa_addr,
-					(family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6),
-					host, NI_MAXHOST, NULL, 0, NI_NUMERICHOST);
-			if(s != 0) {
-				JANUS_LOG(LOG_ERR, "[%"SCNu64"] getnameinfo() failed: %s\n", handle->handle_id, gai_strerror(s));
-				continue;
-			}
-			/* Skip 0.0.0.0, :: and, unless otherwise configured, local scoped addresses  */
-			if(!strcmp(host, "0.0.0.0") || !strcmp(host, "::") || (!janus_ipv6_linklocal_enabled && !strncmp(host, "fe80:", 5)))
-				continue;
-			/* Check if this IP address is in the ignore/enforce list: the enforce list has the precedence but the ignore list can then discard candidates */
-			if(janus_ice_enforce_list != NULL) {
-				if(ifa->ifa_name != NULL && !janus_ice_is_enforced(ifa->ifa_name) && !janus_ice_is_enforced(host))
-					continue;
-			}
-			if(janus_ice_is_ignored(host))
-				continue;
-			/* Ok, add interface to the ICE agent */
-			JANUS_LOG(LOG_VERB, "[%"SCNu64"] Adding %s to the addresses to gather candidates for\n", handle->handle_id, host);
-			NiceAddress addr_local;
-			nice_address_init (&addr_local);
-			if(!nice_address_set_from_string (&addr_local, host)) {
-				JANUS_LOG(LOG_WARN, "[%"SCNu64"] Skipping invalid address %s\n", handle->handle_id, host);
-				continue;
-			}
-			nice_agent_add_local_address (handle->agent, &addr_local);
-		}
-		freeifaddrs(ifaddr);
-	}
-
 	handle->cdone = 0;
 	handle->stream_id = 0;
 	/* Now create a ICE stream for all the media we'll handle */
@@ -3778,9 +5246,13 @@ int janus_ice_setup_local(janus_ice_handle *handle, gboolean offer, gboolean tri
 	pc->handle = handle;
 	pc->dtls_role = dtls_role;
 	janus_mutex_init(&pc->mutex);
+	/* The bandwidth estimation context is read by other threads (e.g., plugins
+	 * asking for the estimate), so we create it here rather than on demand:
+	 * it won't provide any estimate until we get transport wide cc feedback */
+	pc->bwe = janus_bwe_context_create();
 	if(!have_turnrest_credentials) {
 		/* No TURN REST API server and credentials, any static ones? */
-		if(janus_turn_server != NULL) {
+		if(janus_turn_server != NULL && !janus_ice_mux_is_enabled()) {
 			/* We need relay candidates as well */
 			gboolean ok = nice_agent_set_relay_info(handle->agent, handle->stream_id, 1,
 				janus_turn_server, janus_turn_port, janus_turn_user, janus_turn_pwd, janus_turn_type);
@@ -3810,16 +5282,18 @@ int janus_ice_setup_local(janus_ice_handle *handle, gboolean offer, gboolean tri
 	handle->pc = pc;
 	/* Create the media instances we need */
 	pc->media = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_ice_peerconnection_medium_destroy);
+	pc->media_array = g_ptr_array_new();
 	pc->media_byssrc = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_ice_peerconnection_medium_dereference);
 	pc->media_bymid = g_hash_table_new_full(g_str_hash, g_str_equal,
 		(GDestroyNotify)g_free, (GDestroyNotify)janus_ice_peerconnection_medium_dereference);
-	pc->media_bytype = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_ice_peerconnection_medium_dereference);
 #ifdef HAVE_PORTRANGE
 	/* FIXME: libnice supports this since 0.1.0, but the 0.1.3 on Fedora fails with an undefined reference! */
-	nice_agent_set_port_range(handle->agent, handle->stream_id, 1, rtp_range_min, rtp_range_max);
+	if(!janus_ice_mux_is_enabled())
+		nice_agent_set_port_range(handle->agent, handle->stream_id, 1, rtp_range_min, rtp_range_max);
 #endif
-	/* Gather now only if we're doing hanf-trickle */
-	if(!janus_full_trickle_enabled && !nice_agent_gather_candidates(handle->agent, handle->stream_id)) {
+	/* Gather now only if we're doing hanf-trickle (and not using the ICE mux) */
+	if(!janus_full_trickle_enabled && !janus_ice_mux_is_enabled() &&
+			!nice_agent_gather_candidates(handle->agent, handle->stream_id)) {
 #ifdef HAVE_TURNRESTAPI
 		if(turnrest_credentials != NULL) {
 			janus_turnrest_response_destroy(turnrest_credentials);
@@ -3839,6 +5313,18 @@ int janus_ice_setup_local(janus_ice_handle *handle, gboolean offer, gboolean tri
 		turnrest_credentials = NULL;
 	}
 #endif
+	if(janus_ice_mux_is_enabled()) {
+		/* Register the PeerConnection in the ICE mux: there's nothing to gather,
+		 * so unless we're doing full-trickle (where we wait for the trigger to
+		 * send the candidates in trickle events) we're done already */
+		if(janus_ice_mux_register(handle, pc) < 0) {
+			janus_flags_clear(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_HAS_AGENT);
+			janus_ice_webrtc_hangup(handle, "ICE mux error");
+			return -1;
+		}
+		if(!janus_full_trickle_enabled)
+			janus_ice_cb_candidate_gathering_done(handle->agent, handle->stream_id, handle);
+	}
 	/* Create DTLS-SRTP context, at last */
 	pc->dtls = janus_dtls_srtp_create(pc, pc->dtls_role);
 	if(!pc->dtls) {
@@ -3858,6 +5344,7 @@ int janus_ice_setup_local(janus_ice_handle *handle, gboolean offer, gboolean tri
 #endif
 		g_main_context_wakeup(handle->mainctx);
 	}
+	janus_metrics_observe(JANUS_METRICS_HANDLE_SETUP, (guint)(janus_get_monotonic_time() - setup_start));
 	return 0;
 }
 
@@ -3867,6 +5354,9 @@ void janus_ice_restart(janus_ice_handle *handle) {
 	/* Restart ICE */
 	if(nice_agent_restart(handle->agent) == FALSE) {
 		JANUS_LOG(LOG_WARN, "[%"SCNu64"] ICE restart failed...\n", handle->handle_id);
+	} else if(handle->pc->mux != NULL && janus_ice_mux_register(handle, handle->pc) < 0) {
+		/* The old credentials are still valid in the mux, so connectivity checks will fail */
+		JANUS_LOG(LOG_WARN, "[%"SCNu64"] ICE restart failed in the ICE mux...\n", handle->handle_id);
 	}
 	janus_flags_clear(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ICE_RESTART);
 }
@@ -3878,11 +5368,10 @@ void janus_ice_resend_trickles(janus_ice_handle *handle) {
 	janus_ice_peerconnection *pc = handle->pc;
 	if(!pc)
 		return;
-	NiceAgent *agent = handle->agent;
 	/* Iterate on all existing local candidates */
 	gchar buffer[200];
 	GSList *candidates, *i;
-	candidates = nice_agent_get_local_candidates (agent, pc->stream_id, pc->component_id);
+	candidates = janus_ice_get_local_candidates(handle, pc->stream_id, pc->component_id);
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] We have %d candidates for Stream #%d, Component #%d\n",
 		handle->handle_id, g_slist_length(candidates), pc->stream_id, pc->component_id);
 	for(i = candidates; i; i = i->next) {
@@ -3949,7 +5438,7 @@ static void janus_ice_rtp_extension_update(janus_ice_handle *handle, janus_ice_p
 		extbufsize -= 4;
 		/* Check if we need to add the abs-send-time extension */
 		if(video && handle->pc->abs_send_time_ext_id > 0) {
-			int64_t now = (((janus_get_monotonic_time()/1000) << 18) + 500) / 1000;
+			int64_t now = (((janus_get_cached_monotonic_time()/1000) << 18) + 500) / 1000;
 			uint32_t abs_ts = (uint32_t)now & 0x00FFFFFF;
 			uint32_t abs24 = htonl(abs_ts) >> 8;
 			if(!use_2byte) {
@@ -3971,6 +5460,9 @@ static void janus_ice_rtp_extension_update(janus_ice_handle *handle, janus_ice_p
 		if(video && handle->pc->transport_wide_cc_ext_id > 0) {
 			handle->pc->transport_wide_cc_out_seq_num++;
 			uint16_t transSeqNum = htons(handle->pc->transport_wide_cc_out_seq_num);
+			/* Keep track of the sequence number, so that we can use the feedback for estimating the bandwidth */
+			packet->twcc = TRUE;
+			packet->twcc_seq = handle->pc->transport_wide_cc_out_seq_num;
 			if(!use_2byte) {
 				*index = (handle->pc->transport_wide_cc_ext_id << 4) + 1;
 				memcpy(index+1, &transSeqNum, 2);
@@ -4161,11 +5653,9 @@ static void janus_ice_rtp_extension_update(janus_ice_handle *handle, janus_ice_p
 	packet->length = totlen;
 }
 
-static gint rtcp_transport_wide_cc_stats_comparator(gconstpointer item1, gconstpointer item2) {
-	return ((rtcp_transport_wide_cc_stats*)item1)->transport_seq_num - ((rtcp_transport_wide_cc_stats*)item2)->transport_seq_num;
-}
-static gboolean janus_ice_outgoing_transport_wide_cc_feedback(gpointer user_data) {
-	janus_ice_handle *handle = (janus_ice_handle *)user_data;
+/* Helper to add transport-wide CC feedback to a compound RTCP packet we're assembling */
+static void janus_ice_transport_wide_cc_feedback_add(janus_ice_handle *handle,
+		janus_ice_queued_packet **pkt, janus_rtcp_compound *compound) {
 	janus_ice_peerconnection *pc = handle->pc;
 
 	guint32 ssrc_peer = 0;
@@ -4200,97 +5690,59 @@ static gboolean janus_ice_outgoing_transport_wide_cc_feedback(gpointer user_data
 
 	if(medium == NULL) {
 		JANUS_LOG(LOG_HUGE, "No medium with a valid peer SSRC found for transport-wide CC feedback\n");
-		return G_SOURCE_CONTINUE;
+		return;
 	}
 
 	if(pc && pc->do_transport_wide_cc) {
-		/* Create a transport wide feedback message */
-		size_t size = 1300;
-		char rtcpbuf[1300];
-		/* Order packet list */
-		pc->transport_wide_received_seq_nums = g_slist_sort(pc->transport_wide_received_seq_nums,
-			rtcp_transport_wide_cc_stats_comparator);
-		/* Create full stats queue */
-		GQueue *packets = g_queue_new();
-		/* For all packets */
-		GSList *it = NULL;
-		for(it = pc->transport_wide_received_seq_nums; it; it = it->next) {
-			/* Get stat */
-			janus_rtcp_transport_wide_cc_stats *stats = (janus_rtcp_transport_wide_cc_stats *)it->data;
-			/* Get transport seq */
-			guint32 transport_seq_num = stats->transport_seq_num;
-			/* Check if it is an out of order  */
-			if(transport_seq_num < pc->transport_wide_cc_last_feedback_seq_num) {
-				/* Skip, it was already reported as lost */
-				g_free(stats);
-				continue;
-			}
-			/* If not first */
-			if(pc->transport_wide_cc_last_feedback_seq_num) {
-				/* For each lost */
-				guint32 i = 0;
-				for(i = pc->transport_wide_cc_last_feedback_seq_num+1; i<transport_seq_num; ++i) {
-					/* Create new stat */
-					janus_rtcp_transport_wide_cc_stats *missing = g_malloc(sizeof(janus_rtcp_transport_wide_cc_stats));
-					/* Add missing packet */
-					missing->transport_seq_num = i;
-					missing->timestamp = 0;
-					/* Add it */
-					g_queue_push_tail(packets, missing);
-				}
-			}
-			/* Store last */
-			pc->transport_wide_cc_last_feedback_seq_num = transport_seq_num;
-			/* Add this one */
-			g_queue_push_tail(packets, stats);
-		}
-		/* Free and reset stats list */
-		g_slist_free(pc->transport_wide_received_seq_nums);
-		pc->transport_wide_received_seq_nums = NULL;
-		/* Create and enqueue RTCP packets */
-		guint packets_len = 0;
-		while((packets_len = g_queue_get_length(packets)) > 0) {
-			GQueue *packets_to_process;
-			/* If we have more than 400 packets to acknowledge, let's send more than one message */
-			if(packets_len > 400) {
-				/* Split the queue into two */
-				GList *new_head = g_queue_peek_nth_link(packets, 400);
-				GList *new_tail = new_head->prev;
-				new_head->prev = NULL;
-				new_tail->next = NULL;
-				packets_to_process = g_queue_new();
-				packets_to_process->head = packets->head;
-				packets_to_process->tail = new_tail;
-				packets_to_process->length = 400;
-				packets->head = new_head;
-				/* packets->tail is unchanged */
-				packets->length = packets_len - 400;
-			} else {
-				packets_to_process = packets;
-			}
+		/* Create transport wide feedback messages, appending them to the compound
+		 * packet: if we have more than 400 packets to acknowledge, we'll add more
+		 * than one message, and start a new compound packet if it's full */
+		int len = 0;
+		gboolean retry = FALSE;
+		do {
+			if(*pkt == NULL)
+				*pkt = janus_ice_rtcp_compound_new(medium, compound);
+			int available = 0;
+			char *rtcpbuf = janus_rtcp_compound_tail(compound, &available);
+			janus_mutex_lock(&pc->mutex);
 			/* Get feedback packet count and increase it for next one */
-			guint8 feedback_packet_count = pc->transport_wide_cc_feedback_count++;
-			/* Create RTCP packet */
-			int len = janus_rtcp_transport_wide_cc_feedback(rtcpbuf, size,
-				medium->ssrc, ssrc_peer, feedback_packet_count, packets_to_process);
-			/* Enqueue it, we'll send it later */
+			guint8 feedback_packet_count = pc->transport_wide_cc_feedback_count;
+			len = janus_rtcp_transport_wide_cc_feedback(rtcpbuf, available,
+				medium->ssrc, ssrc_peer, feedback_packet_count, pc->transport_wide_cc_ring, 400);
+			if(len > 0)
+				pc->transport_wide_cc_feedback_count++;
+			janus_mutex_unlock(&pc->mutex);
 			if(len > 0) {
-				janus_plugin_rtcp rtcp = { .mindex = medium->mindex, .video = TRUE, .buffer = rtcpbuf, .length = len };
-				janus_ice_relay_rtcp_internal(handle, medium, &rtcp, FALSE);
+				janus_rtcp_compound_commit(compound, len);
+				retry = FALSE;
+			} else if(len < 0 && compound->length > 0 && !retry) {
+				/* Not enough room left: send what we have, and try again in a new one */
+				janus_ice_rtcp_compound_flush(handle, pkt, compound);
+				retry = TRUE;
+				len = 1;
 			}
-			if(packets_to_process != packets) {
-				g_queue_free(packets_to_process);
-			}
-		}
-		/* Free mem */
-		g_queue_free(packets);
+		} while(len > 0);
 	}
+}
+
+static gboolean janus_ice_outgoing_transport_wide_cc_feedback(gpointer user_data) {
+	janus_ice_handle *handle = (janus_ice_handle *)user_data;
+	janus_rtcp_compound compound = { 0 };
+	janus_ice_queued_packet *pkt = NULL;
+	janus_ice_transport_wide_cc_feedback_add(handle, &pkt, &compound);
+	janus_ice_rtcp_compound_flush(handle, &pkt, &compound);
 	return G_SOURCE_CONTINUE;
 }
 
 static gboolean janus_ice_outgoing_rtcp_handle(gpointer user_data) {
 	janus_ice_handle *handle = (janus_ice_handle *)user_data;
 	janus_ice_peerconnection *pc = handle->pc;
+	/* We assemble SR/SDES and RR for all media (and transport-wide CC feedback,
+	 * if it's sent at the same pace) in a single compound packet per interval,
+	 * written directly in the buffer we'll queue, rather than queueing (and
+	 * copying) a separate packet for each message as we used to do */
+	janus_rtcp_compound compound = { 0 };
+	janus_ice_queued_packet *pkt = NULL;
 	/* Iterate on all media */
 	janus_ice_peerconnection_medium *medium = NULL;
 	uint mi=0;
@@ -4302,9 +5754,16 @@ static gboolean janus_ice_outgoing_rtcp_handle(gpointer user_data) {
 			/* Create a SR/SDES compound */
 			int srlen = 28;
 			int sdeslen = 16;
-			char rtcpbuf[sizeof(janus_rtcp_sr)+sdeslen];
-			memset(rtcpbuf, 0, sizeof(rtcpbuf));
-			rtcp_sr *sr = (rtcp_sr *)&rtcpbuf;
+			if(pkt == NULL)
+				pkt = janus_ice_rtcp_compound_new(medium, &compound);
+			char *rtcpbuf = janus_rtcp_compound_reserve(&compound, srlen+sdeslen);
+			if(rtcpbuf == NULL) {
+				/* Full, send what we have and start a new compound packet */
+				janus_ice_rtcp_compound_flush(handle, &pkt, &compound);
+				pkt = janus_ice_rtcp_compound_new(medium, &compound);
+				rtcpbuf = janus_rtcp_compound_reserve(&compound, srlen+sdeslen);
+			}
+			rtcp_sr *sr = (rtcp_sr *)rtcpbuf;
 			sr->header.version = 2;
 			sr->header.type = RTCP_SR;
 			sr->header.rc = 0;
@@ -4331,10 +5790,6 @@ static gboolean janus_ice_outgoing_rtcp_handle(gpointer user_data) {
 			rtcp_sdes *sdes = (rtcp_sdes *)&rtcpbuf[srlen];
 			janus_rtcp_sdes_cname((char *)sdes, sdeslen, "janus", 5);
 			sdes->chunk.ssrc = htonl(medium->ssrc);
-			/* Enqueue it, we'll send it later */
-			janus_plugin_rtcp rtcp = { .mindex = medium->mindex,
-				.video = (medium->type == JANUS_MEDIA_VIDEO), .buffer = rtcpbuf, .length = srlen+sdeslen };
-			janus_ice_relay_rtcp_internal(handle, medium, &rtcp, FALSE);
 			/* Check if we detected too many losses, and send a slowlink event in case */
 			gint lost = janus_rtcp_context_get_lost_all(rtcp_ctx, TRUE);
 			lost = lost > 0 ? lost : 0;
@@ -4347,9 +5802,16 @@ static gboolean janus_ice_outgoing_rtcp_handle(gpointer user_data) {
 				if(medium->rtcp_ctx[vindex] && medium->rtcp_ctx[vindex]->rtp_recvd) {
 					/* Create a RR */
 					int rrlen = 32;
-					char rtcpbuf[32];
-					memset(rtcpbuf, 0, sizeof(rtcpbuf));
-					rtcp_rr *rr = (rtcp_rr *)&rtcpbuf;
+					if(pkt == NULL)
+						pkt = janus_ice_rtcp_compound_new(medium, &compound);
+					char *rtcpbuf = janus_rtcp_compound_reserve(&compound, rrlen);
+					if(rtcpbuf == NULL) {
+						/* Full, send what we have and start a new compound packet */
+						janus_ice_rtcp_compound_flush(handle, &pkt, &compound);
+						pkt = janus_ice_rtcp_compound_new(medium, &compound);
+						rtcpbuf = janus_rtcp_compound_reserve(&compound, rrlen);
+					}
+					rtcp_rr *rr = (rtcp_rr *)rtcpbuf;
 					rr->header.version = 2;
 					rr->header.type = RTCP_RR;
 					rr->header.rc = 1;
@@ -4357,10 +5819,6 @@ static gboolean janus_ice_outgoing_rtcp_handle(gpointer user_data) {
 					rr->ssrc = htonl(medium->ssrc);
 					janus_rtcp_report_block(medium->rtcp_ctx[vindex], &rr->rb[0]);
 					rr->rb[0].ssrc = htonl(medium->ssrc_peer[vindex]);
-					/* Enqueue it, we'll send it later */
-					janus_plugin_rtcp rtcp = { .mindex = medium->mindex,
-						.video = (medium->type == JANUS_MEDIA_VIDEO), .buffer = rtcpbuf, .length = 32 };
-					janus_ice_relay_rtcp_internal(handle, medium, &rtcp, FALSE);
 					if(vindex == 0) {
 						/* Check if we detected too many losses, and send a slowlink event in case */
 						gint lost = janus_rtcp_context_get_lost_all(medium->rtcp_ctx[vindex], FALSE);
@@ -4372,12 +5830,62 @@ static gboolean janus_ice_outgoing_rtcp_handle(gpointer user_data) {
 		}
 	}
 	if(twcc_period == 1000) {
-		/* The Transport Wide CC feedback period is 1s as well, send it here */
-		janus_ice_outgoing_transport_wide_cc_feedback(handle);
+		/* The Transport Wide CC feedback period is 1s as well, add it here */
+		janus_ice_transport_wide_cc_feedback_add(handle, &pkt, &compound);
 	}
+	/* Enqueue the compound packet, we'll send it later */
+	janus_ice_rtcp_compound_flush(handle, &pkt, &compound);
 	return G_SOURCE_CONTINUE;
 }
 
+/* Adaptive FEC policy: losses (as a percentage of the packets we sent) above
+ * which we start generating FlexFEC, and below which we stop doing that */
+#define JANUS_ICE_FEC_LOSS_ON	2
+#define JANUS_ICE_FEC_LOSS_OFF	1
+static int janus_ice_fec_group_size(uint32_t loss) {
+	/* The more we lose, the fewer media packets each FEC packet protects */
+	if(loss >= 10)
+		return 3;
+	else if(loss >= 5)
+		return 5;
+	return 10;
+}
+static void janus_ice_peerconnection_medium_update_fec(janus_ice_handle *handle, janus_ice_peerconnection_medium *medium) {
+	int current = janus_fec_context_get_group_size(medium->fec);
+	int size = 0;
+	if(flexfec && medium->type == JANUS_MEDIA_VIDEO && medium->send &&
+			medium->fec_payload_type > 0 && medium->ssrc_fec > 0) {
+		/* The loss we use is the worst between the one NACKs tell us about
+		 * and the one the peer reports in its Receiver Reports */
+		uint32_t link_q = MIN(janus_rtcp_context_get_out_link_quality(medium->rtcp_ctx[0]),
+			janus_rtcp_context_get_out_media_link_quality(medium->rtcp_ctx[0]));
+		uint32_t loss = (link_q < 100 ? 100 - link_q : 0);
+		uint32_t rtt = janus_rtcp_context_get_rtt(medium->rtcp_ctx[0]);
+		/* When the RTT is low retransmissions are enough and cheaper, so we
+		 * only add FEC when NACKs would come too late (or aren't available
+		 * at all): once enabled, we use lower thresholds to turn it off */
+		gboolean nacks = medium->do_nacks && medium->nack_queue_ms > 0;
+		if(current == 0 && loss >= JANUS_ICE_FEC_LOSS_ON && (!nacks || rtt >= flexfec_rtt_threshold))
+			size = janus_ice_fec_group_size(loss);
+		else if(current > 0 && loss >= JANUS_ICE_FEC_LOSS_OFF && (!nacks || rtt >= flexfec_rtt_threshold*3/4))
+			size = janus_ice_fec_group_size(loss);
+		if(size != current) {
+			if(size > 0) {
+				JANUS_LOG(LOG_VERB, "[%"SCNu64"] Sending FlexFEC for medium #%d (loss=%"SCNu32"%%, rtt=%"SCNu32"ms): 1 repair packet every %d\n",
+					handle->handle_id, medium->mindex, loss, rtt, size);
+			} else {
+				JANUS_LOG(LOG_VERB, "[%"SCNu64"] No need for FlexFEC for medium #%d anymore (loss=%"SCNu32"%%, rtt=%"SCNu32"ms)\n",
+					handle->handle_id, medium->mindex, loss, rtt);
+			}
+		}
+	}
+	if(size == current)
+		return;
+	if(medium->fec == NULL)
+		medium->fec = janus_fec_context_create(medium->ssrc_fec, medium->fec_payload_type);
+	janus_fec_context_set_group_size(medium->fec, size);
+}
+
 static gboolean janus_ice_outgoing_stats_handle(gpointer user_data) {
 	janus_ice_handle *handle = (janus_ice_handle *)user_data;
 	/* This callback is for stats and other things we need to do on a regular basis (typically called once per second) */
@@ -4387,8 +5895,22 @@ static gboolean janus_ice_outgoing_stats_handle(gpointer user_data) {
 	janus_ice_peerconnection *pc = handle->pc;
 	if(pc == NULL)
 		return G_SOURCE_CONTINUE;
-	/* Iterate on all media */
+	/* Update the pacer stats, if pacing is active */
+	janus_ice_pacer_update_stats(handle->pacer);
+	/* Sample how many packets are waiting to be sent, for the metrics */
+	gint queued = g_async_queue_length(handle->queued_packets);
+	janus_metrics_observe(JANUS_METRICS_QUEUE_DEPTH, queued > 0 ? queued : 0);
+	/* Check if it's time to send stats to event handlers, and if anyone's interested */
 	handle->last_event_stats++;
+	gboolean send_stats = FALSE;
+	if(janus_ice_event_stats_period > 0 && handle->last_event_stats >= janus_ice_event_stats_period &&
+			janus_events_is_interested(JANUS_EVENT_TYPE_MEDIA)) {
+		/* When sampling, we only send stats for this handle once every N periods */
+		send_stats = (janus_ice_event_stats_sampling < 2 ||
+			(handle->event_stats_count % janus_ice_event_stats_sampling) == 0);
+		handle->event_stats_count++;
+	}
+	/* Iterate on all media */
 	janus_ice_peerconnection_medium *medium = NULL;
 	json_t *combined_event = NULL;
 	uint mi=0;
@@ -4431,15 +5953,33 @@ static gboolean janus_ice_outgoing_stats_handle(gpointer user_data) {
 				}
 			}
 		}
+		/* Check if we should start or stop generating FEC for this medium */
+		if(medium->type == JANUS_MEDIA_VIDEO)
+			janus_ice_peerconnection_medium_update_fec(handle, medium);
+		/* Sample the RTT as well, for the metrics */
+		if(medium->rtcp_ctx[0] != NULL) {
+			uint32_t rtt = janus_rtcp_context_get_rtt(medium->rtcp_ctx[0]);
+			if(rtt > 0)
+				janus_metrics_observe(JANUS_METRICS_RTT, rtt);
+		}
 		/* We also send live stats to event handlers every tot-seconds (configurable) */
-		if(janus_ice_event_stats_period > 0 && handle->last_event_stats >= janus_ice_event_stats_period) {
-			if(janus_events_is_enabled()) {
+		if(send_stats) {
+			if(janus_ice_event_batch_media_stats) {
+				/* Just add a row per media to the next batch */
+				int vindex=0;
+				for(vindex=0; vindex<3; vindex++) {
+					if(((medium->type == JANUS_MEDIA_DATA && vindex == 0) || medium->rtcp_ctx[vindex]) &&
+							janus_ice_event_stats_check_losses(medium, vindex))
+						janus_ice_event_batch_medium_stats(handle, medium, vindex);
+				}
+			} else {
 				/* Check if we should send dedicated events per media, or one per peerConnection */
-				if(janus_events_is_enabled() && janus_ice_event_get_combine_media_stats() && combined_event == NULL)
+				if(janus_ice_event_get_combine_media_stats() && combined_event == NULL)
 					combined_event = json_array();
 				int vindex=0;
 				for(vindex=0; vindex<3; vindex++) {
-					if(medium && ((medium->type == JANUS_MEDIA_DATA && vindex == 0) || medium->rtcp_ctx[vindex])) {
+					if(medium && ((medium->type == JANUS_MEDIA_DATA && vindex == 0) || medium->rtcp_ctx[vindex]) &&
+							janus_ice_event_stats_check_losses(medium, vindex)) {
 						json_t *info = json_object();
 						json_object_set_new(info, "mid", json_string(medium->mid));
 						json_object_set_new(info, "mindex", json_integer(medium->mindex));
@@ -4486,6 +6026,14 @@ static gboolean janus_ice_outgoing_stats_handle(gpointer user_data) {
 						}
 						if(medium->mindex == 0 && pc->remb_bitrate > 0)
 							json_object_set_new(info, "remb-bitrate", json_integer(pc->remb_bitrate));
+						if(medium->mindex == 0 && janus_bwe_context_get_estimate(pc->bwe) > 0)
+							json_object_set_new(info, "bwe-estimate", json_integer(janus_bwe_context_get_estimate(pc->bwe)));
+						if(vindex == 0 && medium->fec != NULL)
+							json_object_set_new(info, "fec-group-size", json_integer(janus_fec_context_get_group_size(medium->fec)));
+						if(medium->type == JANUS_MEDIA_VIDEO && handle->pacer != NULL) {
+							json_object_set_new(info, "pacer-queue-delay", json_integer(handle->pacer->last_delay_avg));
+							json_object_set_new(info, "pacer-queue-delay-max", json_integer(handle->pacer->last_delay_max));
+						}
 						if(combined_event != NULL) {
 							json_array_append_new(combined_event, info);
 						} else {
@@ -4528,21 +6076,33 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 		/* Start gathering candidates */
 		if(handle->agent == NULL) {
 			JANUS_LOG(LOG_WARN, "[%"SCNu64"] No ICE agent, not going to gather candidates...\n", handle->handle_id);
+		} else if(pc != NULL && pc->mux != NULL) {
+			/* Nothing to gather when using the ICE mux, just trickle the candidates we have */
+			handle->cdone++;
+			pc->gathered = janus_get_monotonic_time();
+			pc->cdone = TRUE;
+			janus_ice_resend_trickles(handle);
 		} else if(!nice_agent_gather_candidates(handle->agent, handle->stream_id)) {
 			JANUS_LOG(LOG_ERR, "[%"SCNu64"] Error gathering candidates...\n", handle->handle_id);
 			janus_ice_webrtc_hangup(handle, "ICE gathering error");
 		}
 		return G_SOURCE_CONTINUE;
 	} else if(pkt == &janus_ice_add_candidates) {
-		/* There are remote candidates pending, add them now */
+		/* There are remote candidates pending, add them now: any candidate
+		 * queued from now on will schedule a new batch */
+		g_atomic_int_set(&handle->candidates_scheduled, 0);
 		GSList *candidates = NULL;
 		NiceCandidate *c = NULL;
 		while((c = g_async_queue_try_pop(handle->queued_candidates)) != NULL) {
-			JANUS_LOG(LOG_VERB, "[%"SCNu64"] Processing candidate %p\n", handle->handle_id, c);
-			candidates = g_slist_append(candidates, c);
+			JANUS_ICE_LOG(handle, LOG_VERB, "[%"SCNu64"] Processing candidate %p\n", handle->handle_id, c);
+			candidates = g_slist_prepend(candidates, c);
 		}
+		candidates = g_slist_reverse(candidates);
 		guint count = g_slist_length(candidates);
-		if(pc != NULL && count > 0) {
+		if(pc != NULL && pc->mux != NULL) {
+			/* When using the ICE mux, we learn the remote addresses from connectivity checks */
+			JANUS_ICE_LOG(handle, LOG_VERB, "[%"SCNu64"] Ignoring %u remote candidates (ICE mux)\n", handle->handle_id, count);
+		} else if(pc != NULL && count > 0) {
 			if(handle->agent_started == 0)
 				handle->agent_started = janus_get_monotonic_time();
 			int added = nice_agent_set_remote_candidates(handle->agent, pc->stream_id, pc->component_id, candidates);
@@ -4550,12 +6110,45 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 				JANUS_LOG(LOG_WARN, "[%"SCNu64"] Failed to add some remote candidates (added %u, expected %u)\n",
 					handle->handle_id, added, count);
 			} else {
-				JANUS_LOG(LOG_VERB, "[%"SCNu64"] %d remote %s added\n", handle->handle_id,
+				JANUS_ICE_LOG(handle, LOG_VERB, "[%"SCNu64"] %d remote %s added\n", handle->handle_id,
 					count, (count > 1 ? "candidates" : "candidate"));
 			}
 		}
 		g_slist_free(candidates);
 		return G_SOURCE_CONTINUE;
+	} else if(pkt == &janus_ice_mux_nominated) {
+		/* The peer nominated a candidate pair on the ICE mux: we handle this
+		 * as if libnice notified us about the component state and pair */
+		NiceAddress local, remote;
+		if(pc == NULL || pc->mux == NULL || !janus_ice_mux_get_selected_pair(pc->mux, &local, &remote))
+			return G_SOURCE_CONTINUE;
+		if(handle->agent_started == 0)
+			handle->agent_started = janus_get_monotonic_time();
+		if(pc->state != NICE_COMPONENT_STATE_READY) {
+			janus_ice_cb_component_state_changed(handle->agent, pc->stream_id, 1,
+				NICE_COMPONENT_STATE_READY, handle);
+		}
+#ifndef HAVE_LIBNICE_TCP
+		gchar laddress[NICE_ADDRESS_STRING_LEN], raddress[NICE_ADDRESS_STRING_LEN];
+		nice_address_to_string(&local, (gchar *)&laddress);
+		nice_address_to_string(&remote, (gchar *)&raddress);
+		gchar lpair[NICE_ADDRESS_STRING_LEN+8], rpair[NICE_ADDRESS_STRING_LEN+8];
+		g_snprintf(lpair, sizeof(lpair), "%s:%u", laddress, nice_address_get_port(&local));
+		g_snprintf(rpair, sizeof(rpair), "%s:%u", raddress, nice_address_get_port(&remote));
+		janus_ice_cb_new_selected_pair(handle->agent, pc->stream_id, 1, lpair, rpair, handle);
+#else
+		/* We only learn remote addresses from connectivity checks, so they're all prflx */
+		NiceCandidate *lc = nice_candidate_new(NICE_CANDIDATE_TYPE_HOST);
+		NiceCandidate *rc = nice_candidate_new(NICE_CANDIDATE_TYPE_PEER_REFLEXIVE);
+		lc->transport = NICE_CANDIDATE_TRANSPORT_UDP;
+		rc->transport = NICE_CANDIDATE_TRANSPORT_UDP;
+		lc->addr = local;
+		rc->addr = remote;
+		janus_ice_cb_new_selected_pair(handle->agent, pc->stream_id, 1, lc, rc, handle);
+		nice_candidate_free(lc);
+		nice_candidate_free(rc);
+#endif
+		return G_SOURCE_CONTINUE;
 	} else if(pkt == &janus_ice_dtls_handshake) {
 		if(!janus_is_webrtc_encryption_enabled()) {
 			JANUS_LOG(LOG_WARN, "[%"SCNu64"] WebRTC encryption disabled, skipping DTLS handshake\n", handle->handle_id);
@@ -4568,10 +6161,8 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 		/* Start the DTLS handshake */
 		janus_dtls_srtp_handshake(pc->dtls);
 		/* Create retransmission timer */
-		pc->dtlsrt_source = g_timeout_source_new(50);
-		g_source_set_callback(pc->dtlsrt_source, janus_dtls_retry, pc->dtls, NULL);
-		guint id = g_source_attach(pc->dtlsrt_source, handle->mainctx);
-		JANUS_LOG(LOG_VERB, "[%"SCNu64"] Creating retransmission timer with ID %u\n", handle->handle_id, id);
+		pc->dtlsrt_timer = janus_timer_add(handle->timers, 50, janus_dtls_retry, pc->dtls, NULL);
+		JANUS_ICE_LOG(handle, LOG_VERB, "[%"SCNu64"] Creating retransmission timer\n", handle->handle_id);
 		return G_SOURCE_CONTINUE;
 	} else if(pkt == &janus_ice_media_stopped) {
 		/* Some media has been disabled on the way in, so use the callback to notify the peer */
@@ -4601,29 +6192,20 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 		}
 		/* Notify the plugin about the fact this PeerConnection has just gone */
 		janus_plugin *plugin = (janus_plugin *)handle->app;
-		JANUS_LOG(LOG_VERB, "[%"SCNu64"] Telling the plugin about the hangup (%s)\n",
+		JANUS_ICE_LOG(handle, LOG_VERB, "[%"SCNu64"] Telling the plugin about the hangup (%s)\n",
 			handle->handle_id, plugin ? plugin->get_name() : "??");
 		if(plugin != NULL && handle->app_handle != NULL) {
 			plugin->hangup_media(handle->app_handle);
 		}
-		/* Get rid of the attached sources */
-		if(handle->rtcp_source) {
-			g_source_destroy(handle->rtcp_source);
-			g_source_unref(handle->rtcp_source);
-			handle->rtcp_source = NULL;
-		}
-		if(handle->twcc_source) {
-			g_source_destroy(handle->twcc_source);
-			g_source_unref(handle->twcc_source);
-			handle->twcc_source = NULL;
-		}
-		if(handle->stats_source) {
-			g_source_destroy(handle->stats_source);
-			g_source_unref(handle->stats_source);
-			handle->stats_source = NULL;
-		}
+		/* Get rid of the timers */
+		janus_timer_destroy(handle->rtcp_timer);
+		handle->rtcp_timer = NULL;
+		janus_timer_destroy(handle->twcc_timer);
+		handle->twcc_timer = NULL;
+		janus_timer_destroy(handle->stats_timer);
+		handle->stats_timer = NULL;
 		/* If event handlers are active, send stats one last time */
-		if(janus_events_is_enabled()) {
+		if(janus_events_is_interested(JANUS_EVENT_TYPE_MEDIA)) {
 			handle->last_event_stats = janus_ice_event_stats_period;
 			(void)janus_ice_outgoing_stats_handle(handle);
 		}
@@ -4632,7 +6214,7 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 	} else if(pkt == &janus_ice_detach_handle) {
 		/* This handle has just been detached, notify the plugin */
 		janus_plugin *plugin = (janus_plugin *)handle->app;
-		JANUS_LOG(LOG_VERB, "[%"SCNu64"] Telling the plugin about the handle detach (%s)\n",
+		JANUS_ICE_LOG(handle, LOG_VERB, "[%"SCNu64"] Telling the plugin about the handle detach (%s)\n",
 			handle->handle_id, plugin ? plugin->get_name() : "??");
 		if(plugin != NULL && handle->app_handle != NULL) {
 			int error = 0;
@@ -4653,10 +6235,10 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 		if(opaqueid_in_api && handle->opaque_id != NULL)
 			json_object_set_new(event, "opaque_id", json_string(handle->opaque_id));
 		/* Send the event */
-		JANUS_LOG(LOG_VERB, "[%"SCNu64"] Sending event to transport...; %p\n", handle->handle_id, handle);
+		JANUS_ICE_LOG(handle, LOG_VERB, "[%"SCNu64"] Sending event to transport...; %p\n", handle->handle_id, handle);
 		janus_session_notify_event(session, event);
 		/* Notify event handlers as well */
-		if(janus_events_is_enabled())
+		if(janus_events_is_interested(JANUS_EVENT_TYPE_HANDLE))
 			janus_events_notify_handlers(JANUS_EVENT_TYPE_HANDLE, JANUS_EVENT_SUBTYPE_NONE,
 				session->session_id, handle->handle_id, "detached",
 				plugin ? plugin->get_package() : NULL, handle->opaque_id, handle->token);
@@ -4665,7 +6247,7 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 		/* Data is writable on this PeerConnection, notify the plugin */
 		janus_plugin *plugin = (janus_plugin *)handle->app;
 		if(plugin != NULL && plugin->data_ready != NULL && handle->app_handle != NULL) {
-			JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Telling the plugin about the data channel being ready (%s)\n",
+			JANUS_ICE_LOG(handle, LOG_HUGE, "[%"SCNu64"] Telling the plugin about the data channel being ready (%s)\n",
 				handle->handle_id, plugin ? plugin->get_name() : "??");
 			plugin->data_ready(handle->app_handle);
 		}
@@ -4681,7 +6263,9 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 		janus_ice_free_queued_packet(pkt);
 		return G_SOURCE_CONTINUE;
 	}
-	gint64 age = (janus_get_monotonic_time() - pkt->added);
+	/* We reuse the time cached when dispatching, rather than sampling the clock for each packet */
+	gint64 now = janus_get_cached_monotonic_time();
+	gint64 age = (now - pkt->added);
 	if(age > G_USEC_PER_SEC) {
 		JANUS_LOG(LOG_WARN, "[%"SCNu64"] Discarding too old outgoing packet (age=%"SCNi64"us)\n", handle->handle_id, age);
 		janus_ice_free_queued_packet(pkt);
@@ -4695,12 +6279,14 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 		janus_ice_free_queued_packet(pkt);
 		return G_SOURCE_CONTINUE;
 	}
-	/* Find the right medium instance */
+	/* Find the right medium instance: we use the array rather than the
+	 * hashtable for m-line indexes, as we do this for each packet we send */
 	if(pkt->mindex != -1) {
-		medium = g_hash_table_lookup(pc->media, GINT_TO_POINTER(pkt->mindex));
+		if(pkt->mindex >= 0 && (guint)pkt->mindex < pc->media_array->len)
+			medium = g_ptr_array_index(pc->media_array, pkt->mindex);
 	} else {
 		janus_media_type mtype = janus_media_type_from_packet(pkt->type);
-		medium = g_hash_table_lookup(pc->media_bytype, GINT_TO_POINTER(mtype));
+		medium = (mtype <= JANUS_MEDIA_DATA) ? pc->media_bytype[mtype] : NULL;
 	}
 	if(medium == NULL) {
 		JANUS_LOG(LOG_ERR, "[%"SCNu64"] No medium #%d associated to this packet??\n", handle->handle_id, pkt->mindex);
@@ -4723,9 +6309,9 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 		medium->noerrorlog = FALSE;
 		if(pkt->encrypted) {
 			/* Already SRTCP */
-			int sent = nice_agent_send(handle->agent, pc->stream_id, pc->component_id, pkt->length, (const gchar *)pkt->data);
+			int sent = janus_ice_agent_send(handle, pc, pkt->length, (const gchar *)pkt->data);
 			if(sent < pkt->length) {
-				JANUS_LOG(LOG_ERR, "[%"SCNu64"] ... only sent %d bytes? (was %d)\n", handle->handle_id, sent, pkt->length);
+				JANUS_LOG_RATELIMITED(LOG_ERR, "[%"SCNu64"] ... only sent %d bytes? (was %d)\n", handle->handle_id, sent, pkt->length);
 			}
 		} else {
 			/* Check if there's anything we need to do before sending */
@@ -4733,58 +6319,48 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 				/* Fix all SSRCs before enqueueing, as we need to use the ones for this media
 				 * leg. Note that this is only needed for RTCP packets coming from plugins: the
 				 * ones created by the core already have the right SSRCs in the right place */
-				JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Fixing SSRCs (local %u, peer %u)\n", handle->handle_id,
+				JANUS_ICE_LOG(handle, LOG_HUGE, "[%"SCNu64"] Fixing SSRCs (local %u, peer %u)\n", handle->handle_id,
 					medium->ssrc, medium->ssrc_peer[0]);
 				janus_rtcp_fix_ssrc(NULL, pkt->data, pkt->length, 1,
 					medium->ssrc, medium->ssrc_peer[0]);
-				/* If this is a PLI and we're simulcasting, send a PLI on other layers as well */
+				/* If this is a PLI and we're simulcasting, send a PLI on other layers as well:
+				 * we append them to the same compound packet, using the room we left for that */
 				if(video && janus_rtcp_has_pli(pkt->data, pkt->length)) {
-					if(medium->ssrc_peer[1]) {
-						char plibuf[12];
-						memset(plibuf, 0, 12);
-						janus_rtcp_pli((char *)&plibuf, 12);
-						janus_rtcp_fix_ssrc(NULL, plibuf, sizeof(plibuf), 1,
-							medium->ssrc, medium->ssrc_peer[1]);
-						janus_plugin_rtcp rtcp = { .mindex = medium->mindex, .video = TRUE, .buffer = plibuf, .length = sizeof(plibuf) };
-						janus_ice_relay_rtcp_internal(handle, medium, &rtcp, FALSE);
-					}
-					if(medium->ssrc_peer[2]) {
-						char plibuf[12];
-						memset(plibuf, 0, 12);
-						janus_rtcp_pli((char *)&plibuf, 12);
-						janus_rtcp_fix_ssrc(NULL, plibuf, sizeof(plibuf), 1,
-							medium->ssrc, medium->ssrc_peer[2]);
-						janus_plugin_rtcp rtcp = { .mindex = medium->mindex, .video = TRUE, .buffer = plibuf, .length = sizeof(plibuf) };
-						janus_ice_relay_rtcp_internal(handle, medium, &rtcp, FALSE);
+					janus_metrics_add(JANUS_METRICS_PLIS_OUT, 1);
+					int layer = 0;
+					for(layer=1; layer<3; layer++) {
+						if(medium->ssrc_peer[layer] == 0)
+							continue;
+						char *plibuf = pkt->data + pkt->length;
+						janus_rtcp_pli(plibuf, 12);
+						janus_rtcp_fix_ssrc(NULL, plibuf, 12, 1,
+							medium->ssrc, medium->ssrc_peer[layer]);
+						pkt->length += 12;
 					}
 				}
 			}
 			uint32_t bitrate = janus_rtcp_get_remb(pkt->data, pkt->length);
 			if(bitrate > 0) {
-				/* There's a REMB, prepend a RR as it won't work otherwise */
+				/* There's a REMB, prepend a RR as it won't work otherwise: we have
+				 * room at the end of the buffer, so we just move the REMB forward */
 				int rrlen = 8;
-				char *rtcpbuf = g_malloc0(rrlen+pkt->length+SRTP_MAX_TAG_LEN+4);
-				rtcp_rr *rr = (rtcp_rr *)rtcpbuf;
+				memmove(pkt->data+rrlen, pkt->data, pkt->length);
+				memset(pkt->data, 0, rrlen);
+				rtcp_rr *rr = (rtcp_rr *)pkt->data;
 				rr->header.version = 2;
 				rr->header.type = RTCP_RR;
 				rr->header.rc = 0;
 				rr->header.length = htons((rrlen/4)-1);
-				/* Append REMB */
-				memcpy(rtcpbuf+rrlen, pkt->data, pkt->length);
 				/* If we're simulcasting, set the extra SSRCs (the first one will be set by janus_rtcp_fix_ssrc) */
 				if(medium->ssrc_peer[1] && pkt->length >= 28) {
-					rtcp_fb *rtcpfb = (rtcp_fb *)(rtcpbuf+rrlen);
+					rtcp_fb *rtcpfb = (rtcp_fb *)(pkt->data+rrlen);
 					rtcp_remb *remb = (rtcp_remb *)rtcpfb->fci;
 					remb->ssrc[1] = htonl(medium->ssrc_peer[1]);
 					if(medium->ssrc_peer[2] && pkt->length >= 32) {
 						remb->ssrc[2] = htonl(medium->ssrc_peer[2]);
 					}
 				}
-				/* Free old packet and update */
-				char *prev_data = pkt->data;
-				pkt->data = rtcpbuf;
 				pkt->length = rrlen+pkt->length;
-				g_clear_pointer(&prev_data, g_free);
 			}
 			/* Do we need to dump this packet for debugging? */
 			if(g_atomic_int_get(&handle->dump_packets))
@@ -4792,19 +6368,22 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 					"[session=%"SCNu64"][handle=%"SCNu64"]", session->session_id, handle->handle_id);
 			/* Encrypt SRTCP */
 			int protected = pkt->length;
+			JANUS_PROBE3(srtcp_protect_start, handle->handle_id, video, pkt->length);
 			int res = janus_is_webrtc_encryption_enabled() ?
 				srtp_protect_rtcp(pc->dtls->srtp_out, pkt->data, &protected) : srtp_err_status_ok;
+			JANUS_PROBE2(srtcp_protect_done, handle->handle_id, res);
 			if(res != srtp_err_status_ok) {
 				/* We don't spam the logs for every SRTP error: just take note of this, and print a summary later */
 				handle->srtp_errors_count++;
+				janus_metrics_add(JANUS_METRICS_SRTP_ERRORS_OUT, 1);
 				handle->last_srtp_error = res;
 				/* If we're debugging, though, print every occurrence */
-				JANUS_LOG(LOG_DBG, "[%"SCNu64"] ... SRTCP protect error... %s (len=%d-->%d)...\n", handle->handle_id, janus_srtp_error_str(res), pkt->length, protected);
+				JANUS_ICE_LOG(handle, LOG_DBG, "[%"SCNu64"] ... SRTCP protect error... %s (len=%d-->%d)...\n", handle->handle_id, janus_srtp_error_str(res), pkt->length, protected);
 			} else {
 				/* Shoot! */
-				int sent = nice_agent_send(handle->agent, pc->stream_id, pc->component_id, protected, pkt->data);
+				int sent = janus_ice_agent_send(handle, pc, protected, pkt->data);
 				if(sent < protected) {
-					JANUS_LOG(LOG_ERR, "[%"SCNu64"] ... only sent %d bytes? (was %d)\n", handle->handle_id, sent, protected);
+					JANUS_LOG_RATELIMITED(LOG_ERR, "[%"SCNu64"] ... only sent %d bytes? (was %d)\n", handle->handle_id, sent, protected);
 				}
 			}
 		}
@@ -4814,6 +6393,7 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 		if(pkt->type == JANUS_ICE_PACKET_AUDIO || pkt->type == JANUS_ICE_PACKET_VIDEO) {
 			/* RTP */
 			int video = (pkt->type == JANUS_ICE_PACKET_VIDEO);
+			JANUS_PROBE3(packet_dequeue, handle->handle_id, video, janus_get_cached_monotonic_time() - pkt->added);
 			if(!medium->send) {
 				janus_ice_free_queued_packet(pkt);
 				return G_SOURCE_CONTINUE;
@@ -4831,10 +6411,10 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 			if(pkt->encrypted) {
 				/* Already RTP (probably a retransmission?) */
 				janus_rtp_header *header = (janus_rtp_header *)pkt->data;
-				JANUS_LOG(LOG_HUGE, "[%"SCNu64"] ... Retransmitting seq.nr %"SCNu16"\n\n", handle->handle_id, ntohs(header->seq_number));
-				int sent = nice_agent_send(handle->agent, pc->stream_id, pc->component_id, pkt->length, (const gchar *)pkt->data);
+				JANUS_ICE_LOG(handle, LOG_HUGE, "[%"SCNu64"] ... Retransmitting seq.nr %"SCNu16"\n\n", handle->handle_id, ntohs(header->seq_number));
+				int sent = janus_ice_agent_send(handle, pc, pkt->length, (const gchar *)pkt->data);
 				if(sent < pkt->length) {
-					JANUS_LOG(LOG_ERR, "[%"SCNu64"] ... only sent %d bytes? (was %d)\n", handle->handle_id, sent, pkt->length);
+					JANUS_LOG_RATELIMITED(LOG_ERR, "[%"SCNu64"] ... only sent %d bytes? (was %d)\n", handle->handle_id, sent, pkt->length);
 				}
 			} else {
 				/* Prune/update/set RTP extensions */
@@ -4849,9 +6429,9 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 				if(medium->payload_type < 0) {
 					medium->payload_type = header->type;
 					if(janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RFC4588_RTX) &&
-							medium->rtx_payload_types && g_hash_table_size(medium->rtx_payload_types) > 0) {
-						medium->rtx_payload_type = GPOINTER_TO_INT(g_hash_table_lookup(medium->rtx_payload_types, GINT_TO_POINTER(medium->payload_type)));
-						JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Retransmissions will have payload type %d\n",
+							medium->rtx_payload_types.count > 0) {
+						medium->rtx_payload_type = janus_ice_pt_map_lookup(&medium->rtx_payload_types, medium->payload_type);
+						JANUS_ICE_LOG(handle, LOG_HUGE, "[%"SCNu64"] Retransmissions will have payload type %d\n",
 							handle->handle_id, medium->rtx_payload_type);
 					}
 					if(medium->codec == NULL) {
@@ -4884,17 +6464,17 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 					int plen = 0;
 					char *payload = janus_rtp_payload(pkt->data, pkt->length, &plen);
 					if(medium->video_is_keyframe(payload, plen)) {
-						JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Keyframe sent, cleaning retransmit buffer\n", handle->handle_id);
+						JANUS_ICE_LOG(handle, LOG_HUGE, "[%"SCNu64"] Keyframe sent, cleaning retransmit buffer\n", handle->handle_id);
 						janus_cleanup_nack_buffer(0, pc, FALSE, TRUE);
 					}
 				}
 				/* Before encrypting, check if we need to copy the unencrypted payload (e.g., for rtx/90000) */
-				janus_rtp_packet *p = NULL;
+				janus_rtp_packet saved, *p = NULL;
 				if(medium->nack_queue_ms > 0 && !pkt->retransmission && pkt->type == JANUS_ICE_PACKET_VIDEO && medium->do_nacks &&
 						janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RFC4588_RTX)) {
 					/* Save the packet for retransmissions that may be needed later: start by
 					 * making room for two more bytes to store the original sequence number */
-					p = g_malloc(sizeof(janus_rtp_packet));
+					p = &saved;
 					janus_rtp_header *header = (janus_rtp_header *)pkt->data;
 					guint16 original_seq = header->seq_number;
 					p->data = g_malloc(pkt->length+2);
@@ -4904,7 +6484,7 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 					char *payload = janus_rtp_payload(pkt->data, pkt->length, &plen);
 					if(plen == 0) {
 						JANUS_LOG(LOG_WARN, "[%"SCNu64"] Discarding outgoing empty RTP packet\n", handle->handle_id);
-						janus_ice_free_rtp_packet(p);
+						g_free(p->data);
 						janus_ice_free_queued_packet(pkt);
 						return G_SOURCE_CONTINUE;
 					}
@@ -4918,36 +6498,47 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 					/* Copy the payload */
 					memcpy(p->data+hsize+2, payload, pkt->length - hsize);
 				}
+				/* If we're generating FlexFEC for this medium, add the unencrypted packet to the current group */
+				char fecbuf[JANUS_ICE_PACKET_POOL_BUFSIZE+JANUS_FEC_HEADER_SIZE];
+				int fec_len = 0;
+				if(video && medium->fec != NULL && !pkt->retransmission)
+					fec_len = janus_fec_context_protect(medium->fec, pkt->data, pkt->length, fecbuf, sizeof(fecbuf) - SRTP_MAX_TAG_LEN);
 				/* Encrypt SRTP */
 				int protected = pkt->length;
+				JANUS_PROBE3(srtp_protect_start, handle->handle_id, video, pkt->length);
 				int res = janus_is_webrtc_encryption_enabled() ?
 					srtp_protect(pc->dtls->srtp_out, pkt->data, &protected) : srtp_err_status_ok;
+				JANUS_PROBE2(srtp_protect_done, handle->handle_id, res);
 				if(res != srtp_err_status_ok) {
 					/* We don't spam the logs for every SRTP error: just take note of this, and print a summary later */
 					handle->srtp_errors_count++;
+					janus_metrics_add(JANUS_METRICS_SRTP_ERRORS_OUT, 1);
 					handle->last_srtp_error = res;
 					/* If we're debugging, though, print every occurrence */
 					janus_rtp_header *header = (janus_rtp_header *)pkt->data;
 					guint32 timestamp = ntohl(header->timestamp);
 					guint16 seq = ntohs(header->seq_number);
-					JANUS_LOG(LOG_DBG, "[%"SCNu64"] ... SRTP protect error... %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")...\n",
+					JANUS_ICE_LOG(handle, LOG_DBG, "[%"SCNu64"] ... SRTP protect error... %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")...\n",
 						handle->handle_id, janus_srtp_error_str(res), pkt->length, protected, timestamp, seq);
-					janus_ice_free_rtp_packet(p);
+					if(p != NULL)
+						g_free(p->data);
 				} else {
 					/* Shoot! */
-					int sent = nice_agent_send(handle->agent, pc->stream_id, pc->component_id, protected, pkt->data);
+					int sent = janus_ice_agent_send(handle, pc, protected, pkt->data);
 					if(sent < protected) {
-						JANUS_LOG(LOG_ERR, "[%"SCNu64"] ... only sent %d bytes? (was %d)\n", handle->handle_id, sent, protected);
+						JANUS_LOG_RATELIMITED(LOG_ERR, "[%"SCNu64"] ... only sent %d bytes? (was %d)\n", handle->handle_id, sent, protected);
 					}
 					/* Update stats */
 					if(sent > 0) {
+						/* Keep track of when this packet was sent, for bandwidth estimation */
+						if(pkt->twcc)
+							janus_bwe_context_add_sent(pc->bwe, pkt->twcc_seq, now, sent);
 						/* Update the RTCP context as well */
 						janus_rtp_header *header = (janus_rtp_header *)pkt->data;
 						guint32 timestamp = ntohl(header->timestamp);
 						medium->out_stats.info[0].packets++;
 						medium->out_stats.info[0].bytes += pkt->length;
 						/* Last second outgoing media */
-						gint64 now = janus_get_monotonic_time();
 						if(medium->out_stats.info[0].updated == 0)
 							medium->out_stats.info[0].updated = now;
 						if(now > medium->out_stats.info[0].updated &&
@@ -4957,15 +6548,19 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 							medium->out_stats.info[0].updated = now;
 						}
 						medium->out_stats.info[0].bytes_lastsec_temp += pkt->length;
-						struct timeval tv;
-						gettimeofday(&tv, NULL);
-						if(medium->last_ntp_ts == 0 || (gint32)(timestamp - medium->last_rtp_ts) > 0) {
-							medium->last_ntp_ts = (gint64)tv.tv_sec*G_USEC_PER_SEC + tv.tv_usec;
-							medium->last_rtp_ts = timestamp;
-						}
-						if(medium->first_ntp_ts[0] == 0) {
-							medium->first_ntp_ts[0] = (gint64)tv.tv_sec*G_USEC_PER_SEC + tv.tv_usec;
-							medium->first_rtp_ts[0] = timestamp;
+						/* Only query the wall clock when the RTP timestamp changes, as
+						 * packets belonging to the same frame would all get the same one */
+						if(medium->last_ntp_ts == 0 || medium->first_ntp_ts[0] == 0 ||
+								(gint32)(timestamp - medium->last_rtp_ts) > 0) {
+							gint64 ntp_ts = g_get_real_time();
+							if(medium->last_ntp_ts == 0 || (gint32)(timestamp - medium->last_rtp_ts) > 0) {
+								medium->last_ntp_ts = ntp_ts;
+								medium->last_rtp_ts = timestamp;
+							}
+							if(medium->first_ntp_ts[0] == 0) {
+								medium->first_ntp_ts[0] = ntp_ts;
+								medium->first_rtp_ts[0] = timestamp;
+							}
 						}
 						/* Update sent packets counter */
 						rtcp_context *rtcp_ctx = medium->rtcp_ctx[0];
@@ -4974,42 +6569,60 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 							if(pkt->type == JANUS_ICE_PACKET_AUDIO) {
 								/* Let's check if this is not Opus: in case we may need to change the timestamp base */
 								int pt = header->type;
-								uint32_t clock_rate = medium->clock_rates ?
-									GPOINTER_TO_UINT(g_hash_table_lookup(medium->clock_rates, GINT_TO_POINTER(pt))) : 48000;
+								uint32_t clock_rate = medium->clock_rate_by_pt[pt & 0x7F] ? medium->clock_rate_by_pt[pt & 0x7F] : 48000;
 								if(rtcp_ctx->tb != clock_rate)
 									rtcp_ctx->tb = clock_rate;
 							}
 						}
 					}
+					if(fec_len > 0) {
+						/* A FEC group was completed with this packet, send the repair packet too */
+						int fec_protected = fec_len;
+						res = janus_is_webrtc_encryption_enabled() ?
+							srtp_protect(pc->dtls->srtp_out, fecbuf, &fec_protected) : srtp_err_status_ok;
+						if(res != srtp_err_status_ok) {
+							handle->srtp_errors_count++;
+							janus_metrics_add(JANUS_METRICS_SRTP_ERRORS_OUT, 1);
+							handle->last_srtp_error = res;
+						} else {
+							janus_ice_agent_send(handle, pc, fec_protected, fecbuf);
+						}
+					}
 					if(medium->nack_queue_ms > 0 && !pkt->retransmission) {
 						/* Save the packet for retransmissions that may be needed later */
 						if(!medium->do_nacks) {
 							/* ... unless NACKs are disabled for this medium */
+							if(p != NULL)
+								g_free(p->data);
 							janus_ice_free_queued_packet(pkt);
 							return G_SOURCE_CONTINUE;
 						}
 						if(p == NULL) {
-							/* If we're not doing RFC4588, we're saving the SRTP packet as it is */
-							p = g_malloc(sizeof(janus_rtp_packet));
-							p->data = g_malloc(protected);
-							memcpy(p->data, pkt->data, protected);
+							/* If we're not doing RFC4588, we're saving the SRTP packet as it is:
+							 * since the queued packet is going away anyway, and its payload can't
+							 * be shared with other recipients (SRTP contexts are per PeerConnection),
+							 * we just take its buffer rather than copying it, unless this is
+							 * a small pooled packet (e.g., audio), as we'd waste most of it */
+							p = &saved;
+							if(!pkt->pooled || protected > JANUS_ICE_PACKET_POOL_BUFSIZE/2) {
+								p->data = janus_ice_queued_packet_steal_data(pkt);
+							} else {
+								p->data = g_malloc(protected);
+								memcpy(p->data, pkt->data, protected);
+							}
 							p->length = protected;
 							janus_plugin_rtp_extensions_reset(&p->extensions);
 						}
-						p->created = janus_get_monotonic_time();
+						p->created = now;
 						p->last_retransmit = 0;
 						p->current_backoff = 0;
-						janus_rtp_header *header = (janus_rtp_header *)pkt->data;
+						janus_rtp_header *header = (janus_rtp_header *)p->data;
 						guint16 seq = ntohs(header->seq_number);
-						if(medium->retransmit_buffer == NULL) {
-							medium->retransmit_buffer = g_queue_new();
-							medium->retransmit_seqs = g_hash_table_new(NULL, NULL);
-						}
-						g_queue_push_tail(medium->retransmit_buffer, p);
-						/* Insert in the table too, for quick lookup */
-						g_hash_table_insert(medium->retransmit_seqs, GUINT_TO_POINTER(seq), p);
-					} else {
-						janus_ice_free_rtp_packet(p);
+						janus_ice_retransmit_buffer_store(&medium->retransmit_buffer, p, seq,
+							(gint64)medium->nack_queue_ms*1000);
+						medium->retransmit_memory = medium->retransmit_buffer->memory;
+					} else if(p != NULL) {
+						g_free(p->data);
 					}
 				}
 			}
@@ -5060,26 +6673,93 @@ static gboolean janus_ice_outgoing_traffic_handle(janus_ice_handle *handle, janu
 	return G_SOURCE_CONTINUE;
 }
 
-static void janus_ice_queue_packet(janus_ice_handle *handle, janus_ice_queued_packet *pkt) {
+/* Check if a media packet can be sent right away, rather than queued: this
+ * is only the case when the plugin is relaying it from the very loop thread
+ * serving the handle (e.g., handles paired via a loop group), the handle
+ * isn't processing its own queue already, and there's nothing queued that
+ * would end up being sent after this packet. Pacing needs the loop source
+ * to drain its queue, so we never skip the queue when it's enabled */
+static gboolean janus_ice_can_send_direct(janus_ice_handle *handle, janus_ice_queued_packet *pkt) {
+	if(pacing || static_event_loops == 0 || handle->loop_group == NULL || handle->dispatching)
+		return FALSE;
+	if(pkt->type != JANUS_ICE_PACKET_AUDIO && pkt->type != JANUS_ICE_PACKET_VIDEO)
+		return FALSE;
+	if(handle->mainctx == NULL || !g_main_context_is_owner(handle->mainctx))
+		return FALSE;
+	if(handle->packet_ring != NULL && janus_ice_packet_ring_pending(handle->packet_ring))
+		return FALSE;
+	return (g_async_queue_length(handle->queued_packets) == 0);
+}
+static void janus_ice_send_direct(janus_ice_handle *handle, janus_ice_queued_packet *pkt) {
+	handle->dispatching = TRUE;
+	janus_ice_outgoing_traffic_handle(handle, pkt);
+	janus_ice_send_batch_flush(handle);
+	handle->dispatching = FALSE;
+}
+
+/* Queue a packet for the handle loop: returns TRUE if the loop needs to be woken up */
+static gboolean janus_ice_enqueue_packet(janus_ice_handle *handle, janus_ice_queued_packet *pkt) {
 	/* TODO: There is a potential race condition where the "queued_packets"
 	 * could get released between the condition and pushing the packet. */
-	if(handle->queued_packets != NULL) {
-		g_async_queue_push(handle->queued_packets, pkt);
-		g_main_context_wakeup(handle->mainctx);
-	} else {
+	if(handle->queued_packets == NULL) {
 		janus_ice_free_queued_packet(pkt);
+		return FALSE;
+	}
+	if(janus_ice_can_send_direct(handle, pkt)) {
+		/* Same loop and nothing pending, no need to queue the packet */
+		janus_ice_send_direct(handle, pkt);
+		return FALSE;
+	}
+	janus_ice_packet_ring *ring = handle->packet_ring;
+	if(ring != NULL && (pkt->type == JANUS_ICE_PACKET_AUDIO || pkt->type == JANUS_ICE_PACKET_VIDEO)) {
+		/* Media packet, use the lock-free queue */
+		if(janus_ice_packet_ring_push(ring, pkt)) {
+			/* Only wake the loop up if the queue was empty */
+			return (g_atomic_int_add(&ring->pending, 1) == 0);
+		}
+		/* The queue is full */
+		g_atomic_int_inc(&handle->queue_overflows);
+		if(!packet_queue_spill) {
+			janus_ice_free_queued_packet(pkt);
+			return FALSE;
+		}
 	}
+	g_async_queue_push(handle->queued_packets, pkt);
+	return TRUE;
 }
-
-void janus_ice_relay_rtp(janus_ice_handle *handle, janus_plugin_rtp *packet) {
-	if(!handle || !handle->pc || handle->queued_packets == NULL || packet == NULL || packet->buffer == NULL ||
-			!janus_is_rtp(packet->buffer, packet->length))
-		return;
+static void janus_ice_queue_packet(janus_ice_handle *handle, janus_ice_queued_packet *pkt) {
+	if(janus_ice_enqueue_packet(handle, pkt))
+		g_main_context_wakeup(handle->mainctx);
+}
+/* Queue many media packets for the handle loop at once: returns TRUE if the loop needs to be woken up */
+static gboolean janus_ice_enqueue_packets(janus_ice_handle *handle, janus_ice_queued_packet **pkts, guint count) {
+	if(count == 0)
+		return FALSE;
+	janus_ice_packet_ring *ring = handle->packet_ring;
+	if(ring != NULL && handle->queued_packets != NULL && !janus_ice_can_send_direct(handle, pkts[0]) &&
+			janus_ice_packet_ring_push_batch(ring, pkts, count))
+		return (g_atomic_int_add(&ring->pending, count) == 0);
+	/* No room for all of them at once, queue them one by one */
+	gboolean wakeup = FALSE;
+	guint i = 0;
+	for(i=0; i<count; i++) {
+		if(janus_ice_enqueue_packet(handle, pkts[i]))
+			wakeup = TRUE;
+	}
+	return wakeup;
+}
+
+/* Helper to prepare the queued packet for an RTP packet coming from a plugin */
+static janus_ice_queued_packet *janus_ice_rtp_queued_packet(janus_ice_handle *handle, janus_plugin_rtp *packet) {
+	if(packet == NULL || packet->buffer == NULL || !janus_is_rtp(packet->buffer, packet->length))
+		return NULL;
 	/* Queue this packet as it is (we'll prune/update/set extensions later) */
-	janus_ice_queued_packet *pkt = g_malloc(sizeof(janus_ice_queued_packet));
+	janus_ice_queued_packet *pkt = janus_ice_queued_packet_new(packet->length + SRTP_MAX_TAG_LEN);
 	pkt->mindex = packet->mindex;
-	pkt->data = g_malloc(packet->length + SRTP_MAX_TAG_LEN);
 	memcpy(pkt->data, packet->buffer, packet->length);
+	/* The plugin may have provided a different header for this recipient */
+	if(packet->header != NULL && packet->length >= 12)
+		memcpy(pkt->data, packet->header, 12);
 	pkt->length = packet->length;
 	pkt->type = packet->video ? JANUS_ICE_PACKET_VIDEO : JANUS_ICE_PACKET_AUDIO;
 	pkt->extensions = packet->extensions;
@@ -5089,43 +6769,81 @@ void janus_ice_relay_rtp(janus_ice_handle *handle, janus_plugin_rtp *packet) {
 	pkt->retransmission = FALSE;
 	pkt->label = NULL;
 	pkt->protocol = NULL;
-	pkt->added = janus_get_monotonic_time();
-	janus_ice_queue_packet(handle, pkt);
+	pkt->added = janus_get_cached_monotonic_time();
+	JANUS_PROBE3(relay_rtp, handle->handle_id, packet->video, packet->length);
+	return pkt;
 }
 
-void janus_ice_relay_rtcp_internal(janus_ice_handle *handle, janus_ice_peerconnection_medium *medium,
-		janus_plugin_rtcp *packet, gboolean filter_rtcp) {
-	if(!handle || !handle->pc || handle->queued_packets == NULL || packet == NULL || packet->buffer == NULL ||
-			!janus_is_rtcp(packet->buffer, packet->length))
+void janus_ice_relay_rtp(janus_ice_handle *handle, janus_plugin_rtp *packet) {
+	if(!handle || !handle->pc || handle->queued_packets == NULL)
 		return;
+	janus_ice_queued_packet *pkt = janus_ice_rtp_queued_packet(handle, packet);
+	if(pkt != NULL)
+		janus_ice_queue_packet(handle, pkt);
+}
+
+/* How many packets at most we prepare before queueing them, when relaying batches */
+#define JANUS_ICE_RELAY_BATCH	32
+int janus_ice_relay_rtp_batch(janus_ice_handle *handle, janus_plugin_rtp *packets, guint count) {
+	if(!handle || !handle->pc || handle->queued_packets == NULL || packets == NULL)
+		return 0;
+	janus_ice_queued_packet *pkts[JANUS_ICE_RELAY_BATCH];
+	guint i = 0, num = 0;
+	int queued = 0;
+	gboolean wakeup = FALSE;
+	for(i=0; i<count; i++) {
+		janus_ice_queued_packet *pkt = janus_ice_rtp_queued_packet(handle, &packets[i]);
+		if(pkt == NULL)
+			continue;
+		pkts[num++] = pkt;
+		queued++;
+		if(num == JANUS_ICE_RELAY_BATCH) {
+			if(janus_ice_enqueue_packets(handle, pkts, num))
+				wakeup = TRUE;
+			num = 0;
+		}
+	}
+	if(janus_ice_enqueue_packets(handle, pkts, num))
+		wakeup = TRUE;
+	/* We only wake the loop up once for the whole batch */
+	if(wakeup)
+		g_main_context_wakeup(handle->mainctx);
+	return queued;
+}
+
+/* Helper to prepare the queued packet for an RTCP message, filtering it if needed */
+static janus_ice_queued_packet *janus_ice_rtcp_queued_packet(janus_ice_handle *handle, janus_ice_peerconnection_medium *medium,
+		janus_plugin_rtcp *packet, gboolean filter_rtcp) {
+	if(packet == NULL || packet->buffer == NULL || !janus_is_rtcp(packet->buffer, packet->length))
+		return NULL;
 	/* We use this internal method to check whether we need to filter RTCP (e.g., to make
 	 * sure we don't just forward any SR/RR from peers/plugins, but use our own) or it has
 	 * already been done, and so this is actually a packet added by the ICE send thread */
-	char *rtcp_buf = packet->buffer;
-	int rtcp_len = packet->length;
 	gboolean has_medium = (medium != NULL);
+	/* We copy the packet once, and do all the rewriting in the copy itself: we
+	 * leave some room at the end, for messages we may have to add when sending */
+	janus_ice_queued_packet *pkt = janus_ice_queued_packet_new(packet->length+JANUS_ICE_RTCP_HEADROOM+SRTP_MAX_TAG_LEN+4);
+	memcpy(pkt->data, packet->buffer, packet->length);
+	int rtcp_len = packet->length;
 	if(filter_rtcp) {
 		/* Strip RR/SR/SDES/NACKs/etc. */
-		rtcp_buf = janus_rtcp_filter(packet->buffer, packet->length, &rtcp_len);
-		if(rtcp_buf == NULL || rtcp_len < 1) {
-			g_free(rtcp_buf);
-			return;
+		rtcp_len = janus_rtcp_filter_inplace(pkt->data, rtcp_len);
+		if(rtcp_len < 1) {
+			janus_ice_free_queued_packet(pkt);
+			return NULL;
 		}
 		if(has_medium) {
 			/* Fix all SSRCs before enqueueing, as we need to use the ones for this media
 			* leg. Note that this is only needed for RTCP packets coming from plugins: the
 			* ones created by the core already have the right SSRCs in the right place */
-			JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Fixing SSRCs (local %u, peer %u)\n", handle->handle_id,
+			JANUS_ICE_LOG(handle, LOG_HUGE, "[%"SCNu64"] Fixing SSRCs (local %u, peer %u)\n", handle->handle_id,
 				medium->ssrc, medium->ssrc_peer[0]);
-			janus_rtcp_fix_ssrc(NULL, rtcp_buf, rtcp_len, 1,
+			janus_rtcp_fix_ssrc(NULL, pkt->data, rtcp_len, 1,
 				medium->ssrc, medium->ssrc_peer[0]);
 		}
 	}
 	/* Queue this packet */
-	janus_ice_queued_packet *pkt = g_malloc(sizeof(janus_ice_queued_packet));
 	pkt->mindex = (has_medium) ? medium->mindex : packet->mindex;
-	pkt->data = g_malloc(rtcp_len+SRTP_MAX_TAG_LEN+4);
-	memcpy(pkt->data, rtcp_buf, rtcp_len);
 	pkt->length = rtcp_len;
 	pkt->type = packet->video ? JANUS_ICE_PACKET_VIDEO : JANUS_ICE_PACKET_AUDIO;
 	memset(&pkt->extensions, 0, sizeof(pkt->extensions));
@@ -5135,18 +6853,82 @@ void janus_ice_relay_rtcp_internal(janus_ice_handle *handle, janus_ice_peerconne
 	pkt->retransmission = FALSE;
 	pkt->label = NULL;
 	pkt->protocol = NULL;
-	pkt->added = janus_get_monotonic_time();
-	janus_ice_queue_packet(handle, pkt);
-	if(rtcp_buf != packet->buffer) {
-		/* We filtered the original packet, deallocate it */
-		g_free(rtcp_buf);
+	pkt->added = janus_get_cached_monotonic_time();
+	return pkt;
+}
+
+/* Helper to allocate a queued packet to assemble a compound RTCP packet in */
+static janus_ice_queued_packet *janus_ice_rtcp_compound_new(janus_ice_peerconnection_medium *medium, janus_rtcp_compound *compound) {
+	janus_ice_queued_packet *pkt = janus_ice_queued_packet_new(JANUS_ICE_RTCP_COMPOUND_SIZE+JANUS_ICE_RTCP_HEADROOM+SRTP_MAX_TAG_LEN+4);
+	pkt->mindex = medium->mindex;
+	pkt->length = 0;
+	pkt->type = (medium->type == JANUS_MEDIA_VIDEO) ? JANUS_ICE_PACKET_VIDEO : JANUS_ICE_PACKET_AUDIO;
+	memset(&pkt->extensions, 0, sizeof(pkt->extensions));
+	pkt->control = TRUE;
+	pkt->control_ext = FALSE;
+	pkt->encrypted = FALSE;
+	pkt->retransmission = FALSE;
+	pkt->label = NULL;
+	pkt->protocol = NULL;
+	pkt->added = janus_get_cached_monotonic_time();
+	janus_rtcp_compound_init(compound, pkt->data, JANUS_ICE_RTCP_COMPOUND_SIZE);
+	return pkt;
+}
+
+/* Helper to enqueue a compound RTCP packet we assembled, if there's anything in it */
+static void janus_ice_rtcp_compound_flush(janus_ice_handle *handle, janus_ice_queued_packet **pkt, janus_rtcp_compound *compound) {
+	if(*pkt == NULL)
+		return;
+	if(compound->length > 0 && handle->queued_packets != NULL) {
+		(*pkt)->length = compound->length;
+		janus_ice_queue_packet(handle, *pkt);
+	} else {
+		janus_ice_free_queued_packet(*pkt);
 	}
+	*pkt = NULL;
+	janus_rtcp_compound_init(compound, NULL, 0);
+}
+
+void janus_ice_relay_rtcp_internal(janus_ice_handle *handle, janus_ice_peerconnection_medium *medium,
+		janus_plugin_rtcp *packet, gboolean filter_rtcp) {
+	if(!handle || !handle->pc || handle->queued_packets == NULL)
+		return;
+	janus_ice_queued_packet *pkt = janus_ice_rtcp_queued_packet(handle, medium, packet, filter_rtcp);
+	if(pkt != NULL)
+		janus_ice_queue_packet(handle, pkt);
 }
 
 void janus_ice_relay_rtcp(janus_ice_handle *handle, janus_plugin_rtcp *packet) {
 	janus_ice_relay_rtcp_internal(handle, NULL, packet, TRUE);
 }
 
+int janus_ice_relay_rtcp_batch(janus_ice_handle *handle, janus_plugin_rtcp *packets, guint count) {
+	if(!handle || !handle->pc || handle->queued_packets == NULL || packets == NULL)
+		return 0;
+	janus_ice_queued_packet *pkts[JANUS_ICE_RELAY_BATCH];
+	guint i = 0, num = 0;
+	int queued = 0;
+	gboolean wakeup = FALSE;
+	for(i=0; i<count; i++) {
+		janus_ice_queued_packet *pkt = janus_ice_rtcp_queued_packet(handle, NULL, &packets[i], TRUE);
+		if(pkt == NULL)
+			continue;
+		pkts[num++] = pkt;
+		queued++;
+		if(num == JANUS_ICE_RELAY_BATCH) {
+			if(janus_ice_enqueue_packets(handle, pkts, num))
+				wakeup = TRUE;
+			num = 0;
+		}
+	}
+	if(janus_ice_enqueue_packets(handle, pkts, num))
+		wakeup = TRUE;
+	/* We only wake the loop up once for the whole batch */
+	if(wakeup)
+		g_main_context_wakeup(handle->mainctx);
+	return queued;
+}
+
 void janus_ice_send_pli(janus_ice_handle *handle) {
 	if(handle == NULL || handle->pc == NULL)
 		return;
@@ -5178,12 +6960,76 @@ void janus_ice_send_remb(janus_ice_handle *handle, uint32_t bitrate) {
 	janus_ice_relay_rtcp(handle, &rtcp);
 }
 
+guint32 janus_ice_get_bandwidth_estimate(janus_ice_handle *handle) {
+	if(!handle || !handle->pc)
+		return 0;
+	janus_ice_peerconnection *pc = handle->pc;
+	return janus_bwe_context_get_estimate(pc->bwe);
+}
+
+/* Messages shared by many queued packets */
+struct janus_ice_shared_data {
+	char *label;
+	char *protocol;
+	gboolean binary;
+	char *data;
+	gint length;
+	janus_refcount ref;
+};
+static void janus_ice_shared_data_free(const janus_refcount *data_ref) {
+	janus_ice_shared_data *data = janus_refcount_containerof(data_ref, janus_ice_shared_data, ref);
+	g_free(data->label);
+	g_free(data->protocol);
+	g_free(data->data);
+	g_free(data);
+}
+
+janus_ice_shared_data *janus_ice_shared_data_new(janus_plugin_data *packet) {
+	if(packet == NULL || packet->buffer == NULL || packet->length < 1)
+		return NULL;
+	janus_ice_shared_data *data = g_malloc(sizeof(janus_ice_shared_data));
+	data->label = packet->label ? g_strdup(packet->label) : NULL;
+	data->protocol = packet->protocol ? g_strdup(packet->protocol) : NULL;
+	data->binary = packet->binary;
+	data->data = g_malloc(packet->length);
+	memcpy(data->data, packet->buffer, packet->length);
+	data->length = packet->length;
+	janus_refcount_init(&data->ref, janus_ice_shared_data_free);
+	return data;
+}
+
+void janus_ice_shared_data_unref(janus_ice_shared_data *data) {
+	if(data != NULL)
+		janus_refcount_decrease(&data->ref);
+}
+
 #ifdef HAVE_SCTP
+void janus_ice_relay_data_shared(janus_ice_handle *handle, janus_ice_shared_data *data) {
+	if(!handle || !handle->pc || handle->queued_packets == NULL || data == NULL)
+		return;
+	/* No copy here: the packet just references the shared message */
+	janus_ice_queued_packet *pkt = janus_ice_queued_packet_new(0);
+	janus_refcount_increase(&data->ref);
+	pkt->shared = data;
+	pkt->mindex = -1;
+	pkt->data = data->data;
+	pkt->length = data->length;
+	pkt->type = data->binary ? JANUS_ICE_PACKET_BINARY : JANUS_ICE_PACKET_TEXT;
+	memset(&pkt->extensions, 0, sizeof(pkt->extensions));
+	pkt->control = FALSE;
+	pkt->control_ext = FALSE;
+	pkt->encrypted = FALSE;
+	pkt->retransmission = FALSE;
+	pkt->label = data->label;
+	pkt->protocol = data->protocol;
+	pkt->added = janus_get_cached_monotonic_time();
+	janus_ice_queue_packet(handle, pkt);
+}
+
 void janus_ice_relay_data(janus_ice_handle *handle, janus_plugin_data *packet) {
 	if(!handle || !handle->pc || handle->queued_packets == NULL || packet == NULL || packet->buffer == NULL || packet->length < 1)
 		return;
-	janus_ice_queued_packet *pkt = g_malloc(sizeof(janus_ice_queued_packet));
-	pkt->data = g_malloc(packet->length);
+	janus_ice_queued_packet *pkt = janus_ice_queued_packet_new(packet->length);
 	pkt->mindex = -1;
 	memcpy(pkt->data, packet->buffer, packet->length);
 	pkt->length = packet->length;
@@ -5195,7 +7041,7 @@ void janus_ice_relay_data(janus_ice_handle *handle, janus_plugin_data *packet) {
 	pkt->retransmission = FALSE;
 	pkt->label = packet->label ? g_strdup(packet->label) : NULL;
 	pkt->protocol = packet->protocol ? g_strdup(packet->protocol) : NULL;
-	pkt->added = janus_get_monotonic_time();
+	pkt->added = janus_get_cached_monotonic_time();
 	janus_ice_queue_packet(handle, pkt);
 }
 #endif
@@ -5205,13 +7051,11 @@ void janus_ice_relay_sctp(janus_ice_handle *handle, char *buffer, int length) {
 	if(!handle || !handle->pc || handle->queued_packets == NULL || buffer == NULL || length < 1)
 		return;
 	/* Find the right medium instance */
-	janus_ice_peerconnection_medium *medium = g_hash_table_lookup(handle->pc->media_bytype,
-		GINT_TO_POINTER(JANUS_MEDIA_DATA));
+	janus_ice_peerconnection_medium *medium = handle->pc->media_bytype[JANUS_MEDIA_DATA];
 	if(!medium)	/* Queue this packet */
 		return;
 	/* Queue this packet */
-	janus_ice_queued_packet *pkt = g_malloc(sizeof(janus_ice_queued_packet));
-	pkt->data = g_malloc(length);
+	janus_ice_queued_packet *pkt = janus_ice_queued_packet_new(length);
 	pkt->mindex = medium->mindex;
 	memcpy(pkt->data, buffer, length);
 	pkt->length = length;
@@ -5223,7 +7067,7 @@ void janus_ice_relay_sctp(janus_ice_handle *handle, char *buffer, int length) {
 	pkt->retransmission = FALSE;
 	pkt->label = NULL;
 	pkt->protocol = NULL;
-	pkt->added = janus_get_monotonic_time();
+	pkt->added = janus_get_cached_monotonic_time();
 	janus_ice_queue_packet(handle, pkt);
 #endif
 }
@@ -5267,24 +7111,15 @@ void janus_ice_dtls_handshake_done(janus_ice_handle *handle) {
 		return;
 	}
 	janus_flags_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_READY);
-	/* Create a source for RTCP and one for stats */
-	handle->rtcp_source = g_timeout_source_new_seconds(1);
-	g_source_set_priority(handle->rtcp_source, G_PRIORITY_DEFAULT);
-	g_source_set_callback(handle->rtcp_source, janus_ice_outgoing_rtcp_handle, handle, NULL);
-	g_source_attach(handle->rtcp_source, handle->mainctx);
+	/* Create a timer for RTCP and one for stats */
+	handle->rtcp_timer = janus_timer_add(handle->timers, 1000, janus_ice_outgoing_rtcp_handle, handle, NULL);
 	if(twcc_period != 1000) {
-		/* The Transport Wide CC feedback period is different, create another source */
-		handle->twcc_source = g_timeout_source_new(twcc_period);
-		g_source_set_priority(handle->twcc_source, G_PRIORITY_DEFAULT);
-		g_source_set_callback(handle->twcc_source, janus_ice_outgoing_transport_wide_cc_feedback, handle, NULL);
-		g_source_attach(handle->twcc_source, handle->mainctx);
+		/* The Transport Wide CC feedback period is different, create another timer */
+		handle->twcc_timer = janus_timer_add(handle->timers, twcc_period, janus_ice_outgoing_transport_wide_cc_feedback, handle, NULL);
 	}
 	handle->last_event_stats = 0;
 	handle->last_srtp_summary = -1;
-	handle->stats_source = g_timeout_source_new_seconds(1);
-	g_source_set_callback(handle->stats_source, janus_ice_outgoing_stats_handle, handle, NULL);
-	g_source_set_priority(handle->stats_source, G_PRIORITY_DEFAULT);
-	g_source_attach(handle->stats_source, handle->mainctx);
+	handle->stats_timer = janus_timer_add(handle->timers, 1000, janus_ice_outgoing_stats_handle, handle, NULL);
 	janus_mutex_unlock(&handle->mutex);
 	JANUS_LOG(LOG_INFO, "[%"SCNu64"] The DTLS handshake has been completed\n", handle->handle_id);
 	/* Notify the plugin that the WebRTC PeerConnection is ready to be used */
@@ -5308,7 +7143,7 @@ void janus_ice_dtls_handshake_done(janus_ice_handle *handle) {
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Sending event to transport...; %p\n", handle->handle_id, handle);
 	janus_session_notify_event(session, event);
 	/* Notify event handlers as well */
-	if(janus_events_is_enabled()) {
+	if(janus_events_is_interested(JANUS_EVENT_TYPE_WEBRTC)) {
 		json_t *info = json_object();
 		json_object_set_new(info, "connection", json_string("webrtcup"));
 		janus_events_notify_handlers(JANUS_EVENT_TYPE_WEBRTC, JANUS_EVENT_SUBTYPE_WEBRTC_STATE,
@@ -28,10 +28,13 @@
 #include "dtls.h"
 #include "sctp.h"
 #include "rtcp.h"
+#include "bwe.h"
+#include "fec.h"
 #include "text2pcap.h"
 #include "utils.h"
 #include "ip-utils.h"
 #include "refcount.h"
+#include "timer-wheel.h"
 #include "plugins/plugin.h"
 
 
@@ -130,6 +133,18 @@ gboolean janus_ice_is_ice_lite_enabled(void);
 /*! \brief Method to check whether ICE-TCP support is enabled/supported or not (still WIP)
  * @returns true if ICE-TCP support is enabled/supported, false otherwise */
 gboolean janus_ice_is_ice_tcp_enabled(void);
+/*! \brief Method to have all PeerConnections share the same UDP sockets, rather
+ * than having libnice bind new ones for each of them (only available in ICE Lite mode)
+ * \note This must be called after the enforce/ignore lists have been set,
+ * as the local addresses the shared sockets are bound to are chosen here
+ * @param[in] port The port to bind the shared sockets to, on each local address
+ * @param[in] sockets How many SO_REUSEPORT sockets (and threads) to create for each address
+ * @param[in] offload Whether UDP receive (GRO) and segmentation (GSO) offload should be used, if available
+ * @returns 0 in case of success, a negative integer on errors */
+int janus_ice_set_mux(uint16_t port, int sockets, gboolean offload);
+/*! \brief Method to check whether PeerConnections share the same UDP sockets (see above)
+ * @returns true if the shared sockets are used, false otherwise */
+gboolean janus_ice_is_mux_enabled(void);
 /*! \brief Method to check whether full-trickle support is enabled or not
  * @returns true if full-trickle support is enabled, false otherwise */
 gboolean janus_ice_is_full_trickle_enabled(void);
@@ -214,6 +229,55 @@ void janus_set_dscp(int dscp);
 /*! \brief Method to get the current DSCP value (see above)
  * @returns The current DSCP value (0 if disabled) */
 int janus_get_dscp(void);
+/*! \brief Method to modify the size of the pool of outgoing packets (i.e., how many
+ * packets per shard Janus keeps preallocated, to avoid allocations when relaying media)
+ * @param[in] size The new pool size (0 to disable the pool) */
+void janus_ice_set_packet_pool_size(uint size);
+/*! \brief Method to get the current size of the pool of outgoing packets (see above)
+ * @returns The current pool size (0 if disabled) */
+uint janus_ice_get_packet_pool_size(void);
+/*! \brief Method to configure batched sending of outgoing packets, where packets that
+ * queue up in a PeerConnection loop are sent to libnice in a single call (disabled by default)
+ * @param[in] size The maximum number of packets per batch (0 or 1 to disable batching) */
+void janus_ice_set_send_batch_size(uint size);
+/*! \brief Method to get the current maximum size of batches of outgoing packets (see above)
+ * @returns The current batch size (0 if disabled) */
+uint janus_ice_get_send_batch_size(void);
+/*! \brief Method to configure pacing of outgoing video packets, where rather than sending
+ * bursts (e.g., keyframes) back-to-back packets are spread over time according to a token
+ * bucket driven by the estimated bitrate towards the peer (disabled by default)
+ * @param[in] enabled Whether pacing should be enabled
+ * @param[in] burst The burst budget, i.e., how many milliseconds of media at the pacing rate can be sent back-to-back (0 for the default, 40ms) */
+void janus_ice_set_pacing(gboolean enabled, uint burst);
+/*! \brief Method to check whether pacing of outgoing video packets is enabled (see above)
+ * @returns TRUE if pacing is enabled, FALSE otherwise */
+gboolean janus_ice_is_pacing_enabled(void);
+/*! \brief Method to get the current burst budget for the pacing of outgoing video packets (see above)
+ * @returns The burst budget, in milliseconds */
+uint janus_ice_get_pacing_burst(void);
+/*! \brief Method to configure the generation of FlexFEC for outgoing video, where
+ * repair packets are sent on a separate SSRC to peers that negotiated it, when the
+ * loss they report is high enough and the RTT too large for NACKs to be effective (disabled by default)
+ * @param[in] enabled Whether FlexFEC should be offered and generated when needed
+ * @param[in] rtt_threshold The RTT (in ms) above which FEC is preferred to retransmissions alone (0 for the default, 100ms) */
+void janus_ice_set_flexfec(gboolean enabled, uint rtt_threshold);
+/*! \brief Method to check whether the generation of FlexFEC for outgoing video is enabled (see above)
+ * @returns TRUE if FlexFEC is enabled, FALSE otherwise */
+gboolean janus_ice_is_flexfec_enabled(void);
+/*! \brief Method to get the RTT threshold above which FEC is preferred to retransmissions alone (see above)
+ * @returns The RTT threshold, in milliseconds */
+uint janus_ice_get_flexfec_rtt_threshold(void);
+/*! \brief Method to configure the lock-free queues plugins use to relay media packets to
+ * PeerConnections, rather than the mutex-based queue used for everything else
+ * @param[in] size The size of the queue in packets, rounded to a power of two (0 to disable the lock-free queues)
+ * @param[in] overflow What to do with packets when a queue is full ("drop", the default, or "spill" to the mutex-based queue) */
+void janus_ice_set_packet_queue(uint size, const char *overflow);
+/*! \brief Method to get the current size of the lock-free packet queues (see above)
+ * @returns The current queue size (0 if disabled) */
+uint janus_ice_get_packet_queue_size(void);
+/*! \brief Method to get the current overflow policy of the lock-free packet queues (see above)
+ * @returns The current overflow policy */
+const char *janus_ice_get_packet_queue_overflow(void);
 /*! \brief Method to modify the event handler statistics period (i.e., the number of seconds that should pass before Janus notifies event handlers about media statistics for a PeerConnection)
  * @param[in] period The new period value, in seconds */
 void janus_ice_set_event_stats_period(int period);
@@ -230,6 +294,31 @@ void janus_ice_event_set_combine_media_stats(gboolean combine_media_stats_to_one
 /*! \brief Method to retrieve whether media statistic events shall be dispatched combined or in single events
  * @returns true to combine events */
 gboolean janus_ice_event_get_combine_media_stats(void);
+/*! \brief Method to only send media stats for a handle to event handlers once every N stats periods
+ * @param[in] sampling How many stats periods should pass between events for the same handle (1 means all of them) */
+void janus_ice_event_set_stats_sampling(int sampling);
+/*! \brief Method to retrieve how media stats events are sampled (see above)
+ * @returns The current sampling rate */
+int janus_ice_event_get_stats_sampling(void);
+/*! \brief Method to define whether media stats shall only be sent for streams with new packet losses
+ * @param[in] lossy_only TRUE to only send stats for streams that lost packets since the last event, FALSE to send them for all */
+void janus_ice_event_set_stats_lossy_only(gboolean lossy_only);
+/*! \brief Method to retrieve whether media stats are only sent for streams with new packet losses
+ * @returns TRUE if only lossy streams are reported */
+gboolean janus_ice_event_get_stats_lossy_only(void);
+/*! \brief Method to define whether the media stats of all handles shall be batched in a single compact event per period
+ * \note When enabled, this takes precedence over janus_ice_event_set_combine_media_stats, and
+ * janus_ice_event_flush_media_stats must be invoked once per stats period to send the batches
+ * @param[in] batch_media_stats TRUE to batch media statistics of all handles, FALSE otherwise */
+void janus_ice_event_set_batch_media_stats(gboolean batch_media_stats);
+/*! \brief Method to retrieve whether media statistic events shall be batched for all handles
+ * @returns TRUE if they're batched */
+gboolean janus_ice_event_get_batch_media_stats(void);
+/*! \brief Method to send the media statistics batched so far to event handlers, as a single event
+ * \note This is a GSourceFunc, so that it can be invoked from a timer
+ * @param[in] user_data Unused
+ * @returns Always G_SOURCE_CONTINUE */
+gboolean janus_ice_event_flush_media_stats(gpointer user_data);
 
 /*! \brief Method to check whether libnice debugging has been enabled (http://nice.freedesktop.org/libnice/libnice-Debug-messages.html)
  * @returns True if libnice debugging is enabled, FALSE otherwise */
@@ -260,6 +349,13 @@ typedef struct janus_ice_peerconnection_medium janus_ice_peerconnection_medium;
 /*! \brief Helper to handle pending trickle candidates (e.g., when we're still waiting for an offer) */
 typedef struct janus_ice_trickle janus_ice_trickle;
 
+/*! \brief Same as JANUS_LOG, but also taking into account the log level
+ * of the handle (and its session), which can be changed via Admin API.
+ * This is what should be used on per-packet paths involving a handle */
+#define JANUS_ICE_LOG(handle, level, format, ...) \
+	JANUS_LOG_CONTEXT(MAX(g_atomic_int_get(&(handle)->log_level), g_atomic_int_get(&(handle)->session_log_level)), \
+		(handle)->handle_id, level, format, ##__VA_ARGS__)
+
 #define JANUS_ICE_HANDLE_WEBRTC_PROCESSING_OFFER	(1 << 0)
 #define JANUS_ICE_HANDLE_WEBRTC_START				(1 << 1)
 #define JANUS_ICE_HANDLE_WEBRTC_READY				(1 << 2)
@@ -321,6 +417,9 @@ typedef struct janus_ice_stats {
 	guint sl_lost_count;
 } janus_ice_stats;
 
+/*! \brief Number of cumulative counters that batched media stats events report as deltas */
+#define JANUS_ICE_BATCH_STATS_COUNTERS	9
+
 /*! \brief Quick helper method to notify a WebRTC hangup through the Janus API
  * @param handle The janus_ice_handle instance this event refers to
  * @param reason A description of why this happened */
@@ -333,15 +432,27 @@ void janus_ice_notify_hangup(janus_ice_handle *handle, const char *reason);
 gboolean janus_plugin_session_is_alive(janus_plugin_session *plugin_session);
 
 
-/*! \brief A helper struct for determining when to send NACKs */
-typedef struct janus_seq_info {
-	gint64 ts;
-	guint16 seq;
-	guint16 state;
-	struct janus_seq_info *next;
-	struct janus_seq_info *prev;
-} janus_seq_info;
-void janus_seq_list_free(janus_seq_info **head);
+/*! \brief Size of the window of recently received sequence numbers (must be a power of two) */
+#define JANUS_SEQ_WINDOW_SIZE 256
+/*! \brief A sliding window of recently received sequence numbers, for determining when to send NACKs
+ * \note Sequence numbers are indexed by \c seq & (JANUS_SEQ_WINDOW_SIZE-1): a bitmap
+ * keeps track of the ones that are missing, so that looking for NACKs to send only
+ * means looking at the bits that are set, and there's no allocation per packet */
+typedef struct janus_seq_window {
+	/*! \brief Whether we received any packet yet */
+	gboolean started;
+	/*! \brief Highest sequence number received so far */
+	guint16 last;
+	/*! \brief Bitmap of the missing sequence numbers in the window */
+	guint64 missing[JANUS_SEQ_WINDOW_SIZE/64];
+	/*! \brief Time each missing sequence number was detected at */
+	gint64 ts[JANUS_SEQ_WINDOW_SIZE];
+	/*! \brief State of each missing sequence number */
+	guint8 state[JANUS_SEQ_WINDOW_SIZE];
+} janus_seq_window;
+/*! \brief Helper method to reset a window of sequence numbers, e.g., after a keyframe or an SSRC change
+ * @param[in] window The janus_seq_window instance to reset */
+void janus_seq_window_reset(janus_seq_window *window);
 enum {
 	SEQ_MISSING,
 	SEQ_NACKED,
@@ -349,6 +460,43 @@ enum {
 	SEQ_RECVED
 };
 
+/*! \brief How many mappings a janus_ice_pt_map can keep inline */
+#define JANUS_ICE_PT_MAP_INLINE	8
+/*! \brief Compact mapping of RTP payload types to values (e.g., rtx payload types or clock rates)
+ * \note A PeerConnection typically negotiates a handful of payload types, so rather
+ * than allocating a hash table for each mapping, the first mappings are kept in an
+ * inline array that is scanned on lookups; only when there are more than that the
+ * mappings are moved to an array indexed by payload type, allocated on demand.
+ * A value of 0 means there's no mapping, and only payload types up to 127 are valid */
+typedef struct janus_ice_pt_map {
+	/*! \brief Number of mappings */
+	guint8 count;
+	/*! \brief Payload types of the inline mappings */
+	guint8 pts[JANUS_ICE_PT_MAP_INLINE];
+	/*! \brief Values of the inline mappings */
+	guint32 values[JANUS_ICE_PT_MAP_INLINE];
+	/*! \brief Values indexed by payload type, when there are too many mappings to keep them inline */
+	guint32 *by_pt;
+} janus_ice_pt_map;
+/*! \brief Get the value a payload type is mapped to
+ * @param[in] map The janus_ice_pt_map instance to look into
+ * @param[in] pt The payload type to look for
+ * @returns The mapped value, or 0 if there's no mapping */
+guint32 janus_ice_pt_map_lookup(const janus_ice_pt_map *map, int pt);
+/*! \brief Map a payload type to a value, or remove the mapping
+ * @param[in] map The janus_ice_pt_map instance to update
+ * @param[in] pt The payload type to map
+ * @param[in] value The value to map the payload type to, or 0 to remove the mapping */
+void janus_ice_pt_map_insert(janus_ice_pt_map *map, int pt, guint32 value);
+/*! \brief Check whether any payload type is mapped to the provided value
+ * @param[in] map The janus_ice_pt_map instance to look into
+ * @param[in] value The value to look for
+ * @returns TRUE if there's at least a payload type mapped to the value, FALSE otherwise */
+gboolean janus_ice_pt_map_contains_value(const janus_ice_pt_map *map, guint32 value);
+/*! \brief Remove all mappings, and free the resources allocated for them, if any
+ * @param[in] map The janus_ice_pt_map instance to clear */
+void janus_ice_pt_map_clear(janus_ice_pt_map *map);
+
 
 /*! \brief Janus ICE handle */
 struct janus_ice_handle {
@@ -360,6 +508,8 @@ struct janus_ice_handle {
 	char *opaque_id;
 	/*! \brief Token that was used to attach the handle, if required */
 	char *token;
+	/*! \brief If this handle was restored from a sessions snapshot, what the plugin said about it in the previous process, until the client is notified */
+	json_t *restored;
 	/*! \brief Monotonic time of when the handle has been created */
 	gint64 created;
 	/*! \brief Opaque application (plugin) pointer */
@@ -376,10 +526,18 @@ struct janus_ice_handle {
 	GMainLoop *mainloop;
 	/*! \brief In case static event loops are used, opaque pointer to the loop */
 	void *static_event_loop;
+	/*! \brief In case static event loops are used, the group of handles sharing the same loop this handle belongs to, if any */
+	gchar *loop_group;
+	/*! \brief Whether the loop is currently processing outgoing packets for this handle (only used by the loop thread) */
+	gboolean dispatching;
 	/*! \brief GLib thread for the handle and libnice */
 	GThread *thread;
-	/*! \brief GLib sources for outgoing traffic, recurring RTCP, and stats (and optionally TWCC) */
-	GSource *rtp_source, *rtcp_source, *stats_source, *twcc_source;
+	/*! \brief GLib source for outgoing traffic */
+	GSource *rtp_source;
+	/*! \brief Timer wheel for the handle loop (shared with other handles, in case static event loops are used) */
+	janus_timer_wheel *timers;
+	/*! \brief Timers for recurring RTCP, and stats (and optionally TWCC) */
+	janus_timer *rtcp_timer, *stats_timer, *twcc_timer;
 	/*! \brief libnice ICE agent */
 	NiceAgent *agent;
 	/*! \brief Monotonic time of when the ICE agent has been created */
@@ -406,16 +564,36 @@ struct janus_ice_handle {
 	GList *pending_trickles;
 	/*! \brief Queue of remote candidates that still need to be processed */
 	GAsyncQueue *queued_candidates;
+	/*! \brief Whether adding the queued remote candidates has been scheduled already */
+	volatile gint candidates_scheduled;
 	/*! \brief Queue of events in the loop and outgoing packets to send */
 	GAsyncQueue *queued_packets;
+	/*! \brief Lock-free queue of outgoing media packets, if enabled */
+	struct janus_ice_packet_ring *packet_ring;
+	/*! \brief Number of media packets that didn't fit in the lock-free queue */
+	volatile gint queue_overflows;
+	/*! \brief In case batched sending is enabled, the packets waiting to be sent in a single call */
+	struct janus_ice_send_batch *send_batch;
+	/*! \brief Number of batches sent so far, and how many packets they contained overall */
+	guint64 send_batches, send_batched_packets;
+	/*! \brief In case the ICE mux is enabled, the incoming packets waiting to be processed in the loop */
+	GAsyncQueue *mux_incoming;
+	/*! \brief In case pacing is enabled, the video packets waiting to be sent and the related token bucket */
+	struct janus_ice_pacer *pacer;
 	/*! \brief Count of the recent SRTP replay errors, in order to avoid spamming the logs */
 	guint srtp_errors_count;
 	/*! \brief Count of the recent SRTP replay errors, in order to avoid spamming the logs */
 	gint last_srtp_error, last_srtp_summary;
 	/*! \brief Count of how many seconds passed since the last stats passed to event handlers */
 	gint last_event_stats;
+	/*! \brief Count of the stats periods elapsed for this handle, when sampling stats for event handlers */
+	guint event_stats_count;
 	/*! \brief Flag to decide whether or not packets need to be dumped to a text2pcap file */
 	volatile gint dump_packets;
+	/*! \brief Log level for this handle, if more verbose than the global one (0 means just use the global one) */
+	volatile gint log_level;
+	/*! \brief Log level of the session this handle belongs to, if more verbose than the global one */
+	volatile gint session_log_level;
 	/*! \brief In case this session must be saved to text2pcap, the instance to dump packets to */
 	janus_text2pcap *text2pcap;
 	/*! \brief Mutex to lock/unlock the ICE session */
@@ -454,14 +632,16 @@ struct janus_ice_peerconnection {
 	GSList *remote_candidates;
 	/*! \brief String representation of the selected pair as notified by libnice (foundations) */
 	gchar *selected_pair;
+	/*! \brief In case the ICE mux is enabled, the registration of this PeerConnection there */
+	struct janus_ice_mux_conn *mux;
 	/*! \brief Whether the setup of remote candidates for this component has started or not */
 	gboolean process_started;
 	/*! \brief Timer to check when we should consider ICE as failed */
-	GSource *icestate_source;
+	janus_timer *icestate_timer;
 	/*! \brief Time of when we first detected an ICE failed (we'll need this for the timer above) */
 	gint64 icefailed_detected;
 	/*! \brief Re-transmission timer for DTLS */
-	GSource *dtlsrt_source;
+	janus_timer *dtlsrt_timer;
 	/*! \brief DTLS-SRTP stack */
 	janus_dtls_srtp *dtls;
 	/*! \brief SDES mid RTP extension ID */
@@ -486,16 +666,12 @@ struct janus_ice_peerconnection {
 	gint transport_wide_cc_ext_id;
 	/*! \brief Last sent transport wide seq num */
 	guint16 transport_wide_cc_out_seq_num;
-	/*! \brief Last received transport wide seq num */
-	guint32 transport_wide_cc_last_seq_num;
-	/*! \brief Last transport wide seq num sent on feedback */
-	guint32 transport_wide_cc_last_feedback_seq_num;
-	/*! \brief Transport wide cc transport seq num wrap cycles */
-	guint16 transport_wide_cc_cycles;
 	/*! \brief Transport wide cc rtp ext ID */
 	guint transport_wide_cc_feedback_count;
-	/*! \brief GLib list of transport wide cc stats in reverse received order */
-	GSList *transport_wide_received_seq_nums;
+	/*! \brief Ring of arrival times of incoming packets, to generate transport wide cc feedback (allocated on demand) */
+	janus_rtcp_transport_wide_cc_ring *transport_wide_cc_ring;
+	/*! \brief Sender side bandwidth estimation, based on the transport wide cc feedback we receive */
+	janus_bwe_context *bwe;
 	/*! \brief Latest REMB feedback we received */
 	uint32_t remb_bitrate;
 	/*! \brief DTLS role of the server for this stream */
@@ -512,23 +688,25 @@ struct janus_ice_peerconnection {
 	gchar *rpass;
 	/*! \brief GLib hash table of media (m-line indexes are the keys) */
 	GHashTable *media;
+	/*! \brief Array of the same media, indexed by m-line index, for quick lookups when sending packets */
+	GPtrArray *media_array;
 	/*! \brief GLib hash table of media (SSRCs are the keys) */
 	GHashTable *media_byssrc;
 	/*! \brief GLib hash table of media (mids are the keys) */
 	GHashTable *media_bymid;
-	/*! \brief GLib hash table of media (media types are the keys)
-	 * @note This is just a convenience hash table to track the very first audio
-	 * or video m-line, in order to make it easier for plugins that don't do
-	 * multistream. That said, we don't plan to keep it forever */
-	GHashTable *media_bytype;
-	/*! \brief List of payload types we can expect */
-	GHashTable *payload_types;
+	/*! \brief Media indexed by type
+	 * @note This is just a convenience array to track an audio or video m-line,
+	 * in order to make it easier for plugins that don't do multistream.
+	 * That said, we don't plan to keep it forever */
+	janus_ice_peerconnection_medium *media_bytype[JANUS_MEDIA_DATA+1];
+	/*! \brief Payload types we can expect (mapped to 1) */
+	janus_ice_pt_map payload_types;
 	/*! \brief Mapping of payload types to their clock rates, as advertised in the SDP */
-	GHashTable *clock_rates;
+	janus_ice_pt_map clock_rates;
 	/*! \brief Mapping of rtx payload types to actual media-related packet types */
-	GHashTable *rtx_payload_types;
+	janus_ice_pt_map rtx_payload_types;
 	/*! \brief Reverse mapping of rtx payload types to actual media-related packet types */
-	GHashTable *rtx_payload_types_rev;
+	janus_ice_pt_map rtx_payload_types_rev;
 	/*! \brief Helper queue for storing requested packets from NACKs */
 	GQueue *nacks_queue;
 	/*! \brief Helper flag to avoid flooding the console with the same error all over again */
@@ -558,6 +736,8 @@ struct janus_ice_peerconnection_medium {
 	guint32 ssrc;
 	/*! \brief Retransmission SSRC of the server for this medium */
 	guint32 ssrc_rtx;
+	/*! \brief FlexFEC SSRC of the server for this medium, if negotiated */
+	guint32 ssrc_fec;
 	/*! \brief SSRC(s) of the peer for this medium (may be simulcasting) */
 	guint32 ssrc_peer[3], ssrc_peer_new[3], ssrc_peer_orig[3], ssrc_peer_temp;
 	/*! \brief Retransmissions SSRC(s) of the peer for this medium (may be simulcasting) */
@@ -577,11 +757,15 @@ struct janus_ice_peerconnection_medium {
 	/*! \brief opus/red payload type, if enabled */
 	int opusred_pt;
 	/*! \brief Mapping of rtx payload types to actual media-related packet types */
-	GHashTable *rtx_payload_types;
-	/*! \brief Mapping of payload types to their clock rates, as advertised in the SDP */
-	GHashTable *clock_rates;
+	janus_ice_pt_map rtx_payload_types;
+	/*! \brief Clock rates of the payload types, as advertised in the SDP, indexed by payload type (0 if unknown) */
+	guint32 clock_rate_by_pt[128];
 	/*! \brief RTP payload types for this medium */
 	gint payload_type, rtx_payload_type;
+	/*! \brief FlexFEC payload type for this medium, if negotiated (video only) */
+	gint fec_payload_type;
+	/*! \brief FlexFEC generation context, if FEC is currently needed for this medium */
+	janus_fec_context *fec;
 	/*! \brief Codec used in this medium */
 	char *codec;
 	/*! \brief Pointer to function to check if a packet is a keyframe (depends on negotiated codec; video only) */
@@ -606,10 +790,10 @@ struct janus_ice_peerconnection_medium {
 	guint32 last_rtp_ts;
 	/*! \brief Whether we should do NACKs (in or out) for this medium */
 	gboolean do_nacks;
-	/*! \brief List of previously sent janus_rtp_packet RTP packets, in case we receive NACKs */
-	GQueue *retransmit_buffer;
-	/*! \brief HashTable of retransmittable sequence numbers, in case we receive NACKs */
-	GHashTable *retransmit_seqs;
+	/*! \brief Ring of previously sent janus_rtp_packet RTP packets, indexed by sequence number, in case we receive NACKs */
+	struct janus_ice_retransmit_buffer *retransmit_buffer;
+	/*! \brief Memory the retransmit buffer uses (ring and packets), updated by the loop thread for the Admin API */
+	volatile gsize retransmit_memory;
 	/*! \brief Current sequence number for the RFC4588 rtx SSRC session */
 	guint16 rtx_seq_number;
 	/*! \brief Last time a log message about sending retransmits was printed */
@@ -620,12 +804,16 @@ struct janus_ice_peerconnection_medium {
 	gint64 nack_sent_log_ts;
 	/*! \brief Number of NACKs sent since last log message */
 	guint nack_sent_recent_cnt;
-	/*! \brief List of recently received sequence numbers (as a support to NACK generation, for each simulcast SSRC) */
-	janus_seq_info *last_seqs[3];
+	/*! \brief Windows of recently received sequence numbers (as a support to NACK generation, for each simulcast SSRC) */
+	janus_seq_window *last_seqs[3];
 	/*! \brief Stats for incoming data (audio/video/data) */
 	janus_ice_stats in_stats;
 	/*! \brief Stats for outgoing data (audio/video/data) */
 	janus_ice_stats out_stats;
+	/*! \brief Counters as of the last batched stats event, to compute the deltas (for each simulcast SSRC) */
+	gint64 batch_stats[3][JANUS_ICE_BATCH_STATS_COUNTERS];
+	/*! \brief Packets lost (by us and by the peer) as of the last stats event, when only lossy media are reported (for each simulcast SSRC) */
+	guint32 event_stats_lost[3];
 	/*! \brief Helper flag to avoid flooding the console with the same error all over again */
 	gboolean noerrorlog;
 	/*! \brief Mutex to lock/unlock this medium */
@@ -641,6 +829,11 @@ struct janus_ice_peerconnection_medium {
  * @param[in] type The medium type
  * @returns A pointer to the new medium, if successful, or NULL otherwise */
 janus_ice_peerconnection_medium *janus_ice_peerconnection_medium_create(janus_ice_handle *handle, janus_media_type type);
+/*! \brief Method to update the clock rate associated to a payload type in a medium
+ * @param[in] medium The janus_ice_peerconnection_medium instance to update
+ * @param[in] pt The payload type to update
+ * @param[in] clock_rate The clock rate for the payload type, or 0 to remove the mapping */
+void janus_ice_peerconnection_medium_set_clock_rate(janus_ice_peerconnection_medium *medium, int pt, uint32_t clock_rate);
 
 /*! \brief Helper to handle pending trickle candidates (e.g., when we're still waiting for an offer) */
 struct janus_ice_trickle {
@@ -683,6 +876,15 @@ void janus_ice_trickle_destroy(janus_ice_trickle *trickle);
  * @param[in] token The auth token provided by the creator, if any (optional)
  * @returns The created Janus ICE handle if successful, NULL otherwise */
 janus_ice_handle *janus_ice_handle_create(void *core_session, const char *opaque_id, const char *token);
+/*! \brief Method to create a new Janus ICE handle with a specific identifier
+ * \note This is used when restoring sessions from a snapshot, in order to
+ * preserve the identifiers clients already know about
+ * @param[in] core_session The core/peer session this ICE handle will belong to
+ * @param[in] handle_id The desired handle identifier, or 0 if it needs to be generated randomly
+ * @param[in] opaque_id The opaque identifier provided by the creator, if any (optional)
+ * @param[in] token The auth token provided by the creator, if any (optional)
+ * @returns The created Janus ICE handle if successful, NULL otherwise (e.g., if the identifier is already taken) */
+janus_ice_handle *janus_ice_handle_create_with_id(void *core_session, guint64 handle_id, const char *opaque_id, const char *token);
 /*! \brief Method to attach a Janus ICE handle to a plugin
  * \details This method is very important, as it allows plugins to send/receive media (RTP/RTCP) to/from a WebRTC peer.
  * @param[in] core_session The core/peer session this ICE handle belongs to
@@ -690,8 +892,12 @@ janus_ice_handle *janus_ice_handle_create(void *core_session, const char *opaque
  * @param[in] plugin The plugin the ICE handle needs to be attached to
  * @param[in] loop_index In case static event loops are used, an indication on which loop to use for this handle
  * (-1 will let the core pick one; in case API selection is disabled in the settings, this value is ignored)
+ * @param[in] loop_group In case static event loops are used, an optional identifier of a group of handles
+ * that should all be served by the same loop (e.g., the legs of a 1:1 call), so that media can be forwarded
+ * among them without any queueing (in case API selection is disabled in the settings, this value is ignored)
  * @returns 0 in case of success, a negative integer otherwise */
-gint janus_ice_handle_attach_plugin(void *core_session, janus_ice_handle *handle, janus_plugin *plugin, int loop_index);
+gint janus_ice_handle_attach_plugin(void *core_session, janus_ice_handle *handle, janus_plugin *plugin,
+	int loop_index, const char *loop_group);
 /*! \brief Method to destroy a Janus ICE handle
  * @param[in] core_session The core/peer session this ICE handle belongs to
  * @param[in] handle The Janus ICE handle to destroy
@@ -718,10 +924,38 @@ void janus_ice_relay_rtp(janus_ice_handle *handle, janus_plugin_rtp *packet);
  * @param[in] handle The Janus ICE handle associated with the peer
  * @param[in] packet The RTCP message to send */
 void janus_ice_relay_rtcp(janus_ice_handle *handle, janus_plugin_rtcp *packet);
+/*! \brief Core RTP callback, called when a plugin has many RTP packets to send to the same peer
+ * \note The packets are queued at once, and the handle loop is only woken up once
+ * @param[in] handle The Janus ICE handle associated with the peer
+ * @param[in] packets The array of RTP packets to send
+ * @param[in] count The number of packets in the array
+ * @returns The number of packets that were queued */
+int janus_ice_relay_rtp_batch(janus_ice_handle *handle, janus_plugin_rtp *packets, guint count);
+/*! \brief Core RTCP callback, called when a plugin has many RTCP messages to send to the same peer
+ * \note The messages are queued at once, and the handle loop is only woken up once
+ * @param[in] handle The Janus ICE handle associated with the peer
+ * @param[in] packets The array of RTCP messages to send
+ * @param[in] count The number of messages in the array
+ * @returns The number of messages that were queued */
+int janus_ice_relay_rtcp_batch(janus_ice_handle *handle, janus_plugin_rtcp *packets, guint count);
 /*! \brief Core SCTP/DataChannel callback, called when a plugin has data to send to a peer
  * @param[in] handle The Janus ICE handle associated with the peer
  * @param[in] packet The message to send */
 void janus_ice_relay_data(janus_ice_handle *handle, janus_plugin_data *packet);
+/*! \brief Message a plugin wants to send to many peers, copied once and shared by all the packets queued for them */
+typedef struct janus_ice_shared_data janus_ice_shared_data;
+/*! \brief Helper to create a shared copy of a message a plugin wants to send to many peers
+ * @param[in] packet The message to share
+ * @returns A janus_ice_shared_data instance (with a reference the caller must release), or NULL in case of errors */
+janus_ice_shared_data *janus_ice_shared_data_new(janus_plugin_data *packet);
+/*! \brief Helper to release a reference to a shared message
+ * @param[in] data The janus_ice_shared_data instance to release */
+void janus_ice_shared_data_unref(janus_ice_shared_data *data);
+/*! \brief Core SCTP/DataChannel callback, called when a plugin has the same message to send to many peers
+ * \note The message is not copied: the queued packet only adds a reference to it
+ * @param[in] handle The Janus ICE handle associated with the peer
+ * @param[in] data The shared message to send */
+void janus_ice_relay_data_shared(janus_ice_handle *handle, janus_ice_shared_data *data);
 /*! \brief Helper core callback, called when a plugin wants to send a RTCP PLI to a peer
  * @param[in] handle The Janus ICE handle associated with the peer */
 void janus_ice_send_pli(janus_ice_handle *handle);
@@ -733,6 +967,14 @@ void janus_ice_send_pli_stream(janus_ice_handle *handle, int mindex);
  * @param[in] handle The Janus ICE handle associated with the peer
  * @param[in] bitrate The bitrate value to put in the REMB message */
 void janus_ice_send_remb(janus_ice_handle *handle, uint32_t bitrate);
+/*! \brief Helper core callback, called when a plugin wants to know the estimated bandwidth towards a peer
+ * @param[in] handle The Janus ICE handle associated with the peer
+ * @returns The estimated bitrate (in bps), or 0 if no estimate is available (e.g., transport wide cc not negotiated) */
+guint32 janus_ice_get_bandwidth_estimate(janus_ice_handle *handle);
+/*! \brief Helper method to get some info on the pacer of a handle, for the Admin API
+ * @param[in] handle The Janus ICE handle to query
+ * @returns A JSON object with info on the pacer, or NULL if pacing isn't active for the handle */
+json_t *janus_ice_pacer_summary(janus_ice_handle *handle);
 /*! \brief Plugin SCTP/DataChannel callback, called by the SCTP stack when when there's data for a plugin
  * @param[in] handle The Janus ICE handle associated with the peer
  * @param[in] label The label of the data channel the message is from
@@ -741,6 +983,12 @@ void janus_ice_send_remb(janus_ice_handle *handle, uint32_t bitrate);
  * @param[in] buffer The message data (buffer)
  * @param[in] length The buffer length */
 void janus_ice_incoming_data(janus_ice_handle *handle, char *label, char *protocol, gboolean textdata, char *buffer, int length);
+/*! \brief Core SCTP/DataChannel callback, called when the SCTP stack received multiple messages from the same packet
+ * \note Plugins implementing \c incoming_data_batch get them all at once, the others one at a time
+ * @param[in] handle The Janus ICE handle associated with the peer
+ * @param[in] packets Array of messages
+ * @param[in] count Number of messages in the array */
+void janus_ice_incoming_data_batch(janus_ice_handle *handle, janus_plugin_data *packets, int count);
 /*! \brief Core SCTP/DataChannel callback, called by the SCTP stack when when there's data to send.
  * @param[in] handle The Janus ICE handle associated with the peer
  * @param[in] buffer The message data (buffer)
@@ -775,6 +1023,10 @@ void janus_ice_candidates_to_sdp(janus_ice_handle *handle, janus_sdp_mline *mlin
  * @param[in] handle The Janus ICE handle this method refers to
  * @param[in] c The remote NiceCandidate to process */
 void janus_ice_add_remote_candidate(janus_ice_handle *handle, NiceCandidate *c);
+/*! \brief Method to add the queued remote candidates to the ICE agent right away, instead
+ * of waiting for the end of the debounce window (e.g., because there are no more candidates)
+ * @param[in] handle The Janus ICE handle this method refers to */
+void janus_ice_flush_remote_candidates(janus_ice_handle *handle);
 /*! \brief Method to handle remote candidates and start the connectivity checks
  * @param[in] handle The Janus ICE handle this method refers to
  * @param[in] stream_id The stream ID of the candidate to add to the SDP
@@ -805,10 +1057,36 @@ int janus_ice_get_static_event_loops(void);
 /*! \brief Method to check whether loop indication via API is allowed
  * @returns true if allowed, false otherwise */
 gboolean janus_ice_is_loop_indication_allowed(void);
+/*! \brief Method to return the ID of the static event loop a handle is served by
+ * @param[in] handle The janus_ice_handle instance to check
+ * @returns The ID of the loop, or -1 if the handle has a dedicated thread */
+int janus_ice_handle_get_loop_id(janus_ice_handle *handle);
 /*! \brief Helper method to return a summary of the static loops activity
+ * (handles, measured CPU load of the loop thread and packets per second)
  * @note This is only used by the Admin API
  * @returns a json_t array with the required info */
 json_t *janus_ice_static_event_loops_info(void);
+/*! \brief Method to keep a pool of ICE agents ready in each static event loop
+ * \note Agents are bound to the context of a loop when created, which is why
+ * this only works with static event loops: new PeerConnections take an agent
+ * from the pool of their loop, if available, and the agents of PeerConnections
+ * that are closed are put back in the pool, rather than destroyed, when there's
+ * room. This must be called after all the other ICE settings have been configured
+ * @param[in] size How many agents to keep ready in each loop (0 disables the pool)
+ * @returns 0 in case of success, a negative integer otherwise */
+int janus_ice_set_agent_pool(guint size);
+/*! \brief Helper method to return info on the pools of ICE agents and SSL objects,
+ * and on how long the local setup of PeerConnections takes (percentiles, in microseconds)
+ * @note This is only used by the Admin API
+ * @returns a json_t object with the required info */
+json_t *janus_ice_pools_info(void);
+/*! \brief Helper method to estimate how much memory the core is using for a handle
+ * \note This only accounts for what the core allocates (handle, PeerConnection,
+ * media, lookup tables and retransmission buffers), and not for what plugins
+ * keep for their own sessions. The caller is expected to hold the handle mutex
+ * @param[in] handle The Janus ICE handle to inspect
+ * @returns a json_t object with a breakdown of the estimate, in bytes */
+json_t *janus_ice_handle_memory(janus_ice_handle *handle);
 /*! \brief Method to stop all the static event loops, if enabled
  * @note This will wait for the related threads to exit, and so may delay the shutdown process */
 void janus_ice_stop_static_event_loops(void);
@@ -40,9 +40,14 @@
 #include "ip-utils.h"
 #include "rtcp.h"
 #include "rtpfwd.h"
+#include "reactor.h"
+#include "ice-mux.h"
 #include "auth.h"
 #include "record.h"
 #include "events.h"
+#include "metrics.h"
+#include "probes.h"
+#include "sched-profile.h"
 
 
 #define JANUS_NAME				"Janus WebRTC Server"
@@ -76,6 +81,30 @@ static GHashTable *loggers_so = NULL;
 static GHashTable *plugins = NULL;
 static GHashTable *plugins_so = NULL;
 
+/* How long plugins, transports, event handlers and loggers took to initialize */
+static GHashTable *init_times = NULL;
+static janus_mutex init_times_mutex = JANUS_MUTEX_INITIALIZER;
+static void janus_init_time_add(const char *package, gint64 duration) {
+	if(package == NULL)
+		return;
+	guint ms = (guint)(duration/1000);
+	JANUS_LOG(LOG_INFO, "\t'%s' initialized in %ums\n", package, ms);
+	janus_mutex_lock(&init_times_mutex);
+	if(init_times == NULL)
+		init_times = g_hash_table_new(g_str_hash, g_str_equal);
+	g_hash_table_insert(init_times, (gpointer)package, GUINT_TO_POINTER(ms));
+	janus_mutex_unlock(&init_times_mutex);
+}
+static void janus_init_time_info(json_t *info, const char *package) {
+	if(info == NULL || package == NULL)
+		return;
+	gpointer ms = NULL;
+	janus_mutex_lock(&init_times_mutex);
+	if(init_times != NULL && g_hash_table_lookup_extended(init_times, package, NULL, &ms))
+		json_object_set_new(info, "init_time", json_integer(GPOINTER_TO_UINT(ms)));
+	janus_mutex_unlock(&init_times_mutex);
+}
+
 
 /* Daemonization */
 static gboolean daemonize = FALSE;
@@ -104,6 +133,7 @@ static struct janus_json_parameter attach_parameters[] = {
 	{"plugin", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
 	{"opaque_id", JSON_STRING, 0},
 	{"loop_index", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"loop_group", JSON_STRING, 0},
 };
 static struct janus_json_parameter body_parameters[] = {
 	{"body", JSON_OBJECT, JANUS_JSON_PARAM_REQUIRED}
@@ -130,6 +160,11 @@ static struct janus_json_parameter admin_parameters[] = {
 static struct janus_json_parameter debug_parameters[] = {
 	{"debug", JANUS_JSON_BOOL, JANUS_JSON_PARAM_REQUIRED}
 };
+static struct janus_json_parameter lock_profile_parameters[] = {
+	{"enable", JANUS_JSON_BOOL, 0},
+	{"reset", JANUS_JSON_BOOL, 0},
+	{"limit", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
+};
 static struct janus_json_parameter timeout_parameters[] = {
 	{"timeout", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE}
 };
@@ -160,6 +195,16 @@ static struct janus_json_parameter st_parameters[] = {
 static struct janus_json_parameter ans_parameters[] = {
 	{"accept", JANUS_JSON_BOOL, JANUS_JSON_PARAM_REQUIRED}
 };
+static struct janus_json_parameter drain_parameters[] = {
+	{"drain", JANUS_JSON_BOOL, 0}
+};
+static struct janus_json_parameter exportsessions_parameters[] = {
+	{"file", JSON_STRING, 0}
+};
+static struct janus_json_parameter importsessions_parameters[] = {
+	{"file", JSON_STRING, 0},
+	{"snapshot", JSON_OBJECT, 0}
+};
 static struct janus_json_parameter querytransport_parameters[] = {
 	{"transport", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
 	{"request", JSON_OBJECT, 0}
@@ -187,11 +232,24 @@ static struct janus_json_parameter customlogline_parameters[] = {
 static struct janus_json_parameter text2pcap_parameters[] = {
 	{"folder", JSON_STRING, 0},
 	{"filename", JSON_STRING, 0},
-	{"truncate", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
+	{"truncate", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"max_size", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"max_duration", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
 };
 static struct janus_json_parameter handleinfo_parameters[] = {
 	{"plugin_only", JANUS_JSON_BOOL, 0}
 };
+static struct janus_json_parameter listsessions_parameters[] = {
+	{"offset", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"limit", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
+};
+static struct janus_json_parameter listhandles_parameters[] = {
+	{"offset", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"limit", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"plugin", JSON_STRING, 0},
+	{"state", JSON_STRING, 0},
+	{"loop", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
+};
 static struct janus_json_parameter resaddr_parameters[] = {
 	{"address", JSON_STRING, JANUS_JSON_PARAM_REQUIRED}
 };
@@ -264,6 +322,9 @@ static GMainLoop *mainloop = NULL;
 /* Public instance name */
 static gchar *server_name = NULL;
 
+/* Clocksource the kernel is using, if known */
+static char *clocksource = NULL;
+
 static json_t *janus_create_message(const char *status, uint64_t session_id, const char *transaction) {
 	json_t *msg = json_object();
 	json_object_set_new(msg, "janus", json_string(status));
@@ -297,6 +358,26 @@ static uint reclaim_session_timeout = DEFAULT_RECLAIM_SESSION_TIMEOUT;
  * change that in some cases, e.g., if we don't want the load on this
  * server to grow too much, or because we're draining the server. */
 static gboolean accept_new_sessions = TRUE;
+/* When draining, we don't accept new sessions either, but we also tell
+ * plugins about it, so that they can ask their users to migrate elsewhere */
+static gboolean draining = FALSE;
+
+/* To restart without losing sessions, we can export them to a snapshot,
+ * and recreate them (with the same IDs) in the new process: clients can
+ * then claim them again, and renegotiate, as the PeerConnections didn't
+ * survive. If a snapshot file is configured in janus.jcfg, it's written
+ * when shutting down and read when starting; the Admin API can export and
+ * import snapshots at any time too, e.g., when the new process is started
+ * while the old one is still running, with transports sharing the ports */
+#define JANUS_SESSIONS_SNAPSHOT_VERSION		1
+static char *sessions_snapshot = NULL;
+/* To avoid a storm of renegotiations when many clients come back at the
+ * same time, each restored handle is told how long to wait before doing
+ * that, so that they're spread by this many milliseconds */
+#define DEFAULT_RESTORE_STAGGER		50
+static uint restore_stagger = DEFAULT_RESTORE_STAGGER;
+static janus_mutex restore_mutex = JANUS_MUTEX_INITIALIZER;
+static gint64 restore_next = 0;
 
 /* We don't hold (trickle) candidates indefinitely either: by default, we
  * only store them for 45 seconds. After that, they're discarded, in order
@@ -341,6 +422,7 @@ static json_t *janus_info(const char *transaction) {
 	json_object_set_new(info, "data_channels", json_false());
 #endif
 	json_object_set_new(info, "accepting-new-sessions", accept_new_sessions ? json_true() : json_false());
+	json_object_set_new(info, "draining", draining ? json_true() : json_false());
 	json_object_set_new(info, "session-timeout", json_integer(global_session_timeout));
 	json_object_set_new(info, "reclaim-session-timeout", json_integer(reclaim_session_timeout));
 	json_object_set_new(info, "candidates-timeout", json_integer(candidates_timeout));
@@ -363,6 +445,7 @@ static json_t *janus_info(const char *transaction) {
 		json_object_set_new(info, "ipv6-link-local", janus_ice_is_ipv6_linklocal_enabled() ? json_true() : json_false());
 	json_object_set_new(info, "ice-lite", janus_ice_is_ice_lite_enabled() ? json_true() : json_false());
 	json_object_set_new(info, "ice-tcp", janus_ice_is_ice_tcp_enabled() ? json_true() : json_false());
+	json_object_set_new(info, "ice-mux", janus_ice_is_mux_enabled() ? json_true() : json_false());
 #ifdef HAVE_ICE_NOMINATION
 	json_object_set_new(info, "ice-nomination", json_string(janus_ice_get_nomination_mode()));
 #endif
@@ -374,6 +457,22 @@ static json_t *janus_info(const char *transaction) {
 	json_object_set_new(info, "min-nack-queue", json_integer(janus_get_min_nack_queue()));
 	json_object_set_new(info, "nack-optimizations", janus_is_nack_optimizations_enabled() ? json_true() : json_false());
 	json_object_set_new(info, "twcc-period", json_integer(janus_get_twcc_period()));
+	json_object_set_new(info, "srtp-profiles", json_string(janus_dtls_get_srtp_profiles()));
+	json_object_set_new(info, "srtp-crypto", json_string(janus_dtls_get_srtp_backend()));
+	json_object_set_new(info, "packet-pool-size", json_integer(janus_ice_get_packet_pool_size()));
+	json_object_set_new(info, "packet-queue-size", json_integer(janus_ice_get_packet_queue_size()));
+	if(janus_ice_get_packet_queue_size() > 0)
+		json_object_set_new(info, "packet-queue-overflow", json_string(janus_ice_get_packet_queue_overflow()));
+	if(janus_ice_get_send_batch_size() > 0)
+		json_object_set_new(info, "send-batch-size", json_integer(janus_ice_get_send_batch_size()));
+	json_object_set_new(info, "pacing", janus_ice_is_pacing_enabled() ? json_true() : json_false());
+	if(janus_ice_is_pacing_enabled())
+		json_object_set_new(info, "pacing-burst", json_integer(janus_ice_get_pacing_burst()));
+	if(clocksource != NULL)
+		json_object_set_new(info, "clocksource", json_string(clocksource));
+	json_object_set_new(info, "flexfec", janus_ice_is_flexfec_enabled() ? json_true() : json_false());
+	if(janus_ice_is_flexfec_enabled())
+		json_object_set_new(info, "flexfec-rtt-threshold", json_integer(janus_ice_get_flexfec_rtt_threshold()));
 	if(janus_get_dscp() > 0)
 		json_object_set_new(info, "dscp", json_integer(janus_get_dscp()));
 	json_object_set_new(info, "dtls-mtu", json_integer(janus_dtls_bio_agent_get_mtu()));
@@ -392,6 +491,7 @@ static json_t *janus_info(const char *transaction) {
 	json_object_set_new(info, "static-event-loops", json_integer(janus_ice_get_static_event_loops()));
 	if(janus_ice_get_static_event_loops())
 		json_object_set_new(info, "loop-indication", janus_ice_is_loop_indication_allowed() ? json_true() : json_false());
+	json_object_set_new(info, "reactor-threads", json_integer(janus_reactor_get_threads()));
 	json_object_set_new(info, "api_secret", api_secret ? json_true() : json_false());
 	json_object_set_new(info, "auth_token", janus_auth_is_enabled() ? json_true() : json_false());
 	json_object_set_new(info, "event_handlers", janus_events_is_enabled() ? json_true() : json_false());
@@ -432,6 +532,7 @@ static json_t *janus_info(const char *transaction) {
 			json_object_set_new(transport, "description", json_string(t->get_description()));
 			json_object_set_new(transport, "version_string", json_string(t->get_version_string()));
 			json_object_set_new(transport, "version", json_integer(t->get_version()));
+			janus_init_time_info(transport, t->get_package());
 			json_object_set_new(t_data, t->get_package(), transport);
 		}
 	}
@@ -453,6 +554,7 @@ static json_t *janus_info(const char *transaction) {
 			json_object_set_new(eventhandler, "description", json_string(e->get_description()));
 			json_object_set_new(eventhandler, "version_string", json_string(e->get_version_string()));
 			json_object_set_new(eventhandler, "version", json_integer(e->get_version()));
+			janus_init_time_info(eventhandler, e->get_package());
 			json_object_set_new(e_data, e->get_package(), eventhandler);
 		}
 	}
@@ -474,6 +576,7 @@ static json_t *janus_info(const char *transaction) {
 			json_object_set_new(logger, "description", json_string(l->get_description()));
 			json_object_set_new(logger, "version_string", json_string(l->get_version_string()));
 			json_object_set_new(logger, "version", json_integer(l->get_version()));
+			janus_init_time_info(logger, l->get_package());
 			json_object_set_new(l_data, l->get_package(), logger);
 		}
 	}
@@ -495,6 +598,7 @@ static json_t *janus_info(const char *transaction) {
 			json_object_set_new(plugin, "description", json_string(p->get_description()));
 			json_object_set_new(plugin, "version_string", json_string(p->get_version_string()));
 			json_object_set_new(plugin, "version", json_integer(p->get_version()));
+			janus_init_time_info(plugin, p->get_package());
 			json_object_set_new(p_data, p->get_package(), plugin);
 		}
 	}
@@ -542,6 +646,7 @@ static void janus_handle_signal(int signum) {
 static void janus_termination_handler(void) {
 	/* Free the instance name, if provided */
 	g_free(server_name);
+	g_free(clocksource);
 	/* Remove the PID file if we created it */
 	janus_pidfile_remove();
 	/* Close the logger */
@@ -578,7 +683,9 @@ gboolean janus_transport_is_api_secret_needed(janus_transport *plugin);
 gboolean janus_transport_is_api_secret_valid(janus_transport *plugin, const char *apisecret);
 gboolean janus_transport_is_auth_token_needed(janus_transport *plugin);
 gboolean janus_transport_is_auth_token_valid(janus_transport *plugin, const char *token);
+gboolean janus_transport_events_is_enabled(void);
 void janus_transport_notify_event(janus_transport *plugin, void *transport, json_t *event);
+char *janus_transport_get_metrics(janus_transport *plugin);
 
 static janus_transport_callbacks janus_handler_transport =
 	{
@@ -588,13 +695,25 @@ static janus_transport_callbacks janus_handler_transport =
 		.is_api_secret_valid = janus_transport_is_api_secret_valid,
 		.is_auth_token_needed = janus_transport_is_auth_token_needed,
 		.is_auth_token_valid = janus_transport_is_auth_token_valid,
-		.events_is_enabled = janus_events_is_enabled,
+		.events_is_enabled = janus_transport_events_is_enabled,
 		.notify_event = janus_transport_notify_event,
+		.get_metrics = janus_transport_get_metrics,
 	};
 static GAsyncQueue *requests = NULL;
 static janus_request exit_message;
 static GThreadPool *tasks = NULL;
 void janus_transport_task(gpointer data, gpointer user_data);
+/* Requests for the same session that need the task pool (e.g., messages
+ * for plugins) are executed in order, one at a time: each session with a
+ * request in the pool has a queue here, and any request addressed to that
+ * session that arrives in the meanwhile is appended to it, and pushed to
+ * the pool only when the previous one is done. This way we get ordering
+ * per session, and concurrency across sessions (capped by task_pool_size) */
+static GHashTable *session_tasks = NULL;
+static janus_mutex session_tasks_mutex = JANUS_MUTEX_INITIALIZER;
+static void janus_session_tasks_free(GQueue *queue) {
+	g_queue_free_full(queue, (GDestroyNotify)janus_request_destroy);
+}
 ///@}
 
 
@@ -605,15 +724,21 @@ void janus_transport_task(gpointer data, gpointer user_data);
  */
 ///@{
 int janus_plugin_push_event(janus_plugin_session *plugin_session, janus_plugin *plugin, const char *transaction, json_t *message, json_t *jsep);
+int janus_plugin_push_event_broadcast(janus_plugin_session **plugin_sessions, guint count, janus_plugin *plugin, json_t *message);
 json_t *janus_plugin_handle_sdp(janus_plugin_session *plugin_session, janus_plugin *plugin, const char *sdp_type, const char *sdp, gboolean restart);
 void janus_plugin_relay_rtp(janus_plugin_session *plugin_session, janus_plugin_rtp *packet);
 void janus_plugin_relay_rtcp(janus_plugin_session *plugin_session, janus_plugin_rtcp *packet);
 void janus_plugin_relay_data(janus_plugin_session *plugin_session, janus_plugin_data *message);
+int janus_plugin_relay_data_broadcast(janus_plugin_session **plugin_sessions, guint count, janus_plugin_data *message);
+int janus_plugin_relay_rtp_batch(janus_plugin_session **plugin_sessions, janus_plugin_rtp *packets, guint count);
+int janus_plugin_relay_rtcp_batch(janus_plugin_session **plugin_sessions, janus_plugin_rtcp *packets, guint count);
 void janus_plugin_send_pli(janus_plugin_session *plugin_session);
 void janus_plugin_send_pli_stream(janus_plugin_session *plugin_session, int mindex);
 void janus_plugin_send_remb(janus_plugin_session *plugin_session, uint32_t bitrate);
+guint32 janus_plugin_get_bandwidth_estimate(janus_plugin_session *plugin_session);
 void janus_plugin_close_pc(janus_plugin_session *plugin_session);
 void janus_plugin_end_session(janus_plugin_session *plugin_session);
+gboolean janus_plugin_events_is_enabled(void);
 void janus_plugin_notify_event(janus_plugin *plugin, janus_plugin_session *plugin_session, json_t *event);
 gboolean janus_plugin_auth_is_signed(void);
 gboolean janus_plugin_auth_is_signature_valid(janus_plugin *plugin, const char *token);
@@ -629,18 +754,41 @@ static janus_callbacks janus_handler_plugin =
 		.send_remb = janus_plugin_send_remb,
 		.close_pc = janus_plugin_close_pc,
 		.end_session = janus_plugin_end_session,
-		.events_is_enabled = janus_events_is_enabled,
+		.events_is_enabled = janus_plugin_events_is_enabled,
 		.notify_event = janus_plugin_notify_event,
 		.auth_is_signed = janus_plugin_auth_is_signed,
 		.auth_is_signature_valid = janus_plugin_auth_is_signature_valid,
 		.auth_signature_contains = janus_plugin_auth_signature_contains,
+		.get_bandwidth_estimate = janus_plugin_get_bandwidth_estimate,
+		.push_event_broadcast = janus_plugin_push_event_broadcast,
+		.relay_data_broadcast = janus_plugin_relay_data_broadcast,
+		.relay_rtp_batch = janus_plugin_relay_rtp_batch,
+		.relay_rtcp_batch = janus_plugin_relay_rtcp_batch,
 	};
 ///@}
 
 
-/* Core Sessions */
-static janus_mutex sessions_mutex;
-static GHashTable *sessions = NULL;
+/* Core Sessions: the table is split in shards (by session ID, which is
+ * random), each with its own lock, so that lookups on the request path only
+ * compete with operations on sessions of the same shard. Each shard also
+ * keeps a min-heap of session deadlines, so that the watchdog only looks at
+ * sessions that may actually have expired: deadlines are not updated when
+ * there's activity on a session (e.g., a keep-alive), but lazily when they're
+ * popped from the heap, at which point the session either times out or is
+ * pushed back with its new deadline. Changes that may anticipate a deadline
+ * (e.g., a shorter timeout) push a new entry, which makes the old one stale. */
+#define JANUS_SESSIONS_SHARDS	16
+typedef struct janus_session_deadline {
+	gint64 deadline;
+	guint64 session_id;
+} janus_session_deadline;
+typedef struct janus_sessions_shard {
+	/* Lookups (by far the most frequent operation) only need a read lock */
+	janus_rwlock lock;
+	GHashTable *table;
+	GArray *deadlines;
+} janus_sessions_shard;
+static janus_sessions_shard sessions[JANUS_SESSIONS_SHARDS];
 static GMainContext *sessions_watchdog_context = NULL;
 
 /* Counters */
@@ -659,6 +807,7 @@ static void janus_session_free(const janus_refcount *session_ref) {
 		g_hash_table_destroy(session->ice_handles);
 		session->ice_handles = NULL;
 	}
+	janus_rwlock_destroy(&session->handles_lock);
 	if(session->source != NULL) {
 		janus_request_destroy(session->source);
 		session->source = NULL;
@@ -684,48 +833,152 @@ static void janus_request_unref(janus_request *request) {
 		janus_refcount_decrease(&request->ref);
 }
 
+static janus_sessions_shard *janus_sessions_shard_get(guint64 session_id) {
+	return &sessions[session_id % JANUS_SESSIONS_SHARDS];
+}
+
+/* Helpers to manage the heap of deadlines of a shard (the shard must be locked) */
+static void janus_sessions_heap_push(GArray *heap, gint64 deadline, guint64 session_id) {
+	janus_session_deadline entry = { .deadline = deadline, .session_id = session_id };
+	g_array_append_val(heap, entry);
+	janus_session_deadline *h = (janus_session_deadline *)heap->data;
+	guint i = heap->len - 1;
+	while(i > 0) {
+		guint parent = (i - 1) / 2;
+		if(h[parent].deadline <= h[i].deadline)
+			break;
+		entry = h[parent];
+		h[parent] = h[i];
+		h[i] = entry;
+		i = parent;
+	}
+}
+
+static void janus_sessions_heap_pop(GArray *heap) {
+	janus_session_deadline *h = (janus_session_deadline *)heap->data;
+	guint len = heap->len - 1, i = 0;
+	h[0] = h[len];
+	g_array_set_size(heap, len);
+	while(TRUE) {
+		guint smallest = i, left = 2*i + 1, right = 2*i + 2;
+		if(left < len && h[left].deadline < h[smallest].deadline)
+			smallest = left;
+		if(right < len && h[right].deadline < h[smallest].deadline)
+			smallest = right;
+		if(smallest == i)
+			break;
+		janus_session_deadline entry = h[smallest];
+		h[smallest] = h[i];
+		h[i] = entry;
+		i = smallest;
+	}
+}
+
+/* When a session should time out, given its last activity (0 means never) */
+static gint64 janus_session_get_deadline(janus_session *session) {
+	/* Use either session-specific timeout or global. */
+	gint64 timeout = (gint64)session->timeout;
+	if(timeout == -1)
+		timeout = (gint64)global_session_timeout;
+	gint64 deadline = timeout > 0 ? session->last_activity + timeout * G_USEC_PER_SEC : 0;
+	if(g_atomic_int_get(&session->transport_gone)) {
+		gint64 reclaim = session->last_activity + (gint64)reclaim_session_timeout * G_USEC_PER_SEC;
+		if(deadline == 0 || reclaim < deadline)
+			deadline = reclaim;
+	}
+	return deadline;
+}
+
+/* Make sure the watchdog knows about the deadline of a session, in case it
+ * changed to an earlier one (the shard must be locked): later deadlines are
+ * taken care of lazily, when the current entry is popped from the heap */
+static void janus_session_schedule(janus_sessions_shard *shard, janus_session *session) {
+	gint64 deadline = janus_session_get_deadline(session);
+	if(deadline == 0 || (session->expiry > 0 && session->expiry <= deadline))
+		return;
+	session->expiry = deadline;
+	janus_sessions_heap_push(shard->deadlines, deadline, session->session_id);
+}
+
+static void janus_session_reschedule(janus_session *session) {
+	janus_sessions_shard *shard = janus_sessions_shard_get(session->session_id);
+	janus_rwlock_write_lock(&shard->lock);
+	if(shard->table != NULL && g_hash_table_lookup(shard->table, &session->session_id) == session)
+		janus_session_schedule(shard, session);
+	janus_rwlock_write_unlock(&shard->lock);
+}
+
+/* Needed when the global timeout changes, as it may be shorter than before */
+static void janus_sessions_reschedule_all(void) {
+	int i = 0;
+	for(i=0; i<JANUS_SESSIONS_SHARDS; i++) {
+		janus_sessions_shard *shard = &sessions[i];
+		janus_rwlock_write_lock(&shard->lock);
+		if(shard->table != NULL) {
+			GHashTableIter iter;
+			gpointer value;
+			g_hash_table_iter_init(&iter, shard->table);
+			while(g_hash_table_iter_next(&iter, NULL, &value))
+				janus_session_schedule(shard, (janus_session *)value);
+		}
+		janus_rwlock_write_unlock(&shard->lock);
+	}
+}
+
 static gboolean janus_check_sessions(gpointer user_data) {
-	janus_mutex_lock(&sessions_mutex);
-	if(sessions && g_hash_table_size(sessions) > 0) {
-		GHashTableIter iter;
-		gpointer value;
-		g_hash_table_iter_init(&iter, sessions);
-		while (g_hash_table_iter_next(&iter, NULL, &value)) {
-			janus_session *session = (janus_session *) value;
-			if(!session || g_atomic_int_get(&session->destroyed))
+	gint64 now = janus_get_monotonic_time();
+	GList *expired = NULL;
+	int i = 0;
+	for(i=0; i<JANUS_SESSIONS_SHARDS; i++) {
+		janus_sessions_shard *shard = &sessions[i];
+		janus_rwlock_write_lock(&shard->lock);
+		while(shard->deadlines != NULL && shard->deadlines->len > 0) {
+			janus_session_deadline entry = g_array_index(shard->deadlines, janus_session_deadline, 0);
+			if(entry.deadline > now)
+				break;
+			janus_sessions_heap_pop(shard->deadlines);
+			janus_session *session = g_hash_table_lookup(shard->table, &entry.session_id);
+			/* Skip entries of sessions that are gone, or that have been rescheduled */
+			if(!session || g_atomic_int_get(&session->destroyed) || session->expiry != entry.deadline)
+				continue;
+			gint64 deadline = janus_session_get_deadline(session);
+			if(deadline == 0 || deadline > now) {
+				/* There's been activity since, push the session back */
+				session->expiry = deadline;
+				if(deadline > 0)
+					janus_sessions_heap_push(shard->deadlines, deadline, session->session_id);
 				continue;
-			gint64 now = janus_get_monotonic_time();
-			/* Use either session-specific timeout or global. */
-			gint64 timeout = (gint64)session->timeout;
-			if(timeout == -1)
-				timeout = (gint64)global_session_timeout;
-			if((timeout > 0 && (now - session->last_activity >= timeout * G_USEC_PER_SEC)) ||
-					((g_atomic_int_get(&session->transport_gone) && now - session->last_activity >= (gint64)reclaim_session_timeout * G_USEC_PER_SEC))) {
-				if(g_atomic_int_compare_and_exchange(&session->timedout, 0, 1)) {
-					JANUS_LOG(LOG_INFO, "Timeout expired for session %"SCNu64"...\n", session->session_id);
-					/* Mark the session as over, we'll deal with it later */
-					janus_session_handles_clear(session);
-					/* Notify the transport */
-					janus_request *source = janus_session_get_request(session);
-					if(source) {
-						json_t *event = janus_create_message("timeout", session->session_id, NULL);
-						/* Send this to the transport client and notify the session's over */
-						source->transport->send_message(source->instance, NULL, FALSE, event);
-						source->transport->session_over(source->instance, session->session_id, TRUE, FALSE);
-					}
-					janus_request_unref(source);
-					/* Notify event handlers as well */
-					if(janus_events_is_enabled())
-						janus_events_notify_handlers(JANUS_EVENT_TYPE_SESSION, JANUS_EVENT_SUBTYPE_NONE,
-							session->session_id, "timeout", NULL);
-					g_hash_table_iter_remove(&iter);
-					g_atomic_int_dec_and_test(&sessions_num);
-					janus_session_destroy(session);
-				}
+			}
+			if(g_atomic_int_compare_and_exchange(&session->timedout, 0, 1)) {
+				/* We take care of the session after releasing the lock */
+				g_hash_table_remove(shard->table, &session->session_id);
+				g_atomic_int_dec_and_test(&sessions_num);
+				expired = g_list_prepend(expired, session);
 			}
 		}
+		janus_rwlock_write_unlock(&shard->lock);
+	}
+	while(expired != NULL) {
+		janus_session *session = (janus_session *)expired->data;
+		expired = g_list_delete_link(expired, expired);
+		JANUS_LOG(LOG_INFO, "Timeout expired for session %"SCNu64"...\n", session->session_id);
+		/* Mark the session as over, we'll deal with it later */
+		janus_session_handles_clear(session);
+		/* Notify the transport */
+		janus_request *source = janus_session_get_request(session);
+		if(source) {
+			json_t *event = janus_create_message("timeout", session->session_id, NULL);
+			/* Send this to the transport client and notify the session's over */
+			source->transport->send_message(source->instance, NULL, FALSE, event);
+			source->transport->session_over(source->instance, session->session_id, TRUE, FALSE);
+		}
+		janus_request_unref(source);
+		/* Notify event handlers as well */
+		if(janus_events_is_enabled())
+			janus_events_notify_handlers(JANUS_EVENT_TYPE_SESSION, JANUS_EVENT_SUBTYPE_NONE,
+				session->session_id, "timeout", NULL);
+		janus_session_destroy(session);
 	}
-	janus_mutex_unlock(&sessions_mutex);
 
 	return G_SOURCE_CONTINUE;
 }
@@ -758,6 +1011,10 @@ static gboolean janus_status_sessions(gpointer user_data) {
 		json_object_set_new(details, "handles", json_integer(g_atomic_int_get(&handles_num)));
 		json_object_set_new(details, "peerconnections", json_integer(janus_ice_get_peerconnection_num()));
 		json_object_set_new(details, "stats-period", json_integer(janus_ice_get_event_stats_period()));
+		if(janus_ice_event_get_stats_sampling() > 1)
+			json_object_set_new(details, "stats-sampling", json_integer(janus_ice_event_get_stats_sampling()));
+		if(janus_ice_event_get_stats_lossy_only())
+			json_object_set_new(details, "stats-lossy-only", json_true());
 		json_object_set_new(info, "info", details);
 		janus_events_notify_handlers(JANUS_EVENT_TYPE_CORE, JANUS_EVENT_SUBTYPE_CORE_STARTUP, 0, info);
 	}
@@ -786,35 +1043,86 @@ janus_session *janus_session_create(guint64 session_id) {
 	g_atomic_int_set(&session->destroyed, 0);
 	g_atomic_int_set(&session->timedout, 0);
 	g_atomic_int_set(&session->transport_gone, 0);
+	g_atomic_int_set(&session->restored, 0);
 	session->last_activity = janus_get_monotonic_time();
+	session->expiry = 0;
 	session->ice_handles = NULL;
+	memset(session->handles, 0, sizeof(session->handles));
+	session->handles_inline = 0;
+	janus_rwlock_init(&session->handles_lock);
 	janus_mutex_init(&session->mutex);
-	janus_mutex_lock(&sessions_mutex);
-	g_hash_table_insert(sessions, janus_uint64_dup(session->session_id), session);
+	janus_sessions_shard *shard = janus_sessions_shard_get(session_id);
+	janus_rwlock_write_lock(&shard->lock);
+	g_hash_table_insert(shard->table, janus_uint64_dup(session->session_id), session);
+	janus_session_schedule(shard, session);
 	g_atomic_int_inc(&sessions_num);
-	janus_mutex_unlock(&sessions_mutex);
+	janus_rwlock_write_unlock(&shard->lock);
 	return session;
 }
 
 janus_session *janus_session_find(guint64 session_id) {
-	janus_mutex_lock(&sessions_mutex);
-	janus_session *session = g_hash_table_lookup(sessions, &session_id);
+	janus_sessions_shard *shard = janus_sessions_shard_get(session_id);
+	janus_rwlock_read_lock(&shard->lock);
+	janus_session *session = shard->table ? g_hash_table_lookup(shard->table, &session_id) : NULL;
 	if(session != NULL) {
 		/* A successful find automatically increases the reference counter:
 		 * it's up to the caller to decrease it again when done */
 		janus_refcount_increase(&session->ref);
 	}
-	janus_mutex_unlock(&sessions_mutex);
+	janus_rwlock_read_unlock(&shard->lock);
 	return session;
 }
 
+/* Remove a session from the sessions table, returning TRUE if it was there */
+static gboolean janus_session_remove(janus_session *session) {
+	janus_sessions_shard *shard = janus_sessions_shard_get(session->session_id);
+	janus_rwlock_write_lock(&shard->lock);
+	gboolean removed = shard->table && g_hash_table_remove(shard->table, &session->session_id);
+	if(removed)
+		g_atomic_int_dec_and_test(&sessions_num);
+	janus_rwlock_write_unlock(&shard->lock);
+	return removed;
+}
+
 void janus_session_notify_event(janus_session *session, json_t *event) {
 	if(session != NULL && !g_atomic_int_get(&session->destroyed)) {
 		janus_request *source = janus_session_get_request(session);
 		if(source != NULL && source->transport != NULL) {
 			/* Send this to the transport client */
 			JANUS_LOG(LOG_HUGE, "Sending event to %s (%p)\n", source->transport->get_package(), source->instance);
+			JANUS_PROBE2(transport_send_start, source->instance, FALSE);
 			source->transport->send_message(source->instance, NULL, FALSE, event);
+			JANUS_PROBE1(transport_send_done, source->instance);
+		} else {
+			/* No transport, free the event */
+			json_decref(event);
+		}
+		janus_request_unref(source);
+	} else {
+		/* No session, free the event */
+		json_decref(event);
+	}
+}
+
+void janus_session_notify_event_prepared(janus_session *session, json_t *event, janus_transport_payload *payload) {
+	if(payload == NULL) {
+		janus_session_notify_event(session, event);
+		return;
+	}
+	if(session != NULL && !g_atomic_int_get(&session->destroyed)) {
+		janus_request *source = janus_session_get_request(session);
+		if(source != NULL && source->transport != NULL) {
+			/* Send this to the transport client */
+			JANUS_LOG(LOG_HUGE, "Sending event to %s (%p)\n", source->transport->get_package(), source->instance);
+			JANUS_PROBE2(transport_send_start, source->instance, FALSE);
+			if(source->transport->send_message_prepared != NULL) {
+				source->transport->send_message_prepared(source->instance, NULL, FALSE, event, payload);
+			} else {
+				/* The transport can't reuse the shared content, pass the whole event */
+				json_object_set(event, payload->name, payload->object);
+				source->transport->send_message(source->instance, NULL, FALSE, event);
+			}
+			JANUS_PROBE1(transport_send_done, source->instance);
 		} else {
 			/* No transport, free the event */
 			json_decref(event);
@@ -840,41 +1148,76 @@ gint janus_session_destroy(janus_session *session) {
 	return 0;
 }
 
+/* Remove a handle from the array of handles of a session, if it's there
+ * (the handles lock must be write locked) */
+static void janus_session_handles_uninline(janus_session *session, janus_ice_handle *handle) {
+	guint i = 0;
+	for(i=0; i<JANUS_SESSION_HANDLES_INLINE; i++) {
+		if(session->handles[i] == handle) {
+			session->handles[i] = NULL;
+			session->handles_inline--;
+			return;
+		}
+	}
+}
+
 janus_ice_handle *janus_session_handles_find(janus_session *session, guint64 handle_id) {
 	if(session == NULL)
 		return NULL;
-	janus_mutex_lock(&session->mutex);
-	janus_ice_handle *handle = session->ice_handles ? g_hash_table_lookup(session->ice_handles, &handle_id) : NULL;
+	janus_rwlock_read_lock(&session->handles_lock);
+	janus_ice_handle *handle = NULL;
+	guint i = 0;
+	for(i=0; i<JANUS_SESSION_HANDLES_INLINE; i++) {
+		if(session->handles[i] != NULL && session->handles[i]->handle_id == handle_id) {
+			handle = session->handles[i];
+			break;
+		}
+	}
+	/* Only check the hashtable if there are handles that didn't fit in the array */
+	if(handle == NULL && session->ice_handles != NULL && g_hash_table_size(session->ice_handles) > session->handles_inline)
+		handle = g_hash_table_lookup(session->ice_handles, &handle_id);
 	if(handle != NULL) {
 		/* A successful find automatically increases the reference counter:
 		 * it's up to the caller to decrease it again when done */
 		janus_refcount_increase(&handle->ref);
 	}
-	janus_mutex_unlock(&session->mutex);
+	janus_rwlock_read_unlock(&session->handles_lock);
 	return handle;
 }
 
 void janus_session_handles_insert(janus_session *session, janus_ice_handle *handle) {
-	janus_mutex_lock(&session->mutex);
+	janus_rwlock_write_lock(&session->handles_lock);
 	if(session->ice_handles == NULL)
 		session->ice_handles = g_hash_table_new_full(g_int64_hash, g_int64_equal, (GDestroyNotify)g_free, (GDestroyNotify)janus_ice_handle_dereference);
 	janus_refcount_increase(&handle->ref);
 	g_hash_table_insert(session->ice_handles, janus_uint64_dup(handle->handle_id), handle);
+	/* The reference is owned by the hashtable, the array just points to it */
+	guint i = 0;
+	for(i=0; i<JANUS_SESSION_HANDLES_INLINE; i++) {
+		if(session->handles[i] == NULL) {
+			session->handles[i] = handle;
+			session->handles_inline++;
+			break;
+		}
+	}
 	g_atomic_int_inc(&handles_num);
-	janus_mutex_unlock(&session->mutex);
+	/* New handles inherit the log level of the session, if any */
+	g_atomic_int_set(&handle->session_log_level, g_atomic_int_get(&session->log_level));
+	janus_rwlock_write_unlock(&session->handles_lock);
 }
 
 gint janus_session_handles_remove(janus_session *session, janus_ice_handle *handle) {
-	janus_mutex_lock(&session->mutex);
+	janus_rwlock_write_lock(&session->handles_lock);
 	gint error = janus_ice_handle_destroy(session, handle);
+	janus_session_handles_uninline(session, handle);
 	if(g_hash_table_remove(session->ice_handles, &handle->handle_id))
 		g_atomic_int_dec_and_test(&handles_num);
-	janus_mutex_unlock(&session->mutex);
+	janus_rwlock_write_unlock(&session->handles_lock);
 	return error;
 }
 
 void janus_session_handles_clear(janus_session *session) {
-	janus_mutex_lock(&session->mutex);
+	janus_rwlock_write_lock(&session->handles_lock);
 	if(session->ice_handles != NULL && g_hash_table_size(session->ice_handles) > 0) {
 		GHashTableIter iter;
 		gpointer value;
@@ -885,16 +1228,17 @@ void janus_session_handles_clear(janus_session *session) {
 			if(!handle)
 				continue;
 			janus_ice_handle_destroy(session, handle);
+			janus_session_handles_uninline(session, handle);
 			g_hash_table_iter_remove(&iter);
 			g_atomic_int_dec_and_test(&handles_num);
 		}
 	}
-	janus_mutex_unlock(&session->mutex);
+	janus_rwlock_write_unlock(&session->handles_lock);
 }
 
 json_t *janus_session_handles_list_json(janus_session *session) {
 	json_t *list = json_array();
-	janus_mutex_lock(&session->mutex);
+	janus_rwlock_read_lock(&session->handles_lock);
 	if(session->ice_handles != NULL && g_hash_table_size(session->ice_handles) > 0) {
 		GHashTableIter iter;
 		gpointer value;
@@ -906,10 +1250,318 @@ json_t *janus_session_handles_list_json(janus_session *session) {
 			json_array_append_new(list, json_integer(handle->handle_id));
 		}
 	}
-	janus_mutex_unlock(&session->mutex);
+	janus_rwlock_read_unlock(&session->handles_lock);
 	return list;
 }
 
+/* Helpers for the paginated Admin API listings: we only copy what we need
+ * while holding the locks, and sort and serialize after releasing them */
+typedef struct janus_admin_handle_entry {
+	guint64 session_id;
+	guint64 handle_id;
+	const char *plugin;
+	const char *state;
+	int loop;
+} janus_admin_handle_entry;
+static gint janus_admin_compare_ids(gconstpointer a, gconstpointer b) {
+	guint64 first = *(const guint64 *)a, second = *(const guint64 *)b;
+	return (first < second) ? -1 : (first > second ? 1 : 0);
+}
+static gint janus_admin_compare_handle_entries(gconstpointer a, gconstpointer b) {
+	return janus_admin_compare_ids(&((const janus_admin_handle_entry *)a)->handle_id,
+		&((const janus_admin_handle_entry *)b)->handle_id);
+}
+static const char *janus_admin_handle_state(janus_ice_handle *handle) {
+	if(janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_READY))
+		return "connected";
+	if(janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_GOT_OFFER) ||
+			janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_GOT_ANSWER))
+		return "negotiating";
+	return "idle";
+}
+static GArray *janus_admin_sessions_snapshot(void) {
+	GArray *ids = g_array_sized_new(FALSE, FALSE, sizeof(guint64), g_atomic_int_get(&sessions_num));
+	int i = 0;
+	for(i=0; i<JANUS_SESSIONS_SHARDS; i++) {
+		janus_sessions_shard *shard = &sessions[i];
+		janus_rwlock_read_lock(&shard->lock);
+		if(shard->table != NULL) {
+			GHashTableIter iter;
+			gpointer value;
+			g_hash_table_iter_init(&iter, shard->table);
+			while(g_hash_table_iter_next(&iter, NULL, &value)) {
+				janus_session *session = value;
+				if(session != NULL)
+					g_array_append_val(ids, session->session_id);
+			}
+		}
+		janus_rwlock_read_unlock(&shard->lock);
+	}
+	g_array_sort(ids, janus_admin_compare_ids);
+	return ids;
+}
+static GArray *janus_admin_handles_snapshot(const char *plugin, const char *state, int loop) {
+	GArray *entries = g_array_new(FALSE, FALSE, sizeof(janus_admin_handle_entry));
+	int i = 0;
+	for(i=0; i<JANUS_SESSIONS_SHARDS; i++) {
+		janus_sessions_shard *shard = &sessions[i];
+		janus_rwlock_read_lock(&shard->lock);
+		if(shard->table != NULL) {
+			GHashTableIter iter;
+			gpointer value;
+			g_hash_table_iter_init(&iter, shard->table);
+			while(g_hash_table_iter_next(&iter, NULL, &value)) {
+				janus_session *session = value;
+				if(session == NULL)
+					continue;
+				janus_rwlock_read_lock(&session->handles_lock);
+				if(session->ice_handles != NULL) {
+					GHashTableIter hiter;
+					gpointer hvalue;
+					g_hash_table_iter_init(&hiter, session->ice_handles);
+					while(g_hash_table_iter_next(&hiter, NULL, &hvalue)) {
+						janus_ice_handle *handle = hvalue;
+						if(handle == NULL)
+							continue;
+						janus_admin_handle_entry entry = {
+							.session_id = session->session_id,
+							.handle_id = handle->handle_id,
+							.plugin = handle->app ? ((janus_plugin *)handle->app)->get_package() : NULL,
+							.state = janus_admin_handle_state(handle),
+							.loop = janus_ice_handle_get_loop_id(handle)
+						};
+						if(plugin != NULL && (entry.plugin == NULL || strcmp(plugin, entry.plugin)))
+							continue;
+						if(state != NULL && strcmp(state, entry.state))
+							continue;
+						if(loop != -1 && loop != entry.loop)
+							continue;
+						g_array_append_val(entries, entry);
+					}
+				}
+				janus_rwlock_read_unlock(&session->handles_lock);
+			}
+		}
+		janus_rwlock_read_unlock(&shard->lock);
+	}
+	g_array_sort(entries, janus_admin_compare_handle_entries);
+	return entries;
+}
+
+/* Sessions snapshots */
+static GList *janus_session_handles_ref(janus_session *session, gboolean restored) {
+	GList *list = NULL;
+	janus_rwlock_read_lock(&session->handles_lock);
+	if(session->ice_handles != NULL) {
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, session->ice_handles);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) {
+			janus_ice_handle *handle = value;
+			if(handle == NULL || (restored && handle->restored == NULL))
+				continue;
+			janus_refcount_increase(&handle->ref);
+			list = g_list_prepend(list, handle);
+		}
+	}
+	janus_rwlock_read_unlock(&session->handles_lock);
+	return list;
+}
+static json_t *janus_sessions_export(void) {
+	/* Reference all the sessions first: we'll query plugins about their
+	 * handles after releasing the locks, as that can take a while */
+	GList *list = NULL, *l = NULL;
+	int i = 0;
+	for(i=0; i<JANUS_SESSIONS_SHARDS; i++) {
+		janus_sessions_shard *shard = &sessions[i];
+		janus_rwlock_read_lock(&shard->lock);
+		if(shard->table != NULL) {
+			GHashTableIter iter;
+			gpointer value;
+			g_hash_table_iter_init(&iter, shard->table);
+			while(g_hash_table_iter_next(&iter, NULL, &value)) {
+				janus_session *session = value;
+				if(session == NULL || g_atomic_int_get(&session->destroyed) || g_atomic_int_get(&session->timedout))
+					continue;
+				janus_refcount_increase(&session->ref);
+				list = g_list_prepend(list, session);
+			}
+		}
+		janus_rwlock_read_unlock(&shard->lock);
+	}
+	json_t *list_json = json_array();
+	for(l = list; l != NULL; l = l->next) {
+		janus_session *session = (janus_session *)l->data;
+		json_t *s = json_object();
+		json_object_set_new(s, "id", json_integer(session->session_id));
+		if(session->timeout != -1)
+			json_object_set_new(s, "timeout", json_integer(session->timeout));
+		json_t *handles = json_array();
+		GList *hlist = janus_session_handles_ref(session, FALSE), *hl = NULL;
+		for(hl = hlist; hl != NULL; hl = hl->next) {
+			janus_ice_handle *handle = (janus_ice_handle *)hl->data;
+			janus_plugin *plugin = NULL;
+			janus_plugin_session *app_handle = NULL;
+			janus_mutex_lock(&handle->mutex);
+			if(handle->app && janus_plugin_session_is_alive(handle->app_handle)) {
+				plugin = (janus_plugin *)handle->app;
+				app_handle = handle->app_handle;
+				janus_refcount_increase(&app_handle->ref);
+			}
+			janus_mutex_unlock(&handle->mutex);
+			if(plugin != NULL) {
+				json_t *h = json_object();
+				json_object_set_new(h, "id", json_integer(handle->handle_id));
+				json_object_set_new(h, "plugin", json_string(plugin->get_package()));
+				if(handle->opaque_id)
+					json_object_set_new(h, "opaque_id", json_string(handle->opaque_id));
+				if(handle->token)
+					json_object_set_new(h, "token", json_string(handle->token));
+				if(plugin->query_session) {
+					json_t *query = plugin->query_session(app_handle);
+					if(query != NULL && json_is_object(query))
+						json_object_set_new(h, "state", query);
+					else if(query != NULL)
+						json_decref(query);
+				}
+				json_array_append_new(handles, h);
+				janus_refcount_decrease(&app_handle->ref);
+			}
+			janus_refcount_decrease(&handle->ref);
+		}
+		g_list_free(hlist);
+		json_object_set_new(s, "handles", handles);
+		json_array_append_new(list_json, s);
+		janus_refcount_decrease(&session->ref);
+	}
+	g_list_free(list);
+	json_t *snapshot = json_object();
+	json_object_set_new(snapshot, "version", json_integer(JANUS_SESSIONS_SNAPSHOT_VERSION));
+	json_object_set_new(snapshot, "created", json_integer(janus_get_real_time()));
+	json_object_set_new(snapshot, "sessions", list_json);
+	return snapshot;
+}
+static int janus_sessions_export_file(const char *path, json_t *snapshot) {
+	/* Write to a temporary file first, so that a new process never reads a partial snapshot */
+	char tmp[1024];
+	g_snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	if(json_dump_file(snapshot, tmp, JSON_COMPACT) < 0 || rename(tmp, path) < 0) {
+		JANUS_LOG(LOG_ERR, "Error writing sessions snapshot to '%s'\n", path);
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+static int janus_sessions_import(json_t *snapshot, int *restored_handles) {
+	if(restored_handles)
+		*restored_handles = 0;
+	json_t *version = json_object_get(snapshot, "version");
+	json_t *list = json_object_get(snapshot, "sessions");
+	if(!json_is_integer(version) || json_integer_value(version) != JANUS_SESSIONS_SNAPSHOT_VERSION || !json_is_array(list)) {
+		JANUS_LOG(LOG_ERR, "Invalid or unsupported sessions snapshot\n");
+		return -1;
+	}
+	int sessions_count = 0, handles_count = 0;
+	size_t i = 0, j = 0;
+	json_t *s = NULL, *h = NULL;
+	json_array_foreach(list, i, s) {
+		json_t *id = json_object_get(s, "id");
+		guint64 session_id = json_is_integer(id) ? (guint64)json_integer_value(id) : 0;
+		if(session_id == 0)
+			continue;
+		janus_session *session = janus_session_find(session_id);
+		if(session != NULL) {
+			JANUS_LOG(LOG_WARN, "Session %"SCNu64" already exists, not restoring it\n", session_id);
+			janus_refcount_decrease(&session->ref);
+			continue;
+		}
+		session = janus_session_create(session_id);
+		json_t *timeout = json_object_get(s, "timeout");
+		if(json_is_integer(timeout))
+			session->timeout = json_integer_value(timeout);
+		g_atomic_int_set(&session->restored, 1);
+		json_t *handles = json_object_get(s, "handles");
+		json_array_foreach(handles, j, h) {
+			id = json_object_get(h, "id");
+			guint64 handle_id = json_is_integer(id) ? (guint64)json_integer_value(id) : 0;
+			const char *package = json_string_value(json_object_get(h, "plugin"));
+			janus_plugin *plugin = package ? janus_plugin_find(package) : NULL;
+			if(handle_id == 0 || plugin == NULL) {
+				JANUS_LOG(LOG_WARN, "Can't restore handle %"SCNu64" in session %"SCNu64" (plugin '%s' not available)\n",
+					handle_id, session_id, package ? package : "??");
+				continue;
+			}
+			janus_ice_handle *handle = janus_ice_handle_create_with_id(session, handle_id,
+				json_string_value(json_object_get(h, "opaque_id")), json_string_value(json_object_get(h, "token")));
+			if(handle == NULL)
+				continue;
+			janus_refcount_increase(&handle->ref);
+			int error = janus_ice_handle_attach_plugin(session, handle, plugin, -1, NULL);
+			if(error != 0) {
+				JANUS_LOG(LOG_WARN, "Couldn't attach restored handle %"SCNu64" to plugin '%s', error '%d'\n", handle_id, package, error);
+				janus_session_handles_remove(session, handle);
+				janus_refcount_decrease(&handle->ref);
+				continue;
+			}
+			json_t *state = json_object_get(h, "state");
+			janus_mutex_lock(&handle->mutex);
+			handle->restored = state ? json_incref(state) : json_object();
+			janus_mutex_unlock(&handle->mutex);
+			janus_refcount_decrease(&handle->ref);
+			handles_count++;
+		}
+		/* There's no transport yet: if reclaiming is enabled we use that
+		 * timeout, otherwise the session timeout will take care of it */
+		if(reclaim_session_timeout > 0)
+			g_atomic_int_set(&session->transport_gone, 1);
+		janus_session_reschedule(session);
+		sessions_count++;
+	}
+	JANUS_LOG(LOG_INFO, "Restored %d sessions (%d handles) from snapshot\n", sessions_count, handles_count);
+	if(restored_handles)
+		*restored_handles = handles_count;
+	return sessions_count;
+}
+/* Let the client that claimed a restored session know about its handles:
+ * each of them is told when to renegotiate, so that renegotiations of all
+ * the clients coming back at the same time are spread over time */
+static void janus_session_notify_restored(janus_session *session) {
+	if(!g_atomic_int_compare_and_exchange(&session->restored, 1, 0))
+		return;
+	GList *list = janus_session_handles_ref(session, TRUE), *l = NULL;
+	for(l = list; l != NULL; l = l->next) {
+		janus_ice_handle *handle = (janus_ice_handle *)l->data;
+		janus_mutex_lock(&handle->mutex);
+		json_t *state = handle->restored;
+		handle->restored = NULL;
+		janus_plugin *plugin = (janus_plugin *)handle->app;
+		janus_mutex_unlock(&handle->mutex);
+		if(state != NULL && plugin != NULL) {
+			gint64 now = janus_get_monotonic_time();
+			janus_mutex_lock(&restore_mutex);
+			if(restore_next < now)
+				restore_next = now;
+			gint64 resume_in = (restore_next - now)/1000;
+			restore_next += (gint64)restore_stagger*1000;
+			janus_mutex_unlock(&restore_mutex);
+			json_t *event = janus_create_message("restored", session->session_id, NULL);
+			json_object_set_new(event, "sender", json_integer(handle->handle_id));
+			if(janus_is_opaqueid_in_api_enabled() && handle->opaque_id != NULL)
+				json_object_set_new(event, "opaque_id", json_string(handle->opaque_id));
+			json_object_set_new(event, "resume_in", json_integer(resume_in));
+			json_t *plugin_data = json_object();
+			json_object_set_new(plugin_data, "plugin", json_string(plugin->get_package()));
+			json_object_set_new(plugin_data, "data", state);
+			json_object_set_new(event, "plugindata", plugin_data);
+			janus_session_notify_event(session, event);
+		} else if(state != NULL) {
+			json_decref(state);
+		}
+		janus_refcount_decrease(&handle->ref);
+	}
+	g_list_free(list);
+}
+
 /* Requests management */
 static void janus_request_free(const janus_refcount *request_ref) {
 	janus_request *request = janus_refcount_containerof(request_ref, janus_request, ref);
@@ -944,6 +1596,8 @@ janus_request *janus_request_new(janus_transport *transport, janus_transport_ses
 	} else {
 		request->error = NULL;
 	}
+	request->received = janus_get_monotonic_time();
+	request->queued_session = 0;
 	g_atomic_int_set(&request->destroyed, 0);
 	janus_refcount_init(&request->ref, janus_request_free);
 	return request;
@@ -1251,6 +1905,8 @@ int janus_process_incoming_request(janus_request *request) {
 		const char *opaque_id = opaque ? json_string_value(opaque) : NULL;
 		json_t *loop = json_object_get(root, "loop_index");
 		int loop_index = loop ? json_integer_value(loop) : -1;
+		json_t *group = json_object_get(root, "loop_group");
+		const char *loop_group = group ? json_string_value(group) : NULL;
 		/* Create handle */
 		handle = janus_ice_handle_create(session, opaque_id, token_value);
 		if(handle == NULL) {
@@ -1262,7 +1918,7 @@ int janus_process_incoming_request(janus_request *request) {
 		janus_refcount_increase(&handle->ref);
 		/* Attach to the plugin */
 		int error = 0;
-		if((error = janus_ice_handle_attach_plugin(session, handle, plugin_t, loop_index)) != 0) {
+		if((error = janus_ice_handle_attach_plugin(session, handle, plugin_t, loop_index, loop_group)) != 0) {
 			/* TODO Make error struct to pass verbose information */
 			janus_session_handles_remove(session, handle);
 			JANUS_LOG(LOG_ERR, "Couldn't attach to plugin '%s', error '%d'\n", plugin_text, error);
@@ -1282,10 +1938,7 @@ int janus_process_incoming_request(janus_request *request) {
 			ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_INVALID_REQUEST_PATH, "Unhandled request '%s' at this path", message_text);
 			goto jsondone;
 		}
-		janus_mutex_lock(&sessions_mutex);
-		if(g_hash_table_remove(sessions, &session->session_id))
-			g_atomic_int_dec_and_test(&sessions_num);
-		janus_mutex_unlock(&sessions_mutex);
+		janus_session_remove(session);
 		/* Notify the source that the session has been destroyed */
 		janus_request *source = janus_session_get_request(session);
 		if(source && source->transport)
@@ -1372,6 +2025,8 @@ int janus_process_incoming_request(janus_request *request) {
 		json_object_set_new(reply, "transaction", json_string(transaction_text));
 		/* Send the success reply */
 		ret = janus_process_success(request, reply);
+		/* If this session was restored from a snapshot, tell the client about its handles */
+		janus_session_notify_restored(session);
 	} else if(!strcasecmp(message_text, "message")) {
 		if(handle == NULL) {
 			/* Query is an handle-level command */
@@ -2184,6 +2839,9 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			json_object_set_new(status, "log_timestamps", janus_log_timestamps ? json_true() : json_false());
 			json_object_set_new(status, "log_colors", janus_log_colors ? json_true() : json_false());
 			json_object_set_new(status, "locking_debug", lock_debug ? json_true() : json_false());
+#ifdef JANUS_LOCK_PROFILING
+			json_object_set_new(status, "lock_profiling", lock_profiling ? json_true() : json_false());
+#endif
 			json_object_set_new(status, "refcount_debug", refcount_debug ? json_true() : json_false());
 			json_object_set_new(status, "libnice_debug", janus_ice_is_ice_debugging_enabled() ? json_true() : json_false());
 			json_object_set_new(status, "min_nack_queue", json_integer(janus_get_min_nack_queue()));
@@ -2211,6 +2869,7 @@ int janus_process_incoming_admin_request(janus_request *request) {
 
 			/* Set global session timeout */
 			global_session_timeout = timeout_num;
+			janus_sessions_reschedule_all();
 
 			/* Prepare JSON reply */
 			json_t *reply = json_object();
@@ -2260,6 +2919,36 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			/* Send the success reply */
 			ret = janus_process_success(request, reply);
 			goto jsondone;
+		} else if(!strcasecmp(message_text, "lock_profile")) {
+			/* Enable/disable the lock contention profiler, and/or get what it collected so far */
+			JANUS_VALIDATE_JSON_OBJECT(root, lock_profile_parameters,
+				error_code, error_cause, FALSE,
+				JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
+			if(error_code != 0) {
+				ret = janus_process_error_string(request, session_id, transaction_text, error_code, error_cause);
+				goto jsondone;
+			}
+#ifndef JANUS_LOCK_PROFILING
+			ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_UNKNOWN_REQUEST,
+				"Lock profiling not available (Janus was not built with --enable-lock-profiling)");
+			goto jsondone;
+#else
+			json_t *enable = json_object_get(root, "enable");
+			if(enable != NULL) {
+				lock_profiling = json_is_true(enable);
+				JANUS_LOG(LOG_INFO, "Lock contention profiler %s\n", lock_profiling ? "enabled" : "disabled");
+			}
+			if(json_is_true(json_object_get(root, "reset")))
+				janus_lock_profile_reset();
+			int limit = json_integer_value(json_object_get(root, "limit"));
+			/* Prepare JSON reply */
+			json_t *reply = janus_create_message("success", 0, transaction_text);
+			json_object_set_new(reply, "lock_profiling", lock_profiling ? json_true() : json_false());
+			json_object_set_new(reply, "sites", janus_lock_profile_dump(limit));
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
+#endif
 		} else if(!strcasecmp(message_text, "set_refcount_debug")) {
 			/* Enable/disable the reference counter debug (would show a message on the console for every increase/decrease) */
 			JANUS_VALIDATE_JSON_OBJECT(root, debug_parameters,
@@ -2430,6 +3119,124 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			/* Send the success reply */
 			ret = janus_process_success(request, reply);
 			goto jsondone;
+		} else if(!strcasecmp(message_text, "drain")) {
+			/* Start (or stop) draining this server: we stop accepting new
+			 * sessions, and let plugins know, so that they can prompt their
+			 * users to migrate to another instance; the reply contains the
+			 * load that's still there, so it can be polled to know when
+			 * the instance can be safely shut down */
+			JANUS_VALIDATE_JSON_OBJECT(root, drain_parameters,
+				error_code, error_cause, FALSE,
+				JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
+			if(error_code != 0) {
+				ret = janus_process_error_string(request, session_id, transaction_text, error_code, error_cause);
+				goto jsondone;
+			}
+			json_t *drain = json_object_get(root, "drain");
+			gboolean drain_value = drain ? json_is_true(drain) : TRUE;
+			if(drain_value != draining) {
+				JANUS_LOG(LOG_INFO, "%s draining this instance\n", drain_value ? "Started" : "Stopped");
+				draining = drain_value;
+				accept_new_sessions = !draining;
+				/* Notify all the plugins that care */
+				GHashTableIter iter;
+				gpointer value;
+				g_hash_table_iter_init(&iter, plugins);
+				while(g_hash_table_iter_next(&iter, NULL, &value)) {
+					janus_plugin *p = (janus_plugin *)value;
+					if(p != NULL && p->drain != NULL)
+						p->drain(draining);
+				}
+				/* Notify event handlers as well */
+				if(janus_events_is_enabled()) {
+					json_t *info = json_object();
+					json_object_set_new(info, "status", json_string(draining ? "draining" : "running"));
+					json_t *details = json_object();
+					json_object_set_new(details, "sessions", json_integer(g_atomic_int_get(&sessions_num)));
+					json_object_set_new(details, "handles", json_integer(g_atomic_int_get(&handles_num)));
+					json_object_set_new(details, "peerconnections", json_integer(janus_ice_get_peerconnection_num()));
+					json_object_set_new(info, "info", details);
+					janus_events_notify_handlers(JANUS_EVENT_TYPE_CORE,
+						draining ? JANUS_EVENT_SUBTYPE_CORE_SHUTDOWN : JANUS_EVENT_SUBTYPE_CORE_STARTUP, 0, info);
+				}
+			}
+			/* Prepare JSON reply */
+			json_t *reply = janus_create_message("success", 0, transaction_text);
+			json_object_set_new(reply, "draining", draining ? json_true() : json_false());
+			json_object_set_new(reply, "sessions", json_integer(g_atomic_int_get(&sessions_num)));
+			json_object_set_new(reply, "handles", json_integer(g_atomic_int_get(&handles_num)));
+			json_object_set_new(reply, "peerconnections", json_integer(janus_ice_get_peerconnection_num()));
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
+		} else if(!strcasecmp(message_text, "export_sessions")) {
+			/* Take a snapshot of the existing sessions and handles, e.g., to hand
+			 * them over to a new process: we either return it, or save it to file */
+			JANUS_VALIDATE_JSON_OBJECT(root, exportsessions_parameters,
+				error_code, error_cause, FALSE,
+				JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
+			if(error_code != 0) {
+				ret = janus_process_error_string(request, session_id, transaction_text, error_code, error_cause);
+				goto jsondone;
+			}
+			const char *file = json_string_value(json_object_get(root, "file"));
+			json_t *snapshot = janus_sessions_export();
+			size_t exported = json_array_size(json_object_get(snapshot, "sessions"));
+			if(file != NULL && janus_sessions_export_file(file, snapshot) < 0) {
+				json_decref(snapshot);
+				ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_UNKNOWN, "Error writing snapshot to '%s'", file);
+				goto jsondone;
+			}
+			/* Prepare JSON reply */
+			json_t *reply = janus_create_message("success", 0, transaction_text);
+			json_object_set_new(reply, "sessions", json_integer(exported));
+			if(file == NULL)
+				json_object_set_new(reply, "snapshot", snapshot);
+			else
+				json_decref(snapshot);
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
+		} else if(!strcasecmp(message_text, "import_sessions")) {
+			/* Recreate the sessions and handles in a snapshot, either provided
+			 * inline or from file: clients can then claim them back */
+			JANUS_VALIDATE_JSON_OBJECT(root, importsessions_parameters,
+				error_code, error_cause, FALSE,
+				JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
+			if(error_code != 0) {
+				ret = janus_process_error_string(request, session_id, transaction_text, error_code, error_cause);
+				goto jsondone;
+			}
+			const char *file = json_string_value(json_object_get(root, "file"));
+			json_t *snapshot = json_object_get(root, "snapshot");
+			if((file == NULL && snapshot == NULL) || (file != NULL && snapshot != NULL)) {
+				ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_INVALID_ELEMENT_TYPE, "Provide either a file or a snapshot");
+				goto jsondone;
+			}
+			if(file != NULL) {
+				json_error_t jerror;
+				snapshot = json_load_file(file, 0, &jerror);
+				if(snapshot == NULL) {
+					ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_UNKNOWN, "Error reading snapshot from '%s': %s", file, jerror.text);
+					goto jsondone;
+				}
+			} else {
+				json_incref(snapshot);
+			}
+			int handles_count = 0;
+			int sessions_count = janus_sessions_import(snapshot, &handles_count);
+			json_decref(snapshot);
+			if(sessions_count < 0) {
+				ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_INVALID_ELEMENT_TYPE, "Invalid or unsupported snapshot");
+				goto jsondone;
+			}
+			/* Prepare JSON reply */
+			json_t *reply = janus_create_message("success", 0, transaction_text);
+			json_object_set_new(reply, "sessions", json_integer(sessions_count));
+			json_object_set_new(reply, "handles", json_integer(handles_count));
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
 		} else if(!strcasecmp(message_text, "message_plugin")) {
 			/* Contact a plugin and expect a response */
 			JANUS_VALIDATE_JSON_OBJECT(root, messageplugin_parameters,
@@ -2618,26 +3425,87 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			ret = janus_process_success(request, reply);
 			goto jsondone;
 		} else if(!strcasecmp(message_text, "list_sessions")) {
-			/* List sessions */
+			/* List sessions: on large servers, this can be paginated */
 			session_id = 0;
-			json_t *list = json_array();
-			if(sessions != NULL && g_hash_table_size(sessions) > 0) {
-				janus_mutex_lock(&sessions_mutex);
-				GHashTableIter iter;
-				gpointer value;
-				g_hash_table_iter_init(&iter, sessions);
-				while (g_hash_table_iter_next(&iter, NULL, &value)) {
-					janus_session *session = value;
-					if(session == NULL) {
-						continue;
-					}
-					json_array_append_new(list, json_integer(session->session_id));
-				}
-				janus_mutex_unlock(&sessions_mutex);
+			JANUS_VALIDATE_JSON_OBJECT(root, listsessions_parameters,
+				error_code, error_cause, FALSE,
+				JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
+			if(error_code != 0) {
+				ret = janus_process_error_string(request, session_id, transaction_text, error_code, error_cause);
+				goto jsondone;
 			}
+			json_t *offset = json_object_get(root, "offset");
+			json_t *limit = json_object_get(root, "limit");
+			guint offset_num = offset ? json_integer_value(offset) : 0;
+			guint limit_num = limit ? json_integer_value(limit) : 0;
+			/* Copy the IDs first, and serialize them after releasing the locks */
+			GArray *ids = janus_admin_sessions_snapshot();
+			json_t *list = json_array();
+			guint i = 0;
+			for(i=offset_num; i<ids->len && (limit_num == 0 || i < offset_num+limit_num); i++)
+				json_array_append_new(list, json_integer(g_array_index(ids, guint64, i)));
 			/* Prepare JSON reply */
 			json_t *reply = janus_create_message("success", 0, transaction_text);
 			json_object_set_new(reply, "sessions", list);
+			if(offset || limit)
+				json_object_set_new(reply, "total", json_integer(ids->len));
+			g_array_free(ids, TRUE);
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
+		} else if(!strcasecmp(message_text, "list_handles")) {
+			/* List the handles of all sessions, optionally filtered by plugin,
+			 * state (idle, negotiating or connected) or static loop, and paginated */
+			session_id = 0;
+			JANUS_VALIDATE_JSON_OBJECT(root, listhandles_parameters,
+				error_code, error_cause, FALSE,
+				JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
+			if(error_code != 0) {
+				ret = janus_process_error_string(request, session_id, transaction_text, error_code, error_cause);
+				goto jsondone;
+			}
+			json_t *offset = json_object_get(root, "offset");
+			json_t *limit = json_object_get(root, "limit");
+			json_t *loop = json_object_get(root, "loop");
+			guint offset_num = offset ? json_integer_value(offset) : 0;
+			guint limit_num = limit ? json_integer_value(limit) : 0;
+			GArray *entries = janus_admin_handles_snapshot(json_string_value(json_object_get(root, "plugin")),
+				json_string_value(json_object_get(root, "state")), loop ? json_integer_value(loop) : -1);
+			json_t *list = json_array();
+			guint i = 0;
+			for(i=offset_num; i<entries->len && (limit_num == 0 || i < offset_num+limit_num); i++) {
+				janus_admin_handle_entry *entry = &g_array_index(entries, janus_admin_handle_entry, i);
+				json_t *h = json_object();
+				json_object_set_new(h, "session_id", json_integer(entry->session_id));
+				json_object_set_new(h, "handle_id", json_integer(entry->handle_id));
+				if(entry->plugin)
+					json_object_set_new(h, "plugin", json_string(entry->plugin));
+				json_object_set_new(h, "state", json_string(entry->state));
+				if(entry->loop != -1)
+					json_object_set_new(h, "loop", json_integer(entry->loop));
+				json_array_append_new(list, h);
+			}
+			/* Prepare JSON reply */
+			json_t *reply = janus_create_message("success", 0, transaction_text);
+			json_object_set_new(reply, "handles", list);
+			json_object_set_new(reply, "total", json_integer(entries->len));
+			g_array_free(entries, TRUE);
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
+		} else if(!strcasecmp(message_text, "summary")) {
+			/* Cheap overview of the load, only using counters we keep anyway */
+			session_id = 0;
+			json_t *reply = janus_create_message("success", 0, transaction_text);
+			json_t *summary = json_object();
+			json_object_set_new(summary, "sessions", json_integer(g_atomic_int_get(&sessions_num)));
+			json_object_set_new(summary, "handles", json_integer(g_atomic_int_get(&handles_num)));
+			json_object_set_new(summary, "peerconnections", json_integer(janus_ice_get_peerconnection_num()));
+			json_object_set_new(summary, "accepting-new-sessions", accept_new_sessions ? json_true() : json_false());
+			json_object_set_new(summary, "draining", draining ? json_true() : json_false());
+			if(janus_ice_get_static_event_loops() > 0)
+				json_object_set_new(summary, "loops", janus_ice_static_event_loops_info());
+			json_object_set_new(reply, "summary", summary);
 			/* Send the success reply */
 			ret = janus_process_success(request, reply);
 			goto jsondone;
@@ -2806,6 +3674,117 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			/* Prepare JSON reply */
 			json_t *reply = janus_create_message("success", 0, transaction_text);
 			json_object_set_new(reply, "loops", list);
+			/* Add the file descriptors each reactor loop is watching too */
+			json_object_set_new(reply, "reactor", janus_reactor_info());
+			/* If PeerConnections share the same sockets, add info on those as well */
+			json_t *mux = janus_ice_mux_info();
+			if(mux != NULL)
+				json_object_set_new(reply, "ice_mux", mux);
+			/* Add info on the pools of agents and SSL objects, and on how long the setup of PeerConnections takes */
+			json_object_set_new(reply, "pools", janus_ice_pools_info());
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
+		} else if(!strcasecmp(message_text, "scheduling_info")) {
+			/* Query the Janus core for the scheduling profile of media threads,
+			 * and for the cores and priorities each of them has been given */
+			json_t *reply = janus_create_message("success", 0, transaction_text);
+			json_object_set_new(reply, "scheduling", janus_sched_info());
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
+		} else if(!strcasecmp(message_text, "memory_info")) {
+			/* Estimate how much memory the core is using for handles, grouped by plugin:
+			 * we take references to sessions and handles first, so that we never
+			 * hold more than a lock at a time while we go through them */
+			GList *sessions_list = NULL, *handles_list = NULL, *temp = NULL;
+			int i = 0;
+			for(i=0; i<JANUS_SESSIONS_SHARDS; i++) {
+				janus_sessions_shard *shard = &sessions[i];
+				janus_rwlock_read_lock(&shard->lock);
+				if(shard->table != NULL) {
+					GHashTableIter iter;
+					gpointer value;
+					g_hash_table_iter_init(&iter, shard->table);
+					while(g_hash_table_iter_next(&iter, NULL, &value)) {
+						janus_session *session = value;
+						if(session == NULL || g_atomic_int_get(&session->destroyed))
+							continue;
+						janus_refcount_increase(&session->ref);
+						sessions_list = g_list_prepend(sessions_list, session);
+					}
+				}
+				janus_rwlock_read_unlock(&shard->lock);
+			}
+			for(temp = sessions_list; temp != NULL; temp = temp->next) {
+				janus_session *session = (janus_session *)temp->data;
+				janus_rwlock_read_lock(&session->handles_lock);
+				if(session->ice_handles != NULL) {
+					GHashTableIter iter;
+					gpointer value;
+					g_hash_table_iter_init(&iter, session->ice_handles);
+					while(g_hash_table_iter_next(&iter, NULL, &value)) {
+						janus_ice_handle *handle = value;
+						if(handle == NULL)
+							continue;
+						janus_refcount_increase(&handle->ref);
+						handles_list = g_list_prepend(handles_list, handle);
+					}
+				}
+				janus_rwlock_read_unlock(&session->handles_lock);
+				janus_refcount_decrease(&session->ref);
+			}
+			g_list_free(sessions_list);
+			json_t *plugins_info = json_object();
+			json_int_t total_handles = 0, total_bytes = 0;
+			for(temp = handles_list; temp != NULL; temp = temp->next) {
+				janus_ice_handle *handle = (janus_ice_handle *)temp->data;
+				janus_mutex_lock(&handle->mutex);
+				json_t *memory = janus_ice_handle_memory(handle);
+				janus_plugin *plugin = (janus_plugin *)handle->app;
+				const char *package = plugin ? plugin->get_package() : "none";
+				janus_mutex_unlock(&handle->mutex);
+				json_int_t bytes = json_integer_value(json_object_get(memory, "total"));
+				json_decref(memory);
+				json_t *p = json_object_get(plugins_info, package);
+				if(p == NULL) {
+					p = json_object();
+					json_object_set_new(p, "handles", json_integer(0));
+					json_object_set_new(p, "bytes", json_integer(0));
+					json_object_set_new(plugins_info, package, p);
+				}
+				json_int_t handles = json_integer_value(json_object_get(p, "handles")) + 1;
+				json_int_t plugin_bytes = json_integer_value(json_object_get(p, "bytes")) + bytes;
+				json_object_set_new(p, "handles", json_integer(handles));
+				json_object_set_new(p, "bytes", json_integer(plugin_bytes));
+				json_object_set_new(p, "bytes-per-handle", json_integer(plugin_bytes/handles));
+				total_handles++;
+				total_bytes += bytes;
+				janus_refcount_decrease(&handle->ref);
+			}
+			g_list_free(handles_list);
+			/* Prepare JSON reply */
+			json_t *reply = janus_create_message("success", 0, transaction_text);
+			json_t *memory = json_object();
+			json_object_set_new(memory, "handles", json_integer(total_handles));
+			json_object_set_new(memory, "bytes", json_integer(total_bytes));
+			json_object_set_new(memory, "bytes-per-handle", json_integer(total_handles ? total_bytes/total_handles : 0));
+			json_object_set_new(memory, "plugins", plugins_info);
+			json_object_set_new(reply, "memory", memory);
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
+		} else if(!strcasecmp(message_text, "recordings_info")) {
+			/* Query the Janus core to see how the asynchronous writing of recordings is doing */
+			json_t *reply = janus_create_message("success", 0, transaction_text);
+			json_object_set_new(reply, "recordings", janus_recorder_async_info());
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
+		} else if(!strcasecmp(message_text, "events_info")) {
+			/* Query the Janus core to see how the queue of each event handler is doing */
+			json_t *reply = janus_create_message("success", 0, transaction_text);
+			json_object_set_new(reply, "events", janus_events_info());
 			/* Send the success reply */
 			ret = janus_process_success(request, reply);
 			goto jsondone;
@@ -2857,10 +3836,7 @@ int janus_process_incoming_admin_request(janus_request *request) {
 	if(handle == NULL) {
 		/* Session-related */
 		if(!strcasecmp(message_text, "destroy_session")) {
-			janus_mutex_lock(&sessions_mutex);
-			if(g_hash_table_remove(sessions, &session->session_id))
-				g_atomic_int_dec_and_test(&sessions_num);
-			janus_mutex_unlock(&sessions_mutex);
+			janus_session_remove(session);
 			/* Notify the source that the session has been destroyed */
 			janus_request *source = janus_session_get_request(session);
 			if(source && source->transport)
@@ -2895,19 +3871,53 @@ int janus_process_incoming_admin_request(janus_request *request) {
 				ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_INVALID_ELEMENT_TYPE, "Invalid element type (timeout should be a non-negative integer or -1)");
 				goto jsondone;
 			}
-
-			/* Set specific session timeout */
-			janus_mutex_lock(&session->mutex);
-			session->timeout = timeout_num;
-			janus_mutex_unlock(&session->mutex);
-
+
+			/* Set specific session timeout */
+			janus_mutex_lock(&session->mutex);
+			session->timeout = timeout_num;
+			janus_mutex_unlock(&session->mutex);
+			janus_session_reschedule(session);
+
+			/* Prepare JSON reply */
+			json_t *reply = json_object();
+			json_object_set_new(reply, "janus", json_string("success"));
+			json_object_set_new(reply, "transaction", json_string(transaction_text));
+			json_object_set_new(reply, "timeout", json_integer(timeout_num));
+			json_object_set_new(reply, "session_id", json_integer(session_id));
+
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
+		} else if(!strcasecmp(message_text, "set_log_level")) {
+			/* Change the log level for all the handles of this session only */
+			JANUS_VALIDATE_JSON_OBJECT(root, level_parameters,
+				error_code, error_cause, FALSE,
+				JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
+			if(error_code != 0) {
+				ret = janus_process_error_string(request, session_id, transaction_text, error_code, error_cause);
+				goto jsondone;
+			}
+			int level_num = json_integer_value(json_object_get(root, "level"));
+			if(level_num < LOG_NONE || level_num > LOG_MAX) {
+				ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_INVALID_ELEMENT_TYPE, "Invalid element type (level should be between %d and %d)", LOG_NONE, LOG_MAX);
+				goto jsondone;
+			}
+			janus_rwlock_read_lock(&session->handles_lock);
+			g_atomic_int_set(&session->log_level, level_num);
+			if(session->ice_handles != NULL) {
+				GHashTableIter iter;
+				gpointer value;
+				g_hash_table_iter_init(&iter, session->ice_handles);
+				while(g_hash_table_iter_next(&iter, NULL, &value)) {
+					janus_ice_handle *h = value;
+					if(h != NULL)
+						g_atomic_int_set(&h->session_log_level, level_num);
+				}
+			}
+			janus_rwlock_read_unlock(&session->handles_lock);
 			/* Prepare JSON reply */
-			json_t *reply = json_object();
-			json_object_set_new(reply, "janus", json_string("success"));
-			json_object_set_new(reply, "transaction", json_string(transaction_text));
-			json_object_set_new(reply, "timeout", json_integer(timeout_num));
-			json_object_set_new(reply, "session_id", json_integer(session_id));
-
+			json_t *reply = janus_create_message("success", session_id, transaction_text);
+			json_object_set_new(reply, "level", json_integer(level_num));
 			/* Send the success reply */
 			ret = janus_process_success(request, reply);
 			goto jsondone;
@@ -2955,8 +3965,9 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			/* Send the success reply */
 			ret = janus_process_success(request, reply);
 			goto jsondone;
-		} else if(!strcasecmp(message_text, "start_pcap") || !strcasecmp(message_text, "start_text2pcap")) {
-			/* Start dumping RTP and RTCP packets to a pcap or text2pcap file */
+		} else if(!strcasecmp(message_text, "start_pcap") || !strcasecmp(message_text, "start_pcapng") ||
+				!strcasecmp(message_text, "start_text2pcap")) {
+			/* Start dumping RTP and RTCP packets to a pcap, pcapng or text2pcap file */
 			JANUS_VALIDATE_JSON_OBJECT(root, text2pcap_parameters,
 				error_code, error_cause, FALSE,
 				JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
@@ -2965,15 +3976,20 @@ int janus_process_incoming_admin_request(janus_request *request) {
 				goto jsondone;
 			}
 			gboolean text = !strcasecmp(message_text, "start_text2pcap");
+			janus_text2pcap_format format = text ? JANUS_TEXT2PCAP_FORMAT_TEXT :
+				(!strcasecmp(message_text, "start_pcapng") ? JANUS_TEXT2PCAP_FORMAT_PCAPNG : JANUS_TEXT2PCAP_FORMAT_PCAP);
 			const char *folder = json_string_value(json_object_get(root, "folder"));
 			const char *filename = json_string_value(json_object_get(root, "filename"));
 			int truncate = json_integer_value(json_object_get(root, "truncate"));
+			/* Optional limits: size in bytes, duration in seconds */
+			guint64 max_size = json_integer_value(json_object_get(root, "max_size"));
+			guint max_duration = json_integer_value(json_object_get(root, "max_duration"));
 			if(handle->text2pcap != NULL) {
 				ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_UNKNOWN,
 					text ? "text2pcap already started" : "pcap already started");
 				goto jsondone;
 			}
-			handle->text2pcap = janus_text2pcap_create(folder, filename, truncate, text);
+			handle->text2pcap = janus_text2pcap_create_full(folder, filename, truncate, format, max_size, max_duration);
 			if(handle->text2pcap == NULL) {
 				ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_UNKNOWN,
 					text ? "Error starting text2pcap dump" : "Error starting pcap dump");
@@ -2987,8 +4003,30 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			/* Send the success reply */
 			ret = janus_process_success(request, reply);
 			goto jsondone;
-		} else if(!strcasecmp(message_text, "stop_pcap") || !strcasecmp(message_text, "stop_text2pcap")) {
-			/* Stop dumping RTP and RTCP packets to a pcap or text2pcap file */
+		} else if(!strcasecmp(message_text, "set_log_level")) {
+			/* Change the log level for this handle only */
+			JANUS_VALIDATE_JSON_OBJECT(root, level_parameters,
+				error_code, error_cause, FALSE,
+				JANUS_ERROR_MISSING_MANDATORY_ELEMENT, JANUS_ERROR_INVALID_ELEMENT_TYPE);
+			if(error_code != 0) {
+				ret = janus_process_error_string(request, session_id, transaction_text, error_code, error_cause);
+				goto jsondone;
+			}
+			int level_num = json_integer_value(json_object_get(root, "level"));
+			if(level_num < LOG_NONE || level_num > LOG_MAX) {
+				ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_INVALID_ELEMENT_TYPE, "Invalid element type (level should be between %d and %d)", LOG_NONE, LOG_MAX);
+				goto jsondone;
+			}
+			g_atomic_int_set(&handle->log_level, level_num);
+			/* Prepare JSON reply */
+			json_t *reply = janus_create_message("success", session_id, transaction_text);
+			json_object_set_new(reply, "level", json_integer(level_num));
+			/* Send the success reply */
+			ret = janus_process_success(request, reply);
+			goto jsondone;
+		} else if(!strcasecmp(message_text, "stop_pcap") || !strcasecmp(message_text, "stop_pcapng") ||
+				!strcasecmp(message_text, "stop_text2pcap")) {
+			/* Stop dumping RTP and RTCP packets to a pcap, pcapng or text2pcap file */
 			if(handle->text2pcap == NULL) {
 				ret = janus_process_error(request, session_id, transaction_text, JANUS_ERROR_UNKNOWN,
 					"Capture not started");
@@ -3039,23 +4077,15 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			g_main_loop_is_running(handle->mainloop)) ? json_true() : json_false());
 		json_object_set_new(info, "created", json_integer(handle->created));
 		json_object_set_new(info, "current_time", json_integer(janus_get_monotonic_time()));
+		/* We'll query the plugin after releasing the handle lock, as that
+		 * can take a while, and would block the handle in the meanwhile */
+		janus_plugin *plugin = NULL;
+		janus_plugin_session *app_handle = NULL;
 		if(handle->app && janus_plugin_session_is_alive(handle->app_handle)) {
-			janus_plugin *plugin = (janus_plugin *)handle->app;
+			plugin = (janus_plugin *)handle->app;
+			app_handle = handle->app_handle;
+			janus_refcount_increase(&app_handle->ref);
 			json_object_set_new(info, "plugin", json_string(plugin->get_package()));
-			if(plugin->query_session) {
-				/* FIXME This check will NOT work with legacy plugins that were compiled BEFORE the method was specified in plugin.h */
-				json_t *query = plugin->query_session(handle->app_handle);
-				if(query != NULL) {
-					/* Make sure this is a JSON object */
-					if(!json_is_object(query)) {
-						JANUS_LOG(LOG_WARN, "Ignoring invalid query response from the plugin (not an object)\n");
-						json_decref(query);
-					} else {
-						json_object_set_new(info, "plugin_specific", query);
-					}
-					query = NULL;
-				}
-			}
 		}
 		if(plugin_only)
 			goto info_done;
@@ -3100,22 +4130,53 @@ int janus_process_incoming_admin_request(janus_request *request) {
 			json_object_set_new(info, "pending-trickles", json_integer(g_list_length(handle->pending_trickles)));
 		if(handle->queued_packets)
 			json_object_set_new(info, "queued-packets", json_integer(g_async_queue_length(handle->queued_packets)));
+		if(g_atomic_int_get(&handle->queue_overflows) > 0)
+			json_object_set_new(info, "queue-overflows", json_integer(g_atomic_int_get(&handle->queue_overflows)));
+		if(g_atomic_int_get(&handle->log_level) > 0)
+			json_object_set_new(info, "log-level", json_integer(g_atomic_int_get(&handle->log_level)));
+		if(g_atomic_int_get(&handle->session_log_level) > 0)
+			json_object_set_new(info, "session-log-level", json_integer(g_atomic_int_get(&handle->session_log_level)));
 		if(g_atomic_int_get(&handle->dump_packets) && handle->text2pcap) {
 			if(handle->text2pcap->text) {
 				json_object_set_new(info, "dump-to-text2pcap", json_true());
 				json_object_set_new(info, "text2pcap-file", json_string(handle->text2pcap->filename));
+			} else if(handle->text2pcap->format == JANUS_TEXT2PCAP_FORMAT_PCAPNG) {
+				json_object_set_new(info, "dump-to-pcapng", json_true());
+				json_object_set_new(info, "pcapng-file", json_string(handle->text2pcap->filename));
+				json_object_set_new(info, "pcapng-dropped", json_integer(g_atomic_int_get(&handle->text2pcap->dropped)));
 			} else {
 				json_object_set_new(info, "dump-to-pcap", json_true());
 				json_object_set_new(info, "pcap-file", json_string(handle->text2pcap->filename));
 			}
+			if(g_atomic_int_get(&handle->text2pcap->capped))
+				json_object_set_new(info, "capture-capped", json_true());
 		}
 		if(handle->pc) {
 			json_t *p = janus_admin_peerconnection_summary(handle->pc);
 			if(p)
 				json_object_set_new(info, "webrtc", p);
 		}
+		/* Add an estimate of how much memory the core uses for this handle */
+		json_object_set_new(info, "memory", janus_ice_handle_memory(handle));
 info_done:
 		janus_mutex_unlock(&handle->mutex);
+		if(app_handle != NULL) {
+			if(plugin->query_session) {
+				/* FIXME This check will NOT work with legacy plugins that were compiled BEFORE the method was specified in plugin.h */
+				json_t *query = plugin->query_session(app_handle);
+				if(query != NULL) {
+					/* Make sure this is a JSON object */
+					if(!json_is_object(query)) {
+						JANUS_LOG(LOG_WARN, "Ignoring invalid query response from the plugin (not an object)\n");
+						json_decref(query);
+					} else {
+						json_object_set_new(info, "plugin_specific", query);
+					}
+					query = NULL;
+				}
+			}
+			janus_refcount_decrease(&app_handle->ref);
+		}
 		/* Prepare JSON reply */
 		json_t *reply = janus_create_message("success", session_id, transaction_text);
 		json_object_set_new(reply, "handle_id", json_integer(handle_id));
@@ -3140,7 +4201,10 @@ int janus_process_success(janus_request *request, json_t *payload)
 		return -1;
 	/* Pass to the right transport plugin */
 	JANUS_LOG(LOG_HUGE, "Sending %s API response to %s (%p)\n", request->admin ? "admin" : "Janus", request->transport->get_package(), request->instance);
-	return request->transport->send_message(request->instance, request->request_id, request->admin, payload);
+	JANUS_PROBE2(transport_send_start, request->instance, request->admin);
+	int ret = request->transport->send_message(request->instance, request->request_id, request->admin, payload);
+	JANUS_PROBE1(transport_send_done, request->instance);
+	return ret;
 }
 
 static int janus_process_error_string(janus_request *request, uint64_t session_id, const char *transaction, gint error, gchar *error_string)
@@ -3156,7 +4220,10 @@ static int janus_process_error_string(janus_request *request, uint64_t session_i
 	json_object_set_new(error_data, "reason", json_string(error_string));
 	json_object_set_new(reply, "error", error_data);
 	/* Pass to the right transport plugin */
-	return request->transport->send_message(request->instance, request->request_id, request->admin, reply);
+	JANUS_PROBE2(transport_send_start, request->instance, request->admin);
+	int ret = request->transport->send_message(request->instance, request->request_id, request->admin, reply);
+	JANUS_PROBE1(transport_send_done, request->instance);
+	return ret;
 }
 
 int janus_process_error(janus_request *request, uint64_t session_id, const char *transaction, gint error, const char *format, ...)
@@ -3190,7 +4257,7 @@ json_t *janus_admin_peerconnection_summary(janus_ice_peerconnection *pc) {
 	json_object_set_new(i, "state", json_string(janus_get_ice_state_name(pc->state)));
 	if(pc->icefailed_detected) {
 		json_object_set_new(i, "failed-detected", json_integer(pc->icefailed_detected));
-		json_object_set_new(i, "icetimer-started", pc->icestate_source ? json_true() : json_false());
+		json_object_set_new(i, "icetimer-started", pc->icestate_timer ? json_true() : json_false());
 	}
 	if(pc->gathered > 0)
 		json_object_set_new(i, "gathered", json_integer(pc->gathered));
@@ -3220,11 +4287,22 @@ json_t *janus_admin_peerconnection_summary(janus_ice_peerconnection *pc) {
 		json_object_set_new(i, "selected-pair", json_string(pc->selected_pair));
 	}
 	json_object_set_new(i, "ready", json_integer(pc->cdone));
+	if(pc->handle->send_batches > 0) {
+		json_object_set_new(i, "send-batches", json_integer(pc->handle->send_batches));
+		json_object_set_new(i, "send-batched-packets", json_integer(pc->handle->send_batched_packets));
+	}
+	json_t *pacer = janus_ice_pacer_summary(pc->handle);
+	if(pacer != NULL)
+		json_object_set_new(i, "pacer", pacer);
 	json_object_set_new(w, "ice", i);
 	json_t *d = json_object();
 	if(pc->dtls) {
 		janus_dtls_srtp *dtls = pc->dtls;
-		json_object_set_new(d, "fingerprint", json_string(janus_dtls_get_local_fingerprint()));
+		const char *fingerprint = janus_dtls_srtp_get_fingerprint(dtls, 0);
+		json_object_set_new(d, "fingerprint", json_string(fingerprint ? fingerprint : janus_dtls_get_local_fingerprint()));
+		fingerprint = janus_dtls_srtp_get_fingerprint(dtls, 1);
+		if(fingerprint)
+			json_object_set_new(d, "fallback-fingerprint", json_string(fingerprint));
 		if(pc->remote_fingerprint)
 			json_object_set_new(d, "remote-fingerprint", json_string(pc->remote_fingerprint));
 		if(pc->remote_hashing)
@@ -3238,8 +4316,10 @@ json_t *janus_admin_peerconnection_summary(janus_ice_peerconnection *pc) {
 		json_object_set_new(d, "ready", dtls->ready ? json_true() : json_false());
 		if(dtls->dtls_started > 0)
 			json_object_set_new(d, "handshake-started", json_integer(dtls->dtls_started));
-		if(dtls->dtls_connected > 0)
+		if(dtls->dtls_connected > 0) {
 			json_object_set_new(d, "connected", json_integer(dtls->dtls_connected));
+			json_object_set_new(d, "resumed", dtls->resumed ? json_true() : json_false());
+		}
 #ifdef HAVE_SCTP
 		/* FIXME Actually check if this succeeded? */
 		json_object_set_new(d, "sctp-association", dtls->sctp ? json_true() : json_false());
@@ -3282,6 +4362,7 @@ json_t *janus_admin_peerconnection_summary(janus_ice_peerconnection *pc) {
 	json_object_set_new(bwe, "twcc", pc->do_transport_wide_cc ? json_true() : json_false());
 	if(pc->transport_wide_cc_ext_id >= 0)
 		json_object_set_new(bwe, "twcc-ext-id", json_integer(pc->transport_wide_cc_ext_id));
+	janus_bwe_context_summary(pc->bwe, bwe);
 	json_object_set_new(w, "bwe", bwe);
 	json_t *media = json_object();
 	/* Iterate on all media */
@@ -3328,12 +4409,20 @@ json_t *janus_admin_peerconnection_medium_summary(janus_ice_peerconnection_mediu
 		json_object_set_new(m, "do_nacks", medium->do_nacks ? json_true() : json_false());
 		json_object_set_new(m, "nack-queue-ms", json_integer(medium->nack_queue_ms));
 	}
+	if(medium->type == JANUS_MEDIA_VIDEO && medium->fec_payload_type > 0) {
+		json_t *fec = json_object();
+		json_object_set_new(fec, "payload-type", json_integer(medium->fec_payload_type));
+		janus_fec_context_summary(medium->fec, fec);
+		json_object_set_new(m, "flexfec", fec);
+	}
 	if(medium->type != JANUS_MEDIA_DATA) {
 		json_t *ms = json_object();
 		if(medium->ssrc)
 			json_object_set_new(ms, "ssrc", json_integer(medium->ssrc));
 		if(medium->ssrc_rtx)
 			json_object_set_new(ms, "ssrc-rtx", json_integer(medium->ssrc_rtx));
+		if(medium->ssrc_fec)
+			json_object_set_new(ms, "ssrc-fec", json_integer(medium->ssrc_fec));
 		if(medium->ssrc_peer[0])
 			json_object_set_new(ms, "ssrc-peer", json_integer(medium->ssrc_peer[0]));
 		if(medium->ssrc_peer[1])
@@ -3469,10 +4558,44 @@ void janus_transportso_close(gpointer key, gpointer value, gpointer user_data) {
 }
 
 /* Transport callback interface */
+/* Keepalives are by far the most frequent Janus API requests, and all they do is
+ * refresh the session: we handle the well formed ones as soon as they arrive,
+ * rather than queueing them for the requests thread and the generic validation.
+ * Anything unusual, including errors, still goes through the regular path */
+static gboolean janus_process_keepalive(janus_request *request) {
+	json_t *root = request->message;
+	const char *message_text = json_string_value(json_object_get(root, "janus"));
+	if(message_text == NULL || strcasecmp(message_text, "keepalive"))
+		return FALSE;
+	json_t *s = json_object_get(root, "session_id");
+	const char *transaction_text = json_string_value(json_object_get(root, "transaction"));
+	if(!json_is_integer(s) || json_integer_value(s) < 1 || transaction_text == NULL ||
+			json_object_get(root, "handle_id") != NULL)
+		return FALSE;
+	guint64 session_id = json_integer_value(s);
+	if(janus_request_check_secret(request, session_id, transaction_text) != 0)
+		return FALSE;
+	janus_session *session = janus_session_find(session_id);
+	if(session == NULL)
+		return FALSE;
+	/* Update the last activity timer, and reply with an ack */
+	session->last_activity = janus_get_monotonic_time();
+	JANUS_LOG(LOG_VERB, "Got a keep-alive on session %"SCNu64"\n", session_id);
+	json_t *reply = janus_create_message("ack", session_id, transaction_text);
+	janus_process_success(request, reply);
+	janus_refcount_decrease(&session->ref);
+	return TRUE;
+}
+
 void janus_transport_incoming_request(janus_transport *plugin, janus_transport_session *transport, void *request_id, gboolean admin, json_t *message, json_error_t *error) {
 	JANUS_LOG(LOG_VERB, "Got %s API request from %s (%p)\n", admin ? "an admin" : "a Janus", plugin->get_package(), transport);
 	/* Create a janus_request instance to handle the request */
 	janus_request *request = janus_request_new(plugin, transport, request_id, admin, message, message ? NULL : error);
+	if(!admin && message != NULL && janus_process_keepalive(request)) {
+		/* Done already, no need to involve the requests thread */
+		janus_request_destroy(request);
+		return;
+	}
 	/* Enqueue the request, the thread will pick it up */
 	g_async_queue_push(requests, request);
 }
@@ -3480,11 +4603,17 @@ void janus_transport_incoming_request(janus_transport *plugin, janus_transport_s
 void janus_transport_gone(janus_transport *plugin, janus_transport_session *transport) {
 	/* Get rid of sessions this transport was handling */
 	JANUS_LOG(LOG_VERB, "A %s transport instance has gone away (%p)\n", plugin->get_package(), transport);
-	janus_mutex_lock(&sessions_mutex);
-	if(sessions && g_hash_table_size(sessions) > 0) {
+	int i = 0;
+	for(i=0; i<JANUS_SESSIONS_SHARDS; i++) {
+		janus_sessions_shard *shard = &sessions[i];
+		janus_rwlock_write_lock(&shard->lock);
+		if(shard->table == NULL) {
+			janus_rwlock_write_unlock(&shard->lock);
+			continue;
+		}
 		GHashTableIter iter;
 		gpointer value;
-		g_hash_table_iter_init(&iter, sessions);
+		g_hash_table_iter_init(&iter, shard->table);
 		while(g_hash_table_iter_next(&iter, NULL, &value)) {
 			janus_session *session = (janus_session *) value;
 			if(!session || g_atomic_int_get(&session->destroyed) || g_atomic_int_get(&session->timedout) || session->last_activity == 0)
@@ -3496,14 +4625,16 @@ void janus_transport_gone(janus_transport *plugin, janus_transport_session *tran
 					/* Mark the session as destroyed */
 					janus_session_destroy(session);
 					g_hash_table_iter_remove(&iter);
+					g_atomic_int_dec_and_test(&sessions_num);
 				} else {
 					/* Set flag for transport_gone. The Janus sessions watchdog will clean this up if not reclaimed */
 					g_atomic_int_set(&session->transport_gone, 1);
+					janus_session_schedule(shard, session);
 				}
 			}
 		}
+		janus_rwlock_write_unlock(&shard->lock);
 	}
-	janus_mutex_unlock(&sessions_mutex);
 }
 
 gboolean janus_transport_is_api_secret_needed(janus_transport *plugin) {
@@ -3526,6 +4657,11 @@ gboolean janus_transport_is_auth_token_valid(janus_transport *plugin, const char
 	return token && janus_auth_check_token(token);
 }
 
+gboolean janus_transport_events_is_enabled(void) {
+	/* Transports only prepare events if some handler will actually get them */
+	return janus_events_is_interested(JANUS_EVENT_TYPE_TRANSPORT);
+}
+
 void janus_transport_notify_event(janus_transport *plugin, void *transport, json_t *event) {
 	/* A plugin asked to notify an event to the handlers */
 	if(!plugin || !event || !json_is_object(event))
@@ -3539,6 +4675,109 @@ void janus_transport_notify_event(janus_transport *plugin, void *transport, json
 	}
 }
 
+char *janus_transport_get_metrics(janus_transport *plugin) {
+	GString *output = g_string_new(NULL);
+	/* Counters and histograms updated by the core */
+	janus_metrics_print(output);
+	/* Gauges we can get without iterating on sessions and handles */
+	janus_metrics_print_family(output, "janus_sessions", "gauge", "Active Janus sessions");
+	janus_metrics_print_sample(output, "janus_sessions", NULL, g_atomic_int_get(&sessions_num));
+	janus_metrics_print_family(output, "janus_peerconnections", "gauge", "Active PeerConnections");
+	janus_metrics_print_sample(output, "janus_peerconnections", NULL, janus_ice_get_peerconnection_num());
+	janus_metrics_print_family(output, "janus_recorder_overflows", "counter", "Frames recorders dropped because their buffers were full");
+	janus_metrics_print_sample(output, "janus_recorder_overflows_total", NULL, janus_recorder_async_overflows());
+	janus_metrics_print_family(output, "janus_recorder_degraded_frames", "counter", "Video frames recorders dropped because they were over the memory budget");
+	janus_metrics_print_sample(output, "janus_recorder_degraded_frames_total", NULL, janus_recorder_async_degraded());
+	janus_metrics_print_family(output, "janus_recorder_queued_bytes", "gauge", "Bytes recorders queued that are waiting to be written");
+	janus_metrics_print_sample(output, "janus_recorder_queued_bytes", NULL, (double)janus_recorder_async_queued());
+	janus_metrics_print_family(output, "janus_recorder_written_bytes", "counter", "Bytes written by the recorder writer threads");
+	janus_metrics_print_sample(output, "janus_recorder_written_bytes_total", NULL, (double)janus_recorder_async_written());
+	char labels[64];
+	size_t i = 0;
+	json_t *loops = janus_ice_static_event_loops_info();
+	if(json_array_size(loops) > 0) {
+		janus_metrics_print_family(output, "janus_event_loop_cpu_load", "gauge", "CPU usage of each static event loop (percentage)");
+		for(i=0; i<json_array_size(loops); i++) {
+			json_t *loop = json_array_get(loops, i);
+			g_snprintf(labels, sizeof(labels), "loop=\"%"JSON_INTEGER_FORMAT"\"", json_integer_value(json_object_get(loop, "id")));
+			janus_metrics_print_sample(output, "janus_event_loop_cpu_load", labels, json_real_value(json_object_get(loop, "cpu-load")));
+		}
+		janus_metrics_print_family(output, "janus_event_loop_packets_per_second", "gauge", "Packets handled by each static event loop in the last second");
+		for(i=0; i<json_array_size(loops); i++) {
+			json_t *loop = json_array_get(loops, i);
+			g_snprintf(labels, sizeof(labels), "loop=\"%"JSON_INTEGER_FORMAT"\"", json_integer_value(json_object_get(loop, "id")));
+			janus_metrics_print_sample(output, "janus_event_loop_packets_per_second", labels, json_integer_value(json_object_get(loop, "packets-per-second")));
+		}
+		janus_metrics_print_family(output, "janus_event_loop_handles", "gauge", "Handles served by each static event loop");
+		for(i=0; i<json_array_size(loops); i++) {
+			json_t *loop = json_array_get(loops, i);
+			g_snprintf(labels, sizeof(labels), "loop=\"%"JSON_INTEGER_FORMAT"\"", json_integer_value(json_object_get(loop, "id")));
+			janus_metrics_print_sample(output, "janus_event_loop_handles", labels, json_integer_value(json_object_get(loop, "handles")));
+		}
+	}
+	json_decref(loops);
+	if(janus_events_is_enabled()) {
+		json_t *events = janus_events_info();
+		json_t *handlers = json_object_get(events, "handlers");
+		janus_metrics_print_family(output, "janus_eventhandler_queued", "gauge", "Events waiting to be delivered to each event handler");
+		for(i=0; i<json_array_size(handlers); i++) {
+			json_t *h = json_array_get(handlers, i);
+			g_snprintf(labels, sizeof(labels), "handler=\"%s\"", json_string_value(json_object_get(h, "package")));
+			janus_metrics_print_sample(output, "janus_eventhandler_queued", labels, json_integer_value(json_object_get(h, "queued")));
+		}
+		janus_metrics_print_family(output, "janus_eventhandler_dropped", "counter", "Events dropped because the queue of an event handler was full");
+		for(i=0; i<json_array_size(handlers); i++) {
+			json_t *h = json_array_get(handlers, i);
+			g_snprintf(labels, sizeof(labels), "handler=\"%s\"", json_string_value(json_object_get(h, "package")));
+			janus_metrics_print_sample(output, "janus_eventhandler_dropped_total", labels, json_integer_value(json_object_get(h, "dropped")));
+		}
+		json_decref(events);
+	}
+	g_string_append(output, "# EOF\n");
+	return g_string_free(output, FALSE);
+}
+
+static void janus_transport_process(janus_request *request) {
+	gint64 queued = janus_get_monotonic_time() - request->received;
+	janus_metrics_observe(JANUS_METRICS_REQUEST_LATENCY, queued / 1000);
+	JANUS_PROBE3(request_start, request, request->admin, queued);
+	if(!request->admin)
+		janus_process_incoming_request(request);
+	else
+		janus_process_incoming_admin_request(request);
+	JANUS_PROBE1(request_done, request);
+}
+
+/* The task pool serves requests without an SDP first, as negotiations
+ * are typically much heavier for plugins: other requests are served in
+ * the order they were received. Since there's at most one request per
+ * session in the pool, this doesn't affect the ordering within a session */
+static gint janus_transport_task_compare(gconstpointer a, gconstpointer b, gpointer user_data) {
+	const janus_request *ra = (const janus_request *)a, *rb = (const janus_request *)b;
+	gboolean jsep_a = json_object_get(ra->message, "jsep") != NULL;
+	gboolean jsep_b = json_object_get(rb->message, "jsep") != NULL;
+	if(jsep_a != jsep_b)
+		return jsep_a ? 1 : -1;
+	return ra->received < rb->received ? -1 : (ra->received > rb->received ? 1 : 0);
+}
+
+static void janus_transport_task_done(janus_request *request);
+static void janus_transport_task_push(janus_request *request) {
+	GError *tperror = NULL;
+	g_thread_pool_push(tasks, request, &tperror);
+	if(tperror != NULL) {
+		/* Something went wrong... */
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to push task in thread pool...\n",
+			tperror->code, tperror->message ? tperror->message : "??");
+		g_error_free(tperror);
+		json_t *transaction = json_object_get(request->message, "transaction");
+		const char *transaction_text = json_is_string(transaction) ? json_string_value(transaction) : NULL;
+		janus_process_error(request, 0, transaction_text, JANUS_ERROR_UNKNOWN, "Thread pool error");
+		/* Move on to the next request of the session, if any */
+		janus_transport_task_done(request);
+	}
+}
+
 void janus_transport_task(gpointer data, gpointer user_data) {
 	JANUS_LOG(LOG_VERB, "Transport task pool, serving request\n");
 	janus_request *request = (janus_request *)data;
@@ -3546,12 +4785,28 @@ void janus_transport_task(gpointer data, gpointer user_data) {
 		JANUS_LOG(LOG_ERR, "Missing request\n");
 		return;
 	}
-	if(!request->admin)
-		janus_process_incoming_request(request);
-	else
-		janus_process_incoming_admin_request(request);
+	janus_transport_process(request);
+	janus_transport_task_done(request);
+}
+
+static void janus_transport_task_done(janus_request *request) {
+	guint64 session_id = request->queued_session;
 	/* Done */
 	janus_request_destroy(request);
+	if(session_id == 0)
+		return;
+	/* Check if there are other requests for this session to serve */
+	janus_request *next = NULL;
+	janus_mutex_lock(&session_tasks_mutex);
+	GQueue *queue = session_tasks ? g_hash_table_lookup(session_tasks, &session_id) : NULL;
+	if(queue != NULL) {
+		next = g_queue_pop_head(queue);
+		if(next == NULL)
+			g_hash_table_remove(session_tasks, &session_id);
+	}
+	janus_mutex_unlock(&session_tasks_mutex);
+	if(next != NULL)
+		janus_transport_task_push(next);
 }
 
 
@@ -3566,30 +4821,38 @@ static void *janus_transport_requests(void *data) {
 			break;
 		/* Should we process the request synchronously or with a task from the thread pool? */
 		destroy = TRUE;
-		/* Process the request synchronously only it's not a message for a plugin */
 		json_t *message = json_object_get(request->message, "janus");
 		const gchar *message_text = json_string_value(message);
-		if(message_text && !strcasecmp(message_text, request->admin ? "message_plugin" : "message")) {
-			/* Spawn a task thread */
-			GError *tperror = NULL;
-			g_thread_pool_push(tasks, request, &tperror);
-			if(tperror != NULL) {
-				/* Something went wrong... */
-				JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to push task in thread pool...\n",
-					tperror->code, tperror->message ? tperror->message : "??");
-				g_error_free(tperror);
-				json_t *transaction = json_object_get(message, "transaction");
-				const char *transaction_text = json_is_string(transaction) ? json_string_value(transaction) : NULL;
-				janus_process_error(request, 0, transaction_text, JANUS_ERROR_UNKNOWN, "Thread pool error");
-			} else {
-				/* Don't destroy the request now, the task will take care of that */
+		gboolean task = message_text && !strcasecmp(message_text, request->admin ? "message_plugin" : "message");
+		/* Requests that tear things down are always served right away */
+		gboolean urgent = message_text && (!strcasecmp(message_text, "hangup") ||
+			!strcasecmp(message_text, "detach") || !strcasecmp(message_text, "destroy"));
+		json_t *s = request->admin ? NULL : json_object_get(request->message, "session_id");
+		guint64 session_id = json_is_integer(s) ? json_integer_value(s) : 0;
+		if(session_id > 0 && !urgent) {
+			janus_mutex_lock(&session_tasks_mutex);
+			GQueue *queue = session_tasks ? g_hash_table_lookup(session_tasks, &session_id) : NULL;
+			if(queue != NULL) {
+				/* There's a request for this session in the pool already, queue this one after it */
+				request->queued_session = session_id;
+				g_queue_push_tail(queue, request);
 				destroy = FALSE;
+			} else if(task && session_tasks != NULL) {
+				/* The pool will serve this session's requests until its queue is empty */
+				request->queued_session = session_id;
+				g_hash_table_insert(session_tasks, janus_uint64_dup(session_id), g_queue_new());
 			}
+			janus_mutex_unlock(&session_tasks_mutex);
+			if(!destroy)
+				continue;
+		}
+		if(task) {
+			/* Spawn a task thread: the task will destroy the request when done */
+			janus_transport_task_push(request);
+			destroy = FALSE;
 		} else {
-			if(!request->admin)
-				janus_process_incoming_request(request);
-			else
-				janus_process_incoming_admin_request(request);
+			/* Process the request synchronously, as it's not a message for a plugin */
+			janus_transport_process(request);
 		}
 		/* Done */
 		if(destroy)
@@ -3745,6 +5008,54 @@ int janus_plugin_push_event(janus_plugin_session *plugin_session, janus_plugin *
 	return JANUS_OK;
 }
 
+int janus_plugin_push_event_broadcast(janus_plugin_session **plugin_sessions, guint count, janus_plugin *plugin, json_t *message) {
+	if(!plugin || !message || (count > 0 && plugin_sessions == NULL))
+		return -1;
+	/* Make sure this is a JSON object */
+	if(!json_is_object(message)) {
+		JANUS_LOG(LOG_ERR, "Cannot broadcast event (JSON error: not an object)\n");
+		return JANUS_ERROR_INVALID_JSON_OBJECT;
+	}
+	/* The plugin data is the same for everybody, so we only prepare it once:
+	 * the events we send to each peer will all reference the same object,
+	 * and transports that support it will only serialize it once as well */
+	json_t *plugin_data = json_object();
+	json_object_set_new(plugin_data, "plugin", json_string(plugin->get_package()));
+	json_object_set(plugin_data, "data", message);
+	janus_transport_payload *payload = janus_transport_payload_create("plugindata", plugin_data);
+	json_decref(plugin_data);
+	int sent = 0;
+	guint i = 0;
+	for(i=0; i<count; i++) {
+		janus_plugin_session *plugin_session = plugin_sessions[i];
+		if(!janus_plugin_session_is_alive(plugin_session))
+			continue;
+		janus_refcount_increase(&plugin_session->ref);
+		janus_ice_handle *ice_handle = (janus_ice_handle *)plugin_session->gateway_handle;
+		if(!ice_handle || janus_flags_is_set(&ice_handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_STOP)) {
+			janus_refcount_decrease(&plugin_session->ref);
+			continue;
+		}
+		janus_refcount_increase(&ice_handle->ref);
+		janus_session *session = ice_handle->session;
+		if(session && !g_atomic_int_get(&session->destroyed)) {
+			/* Prepare JSON event */
+			json_t *event = janus_create_message("event", session->session_id, NULL);
+			json_object_set_new(event, "sender", json_integer(ice_handle->handle_id));
+			if(janus_is_opaqueid_in_api_enabled() && ice_handle->opaque_id != NULL)
+				json_object_set_new(event, "opaque_id", json_string(ice_handle->opaque_id));
+			/* Send the event */
+			JANUS_LOG(LOG_VERB, "[%"SCNu64"] Sending broadcast event to transport...\n", ice_handle->handle_id);
+			janus_session_notify_event_prepared(session, event, payload);
+			sent++;
+		}
+		janus_refcount_decrease(&plugin_session->ref);
+		janus_refcount_decrease(&ice_handle->ref);
+	}
+	janus_refcount_decrease(&payload->ref);
+	return sent;
+}
+
 json_t *janus_plugin_handle_sdp(janus_plugin_session *plugin_session, janus_plugin *plugin, const char *sdp_type, const char *sdp, gboolean restart) {
 	if(!janus_plugin_session_is_alive(plugin_session) ||
 			plugin == NULL || sdp_type == NULL || sdp == NULL) {
@@ -4073,8 +5384,6 @@ json_t *janus_plugin_handle_sdp(janus_plugin_session *plugin_session, janus_plug
 	janus_ice_peerconnection_medium *medium = NULL;
 	uint mi=0;
 	/* Let's build a list of payload types first */
-	if(pc->payload_types == NULL)
-		pc->payload_types = g_hash_table_new(NULL, NULL);
 	for(mi=0; mi<g_hash_table_size(pc->media); mi++) {
 		medium = g_hash_table_lookup(pc->media, GUINT_TO_POINTER(mi));
 		if(medium && medium->type != JANUS_MEDIA_DATA) {
@@ -4082,7 +5391,7 @@ json_t *janus_plugin_handle_sdp(janus_plugin_session *plugin_session, janus_plug
 			if(m && m->ptypes) {
 				GList *tpt = m->ptypes;
 				while(tpt) {
-					g_hash_table_insert(pc->payload_types, tpt->data, tpt->data);
+					janus_ice_pt_map_insert(&pc->payload_types, GPOINTER_TO_INT(tpt->data), 1);
 					tpt = tpt->next;
 				}
 			}
@@ -4093,32 +5402,27 @@ json_t *janus_plugin_handle_sdp(janus_plugin_session *plugin_session, janus_plug
 		medium = g_hash_table_lookup(pc->media, GUINT_TO_POINTER(mi));
 		if(medium && medium->type == JANUS_MEDIA_VIDEO &&
 				janus_flags_is_set(&ice_handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RFC4588_RTX) &&
-				medium->rtx_payload_types == NULL) {
+				medium->rtx_payload_types.count == 0) {
 			/* Make sure we have a list of rtx payload types to generate, if needed */
 			janus_sdp_mline *m = janus_sdp_mline_find_by_index(parsed_sdp, medium->mindex);
 			if(m && m->ptypes) {
-				medium->rtx_payload_types = g_hash_table_new(NULL, NULL);
-				if(pc->rtx_payload_types == NULL)
-					pc->rtx_payload_types = g_hash_table_new(NULL, NULL);
-				if(pc->rtx_payload_types_rev == NULL)
-					pc->rtx_payload_types_rev = g_hash_table_new(NULL, NULL);
 				GList *ptypes = m->ptypes;
 				while(ptypes) {
 					int ptype = GPOINTER_TO_INT(ptypes->data);
-					if(g_hash_table_lookup(pc->rtx_payload_types_rev, GINT_TO_POINTER(ptype))) {
+					if(janus_ice_pt_map_lookup(&pc->rtx_payload_types_rev, ptype)) {
 						/* This is an RTX for an existing payload type, skip */
 						ptypes = ptypes->next;
 						continue;
 					}
 					/* Let's check if a mapping exists already */
-					int rtx_ptype = GPOINTER_TO_INT(g_hash_table_lookup(pc->rtx_payload_types, GINT_TO_POINTER(ptype)));
+					int rtx_ptype = janus_ice_pt_map_lookup(&pc->rtx_payload_types, ptype);
 					if(rtx_ptype == 0) {
 						/* No mapping yet, find one now */
 						rtx_ptype = ptype+1;
 						if(rtx_ptype > 127)
 							rtx_ptype = 96;
-						while(g_hash_table_lookup(pc->payload_types, GINT_TO_POINTER(rtx_ptype)) ||
-								g_hash_table_lookup(pc->rtx_payload_types_rev, GINT_TO_POINTER(rtx_ptype))) {
+						while(janus_ice_pt_map_lookup(&pc->payload_types, rtx_ptype) ||
+								janus_ice_pt_map_lookup(&pc->rtx_payload_types_rev, rtx_ptype)) {
 							rtx_ptype++;
 							if(rtx_ptype > 127)
 								rtx_ptype = 96;
@@ -4130,10 +5434,10 @@ json_t *janus_plugin_handle_sdp(janus_plugin_session *plugin_session, janus_plug
 						}
 					}
 					if(rtx_ptype > 0) {
-						g_hash_table_insert(pc->payload_types, GINT_TO_POINTER(rtx_ptype), GINT_TO_POINTER(rtx_ptype));
-						g_hash_table_insert(pc->rtx_payload_types, GINT_TO_POINTER(ptype), GINT_TO_POINTER(rtx_ptype));
-						g_hash_table_insert(pc->rtx_payload_types_rev, GINT_TO_POINTER(rtx_ptype), GINT_TO_POINTER(ptype));
-						g_hash_table_insert(medium->rtx_payload_types, GINT_TO_POINTER(ptype), GINT_TO_POINTER(rtx_ptype));
+						janus_ice_pt_map_insert(&pc->payload_types, rtx_ptype, 1);
+						janus_ice_pt_map_insert(&pc->rtx_payload_types, ptype, rtx_ptype);
+						janus_ice_pt_map_insert(&pc->rtx_payload_types_rev, rtx_ptype, ptype);
+						janus_ice_pt_map_insert(&medium->rtx_payload_types, ptype, rtx_ptype);
 					}
 					medium->do_nacks = TRUE;
 					ptypes = ptypes->next;
@@ -4141,28 +5445,52 @@ json_t *janus_plugin_handle_sdp(janus_plugin_session *plugin_session, janus_plug
 			}
 		} else if(medium && medium->type == JANUS_MEDIA_VIDEO &&
 				janus_flags_is_set(&ice_handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RFC4588_RTX) &&
-				medium->rtx_payload_types != NULL) {
+				medium->rtx_payload_types.count > 0) {
 			/* Check if there are new payload types that conflict with our rtx additions */
 			janus_sdp_mline *m = janus_sdp_mline_find_by_index(parsed_sdp, medium->mindex);
 			if(m && m->ptypes) {
 				GList *ptypes = g_list_copy(m->ptypes), *tempP = ptypes;
-				GList *rtx_ptypes = g_hash_table_get_values(medium->rtx_payload_types);
 				while(tempP) {
 					int ptype = GPOINTER_TO_INT(tempP->data);
-					if(g_hash_table_lookup(medium->clock_rates, GINT_TO_POINTER(ptype)) &&
-							g_list_find(rtx_ptypes, GINT_TO_POINTER(ptype))) {
+					if(ptype >= 0 && ptype < 128 && medium->clock_rate_by_pt[ptype] &&
+							janus_ice_pt_map_contains_value(&medium->rtx_payload_types, ptype)) {
 						/* We have a payload type that is both a codec and rtx, get rid of it */
 						JANUS_LOG(LOG_WARN, "[%"SCNu64"] Removing duplicate payload type %d\n", ice_handle->handle_id, ptype);
 						janus_sdp_remove_payload_type(parsed_sdp, medium->mindex, ptype);
-						g_hash_table_remove(medium->clock_rates, GINT_TO_POINTER(ptype));
+						janus_ice_peerconnection_medium_set_clock_rate(medium, ptype, 0);
 					}
 					tempP = tempP->next;
 				}
 				g_list_free(ptypes);
-				g_list_free(rtx_ptypes);
 			}
 		}
 	}
+	/* If we're offering and FlexFEC is enabled, pick a payload type for it in video m-lines */
+	if(offer && janus_ice_is_flexfec_enabled()) {
+		for(mi=0; mi<g_hash_table_size(pc->media); mi++) {
+			medium = g_hash_table_lookup(pc->media, GUINT_TO_POINTER(mi));
+			if(medium == NULL || medium->type != JANUS_MEDIA_VIDEO)
+				continue;
+			janus_sdp_mline *m = janus_sdp_mline_find_by_index(parsed_sdp, medium->mindex);
+			if(m == NULL || m->ptypes == NULL || m->direction == JANUS_SDP_INACTIVE)
+				continue;
+			if(medium->fec_payload_type > 0 && !g_list_find(m->ptypes, GINT_TO_POINTER(medium->fec_payload_type)))
+				continue;
+			/* No payload type yet (or the plugin is now using it for something else), find one */
+			int fec_ptype = 127;
+			while(fec_ptype >= 96 && (janus_ice_pt_map_lookup(&pc->payload_types, fec_ptype) ||
+					janus_ice_pt_map_lookup(&pc->rtx_payload_types_rev, fec_ptype)))
+				fec_ptype--;
+			if(fec_ptype < 96) {
+				JANUS_LOG(LOG_WARN, "[%"SCNu64"] No payload type available for FlexFEC on medium #%d\n",
+					ice_handle->handle_id, medium->mindex);
+				medium->fec_payload_type = -1;
+				continue;
+			}
+			janus_ice_pt_map_insert(&pc->payload_types, fec_ptype, 1);
+			medium->fec_payload_type = fec_ptype;
+		}
+	}
 	/* Enrich the SDP the plugin gave us with all the WebRTC related stuff */
 	char *sdp_merged = janus_sdp_merge(ice_handle, parsed_sdp, offer ? TRUE : FALSE);
 	if(sdp_merged == NULL) {
@@ -4245,6 +5573,82 @@ void janus_plugin_relay_data(janus_plugin_session *plugin_session, janus_plugin_
 #endif
 }
 
+int janus_plugin_relay_data_broadcast(janus_plugin_session **plugin_sessions, guint count, janus_plugin_data *packet) {
+	if((count > 0 && plugin_sessions == NULL) || packet == NULL || packet->buffer == NULL || packet->length < 1)
+		return -1;
+#ifdef HAVE_SCTP
+	/* We copy the message only once: the packets we queue for each peer all reference it */
+	janus_ice_shared_data *data = NULL;
+	int sent = 0;
+	guint i = 0;
+	for(i=0; i<count; i++) {
+		janus_plugin_session *plugin_session = plugin_sessions[i];
+		if((plugin_session < (janus_plugin_session *)0x1000) || g_atomic_int_get(&plugin_session->stopped))
+			continue;
+		janus_ice_handle *handle = (janus_ice_handle *)plugin_session->gateway_handle;
+		if(!handle || janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_STOP)
+				|| janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT))
+			continue;
+		if(data == NULL && (data = janus_ice_shared_data_new(packet)) == NULL)
+			return -1;
+		janus_ice_relay_data_shared(handle, data);
+		sent++;
+	}
+	janus_ice_shared_data_unref(data);
+	return sent;
+#else
+	JANUS_LOG(LOG_WARN, "Asked to relay data, but Data Channels support has not been compiled...\n");
+	return -1;
+#endif
+}
+
+/* Helper to get the handle a batch is addressed to, if it can be used */
+static janus_ice_handle *janus_plugin_batch_handle(janus_plugin_session *plugin_session) {
+	if((plugin_session < (janus_plugin_session *)0x1000) || g_atomic_int_get(&plugin_session->stopped))
+		return NULL;
+	janus_ice_handle *handle = (janus_ice_handle *)plugin_session->gateway_handle;
+	if(!handle || janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_STOP)
+			|| janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT))
+		return NULL;
+	return handle;
+}
+
+int janus_plugin_relay_rtp_batch(janus_plugin_session **plugin_sessions, janus_plugin_rtp *packets, guint count) {
+	if(count > 0 && (plugin_sessions == NULL || packets == NULL))
+		return -1;
+	int sent = 0;
+	guint first = 0, next = 0;
+	while(first < count) {
+		/* Group the consecutive packets addressed to the same peer */
+		next = first+1;
+		while(next < count && plugin_sessions[next] == plugin_sessions[first])
+			next++;
+		janus_ice_handle *handle = janus_plugin_batch_handle(plugin_sessions[first]);
+		if(handle != NULL)
+			sent += janus_ice_relay_rtp_batch(handle, &packets[first], next-first);
+		first = next;
+	}
+	return sent;
+}
+
+int janus_plugin_relay_rtcp_batch(janus_plugin_session **plugin_sessions, janus_plugin_rtcp *packets, guint count) {
+	if(count > 0 && (plugin_sessions == NULL || packets == NULL))
+		return -1;
+	int sent = 0;
+	guint first = 0, next = 0;
+	while(first < count) {
+		/* Group the consecutive messages addressed to the same peer */
+		next = first+1;
+		while(next < count && plugin_sessions[next] == plugin_sessions[first])
+			next++;
+		janus_ice_handle *handle = janus_plugin_batch_handle(plugin_sessions[first]);
+		if(handle != NULL)
+			sent += janus_ice_relay_rtcp_batch(handle, &packets[first], next-first);
+		first = next;
+	}
+	return sent;
+}
+
 void janus_plugin_send_pli(janus_plugin_session *plugin_session) {
 	if((plugin_session < (janus_plugin_session *)0x1000) || g_atomic_int_get(&plugin_session->stopped))
 		return;
@@ -4275,6 +5679,16 @@ void janus_plugin_send_remb(janus_plugin_session *plugin_session, uint32_t bitra
 	janus_ice_send_remb(handle, bitrate);
 }
 
+guint32 janus_plugin_get_bandwidth_estimate(janus_plugin_session *plugin_session) {
+	if((plugin_session < (janus_plugin_session *)0x1000) || g_atomic_int_get(&plugin_session->stopped))
+		return 0;
+	janus_ice_handle *handle = (janus_ice_handle *)plugin_session->gateway_handle;
+	if(!handle || janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_STOP)
+			|| janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_ALERT))
+		return 0;
+	return janus_ice_get_bandwidth_estimate(handle);
+}
+
 static gboolean janus_plugin_close_pc_internal(gpointer user_data) {
 	/* We actually enforce the close_pc here */
 	janus_plugin_session *plugin_session = (janus_plugin_session *) user_data;
@@ -4352,6 +5766,11 @@ void janus_plugin_end_session(janus_plugin_session *plugin_session) {
 	g_source_unref(timeout_source);
 }
 
+gboolean janus_plugin_events_is_enabled(void) {
+	/* Plugins only prepare events if some handler will actually get them */
+	return janus_events_is_interested(JANUS_EVENT_TYPE_PLUGIN);
+}
+
 void janus_plugin_notify_event(janus_plugin *plugin, janus_plugin_session *plugin_session, json_t *event) {
 	/* A plugin asked to notify an event to the handlers */
 	if(!plugin || !event || !json_is_object(event))
@@ -4398,6 +5817,22 @@ gboolean janus_plugin_auth_signature_contains(janus_plugin *plugin, const char *
 	return janus_auth_check_signature_contains(token, plugin->get_package(), descriptor);
 }
 
+/* Plugins are all loaded first, and initialized (possibly in parallel) afterwards */
+typedef struct janus_plugin_loading {
+	janus_plugin *plugin;
+	void *handle;
+	GThread *thread;
+	int result;
+	gint64 duration;
+} janus_plugin_loading;
+static gpointer janus_plugin_init_thread(gpointer data) {
+	janus_plugin_loading *pl = (janus_plugin_loading *)data;
+	gint64 start = janus_get_monotonic_time();
+	pl->result = pl->plugin->init(&janus_handler_plugin, configs_folder);
+	pl->duration = janus_get_monotonic_time() - start;
+	return NULL;
+}
+
 
 /* Main */
 gint main(int argc, char *argv[]) {
@@ -4694,7 +6129,7 @@ gint main(int argc, char *argv[]) {
 						!janus_logger->get_description ||
 						!janus_logger->get_package ||
 						!janus_logger->get_name ||
-						!janus_logger->incoming_logline) {
+						(!janus_logger->incoming_logline && !janus_logger->incoming_logrecord)) {
 					JANUS_LOG(LOG_ERR, "\tMissing some mandatory methods/callbacks, skipping this logger plugin...\n");
 					continue;
 				}
@@ -4703,7 +6138,9 @@ gint main(int argc, char *argv[]) {
 						janus_logger->get_package(), janus_logger->get_api_compatibility(), JANUS_LOGGER_API_VERSION);
 					continue;
 				}
+				gint64 init_start = janus_get_monotonic_time();
 				janus_logger->init(server_name ? server_name : JANUS_SERVER_NAME, configs_folder);
+				janus_init_time_add(janus_logger->get_package(), janus_get_monotonic_time() - init_start);
 				JANUS_LOG(LOG_VERB, "\tVersion: %d (%s)\n", janus_logger->get_version(), janus_logger->get_version_string());
 				JANUS_LOG(LOG_VERB, "\t   [%s] %s\n", janus_logger->get_package(), janus_logger->get_name());
 				JANUS_LOG(LOG_VERB, "\t   %s\n", janus_logger->get_description());
@@ -4747,6 +6184,16 @@ gint main(int argc, char *argv[]) {
 		janus_log_level = options.debug_level;
 	}
 
+	/* Check which clocksource we're using, as Janus reads the time a lot */
+	clocksource = janus_get_clocksource();
+	if(clocksource != NULL) {
+		JANUS_LOG(LOG_INFO, "Clocksource: %s\n", clocksource);
+		if(!strcmp(clocksource, "hpet") || !strcmp(clocksource, "acpi_pm") || !strcmp(clocksource, "jiffies")) {
+			JANUS_LOG(LOG_WARN, "The '%s' clocksource doesn't support fast reads from user space, reading the time will be expensive\n",
+				clocksource);
+		}
+	}
+
 	/* Any PID we need to create? */
 	const char *pidfile = NULL;
 	if(options.pid_file) {
@@ -4897,6 +6344,23 @@ gint main(int argc, char *argv[]) {
 	if(lock_debug) {
 		JANUS_PRINT("Lock/mutex debugging is enabled\n");
 	}
+	item = janus_config_get(config, config_general, janus_config_type_item, "lock_profiling");
+#ifdef JANUS_LOCK_PROFILING
+	if(item && item->value)
+		lock_profiling = janus_is_true(item->value);
+	if(lock_profiling) {
+		JANUS_PRINT("Lock contention profiler is enabled\n");
+	}
+#else
+	if(item && item->value && janus_is_true(item->value)) {
+		JANUS_PRINT("Lock contention profiler not available (Janus was not built with --enable-lock-profiling)\n");
+	}
+#endif
+
+	/* Apply the scheduling profile for media threads, if any: we do this as
+	 * early as possible, as threads inherit the CPU affinity we have (which
+	 * matters if other threads must be kept away from the reserved cores) */
+	janus_sched_init(config);
 
 	/* First of all, let's check if we're disabling WebRTC encryption for debugging purposes */
 	item = janus_config_get(config, config_general, janus_config_type_item, "no_webrtc_encryption");
@@ -5002,6 +6466,16 @@ gint main(int argc, char *argv[]) {
 		}
 	}
 
+	/* Should sessions be saved to a snapshot when shutting down, and restored at startup? */
+	item = janus_config_get(config, config_general, janus_config_type_item, "sessions_snapshot");
+	if(item && item->value)
+		sessions_snapshot = g_strdup(item->value);
+	item = janus_config_get(config, config_general, janus_config_type_item, "restore_stagger");
+	if(item && item->value && janus_string_to_uint32(item->value, &restore_stagger) < 0) {
+		JANUS_LOG(LOG_WARN, "Invalid restore_stagger value, using default (%d)\n", DEFAULT_RESTORE_STAGGER);
+		restore_stagger = DEFAULT_RESTORE_STAGGER;
+	}
+
 	/* Check if a custom candidates timeout value was specified */
 	item = janus_config_get(config, config_general, janus_config_type_item, "candidates_timeout");
 	if(item && item->value) {
@@ -5046,6 +6520,30 @@ gint main(int argc, char *argv[]) {
 	} else {
 		janus_recorder_init(FALSE, NULL);
 	}
+	item = janus_config_get(config, config_general, janus_config_type_item, "recordings_writers");
+	int recordings_writers = (item && item->value) ? atoi(item->value) : 0;
+	item = janus_config_get(config, config_general, janus_config_type_item, "recordings_fsync");
+	int recordings_fsync = -1;
+	if(item && item->value) {
+		if(!strcasecmp(item->value, "close"))
+			recordings_fsync = 0;
+		else if(strcasecmp(item->value, "none"))
+			recordings_fsync = atoi(item->value) > 0 ? atoi(item->value) : -1;
+	}
+	if(recordings_writers > 0) {
+		item = janus_config_get(config, config_general, janus_config_type_item, "recordings_buffer");
+		int recordings_buffer = (item && item->value) ? atoi(item->value) : 0;
+		if(recordings_buffer <= 0)
+			recordings_buffer = 1024;
+		if(janus_recorder_async_init(recordings_writers, (size_t)recordings_buffer*1024, recordings_fsync) < 0)
+			JANUS_LOG(LOG_WARN, "Couldn't start the recorder writer threads, recordings will be written synchronously\n");
+		item = janus_config_get(config, config_general, janus_config_type_item, "recordings_budget");
+		int recordings_budget = (item && item->value) ? atoi(item->value) : 0;
+		if(recordings_budget > 0)
+			janus_recorder_async_budget((size_t)recordings_budget*1024);
+	} else {
+		janus_recorder_async_init(0, 0, recordings_fsync);
+	}
 
 	/* Check if we should hide dependencies in "info" requests */
 	item = janus_config_get(config, config_general, janus_config_type_item, "hide_dependencies");
@@ -5213,6 +6711,7 @@ gint main(int argc, char *argv[]) {
 			task_pool_size = -1;
 	}
 	/* Initialize the ICE stack now */
+	janus_metrics_init();
 	janus_ice_init(ice_lite, ice_tcp, full_trickle, ignore_mdns, ipv6, ipv6_linklocal, rtp_min_port, rtp_max_port);
 	if(janus_ice_set_stun_server(stun_server, stun_port) < 0) {
 		if(!ignore_unreachable_ice_server) {
@@ -5353,6 +6852,65 @@ gint main(int argc, char *argv[]) {
 			janus_set_slowlink_threshold(st);
 		}
 	}
+	/* Size of the pool of outgoing packets */
+	item = janus_config_get(config, config_media, janus_config_type_item, "packet_pool_size");
+	if(item && item->value) {
+		int pps = atoi(item->value);
+		if(pps < 0) {
+			JANUS_LOG(LOG_WARN, "Ignoring packet_pool_size value as it's not a positive integer\n");
+		} else {
+			janus_ice_set_packet_pool_size(pps);
+		}
+	}
+	/* Lock-free queues for relayed media packets */
+	item = janus_config_get(config, config_media, janus_config_type_item, "packet_queue_size");
+	janus_config_item *overflow = janus_config_get(config, config_media, janus_config_type_item, "packet_queue_overflow");
+	if((item && item->value) || (overflow && overflow->value)) {
+		int pqs = (item && item->value) ? atoi(item->value) : (int)janus_ice_get_packet_queue_size();
+		if(pqs < 0) {
+			JANUS_LOG(LOG_WARN, "Ignoring packet_queue_size value as it's not a positive integer\n");
+			pqs = janus_ice_get_packet_queue_size();
+		}
+		janus_ice_set_packet_queue(pqs, (overflow && overflow->value) ? overflow->value : NULL);
+	}
+	/* Batched sending of outgoing packets */
+	item = janus_config_get(config, config_media, janus_config_type_item, "send_batch_size");
+	if(item && item->value) {
+		int sbs = atoi(item->value);
+		if(sbs < 0) {
+			JANUS_LOG(LOG_WARN, "Ignoring send_batch_size value as it's not a positive integer\n");
+		} else {
+			janus_ice_set_send_batch_size(sbs);
+		}
+	}
+	/* Pacing of outgoing video packets */
+	item = janus_config_get(config, config_media, janus_config_type_item, "pacing");
+	if(item && item->value && janus_is_true(item->value)) {
+		int burst = 0;
+		janus_config_item *pb = janus_config_get(config, config_media, janus_config_type_item, "pacing_burst");
+		if(pb && pb->value) {
+			burst = atoi(pb->value);
+			if(burst < 0) {
+				JANUS_LOG(LOG_WARN, "Ignoring pacing_burst value as it's not a positive integer\n");
+				burst = 0;
+			}
+		}
+		janus_ice_set_pacing(TRUE, burst);
+	}
+	/* FlexFEC for outgoing video */
+	item = janus_config_get(config, config_media, janus_config_type_item, "flexfec");
+	if(item && item->value && janus_is_true(item->value)) {
+		int rtt_threshold = 0;
+		janus_config_item *ft = janus_config_get(config, config_media, janus_config_type_item, "flexfec_rtt_threshold");
+		if(ft && ft->value) {
+			rtt_threshold = atoi(ft->value);
+			if(rtt_threshold < 0) {
+				JANUS_LOG(LOG_WARN, "Ignoring flexfec_rtt_threshold value as it's not a positive integer\n");
+				rtt_threshold = 0;
+			}
+		}
+		janus_ice_set_flexfec(TRUE, rtt_threshold);
+	}
 	/* TWCC period */
 	item = janus_config_get(config, config_media, janus_config_type_item, "twcc_period");
 	if(item && item->value) {
@@ -5363,6 +6921,35 @@ gint main(int argc, char *argv[]) {
 			janus_set_twcc_period(tp);
 		}
 	}
+	/* Check if all PeerConnections should share the same UDP sockets (ICE Lite only):
+	 * we do this here, as the ICE mux needs the interfaces and DSCP settings */
+	item = janus_config_get(config, config_nat, janus_config_type_item, "ice_mux_port");
+	if(item && item->value) {
+		int mux_port = atoi(item->value);
+		/* By default, we create a socket per static event loop, if there are any */
+		int mux_sockets = janus_ice_get_static_event_loops() > 0 ? janus_ice_get_static_event_loops() : 1;
+		janus_config_item *sockets_item = janus_config_get(config, config_nat, janus_config_type_item, "ice_mux_sockets");
+		if(sockets_item && sockets_item->value)
+			mux_sockets = atoi(sockets_item->value);
+		janus_config_item *offload_item = janus_config_get(config, config_nat, janus_config_type_item, "ice_mux_offload");
+		gboolean mux_offload = (offload_item && offload_item->value) ? janus_is_true(offload_item->value) : FALSE;
+		if(mux_port <= 0 || mux_port > 65535) {
+			JANUS_LOG(LOG_WARN, "Ignoring ice_mux_port value as it's not a valid port\n");
+		} else if(janus_ice_set_mux(mux_port, mux_sockets > 0 ? mux_sockets : 1, mux_offload) < 0 && ice_lite) {
+			JANUS_LOG(LOG_FATAL, "Error setting up the ICE mux on port %d\n", mux_port);
+			janus_options_destroy();
+			exit(1);
+		}
+	}
+	/* Check if we should keep agents ready for new PeerConnections in each static loop */
+	item = janus_config_get(config, config_general, janus_config_type_item, "agent_pool");
+	if(item && item->value) {
+		int agent_pool = atoi(item->value);
+		if(agent_pool < 0)
+			JANUS_LOG(LOG_WARN, "Ignoring agent_pool value as it's not a positive integer\n");
+		else
+			janus_ice_set_agent_pool(agent_pool);
+	}
 
 	/* Setup OpenSSL stuff */
 	const char *server_pem;
@@ -5412,22 +6999,60 @@ gint main(int argc, char *argv[]) {
 	item = janus_config_get(config, config_certs, janus_config_type_item, "rsa_private_key");
 	if(item && item->value)
 		rsa_private_key = janus_is_true(item->value);
+	gboolean rsa_fallback = FALSE;
+	item = janus_config_get(config, config_certs, janus_config_type_item, "rsa_fallback");
+	if(item && item->value)
+		rsa_fallback = janus_is_true(item->value);
+	const char *fallback_pem = NULL, *fallback_key = NULL, *fallback_password = NULL;
+	item = janus_config_get(config, config_certs, janus_config_type_item, "fallback_cert_pem");
+	if(item && item->value)
+		fallback_pem = item->value;
+	item = janus_config_get(config, config_certs, janus_config_type_item, "fallback_cert_key");
+	if(item && item->value)
+		fallback_key = item->value;
+	item = janus_config_get(config, config_certs, janus_config_type_item, "fallback_cert_pwd");
+	if(item && item->value)
+		fallback_password = item->value;
 	gboolean dtls_accept_selfsigned = TRUE;
 	item = janus_config_get(config, config_certs, janus_config_type_item, "dtls_accept_selfsigned");
 	if(item && item->value)
 		dtls_accept_selfsigned = janus_is_true(item->value);
-	if(janus_dtls_srtp_init(server_pem, server_key, password, dtls_ciphers, dtls_timeout, rsa_private_key, dtls_accept_selfsigned) < 0) {
+	if(janus_dtls_srtp_init(server_pem, server_key, password, fallback_pem, fallback_key, fallback_password,
+			dtls_ciphers, dtls_timeout, rsa_private_key, rsa_fallback, dtls_accept_selfsigned) < 0) {
 		janus_options_destroy();
 		exit(1);
 	}
+	item = janus_config_get(config, config_certs, janus_config_type_item, "cert_rotation");
+	if(item && item->value) {
+		int period = atoi(item->value);
+		if(period < 0) {
+			JANUS_LOG(LOG_WARN, "Ignoring cert_rotation value as it's not a positive integer\n");
+		} else {
+			janus_dtls_set_certificate_rotation(period);
+		}
+	}
 	/* Check if there's any custom value for the starting MTU to use in the BIO filter */
 	item = janus_config_get(config, config_media, janus_config_type_item, "dtls_mtu");
 	if(item && item->value)
 		janus_dtls_bio_agent_set_mtu(atoi(item->value));
+	/* Check if peers should be allowed to resume previous DTLS sessions */
+	item = janus_config_get(config, config_media, janus_config_type_item, "dtls_session_resumption");
+	janus_dtls_set_session_resumption(item && item->value && janus_is_true(item->value));
+	/* Check if we should keep SSL objects ready for new DTLS stacks */
+	item = janus_config_get(config, config_media, janus_config_type_item, "dtls_pool");
+	if(item && item->value) {
+		int dtls_pool = atoi(item->value);
+		if(dtls_pool < 0)
+			JANUS_LOG(LOG_WARN, "Ignoring dtls_pool value as it's not a positive integer\n");
+		else
+			janus_dtls_set_ssl_pool(dtls_pool);
+	}
 
 #ifdef HAVE_SCTP
 	/* Initialize SCTP for DataChannels */
-	if(janus_sctp_init() < 0) {
+	item = janus_config_get(config, config_media, janus_config_type_item, "sctp_nothreads");
+	gboolean sctp_nothreads = item && item->value && janus_is_true(item->value);
+	if(janus_sctp_init(sctp_nothreads) < 0) {
 		janus_options_destroy();
 		exit(1);
 	}
@@ -5436,14 +7061,35 @@ gint main(int argc, char *argv[]) {
 #endif
 
 	/* Initialize the RTP forwarders functionality */
-	if(janus_rtp_forwarders_init() < 0) {
+	item = janus_config_get(config, config_media, janus_config_type_item, "rtp_forwarders_thread");
+	gboolean rtpfwd_thread = item && item->value && janus_is_true(item->value);
+	if(janus_rtp_forwarders_init(rtpfwd_thread) < 0) {
+		janus_options_destroy();
+		exit(1);
+	}
+
+	/* Initialize the shared loops plugins can use for their plain RTP/RTCP sockets */
+	int reactor_threads = 1;
+	item = janus_config_get(config, config_general, janus_config_type_item, "reactor_threads");
+	if(item && item->value) {
+		reactor_threads = atoi(item->value);
+		if(reactor_threads < 1) {
+			JANUS_LOG(LOG_WARN, "Invalid reactor_threads value, using 1\n");
+			reactor_threads = 1;
+		}
+	}
+	if(janus_reactor_init(reactor_threads) < 0) {
 		janus_options_destroy();
 		exit(1);
 	}
 
 	/* Sessions */
-	sessions = g_hash_table_new_full(g_int64_hash, g_int64_equal, (GDestroyNotify)g_free, NULL);
-	janus_mutex_init(&sessions_mutex);
+	int shard = 0;
+	for(shard=0; shard<JANUS_SESSIONS_SHARDS; shard++) {
+		janus_rwlock_init(&sessions[shard].lock);
+		sessions[shard].table = g_hash_table_new_full(g_int64_hash, g_int64_equal, (GDestroyNotify)g_free, NULL);
+		sessions[shard].deadlines = g_array_new(FALSE, FALSE, sizeof(janus_session_deadline));
+	}
 	/* Start the sessions timeout watchdog */
 	sessions_watchdog_context = g_main_context_new();
 	GMainLoop *watchdog_loop = g_main_loop_new(sessions_watchdog_context, FALSE);
@@ -5477,6 +7123,11 @@ gint main(int argc, char *argv[]) {
 		janus_options_destroy();
 		exit(1);
 	}
+	g_thread_pool_set_sort_function(tasks, janus_transport_task_compare, NULL);
+	janus_mutex_lock(&session_tasks_mutex);
+	session_tasks = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+		(GDestroyNotify)g_free, (GDestroyNotify)janus_session_tasks_free);
+	janus_mutex_unlock(&session_tasks_mutex);
 	/* Wait 120 seconds before stopping idle threads to avoid the creation of too many threads for AddressSanitizer. */
 	g_thread_pool_set_max_idle_time(120 * 1000);
 
@@ -5523,6 +7174,31 @@ gint main(int argc, char *argv[]) {
 				if(combine)
 					JANUS_LOG(LOG_INFO, "Event handler configured to send media stats combined in a single event\n");
 			}
+			item = janus_config_get(config, config_events, janus_config_type_item, "batch_media_stats");
+			if(item && item->value) {
+				gboolean batch = janus_is_true(item->value);
+				janus_ice_event_set_batch_media_stats(batch);
+				if(batch)
+					JANUS_LOG(LOG_INFO, "Event handler configured to send media stats of all handles batched in a single event\n");
+			}
+			item = janus_config_get(config, config_events, janus_config_type_item, "stats_sampling");
+			if(item && item->value) {
+				int sampling = atoi(item->value);
+				if(sampling < 1) {
+					JANUS_LOG(LOG_WARN, "Invalid event handlers statistics sampling, sending all of them\n");
+				} else {
+					janus_ice_event_set_stats_sampling(sampling);
+					if(sampling > 1)
+						JANUS_LOG(LOG_INFO, "Event handler configured to send media stats for each handle once every %d periods\n", sampling);
+				}
+			}
+			item = janus_config_get(config, config_events, janus_config_type_item, "stats_lossy_only");
+			if(item && item->value) {
+				gboolean lossy_only = janus_is_true(item->value);
+				janus_ice_event_set_stats_lossy_only(lossy_only);
+				if(lossy_only)
+					JANUS_LOG(LOG_INFO, "Event handler configured to only send media stats for streams with packet losses\n");
+			}
 			/* Any event handlers to ignore? */
 			item = janus_config_get(config, config_events, janus_config_type_item, "disable");
 			if(item && item->value)
@@ -5602,7 +7278,9 @@ gint main(int argc, char *argv[]) {
 							janus_eventhandler->get_package(), janus_eventhandler->get_api_compatibility(), JANUS_EVENTHANDLER_API_VERSION);
 						continue;
 					}
+					gint64 init_start = janus_get_monotonic_time();
 					janus_eventhandler->init(configs_folder);
+					janus_init_time_add(janus_eventhandler->get_package(), janus_get_monotonic_time() - init_start);
 					JANUS_LOG(LOG_VERB, "\tVersion: %d (%s)\n", janus_eventhandler->get_version(), janus_eventhandler->get_version_string());
 					JANUS_LOG(LOG_VERB, "\t   [%s] %s\n", janus_eventhandler->get_package(), janus_eventhandler->get_name());
 					JANUS_LOG(LOG_VERB, "\t   %s\n", janus_eventhandler->get_description());
@@ -5640,8 +7318,21 @@ gint main(int argc, char *argv[]) {
 		if(disabled_eventhandlers != NULL)
 			g_strfreev(disabled_eventhandlers);
 		disabled_eventhandlers = NULL;
+		/* Check if the queue of events for each handler should be bounded */
+		int events_max_queued = 0;
+		item = janus_config_get(config, config_events, janus_config_type_item, "max_queued");
+		if(item && item->value) {
+			events_max_queued = atoi(item->value);
+			if(events_max_queued < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid event handlers max_queued value, disabling limit\n");
+				events_max_queued = 0;
+			}
+		}
+		item = janus_config_get(config, config_events, janus_config_type_item, "droppable");
+		const char *events_droppable = (item && item->value) ? item->value : NULL;
 		/* Initialize the event broadcaster */
-		if(janus_events_init(enable_events, (server_name ? server_name : (char *)JANUS_SERVER_NAME), eventhandlers) < 0) {
+		if(janus_events_init(enable_events, (server_name ? server_name : (char *)JANUS_SERVER_NAME), eventhandlers,
+				events_max_queued, events_droppable) < 0) {
 			JANUS_LOG(LOG_FATAL, "Error initializing the Event handlers mechanism...\n");
 			janus_options_destroy();
 			exit(1);
@@ -5651,6 +7342,13 @@ gint main(int argc, char *argv[]) {
 		g_source_set_callback(timeout_source, janus_status_sessions, sessions_watchdog_context, NULL);
 		g_source_attach(timeout_source, sessions_watchdog_context);
 		g_source_unref(timeout_source);
+		/* If media stats are batched, send the batch once per stats period */
+		if(janus_events_is_enabled() && janus_ice_event_get_batch_media_stats() && janus_ice_get_event_stats_period() > 0) {
+			timeout_source = g_timeout_source_new_seconds(janus_ice_get_event_stats_period());
+			g_source_set_callback(timeout_source, janus_ice_event_flush_media_stats, NULL, NULL);
+			g_source_attach(timeout_source, sessions_watchdog_context);
+			g_source_unref(timeout_source);
+		}
 	}
 
 	/* Load plugins */
@@ -5671,6 +7369,7 @@ gint main(int argc, char *argv[]) {
 	if(item && item->value)
 		disabled_plugins = g_strsplit(item->value, ",", -1);
 	/* Open the shared objects */
+	GList *plugins_loading = NULL;
 	struct dirent *pluginent = NULL;
 	char pluginpath[1024];
 	while((pluginent = readdir(dir))) {
@@ -5750,35 +7449,111 @@ gint main(int argc, char *argv[]) {
 					janus_plugin->get_package(), janus_plugin->get_api_compatibility(), JANUS_PLUGIN_API_VERSION);
 				continue;
 			}
-			if(janus_plugin->init(&janus_handler_plugin, configs_folder) < 0) {
-				JANUS_LOG(LOG_WARN, "The '%s' plugin could not be initialized\n", janus_plugin->get_package());
-				dlclose(plugin);
-				continue;
-			}
-			JANUS_LOG(LOG_VERB, "\tVersion: %d (%s)\n", janus_plugin->get_version(), janus_plugin->get_version_string());
-			JANUS_LOG(LOG_VERB, "\t   [%s] %s\n", janus_plugin->get_package(), janus_plugin->get_name());
-			JANUS_LOG(LOG_VERB, "\t   %s\n", janus_plugin->get_description());
-			JANUS_LOG(LOG_VERB, "\t   Plugin API version: %d\n", janus_plugin->get_api_compatibility());
-			if(!janus_plugin->incoming_rtp && !janus_plugin->incoming_rtcp && !janus_plugin->incoming_data) {
-				JANUS_LOG(LOG_WARN, "The '%s' plugin doesn't implement any callback for RTP/RTCP/data... is this on purpose?\n",
-					janus_plugin->get_package());
-			}
-			if(!janus_plugin->incoming_rtp && !janus_plugin->incoming_rtcp && janus_plugin->incoming_data) {
-				JANUS_LOG(LOG_WARN, "The '%s' plugin will only handle data channels (no RTP/RTCP)... is this on purpose?\n",
-					janus_plugin->get_package());
-			}
-			if(plugins == NULL)
-				plugins = g_hash_table_new(g_str_hash, g_str_equal);
-			g_hash_table_insert(plugins, (gpointer)janus_plugin->get_package(), janus_plugin);
-			if(plugins_so == NULL)
-				plugins_so = g_hash_table_new(g_str_hash, g_str_equal);
-			g_hash_table_insert(plugins_so, (gpointer)janus_plugin->get_package(), plugin);
+			/* We'll initialize the plugin when all of them have been loaded */
+			janus_plugin_loading *pl = g_malloc0(sizeof(janus_plugin_loading));
+			pl->plugin = janus_plugin;
+			pl->handle = plugin;
+			plugins_loading = g_list_append(plugins_loading, pl);
 		}
 	}
 	closedir(dir);
 	if(disabled_plugins != NULL)
 		g_strfreev(disabled_plugins);
 	disabled_plugins = NULL;
+	/* Plugins don't depend on each other, so we can initialize them in
+	 * parallel, if configured to: some of them (e.g., a Streaming plugin
+	 * with many mountpoints) may take a while reading their configuration */
+	gboolean parallel_init = FALSE;
+	item = janus_config_get(config, config_plugins, janus_config_type_item, "parallel_init");
+	if(item && item->value)
+		parallel_init = janus_is_true(item->value);
+	gint64 plugins_init_start = janus_get_monotonic_time();
+	GList *pll = plugins_loading;
+	int pl_index = 0;
+	while(pll) {
+		janus_plugin_loading *pl = (janus_plugin_loading *)pll->data;
+		if(parallel_init) {
+			GError *error = NULL;
+			char tname[16];
+			g_snprintf(tname, sizeof(tname), "plugin init %d", pl_index);
+			pl->thread = g_thread_try_new(tname, &janus_plugin_init_thread, pl, &error);
+			if(error != NULL) {
+				JANUS_LOG(LOG_WARN, "Got error %d (%s) trying to launch the init thread of the '%s' plugin, initializing it now...\n",
+					error->code, error->message ? error->message : "??", pl->plugin->get_package());
+				g_error_free(error);
+				pl->thread = NULL;
+			}
+		}
+		if(pl->thread == NULL)
+			janus_plugin_init_thread(pl);
+		pl_index++;
+		pll = pll->next;
+	}
+	/* Now register the plugins, in the same order they were loaded */
+	pll = plugins_loading;
+	while(pll) {
+		janus_plugin_loading *pl = (janus_plugin_loading *)pll->data;
+		pll = pll->next;
+		if(pl->thread != NULL)
+			g_thread_join(pl->thread);
+		janus_plugin *janus_plugin = pl->plugin;
+		void *plugin = pl->handle;
+		int result = pl->result;
+		gint64 duration = pl->duration;
+		g_free(pl);
+		if(result < 0) {
+			JANUS_LOG(LOG_WARN, "The '%s' plugin could not be initialized\n", janus_plugin->get_package());
+			dlclose(plugin);
+			continue;
+		}
+		janus_init_time_add(janus_plugin->get_package(), duration);
+		JANUS_LOG(LOG_VERB, "\tVersion: %d (%s)\n", janus_plugin->get_version(), janus_plugin->get_version_string());
+		JANUS_LOG(LOG_VERB, "\t   [%s] %s\n", janus_plugin->get_package(), janus_plugin->get_name());
+		JANUS_LOG(LOG_VERB, "\t   %s\n", janus_plugin->get_description());
+		JANUS_LOG(LOG_VERB, "\t   Plugin API version: %d\n", janus_plugin->get_api_compatibility());
+		if(!janus_plugin->incoming_rtp && !janus_plugin->incoming_rtcp &&
+				!janus_plugin->incoming_data && !janus_plugin->incoming_data_batch) {
+			JANUS_LOG(LOG_WARN, "The '%s' plugin doesn't implement any callback for RTP/RTCP/data... is this on purpose?\n",
+				janus_plugin->get_package());
+		}
+		if(!janus_plugin->incoming_rtp && !janus_plugin->incoming_rtcp &&
+				(janus_plugin->incoming_data || janus_plugin->incoming_data_batch)) {
+			JANUS_LOG(LOG_WARN, "The '%s' plugin will only handle data channels (no RTP/RTCP)... is this on purpose?\n",
+				janus_plugin->get_package());
+		}
+		if(plugins == NULL)
+			plugins = g_hash_table_new(g_str_hash, g_str_equal);
+		g_hash_table_insert(plugins, (gpointer)janus_plugin->get_package(), janus_plugin);
+		if(plugins_so == NULL)
+			plugins_so = g_hash_table_new(g_str_hash, g_str_equal);
+		g_hash_table_insert(plugins_so, (gpointer)janus_plugin->get_package(), plugin);
+	}
+	g_list_free(plugins_loading);
+	JANUS_LOG(LOG_INFO, "Plugins initialized in %"SCNi64"ms%s\n",
+		(janus_get_monotonic_time() - plugins_init_start)/1000, parallel_init ? " (in parallel)" : "");
+
+	/* Now that plugins are there, check if we have sessions to restore: we
+	 * do this before loading transports, so that clients find them already */
+	if(sessions_snapshot != NULL && g_file_test(sessions_snapshot, G_FILE_TEST_EXISTS)) {
+		json_error_t jerror;
+		json_t *snapshot = json_load_file(sessions_snapshot, 0, &jerror);
+		if(snapshot == NULL) {
+			JANUS_LOG(LOG_WARN, "Error reading sessions snapshot '%s': %s\n", sessions_snapshot, jerror.text);
+		} else {
+			/* Ignore snapshots too old for clients to still be waiting to claim their sessions */
+			json_t *created = json_object_get(snapshot, "created");
+			gint64 age = json_is_integer(created) ? (janus_get_real_time() - json_integer_value(created))/G_USEC_PER_SEC : -1;
+			guint max_age = reclaim_session_timeout > 0 ? reclaim_session_timeout : global_session_timeout;
+			if(age < 0 || (max_age > 0 && age > max_age)) {
+				JANUS_LOG(LOG_WARN, "Ignoring stale sessions snapshot '%s'\n", sessions_snapshot);
+			} else {
+				janus_sessions_import(snapshot, NULL);
+			}
+			json_decref(snapshot);
+		}
+		/* Make sure we don't restore the same sessions again the next time */
+		unlink(sessions_snapshot);
+	}
 
 	/* Load transports */
 	gboolean janus_api_enabled = FALSE, admin_api_enabled = FALSE;
@@ -5878,11 +7653,13 @@ gint main(int argc, char *argv[]) {
 					janus_transport->get_package(), janus_transport->get_api_compatibility(), JANUS_TRANSPORT_API_VERSION);
 				continue;
 			}
+			gint64 init_start = janus_get_monotonic_time();
 			if(janus_transport->init(&janus_handler_transport, configs_folder) < 0) {
 				JANUS_LOG(LOG_WARN, "The '%s' plugin could not be initialized\n", janus_transport->get_package());
 				dlclose(transport);
 				continue;
 			}
+			janus_init_time_add(janus_transport->get_package(), janus_get_monotonic_time() - init_start);
 			JANUS_LOG(LOG_VERB, "\tVersion: %d (%s)\n", janus_transport->get_version(), janus_transport->get_version_string());
 			JANUS_LOG(LOG_VERB, "\t   [%s] %s\n", janus_transport->get_package(), janus_transport->get_name());
 			JANUS_LOG(LOG_VERB, "\t   %s\n", janus_transport->get_description());
@@ -5954,6 +7731,16 @@ gint main(int argc, char *argv[]) {
 		janus_events_notify_handlers(JANUS_EVENT_TYPE_CORE, JANUS_EVENT_SUBTYPE_CORE_SHUTDOWN, 0, info);
 	}
 
+	/* Save the sessions to a snapshot, if needed, while plugins can still be queried */
+	if(sessions_snapshot != NULL) {
+		json_t *snapshot = janus_sessions_export();
+		if(janus_sessions_export_file(sessions_snapshot, snapshot) == 0) {
+			JANUS_LOG(LOG_INFO, "Saved %zu sessions to snapshot '%s'\n",
+				json_array_size(json_object_get(snapshot, "sessions")), sessions_snapshot);
+		}
+		json_decref(snapshot);
+	}
+
 	/* Done */
 	JANUS_LOG(LOG_INFO, "Ending sessions timeout watchdog...\n");
 	g_main_loop_quit(watchdog_loop);
@@ -5977,6 +7764,9 @@ gint main(int argc, char *argv[]) {
 	}
 	/* Get rid of requests tasks and thread too */
 	g_thread_pool_free(tasks, FALSE, FALSE);
+	janus_mutex_lock(&session_tasks_mutex);
+	g_clear_pointer(&session_tasks, g_hash_table_destroy);
+	janus_mutex_unlock(&session_tasks_mutex);
 	JANUS_LOG(LOG_INFO, "Ending requests thread...\n");
 	g_async_queue_push(requests, &exit_message);
 	g_thread_join(requests_thread);
@@ -5984,8 +7774,16 @@ gint main(int argc, char *argv[]) {
 	g_async_queue_unref(requests);
 
 	JANUS_LOG(LOG_INFO, "Destroying sessions...\n");
-	g_clear_pointer(&sessions, g_hash_table_destroy);
+	for(shard=0; shard<JANUS_SESSIONS_SHARDS; shard++) {
+		janus_rwlock_write_lock(&sessions[shard].lock);
+		g_clear_pointer(&sessions[shard].table, g_hash_table_destroy);
+		if(sessions[shard].deadlines != NULL)
+			g_array_free(sessions[shard].deadlines, TRUE);
+		sessions[shard].deadlines = NULL;
+		janus_rwlock_write_unlock(&sessions[shard].lock);
+	}
 	janus_ice_deinit();
+	janus_metrics_deinit();
 	JANUS_LOG(LOG_INFO, "Freeing crypto resources...\n");
 	janus_dtls_srtp_cleanup();
 	EVP_cleanup();
@@ -6006,6 +7804,8 @@ gint main(int argc, char *argv[]) {
 		g_hash_table_foreach(plugins_so, janus_pluginso_close, NULL);
 		g_clear_pointer(&plugins_so, g_hash_table_destroy);
 	}
+	/* Plugins (e.g., the SIP relays) rely on the reactor until they're destroyed */
+	janus_reactor_deinit();
 
 	JANUS_LOG(LOG_INFO, "Closing event handlers:\n");
 	janus_events_deinit();
@@ -6020,6 +7820,7 @@ gint main(int argc, char *argv[]) {
 
 	janus_recorder_deinit();
 	g_free(local_ip);
+	g_free(sessions_snapshot);
 	if (public_ips) {
 		g_list_free(public_ips);
 	}
@@ -6029,6 +7830,7 @@ gint main(int argc, char *argv[]) {
 
 	if(janus_ice_get_static_event_loops() > 0)
 		janus_ice_stop_static_event_loops();
+	janus_sched_deinit();
 
 	janus_protected_folders_clear();
 
@@ -40,14 +40,25 @@
 /*! \brief Helper to address requests and their sources (e.g., a specific HTTP connection, websocket, RabbitMQ or others) */
 typedef struct janus_request janus_request;
 
+/*! \brief How many handles of a session can be looked up without involving its hashtable */
+#define JANUS_SESSION_HANDLES_INLINE	4
+
 /*! \brief Janus Core-Client session */
 typedef struct janus_session {
 	/*! \brief Janus Core-Client session ID */
 	guint64 session_id;
 	/*! \brief Map of handles this session is managing */
 	GHashTable *ice_handles;
+	/*! \brief Some of the handles in the map (most sessions only have a few), for quicker lookups */
+	janus_ice_handle *handles[JANUS_SESSION_HANDLES_INLINE];
+	/*! \brief How many handles are in the handles array */
+	guint handles_inline;
+	/*! \brief Read-write lock protecting the map and array of handles */
+	janus_rwlock handles_lock;
 	/*! \brief Time of the last activity on the session */
 	gint64 last_activity;
+	/*! \brief Deadline the sessions watchdog currently knows for this session (0 if none), protected by the lock of its shard */
+	gint64 expiry;
 	/*! \brief Pointer to the request instance (and the transport that originated the session) */
 	janus_request *source;
 	/*! \brief Flag to notify there's been a session timeout */
@@ -56,6 +67,10 @@ typedef struct janus_session {
 	gint timeout;
 	/*! \brief Flag to notify that transport is gone */
 	volatile gint transport_gone;
+	/*! \brief Flag to notify this session was restored from a snapshot, and its handles still need to be notified when it's claimed */
+	volatile gint restored;
+	/*! \brief Log level for all the handles of this session, if more verbose than the global one (0 means just use the global one) */
+	volatile gint log_level;
 	/*! \brief Mutex to lock/unlock this session */
 	janus_mutex mutex;
 	/*! \brief Atomic flag to check if this instance has been destroyed */
@@ -80,6 +95,12 @@ janus_session *janus_session_find(guint64 session_id);
  * @param[in] session The Janus Core-Client session this notification is related to
  * @param[in] event The event to notify as a Jansson JSON object */
 void janus_session_notify_event(janus_session *session, json_t *event);
+/*! \brief Method to add an event to notify to the queue of notifications for this session, when part of its content is shared with other events
+ * \note If the transport supports it, the shared content is serialized only once for all the recipients
+ * @param[in] session The Janus Core-Client session this notification is related to
+ * @param[in] event The event to notify as a Jansson JSON object, without the shared content
+ * @param[in] payload The content shared with other events */
+void janus_session_notify_event_prepared(janus_session *session, json_t *event, janus_transport_payload *payload);
 /*! \brief Method to destroy a Janus Core-Client session
  * @param[in] session The Janus Core-Client session to destroy
  * @returns 0 in case of success, a negative integer otherwise */
@@ -129,6 +150,10 @@ struct janus_request {
 	json_t *message;
 	/*! \brief Pointer to any JSON errors parsing the original request */
 	json_error_t *error;
+	/*! \brief Monotonic time of when the request was received */
+	gint64 received;
+	/*! \brief ID of the session whose requests queue this request is part of, if any */
+	guint64 queued_session;
 	/*! \brief Atomic flag to check if this instance has been destroyed */
 	volatile gint destroyed;
 	/*! \brief Reference counter for this instance */
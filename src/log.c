@@ -6,7 +6,12 @@
  * I/O wait from threads that may be sensitive to such delays. Each time
  * there's stuff to be written (to stdout, log files, or external loggers),
  * it's added to an async queue, which is consumed from a dedicated thread
- * that then actually takes care of I/O.
+ * that then actually takes care of I/O. To keep the cost of busy logging
+ * (e.g., at the highest debug levels) low, lines are formatted into
+ * buffers taken from a preallocated ring (falling back to the heap only
+ * for very long lines, or when the ring is exhausted), and the logging
+ * thread writes all the lines it finds queued with a single \c writev
+ * per destination, rather than writing and flushing them one by one.
  *
  * \ingroup core
  * \ref core
@@ -15,6 +20,7 @@
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/uio.h>
 
 #include "log.h"
 #include "debug.h"
@@ -23,14 +29,63 @@
 
 #define THREAD_NAME "log"
 
+/* Size of the buffers in the ring (longer lines are allocated on the heap) */
+#define JANUS_LOG_BUFFER_SIZE	512
+/* Number of buffers in the ring */
+#define JANUS_LOG_RING_SIZE		1024
+/* Maximum number of lines written with a single writev */
+#define JANUS_LOG_MAX_BATCH		64
+
 typedef struct janus_log_buffer {
 	int64_t timestamp;
+	int level;
+	guint64 handle_id;
+	size_t offset;
 	char *str;
+	size_t len;
+	gboolean pooled;
+	struct janus_log_buffer *next;
+	char data[JANUS_LOG_BUFFER_SIZE];
 } janus_log_buffer;
 static janus_log_buffer exit_message;
+
+/* Preallocated buffers: the ones available are kept in a stack (we use a
+ * GMutex and not a janus_mutex, as the latter may log when debugging locks) */
+static janus_log_buffer log_ring[JANUS_LOG_RING_SIZE];
+static janus_log_buffer *log_ring_available = NULL;
+static GMutex log_ring_mutex;
+static janus_log_buffer *janus_log_buffer_new(void) {
+	static gsize ring_init = 0;
+	if(g_once_init_enter(&ring_init)) {
+		int i = 0;
+		for(i=0; i<JANUS_LOG_RING_SIZE; i++) {
+			log_ring[i].pooled = TRUE;
+			log_ring[i].next = (i < JANUS_LOG_RING_SIZE-1) ? &log_ring[i+1] : NULL;
+		}
+		log_ring_available = &log_ring[0];
+		g_once_init_leave(&ring_init, 1);
+	}
+	g_mutex_lock(&log_ring_mutex);
+	janus_log_buffer *b = log_ring_available;
+	if(b != NULL)
+		log_ring_available = b->next;
+	g_mutex_unlock(&log_ring_mutex);
+	if(b != NULL)
+		b->next = NULL;
+	return b;
+}
 static void janus_log_buffer_free(janus_log_buffer *b) {
 	if(b == NULL || b == &exit_message)
 		return;
+	if(b->pooled) {
+		/* Put the buffer back in the ring */
+		b->str = NULL;
+		g_mutex_lock(&log_ring_mutex);
+		b->next = log_ring_available;
+		log_ring_available = b;
+		g_mutex_unlock(&log_ring_mutex);
+		return;
+	}
 	g_free(b->str);
 	g_free(b);
 }
@@ -59,11 +114,46 @@ char *janus_log_get_logfile_path(void) {
 	return janus_log_filepath;
 }
 
-static void janus_log_print_buffer(janus_log_buffer *b) {
+/* Helper to write a set of lines to a file, taking care of partial writes */
+static void janus_log_write(FILE *file, janus_log_buffer **batch, int count) {
+	struct iovec iov[JANUS_LOG_MAX_BATCH];
+	int i = 0;
+	for(i=0; i<count; i++) {
+		iov[i].iov_base = batch[i]->str;
+		iov[i].iov_len = batch[i]->len;
+	}
+	/* Anything written through stdio (e.g., before the logger started) goes first */
+	fflush(file);
+	int fd = fileno(file);
+	struct iovec *next = iov;
+	while(count > 0) {
+		ssize_t written = writev(fd, next, count);
+		if(written < 0) {
+			if(errno == EINTR)
+				continue;
+			/* There's not much we can do (we can't even log it) */
+			return;
+		}
+		/* Skip what has been written already */
+		while(count > 0 && (size_t)written >= next->iov_len) {
+			written -= next->iov_len;
+			next++;
+			count--;
+		}
+		if(count > 0 && written > 0) {
+			next->iov_base = (char *)next->iov_base + written;
+			next->iov_len -= written;
+		}
+	}
+}
+
+static void janus_log_print_batch(janus_log_buffer **batch, int count) {
+	if(count < 1)
+		return;
 	if(janus_log_console)
-		fputs(b->str, stdout);
+		janus_log_write(stdout, batch, count);
 	if(janus_log_file)
-		fputs(b->str, janus_log_file);
+		janus_log_write(janus_log_file, batch, count);
 	if(external_loggers != NULL) {
 		GHashTableIter iter;
 		gpointer value;
@@ -72,42 +162,73 @@ static void janus_log_print_buffer(janus_log_buffer *b) {
 			janus_logger *l = value;
 			if(l == NULL)
 				continue;
-			l->incoming_logline(b->timestamp, b->str);
+			int i = 0;
+			if(l->incoming_logrecord != NULL) {
+				/* This logger wants structured records, rather than lines */
+				for(i=0; i<count; i++) {
+					janus_log_record record = {
+						.timestamp = batch[i]->timestamp,
+						.level = batch[i]->level,
+						.handle_id = batch[i]->handle_id,
+						.line = batch[i]->str,
+						.message = batch[i]->str + batch[i]->offset,
+						.message_len = batch[i]->len - batch[i]->offset
+					};
+					l->incoming_logrecord(&record);
+				}
+				continue;
+			}
+			for(i=0; i<count; i++)
+				l->incoming_logline(batch[i]->timestamp, batch[i]->str);
 		}
 	}
-	/* Flush the buffers */
-	if(janus_log_console)
-		fflush(stdout);
-	if(janus_log_file)
-		fflush(janus_log_file);
+}
+
+/* Helper to print and then get rid of all the lines we have in a batch */
+static void janus_log_flush_batch(janus_log_buffer **batch, int *count) {
+	janus_log_print_batch(batch, *count);
+	int i = 0;
+	for(i=0; i<*count; i++)
+		janus_log_buffer_free(batch[i]);
+	*count = 0;
 }
 
 static void *janus_log_thread(void *ctx) {
 	janus_log_buffer *b = NULL;
+	janus_log_buffer *batch[JANUS_LOG_MAX_BATCH];
+	int count = 0;
 
 	while(!g_atomic_int_get(&stopping)) {
+		/* Wait for a line, and then grab all the others that are already queued */
 		b = g_async_queue_pop(janus_log_queue);
-		if(b == NULL || b == &exit_message)
-			break;
-		if(b->str == NULL) {
-			janus_log_buffer_free(b);
-			continue;
+		while(b != NULL && b != &exit_message) {
+			if(b->str == NULL) {
+				janus_log_buffer_free(b);
+			} else {
+				batch[count] = b;
+				count++;
+				if(count == JANUS_LOG_MAX_BATCH)
+					janus_log_flush_batch(batch, &count);
+			}
+			b = g_async_queue_try_pop(janus_log_queue);
 		}
-		/* We have something to log */
-		janus_log_print_buffer(b);
-		/* Done, get rid of this log line */
-		janus_log_buffer_free(b);
+		/* Write all the lines we have with as few syscalls as possible */
+		janus_log_flush_batch(batch, &count);
+		if(b == &exit_message)
+			break;
 	}
 	/* Print all that's left to print */
 	while((b = g_async_queue_try_pop(janus_log_queue)) != NULL) {
-		if(b->str != NULL)
-			janus_log_print_buffer(b);
-		janus_log_buffer_free(b);
+		if(b->str != NULL) {
+			batch[count] = b;
+			count++;
+			if(count == JANUS_LOG_MAX_BATCH)
+				janus_log_flush_batch(batch, &count);
+		} else {
+			janus_log_buffer_free(b);
+		}
 	}
-	if(janus_log_console)
-		fflush(stdout);
-	if(janus_log_file)
-		fflush(janus_log_file);
+	janus_log_flush_batch(batch, &count);
 
 	if(janus_log_file)
 		fclose(janus_log_file);
@@ -118,26 +239,97 @@ static void *janus_log_thread(void *ctx) {
 	return NULL;
 }
 
-void janus_vprintf(const char *format, ...) {
+gboolean janus_log_ratelimit_allow(janus_log_ratelimit *rl, int *suppressed) {
+	if(rl == NULL)
+		return TRUE;
+	gboolean allowed = FALSE;
+	gint64 now = janus_get_monotonic_time();
+	g_bit_lock(&rl->lock, 0);
+	/* Refill the bucket depending on how much time passed */
+	if(rl->refilled == 0) {
+		rl->tokens = JANUS_LOG_RATELIMIT_RATE;
+		rl->refilled = now;
+	} else if(now > rl->refilled) {
+		gint64 tokens = ((now - rl->refilled) * JANUS_LOG_RATELIMIT_RATE) / G_USEC_PER_SEC;
+		if(tokens > 0) {
+			rl->tokens = MIN(JANUS_LOG_RATELIMIT_RATE, rl->tokens + tokens);
+			rl->refilled = now;
+		}
+	}
+	if(rl->tokens > 0) {
+		rl->tokens--;
+		allowed = TRUE;
+		if(suppressed)
+			*suppressed = rl->suppressed;
+		rl->suppressed = 0;
+	} else {
+		rl->suppressed++;
+	}
+	g_bit_unlock(&rl->lock, 0);
+	return allowed;
+}
+
+static void janus_log_queue_line(int level, guint64 handle_id, size_t offset, const char *format, va_list args) {
 	if(g_atomic_int_get(&stopping))
 		return;
 	if(janus_log_queue == NULL)
 		janus_log_queue = g_async_queue_new_full((GDestroyNotify)janus_log_buffer_free);
-	/* Serialize it to a string */
+	/* Serialize it to a string: we try a buffer from the ring first */
 	va_list ap;
-	va_start(ap, format);
-	char *str = NULL;
-	int len = g_vasprintf(&str, format, ap);
-	va_end(ap);
-	if(len < 0 || str == NULL)
-		return;
+	janus_log_buffer *b = janus_log_buffer_new();
+	if(b != NULL) {
+		va_copy(ap, args);
+		int len = g_vsnprintf(b->data, JANUS_LOG_BUFFER_SIZE, format, ap);
+		va_end(ap);
+		if(len < 0) {
+			janus_log_buffer_free(b);
+			return;
+		}
+		if(len < JANUS_LOG_BUFFER_SIZE) {
+			b->str = b->data;
+			b->len = len;
+		} else {
+			/* Too long for the ring */
+			janus_log_buffer_free(b);
+			b = NULL;
+		}
+	}
+	if(b == NULL) {
+		char *str = NULL;
+		va_copy(ap, args);
+		int len = g_vasprintf(&str, format, ap);
+		va_end(ap);
+		if(len < 0 || str == NULL)
+			return;
+		/* We don't need the embedded data buffer in this case */
+		b = g_malloc(G_STRUCT_OFFSET(janus_log_buffer, data));
+		b->str = str;
+		b->len = len;
+		b->pooled = FALSE;
+		b->next = NULL;
+	}
 	/* Queue the new log buffer */
-	janus_log_buffer *b = g_malloc(sizeof(janus_log_buffer));
 	b->timestamp = janus_get_real_time();
-	b->str = str;
+	b->level = level;
+	b->handle_id = handle_id;
+	b->offset = MIN(offset, b->len);
 	g_async_queue_push(janus_log_queue, b);
 }
 
+void janus_vprintf(const char *format, ...) {
+	va_list ap;
+	va_start(ap, format);
+	janus_log_queue_line(LOG_NONE, 0, 0, format, ap);
+	va_end(ap);
+}
+
+void janus_log_printf(int level, guint64 handle_id, size_t offset, const char *format, ...) {
+	va_list ap;
+	va_start(ap, format);
+	janus_log_queue_line(level, handle_id, offset, format, ap);
+	va_end(ap);
+}
+
 int janus_log_init(gboolean daemon, gboolean console, const char *logfile, GHashTable *loggers) {
 	/* Make sure we only initialize once */
 	if(!g_atomic_int_compare_and_exchange(&initialized, 0, 1))
@@ -199,7 +391,7 @@ void janus_log_destroy(void) {
 		janus_log_buffer *b = NULL;
 		while((b = g_async_queue_try_pop(janus_log_queue)) != NULL) {
 			if(b->str != NULL)
-				janus_log_print_buffer(b);
+				janus_log_print_batch(&b, 1);
 			janus_log_buffer_free(b);
 		}
 	}
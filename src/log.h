@@ -23,6 +23,49 @@
 * optional parameters to insert into formatted string (printf style)
 * \note This output is buffered and may not appear immediately on stdout. */
 void janus_vprintf(const char *format, ...) G_GNUC_PRINTF(1, 2);
+/*! \brief Buffered vprintf, with the info needed by structured loggers
+* \note This is what the JANUS_LOG family of macros use
+* @param[in] level The log level of the line
+* @param[in] handle_id The ID of the handle the line refers to, if any (0 otherwise)
+* @param[in] offset Where the actual message starts in the formatted line (i.e., the length of timestamp and other prefixes)
+* @param[in] format Format string as defined by glib, followed by the
+* optional parameters to insert into formatted string (printf style) */
+void janus_log_printf(int level, guint64 handle_id, size_t offset, const char *format, ...) G_GNUC_PRINTF(4, 5);
+
+/*! \brief Structured log record, as passed to loggers that support them */
+typedef struct janus_log_record {
+	/*! \brief Real time of when the line was logged */
+	gint64 timestamp;
+	/*! \brief Log level of the line (0 for lines that were just printed, e.g., with JANUS_PRINT) */
+	int level;
+	/*! \brief ID of the handle the line refers to, if any (0 otherwise) */
+	guint64 handle_id;
+	/*! \brief The whole line, as it would be written to the console */
+	const char *line;
+	/*! \brief The message only, without any timestamp and prefix (points within line) */
+	const char *message;
+	/*! \brief Length of the message */
+	size_t message_len;
+} janus_log_record;
+
+/*! \brief Number of rate limited lines a single call site can print per second (and burst) */
+#define JANUS_LOG_RATELIMIT_RATE	10
+/*! \brief Token bucket used by JANUS_LOG_RATELIMITED for each call site */
+typedef struct janus_log_ratelimit {
+	/*! \brief Lock for the bucket (a bit lock, so that static initialization is enough) */
+	volatile gint lock;
+	/*! \brief Tokens currently available */
+	gint tokens;
+	/*! \brief Monotonic time of the last refill */
+	gint64 refilled;
+	/*! \brief Lines dropped since the last one that was printed */
+	gint suppressed;
+} janus_log_ratelimit;
+/*! \brief Check whether a rate limited line can be printed
+ * @param[in] rl The token bucket of the call site
+ * @param[out] suppressed How many lines were suppressed since the last one that was printed
+ * @returns TRUE if the line can be printed, FALSE if it should be dropped */
+gboolean janus_log_ratelimit_allow(janus_log_ratelimit *rl, int *suppressed);
 
 /*! \brief Log initialization
 * \note This should be called before attempting to use the logger. A buffer
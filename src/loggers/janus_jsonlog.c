@@ -6,12 +6,22 @@
  * there to showcase how you can implement your own external logger for
  * log lines coming from the Janus core or one of the plugins. This
  * specific logger plugin serializes log lines to a JSON object and
- * saves them all to a configured local file.
+ * saves them all to a configured local file. It receives structured
+ * records from the core, so each object contains the level and, when
+ * available, the handle ID the line refers to, besides the message.
+ * As an alternative to JSON, records can also be saved in a compact
+ * binary format (\c binary=true in the configuration), which is much
+ * cheaper to write when verbose logging needs to be always on. Each
+ * record is made of the timestamp (64 bits), the level (8 bits), the
+ * handle ID (64 bits, 0 if none) and the length of the message (32 bits),
+ * all in network byte order, followed by the message itself.
  *
  * \ingroup loggers
  * \ref loggers
  */
 
+#include <arpa/inet.h>
+
 #include "logger.h"
 
 #include "../debug.h"
@@ -39,7 +49,7 @@ const char *janus_jsonlog_get_description(void);
 const char *janus_jsonlog_get_name(void);
 const char *janus_jsonlog_get_author(void);
 const char *janus_jsonlog_get_package(void);
-void janus_jsonlog_incoming_logline(int64_t timestamp, const char *line);
+void janus_jsonlog_incoming_logrecord(const janus_log_record *record);
 json_t *janus_jsonlog_handle_request(json_t *request);
 
 /* Logger setup */
@@ -56,7 +66,7 @@ static janus_logger janus_jsonlog =
 		.get_author = janus_jsonlog_get_author,
 		.get_package = janus_jsonlog_get_package,
 
-		.incoming_logline = janus_jsonlog_incoming_logline,
+		.incoming_logrecord = janus_jsonlog_incoming_logrecord,
 		.handle_request = janus_jsonlog_handle_request,
 	);
 
@@ -75,6 +85,8 @@ static janus_mutex logger_mutex;
 
 /* JSON serialization options */
 static size_t json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
+/* Whether we should save records in binary format, rather than JSON */
+static gboolean binary_format = FALSE;
 
 /* Queue of log lines to handle */
 static GAsyncQueue *loglines = NULL;
@@ -82,13 +94,15 @@ static GAsyncQueue *loglines = NULL;
 /* Structure we use for queueing log lines */
 typedef struct janus_jsonlog_line {
 	int64_t timestamp;		/* When the log line was printed */
-	char *line;				/* Content of the log line */
+	int level;				/* Level of the log line */
+	guint64 handle_id;		/* Handle the log line refers to, if any */
+	size_t len;				/* Length of the message */
+	char line[];			/* Content of the log line (no prefixes) */
 } janus_jsonlog_line;
 static janus_jsonlog_line exit_line;
 static void janus_jsonlog_line_free(janus_jsonlog_line *jline) {
 	if(!jline || jline == &exit_line)
 		return;
-	g_free(jline->line);
 	g_free(jline);
 }
 
@@ -172,6 +186,10 @@ int janus_jsonlog_init(const char *server_name, const char *config_path) {
 					json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
 				}
 			}
+			/* Check if we should save binary records instead */
+			item = janus_config_get(config, config_general, janus_config_type_item, "binary");
+			if(item && item->value)
+				binary_format = janus_is_true(item->value);
 			/* Done */
 			enabled = (logfile != NULL);
 		}
@@ -258,8 +276,8 @@ const char *janus_jsonlog_get_package(void) {
 	return JANUS_JSONLOG_PACKAGE;
 }
 
-void janus_jsonlog_incoming_logline(int64_t timestamp, const char *line) {
-	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized) || line == NULL) {
+void janus_jsonlog_incoming_logrecord(const janus_log_record *record) {
+	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized) || record == NULL || record->message == NULL) {
 		/* Janus is closing or the plugin is */
 		return;
 	}
@@ -267,13 +285,18 @@ void janus_jsonlog_incoming_logline(int64_t timestamp, const char *line) {
 	/* Do NOT handle the log line here in this callback! Since Janus sends
 	 * log lines from its internal logger thread, performing I/O or network
 	 * operations in here could dangerously slow Janus down. Let's just
-	 * duplicate and enqueue the string containing the log line, and handle
-	 * it in our own thread: we have a monotonic time indicator of when the
-	 * log line was actually added on this machine, so that, if relevant, we can
+	 * copy and enqueue the record (with a single allocation), and serialize
+	 * it in our own thread: we have a time indicator of when the log line
+	 * was actually added on this machine, so that, if relevant, we can
 	 * compute any delay in the actual log line processing ourselves. */
-	janus_jsonlog_line *l = g_malloc(sizeof(janus_jsonlog_line));
-	l->timestamp = timestamp;
-	l->line = g_strdup(line);
+	size_t len = record->message_len;
+	janus_jsonlog_line *l = g_malloc(sizeof(janus_jsonlog_line) + len + 1);
+	l->timestamp = record->timestamp;
+	l->level = record->level;
+	l->handle_id = record->handle_id;
+	l->len = len;
+	memcpy(l->line, record->message, len);
+	l->line[len] = '\0';
 	g_async_queue_push(loglines, l);
 
 }
@@ -313,6 +336,18 @@ plugin_response:
 		}
 }
 
+/* Helper to write a buffer to the log file */
+static void janus_jsonlog_write(const char *buffer, size_t len) {
+	size_t offset = 0, written = 0;
+	while(len > 0) {
+		written = fwrite(buffer + offset, sizeof(char), len, logfile);
+		if(written == 0)
+			break;
+		len -= written;
+		offset += written;
+	}
+}
+
 /* Thread to handle incoming log lines */
 static void *janus_jsonlog_thread(void *data) {
 	JANUS_LOG(LOG_VERB, "Joining JSON logger thread\n");
@@ -320,7 +355,7 @@ static void *janus_jsonlog_thread(void *data) {
 	janus_jsonlog_line *jline = NULL;
 	json_t *json = NULL;
 	char *json_text = NULL;
-	size_t json_len = 0, offset = 0, written = 0;
+	char header[21];
 
 	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
 		/* Get a log line from the queue */
@@ -328,29 +363,40 @@ static void *janus_jsonlog_thread(void *data) {
 		if(jline == &exit_line)
 			break;
 
-		/* Create a new JSON object with its contents */
-		json = json_object();
-		json_object_set_new(json, "timestamp", json_integer(jline->timestamp));
-		if(jline->line != NULL)
+		if(binary_format) {
+			/* Write a compact binary record */
+			guint64 timestamp = GUINT64_TO_BE((guint64)jline->timestamp);
+			guint64 handle_id = GUINT64_TO_BE(jline->handle_id);
+			guint32 len = htonl((guint32)jline->len);
+			memcpy(header, &timestamp, sizeof(timestamp));
+			header[8] = (char)jline->level;
+			memcpy(header + 9, &handle_id, sizeof(handle_id));
+			memcpy(header + 17, &len, sizeof(len));
+			janus_jsonlog_write(header, sizeof(header));
+			janus_jsonlog_write(jline->line, jline->len);
+			janus_jsonlog_line_free(jline);
+		} else {
+			/* Create a new JSON object with its contents */
+			json = json_object();
+			json_object_set_new(json, "timestamp", json_integer(jline->timestamp));
+			json_object_set_new(json, "level", json_integer(jline->level));
+			if(jline->handle_id > 0)
+				json_object_set_new(json, "handle_id", json_integer(jline->handle_id));
 			json_object_set_new(json, "line", json_string(jline->line));
-		janus_jsonlog_line_free(jline);
-
-		/* Convert the JSON object to string */
-		json_text = json_dumps(json, json_format);
-		json_decref(json);
-
-		/* Save it to file */
-		json_len = strlen(json_text);
-		offset = 0;
-		while(json_len > 0) {
-			written = fwrite(json_text + offset, sizeof(char), json_len, logfile);
-			json_len -= written;
-			offset += written;
+			janus_jsonlog_line_free(jline);
+
+			/* Convert the JSON object to string, and save it to file */
+			json_text = json_dumps(json, json_format);
+			json_decref(json);
+			if(json_text != NULL) {
+				janus_jsonlog_write(json_text, strlen(json_text));
+				janus_jsonlog_write("\n", 1);
+				free(json_text);
+			}
 		}
-		const char *lf = "\n";
-		fwrite(lf, sizeof(char), strlen(lf), logfile);
-		fflush(logfile);
-		free(json_text);
+		/* Only flush when there's nothing else to write right away */
+		if(g_async_queue_length(loglines) <= 0)
+			fflush(logfile);
 	}
 	JANUS_LOG(LOG_VERB, "Leaving JSON logger thread\n");
 	return NULL;
@@ -49,6 +49,12 @@ janus_logger *create(void) {
  *
  * All the above methods and callbacks are mandatory: the Janus core will
  * reject al logger plugin that doesn't implement any of the mandatory callbacks.
+ * The only exception is \c incoming_logline(), which can be replaced by
+ * \c incoming_logrecord(): this callback receives structured records
+ * instead (a janus_log_record with the timestamp, level, handle ID, and
+ * the message without any prefix), which saves loggers that need any of
+ * that info from having to parse the line themselves. When a logger
+ * implements both, only \c incoming_logrecord() is used.
  *
  * Unlike other kind of modules (transports, plugins), the \c init() method
  * here only passes the path to the configurations files folder, as loggers
@@ -81,10 +87,11 @@ janus_logger *create(void) {
 #include <jansson.h>
 
 #include "../utils.h"
+#include "../log.h"
 
 
 /*! \brief Version of the API, to match the one logger plugins were compiled against */
-#define JANUS_LOGGER_API_VERSION	3
+#define JANUS_LOGGER_API_VERSION	4
 
 /*! \brief Initialization of all logger plugin properties to NULL
  *
@@ -112,6 +119,7 @@ static janus_logger janus_fake_logger_plugin =
 		.get_author = NULL,						\
 		.get_package = NULL,					\
 		.incoming_logline = NULL,				\
+		.incoming_logrecord = NULL,				\
 		## __VA_ARGS__ }
 
 
@@ -157,6 +165,16 @@ struct janus_logger {
 	 * @param[in] timestamp Monotonic timestamp of when the log line was printed
 	 * @param[in] line String containing the log line */
 	void (* const incoming_logline)(int64_t timestamp, const char *line);
+	/*! \brief Method to notify the logger plugin that a new log record is available
+	 * \details This is an alternative to incoming_logline for loggers that
+	 * need structured info on each line (level, handle ID, etc.), and that
+	 * would otherwise need to parse the line to get it
+	 * \note The same considerations made for incoming_logline apply here:
+	 * don't handle the record in this method, and copy what you need, as
+	 * neither the record nor the strings it points to are valid after this
+	 * method returns.
+	 * @param[in] record The log record */
+	void (* const incoming_logrecord)(const janus_log_record *record);
 
 	/*! \brief Method to send a request to this specific logger plugin
 	 * \details The method takes a Jansson json_t, that contains all the info related
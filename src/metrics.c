@@ -0,0 +1,232 @@
+/*! \file    metrics.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Metrics
+ * \details  Simple registry of counters, gauges and histograms, meant to
+ * be scraped in OpenMetrics format (e.g., by Prometheus) without having
+ * to walk all sessions and handles the way the Admin API does. Counters
+ * are updated on the media path, which is why they're split in shards:
+ * each thread is associated to a shard the first time it updates a
+ * counter, so that threads serving different handles don't compete on
+ * the same cache lines; shards are only summed when the metrics are
+ * rendered. Histograms are only meant for values sampled on a regular
+ * basis (e.g., once per second per PeerConnection), and so aren't sharded.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include "metrics.h"
+#include "mutex.h"
+
+/* Shards of counters: each one is padded so that it gets its own cache lines */
+#define JANUS_METRICS_SHARDS	16
+typedef struct janus_metrics_shard {
+	volatile gsize counters[JANUS_METRICS_COUNTERS];
+	char padding[64];
+} janus_metrics_shard;
+static janus_metrics_shard shards[JANUS_METRICS_SHARDS];
+static volatile gint next_shard = 0;
+static GPrivate thread_shard = G_PRIVATE_INIT(NULL);
+
+/* Counters are rendered in families, with a label for the direction */
+static const struct {
+	const char *name, *help;
+	janus_metrics_counter in, out;
+} counter_families[] = {
+	{ "janus_media_packets", "Packets received and sent on PeerConnections",
+		JANUS_METRICS_PACKETS_IN, JANUS_METRICS_PACKETS_OUT },
+	{ "janus_media_bytes", "Bytes received and sent on PeerConnections",
+		JANUS_METRICS_BYTES_IN, JANUS_METRICS_BYTES_OUT },
+	{ "janus_nacks", "Packets NACKed by peers (in) and by us (out)",
+		JANUS_METRICS_NACKS_IN, JANUS_METRICS_NACKS_OUT },
+	{ "janus_plis", "PLIs received from peers (in) and sent to peers (out)",
+		JANUS_METRICS_PLIS_IN, JANUS_METRICS_PLIS_OUT },
+	{ "janus_srtp_errors", "SRTP/SRTCP unprotect (in) and protect (out) errors",
+		JANUS_METRICS_SRTP_ERRORS_IN, JANUS_METRICS_SRTP_ERRORS_OUT },
+	{ NULL, NULL, 0, 0 }
+};
+
+/* Histograms have fixed buckets: we keep non-cumulative counts for each
+ * bucket (plus one for larger values), and make them cumulative when rendering */
+#define JANUS_METRICS_MAX_BUCKETS	10
+typedef struct janus_metrics_histogram_info {
+	const char *name, *help;
+	guint buckets[JANUS_METRICS_MAX_BUCKETS];
+	guint num_buckets;
+	volatile gsize counts[JANUS_METRICS_MAX_BUCKETS+1];
+	volatile gsize sum;
+} janus_metrics_histogram_info;
+static janus_metrics_histogram_info histograms[JANUS_METRICS_HISTOGRAMS] = {
+	{ "janus_rtt_milliseconds", "Round trip time of PeerConnections, sampled every second",
+		{ 10, 25, 50, 100, 200, 400, 800, 1600 }, 8, { 0 }, 0 },
+	{ "janus_queue_depth_packets", "Outgoing packets queued for a handle, sampled every second",
+		{ 0, 10, 50, 100, 500, 1000, 5000 }, 7, { 0 }, 0 },
+	{ "janus_request_queue_milliseconds", "Time API requests waited before being processed",
+		{ 1, 5, 10, 50, 100, 500, 1000, 5000 }, 8, { 0 }, 0 },
+	{ "janus_dtls_handshake_milliseconds", "Time DTLS handshakes took to complete, retransmissions included",
+		{ 10, 25, 50, 100, 250, 500, 1000, 2500, 5000 }, 9, { 0 }, 0 },
+	{ "janus_handle_setup_microseconds", "Time the local setup of PeerConnections (ICE agent and DTLS stack) took",
+		{ 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000 }, 10, { 0 }, 0 }
+};
+
+/* Handles attached to each plugin */
+static GHashTable *plugin_handles = NULL;
+static janus_mutex plugin_handles_mutex = JANUS_MUTEX_INITIALIZER;
+
+
+void janus_metrics_init(void) {
+	janus_mutex_lock(&plugin_handles_mutex);
+	if(plugin_handles == NULL)
+		plugin_handles = g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, NULL);
+	janus_mutex_unlock(&plugin_handles_mutex);
+}
+
+void janus_metrics_deinit(void) {
+	janus_mutex_lock(&plugin_handles_mutex);
+	if(plugin_handles != NULL)
+		g_hash_table_destroy(plugin_handles);
+	plugin_handles = NULL;
+	janus_mutex_unlock(&plugin_handles_mutex);
+}
+
+void janus_metrics_add(janus_metrics_counter counter, guint value) {
+	if(counter >= JANUS_METRICS_COUNTERS || value == 0)
+		return;
+	/* Find out which shard this thread is associated with */
+	guint shard = GPOINTER_TO_UINT(g_private_get(&thread_shard));
+	if(shard == 0) {
+		shard = ((guint)g_atomic_int_add(&next_shard, 1) % JANUS_METRICS_SHARDS) + 1;
+		g_private_set(&thread_shard, GUINT_TO_POINTER(shard));
+	}
+	g_atomic_pointer_add(&shards[shard-1].counters[counter], value);
+}
+
+void janus_metrics_observe(janus_metrics_histogram histogram, guint value) {
+	if(histogram >= JANUS_METRICS_HISTOGRAMS)
+		return;
+	janus_metrics_histogram_info *h = &histograms[histogram];
+	guint i = 0;
+	while(i < h->num_buckets && value > h->buckets[i])
+		i++;
+	g_atomic_pointer_add(&h->counts[i], 1);
+	g_atomic_pointer_add(&h->sum, value);
+}
+
+double janus_metrics_percentile(janus_metrics_histogram histogram, double percentile) {
+	if(histogram >= JANUS_METRICS_HISTOGRAMS)
+		return 0;
+	janus_metrics_histogram_info *h = &histograms[histogram];
+	guint64 counts[JANUS_METRICS_MAX_BUCKETS+1], total = 0;
+	guint b = 0;
+	for(b=0; b<=h->num_buckets; b++) {
+		counts[b] = (gsize)g_atomic_pointer_get(&h->counts[b]);
+		total += counts[b];
+	}
+	if(total == 0)
+		return 0;
+	double rank = (percentile / 100.0) * (double)total, seen = 0;
+	for(b=0; b<h->num_buckets; b++) {
+		if(counts[b] > 0 && seen + counts[b] >= rank) {
+			/* Assume the samples are evenly spread within the bucket */
+			double lower = b > 0 ? h->buckets[b-1] : 0;
+			return lower + (h->buckets[b] - lower) * ((rank - seen) / (double)counts[b]);
+		}
+		seen += counts[b];
+	}
+	/* The percentile is in the overflow bucket, return its lower bound */
+	return h->num_buckets > 0 ? h->buckets[h->num_buckets-1] : 0;
+}
+
+void janus_metrics_plugin_handles(const char *package, int delta) {
+	if(package == NULL || delta == 0)
+		return;
+	janus_mutex_lock(&plugin_handles_mutex);
+	if(plugin_handles == NULL) {
+		janus_mutex_unlock(&plugin_handles_mutex);
+		return;
+	}
+	gint handles = GPOINTER_TO_INT(g_hash_table_lookup(plugin_handles, package)) + delta;
+	g_hash_table_insert(plugin_handles, g_strdup(package), GINT_TO_POINTER(handles > 0 ? handles : 0));
+	janus_mutex_unlock(&plugin_handles_mutex);
+}
+
+void janus_metrics_print_family(GString *output, const char *name, const char *type, const char *help) {
+	if(output == NULL || name == NULL || type == NULL)
+		return;
+	g_string_append_printf(output, "# TYPE %s %s\n", name, type);
+	if(help != NULL)
+		g_string_append_printf(output, "# HELP %s %s\n", name, help);
+}
+
+void janus_metrics_print_sample(GString *output, const char *name, const char *labels, double value) {
+	if(output == NULL || name == NULL)
+		return;
+	g_string_append(output, name);
+	if(labels != NULL)
+		g_string_append_printf(output, "{%s}", labels);
+	/* Integers are printed as such, to avoid losing precision on large counters */
+	if(value > -1e18 && value < 1e18 && value == (double)(gint64)value)
+		g_string_append_printf(output, " %"G_GINT64_FORMAT"\n", (gint64)value);
+	else
+		g_string_append_printf(output, " %g\n", value);
+}
+
+static guint64 janus_metrics_counter_sum(janus_metrics_counter counter) {
+	guint64 total = 0;
+	int i = 0;
+	for(i=0; i<JANUS_METRICS_SHARDS; i++)
+		total += (gsize)g_atomic_pointer_get(&shards[i].counters[counter]);
+	return total;
+}
+
+void janus_metrics_print(GString *output) {
+	if(output == NULL)
+		return;
+	/* Counters */
+	char name[64];
+	int i = 0;
+	while(counter_families[i].name != NULL) {
+		janus_metrics_print_family(output, counter_families[i].name, "counter", counter_families[i].help);
+		g_snprintf(name, sizeof(name), "%s_total", counter_families[i].name);
+		janus_metrics_print_sample(output, name, "direction=\"in\"",
+			(double)janus_metrics_counter_sum(counter_families[i].in));
+		janus_metrics_print_sample(output, name, "direction=\"out\"",
+			(double)janus_metrics_counter_sum(counter_families[i].out));
+		i++;
+	}
+	/* Histograms */
+	char labels[32];
+	for(i=0; i<JANUS_METRICS_HISTOGRAMS; i++) {
+		janus_metrics_histogram_info *h = &histograms[i];
+		janus_metrics_print_family(output, h->name, "histogram", h->help);
+		g_snprintf(name, sizeof(name), "%s_bucket", h->name);
+		guint64 count = 0;
+		guint b = 0;
+		for(b=0; b<h->num_buckets; b++) {
+			count += (gsize)g_atomic_pointer_get(&h->counts[b]);
+			g_snprintf(labels, sizeof(labels), "le=\"%u\"", h->buckets[b]);
+			janus_metrics_print_sample(output, name, labels, (double)count);
+		}
+		count += (gsize)g_atomic_pointer_get(&h->counts[h->num_buckets]);
+		janus_metrics_print_sample(output, name, "le=\"+Inf\"", (double)count);
+		g_snprintf(name, sizeof(name), "%s_count", h->name);
+		janus_metrics_print_sample(output, name, NULL, (double)count);
+		g_snprintf(name, sizeof(name), "%s_sum", h->name);
+		janus_metrics_print_sample(output, name, NULL, (double)(gsize)g_atomic_pointer_get(&h->sum));
+	}
+	/* Per-plugin gauges */
+	janus_metrics_print_family(output, "janus_plugin_handles", "gauge", "Handles attached to each plugin");
+	janus_mutex_lock(&plugin_handles_mutex);
+	if(plugin_handles != NULL) {
+		GHashTableIter iter;
+		gpointer key, value;
+		g_hash_table_iter_init(&iter, plugin_handles);
+		while(g_hash_table_iter_next(&iter, &key, &value)) {
+			char *plugin_label = g_strdup_printf("plugin=\"%s\"", (char *)key);
+			janus_metrics_print_sample(output, "janus_plugin_handles", plugin_label, (double)GPOINTER_TO_INT(value));
+			g_free(plugin_label);
+		}
+	}
+	janus_mutex_unlock(&plugin_handles_mutex);
+}
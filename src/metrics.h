@@ -0,0 +1,108 @@
+/*! \file    metrics.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Metrics (headers)
+ * \details  Simple registry of counters, gauges and histograms, meant to
+ * be scraped in OpenMetrics format (e.g., by Prometheus) without having
+ * to walk all sessions and handles the way the Admin API does. Counters
+ * are updated on the media path, which is why they're split in shards:
+ * each thread is associated to a shard the first time it updates a
+ * counter, so that threads serving different handles don't compete on
+ * the same cache lines; shards are only summed when the metrics are
+ * rendered. Histograms are only meant for values sampled on a regular
+ * basis (e.g., once per second per PeerConnection), and so aren't sharded.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef JANUS_METRICS_H
+#define JANUS_METRICS_H
+
+#include <glib.h>
+
+/*! \brief Counters updated by the core */
+typedef enum janus_metrics_counter {
+	/*! \brief Packets received on PeerConnections (DTLS, RTP and RTCP) */
+	JANUS_METRICS_PACKETS_IN = 0,
+	/*! \brief Packets sent on PeerConnections (DTLS, RTP and RTCP) */
+	JANUS_METRICS_PACKETS_OUT,
+	/*! \brief Bytes received on PeerConnections */
+	JANUS_METRICS_BYTES_IN,
+	/*! \brief Bytes sent on PeerConnections */
+	JANUS_METRICS_BYTES_OUT,
+	/*! \brief Packets NACKed by peers */
+	JANUS_METRICS_NACKS_IN,
+	/*! \brief Packets we NACKed */
+	JANUS_METRICS_NACKS_OUT,
+	/*! \brief PLIs received from peers */
+	JANUS_METRICS_PLIS_IN,
+	/*! \brief PLIs sent to peers */
+	JANUS_METRICS_PLIS_OUT,
+	/*! \brief SRTP/SRTCP unprotect errors */
+	JANUS_METRICS_SRTP_ERRORS_IN,
+	/*! \brief SRTP/SRTCP protect errors */
+	JANUS_METRICS_SRTP_ERRORS_OUT,
+	/*! \brief Number of counters (must be last) */
+	JANUS_METRICS_COUNTERS
+} janus_metrics_counter;
+
+/*! \brief Histograms updated by the core */
+typedef enum janus_metrics_histogram {
+	/*! \brief Round trip time of PeerConnections, in milliseconds */
+	JANUS_METRICS_RTT = 0,
+	/*! \brief Outgoing packets queued for a handle */
+	JANUS_METRICS_QUEUE_DEPTH,
+	/*! \brief How long API requests waited before being processed, in milliseconds */
+	JANUS_METRICS_REQUEST_LATENCY,
+	/*! \brief How long DTLS handshakes took to complete, in milliseconds */
+	JANUS_METRICS_DTLS_HANDSHAKE,
+	/*! \brief How long the local setup of PeerConnections (ICE agent and DTLS stack) took, in microseconds */
+	JANUS_METRICS_HANDLE_SETUP,
+	/*! \brief Number of histograms (must be last) */
+	JANUS_METRICS_HISTOGRAMS
+} janus_metrics_histogram;
+
+/*! \brief Initialize the metrics registry */
+void janus_metrics_init(void);
+/*! \brief Uninitialize the metrics registry */
+void janus_metrics_deinit(void);
+
+/*! \brief Increase a counter
+ * @param[in] counter The counter to update
+ * @param[in] value How much to add to the counter */
+void janus_metrics_add(janus_metrics_counter counter, guint value);
+/*! \brief Add a sample to a histogram
+ * @param[in] histogram The histogram to update
+ * @param[in] value The sampled value */
+void janus_metrics_observe(janus_metrics_histogram histogram, guint value);
+/*! \brief Estimate a percentile of the samples in a histogram
+ * \note The value is interpolated within the bucket the percentile falls in,
+ * and so is only as accurate as the buckets of the histogram are granular
+ * @param[in] histogram The histogram to check
+ * @param[in] percentile The percentile to estimate (e.g., 99 for the 99th percentile)
+ * @returns The estimated value, or 0 if there are no samples */
+double janus_metrics_percentile(janus_metrics_histogram histogram, double percentile);
+/*! \brief Update the number of handles attached to a plugin
+ * @param[in] package The package name of the plugin
+ * @param[in] delta How much to add to (or, if negative, remove from) the number of handles */
+void janus_metrics_plugin_handles(const char *package, int delta);
+
+/*! \brief Render the counters, histograms and per-plugin gauges in OpenMetrics format
+ * \note This doesn't add the final \c # \c EOF line, as the caller may need to add more metrics
+ * @param[in] output The GString to append the metrics to */
+void janus_metrics_print(GString *output);
+/*! \brief Helper to render the \c # \c TYPE and \c # \c HELP lines of a metric family
+ * @param[in] output The GString to append the lines to
+ * @param[in] name The name of the metric family
+ * @param[in] type The type of the metric family (e.g., "gauge")
+ * @param[in] help A description of the metric family */
+void janus_metrics_print_family(GString *output, const char *name, const char *type, const char *help);
+/*! \brief Helper to render a single sample of a metric
+ * @param[in] output The GString to append the sample to
+ * @param[in] name The name of the sample
+ * @param[in] labels The labels of the sample, without braces (e.g., \c loop="1" ), if any
+ * @param[in] value The value of the sample */
+void janus_metrics_print_sample(GString *output, const char *name, const char *labels, double value);
+
+#endif
@@ -0,0 +1,300 @@
+/*! \file    mutex.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Lock contention profiler
+ * \details  Implementation of the optional lock contention profiler that
+ * the locking macros in mutex.h can go through, when Janus is built with
+ * \c --enable-lock-profiling and the profiler is enabled at runtime. Each
+ * thread keeps its own statistics for each lock site (the file and line
+ * a lock was acquired at), so that recording a lock or an unlock never
+ * contends with other threads: how long the thread waited for the lock
+ * (which is only measured when a try-lock fails) and how long it then held
+ * it are counted in histograms with power-of-two microsecond buckets.
+ * Statistics of threads that quit are merged in a global table, and all
+ * of them are aggregated per lock site when dumped via the Admin API.
+ *
+ * \note The profiler is based on plain GMutex instances, rather than on
+ * janus_mutex, to avoid profiling itself.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifdef JANUS_LOCK_PROFILING
+
+#include <time.h>
+#include <string.h>
+
+#include "mutex.h"
+#include "debug.h"
+
+/* Whether the profiler is recording */
+int lock_profiling = 0;
+
+/* Buckets of the histograms: bucket 0 is below 1us, bucket N covers
+ * [2^(N-1), 2^N) microseconds, the last one anything above that */
+#define JANUS_LOCK_PROFILE_BUCKETS	16
+/* How many nested locks we track for each thread */
+#define JANUS_LOCK_PROFILE_HELD		16
+
+/* Statistics for a lock site */
+typedef struct janus_lock_site_stats {
+	janus_lock_site *site;
+	guint64 count, contended;
+	gint64 wait_total, wait_max;
+	gint64 hold_total, hold_max;
+	guint64 wait_hist[JANUS_LOCK_PROFILE_BUCKETS];
+	guint64 hold_hist[JANUS_LOCK_PROFILE_BUCKETS];
+} janus_lock_site_stats;
+
+/* A lock a thread is currently holding */
+typedef struct janus_lock_held {
+	void *lock;
+	janus_lock_site_stats *stats;
+	gint64 acquired;
+} janus_lock_held;
+
+/* Per-thread profiler data */
+typedef struct janus_lock_thread {
+	/* The mutex only protects the table, and is only contended when dumping */
+	GMutex mutex;
+	GHashTable *sites;
+	janus_lock_held held[JANUS_LOCK_PROFILE_HELD];
+	int held_num;
+} janus_lock_thread;
+
+static GMutex threads_mutex;
+static GList *threads = NULL;
+static GHashTable *retired = NULL;
+static __thread janus_lock_thread *thread_data = NULL;
+static void janus_lock_thread_retire(gpointer data);
+static GPrivate thread_key = G_PRIVATE_INIT(janus_lock_thread_retire);
+
+gint64 janus_lock_profile_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec*G_GINT64_CONSTANT(1000000000)) + ts.tv_nsec;
+}
+
+static int janus_lock_profile_bucket(gint64 ns) {
+	gint64 us = ns/1000;
+	int bucket = 0;
+	while(us > 0 && bucket < JANUS_LOCK_PROFILE_BUCKETS-1) {
+		us >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+static void janus_lock_site_stats_merge(janus_lock_site_stats *dst, janus_lock_site_stats *src) {
+	dst->count += src->count;
+	dst->contended += src->contended;
+	dst->wait_total += src->wait_total;
+	if(src->wait_max > dst->wait_max)
+		dst->wait_max = src->wait_max;
+	dst->hold_total += src->hold_total;
+	if(src->hold_max > dst->hold_max)
+		dst->hold_max = src->hold_max;
+	int i = 0;
+	for(i=0; i<JANUS_LOCK_PROFILE_BUCKETS; i++) {
+		dst->wait_hist[i] += src->wait_hist[i];
+		dst->hold_hist[i] += src->hold_hist[i];
+	}
+}
+
+/* Merge the statistics of a table in another one (which must be locked) */
+static void janus_lock_sites_merge(GHashTable *dst, GHashTable *src) {
+	GHashTableIter iter;
+	gpointer value = NULL;
+	g_hash_table_iter_init(&iter, src);
+	while(g_hash_table_iter_next(&iter, NULL, &value)) {
+		janus_lock_site_stats *stats = (janus_lock_site_stats *)value;
+		janus_lock_site_stats *total = g_hash_table_lookup(dst, stats->site);
+		if(total == NULL) {
+			total = g_malloc0(sizeof(janus_lock_site_stats));
+			total->site = stats->site;
+			g_hash_table_insert(dst, stats->site, total);
+		}
+		janus_lock_site_stats_merge(total, stats);
+	}
+}
+
+static janus_lock_thread *janus_lock_thread_get(void) {
+	if(thread_data != NULL)
+		return thread_data;
+	janus_lock_thread *lt = g_malloc0(sizeof(janus_lock_thread));
+	g_mutex_init(&lt->mutex);
+	lt->sites = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)g_free);
+	g_mutex_lock(&threads_mutex);
+	threads = g_list_prepend(threads, lt);
+	g_mutex_unlock(&threads_mutex);
+	/* The GPrivate is only there to be notified when the thread quits */
+	g_private_set(&thread_key, lt);
+	thread_data = lt;
+	return lt;
+}
+
+static void janus_lock_thread_retire(gpointer data) {
+	janus_lock_thread *lt = (janus_lock_thread *)data;
+	if(lt == NULL)
+		return;
+	g_mutex_lock(&threads_mutex);
+	threads = g_list_remove(threads, lt);
+	if(retired == NULL)
+		retired = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)g_free);
+	janus_lock_sites_merge(retired, lt->sites);
+	g_mutex_unlock(&threads_mutex);
+	g_hash_table_destroy(lt->sites);
+	g_mutex_clear(&lt->mutex);
+	g_free(lt);
+}
+
+void janus_lock_profile_acquired(void *lock, janus_lock_site *site, gint64 wait) {
+	janus_lock_thread *lt = janus_lock_thread_get();
+	g_mutex_lock(&lt->mutex);
+	janus_lock_site_stats *stats = g_hash_table_lookup(lt->sites, site);
+	if(stats == NULL) {
+		stats = g_malloc0(sizeof(janus_lock_site_stats));
+		stats->site = site;
+		g_hash_table_insert(lt->sites, site, stats);
+	}
+	stats->count++;
+	if(wait > 0) {
+		stats->contended++;
+		stats->wait_total += wait;
+		if(wait > stats->wait_max)
+			stats->wait_max = wait;
+	}
+	stats->wait_hist[janus_lock_profile_bucket(wait)]++;
+	g_mutex_unlock(&lt->mutex);
+	/* Keep track of the lock, so that we can measure how long it's held:
+	 * if we're nested too deep, we forget about the outermost lock */
+	if(lt->held_num == JANUS_LOCK_PROFILE_HELD) {
+		memmove(&lt->held[0], &lt->held[1], (JANUS_LOCK_PROFILE_HELD-1)*sizeof(janus_lock_held));
+		lt->held_num--;
+	}
+	lt->held[lt->held_num].lock = lock;
+	lt->held[lt->held_num].stats = stats;
+	lt->held[lt->held_num].acquired = janus_lock_profile_now();
+	lt->held_num++;
+}
+
+void janus_lock_profile_released(void *lock) {
+	janus_lock_thread *lt = thread_data;
+	if(lt == NULL || lt->held_num == 0)
+		return;
+	/* Locks are usually released in reverse order, so start from the top;
+	 * locks we don't know about (e.g., acquired before the profiler was
+	 * enabled, or by another thread) are ignored */
+	int i = 0;
+	for(i=lt->held_num-1; i>=0; i--) {
+		if(lt->held[i].lock == lock)
+			break;
+	}
+	if(i < 0)
+		return;
+	gint64 hold = janus_lock_profile_now() - lt->held[i].acquired;
+	janus_lock_site_stats *stats = lt->held[i].stats;
+	if(i < lt->held_num-1)
+		memmove(&lt->held[i], &lt->held[i+1], (lt->held_num-i-1)*sizeof(janus_lock_held));
+	lt->held_num--;
+	g_mutex_lock(&lt->mutex);
+	stats->hold_total += hold;
+	if(hold > stats->hold_max)
+		stats->hold_max = hold;
+	stats->hold_hist[janus_lock_profile_bucket(hold)]++;
+	g_mutex_unlock(&lt->mutex);
+}
+
+/* Sort lock sites by total wait time (and then by number of acquisitions) */
+static gint janus_lock_site_stats_compare(gconstpointer a, gconstpointer b) {
+	const janus_lock_site_stats *sa = (const janus_lock_site_stats *)a;
+	const janus_lock_site_stats *sb = (const janus_lock_site_stats *)b;
+	if(sa->wait_total != sb->wait_total)
+		return sa->wait_total > sb->wait_total ? -1 : 1;
+	if(sa->count != sb->count)
+		return sa->count > sb->count ? -1 : 1;
+	return 0;
+}
+
+static json_t *janus_lock_profile_histogram(guint64 *hist) {
+	json_t *h = json_array();
+	int i = 0;
+	for(i=0; i<JANUS_LOCK_PROFILE_BUCKETS; i++)
+		json_array_append_new(h, json_integer(hist[i]));
+	return h;
+}
+
+json_t *janus_lock_profile_dump(int limit) {
+	/* Aggregate the statistics of all threads, dead or alive */
+	GHashTable *total = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)g_free);
+	g_mutex_lock(&threads_mutex);
+	if(retired != NULL)
+		janus_lock_sites_merge(total, retired);
+	GList *tl = threads;
+	while(tl) {
+		janus_lock_thread *lt = (janus_lock_thread *)tl->data;
+		g_mutex_lock(&lt->mutex);
+		janus_lock_sites_merge(total, lt->sites);
+		g_mutex_unlock(&lt->mutex);
+		tl = tl->next;
+	}
+	g_mutex_unlock(&threads_mutex);
+	GList *sites = g_hash_table_get_values(total);
+	sites = g_list_sort(sites, janus_lock_site_stats_compare);
+	json_t *list = json_array();
+	int num = 0;
+	GList *temp = sites;
+	while(temp && (limit <= 0 || num < limit)) {
+		janus_lock_site_stats *stats = (janus_lock_site_stats *)temp->data;
+		temp = temp->next;
+		if(stats->count == 0 && stats->hold_total == 0) {
+			/* Nothing recorded since the last reset */
+			continue;
+		}
+		json_t *s = json_object();
+		char location[256];
+		g_snprintf(location, sizeof(location), "%s:%d", stats->site->file, stats->site->line);
+		json_object_set_new(s, "site", json_string(location));
+		json_object_set_new(s, "kind", json_string(stats->site->kind));
+		json_object_set_new(s, "count", json_integer(stats->count));
+		json_object_set_new(s, "contended", json_integer(stats->contended));
+		json_object_set_new(s, "wait-total-us", json_integer(stats->wait_total/1000));
+		json_object_set_new(s, "wait-max-us", json_integer(stats->wait_max/1000));
+		json_object_set_new(s, "hold-total-us", json_integer(stats->hold_total/1000));
+		json_object_set_new(s, "hold-max-us", json_integer(stats->hold_max/1000));
+		json_object_set_new(s, "wait-histogram", janus_lock_profile_histogram(stats->wait_hist));
+		json_object_set_new(s, "hold-histogram", janus_lock_profile_histogram(stats->hold_hist));
+		json_array_append_new(list, s);
+		num++;
+	}
+	g_list_free(sites);
+	g_hash_table_destroy(total);
+	return list;
+}
+
+void janus_lock_profile_reset(void) {
+	g_mutex_lock(&threads_mutex);
+	if(retired != NULL)
+		g_hash_table_remove_all(retired);
+	GList *tl = threads;
+	while(tl) {
+		janus_lock_thread *lt = (janus_lock_thread *)tl->data;
+		g_mutex_lock(&lt->mutex);
+		/* Locks currently held keep a pointer to their stats: just zero them */
+		GHashTableIter iter;
+		gpointer value = NULL;
+		g_hash_table_iter_init(&iter, lt->sites);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) {
+			janus_lock_site_stats *stats = (janus_lock_site_stats *)value;
+			janus_lock_site *site = stats->site;
+			memset(stats, 0, sizeof(janus_lock_site_stats));
+			stats->site = site;
+		}
+		g_mutex_unlock(&lt->mutex);
+		tl = tl->next;
+	}
+	g_mutex_unlock(&threads_mutex);
+}
+
+#endif
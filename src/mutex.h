@@ -1,7 +1,11 @@
 /*! \file    mutex.h
  * \author   Lorenzo Miniero <lorenzo@meetecho.com>
- * \brief    Semaphores, Mutexes and Conditions
- * \details  Implementation (based on GMutex or pthread_mutex) of a locking mechanism based on mutexes and conditions.
+ * \brief    Semaphores, Mutexes, Read-Write Locks and Conditions
+ * \details  Implementation (based on GMutex or pthread_mutex) of a locking mechanism based on mutexes and conditions,
+ * plus read-write locks (based on GRWLock or pthread_rwlock) for data that is mostly read.
+ * When built with \c --enable-lock-profiling , locks can also go through a contention
+ * profiler that can be enabled at runtime: for each place in the code where a lock is
+ * acquired, it keeps track of how long threads waited for it and how long they held it.
  *
  * \ingroup core
  * \ref core
@@ -17,6 +21,53 @@
 
 extern int lock_debug;
 
+#ifdef JANUS_LOCK_PROFILING
+#include <jansson.h>
+
+/*! \brief Whether the lock contention profiler is currently recording */
+extern int lock_profiling;
+/*! \brief Whether locks should go through the contention profiler */
+#define janus_lock_profiling_enabled() (lock_profiling)
+
+/*! \brief Place in the code where a lock is acquired, as tracked by the contention profiler */
+typedef struct janus_lock_site {
+	/*! \brief File and line of the lock site */
+	const char *file;
+	int line;
+	/*! \brief What kind of lock this is (mutex, rdlock, wrlock) */
+	const char *kind;
+} janus_lock_site;
+/*! \brief Helper to get the current monotonic time, in nanoseconds, for the contention profiler */
+gint64 janus_lock_profile_now(void);
+/*! \brief Record that the calling thread acquired a lock
+ * @param[in] lock The lock that was acquired
+ * @param[in] site Where the lock was acquired
+ * @param[in] wait How long the thread waited to get the lock, in nanoseconds */
+void janus_lock_profile_acquired(void *lock, janus_lock_site *site, gint64 wait);
+/*! \brief Record that the calling thread is about to release a lock
+ * @param[in] lock The lock that is going to be released */
+void janus_lock_profile_released(void *lock);
+/*! \brief Get the statistics collected so far by the contention profiler
+ * @param[in] limit How many lock sites to return at most (sorted by total wait time), 0 for all of them
+ * @returns A JSON array with the statistics for each lock site */
+json_t *janus_lock_profile_dump(int limit);
+/*! \brief Reset the statistics collected so far by the contention profiler */
+void janus_lock_profile_reset(void);
+/*! \brief Janus lock acquisition through the contention profiler (only measures the wait if the lock is busy) */
+#define janus_lock_profiled(a, k, trylockf, lockf) { \
+	static janus_lock_site jls = { __FILE__, __LINE__, k }; \
+	gint64 jls_wait = 0; \
+	if(!(trylockf)) { \
+		gint64 jls_start = janus_lock_profile_now(); \
+		lockf; \
+		jls_wait = janus_lock_profile_now() - jls_start; \
+	} \
+	janus_lock_profile_acquired(a, &jls, jls_wait); \
+}
+#else
+#define janus_lock_profiling_enabled() 0
+#endif
+
 #ifdef USE_PTHREAD_MUTEX
 
 /*! \brief Janus mutex implementation */
@@ -32,9 +83,11 @@ typedef pthread_mutex_t janus_mutex;
 /*! \brief Janus mutex lock with debug (prints the line that locked a mutex) */
 #define janus_mutex_lock_debug(a) { JANUS_PRINT("[%s:%s:%d:lock] %p\n", __FILE__, __FUNCTION__, __LINE__, a); pthread_mutex_lock(a); }
 /*! \brief Janus mutex lock wrapper (selective locking debug) */
-#define janus_mutex_lock(a) { if(!lock_debug) { janus_mutex_lock_nodebug(a); } else { janus_mutex_lock_debug(a); } }
+#define janus_mutex_lock(a) { if(!lock_debug && !janus_lock_profiling_enabled()) { janus_mutex_lock_nodebug(a); } else if(!lock_debug) { janus_mutex_lock_profiled(a); } else { janus_mutex_lock_debug(a); } }
 /*! \brief Janus mutex try lock without debug */
 #define janus_mutex_trylock_nodebug(a) { ret = !pthread_mutex_trylock(a); }
+/*! \brief Janus mutex try lock as an expression (TRUE if locked) */
+#define janus_mutex_trylock_plain(a) (!pthread_mutex_trylock(a))
 /*! \brief Janus mutex try lock with debug (prints the line that tried to lock a mutex) */
 #define janus_mutex_trylock_debug(a) { JANUS_PRINT("[%s:%s:%d:trylock] %p\n", __FILE__, __FUNCTION__, __LINE__, a); ret = !pthread_mutex_trylock(a); }
 /*! \brief Janus mutex try lock wrapper (selective locking debug) */
@@ -44,7 +97,7 @@ typedef pthread_mutex_t janus_mutex;
 /*! \brief Janus mutex unlock with debug (prints the line that unlocked a mutex) */
 #define janus_mutex_unlock_debug(a) { JANUS_PRINT("[%s:%s:%d:unlock] %p\n", __FILE__, __FUNCTION__, __LINE__, a); pthread_mutex_unlock(a); }
 /*! \brief Janus mutex unlock wrapper (selective locking debug) */
-#define janus_mutex_unlock(a) { if(!lock_debug) { janus_mutex_unlock_nodebug(a); } else { janus_mutex_unlock_debug(a); } }
+#define janus_mutex_unlock(a) { if(!lock_debug && !janus_lock_profiling_enabled()) { janus_mutex_unlock_nodebug(a); } else if(!lock_debug) { janus_mutex_unlock_profiled(a); } else { janus_mutex_unlock_debug(a); } }
 
 /*! \brief Janus condition implementation */
 typedef pthread_cond_t janus_condition;
@@ -67,6 +120,43 @@ typedef pthread_cond_t janus_condition;
 /*! \brief Janus condition broadcast */
 #define janus_condition_broadcast(a) pthread_cond_broadcast(a);
 
+/*! \brief Janus read-write lock implementation */
+typedef pthread_rwlock_t janus_rwlock;
+/*! \brief Janus read-write lock initialization */
+#define janus_rwlock_init(a) pthread_rwlock_init(a,NULL)
+/*! \brief Janus static read-write lock initializer */
+#define JANUS_RWLOCK_INITIALIZER PTHREAD_RWLOCK_INITIALIZER
+/*! \brief Janus read-write lock destruction */
+#define janus_rwlock_destroy(a) pthread_rwlock_destroy(a)
+/*! \brief Janus read-write lock read lock without debug */
+#define janus_rwlock_read_lock_nodebug(a) pthread_rwlock_rdlock(a)
+/*! \brief Janus read-write lock read try lock as an expression (TRUE if locked) */
+#define janus_rwlock_read_trylock_plain(a) (!pthread_rwlock_tryrdlock(a))
+/*! \brief Janus read-write lock read lock with debug (prints the line that locked a read-write lock) */
+#define janus_rwlock_read_lock_debug(a) { JANUS_PRINT("[%s:%s:%d:rdlock] %p\n", __FILE__, __FUNCTION__, __LINE__, a); pthread_rwlock_rdlock(a); }
+/*! \brief Janus read-write lock read lock wrapper (selective locking debug) */
+#define janus_rwlock_read_lock(a) { if(!lock_debug && !janus_lock_profiling_enabled()) { janus_rwlock_read_lock_nodebug(a); } else if(!lock_debug) { janus_rwlock_read_lock_profiled(a); } else { janus_rwlock_read_lock_debug(a); } }
+/*! \brief Janus read-write lock read unlock without debug */
+#define janus_rwlock_read_unlock_nodebug(a) pthread_rwlock_unlock(a)
+/*! \brief Janus read-write lock read unlock with debug (prints the line that unlocked a read-write lock) */
+#define janus_rwlock_read_unlock_debug(a) { JANUS_PRINT("[%s:%s:%d:rdunlock] %p\n", __FILE__, __FUNCTION__, __LINE__, a); pthread_rwlock_unlock(a); }
+/*! \brief Janus read-write lock read unlock wrapper (selective locking debug) */
+#define janus_rwlock_read_unlock(a) { if(!lock_debug && !janus_lock_profiling_enabled()) { janus_rwlock_read_unlock_nodebug(a); } else if(!lock_debug) { janus_rwlock_read_unlock_profiled(a); } else { janus_rwlock_read_unlock_debug(a); } }
+/*! \brief Janus read-write lock write lock without debug */
+#define janus_rwlock_write_lock_nodebug(a) pthread_rwlock_wrlock(a)
+/*! \brief Janus read-write lock write try lock as an expression (TRUE if locked) */
+#define janus_rwlock_write_trylock_plain(a) (!pthread_rwlock_trywrlock(a))
+/*! \brief Janus read-write lock write lock with debug (prints the line that locked a read-write lock) */
+#define janus_rwlock_write_lock_debug(a) { JANUS_PRINT("[%s:%s:%d:wrlock] %p\n", __FILE__, __FUNCTION__, __LINE__, a); pthread_rwlock_wrlock(a); }
+/*! \brief Janus read-write lock write lock wrapper (selective locking debug) */
+#define janus_rwlock_write_lock(a) { if(!lock_debug && !janus_lock_profiling_enabled()) { janus_rwlock_write_lock_nodebug(a); } else if(!lock_debug) { janus_rwlock_write_lock_profiled(a); } else { janus_rwlock_write_lock_debug(a); } }
+/*! \brief Janus read-write lock write unlock without debug */
+#define janus_rwlock_write_unlock_nodebug(a) pthread_rwlock_unlock(a)
+/*! \brief Janus read-write lock write unlock with debug (prints the line that unlocked a read-write lock) */
+#define janus_rwlock_write_unlock_debug(a) { JANUS_PRINT("[%s:%s:%d:wrunlock] %p\n", __FILE__, __FUNCTION__, __LINE__, a); pthread_rwlock_unlock(a); }
+/*! \brief Janus read-write lock write unlock wrapper (selective locking debug) */
+#define janus_rwlock_write_unlock(a) { if(!lock_debug && !janus_lock_profiling_enabled()) { janus_rwlock_write_unlock_nodebug(a); } else if(!lock_debug) { janus_rwlock_write_unlock_profiled(a); } else { janus_rwlock_write_unlock_debug(a); } }
+
 #else
 
 /*! \brief Janus mutex implementation */
@@ -82,9 +172,11 @@ typedef GMutex janus_mutex;
 /*! \brief Janus mutex lock with debug (prints the line that locked a mutex) */
 #define janus_mutex_lock_debug(a) { JANUS_PRINT("[%s:%s:%d:lock] %p\n", __FILE__, __FUNCTION__, __LINE__, a); g_mutex_lock(a); }
 /*! \brief Janus mutex lock wrapper (selective locking debug) */
-#define janus_mutex_lock(a) { if(!lock_debug) { janus_mutex_lock_nodebug(a); } else { janus_mutex_lock_debug(a); } }
+#define janus_mutex_lock(a) { if(!lock_debug && !janus_lock_profiling_enabled()) { janus_mutex_lock_nodebug(a); } else if(!lock_debug) { janus_mutex_lock_profiled(a); } else { janus_mutex_lock_debug(a); } }
 /*! \brief Janus mutex try lock without debug */
 #define janus_mutex_trylock_nodebug(a) { ret = g_mutex_trylock(a); }
+/*! \brief Janus mutex try lock as an expression (TRUE if locked) */
+#define janus_mutex_trylock_plain(a) g_mutex_trylock(a)
 /*! \brief Janus mutex try lock with debug (prints the line that tried to lock a mutex) */
 #define janus_mutex_trylock_debug(a) { JANUS_PRINT("[%s:%s:%d:trylock] %p\n", __FILE__, __FUNCTION__, __LINE__, a); ret = g_mutex_trylock(a); }
 /*! \brief Janus mutex try lock wrapper (selective locking debug) */
@@ -94,7 +186,7 @@ typedef GMutex janus_mutex;
 /*! \brief Janus mutex unlock with debug (prints the line that unlocked a mutex) */
 #define janus_mutex_unlock_debug(a) { JANUS_PRINT("[%s:%s:%d:unlock] %p\n", __FILE__, __FUNCTION__, __LINE__, a); g_mutex_unlock(a); }
 /*! \brief Janus mutex unlock wrapper (selective locking debug) */
-#define janus_mutex_unlock(a) { if(!lock_debug) { janus_mutex_unlock_nodebug(a); } else { janus_mutex_unlock_debug(a); } }
+#define janus_mutex_unlock(a) { if(!lock_debug && !janus_lock_profiling_enabled()) { janus_mutex_unlock_nodebug(a); } else if(!lock_debug) { janus_mutex_unlock_profiled(a); } else { janus_mutex_unlock_debug(a); } }
 
 /*! \brief Janus condition implementation */
 typedef GCond janus_condition;
@@ -111,6 +203,65 @@ typedef GCond janus_condition;
 /*! \brief Janus condition broadcast */
 #define janus_condition_broadcast(a) g_cond_broadcast(a);
 
+/*! \brief Janus read-write lock implementation */
+typedef GRWLock janus_rwlock;
+/*! \brief Janus read-write lock initialization */
+#define janus_rwlock_init(a) g_rw_lock_init(a)
+/*! \brief Janus static read-write lock initializer */
+#define JANUS_RWLOCK_INITIALIZER {0}
+/*! \brief Janus read-write lock destruction */
+#define janus_rwlock_destroy(a) g_rw_lock_clear(a)
+/*! \brief Janus read-write lock read lock without debug */
+#define janus_rwlock_read_lock_nodebug(a) g_rw_lock_reader_lock(a)
+/*! \brief Janus read-write lock read try lock as an expression (TRUE if locked) */
+#define janus_rwlock_read_trylock_plain(a) g_rw_lock_reader_trylock(a)
+/*! \brief Janus read-write lock read lock with debug (prints the line that locked a read-write lock) */
+#define janus_rwlock_read_lock_debug(a) { JANUS_PRINT("[%s:%s:%d:rdlock] %p\n", __FILE__, __FUNCTION__, __LINE__, a); g_rw_lock_reader_lock(a); }
+/*! \brief Janus read-write lock read lock wrapper (selective locking debug) */
+#define janus_rwlock_read_lock(a) { if(!lock_debug && !janus_lock_profiling_enabled()) { janus_rwlock_read_lock_nodebug(a); } else if(!lock_debug) { janus_rwlock_read_lock_profiled(a); } else { janus_rwlock_read_lock_debug(a); } }
+/*! \brief Janus read-write lock read unlock without debug */
+#define janus_rwlock_read_unlock_nodebug(a) g_rw_lock_reader_unlock(a)
+/*! \brief Janus read-write lock read unlock with debug (prints the line that unlocked a read-write lock) */
+#define janus_rwlock_read_unlock_debug(a) { JANUS_PRINT("[%s:%s:%d:rdunlock] %p\n", __FILE__, __FUNCTION__, __LINE__, a); g_rw_lock_reader_unlock(a); }
+/*! \brief Janus read-write lock read unlock wrapper (selective locking debug) */
+#define janus_rwlock_read_unlock(a) { if(!lock_debug && !janus_lock_profiling_enabled()) { janus_rwlock_read_unlock_nodebug(a); } else if(!lock_debug) { janus_rwlock_read_unlock_profiled(a); } else { janus_rwlock_read_unlock_debug(a); } }
+/*! \brief Janus read-write lock write lock without debug */
+#define janus_rwlock_write_lock_nodebug(a) g_rw_lock_writer_lock(a)
+/*! \brief Janus read-write lock write try lock as an expression (TRUE if locked) */
+#define janus_rwlock_write_trylock_plain(a) g_rw_lock_writer_trylock(a)
+/*! \brief Janus read-write lock write lock with debug (prints the line that locked a read-write lock) */
+#define janus_rwlock_write_lock_debug(a) { JANUS_PRINT("[%s:%s:%d:wrlock] %p\n", __FILE__, __FUNCTION__, __LINE__, a); g_rw_lock_writer_lock(a); }
+/*! \brief Janus read-write lock write lock wrapper (selective locking debug) */
+#define janus_rwlock_write_lock(a) { if(!lock_debug && !janus_lock_profiling_enabled()) { janus_rwlock_write_lock_nodebug(a); } else if(!lock_debug) { janus_rwlock_write_lock_profiled(a); } else { janus_rwlock_write_lock_debug(a); } }
+/*! \brief Janus read-write lock write unlock without debug */
+#define janus_rwlock_write_unlock_nodebug(a) g_rw_lock_writer_unlock(a)
+/*! \brief Janus read-write lock write unlock with debug (prints the line that unlocked a read-write lock) */
+#define janus_rwlock_write_unlock_debug(a) { JANUS_PRINT("[%s:%s:%d:wrunlock] %p\n", __FILE__, __FUNCTION__, __LINE__, a); g_rw_lock_writer_unlock(a); }
+/*! \brief Janus read-write lock write unlock wrapper (selective locking debug) */
+#define janus_rwlock_write_unlock(a) { if(!lock_debug && !janus_lock_profiling_enabled()) { janus_rwlock_write_unlock_nodebug(a); } else if(!lock_debug) { janus_rwlock_write_unlock_profiled(a); } else { janus_rwlock_write_unlock_debug(a); } }
+
+#endif
+
+#ifdef JANUS_LOCK_PROFILING
+/*! \brief Janus mutex lock with profiling (keeps track of contention at the lock site) */
+#define janus_mutex_lock_profiled(a) janus_lock_profiled(a, "mutex", janus_mutex_trylock_plain(a), janus_mutex_lock_nodebug(a))
+/*! \brief Janus mutex unlock with profiling (keeps track of how long the mutex was held) */
+#define janus_mutex_unlock_profiled(a) { janus_lock_profile_released(a); janus_mutex_unlock_nodebug(a); }
+/*! \brief Janus read-write lock read lock with profiling */
+#define janus_rwlock_read_lock_profiled(a) janus_lock_profiled(a, "rdlock", janus_rwlock_read_trylock_plain(a), janus_rwlock_read_lock_nodebug(a))
+/*! \brief Janus read-write lock read unlock with profiling */
+#define janus_rwlock_read_unlock_profiled(a) { janus_lock_profile_released(a); janus_rwlock_read_unlock_nodebug(a); }
+/*! \brief Janus read-write lock write lock with profiling */
+#define janus_rwlock_write_lock_profiled(a) janus_lock_profiled(a, "wrlock", janus_rwlock_write_trylock_plain(a), janus_rwlock_write_lock_nodebug(a))
+/*! \brief Janus read-write lock write unlock with profiling */
+#define janus_rwlock_write_unlock_profiled(a) { janus_lock_profile_released(a); janus_rwlock_write_unlock_nodebug(a); }
+#else
+#define janus_mutex_lock_profiled(a) janus_mutex_lock_nodebug(a)
+#define janus_mutex_unlock_profiled(a) janus_mutex_unlock_nodebug(a)
+#define janus_rwlock_read_lock_profiled(a) janus_rwlock_read_lock_nodebug(a)
+#define janus_rwlock_read_unlock_profiled(a) janus_rwlock_read_unlock_nodebug(a)
+#define janus_rwlock_write_lock_profiled(a) janus_rwlock_write_lock_nodebug(a)
+#define janus_rwlock_write_unlock_profiled(a) janus_rwlock_write_unlock_nodebug(a)
 #endif
 
 #endif
@@ -142,6 +142,9 @@ struct JitterBuffer_ {
 
    spx_uint32_t buffer_size;
    JitterBufferPacket packets[SPEEX_JITTER_MAX_BUFFER_SIZE];   /**< Packets stored in the buffer */
+   char *slots;                                                /**< Preallocated storage for the packets, if any (one slot per packet) */
+   spx_uint32_t slot_size;                                     /**< Size of each slot in bytes (0 means memory is allocated for each packet) */
+   JitterBufferStats stats;                                    /**< Statistics on the buffer */
    spx_uint32_t arrival[SPEEX_JITTER_MAX_BUFFER_SIZE];         /**< Packet arrival time (0 means it was late, even though it's a valid timestamp) */
 
    void (*destroy) (void *);                                   /**< Callback for destroying a packet */
@@ -165,6 +168,30 @@ struct JitterBuffer_ {
    int lost_count;                                             /**< Number of consecutive lost packets  */
 };
 
+/** Release the packet in a position of the buffer */
+static void release_packet(JitterBuffer *jitter, spx_uint32_t i)
+{
+   if (jitter->packets[i].data == NULL)
+      return;
+   if (jitter->destroy)
+      jitter->destroy(jitter->packets[i].data);
+   else if (jitter->slots == NULL)
+      speex_free(jitter->packets[i].data);
+   jitter->packets[i].data = NULL;
+   jitter->stats.depth--;
+}
+
+/** (Re)allocate the slots for the current size of the buffer */
+static void allocate_slots(JitterBuffer *jitter, spx_uint32_t slot_size)
+{
+   if (jitter->slots)
+      speex_free(jitter->slots);
+   jitter->slots = NULL;
+   jitter->slot_size = slot_size;
+   if (slot_size > 0)
+      jitter->slots = (char*)speex_alloc(jitter->buffer_size*slot_size);
+}
+
 /** Based on available data, this computes the optimal delay for the jitter buffer.
    The optimised function is in timestamp units and is:
    cost = delay + late_factor*[number of frames that would be late if we used that delay]
@@ -277,6 +304,8 @@ EXPORT JitterBuffer *jitter_buffer_init(int step_size)
       spx_int32_t tmp;
       for (i=0;i<SPEEX_JITTER_MAX_BUFFER_SIZE;i++)
          jitter->packets[i].data=NULL;
+      jitter->slots = NULL;
+      jitter->slot_size = 0;
       jitter->delay_step = step_size;
       jitter->concealment_size = step_size;
       /*FIXME: Should this be 0 or 1?*/
@@ -289,6 +318,7 @@ EXPORT JitterBuffer *jitter_buffer_init(int step_size)
       tmp = 4;
       jitter_buffer_ctl(jitter, JITTER_BUFFER_SET_MAX_LATE_RATE, &tmp);
       jitter_buffer_reset(jitter);
+      SPEEX_MEMSET(&jitter->stats, 0, 1);
    }
    return jitter;
 }
@@ -298,16 +328,10 @@ EXPORT void jitter_buffer_reset(JitterBuffer *jitter)
 {
    int i;
    for (i=0;i<SPEEX_JITTER_MAX_BUFFER_SIZE;i++)
-   {
-      if (jitter->packets[i].data)
-      {
-         if (jitter->destroy)
-            jitter->destroy(jitter->packets[i].data);
-         else
-            speex_free(jitter->packets[i].data);
-         jitter->packets[i].data = NULL;
-      }
-   }
+      release_packet(jitter, i);
+   jitter->stats.depth = 0;
+   jitter->stats.delay = 0;
+   jitter->stats.resets++;
    /* Timestamp is actually undefined at this point */
    jitter->pointer_timestamp = 0;
    jitter->next_stop = 0;
@@ -328,6 +352,8 @@ EXPORT void jitter_buffer_reset(JitterBuffer *jitter)
 EXPORT void jitter_buffer_destroy(JitterBuffer *jitter)
 {
    jitter_buffer_reset(jitter);
+   if (jitter->slots)
+      speex_free(jitter->slots);
    speex_free(jitter);
 }
 
@@ -364,6 +390,22 @@ static void shift_timings(JitterBuffer *jitter, spx_int16_t amount)
 }
 
 
+/** Keep track of an adjustment of the buffering delay (negative means more buffering) */
+static void update_delay_stats(JitterBuffer *jitter, spx_int16_t opt)
+{
+   if (opt == 0)
+      return;
+   if (opt < 0)
+      jitter->stats.grown++;
+   else
+      jitter->stats.shrunk++;
+   jitter->stats.delay -= opt;
+   if (jitter->stats.delay < 0)
+      jitter->stats.delay = 0;
+   if (jitter->stats.delay > jitter->stats.max_delay)
+      jitter->stats.max_delay = jitter->stats.delay;
+}
+
 /** Put one packet into the jitter buffer */
 EXPORT void jitter_buffer_put(JitterBuffer *jitter, const JitterBufferPacket *packet)
 {
@@ -380,11 +422,7 @@ EXPORT void jitter_buffer_put(JitterBuffer *jitter, const JitterBufferPacket *pa
          if (jitter->packets[i].data && LE32(jitter->packets[i].timestamp + jitter->packets[i].span, jitter->pointer_timestamp))
          {
             /*fprintf (stderr, "cleaned (not played)\n");*/
-            if (jitter->destroy)
-               jitter->destroy(jitter->packets[i].data);
-            else
-               speex_free(jitter->packets[i].data);
-            jitter->packets[i].data = NULL;
+            release_packet(jitter, i);
          }
       }
    }
@@ -395,6 +433,7 @@ EXPORT void jitter_buffer_put(JitterBuffer *jitter, const JitterBufferPacket *pa
    {
       update_timings(jitter, ((spx_int32_t)packet->timestamp) - ((spx_int32_t)jitter->next_stop) - jitter->buffer_margin);
       late = 1;
+      jitter->stats.late++;
    } else {
       late = 0;
    }
@@ -406,6 +445,14 @@ EXPORT void jitter_buffer_put(JitterBuffer *jitter, const JitterBufferPacket *pa
       jitter_buffer_reset(jitter);
    }
 
+   jitter->stats.put++;
+   /* Packets that don't fit in a slot can't be stored */
+   if (!jitter->destroy && jitter->slots && packet->len > jitter->slot_size)
+   {
+      jitter->stats.dropped_size++;
+      return;
+   }
+
    /* Only insert the packet if it's not hopelessly late (i.e. totally useless) */
    if (jitter->reset_state || GE32(packet->timestamp+packet->span+jitter->delay_step, jitter->pointer_timestamp))
    {
@@ -430,11 +477,8 @@ EXPORT void jitter_buffer_put(JitterBuffer *jitter, const JitterBufferPacket *pa
                i=j;
             }
          }
-         if (jitter->destroy)
-            jitter->destroy(jitter->packets[i].data);
-         else
-            speex_free(jitter->packets[i].data);
-         jitter->packets[i].data=NULL;
+         release_packet(jitter, i);
+         jitter->stats.dropped_full++;
          /*fprintf (stderr, "Buffer is full, discarding earliest frame %d (currently at %d)\n", timestamp, jitter->pointer_timestamp);*/
       }
 
@@ -442,11 +486,17 @@ EXPORT void jitter_buffer_put(JitterBuffer *jitter, const JitterBufferPacket *pa
       if (jitter->destroy)
       {
          jitter->packets[i].data = packet->data;
+      } else if (jitter->slots) {
+         jitter->packets[i].data = jitter->slots + i*jitter->slot_size;
+         SPEEX_COPY(jitter->packets[i].data, packet->data, packet->len);
       } else {
          jitter->packets[i].data=(char*)speex_alloc(packet->len);
          for (j=0;j<packet->len;j++)
             jitter->packets[i].data[j]=packet->data[j];
       }
+      jitter->stats.depth++;
+      if (jitter->stats.depth > jitter->stats.max_depth)
+         jitter->stats.max_depth = jitter->stats.depth;
       jitter->packets[i].timestamp=packet->timestamp;
       jitter->packets[i].span=packet->span;
       jitter->packets[i].len=packet->len;
@@ -461,6 +511,7 @@ EXPORT void jitter_buffer_put(JitterBuffer *jitter, const JitterBufferPacket *pa
 	   * get here, since the application has no way of knowing whether
 	   * a packet was actually queued or not: as such, when this
 	   * happens, we destroy the packet that was passed ourselves */
+      jitter->stats.dropped_late++;
       if (jitter->destroy)
          jitter->destroy(packet->data);
    }
@@ -610,9 +661,11 @@ EXPORT int jitter_buffer_get(JitterBuffer *jitter, JitterBufferPacket *packet, s
          for (j=0;j<packet->len;j++)
             packet->data[j] = jitter->packets[i].data[j];
          /* Remove packet */
-         speex_free(jitter->packets[i].data);
+         if (jitter->slots == NULL)
+            speex_free(jitter->packets[i].data);
       }
       jitter->packets[i].data = NULL;
+      jitter->stats.depth--;
       /* Set timestamp and span (if requested) */
       offset = (spx_int32_t)jitter->packets[i].timestamp-(spx_int32_t)jitter->pointer_timestamp;
       if (start_offset != NULL)
@@ -645,6 +698,7 @@ EXPORT int jitter_buffer_get(JitterBuffer *jitter, JitterBufferPacket *packet, s
    /*fprintf (stderr, "m");*/
    /*fprintf (stderr, "lost_count = %d\n", jitter->lost_count);*/
 
+   jitter->stats.missing++;
    opt = compute_opt_delay(jitter);
 
    /* Should we force an increase in the buffer or just do normal interpolation? */
@@ -654,6 +708,7 @@ EXPORT int jitter_buffer_get(JitterBuffer *jitter, JitterBufferPacket *packet, s
 
       /* Shift histogram to compensate */
       shift_timings(jitter, -opt);
+      update_delay_stats(jitter, opt);
 
       packet->timestamp = jitter->pointer_timestamp;
       packet->span = -opt;
@@ -700,9 +755,11 @@ EXPORT int jitter_buffer_get_another(JitterBuffer *jitter, JitterBufferPacket *p
          for (j=0;j<packet->len;j++)
             packet->data[j] = jitter->packets[i].data[j];
          /* Remove packet */
-         speex_free(jitter->packets[i].data);
+         if (jitter->slots == NULL)
+            speex_free(jitter->packets[i].data);
       }
       jitter->packets[i].data = NULL;
+      jitter->stats.depth--;
       packet->timestamp = jitter->packets[i].timestamp;
       packet->span = jitter->packets[i].span;
       packet->sequence = jitter->packets[i].sequence;
@@ -721,6 +778,7 @@ static int _jitter_buffer_update_delay(JitterBuffer *jitter, JitterBufferPacket
 {
    spx_int16_t opt = compute_opt_delay(jitter);
    /*fprintf(stderr, "opt adjustment is %d ", opt);*/
+   update_delay_stats(jitter, opt);
 
    if (opt < 0)
    {
@@ -757,6 +815,9 @@ EXPORT int jitter_buffer_get_pointer_timestamp(JitterBuffer *jitter)
 
 EXPORT void jitter_buffer_tick(JitterBuffer *jitter)
 {
+   /* Update the average depth of the buffer (moving average, in 1/256 units) */
+   jitter->stats.avg_depth += (jitter->stats.depth*256 - jitter->stats.avg_depth)/16;
+
    /* Automatically-adjust the buffering delay if requested */
    if (jitter->auto_adjust)
       _jitter_buffer_update_delay(jitter, NULL, NULL);
@@ -842,8 +903,26 @@ EXPORT int jitter_buffer_ctl(JitterBuffer *jitter, int request, void *ptr)
          break;
       case JITTER_BUFFER_SET_LIMIT:
          buffer_size = *(spx_int32_t*)ptr;
+         jitter_buffer_reset(jitter);
          jitter->buffer_size = (buffer_size > 1 && buffer_size <= SPEEX_JITTER_MAX_BUFFER_SIZE) ? buffer_size : SPEEX_JITTER_MAX_BUFFER_SIZE;
+         if (jitter->slots)
+            allocate_slots(jitter, jitter->slot_size);
+         break;
+      case JITTER_BUFFER_SET_SLOT_SIZE:
          jitter_buffer_reset(jitter);
+         allocate_slots(jitter, *(spx_int32_t*)ptr > 0 ? *(spx_int32_t*)ptr : 0);
+         break;
+      case JITTER_BUFFER_GET_SLOT_SIZE:
+         *(spx_int32_t*)ptr = jitter->slot_size;
+         break;
+      case JITTER_BUFFER_GET_STATS:
+         *(JitterBufferStats*)ptr = jitter->stats;
+         break;
+      case JITTER_BUFFER_RESET_STATS:
+         count = jitter->stats.depth;
+         SPEEX_MEMSET(&jitter->stats, 0, 1);
+         jitter->stats.depth = count;
+         jitter->stats.max_depth = count;
          break;
       default:
          speex_warning_int("Unknown jitter_buffer_ctl request: ", request);
@@ -115,6 +115,39 @@ struct _JitterBufferPacket {
 
 #define JITTER_BUFFER_SET_LIMIT 101
 
+/** Preallocate fixed-size storage for all the packets the buffer can hold (only
+    used if no destroy callback is set): packets are then copied to their slot
+    on put(), rather than in memory allocated for each of them, and packets
+    larger than the slot size are discarded. The parameter is the slot size in
+    bytes, 0 to go back to allocating memory for each packet. Notice that
+    changing the limit after this reallocates the slots, and that both reset
+    the buffer. */
+#define JITTER_BUFFER_SET_SLOT_SIZE 102
+#define JITTER_BUFFER_GET_SLOT_SIZE 103
+
+/** Get the statistics of the jitter buffer (parameter is a JitterBufferStats) */
+#define JITTER_BUFFER_GET_STATS 104
+/** Reset the statistics of the jitter buffer (parameter is ignored) */
+#define JITTER_BUFFER_RESET_STATS 105
+
+/** Statistics on the jitter buffer, and on how its depth adapted to the network */
+typedef struct _JitterBufferStats {
+   spx_uint32_t put;            /**< Packets put in the buffer */
+   spx_uint32_t late;           /**< Packets that arrived late, but could still be buffered */
+   spx_uint32_t dropped_late;   /**< Packets discarded because they arrived too late */
+   spx_uint32_t dropped_full;   /**< Packets discarded to make room because the buffer was full */
+   spx_uint32_t dropped_size;   /**< Packets discarded because they didn't fit in a slot */
+   spx_uint32_t missing;        /**< Calls to get() that found no packet (concealment needed) */
+   spx_uint32_t grown;          /**< Times the buffering delay was increased */
+   spx_uint32_t shrunk;         /**< Times the buffering delay was decreased */
+   spx_uint32_t resets;         /**< Times the buffer was reset */
+   spx_int32_t depth;           /**< Packets currently in the buffer */
+   spx_int32_t max_depth;       /**< Highest number of packets in the buffer */
+   spx_int32_t avg_depth;       /**< Average number of packets in the buffer, in 1/256 units */
+   spx_int32_t delay;           /**< Current buffering delay on top of the margin (timestamp units) */
+   spx_int32_t max_delay;       /**< Highest buffering delay on top of the margin (timestamp units) */
+} JitterBufferStats;
+
 
 /** Initialises jitter buffer
  *
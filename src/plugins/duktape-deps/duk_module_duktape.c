@@ -28,6 +28,12 @@
 #define DUK__ASSERT_TOP(ctx,val) do { (void) ctx; (void) (val); } while (0)
 #endif
 
+static duk_module_compile_function duk__compile_hook = NULL;
+
+void duk_module_duktape_set_compile_hook(duk_module_compile_function hook) {
+	duk__compile_hook = hook;
+}
+
 static void duk__resolve_module_id(duk_context *ctx, const char *req_id, const char *mod_id) {
 	duk_uint8_t buf[DUK_COMMONJS_MODULE_ID_LIMIT];
 	duk_uint8_t *p;
@@ -363,13 +369,20 @@ static duk_ret_t duk__require(duk_context *ctx) {
 		duk_pop(ctx);
 		duk_dup(ctx, DUK__IDX_RESOLVED_ID);
 	}
-	pcall_rc = duk_pcompile(ctx, DUK_COMPILE_EVAL);
-	if (pcall_rc != DUK_EXEC_SUCCESS) {
-		goto delete_rethrow;
-	}
-	pcall_rc = duk_pcall(ctx, 0);  /* -> eval'd function wrapper (not called yet) */
-	if (pcall_rc != DUK_EXEC_SUCCESS) {
-		goto delete_rethrow;
+	if (duk__compile_hook != NULL) {
+		pcall_rc = duk__compile_hook(ctx);  /* -> function wrapper (not called yet) */
+		if (pcall_rc != DUK_EXEC_SUCCESS) {
+			goto delete_rethrow;
+		}
+	} else {
+		pcall_rc = duk_pcompile(ctx, DUK_COMPILE_EVAL);
+		if (pcall_rc != DUK_EXEC_SUCCESS) {
+			goto delete_rethrow;
+		}
+		pcall_rc = duk_pcall(ctx, 0);  /* -> eval'd function wrapper (not called yet) */
+		if (pcall_rc != DUK_EXEC_SUCCESS) {
+			goto delete_rethrow;
+		}
 	}
 
 	/* Module has now evaluated to a wrapped module function.  Force its
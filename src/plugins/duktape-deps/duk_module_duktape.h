@@ -15,6 +15,15 @@ extern "C" {
 
 extern void duk_module_duktape_init(duk_context *ctx);
 
+/* Optional hook to turn the (wrapped) source of a module into its module
+ * function, e.g., to cache the compiled bytecode: it gets [ ... source
+ * filename ] and must leave either [ ... mod_func ] and return
+ * DUK_EXEC_SUCCESS, or [ ... error ] and return DUK_EXEC_ERROR.  If no
+ * hook is set, the source is compiled and evaluated as usual.
+ */
+typedef duk_int_t (*duk_module_compile_function)(duk_context *ctx);
+extern void duk_module_duktape_set_compile_hook(duk_module_compile_function hook);
+
 #if defined(__cplusplus)
 }
 #endif  /* end 'extern "C"' wrapper */
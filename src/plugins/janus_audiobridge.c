@@ -33,16 +33,22 @@ room-<unique room ID>: {
 	pin = <optional password needed for joining the room>
 	sampling_rate = <sampling rate> (e.g., 16000 for wideband mixing)
 	spatial_audio = true|false (if true, the mix will be stereo to spatially place users, default=false)
+	top_speakers = <number of loudest participants to mix, ignoring everybody else (default=0, mix all participants)>
+	opus_passthrough = true|false (whether, when a single participant is talking, what they send should be
+		forwarded as it is to Opus listeners, rather than decoded, mixed and encoded again, default=false)
 	audiolevel_ext = true|false (whether the ssrc-audio-level RTP extension must be
 		negotiated/used or not for new joins, default=true)
 	audiolevel_event = true|false (whether to emit event to other users or not, default=false)
 	audio_active_packets = 100 (number of packets with audio level, default=100, 2 seconds)
 	audio_level_average = 25 (average value of audio level, 127=muted, 0='too loud', default=25)
+	silence_threshold = 127 (audio level at or above which packets are considered silent, and so
+		neither decoded nor mixed, 127=muted, 0='too loud', default=127; Opus DTX is always skipped)
 	default_expectedloss = percent of packets we expect participants may miss, to help with outgoing FEC (default=0, max=20; automatically used for forwarders too)
 	default_bitrate = default bitrate in bps to use for the all participants (default=0, which means libopus decides; automatically used for forwarders too)
 	denoise = true|false (whether denoising via RNNoise should be performed for each participant by default)
 	record = true|false (whether this room should be recorded, default=false)
 	record_file = /path/to/recording.wav (where to save the recording)
+	record_format = wav|opus (whether the room should be recorded to a WAV file, or encoded to an Ogg/Opus one, default=wav)
 	record_dir = /path/to/ (path to save the recording to, makes record_file a relative path if provided)
 	mjrs = true|false (whether all participants in the room should be individually recorded to mjr files, default=false)
 	mjrs_dir = "/path/to/" (path to save the mjr files to)
@@ -138,15 +144,19 @@ room-<unique room ID>: {
 	"allowed" : [ array of string tokens users can use to join this room, optional],
 	"sampling_rate" : <sampling rate of the room, optional, 16000 by default>,
 	"spatial_audio" : <true|false, whether the mix should spatially place users, default=false>,
+	"top_speakers" : <number of loudest participants to mix, ignoring everybody else, default=0 (mix all participants)>,
+	"opus_passthrough" : <true|false, whether to forward what a single talking participant sends as it is to Opus listeners, rather than mixing and encoding it again, default=false>,
 	"audiolevel_ext" : <true|false, whether the ssrc-audio-level RTP extension must be negotiated for new joins, default=true>,
 	"audiolevel_event" : <true|false (whether to emit event to other users or not)>,
 	"audio_active_packets" : <number of packets with audio level (default=100, 2 seconds)>,
 	"audio_level_average" : <average value of audio level (127=muted, 0='too loud', default=25)>,
+	"silence_threshold" : <audio level at or above which packets are considered silent, and so neither decoded nor mixed (127=muted, 0='too loud', default=127)>,
 	"default_expectedloss" : <percent of packets we expect participants may miss, to help with outgoing FEC (default=0, max=20; automatically used for forwarders too)>,
 	"default_bitrate" : <bitrate in bps to use for the all participants (default=0, which means libopus decides; automatically used for forwarders too)>,
 	"denoise" : <true|false, whether denoising via RNNoise should be performed for each participant by default, default=false>,
 	"record" : <true|false, whether to record the room or not, default=false>,
 	"record_file" : "</path/to/the/recording.wav, optional>",
+	"record_format" : "<wav|opus, whether to record to a WAV file or to an Ogg/Opus one, default=wav>",
 	"record_dir" : "</path/to/, optional; makes record_file a relative path, if provided>",
 	"mjrs" : <true|false (whether all participants in the room should be individually recorded to mjr files, default=false)>,
 	"mjrs_dir" : "</path/to/, optional>",
@@ -512,7 +522,8 @@ room-<unique room ID>: {
 \verbatim
 {
 	"request" : "listparticipants",
-	"room" : <unique numeric ID of the room>
+	"room" : <unique numeric ID of the room>,
+	"stats" : <true|false, whether to include mixer and jitter buffer statistics as well; optional, default=false>
 }
 \endverbatim
  *
@@ -532,8 +543,86 @@ room-<unique room ID>: {
 			"suspended" : <true|false, whether user is suspended or not>,
 			"talking" : <true|false, whether user is talking or not (only if audio levels are used)>,
 			"spatial_position" : <in case spatial audio is used, the panning of this participant (0=left, 50=center, 100=right)>,
+			"stats" : {	// Only if "stats" was true in the request
+				"jitter-delay" : { <histogram of how long packets waited in the jitter buffer, in ms> },
+				"encode-time" : { <histogram of how long encoding a mixed frame took, in us> },
+				"plc-frames" : <number of missing frames concealed via PLC>,
+				"late-packets" : <number of packets that arrived too late to be played>,
+				"jitter-buffer" : {	// How the jitter buffer adapted to the network
+					"depth" : <packets currently in the jitter buffer>,
+					"max-depth" : <highest number of packets in the jitter buffer>,
+					"avg-depth" : <average number of packets in the jitter buffer>,
+					"delay" : <current buffering on top of the minimum, in ms>,
+					"max-delay" : <highest buffering on top of the minimum, in ms>,
+					"grown" : <how many times the buffering was increased>,
+					"shrunk" : <how many times the buffering was decreased>,
+					"missing" : <how many times there was no packet to decode>,
+					"dropped-late" : <packets dropped because they were too late>,
+					"dropped-full" : <packets dropped because the buffer was full>,
+					"dropped-size" : <packets dropped because they were too large>
+				}
+			}
 		},
 		// Other participants
+	],
+	"stats" : {	// Only if "stats" was true in the request
+		"mix-time" : { <histogram of how long each 20ms mixer tick took, in us> },
+		"mixer-late-frames" : <number of mixer ticks that couldn't be completed in time>
+	}
+}
+\endverbatim
+ *
+ * Histograms are objects whose keys are the upper bound of each bucket
+ * (the last one being open ended, e.g., \c ">20000"), and whose values
+ * are how many samples fell in that bucket since the room (or the
+ * participant) was created. The same statistics are available in the
+ * Admin API handle info, and can be periodically notified to event
+ * handlers too (see the \c stats_interval setting).
+ *
+ * To help decide where new rooms should be created, the resources each
+ * room consumes are accounted too: packets and bytes received from the
+ * participants and sent to them (and to RTP forwarders), the SRTP
+ * operations the core performs for them, the time spent decoding and
+ * encoding audio, and the CPU time used for the room. The CPU time of
+ * the mixer thread is all accounted to the room, while the work done on
+ * behalf of participants (decoding and encoding) is sampled. These values
+ * can be retrieved with the Admin API only \c usage request, optionally
+ * for a specific \c room , and optionally resetting (\c reset=true )
+ * the counters after reading them:
+ *
+\verbatim
+{
+	"request" : "usage",
+	"room" : <unique numeric ID of the room; optional, all rooms if missing>,
+	"reset" : <true|false, whether the counters should start from scratch after this; optional>
+}
+\endverbatim
+ *
+ * which results in a response like this:
+ *
+\verbatim
+{
+	"audiobridge" : "usage",
+	"rooms" : [
+		{
+			"room" : <unique numeric ID of the room>,
+			"description" : "<name of the room>",
+			"num_participants" : <number of participants in the room>,
+			"num_forwarders" : <number of RTP forwarders of the room>,
+			"usage" : {
+				"packets-in" : <packets received>,
+				"bytes-in" : <bytes received>,
+				"packets-out" : <packets sent>,
+				"bytes-out" : <bytes sent>,
+				"srtp-ops" : <SRTP encryptions and decryptions the core performed for those packets>,
+				"decode-time" : <time spent decoding audio, in us>,
+				"encode-time" : <time spent encoding audio, in us>,
+				"cpu-time" : <CPU time used for the room, in us>,
+				"elapsed" : <seconds since accounting started (room creation or last reset)>,
+				"cpu-load" : <average CPU load in that time, as a percentage of one core>
+			}
+		},
+		// Other rooms
 	]
 }
 \endverbatim
@@ -1159,6 +1248,10 @@ room-<unique room ID>: {
  *
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		/* Needed for O_DIRECT */
+#endif
+
 #include "plugin.h"
 #ifdef __FreeBSD__
 #include <sys/socket.h>
@@ -1183,7 +1276,11 @@ room-<unique room ID>: {
 #include <sys/socket.h>
 #include <netdb.h>
 #include <sys/time.h>
+#include <time.h>
 #include <poll.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "../debug.h"
 #include "../apierror.h"
@@ -1197,6 +1294,8 @@ room-<unique room ID>: {
 #include "../sdp-utils.h"
 #include "../utils.h"
 #include "../ip-utils.h"
+#include "../sched-profile.h"
+#include "../usage.h"
 
 
 /* Plugin information */
@@ -1211,6 +1310,9 @@ room-<unique room ID>: {
 #define MAX_MISORDER						50
 
 #define JANUS_AUDIOBRIDGE_MAX_GROUPS		5
+#define JANUS_AUDIOBRIDGE_MAX_SPEAKERS		32
+/* Advantage (in dB) participants being mixed get over the others, when only the loudest speakers are mixed */
+#define JANUS_AUDIOBRIDGE_SPEAKERS_HYSTERESIS	6
 
 /* Plugin methods */
 janus_plugin *create(void);
@@ -1280,6 +1382,12 @@ static struct janus_json_parameter roomopt_parameters[] = {
 static struct janus_json_parameter roomstr_parameters[] = {
 	{"room", JSON_STRING, JANUS_JSON_PARAM_REQUIRED}
 };
+static struct janus_json_parameter listparticipants_parameters[] = {
+	{"stats", JANUS_JSON_BOOL, 0}
+};
+static struct janus_json_parameter usage_parameters[] = {
+	{"reset", JANUS_JSON_BOOL, 0}
+};
 static struct janus_json_parameter roomstropt_parameters[] = {
 	{"room", JSON_STRING, 0}
 };
@@ -1307,8 +1415,11 @@ static struct janus_json_parameter create_parameters[] = {
 	{"sampling_rate", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"sampling", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},	/* We keep this to be backwards compatible */
 	{"spatial_audio", JANUS_JSON_BOOL, 0},
+	{"top_speakers", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"opus_passthrough", JANUS_JSON_BOOL, 0},
 	{"record", JANUS_JSON_BOOL, 0},
 	{"record_file", JSON_STRING, 0},
+	{"record_format", JSON_STRING, 0},
 	{"record_dir", JSON_STRING, 0},
 	{"mjrs", JANUS_JSON_BOOL, 0},
 	{"mjrs_dir", JSON_STRING, 0},
@@ -1318,6 +1429,7 @@ static struct janus_json_parameter create_parameters[] = {
 	{"audiolevel_event", JANUS_JSON_BOOL, 0},
 	{"audio_active_packets", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"audio_level_average", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"silence_threshold", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"default_expectedloss", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"default_bitrate", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"denoise", JANUS_JSON_BOOL, 0},
@@ -1436,11 +1548,18 @@ static struct janus_json_parameter resume_parameters[] = {
 static janus_config *config = NULL;
 static const char *config_folder = NULL;
 static janus_mutex config_mutex = JANUS_MUTEX_INITIALIZER;
+static janus_config_journal *config_journal = NULL;
 
 /* Useful stuff */
 static volatile gint initialized = 0, stopping = 0;
 static gboolean notify_events = TRUE;
 static gboolean string_ids = FALSE;
+static gboolean shared_encoding = FALSE;
+static int encoding_threads = 0;
+static int participant_workers = 0;
+static int resampler_quality = 8;
+static int denoise_threads = 0;
+static int stats_interval = 0;
 static gboolean ipv6_disabled = FALSE;
 static janus_callbacks *gateway = NULL;
 static GThread *handler_thread;
@@ -1448,10 +1567,14 @@ static void *janus_audiobridge_handler(void *data);
 static void janus_audiobridge_relay_rtp_packet(gpointer data, gpointer user_data);
 static void *janus_audiobridge_mixer_thread(void *data);
 static void *janus_audiobridge_participant_thread(void *data);
+static void *janus_audiobridge_worker_thread(void *data);
 static void janus_audiobridge_hangup_media_internal(janus_plugin_session *handle);
 
 /* Extension to add while recording (e.g., "tmp" --> ".wav.tmp") */
 static char *rec_tempext = NULL;
+/* How many mixed frames room recordings can queue for the writer thread, and whether it should use O_DIRECT */
+static guint rec_queue_frames = 250;
+static gboolean rec_direct_io = FALSE;
 
 /* RTP range, in case we need to support plain RTP participants */
 static char *local_ip = NULL;
@@ -1471,6 +1594,33 @@ typedef struct janus_audiobridge_message {
 static GAsyncQueue *messages = NULL;
 static janus_audiobridge_message exit_message;
 
+/* We keep some lightweight histograms to figure out whether mixing, encoding
+ * and the jitter buffers of participants are keeping up with the 20ms ticks */
+#define JANUS_AUDIOBRIDGE_HISTOGRAM_BUCKETS	8
+static const int janus_audiobridge_time_buckets[JANUS_AUDIOBRIDGE_HISTOGRAM_BUCKETS-1] = { 250, 500, 1000, 2500, 5000, 10000, 20000 };
+static const int janus_audiobridge_delay_buckets[JANUS_AUDIOBRIDGE_HISTOGRAM_BUCKETS-1] = { 20, 40, 60, 80, 100, 200, 500 };
+static int janus_audiobridge_histogram_bucket(const int *buckets, gint64 value) {
+	int i = 0;
+	for(i=0; i<JANUS_AUDIOBRIDGE_HISTOGRAM_BUCKETS-1; i++) {
+		if(value <= buckets[i])
+			return i;
+	}
+	return JANUS_AUDIOBRIDGE_HISTOGRAM_BUCKETS-1;
+}
+static json_t *janus_audiobridge_histogram_json(const int *buckets, volatile gint *counters) {
+	json_t *histogram = json_object();
+	char name[20];
+	int i = 0;
+	for(i=0; i<JANUS_AUDIOBRIDGE_HISTOGRAM_BUCKETS; i++) {
+		if(i < JANUS_AUDIOBRIDGE_HISTOGRAM_BUCKETS-1)
+			g_snprintf(name, sizeof(name), "%d", buckets[i]);
+		else
+			g_snprintf(name, sizeof(name), ">%d", buckets[i-1]);
+		json_object_set_new(histogram, name, json_integer(g_atomic_int_get(&counters[i])));
+	}
+	return histogram;
+}
+
 
 /* Structs */
 typedef struct janus_audiobridge_room {
@@ -1483,12 +1633,15 @@ typedef struct janus_audiobridge_room {
 	gboolean is_private;		/* Whether this room is 'private' (as in hidden) or not */
 	uint32_t sampling_rate;		/* Sampling rate of the mix (e.g., 16000 for wideband; can be 8, 12, 16, 24 or 48kHz) */
 	gboolean spatial_audio;		/* Whether the mix will use spatial audio, using stereo */
+	uint top_speakers;			/* If set, only the loudest participants are mixed */
+	gboolean opus_passthrough;	/* Whether a single speaker should be forwarded as it is, rather than mixed */
 	gboolean audiolevel_ext;	/* Whether the ssrc-audio-level extension must be negotiated or not for new joins */
 	gboolean audiolevel_event;	/* Whether to emit event to other users about audiolevel */
 	uint default_expectedloss;	/* Percent of packets we expect participants may miss, to help with outgoing FEC: can be overridden per-participant */
 	int32_t default_bitrate;	/* Default bitrate to use for all Opus streams when encoding */
 	int audio_active_packets;	/* Amount of packets with audio level for checkup */
 	int audio_level_average;	/* Average audio level */
+	int silence_threshold;		/* Audio level at or above which we don't decode and mix packets */
 #ifdef HAVE_RNNOISE
 	gboolean denoise;			/* Whether we should denoise participants by default */
 #endif
@@ -1497,9 +1650,10 @@ typedef struct janus_audiobridge_room {
 	gchar *record_dir;			/* Folder to save the recording file to */
 	gboolean mjrs;				/* Whether all participants in the room should be individually recorded to mjr files or not */
 	gchar *mjrs_dir;			/* Folder to save the mjrs file to */
-	FILE *recording;			/* File to record the room into */
-	gint64 record_lastupdate;	/* Time when we last updated the wav header */
-	volatile gint wav_header_added;	/* If wav header is added in recording file */
+	gboolean record_opus;		/* Whether the room should be recorded to Ogg/Opus, rather than WAV */
+	struct janus_audiobridge_mix_recording *recording;	/* Recording of the room, if active */
+	volatile gint record_dropped;	/* Number of mixed frames we couldn't record because the writer was too slow */
+	volatile gint wav_header_added;	/* If the recording of the room has been started */
 	gint64 rec_start_time;		/* Time when recording started for generating file name */
 	gboolean allow_plainrtp;	/* Whether plain RTP participants are allowed*/
 	gboolean destroy;			/* Value to flag the room for destruction */
@@ -1509,6 +1663,10 @@ typedef struct janus_audiobridge_room {
 	gboolean muted;				/* Whether the room is globally muted (except for admins and played files) */
 	GHashTable *allowed;		/* Map of participants (as tokens) allowed to join */
 	GThread *thread;			/* Mixer thread for this room */
+	volatile gint late_frames;	/* Number of mixer ticks that couldn't be completed in time */
+	volatile gint passthrough_frames;	/* Number of mixer ticks that forwarded a single speaker as it is */
+	volatile gint mix_time[JANUS_AUDIOBRIDGE_HISTOGRAM_BUCKETS];	/* Histogram of how long mixer ticks took */
+	janus_usage usage;			/* Resources consumed by this room */
 	volatile gint destroyed;	/* Whether this room has been destroyed */
 	janus_mutex mutex;			/* Mutex to lock this room instance */
 	/* RTP forwarders for this room's mix */
@@ -1708,6 +1866,11 @@ typedef struct janus_audiobridge_plainrtp_media {
 static void janus_audiobridge_plainrtp_media_cleanup(janus_audiobridge_plainrtp_media *media);
 static int janus_audiobridge_plainrtp_allocate_port(janus_audiobridge_plainrtp_media *media);
 static void *janus_audiobridge_plainrtp_relay_thread(void *data);
+/* Thread sending the mix to all plain RTP G.711 legs */
+static GThread *plainrtp_sender = NULL;
+static GAsyncQueue *plainrtp_batches = NULL;
+static GPtrArray plainrtp_exit_batch;
+static void *janus_audiobridge_plainrtp_sender_thread(void *data);
 
 /* AudioBridge participant */
 typedef struct janus_audiobridge_participant {
@@ -1737,11 +1900,16 @@ typedef struct janus_audiobridge_participant {
 	opus_int16 *upsample_buffer;		/* Buffer for upsampling */
 	opus_int16 *downsample_buffer;		/* Buffer for downsampling */
 	float *denoiser_buffer[2];			/* Buffer for denoising */
+	struct janus_audiobridge_denoiser *denoiser;	/* Denoiser thread this participant is assigned to, if any */
+	int denoise_quiet;					/* Number of consecutive frames in which RNNoise detected no voice */
+	gboolean denoise_gated;				/* Whether we're muting, rather than denoising, this participant */
+	int denoise_floor;					/* Level of the noise when we started muting */
+	volatile gint denoise_gated_frames;	/* Total number of frames we muted rather than denoise */
 #endif
 	/* RTP stuff */
 	JitterBuffer *jitter;	/* Jitter buffer of incoming audio packets */
 	gint64 jitter_next_check;	/* Timestamp to perform next jitter buffer size check */
-	GList *inbuf;			/* Decoded audio from this participant, to feed to the mixer */
+	struct janus_audiobridge_inbuf *inbuf;	/* Decoded audio from this participant, to feed to the mixer */
 	GAsyncQueue *outbuf;	/* Mixed audio to send to this participant */
 	janus_mutex qmutex;		/* Incoming queue mutex */
 	int opus_pt;			/* Opus payload type */
@@ -1752,6 +1920,10 @@ typedef struct janus_audiobridge_participant {
 	int user_audio_active_packets; /* Participant's number of audio packets to evaluate */
 	int user_audio_level_average;	 /* Participant's average level of dBov value */
 	gboolean talking;		/* Whether this participant is currently talking (uses audio levels extension) */
+	int silent_frames;		/* Number of consecutive silent frames we didn't decode */
+	int speaker_level;		/* Smoothed audio level, to rank participants when only the loudest are mixed */
+	gboolean mixing;		/* Whether this participant is one of the loudest ones that are being mixed */
+	volatile gint skipped_frames;	/* Total number of silent frames we didn't decode */
 	janus_rtp_switching_context context;	/* Needed in case the participant changes room */
 	janus_audiocodec codec;	/* Codec this participant is using (most often Opus, but G.711 is supported too) */
 	/* Plain RTP, in case this is not a WebRTC participant */
@@ -1764,10 +1936,24 @@ typedef struct janus_audiobridge_participant {
 	OpusDecoder *decoder;		/* Opus decoder instance */
 	gboolean fec;				/* Opus FEC (from Janus to user) status */
 	int expected_loss;			/* Percentage of expected loss, to configure libopus outgoing FEC behaviour (default=0, no FEC even if negotiated) */
+	volatile gint encode_pending;	/* Whether a mixed frame for this participant is waiting for an encoding worker */
+	volatile gint encode_late;		/* Number of mixed frames dropped because the previous one was still being encoded */
+	volatile gint encode_time[JANUS_AUDIOBRIDGE_HISTOGRAM_BUCKETS];	/* Histogram of how long encoding mixed frames took */
+	volatile gint jitter_delay[JANUS_AUDIOBRIDGE_HISTOGRAM_BUCKETS];	/* Histogram of how long packets waited in the jitter buffer */
+	volatile gint plc_frames;		/* Number of missing frames we concealed via PLC */
+	volatile gint late_packets;		/* Number of packets that arrived after their turn in the jitter buffer */
 	uint32_t last_timestamp;	/* Last in seq timestamp */
 	uint16_t last_seq; 		/* Last sequence number */
 	gboolean reset;				/* Whether or not the Opus context must be reset, without re-joining the room */
 	GThread *thread;			/* Encoding thread for this participant */
+	struct janus_audiobridge_worker *worker;	/* Participant worker taking care of this participant, if not using a thread */
+	gint64 deadline;			/* When the participant worker should decode the next packet for this participant */
+	volatile gint encode_queued;	/* Whether this participant is already queued in its worker for encoding */
+	gboolean worker_suspended;	/* Whether the participant worker noticed this participant was suspended */
+	gint64 decode_before;		/* When we last decoded a packet from the jitter buffer */
+	int jitter_ticks;			/* Jitter buffer ticks, to adjust its size every second */
+	gboolean decode_first;		/* Whether we haven't decoded any packet yet (no PLC until we do) */
+	int lost_packets_gap;		/* How many consecutive packets we recovered via PLC */
 	gboolean mjr_active;		/* Whether this participant has to be recorded to an mjr file or not */
 	gchar *mjr_base;			/* Base name for the mjr recording (e.g., /path/to/filename, will generate /path/to/filename-audio.mjr) */
 	janus_recorder *arc;		/* The Janus recorder instance for this user's audio, if enabled */
@@ -1784,6 +1970,69 @@ typedef struct janus_audiobridge_participant {
 	janus_refcount ref;			/* Reference counter for this participant */
 } janus_audiobridge_participant;
 
+/* Participant worker: instead of a thread per participant, a fixed set of
+ * workers can decode and encode on behalf of many participants. Each worker
+ * keeps its participants in a queue ordered by when their next 20ms decode
+ * is due (they all have the same period, so that's enough to know who's next),
+ * plus a queue of participants that have a mixed frame waiting to be encoded */
+typedef struct janus_audiobridge_worker {
+	int id;						/* Index of this worker */
+	GThread *thread;			/* Thread of this worker */
+	janus_mutex mutex;			/* Mutex to protect the queues */
+	GCond cond;					/* Condition to wake the worker up */
+	GQueue *wheel;				/* Participants handled by this worker, in deadline order */
+	GQueue *encodes;			/* Participants with a mixed frame waiting to be encoded */
+	volatile gint count;		/* Number of participants handled by this worker */
+	volatile gint missed;		/* Number of decode deadlines this worker missed by more than a frame */
+	volatile gint load;			/* Percentage of time this worker was busy in the last second */
+	gint64 busy, load_start;	/* Needed to compute the load */
+} janus_audiobridge_worker;
+static janus_audiobridge_worker *workers = NULL;
+static void janus_audiobridge_worker_add(janus_audiobridge_session *session, janus_audiobridge_participant *participant);
+
+#ifdef HAVE_RNNOISE
+/* Denoiser: rather than running RNNoise inline when decoding, decoded frames
+ * can be handed to a pool of denoiser threads, each taking care of a fixed
+ * set of participants (so that the frames of a participant are always
+ * processed in order, and by the same RNNoise states). Denoisers process all
+ * the frames that are waiting in a single batch, so that the RNNoise model is
+ * still hot in the cache when moving from a participant to the next one */
+typedef struct janus_audiobridge_denoiser {
+	int id;						/* Index of this denoiser */
+	GThread *thread;			/* Thread of this denoiser */
+	GAsyncQueue *frames;		/* Decoded frames waiting to be denoised */
+	volatile gint count;		/* Number of participants assigned to this denoiser */
+	volatile gint batches;		/* Number of batches processed so far */
+	volatile gint processed;	/* Number of frames processed so far */
+} janus_audiobridge_denoiser;
+typedef struct janus_audiobridge_denoise_frame {
+	janus_audiobridge_participant *participant;
+	struct janus_audiobridge_rtp_relay_packet *pkt;
+} janus_audiobridge_denoise_frame;
+static janus_audiobridge_denoise_frame denoise_exit_frame;
+static janus_audiobridge_denoiser *denoisers = NULL;
+static volatile gint denoisers_next = 0;
+#define JANUS_AUDIOBRIDGE_DENOISE_BATCH		64
+/* If RNNoise detects no voice for a second, we stop running it and mute the
+ * participant instead, until the audio gets louder than the noise was */
+#define JANUS_AUDIOBRIDGE_DENOISE_QUIET_VAD		0.1f
+#define JANUS_AUDIOBRIDGE_DENOISE_QUIET_FRAMES	50
+#define JANUS_AUDIOBRIDGE_DENOISE_GATE_MARGIN	6
+static void *janus_audiobridge_denoiser_thread(void *data);
+#endif
+
+/* Frame the mixer encoded once for all the participants that get the same mix */
+typedef struct janus_audiobridge_encoded_frame {
+	unsigned char *data;
+	gint length;
+	janus_refcount ref;
+} janus_audiobridge_encoded_frame;
+static void janus_audiobridge_encoded_frame_free(const janus_refcount *f_ref) {
+	janus_audiobridge_encoded_frame *frame = janus_refcount_containerof(f_ref, janus_audiobridge_encoded_frame, ref);
+	g_free(frame->data);
+	g_free(frame);
+}
+
 typedef struct janus_audiobridge_rtp_relay_packet {
 	janus_rtp_header *data;
 	gint length;
@@ -1791,57 +2040,183 @@ typedef struct janus_audiobridge_rtp_relay_packet {
 	uint32_t timestamp;
 	uint16_t seq_number;
 	gboolean silence;
+	int level;				/* Audio level from the RTP extension, if available (-1 otherwise) */
+	/* For mixed frames, set if already encoded; for decoded frames, the
+	 * original Opus payload, in case we may need to forward it as it is */
+	janus_audiobridge_encoded_frame *encoded;
 } janus_audiobridge_rtp_relay_packet;
 
-/* Buffered audio/video packet */
+/* Decoded audio from a participant, waiting for the mixer: this is a single
+ * producer (whoever decodes, or denoises, the participant's audio) and single
+ * consumer (the mixer) ring of frames that are allocated once and then reused,
+ * so that neither side needs to lock or allocate anything per frame. The
+ * producer fills the slot after the last reserved one, and publishes slots in
+ * order once they're ready (denoising may be in between); the mixer reads and
+ * releases them. Other threads can't touch the ring, but they can ask the mixer
+ * to drop whatever is queued, e.g., when a participant is muted */
+#define JANUS_AUDIOBRIDGE_INBUF_SLOTS	8	/* Must be a power of 2 */
+typedef struct janus_audiobridge_inbuf {
+	janus_audiobridge_rtp_relay_packet slots[JANUS_AUDIOBRIDGE_INBUF_SLOTS];
+	janus_audiobridge_rtp_relay_packet spare;	/* Where we decode when the ring is full */
+	guint reserved;			/* Slots the producer filled so far (only used by the producer) */
+	volatile gint head;		/* Slots the producer published so far */
+	volatile gint tail;		/* Slots the mixer released so far */
+	volatile gint clear;	/* Whether the mixer should drop all the published slots */
+	volatile gint dropped;	/* Number of decoded frames we had no room for */
+} janus_audiobridge_inbuf;
+
+/* Helpers to summarize the statistics of a room and of a participant */
+static json_t *janus_audiobridge_room_stats(janus_audiobridge_room *audiobridge) {
+	json_t *stats = json_object();
+	json_object_set_new(stats, "mix-time", janus_audiobridge_histogram_json(janus_audiobridge_time_buckets, audiobridge->mix_time));
+	json_object_set_new(stats, "mixer-late-frames", json_integer(g_atomic_int_get(&audiobridge->late_frames)));
+	return stats;
+}
+static json_t *janus_audiobridge_participant_stats(janus_audiobridge_participant *participant) {
+	json_t *stats = json_object();
+	json_object_set_new(stats, "jitter-delay", janus_audiobridge_histogram_json(janus_audiobridge_delay_buckets, participant->jitter_delay));
+	json_object_set_new(stats, "encode-time", janus_audiobridge_histogram_json(janus_audiobridge_time_buckets, participant->encode_time));
+	json_object_set_new(stats, "plc-frames", json_integer(g_atomic_int_get(&participant->plc_frames)));
+	json_object_set_new(stats, "late-packets", json_integer(g_atomic_int_get(&participant->late_packets)));
+	JitterBufferStats jstats = { 0 };
+	janus_mutex_lock(&participant->qmutex);
+	gboolean has_jitter = (participant->jitter != NULL);
+	if(has_jitter)
+		jitter_buffer_ctl(participant->jitter, JITTER_BUFFER_GET_STATS, &jstats);
+	janus_mutex_unlock(&participant->qmutex);
+	if(has_jitter) {
+		/* Timestamps in the jitter buffer are in samples, convert them to ms */
+		int samples_per_ms = participant->codec == JANUS_AUDIOCODEC_OPUS ? 48 : 8;
+		json_t *jitter = json_object();
+		json_object_set_new(jitter, "depth", json_integer(jstats.depth));
+		json_object_set_new(jitter, "max-depth", json_integer(jstats.max_depth));
+		json_object_set_new(jitter, "avg-depth", json_real((double)jstats.avg_depth/256.0));
+		json_object_set_new(jitter, "delay", json_integer(jstats.delay/samples_per_ms));
+		json_object_set_new(jitter, "max-delay", json_integer(jstats.max_delay/samples_per_ms));
+		json_object_set_new(jitter, "grown", json_integer(jstats.grown));
+		json_object_set_new(jitter, "shrunk", json_integer(jstats.shrunk));
+		json_object_set_new(jitter, "missing", json_integer(jstats.missing));
+		json_object_set_new(jitter, "dropped-late", json_integer(jstats.dropped_late));
+		json_object_set_new(jitter, "dropped-full", json_integer(jstats.dropped_full));
+		json_object_set_new(jitter, "dropped-size", json_integer(jstats.dropped_size));
+		json_object_set_new(stats, "jitter-buffer", jitter);
+	}
+	return stats;
+}
+
+/* Buffered audio packet: the jitter buffer stores it in one of its
+ * preallocated slots, so only the used part of the buffer is copied */
+#define JANUS_AUDIOBRIDGE_MAX_RTP_SIZE	1500
 typedef struct janus_audiobridge_buffer_packet {
-	/* Pointer to the packet data, if RTP */
+	/* Pointer to the packet data, if RTP (only valid after it's been fixed) */
 	janus_plugin_rtp *rtp;
 	/* Monotonic insert time */
 	int64_t inserted;
+	/* Copy of the packet info and data */
+	janus_plugin_rtp packet;
+	char buffer[JANUS_AUDIOBRIDGE_MAX_RTP_SIZE];
 } janus_audiobridge_buffer_packet;
-static janus_audiobridge_buffer_packet *janus_audiobridge_buffer_packet_create(janus_plugin_rtp *rtp) {
-	janus_audiobridge_buffer_packet *pkt = g_malloc(sizeof(janus_audiobridge_buffer_packet));
-	pkt->rtp = janus_plugin_rtp_duplicate(rtp);
+/* Helper to fill a buffered packet: returns the number of bytes to store */
+static spx_uint32_t janus_audiobridge_buffer_packet_fill(janus_audiobridge_buffer_packet *pkt, janus_plugin_rtp *rtp) {
+	pkt->rtp = NULL;
 	pkt->inserted = janus_get_monotonic_time();
-	return pkt;
+	pkt->packet = *rtp;
+	pkt->packet.buffer = NULL;
+	memcpy(pkt->buffer, rtp->buffer, rtp->length);
+	return offsetof(janus_audiobridge_buffer_packet, buffer) + rtp->length;
 }
-static void janus_audiobridge_buffer_packet_destroy(janus_audiobridge_buffer_packet *pkt) {
-	if(!pkt)
-		return;
-	if(pkt->rtp)
-		g_free(pkt->rtp->buffer);
-	g_free(pkt->rtp);
-	g_free(pkt);
+/* Helper to fix the pointers of a packet we got out of the jitter buffer */
+static void janus_audiobridge_buffer_packet_fix(janus_audiobridge_buffer_packet *pkt) {
+	pkt->packet.buffer = pkt->buffer;
+	pkt->rtp = &pkt->packet;
 }
 
 static void janus_audiobridge_participant_istalking(janus_audiobridge_session *session,
 	janus_audiobridge_participant *participant, janus_plugin_rtp *packet, gboolean *silence);
 
+/* Helper to account the CPU time of some work we sampled for a participant to their room */
+static void janus_audiobridge_participant_usage_sample(janus_audiobridge_participant *participant, guint weight, gint64 cpu) {
+	janus_audiobridge_room *audiobridge = participant->room;
+	if(audiobridge != NULL)
+		janus_usage_sample_stop(&audiobridge->usage, weight, cpu);
+}
+
 static void janus_audiobridge_participant_clear_jitter_buffer(janus_audiobridge_participant *participant) {
 	if(participant->jitter) {
 		jitter_buffer_reset(participant->jitter);
 	}
 }
 
-static void janus_audiobridge_participant_clear_inbuf(janus_audiobridge_participant *participant) {
-	while(participant->inbuf) {
-		GList *first = g_list_first(participant->inbuf);
-		janus_audiobridge_rtp_relay_packet *pkt = (janus_audiobridge_rtp_relay_packet *)first->data;
-		participant->inbuf = g_list_delete_link(participant->inbuf, first);
-		first = NULL;
-		if(pkt == NULL)
-			continue;
+static janus_audiobridge_inbuf *janus_audiobridge_inbuf_create(void) {
+	return g_malloc0(sizeof(janus_audiobridge_inbuf));
+}
+
+static void janus_audiobridge_inbuf_destroy(janus_audiobridge_inbuf *inbuf) {
+	if(inbuf == NULL)
+		return;
+	int i = 0;
+	for(i=0; i<=JANUS_AUDIOBRIDGE_INBUF_SLOTS; i++) {
+		janus_audiobridge_rtp_relay_packet *pkt = (i < JANUS_AUDIOBRIDGE_INBUF_SLOTS) ? &inbuf->slots[i] : &inbuf->spare;
+		if(pkt->encoded) {
+			janus_refcount_decrease(&pkt->encoded->ref);
+		}
 		g_free(pkt->data);
-		pkt->data = NULL;
-		g_free(pkt);
-		pkt = NULL;
 	}
+	g_free(inbuf);
+}
+
+/* Mixer side: get the oldest published slot, if any, without releasing it */
+static janus_audiobridge_rtp_relay_packet *janus_audiobridge_inbuf_peek(janus_audiobridge_inbuf *inbuf) {
+	if(inbuf == NULL)
+		return NULL;
+	gint tail = g_atomic_int_get(&inbuf->tail), head = g_atomic_int_get(&inbuf->head);
+	if(g_atomic_int_compare_and_exchange(&inbuf->clear, 1, 0)) {
+		/* We've been asked to drop everything that's queued */
+		while(tail != head) {
+			janus_audiobridge_rtp_relay_packet *pkt = &inbuf->slots[tail & (JANUS_AUDIOBRIDGE_INBUF_SLOTS-1)];
+			if(pkt->encoded) {
+				janus_refcount_decrease(&pkt->encoded->ref);
+				pkt->encoded = NULL;
+			}
+			tail++;
+		}
+		g_atomic_int_set(&inbuf->tail, tail);
+	}
+	if(tail == head)
+		return NULL;
+	return &inbuf->slots[tail & (JANUS_AUDIOBRIDGE_INBUF_SLOTS-1)];
+}
+
+/* Mixer side: release the oldest published slot, so that the producer can reuse it */
+static void janus_audiobridge_inbuf_release(janus_audiobridge_inbuf *inbuf) {
+	gint tail = g_atomic_int_get(&inbuf->tail);
+	if(tail == g_atomic_int_get(&inbuf->head))
+		return;
+	janus_audiobridge_rtp_relay_packet *pkt = &inbuf->slots[tail & (JANUS_AUDIOBRIDGE_INBUF_SLOTS-1)];
+	if(pkt->encoded) {
+		janus_refcount_decrease(&pkt->encoded->ref);
+		pkt->encoded = NULL;
+	}
+	g_atomic_int_set(&inbuf->tail, tail+1);
+}
+
+static guint janus_audiobridge_inbuf_count(janus_audiobridge_inbuf *inbuf) {
+	if(inbuf == NULL)
+		return 0;
+	return (guint)g_atomic_int_get(&inbuf->head) - (guint)g_atomic_int_get(&inbuf->tail);
+}
+
+static void janus_audiobridge_participant_clear_inbuf(janus_audiobridge_participant *participant) {
+	/* We can't touch the ring from here, so we ask the mixer to drop the queued frames */
+	if(participant->inbuf != NULL)
+		g_atomic_int_set(&participant->inbuf->clear, 1);
 }
 
 static void janus_audiobridge_participant_clear_outbuf(janus_audiobridge_participant *participant) {
 	while(participant->outbuf && g_async_queue_length(participant->outbuf) > 0) {
 		janus_audiobridge_rtp_relay_packet *pkt = g_async_queue_pop(participant->outbuf);
+		if(pkt->encoded)
+			janus_refcount_decrease(&pkt->encoded->ref);
 		g_free(pkt->data);
 		g_free(pkt);
 	}
@@ -1874,7 +2249,7 @@ static void janus_audiobridge_participant_free(const janus_refcount *participant
 		opus_decoder_destroy(participant->decoder);
 	if(participant->jitter)
 		jitter_buffer_destroy(participant->jitter);
-	janus_audiobridge_participant_clear_inbuf(participant);
+	janus_audiobridge_inbuf_destroy(participant->inbuf);
 	if(participant->outbuf != NULL) {
 		janus_audiobridge_participant_clear_outbuf(participant);
 		g_async_queue_unref(participant->outbuf);
@@ -2205,13 +2580,225 @@ static int janus_audiobridge_resample(int16_t *input, int input_num, int input_r
 	} else {
 		/* Downsample */
 		int down = input_rate/output_rate, i = 0;
-		for(i=0; i<input_num; i++) {
+		for(i=0; i<input_num/down; i++) {
 			*(output + i) = *(input + i*down);
 		}
 		return input_num/down;
 	}
 }
 
+/* Mixing kernels: the mixer thread adds the contribution of each participant
+ * to the mix (optionally applying a gain), removes it again when preparing
+ * the frame for that participant, and converts the mix back to 16-bit samples.
+ * Gains are precomputed per channel (left for even samples, right for odd
+ * samples, the same value for both when mono), and are applied by truncating
+ * the result, so that adding and removing a contribution always cancel out.
+ * Since this is the hot path in large rooms, we pick vectorized versions of
+ * the kernels at startup, if the CPU we're running on supports them */
+typedef struct janus_audiobridge_mix_kernels {
+	const char *name;
+	/* mix[i] += samples[i]*gain */
+	void (*add)(opus_int32 *mix, const opus_int16 *samples, int num, float lgain, float rgain);
+	/* out[i] = mix[i] - samples[i]*gain */
+	void (*sub)(opus_int32 *out, const opus_int32 *mix, const opus_int16 *samples, int num, float lgain, float rgain);
+	/* out[i] = mix[i], saturated to 16 bits */
+	void (*saturate)(opus_int16 *out, const opus_int32 *mix, int num);
+} janus_audiobridge_mix_kernels;
+
+static void janus_audiobridge_mix_add_scalar(opus_int32 *mix, const opus_int16 *samples, int num, float lgain, float rgain) {
+	int i = 0;
+	if(lgain == 1.0f && rgain == 1.0f) {
+		for(i=0; i<num; i++)
+			mix[i] += samples[i];
+		return;
+	}
+	for(i=0; i+1<num; i+=2) {
+		mix[i] += (opus_int32)(samples[i]*lgain);
+		mix[i+1] += (opus_int32)(samples[i+1]*rgain);
+	}
+	if(i < num)
+		mix[i] += (opus_int32)(samples[i]*lgain);
+}
+static void janus_audiobridge_mix_sub_scalar(opus_int32 *out, const opus_int32 *mix, const opus_int16 *samples, int num, float lgain, float rgain) {
+	int i = 0;
+	if(lgain == 1.0f && rgain == 1.0f) {
+		for(i=0; i<num; i++)
+			out[i] = mix[i] - samples[i];
+		return;
+	}
+	for(i=0; i+1<num; i+=2) {
+		out[i] = mix[i] - (opus_int32)(samples[i]*lgain);
+		out[i+1] = mix[i+1] - (opus_int32)(samples[i+1]*rgain);
+	}
+	if(i < num)
+		out[i] = mix[i] - (opus_int32)(samples[i]*lgain);
+}
+static void janus_audiobridge_mix_saturate_scalar(opus_int16 *out, const opus_int32 *mix, int num) {
+	int i = 0;
+	for(i=0; i<num; i++)
+		out[i] = mix[i] > 32767 ? 32767 : (mix[i] < -32768 ? -32768 : mix[i]);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define JANUS_AUDIOBRIDGE_MIX_X86
+/* SSE4.1 (4 samples at a time) */
+__attribute__((target("sse4.1")))
+static void janus_audiobridge_mix_add_sse41(opus_int32 *mix, const opus_int16 *samples, int num, float lgain, float rgain) {
+	int i = 0;
+	__m128 gains = _mm_setr_ps(lgain, rgain, lgain, rgain);
+	for(i=0; i+4<=num; i+=4) {
+		__m128i s = _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)(samples+i)));
+		__m128i g = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(s), gains));
+		__m128i m = _mm_loadu_si128((const __m128i *)(mix+i));
+		_mm_storeu_si128((__m128i *)(mix+i), _mm_add_epi32(m, g));
+	}
+	if(i < num)
+		janus_audiobridge_mix_add_scalar(mix+i, samples+i, num-i, lgain, rgain);
+}
+__attribute__((target("sse4.1")))
+static void janus_audiobridge_mix_sub_sse41(opus_int32 *out, const opus_int32 *mix, const opus_int16 *samples, int num, float lgain, float rgain) {
+	int i = 0;
+	__m128 gains = _mm_setr_ps(lgain, rgain, lgain, rgain);
+	for(i=0; i+4<=num; i+=4) {
+		__m128i s = _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)(samples+i)));
+		__m128i g = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(s), gains));
+		__m128i m = _mm_loadu_si128((const __m128i *)(mix+i));
+		_mm_storeu_si128((__m128i *)(out+i), _mm_sub_epi32(m, g));
+	}
+	if(i < num)
+		janus_audiobridge_mix_sub_scalar(out+i, mix+i, samples+i, num-i, lgain, rgain);
+}
+__attribute__((target("sse4.1")))
+static void janus_audiobridge_mix_saturate_sse41(opus_int16 *out, const opus_int32 *mix, int num) {
+	int i = 0;
+	for(i=0; i+8<=num; i+=8) {
+		__m128i lo = _mm_loadu_si128((const __m128i *)(mix+i));
+		__m128i hi = _mm_loadu_si128((const __m128i *)(mix+i+4));
+		_mm_storeu_si128((__m128i *)(out+i), _mm_packs_epi32(lo, hi));
+	}
+	if(i < num)
+		janus_audiobridge_mix_saturate_scalar(out+i, mix+i, num-i);
+}
+/* AVX2 (8 samples at a time) */
+__attribute__((target("avx2")))
+static void janus_audiobridge_mix_add_avx2(opus_int32 *mix, const opus_int16 *samples, int num, float lgain, float rgain) {
+	int i = 0;
+	__m256 gains = _mm256_setr_ps(lgain, rgain, lgain, rgain, lgain, rgain, lgain, rgain);
+	for(i=0; i+8<=num; i+=8) {
+		__m256i s = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(samples+i)));
+		__m256i g = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(s), gains));
+		__m256i m = _mm256_loadu_si256((const __m256i *)(mix+i));
+		_mm256_storeu_si256((__m256i *)(mix+i), _mm256_add_epi32(m, g));
+	}
+	if(i < num)
+		janus_audiobridge_mix_add_scalar(mix+i, samples+i, num-i, lgain, rgain);
+}
+__attribute__((target("avx2")))
+static void janus_audiobridge_mix_sub_avx2(opus_int32 *out, const opus_int32 *mix, const opus_int16 *samples, int num, float lgain, float rgain) {
+	int i = 0;
+	__m256 gains = _mm256_setr_ps(lgain, rgain, lgain, rgain, lgain, rgain, lgain, rgain);
+	for(i=0; i+8<=num; i+=8) {
+		__m256i s = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(samples+i)));
+		__m256i g = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(s), gains));
+		__m256i m = _mm256_loadu_si256((const __m256i *)(mix+i));
+		_mm256_storeu_si256((__m256i *)(out+i), _mm256_sub_epi32(m, g));
+	}
+	if(i < num)
+		janus_audiobridge_mix_sub_scalar(out+i, mix+i, samples+i, num-i, lgain, rgain);
+}
+__attribute__((target("avx2")))
+static void janus_audiobridge_mix_saturate_avx2(opus_int16 *out, const opus_int32 *mix, int num) {
+	int i = 0;
+	for(i=0; i+16<=num; i+=16) {
+		__m256i lo = _mm256_loadu_si256((const __m256i *)(mix+i));
+		__m256i hi = _mm256_loadu_si256((const __m256i *)(mix+i+8));
+		/* Packing works per 128-bit lane, so we need to reorder the result */
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+		_mm256_storeu_si256((__m256i *)(out+i), packed);
+	}
+	if(i < num)
+		janus_audiobridge_mix_saturate_scalar(out+i, mix+i, num-i);
+}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define JANUS_AUDIOBRIDGE_MIX_NEON
+/* NEON (4 samples at a time) */
+static void janus_audiobridge_mix_add_neon(opus_int32 *mix, const opus_int16 *samples, int num, float lgain, float rgain) {
+	int i = 0;
+	const float g[4] = { lgain, rgain, lgain, rgain };
+	float32x4_t gains = vld1q_f32(g);
+	for(i=0; i+4<=num; i+=4) {
+		int32x4_t s = vmovl_s16(vld1_s16(samples+i));
+		int32x4_t v = vcvtq_s32_f32(vmulq_f32(vcvtq_f32_s32(s), gains));
+		vst1q_s32(mix+i, vaddq_s32(vld1q_s32(mix+i), v));
+	}
+	if(i < num)
+		janus_audiobridge_mix_add_scalar(mix+i, samples+i, num-i, lgain, rgain);
+}
+static void janus_audiobridge_mix_sub_neon(opus_int32 *out, const opus_int32 *mix, const opus_int16 *samples, int num, float lgain, float rgain) {
+	int i = 0;
+	const float g[4] = { lgain, rgain, lgain, rgain };
+	float32x4_t gains = vld1q_f32(g);
+	for(i=0; i+4<=num; i+=4) {
+		int32x4_t s = vmovl_s16(vld1_s16(samples+i));
+		int32x4_t v = vcvtq_s32_f32(vmulq_f32(vcvtq_f32_s32(s), gains));
+		vst1q_s32(out+i, vsubq_s32(vld1q_s32(mix+i), v));
+	}
+	if(i < num)
+		janus_audiobridge_mix_sub_scalar(out+i, mix+i, samples+i, num-i, lgain, rgain);
+}
+static void janus_audiobridge_mix_saturate_neon(opus_int16 *out, const opus_int32 *mix, int num) {
+	int i = 0;
+	for(i=0; i+4<=num; i+=4)
+		vst1_s16(out+i, vqmovn_s32(vld1q_s32(mix+i)));
+	if(i < num)
+		janus_audiobridge_mix_saturate_scalar(out+i, mix+i, num-i);
+}
+#endif
+
+static janus_audiobridge_mix_kernels mix_kernels = {
+	"scalar",
+	janus_audiobridge_mix_add_scalar,
+	janus_audiobridge_mix_sub_scalar,
+	janus_audiobridge_mix_saturate_scalar
+};
+static void janus_audiobridge_mix_kernels_init(void) {
+#if defined(JANUS_AUDIOBRIDGE_MIX_X86)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) {
+		mix_kernels.name = "avx2";
+		mix_kernels.add = janus_audiobridge_mix_add_avx2;
+		mix_kernels.sub = janus_audiobridge_mix_sub_avx2;
+		mix_kernels.saturate = janus_audiobridge_mix_saturate_avx2;
+	} else if(__builtin_cpu_supports("sse4.1")) {
+		mix_kernels.name = "sse4.1";
+		mix_kernels.add = janus_audiobridge_mix_add_sse41;
+		mix_kernels.sub = janus_audiobridge_mix_sub_sse41;
+		mix_kernels.saturate = janus_audiobridge_mix_saturate_sse41;
+	}
+#elif defined(JANUS_AUDIOBRIDGE_MIX_NEON)
+	mix_kernels.name = "neon";
+	mix_kernels.add = janus_audiobridge_mix_add_neon;
+	mix_kernels.sub = janus_audiobridge_mix_sub_neon;
+	mix_kernels.saturate = janus_audiobridge_mix_saturate_neon;
+#endif
+	JANUS_LOG(LOG_INFO, "AudioBridge mixer using %s kernels\n", mix_kernels.name);
+}
+
+/* Helper to compute the per-channel gains to apply to the audio of a participant */
+static void janus_audiobridge_participant_gains(janus_audiobridge_participant *p, float *lgain, float *rgain) {
+	float volume = (float)p->volume_gain/100.0f;
+	if(!p->stereo) {
+		*lgain = volume;
+		*rgain = volume;
+		return;
+	}
+	/* Spatial position goes from 0 (left) to 100 (right) */
+	*lgain = volume*(float)(100 - p->spatial_position)/100.0f;
+	*rgain = volume*(float)p->spatial_position/100.0f;
+}
+
 
 /* Opus settings */
 #define	OPUS_SAMPLES	960
@@ -2476,6 +3063,9 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 		return -1;
 	}
 
+	/* Pick the best mixing kernels for this CPU */
+	janus_audiobridge_mix_kernels_init();
+
 	/* Read configuration */
 	char filename[255];
 	g_snprintf(filename, 255, "%s/%s.jcfg", config_path, JANUS_AUDIOBRIDGE_PACKAGE);
@@ -2498,6 +3088,16 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 
 #ifdef HAVE_RNNOISE
 	JANUS_LOG(LOG_INFO, "Denoising via RNNoise supported (%d)\n", rnnoise_get_frame_size());
+#if defined(JANUS_AUDIOBRIDGE_MIX_X86)
+	/* RNNoise can use AVX2 since 0.2, if built with run-time CPU detection */
+	if(__builtin_cpu_supports("avx2")) {
+#ifdef HAVE_RNNOISE_SIMD
+		JANUS_LOG(LOG_INFO, "RNNoise will use AVX2, if it was built with x86 RTCD (--enable-x86-rtcd)\n");
+#else
+		JANUS_LOG(LOG_WARN, "This CPU supports AVX2, but RNNoise is older than 0.2: a newer version would denoise much faster\n");
+#endif
+	}
+#endif
 #else
 	JANUS_LOG(LOG_WARN, "Denoising via RNNoise NOT supported\n");
 #endif
@@ -2509,6 +3109,19 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 		janus_config_item *key = janus_config_get(config, config_general, janus_config_type_item, "admin_key");
 		if(key != NULL && key->value != NULL)
 			admin_key = g_strdup(key->value);
+		/* Should we journal changes to permanent rooms, rather than saving the whole file? */
+		janus_config_item *journal = janus_config_get(config, config_general, janus_config_type_item, "config_journal");
+		if(journal != NULL && journal->value != NULL && janus_is_true(journal->value)) {
+			int compact_after = 0;
+			janus_config_item *compact = janus_config_get(config, config_general, janus_config_type_item, "config_journal_compact");
+			if(compact != NULL && compact->value != NULL)
+				compact_after = atoi(compact->value);
+			if(compact_after < 0)
+				compact_after = 0;
+			config_journal = janus_config_journal_open(config, &config_mutex, config_folder, JANUS_AUDIOBRIDGE_PACKAGE, compact_after);
+			if(config_journal == NULL)
+				JANUS_LOG(LOG_WARN, "Couldn't open the configuration journal, permanent rooms will be saved to the whole file\n");
+		}
 		janus_config_item *lrf = janus_config_get(config, config_general, janus_config_type_item, "lock_rtp_forward");
 		if(admin_key && lrf != NULL && lrf->value != NULL)
 			lock_rtpfwd = janus_is_true(lrf->value);
@@ -2518,6 +3131,24 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 		janus_config_item *ext = janus_config_get(config, config_general, janus_config_type_item, "record_tmp_ext");
 		if(ext != NULL && ext->value != NULL)
 			rec_tempext = g_strdup(ext->value);
+		janus_config_item *rq = janus_config_get(config, config_general, janus_config_type_item, "record_queue_ms");
+		if(rq != NULL && rq->value != NULL) {
+			int queue = atoi(rq->value);
+			if(queue < 20) {
+				JANUS_LOG(LOG_WARN, "Invalid record_queue_ms value: %s (using %u)\n", rq->value, rec_queue_frames*20);
+			} else {
+				rec_queue_frames = queue/20;
+			}
+		}
+		janus_config_item *rdio = janus_config_get(config, config_general, janus_config_type_item, "record_direct_io");
+		if(rdio != NULL && rdio->value != NULL)
+			rec_direct_io = janus_is_true(rdio->value);
+#ifndef O_DIRECT
+		if(rec_direct_io) {
+			JANUS_LOG(LOG_WARN, "O_DIRECT not supported on this platform, ignoring record_direct_io\n");
+			rec_direct_io = FALSE;
+		}
+#endif
 		janus_config_item *events = janus_config_get(config, config_general, janus_config_type_item, "events");
 		if(events != NULL && events->value != NULL)
 			notify_events = janus_is_true(events->value);
@@ -2530,6 +3161,66 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 		if(string_ids) {
 			JANUS_LOG(LOG_INFO, "AudioBridge will use alphanumeric IDs, not numeric\n");
 		}
+		janus_config_item *se = janus_config_get(config, config_general, janus_config_type_item, "shared_encoding");
+		if(se != NULL && se->value != NULL)
+			shared_encoding = janus_is_true(se->value);
+		if(shared_encoding) {
+			JANUS_LOG(LOG_INFO, "AudioBridge will encode the mix once for all participants not contributing to it\n");
+		}
+		janus_config_item *et = janus_config_get(config, config_general, janus_config_type_item, "encoding_threads");
+		if(et != NULL && et->value != NULL) {
+			encoding_threads = atoi(et->value);
+			if(encoding_threads < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid encoding_threads value: %s (disabling)\n", et->value);
+				encoding_threads = 0;
+			}
+		}
+		if(encoding_threads > 0) {
+			JANUS_LOG(LOG_INFO, "AudioBridge mixers will use %d encoding threads per room\n", encoding_threads);
+		}
+		janus_config_item *pw = janus_config_get(config, config_general, janus_config_type_item, "participant_workers");
+		if(pw != NULL && pw->value != NULL) {
+			participant_workers = !strcasecmp(pw->value, "auto") ? (int)g_get_num_processors() : atoi(pw->value);
+			if(participant_workers < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid participant_workers value: %s (disabling)\n", pw->value);
+				participant_workers = 0;
+			}
+		}
+		if(participant_workers > 0) {
+			JANUS_LOG(LOG_INFO, "AudioBridge participants will be served by %d workers\n", participant_workers);
+		}
+		janus_config_item *dt = janus_config_get(config, config_general, janus_config_type_item, "denoise_threads");
+		if(dt != NULL && dt->value != NULL) {
+			denoise_threads = !strcasecmp(dt->value, "auto") ? (int)g_get_num_processors() : atoi(dt->value);
+			if(denoise_threads < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid denoise_threads value: %s (disabling)\n", dt->value);
+				denoise_threads = 0;
+			}
+		}
+#ifdef HAVE_RNNOISE
+		if(denoise_threads > 0) {
+			JANUS_LOG(LOG_INFO, "AudioBridge participants will be denoised by %d threads\n", denoise_threads);
+		}
+#else
+		denoise_threads = 0;
+#endif
+		janus_config_item *si = janus_config_get(config, config_general, janus_config_type_item, "stats_interval");
+		if(si != NULL && si->value != NULL) {
+			stats_interval = atoi(si->value);
+			if(stats_interval < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid stats_interval value: %s (disabling)\n", si->value);
+				stats_interval = 0;
+			}
+		}
+		janus_config_item *rsq = janus_config_get(config, config_general, janus_config_type_item, "resampler_quality");
+		if(rsq != NULL && rsq->value != NULL) {
+			int quality = atoi(rsq->value);
+			if(quality < SPEEX_RESAMPLER_QUALITY_MIN || quality > SPEEX_RESAMPLER_QUALITY_MAX) {
+				JANUS_LOG(LOG_WARN, "Invalid resampler_quality value: %s (using %d)\n", rsq->value, resampler_quality);
+			} else {
+				resampler_quality = quality;
+			}
+		}
 		janus_config_item *lip = janus_config_get(config, config_general, janus_config_type_item, "local_ip");
 		if(lip && lip->value) {
 			/* Verify that the address is valid */
@@ -2610,10 +3301,13 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 			janus_config_item *priv = janus_config_get(config, cat, janus_config_type_item, "is_private");
 			janus_config_item *sampling = janus_config_get(config, cat, janus_config_type_item, "sampling_rate");
 			janus_config_item *spatial = janus_config_get(config, cat, janus_config_type_item, "spatial_audio");
+			janus_config_item *speakers = janus_config_get(config, cat, janus_config_type_item, "top_speakers");
+			janus_config_item *passthrough = janus_config_get(config, cat, janus_config_type_item, "opus_passthrough");
 			janus_config_item *audiolevel_ext = janus_config_get(config, cat, janus_config_type_item, "audiolevel_ext");
 			janus_config_item *audiolevel_event = janus_config_get(config, cat, janus_config_type_item, "audiolevel_event");
 			janus_config_item *audio_active_packets = janus_config_get(config, cat, janus_config_type_item, "audio_active_packets");
 			janus_config_item *audio_level_average = janus_config_get(config, cat, janus_config_type_item, "audio_level_average");
+			janus_config_item *silence_threshold = janus_config_get(config, cat, janus_config_type_item, "silence_threshold");
 			janus_config_item *default_expectedloss = janus_config_get(config, cat, janus_config_type_item, "default_expectedloss");
 			janus_config_item *default_bitrate = janus_config_get(config, cat, janus_config_type_item, "default_bitrate");
 			janus_config_item *denoise = janus_config_get(config, cat, janus_config_type_item, "denoise");
@@ -2622,6 +3316,7 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 			janus_config_array *groups = janus_config_get(config, cat, janus_config_type_array, "groups");
 			janus_config_item *record = janus_config_get(config, cat, janus_config_type_item, "record");
 			janus_config_item *recfile = janus_config_get(config, cat, janus_config_type_item, "record_file");
+			janus_config_item *recformat = janus_config_get(config, cat, janus_config_type_item, "record_format");
 			janus_config_item *recdir = janus_config_get(config, cat, janus_config_type_item, "record_dir");
 			janus_config_item *mjrs = janus_config_get(config, cat, janus_config_type_item, "mjrs");
 			janus_config_item *mjrsdir = janus_config_get(config, cat, janus_config_type_item, "mjrs_dir");
@@ -2633,6 +3328,7 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 			}
 			/* Create the AudioBridge room */
 			janus_audiobridge_room *audiobridge = g_malloc0(sizeof(janus_audiobridge_room));
+			janus_usage_init(&audiobridge->usage);
 			janus_refcount_init(&audiobridge->ref, janus_audiobridge_room_free);
 			const char *room_num = cat->name;
 			if(strstr(room_num, "room-") == room_num)
@@ -2690,6 +3386,17 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 					continue;
 			}
 			audiobridge->spatial_audio = spatial && spatial->value && janus_is_true(spatial->value);
+			audiobridge->top_speakers = 0;
+			if(speakers != NULL && speakers->value != NULL) {
+				int top_speakers = atoi(speakers->value);
+				if(top_speakers < 0 || top_speakers > JANUS_AUDIOBRIDGE_MAX_SPEAKERS) {
+					JANUS_LOG(LOG_WARN, "Invalid top_speakers value %d (max %d), mixing all participants\n",
+						top_speakers, JANUS_AUDIOBRIDGE_MAX_SPEAKERS);
+				} else {
+					audiobridge->top_speakers = top_speakers;
+				}
+			}
+			audiobridge->opus_passthrough = passthrough && passthrough->value && janus_is_true(passthrough->value);
 			audiobridge->audiolevel_ext = TRUE;
 			if(audiolevel_ext != NULL && audiolevel_ext->value != NULL)
 				audiobridge->audiolevel_ext = janus_is_true(audiolevel_ext->value);
@@ -2714,6 +3421,15 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 					}
 				}
 			}
+			audiobridge->silence_threshold = 127;
+			if(silence_threshold != NULL && silence_threshold->value != NULL) {
+				int threshold = atoi(silence_threshold->value);
+				if(threshold >= 0 && threshold <= 127) {
+					audiobridge->silence_threshold = threshold;
+				} else {
+					JANUS_LOG(LOG_WARN, "Invalid silence_threshold value provided, using default: %d\n", audiobridge->silence_threshold);
+				}
+			}
 			audiobridge->default_expectedloss = 0;
 			if(default_expectedloss != NULL && default_expectedloss->value != NULL) {
 				int expectedloss = atoi(default_expectedloss->value);
@@ -2750,6 +3466,18 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 				g_atomic_int_set(&audiobridge->record, 1);
 			if(recfile && recfile->value)
 				audiobridge->record_file = g_strdup(recfile->value);
+			audiobridge->record_opus = FALSE;
+			if(recformat && recformat->value) {
+				if(!strcasecmp(recformat->value, "opus")) {
+#ifdef HAVE_LIBOGG
+					audiobridge->record_opus = TRUE;
+#else
+					JANUS_LOG(LOG_WARN, "Ogg/Opus recordings need libogg, recording to WAV instead\n");
+#endif
+				} else if(strcasecmp(recformat->value, "wav")) {
+					JANUS_LOG(LOG_WARN, "Unsupported record_format %s, recording to WAV instead\n", recformat->value);
+				}
+			}
 			if(recdir && recdir->value) {
 				audiobridge->record_dir = g_strdup(recdir->value);
 				if(janus_mkdir(audiobridge->record_dir, 0755) < 0) {
@@ -2887,9 +3615,71 @@ int janus_audiobridge_init(janus_callbacks *callback, const char *config_path) {
 		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the AudioBridge handler thread...\n",
 			error->code, error->message ? error->message : "??");
 		g_error_free(error);
+		janus_config_journal_close(config_journal);
+		config_journal = NULL;
+		janus_config_destroy(config);
+		return -1;
+	}
+	/* Launch the participant workers, if we're not using a thread per participant */
+	if(participant_workers > 0) {
+		workers = g_malloc0(participant_workers * sizeof(janus_audiobridge_worker));
+		int i = 0;
+		for(i=0; i<participant_workers; i++) {
+			janus_audiobridge_worker *w = &workers[i];
+			w->id = i;
+			janus_mutex_init(&w->mutex);
+			g_cond_init(&w->cond);
+			w->wheel = g_queue_new();
+			w->encodes = g_queue_new();
+			char tname[16];
+			g_snprintf(tname, sizeof(tname), "ab worker %d", i);
+			w->thread = g_thread_try_new(tname, janus_audiobridge_worker_thread, w, &error);
+			if(error != NULL) {
+				/* We'll keep on using the workers we could launch, if any */
+				JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the AudioBridge participant worker #%d...\n",
+					error->code, error->message ? error->message : "??", i);
+				g_error_free(error);
+				error = NULL;
+				w->thread = NULL;
+			}
+		}
+	}
+	/* Launch the plain RTP sender */
+	plainrtp_batches = g_async_queue_new();
+	plainrtp_sender = g_thread_try_new("ab rtp sender", janus_audiobridge_plainrtp_sender_thread, NULL, &error);
+	if(error != NULL) {
+		g_atomic_int_set(&initialized, 0);
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the AudioBridge plain RTP sender thread...\n",
+			error->code, error->message ? error->message : "??");
+		g_error_free(error);
+		janus_config_journal_close(config_journal);
+		config_journal = NULL;
 		janus_config_destroy(config);
 		return -1;
 	}
+#ifdef HAVE_RNNOISE
+	/* Launch the denoisers, if we're not denoising inline */
+	if(denoise_threads > 0) {
+		denoisers = g_malloc0(denoise_threads * sizeof(janus_audiobridge_denoiser));
+		int i = 0;
+		for(i=0; i<denoise_threads; i++) {
+			janus_audiobridge_denoiser *d = &denoisers[i];
+			d->id = i;
+			d->frames = g_async_queue_new();
+			char tname[16];
+			g_snprintf(tname, sizeof(tname), "ab denoise %d", i);
+			d->thread = g_thread_try_new(tname, janus_audiobridge_denoiser_thread, d, &error);
+			if(error != NULL) {
+				/* We'll keep on using the denoisers we could launch, if any */
+				JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the AudioBridge denoiser #%d...\n",
+					error->code, error->message ? error->message : "??", i);
+				g_error_free(error);
+				error = NULL;
+				d->thread = NULL;
+			}
+		}
+	}
+#endif
 	JANUS_LOG(LOG_INFO, "%s initialized!\n", JANUS_AUDIOBRIDGE_NAME);
 	return 0;
 }
@@ -2904,6 +3694,49 @@ void janus_audiobridge_destroy(void) {
 		g_thread_join(handler_thread);
 		handler_thread = NULL;
 	}
+	/* Stop the plain RTP sender */
+	if(plainrtp_sender != NULL) {
+		g_async_queue_push(plainrtp_batches, &plainrtp_exit_batch);
+		g_thread_join(plainrtp_sender);
+		plainrtp_sender = NULL;
+	}
+	/* Stop the participant workers: they release their participants when leaving */
+	if(workers != NULL) {
+		int i = 0;
+		for(i=0; i<participant_workers; i++) {
+			janus_audiobridge_worker *w = &workers[i];
+			if(w->thread != NULL) {
+				janus_mutex_lock(&w->mutex);
+				g_cond_signal(&w->cond);
+				janus_mutex_unlock(&w->mutex);
+				g_thread_join(w->thread);
+				w->thread = NULL;
+			}
+			g_queue_free(w->wheel);
+			g_queue_free(w->encodes);
+			g_cond_clear(&w->cond);
+			janus_mutex_destroy(&w->mutex);
+		}
+		g_free(workers);
+		workers = NULL;
+	}
+#ifdef HAVE_RNNOISE
+	/* Stop the denoisers too */
+	if(denoisers != NULL) {
+		int i = 0;
+		for(i=0; i<denoise_threads; i++) {
+			janus_audiobridge_denoiser *d = &denoisers[i];
+			if(d->thread != NULL) {
+				g_async_queue_push(d->frames, &denoise_exit_frame);
+				g_thread_join(d->thread);
+				d->thread = NULL;
+			}
+			g_async_queue_unref(d->frames);
+		}
+		g_free(denoisers);
+		denoisers = NULL;
+	}
+#endif
 	/* FIXME We should destroy the sessions cleanly */
 	janus_mutex_lock(&sessions_mutex);
 	g_hash_table_destroy(sessions);
@@ -2916,6 +3749,8 @@ void janus_audiobridge_destroy(void) {
 	g_async_queue_unref(messages);
 	messages = NULL;
 
+	janus_config_journal_close(config_journal);
+	config_journal = NULL;
 	janus_config_destroy(config);
 	g_free(admin_key);
 	g_free(rec_tempext);
@@ -3058,14 +3893,52 @@ json_t *janus_audiobridge_query_session(janus_plugin_session *handle) {
 		if(participant->jitter)
 			jitter_buffer_ctl(participant->jitter, JITTER_BUFFER_GET_AVALIABLE_COUNT, &count);
 		json_object_set_new(info, "buffer-in", json_integer(count));
-		json_object_set_new(info, "queue-in", json_integer(g_list_length(participant->inbuf)));
+		json_object_set_new(info, "queue-in", json_integer(janus_audiobridge_inbuf_count(participant->inbuf)));
+		if(participant->inbuf != NULL)
+			json_object_set_new(info, "queue-in-dropped", json_integer(g_atomic_int_get(&participant->inbuf->dropped)));
 		janus_mutex_unlock(&participant->qmutex);
 		if(participant->outbuf)
 			json_object_set_new(info, "queue-out", json_integer(g_async_queue_length(participant->outbuf)));
+		if(encoding_threads > 0)
+			json_object_set_new(info, "encode-late", json_integer(g_atomic_int_get(&participant->encode_late)));
+		if(room != NULL)
+			json_object_set_new(info, "mixer-late-frames", json_integer(g_atomic_int_get(&room->late_frames)));
+		if(room != NULL && g_atomic_int_get(&room->record))
+			json_object_set_new(info, "recording-dropped-frames", json_integer(g_atomic_int_get(&room->record_dropped)));
+		if(room != NULL && room->opus_passthrough)
+			json_object_set_new(info, "mixer-passthrough-frames", json_integer(g_atomic_int_get(&room->passthrough_frames)));
+		json_object_set_new(info, "skipped-silent-frames", json_integer(g_atomic_int_get(&participant->skipped_frames)));
+		json_object_set_new(info, "stats", janus_audiobridge_participant_stats(participant));
+		if(room != NULL)
+			json_object_set_new(info, "room-stats", janus_audiobridge_room_stats(room));
+		if(room != NULL && room->top_speakers > 0)
+			json_object_set_new(info, "mixing", participant->mixing ? json_true() : json_false());
+		janus_audiobridge_worker *w = participant->worker;
+		if(w != NULL) {
+			json_t *worker = json_object();
+			json_object_set_new(worker, "id", json_integer(w->id));
+			json_object_set_new(worker, "participants", json_integer(g_atomic_int_get(&w->count)));
+			json_object_set_new(worker, "load", json_integer(g_atomic_int_get(&w->load)));
+			json_object_set_new(worker, "missed-deadlines", json_integer(g_atomic_int_get(&w->missed)));
+			json_object_set_new(info, "worker", worker);
+		}
 		if(participant->stereo)
 			json_object_set_new(info, "spatial_position", json_integer(participant->spatial_position));
 #ifdef HAVE_RNNOISE
 		json_object_set_new(info, "denoise",  participant->denoise ? json_true() : json_false());
+		if(participant->denoise) {
+			json_object_set_new(info, "denoise-muted", participant->denoise_gated ? json_true() : json_false());
+			json_object_set_new(info, "denoise-muted-frames", json_integer(g_atomic_int_get(&participant->denoise_gated_frames)));
+		}
+		janus_audiobridge_denoiser *d = participant->denoiser;
+		if(d != NULL) {
+			json_t *denoiser = json_object();
+			json_object_set_new(denoiser, "id", json_integer(d->id));
+			json_object_set_new(denoiser, "participants", json_integer(g_atomic_int_get(&d->count)));
+			json_object_set_new(denoiser, "batches", json_integer(g_atomic_int_get(&d->batches)));
+			json_object_set_new(denoiser, "frames", json_integer(g_atomic_int_get(&d->processed)));
+			json_object_set_new(info, "denoiser", denoiser);
+		}
 #endif
 		if(participant->arc && participant->arc->filename)
 			json_object_set_new(info, "audio-recording", json_string(participant->arc->filename));
@@ -3198,16 +4071,20 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 		if(sampling == NULL)
 			sampling = json_object_get(root, "sampling");
 		json_t *spatial = json_object_get(root, "spatial_audio");
+		json_t *speakers = json_object_get(root, "top_speakers");
+		json_t *passthrough = json_object_get(root, "opus_passthrough");
 		json_t *audiolevel_ext = json_object_get(root, "audiolevel_ext");
 		json_t *audiolevel_event = json_object_get(root, "audiolevel_event");
 		json_t *audio_active_packets = json_object_get(root, "audio_active_packets");
 		json_t *audio_level_average = json_object_get(root, "audio_level_average");
+		json_t *silence_threshold = json_object_get(root, "silence_threshold");
 		json_t *default_expectedloss = json_object_get(root, "default_expectedloss");
 		json_t *default_bitrate = json_object_get(root, "default_bitrate");
 		json_t *denoise = json_object_get(root, "denoise");
 		json_t *groups = json_object_get(root, "groups");
 		json_t *record = json_object_get(root, "record");
 		json_t *recfile = json_object_get(root, "record_file");
+		json_t *recformat = json_object_get(root, "record_format");
 		json_t *recdir = json_object_get(root, "record_dir");
 		json_t *mjrs = json_object_get(root, "mjrs");
 		json_t *mjrsdir = json_object_get(root, "mjrs_dir");
@@ -3293,6 +4170,7 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 		}
 		/* Create the AudioBridge room */
 		janus_audiobridge_room *audiobridge = g_malloc0(sizeof(janus_audiobridge_room));
+		janus_usage_init(&audiobridge->usage);
 		janus_refcount_init(&audiobridge->ref, janus_audiobridge_room_free);
 		/* Generate a random ID, if needed */
 		gboolean room_id_allocated = FALSE;
@@ -3337,6 +4215,16 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 		else
 			audiobridge->sampling_rate = 16000;
 		audiobridge->spatial_audio = spatial ? json_is_true(spatial) : FALSE;
+		audiobridge->top_speakers = 0;
+		if(speakers != NULL) {
+			if(json_integer_value(speakers) > JANUS_AUDIOBRIDGE_MAX_SPEAKERS) {
+				JANUS_LOG(LOG_WARN, "Invalid top_speakers value %"JSON_INTEGER_FORMAT" (max %d), mixing all participants\n",
+					json_integer_value(speakers), JANUS_AUDIOBRIDGE_MAX_SPEAKERS);
+			} else {
+				audiobridge->top_speakers = json_integer_value(speakers);
+			}
+		}
+		audiobridge->opus_passthrough = passthrough ? json_is_true(passthrough) : FALSE;
 		audiobridge->audiolevel_ext = audiolevel_ext ? json_is_true(audiolevel_ext) : TRUE;
 		audiobridge->audiolevel_event = audiolevel_event ? json_is_true(audiolevel_event) : FALSE;
 		if(audiobridge->audiolevel_event) {
@@ -3355,6 +4243,15 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 					audiobridge->audio_level_average);
 			}
 		}
+		audiobridge->silence_threshold = 127;
+		if(silence_threshold != NULL) {
+			if(json_integer_value(silence_threshold) <= 127) {
+				audiobridge->silence_threshold = json_integer_value(silence_threshold);
+			} else {
+				JANUS_LOG(LOG_WARN, "Invalid silence_threshold value provided, using default: %d\n",
+					audiobridge->silence_threshold);
+			}
+		}
 		audiobridge->default_expectedloss = 0;
 		if(default_expectedloss != NULL) {
 			int expectedloss = json_integer_value(default_expectedloss);
@@ -3404,6 +4301,19 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 			g_atomic_int_set(&audiobridge->record, 1);
 		if(recfile)
 			audiobridge->record_file = g_strdup(json_string_value(recfile));
+		audiobridge->record_opus = FALSE;
+		if(recformat) {
+			const char *format = json_string_value(recformat);
+			if(!strcasecmp(format, "opus")) {
+#ifdef HAVE_LIBOGG
+				audiobridge->record_opus = TRUE;
+#else
+				JANUS_LOG(LOG_WARN, "Ogg/Opus recordings need libogg, recording to WAV instead\n");
+#endif
+			} else if(strcasecmp(format, "wav")) {
+				JANUS_LOG(LOG_WARN, "Unsupported record_format %s, recording to WAV instead\n", format);
+			}
+		}
 		if(recdir) {
 			audiobridge->record_dir = g_strdup(json_string_value(recdir));
 			if(janus_mkdir(audiobridge->record_dir, 0755) < 0) {
@@ -3527,6 +4437,10 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 					g_snprintf(value, BUFSIZ, "%d", audiobridge->audio_level_average);
 					janus_config_add(config, c, janus_config_item_create("audio_level_average", value));
 				}
+				if(audiobridge->silence_threshold < 127) {
+					g_snprintf(value, BUFSIZ, "%d", audiobridge->silence_threshold);
+					janus_config_add(config, c, janus_config_item_create("silence_threshold", value));
+				}
 			}
 			if(audiobridge->allow_plainrtp)
 				janus_config_add(config, c, janus_config_item_create("allow_rtp_participants", "true"));
@@ -3545,6 +4459,8 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 				janus_config_add(config, c, janus_config_item_create("record", "true"));
 				janus_config_add(config, c, janus_config_item_create("record_file", audiobridge->record_file));
 			}
+			if(audiobridge->record_opus)
+				janus_config_add(config, c, janus_config_item_create("record_format", "opus"));
 			if(audiobridge->record_dir)
 				janus_config_add(config, c, janus_config_item_create("record_dir", audiobridge->record_dir));
 			if(audiobridge->mjrs)
@@ -3553,8 +4469,15 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 				janus_config_add(config, c, janus_config_item_create("mjrs_dir", audiobridge->mjrs_dir));
 			if(audiobridge->spatial_audio)
 				janus_config_add(config, c, janus_config_item_create("spatial_audio", "true"));
+			if(audiobridge->top_speakers > 0) {
+				g_snprintf(value, BUFSIZ, "%u", audiobridge->top_speakers);
+				janus_config_add(config, c, janus_config_item_create("top_speakers", value));
+			}
+			if(audiobridge->opus_passthrough)
+				janus_config_add(config, c, janus_config_item_create("opus_passthrough", "true"));
 			/* Save modified configuration */
-			if(janus_config_save(config, config_folder, JANUS_AUDIOBRIDGE_PACKAGE) < 0)
+			if((config_journal == NULL || janus_config_journal_put(config_journal, c) < 0) &&
+					janus_config_save(config, config_folder, JANUS_AUDIOBRIDGE_PACKAGE) < 0)
 				save = FALSE;	/* This will notify the user the room is not permanent */
 			janus_mutex_unlock(&config_mutex);
 		}
@@ -3708,6 +4631,10 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 					g_snprintf(value, BUFSIZ, "%d", audiobridge->audio_level_average);
 					janus_config_add(config, c, janus_config_item_create("audio_level_average", value));
 				}
+				if(audiobridge->silence_threshold < 127) {
+					g_snprintf(value, BUFSIZ, "%d", audiobridge->silence_threshold);
+					janus_config_add(config, c, janus_config_item_create("silence_threshold", value));
+				}
 			}
 			if(audiobridge->allow_plainrtp)
 				janus_config_add(config, c, janus_config_item_create("allow_rtp_participants", "true"));
@@ -3726,6 +4653,8 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 				janus_config_add(config, c, janus_config_item_create("record", "true"));
 				janus_config_add(config, c, janus_config_item_create("record_file", audiobridge->record_file));
 			}
+			if(audiobridge->record_opus)
+				janus_config_add(config, c, janus_config_item_create("record_format", "opus"));
 			if(audiobridge->record_dir)
 				janus_config_add(config, c, janus_config_item_create("record_dir", audiobridge->record_dir));
 			if(audiobridge->mjrs)
@@ -3734,8 +4663,15 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 				janus_config_add(config, c, janus_config_item_create("mjrs_dir", audiobridge->mjrs_dir));
 			if(audiobridge->spatial_audio)
 				janus_config_add(config, c, janus_config_item_create("spatial_audio", "true"));
+			if(audiobridge->top_speakers > 0) {
+				g_snprintf(value, BUFSIZ, "%u", audiobridge->top_speakers);
+				janus_config_add(config, c, janus_config_item_create("top_speakers", value));
+			}
+			if(audiobridge->opus_passthrough)
+				janus_config_add(config, c, janus_config_item_create("opus_passthrough", "true"));
 			/* Save modified configuration */
-			if(janus_config_save(config, config_folder, JANUS_AUDIOBRIDGE_PACKAGE) < 0)
+			if((config_journal == NULL || janus_config_journal_put(config_journal, c) < 0) &&
+					janus_config_save(config, config_folder, JANUS_AUDIOBRIDGE_PACKAGE) < 0)
 				save = FALSE;	/* This will notify the user the room changes are not permanent */
 			janus_mutex_unlock(&config_mutex);
 		}
@@ -3825,7 +4761,8 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 			g_snprintf(cat, BUFSIZ, "room-%s", room_id_str);
 			janus_config_remove(config, NULL, cat);
 			/* Save modified configuration */
-			if(janus_config_save(config, config_folder, JANUS_AUDIOBRIDGE_PACKAGE) < 0)
+			if((config_journal == NULL || janus_config_journal_remove(config_journal, cat) < 0) &&
+					janus_config_save(config, config_folder, JANUS_AUDIOBRIDGE_PACKAGE) < 0)
 				save = FALSE;	/* This will notify the user the room destruction is not permanent */
 			janus_mutex_unlock(&config_mutex);
 		}
@@ -4032,6 +4969,10 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 			json_object_set_new(rl, "description", json_string(room->room_name));
 			json_object_set_new(rl, "sampling_rate", json_integer(room->sampling_rate));
 			json_object_set_new(rl, "spatial_audio", room->spatial_audio ? json_true() : json_false());
+			if(room->top_speakers > 0)
+				json_object_set_new(rl, "top_speakers", json_integer(room->top_speakers));
+			if(room->opus_passthrough)
+				json_object_set_new(rl, "opus_passthrough", json_true());
 			json_object_set_new(rl, "pin_required", room->room_pin ? json_true() : json_false());
 			json_object_set_new(rl, "record", g_atomic_int_get(&room->record) ? json_true() : json_false());
 			json_object_set_new(rl, "muted", room->muted ? json_true() : json_false());
@@ -4784,9 +5725,15 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 				error_code, error_cause, TRUE,
 				JANUS_AUDIOBRIDGE_ERROR_MISSING_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT);
 		}
+		if(error_code != 0)
+			goto prepare_response;
+		JANUS_VALIDATE_JSON_OBJECT(root, listparticipants_parameters,
+			error_code, error_cause, TRUE,
+			JANUS_AUDIOBRIDGE_ERROR_MISSING_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT);
 		if(error_code != 0)
 			goto prepare_response;
 		json_t *room = json_object_get(root, "room");
+		gboolean stats = json_is_true(json_object_get(root, "stats"));
 		guint64 room_id = 0;
 		char room_id_num[30], *room_id_str = NULL;
 		if(!string_ids) {
@@ -4826,14 +5773,19 @@ static json_t *janus_audiobridge_process_synchronous_request(janus_audiobridge_s
 				json_object_set_new(pl, "spatial_position", json_integer(p->spatial_position));
 			if(g_atomic_int_get(&p->suspended))
 				json_object_set_new(pl, "suspended", json_true());
+			if(stats)
+				json_object_set_new(pl, "stats", janus_audiobridge_participant_stats(p));
 			json_array_append_new(list, pl);
 		}
+		json_t *room_stats = stats ? janus_audiobridge_room_stats(audiobridge) : NULL;
 		janus_refcount_decrease(&audiobridge->ref);
 		janus_mutex_unlock(&rooms_mutex);
 		response = json_object();
 		json_object_set_new(response, "audiobridge", json_string("participants"));
 		json_object_set_new(response, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
 		json_object_set_new(response, "participants", list);
+		if(room_stats != NULL)
+			json_object_set_new(response, "stats", room_stats);
 		goto prepare_response;
 	} else if(!strcasecmp(request_text, "resetdecoder")) {
 		/* Mark the Opus decoder for the participant invalid and recreate it */
@@ -6055,7 +7007,54 @@ json_t *janus_audiobridge_handle_admin_message(json_t *message) {
 		goto admin_response;
 	json_t *request = json_object_get(message, "request");
 	const char *request_text = json_string_value(request);
-	if((response = janus_audiobridge_process_synchronous_request(NULL, message)) != NULL) {
+	if(!strcasecmp(request_text, "usage")) {
+		/* Return the resources each room (or a specific one) consumed so far */
+		if(!string_ids) {
+			JANUS_VALIDATE_JSON_OBJECT(message, roomopt_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_AUDIOBRIDGE_ERROR_MISSING_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT);
+		} else {
+			JANUS_VALIDATE_JSON_OBJECT(message, roomstropt_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_AUDIOBRIDGE_ERROR_MISSING_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT);
+		}
+		if(error_code != 0)
+			goto admin_response;
+		JANUS_VALIDATE_JSON_OBJECT(message, usage_parameters,
+			error_code, error_cause, TRUE,
+			JANUS_AUDIOBRIDGE_ERROR_MISSING_ELEMENT, JANUS_AUDIOBRIDGE_ERROR_INVALID_ELEMENT);
+		if(error_code != 0)
+			goto admin_response;
+		json_t *room = json_object_get(message, "room");
+		gboolean reset = json_is_true(json_object_get(message, "reset"));
+		json_t *list = json_array();
+		janus_mutex_lock(&rooms_mutex);
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, rooms);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) {
+			janus_audiobridge_room *audiobridge = value;
+			if(room != NULL && (string_ids ? strcmp(audiobridge->room_id_str, json_string_value(room)) :
+					audiobridge->room_id != json_integer_value(room)))
+				continue;
+			json_t *rl = json_object();
+			json_object_set_new(rl, "room", string_ids ? json_string(audiobridge->room_id_str) : json_integer(audiobridge->room_id));
+			json_object_set_new(rl, "description", json_string(audiobridge->room_name));
+			janus_mutex_lock(&audiobridge->mutex);
+			json_object_set_new(rl, "num_participants", json_integer(g_hash_table_size(audiobridge->participants)));
+			json_object_set_new(rl, "num_forwarders", json_integer(g_hash_table_size(audiobridge->rtp_forwarders)));
+			janus_mutex_unlock(&audiobridge->mutex);
+			json_object_set_new(rl, "usage", janus_usage_json(&audiobridge->usage));
+			if(reset)
+				janus_usage_init(&audiobridge->usage);
+			json_array_append_new(list, rl);
+		}
+		janus_mutex_unlock(&rooms_mutex);
+		response = json_object();
+		json_object_set_new(response, "audiobridge", json_string("usage"));
+		json_object_set_new(response, "rooms", list);
+		goto admin_response;
+	} else if((response = janus_audiobridge_process_synchronous_request(NULL, message)) != NULL) {
 		/* We got a response, send it back */
 		goto admin_response;
 	} else {
@@ -6162,6 +7161,8 @@ void janus_audiobridge_incoming_rtp(janus_plugin_session *handle, janus_plugin_r
 		return;
 	char *buf = packet->buffer;
 	uint16_t len = packet->length;
+	/* Plain RTP participants feed us packets the core didn't decrypt */
+	janus_usage_packets_in(&participant->room->usage, 1, len, participant->plainrtp_media.audio_rtp_fd <= 0);
 	/* Save the frame if we're recording this leg */
 	janus_recorder_save_frame(participant->arc, buf, len);
 	if(g_atomic_int_get(&participant->active) && (participant->codec != JANUS_AUDIOCODEC_OPUS ||
@@ -6192,13 +7193,22 @@ void janus_audiobridge_incoming_rtp(janus_plugin_session *handle, janus_plugin_r
 		}
 		/* Queue the audio packet in the jitter buffer (we won't decode now, there might be buffering involved) */
 		if(participant->jitter) {
-			janus_audiobridge_buffer_packet *pkt = janus_audiobridge_buffer_packet_create(packet);
+			if(len > JANUS_AUDIOBRIDGE_MAX_RTP_SIZE) {
+				JANUS_LOG(LOG_WARN, "Audio packet too large (%"SCNu16" > %d), skipping\n", len, JANUS_AUDIOBRIDGE_MAX_RTP_SIZE);
+				return;
+			}
+			janus_audiobridge_buffer_packet pkt;
+			spx_uint32_t pkt_len = janus_audiobridge_buffer_packet_fill(&pkt, packet);
 			janus_mutex_lock(&participant->qmutex);
 			JitterBufferPacket jbp = {0};
-			jbp.data = (char *)pkt;
-			jbp.len = 0;
+			jbp.data = (char *)&pkt;
+			jbp.len = pkt_len;
 			jbp.span = (participant->codec == JANUS_AUDIOCODEC_OPUS ? 960 : 160);
 			jbp.timestamp = (uint32_t)ntohs(rtp->seq_number) * jbp.span;
+			/* Keep track of packets whose turn has already passed: the jitter buffer will drop them */
+			if(!participant->decode_first &&
+					(gint32)(jbp.timestamp + jbp.span - (uint32_t)jitter_buffer_get_pointer_timestamp(participant->jitter)) <= 0)
+				g_atomic_int_inc(&participant->late_packets);
 			jitter_buffer_put(participant->jitter, &jbp);
 			janus_mutex_unlock(&participant->qmutex);
 		}
@@ -6711,14 +7721,17 @@ static void *janus_audiobridge_handler(void *data) {
 				participant->codec = codec;
 				participant->display = NULL;
 				participant->jitter = jitter_buffer_init(participant->codec == JANUS_AUDIOCODEC_OPUS ? 960 : 160);
-				jitter_buffer_ctl(participant->jitter, JITTER_BUFFER_SET_DESTROY_CALLBACK, &janus_audiobridge_buffer_packet_destroy);
 				spx_int32_t min_buffer_size = participant->codec == JANUS_AUDIOCODEC_OPUS ? (JITTER_BUFFER_MIN_PACKETS * 960) : (JITTER_BUFFER_MIN_PACKETS * 160);
 				jitter_buffer_ctl(participant->jitter, JITTER_BUFFER_SET_MARGIN, &min_buffer_size);
 				spx_int32_t max_buffer_size = JITTER_BUFFER_MAX_PACKETS;
 				jitter_buffer_ctl(participant->jitter, JITTER_BUFFER_SET_LIMIT, &max_buffer_size);
+				/* Packets are copied to preallocated slots, so there's no allocation per packet */
+				spx_int32_t slot_size = sizeof(janus_audiobridge_buffer_packet);
+				jitter_buffer_ctl(participant->jitter, JITTER_BUFFER_SET_SLOT_SIZE, &slot_size);
+				jitter_buffer_ctl(participant->jitter, JITTER_BUFFER_RESET_STATS, NULL);
 				/* disable automatic adjustment */
 				jitter_buffer_update_delay(participant->jitter, NULL, NULL);
-				participant->inbuf = NULL;
+				participant->inbuf = janus_audiobridge_inbuf_create();
 				participant->outbuf = NULL;
 				participant->encoder = NULL;
 				participant->decoder = NULL;
@@ -6753,6 +7766,8 @@ static void *janus_audiobridge_handler(void *data) {
 			participant->opus_complexity = complexity;
 			participant->opus_bitrate = opus_bitrate;
 			participant->expected_loss = expected_loss;
+			participant->speaker_level = 127;
+			participant->mixing = FALSE;
 			participant->stereo = audiobridge->spatial_audio;
 			if(participant->stereo) {
 				if(spatial_position > 100)
@@ -6935,8 +7950,12 @@ static void *janus_audiobridge_handler(void *data) {
 				}
 			}
 			janus_mutex_unlock(&participant->rec_mutex);
-			/* Finally, start the encoding thread if it hasn't already */
-			if(participant->thread == NULL) {
+			/* Finally, start the encoding thread if it hasn't already (or
+			 * have a participant worker take care of this participant) */
+			if(workers != NULL) {
+				if(participant->worker == NULL)
+					janus_audiobridge_worker_add(session, participant);
+			} else if(participant->thread == NULL) {
 				GError *error = NULL;
 				char roomtrunc[5], parttrunc[5];
 				g_snprintf(roomtrunc, sizeof(roomtrunc), "%s", audiobridge->room_id_str);
@@ -8095,121 +9114,656 @@ error:
 	JANUS_LOG(LOG_VERB, "Leaving AudioBridge handler thread\n");
 	return NULL;
 }
-static void janus_audiobridge_rec_add_wav_header(janus_audiobridge_room *audiobridge) {
-	/* Do we need to record the mix? */
-	char filename[255];
-	gint64 now = janus_get_real_time();
-	audiobridge->rec_start_time = now;
-	if(audiobridge->record_file) {
-		g_snprintf(filename, 255, "%s%s%s%s%s",
-			audiobridge->record_dir ? audiobridge->record_dir : "",
-			audiobridge->record_dir ? "/" : "",
-			audiobridge->record_file,
-			rec_tempext ? "." : "", rec_tempext ? rec_tempext : "");
-	} else {
-		g_snprintf(filename, 255, "%s%sjanus-audioroom-%s-%"SCNi64".wav%s%s",
-			audiobridge->record_dir ? audiobridge->record_dir : "",
-			audiobridge->record_dir ? "/" : "",
-			audiobridge->room_id_str, now,
-			rec_tempext ? "." : "", rec_tempext ? rec_tempext : "");
+/* Recordings of the room mix: the mixer only queues the frames to record,
+ * while a dedicated thread takes care of the actual I/O (and of the encoding,
+ * when recording to Ogg/Opus), so that a slow disk can't delay the mix. The
+ * writer aggregates the data in large aligned chunks, which also means it
+ * can write them with O_DIRECT, if configured to do so. If the writer can't
+ * keep up, new frames are dropped rather than blocking the mixer */
+#define JANUS_AUDIOBRIDGE_RECORDING_CHUNK	65536
+typedef struct janus_audiobridge_mix_frame {
+	opus_int16 *data;
+	int samples;
+} janus_audiobridge_mix_frame;
+static janus_audiobridge_mix_frame rec_exit_frame;
+typedef struct janus_audiobridge_mix_recording {
+	janus_audiobridge_room *room;	/* Room this recording is for (we hold a reference) */
+	char *filename;			/* Path of the recording, when complete */
+	char *tmpfilename;		/* Path we write to, if a temporary extension is configured */
+	gboolean opus;			/* Whether we're recording to Ogg/Opus, rather than WAV */
+	int channels;
+	uint32_t sampling_rate;
+	int fd;					/* File descriptor we write the chunks with (may be O_DIRECT) */
+	int hfd;				/* File descriptor for everything else (e.g., WAV header updates) */
+	char *buffer;			/* Aligned buffer we aggregate the data in */
+	size_t used;			/* How much of the buffer we're using */
+	off_t offset;			/* How much we've written to the file so far */
+	gint64 last_update;		/* When we last updated the WAV header */
+	GAsyncQueue *frames;	/* Frames the mixer queued for us */
+	gboolean dropping;		/* Whether we're dropping frames (to only log once) */
+#ifdef HAVE_LIBOGG
+	OpusEncoder *encoder;
+	ogg_stream_state stream;
+	ogg_int64_t granulepos, packetno;
+	unsigned char pending[1500];	/* Last encoded packet, to mark the end of stream when we close */
+	int pending_len;
+#endif
+} janus_audiobridge_mix_recording;
+
+static void janus_audiobridge_mix_recording_free(janus_audiobridge_mix_recording *rec) {
+	if(rec == NULL)
+		return;
+	janus_audiobridge_mix_frame *frame = NULL;
+	while((frame = g_async_queue_try_pop(rec->frames)) != NULL) {
+		if(frame == &rec_exit_frame)
+			continue;
+		g_free(frame->data);
+		g_free(frame);
 	}
-	audiobridge->recording = fopen(filename, "wb");
-	if(audiobridge->recording == NULL) {
-		JANUS_LOG(LOG_WARN, "Recording requested, but could NOT open file %s for writing, giving up...\n", filename);
-		g_atomic_int_set(&audiobridge->record, 0);
-		g_atomic_int_set(&audiobridge->wav_header_added, 0);
-		g_free(audiobridge->record_file);
-		audiobridge->record_file = NULL;
-	} else {
-		JANUS_LOG(LOG_VERB, "Recording requested, opened file %s for writing\n", filename);
-		/* Write WAV header */
-		wav_header header = {
-			{'R', 'I', 'F', 'F'},
-			0,
+	g_async_queue_unref(rec->frames);
+#ifdef HAVE_LIBOGG
+	if(rec->encoder)
+		opus_encoder_destroy(rec->encoder);
+	if(rec->opus)
+		ogg_stream_clear(&rec->stream);
+#endif
+	free(rec->buffer);
+	g_free(rec->filename);
+	g_free(rec->tmpfilename);
+	janus_refcount_decrease(&rec->room->ref);
+	g_free(rec);
+}
+
+/* Write the buffered data to disk: full chunks are aligned, so we can use
+ * O_DIRECT, while the last partial one will go through the other descriptor */
+static void janus_audiobridge_mix_recording_flush(janus_audiobridge_mix_recording *rec) {
+	if(rec->used == 0)
+		return;
+	int fd = (rec->used == JANUS_AUDIOBRIDGE_RECORDING_CHUNK) ? rec->fd : rec->hfd;
+	size_t written = 0;
+	while(written < rec->used) {
+		ssize_t res = pwrite(fd, rec->buffer + written, rec->used - written, rec->offset + written);
+		if(res < 0 && errno == EINTR)
+			continue;
+		if(res <= 0) {
+			JANUS_LOG(LOG_ERR, "Error writing to recording %s: %d (%s)\n",
+				rec->tmpfilename ? rec->tmpfilename : rec->filename, errno, g_strerror(errno));
+			break;
+		}
+		written += res;
+	}
+	rec->offset += rec->used;
+	rec->used = 0;
+}
+
+static void janus_audiobridge_mix_recording_append(janus_audiobridge_mix_recording *rec, const char *data, size_t len) {
+	while(len > 0) {
+		size_t size = JANUS_AUDIOBRIDGE_RECORDING_CHUNK - rec->used;
+		if(size > len)
+			size = len;
+		memcpy(rec->buffer + rec->used, data, size);
+		rec->used += size;
+		data += size;
+		len -= size;
+		if(rec->used == JANUS_AUDIOBRIDGE_RECORDING_CHUNK)
+			janus_audiobridge_mix_recording_flush(rec);
+	}
+}
+
+/* Update the lengths in the WAV header, based on what we wrote so far */
+static void janus_audiobridge_mix_recording_update_wav_header(janus_audiobridge_mix_recording *rec) {
+	if(rec->offset < (off_t)sizeof(wav_header))
+		return;
+	uint32_t size = rec->offset - 8;
+	if(pwrite(rec->hfd, &size, sizeof(size), 4) != sizeof(size))
+		JANUS_LOG(LOG_WARN, "Error updating WAV header: %d (%s)\n", errno, g_strerror(errno));
+	size = rec->offset - sizeof(wav_header);
+	if(pwrite(rec->hfd, &size, sizeof(size), 40) != sizeof(size))
+		JANUS_LOG(LOG_WARN, "Error updating WAV header: %d (%s)\n", errno, g_strerror(errno));
+	rec->last_update = janus_get_monotonic_time();
+}
+
+#ifdef HAVE_LIBOGG
+static void janus_audiobridge_mix_recording_ogg_pages(janus_audiobridge_mix_recording *rec, gboolean flush) {
+	ogg_page page;
+	while((flush ? ogg_stream_flush(&rec->stream, &page) : ogg_stream_pageout(&rec->stream, &page)) > 0) {
+		janus_audiobridge_mix_recording_append(rec, (char *)page.header, page.header_len);
+		janus_audiobridge_mix_recording_append(rec, (char *)page.body, page.body_len);
+	}
+}
+
+static void janus_audiobridge_mix_recording_ogg_packet(janus_audiobridge_mix_recording *rec,
+		unsigned char *data, int len, gboolean bos, gboolean eos) {
+	ogg_packet op;
+	op.packet = data;
+	op.bytes = len;
+	op.b_o_s = bos;
+	op.e_o_s = eos;
+	op.granulepos = rec->granulepos;
+	op.packetno = rec->packetno++;
+	ogg_stream_packetin(&rec->stream, &op);
+}
+
+static int janus_audiobridge_mix_recording_ogg_start(janus_audiobridge_mix_recording *rec) {
+	int error = 0;
+	rec->encoder = opus_encoder_create(rec->sampling_rate, rec->channels, OPUS_APPLICATION_AUDIO, &error);
+	if(error != OPUS_OK) {
+		JANUS_LOG(LOG_ERR, "Error creating Opus encoder for recording: %d (%s)\n", error, opus_strerror(error));
+		rec->encoder = NULL;
+		return -1;
+	}
+	if(ogg_stream_init(&rec->stream, janus_random_uint32() & 0x7FFFFFFF) < 0) {
+		JANUS_LOG(LOG_ERR, "Error initializing Ogg stream for recording\n");
+		return -1;
+	}
+	/* OpusHead (RFC 7845) */
+	opus_int32 lookahead = 0;
+	opus_encoder_ctl(rec->encoder, OPUS_GET_LOOKAHEAD(&lookahead));
+	uint16_t preskip = lookahead * (48000 / rec->sampling_rate);
+	unsigned char head[19];
+	memcpy(head, "OpusHead", 8);
+	head[8] = 1;
+	head[9] = rec->channels;
+	head[10] = preskip & 0xFF;
+	head[11] = (preskip >> 8) & 0xFF;
+	head[12] = rec->sampling_rate & 0xFF;
+	head[13] = (rec->sampling_rate >> 8) & 0xFF;
+	head[14] = (rec->sampling_rate >> 16) & 0xFF;
+	head[15] = (rec->sampling_rate >> 24) & 0xFF;
+	head[16] = head[17] = 0;
+	head[18] = 0;
+	janus_audiobridge_mix_recording_ogg_packet(rec, head, sizeof(head), TRUE, FALSE);
+	janus_audiobridge_mix_recording_ogg_pages(rec, TRUE);
+	/* OpusTags */
+	const char *vendor = "Janus AudioBridge";
+	size_t vlen = strlen(vendor);
+	unsigned char tags[8+4+32+4];
+	memcpy(tags, "OpusTags", 8);
+	tags[8] = vlen & 0xFF;
+	tags[9] = tags[10] = tags[11] = 0;
+	memcpy(tags+12, vendor, vlen);
+	memset(tags+12+vlen, 0, 4);
+	janus_audiobridge_mix_recording_ogg_packet(rec, tags, 12+vlen+4, FALSE, FALSE);
+	janus_audiobridge_mix_recording_ogg_pages(rec, TRUE);
+	return 0;
+}
+
+static void janus_audiobridge_mix_recording_ogg_frame(janus_audiobridge_mix_recording *rec, janus_audiobridge_mix_frame *frame) {
+	/* We're always one packet behind, so that we know which one is the last */
+	if(rec->pending_len > 0) {
+		janus_audiobridge_mix_recording_ogg_packet(rec, rec->pending, rec->pending_len, FALSE, FALSE);
+		janus_audiobridge_mix_recording_ogg_pages(rec, FALSE);
+		rec->pending_len = 0;
+	}
+	int len = opus_encode(rec->encoder, frame->data, frame->samples/rec->channels, rec->pending, sizeof(rec->pending));
+	if(len < 0) {
+		JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error encoding the recording frame: %d (%s)\n", len, opus_strerror(len));
+		return;
+	}
+	rec->pending_len = len;
+	/* The granule position is always in 48kHz units */
+	rec->granulepos += 960;
+}
+#endif
+
+static void *janus_audiobridge_mix_recording_thread(void *data) {
+	janus_audiobridge_mix_recording *rec = (janus_audiobridge_mix_recording *)data;
+	janus_audiobridge_room *audiobridge = rec->room;
+	const char *path = rec->tmpfilename ? rec->tmpfilename : rec->filename;
+	JANUS_LOG(LOG_VERB, "Room %s recording writer starting (%s)...\n", audiobridge->room_id_str, path);
+	gboolean failed = FALSE;
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+	rec->fd = -1;
+	rec->hfd = -1;
+#ifdef O_DIRECT
+	if(rec_direct_io) {
+		rec->fd = open(path, flags | O_DIRECT, 0644);
+		if(rec->fd < 0) {
+			JANUS_LOG(LOG_WARN, "Couldn't open %s with O_DIRECT (%d, %s), falling back to buffered I/O\n",
+				path, errno, g_strerror(errno));
+		} else {
+			rec->hfd = open(path, O_WRONLY);
+		}
+	}
+#endif
+	if(rec->fd < 0)
+		rec->fd = open(path, flags, 0644);
+	if(rec->hfd < 0)
+		rec->hfd = rec->fd;
+	if(rec->fd < 0 || posix_memalign((void **)&rec->buffer, 4096, JANUS_AUDIOBRIDGE_RECORDING_CHUNK) != 0) {
+		JANUS_LOG(LOG_WARN, "Recording requested, but could NOT open file %s for writing, giving up...\n", path);
+		g_atomic_int_set(&audiobridge->record, 0);
+		failed = TRUE;
+	} else if(rec->opus) {
+#ifdef HAVE_LIBOGG
+		if(janus_audiobridge_mix_recording_ogg_start(rec) < 0) {
+			g_atomic_int_set(&audiobridge->record, 0);
+			failed = TRUE;
+		}
+#endif
+	} else {
+		/* Write WAV header */
+		wav_header header = {
+			{'R', 'I', 'F', 'F'},
+			0,
 			{'W', 'A', 'V', 'E'},
 			{'f', 'm', 't', ' '},
 			16,
 			1,
-			audiobridge->spatial_audio ? 2 : 1,
-			audiobridge->sampling_rate,
-			audiobridge->sampling_rate * 2 * (audiobridge->spatial_audio ? 2 : 1),
+			rec->channels,
+			rec->sampling_rate,
+			rec->sampling_rate * 2 * rec->channels,
 			2,
 			16,
 			{'d', 'a', 't', 'a'},
 			0
 		};
-		if(fwrite(&header, 1, sizeof(header), audiobridge->recording) != sizeof(header)) {
-			JANUS_LOG(LOG_ERR, "Error writing WAV header...\n");
+		janus_audiobridge_mix_recording_append(rec, (char *)&header, sizeof(header));
+		rec->last_update = janus_get_monotonic_time();
+	}
+	if(!failed)
+		JANUS_LOG(LOG_VERB, "Recording requested, opened file %s for writing\n", path);
+	/* Write whatever the mixer sends us */
+	janus_audiobridge_mix_frame *frame = NULL;
+	while((frame = g_async_queue_pop(rec->frames)) != &rec_exit_frame) {
+		if(!failed) {
+#ifdef HAVE_LIBOGG
+			if(rec->opus)
+				janus_audiobridge_mix_recording_ogg_frame(rec, frame);
+			else
+#endif
+				janus_audiobridge_mix_recording_append(rec, (char *)frame->data, frame->samples*sizeof(opus_int16));
+			/* Every 5 seconds we update the wav header */
+			if(!rec->opus && janus_get_monotonic_time() - rec->last_update >= 5*G_USEC_PER_SEC)
+				janus_audiobridge_mix_recording_update_wav_header(rec);
+		}
+		g_free(frame->data);
+		g_free(frame);
+	}
+	if(!failed) {
+		/* We're done, write what's left and close the file */
+#ifdef HAVE_LIBOGG
+		if(rec->opus) {
+			if(rec->pending_len > 0)
+				janus_audiobridge_mix_recording_ogg_packet(rec, rec->pending, rec->pending_len, FALSE, TRUE);
+			janus_audiobridge_mix_recording_ogg_pages(rec, TRUE);
+		}
+#endif
+		janus_audiobridge_mix_recording_flush(rec);
+		if(!rec->opus)
+			janus_audiobridge_mix_recording_update_wav_header(rec);
+	}
+	if(rec->hfd != rec->fd && rec->hfd >= 0)
+		close(rec->hfd);
+	if(rec->fd >= 0)
+		close(rec->fd);
+	if(!failed) {
+		if(rec->tmpfilename) {
+			/* We need to rename the file, to remove the temporary extension */
+			if(rename(rec->tmpfilename, rec->filename) != 0) {
+				JANUS_LOG(LOG_ERR, "Error renaming %s to %s...\n", rec->tmpfilename, rec->filename);
+			} else {
+				JANUS_LOG(LOG_INFO, "Recording renamed: %s\n", rec->filename);
+			}
+		}
+		/* Also notify event handlers */
+		if(notify_events && gateway->events_is_enabled()) {
+			json_t *info = json_object();
+			json_object_set_new(info, "event", json_string("recordingdone"));
+			json_object_set_new(info, "room",
+				string_ids ? json_string(audiobridge->room_id_str) : json_integer(audiobridge->room_id));
+			json_object_set_new(info, "record_file", json_string(rec->filename));
+			gateway->notify_event(&janus_audiobridge_plugin, NULL, info);
 		}
-		fflush(audiobridge->recording);
-		audiobridge->record_lastupdate = janus_get_monotonic_time();
-		g_atomic_int_set(&audiobridge->wav_header_added, 1);
 	}
+	JANUS_LOG(LOG_VERB, "Room %s recording writer leaving...\n", audiobridge->room_id_str);
+	janus_audiobridge_mix_recording_free(rec);
+	g_thread_unref(g_thread_self());
+	return NULL;
 }
-static void janus_audiobridge_update_wav_header(janus_audiobridge_room *audiobridge) {
-	/* Update the length in the header */
-	if(audiobridge->recording == NULL)
-		return;
-	fseek(audiobridge->recording, 0, SEEK_END);
-	long int size = ftell(audiobridge->recording);
-	if(size >= 8) {
-		size -= 8;
-		fseek(audiobridge->recording, 4, SEEK_SET);
-		fwrite(&size, sizeof(uint32_t), 1, audiobridge->recording);
-		size += 8;
-		fseek(audiobridge->recording, 40, SEEK_SET);
-		fwrite(&size, sizeof(uint32_t), 1, audiobridge->recording);
-		fflush(audiobridge->recording);
-	}
-	fclose(audiobridge->recording);
-	audiobridge->recording = NULL;
-	g_atomic_int_set(&audiobridge->wav_header_added, 0);
 
+static void janus_audiobridge_mix_recording_start(janus_audiobridge_room *audiobridge) {
+	/* Do we need to record the mix? */
 	char filename[255];
+	gint64 now = janus_get_real_time();
+	audiobridge->rec_start_time = now;
 	if(audiobridge->record_file) {
 		g_snprintf(filename, 255, "%s%s%s",
 			audiobridge->record_dir ? audiobridge->record_dir : "",
 			audiobridge->record_dir ? "/" : "",
 			audiobridge->record_file);
 	} else {
-		g_snprintf(filename, 255, "%s%sjanus-audioroom-%s-%"SCNi64".wav",
+		g_snprintf(filename, 255, "%s%sjanus-audioroom-%s-%"SCNi64".%s",
 			audiobridge->record_dir ? audiobridge->record_dir : "",
 			audiobridge->record_dir ? "/" : "",
-			audiobridge->room_id_str, audiobridge->rec_start_time);
-	}
-	if(rec_tempext) {
-		/* We need to rename the file, to remove the temporary extension */
-		char extfilename[255];
-		if(audiobridge->record_file) {
-			g_snprintf(extfilename, 255, "%s%s%s.%s",
-				audiobridge->record_dir ? audiobridge->record_dir : "",
-				audiobridge->record_dir ? "/" : "",
-				audiobridge->record_file, rec_tempext);
-		} else {
-			g_snprintf(extfilename, 255, "%s%sjanus-audioroom-%s-%"SCNi64".wav.%s",
-				audiobridge->record_dir ? audiobridge->record_dir : "",
-				audiobridge->record_dir ? "/" : "",
-				audiobridge->room_id_str,
-				audiobridge->rec_start_time, rec_tempext);
-		}
-		if(rename(extfilename, filename) != 0) {
-			JANUS_LOG(LOG_ERR, "Error renaming %s to %s...\n", extfilename, filename);
+			audiobridge->room_id_str, now, audiobridge->record_opus ? "opus" : "wav");
+	}
+	janus_audiobridge_mix_recording *rec = g_malloc0(sizeof(janus_audiobridge_mix_recording));
+	janus_refcount_increase(&audiobridge->ref);
+	rec->room = audiobridge;
+	rec->filename = g_strdup(filename);
+	if(rec_tempext)
+		rec->tmpfilename = g_strdup_printf("%s.%s", filename, rec_tempext);
+	rec->opus = audiobridge->record_opus;
+	rec->channels = audiobridge->spatial_audio ? 2 : 1;
+	rec->sampling_rate = audiobridge->sampling_rate;
+	rec->fd = -1;
+	rec->hfd = -1;
+	rec->frames = g_async_queue_new();
+	/* The writer thread will open the file itself, so that we don't block here either */
+	GError *error = NULL;
+	char roomtrunc[8], tname[16];
+	g_snprintf(roomtrunc, sizeof(roomtrunc), "%s", audiobridge->room_id_str);
+	g_snprintf(tname, sizeof(tname), "abrec %s", roomtrunc);
+	GThread *thread = g_thread_try_new(tname, &janus_audiobridge_mix_recording_thread, rec, &error);
+	if(error != NULL) {
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the recording thread, giving up...\n",
+			error->code, error->message ? error->message : "??");
+		g_error_free(error);
+		janus_audiobridge_mix_recording_free(rec);
+		g_atomic_int_set(&audiobridge->record, 0);
+		g_atomic_int_set(&audiobridge->wav_header_added, 0);
+		return;
+	}
+	(void)thread;
+	audiobridge->recording = rec;
+	g_atomic_int_set(&audiobridge->record_dropped, 0);
+	g_atomic_int_set(&audiobridge->wav_header_added, 1);
+}
+
+static void janus_audiobridge_mix_recording_write(janus_audiobridge_room *audiobridge, opus_int16 *data, int samples) {
+	janus_audiobridge_mix_recording *rec = audiobridge->recording;
+	if(rec == NULL)
+		return;
+	if((guint)g_async_queue_length(rec->frames) >= rec_queue_frames) {
+		/* The writer can't keep up, drop the frame rather than waiting */
+		g_atomic_int_inc(&audiobridge->record_dropped);
+		if(!rec->dropping) {
+			JANUS_LOG(LOG_WARN, "[%s] Recording writer is too slow, dropping frames\n", audiobridge->room_id_str);
+			rec->dropping = TRUE;
+		}
+		return;
+	}
+	rec->dropping = FALSE;
+	janus_audiobridge_mix_frame *frame = g_malloc(sizeof(janus_audiobridge_mix_frame));
+	frame->data = g_malloc(samples * sizeof(opus_int16));
+	memcpy(frame->data, data, samples * sizeof(opus_int16));
+	frame->samples = samples;
+	g_async_queue_push(rec->frames, frame);
+}
+
+static void janus_audiobridge_mix_recording_stop(janus_audiobridge_room *audiobridge) {
+	janus_audiobridge_mix_recording *rec = audiobridge->recording;
+	audiobridge->recording = NULL;
+	g_atomic_int_set(&audiobridge->wav_header_added, 0);
+	/* The writer thread will flush, close the file and get rid of the resources */
+	if(rec != NULL)
+		g_async_queue_push(rec->frames, &rec_exit_frame);
+}
+
+/* Thread to mix the contributions from all participants */
+/* Encoders the mixer shares among participants that get the same mix: since
+ * participants that are not contributing to the mix all get exactly the same
+ * audio, there's no need to encode it for each of them, as long as they're
+ * using the same encoder settings (which is what we use as a key) */
+typedef struct janus_audiobridge_shared_encoder {
+	OpusEncoder *encoder;
+	janus_audiobridge_encoded_frame *frame;
+	guint32 last_ts;
+	gint64 last_used;
+} janus_audiobridge_shared_encoder;
+static void janus_audiobridge_shared_encoder_free(gpointer data) {
+	janus_audiobridge_shared_encoder *se = (janus_audiobridge_shared_encoder *)data;
+	if(se == NULL)
+		return;
+	if(se->encoder)
+		opus_encoder_destroy(se->encoder);
+	if(se->frame)
+		janus_refcount_decrease(&se->frame->ref);
+	g_free(se);
+}
+static janus_audiobridge_encoded_frame *janus_audiobridge_shared_encode(GHashTable *encoders,
+		janus_audiobridge_room *audiobridge, janus_audiobridge_participant *p,
+		opus_int16 *mix, int samples, guint32 ts, gint64 now) {
+	char key[64];
+	g_snprintf(key, sizeof(key), "%d|%"SCNi32"|%d|%d|%d", p->stereo, p->opus_bitrate,
+		p->opus_complexity, p->fec, p->expected_loss);
+	janus_audiobridge_shared_encoder *se = g_hash_table_lookup(encoders, key);
+	if(se == NULL) {
+		int error = 0;
+		OpusEncoder *encoder = opus_encoder_create(audiobridge->sampling_rate,
+			audiobridge->spatial_audio ? 2 : 1, OPUS_APPLICATION_VOIP, &error);
+		if(error != OPUS_OK) {
+			JANUS_LOG(LOG_ERR, "Error creating shared Opus encoder: %d (%s)\n", error, opus_strerror(error));
+			return NULL;
+		}
+		if(audiobridge->sampling_rate == 8000) {
+			opus_encoder_ctl(encoder, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_NARROWBAND));
+		} else if(audiobridge->sampling_rate == 12000) {
+			opus_encoder_ctl(encoder, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_MEDIUMBAND));
+		} else if(audiobridge->sampling_rate == 16000) {
+			opus_encoder_ctl(encoder, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_WIDEBAND));
+		} else if(audiobridge->sampling_rate == 24000) {
+			opus_encoder_ctl(encoder, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_SUPERWIDEBAND));
 		} else {
-			JANUS_LOG(LOG_INFO, "Recording renamed: %s\n", filename);
+			opus_encoder_ctl(encoder, OPUS_SET_MAX_BANDWIDTH(OPUS_BANDWIDTH_FULLBAND));
+		}
+		opus_encoder_ctl(encoder, OPUS_SET_INBAND_FEC(p->fec));
+		opus_encoder_ctl(encoder, OPUS_SET_PACKET_LOSS_PERC(p->expected_loss));
+		opus_encoder_ctl(encoder, OPUS_SET_COMPLEXITY(p->opus_complexity));
+		if(p->opus_bitrate > 0)
+			opus_encoder_ctl(encoder, OPUS_SET_BITRATE(p->opus_bitrate));
+		se = g_malloc0(sizeof(janus_audiobridge_shared_encoder));
+		se->encoder = encoder;
+		g_hash_table_insert(encoders, g_strdup(key), se);
+		JANUS_LOG(LOG_VERB, "[%s] Created shared Opus encoder (%s)\n", audiobridge->room_id_str, key);
+	}
+	se->last_used = now;
+	if(se->frame != NULL && se->last_ts == ts) {
+		/* We already encoded this frame for another participant */
+		janus_refcount_increase(&se->frame->ref);
+		return se->frame;
+	}
+	if(se->frame != NULL) {
+		janus_refcount_decrease(&se->frame->ref);
+		se->frame = NULL;
+	}
+	unsigned char data[1500-12];
+	gint64 start = janus_get_monotonic_time();
+	int length = opus_encode(se->encoder, mix, p->stereo ? samples/2 : samples, data, sizeof(data));
+	janus_usage_add(&audiobridge->usage, JANUS_USAGE_ENCODE_TIME, janus_get_monotonic_time() - start);
+	if(length < 0) {
+		JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error encoding the shared Opus frame: %d (%s)\n", length, opus_strerror(length));
+		return NULL;
+	}
+	janus_audiobridge_encoded_frame *frame = g_malloc(sizeof(janus_audiobridge_encoded_frame));
+	frame->data = g_malloc(length);
+	memcpy(frame->data, data, length);
+	frame->length = length;
+	janus_refcount_init(&frame->ref, janus_audiobridge_encoded_frame_free);
+	se->frame = frame;
+	se->last_ts = ts;
+	janus_refcount_increase(&frame->ref);
+	return frame;
+}
+static gboolean janus_audiobridge_shared_encoder_expired(gpointer key, gpointer value, gpointer user_data) {
+	janus_audiobridge_shared_encoder *se = (janus_audiobridge_shared_encoder *)value;
+	gint64 now = *((gint64 *)user_data);
+	return (now - se->last_used) > G_USEC_PER_SEC;
+}
+/* G.711 is cheap enough that the mixer can encode it itself: participants
+ * that get the full mix share the same frame, per codec */
+static janus_audiobridge_encoded_frame *janus_audiobridge_g711_encode_frame(janus_audiocodec codec, opus_int16 *samples) {
+	janus_audiobridge_encoded_frame *frame = g_malloc(sizeof(janus_audiobridge_encoded_frame));
+	frame->data = g_malloc(G711_SAMPLES);
+	frame->length = G711_SAMPLES;
+	int i = 0;
+	if(codec == JANUS_AUDIOCODEC_PCMA) {
+		for(i=0; i<G711_SAMPLES; i++)
+			frame->data[i] = janus_audiobridge_g711_alaw_encode(samples[i]);
+	} else {
+		for(i=0; i<G711_SAMPLES; i++)
+			frame->data[i] = janus_audiobridge_g711_ulaw_encode(samples[i]);
+	}
+	janus_refcount_init(&frame->ref, janus_audiobridge_encoded_frame_free);
+	return frame;
+}
+
+/* Plain RTP G.711 legs (e.g., SIP gateways attached to a room) don't need a
+ * thread or worker of their own to get the mix, since the mixer encodes it
+ * already: mixers hand the frames for all of them, once per tick, to a single
+ * sender thread, which takes care of the RTP headers and of the sockets */
+typedef struct janus_audiobridge_plainrtp_frame {
+	janus_audiobridge_participant *participant;
+	janus_audiobridge_encoded_frame *frame;
+	guint32 ssrc, timestamp;
+	guint16 seq_number;
+} janus_audiobridge_plainrtp_frame;
+static void janus_audiobridge_plainrtp_frame_free(janus_audiobridge_plainrtp_frame *pf) {
+	janus_refcount_decrease(&pf->frame->ref);
+	janus_refcount_decrease(&pf->participant->session->ref);
+	janus_refcount_decrease(&pf->participant->ref);
+	g_free(pf);
+}
+static void *janus_audiobridge_plainrtp_sender_thread(void *data) {
+	JANUS_LOG(LOG_VERB, "AudioBridge plain RTP sender starting...\n");
+	char buffer[12+G711_SAMPLES];
+	janus_audiobridge_rtp_relay_packet outpkt = { 0 };
+	outpkt.data = (janus_rtp_header *)buffer;
+	GPtrArray *batch = NULL;
+	guint i = 0;
+	while((batch = g_async_queue_pop(plainrtp_batches)) != &plainrtp_exit_batch) {
+		for(i=0; i<batch->len; i++) {
+			janus_audiobridge_plainrtp_frame *pf = g_ptr_array_index(batch, i);
+			janus_audiobridge_participant *participant = pf->participant;
+			janus_audiobridge_session *session = participant->session;
+			if(g_atomic_int_get(&session->destroyed) == 0 && g_atomic_int_get(&session->started) &&
+					!g_atomic_int_get(&participant->suspended) && g_atomic_int_get(&participant->active)) {
+				memset(buffer, 0, 12);
+				memcpy(buffer+12, pf->frame->data, pf->frame->length);
+				outpkt.length = 12 + pf->frame->length;
+				outpkt.data->version = 2;
+				outpkt.data->seq_number = htons(pf->seq_number);
+				outpkt.data->timestamp = htonl(pf->timestamp/6);
+				outpkt.data->ssrc = htonl(pf->ssrc);
+				/* Backup the actual timestamp and sequence number set by the audiobridge, in case a room is changed */
+				outpkt.ssrc = pf->ssrc;
+				outpkt.timestamp = pf->timestamp/6;
+				outpkt.seq_number = pf->seq_number;
+				janus_audiobridge_relay_rtp_packet(session, &outpkt);
+			}
+			janus_audiobridge_plainrtp_frame_free(pf);
 		}
+		g_ptr_array_free(batch, TRUE);
 	}
-	/* Also notify event handlers */
-	if(notify_events && gateway->events_is_enabled()) {
-		json_t *info = json_object();
-		json_object_set_new(info, "event", json_string("recordingdone"));
-		json_object_set_new(info, "room",
-			string_ids ? json_string(audiobridge->room_id_str) : json_integer(audiobridge->room_id));
-		json_object_set_new(info, "record_file", json_string(filename));
-		gateway->notify_event(&janus_audiobridge_plugin, NULL, info);
+	/* Get rid of whatever is left */
+	while((batch = g_async_queue_try_pop(plainrtp_batches)) != NULL) {
+		if(batch == &plainrtp_exit_batch)
+			continue;
+		for(i=0; i<batch->len; i++)
+			janus_audiobridge_plainrtp_frame_free(g_ptr_array_index(batch, i));
+		g_ptr_array_free(batch, TRUE);
 	}
+	JANUS_LOG(LOG_VERB, "AudioBridge plain RTP sender leaving...\n");
+	return NULL;
+}
+
+/* When encoding threads are enabled, the mixer doesn't queue mixed frames to
+ * the participant threads, but hands them to a pool of workers instead, and
+ * waits for them to be encoded and sent before the next tick is due */
+static void janus_audiobridge_participant_send_mixed(janus_audiobridge_participant *participant,
+	janus_audiobridge_rtp_relay_packet *mixedpkt, janus_audiobridge_rtp_relay_packet *outpkt);
+typedef struct janus_audiobridge_encode_job {
+	janus_audiobridge_participant *participant;
+	janus_audiobridge_rtp_relay_packet *mixedpkt;
+} janus_audiobridge_encode_job;
+static void janus_audiobridge_encode_worker(gpointer data, gpointer user_data) {
+	janus_audiobridge_encode_job *job = (janus_audiobridge_encode_job *)data;
+	GAsyncQueue *done = (GAsyncQueue *)user_data;
+	janus_audiobridge_participant *participant = job->participant;
+	janus_audiobridge_rtp_relay_packet *mixedpkt = job->mixedpkt;
+	janus_audiobridge_session *session = participant->session;
+	if(!g_atomic_int_get(&participant->destroyed) && g_atomic_int_get(&session->destroyed) == 0 &&
+			g_atomic_int_get(&session->started)) {
+		/* Each worker uses its own output buffer */
+		uint8_t buffer[1500];
+		memset(buffer, 0, 12);
+		janus_audiobridge_rtp_relay_packet outpkt = { 0 };
+		outpkt.data = (janus_rtp_header *)buffer;
+		janus_audiobridge_participant_send_mixed(participant, mixedpkt, &outpkt);
+	}
+	/* Let the mixer know we're done with this tick */
+	guint seq = (guint)mixedpkt->seq_number + 1;
+	if(mixedpkt->encoded)
+		janus_refcount_decrease(&mixedpkt->encoded->ref);
+	g_free(mixedpkt->data);
+	g_free(mixedpkt);
+	g_atomic_int_set(&participant->encode_pending, 0);
+	g_async_queue_push(done, GUINT_TO_POINTER(seq));
+	janus_refcount_decrease(&session->ref);
+	janus_refcount_decrease(&participant->ref);
+	g_free(job);
+}
+
+/* Helper to compute the audio level (in -dBov, as in RFC 6464) of a decoded frame */
+static int janus_audiobridge_frame_level(opus_int16 *samples, int count) {
+	if(samples == NULL || count <= 0)
+		return 127;
+	double sum = 0;
+	int i = 0;
+	for(i=0; i<count; i++)
+		sum += (double)samples[i] * (double)samples[i];
+	double rms = sqrt(sum/count);
+	if(rms < 1.0)
+		return 127;
+	int level = (int)(-20.0 * log10(rms/32767.0));
+	return level < 0 ? 0 : (level > 127 ? 127 : level);
+}
+
+/* Helper to pick the loudest participants in a room, when only the top speakers
+ * should be mixed: participants are ranked by their smoothed audio level, taken
+ * from the audio level extension if available or computed from the decoded
+ * frame otherwise, and those that were already being mixed get an advantage, so
+ * that we don't keep on switching between speakers with similar levels */
+static void janus_audiobridge_select_speakers(janus_audiobridge_room *audiobridge, GList *participants) {
+	janus_audiobridge_participant *speakers[JANUS_AUDIOBRIDGE_MAX_SPEAKERS];
+	int scores[JANUS_AUDIOBRIDGE_MAX_SPEAKERS];
+	uint max = audiobridge->top_speakers, selected = 0, i = 0;
+	GList *ps = participants;
+	while(ps) {
+		janus_audiobridge_participant *p = (janus_audiobridge_participant *)ps->data;
+		ps = ps->next;
+		gboolean was_mixing = p->mixing;
+		p->mixing = FALSE;
+		int level = 127;
+		if(!g_atomic_int_get(&p->destroyed) && p->session && g_atomic_int_get(&p->session->started) &&
+				g_atomic_int_get(&p->active) && !p->muted && !g_atomic_int_get(&p->suspended)) {
+			janus_audiobridge_rtp_relay_packet *pkt = janus_audiobridge_inbuf_peek(p->inbuf);
+			if(pkt != NULL && pkt->length > 0 && !pkt->silence) {
+				level = pkt->level >= 0 ? pkt->level :
+					janus_audiobridge_frame_level((opus_int16 *)pkt->data, p->codec == JANUS_AUDIOCODEC_OPUS ? pkt->length : 160);
+			}
+		}
+		p->speaker_level = (p->speaker_level*3 + level)/4;
+		if(level == 127)
+			continue;
+		/* Lower is louder: keep the selected participants sorted */
+		int score = p->speaker_level - (was_mixing ? JANUS_AUDIOBRIDGE_SPEAKERS_HYSTERESIS : 0);
+		if(selected == max && score >= scores[selected-1])
+			continue;
+		i = (selected < max) ? selected++ : max-1;
+		while(i > 0 && scores[i-1] > score) {
+			scores[i] = scores[i-1];
+			speakers[i] = speakers[i-1];
+			i--;
+		}
+		scores[i] = score;
+		speakers[i] = p;
+	}
+	for(i=0; i<selected; i++)
+		speakers[i]->mixing = TRUE;
 }
 
-/* Thread to mix the contributions from all participants */
 static void *janus_audiobridge_mixer_thread(void *data) {
 	JANUS_LOG(LOG_VERB, "Audio bridge thread starting...\n");
 	janus_audiobridge_room *audiobridge = (janus_audiobridge_room *)data;
@@ -8220,6 +9774,12 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 	}
 	JANUS_LOG(LOG_VERB, "Thread is for mixing room %s (%s) at rate %"SCNu32"...\n",
 		audiobridge->room_id_str, audiobridge->room_name, audiobridge->sampling_rate);
+	/* Apply the core scheduling profile for mixers, if any */
+	char tname[64];
+	g_snprintf(tname, sizeof(tname), "mixer %s", audiobridge->room_id_str);
+	janus_sched_thread_start(JANUS_SCHED_MIXER, tname);
+	/* The CPU time of this thread is all accounted to the room */
+	gint64 cpu_last = janus_usage_thread_cpu_time();
 
 	/* Buffer (we allocate assuming 48kHz, although we'll likely use less than that) */
 	int samples = audiobridge->sampling_rate/50;
@@ -8233,6 +9793,12 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 	memset(sumBuffer, 0, OPUS_SAMPLES*(audiobridge->spatial_audio ? 8 : 4));
 	memset(outBuffer, 0, OPUS_SAMPLES*(audiobridge->spatial_audio ? 4 : 2));
 	memset(resampled, 0, OPUS_SAMPLES*(audiobridge->spatial_audio ? 4 : 2));
+	/* G.711 participants all get the mix at 8kHz: since downsampling is linear,
+	 * we downsample the full mix only once per tick, and then only remove the
+	 * (downsampled) contribution of each G.711 participant from that */
+	opus_int32 g711Mix[G711_SAMPLES], g711Sum[G711_SAMPLES];
+	opus_int16 g711Out[G711_SAMPLES], g711Own[G711_SAMPLES];
+	gboolean have_g711_mix = FALSE;
 
 	/* In case forwarding groups are enabled, we need additional buffers */
 	uint groups_num = audiobridge->groups ? g_hash_table_size(audiobridge->groups) : 0, index = 0;
@@ -8283,50 +9849,80 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 	uint8_t *rtpalaw = g_malloc0((12+G711_SAMPLES) * (groups_num+1)),
 			*rtpulaw = g_malloc0((12+G711_SAMPLES) * (groups_num+1));
 
-	/* Timer */
-	struct timeval now, before;
-	gettimeofday(&before, NULL);
-	now.tv_sec = before.tv_sec;
-	now.tv_usec = before.tv_usec;
-	time_t passed, d_s, d_us;
+	/* Timer: we wake up at absolute deadlines, so that the time spent mixing doesn't cause drift */
+	struct timespec deadline, now;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	gint64 late = 0, tick_start = 0, tick_end = 0, stats_last = janus_get_monotonic_time();
+
+	/* Encoding workers, if enabled */
+	GThreadPool *encoders = NULL;
+	GAsyncQueue *encoded = NULL;
+	guint dispatched = 0;
+	if(encoding_threads > 0) {
+		GError *error = NULL;
+		encoded = g_async_queue_new();
+		encoders = g_thread_pool_new(janus_audiobridge_encode_worker, encoded, encoding_threads, TRUE, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "[%s] Error creating encoding threads, falling back to participant threads: %d (%s)\n",
+				audiobridge->room_id_str, error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			encoders = NULL;
+			g_async_queue_unref(encoded);
+			encoded = NULL;
+		}
+	}
 
 	/* RTP */
 	guint16 seq = 0;
 	guint32 ts = 0;
 
+	/* Encoders shared by the participants that are not contributing to the mix, if enabled */
+	GHashTable *shared_encoders = shared_encoding ?
+		g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, janus_audiobridge_shared_encoder_free) : NULL;
+	gint64 shared_now = 0, shared_cleanup = janus_get_monotonic_time();
+	/* G.711 frames shared by the participants that are not contributing to the mix */
+	janus_audiobridge_encoded_frame *shared_alaw = NULL, *shared_ulaw = NULL;
+	/* Frames for the plain RTP sender, if any G.711 plain RTP leg is here */
+	GPtrArray *plainrtp_batch = NULL;
+
 	g_atomic_int_set(&audiobridge->wav_header_added, 0);
 	/* Loop */
 	int i=0;
 	int count = 0, rf_count = 0, pf_count = 0, prev_count = 0;
-	int lgain = 0, rgain = 0, diff = 0;
+	float lgain = 1.0f, rgain = 1.0f;
+	/* In case a single participant is talking, we may forward what they sent as it is */
+	int contributors = 0;
+	janus_audiobridge_participant *speaker = NULL;
+	janus_audiobridge_encoded_frame *passthrough = NULL;
 	while(!g_atomic_int_get(&stopping) && !g_atomic_int_get(&audiobridge->destroyed)) {
-		/* See if it's time to prepare a frame */
-		gettimeofday(&now, NULL);
-		d_s = now.tv_sec - before.tv_sec;
-		d_us = now.tv_usec - before.tv_usec;
-		if(d_us < 0) {
-			d_us += 1000000;
-			--d_s;
-		}
-		passed = d_s*1000000 + d_us;
-		if(passed < 15000) {	/* Let's wait about 15ms at max */
-			g_usleep(5000);
-			continue;
-		}
-		/* If we're recording to a wav file, update the info */
+		/* Wait until it's time to prepare a frame */
+		deadline.tv_nsec += 20000000;
+		if(deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		tick_start = (gint64)now.tv_sec*G_USEC_PER_SEC + now.tv_nsec/1000;
+		late = (gint64)(now.tv_sec - deadline.tv_sec)*G_USEC_PER_SEC + (now.tv_nsec - deadline.tv_nsec)/1000;
+		if(late >= 20000) {
+			/* We missed at least a full tick */
+			g_atomic_int_inc(&audiobridge->late_frames);
+			if(late >= 100000) {
+				/* Too late to catch up, start from now */
+				JANUS_LOG(LOG_WARN, "[%s] Mixer is %"SCNi64"ms late, resetting the timer\n",
+					audiobridge->room_id_str, late/1000);
+				deadline = now;
+			}
+		}
+		/* If we're recording the room, check if we need to start or stop */
 		if(g_atomic_int_get(&audiobridge->record) && !g_atomic_int_get(&audiobridge->wav_header_added)) {
-			JANUS_LOG(LOG_VERB, "Adding WAV header for recording %s (%s)...\n", audiobridge->room_id_str, audiobridge->room_name);
-			janus_audiobridge_rec_add_wav_header(audiobridge);
+			JANUS_LOG(LOG_VERB, "Starting recording %s (%s)...\n", audiobridge->room_id_str, audiobridge->room_name);
+			janus_audiobridge_mix_recording_start(audiobridge);
 		}
 		if(!g_atomic_int_get(&audiobridge->record) && g_atomic_int_get(&audiobridge->wav_header_added)) {
-			JANUS_LOG(LOG_VERB, "Updating WAV header for recording %s (%s)...\n", audiobridge->room_id_str, audiobridge->room_name);
-			janus_audiobridge_update_wav_header(audiobridge);
-		}
-		/* Update the reference time */
-		before.tv_usec += 20000;
-		if(before.tv_usec > 1000000) {
-			before.tv_sec++;
-			before.tv_usec -= 1000000;
+			JANUS_LOG(LOG_VERB, "Stopping recording %s (%s)...\n", audiobridge->room_id_str, audiobridge->room_name);
+			janus_audiobridge_mix_recording_stop(audiobridge);
 		}
 		/* Do we need to mix at all? */
 		janus_mutex_lock_nodebug(&audiobridge->mutex);
@@ -8371,127 +9967,49 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 			buffer[i] = 0;
 		if(groups_num > 0)
 			memset(groupBuffers, 0, groupBuffersSize);
+		contributors = 0;
+		speaker = NULL;
+		have_g711_mix = FALSE;
+		/* If we only mix the loudest speakers, pick them first */
+		if(audiobridge->top_speakers > 0)
+			janus_audiobridge_select_speakers(audiobridge, participants_list);
 		ps = participants_list;
 		while(ps) {
 			janus_audiobridge_participant *p = (janus_audiobridge_participant *)ps->data;
-			janus_mutex_lock(&p->qmutex);
+			if(audiobridge->top_speakers > 0 && !p->mixing) {
+				ps = ps->next;
+				continue;
+			}
 			if(g_atomic_int_get(&p->destroyed) || !p->session || !g_atomic_int_get(&p->session->started) ||
-					!g_atomic_int_get(&p->active) || p->muted || g_atomic_int_get(&p->suspended) || !p->inbuf) {
-				janus_mutex_unlock(&p->qmutex);
+					!g_atomic_int_get(&p->active) || p->muted || g_atomic_int_get(&p->suspended)) {
 				ps = ps->next;
 				continue;
 			}
-			GList *peek = g_list_first(p->inbuf);
-			janus_audiobridge_rtp_relay_packet *pkt = (janus_audiobridge_rtp_relay_packet *)(peek ? peek->data : NULL);
+			janus_audiobridge_rtp_relay_packet *pkt = janus_audiobridge_inbuf_peek(p->inbuf);
 			if(pkt != NULL && !pkt->silence) {
 				if(p->codec != JANUS_AUDIOCODEC_OPUS && audiobridge->sampling_rate != 8000) {
 					/* Upsample this to whatever the mixer needs */
 					pkt->length = janus_audiobridge_resample((opus_int16 *)pkt->data, 160, 8000, resampled, audiobridge->sampling_rate);
 					if(pkt->length == 0) {
 						JANUS_LOG(LOG_WARN, "[G.711] Error upsampling to %d, skipping audio packet\n", audiobridge->sampling_rate);
-						janus_mutex_unlock(&p->qmutex);
 						ps = ps->next;
 						continue;
 					}
 					memcpy(pkt->data, resampled, pkt->length*2);
 				}
 				curBuffer = (opus_int16 *)pkt->data;
+				janus_audiobridge_participant_gains(p, &lgain, &rgain);
 				if(groups_num == 0) {
 					/* Add to the main mix */
-					if(!p->stereo) {
-						for(i=0; i<samples; i++) {
-							if(p->volume_gain == 100) {
-								buffer[i] += curBuffer[i];
-							} else {
-								buffer[i] += (curBuffer[i]*p->volume_gain)/100;
-							}
-						}
-					} else {
-						diff = 50 - p->spatial_position;
-						lgain = 50 + diff;
-						rgain = 50 - diff;
-						for(i=0; i<samples; i++) {
-							if(i%2 == 0) {
-								if(lgain == 100) {
-									if(p->volume_gain == 100) {
-										buffer[i] += curBuffer[i];
-									} else {
-										buffer[i] += (curBuffer[i]*p->volume_gain)/100;
-									}
-								} else {
-									if(p->volume_gain == 100) {
-										buffer[i] += (curBuffer[i]*lgain)/100;
-									} else {
-										buffer[i] += (((curBuffer[i]*lgain)/100)*p->volume_gain)/100;
-									}
-								}
-							} else {
-								if(rgain == 100) {
-									if(p->volume_gain == 100) {
-										buffer[i] += curBuffer[i];
-									} else {
-										buffer[i] += (curBuffer[i]*p->volume_gain)/100;
-									}
-								} else {
-									if(p->volume_gain == 100) {
-										buffer[i] += (curBuffer[i]*rgain)/100;
-									} else {
-										buffer[i] += (((curBuffer[i]*rgain)/100)*p->volume_gain)/100;
-									}
-								}
-							}
-						}
-					}
+					mix_kernels.add(buffer, curBuffer, samples, lgain, rgain);
 				} else {
 					/* Add to the group submix */
 					int index = p->group-1;
-					if(!p->stereo) {
-						for(i=0; i<samples; i++) {
-							if(p->volume_gain == 100) {
-								*(groupBuffers + index*samples + i) += curBuffer[i];
-							} else {
-								*(groupBuffers + index*samples + i) += (curBuffer[i]*p->volume_gain)/100;
-							}
-						}
-					} else {
-						diff = 50 - p->spatial_position;
-						lgain = 50 + diff;
-						rgain = 50 - diff;
-						for(i=0; i<samples; i++) {
-							if(i%2 == 0) {
-								if(lgain == 100) {
-									if(p->volume_gain == 100) {
-										*(groupBuffers + index*samples + i) += curBuffer[i];
-									} else {
-										*(groupBuffers + index*samples + i) += (curBuffer[i]*p->volume_gain)/100;
-									}
-								} else {
-									if(p->volume_gain == 100) {
-										*(groupBuffers + index*samples + i) += (curBuffer[i]*lgain)/100;
-									} else {
-										*(groupBuffers + index*samples + i) += (((curBuffer[i]*lgain)/100)*p->volume_gain)/100;
-									}
-								}
-							} else {
-								if(rgain == 100) {
-									if(p->volume_gain == 100) {
-										*(groupBuffers + index*samples + i) += curBuffer[i];
-									} else {
-										*(groupBuffers + index*samples + i) += (curBuffer[i]*p->volume_gain)/100;
-									}
-								} else {
-									if(p->volume_gain == 100) {
-										*(groupBuffers + index*samples + i) += (curBuffer[i]*rgain)/100;
-									} else {
-										*(groupBuffers + index*samples + i) += (((curBuffer[i]*rgain)/100)*p->volume_gain)/100;
-									}
-								}
-							}
-						}
-					}
+					mix_kernels.add(groupBuffers + index*samples, curBuffer, samples, lgain, rgain);
 				}
+				contributors++;
+				speaker = p;
 			}
-			janus_mutex_unlock(&p->qmutex);
 			ps = ps->next;
 		}
 #ifdef HAVE_LIBOGG
@@ -8557,31 +10075,36 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 						gateway->notify_event(&janus_audiobridge_plugin, NULL, info);
 					}
 				}
+				lgain = rgain = (float)p->volume_gain/100.0f;
+				contributors++;
 				if(groups_num == 0) {
 					/* Add to the main mix */
-					for(i=0; i<samples; i++) {
-						if(p->volume_gain == 100) {
-							buffer[i] += resampled[i];
-						} else {
-							buffer[i] += (resampled[i]*p->volume_gain)/100;
-						}
-					}
+					mix_kernels.add(buffer, resampled, samples, lgain, rgain);
 				} else {
 					/* Add to the group submix */
 					index = p->group-1;
-					for(i=0; i<samples; i++) {
-						if(p->volume_gain == 100) {
-							*(groupBuffers + index*samples + i) += resampled[i];
-						} else {
-							*(groupBuffers + index*samples + i) += (resampled[i]*p->volume_gain)/100;
-						}
-					}
+					mix_kernels.add(groupBuffers + index*samples, resampled, samples, lgain, rgain);
 				}
 				ps = ps->next;
 			}
 			g_list_free_full(anncs_list, (GDestroyNotify)janus_audiobridge_participant_unref);
 		}
 #endif
+		/* If only one participant is talking, check if we can just forward what they sent */
+		passthrough = NULL;
+		if(audiobridge->opus_passthrough && contributors == 1 && speaker != NULL && speaker->volume_gain == 100
+#ifdef HAVE_RNNOISE
+				&& !speaker->denoise
+#endif
+				) {
+			janus_audiobridge_rtp_relay_packet *pkt = janus_audiobridge_inbuf_peek(speaker->inbuf);
+			if(pkt != NULL && pkt->encoded != NULL) {
+				passthrough = pkt->encoded;
+				janus_refcount_increase(&passthrough->ref);
+			}
+			if(passthrough != NULL)
+				g_atomic_int_inc(&audiobridge->passthrough_frames);
+		}
 		/* If groups are in use, put them together in the main mix */
 		if(groups_num > 0) {
 			/* Mix all submixes */
@@ -8592,29 +10115,9 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 		}
 		/* Are we recording the mix? (only do it if there's someone in, though...) */
 		if(audiobridge->recording != NULL && g_list_length(participants_list) > 0) {
-			for(i=0; i<samples; i++) {
-				/* FIXME Smoothen/Normalize instead of truncating? */
-				outBuffer[i] = buffer[i];
-			}
-			fwrite(outBuffer, sizeof(opus_int16), samples, audiobridge->recording);
-			/* Every 5 seconds we update the wav header */
-			gint64 now = janus_get_monotonic_time();
-			if(now - audiobridge->record_lastupdate >= 5*G_USEC_PER_SEC) {
-				audiobridge->record_lastupdate = now;
-				/* Update the length in the header */
-				fseek(audiobridge->recording, 0, SEEK_END);
-				long int size = ftell(audiobridge->recording);
-				if(size >= 8) {
-					size -= 8;
-					fseek(audiobridge->recording, 4, SEEK_SET);
-					fwrite(&size, sizeof(uint32_t), 1, audiobridge->recording);
-					size += 8;
-					fseek(audiobridge->recording, 40, SEEK_SET);
-					fwrite(&size, sizeof(uint32_t), 1, audiobridge->recording);
-					fflush(audiobridge->recording);
-					fseek(audiobridge->recording, 0, SEEK_END);
-				}
-			}
+			/* FIXME Smoothen/Normalize instead of saturating? */
+			mix_kernels.saturate(outBuffer, buffer, samples);
+			janus_audiobridge_mix_recording_write(audiobridge, outBuffer, samples);
 		}
 		/* Send proper packet to each participant (remove own contribution) */
 		ps = participants_list;
@@ -8627,55 +10130,48 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 				continue;
 			}
 			janus_audiobridge_rtp_relay_packet *pkt = NULL;
-			janus_mutex_lock(&p->qmutex);
-			if(g_atomic_int_get(&p->active) && !p->muted && p->inbuf) {
-				GList *first = g_list_first(p->inbuf);
-				pkt = (janus_audiobridge_rtp_relay_packet *)(first ? first->data : NULL);
-				p->inbuf = g_list_delete_link(p->inbuf, first);
-			}
-			janus_mutex_unlock(&p->qmutex);
+			if(g_atomic_int_get(&p->active) && !p->muted)
+				pkt = janus_audiobridge_inbuf_peek(p->inbuf);
 			/* Remove the participant's own contribution */
-			curBuffer = (opus_int16 *)((pkt && pkt->length && !pkt->silence) ? pkt->data : NULL);
-			if(!p->stereo) {
-				for(i=0; i<samples; i++) {
-					if(p->volume_gain == 100)
-						sumBuffer[i] = buffer[i] - (curBuffer ? (curBuffer[i]) : 0);
-					else
-						sumBuffer[i] = buffer[i] - (curBuffer ? (curBuffer[i]*p->volume_gain)/100 : 0);
-				}
+			curBuffer = (opus_int16 *)((pkt && pkt->length && !pkt->silence &&
+				(audiobridge->top_speakers == 0 || p->mixing)) ? pkt->data : NULL);
+			if(curBuffer != NULL) {
+				janus_audiobridge_participant_gains(p, &lgain, &rgain);
+				mix_kernels.sub(sumBuffer, buffer, curBuffer, samples, lgain, rgain);
+				/* FIXME Smoothen/Normalize instead of saturating? */
+				mix_kernels.saturate(outBuffer, sumBuffer, samples);
 			} else {
-				diff = 50 - p->spatial_position;
-				lgain = 50 + diff;
-				rgain = 50 - diff;
-				for(i=0; i<samples; i++) {
-					if(i%2 == 0) {
-						if(lgain == 100) {
-							sumBuffer[i] = buffer[i] - (curBuffer ? (curBuffer[i]) : 0);
-						} else {
-							sumBuffer[i] = buffer[i] - (curBuffer ? (curBuffer[i]*lgain)/100 : 0);
-						}
-					} else {
-						if(rgain == 100) {
-							sumBuffer[i] = buffer[i] - (curBuffer ? (curBuffer[i]) : 0);
-						} else {
-							sumBuffer[i] = buffer[i] - (curBuffer ? (curBuffer[i]*rgain)/100 : 0);
-						}
-					}
-				}
+				mix_kernels.saturate(outBuffer, buffer, samples);
 			}
-			for(i=0; i<samples; i++)
-				/* FIXME Smoothen/Normalize instead of truncating? */
-				outBuffer[i] = sumBuffer[i];
 			/* Enqueue this mixed frame for encoding in the participant thread */
 			janus_audiobridge_rtp_relay_packet *mixedpkt = g_malloc(sizeof(janus_audiobridge_rtp_relay_packet));
 			mixedpkt->data = g_malloc(samples*2);
-			if(p->codec != JANUS_AUDIOCODEC_OPUS && audiobridge->sampling_rate != 8000) {
+			if(p->codec != JANUS_AUDIOCODEC_OPUS && audiobridge->sampling_rate != 8000 && !audiobridge->spatial_audio) {
+				/* Downsample this from whatever the mixer uses, sharing the work */
+				int down = audiobridge->sampling_rate/8000;
+				if(!have_g711_mix) {
+					for(i=0; i<G711_SAMPLES; i++)
+						g711Mix[i] = buffer[i*down];
+					mix_kernels.saturate(g711Out, g711Mix, G711_SAMPLES);
+					have_g711_mix = TRUE;
+				}
+				if(curBuffer == NULL) {
+					memcpy(mixedpkt->data, g711Out, G711_SAMPLES*2);
+				} else {
+					for(i=0; i<G711_SAMPLES; i++)
+						g711Own[i] = curBuffer[i*down];
+					mix_kernels.sub(g711Sum, g711Mix, g711Own, G711_SAMPLES, lgain, rgain);
+					mix_kernels.saturate((opus_int16 *)mixedpkt->data, g711Sum, G711_SAMPLES);
+				}
+			} else if(p->codec != JANUS_AUDIOCODEC_OPUS && audiobridge->sampling_rate != 8000) {
 				/* Downsample this from whatever the mixer uses */
 				i = janus_audiobridge_resample(outBuffer, samples, audiobridge->sampling_rate, (int16_t *)mixedpkt->data, 8000);
 				if(i == 0) {
 					JANUS_LOG(LOG_WARN, "[G.711] Error downsampling from %d, skipping audio packet\n", audiobridge->sampling_rate);
 					g_free(mixedpkt->data);
 					g_free(mixedpkt);
+					if(pkt)
+						janus_audiobridge_inbuf_release(p->inbuf);
 					janus_refcount_decrease(&p->ref);
 					ps = ps->next;
 					continue;
@@ -8689,17 +10185,108 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 			mixedpkt->seq_number = seq;
 			mixedpkt->ssrc = audiobridge->room_ssrc;
 			mixedpkt->silence = FALSE;
-			g_async_queue_push(p->outbuf, mixedpkt);
+			mixedpkt->level = -1;
+			mixedpkt->encoded = NULL;
+			if(passthrough != NULL && p != speaker && p->codec == JANUS_AUDIOCODEC_OPUS) {
+				/* The speaker is the only one talking: this participant gets what they sent */
+				janus_refcount_increase(&passthrough->ref);
+				mixedpkt->encoded = passthrough;
+			} else if(shared_encoders != NULL && curBuffer == NULL && p->codec == JANUS_AUDIOCODEC_OPUS && p->encoder != NULL) {
+				/* This participant gets the full mix, so we can encode it once for all */
+				if(shared_now == 0)
+					shared_now = janus_get_monotonic_time();
+				mixedpkt->encoded = janus_audiobridge_shared_encode(shared_encoders, audiobridge, p,
+					outBuffer, samples, ts, shared_now);
+			} else if(p->codec == JANUS_AUDIOCODEC_PCMA || p->codec == JANUS_AUDIOCODEC_PCMU) {
+				janus_audiobridge_encoded_frame **shared = (p->codec == JANUS_AUDIOCODEC_PCMA ? &shared_alaw : &shared_ulaw);
+				if(curBuffer == NULL) {
+					/* This participant gets the full mix, so we can encode it once for all */
+					if(*shared == NULL)
+						*shared = janus_audiobridge_g711_encode_frame(p->codec, (opus_int16 *)mixedpkt->data);
+					janus_refcount_increase(&(*shared)->ref);
+					mixedpkt->encoded = *shared;
+				} else if(p->plainrtp && p->plainrtp_media.audio_rtp_fd > 0) {
+					mixedpkt->encoded = janus_audiobridge_g711_encode_frame(p->codec, (opus_int16 *)mixedpkt->data);
+				}
+			}
+			if(mixedpkt->encoded != NULL && p->codec != JANUS_AUDIOCODEC_OPUS &&
+					p->plainrtp && p->plainrtp_media.audio_rtp_fd > 0) {
+				/* This is a plain RTP leg: leave it to the plain RTP sender */
+				janus_audiobridge_plainrtp_frame *pf = g_malloc(sizeof(janus_audiobridge_plainrtp_frame));
+				janus_refcount_increase(&p->ref);
+				janus_refcount_increase(&p->session->ref);
+				pf->participant = p;
+				pf->frame = mixedpkt->encoded;
+				pf->ssrc = mixedpkt->ssrc;
+				pf->timestamp = mixedpkt->timestamp;
+				pf->seq_number = mixedpkt->seq_number;
+				if(plainrtp_batch == NULL)
+					plainrtp_batch = g_ptr_array_new();
+				g_ptr_array_add(plainrtp_batch, pf);
+				g_free(mixedpkt->data);
+				g_free(mixedpkt);
+			} else if(encoders == NULL) {
+				g_async_queue_push(p->outbuf, mixedpkt);
+				janus_audiobridge_worker *w = p->worker;
+				if(w != NULL) {
+					/* Let the worker know there's something to encode for this participant */
+					janus_mutex_lock(&w->mutex);
+					if(p->worker == w && g_atomic_int_compare_and_exchange(&p->encode_queued, 0, 1)) {
+						g_queue_push_tail(w->encodes, p);
+						g_cond_signal(&w->cond);
+					}
+					janus_mutex_unlock(&w->mutex);
+				}
+			} else if(g_atomic_int_compare_and_exchange(&p->encode_pending, 0, 1)) {
+				/* Have a worker encode and send this frame: the references are released there */
+				janus_refcount_increase(&p->ref);
+				janus_refcount_increase(&p->session->ref);
+				janus_audiobridge_encode_job *job = g_malloc(sizeof(janus_audiobridge_encode_job));
+				job->participant = p;
+				job->mixedpkt = mixedpkt;
+				g_thread_pool_push(encoders, job, NULL);
+				dispatched++;
+			} else {
+				/* The previous frame for this participant is still waiting to be encoded */
+				g_atomic_int_inc(&p->encode_late);
+				if(mixedpkt->encoded)
+					janus_refcount_decrease(&mixedpkt->encoded->ref);
+				g_free(mixedpkt->data);
+				g_free(mixedpkt);
+			}
 			if(pkt) {
-				g_free(pkt->data);
-				pkt->data = NULL;
-				g_free(pkt);
+				janus_audiobridge_inbuf_release(p->inbuf);
 				pkt = NULL;
 			}
 			janus_refcount_decrease(&p->ref);
 			ps = ps->next;
 		}
 		g_list_free(participants_list);
+		if(passthrough != NULL) {
+			janus_refcount_decrease(&passthrough->ref);
+			passthrough = NULL;
+		}
+		if(shared_alaw != NULL) {
+			janus_refcount_decrease(&shared_alaw->ref);
+			shared_alaw = NULL;
+		}
+		if(shared_ulaw != NULL) {
+			janus_refcount_decrease(&shared_ulaw->ref);
+			shared_ulaw = NULL;
+		}
+		if(plainrtp_batch != NULL) {
+			g_async_queue_push(plainrtp_batches, plainrtp_batch);
+			plainrtp_batch = NULL;
+		}
+		if(shared_encoders != NULL) {
+			/* Get rid of the shared encoders nobody used for a while */
+			shared_now = janus_get_monotonic_time();
+			if(shared_now - shared_cleanup >= G_USEC_PER_SEC) {
+				shared_cleanup = shared_now;
+				g_hash_table_foreach_remove(shared_encoders, janus_audiobridge_shared_encoder_expired, &shared_now);
+			}
+			shared_now = 0;
+		}
 		/* Forward the mixed packet as RTP to any RTP forwarder that may be listening */
 		janus_mutex_lock(&audiobridge->rtp_mutex);
 		if(g_hash_table_size(audiobridge->rtp_forwarders) > 0 && audiobridge->rtp_encoder) {
@@ -8723,8 +10310,7 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 			if(go_on) {
 				/* By default, let's send the mixed frame to everybody */
 				if(groups_num == 0) {
-					for(i=0; i<samples; i++)
-						outBuffer[i] = buffer[i];
+					mix_kernels.saturate(outBuffer, buffer, samples);
 					have_opus[0] = FALSE;
 					have_alaw[0] = FALSE;
 					have_ulaw[0] = FALSE;
@@ -8739,6 +10325,8 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 				gpointer key, value;
 				g_hash_table_iter_init(&iter, audiobridge->rtp_forwarders);
 				opus_int32 length = 0;
+				/* Send the packets to all forwarders at once */
+				janus_rtp_forwarder_batch *batch = janus_rtp_forwarder_batch_new();
 				while(audiobridge->rtp_udp_sock > 0 && g_hash_table_iter_next(&iter, &key, &value)) {
 					janus_rtp_forwarder *rf = (janus_rtp_forwarder *)value;
 					janus_audiobridge_rtp_forwarder_metadata *rfm = (janus_audiobridge_rtp_forwarder_metadata *)rf->metadata;
@@ -8748,13 +10336,11 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 					if(groups_num > 0) {
 						if(rfm->group == 0) {
 							/* We're forwarding the main mix */
-							for(i=0; i<samples; i++)
-								outBuffer[i] = buffer[i];
+							mix_kernels.saturate(outBuffer, buffer, samples);
 						} else {
 							/* We're forwarding a group mix */
 							index = rfm->group-1;
-							for(i=0; i<samples; i++)
-								outBuffer[i] = *(groupBuffers + index*samples + i);
+							mix_kernels.saturate(outBuffer, groupBuffers + index*samples, samples);
 						}
 					}
 					if(rfm->codec == JANUS_AUDIOCODEC_OPUS) {
@@ -8762,9 +10348,11 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 						if(!have_opus[rfm->group]) {
 							/* We don't, encode now */
 							OpusEncoder *rtp_encoder = (rfm->group == 0 ? audiobridge->rtp_encoder : groupEncoders[rfm->group-1]);
+							gint64 encode_start = janus_get_monotonic_time();
 							length = opus_encode(rtp_encoder, outBuffer,
 								audiobridge->spatial_audio ? samples/2 : samples,
 								rtpbuffer + rfm->group*1500 + 12, 1500-12);
+							janus_usage_add(&audiobridge->usage, JANUS_USAGE_ENCODE_TIME, janus_get_monotonic_time() - encode_start);
 							if(length < 0) {
 								JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error encoding the Opus frame: %d (%s)\n", length, opus_strerror(length));
 								continue;
@@ -8814,21 +10402,74 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 					rfm->timestamp += (rfm->codec == JANUS_AUDIOCODEC_OPUS ? OPUS_SAMPLES : G711_SAMPLES);
 					rtph->timestamp = htonl(rfm->timestamp);
 					/* Forward the packet */
-					janus_rtp_forwarder_send_rtp(rf, (char *)rtph, length+12, -1);
+					janus_rtp_forwarder_batch_add(batch, rf, (char *)rtph, length+12, -1,
+						NULL, NULL, JANUS_VIDEOCODEC_NONE, NULL);
+					janus_usage_packets_out(&audiobridge->usage, 1, length+12, rf->is_srtp);
 				}
+				janus_rtp_forwarder_batch_send(batch);
 			}
 		}
 		janus_mutex_unlock(&audiobridge->rtp_mutex);
+		if(dispatched > 0) {
+			/* Wait for the workers to encode this frame for all participants, but not past the next tick */
+			gint64 until = (gint64)deadline.tv_sec*G_USEC_PER_SEC + deadline.tv_nsec/1000 + 20000;
+			while(dispatched > 0) {
+				gint64 timeout = until - janus_get_monotonic_time();
+				gpointer done = timeout > 0 ? g_async_queue_timeout_pop(encoded, timeout) : NULL;
+				if(done == NULL) {
+					/* Some workers didn't make it in time */
+					g_atomic_int_inc(&audiobridge->late_frames);
+					break;
+				}
+				if(GPOINTER_TO_UINT(done) == (guint)seq + 1)
+					dispatched--;
+			}
+			dispatched = 0;
+		}
+		tick_end = janus_get_monotonic_time();
+		g_atomic_int_inc(&audiobridge->mix_time[janus_audiobridge_histogram_bucket(janus_audiobridge_time_buckets,
+			tick_end - tick_start)]);
+		janus_usage_thread_update(&audiobridge->usage, &cpu_last);
+		/* Periodically notify the statistics to event handlers, if needed */
+		if(stats_interval > 0 && tick_end - stats_last >= (gint64)stats_interval*G_USEC_PER_SEC) {
+			stats_last = tick_end;
+			if(notify_events && gateway->events_is_enabled()) {
+				json_t *info = janus_audiobridge_room_stats(audiobridge);
+				json_object_set_new(info, "event", json_string("stats"));
+				json_object_set_new(info, "room", string_ids ? json_string(audiobridge->room_id_str) : json_integer(audiobridge->room_id));
+				json_t *list = json_array();
+				janus_mutex_lock_nodebug(&audiobridge->mutex);
+				GHashTableIter iter;
+				gpointer value;
+				g_hash_table_iter_init(&iter, audiobridge->participants);
+				while(g_hash_table_iter_next(&iter, NULL, &value)) {
+					janus_audiobridge_participant *p = value;
+					json_t *pl = janus_audiobridge_participant_stats(p);
+					json_object_set_new(pl, "id", string_ids ? json_string(p->user_id_str) : json_integer(p->user_id));
+					json_array_append_new(list, pl);
+				}
+				janus_mutex_unlock_nodebug(&audiobridge->mutex);
+				json_object_set_new(info, "participants", list);
+				gateway->notify_event(&janus_audiobridge_plugin, NULL, info);
+			}
+		}
 	}
 	/* Close the recording file */
 	if(audiobridge->recording != NULL && g_atomic_int_get(&audiobridge->wav_header_added)) {
-		JANUS_LOG(LOG_VERB, "Update wave header for recording %s (%s)...\n", audiobridge->room_id_str, audiobridge->room_name);
-		janus_audiobridge_update_wav_header(audiobridge);
+		JANUS_LOG(LOG_VERB, "Stopping recording %s (%s)...\n", audiobridge->room_id_str, audiobridge->room_name);
+		janus_audiobridge_mix_recording_stop(audiobridge);
 	}
 	g_free(rtpbuffer);
 	g_free(rtpalaw);
 	g_free(rtpulaw);
 	g_free(groupBuffers);
+	if(encoders != NULL) {
+		/* Wait for the workers to be done before getting rid of them */
+		g_thread_pool_free(encoders, FALSE, TRUE);
+		g_async_queue_unref(encoded);
+	}
+	if(shared_encoders != NULL)
+		g_hash_table_destroy(shared_encoders);
 	if(groupEncoders) {
 		for(index=0; index<groups_num; index++) {
 			if(groupEncoders[index])
@@ -8837,6 +10478,8 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 		g_free(groupEncoders);
 	}
 	JANUS_LOG(LOG_VERB, "Leaving mixer thread for room %s (%s)...\n", audiobridge->room_id_str, audiobridge->room_name);
+	janus_usage_thread_update(&audiobridge->usage, &cpu_last);
+	janus_sched_thread_stop();
 
 	janus_refcount_decrease(&audiobridge->ref);
 
@@ -8844,6 +10487,333 @@ static void *janus_audiobridge_mixer_thread(void *data) {
 	return NULL;
 }
 
+/* Helper to encode a mixed frame and send it to a specific participant */
+static void janus_audiobridge_participant_send_mixed(janus_audiobridge_participant *participant,
+		janus_audiobridge_rtp_relay_packet *mixedpkt, janus_audiobridge_rtp_relay_packet *outpkt) {
+	uint8_t *payload = (uint8_t *)outpkt->data;
+	if(g_atomic_int_get(&participant->active) && (participant->codec == JANUS_AUDIOCODEC_PCMA ||
+			participant->codec == JANUS_AUDIOCODEC_PCMU) && g_atomic_int_compare_and_exchange(&participant->encoding, 0, 1)) {
+		/* Encode using G.711 */
+		if(mixedpkt->length != 320) {
+			/* TODO Resample */
+		}
+		int i = 0;
+		opus_int16 *outBuffer = (opus_int16 *)mixedpkt->data;
+		if(mixedpkt->encoded != NULL) {
+			/* The mixer already encoded this frame for us */
+			memcpy(payload+12, mixedpkt->encoded->data, G711_SAMPLES);
+		} else if(participant->codec == JANUS_AUDIOCODEC_PCMA) {
+			/* A-law */
+			for(i=0; i<160; i++)
+				*(payload+12+i) = janus_audiobridge_g711_alaw_encode(outBuffer[i]);
+		} else {
+			/* Mu-Law */
+			for(i=0; i<160; i++)
+				*(payload+12+i) = janus_audiobridge_g711_ulaw_encode(outBuffer[i]);
+		}
+		g_atomic_int_set(&participant->encoding, 0);
+		outpkt->length = 172;	/* Take the RTP header into consideration */
+		/* Update RTP header */
+		outpkt->data->version = 2;
+		outpkt->data->markerbit = 0;	/* FIXME Should be 1 for the first packet */
+		outpkt->data->seq_number = htons(mixedpkt->seq_number);
+		outpkt->data->timestamp = htonl(mixedpkt->timestamp/6);
+		outpkt->data->ssrc = htonl(mixedpkt->ssrc);	/* The Janus core will fix this anyway */
+		/* Backup the actual timestamp and sequence number set by the audiobridge, in case a room is changed */
+		outpkt->ssrc = mixedpkt->ssrc;
+		outpkt->timestamp = mixedpkt->timestamp/6;
+		outpkt->seq_number = mixedpkt->seq_number;
+		janus_audiobridge_relay_rtp_packet(participant->session, outpkt);
+	} else if(g_atomic_int_get(&participant->active) && participant->encoder &&
+			g_atomic_int_compare_and_exchange(&participant->encoding, 0, 1)) {
+		if(mixedpkt->encoded != NULL) {
+			/* The mixer already encoded this frame for us */
+			memcpy(payload+12, mixedpkt->encoded->data, mixedpkt->encoded->length);
+			outpkt->length = mixedpkt->encoded->length;
+		} else {
+			/* Encode raw frame to Opus */
+			opus_int16 *outBuffer = (opus_int16 *)mixedpkt->data;
+			gint64 start = janus_get_monotonic_time();
+			outpkt->length = opus_encode(participant->encoder, outBuffer,
+				participant->stereo ? mixedpkt->length/2 : mixedpkt->length, payload+12, 1500-12);
+			gint64 encode_time = janus_get_monotonic_time() - start;
+			g_atomic_int_inc(&participant->encode_time[janus_audiobridge_histogram_bucket(janus_audiobridge_time_buckets,
+				encode_time)]);
+			janus_audiobridge_room *audiobridge = participant->room;
+			if(audiobridge != NULL)
+				janus_usage_add(&audiobridge->usage, JANUS_USAGE_ENCODE_TIME, encode_time);
+		}
+		g_atomic_int_set(&participant->encoding, 0);
+		if(outpkt->length < 0) {
+			JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error encoding the Opus frame: %d (%s)\n", outpkt->length, opus_strerror(outpkt->length));
+		} else {
+			outpkt->length += 12;	/* Take the RTP header into consideration */
+			/* Update RTP header */
+			outpkt->data->version = 2;
+			outpkt->data->markerbit = 0;	/* FIXME Should be 1 for the first packet */
+			outpkt->data->seq_number = htons(mixedpkt->seq_number);
+			outpkt->data->timestamp = htonl(mixedpkt->timestamp);
+			outpkt->data->ssrc = htonl(mixedpkt->ssrc);	/* The Janus core will fix this anyway */
+			/* Backup the actual timestamp and sequence number set by the audiobridge, in case a room is changed */
+			outpkt->ssrc = mixedpkt->ssrc;
+			outpkt->timestamp = mixedpkt->timestamp;
+			outpkt->seq_number = mixedpkt->seq_number;
+			janus_audiobridge_relay_rtp_packet(participant->session, outpkt);
+		}
+	}
+}
+
+/* Helper to check whether a packet from a participant can be skipped, that is
+ * if it's an Opus DTX frame, or the audio level says it's below the threshold */
+static gboolean janus_audiobridge_participant_is_silent(janus_audiobridge_participant *participant,
+		janus_plugin_rtp *packet, int plen) {
+	if(participant->codec == JANUS_AUDIOCODEC_OPUS && plen <= 2)
+		return TRUE;
+	if(participant->extmap_id < 1 || packet == NULL || packet->extensions.audio_level == -1)
+		return FALSE;
+	janus_audiobridge_room *audiobridge = participant->room;
+	return packet->extensions.audio_level >= (audiobridge ? audiobridge->silence_threshold : 127);
+}
+
+/* Producer side: get the slot to decode the next frame to (the spare one, if the ring is full) */
+static janus_audiobridge_rtp_relay_packet *janus_audiobridge_inbuf_slot(janus_audiobridge_inbuf *inbuf) {
+	guint queued = inbuf->reserved - (guint)g_atomic_int_get(&inbuf->tail);
+	if(queued > QUEUE_IN_MAX_PACKETS && !g_atomic_int_get(&inbuf->clear)) {
+		/* Do not let queue-in grow too much */
+		JANUS_LOG(LOG_WARN, "Participant queue-in contains too many packets, clearing now (count=%u)\n", queued);
+		g_atomic_int_set(&inbuf->clear, 1);
+	}
+	janus_audiobridge_rtp_relay_packet *pkt = (queued < JANUS_AUDIOBRIDGE_INBUF_SLOTS) ?
+		&inbuf->slots[inbuf->reserved & (JANUS_AUDIOBRIDGE_INBUF_SLOTS-1)] : &inbuf->spare;
+	if(pkt->data == NULL)
+		pkt->data = g_malloc0(BUFFER_SAMPLES * sizeof(opus_int16));
+	if(pkt->encoded) {
+		/* Only the spare slot may still have this */
+		janus_refcount_decrease(&pkt->encoded->ref);
+		pkt->encoded = NULL;
+	}
+	return pkt;
+}
+
+/* Producer side: publish the oldest slot that was filled and not published yet */
+static void janus_audiobridge_inbuf_publish(janus_audiobridge_inbuf *inbuf) {
+	g_atomic_int_inc(&inbuf->head);
+}
+
+/* Helper to denoise a decoded packet (the slot we got from the ring), if
+ * needed, before publishing it for the mixer */
+static void janus_audiobridge_participant_decoded(janus_audiobridge_participant *participant, janus_audiobridge_rtp_relay_packet *pkt) {
+	janus_audiobridge_inbuf *inbuf = participant->inbuf;
+	if(pkt == &inbuf->spare) {
+		/* There was no room for this frame */
+		g_atomic_int_inc(&inbuf->dropped);
+		return;
+	}
+	inbuf->reserved++;
+#ifdef HAVE_RNNOISE
+	/* Once a participant has a denoiser, all its frames go through there, to keep them in order */
+	if(participant->denoise || participant->denoiser != NULL) {
+		if(denoisers != NULL) {
+			/* Hand the packet to the denoiser this participant is assigned to */
+			if(participant->denoiser == NULL) {
+				int i = 0, index = g_atomic_int_add(&denoisers_next, 1);
+				for(i=0; i<denoise_threads; i++) {
+					janus_audiobridge_denoiser *d = &denoisers[(index+i) % denoise_threads];
+					if(d->thread != NULL) {
+						participant->denoiser = d;
+						g_atomic_int_inc(&d->count);
+						break;
+					}
+				}
+			}
+			if(participant->denoiser != NULL) {
+				janus_audiobridge_denoise_frame *frame = g_malloc(sizeof(janus_audiobridge_denoise_frame));
+				janus_refcount_increase(&participant->ref);
+				frame->participant = participant;
+				frame->pkt = pkt;
+				g_async_queue_push(participant->denoiser->frames, frame);
+				return;
+			}
+		}
+		if(participant->denoise)
+			janus_audiobridge_participant_denoise(participant, (char *)pkt->data, pkt->length);
+	}
+#endif
+	janus_audiobridge_inbuf_publish(inbuf);
+}
+
+/* Helper to get the next packet out of the jitter buffer of a participant and
+ * decode it (or use PLC, if it's missing), queueing the result for the mixer:
+ * returns FALSE in case of errors, which means we should stop serving them */
+static gboolean janus_audiobridge_participant_decode(janus_audiobridge_participant *participant) {
+	if(participant->jitter == NULL)
+		return TRUE;
+	janus_audiobridge_session *session = participant->session;
+	JitterBufferPacket jbp = {0};
+	janus_audiobridge_buffer_packet buffered;
+	janus_audiobridge_buffer_packet *bpkt = NULL;
+	janus_audiobridge_rtp_relay_packet *pkt = NULL;
+	janus_rtp_header *rtp = NULL;
+	int ret = 0;
+	jbp.data = (char *)&buffered;
+	jbp.len = sizeof(buffered);
+	janus_mutex_lock(&participant->qmutex);
+	ret = jitter_buffer_get(participant->jitter, &jbp, participant->codec == JANUS_AUDIOCODEC_OPUS ? 960 : 160, NULL);
+	participant->jitter_ticks++;
+	/* Adjust the buffer size every 50 ticks (~1 second) */
+	if(participant->jitter_ticks == JITTER_BUFFER_MAX_PACKETS) {
+		jitter_buffer_update_delay(participant->jitter, NULL, NULL);
+		participant->jitter_ticks = 0;
+	}
+	jitter_buffer_tick(participant->jitter);
+	janus_mutex_unlock(&participant->qmutex);
+	if(ret != JITTER_BUFFER_OK) {
+		/* We didn't get a packet: check if PLC can help */
+		if(!participant->decode_first && participant->silent_frames == 0 && participant->codec == JANUS_AUDIOCODEC_OPUS &&
+				participant->lost_packets_gap <= JITTER_BUFFER_MAX_GAP_SIZE && !participant->muted) {
+			participant->lost_packets_gap++;
+			if(!g_atomic_int_compare_and_exchange(&participant->decoding, 0, 1)) {
+				/* This means we're cleaning up, so don't try to decode */
+				return FALSE;
+			}
+			int32_t output_samples = 0;
+			opus_decoder_ctl(participant->decoder, OPUS_GET_LAST_PACKET_DURATION(&output_samples));
+			/* Prepare a fake packet we can queue */
+			pkt = janus_audiobridge_inbuf_slot(participant->inbuf);
+			pkt->ssrc = 0;
+			pkt->timestamp = participant->last_timestamp + OPUS_SAMPLES;
+			pkt->seq_number = participant->last_seq + 1;
+			/* This is a redundant packet, so we can't parse any extension info */
+			pkt->silence = FALSE;
+			pkt->level = -1;
+			pkt->encoded = NULL;
+			janus_audiobridge_participant_istalking(session, participant, NULL, NULL);
+			pkt->length = opus_decode(participant->decoder, NULL, 0, (opus_int16 *)pkt->data, output_samples, 0);
+			/* Update the details */
+			participant->last_seq = pkt->seq_number;
+			participant->last_timestamp = pkt->timestamp;
+			g_atomic_int_set(&participant->decoding, 0);
+			if(pkt->length < 0) {
+				JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error decoding the Opus frame: %d (%s)\n", pkt->length, opus_strerror(pkt->length));
+				return FALSE;
+			}
+			g_atomic_int_inc(&participant->plc_frames);
+			/* Queue the decoded packet for the mixer */
+			janus_audiobridge_participant_decoded(participant, pkt);
+		} else {
+			/* No packet in the jitter buffer? Move on the talking detection, if needed */
+			janus_audiobridge_participant_istalking(session, participant, NULL, NULL);
+		}
+	} else {
+		/* Decode the audio packet */
+		bpkt = (janus_audiobridge_buffer_packet *)jbp.data;
+		janus_audiobridge_buffer_packet_fix(bpkt);
+		g_atomic_int_inc(&participant->jitter_delay[janus_audiobridge_histogram_bucket(janus_audiobridge_delay_buckets,
+			(janus_get_monotonic_time() - bpkt->inserted)/1000)]);
+		if(!g_atomic_int_compare_and_exchange(&participant->decoding, 0, 1)) {
+			/* This means we're cleaning up, so don't try to decode */
+			return FALSE;
+		}
+		/* Access the payload */
+		char *buffer = bpkt->rtp ? bpkt->rtp->buffer : NULL;
+		uint16_t len = bpkt->rtp ? bpkt->rtp->length : 0;
+		int plen = 0;
+		const unsigned char *payload = (const unsigned char *)janus_rtp_payload(buffer, len, &plen);
+		if(!payload) {
+			JANUS_LOG(LOG_ERR, "[%s] Ops! got an error accessing the RTP payload\n",
+				participant->codec == JANUS_AUDIOCODEC_OPUS ? "Opus" : "G.711");
+			g_atomic_int_set(&participant->decoding, 0);
+			return FALSE;
+		}
+		rtp = (janus_rtp_header *)buffer;
+		participant->decode_first = FALSE;
+		participant->lost_packets_gap = 0;
+		if(janus_audiobridge_participant_is_silent(participant, bpkt->rtp, plen)) {
+			/* Nothing worth decoding or mixing: just keep the talking detection going */
+			janus_audiobridge_participant_istalking(session, participant, bpkt->rtp, NULL);
+			participant->last_seq = ntohs(rtp->seq_number);
+			participant->last_timestamp = ntohl(rtp->timestamp);
+			participant->silent_frames++;
+			g_atomic_int_inc(&participant->skipped_frames);
+			g_atomic_int_set(&participant->decoding, 0);
+			return TRUE;
+		}
+		/* Decode the packet */
+		pkt = janus_audiobridge_inbuf_slot(participant->inbuf);
+		if(participant->silent_frames > 0) {
+			/* We skipped some frames, so let PLC bring the decoder state up to date before decoding this one */
+			if(participant->codec == JANUS_AUDIOCODEC_OPUS) {
+				int32_t output_samples = 0;
+				opus_decoder_ctl(participant->decoder, OPUS_GET_LAST_PACKET_DURATION(&output_samples));
+				if(output_samples > 0)
+					opus_decode(participant->decoder, NULL, 0, (opus_int16 *)pkt->data, output_samples, 0);
+			}
+			participant->silent_frames = 0;
+		}
+		pkt->ssrc = 0;
+		pkt->timestamp = ntohl(rtp->timestamp);
+		pkt->seq_number = ntohs(rtp->seq_number);
+		/* Check the audio level extension to see if this is silence */
+		pkt->silence = FALSE;
+		pkt->level = participant->extmap_id > 0 && bpkt->rtp ? bpkt->rtp->extensions.audio_level : -1;
+		pkt->encoded = NULL;
+		janus_audiobridge_participant_istalking(session, participant, bpkt->rtp, &pkt->silence);
+		pkt->length = 0;
+		gint64 decode_start = janus_get_monotonic_time();
+		janus_audiobridge_room *audiobridge = participant->room;
+		if(participant->codec == JANUS_AUDIOCODEC_OPUS) {
+			/* Opus */
+			pkt->length = opus_decode(participant->decoder, payload, plen, (opus_int16 *)pkt->data, BUFFER_SAMPLES, 0);
+			if(pkt->length > 0 && audiobridge && audiobridge->opus_passthrough && !audiobridge->spatial_audio &&
+					plen <= 1500-12 && opus_packet_get_nb_samples(payload, plen, 48000) == 960) {
+				/* Keep the original payload too, in case the mixer can forward it as it is */
+				janus_audiobridge_encoded_frame *frame = g_malloc(sizeof(janus_audiobridge_encoded_frame));
+				frame->data = g_malloc(plen);
+				memcpy(frame->data, payload, plen);
+				frame->length = plen;
+				janus_refcount_init(&frame->ref, janus_audiobridge_encoded_frame_free);
+				pkt->encoded = frame;
+			}
+		} else if(participant->codec == JANUS_AUDIOCODEC_PCMA || participant->codec == JANUS_AUDIOCODEC_PCMU) {
+			/* G.711 */
+			if(plen != 160) {
+				JANUS_LOG(LOG_WARN, "[G.711] Wrong packet size (expected 160, got %d), skipping audio packet\n", plen);
+				g_atomic_int_set(&participant->decoding, 0);
+				return FALSE;
+			}
+			int i = 0;
+			uint16_t *samples = (uint16_t *)pkt->data;
+			if(rtp->type == 0) {
+				/* mu-law */
+				for(i=0; i<plen; i++)
+					*(samples+i) = janus_audiobridge_g711_ulaw_dectable[*(payload+i)];
+			} else if(rtp->type == 8) {
+				/* a-law */
+				for(i=0; i<plen; i++)
+					*(samples+i) = janus_audiobridge_g711_alaw_dectable[*(payload+i)];
+			}
+			pkt->length = 320;
+		}
+		if(audiobridge != NULL)
+			janus_usage_add(&audiobridge->usage, JANUS_USAGE_DECODE_TIME, janus_get_monotonic_time() - decode_start);
+		/* Update the details */
+		participant->last_seq = pkt->seq_number;
+		participant->last_timestamp = pkt->timestamp;
+		g_atomic_int_set(&participant->decoding, 0);
+		if(pkt->length < 0) {
+			if(participant->codec == JANUS_AUDIOCODEC_OPUS) {
+				JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error decoding the Opus frame: %d (%s)\n", pkt->length, opus_strerror(pkt->length));
+			} else {
+				JANUS_LOG(LOG_ERR, "[G.711] Ops! got an error decoding the audio frame\n");
+			}
+			return FALSE;
+		}
+		/* Queue the decoded packet for the mixer */
+		janus_audiobridge_participant_decoded(participant, pkt);
+	}
+	return TRUE;
+}
+
 /* Thread to encode a mixed frame and send it to a specific participant */
 static void *janus_audiobridge_participant_thread(void *data) {
 	JANUS_LOG(LOG_VERB, "AudioBridge Participant thread starting...\n");
@@ -8865,27 +10835,27 @@ static void *janus_audiobridge_participant_thread(void *data) {
 	outpkt->seq_number = 0;
 	outpkt->length = 0;
 	outpkt->silence = FALSE;
-	uint8_t *payload = (uint8_t *)outpkt->data;
+	outpkt->level = -1;
+	outpkt->encoded = NULL;
 
-	JitterBufferPacket jbp = {0};
-	janus_audiobridge_buffer_packet *bpkt = NULL;
-	janus_audiobridge_rtp_relay_packet *pkt = NULL;
 	janus_audiobridge_rtp_relay_packet *mixedpkt = NULL;
-	int jitter_ticks = 0;
-	janus_rtp_header *rtp = NULL;
-	gint64 now = janus_get_monotonic_time(), before = now;
-	gboolean first = TRUE;
-	int ret = 0;
-	int lost_packets_gap = 0;
+	gint64 now = janus_get_monotonic_time();
+	/* This thread spends most of its time sleeping, so we only sample the work it does for the room */
+	gint64 cpu_start = 0;
+	guint cpu_weight = 0;
+	participant->decode_before = now;
+	participant->jitter_ticks = 0;
+	participant->decode_first = TRUE;
+	participant->lost_packets_gap = 0;
 
 	/* Start working: check both the incoming queue (to decode and queue) and the outgoing one (to encode and send) */
 	while(!g_atomic_int_get(&stopping) && g_atomic_int_get(&session->destroyed) == 0) {
 		janus_mutex_lock(&participant->suspend_cond_mutex);
 		while(g_atomic_int_get(&participant->suspended)) {
 			g_cond_wait(&participant->suspend_cond, &participant->suspend_cond_mutex);
-			before = janus_get_monotonic_time();
+			participant->decode_before = janus_get_monotonic_time();
 			participant->context.seq_reset = TRUE;
-			first = TRUE;
+			participant->decode_first = TRUE;
 			/* Clear the output queue since it might contain old packets and break RTP sequence */
 			janus_audiobridge_participant_clear_outbuf(participant);
 		}
@@ -8893,221 +10863,24 @@ static void *janus_audiobridge_participant_thread(void *data) {
 		/* Start with packets to decode and queue for the mixer */
 		now = janus_get_monotonic_time();
 		/* Start by reading packets to decode from the jitter buffer on a clock */
-		if(now - before >= 18000) {
-			before += 20000;
-			if(participant->jitter) {
-				janus_mutex_lock(&participant->qmutex);
-				ret = jitter_buffer_get(participant->jitter, &jbp, participant->codec == JANUS_AUDIOCODEC_OPUS ? 960 : 160, NULL);
-				jitter_ticks++;
-				/* Adjust the buffer size every 50 ticks (~1 second) */
-				if(jitter_ticks == JITTER_BUFFER_MAX_PACKETS) {
-					jitter_buffer_update_delay(participant->jitter, NULL, NULL);
-					jitter_ticks = 0;
-				}
-				jitter_buffer_tick(participant->jitter);
-				janus_mutex_unlock(&participant->qmutex);
-				if(ret != JITTER_BUFFER_OK) {
-					/* We didn't get a packet: check if PLC can help */
-					if(!first && participant->codec == JANUS_AUDIOCODEC_OPUS && lost_packets_gap <= JITTER_BUFFER_MAX_GAP_SIZE && !participant->muted) {
-						lost_packets_gap++;
-						if(!g_atomic_int_compare_and_exchange(&participant->decoding, 0, 1)) {
-							/* This means we're cleaning up, so don't try to decode */
-							janus_audiobridge_buffer_packet_destroy(bpkt);
-							break;
-						}
-						int32_t output_samples = 0;
-						opus_decoder_ctl(participant->decoder, OPUS_GET_LAST_PACKET_DURATION(&output_samples));
-						/* Allocate a fake packet we can queue */
-						pkt = g_malloc(sizeof(janus_audiobridge_rtp_relay_packet));
-						pkt->data = g_malloc0(BUFFER_SAMPLES * sizeof(opus_int16));
-						pkt->ssrc = 0;
-						pkt->timestamp = participant->last_timestamp + OPUS_SAMPLES;
-						pkt->seq_number = participant->last_seq + 1;
-						/* This is a redundant packet, so we can't parse any extension info */
-						pkt->silence = FALSE;
-						janus_audiobridge_participant_istalking(session, participant, NULL, NULL);
-						pkt->length = opus_decode(participant->decoder, NULL, 0, (opus_int16 *)pkt->data, output_samples, 0);
-#ifdef HAVE_RNNOISE
-						/* Check if we need to denoise this packet */
-						if(participant->denoise)
-							janus_audiobridge_participant_denoise(participant, (char *)pkt->data, pkt->length);
-#endif
-						/* Update the details */
-						participant->last_seq = pkt->seq_number;
-						participant->last_timestamp = pkt->timestamp;
-						g_atomic_int_set(&participant->decoding, 0);
-						if(pkt->length < 0) {
-							JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error decoding the Opus frame: %d (%s)\n", pkt->length, opus_strerror(pkt->length));
-							g_free(pkt->data);
-							g_free(pkt);
-							break;
-						}
-						/* Queue the decoded packet for the mixer */
-						janus_mutex_lock(&participant->qmutex);
-						/* Do not let queue-in grow too much */
-						guint count = g_list_length(participant->inbuf);
-						if((int) count > QUEUE_IN_MAX_PACKETS) {
-							JANUS_LOG(LOG_WARN, "Participant queue-in contains too many packets, clearing now (count=%u)\n", count);
-							janus_audiobridge_participant_clear_inbuf(participant);
-						}
-						participant->inbuf = g_list_append(participant->inbuf, pkt);
-						janus_mutex_unlock(&participant->qmutex);
-					} else {
-						/* No packet in the jitter buffer? Move on the talking detection, if needed */
-						janus_audiobridge_participant_istalking(session, participant, NULL, NULL);
-					}
-				} else {
-					/* Decode the audio packet */
-					bpkt = (janus_audiobridge_buffer_packet *)jbp.data;
-					if(!g_atomic_int_compare_and_exchange(&participant->decoding, 0, 1)) {
-						/* This means we're cleaning up, so don't try to decode */
-						janus_audiobridge_buffer_packet_destroy(bpkt);
-						break;
-					}
-					/* Access the payload */
-					char *buffer = bpkt->rtp ? bpkt->rtp->buffer : NULL;
-					uint16_t len = bpkt->rtp ? bpkt->rtp->length : 0;
-					int plen = 0;
-					const unsigned char *payload = (const unsigned char *)janus_rtp_payload(buffer, len, &plen);
-					if(!payload) {
-						JANUS_LOG(LOG_ERR, "[%s] Ops! got an error accessing the RTP payload\n",
-							participant->codec == JANUS_AUDIOCODEC_OPUS ? "Opus" : "G.711");
-						g_atomic_int_set(&participant->decoding, 0);
-						janus_audiobridge_buffer_packet_destroy(bpkt);
-						break;
-					}
-					rtp = (janus_rtp_header *)buffer;
-					first = FALSE;
-					lost_packets_gap = 0;
-					/* Decode the packet */
-					pkt = g_malloc(sizeof(janus_audiobridge_rtp_relay_packet));
-					pkt->data = g_malloc0(BUFFER_SAMPLES*sizeof(opus_int16));
-					pkt->ssrc = 0;
-					pkt->timestamp = ntohl(rtp->timestamp);
-					pkt->seq_number = ntohs(rtp->seq_number);
-					/* Check the audio level extension to see if this is silence */
-					pkt->silence = FALSE;
-					janus_audiobridge_participant_istalking(session, participant, bpkt->rtp, &pkt->silence);
-					pkt->length = 0;
-					if(participant->codec == JANUS_AUDIOCODEC_OPUS) {
-						/* Opus */
-						pkt->length = opus_decode(participant->decoder, payload, plen, (opus_int16 *)pkt->data, BUFFER_SAMPLES, 0);
-					} else if(participant->codec == JANUS_AUDIOCODEC_PCMA || participant->codec == JANUS_AUDIOCODEC_PCMU) {
-						/* G.711 */
-						if(plen != 160) {
-							JANUS_LOG(LOG_WARN, "[G.711] Wrong packet size (expected 160, got %d), skipping audio packet\n", plen);
-							g_atomic_int_set(&participant->decoding, 0);
-							janus_audiobridge_buffer_packet_destroy(bpkt);
-							g_free(pkt->data);
-							g_free(pkt);
-							break;
-						}
-						int i = 0;
-						uint16_t *samples = (uint16_t *)pkt->data;
-						if(rtp->type == 0) {
-							/* mu-law */
-							for(i=0; i<plen; i++)
-								*(samples+i) = janus_audiobridge_g711_ulaw_dectable[*(payload+i)];
-						} else if(rtp->type == 8) {
-							/* a-law */
-							for(i=0; i<plen; i++)
-								*(samples+i) = janus_audiobridge_g711_alaw_dectable[*(payload+i)];
-						}
-						pkt->length = 320;
-					}
-#ifdef HAVE_RNNOISE
-					/* Check if we need to denoise this packet */
-					if(participant->denoise)
-						janus_audiobridge_participant_denoise(participant, (char *)pkt->data, pkt->length);
-#endif
-					/* Get rid of the buffered packet */
-					janus_audiobridge_buffer_packet_destroy(bpkt);
-					/* Update the details */
-					participant->last_seq = pkt->seq_number;
-					participant->last_timestamp = pkt->timestamp;
-					g_atomic_int_set(&participant->decoding, 0);
-					if(pkt->length < 0) {
-						if(participant->codec == JANUS_AUDIOCODEC_OPUS) {
-							JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error decoding the Opus frame: %d (%s)\n", pkt->length, opus_strerror(pkt->length));
-						} else {
-							JANUS_LOG(LOG_ERR, "[G.711] Ops! got an error decoding the audio frame\n");
-						}
-						g_free(pkt->data);
-						g_free(pkt);
-						break;
-					}
-					/* Queue the decoded packet for the mixer */
-					janus_mutex_lock(&participant->qmutex);
-					/* Do not let queue-in grow too much */
-					guint count = g_list_length(participant->inbuf);
-					if(count > QUEUE_IN_MAX_PACKETS) {
-						JANUS_LOG(LOG_WARN, "Participant queue-in contains too many packets, clearing now (count=%u)\n", count);
-						janus_audiobridge_participant_clear_inbuf(participant);
-					}
-					participant->inbuf = g_list_append(participant->inbuf, pkt);
-					janus_mutex_unlock(&participant->qmutex);
-				}
-			}
+		if(now - participant->decode_before >= 18000) {
+			participant->decode_before += 20000;
+			cpu_weight = janus_usage_sample_start(&cpu_start);
+			gboolean ok = janus_audiobridge_participant_decode(participant);
+			janus_audiobridge_participant_usage_sample(participant, cpu_weight, cpu_start);
+			if(!ok)
+				break;
 		}
 		/* Now check if there's packets to encode */
 		mixedpkt = g_async_queue_try_pop(participant->outbuf);
 		if(mixedpkt != NULL && g_atomic_int_get(&session->destroyed) == 0 && g_atomic_int_get(&session->started)) {
-			if(g_atomic_int_get(&participant->active) && (participant->codec == JANUS_AUDIOCODEC_PCMA ||
-					participant->codec == JANUS_AUDIOCODEC_PCMU) && g_atomic_int_compare_and_exchange(&participant->encoding, 0, 1)) {
-				/* Encode using G.711 */
-				if(mixedpkt->length != 320) {
-					/* TODO Resample */
-				}
-				int i = 0;
-				opus_int16 *outBuffer = (opus_int16 *)mixedpkt->data;
-				if(participant->codec == JANUS_AUDIOCODEC_PCMA) {
-					/* A-law */
-					for(i=0; i<160; i++)
-						*(payload+12+i) = janus_audiobridge_g711_alaw_encode(outBuffer[i]);
-				} else {
-					/* Mu-Law */
-					for(i=0; i<160; i++)
-						*(payload+12+i) = janus_audiobridge_g711_ulaw_encode(outBuffer[i]);
-				}
-				g_atomic_int_set(&participant->encoding, 0);
-				outpkt->length = 172;	/* Take the RTP header into consideration */
-				/* Update RTP header */
-				outpkt->data->version = 2;
-				outpkt->data->markerbit = 0;	/* FIXME Should be 1 for the first packet */
-				outpkt->data->seq_number = htons(mixedpkt->seq_number);
-				outpkt->data->timestamp = htonl(mixedpkt->timestamp/6);
-				outpkt->data->ssrc = htonl(mixedpkt->ssrc);	/* The Janus core will fix this anyway */
-				/* Backup the actual timestamp and sequence number set by the audiobridge, in case a room is changed */
-				outpkt->ssrc = mixedpkt->ssrc;
-				outpkt->timestamp = mixedpkt->timestamp/6;
-				outpkt->seq_number = mixedpkt->seq_number;
-				janus_audiobridge_relay_rtp_packet(participant->session, outpkt);
-			} else if(g_atomic_int_get(&participant->active) && participant->encoder &&
-					g_atomic_int_compare_and_exchange(&participant->encoding, 0, 1)) {
-				/* Encode raw frame to Opus */
-				opus_int16 *outBuffer = (opus_int16 *)mixedpkt->data;
-				outpkt->length = opus_encode(participant->encoder, outBuffer,
-					participant->stereo ? mixedpkt->length/2 : mixedpkt->length, payload+12, 1500-12);
-				g_atomic_int_set(&participant->encoding, 0);
-				if(outpkt->length < 0) {
-					JANUS_LOG(LOG_ERR, "[Opus] Ops! got an error encoding the Opus frame: %d (%s)\n", outpkt->length, opus_strerror(outpkt->length));
-				} else {
-					outpkt->length += 12;	/* Take the RTP header into consideration */
-					/* Update RTP header */
-					outpkt->data->version = 2;
-					outpkt->data->markerbit = 0;	/* FIXME Should be 1 for the first packet */
-					outpkt->data->seq_number = htons(mixedpkt->seq_number);
-					outpkt->data->timestamp = htonl(mixedpkt->timestamp);
-					outpkt->data->ssrc = htonl(mixedpkt->ssrc);	/* The Janus core will fix this anyway */
-					/* Backup the actual timestamp and sequence number set by the audiobridge, in case a room is changed */
-					outpkt->ssrc = mixedpkt->ssrc;
-					outpkt->timestamp = mixedpkt->timestamp;
-					outpkt->seq_number = mixedpkt->seq_number;
-					janus_audiobridge_relay_rtp_packet(participant->session, outpkt);
-				}
-			}
+			cpu_weight = janus_usage_sample_start(&cpu_start);
+			janus_audiobridge_participant_send_mixed(participant, mixedpkt, outpkt);
+			janus_audiobridge_participant_usage_sample(participant, cpu_weight, cpu_start);
 		}
 		if(mixedpkt) {
+			if(mixedpkt->encoded)
+				janus_refcount_decrease(&mixedpkt->encoded->ref);
 			g_free(mixedpkt->data);
 			g_free(mixedpkt);
 		}
@@ -9124,6 +10897,232 @@ static void *janus_audiobridge_participant_thread(void *data) {
 	return NULL;
 }
 
+/* Helper to stop serving a participant in a worker: must be called with the worker mutex locked */
+static void janus_audiobridge_worker_drop(janus_audiobridge_worker *w, janus_audiobridge_participant *participant) {
+	g_queue_remove(w->wheel, participant);
+	if(g_atomic_int_compare_and_exchange(&participant->encode_queued, 1, 0))
+		g_queue_remove(w->encodes, participant);
+	participant->worker = NULL;
+	g_atomic_int_add(&w->count, -1);
+	janus_audiobridge_participant_clear_outbuf(participant);
+	janus_audiobridge_session *session = participant->session;
+	janus_refcount_decrease(&participant->ref);
+	janus_refcount_decrease(&session->ref);
+}
+
+/* Helper to (re-)schedule a participant in the wheel of a worker, in deadline order:
+ * must be called with the worker mutex locked */
+static void janus_audiobridge_worker_schedule(janus_audiobridge_worker *w, janus_audiobridge_participant *participant) {
+	/* Deadlines are mostly increasing, so start looking from the tail */
+	GList *l = w->wheel->tail;
+	while(l != NULL && ((janus_audiobridge_participant *)l->data)->deadline > participant->deadline)
+		l = l->prev;
+	if(l == NULL)
+		g_queue_push_head(w->wheel, participant);
+	else
+		g_queue_insert_after(w->wheel, l, participant);
+}
+
+/* Helper to have the least loaded participant worker take care of a participant */
+static void janus_audiobridge_worker_add(janus_audiobridge_session *session, janus_audiobridge_participant *participant) {
+	janus_audiobridge_worker *w = NULL;
+	int i = 0;
+	for(i=0; i<participant_workers; i++) {
+		if(workers[i].thread == NULL)
+			continue;
+		if(w == NULL || g_atomic_int_get(&workers[i].count) < g_atomic_int_get(&w->count))
+			w = &workers[i];
+	}
+	if(w == NULL) {
+		/* FIXME We should fail here... */
+		JANUS_LOG(LOG_ERR, "No participant worker available for participant %s\n", participant->user_id_str);
+		return;
+	}
+	JANUS_LOG(LOG_VERB, "Participant %s (%s) will be served by worker #%d\n",
+		participant->user_id_str, participant->display ? participant->display : "??", w->id);
+	janus_refcount_increase(&session->ref);
+	janus_refcount_increase(&participant->ref);
+	participant->decode_before = janus_get_monotonic_time();
+	participant->deadline = participant->decode_before;
+	participant->jitter_ticks = 0;
+	participant->decode_first = TRUE;
+	participant->lost_packets_gap = 0;
+	participant->worker_suspended = FALSE;
+	g_atomic_int_set(&participant->encode_queued, 0);
+	janus_mutex_lock(&w->mutex);
+	participant->worker = w;
+	g_atomic_int_inc(&w->count);
+	janus_audiobridge_worker_schedule(w, participant);
+	g_cond_signal(&w->cond);
+	janus_mutex_unlock(&w->mutex);
+}
+
+/* Thread of a participant worker: decodes packets for all its participants on a
+ * 20ms clock each, and encodes and sends the mixed frames the mixers queue for them */
+static void *janus_audiobridge_worker_thread(void *data) {
+	janus_audiobridge_worker *w = (janus_audiobridge_worker *)data;
+	JANUS_LOG(LOG_VERB, "AudioBridge participant worker #%d starting...\n", w->id);
+	/* Output buffer */
+	janus_audiobridge_rtp_relay_packet *outpkt = g_malloc(sizeof(janus_audiobridge_rtp_relay_packet));
+	outpkt->data = g_malloc0(1500);
+	outpkt->ssrc = 0;
+	outpkt->timestamp = 0;
+	outpkt->seq_number = 0;
+	outpkt->length = 0;
+	outpkt->silence = FALSE;
+	outpkt->level = -1;
+	outpkt->encoded = NULL;
+	janus_audiobridge_participant *participant = NULL;
+	janus_audiobridge_session *session = NULL;
+	janus_audiobridge_rtp_relay_packet *mixedpkt = NULL;
+	gint64 now = janus_get_monotonic_time(), start = 0, cpu_start = 0;
+	guint cpu_weight = 0;
+	w->load_start = now;
+	w->busy = 0;
+	janus_mutex_lock(&w->mutex);
+	while(!g_atomic_int_get(&stopping)) {
+		now = janus_get_monotonic_time();
+		if(now - w->load_start >= G_USEC_PER_SEC) {
+			g_atomic_int_set(&w->load, (int)(w->busy * 100 / (now - w->load_start)));
+			w->busy = 0;
+			w->load_start = now;
+		}
+		participant = g_queue_pop_head(w->encodes);
+		if(participant != NULL) {
+			/* Encode and send the mixed frames waiting for this participant */
+			g_atomic_int_set(&participant->encode_queued, 0);
+			janus_refcount_increase(&participant->ref);
+			janus_mutex_unlock(&w->mutex);
+			start = janus_get_monotonic_time();
+			cpu_weight = janus_usage_sample_start(&cpu_start);
+			session = participant->session;
+			while((mixedpkt = g_async_queue_try_pop(participant->outbuf)) != NULL) {
+				if(g_atomic_int_get(&session->destroyed) == 0 && g_atomic_int_get(&session->started) &&
+						!g_atomic_int_get(&participant->suspended))
+					janus_audiobridge_participant_send_mixed(participant, mixedpkt, outpkt);
+				if(mixedpkt->encoded)
+					janus_refcount_decrease(&mixedpkt->encoded->ref);
+				g_free(mixedpkt->data);
+				g_free(mixedpkt);
+			}
+			janus_audiobridge_participant_usage_sample(participant, cpu_weight, cpu_start);
+			janus_refcount_decrease(&participant->ref);
+			w->busy += janus_get_monotonic_time() - start;
+			janus_mutex_lock(&w->mutex);
+			continue;
+		}
+		participant = g_queue_peek_head(w->wheel);
+		if(participant == NULL) {
+			/* Nothing to do, wait for a participant to show up */
+			gint64 until = g_get_monotonic_time() + G_USEC_PER_SEC;
+			g_cond_wait_until(&w->cond, &w->mutex, until);
+			continue;
+		}
+		if(participant->deadline > now) {
+			/* Wait for the next deadline, or for something to encode */
+			gint64 until = g_get_monotonic_time() + (participant->deadline - now);
+			g_cond_wait_until(&w->cond, &w->mutex, until);
+			continue;
+		}
+		/* It's time to decode a packet for this participant */
+		g_queue_pop_head(w->wheel);
+		session = participant->session;
+		if(g_atomic_int_get(&session->destroyed)) {
+			janus_audiobridge_worker_drop(w, participant);
+			continue;
+		}
+		if(now - participant->deadline >= 20000) {
+			g_atomic_int_inc(&w->missed);
+			if(now - participant->deadline >= 100000) {
+				/* We're way too late, don't try to catch up */
+				participant->deadline = now;
+				participant->decode_before = now;
+			}
+		}
+		participant->deadline += 20000;
+		janus_audiobridge_worker_schedule(w, participant);
+		janus_mutex_unlock(&w->mutex);
+		start = janus_get_monotonic_time();
+		cpu_weight = janus_usage_sample_start(&cpu_start);
+		gboolean ok = TRUE;
+		if(g_atomic_int_get(&participant->suspended)) {
+			participant->worker_suspended = TRUE;
+		} else {
+			if(participant->worker_suspended) {
+				/* We've just been resumed, start over */
+				participant->worker_suspended = FALSE;
+				participant->decode_before = now;
+				participant->context.seq_reset = TRUE;
+				participant->decode_first = TRUE;
+				/* Clear the output queue since it might contain old packets and break RTP sequence */
+				janus_audiobridge_participant_clear_outbuf(participant);
+			}
+			participant->decode_before += 20000;
+			ok = janus_audiobridge_participant_decode(participant);
+		}
+		janus_audiobridge_participant_usage_sample(participant, cpu_weight, cpu_start);
+		w->busy += janus_get_monotonic_time() - start;
+		janus_mutex_lock(&w->mutex);
+		if(!ok && participant->worker == w)
+			janus_audiobridge_worker_drop(w, participant);
+	}
+	/* We're done, release all the participants we were serving */
+	while((participant = g_queue_peek_head(w->wheel)) != NULL)
+		janus_audiobridge_worker_drop(w, participant);
+	janus_mutex_unlock(&w->mutex);
+	g_free(outpkt->data);
+	g_free(outpkt);
+	JANUS_LOG(LOG_VERB, "AudioBridge participant worker #%d leaving...\n", w->id);
+	return NULL;
+}
+
+#ifdef HAVE_RNNOISE
+static void *janus_audiobridge_denoiser_thread(void *data) {
+	janus_audiobridge_denoiser *d = (janus_audiobridge_denoiser *)data;
+	JANUS_LOG(LOG_VERB, "AudioBridge denoiser #%d starting...\n", d->id);
+	janus_audiobridge_denoise_frame *batch[JANUS_AUDIOBRIDGE_DENOISE_BATCH];
+	janus_audiobridge_denoise_frame *frame = NULL;
+	gboolean done = FALSE;
+	int i = 0, count = 0;
+	while(!done) {
+		/* Wait for a frame, and then take all the others that are waiting too */
+		frame = g_async_queue_pop(d->frames);
+		count = 0;
+		while(frame != NULL) {
+			if(frame == &denoise_exit_frame) {
+				done = TRUE;
+				break;
+			}
+			batch[count++] = frame;
+			if(count == JANUS_AUDIOBRIDGE_DENOISE_BATCH)
+				break;
+			frame = g_async_queue_try_pop(d->frames);
+		}
+		for(i=0; i<count; i++) {
+			frame = batch[i];
+			if(frame->participant->denoise && !g_atomic_int_get(&frame->participant->destroyed))
+				janus_audiobridge_participant_denoise(frame->participant, (char *)frame->pkt->data, frame->pkt->length);
+			janus_audiobridge_inbuf_publish(frame->participant->inbuf);
+			janus_refcount_decrease(&frame->participant->ref);
+			g_free(frame);
+		}
+		if(count > 0) {
+			g_atomic_int_inc(&d->batches);
+			g_atomic_int_add(&d->processed, count);
+		}
+	}
+	/* Get rid of whatever is left */
+	while((frame = g_async_queue_try_pop(d->frames)) != NULL) {
+		if(frame == &denoise_exit_frame)
+			continue;
+		janus_refcount_decrease(&frame->participant->ref);
+		g_free(frame);
+	}
+	JANUS_LOG(LOG_VERB, "AudioBridge denoiser #%d leaving...\n", d->id);
+	return NULL;
+}
+#endif
+
 static void janus_audiobridge_relay_rtp_packet(gpointer data, gpointer user_data) {
 	janus_audiobridge_rtp_relay_packet *packet = (janus_audiobridge_rtp_relay_packet *)user_data;
 	if(!packet || !packet->data || packet->length < 1) {
@@ -9147,6 +11146,9 @@ static void janus_audiobridge_relay_rtp_packet(gpointer data, gpointer user_data
 		packet->data->type = (participant->codec == JANUS_AUDIOCODEC_PCMA ? 8 : 0);
 	/* Fix sequence number and timestamp (room switching may be involved) */
 	janus_rtp_header_update(packet->data, &participant->context, FALSE, 0);
+	janus_audiobridge_room *audiobridge = participant->room;
+	if(audiobridge != NULL)
+		janus_usage_packets_out(&audiobridge->usage, 1, packet->length, participant->plainrtp_media.audio_rtp_fd <= 0);
 	if(participant->plainrtp_media.audio_rtp_fd > 0) {
 		if(participant->plainrtp_media.audio_ssrc == 0)
 			participant->plainrtp_media.audio_ssrc = ntohl(packet->ssrc);
@@ -9492,7 +11494,7 @@ static void janus_audiobridge_participant_denoise(janus_audiobridge_participant
 			spx_uint32_t channels = !participant->resampler_stereo ? 1 : 2;
 			spx_uint32_t from_rate = participant->resampler_rate;
 			spx_uint32_t to_rate = 48000;
-			int quality = 8, error = 0;
+			int quality = resampler_quality, error = 0;
 			participant->upsampler = speex_resampler_init(channels, from_rate, to_rate, quality, &error);
 			if(participant->upsampler != NULL) {
 				JANUS_LOG(LOG_INFO, "Created %s resampler from %d to %d (channels=%d, quality=%d)\n",
@@ -9523,6 +11525,23 @@ static void janus_audiobridge_participant_denoise(janus_audiobridge_participant
 	/* Actual length of the resampled array (double size for stereo) */
 	const int samples_len = !participant->resampler_stereo ? samples_count : 2*samples_count;
 
+	/* Check if RNNoise has been hearing nothing but noise for a while */
+	int level = janus_audiobridge_frame_level(samples, samples_len);
+	if(participant->denoise_gated) {
+		if(level + JANUS_AUDIOBRIDGE_DENOISE_GATE_MARGIN > participant->denoise_floor) {
+			/* Not louder than the noise was, keep the participant muted (and
+			 * keep track of the quietest noise, in case it goes away) */
+			if(level > participant->denoise_floor)
+				participant->denoise_floor = level;
+			memset(samples, 0, samples_len*sizeof(opus_int16));
+			g_atomic_int_inc(&participant->denoise_gated_frames);
+			return;
+		}
+		/* This may be voice, start denoising again */
+		participant->denoise_gated = FALSE;
+		participant->denoise_quiet = 0;
+	}
+
 	/* Should be 960 */
 	int upsample_buffer_count = len * (48000/participant->resampler_rate);
 	/* Upsampled buffer */
@@ -9542,6 +11561,7 @@ static void janus_audiobridge_participant_denoise(janus_audiobridge_participant
 	int i = 0, j = 0;
 	float *denoiser_buffer = participant->denoiser_buffer[0];
 	float *denoiser_buffer_alt = participant->denoiser_buffer[1];
+	float vad = 0.0f, prob = 0.0f;
 
 	/* Denoise in chunks of 480 samples */
 	if(!participant->resampler_stereo) {
@@ -9549,7 +11569,9 @@ static void janus_audiobridge_participant_denoise(janus_audiobridge_participant
 			for(j=0; j<DENOISER_FRAME_SIZE; j++) {
 				denoiser_buffer[j] = upsample_buffer[i + j];
 			}
-			rnnoise_process_frame(participant->rnnoise[0], denoiser_buffer, denoiser_buffer);
+			prob = rnnoise_process_frame(participant->rnnoise[0], denoiser_buffer, denoiser_buffer);
+			if(prob > vad)
+				vad = prob;
 			for(j=0; j<DENOISER_FRAME_SIZE; j++) {
 				upsample_buffer[i + j] = denoiser_buffer[j];
 			}
@@ -9560,8 +11582,12 @@ static void janus_audiobridge_participant_denoise(janus_audiobridge_participant
 				denoiser_buffer[j] = upsample_buffer[2*i + 2*j];
 				denoiser_buffer_alt[j] = upsample_buffer[2*i + 2*j + 1];
 			}
-			rnnoise_process_frame(participant->rnnoise[0], denoiser_buffer, denoiser_buffer);
-			rnnoise_process_frame(participant->rnnoise[1], denoiser_buffer_alt, denoiser_buffer_alt);
+			prob = rnnoise_process_frame(participant->rnnoise[0], denoiser_buffer, denoiser_buffer);
+			if(prob > vad)
+				vad = prob;
+			prob = rnnoise_process_frame(participant->rnnoise[1], denoiser_buffer_alt, denoiser_buffer_alt);
+			if(prob > vad)
+				vad = prob;
 			for(j=0; j<DENOISER_FRAME_SIZE; j++) {
 				upsample_buffer[2*i + 2*j] = denoiser_buffer[j];
 				upsample_buffer[2*i + 2*j + 1] = denoiser_buffer_alt[j];
@@ -9569,6 +11595,17 @@ static void janus_audiobridge_participant_denoise(janus_audiobridge_participant
 		}
 	}
 
+	/* If there was no voice for a while, stop denoising and just mute */
+	if(vad < JANUS_AUDIOBRIDGE_DENOISE_QUIET_VAD) {
+		participant->denoise_quiet++;
+		if(participant->denoise_quiet >= JANUS_AUDIOBRIDGE_DENOISE_QUIET_FRAMES) {
+			participant->denoise_gated = TRUE;
+			participant->denoise_floor = level;
+		}
+	} else {
+		participant->denoise_quiet = 0;
+	}
+
 	/* Downsample */
 	if(participant->resampler_rate != 48000) {
 		downsample_buffer = participant->downsample_buffer;
@@ -59,7 +59,10 @@
  * with \c incomingTextData() or \c incomingBinaryData
  * though, the performance impact of directly processing and manipulating
  * RTP an RTCP packets is probably too high, and so their usage is currently
- * discouraged. The \c dataReady() callback can be used to figure out when
+ * discouraged. Should a script need them for some users only, it can use
+ * \c setNativeMedia() to have RTP and RTCP packets coming from all the
+ * other users processed and routed in C, using the recipients configured
+ * via \c addRecipient(), without ever entering the JavaScript engine. The \c dataReady() callback can be used to figure out when
  * data can be sent. As an additional note, JavaScript scripts can also decide to
  * implement the functions that return information about the plugin itself,
  * namely \c getVersion() \c getVersionString() \c getDescription()
@@ -95,13 +98,18 @@
  * - \c removeRecipient(): specify which user should not receive a user's media anymore;
  * - \c setBitrate(): specify the bitrate to force on a user via REMB feedback;
  * - \c setPliFreq(): specify how often the plugin should send a PLI to this user;
+ * - \c setNativeMedia(): specify whether media from a user should be routed in C even if \c incomingRtp() and \c incomingRtcp() are implemented;
  * - \c setSubstream(): set the target simulcast substream;
  * - \c setTemporalLayer(): set the target simulcast temporal layer;
  * - \c sendPli(): send a PLI (keyframe request);
  * - \c startRecording(): start recording audio, video and or data for a user;
  * - \c stopRecording(): start recording audio, video and or data for a user;
  * - \c pokeScheduler(): notify the C code that there's a coroutine to resume;
- * - \c timeCallback(): trigger the execution of a JavaScript function after X milliseconds.
+ * - \c timeCallback(): trigger the execution of a JavaScript function after X milliseconds;
+ * - \c getInstance(): get the index of the Duktape instance the script is running in;
+ * - \c getInstancesCount(): get how many Duktape instances the plugin is using;
+ * - \c getSessionInstance(): get the index of the Duktape instance a user is handled by;
+ * - \c postMessage(): send a message to another Duktape instance (see \ref jinstances).
  *
  * As anticipated in the previous section, almost all these methods also
  * expect the unique session identifier to address a specific user in the
@@ -186,6 +194,54 @@ timeCallback("resumeScheduler", null, 0);
  * compact and less verbose, and as such is preferred in cases where
  * timing and opaque arguments are not needed.
  *
+ * \section jinstances Multiple Duktape instances
+ *
+ * By default, the plugin loads the script in a single Duktape heap, which
+ * means that all callbacks are serialized, no matter how many users are
+ * involved. In case that's a bottleneck, the \c instances property in
+ * the plugin configuration can be used to load the script in more than
+ * one heap: users are then sharded among these instances, each with its
+ * own scheduler, which means they'll be served in parallel. Timed
+ * callbacks are always invoked in the instance that created them, while
+ * callbacks that are not related to a specific user (e.g., those providing
+ * information on the plugin, or \c handleAdminMessage() ) are only
+ * invoked in the first instance. Both \c init() and \c destroy() are
+ * invoked in all of them.
+ *
+ * Instances don't share anything, though: the script is loaded in each
+ * of them separately, which means a global variable in one of them is
+ * not visible to the others. Maps of rooms and the like must then either
+ * be partitioned, or explicitly kept in sync. The \c postMessage() function
+ * is available for the purpose:
+ *
+ * \verbatim
+// Send a string to instance 2
+postMessage(2, "a string, e.g., some serialized JSON");
+// Send a string to all the other instances
+postMessage(-1, "a string, e.g., some serialized JSON");
+\endverbatim
+ *
+ * Messages are delivered asynchronously, by the scheduler of the target
+ * instance, to an additional \c incomingMessage() callback the script must
+ * implement, which receives the index of the sender instance and the
+ * message itself. The \c getInstance() \c getInstancesCount() and
+ * \c getSessionInstance() functions can help the script figure out the
+ * right recipient for its messages. Notice that functions that address
+ * users by ID (e.g., \c pushEvent() or \c addRecipient() ) work with any
+ * user, no matter which instance they're handled by.
+ *
+ * \section jcache Bytecode cache
+ *
+ * Compiling large scripts can take a while, which is paid at each startup
+ * and for each instance. Setting the \c cache property in the plugin
+ * configuration to a folder makes the plugin save there the bytecode of
+ * the script and of all the modules loaded via \c require() the first
+ * time they're compiled, and load it the next time instead of parsing and
+ * compiling the source again. Cached bytecode is keyed by a hash of the
+ * source (and of the Duktape version), so any change to a file results in
+ * it being compiled again. Notice that Duktape doesn't validate bytecode
+ * it loads, which means the folder must only be writable by Janus.
+ *
  * Refer to the \ref jspapi section for more information on how you
  * can register your own C functions.
  */
@@ -268,10 +324,17 @@ janus_plugin *create(void) {
 volatile gint duktape_initialized = 0, duktape_stopping = 0;
 janus_callbacks *duktape_janus_core = NULL;
 static char *duktape_folder = NULL;
+/* Bytecode cache: if a folder is configured, the compiled versions of the
+ * script and of the modules it loads are saved there, keyed by a hash of
+ * their source, so that restarts can skip parsing and compiling them */
+static char *duktape_cache_folder = NULL;
+static volatile gint duktape_cache_hits = 0, duktape_cache_misses = 0;
 
 /* Duktape stuff */
 duk_context *duktape_ctx = NULL;
 janus_mutex duktape_mutex = JANUS_MUTEX_INITIALIZER;
+janus_duktape_instance *duktape_instances = NULL;
+guint duktape_instances_count = 1;
 static const char *duktape_functions[] = {
 	"init", "destroy", "resumeScheduler",
 	"createSession", "destroySession", "querySession",
@@ -302,15 +365,28 @@ static gboolean has_data_ready = FALSE;
 static gboolean has_slow_link = FALSE;
 static gboolean has_substream_changed = FALSE;
 static gboolean has_temporal_changed = FALSE;
-/* JavaScript C scheduler (for coroutines) */
-static GThread *scheduler_thread = NULL;
+static gboolean has_incoming_message = FALSE;
+/* JavaScript C scheduler (for coroutines): each instance has its own */
 static void *janus_duktape_scheduler(void *data);
-static GAsyncQueue *events = NULL;
 typedef enum janus_duktape_event {
 	janus_duktape_event_none = 0,
 	janus_duktape_event_resume,		/* Resume one or more pending coroutines */
 	janus_duktape_event_exit		/* Break the scheduler loop */
 } janus_duktape_event;
+/* Messages instances can send each other, which the scheduler of the
+ * recipient delivers to the incomingMessage() callback of the script */
+typedef struct janus_duktape_message {
+	guint from;
+	char *text;
+} janus_duktape_message;
+/* Helper to find out which instance a Duktape context (or thread) belongs to */
+static janus_duktape_instance *janus_duktape_get_instance(duk_context *ctx) {
+	duk_push_heap_stash(ctx);
+	duk_get_prop_string(ctx, -1, "janus_instance");
+	janus_duktape_instance *instance = (janus_duktape_instance *)duk_get_pointer(ctx, -1);
+	duk_pop_2(ctx);
+	return instance ? instance : &duktape_instances[0];
+}
 /* JavaScript timer loop (for scheduled callbacks) */
 static GMainContext *timer_context = NULL;
 static GMainLoop *timer_loop = NULL;
@@ -321,10 +397,12 @@ typedef struct janus_duktape_callback {
 	guint id;
 	uint32_t ms;
 	GSource *source;
+	janus_duktape_instance *instance;
 	char *function;
 	char *argument;
 } janus_duktape_callback;
 static GHashTable *callbacks = NULL;
+static janus_mutex callbacks_mutex = JANUS_MUTEX_INITIALIZER;
 static void janus_duktape_callback_free(janus_duktape_callback *cb) {
 	if(!cb)
 		return;
@@ -492,7 +570,8 @@ static duk_ret_t janus_duktape_method_readfile(duk_context *ctx) {
 
 static duk_ret_t janus_duktape_method_pokescheduler(duk_context *ctx) {
 	/* This method allows the JavaScript script to poke the scheduler and have it wake up ASAP */
-	g_async_queue_push(events, GUINT_TO_POINTER(janus_duktape_event_resume));
+	janus_duktape_instance *instance = janus_duktape_get_instance(ctx);
+	g_async_queue_push(instance->events, GUINT_TO_POINTER(janus_duktape_event_resume));
 	duk_push_int(ctx, 0);
 	return 1;
 }
@@ -523,16 +602,93 @@ static duk_ret_t janus_duktape_method_timecallback(duk_context *ctx) {
 	if(argument != NULL)
 		cb->argument = g_strdup(argument);
 	cb->ms = ms;
+	cb->instance = janus_duktape_get_instance(ctx);
 	cb->source = g_timeout_source_new(ms);
 	g_source_set_callback(cb->source, janus_duktape_timer_cb, cb, NULL);
+	janus_mutex_lock(&callbacks_mutex);
 	g_hash_table_insert(callbacks, cb, cb);
 	cb->id = g_source_attach(cb->source, timer_context);
+	janus_mutex_unlock(&callbacks_mutex);
 	JANUS_LOG(LOG_VERB, "Created scheduled callback (%"SCNu32"ms) with ID %u\n", cb->ms, cb->id);
 	/* Done */
 	duk_push_int(ctx, 0);
 	return 1;
 }
 
+static duk_ret_t janus_duktape_method_getinstance(duk_context *ctx) {
+	/* This method allows the JS script to know which instance it's running in */
+	janus_duktape_instance *instance = janus_duktape_get_instance(ctx);
+	duk_push_int(ctx, instance->id);
+	return 1;
+}
+
+static duk_ret_t janus_duktape_method_getinstancescount(duk_context *ctx) {
+	/* This method allows the JS script to know how many instances there are */
+	duk_push_int(ctx, duktape_instances_count);
+	return 1;
+}
+
+static duk_ret_t janus_duktape_method_getsessioninstance(duk_context *ctx) {
+	if(duk_get_type(ctx, 0) != DUK_TYPE_NUMBER) {
+		duk_push_error_object(ctx, DUK_RET_TYPE_ERROR, "Invalid argument (expected %s, got %s)\n",
+			janus_duktape_type_string(DUK_TYPE_NUMBER), janus_duktape_type_string(duk_get_type(ctx, 0)));
+		return duk_throw(ctx);
+	}
+	uint32_t id = (uint32_t)duk_get_number(ctx, 0);
+	/* Find the session: it may be handled by any instance */
+	janus_mutex_lock(&duktape_sessions_mutex);
+	janus_duktape_session *session = g_hash_table_lookup(duktape_ids, GUINT_TO_POINTER(id));
+	if(session == NULL || g_atomic_int_get(&session->destroyed)) {
+		janus_mutex_unlock(&duktape_sessions_mutex);
+		duk_push_error_object(ctx, DUK_ERR_ERROR, "Session %"SCNu32" doesn't exist", id);
+		return duk_throw(ctx);
+	}
+	guint instance = session->instance->id;
+	janus_mutex_unlock(&duktape_sessions_mutex);
+	duk_push_int(ctx, instance);
+	return 1;
+}
+
+static duk_ret_t janus_duktape_method_postmessage(duk_context *ctx) {
+	/* This method allows the JS script to send a message to other instances:
+	 * instances share nothing, so this is how they can share state */
+	if(duk_get_type(ctx, 0) != DUK_TYPE_NUMBER) {
+		duk_push_error_object(ctx, DUK_RET_TYPE_ERROR, "Invalid argument (expected %s, got %s)\n",
+			janus_duktape_type_string(DUK_TYPE_NUMBER), janus_duktape_type_string(duk_get_type(ctx, 0)));
+		return duk_throw(ctx);
+	}
+	if(duk_get_type(ctx, 1) != DUK_TYPE_STRING) {
+		duk_push_error_object(ctx, DUK_RET_TYPE_ERROR, "Invalid argument (expected %s, got %s)\n",
+			janus_duktape_type_string(DUK_TYPE_STRING), janus_duktape_type_string(duk_get_type(ctx, 1)));
+		return duk_throw(ctx);
+	}
+	int target = (int)duk_get_number(ctx, 0);
+	const char *text = duk_get_string(ctx, 1);
+	if(target >= (int)duktape_instances_count) {
+		duk_push_error_object(ctx, DUK_ERR_ERROR, "Instance %d doesn't exist", target);
+		return duk_throw(ctx);
+	}
+	if(!has_incoming_message) {
+		duk_push_error_object(ctx, DUK_ERR_ERROR, "Can't post messages, the script has no incomingMessage callback");
+		return duk_throw(ctx);
+	}
+	/* A negative target means all the other instances */
+	janus_duktape_instance *instance = janus_duktape_get_instance(ctx);
+	int sent = 0;
+	guint i = 0;
+	for(i=0; i<duktape_instances_count; i++) {
+		if((target >= 0 && i != (guint)target) || (target < 0 && i == instance->id))
+			continue;
+		janus_duktape_message *msg = g_malloc(sizeof(janus_duktape_message));
+		msg->from = instance->id;
+		msg->text = g_strdup(text);
+		g_async_queue_push(duktape_instances[i].events, msg);
+		sent++;
+	}
+	duk_push_int(ctx, sent);
+	return 1;
+}
+
 static duk_ret_t janus_duktape_method_pushevent(duk_context *ctx) {
 	/* Get the arguments from the provided context */
 	if(duk_get_type(ctx, 0) != DUK_TYPE_NUMBER) {
@@ -972,6 +1128,37 @@ static duk_ret_t janus_duktape_method_setplifreq(duk_context *ctx) {
 	return 1;
 }
 
+static duk_ret_t janus_duktape_method_setnativemedia(duk_context *ctx) {
+	if(duk_get_type(ctx, 0) != DUK_TYPE_NUMBER) {
+		duk_push_error_object(ctx, DUK_RET_TYPE_ERROR, "Invalid argument (expected %s, got %s)\n",
+			janus_duktape_type_string(DUK_TYPE_NUMBER), janus_duktape_type_string(duk_get_type(ctx, 0)));
+		return duk_throw(ctx);
+	}
+	if(duk_get_type(ctx, 1) != DUK_TYPE_BOOLEAN) {
+		duk_push_error_object(ctx, DUK_RET_TYPE_ERROR, "Invalid argument (expected %s, got %s)\n",
+			janus_duktape_type_string(DUK_TYPE_BOOLEAN), janus_duktape_type_string(duk_get_type(ctx, 1)));
+		return duk_throw(ctx);
+	}
+	uint32_t id = (uint32_t)duk_get_number(ctx, 0);
+	gboolean native_media = duk_get_boolean(ctx, 1);
+	/* Find the session */
+	janus_mutex_lock(&duktape_sessions_mutex);
+	janus_duktape_session *session = g_hash_table_lookup(duktape_ids, GUINT_TO_POINTER(id));
+	if(session == NULL || g_atomic_int_get(&session->destroyed)) {
+		janus_mutex_unlock(&duktape_sessions_mutex);
+		duk_push_error_object(ctx, DUK_ERR_ERROR, "Session %"SCNu32" doesn't exist", id);
+		return duk_throw(ctx);
+	}
+	janus_refcount_increase(&session->ref);
+	janus_mutex_unlock(&duktape_sessions_mutex);
+	/* RTP and RTCP packets from this session will not be passed to the script anymore */
+	g_atomic_int_set(&session->native_media, native_media ? 1 : 0);
+	/* Done */
+	janus_refcount_decrease(&session->ref);
+	duk_push_int(ctx, 0);
+	return 1;
+}
+
 static duk_ret_t janus_duktape_method_setsubstream(duk_context *ctx) {
 	if(duk_get_type(ctx, 0) != DUK_TYPE_NUMBER) {
 		duk_push_error_object(ctx, DUK_RET_TYPE_ERROR, "Invalid argument (expected %s, got %s)\n",
@@ -1481,6 +1668,254 @@ static duk_ret_t janus_duktape_method_stoprecording(duk_context *ctx) {
 }
 
 
+/* Bytecode cache helpers */
+static char *janus_duktape_cache_path(const char *source, duk_size_t len, gboolean module) {
+	/* The key includes the Duktape version, as the bytecode format may change */
+	long version = DUK_VERSION;
+	GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA256);
+	g_checksum_update(checksum, (const guchar *)&version, sizeof(version));
+	g_checksum_update(checksum, (const guchar *)(module ? "m" : "s"), 1);
+	g_checksum_update(checksum, (const guchar *)source, len);
+	char *path = g_strdup_printf("%s/%s.dukbc", duktape_cache_folder, g_checksum_get_string(checksum));
+	g_checksum_free(checksum);
+	return path;
+}
+static duk_ret_t janus_duktape_cache_load_safe(duk_context *ctx, void *udata) {
+	duk_load_function(ctx);
+	return 1;
+}
+static duk_ret_t janus_duktape_cache_dump_safe(duk_context *ctx, void *udata) {
+	duk_dump_function(ctx);
+	return 1;
+}
+/* Compile [ ... source filename ] to [ ... function ] (or [ ... error ]), using the cache
+ * if possible: modules are evaluated as well, as it's their wrapper function we need */
+static duk_int_t janus_duktape_compile_cached(duk_context *ctx, gboolean module) {
+	char *path = NULL;
+	if(duktape_cache_folder != NULL) {
+		duk_size_t len = 0;
+		const char *source = duk_get_lstring(ctx, -2, &len);
+		if(source != NULL)
+			path = janus_duktape_cache_path(source, len, module);
+	}
+	if(path != NULL) {
+		gchar *bytecode = NULL;
+		gsize size = 0;
+		if(g_file_get_contents(path, &bytecode, &size, NULL) && size > 0) {
+			void *buf = duk_push_fixed_buffer(ctx, size);
+			memcpy(buf, bytecode, size);
+			g_free(bytecode);
+			if(duk_safe_call(ctx, janus_duktape_cache_load_safe, NULL, 1, 1) == DUK_EXEC_SUCCESS) {
+				/* Get rid of source and filename, we're done */
+				duk_remove(ctx, -2);
+				duk_remove(ctx, -2);
+				g_atomic_int_inc(&duktape_cache_hits);
+				g_free(path);
+				return DUK_EXEC_SUCCESS;
+			}
+			JANUS_LOG(LOG_WARN, "Invalid cached bytecode %s (%s), compiling again\n", path, duk_safe_to_string(ctx, -1));
+			duk_pop(ctx);
+			unlink(path);
+		} else {
+			g_free(bytecode);
+		}
+	}
+	duk_int_t rc = duk_pcompile(ctx, module ? DUK_COMPILE_EVAL : 0);
+	if(rc == DUK_EXEC_SUCCESS && module)
+		rc = duk_pcall(ctx, 0);
+	if(rc == DUK_EXEC_SUCCESS && path != NULL) {
+		g_atomic_int_inc(&duktape_cache_misses);
+		duk_dup(ctx, -1);
+		if(duk_safe_call(ctx, janus_duktape_cache_dump_safe, NULL, 1, 1) == DUK_EXEC_SUCCESS) {
+			duk_size_t size = 0;
+			void *bytecode = duk_get_buffer(ctx, -1, &size);
+			GError *error = NULL;
+			if(bytecode == NULL || !g_file_set_contents(path, bytecode, size, &error)) {
+				JANUS_LOG(LOG_WARN, "Couldn't save bytecode to %s: %s\n", path, error ? error->message : "no data");
+				if(error != NULL)
+					g_error_free(error);
+			}
+		}
+		duk_pop(ctx);
+	}
+	g_free(path);
+	return rc;
+}
+static duk_int_t janus_duktape_compile_module(duk_context *ctx) {
+	return janus_duktape_compile_cached(ctx, TRUE);
+}
+
+/* Helper to create a Duktape heap for an instance, and load the script in it */
+static int janus_duktape_instance_load(janus_duktape_instance *instance, const char *duktape_file) {
+	duk_context *ctx = duk_create_heap_default();
+	if(ctx == NULL) {
+		JANUS_LOG(LOG_ERR, "Error creating Duktape heap...\n");
+		return -1;
+	}
+	duk_console_init(ctx, DUK_CONSOLE_PROXY_WRAPPER);
+	duk_module_duktape_init(ctx);
+	/* Take note of which instance this heap belongs to */
+	duk_push_heap_stash(ctx);
+	duk_push_pointer(ctx, instance);
+	duk_put_prop_string(ctx, -2, "janus_instance");
+	duk_pop(ctx);
+
+	/* Register our functions */
+	duk_push_c_function(ctx, janus_duktape_method_getmodulesfolder, 0);
+	duk_put_global_string(ctx, "getModulesFolder");
+	duk_push_c_function(ctx, janus_duktape_method_readfile, 1);
+	duk_put_global_string(ctx, "readFile");
+	duk_push_c_function(ctx, janus_duktape_method_pokescheduler, 0);
+	duk_put_global_string(ctx, "pokeScheduler");
+	duk_push_c_function(ctx, janus_duktape_method_timecallback, 3);
+	duk_put_global_string(ctx, "timeCallback");
+	duk_push_c_function(ctx, janus_duktape_method_getinstance, 0);
+	duk_put_global_string(ctx, "getInstance");
+	duk_push_c_function(ctx, janus_duktape_method_getinstancescount, 0);
+	duk_put_global_string(ctx, "getInstancesCount");
+	duk_push_c_function(ctx, janus_duktape_method_getsessioninstance, 1);
+	duk_put_global_string(ctx, "getSessionInstance");
+	duk_push_c_function(ctx, janus_duktape_method_postmessage, 2);
+	duk_put_global_string(ctx, "postMessage");
+	duk_push_c_function(ctx, janus_duktape_method_pushevent, 4);
+	duk_put_global_string(ctx, "pushEvent");
+	duk_push_c_function(ctx, janus_duktape_method_notifyevent, 2);
+	duk_put_global_string(ctx, "notifyEvent");
+	duk_push_c_function(ctx, janus_duktape_method_eventsisenabled, 0);
+	duk_put_global_string(ctx, "eventsIsEnabled");
+	duk_push_c_function(ctx, janus_duktape_method_closepc, 1);
+	duk_put_global_string(ctx, "closePc");
+	duk_push_c_function(ctx, janus_duktape_method_endsession, 1);
+	duk_put_global_string(ctx, "endSession");
+	duk_push_c_function(ctx, janus_duktape_method_configuremedium, 4);
+	duk_put_global_string(ctx, "configureMedium");
+	duk_push_c_function(ctx, janus_duktape_method_addrecipient, 2);
+	duk_put_global_string(ctx, "addRecipient");
+	duk_push_c_function(ctx, janus_duktape_method_removerecipient, 2);
+	duk_put_global_string(ctx, "removeRecipient");
+	duk_push_c_function(ctx, janus_duktape_method_setbitrate, 2);
+	duk_put_global_string(ctx, "setBitrate");
+	duk_push_c_function(ctx, janus_duktape_method_setplifreq, 2);
+	duk_put_global_string(ctx, "setPliFreq");
+	duk_push_c_function(ctx, janus_duktape_method_setnativemedia, 2);
+	duk_put_global_string(ctx, "setNativeMedia");
+	duk_push_c_function(ctx, janus_duktape_method_setsubstream, 2);
+	duk_put_global_string(ctx, "setSubstream");
+	duk_push_c_function(ctx, janus_duktape_method_settemporallayer, 2);
+	duk_put_global_string(ctx, "setTemporalLayer");
+	duk_push_c_function(ctx, janus_duktape_method_sendpli, 1);
+	duk_put_global_string(ctx, "sendPli");
+	duk_push_c_function(ctx, janus_duktape_method_relayrtp, 4);
+	duk_put_global_string(ctx, "relayRtp");
+	duk_push_c_function(ctx, janus_duktape_method_relayrtcp, 4);
+	duk_put_global_string(ctx, "relayRtcp");
+	duk_push_c_function(ctx, janus_duktape_method_relaydata, 5);	/* Legacy function, deprecated */
+	duk_put_global_string(ctx, "relayData");
+	duk_push_c_function(ctx, janus_duktape_method_relaytextdata, 5);
+	duk_put_global_string(ctx, "relayTextData");
+	duk_push_c_function(ctx, janus_duktape_method_relaybinarydata, 5);
+	duk_put_global_string(ctx, "relayBinaryData");
+	duk_push_c_function(ctx, janus_duktape_method_startrecording, 13);
+	duk_put_global_string(ctx, "startRecording");
+	duk_push_c_function(ctx, janus_duktape_method_stoprecording, 4);
+	duk_put_global_string(ctx, "stopRecording");
+	duk_push_c_function(ctx, janus_duktape_method_getversion, 0);
+	duk_put_global_string(ctx, "getDuktapeVersion");
+	/* Register all extra functions, if any were added */
+	janus_duktape_register_extra_functions(ctx);
+
+	/* Now load the script (FIXME badly) */
+	FILE *f = fopen(duktape_file, "rb");
+	if(f == NULL) {
+		JANUS_LOG(LOG_ERR, "Error loading JS script %s: no such file\n", duktape_file);
+		duk_destroy_heap(ctx);
+		return -1;
+	}
+	fseek(f, 0, SEEK_END);
+	long int fs = ftell(f);
+	if(fs < 1) {
+		JANUS_LOG(LOG_ERR, "Error loading JS script %s: empty file\n", duktape_file);
+		fclose(f);
+		duk_destroy_heap(ctx);
+		return -1;
+	}
+	size_t len = fs;
+	char *buf = (char *)g_malloc0(len);
+	fseek(f, 0, SEEK_SET);
+	if(fread((void *)buf, 1, len, f) < len) {
+		JANUS_LOG(LOG_ERR, "Error reading JS script %s: %s\n", duktape_file, g_strerror(errno));
+		g_free(buf);
+		fclose(f);
+		duk_destroy_heap(ctx);
+		return -1;
+	}
+	fclose(f);
+	duk_push_lstring(ctx, (const char *)buf, (duk_size_t)len);
+	g_free(buf);
+	duk_push_string(ctx, duktape_file);
+	if(janus_duktape_compile_cached(ctx, FALSE) != DUK_EXEC_SUCCESS || duk_pcall(ctx, 0) != DUK_EXEC_SUCCESS) {
+		JANUS_LOG(LOG_ERR, "Error loading JS script %s: %s\n", duktape_file, duk_safe_to_string(ctx, -1));
+		duk_destroy_heap(ctx);
+		return -1;
+	}
+	duk_pop(ctx);
+	/* Make sure that all the functions we need are there */
+	uint i=0;
+	for(i=0; i<duktape_funcsize; i++) {
+		duk_get_global_string(ctx, duktape_functions[i]);
+		if(duk_is_function(ctx, duk_get_top(ctx)-1) == 0) {
+			JANUS_LOG(LOG_ERR, "Function '%s' is missing in %s\n", duktape_functions[i], duktape_file);
+			duk_destroy_heap(ctx);
+			return -1;
+		}
+	}
+	instance->ctx = ctx;
+	return 0;
+}
+
+/* Helper to stop the schedulers and get rid of the Duktape instances */
+static void janus_duktape_instances_free(void) {
+	if(duktape_instances == NULL)
+		return;
+	guint i = 0;
+	for(i=0; i<duktape_instances_count; i++) {
+		janus_duktape_instance *instance = &duktape_instances[i];
+		if(instance->scheduler != NULL) {
+			g_async_queue_push(instance->events, GUINT_TO_POINTER(janus_duktape_event_exit));
+			g_thread_join(instance->scheduler);
+			instance->scheduler = NULL;
+		}
+	}
+	for(i=0; i<duktape_instances_count; i++) {
+		janus_duktape_instance *instance = &duktape_instances[i];
+		if(instance->mutex != NULL)
+			janus_mutex_lock(instance->mutex);
+		if(instance->ctx != NULL)
+			duk_destroy_heap(instance->ctx);
+		instance->ctx = NULL;
+		if(instance->mutex != NULL)
+			janus_mutex_unlock(instance->mutex);
+		if(instance->events != NULL) {
+			janus_duktape_message *msg = NULL;
+			while((msg = g_async_queue_try_pop(instance->events)) != NULL) {
+				if(msg == GUINT_TO_POINTER(janus_duktape_event_resume) || msg == GUINT_TO_POINTER(janus_duktape_event_exit))
+					continue;
+				g_free(msg->text);
+				g_free(msg);
+			}
+			g_async_queue_unref(instance->events);
+		}
+		if(instance->mutex != NULL && instance->mutex != &duktape_mutex) {
+			janus_mutex_destroy(instance->mutex);
+			g_free(instance->mutex);
+		}
+	}
+	g_free(duktape_instances);
+	duktape_instances = NULL;
+	duktape_ctx = NULL;
+}
+
+
 /* Plugin implementation */
 int janus_duktape_init(janus_callbacks *callback, const char *config_path) {
 	if(g_atomic_int_get(&duktape_stopping)) {
@@ -1518,6 +1953,7 @@ int janus_duktape_init(janus_callbacks *callback, const char *config_path) {
 		JANUS_LOG(LOG_ERR, "Missing script path in Duktape plugin configuration...\n");
 		janus_config_destroy(config);
 		g_free(duktape_folder);
+		g_clear_pointer(&duktape_cache_folder, g_free);
 		return -1;
 	}
 	char *duktape_file = g_strdup(script->value);
@@ -1525,126 +1961,57 @@ int janus_duktape_init(janus_callbacks *callback, const char *config_path) {
 	janus_config_item *conf = janus_config_get(config, config_general, janus_config_type_item, "config");
 	if(conf && conf->value)
 		duktape_config = g_strdup(conf->value);
-	janus_config_destroy(config);
-
-	/* Initialize Duktape */
-	duktape_ctx = duk_create_heap_default();
-	if(duktape_ctx == NULL) {
-		JANUS_LOG(LOG_ERR, "Error creating Duktape heap...\n");
-		g_free(duktape_folder);
-		return -1;
-	}
-	duk_console_init(duktape_ctx, DUK_CONSOLE_PROXY_WRAPPER);
-	duk_module_duktape_init(duktape_ctx);
-
-	/* Register our functions */
-	duk_push_c_function(duktape_ctx, janus_duktape_method_getmodulesfolder, 0);
-	duk_put_global_string(duktape_ctx, "getModulesFolder");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_readfile, 1);
-	duk_put_global_string(duktape_ctx, "readFile");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_pokescheduler, 0);
-	duk_put_global_string(duktape_ctx, "pokeScheduler");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_timecallback, 3);
-	duk_put_global_string(duktape_ctx, "timeCallback");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_pushevent, 4);
-	duk_put_global_string(duktape_ctx, "pushEvent");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_notifyevent, 2);
-	duk_put_global_string(duktape_ctx, "notifyEvent");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_eventsisenabled, 0);
-	duk_put_global_string(duktape_ctx, "eventsIsEnabled");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_closepc, 1);
-	duk_put_global_string(duktape_ctx, "closePc");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_endsession, 1);
-	duk_put_global_string(duktape_ctx, "endSession");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_configuremedium, 4);
-	duk_put_global_string(duktape_ctx, "configureMedium");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_addrecipient, 2);
-	duk_put_global_string(duktape_ctx, "addRecipient");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_removerecipient, 2);
-	duk_put_global_string(duktape_ctx, "removeRecipient");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_setbitrate, 2);
-	duk_put_global_string(duktape_ctx, "setBitrate");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_setplifreq, 2);
-	duk_put_global_string(duktape_ctx, "setPliFreq");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_setsubstream, 2);
-	duk_put_global_string(duktape_ctx, "setSubstream");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_settemporallayer, 2);
-	duk_put_global_string(duktape_ctx, "setTemporalLayer");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_sendpli, 1);
-	duk_put_global_string(duktape_ctx, "sendPli");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_relayrtp, 4);
-	duk_put_global_string(duktape_ctx, "relayRtp");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_relayrtcp, 4);
-	duk_put_global_string(duktape_ctx, "relayRtcp");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_relaydata, 5);	/* Legacy function, deprecated */
-	duk_put_global_string(duktape_ctx, "relayData");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_relaytextdata, 5);
-	duk_put_global_string(duktape_ctx, "relayTextData");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_relaybinarydata, 5);
-	duk_put_global_string(duktape_ctx, "relayBinaryData");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_startrecording, 13);
-	duk_put_global_string(duktape_ctx, "startRecording");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_stoprecording, 4);
-	duk_put_global_string(duktape_ctx, "stopRecording");
-	duk_push_c_function(duktape_ctx, janus_duktape_method_getversion, 0);
-	duk_put_global_string(duktape_ctx, "getDuktapeVersion");
-	/* Register all extra functions, if any were added */
-	janus_duktape_register_extra_functions(duktape_ctx);
-
-	/* Now load the script (FIXME badly) */
-	FILE *f = fopen(duktape_file, "rb");
-	if(f == NULL) {
-		JANUS_LOG(LOG_ERR, "Error loading JS script %s: no such file\n", duktape_file);
-		duk_destroy_heap(duktape_ctx);
-		g_free(duktape_folder);
-		g_free(duktape_file);
-		return -1;
-	}
-	fseek(f, 0, SEEK_END);
-	long int fs = ftell(f);
-	if(fs < 1) {
-		JANUS_LOG(LOG_ERR, "Error loading JS script %s: empty file\n", duktape_file);
-		fclose(f);
-		duk_destroy_heap(duktape_ctx);
-		g_free(duktape_folder);
-		g_free(duktape_file);
-		return -1;
-	}
-	size_t len = fs;
-	char *buf = (char *)g_malloc0(len);
-	fseek(f, 0, SEEK_SET);
-	if(fread((void *)buf, 1, len, f) < len) {
-		JANUS_LOG(LOG_ERR, "Error reading JS script %s: %s\n", duktape_file, g_strerror(errno));
-		g_free(buf);
-		fclose(f);
-		duk_destroy_heap(duktape_ctx);
-		g_free(duktape_folder);
-		g_free(duktape_file);
-		return -1;
+	janus_config_item *cache = janus_config_get(config, config_general, janus_config_type_item, "cache");
+	if(cache && cache->value) {
+		if(g_mkdir_with_parents(cache->value, 0755) < 0) {
+			JANUS_LOG(LOG_WARN, "Couldn't create bytecode cache folder %s (%s), cache disabled\n",
+				cache->value, g_strerror(errno));
+		} else {
+			duktape_cache_folder = g_strdup(cache->value);
+			JANUS_LOG(LOG_INFO, "Caching compiled bytecode in %s\n", duktape_cache_folder);
+		}
 	}
-	fclose(f);
-	duk_push_lstring(duktape_ctx, (const char *)buf, (duk_size_t)len);
-	g_free(buf);
-	if(duk_peval(duktape_ctx) != 0) {
-		JANUS_LOG(LOG_ERR, "Error loading JS script %s: %s\n", duktape_file, duk_safe_to_string(duktape_ctx, -1));
-		duk_destroy_heap(duktape_ctx);
-		g_free(duktape_folder);
-		g_free(duktape_file);
-		return -1;
+	duk_module_duktape_set_compile_hook(duktape_cache_folder ? janus_duktape_compile_module : NULL);
+	janus_config_item *inst = janus_config_get(config, config_general, janus_config_type_item, "instances");
+	if(inst && inst->value) {
+		int instances = atoi(inst->value);
+		if(instances < 1) {
+			JANUS_LOG(LOG_WARN, "Invalid number of instances (%s), using a single Duktape heap\n", inst->value);
+			instances = 1;
+		}
+		duktape_instances_count = instances;
 	}
-	duk_pop(duktape_ctx);
-	/* Make sure that all the functions we need are there */
-	uint i=0;
-	for(i=0; i<duktape_funcsize; i++) {
-		duk_get_global_string(duktape_ctx, duktape_functions[i]);
-		if(duk_is_function(duktape_ctx, duk_get_top(duktape_ctx)-1) == 0) {
-			JANUS_LOG(LOG_ERR, "Function '%s' is missing in %s\n", duktape_functions[i], duktape_file);
-			duk_destroy_heap(duktape_ctx);
+	janus_config_destroy(config);
+
+	/* Initialize Duktape: each instance gets its own heap, with the script loaded */
+	duktape_instances = g_malloc0(duktape_instances_count * sizeof(janus_duktape_instance));
+	guint i = 0;
+	for(i=0; i<duktape_instances_count; i++) {
+		janus_duktape_instance *instance = &duktape_instances[i];
+		instance->id = i;
+		if(i == 0) {
+			instance->mutex = &duktape_mutex;
+		} else {
+			instance->mutex = g_malloc(sizeof(janus_mutex));
+			janus_mutex_init(instance->mutex);
+		}
+		instance->events = g_async_queue_new();
+		if(janus_duktape_instance_load(instance, duktape_file) < 0) {
+			janus_duktape_instances_free();
+			duktape_instances_count = 1;
 			g_free(duktape_folder);
+			g_clear_pointer(&duktape_cache_folder, g_free);
 			g_free(duktape_file);
+			g_free(duktape_config);
 			return -1;
 		}
 	}
+	duktape_ctx = duktape_instances[0].ctx;
+	if(duktape_cache_folder != NULL) {
+		JANUS_LOG(LOG_INFO, "Bytecode cache: %d hits, %d misses\n",
+			g_atomic_int_get(&duktape_cache_hits), g_atomic_int_get(&duktape_cache_misses));
+	}
+
 	/* Some JS functions are optional (e.g., those to directly handle RTP, RTCP and
 	 * data, as those will typically be kept at a C level, with JavaScript only dictating
 	 * the logic, or those overriding the plugin namespace and versioning information */
@@ -1699,27 +2066,38 @@ int janus_duktape_init(janus_callbacks *callback, const char *config_path) {
 	duk_get_global_string(duktape_ctx, "temporalLayerChanged");
 	if(duk_is_function(duktape_ctx, duk_get_top(duktape_ctx)-1) != 0)
 		has_temporal_changed = TRUE;
+	duk_get_global_string(duktape_ctx, "incomingMessage");
+	if(duk_is_function(duktape_ctx, duk_get_top(duktape_ctx)-1) != 0)
+		has_incoming_message = TRUE;
+	if(duktape_instances_count > 1 && !has_incoming_message) {
+		JANUS_LOG(LOG_WARN, "JS script loaded in %u instances, but with no incomingMessage callback to share state\n",
+			duktape_instances_count);
+	}
 
 	duktape_sessions = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_duktape_session_destroy);
 	duktape_ids = g_hash_table_new(NULL, NULL);
-	events = g_async_queue_new();
 	callbacks = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_duktape_callback_free);
 
 	g_atomic_int_set(&duktape_initialized, 1);
 
-	/* Launch the scheduler thread (which will be responsible for resuming asynchronous coroutines) */
+	/* Launch the scheduler threads (which will be responsible for resuming asynchronous coroutines) */
 	GError *error = NULL;
-	scheduler_thread = g_thread_try_new("duktape scheduler", janus_duktape_scheduler, NULL, &error);
-	if(error != NULL) {
-		g_atomic_int_set(&duktape_initialized, 0);
-		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Duktape scheduler thread...\n",
-			error->code, error->message ? error->message : "??");
-		g_error_free(error);
-		duk_destroy_heap(duktape_ctx);
-		g_free(duktape_folder);
-		g_free(duktape_file);
-		g_free(duktape_config);
-		return -1;
+	for(i=0; i<duktape_instances_count; i++) {
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "duktape sched %u", i);
+		duktape_instances[i].scheduler = g_thread_try_new(tname, janus_duktape_scheduler, &duktape_instances[i], &error);
+		if(error != NULL) {
+			g_atomic_int_set(&duktape_initialized, 0);
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Duktape scheduler thread...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			janus_duktape_instances_free();
+			g_free(duktape_folder);
+			g_clear_pointer(&duktape_cache_folder, g_free);
+			g_free(duktape_file);
+			g_free(duktape_config);
+			return -1;
+		}
 	}
 	/* Launch the timer loop thread (which will be responsible for scheduling timed callbacks) */
 	timer_context = g_main_context_new();
@@ -1734,8 +2112,9 @@ int janus_duktape_init(janus_callbacks *callback, const char *config_path) {
 			g_main_loop_unref(timer_loop);
 		if(timer_context != NULL)
 			g_main_context_unref(timer_context);
-		duk_destroy_heap(duktape_ctx);
+		janus_duktape_instances_free();
 		g_free(duktape_folder);
+		g_clear_pointer(&duktape_cache_folder, g_free);
 		g_free(duktape_file);
 		g_free(duktape_config);
 		return -1;
@@ -1744,24 +2123,40 @@ int janus_duktape_init(janus_callbacks *callback, const char *config_path) {
 	/* This is the callback we'll need to invoke to contact the Janus core */
 	duktape_janus_core = callback;
 
-	/* Init the JS script, in case it's needed */
-	duk_get_global_string(duktape_ctx, "init");
-	duk_push_string(duktape_ctx, duktape_config);
-	int res = duk_pcall(duktape_ctx, 1);
-	if(res != DUK_EXEC_SUCCESS) {
-		g_atomic_int_set(&duktape_initialized, 0);
-		JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(duktape_ctx, -1));
-		duk_pop(duktape_ctx);
-		if(timer_loop != NULL)
-			g_main_loop_unref(timer_loop);
-		if(timer_context != NULL)
-			g_main_context_unref(timer_context);
-		duk_destroy_heap(duktape_ctx);
-		g_free(duktape_folder);
-		g_free(duktape_file);
-		g_free(duktape_config);
-		return -1;
+	/* Init the JS script in all instances, in case it's needed */
+	for(i=0; i<duktape_instances_count; i++) {
+		duk_context *ctx = duktape_instances[i].ctx;
+		janus_mutex_lock(duktape_instances[i].mutex);
+		duk_get_global_string(ctx, "init");
+		duk_push_string(ctx, duktape_config);
+		int res = duk_pcall(ctx, 1);
+		if(res != DUK_EXEC_SUCCESS) {
+			g_atomic_int_set(&duktape_initialized, 0);
+			JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(ctx, -1));
+			duk_pop(ctx);
+			janus_mutex_unlock(duktape_instances[i].mutex);
+			if(timer_loop != NULL)
+				g_main_loop_quit(timer_loop);
+			if(timer_thread != NULL) {
+				g_thread_join(timer_thread);
+				timer_thread = NULL;
+			}
+			if(timer_loop != NULL)
+				g_main_loop_unref(timer_loop);
+			if(timer_context != NULL)
+				g_main_context_unref(timer_context);
+			janus_duktape_instances_free();
+			g_free(duktape_folder);
+			g_clear_pointer(&duktape_cache_folder, g_free);
+			g_free(duktape_file);
+			g_free(duktape_config);
+			return -1;
+		}
+		duk_pop(ctx);
+		janus_mutex_unlock(duktape_instances[i].mutex);
 	}
+	if(duktape_instances_count > 1)
+		JANUS_LOG(LOG_INFO, "JS script loaded in %u instances\n", duktape_instances_count);
 
 	g_free(duktape_file);
 	g_free(duktape_config);
@@ -1775,10 +2170,13 @@ void janus_duktape_destroy(void) {
 		return;
 	g_atomic_int_set(&duktape_stopping, 1);
 
-	g_async_queue_push(events, GUINT_TO_POINTER(janus_duktape_event_exit));
-	if(scheduler_thread != NULL) {
-		g_thread_join(scheduler_thread);
-		scheduler_thread = NULL;
+	guint i = 0;
+	for(i=0; i<duktape_instances_count; i++) {
+		if(duktape_instances[i].scheduler != NULL) {
+			g_async_queue_push(duktape_instances[i].events, GUINT_TO_POINTER(janus_duktape_event_exit));
+			g_thread_join(duktape_instances[i].scheduler);
+			duktape_instances[i].scheduler = NULL;
+		}
 	}
 	if(timer_loop != NULL)
 		g_main_loop_quit(timer_loop);
@@ -1795,31 +2193,32 @@ void janus_duktape_destroy(void) {
 		timer_context = NULL;
 	}
 
-	/* Deinit the JS script, in case it's needed */
-	janus_mutex_lock(&duktape_mutex);
-	duk_get_global_string(duktape_ctx, "destroy");
-	int res = duk_pcall(duktape_ctx, 0);
-	if(res != DUK_EXEC_SUCCESS) {
-		JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(duktape_ctx, -1));
-		duk_pop(duktape_ctx);
+	/* Deinit the JS script in all instances, in case it's needed */
+	for(i=0; i<duktape_instances_count; i++) {
+		duk_context *ctx = duktape_instances[i].ctx;
+		janus_mutex_lock(duktape_instances[i].mutex);
+		duk_get_global_string(ctx, "destroy");
+		int res = duk_pcall(ctx, 0);
+		if(res != DUK_EXEC_SUCCESS) {
+			JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(ctx, -1));
+		}
+		duk_pop(ctx);
+		janus_mutex_unlock(duktape_instances[i].mutex);
 	}
+	janus_mutex_lock(&callbacks_mutex);
 	g_hash_table_destroy(callbacks);
 	callbacks = NULL;
-	janus_mutex_unlock(&duktape_mutex);
+	janus_mutex_unlock(&callbacks_mutex);
 
 	janus_mutex_lock(&duktape_sessions_mutex);
 	g_hash_table_destroy(duktape_sessions);
 	duktape_sessions = NULL;
 	g_hash_table_destroy(duktape_ids);
 	duktape_ids = NULL;
-	g_async_queue_unref(events);
-	events = NULL;
 	janus_mutex_unlock(&duktape_sessions_mutex);
 
-	janus_mutex_lock(&duktape_mutex);
-	duk_destroy_heap(duktape_ctx);
-	duktape_ctx = NULL;
-	janus_mutex_unlock(&duktape_mutex);
+	janus_duktape_instances_free();
+	duktape_instances_count = 1;
 
 	g_free(duktape_script_version_string);
 	g_free(duktape_script_description);
@@ -1828,6 +2227,10 @@ void janus_duktape_destroy(void) {
 	g_free(duktape_script_package);
 
 	g_free(duktape_folder);
+	g_clear_pointer(&duktape_cache_folder, g_free);
+	duk_module_duktape_set_compile_hook(NULL);
+	g_atomic_int_set(&duktape_cache_hits, 0);
+	g_atomic_int_set(&duktape_cache_misses, 0);
 
 	g_atomic_int_set(&duktape_initialized, 0);
 	g_atomic_int_set(&duktape_stopping, 0);
@@ -2078,6 +2481,8 @@ void janus_duktape_create_session(janus_plugin_session *handle, int *error) {
 	session->vcodec = JANUS_VIDEOCODEC_NONE;
 	g_atomic_int_set(&session->hangingup, 0);
 	g_atomic_int_set(&session->destroyed, 0);
+	/* Sessions are sharded among the available Duktape instances */
+	session->instance = &duktape_instances[janus_uint64_hash(id) % duktape_instances_count];
 	janus_refcount_init(&session->ref, janus_duktape_session_free);
 	handle->plugin_handle = session;
 	g_hash_table_insert(duktape_sessions, handle, session);
@@ -2085,9 +2490,10 @@ void janus_duktape_create_session(janus_plugin_session *handle, int *error) {
 	janus_mutex_unlock(&duktape_sessions_mutex);
 
 	/* Notify the JS script */
-	janus_mutex_lock(&duktape_mutex);
-	duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-	duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+	janus_duktape_instance *instance = session->instance;
+	janus_mutex_lock(instance->mutex);
+	duk_idx_t thr_idx = duk_push_thread(instance->ctx);
+	duk_context *t = duk_get_context(instance->ctx, thr_idx);
 	duk_get_global_string(t, "createSession");
 	duk_push_number(t, session->id);
 	int res = duk_pcall(t, 1);
@@ -2096,8 +2502,8 @@ void janus_duktape_create_session(janus_plugin_session *handle, int *error) {
 		JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 	}
 	duk_pop(t);
-	duk_pop(duktape_ctx);
-	janus_mutex_unlock(&duktape_mutex);
+	duk_pop(instance->ctx);
+	janus_mutex_unlock(instance->mutex);
 
 	return;
 }
@@ -2121,9 +2527,10 @@ void janus_duktape_destroy_session(janus_plugin_session *handle, int *error) {
 	janus_mutex_unlock(&duktape_sessions_mutex);
 
 	/* Notify the JS script */
-	janus_mutex_lock(&duktape_mutex);
-	duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-	duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+	janus_duktape_instance *instance = session->instance;
+	janus_mutex_lock(instance->mutex);
+	duk_idx_t thr_idx = duk_push_thread(instance->ctx);
+	duk_context *t = duk_get_context(instance->ctx, thr_idx);
 	duk_get_global_string(t, "destroySession");
 	duk_push_number(t, id);
 	int res = duk_pcall(t, 1);
@@ -2132,8 +2539,8 @@ void janus_duktape_destroy_session(janus_plugin_session *handle, int *error) {
 		JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 	}
 	duk_pop(t);
-	duk_pop(duktape_ctx);
-	janus_mutex_unlock(&duktape_mutex);
+	duk_pop(instance->ctx);
+	janus_mutex_unlock(instance->mutex);
 
 	/* Get any rid references recipients of this sessions may have */
 	janus_mutex_lock(&session->recipients_mutex);
@@ -2171,9 +2578,10 @@ json_t *janus_duktape_query_session(janus_plugin_session *handle) {
 	janus_refcount_increase(&session->ref);
 	janus_mutex_unlock(&duktape_sessions_mutex);
 	/* Ask the JS script for information on this session */
-	janus_mutex_lock(&duktape_mutex);
-	duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-	duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+	janus_duktape_instance *instance = session->instance;
+	janus_mutex_lock(instance->mutex);
+	duk_idx_t thr_idx = duk_push_thread(instance->ctx);
+	duk_context *t = duk_get_context(instance->ctx, thr_idx);
 	duk_get_global_string(t, "querySession");
 	duk_push_number(t, session->id);
 	int res = duk_pcall(t, 1);
@@ -2183,19 +2591,19 @@ json_t *janus_duktape_query_session(janus_plugin_session *handle) {
 		json_t *json = json_object();
 		json_object_set_new(json, "error", json_string(duk_safe_to_string(t, -1)));
 		duk_pop(t);
-		duk_pop(duktape_ctx);
+		duk_pop(instance->ctx);
 		janus_refcount_decrease(&session->ref);
-		janus_mutex_unlock(&duktape_mutex);
+		janus_mutex_unlock(instance->mutex);
 		return json;
 	}
 	janus_refcount_decrease(&session->ref);
 	const char *info = duk_get_string(t, -1);
 	duk_pop(t);
-	duk_pop(duktape_ctx);
+	duk_pop(instance->ctx);
 	/* We need a Jansson object */
 	json_error_t error;
 	json_t *json = json_loads(info, 0, &error);
-	janus_mutex_unlock(&duktape_mutex);
+	janus_mutex_unlock(instance->mutex);
 	if(!json) {
 		JANUS_LOG(LOG_ERR, "JSON error: on line %d: %s", error.line, error.text);
 		return NULL;
@@ -2260,9 +2668,10 @@ struct janus_plugin_result *janus_duktape_handle_message(janus_plugin_session *h
 		json_decref(jsep);
 	}
 	/* Invoke the script function */
-	janus_mutex_lock(&duktape_mutex);
-	duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-	duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+	janus_duktape_instance *instance = session->instance;
+	janus_mutex_lock(instance->mutex);
+	duk_idx_t thr_idx = duk_push_thread(instance->ctx);
+	duk_context *t = duk_get_context(instance->ctx, thr_idx);
 	duk_get_global_string(t, "handleMessage");
 	duk_push_number(t, session->id);
 	duk_push_string(t, transaction);
@@ -2273,8 +2682,8 @@ struct janus_plugin_result *janus_duktape_handle_message(janus_plugin_session *h
 		/* Something went wrong... */
 		JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(instance->ctx);
+		janus_mutex_unlock(instance->mutex);
 		return janus_plugin_result_new(JANUS_PLUGIN_ERROR, "Duktape error", NULL);
 	}
 	janus_refcount_decrease(&session->ref);
@@ -2288,8 +2697,8 @@ struct janus_plugin_result *janus_duktape_handle_message(janus_plugin_session *h
 		/* Either an error or an asynchronous response */
 		int res = (int)duk_get_number(t, 0);
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(instance->ctx);
+		janus_mutex_unlock(instance->mutex);
 		if(res < 0) {
 			/* We got an error */
 			return janus_plugin_result_new(JANUS_PLUGIN_ERROR, "Duktape error", NULL);
@@ -2302,8 +2711,8 @@ struct janus_plugin_result *janus_duktape_handle_message(janus_plugin_session *h
 		json_error_t error;
 		json_t *json = json_loads(response, 0, &error);
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(instance->ctx);
+		janus_mutex_unlock(instance->mutex);
 		if(!json) {
 			JANUS_LOG(LOG_ERR, "JSON error: on line %d: %s\n", error.line, error.text);
 			return janus_plugin_result_new(JANUS_PLUGIN_ERROR, "Duktape error", NULL);
@@ -2312,8 +2721,8 @@ struct janus_plugin_result *janus_duktape_handle_message(janus_plugin_session *h
 	}
 	/* If we got here, we didn't get what we expect */
 	duk_pop(t);
-	duk_pop(duktape_ctx);
-	janus_mutex_unlock(&duktape_mutex);
+	duk_pop(instance->ctx);
+	janus_mutex_unlock(instance->mutex);
 	return janus_plugin_result_new(JANUS_PLUGIN_ERROR, "Duktape error", NULL);
 }
 
@@ -2378,9 +2787,10 @@ void janus_duktape_setup_media(janus_plugin_session *handle) {
 	session->pli_latest = janus_get_monotonic_time();
 
 	/* Notify the JS script */
-	janus_mutex_lock(&duktape_mutex);
-	duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-	duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+	janus_duktape_instance *instance = session->instance;
+	janus_mutex_lock(instance->mutex);
+	duk_idx_t thr_idx = duk_push_thread(instance->ctx);
+	duk_context *t = duk_get_context(instance->ctx, thr_idx);
 	duk_get_global_string(t, "setupMedia");
 	duk_push_number(t, session->id);
 	int res = duk_pcall(t, 1);
@@ -2389,8 +2799,8 @@ void janus_duktape_setup_media(janus_plugin_session *handle) {
 		JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 	}
 	duk_pop(t);
-	duk_pop(duktape_ctx);
-	janus_mutex_unlock(&duktape_mutex);
+	duk_pop(instance->ctx);
+	janus_mutex_unlock(instance->mutex);
 	janus_refcount_decrease(&session->ref);
 }
 
@@ -2408,11 +2818,12 @@ void janus_duktape_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp *
 	char *buf = rtp_packet->buffer;
 	uint16_t len = rtp_packet->length;
 	/* Check if the JS script wants to handle/manipulate RTP packets itself */
-	if(has_incoming_rtp) {
+	if(has_incoming_rtp && !g_atomic_int_get(&session->native_media)) {
 		/* Yep, pass the data to the JS script and return */
-		janus_mutex_lock(&duktape_mutex);
-		duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-		duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+		janus_duktape_instance *instance = session->instance;
+		janus_mutex_lock(instance->mutex);
+		duk_idx_t thr_idx = duk_push_thread(instance->ctx);
+		duk_context *t = duk_get_context(instance->ctx, thr_idx);
 		duk_get_global_string(t, "incomingRtp");
 		duk_push_number(t, session->id);
 		duk_push_boolean(t, video);
@@ -2424,8 +2835,8 @@ void janus_duktape_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp *
 			JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 		}
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(instance->ctx);
+		janus_mutex_unlock(instance->mutex);
 		return;
 	}
 	/* Is this session allowed to send media? */
@@ -2525,11 +2936,12 @@ void janus_duktape_incoming_rtcp(janus_plugin_session *handle, janus_plugin_rtcp
 	char *buf = packet->buffer;
 	uint16_t len = packet->length;
 	/* Check if the JS script wants to handle/manipulate RTCP packets itself */
-	if(has_incoming_rtcp) {
+	if(has_incoming_rtcp && !g_atomic_int_get(&session->native_media)) {
 		/* Yep, pass the data to the JS script and return */
-		janus_mutex_lock(&duktape_mutex);
-		duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-		duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+		janus_duktape_instance *instance = session->instance;
+		janus_mutex_lock(instance->mutex);
+		duk_idx_t thr_idx = duk_push_thread(instance->ctx);
+		duk_context *t = duk_get_context(instance->ctx, thr_idx);
 		duk_get_global_string(t, "incomingRtcp");
 		duk_push_number(t, session->id);
 		duk_push_boolean(t, video);
@@ -2541,8 +2953,8 @@ void janus_duktape_incoming_rtcp(janus_plugin_session *handle, janus_plugin_rtcp
 			JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 		}
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(instance->ctx);
+		janus_mutex_unlock(instance->mutex);
 		return;
 	}
 	/* If a REMB arrived, make sure we cap it to our configuration, and send it as a video RTCP */
@@ -2585,9 +2997,10 @@ void janus_duktape_incoming_data(janus_plugin_session *handle, janus_plugin_data
 		/* Yep, pass the data to the JS script and return */
 		if(packet->binary && !has_incoming_text_data)
 			JANUS_LOG(LOG_WARN, "Missing 'incomingTextData', invoking deprecated function 'incomingData' instead\n");
-		janus_mutex_lock(&duktape_mutex);
-		duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-		duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+		janus_duktape_instance *instance = session->instance;
+		janus_mutex_lock(instance->mutex);
+		duk_idx_t thr_idx = duk_push_thread(instance->ctx);
+		duk_context *t = duk_get_context(instance->ctx, thr_idx);
 		duk_get_global_string(t, packet->binary ? "incomingBinaryData" : (has_incoming_text_data ? "incomingTextData" : "incomingData"));
 		duk_push_number(t, session->id);
 		/* We use a string for both text and binary data */
@@ -2601,8 +3014,8 @@ void janus_duktape_incoming_data(janus_plugin_session *handle, janus_plugin_data
 			JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 		}
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(instance->ctx);
+		janus_mutex_unlock(instance->mutex);
 		return;
 	}
 	/* Is this session allowed to send data? */
@@ -2639,9 +3052,10 @@ void janus_duktape_data_ready(janus_plugin_session *handle) {
 	/* Check if the JS script wants to receive this event */
 	if(has_data_ready) {
 		/* Yep, pass the event to the JS script and return */
-		janus_mutex_lock(&duktape_mutex);
-		duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-		duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+		janus_duktape_instance *instance = session->instance;
+		janus_mutex_lock(instance->mutex);
+		duk_idx_t thr_idx = duk_push_thread(instance->ctx);
+		duk_context *t = duk_get_context(instance->ctx, thr_idx);
 		duk_get_global_string(t, "dataReady");
 		duk_push_number(t, session->id);
 		int res = duk_pcall(t, 1);
@@ -2650,8 +3064,8 @@ void janus_duktape_data_ready(janus_plugin_session *handle) {
 			JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 		}
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(instance->ctx);
+		janus_mutex_unlock(instance->mutex);
 		return;
 	}
 }
@@ -2673,9 +3087,10 @@ void janus_duktape_slow_link(janus_plugin_session *handle, int mindex, gboolean
 	janus_refcount_increase(&session->ref);
 	if(has_slow_link) {
 		/* Notify the JS script */
-		janus_mutex_lock(&duktape_mutex);
-		duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-		duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+		janus_duktape_instance *instance = session->instance;
+		janus_mutex_lock(instance->mutex);
+		duk_idx_t thr_idx = duk_push_thread(instance->ctx);
+		duk_context *t = duk_get_context(instance->ctx, thr_idx);
 		duk_get_global_string(t, "slowLink");
 		duk_push_number(t, session->id);
 		duk_push_boolean(t, uplink);
@@ -2686,8 +3101,8 @@ void janus_duktape_slow_link(janus_plugin_session *handle, int mindex, gboolean
 			JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 		}
 		duk_pop(t);
-		duk_pop(duktape_ctx);
-		janus_mutex_unlock(&duktape_mutex);
+		duk_pop(instance->ctx);
+		janus_mutex_unlock(instance->mutex);
 	}
 	janus_refcount_decrease(&session->ref);
 }
@@ -2748,9 +3163,10 @@ void janus_duktape_hangup_media(janus_plugin_session *handle) {
 	janus_mutex_unlock(&session->recipients_mutex);
 
 	/* Notify the JS script */
-	janus_mutex_lock(&duktape_mutex);
-	duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-	duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+	janus_duktape_instance *instance = session->instance;
+	janus_mutex_lock(instance->mutex);
+	duk_idx_t thr_idx = duk_push_thread(instance->ctx);
+	duk_context *t = duk_get_context(instance->ctx, thr_idx);
 	duk_get_global_string(t, "hangupMedia");
 	duk_push_number(t, session->id);
 	int res = duk_pcall(t, 1);
@@ -2759,8 +3175,8 @@ void janus_duktape_hangup_media(janus_plugin_session *handle) {
 		JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 	}
 	duk_pop(t);
-	duk_pop(duktape_ctx);
-	janus_mutex_unlock(&duktape_mutex);
+	duk_pop(instance->ctx);
+	janus_mutex_unlock(instance->mutex);
 	janus_refcount_decrease(&session->ref);
 }
 
@@ -2804,9 +3220,10 @@ static void janus_duktape_relay_rtp_packet(gpointer data, gpointer user_data) {
 		if(session->sim_context.changed_substream) {
 			/* Notify the script about the substream change */
 			if(has_substream_changed) {
-				janus_mutex_lock(&duktape_mutex);
-				duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-				duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+				janus_duktape_instance *instance = session->instance;
+				janus_mutex_lock(instance->mutex);
+				duk_idx_t thr_idx = duk_push_thread(instance->ctx);
+				duk_context *t = duk_get_context(instance->ctx, thr_idx);
 				duk_get_global_string(t, "substreamChanged");
 				duk_push_number(t, session->id);
 				duk_push_number(t, session->sim_context.substream);
@@ -2816,16 +3233,17 @@ static void janus_duktape_relay_rtp_packet(gpointer data, gpointer user_data) {
 					JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 				}
 				duk_pop(t);
-				duk_pop(duktape_ctx);
-				janus_mutex_unlock(&duktape_mutex);
+				duk_pop(instance->ctx);
+				janus_mutex_unlock(instance->mutex);
 			}
 		}
 		if(session->sim_context.changed_temporal) {
 			/* Notify the user about the temporal layer change */
 			if(has_substream_changed) {
-				janus_mutex_lock(&duktape_mutex);
-				duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-				duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+				janus_duktape_instance *instance = session->instance;
+				janus_mutex_lock(instance->mutex);
+				duk_idx_t thr_idx = duk_push_thread(instance->ctx);
+				duk_context *t = duk_get_context(instance->ctx, thr_idx);
 				duk_get_global_string(t, "temporalLayerChanged");
 				duk_push_number(t, session->id);
 				duk_push_number(t, session->sim_context.templayer);
@@ -2835,8 +3253,8 @@ static void janus_duktape_relay_rtp_packet(gpointer data, gpointer user_data) {
 					JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 				}
 				duk_pop(t);
-				duk_pop(duktape_ctx);
-				janus_mutex_unlock(&duktape_mutex);
+				duk_pop(instance->ctx);
+				janus_mutex_unlock(instance->mutex);
 			}
 		}
 		/* If we got here, update the RTP header and send the packet */
@@ -2908,28 +3326,47 @@ static void janus_duktape_relay_data_packet(gpointer data, gpointer user_data) {
 /* This is a scheduler thread: if we know there are coroutines to resume in
  * JavaScript (e.g., for asynchronous requests), we do that ourselves here */
 static void *janus_duktape_scheduler(void *data) {
-	JANUS_LOG(LOG_VERB, "Joining Duktape scheduler thread\n");
+	janus_duktape_instance *instance = (janus_duktape_instance *)data;
+	JANUS_LOG(LOG_VERB, "Joining Duktape scheduler thread (instance %u)\n", instance->id);
 	janus_duktape_event *event = NULL;
 	/* Wait until there are events to process */
 	while(g_atomic_int_get(&duktape_initialized) && !g_atomic_int_get(&duktape_stopping)) {
-		event = g_async_queue_pop(events);
+		event = g_async_queue_pop(instance->events);
 		if(event == GUINT_TO_POINTER(janus_duktape_event_exit))
 			break;
 		if(event == GUINT_TO_POINTER(janus_duktape_event_resume)) {
 			/* There are coroutines to resume */
-			janus_mutex_lock(&duktape_mutex);
-			duk_get_global_string(duktape_ctx, "resumeScheduler");
-			int res = duk_pcall(duktape_ctx, 0);
+			janus_mutex_lock(instance->mutex);
+			duk_get_global_string(instance->ctx, "resumeScheduler");
+			int res = duk_pcall(instance->ctx, 0);
 			if(res != DUK_EXEC_SUCCESS) {
-				JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(duktape_ctx, -1));
+				JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(instance->ctx, -1));
 			}
-			duk_pop(duktape_ctx);
+			duk_pop(instance->ctx);
 			/* Print the count of elements into Duktape stack */
-			janus_duktape_stackdump(duktape_ctx);
-			janus_mutex_unlock(&duktape_mutex);
+			janus_duktape_stackdump(instance->ctx);
+			janus_mutex_unlock(instance->mutex);
+		} else if(event != NULL) {
+			/* A message from another instance */
+			janus_duktape_message *msg = (janus_duktape_message *)event;
+			janus_mutex_lock(instance->mutex);
+			duk_idx_t thr_idx = duk_push_thread(instance->ctx);
+			duk_context *t = duk_get_context(instance->ctx, thr_idx);
+			duk_get_global_string(t, "incomingMessage");
+			duk_push_int(t, msg->from);
+			duk_push_string(t, msg->text);
+			int res = duk_pcall(t, 2);
+			if(res != DUK_EXEC_SUCCESS) {
+				JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
+			}
+			duk_pop(t);
+			duk_pop(instance->ctx);
+			janus_mutex_unlock(instance->mutex);
+			g_free(msg->text);
+			g_free(msg);
 		}
 	}
-	JANUS_LOG(LOG_VERB, "Leaving Duktape scheduler thread\n");
+	JANUS_LOG(LOG_VERB, "Leaving Duktape scheduler thread (instance %u)\n", instance->id);
 	return NULL;
 }
 
@@ -2954,9 +3391,10 @@ static gboolean janus_duktape_timer_cb(void *data) {
 		return FALSE;
 	/* Invoke the callback with the provided argument, if available */
 	JANUS_LOG(LOG_VERB, "Invoking scheduled callback (waited %"SCNu32"ms) with ID %u\n", cb->ms, cb->id);
-	janus_mutex_lock(&duktape_mutex);
-	duk_idx_t thr_idx = duk_push_thread(duktape_ctx);
-	duk_context *t = duk_get_context(duktape_ctx, thr_idx);
+	janus_duktape_instance *instance = cb->instance;
+	janus_mutex_lock(instance->mutex);
+	duk_idx_t thr_idx = duk_push_thread(instance->ctx);
+	duk_context *t = duk_get_context(instance->ctx, thr_idx);
 	duk_get_global_string(t, cb->function);
 	if(cb->argument) {
 		duk_push_string(t, cb->argument);
@@ -2966,9 +3404,11 @@ static gboolean janus_duktape_timer_cb(void *data) {
 		JANUS_LOG(LOG_ERR, "Duktape error: %s\n", duk_safe_to_string(t, -1));
 	}
 	duk_pop(t);
-	duk_pop(duktape_ctx);
+	duk_pop(instance->ctx);
+	janus_mutex_unlock(instance->mutex);
 	/* Done */
+	janus_mutex_lock(&callbacks_mutex);
 	g_hash_table_remove(callbacks, cb);
-	janus_mutex_unlock(&duktape_mutex);
+	janus_mutex_unlock(&callbacks_mutex);
 	return FALSE;
 }
@@ -47,6 +47,20 @@ extern janus_callbacks *duktape_janus_core;
 extern duk_context *duktape_ctx;
 extern janus_mutex duktape_mutex;
 
+/* Duktape instances: the plugin can be configured to load the script in more
+ * than one Duktape heap, in which case sessions are sharded among them, so
+ * that they can be served in parallel. The first instance uses the
+ * duktape_ctx and duktape_mutex above, so it's always available */
+typedef struct janus_duktape_instance {
+	guint id;							/* Index of this instance */
+	duk_context *ctx;					/* Duktape context of this instance */
+	janus_mutex *mutex;					/* Mutex to lock the Duktape context of this instance */
+	GAsyncQueue *events;				/* Events for the scheduler of this instance */
+	GThread *scheduler;					/* Scheduler thread of this instance */
+} janus_duktape_instance;
+extern janus_duktape_instance *duktape_instances;
+extern guint duktape_instances_count;
+
 /* Duktape session: we keep only the barebone stuff here, the rest will be in the JavaScript script */
 typedef struct janus_duktape_session {
 	janus_plugin_session *handle;		/* Pointer to the core-plugin session */
@@ -69,6 +83,7 @@ typedef struct janus_duktape_session {
 	janus_vp8_simulcast_context vp8_context;
 	uint32_t bitrate;					/* Bitrate limit */
 	uint16_t pli_freq;					/* Regular PLI frequency (0=disabled) */
+	volatile gint native_media;			/* Whether RTP/RTCP from this session are routed in C even if the script handles media */
 	gint64 pli_latest;					/* Time of latest sent PLI (to avoid flooding) */
 	GSList *recipients;					/* Sessions that should receive media from this session */
 	struct janus_duktape_session *sender;	/* Other session this session is receiving media from */
@@ -84,6 +99,7 @@ typedef struct janus_duktape_session {
 	volatile gint dataready;			/* Whether the data channel was established on this sessions's PeerConnection */
 	volatile gint hangingup;			/* Whether this session's PeerConnection is hanging up */
 	volatile gint destroyed;			/* Whether this session's been marked as destroyed */
+	janus_duktape_instance *instance;	/* Duktape instance this session is handled by */
 	/* If you need any additional property (e.g., for hooks you added in janus_duktape_extra.c) add them below this line */
 
 	/* Reference counter */
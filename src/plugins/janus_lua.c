@@ -59,7 +59,10 @@
  * with \c incomingTextData() or \c incomingBinaryData
  * though, the performance impact of directly processing and manipulating
  * RTP an RTCP packets is probably too high, and so their usage is currently
- * discouraged. The \c dataReady() callback can be used to figure out when
+ * discouraged. Should a script need them for some users only, it can use
+ * \c setNativeMedia() to have RTP and RTCP packets coming from all the
+ * other users processed and routed in C, using the recipients configured
+ * via \c addRecipient(), without ever entering the Lua engine. The \c dataReady() callback can be used to figure out when
  * data can be sent. As an additional note, Lua scripts can also decide to
  * implement the functions that return information about the plugin itself,
  * namely \c getVersion() \c getVersionString() \c getDescription()
@@ -96,13 +99,18 @@
  * - \c removeRecipient(): specify which user should not receive a user's media anymore;
  * - \c setBitrate(): specify the bitrate to force on a user via REMB feedback;
  * - \c setPliFreq(): specify how often the plugin should send a PLI to this user;
+ * - \c setNativeMedia(): specify whether media from a user should be routed in C even if \c incomingRtp() and \c incomingRtcp() are implemented;
  * - \c setSubstream(): set the target simulcast substream;
  * - \c setTemporalLayer(): set the target simulcast temporal layer;
  * - \c sendPli(): send a PLI (keyframe request);
  * - \c startRecording(): start recording audio, video and or data for a user;
  * - \c stopRecording(): start recording audio, video and or data for a user;
  * - \c pokeScheduler(): notify the C code that there's a coroutine to resume;
- * - \c timeCallback(): trigger the execution of a Lua function after X milliseconds.
+ * - \c timeCallback(): trigger the execution of a Lua function after X milliseconds;
+ * - \c getInstance(): get the index of the Lua instance the script is running in;
+ * - \c getInstancesCount(): get how many Lua instances the plugin is using;
+ * - \c getSessionInstance(): get the index of the Lua instance a user is handled by;
+ * - \c postMessage(): send a message to another Lua instance (see \ref luainstances).
  *
  * As anticipated in the previous section, almost all these methods also
  * expect the unique session identifier to address a specific user in the
@@ -187,6 +195,54 @@ timeCallback("resumeScheduler", nil, 0)
  * compact and less verbose, and as such is preferred in cases where
  * timing and opaque arguments are not needed.
  *
+ * \section luainstances Multiple Lua instances
+ *
+ * By default, the plugin loads the script in a single Lua state, which
+ * means that all callbacks are serialized, no matter how many users are
+ * involved. In case that's a bottleneck, the \c instances property in
+ * the plugin configuration can be used to load the script in more than
+ * one Lua state: users are then sharded among these instances, each with
+ * its own scheduler, which means they'll be served in parallel. Timed
+ * callbacks are always invoked in the instance that created them, while
+ * callbacks that are not related to a specific user (e.g., those providing
+ * information on the plugin, or \c handleAdminMessage() ) are only
+ * invoked in the first instance. Both \c init() and \c destroy() are
+ * invoked in all of them.
+ *
+ * Instances don't share anything, though: the script is loaded in each
+ * of them separately, which means a global variable in one of them is
+ * not visible to the others. Maps of rooms and the like must then either
+ * be partitioned, or explicitly kept in sync. The \c postMessage() function
+ * is available for the purpose:
+ *
+ * \verbatim
+-- Send a string to instance 2
+postMessage(2, "a string, e.g., some serialized JSON")
+-- Send a string to all the other instances
+postMessage(-1, "a string, e.g., some serialized JSON")
+\endverbatim
+ *
+ * Messages are delivered asynchronously, by the scheduler of the target
+ * instance, to an additional \c incomingMessage() callback the script must
+ * implement, which receives the index of the sender instance and the
+ * message itself. The \c getInstance() \c getInstancesCount() and
+ * \c getSessionInstance() functions can help the script figure out the
+ * right recipient for its messages. Notice that functions that address
+ * users by ID (e.g., \c pushEvent() or \c addRecipient() ) work with any
+ * user, no matter which instance they're handled by.
+ *
+ * The plugin can also be built against LuaJIT instead of the stock Lua
+ * interpreter (pass \c --enable-luajit to the configure script), which
+ * makes scripts faster in general. When that's the case, scripts that
+ * need to look at RTP packets can implement \c incomingRtpFfi() instead
+ * of \c incomingRtp(): rather than a copy of the packet in a Lua string,
+ * the callback receives a pointer to the \c janus_plugin_rtp instance
+ * itself, whose buffer and parsed extensions can be accessed in place via
+ * the FFI (\c janus-ffi.lua contains the related declarations and some
+ * helpers to read the RTP header). The pointer is only valid while the
+ * callback runs: it can be passed to \c relayRtp() in place of the payload
+ * during that time, to relay the packet (and its extensions) without any copy.
+ *
  * Refer to the \ref luapapi section for more information on how you
  * can register your own C functions.
  */
@@ -272,6 +328,8 @@ janus_callbacks *lua_janus_core = NULL;
 /* Lua stuff */
 lua_State *lua_state = NULL;
 janus_mutex lua_mutex = JANUS_MUTEX_INITIALIZER;
+janus_lua_instance *lua_instances = NULL;
+guint lua_instances_count = 1;
 static const char *lua_functions[] = {
 	"init", "destroy", "resumeScheduler",
 	"createSession", "destroySession", "querySession",
@@ -294,6 +352,7 @@ static gboolean has_get_package = FALSE;
 static char *lua_script_package = NULL;
 static gboolean has_handle_admin_message = FALSE;
 static gboolean has_incoming_rtp = FALSE;
+static gboolean has_incoming_rtp_ffi = FALSE;
 static gboolean has_incoming_rtcp = FALSE;
 static gboolean has_incoming_data_legacy = FALSE,	/* Legacy callback */
 	has_incoming_text_data = FALSE,
@@ -302,15 +361,27 @@ static gboolean has_data_ready = FALSE;
 static gboolean has_slow_link = FALSE;
 static gboolean has_substream_changed = FALSE;
 static gboolean has_temporal_changed = FALSE;
-/* Lua C scheduler (for coroutines) */
-static GThread *scheduler_thread = NULL;
+static gboolean has_incoming_message = FALSE;
+/* Lua C scheduler (for coroutines): each instance has its own */
 static void *janus_lua_scheduler(void *data);
-static GAsyncQueue *events = NULL;
 typedef enum janus_lua_event {
 	janus_lua_event_none = 0,
 	janus_lua_event_resume,		/* Resume one or more pending coroutines */
 	janus_lua_event_exit		/* Break the scheduler loop */
 } janus_lua_event;
+/* Messages instances can send each other, which the scheduler of the
+ * recipient delivers to the incomingMessage() callback of the script */
+typedef struct janus_lua_message {
+	guint from;
+	char *text;
+} janus_lua_message;
+/* Helper to find out which instance a Lua state (or coroutine) belongs to */
+static janus_lua_instance *janus_lua_get_instance(lua_State *s) {
+	lua_getfield(s, LUA_REGISTRYINDEX, "janus_lua_instance");
+	janus_lua_instance *instance = (janus_lua_instance *)lua_touserdata(s, -1);
+	lua_pop(s, 1);
+	return instance ? instance : &lua_instances[0];
+}
 /* Lua timer loop (for scheduled callbacks) */
 static GMainContext *timer_context = NULL;
 static GMainLoop *timer_loop = NULL;
@@ -321,10 +392,12 @@ typedef struct janus_lua_callback {
 	guint id;
 	uint32_t ms;
 	GSource *source;
+	janus_lua_instance *instance;
 	char *function;
 	char *argument;
 } janus_lua_callback;
 static GHashTable *callbacks = NULL;
+static janus_mutex callbacks_mutex = JANUS_MUTEX_INITIALIZER;
 static void janus_lua_callback_free(janus_lua_callback *cb) {
 	if(!cb)
 		return;
@@ -438,7 +511,8 @@ static int janus_lua_method_januslog(lua_State *s) {
 
 static int janus_lua_method_pokescheduler(lua_State *s) {
 	/* This method allows the Lua script to poke the scheduler and have it wake up ASAP */
-	g_async_queue_push(events, GUINT_TO_POINTER(janus_lua_event_resume));
+	janus_lua_instance *instance = janus_lua_get_instance(s);
+	g_async_queue_push(instance->events, GUINT_TO_POINTER(janus_lua_event_resume));
 	lua_pushnumber(s, 0);
 	return 1;
 }
@@ -465,16 +539,93 @@ static int janus_lua_method_timecallback(lua_State *s) {
 	if(argument != NULL)
 		cb->argument = g_strdup(argument);
 	cb->ms = ms;
+	cb->instance = janus_lua_get_instance(s);
 	cb->source = g_timeout_source_new(ms);
 	g_source_set_callback(cb->source, janus_lua_timer_cb, cb, NULL);
+	janus_mutex_lock(&callbacks_mutex);
 	g_hash_table_insert(callbacks, cb, cb);
 	cb->id = g_source_attach(cb->source, timer_context);
+	janus_mutex_unlock(&callbacks_mutex);
 	JANUS_LOG(LOG_VERB, "Created scheduled callback (%"SCNu32"ms) with ID %u\n", cb->ms, cb->id);
 	/* Done */
 	lua_pushnumber(s, 0);
 	return 1;
 }
 
+static int janus_lua_method_getinstance(lua_State *s) {
+	/* This method allows the Lua script to know which instance it's running in */
+	janus_lua_instance *instance = janus_lua_get_instance(s);
+	lua_pushnumber(s, instance->id);
+	return 1;
+}
+
+static int janus_lua_method_getinstancescount(lua_State *s) {
+	/* This method allows the Lua script to know how many instances there are */
+	lua_pushnumber(s, lua_instances_count);
+	return 1;
+}
+
+static int janus_lua_method_getsessioninstance(lua_State *s) {
+	/* Get the arguments from the provided state */
+	int n = lua_gettop(s);
+	if(n != 1) {
+		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 1)\n", n);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	guint32 id = lua_tonumber(s, 1);
+	/* Find the session: it may be handled by any instance */
+	janus_mutex_lock(&lua_sessions_mutex);
+	janus_lua_session *session = g_hash_table_lookup(lua_ids, GUINT_TO_POINTER(id));
+	if(session == NULL || g_atomic_int_get(&session->destroyed)) {
+		janus_mutex_unlock(&lua_sessions_mutex);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	guint instance = session->instance->id;
+	janus_mutex_unlock(&lua_sessions_mutex);
+	lua_pushnumber(s, instance);
+	return 1;
+}
+
+static int janus_lua_method_postmessage(lua_State *s) {
+	/* This method allows the Lua script to send a message to other instances:
+	 * instances share nothing, so this is how they can share state */
+	int n = lua_gettop(s);
+	if(n != 2) {
+		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 2)\n", n);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	int target = lua_tonumber(s, 1);
+	const char *text = lua_tostring(s, 2);
+	if(text == NULL || target >= (int)lua_instances_count) {
+		JANUS_LOG(LOG_ERR, "Invalid arguments (missing message or invalid instance)\n");
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	if(!has_incoming_message) {
+		JANUS_LOG(LOG_ERR, "Can't post messages, the script has no incomingMessage callback\n");
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	/* A negative target means all the other instances */
+	janus_lua_instance *instance = janus_lua_get_instance(s);
+	int sent = 0;
+	guint i = 0;
+	for(i=0; i<lua_instances_count; i++) {
+		if((target >= 0 && i != (guint)target) || (target < 0 && i == instance->id))
+			continue;
+		janus_lua_message *msg = g_malloc(sizeof(janus_lua_message));
+		msg->from = instance->id;
+		msg->text = g_strdup(text);
+		g_async_queue_push(lua_instances[i].events, msg);
+		sent++;
+	}
+	lua_pushnumber(s, sent);
+	return 1;
+}
+
 static int janus_lua_method_pushevent(lua_State *s) {
 	/* Get the arguments from the provided state */
 	int n = lua_gettop(s);
@@ -877,6 +1028,34 @@ static int janus_lua_method_setplifreq(lua_State *s) {
 	return 1;
 }
 
+static int janus_lua_method_setnativemedia(lua_State *s) {
+	/* Get the arguments from the provided state */
+	int n = lua_gettop(s);
+	if(n != 2) {
+		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 2)\n", n);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	guint32 id = lua_tonumber(s, 1);
+	gboolean native_media = lua_toboolean(s, 2);
+	/* Find the session */
+	janus_mutex_lock(&lua_sessions_mutex);
+	janus_lua_session *session = g_hash_table_lookup(lua_ids, GUINT_TO_POINTER(id));
+	if(session == NULL || g_atomic_int_get(&session->destroyed)) {
+		janus_mutex_unlock(&lua_sessions_mutex);
+		lua_pushnumber(s, -1);
+		return 1;
+	}
+	janus_refcount_increase(&session->ref);
+	janus_mutex_unlock(&lua_sessions_mutex);
+	/* RTP and RTCP packets from this session will not be passed to the script anymore */
+	g_atomic_int_set(&session->native_media, native_media ? 1 : 0);
+	/* Done */
+	janus_refcount_decrease(&session->ref);
+	lua_pushnumber(s, 0);
+	return 1;
+}
+
 static int janus_lua_method_setsubstream(lua_State *s) {
 	/* Get the arguments from the provided state */
 	int n = lua_gettop(s);
@@ -972,9 +1151,11 @@ static int janus_lua_method_relayrtp(lua_State *s) {
 	}
 	guint32 id = lua_tonumber(s, 1);
 	int is_video = lua_toboolean(s, 2);
-	const char *payload = lua_tostring(s, 3);
+	/* With LuaJIT, this may be the packet passed to incomingRtpFfi, rather than a string */
+	janus_plugin_rtp *packet = lua_islightuserdata(s, 3) ? (janus_plugin_rtp *)lua_touserdata(s, 3) : NULL;
+	const char *payload = packet ? packet->buffer : lua_tostring(s, 3);
 	int len = lua_tonumber(s, 4);
-	if(!payload || len < 1) {
+	if(!payload || len < 1 || (packet && len > packet->length)) {
 		JANUS_LOG(LOG_ERR, "Invalid payload\n");
 		lua_pushnumber(s, -1);
 		return 1;
@@ -988,9 +1169,12 @@ static int janus_lua_method_relayrtp(lua_State *s) {
 		return 1;
 	}
 	janus_mutex_unlock(&lua_sessions_mutex);
-	/* Send the RTP packet */
+	/* Send the RTP packet: if we got the original one, we keep its extensions */
 	janus_plugin_rtp rtp = { .mindex = -1, .video = is_video, .buffer = (char *)payload, .length = len };
-	janus_plugin_rtp_extensions_reset(&rtp.extensions);
+	if(packet != NULL)
+		rtp.extensions = packet->extensions;
+	else
+		janus_plugin_rtp_extensions_reset(&rtp.extensions);
 	lua_janus_core->relay_rtp(session->handle, &rtp);
 	lua_pushnumber(s, 0);
 	return 1;
@@ -1320,6 +1504,124 @@ static int janus_lua_method_stoprecording(lua_State *s) {
 }
 
 
+/* Helper to create a Lua state for an instance, and load the script in it */
+static int janus_lua_instance_load(janus_lua_instance *instance, const char *lua_folder, const char *lua_file) {
+	lua_State *state = luaL_newstate();
+	luaL_openlibs(state);
+	/* Take note of which instance this state belongs to */
+	lua_pushlightuserdata(state, instance);
+	lua_setfield(state, LUA_REGISTRYINDEX, "janus_lua_instance");
+
+	if(lua_folder != NULL) {
+		/* Add the script folder to the path, so that we can load other scripts from there */
+		lua_getglobal(state, "package");
+		lua_getfield(state, -1, "path");
+		const char *cur_path = lua_tostring(state, -1);
+		char new_path[1024];
+		memset(new_path, 0, sizeof(new_path));
+		g_snprintf(new_path, sizeof(new_path), "%s;%s/?.lua", cur_path, lua_folder);
+		lua_pop(state, 1);
+		lua_pushstring(state, new_path);
+		lua_setfield(state, -2, "path");
+		lua_pop(state, 1);
+	}
+
+	/* Register our functions */
+	lua_register(state, "janusLog", janus_lua_method_januslog);
+	lua_register(state, "pokeScheduler", janus_lua_method_pokescheduler);
+	lua_register(state, "timeCallback", janus_lua_method_timecallback);
+	lua_register(state, "getInstance", janus_lua_method_getinstance);
+	lua_register(state, "getInstancesCount", janus_lua_method_getinstancescount);
+	lua_register(state, "getSessionInstance", janus_lua_method_getsessioninstance);
+	lua_register(state, "postMessage", janus_lua_method_postmessage);
+	lua_register(state, "pushEvent", janus_lua_method_pushevent);
+	lua_register(state, "notifyEvent", janus_lua_method_notifyevent);
+	lua_register(state, "eventsIsEnabled", janus_lua_method_eventsisenabled);
+	lua_register(state, "closePc", janus_lua_method_closepc);
+	lua_register(state, "endSession", janus_lua_method_endsession);
+	lua_register(state, "configureMedium", janus_lua_method_configuremedium);
+	lua_register(state, "addRecipient", janus_lua_method_addrecipient);
+	lua_register(state, "removeRecipient", janus_lua_method_removerecipient);
+	lua_register(state, "setBitrate", janus_lua_method_setbitrate);
+	lua_register(state, "setPliFreq", janus_lua_method_setplifreq);
+	lua_register(state, "setNativeMedia", janus_lua_method_setnativemedia);
+	lua_register(state, "setSubstream", janus_lua_method_setsubstream);
+	lua_register(state, "setTemporalLayer", janus_lua_method_settemporallayer);
+	lua_register(state, "sendPli", janus_lua_method_sendpli);
+	lua_register(state, "relayRtp", janus_lua_method_relayrtp);
+	lua_register(state, "relayRtcp", janus_lua_method_relayrtcp);
+	lua_register(state, "relayData", janus_lua_method_relaydata);	/* Legacy function, deprecated */
+	lua_register(state, "relayTextData", janus_lua_method_relaytextdata);
+	lua_register(state, "relayBinaryData", janus_lua_method_relaybinarydata);
+	lua_register(state, "startRecording", janus_lua_method_startrecording);
+	lua_register(state, "stopRecording", janus_lua_method_stoprecording);
+	/* Register all extra functions, if any were added */
+	janus_lua_register_extra_functions(state);
+
+	/* Now load the script */
+	int err = luaL_dofile(state, lua_file);
+	if(err) {
+		JANUS_LOG(LOG_ERR, "Error loading Lua script %s: %s\n", lua_file, lua_tostring(state, -1));
+		lua_close(state);
+		return -1;
+	}
+	/* Make sure that all the functions we need are there */
+	uint i=0;
+	for(i=0; i<lua_funcsize; i++) {
+		lua_getglobal(state, lua_functions[i]);
+		if(lua_isfunction(state, lua_gettop(state)) == 0) {
+			JANUS_LOG(LOG_ERR, "Function '%s' is missing in %s\n", lua_functions[i], lua_file);
+			lua_close(state);
+			return -1;
+		}
+	}
+	instance->state = state;
+	return 0;
+}
+
+/* Helper to stop the schedulers and get rid of the Lua instances */
+static void janus_lua_instances_free(void) {
+	if(lua_instances == NULL)
+		return;
+	guint i = 0;
+	for(i=0; i<lua_instances_count; i++) {
+		janus_lua_instance *instance = &lua_instances[i];
+		if(instance->scheduler != NULL) {
+			g_async_queue_push(instance->events, GUINT_TO_POINTER(janus_lua_event_exit));
+			g_thread_join(instance->scheduler);
+			instance->scheduler = NULL;
+		}
+	}
+	for(i=0; i<lua_instances_count; i++) {
+		janus_lua_instance *instance = &lua_instances[i];
+		if(instance->mutex != NULL)
+			janus_mutex_lock(instance->mutex);
+		if(instance->state != NULL)
+			lua_close(instance->state);
+		instance->state = NULL;
+		if(instance->mutex != NULL)
+			janus_mutex_unlock(instance->mutex);
+		if(instance->events != NULL) {
+			janus_lua_message *msg = NULL;
+			while((msg = g_async_queue_try_pop(instance->events)) != NULL) {
+				if(msg == GUINT_TO_POINTER(janus_lua_event_resume) || msg == GUINT_TO_POINTER(janus_lua_event_exit))
+					continue;
+				g_free(msg->text);
+				g_free(msg);
+			}
+			g_async_queue_unref(instance->events);
+		}
+		if(instance->mutex != NULL && instance->mutex != &lua_mutex) {
+			janus_mutex_destroy(instance->mutex);
+			g_free(instance->mutex);
+		}
+	}
+	g_free(lua_instances);
+	lua_instances = NULL;
+	lua_state = NULL;
+}
+
+
 /* Plugin implementation */
 int janus_lua_init(janus_callbacks *callback, const char *config_path) {
 	if(g_atomic_int_get(&lua_stopping)) {
@@ -1365,74 +1667,39 @@ int janus_lua_init(janus_callbacks *callback, const char *config_path) {
 	janus_config_item *conf = janus_config_get(config, config_general, janus_config_type_item, "config");
 	if(conf && conf->value)
 		lua_config = g_strdup(conf->value);
-	janus_config_destroy(config);
-
-	/* Initialize Lua */
-	lua_state = luaL_newstate();
-	luaL_openlibs(lua_state);
-
-	if(lua_folder != NULL) {
-		/* Add the script folder to the path, so that we can load other scripts from there */
-		lua_getglobal(lua_state, "package");
-		lua_getfield(lua_state, -1, "path");
-		const char *cur_path = lua_tostring(lua_state, -1);
-		char new_path[1024];
-		memset(new_path, 0, sizeof(new_path));
-		g_snprintf(new_path, sizeof(new_path), "%s;%s/?.lua", cur_path, lua_folder);
-		lua_pop(lua_state, 1);
-		lua_pushstring(lua_state, new_path);
-		lua_setfield(lua_state, -2, "path");
-		lua_pop(lua_state, 1);
+	janus_config_item *inst = janus_config_get(config, config_general, janus_config_type_item, "instances");
+	if(inst && inst->value) {
+		int instances = atoi(inst->value);
+		if(instances < 1) {
+			JANUS_LOG(LOG_WARN, "Invalid number of instances (%s), using a single Lua state\n", inst->value);
+			instances = 1;
+		}
+		lua_instances_count = instances;
 	}
+	janus_config_destroy(config);
 
-	/* Register our functions */
-	lua_register(lua_state, "janusLog", janus_lua_method_januslog);
-	lua_register(lua_state, "pokeScheduler", janus_lua_method_pokescheduler);
-	lua_register(lua_state, "timeCallback", janus_lua_method_timecallback);
-	lua_register(lua_state, "pushEvent", janus_lua_method_pushevent);
-	lua_register(lua_state, "notifyEvent", janus_lua_method_notifyevent);
-	lua_register(lua_state, "eventsIsEnabled", janus_lua_method_eventsisenabled);
-	lua_register(lua_state, "closePc", janus_lua_method_closepc);
-	lua_register(lua_state, "endSession", janus_lua_method_endsession);
-	lua_register(lua_state, "configureMedium", janus_lua_method_configuremedium);
-	lua_register(lua_state, "addRecipient", janus_lua_method_addrecipient);
-	lua_register(lua_state, "removeRecipient", janus_lua_method_removerecipient);
-	lua_register(lua_state, "setBitrate", janus_lua_method_setbitrate);
-	lua_register(lua_state, "setPliFreq", janus_lua_method_setplifreq);
-	lua_register(lua_state, "setSubstream", janus_lua_method_setsubstream);
-	lua_register(lua_state, "setTemporalLayer", janus_lua_method_settemporallayer);
-	lua_register(lua_state, "sendPli", janus_lua_method_sendpli);
-	lua_register(lua_state, "relayRtp", janus_lua_method_relayrtp);
-	lua_register(lua_state, "relayRtcp", janus_lua_method_relayrtcp);
-	lua_register(lua_state, "relayData", janus_lua_method_relaydata);	/* Legacy function, deprecated */
-	lua_register(lua_state, "relayTextData", janus_lua_method_relaytextdata);
-	lua_register(lua_state, "relayBinaryData", janus_lua_method_relaybinarydata);
-	lua_register(lua_state, "startRecording", janus_lua_method_startrecording);
-	lua_register(lua_state, "stopRecording", janus_lua_method_stoprecording);
-	/* Register all extra functions, if any were added */
-	janus_lua_register_extra_functions(lua_state);
-
-	/* Now load the script */
-	int err = luaL_dofile(lua_state, lua_file);
-	if(err) {
-		JANUS_LOG(LOG_ERR, "Error loading Lua script %s: %s\n", lua_file, lua_tostring(lua_state, -1));
-		lua_close(lua_state);
-		g_free(lua_folder);
-		g_free(lua_file);
-		return -1;
-	}
-	/* Make sure that all the functions we need are there */
-	uint i=0;
-	for(i=0; i<lua_funcsize; i++) {
-		lua_getglobal(lua_state, lua_functions[i]);
-		if(lua_isfunction(lua_state, lua_gettop(lua_state)) == 0) {
-			JANUS_LOG(LOG_ERR, "Function '%s' is missing in %s\n", lua_functions[i], lua_file);
-			lua_close(lua_state);
+	/* Initialize Lua: each instance gets its own state, with the script loaded */
+	lua_instances = g_malloc0(lua_instances_count * sizeof(janus_lua_instance));
+	guint i = 0;
+	for(i=0; i<lua_instances_count; i++) {
+		janus_lua_instance *instance = &lua_instances[i];
+		instance->id = i;
+		if(i == 0) {
+			instance->mutex = &lua_mutex;
+		} else {
+			instance->mutex = g_malloc(sizeof(janus_mutex));
+			janus_mutex_init(instance->mutex);
+		}
+		instance->events = g_async_queue_new();
+		if(janus_lua_instance_load(instance, lua_folder, lua_file) < 0) {
+			janus_lua_instances_free();
 			g_free(lua_folder);
 			g_free(lua_file);
+			g_free(lua_config);
 			return -1;
 		}
 	}
+	lua_state = lua_instances[0].state;
 	/* Some Lua functions are optional (e.g., those to directly handle RTP, RTCP and
 	 * data, as those will typically be kept at a C level, with Lua only dictating
 	 * the logic, or those overriding the plugin namespace and versioning information */
@@ -1460,6 +1727,15 @@ int janus_lua_init(janus_callbacks *callback, const char *config_path) {
 	lua_getglobal(lua_state, "incomingRtp");
 	if(lua_isfunction(lua_state, lua_gettop(lua_state)) != 0)
 		has_incoming_rtp = TRUE;
+	lua_getglobal(lua_state, "incomingRtpFfi");
+	if(lua_isfunction(lua_state, lua_gettop(lua_state)) != 0) {
+#ifdef HAVE_LUAJIT
+		has_incoming_rtp_ffi = TRUE;
+#else
+		JANUS_LOG(LOG_WARN, "The Lua script contains the 'incomingRtpFfi' callback, but the plugin "
+			"was not built with LuaJIT: ignoring it\n");
+#endif
+	}
 	lua_getglobal(lua_state, "incomingRtcp");
 	if(lua_isfunction(lua_state, lua_gettop(lua_state)) != 0)
 		has_incoming_rtcp = TRUE;
@@ -1487,27 +1763,37 @@ int janus_lua_init(janus_callbacks *callback, const char *config_path) {
 	lua_getglobal(lua_state, "temporalLayerChanged");
 	if(lua_isfunction(lua_state, lua_gettop(lua_state)) != 0)
 		has_temporal_changed = TRUE;
+	lua_getglobal(lua_state, "incomingMessage");
+	if(lua_isfunction(lua_state, lua_gettop(lua_state)) != 0)
+		has_incoming_message = TRUE;
+	if(lua_instances_count > 1 && !has_incoming_message) {
+		JANUS_LOG(LOG_WARN, "Lua script loaded in %u instances, but with no incomingMessage callback to share state\n",
+			lua_instances_count);
+	}
 
 	lua_sessions = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_lua_session_destroy);
 	lua_ids = g_hash_table_new(NULL, NULL);
-	events = g_async_queue_new();
 	callbacks = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_lua_callback_free);
 
 	g_atomic_int_set(&lua_initialized, 1);
 
-	/* Launch the scheduler thread (which will be responsible for resuming asynchronous coroutines) */
+	/* Launch the scheduler threads (which will be responsible for resuming asynchronous coroutines) */
 	GError *error = NULL;
-	scheduler_thread = g_thread_try_new("lua scheduler", janus_lua_scheduler, NULL, &error);
-	if(error != NULL) {
-		g_atomic_int_set(&lua_initialized, 0);
-		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Lua scheduler thread...\n",
-			error->code, error->message ? error->message : "??");
-		g_error_free(error);
-		lua_close(lua_state);
-		g_free(lua_folder);
-		g_free(lua_file);
-		g_free(lua_config);
-		return -1;
+	for(i=0; i<lua_instances_count; i++) {
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "lua scheduler %u", i);
+		lua_instances[i].scheduler = g_thread_try_new(tname, janus_lua_scheduler, &lua_instances[i], &error);
+		if(error != NULL) {
+			g_atomic_int_set(&lua_initialized, 0);
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Lua scheduler thread...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			janus_lua_instances_free();
+			g_free(lua_folder);
+			g_free(lua_file);
+			g_free(lua_config);
+			return -1;
+		}
 	}
 	/* Launch the timer loop thread (which will be responsible for scheduling timed callbacks) */
 	timer_context = g_main_context_new();
@@ -1522,7 +1808,7 @@ int janus_lua_init(janus_callbacks *callback, const char *config_path) {
 			g_main_loop_unref(timer_loop);
 		if(timer_context != NULL)
 			g_main_context_unref(timer_context);
-		lua_close(lua_state);
+		janus_lua_instances_free();
 		g_free(lua_folder);
 		g_free(lua_file);
 		g_free(lua_config);
@@ -1532,15 +1818,25 @@ int janus_lua_init(janus_callbacks *callback, const char *config_path) {
 	/* This is the callback we'll need to invoke to contact the Janus core */
 	lua_janus_core = callback;
 
-	/* Init the Lua script, in case it's needed */
-	lua_getglobal(lua_state, "init");
-	lua_pushstring(lua_state, lua_config);
-	lua_call(lua_state, 1, 0);
+	/* Init the Lua script in all instances, in case it's needed */
+	for(i=0; i<lua_instances_count; i++) {
+		janus_mutex_lock(lua_instances[i].mutex);
+		lua_getglobal(lua_instances[i].state, "init");
+		lua_pushstring(lua_instances[i].state, lua_config);
+		lua_call(lua_instances[i].state, 1, 0);
+		janus_mutex_unlock(lua_instances[i].mutex);
+	}
+	if(lua_instances_count > 1)
+		JANUS_LOG(LOG_INFO, "Lua script loaded in %u instances\n", lua_instances_count);
 
 	g_free(lua_folder);
 	g_free(lua_file);
 	g_free(lua_config);
 
+#ifdef HAVE_LUAJIT
+	JANUS_LOG(LOG_INFO, "Using %s%s\n", LUAJIT_VERSION,
+		has_incoming_rtp_ffi ? " (RTP packets passed via FFI)" : "");
+#endif
 	JANUS_LOG(LOG_INFO, "%s initialized!\n", JANUS_LUA_NAME);
 	return 0;
 }
@@ -1550,10 +1846,13 @@ void janus_lua_destroy(void) {
 		return;
 	g_atomic_int_set(&lua_stopping, 1);
 
-	g_async_queue_push(events, GUINT_TO_POINTER(janus_lua_event_exit));
-	if(scheduler_thread != NULL) {
-		g_thread_join(scheduler_thread);
-		scheduler_thread = NULL;
+	guint i = 0;
+	for(i=0; i<lua_instances_count; i++) {
+		if(lua_instances[i].scheduler != NULL) {
+			g_async_queue_push(lua_instances[i].events, GUINT_TO_POINTER(janus_lua_event_exit));
+			g_thread_join(lua_instances[i].scheduler);
+			lua_instances[i].scheduler = NULL;
+		}
 	}
 	if(timer_loop != NULL)
 		g_main_loop_quit(timer_loop);
@@ -1570,27 +1869,27 @@ void janus_lua_destroy(void) {
 		timer_context = NULL;
 	}
 
-	/* Deinit the Lua script, in case it's needed */
-	janus_mutex_lock(&lua_mutex);
-	lua_getglobal(lua_state, "destroy");
-	lua_call(lua_state, 0, 0);
+	/* Deinit the Lua script in all instances, in case it's needed */
+	for(i=0; i<lua_instances_count; i++) {
+		janus_mutex_lock(lua_instances[i].mutex);
+		lua_getglobal(lua_instances[i].state, "destroy");
+		lua_call(lua_instances[i].state, 0, 0);
+		janus_mutex_unlock(lua_instances[i].mutex);
+	}
+	janus_mutex_lock(&callbacks_mutex);
 	g_hash_table_destroy(callbacks);
 	callbacks = NULL;
-	janus_mutex_unlock(&lua_mutex);
+	janus_mutex_unlock(&callbacks_mutex);
 
 	janus_mutex_lock(&lua_sessions_mutex);
 	g_hash_table_destroy(lua_sessions);
 	lua_sessions = NULL;
 	g_hash_table_destroy(lua_ids);
 	lua_ids = NULL;
-	g_async_queue_unref(events);
-	events = NULL;
 	janus_mutex_unlock(&lua_sessions_mutex);
 
-	janus_mutex_lock(&lua_mutex);
-	lua_close(lua_state);
-	lua_state = NULL;
-	janus_mutex_unlock(&lua_mutex);
+	janus_lua_instances_free();
+	lua_instances_count = 1;
 
 	g_free(lua_script_version_string);
 	g_free(lua_script_description);
@@ -1787,6 +2086,8 @@ void janus_lua_create_session(janus_plugin_session *handle, int *error) {
 	session->vcodec = JANUS_VIDEOCODEC_NONE;
 	g_atomic_int_set(&session->hangingup, 0);
 	g_atomic_int_set(&session->destroyed, 0);
+	/* Sessions are sharded among the available Lua instances */
+	session->instance = &lua_instances[janus_uint64_hash(id) % lua_instances_count];
 	janus_refcount_init(&session->ref, janus_lua_session_free);
 	handle->plugin_handle = session;
 	g_hash_table_insert(lua_sessions, handle, session);
@@ -1794,13 +2095,14 @@ void janus_lua_create_session(janus_plugin_session *handle, int *error) {
 	janus_mutex_unlock(&lua_sessions_mutex);
 
 	/* Notify the Lua script */
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_instance *instance = session->instance;
+	janus_mutex_lock(instance->mutex);
+	lua_State *t = lua_newthread(instance->state);
 	lua_getglobal(t, "createSession");
 	lua_pushnumber(t, session->id);
 	lua_call(t, 1, 0);
-	lua_pop(lua_state, 1);
-	janus_mutex_unlock(&lua_mutex);
+	lua_pop(instance->state, 1);
+	janus_mutex_unlock(instance->mutex);
 
 	return;
 }
@@ -1824,13 +2126,14 @@ void janus_lua_destroy_session(janus_plugin_session *handle, int *error) {
 	janus_mutex_unlock(&lua_sessions_mutex);
 
 	/* Notify the Lua script */
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_instance *instance = session->instance;
+	janus_mutex_lock(instance->mutex);
+	lua_State *t = lua_newthread(instance->state);
 	lua_getglobal(t, "destroySession");
 	lua_pushnumber(t, id);
 	lua_call(t, 1, 0);
-	lua_pop(lua_state, 1);
-	janus_mutex_unlock(&lua_mutex);
+	lua_pop(instance->state, 1);
+	janus_mutex_unlock(instance->mutex);
 
 	/* Get any rid references recipients of this sessions may have */
 	janus_mutex_lock(&session->recipients_mutex);
@@ -1868,19 +2171,20 @@ json_t *janus_lua_query_session(janus_plugin_session *handle) {
 	janus_refcount_increase(&session->ref);
 	janus_mutex_unlock(&lua_sessions_mutex);
 	/* Ask the Lua script for information on this session */
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_instance *instance = session->instance;
+	janus_mutex_lock(instance->mutex);
+	lua_State *t = lua_newthread(instance->state);
 	lua_getglobal(t, "querySession");
 	lua_pushnumber(t, session->id);
 	lua_call(t, 1, 1);
-	lua_pop(lua_state, 1);
+	lua_pop(instance->state, 1);
 	janus_refcount_decrease(&session->ref);
 	const char *info = lua_tostring(t, -1);
 	lua_pop(t, 1);
 	/* We need a Jansson object */
 	json_error_t error;
 	json_t *json = json_loads(info, 0, &error);
-	janus_mutex_unlock(&lua_mutex);
+	janus_mutex_unlock(instance->mutex);
 	if(!json) {
 		JANUS_LOG(LOG_ERR, "JSON error: on line %d: %s", error.line, error.text);
 		return NULL;
@@ -1946,15 +2250,16 @@ struct janus_plugin_result *janus_lua_handle_message(janus_plugin_session *handl
 		json_decref(jsep);
 	}
 	/* Invoke the script function */
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_instance *instance = session->instance;
+	janus_mutex_lock(instance->mutex);
+	lua_State *t = lua_newthread(instance->state);
 	lua_getglobal(t, "handleMessage");
 	lua_pushnumber(t, session->id);
 	lua_pushstring(t, transaction);
 	lua_pushstring(t, message_text);
 	lua_pushstring(t, jsep_text);
 	lua_call(t, 4, 2);
-	lua_pop(lua_state, 1);
+	lua_pop(instance->state, 1);
 	janus_refcount_decrease(&session->ref);
 	if(message_text != NULL)
 		free(message_text);
@@ -1963,7 +2268,7 @@ struct janus_plugin_result *janus_lua_handle_message(janus_plugin_session *handl
 	g_free(transaction);
 	int n = lua_gettop(t);
 	if(n != 2) {
-		janus_mutex_unlock(&lua_mutex);
+		janus_mutex_unlock(instance->mutex);
 		JANUS_LOG(LOG_ERR, "Wrong number of arguments: %d (expected 2)\n", n);
 		return janus_plugin_result_new(JANUS_PLUGIN_ERROR, "Lua error", NULL);
 	}
@@ -1973,20 +2278,20 @@ struct janus_plugin_result *janus_lua_handle_message(janus_plugin_session *handl
 	lua_pop(t, 2);
 	if(res < 0) {
 		/* We got an error */
-		janus_mutex_unlock(&lua_mutex);
+		janus_mutex_unlock(instance->mutex);
 		return janus_plugin_result_new(JANUS_PLUGIN_ERROR, response ? response : "Lua error", NULL);
 	} else if(res == 0) {
 		/* Synchronous response: we need a Jansson object */
 		json_error_t error;
 		json_t *json = json_loads(response, 0, &error);
-		janus_mutex_unlock(&lua_mutex);
+		janus_mutex_unlock(instance->mutex);
 		if(!json) {
 			JANUS_LOG(LOG_ERR, "JSON error: on line %d: %s\n", error.line, error.text);
 			return janus_plugin_result_new(JANUS_PLUGIN_ERROR, "Lua error", NULL);
 		}
 		return janus_plugin_result_new(JANUS_PLUGIN_OK, NULL, json);
 	}
-	janus_mutex_unlock(&lua_mutex);
+	janus_mutex_unlock(instance->mutex);
 	/* If we got here, it's an asynchronous response */
 	return janus_plugin_result_new(JANUS_PLUGIN_OK_WAIT, NULL, NULL);
 }
@@ -2048,13 +2353,14 @@ void janus_lua_setup_media(janus_plugin_session *handle) {
 	session->pli_latest = janus_get_monotonic_time();
 
 	/* Notify the Lua script */
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_instance *instance = session->instance;
+	janus_mutex_lock(instance->mutex);
+	lua_State *t = lua_newthread(instance->state);
 	lua_getglobal(t, "setupMedia");
 	lua_pushnumber(t, session->id);
 	lua_call(t, 1, 0);
-	lua_pop(lua_state, 1);
-	janus_mutex_unlock(&lua_mutex);
+	lua_pop(instance->state, 1);
+	janus_mutex_unlock(instance->mutex);
 	janus_refcount_decrease(&session->ref);
 }
 
@@ -2072,18 +2378,31 @@ void janus_lua_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp *rtp_
 	char *buf = rtp_packet->buffer;
 	uint16_t len = rtp_packet->length;
 	/* Check if the Lua script wants to handle/manipulate RTP packets itself */
-	if(has_incoming_rtp) {
+	if((has_incoming_rtp || has_incoming_rtp_ffi) && !g_atomic_int_get(&session->native_media)) {
 		/* Yep, pass the data to the Lua script and return */
-		janus_mutex_lock(&lua_mutex);
-		lua_State *t = lua_newthread(lua_state);
-		lua_getglobal(t, "incomingRtp");
-		lua_pushnumber(t, session->id);
-		lua_pushboolean(t, video);
-		lua_pushlstring(t, buf, len);
-		lua_pushnumber(t, len);
-		lua_call(t, 4, 0);
-		lua_pop(lua_state, 1);
-		janus_mutex_unlock(&lua_mutex);
+		janus_lua_instance *instance = session->instance;
+		janus_mutex_lock(instance->mutex);
+		lua_State *t = lua_newthread(instance->state);
+		if(has_incoming_rtp_ffi) {
+			/* With LuaJIT, we don't copy the packet to a Lua string, but pass
+			 * a pointer to the janus_plugin_rtp instance itself, which the
+			 * script can access (buffer and extensions) via the FFI: notice
+			 * that this is only valid for the duration of the callback */
+			lua_getglobal(t, "incomingRtpFfi");
+			lua_pushnumber(t, session->id);
+			lua_pushboolean(t, video);
+			lua_pushlightuserdata(t, rtp_packet);
+			lua_call(t, 3, 0);
+		} else {
+			lua_getglobal(t, "incomingRtp");
+			lua_pushnumber(t, session->id);
+			lua_pushboolean(t, video);
+			lua_pushlstring(t, buf, len);
+			lua_pushnumber(t, len);
+			lua_call(t, 4, 0);
+		}
+		lua_pop(instance->state, 1);
+		janus_mutex_unlock(instance->mutex);
 		return;
 	}
 	/* Is this session allowed to send media? */
@@ -2185,18 +2504,19 @@ void janus_lua_incoming_rtcp(janus_plugin_session *handle, janus_plugin_rtcp *pa
 	char *buf = packet->buffer;
 	uint16_t len = packet->length;
 	/* Check if the Lua script wants to handle/manipulate RTCP packets itself */
-	if(has_incoming_rtcp) {
+	if(has_incoming_rtcp && !g_atomic_int_get(&session->native_media)) {
 		/* Yep, pass the data to the Lua script and return */
-		janus_mutex_lock(&lua_mutex);
-		lua_State *t = lua_newthread(lua_state);
+		janus_lua_instance *instance = session->instance;
+		janus_mutex_lock(instance->mutex);
+		lua_State *t = lua_newthread(instance->state);
 		lua_getglobal(t, "incomingRtcp");
 		lua_pushnumber(t, session->id);
 		lua_pushboolean(t, video);
 		lua_pushlstring(t, buf, len);
 		lua_pushnumber(t, len);
 		lua_call(t, 4, 0);
-		lua_pop(lua_state, 1);
-		janus_mutex_unlock(&lua_mutex);
+		lua_pop(instance->state, 1);
+		janus_mutex_unlock(instance->mutex);
 		return;
 	}
 	/* If a REMB arrived, make sure we cap it to our configuration, and send it as a video RTCP */
@@ -2239,8 +2559,9 @@ void janus_lua_incoming_data(janus_plugin_session *handle, janus_plugin_data *pa
 		/* Yep, pass the data to the Lua script and return */
 		if(!packet->binary && !has_incoming_text_data)
 			JANUS_LOG(LOG_WARN, "Missing 'incomingTextData', invoking deprecated function 'incomingData' instead\n");
-		janus_mutex_lock(&lua_mutex);
-		lua_State *t = lua_newthread(lua_state);
+		janus_lua_instance *instance = session->instance;
+		janus_mutex_lock(instance->mutex);
+		lua_State *t = lua_newthread(instance->state);
 		lua_getglobal(t, packet->binary ? "incomingBinaryData" : (has_incoming_text_data ? "incomingTextData" : "incomingData"));
 		lua_pushnumber(t, session->id);
 		/* We use a string for both text and binary data */
@@ -2249,8 +2570,8 @@ void janus_lua_incoming_data(janus_plugin_session *handle, janus_plugin_data *pa
 		lua_pushlstring(t, label, label ? strlen(label) : 0);
 		lua_pushlstring(t, protocol, protocol ? strlen(protocol) : 0);
 		lua_call(t, 5, 0);
-		lua_pop(lua_state, 1);
-		janus_mutex_unlock(&lua_mutex);
+		lua_pop(instance->state, 1);
+		janus_mutex_unlock(instance->mutex);
 		return;
 	}
 	/* Is this session allowed to send data? */
@@ -2287,13 +2608,14 @@ void janus_lua_data_ready(janus_plugin_session *handle) {
 	/* Check if the Lua script wants to receive this event */
 	if(has_data_ready) {
 		/* Yep, pass the event to the Lua script and return */
-		janus_mutex_lock(&lua_mutex);
-		lua_State *t = lua_newthread(lua_state);
+		janus_lua_instance *instance = session->instance;
+		janus_mutex_lock(instance->mutex);
+		lua_State *t = lua_newthread(instance->state);
 		lua_getglobal(t, "dataReady");
 		lua_pushnumber(t, session->id);
 		lua_call(t, 1, 0);
-		lua_pop(lua_state, 1);
-		janus_mutex_unlock(&lua_mutex);
+		lua_pop(instance->state, 1);
+		janus_mutex_unlock(instance->mutex);
 		return;
 	}
 }
@@ -2315,15 +2637,16 @@ void janus_lua_slow_link(janus_plugin_session *handle, int mindex, gboolean vide
 	janus_refcount_increase(&session->ref);
 	if(has_slow_link) {
 		/* Notify the Lua script */
-		janus_mutex_lock(&lua_mutex);
-		lua_State *t = lua_newthread(lua_state);
+		janus_lua_instance *instance = session->instance;
+		janus_mutex_lock(instance->mutex);
+		lua_State *t = lua_newthread(instance->state);
 		lua_getglobal(t, "slowLink");
 		lua_pushnumber(t, session->id);
 		lua_pushboolean(t, uplink);
 		lua_pushboolean(t, video);
 		lua_call(t, 3, 0);
-		lua_pop(lua_state, 1);
-		janus_mutex_unlock(&lua_mutex);
+		lua_pop(instance->state, 1);
+		janus_mutex_unlock(instance->mutex);
 	}
 	janus_refcount_decrease(&session->ref);
 }
@@ -2384,13 +2707,14 @@ void janus_lua_hangup_media(janus_plugin_session *handle) {
 	janus_mutex_unlock(&session->recipients_mutex);
 
 	/* Notify the Lua script */
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_instance *instance = session->instance;
+	janus_mutex_lock(instance->mutex);
+	lua_State *t = lua_newthread(instance->state);
 	lua_getglobal(t, "hangupMedia");
 	lua_pushnumber(t, session->id);
 	lua_call(t, 1, 0);
-	lua_pop(lua_state, 1);
-	janus_mutex_unlock(&lua_mutex);
+	lua_pop(instance->state, 1);
+	janus_mutex_unlock(instance->mutex);
 	janus_refcount_decrease(&session->ref);
 }
 
@@ -2434,27 +2758,29 @@ static void janus_lua_relay_rtp_packet(gpointer data, gpointer user_data) {
 		if(session->sim_context.changed_substream) {
 			/* Notify the script about the substream change */
 			if(has_substream_changed) {
-				janus_mutex_lock(&lua_mutex);
-				lua_State *t = lua_newthread(lua_state);
+				janus_lua_instance *instance = session->instance;
+				janus_mutex_lock(instance->mutex);
+				lua_State *t = lua_newthread(instance->state);
 				lua_getglobal(t, "substreamChanged");
 				lua_pushnumber(t, session->id);
 				lua_pushnumber(t, session->sim_context.substream);
 				lua_call(t, 2, 0);
-				lua_pop(lua_state, 1);
-				janus_mutex_unlock(&lua_mutex);
+				lua_pop(instance->state, 1);
+				janus_mutex_unlock(instance->mutex);
 			}
 		}
 		if(session->sim_context.changed_temporal) {
 			/* Notify the user about the temporal layer change */
 			if(has_substream_changed) {
-				janus_mutex_lock(&lua_mutex);
-				lua_State *t = lua_newthread(lua_state);
+				janus_lua_instance *instance = session->instance;
+				janus_mutex_lock(instance->mutex);
+				lua_State *t = lua_newthread(instance->state);
 				lua_getglobal(t, "temporalLayerChanged");
 				lua_pushnumber(t, session->id);
 				lua_pushnumber(t, session->sim_context.templayer);
 				lua_call(t, 2, 0);
-				lua_pop(lua_state, 1);
-				janus_mutex_unlock(&lua_mutex);
+				lua_pop(instance->state, 1);
+				janus_mutex_unlock(instance->mutex);
 			}
 		}
 		/* If we got here, update the RTP header and send the packet */
@@ -2526,24 +2852,38 @@ static void janus_lua_relay_data_packet(gpointer data, gpointer user_data) {
 /* This is a scheduler thread: if we know there are coroutines to resume
  * in Lua (e.g., for asynchronous requests), we do that ourselves here */
 static void *janus_lua_scheduler(void *data) {
-	JANUS_LOG(LOG_VERB, "Joining Lua scheduler thread\n");
+	janus_lua_instance *instance = (janus_lua_instance *)data;
+	JANUS_LOG(LOG_VERB, "Joining Lua scheduler thread (instance %u)\n", instance->id);
 	janus_lua_event *event = NULL;
 	/* Wait until there are events to process */
 	while(g_atomic_int_get(&lua_initialized) && !g_atomic_int_get(&lua_stopping)) {
-		event = g_async_queue_pop(events);
+		event = g_async_queue_pop(instance->events);
 		if(event == GUINT_TO_POINTER(janus_lua_event_exit))
 			break;
 		if(event == GUINT_TO_POINTER(janus_lua_event_resume)) {
 			/* There are coroutines to resume */
-			janus_mutex_lock(&lua_mutex);
-			lua_getglobal(lua_state, "resumeScheduler");
-			lua_call(lua_state, 0, 0);
+			janus_mutex_lock(instance->mutex);
+			lua_getglobal(instance->state, "resumeScheduler");
+			lua_call(instance->state, 0, 0);
 			/* Print the count of elements into Lua stack */
-			janus_lua_stackdump(lua_state);
-			janus_mutex_unlock(&lua_mutex);
+			janus_lua_stackdump(instance->state);
+			janus_mutex_unlock(instance->mutex);
+		} else if(event != NULL) {
+			/* A message from another instance */
+			janus_lua_message *msg = (janus_lua_message *)event;
+			janus_mutex_lock(instance->mutex);
+			lua_State *t = lua_newthread(instance->state);
+			lua_getglobal(t, "incomingMessage");
+			lua_pushnumber(t, msg->from);
+			lua_pushstring(t, msg->text);
+			lua_call(t, 2, 0);
+			lua_pop(instance->state, 1);
+			janus_mutex_unlock(instance->mutex);
+			g_free(msg->text);
+			g_free(msg);
 		}
 	}
-	JANUS_LOG(LOG_VERB, "Leaving Lua scheduler thread\n");
+	JANUS_LOG(LOG_VERB, "Leaving Lua scheduler thread (instance %u)\n", instance->id);
 	return NULL;
 }
 
@@ -2568,8 +2908,9 @@ static gboolean janus_lua_timer_cb(void *data) {
 		return FALSE;
 	/* Invoke the callback with the provided argument, if available */
 	JANUS_LOG(LOG_VERB, "Invoking scheduled callback (waited %"SCNu32"ms) with ID %u\n", cb->ms, cb->id);
-	janus_mutex_lock(&lua_mutex);
-	lua_State *t = lua_newthread(lua_state);
+	janus_lua_instance *instance = cb->instance;
+	janus_mutex_lock(instance->mutex);
+	lua_State *t = lua_newthread(instance->state);
 	lua_getglobal(t, cb->function);
 	if(cb->argument == NULL) {
 		lua_call(t, 0, 0);
@@ -2577,9 +2918,11 @@ static gboolean janus_lua_timer_cb(void *data) {
 		lua_pushstring(t, cb->argument);
 		lua_call(t, 1, 0);
 	}
-	lua_pop(lua_state, 1);
+	lua_pop(instance->state, 1);
+	janus_mutex_unlock(instance->mutex);
 	/* Done */
+	janus_mutex_lock(&callbacks_mutex);
 	g_hash_table_remove(callbacks, cb);
-	janus_mutex_unlock(&lua_mutex);
+	janus_mutex_unlock(&callbacks_mutex);
 	return FALSE;
 }
@@ -26,6 +26,9 @@
 #include <lua.h>
 #include <lualib.h>
 #include <lauxlib.h>
+#ifdef HAVE_LUAJIT
+#include <luajit.h>
+#endif
 
 #include "plugin.h"
 
@@ -47,6 +50,20 @@ extern janus_callbacks *lua_janus_core;
 extern lua_State *lua_state;
 extern janus_mutex lua_mutex;
 
+/* Lua instances: the plugin can be configured to load the script in more
+ * than one Lua state, in which case sessions are sharded among them, so
+ * that they can be served in parallel. The first instance uses the
+ * lua_state and lua_mutex above, so it's always available */
+typedef struct janus_lua_instance {
+	guint id;							/* Index of this instance */
+	lua_State *state;					/* Lua state of this instance */
+	janus_mutex *mutex;					/* Mutex to lock the Lua state of this instance */
+	GAsyncQueue *events;				/* Events for the scheduler of this instance */
+	GThread *scheduler;					/* Scheduler thread of this instance */
+} janus_lua_instance;
+extern janus_lua_instance *lua_instances;
+extern guint lua_instances_count;
+
 /* Lua session: we keep only the barebone stuff here, the rest will be in the Lua script */
 typedef struct janus_lua_session {
 	janus_plugin_session *handle;		/* Pointer to the core-plugin session */
@@ -68,6 +85,7 @@ typedef struct janus_lua_session {
 	janus_vp8_simulcast_context vp8_context;
 	uint32_t bitrate;					/* Bitrate limit */
 	uint16_t pli_freq;					/* Regular PLI frequency (0=disabled) */
+	volatile gint native_media;			/* Whether RTP/RTCP from this session are routed in C even if the script handles media */
 	gint64 pli_latest;					/* Time of latest sent PLI (to avoid flooding) */
 	GSList *recipients;					/* Sessions that should receive media from this session */
 	struct janus_lua_session *sender;	/* Other session this session is receiving media from */
@@ -83,6 +101,7 @@ typedef struct janus_lua_session {
 	volatile gint dataready;			/* Whether the data channel was established on this sessions's PeerConnection */
 	volatile gint hangingup;			/* Whether this session's PeerConnection is hanging up */
 	volatile gint destroyed;			/* Whether this session's been marked as destroyed */
+	janus_lua_instance *instance;		/* Lua instance this session is handled by */
 	/* If you need any additional property (e.g., for hooks you added in janus_lua_extra.c) add them below this line */
 
 	/* Reference counter */
@@ -40,6 +40,13 @@
  * configuration file, which will automatically mark all new recordings
  * as private by default unless otherwise specified in the API request.
  *
+ * Replaying recordings doesn't need a thread per viewer: a fixed number
+ * of playout threads (\c playout_threads in the configuration file, two
+ * by default) serve all of them, sending each frame when it's due. The
+ * ordered frames of a recording are also cached in memory, and shared
+ * by all its viewers, up to \c frames_cache MB (64 by default): this
+ * way, popular recordings are only parsed once, unless their files change.
+ *
  * \note The application creates a special file in INI format with
  * <tt>.nfo</tt> extension for each recording that is saved. This is necessary
  * to map a specific audio .mjr file to a different video .mjr one, as
@@ -71,13 +78,14 @@
  * to scan the folder of recordings again in case some were added manually
  * and not indexed in the meanwhile.
  *
- * The \c record , \c play , \c start and \c stop requests instead are
- * all asynchronous, which means you'll get a notification about their
- * success or failure in an event. \c record asks the plugin to start
- * recording a session; \c play asks the plugin to prepare the playout
- * of one of the previously recorded sessions; \c start starts the
- * actual playout, and \c stop stops whatever the session was for, i.e.,
- * recording or replaying.
+ * The \c record , \c play , \c start , \c seek , \c range and \c stop
+ * requests instead are all asynchronous, which means you'll get a
+ * notification about their success or failure in an event. \c record
+ * asks the plugin to start recording a session; \c play asks the plugin
+ * to prepare the playout of one of the previously recorded sessions;
+ * \c start starts the actual playout, \c seek and \c range move it to
+ * a different position (and/or change its speed), and \c stop stops
+ * whatever the session was for, i.e., recording or replaying.
  *
  * The \c list request has to be formatted as follows:
  *
@@ -261,6 +269,50 @@
 		"status" : "playing"
 	}
 }
+\endverbatim
+ *
+ * While a recording is being replayed (or even before it starts, right
+ * after the \c play request), you can move to a different position in
+ * the recording with a \c seek request, and change the speed of the
+ * playout as well, e.g., to review a recording faster:
+ *
+\verbatim
+{
+	"request" : "seek",
+	"position" : <position to move to, in milliseconds from the start; optional if speed is provided>,
+	"speed" : <playout speed, from 1 (default) to 4; optional>
+}
+\endverbatim
+ *
+ * Since a decoder can only resume from a keyframe, if the recording has
+ * video the playout will actually move to the closest keyframe before the
+ * requested position (as marked in the index of the recording), with audio
+ * and data aligned to it. Notice that audio is only played at normal speed,
+ * which means it will be skipped when the speed is higher than 1. A \c range
+ * request works the same way, but also sets where the playout should stop:
+ *
+\verbatim
+{
+	"request" : "range",
+	"start" : <position to start from, in milliseconds from the start>,
+	"end" : <position to stop at, in milliseconds from the start; optional, plays until the end if missing>,
+	"speed" : <playout speed, from 1 (default) to 4; optional>
+}
+\endverbatim
+ *
+ * Both requests will result in a \c seeking status (or \c ok if only the
+ * speed was changed) and, as soon as the playout has actually moved, in a
+ * \c seeked event with the position the playout moved to:
+ *
+\verbatim
+{
+	"recordplay" : "event",
+	"result": {
+		"status" : "seeked",
+		"id" : <unique numeric ID of the recording>,
+		"position" : <position the playout moved to, in milliseconds>
+	}
+}
 \endverbatim
  *
  * Just as before, a \c stop request can interrupt the playout process at
@@ -413,6 +465,15 @@ static struct janus_json_parameter play_parameters[] = {
 	{"id", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE},
 	{"restart", JANUS_JSON_BOOL, 0}
 };
+static struct janus_json_parameter seek_parameters[] = {
+	{"position", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"speed", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
+};
+static struct janus_json_parameter range_parameters[] = {
+	{"start", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE},
+	{"end", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"speed", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
+};
 
 /* Useful stuff */
 static volatile gint initialized = 0, stopping = 0;
@@ -443,10 +504,33 @@ typedef struct janus_recordplay_frame_packet {
 	uint64_t ts;	/* RTP Timestamp */
 	int len;		/* Length of the data */
 	long offset;	/* Offset of the data in the file */
+	gboolean keyframe;	/* Whether this is (part of) a video keyframe */
 	struct janus_recordplay_frame_packet *next;
 	struct janus_recordplay_frame_packet *prev;
 } janus_recordplay_frame_packet;
-janus_recordplay_frame_packet *janus_recordplay_get_frames(const char *dir, const char *filename);
+
+/* Ordered frames of a recording file: indexes are cached and shared by
+ * all the viewers of the same file, so that popular recordings are only
+ * parsed once; the cache is bounded in memory, and least recently used
+ * indexes are evicted first. Indexes are read-only once created */
+typedef struct janus_recordplay_frames {
+	char *path;					/* Path of the recording file */
+	gint64 mtime;				/* Modification time of the file when it was indexed */
+	size_t size;				/* Size of the file when it was indexed */
+	janus_recordplay_frame_packet *list;	/* Ordered list of frames */
+	janus_recordplay_frame_packet **array;	/* Same frames, as an array (for seeking) */
+	guint count;				/* Number of frames */
+	size_t memory;				/* Memory taken by the list of frames */
+	GList *link;				/* Link in the LRU queue, if cached */
+	janus_refcount ref;			/* Reference counter */
+} janus_recordplay_frames;
+static GHashTable *frames_cache = NULL;		/* Cached indexes, by path */
+static GQueue frames_lru = G_QUEUE_INIT;	/* Cached indexes, most recently used first */
+static size_t frames_cache_memory = 0, frames_cache_max = 64*1024*1024;
+static janus_mutex frames_mutex = JANUS_MUTEX_INITIALIZER;
+janus_recordplay_frames *janus_recordplay_get_frames(const char *dir, const char *filename);
+static void janus_recordplay_frames_unref(janus_recordplay_frames *frames);
+static void janus_recordplay_frames_evict(janus_recordplay_frames *frames);
 
 typedef struct janus_recordplay_recording {
 	guint64 id;					/* Recording unique ID */
@@ -491,10 +575,14 @@ typedef struct janus_recordplay_session {
 	janus_recorder *vrc;	/* Video recorder */
 	janus_recorder *drc;	/* Data recorder */
 	janus_mutex rec_mutex;	/* Mutex to protect the recorders from race conditions */
-	janus_recordplay_frame_packet *aframes;	/* Audio frames (for playout) */
-	janus_recordplay_frame_packet *vframes;	/* Video frames (for playout) */
-	janus_recordplay_frame_packet *dframes;	/* Data packets (for playout) */
+	janus_recordplay_frames *aframes;	/* Audio frames (for playout) */
+	janus_recordplay_frames *vframes;	/* Video frames (for playout) */
+	janus_recordplay_frames *dframes;	/* Data packets (for playout) */
 	gboolean opusred;		/* Whether this user supports RED for audio (for playout) */
+	volatile gint seek;		/* Position to seek to in ms, plus one (0 if no seek was requested) */
+	volatile gint range_end;	/* Position to stop the playout at in ms, plus one (0 to play until the end) */
+	volatile gint speed;	/* Playout speed, e.g., 2 for twice as fast (audio is only played at normal speed) */
+	volatile gint position;	/* Current position of the playout, in ms */
 	gboolean textdata;		/* Whether data format is text */
 	guint video_remb_startup;
 	gint64 video_remb_last;
@@ -526,6 +614,9 @@ static void janus_recordplay_session_free(const janus_refcount *session_ref) {
 	/* Remove the reference to the core plugin session */
 	janus_refcount_decrease(&session->handle->ref);
 	/* This session can be destroyed, free all the resources */
+	janus_recordplay_frames_unref(session->aframes);
+	janus_recordplay_frames_unref(session->vframes);
+	janus_recordplay_frames_unref(session->dframes);
 	g_free(session->video_profile);
 	janus_mutex_destroy(&session->rid_mutex);
 	janus_mutex_destroy(&session->rec_mutex);
@@ -556,7 +647,56 @@ static void janus_recordplay_recording_free(const janus_refcount *recording_ref)
 
 static char *recordings_path = NULL;
 void janus_recordplay_update_recordings_list(void);
-static void *janus_recordplay_playout_thread(void *data);
+
+/* Playout of a recording to a viewer: rather than a thread per viewer,
+ * playouts are served by a fixed set of playout threads, each keeping
+ * its playouts in a queue ordered by when their next frame is due. The
+ * time each frame is due at is computed from when the playout started,
+ * and not from when the previous frame was sent, so no drift accumulates.
+ * Seeking or changing the speed just starts a new segment, i.e., a new
+ * reference for when frames are due: since this means jumps in the
+ * recorded sequence numbers and timestamps, they're rewritten on the
+ * way out, so that viewers always see a continuous stream */
+typedef struct janus_recordplay_rewrite {
+	gboolean started;			/* Whether we sent any packet already */
+	gboolean jump;				/* Whether the next packet starts a new segment */
+	uint64_t ts_in;				/* Recorded timestamp of the first packet of the segment */
+	uint32_t ts_out;			/* Timestamp we sent the first packet of the segment with */
+	uint16_t seq_offset;		/* Offset to apply to recorded sequence numbers */
+	uint32_t last_ts;			/* Last timestamp we sent */
+	uint16_t last_seq;			/* Last sequence number we sent */
+	gint64 last_sent;			/* When we sent the last packet */
+} janus_recordplay_rewrite;
+#define JANUS_RECORDPLAY_MAX_SPEED	4
+typedef struct janus_recordplay_playout {
+	janus_recordplay_session *session;		/* Viewer this playout is for */
+	janus_recordplay_recording *recording;	/* Recording being played */
+	janus_recordplay_frames *aframes, *vframes, *dframes;	/* Frame indexes */
+	janus_recording *afile, *vfile, *dfile;	/* Recording files */
+	janus_recordplay_frame_packet *audio, *video, *data;	/* Next frames to send */
+	int audio_pt, video_pt;		/* Payload types to use */
+	int akhz, vkhz;				/* Clock rates, in kHz */
+	janus_recordplay_rewrite arewrite, vrewrite;	/* Rewriting of audio and video packets */
+	gint64 started;				/* Monotonic time the current segment started at */
+	gint64 position;			/* Position in the recording (in us) the current segment started from */
+	int speed;					/* Speed of the current segment */
+	gint64 end;					/* Position in the recording (in us) to stop at, if any */
+	gint64 deadline;			/* Monotonic time the next frame is due at */
+	char buffer[1500];			/* Buffer to send frames from */
+} janus_recordplay_playout;
+typedef struct janus_recordplay_player {
+	int id;						/* Index of this playout thread */
+	GThread *thread;			/* Playout thread */
+	janus_mutex mutex;			/* Mutex to protect the queue */
+	GCond cond;					/* Condition to wake the thread up */
+	GQueue *playouts;			/* Playouts handled by this thread, in deadline order */
+	volatile gint count;		/* Number of playouts handled by this thread */
+	volatile gint missed;		/* Number of frames that were sent late by more than 20ms */
+} janus_recordplay_player;
+static janus_recordplay_player *players = NULL;
+static int playout_threads = 2;
+static void *janus_recordplay_player_thread(void *data);
+static int janus_recordplay_playout_start(janus_recordplay_session *session);
 
 /* Helper to send RTCP feedback back to recorders, if needed */
 void janus_recordplay_send_rtcp_feedback(janus_plugin_session *handle, int video, char *buf, int len);
@@ -869,6 +1009,24 @@ int janus_recordplay_init(janus_callbacks *callback, const char *config_path) {
 		if(!notify_events && callback->events_is_enabled()) {
 			JANUS_LOG(LOG_WARN, "Notification of events to handlers disabled for %s\n", JANUS_RECORDPLAY_NAME);
 		}
+		janus_config_item *threads = janus_config_get(config, config_general, janus_config_type_item, "playout_threads");
+		if(threads != NULL && threads->value != NULL) {
+			int val = atoi(threads->value);
+			if(val < 1) {
+				JANUS_LOG(LOG_WARN, "Ignoring playout_threads value as it's not a positive integer\n");
+			} else {
+				playout_threads = val;
+			}
+		}
+		janus_config_item *cache = janus_config_get(config, config_general, janus_config_type_item, "frames_cache");
+		if(cache != NULL && cache->value != NULL) {
+			int val = atoi(cache->value);
+			if(val < 0) {
+				JANUS_LOG(LOG_WARN, "Ignoring frames_cache value as it's not a positive integer\n");
+			} else {
+				frames_cache_max = (size_t)val*1024*1024;
+			}
+		}
 		/* Done */
 		janus_config_destroy(config);
 		config = NULL;
@@ -895,6 +1053,10 @@ int janus_recordplay_init(janus_callbacks *callback, const char *config_path) {
 	}
 	recordings = g_hash_table_new_full(g_int64_hash, g_int64_equal, (GDestroyNotify)g_free, (GDestroyNotify)janus_recordplay_recording_destroy);
 	janus_recordplay_update_recordings_list();
+	if(frames_cache_max > 0)
+		frames_cache = g_hash_table_new(g_str_hash, g_str_equal);
+	JANUS_LOG(LOG_VERB, "Using %d playout threads, caching up to %zu bytes of frame indexes\n",
+		playout_threads, frames_cache_max);
 
 	sessions = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_recordplay_session_destroy);
 	messages = g_async_queue_new_full((GDestroyNotify) janus_recordplay_message_free);
@@ -903,8 +1065,29 @@ int janus_recordplay_init(janus_callbacks *callback, const char *config_path) {
 
 	g_atomic_int_set(&initialized, 1);
 
-	/* Launch the thread that will handle incoming messages */
+	/* Launch the playout threads */
 	GError *error = NULL;
+	players = g_malloc0(playout_threads * sizeof(janus_recordplay_player));
+	int i = 0;
+	for(i=0; i<playout_threads; i++) {
+		janus_recordplay_player *player = &players[i];
+		player->id = i;
+		janus_mutex_init(&player->mutex);
+		g_cond_init(&player->cond);
+		player->playouts = g_queue_new();
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "rp playout %d", i);
+		player->thread = g_thread_try_new(tname, janus_recordplay_player_thread, player, &error);
+		if(error != NULL) {
+			/* We'll keep on using the playout threads we could launch, if any */
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Record&Play playout thread #%d...\n",
+				error->code, error->message ? error->message : "??", i);
+			g_error_free(error);
+			error = NULL;
+			player->thread = NULL;
+		}
+	}
+	/* Launch the thread that will handle incoming messages */
 	handler_thread = g_thread_try_new("recordplay handler", janus_recordplay_handler, NULL, &error);
 	if(error != NULL) {
 		g_atomic_int_set(&initialized, 0);
@@ -931,6 +1114,33 @@ void janus_recordplay_destroy(void) {
 		g_thread_join(handler_thread);
 		handler_thread = NULL;
 	}
+	/* Stop the playout threads: they release their playouts when leaving */
+	if(players != NULL) {
+		int i = 0;
+		for(i=0; i<playout_threads; i++) {
+			janus_recordplay_player *player = &players[i];
+			if(player->thread != NULL) {
+				janus_mutex_lock(&player->mutex);
+				g_cond_signal(&player->cond);
+				janus_mutex_unlock(&player->mutex);
+				g_thread_join(player->thread);
+				player->thread = NULL;
+			}
+			g_queue_free(player->playouts);
+			g_cond_clear(&player->cond);
+			janus_mutex_destroy(&player->mutex);
+		}
+		g_free(players);
+		players = NULL;
+	}
+	/* Get rid of the cached frame indexes */
+	janus_mutex_lock(&frames_mutex);
+	while(frames_lru.tail != NULL)
+		janus_recordplay_frames_evict((janus_recordplay_frames *)frames_lru.tail->data);
+	if(frames_cache != NULL)
+		g_hash_table_destroy(frames_cache);
+	frames_cache = NULL;
+	janus_mutex_unlock(&frames_mutex);
 	/* FIXME We should destroy the sessions cleanly */
 	janus_mutex_lock(&sessions_mutex);
 	g_hash_table_destroy(sessions);
@@ -1000,6 +1210,7 @@ void janus_recordplay_create_session(janus_plugin_session *handle, int *error) {
 	session->vrc = NULL;
 	session->drc = NULL;
 	janus_mutex_init(&session->rec_mutex);
+	g_atomic_int_set(&session->speed, 1);
 	g_atomic_int_set(&session->hangingup, 0);
 	g_atomic_int_set(&session->destroyed, 0);
 	session->video_remb_startup = 4;
@@ -1064,6 +1275,10 @@ json_t *janus_recordplay_query_session(janus_plugin_session *handle) {
 		json_object_set_new(info, "recording_name", json_string(session->recording->name));
 		if(session->recording->e2ee)
 			json_object_set_new(info, "e2ee", json_true());
+		if(!session->recorder) {
+			json_object_set_new(info, "position", json_integer(g_atomic_int_get(&session->position)));
+			json_object_set_new(info, "speed", json_integer(g_atomic_int_get(&session->speed)));
+		}
 		janus_refcount_decrease(&session->recording->ref);
 	}
 	json_object_set_new(info, "hangingup", json_integer(g_atomic_int_get(&session->hangingup)));
@@ -1228,7 +1443,8 @@ struct janus_plugin_result *janus_recordplay_handle_message(janus_plugin_session
 		goto plugin_response;
 	} else if(!strcasecmp(request_text, "record") || !strcasecmp(request_text, "play")
 			|| !strcasecmp(request_text, "start") || !strcasecmp(request_text, "stop")
-			|| !strcasecmp(request_text, "pause") || !strcasecmp(request_text, "resume")) {
+			|| !strcasecmp(request_text, "pause") || !strcasecmp(request_text, "resume")
+			|| !strcasecmp(request_text, "seek") || !strcasecmp(request_text, "range")) {
 		/* These messages are handled asynchronously */
 		janus_recordplay_message *msg = g_malloc(sizeof(janus_recordplay_message));
 		msg->handle = handle;
@@ -1345,15 +1561,13 @@ void janus_recordplay_setup_media(janus_plugin_session *handle) {
 	/* Take note of the fact that the session is now active */
 	session->active = TRUE;
 	if(!session->recorder) {
-		GError *error = NULL;
-		janus_refcount_increase(&session->ref);
-		g_thread_try_new("recordplay playout thread", &janus_recordplay_playout_thread, session, &error);
-		if(error != NULL) {
-			janus_refcount_decrease(&session->ref);
+		if(janus_recordplay_playout_start(session) < 0) {
 			/* FIXME Should we notify this back to the user somehow? */
-			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Record&Play playout thread...\n",
-				error->code, error->message ? error->message : "??");
-			g_error_free(error);
+			if(session->recording) {
+				janus_mutex_lock(&session->recording->mutex);
+				session->recording->viewers = g_list_remove(session->recording->viewers, session);
+				janus_mutex_unlock(&session->recording->mutex);
+			}
 			gateway->close_pc(session->handle);
 		}
 	}
@@ -2097,6 +2311,12 @@ recdone:
 				goto error;
 			}
 			/* Access the frames */
+			janus_recordplay_frames_unref(session->aframes);
+			session->aframes = NULL;
+			janus_recordplay_frames_unref(session->vframes);
+			session->vframes = NULL;
+			janus_recordplay_frames_unref(session->dframes);
+			session->dframes = NULL;
 			if(rec->arc_file) {
 				session->aframes = janus_recordplay_get_frames(recordings_path, rec->arc_file);
 				if(session->aframes == NULL) {
@@ -2125,6 +2345,10 @@ recdone:
 			}
 			if(rec->opusred_pt > 0)
 				session->opusred = TRUE;	/* Assume the user does support RED, if it's in the recording */
+			g_atomic_int_set(&session->seek, 0);
+			g_atomic_int_set(&session->range_end, 0);
+			g_atomic_int_set(&session->speed, 1);
+			g_atomic_int_set(&session->position, 0);
 			session->recording = rec;
 			session->recorder = FALSE;
 			rec->viewers = g_list_append(rec->viewers, session);
@@ -2193,6 +2417,68 @@ playdone:
 			}
 			/* Tell the core to tear down the PeerConnection, hangup_media will do the rest */
 			gateway->close_pc(session->handle);
+		} else if(!strcasecmp(request_text, "seek") || !strcasecmp(request_text, "range")) {
+			/* Seeking, ranges and speed changes are all applied by the playout thread */
+			gboolean range = !strcasecmp(request_text, "range");
+			if(range) {
+				JANUS_VALIDATE_JSON_OBJECT(root, range_parameters,
+					error_code, error_cause, TRUE,
+					JANUS_RECORDPLAY_ERROR_MISSING_ELEMENT, JANUS_RECORDPLAY_ERROR_INVALID_ELEMENT);
+			} else {
+				JANUS_VALIDATE_JSON_OBJECT(root, seek_parameters,
+					error_code, error_cause, TRUE,
+					JANUS_RECORDPLAY_ERROR_MISSING_ELEMENT, JANUS_RECORDPLAY_ERROR_INVALID_ELEMENT);
+			}
+			if(error_code != 0)
+				goto error;
+			if(session->recorder || session->recording == NULL || (!session->aframes && !session->vframes)) {
+				JANUS_LOG(LOG_ERR, "Not a playout session, can't %s\n", request_text);
+				error_code = JANUS_RECORDPLAY_ERROR_INVALID_STATE;
+				g_snprintf(error_cause, 512, "Not a playout session, can't %s", request_text);
+				goto error;
+			}
+			json_t *position = json_object_get(root, range ? "start" : "position");
+			json_t *end = json_object_get(root, "end");
+			json_t *speed = json_object_get(root, "speed");
+			if(position == NULL && speed == NULL) {
+				JANUS_LOG(LOG_ERR, "Missing element (position or speed)\n");
+				error_code = JANUS_RECORDPLAY_ERROR_MISSING_ELEMENT;
+				g_snprintf(error_cause, 512, "Missing element (position or speed)");
+				goto error;
+			}
+			if(position && json_integer_value(position) >= G_MAXINT) {
+				JANUS_LOG(LOG_ERR, "Invalid element (position out of range)\n");
+				error_code = JANUS_RECORDPLAY_ERROR_INVALID_ELEMENT;
+				g_snprintf(error_cause, 512, "Invalid element (position out of range)");
+				goto error;
+			}
+			if(end && (json_integer_value(end) <= json_integer_value(position) || json_integer_value(end) >= G_MAXINT)) {
+				JANUS_LOG(LOG_ERR, "Invalid element (end must be after start)\n");
+				error_code = JANUS_RECORDPLAY_ERROR_INVALID_ELEMENT;
+				g_snprintf(error_cause, 512, "Invalid element (end must be after start)");
+				goto error;
+			}
+			if(speed && (json_integer_value(speed) < 1 || json_integer_value(speed) > JANUS_RECORDPLAY_MAX_SPEED)) {
+				JANUS_LOG(LOG_ERR, "Invalid element (speed must be between 1 and %d)\n", JANUS_RECORDPLAY_MAX_SPEED);
+				error_code = JANUS_RECORDPLAY_ERROR_INVALID_ELEMENT;
+				g_snprintf(error_cause, 512, "Invalid element (speed must be between 1 and %d)", JANUS_RECORDPLAY_MAX_SPEED);
+				goto error;
+			}
+			if(speed)
+				g_atomic_int_set(&session->speed, json_integer_value(speed));
+			if(range)
+				g_atomic_int_set(&session->range_end, end ? json_integer_value(end)+1 : 0);
+			if(position)
+				g_atomic_int_set(&session->seek, json_integer_value(position)+1);
+			/* Done! */
+			result = json_object();
+			json_object_set_new(result, "status", json_string(position ? "seeking" : "ok"));
+			json_object_set_new(result, "id", json_integer(session->recording->id));
+			if(position)
+				json_object_set_new(result, "position", json_integer(json_integer_value(position)));
+			if(range && end)
+				json_object_set_new(result, "end", json_integer(json_integer_value(end)));
+			json_object_set_new(result, "speed", json_integer(g_atomic_int_get(&session->speed)));
 		} else if (!strcasecmp(request_text, "pause") || !strcasecmp(request_text, "resume")) {
 			JANUS_LOG(LOG_VERB, "Record&Play: Got pause/resume request\n");
 			if(session->recording) {
@@ -2454,228 +2740,152 @@ void janus_recordplay_update_recordings_list(void) {
 	janus_mutex_unlock(&recordings_mutex);
 }
 
-janus_recordplay_frame_packet *janus_recordplay_get_frames(const char *dir, const char *filename) {
+static void janus_recordplay_frames_free(const janus_refcount *frames_ref) {
+	janus_recordplay_frames *frames = janus_refcount_containerof(frames_ref, janus_recordplay_frames, ref);
+	/* This index can be destroyed, free all the resources */
+	janus_recordplay_frame_packet *tmp = NULL, *list = frames->list;
+	while(list) {
+		tmp = list->next;
+		g_free(list);
+		list = tmp;
+	}
+	g_free(frames->array);
+	g_free(frames->path);
+	g_free(frames);
+}
+
+static void janus_recordplay_frames_unref(janus_recordplay_frames *frames) {
+	if(frames)
+		janus_refcount_decrease(&frames->ref);
+}
+
+/* Remove an index from the cache (called with frames_mutex locked): viewers
+ * still using it keep their reference, so it will only go away when they're done */
+static void janus_recordplay_frames_evict(janus_recordplay_frames *frames) {
+	g_hash_table_remove(frames_cache, frames->path);
+	g_queue_delete_link(&frames_lru, frames->link);
+	frames->link = NULL;
+	frames_cache_memory -= frames->memory;
+	janus_refcount_decrease(&frames->ref);
+}
+
+static janus_recordplay_frame_packet *janus_recordplay_index_frames(janus_recording *recording, const char *source);
+janus_recordplay_frames *janus_recordplay_get_frames(const char *dir, const char *filename) {
 	if(!dir || !filename)
 		return NULL;
-	/* Open the file */
+	/* Open the file: the recording code takes care of indexing it, if needed */
 	char source[1024];
 	if(strstr(filename, ".mjr"))
 		g_snprintf(source, 1024, "%s/%s", dir, filename);
 	else
 		g_snprintf(source, 1024, "%s/%s.mjr", dir, filename);
-	FILE *file = fopen(source, "rb");
-	if(file == NULL) {
+	janus_recording *recording = janus_recording_open(source);
+	if(recording == NULL) {
 		JANUS_LOG(LOG_ERR, "Could not open file %s\n", source);
 		return NULL;
 	}
-	fseek(file, 0L, SEEK_END);
-	long fsize = ftell(file);
-	fseek(file, 0L, SEEK_SET);
-	JANUS_LOG(LOG_VERB, "File is %zu bytes\n", fsize);
+	JANUS_LOG(LOG_VERB, "File is %zu bytes (%u frames)\n", recording->size, recording->count);
+	/* Check if we ordered the frames of this file already, and it didn't change since then */
+	janus_mutex_lock(&frames_mutex);
+	janus_recordplay_frames *frames = frames_cache ? g_hash_table_lookup(frames_cache, source) : NULL;
+	if(frames != NULL) {
+		if(frames->mtime == recording->mtime && frames->size == recording->size) {
+			JANUS_LOG(LOG_VERB, "Using the cached frames of %s\n", source);
+			janus_refcount_increase(&frames->ref);
+			g_queue_unlink(&frames_lru, frames->link);
+			g_queue_push_head_link(&frames_lru, frames->link);
+			janus_mutex_unlock(&frames_mutex);
+			janus_recording_close(recording);
+			return frames;
+		}
+		/* The file changed, get rid of the stale index */
+		JANUS_LOG(LOG_VERB, "File %s changed, dropping the cached frames\n", source);
+		janus_recordplay_frames_evict(frames);
+	}
+	janus_mutex_unlock(&frames_mutex);
+	janus_recordplay_frame_packet *list = janus_recordplay_index_frames(recording, source);
+	if(list == NULL) {
+		janus_recording_close(recording);
+		return NULL;
+	}
+	frames = g_malloc0(sizeof(janus_recordplay_frames));
+	frames->path = g_strdup(source);
+	frames->mtime = recording->mtime;
+	frames->size = recording->size;
+	frames->list = list;
+	frames->count = recording->count;
+	frames->array = g_malloc(frames->count * sizeof(janus_recordplay_frame_packet *));
+	guint i = 0;
+	for(i=0; list != NULL && i<frames->count; i++) {
+		frames->array[i] = list;
+		list = list->next;
+	}
+	frames->count = i;
+	frames->memory = recording->count * (sizeof(janus_recordplay_frame_packet) + sizeof(janus_recordplay_frame_packet *));
+	janus_refcount_init(&frames->ref, janus_recordplay_frames_free);
+	janus_recording_close(recording);
+	/* Cache the index, if it fits, evicting the least recently used ones if needed */
+	janus_mutex_lock(&frames_mutex);
+	if(frames_cache != NULL && frames->memory <= frames_cache_max &&
+			g_hash_table_lookup(frames_cache, frames->path) == NULL) {
+		janus_refcount_increase(&frames->ref);
+		g_hash_table_insert(frames_cache, frames->path, frames);
+		g_queue_push_head(&frames_lru, frames);
+		frames->link = frames_lru.head;
+		frames_cache_memory += frames->memory;
+		while(frames_cache_memory > frames_cache_max && frames_lru.tail != NULL)
+			janus_recordplay_frames_evict((janus_recordplay_frames *)frames_lru.tail->data);
+	}
+	janus_mutex_unlock(&frames_mutex);
+	return frames;
+}
 
-	/* Pre-parse */
-	JANUS_LOG(LOG_VERB, "Pre-parsing file %s to generate ordered index...\n", source);
-	gboolean parsed_header = FALSE;
-	int bytes = 0;
-	long offset = 0;
-	uint16_t len = 0, count = 0;
+/* Generate the ordered list of frames out of the index of a recording */
+static janus_recordplay_frame_packet *janus_recordplay_index_frames(janus_recording *recording, const char *source) {
+	JANUS_LOG(LOG_VERB, "Sorting the frames of %s...\n", source);
+	gboolean data = (recording->type == JANUS_RECORDER_DATA);
+	uint16_t count = 0;
 	uint32_t first_ts = 0, last_ts = 0, reset = 0;	/* To handle whether there's a timestamp reset in the recording */
-	int video = 0, audio = 0, data = 0;
-	gint64 c_time = 0, w_time = 0;
-	char prebuffer[1500];
-	memset(prebuffer, 0, 1500);
+	janus_recording_frame *frame = NULL;
+	guint i = 0;
 	/* Let's look for timestamp resets first */
-	while(offset < fsize) {
-		/* Read frame header */
-		fseek(file, offset, SEEK_SET);
-		bytes = fread(prebuffer, sizeof(char), 8, file);
-		if(bytes != 8 || prebuffer[0] != 'M') {
-			JANUS_LOG(LOG_ERR, "Invalid header...\n");
-			fclose(file);
-			return NULL;
-		}
-		if(prebuffer[1] == 'E') {
-			/* Either the old .mjr format header ('MEETECHO' header followed by 'audio' or 'video'), or a frame */
-			offset += 8;
-			bytes = fread(&len, sizeof(uint16_t), 1, file);
-			len = ntohs(len);
-			offset += 2;
-			if(len == 5 && !parsed_header) {
-				/* This is the main header */
-				parsed_header = TRUE;
-				JANUS_LOG(LOG_VERB, "Old .mjr header format\n");
-				bytes = fread(prebuffer, sizeof(char), 5, file);
-				if(prebuffer[0] == 'v') {
-					JANUS_LOG(LOG_INFO, "This is an old video recording, assuming VP8\n");
-					video = 1;
-				} else if(prebuffer[0] == 'a') {
-					JANUS_LOG(LOG_INFO, "This is an old audio recording, assuming Opus\n");
-					audio = 1;
-				} else if(prebuffer[0] == 'd') {
-					JANUS_LOG(LOG_INFO, "This is an old data recording, assuming Text\n");
-					data = 1;
-				} else {
-					JANUS_LOG(LOG_WARN, "Unsupported recording media type...\n");
-					fclose(file);
-					return NULL;
-				}
-				offset += len;
-				continue;
-			} else if(!data && len < 12) {
-				/* Not RTP, skip */
-				JANUS_LOG(LOG_VERB, "Skipping packet (not RTP?)\n");
-				offset += len;
-				continue;
-			}
-		} else if(prebuffer[1] == 'J') {
-			/* New .mjr format, the header may contain useful info */
-			offset += 8;
-			bytes = fread(&len, sizeof(uint16_t), 1, file);
-			len = ntohs(len);
-			offset += 2;
-			if(len > 0 && !parsed_header) {
-				/* This is the info header */
-				JANUS_LOG(LOG_VERB, "New .mjr header format\n");
-				bytes = fread(prebuffer, sizeof(char), len, file);
-				if(bytes < 0) {
-					JANUS_LOG(LOG_ERR, "Error reading from file... %s\n", g_strerror(errno));
-					fclose(file);
-					return NULL;
-				}
-				parsed_header = TRUE;
-				prebuffer[len] = '\0';
-				json_error_t error;
-				json_t *info = json_loads(prebuffer, 0, &error);
-				if(!info) {
-					JANUS_LOG(LOG_ERR, "JSON error: on line %d: %s\n", error.line, error.text);
-					JANUS_LOG(LOG_WARN, "Error parsing info header...\n");
-					fclose(file);
-					return NULL;
-				}
-				/* Is it audio or video? */
-				json_t *type = json_object_get(info, "t");
-				if(!type || !json_is_string(type)) {
-					JANUS_LOG(LOG_WARN, "Missing/invalid recording type in info header...\n");
-					json_decref(info);
-					fclose(file);
-					return NULL;
-				}
-				const char *t = json_string_value(type);
-				if(!strcasecmp(t, "v")) {
-					video = 1;
-				} else if(!strcasecmp(t, "a")) {
-					audio = 1;
-				} else if(!strcasecmp(t, "d")) {
-					data = 1;
-				} else {
-					JANUS_LOG(LOG_WARN, "Unsupported recording type '%s' in info header...\n", t);
-					json_decref(info);
-					fclose(file);
-					return NULL;
-				}
-				/* What codec was used? */
-				json_t *codec = json_object_get(info, "c");
-				if(!codec || !json_is_string(codec)) {
-					JANUS_LOG(LOG_WARN, "Missing recording codec in info header...\n");
-					json_decref(info);
-					fclose(file);
-					return NULL;
-				}
-				const char *c = json_string_value(codec);
-				/* When was the file created? */
-				json_t *created = json_object_get(info, "s");
-				if(!created || !json_is_integer(created)) {
-					JANUS_LOG(LOG_WARN, "Missing recording created time in info header...\n");
-					json_decref(info);
-					fclose(file);
-					return NULL;
-				}
-				c_time = json_integer_value(created);
-				/* When was the first frame written? */
-				json_t *written = json_object_get(info, "u");
-				if(!written || !json_is_integer(written)) {
-					JANUS_LOG(LOG_WARN, "Missing recording written time in info header...\n");
-					json_decref(info);
-					fclose(file);
-					return NULL;
-				}
-				w_time = json_integer_value(created);
-				/* Summary */
-				JANUS_LOG(LOG_VERB, "This is %s recording:\n", video ? "a video" : (audio ? "an audio" : "a data"));
-				JANUS_LOG(LOG_VERB, "  -- Codec:   %s\n", c);
-				JANUS_LOG(LOG_VERB, "  -- Created: %"SCNi64"\n", c_time);
-				JANUS_LOG(LOG_VERB, "  -- Written: %"SCNi64"\n", w_time);
-				json_decref(info);
-			}
+	for(i=0; !data && i<recording->count; i++) {
+		frame = &recording->frames[i];
+		if(last_ts == 0) {
+			first_ts = frame->timestamp;
+			if(first_ts > 1000*1000)	/* Just used to check whether a packet is pre- or post-reset */
+				first_ts -= 1000*1000;
 		} else {
-			JANUS_LOG(LOG_ERR, "Invalid header...\n");
-			fclose(file);
-			return NULL;
-		}
-		/* Only read RTP header */
-		if(audio || video) {
-			bytes = fread(prebuffer, sizeof(char), 16, file);
-			janus_rtp_header *rtp = (janus_rtp_header *)prebuffer;
-			if(last_ts == 0) {
-				first_ts = ntohl(rtp->timestamp);
-				if(first_ts > 1000*1000)	/* Just used to check whether a packet is pre- or post-reset */
-					first_ts -= 1000*1000;
-			} else {
-				if(ntohl(rtp->timestamp) < last_ts) {
-					/* The new timestamp is smaller than the next one, is it a timestamp reset or simply out of order? */
-					if(last_ts-ntohl(rtp->timestamp) > 2*1000*1000*1000) {
-						reset = ntohl(rtp->timestamp);
-						JANUS_LOG(LOG_VERB, "Timestamp reset: %"SCNu32"\n", reset);
-					}
-				} else if(ntohl(rtp->timestamp) < reset) {
-					JANUS_LOG(LOG_VERB, "Updating timestamp reset: %"SCNu32" (was %"SCNu32")\n", ntohl(rtp->timestamp), reset);
-					reset = ntohl(rtp->timestamp);
+			if(frame->timestamp < last_ts) {
+				/* The new timestamp is smaller than the next one, is it a timestamp reset or simply out of order? */
+				if(last_ts-frame->timestamp > 2*1000*1000*1000) {
+					reset = frame->timestamp;
+					JANUS_LOG(LOG_VERB, "Timestamp reset: %"SCNu32"\n", reset);
 				}
+			} else if(frame->timestamp < reset) {
+				JANUS_LOG(LOG_VERB, "Updating timestamp reset: %"SCNu32" (was %"SCNu32")\n", frame->timestamp, reset);
+				reset = frame->timestamp;
 			}
-			last_ts = ntohl(rtp->timestamp);
 		}
-		/* Skip data for now */
-		offset += len;
+		last_ts = frame->timestamp;
 	}
-	/* Now let's parse the frames and order them */
-	offset = 0;
+	/* Now let's go through the frames and order them */
 	janus_recordplay_frame_packet *list = NULL, *last = NULL;
-	while(offset < fsize) {
-		/* Read frame header */
-		fseek(file, offset, SEEK_SET);
-		bytes = fread(prebuffer, sizeof(char), 8, file);
-		prebuffer[8] = '\0';
-		JANUS_LOG(LOG_HUGE, "Header: %s\n", prebuffer);
-		offset += 8;
-		bytes = fread(&len, sizeof(uint16_t), 1, file);
-		len = ntohs(len);
-		JANUS_LOG(LOG_HUGE, "  -- Length: %"SCNu16"\n", len);
-		offset += 2;
-		if(prebuffer[1] == 'J' || (!data && len < 12)) {
-			/* Not RTP, skip */
-			JANUS_LOG(LOG_HUGE, "  -- Not RTP, skipping\n");
-			offset += len;
-			continue;
-		}
-
+	for(i=0; i<recording->count; i++) {
+		frame = &recording->frames[i];
 		if(data) {
 			/* Things are simpler for data, no reordering is needed: start by the data time */
 			gint64 when = 0;
-			bytes = fread(&when, 1, sizeof(gint64), file);
-			if(bytes < (int)sizeof(gint64)) {
-				JANUS_LOG(LOG_WARN, "Missing data timestamp header");
-				break;
-			}
+			memcpy(&when, recording->data + frame->offset, sizeof(gint64));
 			when = ntohll((uint64_t)when);
-			offset += sizeof(gint64);
-			len -= sizeof(gint64);
 			/* Generate frame packet and insert in the ordered list */
 			janus_recordplay_frame_packet *p = g_malloc(sizeof(janus_recordplay_frame_packet));
 			p->seq = 0;
 			/* We "abuse" the timestamp field for the timing info */
-			p->ts = when-c_time;
-			p->len = len;
-			p->offset = offset;
+			p->ts = when-recording->created;
+			p->len = frame->length - sizeof(gint64);
+			p->offset = frame->offset + sizeof(gint64);
+			p->keyframe = FALSE;
 			p->next = NULL;
 			p->prev = last;
 			if(list == NULL) {
@@ -2684,39 +2894,30 @@ janus_recordplay_frame_packet *janus_recordplay_get_frames(const char *dir, cons
 				last->next = p;
 			}
 			last = p;
-			/* Done */
-			offset += len;
 			continue;
 		}
-		/* Only read RTP header */
-		bytes = fread(prebuffer, sizeof(char), 16, file);
-		if(bytes < 0) {
-			JANUS_LOG(LOG_WARN, "Error reading RTP header, stopping here...\n");
-			break;
-		}
-		janus_rtp_header *rtp = (janus_rtp_header *)prebuffer;
-		JANUS_LOG(LOG_HUGE, "  -- RTP packet (ssrc=%"SCNu32", pt=%"SCNu16", ext=%"SCNu16", seq=%"SCNu16", ts=%"SCNu32")\n",
-				ntohl(rtp->ssrc), rtp->type, rtp->extension, ntohs(rtp->seq_number), ntohl(rtp->timestamp));
+		JANUS_LOG(LOG_HUGE, "  -- RTP packet (seq=%"SCNu16", ts=%"SCNu32")\n", frame->seq, frame->timestamp);
 		/* Generate frame packet and insert in the ordered list */
 		janus_recordplay_frame_packet *p = g_malloc(sizeof(janus_recordplay_frame_packet));
-		p->seq = ntohs(rtp->seq_number);
+		p->seq = frame->seq;
 		if(reset == 0) {
 			/* Simple enough... */
-			p->ts = ntohl(rtp->timestamp);
+			p->ts = frame->timestamp;
 		} else {
 			/* Is this packet pre- or post-reset? */
-			if(ntohl(rtp->timestamp) > first_ts) {
+			if(frame->timestamp > first_ts) {
 				/* Pre-reset... */
-				p->ts = ntohl(rtp->timestamp);
+				p->ts = frame->timestamp;
 			} else {
 				/* Post-reset... */
 				uint64_t max32 = UINT32_MAX;
 				max32++;
-				p->ts = max32+ntohl(rtp->timestamp);
+				p->ts = max32+frame->timestamp;
 			}
 		}
-		p->len = len;
-		p->offset = offset;
+		p->len = frame->length;
+		p->offset = frame->offset;
+		p->keyframe = frame->keyframe;
 		p->next = NULL;
 		p->prev = NULL;
 		if(list == NULL) {
@@ -2784,8 +2985,6 @@ janus_recordplay_frame_packet *janus_recordplay_get_frames(const char *dir, cons
 				list = p;
 			}
 		}
-		/* Skip data for now */
-		offset += len;
 		count++;
 	}
 
@@ -2800,421 +2999,438 @@ janus_recordplay_frame_packet *janus_recordplay_get_frames(const char *dir, cons
 	JANUS_LOG(LOG_VERB, "Counted %"SCNu16" frame packets\n", count);
 
 	/* Done! */
-	fclose(file);
 	return list;
 }
 
-static void *janus_recordplay_playout_thread(void *sessiondata) {
-	janus_recordplay_session *session = (janus_recordplay_session *)sessiondata;
-	if(!session) {
-		JANUS_LOG(LOG_ERR, "Invalid session, can't start playout thread...\n");
-		g_thread_unref(g_thread_self());
-		return NULL;
-	}
-	if(!session->recording) {
-		janus_refcount_decrease(&session->ref);
-		JANUS_LOG(LOG_ERR, "No recording object, can't start playout thread...\n");
-		g_thread_unref(g_thread_self());
+/* Copy a frame from a (memory mapped) recording to the buffer we'll send it from */
+static int janus_recordplay_read_frame(janus_recording *recording, janus_recordplay_frame_packet *frame, char *buffer, int size) {
+	if(recording == NULL || frame == NULL || frame->offset < 0 || (size_t)frame->offset >= recording->size)
+		return 0;
+	size_t len = frame->len;
+	if(len > (size_t)size)
+		len = size;
+	if((size_t)frame->offset + len > recording->size)
+		len = recording->size - frame->offset;
+	memcpy(buffer, recording->data + frame->offset, len);
+	return len;
+}
+
+/* Helpers to open the recording files of an index */
+static janus_recording *janus_recordplay_playout_open(janus_recordplay_frames *frames, const char *media) {
+	if(frames == NULL)
 		return NULL;
-	}
-	janus_refcount_increase(&session->recording->ref);
+	janus_recording *file = janus_recording_open(frames->path);
+	if(file == NULL)
+		JANUS_LOG(LOG_ERR, "Could not open %s file %s, can't start playout...\n", media, frames->path);
+	return file;
+}
+
+static void janus_recordplay_playout_free(janus_recordplay_playout *playout) {
+	if(playout->afile)
+		janus_recording_close(playout->afile);
+	if(playout->vfile)
+		janus_recording_close(playout->vfile);
+	if(playout->dfile)
+		janus_recording_close(playout->dfile);
+	janus_recordplay_frames_unref(playout->aframes);
+	janus_recordplay_frames_unref(playout->vframes);
+	janus_recordplay_frames_unref(playout->dframes);
+	janus_refcount_decrease(&playout->recording->ref);
+	janus_refcount_decrease(&playout->session->ref);
+	g_free(playout);
+}
+
+/* Insert a playout in the queue of its thread, according to its deadline (called with the mutex locked) */
+static gint janus_recordplay_playout_compare(gconstpointer a, gconstpointer b, gpointer user_data) {
+	const janus_recordplay_playout *pa = (const janus_recordplay_playout *)a;
+	const janus_recordplay_playout *pb = (const janus_recordplay_playout *)b;
+	return (pa->deadline < pb->deadline) ? -1 : ((pa->deadline > pb->deadline) ? 1 : 0);
+}
+
+static int janus_recordplay_playout_start(janus_recordplay_session *session) {
 	janus_recordplay_recording *rec = session->recording;
+	if(rec == NULL) {
+		JANUS_LOG(LOG_ERR, "No recording object, can't start playout...\n");
+		return -1;
+	}
 	if(session->recorder) {
-		janus_refcount_decrease(&rec->ref);
-		janus_refcount_decrease(&session->ref);
-		JANUS_LOG(LOG_ERR, "This is a recorder, can't start playout thread...\n");
-		g_thread_unref(g_thread_self());
-		return NULL;
+		JANUS_LOG(LOG_ERR, "This is a recorder, can't start playout...\n");
+		return -1;
 	}
 	if(!session->aframes && !session->vframes) {
-		janus_refcount_decrease(&rec->ref);
-		janus_refcount_decrease(&session->ref);
-		JANUS_LOG(LOG_ERR, "No audio and no video frames, can't start playout thread...\n");
-		g_thread_unref(g_thread_self());
-		return NULL;
+		JANUS_LOG(LOG_ERR, "No audio and no video frames, can't start playout...\n");
+		return -1;
+	}
+	/* Pick the playout thread with the fewest playouts */
+	janus_recordplay_player *player = NULL;
+	int i = 0;
+	for(i=0; players != NULL && i<playout_threads; i++) {
+		if(players[i].thread == NULL)
+			continue;
+		if(player == NULL || g_atomic_int_get(&players[i].count) < g_atomic_int_get(&player->count))
+			player = &players[i];
+	}
+	if(player == NULL) {
+		JANUS_LOG(LOG_ERR, "No playout thread available, can't start playout...\n");
+		return -1;
 	}
-	JANUS_LOG(LOG_VERB, "Joining playout thread\n");
 	/* Open the files */
-	FILE *afile = NULL, *vfile = NULL, *dfile = NULL;
+	janus_recordplay_playout *playout = g_malloc0(sizeof(janus_recordplay_playout));
+	janus_refcount_increase(&session->ref);
+	playout->session = session;
+	janus_refcount_increase(&rec->ref);
+	playout->recording = rec;
 	if(session->aframes) {
-		if(rec->arc_file == NULL) {
-			janus_refcount_decrease(&rec->ref);
-			janus_refcount_decrease(&session->ref);
-			JANUS_LOG(LOG_ERR, "The recording session contains some audio packets but seems to lack a recording file name\n");
-			g_thread_unref(g_thread_self());
-			return NULL;
-		}
-		char source[1024];
-		if(strstr(rec->arc_file, ".mjr"))
-			g_snprintf(source, 1024, "%s/%s", recordings_path, rec->arc_file);
-		else
-			g_snprintf(source, 1024, "%s/%s.mjr", recordings_path, rec->arc_file);
-		afile = fopen(source, "rb");
-		if(afile == NULL) {
-			janus_refcount_decrease(&rec->ref);
-			janus_refcount_decrease(&session->ref);
-			JANUS_LOG(LOG_ERR, "Could not open audio file %s, can't start playout thread...\n", source);
-			g_thread_unref(g_thread_self());
-			return NULL;
-		}
+		janus_refcount_increase(&session->aframes->ref);
+		playout->aframes = session->aframes;
+		playout->afile = janus_recordplay_playout_open(playout->aframes, "audio");
 	}
 	if(session->vframes) {
-		if(rec->vrc_file == NULL) {
-			janus_refcount_decrease(&rec->ref);
-			janus_refcount_decrease(&session->ref);
-			JANUS_LOG(LOG_ERR, "The recording session contains some video packets but seems to lack a recording file name\n");
-			if(afile)
-				fclose(afile);
-			afile = NULL;
-			g_thread_unref(g_thread_self());
-			return NULL;
-		}
-		char source[1024];
-		if(strstr(rec->vrc_file, ".mjr"))
-			g_snprintf(source, 1024, "%s/%s", recordings_path, rec->vrc_file);
-		else
-			g_snprintf(source, 1024, "%s/%s.mjr", recordings_path, rec->vrc_file);
-		vfile = fopen(source, "rb");
-		if(vfile == NULL) {
-			janus_refcount_decrease(&rec->ref);
-			janus_refcount_decrease(&session->ref);
-			JANUS_LOG(LOG_ERR, "Could not open video file %s, can't start playout thread...\n", source);
-			if(afile)
-				fclose(afile);
-			afile = NULL;
-			g_thread_unref(g_thread_self());
-			return NULL;
-		}
+		janus_refcount_increase(&session->vframes->ref);
+		playout->vframes = session->vframes;
+		playout->vfile = janus_recordplay_playout_open(playout->vframes, "video");
 	}
-
 	if(session->dframes) {
-		if(rec->drc_file == NULL) {
-			janus_refcount_decrease(&rec->ref);
-			janus_refcount_decrease(&session->ref);
-			JANUS_LOG(LOG_ERR, "The recording session contains some data packets but seems to lack a recording file name\n");
-			if(afile)
-				fclose(afile);
-			afile = NULL;
-			if(vfile)
-				fclose(vfile);
-			vfile = NULL;
-			g_thread_unref(g_thread_self());
-			return NULL;
-		}
-		char source[1024];
-		if(strstr(rec->drc_file, ".mjr"))
-			g_snprintf(source, 1024, "%s/%s", recordings_path, rec->drc_file);
-		else
-			g_snprintf(source, 1024, "%s/%s.mjr", recordings_path, rec->drc_file);
-		dfile = fopen(source, "rb");
-		if(dfile == NULL) {
-			janus_refcount_decrease(&rec->ref);
-			janus_refcount_decrease(&session->ref);
-			JANUS_LOG(LOG_ERR, "Could not open data file %s, can't start playout thread...\n", source);
-			if(afile)
-				fclose(afile);
-			afile = NULL;
-			if(vfile)
-				fclose(vfile);
-			vfile = NULL;
-			g_thread_unref(g_thread_self());
-			return NULL;
-		}
+		janus_refcount_increase(&session->dframes->ref);
+		playout->dframes = session->dframes;
+		playout->dfile = janus_recordplay_playout_open(playout->dframes, "data");
 	}
-	/* Timer */
-	gboolean asent = FALSE, vsent = FALSE, dsent = FALSE;
-	struct timeval now, abefore, vbefore, dbefore;
-	time_t d_s, d_us;
-	gettimeofday(&now, NULL);
-	gettimeofday(&abefore, NULL);
-	gettimeofday(&vbefore, NULL);
-	gettimeofday(&dbefore, NULL);
-
-	janus_recordplay_frame_packet *audio = session->aframes, *video = session->vframes, *data = session->dframes;
-	char *buffer = g_malloc0(1500);
-	int bytes = 0;
-	int64_t ts_diff = 0, passed = 0;
+	if((playout->aframes && !playout->afile) || (playout->vframes && !playout->vfile) ||
+			(playout->dframes && !playout->dfile)) {
+		janus_recordplay_playout_free(playout);
+		return -1;
+	}
+	playout->audio = playout->aframes ? playout->aframes->list : NULL;
+	playout->video = playout->vframes ? playout->vframes->list : NULL;
+	playout->data = playout->dframes ? playout->dframes->list : NULL;
+	playout->audio_pt = rec->audio_pt;
+	playout->video_pt = rec->video_pt;
+	playout->akhz = 48;
+	if(playout->audio_pt == 0 || playout->audio_pt == 8 || playout->audio_pt == 9)
+		playout->akhz = 8;
+	playout->vkhz = 90;
+	/* The first frames are sent right away */
+	playout->started = janus_get_monotonic_time();
+	playout->position = 0;
+	playout->speed = 1;
+	playout->deadline = playout->started;
+	JANUS_LOG(LOG_VERB, "Playout of recording %"SCNu64" will be served by playout thread #%d\n", rec->id, player->id);
+	janus_mutex_lock(&player->mutex);
+	g_atomic_int_inc(&player->count);
+	g_queue_insert_sorted(player->playouts, playout, janus_recordplay_playout_compare, NULL);
+	g_cond_signal(&player->cond);
+	janus_mutex_unlock(&player->mutex);
+	return 0;
+}
 
-	int audio_pt = session->recording->audio_pt;
-	int video_pt = session->recording->video_pt;
+/* Playout is over: release the resources, and tear the PeerConnection down */
+static void janus_recordplay_playout_done(janus_recordplay_player *player, janus_recordplay_playout *playout) {
+	janus_recordplay_session *session = playout->session;
+	janus_recordplay_recording *rec = playout->recording;
+	JANUS_LOG(LOG_VERB, "Playout of recording %"SCNu64" is over\n", rec->id);
+	g_atomic_int_add(&player->count, -1);
+	/* Get rid of the indexes */
+	janus_recordplay_frames_unref(session->aframes);
+	session->aframes = NULL;
+	janus_recordplay_frames_unref(session->vframes);
+	session->vframes = NULL;
+	janus_recordplay_frames_unref(session->dframes);
+	session->dframes = NULL;
+	/* Remove from the list of viewers */
+	janus_mutex_lock(&rec->mutex);
+	rec->viewers = g_list_remove(rec->viewers, session);
+	janus_mutex_unlock(&rec->mutex);
+	/* Tell the core to tear down the PeerConnection, hangup_media will do the rest */
+	if(!g_atomic_int_get(&stopping))
+		gateway->close_pc(session->handle);
+	janus_recordplay_playout_free(playout);
+}
 
-	int akhz = 48;
-	if(audio_pt == 0 || audio_pt == 8 || audio_pt == 9)
-		akhz = 8;
-	int vkhz = 90;
+/* Rewrite the sequence number and timestamp of a packet we're about to send */
+static void janus_recordplay_rewrite_packet(janus_recordplay_rewrite *rw, janus_rtp_header *rtp,
+		janus_recordplay_frame_packet *frame, int khz, int speed, gint64 now) {
+	if(!rw->started) {
+		/* Keep the recorded sequence numbers and timestamps, until there's a jump */
+		rw->ts_in = frame->ts;
+		rw->ts_out = (uint32_t)frame->ts;
+		rw->seq_offset = 0;
+		rw->started = TRUE;
+		rw->jump = FALSE;
+	} else if(rw->jump) {
+		/* Continue from where we left, taking into account the time that passed */
+		gint64 gap = ((now - rw->last_sent)*khz)/1000;
+		rw->ts_in = frame->ts;
+		rw->ts_out = rw->last_ts + (uint32_t)MAX(gap, 1);
+		rw->seq_offset = rw->last_seq + 1 - frame->seq;
+		rw->jump = FALSE;
+	}
+	rw->last_ts = rw->ts_out + (uint32_t)((frame->ts - rw->ts_in)/speed);
+	rw->last_seq = frame->seq + rw->seq_offset;
+	rw->last_sent = now;
+	rtp->timestamp = htonl(rw->last_ts);
+	rtp->seq_number = htons(rw->last_seq);
+}
 
-	while(!g_atomic_int_get(&session->destroyed) && session->active
-			&& !g_atomic_int_get(&rec->destroyed) && (audio || video)) {
-		if(!asent && !vsent && !dsent) {
-			/* We skipped the last round, so sleep a bit (5ms) */
-			g_usleep(5000);
-		}
-		asent = FALSE;
-		vsent = FALSE;
-		dsent = FALSE;
-		if(audio) {
-			if(audio == session->aframes) {
-				/* First packet, send now */
-				fseek(afile, audio->offset, SEEK_SET);
-				bytes = fread(buffer, sizeof(char), audio->len, afile);
-				if(bytes != audio->len)
-					JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, audio->len);
-				/* Update payload type */
-				janus_rtp_header *rtp = (janus_rtp_header *)buffer;
-				if(rec->opusred_pt == 0 || rtp->type != rec->opusred_pt)
-					rtp->type = audio_pt;
-				/* If the recording contains RED but the user doesn't support it, only use the primary data */
-				if(rec->opusred_pt > 0 && rtp->type == rec->opusred_pt && !session->opusred) {
-					int plen = 0;
-					char *payload = janus_rtp_payload(buffer, bytes, &plen);
-					if(payload && plen > 0) {
-						GList *blocks = janus_red_parse_blocks(payload, plen);
-						if(blocks != NULL) {
-							/* Copy the last block (primary data) to the RTP payload */
-							GList *last = g_list_last(blocks);
-							janus_red_block *rb = (janus_red_block *)(last ? last->data : NULL);
-							if(rb && rb->data && rb->length > 0) {
-								rtp->type = audio_pt;
-								bytes -= (plen - rb->length);
-								memmove(payload, rb->data, rb->length);
-							}
-							g_list_free_full(blocks, (GDestroyNotify)g_free);
-						}
-					}
-				}
-				janus_plugin_rtp prtp = { .mindex = -1, .video = FALSE, .buffer = (char *)buffer, .length = bytes };
-				janus_plugin_rtp_extensions_reset(&prtp.extensions);
-				gateway->relay_rtp(session->handle, &prtp);
-				gettimeofday(&now, NULL);
-				abefore.tv_sec = now.tv_sec;
-				abefore.tv_usec = now.tv_usec;
-				asent = TRUE;
-				audio = audio->next;
-			} else {
-				/* What's the timestamp skip from the previous packet? */
-				ts_diff = audio->ts - audio->prev->ts;
-				ts_diff = (ts_diff*1000)/akhz;
-				/* Check if it's time to send */
-				gettimeofday(&now, NULL);
-				d_s = now.tv_sec - abefore.tv_sec;
-				d_us = now.tv_usec - abefore.tv_usec;
-				if(d_us < 0) {
-					d_us += 1000000;
-					--d_s;
-				}
-				passed = d_s*1000000 + d_us;
-				if(passed < (ts_diff-5000)) {
-					asent = FALSE;
-				} else {
-					/* Update the reference time */
-					abefore.tv_usec += ts_diff%1000000;
-					if(abefore.tv_usec > 1000000) {
-						abefore.tv_sec++;
-						abefore.tv_usec -= 1000000;
-					}
-					if(ts_diff/1000000 > 0) {
-						abefore.tv_sec += ts_diff/1000000;
-						abefore.tv_usec -= ts_diff/1000000;
-					}
-					/* Send now */
-					fseek(afile, audio->offset, SEEK_SET);
-					bytes = fread(buffer, sizeof(char), audio->len, afile);
-					if(bytes != audio->len)
-						JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, audio->len);
-					/* Update payload type */
-					janus_rtp_header *rtp = (janus_rtp_header *)buffer;
-					if(rec->opusred_pt == 0 || rtp->type != rec->opusred_pt)
-						rtp->type = audio_pt;
-					/* If the recording contains RED but the user doesn't support it, only use the primary data */
-					if(rec->opusred_pt > 0 && rtp->type == rec->opusred_pt && !session->opusred) {
-						int plen = 0;
-						char *payload = janus_rtp_payload(buffer, bytes, &plen);
-						if(payload && plen > 0) {
-							GList *blocks = janus_red_parse_blocks(payload, plen);
-							if(blocks != NULL) {
-								/* Copy the last block (primary data) to the RTP payload */
-								GList *last = g_list_last(blocks);
-								janus_red_block *rb = (janus_red_block *)(last ? last->data : NULL);
-								if(rb && rb->data && rb->length > 0) {
-									rtp->type = audio_pt;
-									bytes -= (plen - rb->length);
-									memmove(payload, rb->data, rb->length);
-								}
-								g_list_free_full(blocks, (GDestroyNotify)g_free);
-							}
-						}
-					}
-					janus_plugin_rtp prtp = { .mindex = -1, .video = FALSE, .buffer = (char *)buffer, .length = bytes };
-					janus_plugin_rtp_extensions_reset(&prtp.extensions);
-					gateway->relay_rtp(session->handle, &prtp);
-					asent = TRUE;
-					audio = audio->next;
-				}
-			}
-		}
-		if(video) {
-			if(video == session->vframes) {
-				/* First packets: there may be many of them with the same timestamp, send them all */
-				uint64_t ts = video->ts;
-				while(video && video->ts == ts) {
-					fseek(vfile, video->offset, SEEK_SET);
-					bytes = fread(buffer, sizeof(char), video->len, vfile);
-					if(bytes != video->len)
-						JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, video->len);
-					/* Update payload type */
-					janus_rtp_header *rtp = (janus_rtp_header *)buffer;
-					rtp->type = video_pt;
-					janus_plugin_rtp prtp = { .mindex = -1, .video = TRUE, .buffer = (char *)buffer, .length = bytes };
-					janus_plugin_rtp_extensions_reset(&prtp.extensions);
-					gateway->relay_rtp(session->handle, &prtp);
-					video = video->next;
-				}
-				vsent = TRUE;
-				gettimeofday(&now, NULL);
-				vbefore.tv_sec = now.tv_sec;
-				vbefore.tv_usec = now.tv_usec;
-			} else {
-				/* What's the timestamp skip from the previous packet? */
-				ts_diff = video->ts - video->prev->ts;
-				ts_diff = (ts_diff*1000)/vkhz;
-				/* Check if it's time to send */
-				gettimeofday(&now, NULL);
-				d_s = now.tv_sec - vbefore.tv_sec;
-				d_us = now.tv_usec - vbefore.tv_usec;
-				if(d_us < 0) {
-					d_us += 1000000;
-					--d_s;
-				}
-				passed = d_s*1000000 + d_us;
-				if(passed < (ts_diff-5000)) {
-					vsent = FALSE;
-				} else {
-					/* Update the reference time */
-					vbefore.tv_usec += ts_diff%1000000;
-					if(vbefore.tv_usec > 1000000) {
-						vbefore.tv_sec++;
-						vbefore.tv_usec -= 1000000;
-					}
-					if(ts_diff/1000000 > 0) {
-						vbefore.tv_sec += ts_diff/1000000;
-						vbefore.tv_usec -= ts_diff/1000000;
-					}
-					/* There may be multiple packets with the same timestamp, send them all */
-					uint64_t ts = video->ts;
-					while(video && video->ts == ts) {
-						/* Send now */
-						fseek(vfile, video->offset, SEEK_SET);
-						bytes = fread(buffer, sizeof(char), video->len, vfile);
-						if(bytes != video->len)
-							JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, video->len);
-						/* Update payload type */
-						janus_rtp_header *rtp = (janus_rtp_header *)buffer;
-						rtp->type = video_pt;
-						janus_plugin_rtp prtp = { .mindex = -1, .video = TRUE, .buffer = (char *)buffer, .length = bytes };
-						janus_plugin_rtp_extensions_reset(&prtp.extensions);
-						gateway->relay_rtp(session->handle, &prtp);
-						video = video->next;
-					}
-					vsent = TRUE;
+/* Helpers to send a frame of a playout */
+static void janus_recordplay_playout_send_audio(janus_recordplay_playout *playout, janus_recordplay_frame_packet *frame, gint64 now) {
+	janus_recordplay_session *session = playout->session;
+	janus_recordplay_recording *rec = playout->recording;
+	char *buffer = playout->buffer;
+	int bytes = janus_recordplay_read_frame(playout->afile, frame, buffer, sizeof(playout->buffer));
+	if(bytes != frame->len)
+		JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, frame->len);
+	/* Update payload type */
+	janus_rtp_header *rtp = (janus_rtp_header *)buffer;
+	if(rec->opusred_pt == 0 || rtp->type != rec->opusred_pt)
+		rtp->type = playout->audio_pt;
+	/* If the recording contains RED but the user doesn't support it, only use the primary data */
+	if(rec->opusred_pt > 0 && rtp->type == rec->opusred_pt && !session->opusred) {
+		int plen = 0;
+		char *payload = janus_rtp_payload(buffer, bytes, &plen);
+		if(payload && plen > 0) {
+			GList *blocks = janus_red_parse_blocks(payload, plen);
+			if(blocks != NULL) {
+				/* Copy the last block (primary data) to the RTP payload */
+				GList *last = g_list_last(blocks);
+				janus_red_block *rb = (janus_red_block *)(last ? last->data : NULL);
+				if(rb && rb->data && rb->length > 0) {
+					rtp->type = playout->audio_pt;
+					bytes -= (plen - rb->length);
+					memmove(payload, rb->data, rb->length);
 				}
-			}
-		}
-		if(data) {
-			u_int64_t prev_ts = 0; /* All timestamps for data are indexed to 0, since when parsing ts = when - c_time */
-			if(data->prev)
-				prev_ts = data->prev->ts;
-			ts_diff = data->ts - prev_ts;
-
-			/* Check if it's time to send */
-			gettimeofday(&now, NULL);
-			d_s = now.tv_sec - dbefore.tv_sec;
-			d_us = now.tv_usec - dbefore.tv_usec;
-			if(d_us < 0) {
-				d_us += 1000000;
-				--d_s;
-			}
-			passed = d_s*1000000 + d_us;
-			if(passed < (ts_diff-5000)) {
-				dsent = FALSE;
-			} else {
-				/* Update the reference time */
-				dbefore.tv_usec += ts_diff%1000000;
-				if(dbefore.tv_usec > 1000000) {
-					dbefore.tv_sec++;
-					dbefore.tv_usec -= 1000000;
-				}
-				if(ts_diff/1000000 > 0) {
-					dbefore.tv_sec += ts_diff/1000000;
-					dbefore.tv_usec -= ts_diff/1000000;
-				}
-				/* Read data packet */
-				fseek(dfile, data->offset, SEEK_SET);
-				bytes = fread(buffer, sizeof(char), data->len, dfile);
-				if(bytes != data->len)
-					JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, data->len);
-				/* Update payload type */
-				janus_plugin_data datapacket = {
-					.label = NULL,
-					.protocol = NULL,
-					.binary = rec->textdata ? FALSE : TRUE,
-					.buffer = (char *)buffer,
-					.length = bytes
-				};
-				gateway->relay_data(session->handle, &datapacket);
-				dsent = TRUE;
-				data = data->next;
+				g_list_free_full(blocks, (GDestroyNotify)g_free);
 			}
 		}
 	}
+	janus_recordplay_rewrite_packet(&playout->arewrite, rtp, frame, playout->akhz, 1, now);
+	janus_plugin_rtp prtp = { .mindex = -1, .video = FALSE, .buffer = buffer, .length = bytes };
+	janus_plugin_rtp_extensions_reset(&prtp.extensions);
+	gateway->relay_rtp(session->handle, &prtp);
+}
 
-	g_free(buffer);
+static void janus_recordplay_playout_send_video(janus_recordplay_playout *playout, janus_recordplay_frame_packet *frame, gint64 now) {
+	char *buffer = playout->buffer;
+	int bytes = janus_recordplay_read_frame(playout->vfile, frame, buffer, sizeof(playout->buffer));
+	if(bytes != frame->len)
+		JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, frame->len);
+	/* Update payload type */
+	janus_rtp_header *rtp = (janus_rtp_header *)buffer;
+	rtp->type = playout->video_pt;
+	janus_recordplay_rewrite_packet(&playout->vrewrite, rtp, frame, playout->vkhz, playout->speed, now);
+	janus_plugin_rtp prtp = { .mindex = -1, .video = TRUE, .buffer = buffer, .length = bytes };
+	janus_plugin_rtp_extensions_reset(&prtp.extensions);
+	gateway->relay_rtp(playout->session->handle, &prtp);
+}
 
-	/* Get rid of the indexes */
-	janus_recordplay_frame_packet *tmp = NULL;
-	audio = session->aframes;
-	while(audio) {
-		tmp = audio->next;
-		g_free(audio);
-		audio = tmp;
-	}
-	session->aframes = NULL;
-	video = session->vframes;
-	while(video) {
-		tmp = video->next;
-		g_free(video);
-		video = tmp;
-	}
-	session->vframes = NULL;
-	data = session->dframes;
-	while(data) {
-		tmp = data->next;
-		g_free(data);
-		data = tmp;
-	}
-	session->dframes = NULL;
+static void janus_recordplay_playout_send_data(janus_recordplay_playout *playout, janus_recordplay_frame_packet *frame) {
+	char *buffer = playout->buffer;
+	int bytes = janus_recordplay_read_frame(playout->dfile, frame, buffer, sizeof(playout->buffer));
+	if(bytes != frame->len)
+		JANUS_LOG(LOG_WARN, "Didn't manage to read all the bytes we needed (%d < %d)...\n", bytes, frame->len);
+	janus_plugin_data datapacket = {
+		.label = NULL,
+		.protocol = NULL,
+		.binary = playout->recording->textdata ? FALSE : TRUE,
+		.buffer = buffer,
+		.length = bytes
+	};
+	gateway->relay_data(playout->session->handle, &datapacket);
+}
 
-	if(afile)
-		fclose(afile);
-	afile = NULL;
-	if(vfile)
-		fclose(vfile);
-	vfile = NULL;
-	if(dfile)
-		fclose(dfile);
-	dfile = NULL;
+/* Position of a frame in a recording, in microseconds: audio and video
+ * frames are positioned by their RTP timestamp distance from the first
+ * frame, while data frames ("abusing" the timestamp field) by their time
+ * since the recording started (khz is 0 for them) */
+static gint64 janus_recordplay_frame_position(janus_recordplay_frames *frames, janus_recordplay_frame_packet *frame, int khz) {
+	if(khz == 0)
+		return (gint64)frame->ts;
+	return (gint64)(frame->ts - frames->list->ts)*1000/khz;
+}
 
-	/* Remove from the list of viewers */
-	janus_mutex_lock(&rec->mutex);
-	rec->viewers = g_list_remove(rec->viewers, session);
-	janus_mutex_unlock(&rec->mutex);
+/* Find the first frame at or after a position, or NULL if there's none */
+static janus_recordplay_frame_packet *janus_recordplay_frames_find(janus_recordplay_frames *frames, int khz, gint64 position) {
+	if(frames == NULL || frames->count == 0)
+		return NULL;
+	guint lo = 0, hi = frames->count;
+	while(lo < hi) {
+		guint mid = lo + (hi-lo)/2;
+		if(janus_recordplay_frame_position(frames, frames->array[mid], khz) < position)
+			lo = mid+1;
+		else
+			hi = mid;
+	}
+	return lo < frames->count ? frames->array[lo] : NULL;
+}
 
-	/* Tell the core to tear down the PeerConnection, hangup_media will do the rest */
-	gateway->close_pc(session->handle);
+/* Move a playout to a different position: if there's video, we move
+ * back to the closest keyframe (as that's the only place a decoder can
+ * resume from), and then align audio and data to that keyframe */
+static gint64 janus_recordplay_playout_seek(janus_recordplay_playout *playout, gint64 position, gint64 now) {
+	if(playout->vframes) {
+		janus_recordplay_frame_packet *video = janus_recordplay_frames_find(playout->vframes, playout->vkhz, position);
+		janus_recordplay_frame_packet *keyframe = video;
+		while(keyframe && !keyframe->keyframe)
+			keyframe = keyframe->prev;
+		if(keyframe) {
+			/* Start from the first packet of the keyframe */
+			while(keyframe->prev && keyframe->prev->ts == keyframe->ts)
+				keyframe = keyframe->prev;
+			video = keyframe;
+		}
+		playout->video = video;
+		if(video)
+			position = janus_recordplay_frame_position(playout->vframes, video, playout->vkhz);
+	}
+	if(playout->aframes)
+		playout->audio = janus_recordplay_frames_find(playout->aframes, playout->akhz, position);
+	if(playout->dframes)
+		playout->data = janus_recordplay_frames_find(playout->dframes, 0, position);
+	/* Start a new segment from there */
+	playout->started = now;
+	playout->position = position;
+	playout->arewrite.jump = TRUE;
+	playout->vrewrite.jump = TRUE;
+	return position;
+}
 
-	janus_refcount_decrease(&rec->ref);
-	janus_refcount_decrease(&session->ref);
+/* Send all the frames of a playout that are due, and compute when the next
+ * one will be: returns FALSE if the playout is over. Frames are due at their
+ * position in the recording, relative to when the current segment started */
+static gboolean janus_recordplay_playout_send(janus_recordplay_player *player, janus_recordplay_playout *playout, gint64 now) {
+	janus_recordplay_session *session = playout->session;
+	if(g_atomic_int_get(&session->destroyed) || !session->active ||
+			g_atomic_int_get(&playout->recording->destroyed))
+		return FALSE;
+	if(now - playout->deadline >= 20000) {
+		g_atomic_int_inc(&player->missed);
+		if(now - playout->deadline >= 500000) {
+			/* We're way too late, don't try to catch up: shift the whole playout instead */
+			playout->started += (now - playout->deadline);
+		}
+	}
+	/* Check if the viewer asked for a different speed, range or position */
+	gint64 current = playout->position + (now - playout->started)*playout->speed;
+	int speed = g_atomic_int_get(&session->speed);
+	if(speed != playout->speed && speed >= 1 && speed <= JANUS_RECORDPLAY_MAX_SPEED) {
+		JANUS_LOG(LOG_VERB, "Changing speed of the playout of recording %"SCNu64": %dx --> %dx\n",
+			playout->recording->id, playout->speed, speed);
+		playout->started = now;
+		playout->position = current;
+		playout->speed = speed;
+		playout->vrewrite.jump = TRUE;
+	}
+	int end = g_atomic_int_get(&session->range_end);
+	playout->end = end > 0 ? (gint64)(end-1)*1000 : 0;
+	int seek = g_atomic_int_get(&session->seek);
+	if(seek > 0 && g_atomic_int_compare_and_exchange(&session->seek, seek, 0)) {
+		current = janus_recordplay_playout_seek(playout, (gint64)(seek-1)*1000, now);
+		JANUS_LOG(LOG_VERB, "Playout of recording %"SCNu64" moved to %"SCNi64"ms (asked for %dms)\n",
+			playout->recording->id, current/1000, seek-1);
+		json_t *event = json_object();
+		json_object_set_new(event, "recordplay", json_string("event"));
+		json_t *result = json_object();
+		json_object_set_new(result, "status", json_string("seeked"));
+		json_object_set_new(result, "id", json_integer(playout->recording->id));
+		json_object_set_new(result, "position", json_integer(current/1000));
+		json_object_set_new(event, "result", result);
+		gateway->push_event(session->handle, &janus_recordplay_plugin, NULL, event, NULL);
+		json_decref(event);
+	}
+	g_atomic_int_set(&session->position, (gint)(current/1000));
+	/* Even if nothing's due for a while, check the state of the session every 100ms */
+	gint64 next = now + 100000, position = 0, when = 0;
+	while(playout->audio) {
+		position = janus_recordplay_frame_position(playout->aframes, playout->audio, playout->akhz);
+		if(playout->end > 0 && position >= playout->end) {
+			playout->audio = NULL;
+			break;
+		}
+		when = playout->started + (position - playout->position)/playout->speed;
+		if(when > now) {
+			next = MIN(next, when);
+			break;
+		}
+		/* Audio can't be played faster than it was recorded, so we skip it when at a different speed */
+		if(playout->speed == 1)
+			janus_recordplay_playout_send_audio(playout, playout->audio, now);
+		else
+			playout->arewrite.jump = TRUE;
+		playout->audio = playout->audio->next;
+	}
+	while(playout->video) {
+		/* There may be multiple packets with the same timestamp, they'll all be sent together */
+		position = janus_recordplay_frame_position(playout->vframes, playout->video, playout->vkhz);
+		if(playout->end > 0 && position >= playout->end) {
+			playout->video = NULL;
+			break;
+		}
+		when = playout->started + (position - playout->position)/playout->speed;
+		if(when > now) {
+			next = MIN(next, when);
+			break;
+		}
+		janus_recordplay_playout_send_video(playout, playout->video, now);
+		playout->video = playout->video->next;
+	}
+	while(playout->data) {
+		position = janus_recordplay_frame_position(playout->dframes, playout->data, 0);
+		if(playout->end > 0 && position >= playout->end) {
+			playout->data = NULL;
+			break;
+		}
+		when = playout->started + (position - playout->position)/playout->speed;
+		if(when > now) {
+			next = MIN(next, when);
+			break;
+		}
+		janus_recordplay_playout_send_data(playout, playout->data);
+		playout->data = playout->data->next;
+	}
+	if(!playout->audio && !playout->video)
+		return FALSE;
+	playout->deadline = next;
+	return TRUE;
+}
 
-	JANUS_LOG(LOG_VERB, "Leaving playout thread\n");
-	g_thread_unref(g_thread_self());
+/* Thread serving playouts: sends the frames of all its playouts when they're due */
+static void *janus_recordplay_player_thread(void *data) {
+	janus_recordplay_player *player = (janus_recordplay_player *)data;
+	JANUS_LOG(LOG_VERB, "Joining Record&Play playout thread #%d\n", player->id);
+	janus_recordplay_playout *playout = NULL;
+	gint64 now = 0;
+	janus_mutex_lock(&player->mutex);
+	while(!g_atomic_int_get(&stopping)) {
+		now = janus_get_monotonic_time();
+		playout = g_queue_peek_head(player->playouts);
+		if(playout == NULL) {
+			/* Nothing to do, wait for a playout to show up */
+			gint64 until = g_get_monotonic_time() + G_USEC_PER_SEC;
+			g_cond_wait_until(&player->cond, &player->mutex, until);
+			continue;
+		}
+		if(playout->deadline > now) {
+			/* Wait for the next deadline, or for a new playout */
+			gint64 until = g_get_monotonic_time() + (playout->deadline - now);
+			g_cond_wait_until(&player->cond, &player->mutex, until);
+			continue;
+		}
+		/* It's time to send some frames for this playout */
+		g_queue_pop_head(player->playouts);
+		janus_mutex_unlock(&player->mutex);
+		gboolean active = janus_recordplay_playout_send(player, playout, now);
+		if(!active)
+			janus_recordplay_playout_done(player, playout);
+		janus_mutex_lock(&player->mutex);
+		if(active)
+			g_queue_insert_sorted(player->playouts, playout, janus_recordplay_playout_compare, NULL);
+	}
+	/* Get rid of the playouts that were still going on */
+	while((playout = g_queue_pop_head(player->playouts)) != NULL) {
+		janus_mutex_unlock(&player->mutex);
+		janus_recordplay_playout_done(player, playout);
+		janus_mutex_lock(&player->mutex);
+	}
+	janus_mutex_unlock(&player->mutex);
+	JANUS_LOG(LOG_VERB, "Leaving Record&Play playout thread #%d\n", player->id);
 	return NULL;
 }
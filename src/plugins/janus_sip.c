@@ -705,6 +705,12 @@
  *
  */
 
+#ifdef HAVE_RECVMMSG
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		/* Needed for recvmmsg */
+#endif
+#endif
+
 #include "plugin.h"
 
 #include <arpa/inet.h>
@@ -725,6 +731,9 @@
 #include <sofia-sip/tport_tag.h>
 #include <sofia-sip/su_log.h>
 #include <sofia-sip/sofia_features.h>
+#ifdef HAVE_LIBOPUS
+#include <opus/opus.h>
+#endif
 
 #include "../debug.h"
 #include "../apierror.h"
@@ -737,6 +746,7 @@
 #include "../sdp-utils.h"
 #include "../utils.h"
 #include "../ip-utils.h"
+#include "../reactor.h"
 
 
 /* Plugin information */
@@ -1024,8 +1034,27 @@ struct ssip_s {
 	GHashTable *subscriptions;
 	janus_mutex smutex;
 	struct janus_sip_session *session;
+	struct janus_sip_shared_stack *shared;	/* Only set if the NUA is shared with other accounts */
+	char *shared_user;						/* Contact user this account is known as in the shared stack */
 };
 
+/* Shared stacks: a single NUA and event loop serving many accounts, so
+ * that we don't need a thread and a set of sockets per registration */
+typedef struct janus_sip_shared_stack {
+	int index;
+	su_root_t *s_root;
+	nua_t *s_nua;
+	char *contact;			/* Contact header as returned by the NUA, if queried */
+	GHashTable *accounts;	/* Contact user -> session */
+	GThread *thread;
+	janus_mutex mutex;
+} janus_sip_shared_stack;
+static int shared_stacks_num = 0;
+static janus_sip_shared_stack **shared_stacks = NULL;
+
+/* Whether media should be relayed by the core reactor, rather than by a thread per call */
+static gboolean media_reactor = FALSE;
+
 typedef struct janus_sip_transfer {
 	struct janus_sip_session *session;
 	char *referred_by;
@@ -1099,6 +1128,7 @@ typedef struct janus_sip_media {
 	gboolean video_pli_supported;
 	janus_sdp_mdirection hold_video_dir, pre_hold_video_dir;
 	janus_rtp_switching_context acontext, vcontext;
+	janus_rtcp_context audio_stats, video_stats;	/* Loss and jitter of what the peer sends */
 	int pipefd[2];
 	gboolean updated;
 	int video_orientation_extension_id;
@@ -1127,7 +1157,10 @@ typedef struct janus_sip_session {
 	janus_recorder *vrc;		/* The Janus recorder instance for this user's video, if enabled */
 	janus_recorder *vrc_peer;	/* The Janus recorder instance for the peer's video, if enabled */
 	janus_mutex rec_mutex;		/* Mutex to protect the recorders from race conditions */
+	struct janus_sip_transcoder *transcoder;	/* If we're transcoding between Opus and G.711 */
+	janus_mutex transcoder_mutex;	/* Mutex to protect the transcoder */
 	GThread *relayer_thread;
+	struct janus_sip_relay *relay;	/* If media is relayed by the reactor, rather than a thread */
 	volatile gint establishing, established;
 	volatile gint hangingup;
 	volatile gint destroyed;
@@ -1163,10 +1196,99 @@ static void janus_sip_srtp_cleanup(janus_sip_session *session);
 static void janus_sip_media_reset(janus_sip_session *session);
 static void janus_sip_rtcp_pli_send(janus_sip_session *session);
 
+/* Media relayed by the core reactor: watches for the RTP/RTCP sockets and the pipe */
+#define JANUS_SIP_RELAY_SOCKETS		4
+#define JANUS_SIP_RELAY_RECV_BATCH	16
+typedef struct janus_sip_relay {
+	janus_sip_session *session;
+	janus_reactor_watch *watches[JANUS_SIP_RELAY_SOCKETS+1];	/* The pipe is last */
+	int fds[JANUS_SIP_RELAY_SOCKETS+1];
+	int pollerrs;
+	gboolean done;
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr msgs[JANUS_SIP_RELAY_RECV_BATCH];
+	struct iovec iovecs[JANUS_SIP_RELAY_RECV_BATCH];
+	char buffers[JANUS_SIP_RELAY_RECV_BATCH][1500];
+#else
+	char buffers[1][1500];
+#endif
+	janus_mutex mutex;
+	janus_refcount ref;
+} janus_sip_relay;
+
+#ifdef HAVE_LIBOPUS
+/* Opus <-> G.711 transcoding, done by a fixed pool of workers */
+#define JANUS_SIP_TRANSCODE_SAMPLES		160		/* 20ms at 8kHz */
+#define JANUS_SIP_TRANSCODE_MAX_SAMPLES	960		/* 120ms at 8kHz, the longest Opus frame */
+#define JANUS_SIP_TRANSCODE_QUEUE_MAX	200
+typedef struct janus_sip_transcode_worker {
+	int index;
+	GThread *thread;
+	GAsyncQueue *packets;
+	volatile gint calls;
+} janus_sip_transcode_worker;
+static int transcoding_threads = 0, transcoding_max_calls = 8;
+static janus_sip_transcode_worker **transcode_workers = NULL;
+static uint8_t janus_sip_ulaw_enctable[65536], janus_sip_alaw_enctable[65536];
+static int16_t janus_sip_ulaw_dectable[256], janus_sip_alaw_dectable[256];
+typedef struct janus_sip_transcoder {
+	janus_sip_session *session;
+	janus_sip_transcode_worker *worker;
+	int opus_pt;				/* Opus payload type on the WebRTC side */
+	volatile gint g711_pt;		/* G.711 payload type on the SIP side, once negotiated */
+	OpusEncoder *encoder;
+	OpusDecoder *decoder;
+	/* RTP state of what we send on either side, and what we map it from */
+	guint16 sip_seq, webrtc_seq;
+	guint32 sip_ts, webrtc_ts;
+	gboolean webrtc_in_started, sip_in_started;
+	guint32 webrtc_in_base, sip_in_base;
+	/* G.711 samples from the SIP peer we still have to encode */
+	opus_int16 pending[JANUS_SIP_TRANSCODE_SAMPLES];
+	int pending_samples;
+	guint32 pending_ts;
+	volatile gint to_sip, to_webrtc, dropped;
+	volatile gint destroyed;
+	janus_refcount ref;
+} janus_sip_transcoder;
+typedef struct janus_sip_transcode_packet {
+	janus_sip_transcoder *transcoder;
+	gboolean from_sip;
+	int length;
+	char data[1500];
+} janus_sip_transcode_packet;
+static janus_sip_transcode_packet transcode_exit_packet;
+static void janus_sip_transcoder_offer(janus_sip_session *session, janus_sdp *sdp);
+static char *janus_sip_transcoder_answer(janus_sip_session *session, janus_sdp *sdp);
+static void janus_sip_transcoder_detach(janus_sip_session *session);
+static gboolean janus_sip_transcoder_push(janus_sip_session *session, gboolean from_sip, char *buf, int len);
+static void janus_sip_g711_init(void);
+static void *janus_sip_transcode_thread(void *data);
+#endif
+
+/* Whether a thread or the reactor is relaying media for this session */
+static gboolean janus_sip_relay_is_active(janus_sip_session *session) {
+	return session->relayer_thread != NULL || session->relay != NULL;
+}
+
+/* Wake up whoever is relaying media for this session via the pipe */
+static void janus_sip_relay_wakeup(janus_sip_session *session) {
+	if(session->media.pipefd[1] > 0) {
+		int code = 1;
+		ssize_t res = 0;
+		do {
+			res = write(session->media.pipefd[1], &code, sizeof(int));
+		} while(res == -1 && errno == EINTR);
+	}
+}
+
 static void janus_sip_call_update_status(janus_sip_session *session, janus_sip_call_status new_status) {
 	if(session->status != new_status) {
 		JANUS_LOG(LOG_VERB, "[%s] Call status change: [%s]-->[%s]\n", session->account.username == NULL ? "null" : session->account.username, janus_sip_call_status_string(session->status), janus_sip_call_status_string(new_status));
 		session->status = new_status;
+		/* The reactor has no timeout to notice the call is over, so wake it up */
+		if(session->relay != NULL && (new_status <= janus_sip_call_status_idle || new_status >= janus_sip_call_status_closing))
+			janus_sip_relay_wakeup(session);
 	}
 }
 
@@ -1222,6 +1344,7 @@ static void janus_sip_session_free(const janus_refcount *session_ref) {
 		su_home_deinit(session->stack->s_home);
 		su_home_unref(session->stack->s_home);
 		g_free(session->stack->contact_header);
+		g_free(session->stack->shared_user);
 		g_free(session->stack);
 		session->stack = NULL;
 	}
@@ -1589,13 +1712,21 @@ static void janus_sip_media_reset(janus_sip_session *session) {
 	session->media.dtmf_pt = -1;
 	janus_rtp_switching_context_reset(&session->media.acontext);
 	janus_rtp_switching_context_reset(&session->media.vcontext);
+	memset(&session->media.audio_stats, 0, sizeof(session->media.audio_stats));
+	memset(&session->media.video_stats, 0, sizeof(session->media.video_stats));
 }
 
 
 /* Sofia Event thread */
 gpointer janus_sip_sofia_thread(gpointer user_data);
+/* Shared Sofia stacks */
+gpointer janus_sip_shared_stack_thread(gpointer user_data);
+static gboolean janus_sip_shared_stack_attach(janus_sip_session *session);
+static void janus_sip_shared_stack_update(janus_sip_session *session);
+static void janus_sip_shared_stack_detach(janus_sip_session *session);
 /* Sofia callbacks */
 void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase, nua_t *nua, nua_magic_t *magic, nua_handle_t *nh, nua_hmagic_t *hmagic, sip_t const *sip, tagi_t tags[]);
+void janus_sip_shared_stack_callback(nua_event_t event, int status, char const *phrase, nua_t *nua, nua_magic_t *magic, nua_handle_t *nh, nua_hmagic_t *hmagic, sip_t const *sip, tagi_t tags[]);
 void janus_sip_save_reason(sip_t const *sip, janus_sip_session *session);
 /* SDP parsing and manipulation */
 void janus_sip_sdp_process(janus_sip_session *session, janus_sdp *sdp, gboolean answer, gboolean update, gboolean *changed);
@@ -1603,6 +1734,7 @@ char *janus_sip_sdp_manipulate(janus_sip_session *session, janus_sdp *sdp, gbool
 /* Media */
 static int janus_sip_allocate_local_ports(janus_sip_session *session, gboolean update);
 static void *janus_sip_relay_thread(void *data);
+static void janus_sip_relay_start(janus_sip_session *session);
 static void janus_sip_media_cleanup(janus_sip_session *session);
 static void janus_sip_check_rfc2833(janus_sip_session *session, char *buffer, int len);
 
@@ -2125,6 +2257,43 @@ int janus_sip_init(janus_callbacks *callback, const char *config_path) {
 			}
 		}
 
+		item = janus_config_get(config, config_general, janus_config_type_item, "shared_stacks");
+		if(item && item->value) {
+			int val = atoi(item->value);
+			if(val < 0) {
+				JANUS_LOG(LOG_WARN, "Ignoring shared_stacks value as it's not a positive integer\n");
+			} else {
+				shared_stacks_num = val;
+			}
+		}
+
+		item = janus_config_get(config, config_general, janus_config_type_item, "media_reactor");
+		if(item && item->value)
+			media_reactor = janus_is_true(item->value);
+
+		item = janus_config_get(config, config_general, janus_config_type_item, "transcoding_threads");
+		if(item && item->value) {
+#ifdef HAVE_LIBOPUS
+			int val = atoi(item->value);
+			if(val < 0) {
+				JANUS_LOG(LOG_WARN, "Ignoring transcoding_threads value as it's not a positive integer\n");
+			} else {
+				transcoding_threads = val;
+			}
+			item = janus_config_get(config, config_general, janus_config_type_item, "transcoding_max_calls");
+			if(item && item->value) {
+				val = atoi(item->value);
+				if(val <= 0) {
+					JANUS_LOG(LOG_WARN, "Ignoring transcoding_max_calls value as it's not a positive integer\n");
+				} else {
+					transcoding_max_calls = val;
+				}
+			}
+#else
+			JANUS_LOG(LOG_WARN, "Opus support not available, ignoring transcoding_threads\n");
+#endif
+		}
+
 		/* Check if Sofia should find certificates in a custom folder  */
 		item = janus_config_get(config, config_general, janus_config_type_item, "sips_certs_dir");
 		if(item && item->value) {
@@ -2217,8 +2386,67 @@ int janus_sip_init(janus_callbacks *callback, const char *config_path) {
 
 	g_atomic_int_set(&initialized, 1);
 
-	/* Launch the thread that will handle incoming messages */
+	/* If we need shared stacks, create them now */
 	GError *error = NULL;
+	if(shared_stacks_num > 0) {
+		shared_stacks = g_malloc0(shared_stacks_num * sizeof(janus_sip_shared_stack *));
+		int i = 0;
+		for(i=0; i<shared_stacks_num; i++) {
+			janus_sip_shared_stack *shared = g_malloc0(sizeof(janus_sip_shared_stack));
+			shared->index = i;
+			shared->accounts = g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, NULL);
+			janus_mutex_init(&shared->mutex);
+			shared_stacks[i] = shared;
+			char tname[16];
+			g_snprintf(tname, sizeof(tname), "sip shared %d", i+1);
+			shared->thread = g_thread_try_new(tname, janus_sip_shared_stack_thread, shared, &error);
+			if(error != NULL) {
+				JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the shared SIP Sofia thread...\n",
+					error->code, error->message ? error->message : "??");
+				g_error_free(error);
+				error = NULL;
+				shared->thread = NULL;
+			}
+		}
+		JANUS_LOG(LOG_INFO, "UDP accounts will share %d Sofia stacks\n", shared_stacks_num);
+	}
+#ifdef HAVE_LIBOPUS
+	if(transcoding_threads > 0) {
+		janus_sip_g711_init();
+		transcode_workers = g_malloc0(transcoding_threads * sizeof(janus_sip_transcode_worker *));
+		int i = 0;
+		for(i=0; i<transcoding_threads; i++) {
+			janus_sip_transcode_worker *worker = g_malloc0(sizeof(janus_sip_transcode_worker));
+			worker->index = i+1;
+			worker->packets = g_async_queue_new();
+			char tname[16];
+			g_snprintf(tname, sizeof(tname), "sip transcode %d", worker->index);
+			worker->thread = g_thread_try_new(tname, janus_sip_transcode_thread, worker, &error);
+			if(error != NULL) {
+				JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the SIP transcoding thread...\n",
+					error->code, error->message ? error->message : "??");
+				g_error_free(error);
+				error = NULL;
+				worker->thread = NULL;
+				/* Make sure no call ends up on this worker */
+				g_atomic_int_set(&worker->calls, transcoding_max_calls);
+			}
+			transcode_workers[i] = worker;
+		}
+		JANUS_LOG(LOG_INFO, "Opus/G.711 transcoding enabled (%d workers, up to %d calls each)\n",
+			transcoding_threads, transcoding_max_calls);
+	}
+#endif
+	if(media_reactor) {
+		if(janus_reactor_get_threads() == 0) {
+			JANUS_LOG(LOG_WARN, "Reactor not available, media will be relayed by a thread per call\n");
+			media_reactor = FALSE;
+		} else {
+			JANUS_LOG(LOG_INFO, "Media will be relayed by the core reactor (%d loops)\n", janus_reactor_get_threads());
+		}
+	}
+
+	/* Launch the thread that will handle incoming messages */
 	handler_thread = g_thread_try_new("sip handler", janus_sip_handler, NULL, &error);
 	if(error != NULL) {
 		g_atomic_int_set(&initialized, 0);
@@ -2258,6 +2486,45 @@ void janus_sip_destroy(void) {
 	janus_mutex_unlock(&sessions_mutex);
 	g_async_queue_unref(messages);
 	messages = NULL;
+	/* Shut the shared stacks down, if any */
+	int i = 0;
+	for(i=0; i<shared_stacks_num; i++) {
+		janus_sip_shared_stack *shared = shared_stacks[i];
+		janus_mutex_lock(&shared->mutex);
+		if(shared->s_nua)
+			nua_shutdown(shared->s_nua);
+		janus_mutex_unlock(&shared->mutex);
+		if(shared->thread != NULL)
+			g_thread_join(shared->thread);
+		g_hash_table_destroy(shared->accounts);
+		g_free(shared->contact);
+		g_free(shared);
+	}
+	g_free(shared_stacks);
+	shared_stacks = NULL;
+	shared_stacks_num = 0;
+#ifdef HAVE_LIBOPUS
+	/* Stop the transcoding workers, if any */
+	for(i=0; i<transcoding_threads; i++) {
+		janus_sip_transcode_worker *worker = transcode_workers[i];
+		if(worker->thread != NULL) {
+			g_async_queue_push(worker->packets, &transcode_exit_packet);
+			g_thread_join(worker->thread);
+		}
+		janus_sip_transcode_packet *pkt = NULL;
+		while((pkt = g_async_queue_try_pop(worker->packets)) != NULL) {
+			if(pkt == &transcode_exit_packet)
+				continue;
+			janus_refcount_decrease(&pkt->transcoder->ref);
+			g_free(pkt);
+		}
+		g_async_queue_unref(worker->packets);
+		g_free(worker);
+	}
+	g_free(transcode_workers);
+	transcode_workers = NULL;
+	transcoding_threads = 0;
+#endif
 	g_atomic_int_set(&initialized, 0);
 	g_atomic_int_set(&stopping, 0);
 
@@ -2401,6 +2668,8 @@ void janus_sip_create_session(janus_plugin_session *handle, int *error) {
 	session->media.video_remote_policy.ssrc.type = ssrc_any_inbound;
 	session->media.video_local_policy.ssrc.type = ssrc_any_inbound;
 	janus_mutex_init(&session->rec_mutex);
+	session->transcoder = NULL;
+	janus_mutex_init(&session->transcoder_mutex);
 	g_atomic_int_set(&session->establishing, 0);
 	g_atomic_int_set(&session->established, 0);
 	g_atomic_int_set(&session->hangingup, 0);
@@ -2431,6 +2700,9 @@ void janus_sip_destroy_session(janus_plugin_session *handle, int *error) {
 	}
 	JANUS_LOG(LOG_VERB, "Destroying SIP session (%s)...\n", session->account.username ? session->account.username : "unregistered user");
 	janus_sip_hangup_media_internal(handle);
+#ifdef HAVE_LIBOPUS
+	janus_sip_transcoder_detach(session);
+#endif
 	/* If this is a master or helper session, update the related sessions */
 	if(session->master_id != 0) {
 		if(session->master == NULL) {
@@ -2470,8 +2742,10 @@ void janus_sip_destroy_session(janus_plugin_session *handle, int *error) {
 		g_hash_table_remove(transfers, GUINT_TO_POINTER(session->refer_id));
 		session->refer_id = 0;
 	}
-	/* Shutdown the NUA */
-	if(session->stack) {
+	/* Shutdown the NUA, or leave the shared one */
+	if(session->stack && session->stack->shared) {
+		janus_sip_shared_stack_detach(session);
+	} else if(session->stack) {
 		janus_mutex_lock(&session->stack->smutex);
 		if(session->stack->s_nua)
 			nua_shutdown(session->stack->s_nua);
@@ -2482,6 +2756,17 @@ void janus_sip_destroy_session(janus_plugin_session *handle, int *error) {
 	return;
 }
 
+/* Helper to summarize what we received from the peer on a medium, if anything */
+static json_t *janus_sip_media_stats(janus_rtcp_context *ctx) {
+	if(ctx->received == 0)
+		return NULL;
+	json_t *stats = json_object();
+	json_object_set_new(stats, "packets", json_integer(ctx->received));
+	json_object_set_new(stats, "lost", json_integer(ctx->expected > ctx->received ? ctx->expected - ctx->received : 0));
+	json_object_set_new(stats, "jitter", json_integer(janus_rtcp_context_get_jitter(ctx, FALSE)));
+	return stats;
+}
+
 json_t *janus_sip_query_session(janus_plugin_session *handle) {
 	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized)) {
 		return NULL;
@@ -2528,6 +2813,29 @@ json_t *janus_sip_query_session(janus_plugin_session *handle) {
 		json_object_set_new(info, "sdes-local-video", json_string(session->media.has_srtp_local_video ? "yes" : "no"));
 		json_object_set_new(info, "sdes-remote-audio", json_string(session->media.has_srtp_remote_audio ? "yes" : "no"));
 		json_object_set_new(info, "sdes-remote-video", json_string(session->media.has_srtp_remote_video ? "yes" : "no"));
+		if(janus_sip_relay_is_active(session))
+			json_object_set_new(info, "media-relay", json_string(session->relay ? "reactor" : "thread"));
+#ifdef HAVE_LIBOPUS
+		janus_mutex_lock(&session->transcoder_mutex);
+		janus_sip_transcoder *t = session->transcoder;
+		if(t != NULL) {
+			json_t *transcoding = json_object();
+			int g711_pt = g_atomic_int_get(&t->g711_pt);
+			json_object_set_new(transcoding, "codec", json_string(g711_pt == 8 ? "pcma" : (g711_pt == 0 ? "pcmu" : "none")));
+			json_object_set_new(transcoding, "worker", json_integer(t->worker->index));
+			json_object_set_new(transcoding, "to-sip", json_integer(g_atomic_int_get(&t->to_sip)));
+			json_object_set_new(transcoding, "to-webrtc", json_integer(g_atomic_int_get(&t->to_webrtc)));
+			json_object_set_new(transcoding, "dropped", json_integer(g_atomic_int_get(&t->dropped)));
+			json_object_set_new(info, "transcoding", transcoding);
+		}
+		janus_mutex_unlock(&session->transcoder_mutex);
+#endif
+		json_t *stats = janus_sip_media_stats(&session->media.audio_stats);
+		if(stats)
+			json_object_set_new(info, "audio-stats", stats);
+		stats = janus_sip_media_stats(&session->media.video_stats);
+		if(stats)
+			json_object_set_new(info, "video-stats", stats);
 	}
 	janus_mutex_unlock(&session->mutex);
 	if(session->arc || session->vrc || session->arc_peer || session->vrc_peer) {
@@ -2597,6 +2905,364 @@ void janus_sip_setup_media(janus_plugin_session *handle) {
 	/* Only relay RTP/RTCP when we get this event */
 }
 
+/* Helper to send an audio packet to the SIP peer, protecting it if needed */
+static void janus_sip_send_audio(janus_sip_session *session, char *buf, int len) {
+	/* Is SRTP involved? */
+	if(session->media.has_srtp_local_audio) {
+		char sbuf[2048];
+		memcpy(&sbuf, buf, len);
+		int protected = len;
+		int res = srtp_protect(session->media.audio_srtp_out, &sbuf, &protected);
+		if(res != srtp_err_status_ok) {
+			janus_rtp_header *header = (janus_rtp_header *)&sbuf;
+			guint32 timestamp = ntohl(header->timestamp);
+			guint16 seq = ntohs(header->seq_number);
+			JANUS_LOG(LOG_ERR, "[SIP-%s] Audio SRTP protect error... %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")...\n",
+				session->account.username, janus_srtp_error_str(res), len, protected, timestamp, seq);
+		} else {
+			/* Forward the frame to the peer */
+			if(send(session->media.audio_rtp_fd, sbuf, protected, 0) < 0) {
+				janus_rtp_header *header = (janus_rtp_header *)&sbuf;
+				guint32 timestamp = ntohl(header->timestamp);
+				guint16 seq = ntohs(header->seq_number);
+				JANUS_LOG(LOG_HUGE, "[SIP-%s] Error sending SRTP audio packet... %s (len=%d, ts=%"SCNu32", seq=%"SCNu16")...\n",
+					session->account.username, g_strerror(errno), protected, timestamp, seq);
+			}
+		}
+	} else {
+		/* Forward the frame to the peer */
+		if(send(session->media.audio_rtp_fd, buf, len, 0) < 0) {
+			janus_rtp_header *header = (janus_rtp_header *)&buf;
+			guint32 timestamp = ntohl(header->timestamp);
+			guint16 seq = ntohs(header->seq_number);
+			JANUS_LOG(LOG_HUGE, "[SIP-%s] Error sending RTP audio packet... %s (len=%d, ts=%"SCNu32", seq=%"SCNu16")...\n",
+				session->account.username, g_strerror(errno), len, timestamp, seq);
+		}
+	}
+}
+
+#ifdef HAVE_LIBOPUS
+/* Opus <-> G.711 transcoding: G.711 is table driven in both directions
+ * (the encoding tables cover all the possible 16-bit samples), while
+ * Opus encoders and decoders work at 8kHz, so that no resampling is needed */
+static uint8_t janus_sip_g711_ulaw_encode(int16_t pcm) {
+	int sample = pcm, sign = 0;
+	if(sample < 0) {
+		sample = -sample;
+		sign = 0x80;
+	}
+	if(sample > 32635)
+		sample = 32635;
+	sample += 0x84;
+	int exponent = 7, mask = 0x4000;
+	while(exponent > 0 && !(sample & mask)) {
+		exponent--;
+		mask >>= 1;
+	}
+	int mantissa = (sample >> (exponent + 3)) & 0x0F;
+	return (uint8_t)~(sign | (exponent << 4) | mantissa);
+}
+static uint8_t janus_sip_g711_alaw_encode(int16_t pcm) {
+	int sample = pcm, sign = 0x80;
+	if(sample < 0) {
+		sample = -sample;
+		sign = 0;
+	}
+	if(sample > 32635)
+		sample = 32635;
+	uint8_t encoded = 0;
+	if(sample >= 256) {
+		int exponent = 7, mask = 0x4000;
+		while(exponent > 1 && !(sample & mask)) {
+			exponent--;
+			mask >>= 1;
+		}
+		int mantissa = (sample >> (exponent + 3)) & 0x0F;
+		encoded = (exponent << 4) | mantissa;
+	} else {
+		encoded = (uint8_t)(sample >> 4);
+	}
+	return encoded ^ (sign ^ 0x55);
+}
+static int16_t janus_sip_g711_ulaw_decode(uint8_t ulaw) {
+	ulaw = ~ulaw;
+	int sample = (((ulaw & 0x0F) << 3) + 0x84) << ((ulaw & 0x70) >> 4);
+	return (ulaw & 0x80) ? (0x84 - sample) : (sample - 0x84);
+}
+static int16_t janus_sip_g711_alaw_decode(uint8_t alaw) {
+	alaw ^= 0x55;
+	int sample = (alaw & 0x0F) << 4;
+	int exponent = (alaw & 0x70) >> 4;
+	if(exponent == 0)
+		sample += 8;
+	else
+		sample = (sample + 0x108) << (exponent - 1);
+	return (alaw & 0x80) ? sample : -sample;
+}
+static void janus_sip_g711_init(void) {
+	int i = 0;
+	for(i=0; i<65536; i++) {
+		janus_sip_ulaw_enctable[i] = janus_sip_g711_ulaw_encode((int16_t)i);
+		janus_sip_alaw_enctable[i] = janus_sip_g711_alaw_encode((int16_t)i);
+	}
+	for(i=0; i<256; i++) {
+		janus_sip_ulaw_dectable[i] = janus_sip_g711_ulaw_decode(i);
+		janus_sip_alaw_dectable[i] = janus_sip_g711_alaw_decode(i);
+	}
+}
+
+static void janus_sip_transcoder_free(const janus_refcount *transcoder_ref) {
+	janus_sip_transcoder *t = janus_refcount_containerof(transcoder_ref, janus_sip_transcoder, ref);
+	if(t->encoder)
+		opus_encoder_destroy(t->encoder);
+	if(t->decoder)
+		opus_decoder_destroy(t->decoder);
+	janus_refcount_decrease(&t->session->ref);
+	g_free(t);
+}
+
+/* Admission control: we pick the least loaded worker, as long as it's not full already */
+static gboolean janus_sip_transcoder_attach(janus_sip_session *session, int opus_pt) {
+	janus_sip_transcode_worker *worker = NULL;
+	int i = 0;
+	for(i=0; i<transcoding_threads; i++) {
+		janus_sip_transcode_worker *w = transcode_workers[i];
+		if(g_atomic_int_get(&w->calls) >= transcoding_max_calls)
+			continue;
+		if(worker == NULL || g_atomic_int_get(&w->calls) < g_atomic_int_get(&worker->calls))
+			worker = w;
+	}
+	if(worker == NULL)
+		return FALSE;
+	int error = 0;
+	janus_sip_transcoder *t = g_malloc0(sizeof(janus_sip_transcoder));
+	t->decoder = opus_decoder_create(8000, 1, &error);
+	if(error == OPUS_OK)
+		t->encoder = opus_encoder_create(8000, 1, OPUS_APPLICATION_VOIP, &error);
+	if(error != OPUS_OK) {
+		JANUS_LOG(LOG_ERR, "[SIP-%s] Error creating Opus transcoder: %s\n", session->account.username, opus_strerror(error));
+		if(t->decoder)
+			opus_decoder_destroy(t->decoder);
+		g_free(t);
+		return FALSE;
+	}
+	t->session = session;
+	janus_refcount_increase(&session->ref);
+	t->worker = worker;
+	t->opus_pt = opus_pt;
+	t->g711_pt = -1;
+	t->sip_seq = g_random_int_range(0, G_MAXUINT16);
+	t->sip_ts = g_random_int();
+	t->webrtc_seq = g_random_int_range(0, G_MAXUINT16);
+	t->webrtc_ts = g_random_int();
+	janus_refcount_init(&t->ref, janus_sip_transcoder_free);
+	g_atomic_int_inc(&worker->calls);
+	janus_mutex_lock(&session->transcoder_mutex);
+	session->transcoder = t;
+	janus_mutex_unlock(&session->transcoder_mutex);
+	JANUS_LOG(LOG_VERB, "[SIP-%s] Transcoding Opus (pt=%d) on worker #%d\n", session->account.username, opus_pt, worker->index);
+	return TRUE;
+}
+
+static void janus_sip_transcoder_detach(janus_sip_session *session) {
+	janus_mutex_lock(&session->transcoder_mutex);
+	janus_sip_transcoder *t = session->transcoder;
+	session->transcoder = NULL;
+	janus_mutex_unlock(&session->transcoder_mutex);
+	if(t == NULL)
+		return;
+	if(g_atomic_int_compare_and_exchange(&t->destroyed, 0, 1))
+		g_atomic_int_add(&t->worker->calls, -1);
+	janus_refcount_decrease(&t->ref);
+}
+
+/* Replace the codecs of an audio m-line, either with G.711 (for the SIP peer) or with Opus (for the browser) */
+static void janus_sip_transcoder_set_codecs(janus_sdp *sdp, janus_sdp_mline *m, int opus_pt) {
+	while(m->ptypes != NULL)
+		janus_sdp_remove_payload_type(sdp, m->index, GPOINTER_TO_INT(m->ptypes->data));
+	if(opus_pt < 0) {
+		m->ptypes = g_list_append(m->ptypes, GINT_TO_POINTER(0));
+		m->ptypes = g_list_append(m->ptypes, GINT_TO_POINTER(8));
+		janus_sdp_attribute_add_to_mline(m, janus_sdp_attribute_create("rtpmap", "0 PCMU/8000"));
+		janus_sdp_attribute_add_to_mline(m, janus_sdp_attribute_create("rtpmap", "8 PCMA/8000"));
+	} else {
+		m->ptypes = g_list_append(m->ptypes, GINT_TO_POINTER(opus_pt));
+		janus_sdp_attribute_add_to_mline(m, janus_sdp_attribute_create("rtpmap", "%d opus/48000/2", opus_pt));
+	}
+}
+
+/* If the browser offered Opus but no G.711, offer G.711 to the SIP peer
+ * ourselves and transcode, if there's capacity left for that */
+static void janus_sip_transcoder_offer(janus_sip_session *session, janus_sdp *sdp) {
+	janus_sdp_mline *m = janus_sdp_mline_find(sdp, JANUS_SDP_AUDIO);
+	if(m == NULL || m->port == 0)
+		return;
+	int opus_pt = janus_sdp_get_codec_pt(sdp, m->index, "opus");
+	if(opus_pt < 0 || janus_sdp_get_codec_pt(sdp, m->index, "pcmu") >= 0 ||
+			janus_sdp_get_codec_pt(sdp, m->index, "pcma") >= 0)
+		return;
+	if(session->transcoder == NULL && !janus_sip_transcoder_attach(session, opus_pt)) {
+		JANUS_LOG(LOG_WARN, "[SIP-%s] Can't transcode (no capacity left), offering Opus as it is\n", session->account.username);
+		return;
+	}
+	janus_sip_transcoder_set_codecs(sdp, m, -1);
+}
+
+/* The SIP peer answered with G.711: turn the answer into an Opus one for
+ * the browser, and return the new SDP (or NULL if we can't transcode) */
+static char *janus_sip_transcoder_answer(janus_sip_session *session, janus_sdp *sdp) {
+	janus_sip_transcoder *t = session->transcoder;
+	janus_sdp_mline *m = janus_sdp_mline_find(sdp, JANUS_SDP_AUDIO);
+	if(t == NULL || m == NULL || m->port == 0)
+		return NULL;
+	if(session->media.audio_pt != 0 && session->media.audio_pt != 8) {
+		JANUS_LOG(LOG_WARN, "[SIP-%s] Peer didn't pick G.711 (pt=%d), not transcoding\n",
+			session->account.username, session->media.audio_pt);
+		janus_sip_transcoder_detach(session);
+		return NULL;
+	}
+	g_atomic_int_set(&t->g711_pt, session->media.audio_pt);
+	janus_sip_transcoder_set_codecs(sdp, m, t->opus_pt);
+	return janus_sdp_write(sdp);
+}
+
+/* Queue a packet for the worker of this call: returns FALSE if we're not transcoding */
+static gboolean janus_sip_transcoder_push(janus_sip_session *session, gboolean from_sip, char *buf, int len) {
+	janus_mutex_lock(&session->transcoder_mutex);
+	janus_sip_transcoder *t = session->transcoder;
+	if(t == NULL) {
+		janus_mutex_unlock(&session->transcoder_mutex);
+		return FALSE;
+	}
+	if(len > 1500 || g_async_queue_length(t->worker->packets) > JANUS_SIP_TRANSCODE_QUEUE_MAX) {
+		/* Too much work for this worker already, don't make things worse */
+		janus_mutex_unlock(&session->transcoder_mutex);
+		g_atomic_int_inc(&t->dropped);
+		return TRUE;
+	}
+	janus_refcount_increase(&t->ref);
+	janus_mutex_unlock(&session->transcoder_mutex);
+	janus_sip_transcode_packet *pkt = g_malloc(sizeof(janus_sip_transcode_packet));
+	pkt->transcoder = t;
+	pkt->from_sip = from_sip;
+	pkt->length = len;
+	memcpy(pkt->data, buf, len);
+	g_async_queue_push(t->worker->packets, pkt);
+	return TRUE;
+}
+
+/* Decode an Opus packet from the browser, and send it as G.711 to the SIP peer */
+static void janus_sip_transcode_to_sip(janus_sip_transcoder *t, char *buf, int len) {
+	janus_sip_session *session = t->session;
+	janus_rtp_header *header = (janus_rtp_header *)buf;
+	int g711_pt = g_atomic_int_get(&t->g711_pt);
+	if(g711_pt < 0 || header->type != t->opus_pt || session->media.audio_rtp_fd == -1)
+		return;
+	int plen = 0;
+	char *payload = janus_rtp_payload(buf, len, &plen);
+	if(payload == NULL || plen < 1)
+		return;
+	opus_int16 samples[JANUS_SIP_TRANSCODE_MAX_SAMPLES];
+	int num = opus_decode(t->decoder, (const unsigned char *)payload, plen, samples, JANUS_SIP_TRANSCODE_MAX_SAMPLES, 0);
+	if(num <= 0) {
+		JANUS_LOG(LOG_HUGE, "[SIP-%s] Error decoding Opus frame: %s\n", session->account.username, opus_strerror(num));
+		return;
+	}
+	/* Keep the timing of the original packets (e.g., DTX), just on an 8kHz clock */
+	guint32 timestamp = ntohl(header->timestamp);
+	if(!t->webrtc_in_started) {
+		t->webrtc_in_started = TRUE;
+		t->webrtc_in_base = timestamp;
+	}
+	char out[12+JANUS_SIP_TRANSCODE_MAX_SAMPLES];
+	memcpy(out, buf, 12);
+	janus_rtp_header *rtp = (janus_rtp_header *)out;
+	rtp->csrccount = 0;
+	rtp->extension = 0;
+	rtp->padding = 0;
+	rtp->type = g711_pt;
+	rtp->seq_number = htons(t->sip_seq++);
+	rtp->timestamp = htonl(t->sip_ts + (timestamp - t->webrtc_in_base)/6);
+	uint8_t *enctable = (g711_pt == 8 ? janus_sip_alaw_enctable : janus_sip_ulaw_enctable);
+	int i = 0;
+	for(i=0; i<num; i++)
+		out[12+i] = enctable[(uint16_t)samples[i]];
+	janus_recorder_save_frame(session->arc, out, 12+num);
+	janus_sip_send_audio(session, out, 12+num);
+	g_atomic_int_inc(&t->to_sip);
+}
+
+/* Decode a G.711 packet from the SIP peer, and relay it as Opus to the browser, 20ms at a time */
+static void janus_sip_transcode_to_webrtc(janus_sip_transcoder *t, char *buf, int len) {
+	janus_sip_session *session = t->session;
+	janus_rtp_header *header = (janus_rtp_header *)buf;
+	int g711_pt = g_atomic_int_get(&t->g711_pt);
+	if(g711_pt < 0 || header->type != g711_pt)
+		return;
+	int plen = 0;
+	char *payload = janus_rtp_payload(buf, len, &plen);
+	if(payload == NULL || plen < 1)
+		return;
+	guint32 timestamp = ntohl(header->timestamp);
+	if(!t->sip_in_started) {
+		t->sip_in_started = TRUE;
+		t->sip_in_base = timestamp;
+	}
+	int16_t *dectable = (g711_pt == 8 ? janus_sip_alaw_dectable : janus_sip_ulaw_dectable);
+	char out[1500];
+	int i = 0;
+	for(i=0; i<plen; i++) {
+		if(t->pending_samples == 0)
+			t->pending_ts = timestamp + i;
+		t->pending[t->pending_samples++] = dectable[(uint8_t)payload[i]];
+		if(t->pending_samples < JANUS_SIP_TRANSCODE_SAMPLES)
+			continue;
+		/* We have a full frame, encode it */
+		t->pending_samples = 0;
+		int bytes = opus_encode(t->encoder, t->pending, JANUS_SIP_TRANSCODE_SAMPLES,
+			(unsigned char *)out+12, sizeof(out)-12);
+		if(bytes <= 0) {
+			JANUS_LOG(LOG_HUGE, "[SIP-%s] Error encoding Opus frame: %s\n", session->account.username, opus_strerror(bytes));
+			continue;
+		}
+		memset(out, 0, 12);
+		janus_rtp_header *rtp = (janus_rtp_header *)out;
+		rtp->version = 2;
+		rtp->type = t->opus_pt;
+		rtp->seq_number = htons(t->webrtc_seq++);
+		rtp->timestamp = htonl(t->webrtc_ts + (t->pending_ts - t->sip_in_base)*6);
+		rtp->ssrc = htonl(session->media.audio_ssrc_peer);
+		janus_plugin_rtp packet = { .mindex = -1, .video = FALSE, .buffer = out, .length = 12+bytes };
+		janus_plugin_rtp_extensions_reset(&packet.extensions);
+		gateway->relay_rtp(session->handle, &packet);
+		g_atomic_int_inc(&t->to_webrtc);
+	}
+}
+
+/* Transcoding worker: calls are pinned to a worker, so codec states are never shared */
+static void *janus_sip_transcode_thread(void *data) {
+	janus_sip_transcode_worker *worker = (janus_sip_transcode_worker *)data;
+	JANUS_LOG(LOG_VERB, "Joining SIP transcoding worker #%d\n", worker->index);
+	janus_sip_transcode_packet *pkt = NULL;
+	while(!g_atomic_int_get(&stopping)) {
+		pkt = g_async_queue_pop(worker->packets);
+		if(pkt == &transcode_exit_packet)
+			break;
+		janus_sip_transcoder *t = pkt->transcoder;
+		if(!g_atomic_int_get(&t->destroyed) && !g_atomic_int_get(&t->session->destroyed)) {
+			if(pkt->from_sip)
+				janus_sip_transcode_to_webrtc(t, pkt->data, pkt->length);
+			else
+				janus_sip_transcode_to_sip(t, pkt->data, pkt->length);
+		}
+		janus_refcount_decrease(&t->ref);
+		g_free(pkt);
+	}
+	JANUS_LOG(LOG_VERB, "Leaving SIP transcoding worker #%d\n", worker->index);
+	return NULL;
+}
+#endif
+
 void janus_sip_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp *packet) {
 	if(handle == NULL || g_atomic_int_get(&handle->stopped) || g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
 		return;
@@ -2687,40 +3353,14 @@ void janus_sip_incoming_rtp(janus_plugin_session *handle, janus_plugin_rtp *pack
 				JANUS_LOG(LOG_VERB, "Got SIP audio SSRC: %"SCNu32"\n", session->media.audio_ssrc);
 			}
 			if(session->media.has_audio && session->media.audio_rtp_fd != -1) {
+#ifdef HAVE_LIBOPUS
+				/* If the SIP peer can't do Opus, the transcoder will take care of this */
+				if(session->transcoder != NULL && janus_sip_transcoder_push(session, FALSE, buf, len))
+					return;
+#endif
 				/* Save the frame if we're recording */
 				janus_recorder_save_frame(session->arc, buf, len);
-				/* Is SRTP involved? */
-				if(session->media.has_srtp_local_audio) {
-					char sbuf[2048];
-					memcpy(&sbuf, buf, len);
-					int protected = len;
-					int res = srtp_protect(session->media.audio_srtp_out, &sbuf, &protected);
-					if(res != srtp_err_status_ok) {
-						janus_rtp_header *header = (janus_rtp_header *)&sbuf;
-						guint32 timestamp = ntohl(header->timestamp);
-						guint16 seq = ntohs(header->seq_number);
-						JANUS_LOG(LOG_ERR, "[SIP-%s] Audio SRTP protect error... %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")...\n",
-							session->account.username, janus_srtp_error_str(res), len, protected, timestamp, seq);
-					} else {
-						/* Forward the frame to the peer */
-						if(send(session->media.audio_rtp_fd, sbuf, protected, 0) < 0) {
-							janus_rtp_header *header = (janus_rtp_header *)&sbuf;
-							guint32 timestamp = ntohl(header->timestamp);
-							guint16 seq = ntohs(header->seq_number);
-							JANUS_LOG(LOG_HUGE, "[SIP-%s] Error sending SRTP audio packet... %s (len=%d, ts=%"SCNu32", seq=%"SCNu16")...\n",
-								session->account.username, g_strerror(errno), protected, timestamp, seq);
-						}
-					}
-				} else {
-					/* Forward the frame to the peer */
-					if(send(session->media.audio_rtp_fd, buf, len, 0) < 0) {
-						janus_rtp_header *header = (janus_rtp_header *)&buf;
-						guint32 timestamp = ntohl(header->timestamp);
-						guint16 seq = ntohs(header->seq_number);
-						JANUS_LOG(LOG_HUGE, "[SIP-%s] Error sending RTP audio packet... %s (len=%d, ts=%"SCNu32", seq=%"SCNu16")...\n",
-							session->account.username, g_strerror(errno), len, timestamp, seq);
-					}
-				}
+				janus_sip_send_audio(session, buf, len);
 			}
 		}
 	}
@@ -2858,7 +3498,7 @@ static void janus_sip_hangup_media_internal(janus_plugin_session *handle) {
 		return;
 	session->media.simulcast_ssrc = 0;
 	/* Do cleanup if media thread has not been created */
-	if(!session->media.ready && !session->relayer_thread) {
+	if(!session->media.ready && !janus_sip_relay_is_active(session)) {
 		janus_mutex_lock(&session->mutex);
 		janus_sip_media_cleanup(session);
 		janus_mutex_unlock(&session->mutex);
@@ -3337,7 +3977,11 @@ static void *janus_sip_handler(void *data) {
 			}
 
 			session->account.registration_status = janus_sip_registration_status_registering;
-			if(!refresh && session->stack == NULL) {
+			if(session->stack != NULL && session->stack->shared != NULL) {
+				/* We're on a shared stack already, but may be known with a different user now */
+				janus_sip_shared_stack_update(session);
+			}
+			if(!refresh && session->stack == NULL && !janus_sip_shared_stack_attach(session)) {
 				/* Start the thread first */
 				GError *error = NULL;
 				char tname[16];
@@ -3765,6 +4409,12 @@ static void *janus_sip_handler(void *data) {
 				JANUS_LOG(LOG_VERB, "Going to negotiate video...\n");
 				session->media.has_video = TRUE;	/* FIXME Maybe we need a better way to signal this */
 			}
+#ifdef HAVE_LIBOPUS
+			/* If the browser only offered Opus, we may be able to transcode to G.711 */
+			janus_sip_transcoder_detach(session);
+			if(transcoding_threads > 0 && session->media.has_audio)
+				janus_sip_transcoder_offer(session, parsed_sdp);
+#endif
 			janus_mutex_lock(&session->mutex);
 			if(janus_sip_allocate_local_ports(session, FALSE) < 0) {
 				janus_mutex_unlock(&session->mutex);
@@ -4194,19 +4844,7 @@ static void *janus_sip_handler(void *data) {
 			if(answer) {
 				/* Start the media */
 				session->media.ready = TRUE;	/* FIXME Maybe we need a better way to signal this */
-				GError *error = NULL;
-				char tname[16];
-				g_snprintf(tname, sizeof(tname), "siprtp %s", session->account.username);
-				janus_refcount_increase(&session->ref);
-				session->relayer_thread = g_thread_try_new(tname, janus_sip_relay_thread, session, &error);
-				if(error != NULL) {
-					session->relayer_thread = NULL;
-					session->media.ready = FALSE;
-					janus_refcount_decrease(&session->ref);
-					JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the RTP/RTCP thread...\n",
-						error->code, error->message ? error->message : "??");
-					g_error_free(error);
-				}
+				janus_sip_relay_start(session);
 			}
 		} else if(!strcasecmp(request_text, "update")) {
 			/* Update an existing call */
@@ -4325,6 +4963,11 @@ static void *janus_sip_handler(void *data) {
 				if(!offer)
 					session->media.updated = TRUE;
 			}
+#ifdef HAVE_LIBOPUS
+			/* If we're transcoding, we keep on offering G.711 to the peer */
+			if(offer && session->transcoder != NULL)
+				janus_sip_transcoder_offer(session, parsed_sdp);
+#endif
 			char *sdp = janus_sip_sdp_manipulate(session, parsed_sdp, !offer);
 			if(sdp == NULL) {
 				JANUS_LOG(LOG_ERR, "Error manipulating SDP\n");
@@ -5411,7 +6054,7 @@ void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase,
 			}
 			gboolean reinvite = FALSE, busy = FALSE;
 			if(session->stack->s_nh_i == NULL) {
-				if(g_atomic_int_get(&session->establishing) || g_atomic_int_get(&session->established) || session->relayer_thread != NULL) {
+				if(g_atomic_int_get(&session->establishing) || g_atomic_int_get(&session->established) || janus_sip_relay_is_active(session)) {
 					/* Still busy establishing another call (or maybe still cleaning up the previous call) */
 					busy = TRUE;
 				}
@@ -5435,7 +6078,7 @@ void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase,
 				while(temp != NULL) {
 					helper = (janus_sip_session *)temp->data;
 					if(helper->stack->s_nh_i == NULL && !g_atomic_int_get(&helper->establishing) &&
-							!g_atomic_int_get(&helper->established) && helper->relayer_thread == NULL) {
+							!g_atomic_int_get(&helper->established) && !janus_sip_relay_is_active(helper)) {
 						/* Found! */
 						break;
 					}
@@ -6206,19 +6849,7 @@ void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase,
 				break;
 			}
 			if(!session->media.earlymedia && !session->media.update) {
-				GError *error = NULL;
-				char tname[16];
-				g_snprintf(tname, sizeof(tname), "siprtp %s", session->account.username);
-				janus_refcount_increase(&session->ref);
-				session->relayer_thread = g_thread_try_new(tname, janus_sip_relay_thread, session, &error);
-				if(error != NULL) {
-					session->relayer_thread = NULL;
-					session->media.ready = FALSE;
-					janus_refcount_decrease(&session->ref);
-					JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the RTP/RTCP thread...\n",
-						error->code, error->message ? error->message : "??");
-					g_error_free(error);
-				}
+				janus_sip_relay_start(session);
 			}
 			/* Check if there's an isfocus feature parameter in the Contact header */
 			gboolean is_focus = FALSE;
@@ -6233,6 +6864,15 @@ void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase,
 				}
 			}
 			/* Send event back to the application */
+			char *transcoded_sdp = NULL;
+#ifdef HAVE_LIBOPUS
+			/* If we're transcoding, the browser will get Opus rather than G.711 */
+			if(session->transcoder != NULL) {
+				transcoded_sdp = janus_sip_transcoder_answer(session, sdp);
+				if(transcoded_sdp != NULL)
+					fixed_sdp = transcoded_sdp;
+			}
+#endif
 			json_t *jsep = NULL;
 			if(!session->media.earlymedia) {
 				jsep = json_pack("{ssss}", "type", "answer", "sdp", fixed_sdp);
@@ -6261,6 +6901,7 @@ void janus_sip_sofia_callback(nua_event_t event, int status, char const *phrase,
 			JANUS_LOG(LOG_VERB, "  >> Pushing event to peer: %d (%s)\n", ret, janus_get_api_error(ret));
 			json_decref(call);
 			json_decref(jsep);
+			g_free(transcoded_sdp);
 			janus_sdp_destroy(sdp);
 			/* Also notify event handlers */
 			if(!session->media.update && notify_events && gateway->events_is_enabled()) {
@@ -7202,11 +7843,481 @@ static void janus_sip_media_cleanup(janus_sip_session *session) {
 	}
 	/* Clean up SRTP stuff, if needed */
 	janus_sip_srtp_cleanup(session);
+#ifdef HAVE_LIBOPUS
+	/* Stop transcoding, if we were */
+	janus_sip_transcoder_detach(session);
+#endif
 
 	/* Media fields not cleaned up elsewhere */
 	janus_sip_media_reset(session);
 }
 
+/* Helper to resolve the remote media addresses and (re)connect the sockets,
+ * which we do when we start relaying media and after each session update */
+static void janus_sip_relay_update(janus_sip_session *session) {
+	session->media.updated = FALSE;
+	/* Resolve the addresses, if needed */
+	gboolean have_audio_server_ip = FALSE;
+	gboolean have_video_server_ip = FALSE;
+	struct sockaddr_storage audio_server_addr = { 0 }, video_server_addr = { 0 };
+	if(session->media.remote_audio_ip && strcmp(session->media.remote_audio_ip, "0.0.0.0")) {
+		if(janus_network_resolve_address(session->media.remote_audio_ip, &audio_server_addr) < 0) {
+			JANUS_LOG(LOG_ERR, "[SIP-%s] Couldn't resolve audio address '%s'\n",
+				session->account.username, session->media.remote_audio_ip);
+		} else {
+			/* Address resolved */
+			have_audio_server_ip = TRUE;
+		}
+	}
+	if(session->media.remote_video_ip && strcmp(session->media.remote_video_ip, "0.0.0.0")) {
+		if(janus_network_resolve_address(session->media.remote_video_ip, &video_server_addr) < 0) {
+			JANUS_LOG(LOG_ERR, "[SIP-%s] Couldn't resolve video address '%s'\n",
+				session->account.username, session->media.remote_video_ip);
+		} else {
+			/* Address resolved */
+			have_video_server_ip = TRUE;
+		}
+	}
+
+	if(have_audio_server_ip || have_video_server_ip) {
+		janus_sip_connect_sockets(session, have_audio_server_ip ? &audio_server_addr : NULL,
+			have_video_server_ip ? &video_server_addr : NULL);
+	} else if(session->media.remote_audio_ip == NULL && session->media.remote_video_ip == NULL) {
+		JANUS_LOG(LOG_ERR, "[SIP-%p] Couldn't update session details: both audio and video remote IP addresses are NULL\n",
+			session->account.username);
+	} else {
+		if(session->media.remote_audio_ip)
+			JANUS_LOG(LOG_ERR, "[SIP-%p] Couldn't update session details: audio remote IP address (%s) is invalid\n",
+				session->account.username, session->media.remote_audio_ip);
+		if(session->media.remote_video_ip)
+			JANUS_LOG(LOG_ERR, "[SIP-%p] Couldn't update session details: video remote IP address (%s) is invalid\n",
+				session->account.username, session->media.remote_video_ip);
+	}
+
+	/* In case we're on hold (remote address is 0.0.0.0) set the send properties to FALSE */
+	if(have_audio_server_ip && !strcmp(session->media.remote_audio_ip, "0.0.0.0")) {
+		session->media.audio_send = FALSE;
+		session->media.audio_recv = FALSE;
+	}
+	if(have_video_server_ip && !strcmp(session->media.remote_video_ip, "0.0.0.0")) {
+		session->media.video_send = FALSE;
+		session->media.video_recv = FALSE;
+	}
+}
+
+/* Helper to check an error on one of the media sockets: ICMP errors on RTCP
+ * sockets just get them closed, while other errors are only considered fatal
+ * when they keep on happening; returns TRUE if the media session is over */
+static gboolean janus_sip_relay_error(janus_sip_session *session, int fd, int *pollerrs) {
+	/* Check the socket error */
+	int error = 0;
+	socklen_t errlen = sizeof(error);
+	getsockopt(fd, SOL_SOCKET, SO_ERROR, (void *)&error, &errlen);
+	if(error == 0) {
+		/* Maybe not a breaking error after all? */
+		return FALSE;
+	} else if(error == 111) {
+		/* ICMP error? If it's related to RTCP, let's just close the RTCP socket and move on */
+		if(fd == session->media.audio_rtcp_fd) {
+			JANUS_LOG(LOG_WARN, "[SIP-%s] Got a '%s' on the audio RTCP socket, closing it\n",
+				session->account.username, g_strerror(error));
+			janus_mutex_lock(&session->mutex);
+			close(session->media.audio_rtcp_fd);
+			session->media.audio_rtcp_fd = -1;
+			janus_mutex_unlock(&session->mutex);
+			return FALSE;
+		} else if(fd == session->media.video_rtcp_fd) {
+			JANUS_LOG(LOG_WARN, "[SIP-%s] Got a '%s' on the video RTCP socket, closing it\n",
+				session->account.username, g_strerror(error));
+			janus_mutex_lock(&session->mutex);
+			close(session->media.video_rtcp_fd);
+			session->media.video_rtcp_fd = -1;
+			janus_mutex_unlock(&session->mutex);
+			return FALSE;
+		}
+	}
+	/* FIXME Should we be more tolerant of ICMP errors on RTP sockets as well? */
+	(*pollerrs)++;
+	if(*pollerrs < 100)
+		return FALSE;
+	JANUS_LOG(LOG_ERR, "[SIP-%s] Too many errors polling socket %d...\n", session->account.username, fd);
+	JANUS_LOG(LOG_ERR, "[SIP-%s]   -- %d (%s)\n", session->account.username, error, g_strerror(error));
+	return TRUE;
+}
+
+/* Helper to process a packet we received from the SIP peer on one of the
+ * media sockets, and relay it to the application: returns TRUE if it was
+ * a valid RTP/RTCP packet, even if we ended up dropping it */
+static gboolean janus_sip_relay_packet(janus_sip_session *session, int fd, char *buffer, int bytes) {
+	if(fd == session->media.audio_rtp_fd) {
+		/* Got something audio (RTP) */
+		if(bytes < 0 || !janus_is_rtp(buffer, bytes)) {
+			/* Failed to read or not an RTP packet? */
+			return FALSE;
+		}
+		if(!session->media.audio_recv) {
+			/* Dropping audio packet, we weren't expecting anything */
+			return TRUE;
+		}
+		if(session->media.on_hold && session->media.hold_audio_dir != JANUS_SDP_RECVONLY) {
+			/* Dropping video packet, the call is on hold and we're not receiving anything */
+			return TRUE;
+		}
+		janus_rtp_header *header = (janus_rtp_header *)buffer;
+		janus_sip_check_rfc2833(session, buffer, bytes);
+		if(session->media.audio_ssrc_peer == 0) {
+			session->media.audio_ssrc_peer = ntohl(header->ssrc);
+			JANUS_LOG(LOG_VERB, "Got SIP peer audio SSRC: %"SCNu32"\n", session->media.audio_ssrc_peer);
+		}
+		/* Is this SRTP? */
+		if(session->media.has_srtp_remote_audio) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect(session->media.audio_srtp_in, buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				guint32 timestamp = ntohl(header->timestamp);
+				guint16 seq = ntohs(header->seq_number);
+				JANUS_LOG(LOG_ERR, "[SIP-%s] Audio SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
+					session->account.username, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
+				return TRUE;
+			}
+			bytes = buflen;
+		}
+		/* Keep track of loss and jitter, using the original sequence numbers and timestamps */
+		if(session->media.audio_stats.tb == 0) {
+			session->media.audio_stats.tb = (session->media.audio_pt_name &&
+				!strcasecmp(session->media.audio_pt_name, "opus")) ? 48000 : 8000;
+		}
+		janus_rtcp_process_incoming_rtp(&session->media.audio_stats, buffer, bytes, FALSE, FALSE, TRUE, NULL);
+		/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
+		janus_rtp_header_update(header, &session->media.acontext, FALSE, 0);
+		/* Save the frame if we're recording */
+		header->ssrc = htonl(session->media.audio_ssrc_peer);
+		janus_recorder_save_frame(session->arc_peer, buffer, bytes);
+#ifdef HAVE_LIBOPUS
+		/* If the browser didn't negotiate this codec, the transcoder will take care of this */
+		if(session->transcoder != NULL && janus_sip_transcoder_push(session, TRUE, buffer, bytes))
+			return TRUE;
+#endif
+		/* Relay to application */
+		janus_plugin_rtp rtp = { .mindex = -1, .video = FALSE, .buffer = buffer, .length = bytes };
+		janus_plugin_rtp_extensions_reset(&rtp.extensions);
+		/* Add audio-level extension, if present */
+		if(session->media.audio_level_extension_id != -1) {
+			gboolean vad = FALSE;
+			int level = -1;
+			if(janus_rtp_header_extension_parse_audio_level(buffer, bytes,
+					session->media.audio_level_extension_id, &vad, &level) == 0) {
+				rtp.extensions.audio_level = level;
+				rtp.extensions.audio_level_vad = vad;
+			}
+		}
+		gateway->relay_rtp(session->handle, &rtp);
+		return TRUE;
+	} else if(fd == session->media.audio_rtcp_fd) {
+		/* Got something audio (RTCP) */
+		if(bytes < 0 || !janus_is_rtcp(buffer, bytes)) {
+			/* Failed to read or not an RTCP packet? */
+			return FALSE;
+		}
+		if(!session->media.video_recv) {
+			/* Dropping video packet, we weren't expecting anything */
+			return TRUE;
+		}
+		if(session->media.on_hold && session->media.hold_video_dir != JANUS_SDP_RECVONLY) {
+			/* Dropping video packet, the call is on hold and we're not receiving anything */
+			return TRUE;
+		}
+		/* Is this SRTCP? */
+		if(session->media.has_srtp_remote_audio) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect_rtcp(session->media.audio_srtp_in, buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				JANUS_LOG(LOG_ERR, "[SIP-%s] Audio SRTCP unprotect error: %s (len=%d-->%d)\n",
+					session->account.username, janus_srtp_error_str(res), bytes, buflen);
+				return TRUE;
+			}
+			bytes = buflen;
+		}
+		/* Relay to application */
+		janus_plugin_rtcp rtcp = { .mindex = -1, .video = FALSE, .buffer = buffer, bytes };
+		gateway->relay_rtcp(session->handle, &rtcp);
+		return TRUE;
+	} else if(fd == session->media.video_rtp_fd) {
+		/* Got something video (RTP) */
+		if(bytes < 0 || !janus_is_rtp(buffer, bytes)) {
+			/* Failed to read or not an RTP packet? */
+			return FALSE;
+		}
+		janus_rtp_header *header = (janus_rtp_header *)buffer;
+		if(session->media.video_ssrc_peer == 0) {
+			session->media.video_ssrc_peer = ntohl(header->ssrc);
+			JANUS_LOG(LOG_VERB, "Got SIP peer video SSRC: %"SCNu32"\n", session->media.video_ssrc_peer);
+		}
+		/* Is this SRTP? */
+		if(session->media.has_srtp_remote_video) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect(session->media.video_srtp_in, buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				guint32 timestamp = ntohl(header->timestamp);
+				guint16 seq = ntohs(header->seq_number);
+				JANUS_LOG(LOG_ERR, "[SIP-%s] Video SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
+					session->account.username, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
+				return TRUE;
+			}
+			bytes = buflen;
+		}
+		/* Keep track of loss and jitter, using the original sequence numbers and timestamps */
+		if(session->media.video_stats.tb == 0)
+			session->media.video_stats.tb = 90000;
+		janus_rtcp_process_incoming_rtp(&session->media.video_stats, buffer, bytes, FALSE, FALSE, FALSE, NULL);
+		/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
+		janus_rtp_header_update(header, &session->media.vcontext, TRUE, 0);
+		/* Save the frame if we're recording */
+		header->ssrc = htonl(session->media.video_ssrc_peer);
+		janus_recorder_save_frame(session->vrc_peer, buffer, bytes);
+		/* Relay to application */
+		janus_plugin_rtp rtp = { .mindex = -1, .video = TRUE, .buffer = buffer, .length = bytes };
+		janus_plugin_rtp_extensions_reset(&rtp.extensions);
+		/* Add video-orientation extension, if present */
+		if(session->media.video_orientation_extension_id > 0) {
+			gboolean c = FALSE, f = FALSE, r1 = FALSE, r0 = FALSE;
+			if(janus_rtp_header_extension_parse_video_orientation(buffer, bytes,
+					session->media.video_orientation_extension_id, &c, &f, &r1, &r0) == 0) {
+				rtp.extensions.video_rotation = 0;
+				if(r1 && r0)
+					rtp.extensions.video_rotation = 270;
+				else if(r1)
+					rtp.extensions.video_rotation = 180;
+				else if(r0)
+					rtp.extensions.video_rotation = 90;
+				rtp.extensions.video_back_camera = c;
+				rtp.extensions.video_flipped = f;
+			}
+		}
+		gateway->relay_rtp(session->handle, &rtp);
+		return TRUE;
+	} else if(fd == session->media.video_rtcp_fd) {
+		/* Got something video (RTCP) */
+		if(bytes < 0 || !janus_is_rtcp(buffer, bytes)) {
+			/* Failed to read or not an RTCP packet? */
+			return FALSE;
+		}
+		/* Is this SRTCP? */
+		if(session->media.has_srtp_remote_video) {
+			int buflen = bytes;
+			srtp_err_status_t res = srtp_unprotect_rtcp(session->media.video_srtp_in, buffer, &buflen);
+			if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
+				JANUS_LOG(LOG_ERR, "[SIP-%s] Video SRTP unprotect error: %s (len=%d-->%d)\n",
+					session->account.username, janus_srtp_error_str(res), bytes, buflen);
+				return TRUE;
+			}
+			bytes = buflen;
+		}
+		/* Relay to application */
+		janus_plugin_rtcp rtcp = { .mindex = -1, .video = TRUE, .buffer = buffer, bytes };
+		gateway->relay_rtcp(session->handle, &rtcp);
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/* Media served by the core reactor, rather than by a thread per call: the
+ * RTP/RTCP sockets and the pipe are watched by the shared event loops, and
+ * the same helpers the relay thread uses are invoked when they're readable.
+ * Since each socket may be served by a different loop, the callbacks
+ * are serialized with a mutex, which also protects the watches */
+static void janus_sip_relay_free(const janus_refcount *relay_ref) {
+	janus_sip_relay *relay = janus_refcount_containerof(relay_ref, janus_sip_relay, ref);
+	if(relay->session != NULL)
+		janus_refcount_decrease(&relay->session->ref);
+	janus_mutex_destroy(&relay->mutex);
+	g_free(relay);
+}
+static void janus_sip_relay_unref(gpointer data) {
+	janus_sip_relay *relay = (janus_sip_relay *)data;
+	janus_refcount_decrease(&relay->ref);
+}
+static gboolean janus_sip_relay_callback(int fd, gboolean error, void *user_data);
+/* Make sure we're watching the media sockets we currently have (called with the relay mutex locked) */
+static void janus_sip_relay_sync(janus_sip_relay *relay) {
+	janus_sip_session *session = relay->session;
+	int fds[JANUS_SIP_RELAY_SOCKETS] = {
+		session->media.audio_rtp_fd, session->media.audio_rtcp_fd,
+		session->media.video_rtp_fd, session->media.video_rtcp_fd
+	};
+	int i = 0;
+	for(i=0; i<JANUS_SIP_RELAY_SOCKETS; i++) {
+		if(relay->fds[i] == fds[i] && (fds[i] == -1 || relay->watches[i] != NULL))
+			continue;
+		if(relay->watches[i] != NULL) {
+			janus_reactor_unwatch(relay->watches[i]);
+			relay->watches[i] = NULL;
+		}
+		relay->fds[i] = fds[i];
+		if(fds[i] == -1)
+			continue;
+		janus_refcount_increase(&relay->ref);
+		relay->watches[i] = janus_reactor_watch_fd(fds[i], janus_sip_relay_callback, relay, janus_sip_relay_unref);
+		if(relay->watches[i] == NULL) {
+			JANUS_LOG(LOG_ERR, "[SIP-%s] Couldn't watch media socket %d\n", session->account.username, fds[i]);
+			janus_refcount_decrease(&relay->ref);
+		}
+	}
+}
+/* We're done with the media session (called with the relay mutex locked) */
+static void janus_sip_relay_finish(janus_sip_relay *relay) {
+	relay->done = TRUE;
+	int i = 0;
+	for(i=0; i<=JANUS_SIP_RELAY_SOCKETS; i++) {
+		if(relay->watches[i] != NULL) {
+			janus_reactor_unwatch(relay->watches[i]);
+			relay->watches[i] = NULL;
+		}
+		relay->fds[i] = -1;
+	}
+	/* Cleanup the media session */
+	janus_sip_session *session = relay->session;
+	janus_mutex_lock(&session->mutex);
+	session->relay = NULL;
+	janus_sip_media_cleanup(session);
+	janus_mutex_unlock(&session->mutex);
+	JANUS_LOG(LOG_VERB, "[SIP-%s] Done relaying media on the reactor\n", session->account.username);
+	/* Get rid of the reference the session had (the watch we're in still has one) */
+	janus_refcount_decrease(&relay->ref);
+}
+static gboolean janus_sip_relay_callback(int fd, gboolean error, void *user_data) {
+	janus_sip_relay *relay = (janus_sip_relay *)user_data;
+	janus_mutex_lock(&relay->mutex);
+	if(relay->done) {
+		janus_mutex_unlock(&relay->mutex);
+		return FALSE;
+	}
+	janus_sip_session *session = relay->session;
+	if(g_atomic_int_get(&session->destroyed) || session->media.pipefd[0] == -1 ||
+			session->status <= janus_sip_call_status_idle ||
+			session->status >= janus_sip_call_status_closing) {
+		janus_sip_relay_finish(relay);
+		janus_mutex_unlock(&relay->mutex);
+		return FALSE;
+	}
+	if(fd == relay->fds[JANUS_SIP_RELAY_SOCKETS]) {
+		/* We've been woken up for a reason, check if there was a session update */
+		int code = 0;
+		if(error || read(fd, &code, sizeof(int)) == 0) {
+			/* Pipe was closed? Means the call is over */
+			janus_sip_relay_finish(relay);
+			janus_mutex_unlock(&relay->mutex);
+			return FALSE;
+		}
+		if(session->media.updated)
+			janus_sip_relay_update(session);
+		janus_sip_relay_sync(relay);
+		janus_mutex_unlock(&relay->mutex);
+		return TRUE;
+	}
+	if(fd != session->media.audio_rtp_fd && fd != session->media.audio_rtcp_fd &&
+			fd != session->media.video_rtp_fd && fd != session->media.video_rtcp_fd) {
+		/* Not one of our sockets anymore, the next sync will get rid of the watch */
+		janus_mutex_unlock(&relay->mutex);
+		return FALSE;
+	}
+	if(error) {
+		/* If we just updated the session, let's wait until things have calmed down */
+		if(!session->media.updated && janus_sip_relay_error(session, fd, &relay->pollerrs)) {
+			/* Can we assume it's pretty much over, after a POLLERR? */
+			janus_sip_relay_finish(relay);
+			janus_mutex_unlock(&relay->mutex);
+			/* FIXME Simulate a "hangup" coming from the application */
+			janus_sip_hangup_media(session->handle);
+			return FALSE;
+		}
+		/* The socket may have been closed, in case this was an ICMP error on RTCP */
+		gboolean keep = (fd == session->media.audio_rtp_fd || fd == session->media.audio_rtcp_fd ||
+			fd == session->media.video_rtp_fd || fd == session->media.video_rtcp_fd);
+		janus_mutex_unlock(&relay->mutex);
+		return keep;
+	}
+	/* Got RTP/RTCP packets: read as many as we can in a single call, if possible */
+#ifdef HAVE_RECVMMSG
+	int res = recvmmsg(fd, relay->msgs, JANUS_SIP_RELAY_RECV_BATCH, MSG_DONTWAIT, NULL);
+	int i = 0;
+	for(i=0; i<res; i++) {
+		if(janus_sip_relay_packet(session, fd, relay->buffers[i], relay->msgs[i].msg_len))
+			relay->pollerrs = 0;
+	}
+#else
+	int bytes = recvfrom(fd, relay->buffers[0], sizeof(relay->buffers[0]), MSG_DONTWAIT, NULL, NULL);
+	if(bytes > 0 && janus_sip_relay_packet(session, fd, relay->buffers[0], bytes))
+		relay->pollerrs = 0;
+#endif
+	janus_mutex_unlock(&relay->mutex);
+	return TRUE;
+}
+/* Start relaying the media of a session on the reactor */
+static int janus_sip_relay_watch(janus_sip_session *session) {
+	if(session->media.pipefd[0] == -1)
+		return -1;
+	janus_sip_relay *relay = g_malloc0(sizeof(janus_sip_relay));
+	relay->session = session;
+	janus_mutex_init(&relay->mutex);
+	janus_refcount_init(&relay->ref, janus_sip_relay_free);
+	int i = 0;
+	for(i=0; i<=JANUS_SIP_RELAY_SOCKETS; i++)
+		relay->fds[i] = -1;
+#ifdef HAVE_RECVMMSG
+	for(i=0; i<JANUS_SIP_RELAY_RECV_BATCH; i++) {
+		relay->iovecs[i].iov_base = relay->buffers[i];
+		relay->iovecs[i].iov_len = sizeof(relay->buffers[i]);
+		relay->msgs[i].msg_hdr.msg_iov = &relay->iovecs[i];
+		relay->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+#endif
+	/* We start by watching the pipe: we'll connect and watch the sockets as soon as it wakes us up */
+	janus_mutex_lock(&relay->mutex);
+	session->media.updated = TRUE;
+	relay->fds[JANUS_SIP_RELAY_SOCKETS] = session->media.pipefd[0];
+	janus_refcount_increase(&relay->ref);
+	relay->watches[JANUS_SIP_RELAY_SOCKETS] = janus_reactor_watch_fd(session->media.pipefd[0],
+		janus_sip_relay_callback, relay, janus_sip_relay_unref);
+	if(relay->watches[JANUS_SIP_RELAY_SOCKETS] == NULL) {
+		janus_mutex_unlock(&relay->mutex);
+		/* The session reference is not ours to release, in this case */
+		relay->session = NULL;
+		janus_refcount_decrease(&relay->ref);
+		janus_refcount_decrease(&relay->ref);
+		return -1;
+	}
+	session->relay = relay;
+	janus_mutex_unlock(&relay->mutex);
+	JANUS_LOG(LOG_VERB, "[SIP-%s] Relaying media on the reactor (%s <--> %s)\n",
+		session->account.username, session->account.username, session->callee);
+	janus_sip_relay_wakeup(session);
+	return 0;
+}
+
+/* Helper to start relaying the media of a call, either on the core reactor
+ * (if media_reactor is enabled) or in a thread of its own */
+static void janus_sip_relay_start(janus_sip_session *session) {
+	janus_refcount_increase(&session->ref);
+	if(media_reactor && session->account.username && session->callee) {
+		if(janus_sip_relay_watch(session) == 0)
+			return;
+		JANUS_LOG(LOG_WARN, "[SIP-%s] Couldn't relay media on the reactor, using a thread\n", session->account.username);
+	}
+	GError *error = NULL;
+	char tname[16];
+	g_snprintf(tname, sizeof(tname), "siprtp %s", session->account.username);
+	session->relayer_thread = g_thread_try_new(tname, janus_sip_relay_thread, session, &error);
+	if(error != NULL) {
+		session->relayer_thread = NULL;
+		session->media.ready = FALSE;
+		janus_refcount_decrease(&session->ref);
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the RTP/RTCP thread...\n",
+			error->code, error->message ? error->message : "??");
+		g_error_free(error);
+	}
+}
+
 /* Thread to relay RTP/RTCP frames coming from the SIP peer */
 static void *janus_sip_relay_thread(void *data) {
 	janus_sip_session *session = (janus_sip_session *)data;
@@ -7248,8 +8359,6 @@ static void *janus_sip_relay_thread(void *data) {
 	gboolean goon = TRUE;
 
 	session->media.updated = TRUE; /* Connect UDP sockets upon loop entry */
-	gboolean have_audio_server_ip = TRUE;
-	gboolean have_video_server_ip = TRUE;
 
 	while(goon && session != NULL && !g_atomic_int_get(&session->destroyed) &&
 			session->status > janus_sip_call_status_idle &&
@@ -7257,55 +8366,7 @@ static void *janus_sip_relay_thread(void *data) {
 
 		if(session->media.updated) {
 			/* Apparently there was a session update, or the loop has just been entered */
-			session->media.updated = FALSE;
-
-			/* Resolve the addresses, if needed */
-			have_audio_server_ip = FALSE;
-			have_video_server_ip = FALSE;
-			struct sockaddr_storage audio_server_addr = { 0 }, video_server_addr = { 0 };
-			if(session->media.remote_audio_ip && strcmp(session->media.remote_audio_ip, "0.0.0.0")) {
-				if(janus_network_resolve_address(session->media.remote_audio_ip, &audio_server_addr) < 0) {
-					JANUS_LOG(LOG_ERR, "[SIP-%s] Couldn't resolve audio address '%s'\n",
-						session->account.username, session->media.remote_audio_ip);
-				} else {
-					/* Address resolved */
-					have_audio_server_ip = TRUE;
-				}
-			}
-			if(session->media.remote_video_ip && strcmp(session->media.remote_video_ip, "0.0.0.0")) {
-				if(janus_network_resolve_address(session->media.remote_video_ip, &video_server_addr) < 0) {
-					JANUS_LOG(LOG_ERR, "[SIP-%s] Couldn't resolve video address '%s'\n",
-						session->account.username, session->media.remote_video_ip);
-				} else {
-					/* Address resolved */
-					have_video_server_ip = TRUE;
-				}
-			}
-
-			if(have_audio_server_ip || have_video_server_ip) {
-				janus_sip_connect_sockets(session, have_audio_server_ip ? &audio_server_addr : NULL,
-					have_video_server_ip ? &video_server_addr : NULL);
-			} else if(session->media.remote_audio_ip == NULL && session->media.remote_video_ip == NULL) {
-				JANUS_LOG(LOG_ERR, "[SIP-%p] Couldn't update session details: both audio and video remote IP addresses are NULL\n",
-					session->account.username);
-			} else {
-				if(session->media.remote_audio_ip)
-					JANUS_LOG(LOG_ERR, "[SIP-%p] Couldn't update session details: audio remote IP address (%s) is invalid\n",
-						session->account.username, session->media.remote_audio_ip);
-				if(session->media.remote_video_ip)
-					JANUS_LOG(LOG_ERR, "[SIP-%p] Couldn't update session details: video remote IP address (%s) is invalid\n",
-						session->account.username, session->media.remote_video_ip);
-			}
-
-			/* In case we're on hold (remote address is 0.0.0.0) set the send properties to FALSE */
-			if(have_audio_server_ip && !strcmp(session->media.remote_audio_ip, "0.0.0.0")) {
-				session->media.audio_send = FALSE;
-				session->media.audio_recv = FALSE;
-			}
-			if(have_video_server_ip && !strcmp(session->media.remote_video_ip, "0.0.0.0")) {
-				session->media.video_send = FALSE;
-				session->media.video_recv = FALSE;
-			}
+			janus_sip_relay_update(session);
 		}
 
 		/* Prepare poll */
@@ -7368,40 +8429,8 @@ static void *janus_sip_relay_thread(void *data) {
 				/* If we just updated the session, let's wait until things have calmed down */
 				if(session->media.updated)
 					break;
-				/* Check the socket error */
-				int error = 0;
-				socklen_t errlen = sizeof(error);
-				getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, (void *)&error, &errlen);
-				if(error == 0) {
-					/* Maybe not a breaking error after all? */
-					continue;
-				} else if(error == 111) {
-					/* ICMP error? If it's related to RTCP, let's just close the RTCP socket and move on */
-					if(fds[i].fd == session->media.audio_rtcp_fd) {
-						JANUS_LOG(LOG_WARN, "[SIP-%s] Got a '%s' on the audio RTCP socket, closing it\n",
-							session->account.username, g_strerror(error));
-						janus_mutex_lock(&session->mutex);
-						close(session->media.audio_rtcp_fd);
-						session->media.audio_rtcp_fd = -1;
-						janus_mutex_unlock(&session->mutex);
-						continue;
-					} else if(fds[i].fd == session->media.video_rtcp_fd) {
-						JANUS_LOG(LOG_WARN, "[SIP-%s] Got a '%s' on the video RTCP socket, closing it\n",
-							session->account.username, g_strerror(error));
-						janus_mutex_lock(&session->mutex);
-						close(session->media.video_rtcp_fd);
-						session->media.video_rtcp_fd = -1;
-						janus_mutex_unlock(&session->mutex);
-						continue;
-					}
-				}
-				/* FIXME Should we be more tolerant of ICMP errors on RTP sockets as well? */
-				pollerrs++;
-				if(pollerrs < 100)
+				if(!janus_sip_relay_error(session, fds[i].fd, &pollerrs))
 					continue;
-				JANUS_LOG(LOG_ERR, "[SIP-%s] Too many errors polling %d (socket #%d): %s...\n", session->account.username,
-					fds[i].fd, i, fds[i].revents & POLLERR ? "POLLERR" : "POLLHUP");
-				JANUS_LOG(LOG_ERR, "[SIP-%s]   -- %d (%s)\n", session->account.username, error, g_strerror(error));
 				goon = FALSE;	/* Can we assume it's pretty much over, after a POLLERR? */
 				/* FIXME Simulate a "hangup" coming from the application */
 				janus_sip_hangup_media(session->handle);
@@ -7414,172 +8443,10 @@ static void *janus_sip_relay_thread(void *data) {
 					break;
 				}
 				/* Got an RTP/RTCP packet */
-				if(session->media.audio_rtp_fd != -1 && fds[i].fd == session->media.audio_rtp_fd) {
-					/* Got something audio (RTP) */
-					addrlen = sizeof(remote);
-					bytes = recvfrom(session->media.audio_rtp_fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
-					if(bytes < 0 || !janus_is_rtp(buffer, bytes)) {
-						/* Failed to read or not an RTP packet? */
-						continue;
-					}
-					pollerrs = 0;
-					if(!session->media.audio_recv) {
-						/* Dropping audio packet, we weren't expecting anything */
-						continue;
-					}
-					if(session->media.on_hold && session->media.hold_audio_dir != JANUS_SDP_RECVONLY) {
-						/* Dropping video packet, the call is on hold and we're not receiving anything */
-						continue;
-					}
-					janus_rtp_header *header = (janus_rtp_header *)buffer;
-					janus_sip_check_rfc2833(session, buffer, bytes);
-					if(session->media.audio_ssrc_peer == 0) {
-						session->media.audio_ssrc_peer = ntohl(header->ssrc);
-						JANUS_LOG(LOG_VERB, "Got SIP peer audio SSRC: %"SCNu32"\n", session->media.audio_ssrc_peer);
-					}
-					/* Is this SRTP? */
-					if(session->media.has_srtp_remote_audio) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect(session->media.audio_srtp_in, buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							guint32 timestamp = ntohl(header->timestamp);
-							guint16 seq = ntohs(header->seq_number);
-							JANUS_LOG(LOG_ERR, "[SIP-%s] Audio SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
-								session->account.username, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
-					janus_rtp_header_update(header, &session->media.acontext, FALSE, 0);
-					/* Save the frame if we're recording */
-					header->ssrc = htonl(session->media.audio_ssrc_peer);
-					janus_recorder_save_frame(session->arc_peer, buffer, bytes);
-					/* Relay to application */
-					janus_plugin_rtp rtp = { .mindex = -1, .video = FALSE, .buffer = buffer, .length = bytes };
-					janus_plugin_rtp_extensions_reset(&rtp.extensions);
-					/* Add audio-level extension, if present */
-					if(session->media.audio_level_extension_id != -1) {
-						gboolean vad = FALSE;
-						int level = -1;
-						if(janus_rtp_header_extension_parse_audio_level(buffer, bytes,
-								session->media.audio_level_extension_id, &vad, &level) == 0) {
-							rtp.extensions.audio_level = level;
-							rtp.extensions.audio_level_vad = vad;
-						}
-					}
-					gateway->relay_rtp(session->handle, &rtp);
-					continue;
-				} else if(session->media.audio_rtcp_fd != -1 && fds[i].fd == session->media.audio_rtcp_fd) {
-					/* Got something audio (RTCP) */
-					addrlen = sizeof(remote);
-					bytes = recvfrom(session->media.audio_rtcp_fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
-					if(bytes < 0 || !janus_is_rtcp(buffer, bytes)) {
-						/* Failed to read or not an RTCP packet? */
-						continue;
-					}
-					pollerrs = 0;
-					if(!session->media.video_recv) {
-						/* Dropping video packet, we weren't expecting anything */
-						continue;
-					}
-					if(session->media.on_hold && session->media.hold_video_dir != JANUS_SDP_RECVONLY) {
-						/* Dropping video packet, the call is on hold and we're not receiving anything */
-						continue;
-					}
-					/* Is this SRTCP? */
-					if(session->media.has_srtp_remote_audio) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect_rtcp(session->media.audio_srtp_in, buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							JANUS_LOG(LOG_ERR, "[SIP-%s] Audio SRTCP unprotect error: %s (len=%d-->%d)\n",
-								session->account.username, janus_srtp_error_str(res), bytes, buflen);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Relay to application */
-					janus_plugin_rtcp rtcp = { .mindex = -1, .video = FALSE, .buffer = buffer, bytes };
-					gateway->relay_rtcp(session->handle, &rtcp);
-					continue;
-				} else if(session->media.video_rtp_fd != -1 && fds[i].fd == session->media.video_rtp_fd) {
-					/* Got something video (RTP) */
-					addrlen = sizeof(remote);
-					bytes = recvfrom(session->media.video_rtp_fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
-					if(bytes < 0 || !janus_is_rtp(buffer, bytes)) {
-						/* Failed to read or not an RTP packet? */
-						continue;
-					}
-					pollerrs = 0;
-					janus_rtp_header *header = (janus_rtp_header *)buffer;
-					if(session->media.video_ssrc_peer == 0) {
-						session->media.video_ssrc_peer = ntohl(header->ssrc);
-						JANUS_LOG(LOG_VERB, "Got SIP peer video SSRC: %"SCNu32"\n", session->media.video_ssrc_peer);
-					}
-					/* Is this SRTP? */
-					if(session->media.has_srtp_remote_video) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect(session->media.video_srtp_in, buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							guint32 timestamp = ntohl(header->timestamp);
-							guint16 seq = ntohs(header->seq_number);
-							JANUS_LOG(LOG_ERR, "[SIP-%s] Video SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
-								session->account.username, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Check if the SSRC changed (e.g., after a re-INVITE or UPDATE) */
-					janus_rtp_header_update(header, &session->media.vcontext, TRUE, 0);
-					/* Save the frame if we're recording */
-					header->ssrc = htonl(session->media.video_ssrc_peer);
-					janus_recorder_save_frame(session->vrc_peer, buffer, bytes);
-					/* Relay to application */
-					janus_plugin_rtp rtp = { .mindex = -1, .video = TRUE, .buffer = buffer, .length = bytes };
-					janus_plugin_rtp_extensions_reset(&rtp.extensions);
-					/* Add video-orientation extension, if present */
-					if(session->media.video_orientation_extension_id > 0) {
-						gboolean c = FALSE, f = FALSE, r1 = FALSE, r0 = FALSE;
-						if(janus_rtp_header_extension_parse_video_orientation(buffer, bytes,
-								session->media.video_orientation_extension_id, &c, &f, &r1, &r0) == 0) {
-							rtp.extensions.video_rotation = 0;
-							if(r1 && r0)
-								rtp.extensions.video_rotation = 270;
-							else if(r1)
-								rtp.extensions.video_rotation = 180;
-							else if(r0)
-								rtp.extensions.video_rotation = 90;
-							rtp.extensions.video_back_camera = c;
-							rtp.extensions.video_flipped = f;
-						}
-					}
-					gateway->relay_rtp(session->handle, &rtp);
-					continue;
-				} else if(session->media.video_rtcp_fd != -1 && fds[i].fd == session->media.video_rtcp_fd) {
-					/* Got something video (RTCP) */
-					addrlen = sizeof(remote);
-					bytes = recvfrom(session->media.video_rtcp_fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
-					if(bytes < 0 || !janus_is_rtcp(buffer, bytes)) {
-						/* Failed to read or not an RTCP packet? */
-						continue;
-					}
+				addrlen = sizeof(remote);
+				bytes = recvfrom(fds[i].fd, buffer, 1500, 0, (struct sockaddr*)&remote, &addrlen);
+				if(janus_sip_relay_packet(session, fds[i].fd, buffer, bytes))
 					pollerrs = 0;
-					/* Is this SRTCP? */
-					if(session->media.has_srtp_remote_video) {
-						int buflen = bytes;
-						srtp_err_status_t res = srtp_unprotect_rtcp(session->media.video_srtp_in, buffer, &buflen);
-						if(res != srtp_err_status_ok && res != srtp_err_status_replay_fail && res != srtp_err_status_replay_old) {
-							JANUS_LOG(LOG_ERR, "[SIP-%s] Video SRTP unprotect error: %s (len=%d-->%d)\n",
-								session->account.username, janus_srtp_error_str(res), bytes, buflen);
-							continue;
-						}
-						bytes = buflen;
-					}
-					/* Relay to application */
-					janus_plugin_rtcp rtcp = { .mindex = -1, .video = TRUE, .buffer = buffer, bytes };
-					gateway->relay_rtcp(session->handle, &rtcp);
-					continue;
-				}
 			}
 		}
 	}
@@ -7685,6 +8552,286 @@ gpointer janus_sip_sofia_thread(gpointer user_data) {
 	return NULL;
 }
 
+/* Shared Sofia Event thread */
+gpointer janus_sip_shared_stack_thread(gpointer user_data) {
+	janus_sip_shared_stack *shared = (janus_sip_shared_stack *)user_data;
+	JANUS_LOG(LOG_VERB, "Joining shared sofia loop thread #%d...\n", shared->index+1);
+	su_root_t *s_root = su_root_create(NULL);
+	if(s_root == NULL) {
+		JANUS_LOG(LOG_ERR, "Error creating the root of shared sofia stack #%d\n", shared->index+1);
+		return NULL;
+	}
+	/* Accounts sharing a stack can't ask for TCP or SIPS, or a custom User-Agent:
+	 * as such, we only need the generic settings, as there's no contact user either */
+	char sip_url[128];
+	char *ipv6 = strstr(local_ip, ":");
+	g_snprintf(sip_url, sizeof(sip_url), "sip:%s%s%s:*;transport=udp", ipv6 ? "[" : "", local_ip, ipv6 ? "]" : "");
+	char outbound_options[256] = "use-rport no-validate";
+	if(keepalive_interval > 0)
+		janus_strlcat(outbound_options, " options-keepalive", sizeof(outbound_options));
+	if(!behind_nat)
+		janus_strlcat(outbound_options, " no-natify", sizeof(outbound_options));
+	nua_t *s_nua = nua_create(s_root,
+				janus_sip_shared_stack_callback,
+				(nua_magic_t *)shared,
+				SIPTAG_ALLOW_STR("INVITE, ACK, BYE, CANCEL, OPTIONS, REFER, MESSAGE, INFO, NOTIFY"),
+				NUTAG_URL(sip_url),
+				SIPTAG_USER_AGENT_STR(user_agent),
+				NUTAG_KEEPALIVE(keepalive_interval * 1000),	/* Sofia expects it in milliseconds */
+				NUTAG_OUTBOUND(outbound_options),
+				NUTAG_APPL_METHOD("REFER"),			/* We'll respond to incoming REFER messages ourselves */
+				SIPTAG_SUPPORTED_STR("replaces"),	/* Advertise that we support the Replaces header */
+				SIPTAG_SUPPORTED(NULL),
+				NTATAG_SIP_T1X64(sip_timer_t1x64),
+				TAG_NULL());
+	if(s_nua == NULL) {
+		JANUS_LOG(LOG_ERR, "Error creating shared sofia stack #%d\n", shared->index+1);
+		su_root_destroy(s_root);
+		return NULL;
+	}
+	janus_mutex_lock(&shared->mutex);
+	shared->s_root = s_root;
+	shared->s_nua = s_nua;
+	janus_mutex_unlock(&shared->mutex);
+	/* There's no contact user for the whole stack, so we'll always
+	 * add a Contact header ourselves, using the address we get here */
+	nua_get_params(s_nua, SIPTAG_FROM_STR(""), TAG_END());
+	/* Registration refreshes and keep-alives of all the accounts are
+	 * timers of this root, so they're all served by this loop alone */
+	su_root_run(s_root);
+	/* When we get here, we're done */
+	janus_mutex_lock(&shared->mutex);
+	shared->s_nua = NULL;
+	shared->s_root = NULL;
+	janus_mutex_unlock(&shared->mutex);
+	nua_destroy(s_nua);
+	su_root_destroy(s_root);
+	JANUS_LOG(LOG_VERB, "Leaving shared sofia loop thread #%d...\n", shared->index+1);
+	return NULL;
+}
+
+/* Helper to build the Contact header of an account on a shared stack */
+static char *janus_sip_shared_stack_contact(janus_sip_shared_stack *shared, const char *user) {
+	if(shared->contact == NULL || user == NULL)
+		return NULL;
+	const char *uri = strstr(shared->contact, "sip:");
+	if(uri == NULL)
+		return NULL;
+	uri += strlen("sip:");
+	/* Skip the user part, if any */
+	const char *at = strchr(uri, '@'), *end = strpbrk(uri, ";>");
+	if(at != NULL && (end == NULL || at < end))
+		uri = at+1;
+	return g_strdup_printf("<sip:%s@%s%s", user, uri, strchr(uri, '>') ? "" : ">");
+}
+
+/* Try adding an account to the least loaded shared stack */
+static gboolean janus_sip_shared_stack_attach(janus_sip_session *session) {
+	if(shared_stacks_num == 0 || session->account.authuser == NULL)
+		return FALSE;
+	/* Accounts with settings that are per-stack in Sofia need their own */
+	if(session->account.force_tcp || session->account.sips ||
+			session->account.rfc2543_cancel || session->account.user_agent != NULL)
+		return FALSE;
+	const char *user = session->account.authuser;
+	janus_sip_shared_stack *shared = NULL;
+	guint accounts = 0;
+	int i = 0;
+	for(i=0; i<shared_stacks_num; i++) {
+		janus_sip_shared_stack *s = shared_stacks[i];
+		janus_mutex_lock(&s->mutex);
+		/* Incoming requests are matched by Contact user, which must be unique */
+		if(s->s_nua != NULL && !g_hash_table_contains(s->accounts, user) &&
+				(shared == NULL || g_hash_table_size(s->accounts) < accounts)) {
+			shared = s;
+			accounts = g_hash_table_size(s->accounts);
+		}
+		janus_mutex_unlock(&s->mutex);
+	}
+	if(shared == NULL)
+		return FALSE;
+	janus_mutex_lock(&shared->mutex);
+	if(shared->s_nua == NULL || g_hash_table_contains(shared->accounts, user)) {
+		/* Something changed in the meanwhile, use a stack of our own */
+		janus_mutex_unlock(&shared->mutex);
+		return FALSE;
+	}
+	ssip_t *ssip = g_malloc0(sizeof(ssip_t));
+	su_home_init(ssip->s_home);
+	ssip->session = session;
+	ssip->s_root = shared->s_root;
+	ssip->s_nua = shared->s_nua;
+	ssip->shared = shared;
+	ssip->shared_user = g_strdup(user);
+	ssip->contact_header = janus_sip_shared_stack_contact(shared, user);
+	janus_mutex_init(&ssip->smutex);
+	session->stack = ssip;
+	/* The shared stack holds a reference, as the thread of a dedicated stack would */
+	janus_refcount_increase(&session->ref);
+	g_hash_table_insert(shared->accounts, g_strdup(user), session);
+	janus_mutex_unlock(&shared->mutex);
+	JANUS_LOG(LOG_VERB, "Account '%s' is using shared sofia stack #%d\n", user, shared->index+1);
+	return TRUE;
+}
+
+/* Make sure an account on a shared stack is known by its current Contact user */
+static void janus_sip_shared_stack_update(janus_sip_session *session) {
+	ssip_t *ssip = session->stack;
+	janus_sip_shared_stack *shared = ssip->shared;
+	const char *user = session->account.authuser;
+	if(user == NULL || (ssip->shared_user != NULL && !strcmp(ssip->shared_user, user)))
+		return;
+	janus_mutex_lock(&shared->mutex);
+	if(g_hash_table_contains(shared->accounts, user)) {
+		janus_mutex_unlock(&shared->mutex);
+		JANUS_LOG(LOG_WARN, "Another account is known as '%s' on shared sofia stack #%d, incoming requests will not reach this one\n",
+			user, shared->index+1);
+		return;
+	}
+	if(ssip->shared_user != NULL && g_hash_table_lookup(shared->accounts, ssip->shared_user) == session)
+		g_hash_table_remove(shared->accounts, ssip->shared_user);
+	else
+		janus_refcount_increase(&session->ref);
+	g_hash_table_insert(shared->accounts, g_strdup(user), session);
+	g_free(ssip->shared_user);
+	ssip->shared_user = g_strdup(user);
+	g_free(ssip->contact_header);
+	ssip->contact_header = janus_sip_shared_stack_contact(shared, user);
+	janus_mutex_unlock(&shared->mutex);
+}
+
+/* Remove an account from its shared stack: this is what the thread of a
+ * dedicated stack does when it's shut down, except that we unregister
+ * ourselves, and leave it to the shared stack to get rid of the handle */
+static void janus_sip_shared_stack_detach(janus_sip_session *session) {
+	ssip_t *ssip = session->stack;
+	janus_sip_shared_stack *shared = ssip->shared;
+	janus_mutex_lock(&shared->mutex);
+	gboolean found = (ssip->shared_user != NULL &&
+		g_hash_table_lookup(shared->accounts, ssip->shared_user) == session);
+	if(found)
+		g_hash_table_remove(shared->accounts, ssip->shared_user);
+	janus_mutex_unlock(&shared->mutex);
+	if(!found)
+		return;
+	/* Check if this session (and/or its helpers) had dangling references for ongoing calls */
+	janus_mutex_lock(&session->mutex);
+	while(session->active_calls) {
+		janus_sip_session *s = (janus_sip_session *)session->active_calls->data;
+		if(s != NULL) {
+			JANUS_LOG(LOG_VERB, "[%p] Removing reference\n", s);
+			janus_refcount_decrease(&s->ref);
+		}
+		session->active_calls = g_list_remove(session->active_calls, s);
+	}
+	janus_mutex_unlock(&session->mutex);
+	janus_mutex_lock(&ssip->smutex);
+	ssip->s_nua = NULL;
+	ssip->s_root = NULL;
+	janus_mutex_unlock(&ssip->smutex);
+	if(ssip->s_nh_r != NULL) {
+		if(session->account.registration_status == janus_sip_registration_status_registered) {
+			nua_handle_bind(ssip->s_nh_r, NULL);
+			nua_unregister(ssip->s_nh_r, TAG_END());
+		} else {
+			nua_handle_destroy(ssip->s_nh_r);
+		}
+		ssip->s_nh_r = NULL;
+	}
+	if(ssip->s_nh_i != NULL) {
+		if(session->status == janus_sip_call_status_closing) {
+			/* We just sent a BYE (or rejected a call): wait for the call to end */
+			nua_handle_bind(ssip->s_nh_i, NULL);
+		} else {
+			nua_handle_destroy(ssip->s_nh_i);
+		}
+		ssip->s_nh_i = NULL;
+	}
+	if(ssip->s_nh_m != NULL) {
+		nua_handle_destroy(ssip->s_nh_m);
+		ssip->s_nh_m = NULL;
+	}
+	janus_mutex_lock(&ssip->smutex);
+	if(ssip->subscriptions != NULL)
+		g_hash_table_unref(ssip->subscriptions);
+	ssip->subscriptions = NULL;
+	janus_mutex_unlock(&ssip->smutex);
+	janus_refcount_decrease(&session->ref);
+}
+
+/* Sofia callback for shared stacks: we find out which account an event is for, if any */
+void janus_sip_shared_stack_callback(nua_event_t event, int status, char const *phrase, nua_t *nua, nua_magic_t *magic, nua_handle_t *nh, nua_hmagic_t *hmagic, sip_t const *sip, tagi_t tags[]) {
+	janus_sip_shared_stack *shared = (janus_sip_shared_stack *)magic;
+	janus_sip_session *session = (janus_sip_session *)hmagic;
+	if(session != NULL) {
+		/* Existing handle */
+		janus_refcount_increase(&session->ref);
+	} else if(nh != NULL && sip != NULL && sip->sip_request != NULL && sip->sip_request->rq_url->url_user != NULL) {
+		/* New incoming request: the Request-URI tells us who it's for */
+		janus_mutex_lock(&shared->mutex);
+		session = g_hash_table_lookup(shared->accounts, sip->sip_request->rq_url->url_user);
+		if(session != NULL)
+			janus_refcount_increase(&session->ref);
+		janus_mutex_unlock(&shared->mutex);
+		if(session != NULL)
+			nua_handle_bind(nh, (nua_hmagic_t *)session);
+	}
+	if(session != NULL) {
+		janus_sip_sofia_callback(event, status, phrase, nua, (nua_magic_t *)session, nh, (nua_hmagic_t *)session, sip, tags);
+		janus_refcount_decrease(&session->ref);
+		return;
+	}
+	/* If we got here, the event is not associated to any account */
+	switch(event) {
+		case nua_r_get_params: {
+			const tagi_t *from = NULL;
+			if(status != 200 || (from = tl_find(tags, siptag_from_str)) == NULL || from->t_value == 0)
+				break;
+			JANUS_LOG(LOG_VERB, "[shared #%d] 'siptag_from_str': %s\n", shared->index+1, (const char *)from->t_value);
+			janus_mutex_lock(&shared->mutex);
+			g_free(shared->contact);
+			shared->contact = g_strdup((const char *)from->t_value);
+			janus_mutex_unlock(&shared->mutex);
+			break;
+		}
+		case nua_r_register:
+		case nua_r_unregister:
+			/* An account that went away unregistered, we're done with its handle */
+			if(status >= 200 && nh != NULL)
+				nua_handle_destroy(nh);
+			break;
+		case nua_i_state: {
+			/* The call of an account that went away is over, we're done with its handle */
+			tagi_t const *ti = tl_find(tags, nutag_callstate);
+			if(ti != NULL && ti->t_value == nua_callstate_terminated && nh != NULL)
+				nua_handle_destroy(nh);
+			break;
+		}
+		case nua_r_shutdown:
+			JANUS_LOG(LOG_VERB, "[shared #%d][%s]: %d %s\n", shared->index+1, nua_event_name(event), status, phrase ? phrase : "??");
+			if(status >= 200)
+				su_root_break(shared->s_root);
+			break;
+		case nua_i_invite:
+		case nua_i_info:
+		case nua_i_message:
+		case nua_i_notify:
+		case nua_i_refer:
+		case nua_i_subscribe:
+			/* Unknown Request-URI, reject the request */
+			JANUS_LOG(LOG_WARN, "[shared #%d][%s]: no account for this request, rejecting it\n",
+				shared->index+1, nua_event_name(event));
+			if(nh != NULL) {
+				nua_respond(nh, 404, sip_status_phrase(404), NUTAG_WITH_THIS(nua), TAG_END());
+				nua_handle_destroy(nh);
+			}
+			break;
+		default:
+			JANUS_LOG(LOG_VERB, "[shared #%d][%s]: %d %s\n", shared->index+1, nua_event_name(event), status, phrase ? phrase : "??");
+			break;
+	}
+}
+
 /* Check peer RTP has RFC2833 and push event */
 static void janus_sip_check_rfc2833(janus_sip_session *session, char *buffer, int len) {
 	if(session->media.dtmf_pt <= 0)
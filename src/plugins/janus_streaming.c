@@ -64,7 +64,10 @@ type = rtp|live|ondemand|rtsp
        live = local file streamed live to multiple viewers
               (multiple viewers = same streaming context)
        ondemand = local file streamed on-demand to a single listener
-                  (multiple viewers = different streaming contexts)
+                  (multiple viewers = different streaming contexts; by
+                  default each viewer gets its own thread, but the plugin
+                  can be configured to serve them all with a small pool of
+                  shared threads instead, see ondemand_threads)
        rtsp = stream originated by an external RTSP feed (only
               available if libcurl support was compiled)
 id = <unique numeric ID>
@@ -119,6 +122,47 @@ databuffermsg = true|false (whether the plugin should store the latest
 threads = number of threads to assist with the relaying part, which can help
 	if you expect a lot of viewers that may cause the RTP receiving part
 	in the Streaming plugin to slow down and fail to catch up (default=0)
+max_threads = if higher than threads, the number of helper threads will
+	change dynamically, between threads (or 1) and max_threads, depending
+	on how many viewers there are and on how busy the helpers are: viewers
+	are moved between helpers without any interruption (default=0, disabled)
+viewers_per_thread = how many viewers each helper thread should serve, at
+	most, before a new one is spawned, when max_threads is set (default=100)
+ingest_threads = number of threads to receive the media streams of the mountpoint
+	with: streams are spread across the threads, and each stream is always
+	received by the same thread, which can help with mountpoints with many
+	high bitrate streams (default=1, only for the 'rtp' type)
+dvr_seconds = how many seconds of the stream to keep in a time-shift buffer,
+	so that viewers can watch the mountpoint with a delay, or new viewers
+	can start from the latest keyframe right away (default=0, disabled;
+	also available for the 'rtsp' type)
+dvr_max_size = maximum amount of memory (in bytes) the time-shift buffer
+	can use, no matter how many seconds it's configured for (default=64MB)
+reorder_ms = how long (in milliseconds) packets of each audio and video stream
+	can be held for, so that packets arriving out of order can be relayed
+	in sequence; packets still missing after that are reported as lost,
+	and NACKed to the source if its RTCP port is known (default=0, disabled;
+	also available for the 'rtsp' type)
+feedback_ms = how long (in milliseconds) keyframe requests and bandwidth
+	estimates from viewers are aggregated for, before a single PLI and/or
+	REMB is sent back to the source (default=1000; also available for the
+	'rtsp' type)
+remb_percentile = which percentile of the estimates viewers reported in each
+	window the REMB sent to the source should be based on, e.g., 10 to
+	ignore the worst connected viewers (default=0, the lowest estimate;
+	also available for the 'rtsp' type)
+edge_port = port other Janus instances can pull this mountpoint from, using
+	edge mountpoints (see origin_host below): all streams are multiplexed
+	on this single port, and only sent to edges that have viewers (default=0,
+	disabled; also available for the 'rtsp' type)
+edge_secret = secret edges need to provide to pull from this mountpoint, if any
+origin_host = address of the origin this mountpoint should pull its streams
+	from, making it an edge: the origin is only subscribed to when there are
+	viewers, and keyframe requests are sent upstream at most once per second
+	per stream; streams must match the ones of the origin mountpoint, and
+	are still bound to local ports (port = 0 picks one in the RTP range)
+origin_port = edge_port of the origin mountpoint to pull from
+origin_secret = edge_secret of the origin mountpoint, if needed
 
 In case you want to use SRTP for your RTP-based mountpoint, you'll need
 to configure the SRTP-related properties as well, namely the suite to
@@ -157,7 +201,9 @@ rtsp_user = RTSP authorization username, if needed
 rtsp_pwd = RTSP authorization password, if needed
 rtsp_quirk = Some RTSP servers offer the stream using only the path, instead of the fully qualified URL.
 	If set true, this boolean informs Janus that we should try a path-only DESCRIBE request if the initial request returns 404.
-rtsp_failcheck = whether an error should be returned if connecting to the RTSP server fails (default=true)
+rtsp_failcheck = whether an error should be returned if connecting to the RTSP server fails (default=true);
+	for mountpoints in the configuration file this is ignored if rtsp_lazy_connect is set in
+	the general section, in which case they're always connected in the background at startup
 rtspiface = network interface IP address or device name to listen on when receiving RTSP streams
 rtsp_reconnect_delay = after n seconds passed and no media assumed, the RTSP server has gone and schedule a reconnect (default=5s)
 rtsp_session_timeout = by default the streaming plugin will check the RTSP connection with an OPTIONS query,
@@ -705,7 +751,8 @@ multistream-test: {
 	]
 	"offer_audio" : <true|false; deprecated; whether or not audio should be negotiated; true by default if the mountpoint has audio>,
 	"offer_video" : <true|false; deprecated; whether or not video should be negotiated; true by default if the mountpoint has video>,
-	"offer_data" : <true|false; deprecated; whether or not datachannels should be negotiated; true by default if the mountpoint has datachannels>
+	"offer_data" : <true|false; deprecated; whether or not datachannels should be negotiated; true by default if the mountpoint has datachannels>,
+	"timeshift" : <how many seconds behind live to watch the mountpoint; optional, only available if the mountpoint has a time-shift buffer>
 }
 \endverbatim
  *
@@ -827,7 +874,8 @@ multistream-test: {
 			"max_delay" : <maximum delay to enforce via the playout-delay RTP extension, in blocks of 10ms; optional>
 		},
 		// Other streams, if any
-	]
+	],
+	"timeshift" : <how many seconds behind live to watch the mountpoint, 0 to go back live; optional>
 }
 \endverbatim
  *
@@ -845,6 +893,15 @@ multistream-test: {
  * on mountpoints involving a different video codec. In both cases, make
  * sure you specify the \c mid of the stream in case multiple videos are
  * available in a mountpoint, or the request may have no effect.
+ * The \c timeshift property only works with RTP and RTSP mountpoints that
+ * were configured with a time-shift buffer (see \c dvr_seconds ), and
+ * allows viewers to rewind or catch up on the live stream: the plugin will
+ * start sending media from the latest keyframe that is at least that many
+ * seconds old, and keep the viewer that far behind from then on; setting
+ * it to 0 will send the latest keyframe and then go back to live. Notice
+ * that, when a time-shift buffer is available, new viewers are always
+ * started from the latest keyframe in the buffer, rather than waiting for
+ * a new one from the source, which means no PLI is sent on their behalf.
  *
  * Another interesting feature in the Streaming plugin is the so-called
  * mountpoint "switching". Basically, when subscribed to a specific
@@ -906,9 +963,74 @@ multistream-test: {
  * you can watch in sequence, again on the same handle. If you're interested
  * in subscribing to multiple mountpoints at the same time, instead, you'll
  * have to create multiple handles for the purpose.
+ *
+ * Finally, when the Janus instance is drained via the Admin API (e.g.,
+ * because it's about to be scaled down), all viewers are notified with
+ * an event like the following, with \c draining set to \c false if the
+ * drain is cancelled instead. Applications can use it to have viewers
+ * watch the same mountpoint on a different instance:
+ *
+\verbatim
+{
+	"streaming" : "event",
+	"draining" : true
+}
+\endverbatim
+ *
+ * To help decide where new mountpoints should be created, the resources
+ * each mountpoint consumes are accounted too: packets and bytes received
+ * from its sources and sent to its viewers, the SRTP operations done for
+ * them (by the plugin for SRTP sources, by the core for viewers), and the
+ * CPU time of the threads that receive and relay its media. These values
+ * can be retrieved with the Admin API only \c usage request, optionally
+ * for a specific mountpoint \c id , and optionally resetting (\c reset=true )
+ * the counters after reading them:
+ *
+\verbatim
+{
+	"request" : "usage",
+	"id" : <unique ID of the mountpoint; optional, all mountpoints if missing>,
+	"reset" : <true|false, whether the counters should start from scratch after this; optional>
+}
+\endverbatim
+ *
+ * which results in a response like this:
+ *
+\verbatim
+{
+	"streaming" : "usage",
+	"mountpoints" : [
+		{
+			"id" : <unique ID of the mountpoint>,
+			"description" : "<description of the mountpoint>",
+			"viewers" : <number of viewers of the mountpoint>,
+			"helper_threads" : <number of helper threads of the mountpoint>,
+			"usage" : {
+				"packets-in" : <packets received>,
+				"bytes-in" : <bytes received>,
+				"packets-out" : <packets sent>,
+				"bytes-out" : <bytes sent>,
+				"srtp-ops" : <SRTP encryptions and decryptions done for those packets>,
+				"decode-time" : <always 0, as the Streaming plugin doesn't decode media>,
+				"encode-time" : <always 0, as the Streaming plugin doesn't encode media>,
+				"cpu-time" : <CPU time used for the mountpoint, in us>,
+				"elapsed" : <seconds since accounting started (mountpoint creation or last reset)>,
+				"cpu-load" : <average CPU load in that time, as a percentage of one core>
+			}
+		},
+		// Other mountpoints
+	]
+}
+\endverbatim
  */
 
 
+#ifdef HAVE_RECVMMSG
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		/* Needed for recvmmsg */
+#endif
+#endif
+
 #include "plugin.h"
 
 #include <errno.h>
@@ -941,6 +1063,8 @@ multistream-test: {
 #include "../utils.h"
 #include "../sdp-utils.h"
 #include "../ip-utils.h"
+#include "../sched-profile.h"
+#include "../usage.h"
 
 /* Default settings */
 #define JANUS_STREAMING_DEFAULT_SESSION_TIMEOUT 0 /* Overwrite the RTSP session timeout. If set to zero, the RTSP timeout is derived from a session. */
@@ -977,6 +1101,7 @@ void janus_streaming_data_ready(janus_plugin_session *handle);
 void janus_streaming_hangup_media(janus_plugin_session *handle);
 void janus_streaming_destroy_session(janus_plugin_session *handle, int *error);
 json_t *janus_streaming_query_session(janus_plugin_session *handle);
+void janus_streaming_drain(gboolean draining);
 static int janus_streaming_get_fd_port(int fd);
 
 /* Plugin setup */
@@ -1003,6 +1128,7 @@ static janus_plugin janus_streaming_plugin =
 		.hangup_media = janus_streaming_hangup_media,
 		.destroy_session = janus_streaming_destroy_session,
 		.query_session = janus_streaming_query_session,
+		.drain = janus_streaming_drain,
 	);
 
 /* Plugin creator */
@@ -1027,10 +1153,14 @@ static struct janus_json_parameter idstr_parameters[] = {
 static struct janus_json_parameter idstropt_parameters[] = {
 	{"id", JSON_STRING, 0}
 };
+static struct janus_json_parameter usage_parameters[] = {
+	{"reset", JANUS_JSON_BOOL, 0}
+};
 static struct janus_json_parameter watch_parameters[] = {
 	{"pin", JSON_STRING, 0},
 	{"media", JANUS_JSON_ARRAY, 0},
 	{"restart", JANUS_JSON_BOOL, 0},
+	{"timeshift", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	/* Deprecated parameters: still there only for
 	 * backwards compatibility, but not for long */
 	{"offer_audio", JANUS_JSON_BOOL, 0},
@@ -1068,11 +1198,24 @@ static struct janus_json_parameter create_parameters[] = {
 static struct janus_json_parameter rtp_parameters[] = {
 	{"collision", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"threads", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"ingest_threads", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"srtpsuite", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"srtpcrypto", JSON_STRING, 0},
 	{"e2ee", JANUS_JSON_BOOL, 0},
 	{"playoutdelay_ext", JANUS_JSON_BOOL, 0},
-	{"abscapturetime_src_ext_id", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
+	{"abscapturetime_src_ext_id", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"dvr_seconds", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"dvr_max_size", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"reorder_ms", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"feedback_ms", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"remb_percentile", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"max_threads", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"viewers_per_thread", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"edge_port", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"edge_secret", JSON_STRING, 0},
+	{"origin_host", JSON_STRING, 0},
+	{"origin_port", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"origin_secret", JSON_STRING, 0}
 };
 static struct janus_json_parameter live_parameters[] = {
 	{"filename", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
@@ -1108,7 +1251,16 @@ static struct janus_json_parameter rtsp_parameters[] = {
 	{"videobufferkf", JANUS_JSON_BOOL, 0},
 	{"threads", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"rtspiface", JSON_STRING, 0},
-	{"rtsp_failcheck", JANUS_JSON_BOOL, 0}
+	{"rtsp_failcheck", JANUS_JSON_BOOL, 0},
+	{"dvr_seconds", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"dvr_max_size", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"reorder_ms", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"feedback_ms", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"remb_percentile", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"max_threads", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"viewers_per_thread", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"edge_port", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"edge_secret", JSON_STRING, 0}
 };
 #endif
 static struct janus_json_parameter rtp_media_parameters[] = {
@@ -1220,6 +1372,8 @@ static struct janus_json_parameter configure_parameters[] = {
 	/* For the playout-delay RTP extension, if negotiated */
 	{"min_delay", JSON_INTEGER, 0},
 	{"max_delay", JSON_INTEGER, 0},
+	/* For the time-shift buffer, if available */
+	{"timeshift", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	/* Deprecated parameters: still there only for
 	 * backwards compatibility, but not for long */
 	{"audio", JSON_STRING, 0},
@@ -1234,12 +1388,23 @@ static struct janus_json_parameter disable_parameters[] = {
 static janus_config *config = NULL;
 static const char *config_folder = NULL;
 static janus_mutex config_mutex = JANUS_MUTEX_INITIALIZER;
+static janus_config_journal *config_journal = NULL;
 
 /* Useful stuff */
 static volatile gint initialized = 0, stopping = 0;
 static gboolean notify_events = TRUE;
 static gboolean string_ids = FALSE;
 static gboolean ipv6_disabled = FALSE;
+/* How many datagrams we read at most per syscall in RTP mountpoints,
+ * and whether we should use kernel timestamps for them */
+#define JANUS_STREAMING_DEFAULT_RECV_BATCH	16
+#define JANUS_STREAMING_MAX_RECV_BATCH		64
+#ifdef HAVE_RECVMMSG
+static int recv_batch_size = JANUS_STREAMING_DEFAULT_RECV_BATCH;
+#else
+static int recv_batch_size = 1;
+#endif
+static gboolean kernel_timestamps = FALSE;
 static janus_callbacks *gateway = NULL;
 static GThread *handler_thread;
 static void *janus_streaming_handler(void *data);
@@ -1252,11 +1417,44 @@ static uint16_t rtp_range_max = DEFAULT_RTP_RANGE_MAX;
 static uint16_t rtp_range_slider = DEFAULT_RTP_RANGE_MIN;
 static janus_mutex fd_mutex = JANUS_MUTEX_INITIALIZER;
 
+#ifdef HAVE_LIBCURL
+/* RTSP requests (connections, reconnections and keep-alives) are never sent
+ * by the threads relaying media: they're queued to a small pool of threads
+ * instead, which also limits how many cameras we talk to at the same time */
+#define DEFAULT_RTSP_THREADS				4
+#define JANUS_STREAMING_RTSP_MAX_BACKOFF	(60*G_USEC_PER_SEC)
+static int rtsp_threads = DEFAULT_RTSP_THREADS;
+/* Whether RTSP mountpoints in the configuration file should be connected in the background at startup */
+static gboolean rtsp_lazy_connect = FALSE;
+static GThreadPool *rtsp_pool = NULL;
+typedef enum janus_streaming_rtsp_request {
+	janus_streaming_rtsp_reconnect = 0,
+	janus_streaming_rtsp_keepalive
+} janus_streaming_rtsp_request;
+typedef struct janus_streaming_rtsp_task {
+	struct janus_streaming_mountpoint *mp;
+	janus_streaming_rtsp_request request;
+} janus_streaming_rtsp_task;
+static void janus_streaming_rtsp_task_run(gpointer data, gpointer user_data);
+#endif
+
 static void *janus_streaming_ondemand_thread(void *data);
+/* Pool of threads serving viewers of on-demand mountpoints (none means a thread per viewer) */
+static int ondemand_threads = 0;
+typedef struct janus_streaming_ondemand_worker {
+	guint id;
+	GThread *thread;
+	GList *viewers;
+	janus_mutex mutex;
+	volatile gint count;
+} janus_streaming_ondemand_worker;
+static janus_streaming_ondemand_worker *ondemand_workers = NULL;
+static void *janus_streaming_ondemand_worker_thread(void *data);
 static void *janus_streaming_filesource_thread(void *data);
 static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data);
 static void janus_streaming_relay_rtcp_packet(gpointer data, gpointer user_data);
 static void *janus_streaming_relay_thread(void *data);
+static void *janus_streaming_ingest_thread(void *data);
 static void janus_streaming_hangup_media_internal(janus_plugin_session *handle);
 
 typedef enum janus_streaming_type {
@@ -1281,16 +1479,33 @@ typedef struct janus_streaming_rtp_keyframe {
 	janus_mutex mutex;
 } janus_streaming_rtp_keyframe;
 
+/* Copy of a packet all the helper threads of a mountpoint share, rather
+ * than having each of them clone it: since the viewers rewrite the RTP
+ * header on a copy of their own, the buffer itself is never modified */
+typedef struct janus_streaming_relay_buffer {
+	char *data;
+	janus_refcount ref;
+} janus_streaming_relay_buffer;
+static void janus_streaming_relay_buffer_free(const janus_refcount *buffer_ref) {
+	janus_streaming_relay_buffer *buffer = janus_refcount_containerof(buffer_ref, janus_streaming_relay_buffer, ref);
+	g_free(buffer->data);
+	g_free(buffer);
+}
+
 typedef struct janus_streaming_rtp_relay_packet {
 	int mindex;
 	janus_rtp_header *data;
 	gint length;
+	/* If set, data belongs to this shared buffer */
+	janus_streaming_relay_buffer *shared;
 	gboolean is_rtp;	/* This may be a data packet and not RTP */
 	gboolean is_data;
 	gboolean is_video;
 	gboolean is_keyframe;
 	gboolean simulcast;
 	uint32_t ssrc[3];
+	/* If simulcasting, how the packet was classified for all viewers */
+	janus_rtp_simulcasting_packet sim_info;
 	janus_videocodec codec;
 	int substream;
 	int ptype;
@@ -1301,16 +1516,123 @@ typedef struct janus_streaming_rtp_relay_packet {
 	janus_vp9_svc_info svc_info;
 	/* The following is only relevant for datachannels */
 	gboolean textdata;
+	/* Whether this packet comes from the time-shift buffer */
+	gboolean timeshifted;
+	/* Only used to tell a helper thread a viewer was moved to or from it */
+	struct janus_streaming_session *viewer;
 } janus_streaming_rtp_relay_packet;
 static janus_streaming_rtp_relay_packet exit_packet;
 static void janus_streaming_rtp_relay_packet_free(janus_streaming_rtp_relay_packet *pkt) {
 	if(pkt == NULL || pkt == &exit_packet)
 		return;
-	g_free(pkt->data);
+	if(pkt->shared != NULL) {
+		janus_refcount_decrease(&pkt->shared->ref);
+	} else {
+		g_free(pkt->data);
+	}
 	g_free(pkt);
 
 }
 
+/* Time-shift (DVR) buffer for live RTP/RTSP mountpoints: we keep a copy of
+ * the last N seconds of RTP packets in a ring, and take note of where
+ * keyframes start, so that viewers can be served from there with a delay */
+typedef struct janus_streaming_dvr_packet {
+	janus_streaming_rtp_relay_packet packet;
+	gint64 received;		/* When we relayed this packet live (monotonic time) */
+} janus_streaming_dvr_packet;
+typedef struct janus_streaming_dvr {
+	gint64 max_duration;	/* How long (in us) we keep packets for */
+	guint64 max_size;		/* How much memory (in bytes) packets can take, at most */
+	janus_streaming_dvr_packet **ring;
+	guint capacity, head, count;
+	guint64 first;			/* Absolute index of the oldest packet in the ring */
+	guint64 size;
+	GArray *seekpoints;		/* Absolute indexes of packets viewers can start from (keyframes) */
+	gboolean video;			/* Once we've seen video, only keyframes can be seek points */
+	int seek_mindex;
+	guint32 seek_ts;
+} janus_streaming_dvr;
+/* Default cap on the memory a time-shift buffer can use */
+#define JANUS_STREAMING_DVR_DEFAULT_MAX_SIZE	(64*1024*1024)
+
+/* Reorder buffer for live RTP/RTSP mountpoints: packets that don't arrive
+ * in sequence are held for up to reorder_ms, so that the ones missing have
+ * a chance to arrive (or be retransmitted, if we NACK them) before we relay
+ * them in order; whatever is still missing after that is considered lost */
+typedef struct janus_streaming_reorder_packet {
+	char data[1500];
+	int length;
+	guint16 seq;
+	gint64 received;
+} janus_streaming_reorder_packet;
+typedef struct janus_streaming_reorder {
+	gint64 depth;			/* How long (in us) packets can wait for the missing ones */
+	GQueue *packets;		/* Packets we're holding, ordered by sequence number */
+	gboolean started;
+	guint32 ssrc;
+	guint16 next_seq;		/* Sequence number of the next packet to relay */
+	guint16 highest_seq;	/* Highest sequence number received so far */
+	/* Stats */
+	guint32 reordered, lost, late, nacks;
+} janus_streaming_reorder;
+/* Most packets we hold per stream, whatever the depth */
+#define JANUS_STREAMING_REORDER_MAX_PACKETS	256
+/* Largest gap in sequence numbers we send NACKs for */
+#define JANUS_STREAMING_REORDER_MAX_NACKS	64
+
+/* Hierarchical relay: edge mountpoints (on other Janus instances) can pull
+ * the streams of an origin RTP/RTSP mountpoint over a single UDP socket, with
+ * all streams multiplexed. Each datagram starts with a small header (magic,
+ * type, mindex and substream) followed by the payload: edges only subscribe,
+ * and keep the subscription alive, while they have viewers, and send keyframe
+ * requests upstream at most once per second per stream, no matter how many
+ * of their viewers are asking for one */
+#define JANUS_STREAMING_EDGE_MAGIC			0x4A	/* Not version 2, so can't be confused with RTP/RTCP */
+#define JANUS_STREAMING_EDGE_HEADER_SIZE	4
+#define JANUS_STREAMING_EDGE_SUBSCRIBE		'S'
+#define JANUS_STREAMING_EDGE_UNSUBSCRIBE	'U'
+#define JANUS_STREAMING_EDGE_PLI			'P'
+#define JANUS_STREAMING_EDGE_MEDIA			'M'
+#define JANUS_STREAMING_EDGE_KEEPALIVE		G_USEC_PER_SEC
+#define JANUS_STREAMING_EDGE_TIMEOUT		(5*G_USEC_PER_SEC)
+#define JANUS_STREAMING_EDGE_PLI_INTERVAL	G_USEC_PER_SEC
+/* Edge currently pulling from an origin mountpoint */
+typedef struct janus_streaming_edge_peer {
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	gint64 subscribed, last_seen;
+	guint64 packets, bytes;
+	guint32 plis;
+} janus_streaming_edge_peer;
+/* Origin side: the socket edges talk to, and who's subscribed */
+typedef struct janus_streaming_edges {
+	int fd;
+	uint16_t port;
+	char *secret;
+	GList *peers;			/* Protected by the mutex, as they're served by all ingest threads */
+	gint64 last_check;
+	guint32 unauthorized;
+	janus_mutex mutex;
+} janus_streaming_edges;
+/* Where an edge delivers what it gets from the origin, per stream */
+typedef struct janus_streaming_origin_target {
+	struct sockaddr_storage addr[3];
+	socklen_t addrlen[3];
+} janus_streaming_origin_target;
+/* Edge side: the origin we pull from, and the thread doing it */
+typedef struct janus_streaming_origin {
+	char *host;
+	uint16_t port;
+	char *secret;
+	int fd;					/* Connected to the origin */
+	int local_fd[2];		/* To deliver media to our own streams (IPv4 and IPv6) */
+	GHashTable *targets;	/* janus_streaming_origin_target instances, indexed by mindex */
+	gboolean subscribed;
+	guint64 packets, bytes;
+	guint32 plis;
+} janus_streaming_origin;
+
 #ifdef HAVE_LIBCURL
 typedef struct janus_streaming_buffer {
 	char *buffer;
@@ -1331,9 +1653,18 @@ typedef struct janus_streaming_rtp_source {
 	GHashTable *media_byfd;		/* As above, indexed by file descriptor */
 	janus_mutex rec_mutex;		/* Mutex to protect the recorders of all media streams from race conditions */
 	int pipefd[2];				/* Just needed to quickly interrupt the poll when it's time to wrap up */
+	int ingest_threads;			/* How many threads receive the media streams (the mountpoint thread included) */
+	GList *ingest;				/* Additional ingest threads, if any */
 	int rtp_collision;			/* Whether we should take care of potential RTP collisions */
-	uint32_t lowest_bitrate;	/* Lowest bitrate received by viewers via REMB since last update */
+	gint64 feedback_window;		/* How long (in us) feedback from viewers is aggregated for before we send any */
+	int remb_percentile;		/* Percentile of the viewers estimates the REMB we send is based on (0=lowest) */
+	janus_mutex feedback_mutex;	/* Mutex to protect the estimates below */
+	GHashTable *remb_estimates;	/* Latest estimate of each viewer in the current window, indexed by session */
+	volatile gint remb_pending;	/* Whether there are estimates we should send a REMB for */
 	gint64 remb_latest;			/* Time of latest sent REMB (to avoid flooding) */
+	uint32_t remb_bitrate;		/* Bitrate of the latest REMB we sent */
+	volatile gint pli_requests, plis_sent, plis_suppressed;	/* Keyframe requests stats */
+	volatile gint rembs_received, rembs_sent;	/* Bandwidth estimates stats */
 #ifdef HAVE_LIBCURL
 	gboolean rtsp;
 	CURL *curl;
@@ -1346,7 +1677,12 @@ typedef struct janus_streaming_rtp_source {
 	gint64 ka_timeout;
 	char *rtsp_ahost, *rtsp_vhost;
 	janus_streaming_codecs rtsp_acodecs, rtsp_vcodecs;
-	gboolean rtsp_bufferkf, reconnecting;
+	gboolean rtsp_bufferkf;
+	volatile gint reconnecting;		/* Whether the control pool is reconnecting this source */
+	volatile gint rtsp_connected;	/* Whether the latest (re)connection attempt succeeded */
+	volatile gint rtsp_busy;		/* Whether a request for this source is queued in the control pool */
+	int reconnect_failures;			/* How many reconnection attempts failed in a row */
+	gint64 reconnect_backoff;		/* How long (in us) to wait before the next reconnection attempt */
 	gint64 reconnect_timer;
 	gint64 reconnect_delay;
 	gint64 session_timeout;
@@ -1366,6 +1702,14 @@ typedef struct janus_streaming_rtp_source {
 	gboolean playoutdelay_ext;
 	/* Extension header id in RTP source with abs-capture-time */
 	int abscapturetime_src_ext_id;
+	/* Time-shift buffer, if enabled (protected by the mountpoint mutex) */
+	janus_streaming_dvr *dvr;
+	/* How long (in ms) packets can be held in the streams reorder buffers, if at all */
+	int reorder_ms;
+	/* Edges pulling from this mountpoint, if we're an origin */
+	janus_streaming_edges *edges;
+	/* Origin we pull from, if we're an edge */
+	janus_streaming_origin *origin;
 } janus_streaming_rtp_source;
 
 typedef enum janus_streaming_media {
@@ -1424,7 +1768,10 @@ typedef struct janus_streaming_rtp_source_stream {
 	volatile gint need_pli;		/* Whether we need to send a PLI later */
 	volatile gint sending_pli;	/* Whether we're currently sending a PLI */
 	gint64 pli_latest;			/* Time of latest sent PLI (to avoid flooding) */
+	gboolean from_origin;		/* Whether this stream is fed by an origin mountpoint, which gets our PLIs */
 	struct sockaddr_storage rtcp_addr;
+	int ingest;					/* Which of the mountpoint ingest threads receives this stream */
+	janus_streaming_reorder *reorder[3];	/* Reorder buffers, if enabled (only used by the ingest thread) */
 	janus_streaming_rtp_keyframe keyframe;
 	gboolean textdata;
 	gboolean buffermsg;
@@ -1438,10 +1785,28 @@ static void janus_streaming_rtp_source_stream_unref(janus_streaming_rtp_source_s
 		janus_refcount_decrease(&stream->ref);
 }
 
+/* Shared playout of on-demand mountpoints: rather than having each viewer
+ * read and packetize the file in its own thread, files can be split in
+ * frames once, and a small pool of threads then serves all the viewers */
+typedef struct janus_streaming_ondemand_frame {
+	guint offset;
+	guint length;
+} janus_streaming_ondemand_frame;
+typedef struct janus_streaming_ondemand_frames {
+	GByteArray *data;	/* Payloads of all the frames, back to back */
+	GArray *index;		/* Offset and length of each frame in the data */
+} janus_streaming_ondemand_frames;
+/* Largest file we're willing to keep in memory for the shared playout */
+#define JANUS_STREAMING_ONDEMAND_MAX_SIZE	(32*1024*1024)
+
 typedef struct janus_streaming_file_source {
 	char *filename;
 	gboolean opus;
 	janus_streaming_codecs codecs;
+	/* Frames of the file, if loaded for the shared on-demand playout */
+	janus_streaming_ondemand_frames *frames;
+	gboolean frames_loaded;
+	janus_mutex frames_mutex;
 } janus_streaming_file_source;
 
 /* used for audio/video fd and RTCP fd */
@@ -1470,6 +1835,11 @@ typedef struct janus_streaming_mountpoint {
 	GList *viewers;
 	int helper_threads;		/* Only relevant for RTP/RTSP mountpoints */
 	GList *threads;			/* Only relevant for RTP/RTSP mountpoints */
+	int min_helper_threads, max_helper_threads;	/* Only set if the helper threads are scaled automatically */
+	int viewers_per_thread;	/* How many viewers a helper thread should serve, when scaling automatically */
+	guint helper_id;		/* ID of the latest helper thread we spawned */
+	gint64 helpers_check;	/* When we last checked if the helper threads should be scaled */
+	janus_usage usage;		/* Resources (bandwidth, CPU) this mountpoint consumed so far */
 	volatile gint destroyed;
 	janus_mutex mutex;
 	janus_refcount ref;
@@ -1478,6 +1848,12 @@ GHashTable *mountpoints = NULL, *mountpoints_temp = NULL;
 janus_mutex mountpoints_mutex = JANUS_MUTEX_INITIALIZER;
 static char *admin_key = NULL;
 
+/* Additional threads receiving a subset of the streams of a mountpoint */
+typedef struct janus_streaming_ingest {
+	janus_streaming_mountpoint *mountpoint;
+	int id;
+} janus_streaming_ingest;
+
 typedef struct janus_streaming_helper {
 	janus_streaming_mountpoint *mp;
 	guint id;
@@ -1485,14 +1861,20 @@ typedef struct janus_streaming_helper {
 	int num_viewers;
 	GList *viewers;
 	GAsyncQueue *queued_packets;
+	volatile gint retired;		/* Whether this helper is going away, after serving what it has queued */
 	volatile gint destroyed;
 	janus_mutex mutex;
 	janus_refcount ref;
 } janus_streaming_helper;
+/* Default number of viewers per helper thread, when scaling automatically */
+#define JANUS_STREAMING_HELPER_DEFAULT_VIEWERS	100
+/* Packets a helper thread can have queued before we consider it too busy */
+#define JANUS_STREAMING_HELPER_MAX_QUEUE		500
 static void janus_streaming_helper_destroy(janus_streaming_helper *helper) {
 	if(helper && g_atomic_int_compare_and_exchange(&helper->destroyed, 0, 1))
 		janus_refcount_decrease(&helper->ref);
 }
+static void janus_streaming_helper_packet_free(janus_streaming_rtp_relay_packet *pkt);
 static void janus_streaming_helper_free(const janus_refcount *helper_ref) {
 	janus_streaming_helper *helper = janus_refcount_containerof(helper_ref, janus_streaming_helper, ref);
 	/* This helper can be destroyed, free all the resources */
@@ -1503,6 +1885,7 @@ static void janus_streaming_helper_free(const janus_refcount *helper_ref) {
 }
 static void *janus_streaming_helper_thread(void *data);
 static void janus_streaming_helper_rtprtcp_packet(gpointer data, gpointer user_data);
+static void janus_streaming_relay_to_viewers(janus_streaming_mountpoint *mp, janus_streaming_rtp_relay_packet *packet, GFunc relay);
 
 /* Helpers to create an RTP live source (e.g., from gstreamer/ffmpeg/vlc/etc.) */
 janus_streaming_rtp_source_stream *janus_streaming_create_rtp_source_stream(
@@ -1514,7 +1897,7 @@ janus_streaming_rtp_source_stream *janus_streaming_create_rtp_source_stream(
 		gboolean textdata, gboolean buffermsg);
 janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 		uint64_t id, char *id_str, char *name, char *desc, char *metadata,
-		GList *media, int srtpsuite, char *srtpcrypto, int threads, int rtp_collision,
+		GList *media, int srtpsuite, char *srtpcrypto, int threads, int ingest_threads, int rtp_collision,
 		gboolean e2ee, gboolean playoutdelay_ext, int abscapturetime_src_ext_id);
 /* Helper to create a file/ondemand live source */
 janus_streaming_mountpoint *janus_streaming_create_file_source(
@@ -1576,6 +1959,11 @@ typedef struct janus_streaming_session {
 	gboolean playoutdelay_ext;
 	/* Extension header id in RTP source with abs-capture-time */
 	int abscapturetime_src_ext_id;
+	/* Time-shift, if the mountpoint has a time-shift buffer */
+	gint64 timeshift;			/* How far behind live (in us) the viewer wants to be */
+	guint64 dvr_next;			/* Index of the next buffered packet to send (protected by the mountpoint mutex) */
+	volatile gint timeshifted;	/* Whether the viewer is currently being served from the buffer */
+	janus_streaming_helper *helper;	/* Helper thread serving this viewer, if any (set with the mountpoint mutex) */
 	janus_mutex mutex;
 	volatile gint dataready;
 	volatile gint stopping;
@@ -1584,6 +1972,113 @@ typedef struct janus_streaming_session {
 	volatile gint destroyed;
 	janus_refcount ref;
 } janus_streaming_session;
+
+/* When fanning out a packet to many viewers, we don't hand it to the core
+ * once per viewer, but collect them in a batch we relay all at once: as the
+ * buffer is shared, RTP packets carry the header we rewrote for each viewer */
+#define JANUS_STREAMING_RELAY_BATCH	32
+typedef struct janus_streaming_relay_batch {
+	guint count;
+	janus_plugin_session *handles[JANUS_STREAMING_RELAY_BATCH];
+	janus_plugin_rtp packets[JANUS_STREAMING_RELAY_BATCH];
+	janus_rtp_header headers[JANUS_STREAMING_RELAY_BATCH];
+	guint rtcp_count;
+	janus_plugin_session *rtcp_handles[JANUS_STREAMING_RELAY_BATCH];
+	janus_plugin_rtcp rtcp_packets[JANUS_STREAMING_RELAY_BATCH];
+	janus_usage *usage;		/* Where to account the packets we relay, if anywhere */
+} janus_streaming_relay_batch;
+static void janus_streaming_relay_batch_flush(janus_streaming_relay_batch *batch) {
+	if(batch == NULL)
+		return;
+	if(batch->usage != NULL) {
+		/* All of these go to PeerConnections, so the core will encrypt them */
+		gsize bytes = 0;
+		guint i = 0;
+		for(i=0; i<batch->count; i++)
+			bytes += batch->packets[i].length;
+		for(i=0; i<batch->rtcp_count; i++)
+			bytes += batch->rtcp_packets[i].length;
+		janus_usage_packets_out(batch->usage, batch->count + batch->rtcp_count, bytes, TRUE);
+	}
+	if(batch->count > 0 && gateway != NULL)
+		gateway->relay_rtp_batch(batch->handles, batch->packets, batch->count);
+	batch->count = 0;
+	if(batch->rtcp_count > 0 && gateway != NULL)
+		gateway->relay_rtcp_batch(batch->rtcp_handles, batch->rtcp_packets, batch->rtcp_count);
+	batch->rtcp_count = 0;
+}
+static void janus_streaming_relay_batch_add(janus_streaming_relay_batch *batch, janus_plugin_session *handle, janus_plugin_rtp *rtp) {
+	if(batch == NULL) {
+		/* No batch, relay right away */
+		gateway->relay_rtp(handle, rtp);
+		return;
+	}
+	guint i = batch->count;
+	batch->handles[i] = handle;
+	batch->packets[i] = *rtp;
+	memcpy(&batch->headers[i], rtp->header ? rtp->header : rtp->buffer, sizeof(janus_rtp_header));
+	batch->packets[i].header = (char *)&batch->headers[i];
+	batch->count++;
+	if(batch->count == JANUS_STREAMING_RELAY_BATCH)
+		janus_streaming_relay_batch_flush(batch);
+}
+static void janus_streaming_relay_batch_add_rtcp(janus_streaming_relay_batch *batch, janus_plugin_session *handle, janus_plugin_rtcp *rtcp) {
+	if(batch == NULL) {
+		/* No batch, relay right away */
+		gateway->relay_rtcp(handle, rtcp);
+		return;
+	}
+	guint i = batch->rtcp_count;
+	batch->rtcp_handles[i] = handle;
+	batch->rtcp_packets[i] = *rtcp;
+	batch->rtcp_count++;
+	if(batch->rtcp_count == JANUS_STREAMING_RELAY_BATCH)
+		janus_streaming_relay_batch_flush(batch);
+}
+static void janus_streaming_relay_rtp_packet_batch(janus_streaming_session *session,
+	janus_streaming_rtp_relay_packet *packet, janus_streaming_relay_batch *batch);
+static void janus_streaming_relay_rtcp_packet_batch(janus_streaming_session *session,
+	janus_streaming_rtp_relay_packet *packet, janus_streaming_relay_batch *batch);
+/* Relay a packet to a list of viewers in a single batch, accounting it to the mountpoint */
+static void janus_streaming_relay_to_list(GList *viewers, janus_streaming_rtp_relay_packet *packet, gboolean rtcp, janus_usage *usage) {
+	janus_streaming_relay_batch batch;
+	batch.count = 0;
+	batch.rtcp_count = 0;
+	batch.usage = usage;
+	GList *l = viewers;
+	while(l) {
+		if(rtcp)
+			janus_streaming_relay_rtcp_packet_batch((janus_streaming_session *)l->data, packet, &batch);
+		else
+			janus_streaming_relay_rtp_packet_batch((janus_streaming_session *)l->data, packet, &batch);
+		l = l->next;
+	}
+	janus_streaming_relay_batch_flush(&batch);
+}
+
+static gboolean janus_streaming_ondemand_add_viewer(janus_streaming_session *session, janus_streaming_mountpoint *mp);
+static void janus_streaming_dvr_setup(janus_streaming_mountpoint *mp, int seconds, guint64 max_size);
+static void janus_streaming_dvr_free(janus_streaming_dvr *dvr);
+static gboolean janus_streaming_dvr_seek_session(janus_streaming_session *session, janus_streaming_mountpoint *mp);
+static void janus_streaming_dvr_save(janus_config *config, janus_config_category *c, janus_streaming_rtp_source *source);
+static void janus_streaming_reorder_free(janus_streaming_reorder *reorder);
+static janus_streaming_helper *janus_streaming_helper_spawn(janus_streaming_mountpoint *mp);
+static void janus_streaming_helper_add_viewer(janus_streaming_mountpoint *mp, janus_streaming_session *session);
+static void janus_streaming_helper_remove_viewer(janus_streaming_mountpoint *mp, janus_streaming_session *session);
+static void janus_streaming_helpers_setup(janus_streaming_mountpoint *mp, int max_threads, int viewers_per_thread);
+static void janus_streaming_helpers_check(janus_streaming_mountpoint *mp, gint64 now);
+static void janus_streaming_helpers_save(janus_config *config, janus_config_category *c, janus_streaming_mountpoint *mp);
+static void janus_streaming_reorder_setup(janus_streaming_mountpoint *mp, int ms);
+static void janus_streaming_reorder_save(janus_config *config, janus_config_category *c, janus_streaming_rtp_source *source);
+static void janus_streaming_feedback_init(janus_streaming_rtp_source *source);
+static void janus_streaming_feedback_setup(janus_streaming_mountpoint *mp, int ms, int percentile);
+static void janus_streaming_feedback_save(janus_config *config, janus_config_category *c, janus_streaming_rtp_source *source);
+static void janus_streaming_edges_setup(janus_streaming_mountpoint *mp, int port, const char *secret);
+static void janus_streaming_edges_free(janus_streaming_edges *edges);
+static void janus_streaming_edges_save(janus_config *config, janus_config_category *c, janus_streaming_rtp_source *source);
+static void janus_streaming_origin_setup(janus_streaming_mountpoint *mp, const char *host, int port, const char *secret);
+static void janus_streaming_origin_free(janus_streaming_origin *origin);
+static void janus_streaming_origin_save(janus_config *config, janus_config_category *c, janus_streaming_rtp_source *source);
 static GHashTable *sessions;
 static janus_mutex sessions_mutex = JANUS_MUTEX_INITIALIZER;
 
@@ -1609,26 +2104,41 @@ static void janus_streaming_mountpoint_destroy(janus_streaming_mountpoint *mount
 	if(mountpoint->streaming_source == janus_streaming_source_rtp) {
 		janus_streaming_rtp_source *source = mountpoint->source;
 		if(source != NULL && source->pipefd[1] > 0) {
-			int code = 1;
+			/* Each ingest thread will read its own code */
+			int code = 1, i = 0;
 			ssize_t res = 0;
-			do {
-				res = write(source->pipefd[1], &code, sizeof(int));
-			} while(res == -1 && errno == EINTR);
+			for(i=0; i<MAX(source->ingest_threads, 1); i++) {
+				do {
+					res = write(source->pipefd[1], &code, sizeof(int));
+				} while(res == -1 && errno == EINTR);
+			}
 		}
 	}
 	/* Wait for the thread to finish */
 	if(mountpoint->thread != NULL)
 		g_thread_join(mountpoint->thread);
-	/* Get rid of the helper threads, if any */
-	if(mountpoint->helper_threads > 0) {
-		GList *l = mountpoint->threads;
-		while(l) {
-			janus_streaming_helper *ht = (janus_streaming_helper *)l->data;
-			g_async_queue_push(ht->queued_packets, &exit_packet);
-			janus_streaming_helper_destroy(ht);
-			l = l->next;
+	if(mountpoint->streaming_source == janus_streaming_source_rtp) {
+		janus_streaming_rtp_source *source = mountpoint->source;
+		if(source != NULL && source->ingest != NULL) {
+			GList *l = source->ingest;
+			while(l) {
+				g_thread_join((GThread *)l->data);
+				l = l->next;
+			}
+			g_list_free(source->ingest);
+			source->ingest = NULL;
 		}
 	}
+	/* Get rid of the helper threads, if any */
+	janus_mutex_lock(&mountpoint->mutex);
+	GList *l = mountpoint->threads;
+	while(l) {
+		janus_streaming_helper *ht = (janus_streaming_helper *)l->data;
+		g_async_queue_push(ht->queued_packets, &exit_packet);
+		janus_streaming_helper_destroy(ht);
+		l = l->next;
+	}
+	janus_mutex_unlock(&mountpoint->mutex);
 	/* Decrease the counter */
 	janus_refcount_decrease(&mountpoint->ref);
 }
@@ -1699,6 +2209,7 @@ typedef struct janus_streaming_opus_context {
 	ogg_packet pkt;
 	char *oggbuf;
 	gint state, headers;
+	gboolean rewound;
 } janus_streaming_opus_context;
 /* Helper method to open an Opus file, and make sure it's valid */
 static int janus_streaming_opus_context_init(janus_streaming_opus_context *ctx) {
@@ -1746,6 +2257,7 @@ static int janus_streaming_opus_context_read(janus_streaming_opus_context *ctx,
 		if(read == 0 && feof(ctx->file)) {
 			/* FIXME We're doing this forever... should this be configurable? */
 			JANUS_LOG(LOG_VERB, "[%s] Rewind! (%s)\n", ctx->name, ctx->filename);
+			ctx->rewound = TRUE;
 			if(janus_streaming_opus_context_init(ctx) < 0)
 				return -3;
 			return janus_streaming_opus_context_read(ctx, buffer, length);
@@ -1835,14 +2347,19 @@ static void janus_streaming_opus_context_cleanup(janus_streaming_opus_context *c
 
 
 /* Helper method to send an RTCP PLI */
-static void janus_streaming_rtcp_pli_send(janus_streaming_rtp_source_stream *stream) {
+static void janus_streaming_rtcp_pli_send(janus_streaming_rtp_source *source, janus_streaming_rtp_source_stream *stream) {
+	if(stream != NULL && stream->from_origin) {
+		/* The origin thread will aggregate the requests and forward them upstream */
+		g_atomic_int_set(&stream->need_pli, 1);
+		return;
+	}
 	if(stream == NULL || stream->rtcp_fd < 0 || stream->rtcp_addr.ss_family == 0)
 		return;
 	if(!g_atomic_int_compare_and_exchange(&stream->sending_pli, 0, 1))
 		return;
 	gint64 now = janus_get_monotonic_time();
-	if(now - stream->pli_latest < G_USEC_PER_SEC) {
-		/* We just sent a PLI less than a second ago, schedule a new delivery later */
+	if(now - stream->pli_latest < source->feedback_window) {
+		/* We just sent a PLI in this window, schedule a new delivery later */
 		g_atomic_int_set(&stream->need_pli, 1);
 		g_atomic_int_set(&stream->sending_pli, 0);
 		return;
@@ -1864,24 +2381,77 @@ static void janus_streaming_rtcp_pli_send(janus_streaming_rtp_source_stream *str
 		JANUS_LOG(LOG_ERR, "Error in sendto... %d (%s)\n", errno, g_strerror(errno));
 	} else {
 		JANUS_LOG(LOG_HUGE, "Sent %d/%d bytes\n", sent, rtcp_len);
+		g_atomic_int_inc(&source->plis_sent);
 	}
 	g_atomic_int_set(&stream->sending_pli, 0);
 }
 
+/* Helper method to handle a keyframe request (from a viewer, an edge or
+ * the plugin itself): if a PLI is already scheduled for this window, the
+ * request is merged with that one, otherwise we try sending one right away */
+static void janus_streaming_rtcp_pli_request(janus_streaming_rtp_source *source, janus_streaming_rtp_source_stream *stream) {
+	if(source == NULL || stream == NULL)
+		return;
+	g_atomic_int_inc(&source->pli_requests);
+	if(g_atomic_int_get(&stream->need_pli)) {
+		g_atomic_int_inc(&source->plis_suppressed);
+		return;
+	}
+	janus_streaming_rtcp_pli_send(source, stream);
+}
+
+/* Helper method to keep track of the bandwidth a viewer estimated, until the next REMB */
+static void janus_streaming_feedback_remb(janus_streaming_rtp_source *source, janus_streaming_session *session, uint32_t bitrate) {
+	if(source == NULL || session == NULL || bitrate == 0)
+		return;
+	g_atomic_int_inc(&source->rembs_received);
+	janus_mutex_lock(&source->feedback_mutex);
+	/* Only the latest estimate of each viewer in the window counts */
+	g_hash_table_insert(source->remb_estimates, session, GUINT_TO_POINTER(bitrate));
+	g_atomic_int_set(&source->remb_pending, 1);
+	janus_mutex_unlock(&source->feedback_mutex);
+}
+
+static int janus_streaming_remb_compare(const void *a, const void *b) {
+	uint32_t ea = *(const uint32_t *)a, eb = *(const uint32_t *)b;
+	return ea < eb ? -1 : (ea > eb ? 1 : 0);
+}
+
 /* Helper method to send an RTCP REMB */
 static void janus_streaming_rtcp_remb_send(janus_streaming_rtp_source *source, janus_streaming_rtp_source_stream *stream) {
 	if(stream == NULL || stream->rtcp_fd < 0 || stream->rtcp_addr.ss_family == 0)
 		return;
 	/* Update the time of when we last sent REMB feedback */
 	source->remb_latest = janus_get_monotonic_time();
+	/* Pick the configured percentile of the estimates we got in this window */
+	janus_mutex_lock(&source->feedback_mutex);
+	guint count = g_hash_table_size(source->remb_estimates);
+	if(count == 0) {
+		g_atomic_int_set(&source->remb_pending, 0);
+		janus_mutex_unlock(&source->feedback_mutex);
+		return;
+	}
+	uint32_t *estimates = g_malloc(count * sizeof(uint32_t));
+	guint i = 0;
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, source->remb_estimates);
+	while(g_hash_table_iter_next(&iter, NULL, &value))
+		estimates[i++] = GPOINTER_TO_UINT(value);
+	g_hash_table_remove_all(source->remb_estimates);
+	g_atomic_int_set(&source->remb_pending, 0);
+	janus_mutex_unlock(&source->feedback_mutex);
+	qsort(estimates, count, sizeof(uint32_t), janus_streaming_remb_compare);
+	uint32_t bitrate = estimates[(source->remb_percentile * (count - 1)) / 100];
+	g_free(estimates);
+	source->remb_bitrate = bitrate;
 	/* Generate a REMB */
 	char rtcp_buf[24];
 	int rtcp_len = 24;
-	janus_rtcp_remb((char *)(&rtcp_buf), rtcp_len, source->lowest_bitrate);
+	janus_rtcp_remb((char *)(&rtcp_buf), rtcp_len, bitrate);
 	janus_rtcp_fix_ssrc(NULL, rtcp_buf, rtcp_len, 1, 1, stream->ssrc);
-	JANUS_LOG(LOG_HUGE, "Sending REMB: %"SCNu32"\n", source->lowest_bitrate);
-	/* Reset the lowest bitrate */
-	source->lowest_bitrate = 0;
+	JANUS_LOG(LOG_HUGE, "Sending REMB: %"SCNu32" (%u estimates)\n", bitrate, count);
+	g_atomic_int_inc(&source->rembs_sent);
 	/* Send the packet */
 	socklen_t addrlen = stream->rtcp_addr.ss_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
 	int sent = 0;
@@ -2021,6 +2591,19 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 		janus_config_item *key = janus_config_get(config, config_general, janus_config_type_item, "admin_key");
 		if(key != NULL && key->value != NULL)
 			admin_key = g_strdup(key->value);
+		/* Should we journal changes to permanent mountpoints, rather than saving the whole file? */
+		janus_config_item *journal = janus_config_get(config, config_general, janus_config_type_item, "config_journal");
+		if(journal != NULL && journal->value != NULL && janus_is_true(journal->value)) {
+			int compact_after = 0;
+			janus_config_item *compact = janus_config_get(config, config_general, janus_config_type_item, "config_journal_compact");
+			if(compact != NULL && compact->value != NULL)
+				compact_after = atoi(compact->value);
+			if(compact_after < 0)
+				compact_after = 0;
+			config_journal = janus_config_journal_open(config, &config_mutex, config_folder, JANUS_STREAMING_PACKAGE, compact_after);
+			if(config_journal == NULL)
+				JANUS_LOG(LOG_WARN, "Couldn't open the configuration journal, permanent mountpoints will be saved to the whole file\n");
+		}
 		janus_config_item *range = janus_config_get(config, config_general, janus_config_type_item, "rtp_port_range");
 		if(range && range->value) {
 			/* Split in min and max port */
@@ -2065,7 +2648,75 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 		if(string_ids) {
 			JANUS_LOG(LOG_INFO, "Streaming will use alphanumeric IDs, not numeric\n");
 		}
+		janus_config_item *batch = janus_config_get(config, config_general, janus_config_type_item, "recv_batch_size");
+		if(batch != NULL && batch->value != NULL) {
+			int rbs = atoi(batch->value);
+			if(rbs < 1) {
+				JANUS_LOG(LOG_WARN, "Invalid recv_batch_size value, using the default (%d)\n", recv_batch_size);
+			} else {
+#ifndef HAVE_RECVMMSG
+				if(rbs > 1)
+					JANUS_LOG(LOG_WARN, "recvmmsg not available, ignoring recv_batch_size\n");
+				rbs = 1;
+#endif
+				if(rbs > JANUS_STREAMING_MAX_RECV_BATCH) {
+					JANUS_LOG(LOG_WARN, "recv_batch_size too large, limiting to %d\n", JANUS_STREAMING_MAX_RECV_BATCH);
+					rbs = JANUS_STREAMING_MAX_RECV_BATCH;
+				}
+				recv_batch_size = rbs;
+			}
+		}
+		janus_config_item *odt = janus_config_get(config, config_general, janus_config_type_item, "ondemand_threads");
+		if(odt != NULL && odt->value != NULL) {
+			ondemand_threads = atoi(odt->value);
+			if(ondemand_threads < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid ondemand_threads value, using a thread per viewer\n");
+				ondemand_threads = 0;
+			} else if(ondemand_threads > 0) {
+				JANUS_LOG(LOG_INFO, "On-demand mountpoints will be served by %d shared threads\n", ondemand_threads);
+			}
+		}
+		janus_config_item *kts = janus_config_get(config, config_general, janus_config_type_item, "kernel_timestamps");
+		if(kts != NULL && kts->value != NULL)
+			kernel_timestamps = janus_is_true(kts->value);
+#ifndef SO_TIMESTAMPNS
+		if(kernel_timestamps) {
+			JANUS_LOG(LOG_WARN, "Kernel timestamps not supported on this platform, ignoring\n");
+			kernel_timestamps = FALSE;
+		}
+#endif
+		JANUS_LOG(LOG_VERB, "Reading up to %d datagrams per syscall in RTP mountpoints (kernel timestamps %s)\n",
+			recv_batch_size, kernel_timestamps ? "enabled" : "disabled");
+#ifdef HAVE_LIBCURL
+		janus_config_item *rtspt = janus_config_get(config, config_general, janus_config_type_item, "rtsp_threads");
+		if(rtspt != NULL && rtspt->value != NULL) {
+			rtsp_threads = atoi(rtspt->value);
+			if(rtsp_threads < 1) {
+				JANUS_LOG(LOG_WARN, "Invalid rtsp_threads value, using the default (%d)\n", DEFAULT_RTSP_THREADS);
+				rtsp_threads = DEFAULT_RTSP_THREADS;
+			}
+		}
+		janus_config_item *rtsplc = janus_config_get(config, config_general, janus_config_type_item, "rtsp_lazy_connect");
+		if(rtsplc != NULL && rtsplc->value != NULL)
+			rtsp_lazy_connect = janus_is_true(rtsplc->value);
+		if(rtsp_lazy_connect)
+			JANUS_LOG(LOG_INFO, "RTSP mountpoints in the configuration file will be connected in the background\n");
+#endif
+	}
+#ifdef HAVE_LIBCURL
+	/* Start the pool of threads that will talk to RTSP servers */
+	GError *pool_error = NULL;
+	rtsp_pool = g_thread_pool_new(janus_streaming_rtsp_task_run, NULL, rtsp_threads, FALSE, &pool_error);
+	if(pool_error != NULL) {
+		/* RTSP requests will be sent by the mountpoint threads themselves */
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the RTSP thread pool...\n",
+			pool_error->code, pool_error->message ? pool_error->message : "??");
+		g_error_free(pool_error);
+		rtsp_pool = NULL;
+	} else {
+		JANUS_LOG(LOG_VERB, "RTSP requests will be sent by up to %d threads\n", rtsp_threads);
 	}
+#endif
 	/* Iterate on all mountpoints */
 	mountpoints = g_hash_table_new_full(string_ids ? g_str_hash : g_int64_hash, string_ids ? g_str_equal : g_int64_equal,
 		(GDestroyNotify)g_free, (GDestroyNotify)janus_streaming_mountpoint_destroy);
@@ -2134,6 +2785,7 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 				janus_config_item *media = janus_config_get(config, cat, janus_config_type_array, "media");
 				janus_config_item *rtpcollision = janus_config_get(config, cat, janus_config_type_item, "collision");
 				janus_config_item *threads = janus_config_get(config, cat, janus_config_type_item, "threads");
+				janus_config_item *ingest = janus_config_get(config, cat, janus_config_type_item, "ingest_threads");
 				janus_config_item *ssuite = janus_config_get(config, cat, janus_config_type_item, "srtpsuite");
 				janus_config_item *scrypto = janus_config_get(config, cat, janus_config_type_item, "srtpcrypto");
 				janus_config_item *e2ee = janus_config_get(config, cat, janus_config_type_item, "e2ee");
@@ -2557,6 +3209,7 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 						ssuite && ssuite->value ? atoi(ssuite->value) : 0,
 						scrypto && scrypto->value ? (char *)scrypto->value : NULL,
 						(threads && threads->value) ? atoi(threads->value) : 0,
+						(ingest && ingest->value) ? atoi(ingest->value) : 1,
 						(rtpcollision && rtpcollision->value) ?  atoi(rtpcollision->value) : 0,
 						(e2ee && e2ee->value) ? janus_is_true(e2ee->value) : FALSE,
 						(pd && pd->value) ? janus_is_true(pd->value) : FALSE,
@@ -2570,6 +3223,46 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 					mp->secret = g_strdup(secret->value);
 				if(pin && pin->value)
 					mp->pin = g_strdup(pin->value);
+				/* Any time-shift buffer? */
+				janus_config_item *dvrs = janus_config_get(config, cat, janus_config_type_item, "dvr_seconds");
+				janus_config_item *dvrms = janus_config_get(config, cat, janus_config_type_item, "dvr_max_size");
+				if(dvrs && dvrs->value && atoi(dvrs->value) > 0) {
+					janus_streaming_dvr_setup(mp, atoi(dvrs->value),
+						(dvrms && dvrms->value) ? g_ascii_strtoull(dvrms->value, NULL, 10) : 0);
+				}
+				/* Any reorder buffer? */
+				janus_config_item *reorder = janus_config_get(config, cat, janus_config_type_item, "reorder_ms");
+				if(reorder && reorder->value && atoi(reorder->value) > 0)
+					janus_streaming_reorder_setup(mp, atoi(reorder->value));
+				/* How should feedback from viewers be aggregated? */
+				janus_config_item *feedback = janus_config_get(config, cat, janus_config_type_item, "feedback_ms");
+				janus_config_item *percentile = janus_config_get(config, cat, janus_config_type_item, "remb_percentile");
+				if((feedback && feedback->value) || (percentile && percentile->value)) {
+					janus_streaming_feedback_setup(mp, (feedback && feedback->value) ? atoi(feedback->value) : 0,
+						(percentile && percentile->value) ? atoi(percentile->value) : 0);
+				}
+				/* Should the helper threads be scaled automatically? */
+				janus_config_item *maxt = janus_config_get(config, cat, janus_config_type_item, "max_threads");
+				janus_config_item *vperthread = janus_config_get(config, cat, janus_config_type_item, "viewers_per_thread");
+				if(maxt && maxt->value && atoi(maxt->value) > 0) {
+					janus_streaming_helpers_setup(mp, atoi(maxt->value),
+						(vperthread && vperthread->value) ? atoi(vperthread->value) : 0);
+				}
+				/* Can edges pull from this mountpoint? */
+				janus_config_item *edgeport = janus_config_get(config, cat, janus_config_type_item, "edge_port");
+				janus_config_item *edgesecret = janus_config_get(config, cat, janus_config_type_item, "edge_secret");
+				if(edgeport && edgeport->value && atoi(edgeport->value) > 0) {
+					janus_streaming_edges_setup(mp, atoi(edgeport->value),
+						(edgesecret && edgesecret->value) ? edgesecret->value : NULL);
+				}
+				/* Is this an edge, pulling from an origin mountpoint? */
+				janus_config_item *originhost = janus_config_get(config, cat, janus_config_type_item, "origin_host");
+				janus_config_item *originport = janus_config_get(config, cat, janus_config_type_item, "origin_port");
+				janus_config_item *originsecret = janus_config_get(config, cat, janus_config_type_item, "origin_secret");
+				if(originhost && originhost->value && originport && originport->value && atoi(originport->value) > 0) {
+					janus_streaming_origin_setup(mp, originhost->value, atoi(originport->value),
+						(originsecret && originsecret->value) ? originsecret->value : NULL);
+				}
 			} else if(!strcasecmp(type->value, "live")) {
 				/* File-based live source */
 				janus_config_item *desc = janus_config_get(config, cat, janus_config_type_item, "description");
@@ -2765,6 +3458,10 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 				gboolean error_on_failure = TRUE;
 				if(failerr && failerr->value)
 					error_on_failure = janus_is_true(failerr->value);
+				/* Connecting to the RTSP servers one at a time would slow down the startup
+				 * a lot, so we may leave that to the control pool, as we do for reconnects */
+				if(rtsp_lazy_connect)
+					error_on_failure = FALSE;
 				if(threads && threads->value && atoi(threads->value) < 0) {
 					JANUS_LOG(LOG_ERR, "Can't add 'rtsp' mountpoint '%s', invalid threads configuration...\n", cat->name);
 					cl = cl->next;
@@ -2832,6 +3529,38 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 					mp->secret = g_strdup(secret->value);
 				if(pin && pin->value)
 					mp->pin = g_strdup(pin->value);
+				/* Any time-shift buffer? */
+				janus_config_item *dvrs = janus_config_get(config, cat, janus_config_type_item, "dvr_seconds");
+				janus_config_item *dvrms = janus_config_get(config, cat, janus_config_type_item, "dvr_max_size");
+				if(dvrs && dvrs->value && atoi(dvrs->value) > 0) {
+					janus_streaming_dvr_setup(mp, atoi(dvrs->value),
+						(dvrms && dvrms->value) ? g_ascii_strtoull(dvrms->value, NULL, 10) : 0);
+				}
+				/* Any reorder buffer? */
+				janus_config_item *reorder = janus_config_get(config, cat, janus_config_type_item, "reorder_ms");
+				if(reorder && reorder->value && atoi(reorder->value) > 0)
+					janus_streaming_reorder_setup(mp, atoi(reorder->value));
+				/* How should feedback from viewers be aggregated? */
+				janus_config_item *feedback = janus_config_get(config, cat, janus_config_type_item, "feedback_ms");
+				janus_config_item *percentile = janus_config_get(config, cat, janus_config_type_item, "remb_percentile");
+				if((feedback && feedback->value) || (percentile && percentile->value)) {
+					janus_streaming_feedback_setup(mp, (feedback && feedback->value) ? atoi(feedback->value) : 0,
+						(percentile && percentile->value) ? atoi(percentile->value) : 0);
+				}
+				/* Should the helper threads be scaled automatically? */
+				janus_config_item *maxt = janus_config_get(config, cat, janus_config_type_item, "max_threads");
+				janus_config_item *vperthread = janus_config_get(config, cat, janus_config_type_item, "viewers_per_thread");
+				if(maxt && maxt->value && atoi(maxt->value) > 0) {
+					janus_streaming_helpers_setup(mp, atoi(maxt->value),
+						(vperthread && vperthread->value) ? atoi(vperthread->value) : 0);
+				}
+				/* Can edges pull from this mountpoint? */
+				janus_config_item *edgeport = janus_config_get(config, cat, janus_config_type_item, "edge_port");
+				janus_config_item *edgesecret = janus_config_get(config, cat, janus_config_type_item, "edge_secret");
+				if(edgeport && edgeport->value && atoi(edgeport->value) > 0) {
+					janus_streaming_edges_setup(mp, atoi(edgeport->value),
+						(edgesecret && edgesecret->value) ? edgesecret->value : NULL);
+				}
 #endif
 			} else {
 				JANUS_LOG(LOG_WARN, "Ignoring unknown mountpoint type '%s' (%s)...\n", type->value, cat->name);
@@ -2873,9 +3602,31 @@ int janus_streaming_init(janus_callbacks *callback, const char *config_path) {
 		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the Streaming handler thread...\n",
 			error->code, error->message ? error->message : "??");
 		g_error_free(error);
+		janus_config_journal_close(config_journal);
+		config_journal = NULL;
 		janus_config_destroy(config);
 		return -1;
 	}
+	if(ondemand_threads > 0) {
+		/* Launch the threads that will serve the viewers of on-demand mountpoints */
+		ondemand_workers = g_malloc0(ondemand_threads * sizeof(janus_streaming_ondemand_worker));
+		int i = 0;
+		char tname[16];
+		for(i=0; i<ondemand_threads; i++) {
+			ondemand_workers[i].id = i;
+			janus_mutex_init(&ondemand_workers[i].mutex);
+			g_snprintf(tname, sizeof(tname), "ondemand %d", i);
+			ondemand_workers[i].thread = g_thread_try_new(tname, janus_streaming_ondemand_worker_thread, &ondemand_workers[i], &error);
+			if(error != NULL) {
+				/* We'll spawn a thread per viewer for the viewers this worker would have served */
+				JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the on-demand thread #%d...\n",
+					error->code, error->message ? error->message : "??", i);
+				g_error_free(error);
+				error = NULL;
+				ondemand_workers[i].thread = NULL;
+			}
+		}
+	}
 	JANUS_LOG(LOG_INFO, "%s initialized!\n", JANUS_STREAMING_NAME);
 	return 0;
 }
@@ -2890,6 +3641,24 @@ void janus_streaming_destroy(void) {
 		g_thread_join(handler_thread);
 		handler_thread = NULL;
 	}
+	if(ondemand_workers != NULL) {
+		/* The threads will get rid of their viewers themselves before leaving */
+		int i = 0;
+		for(i=0; i<ondemand_threads; i++) {
+			if(ondemand_workers[i].thread != NULL)
+				g_thread_join(ondemand_workers[i].thread);
+			janus_mutex_destroy(&ondemand_workers[i].mutex);
+		}
+		g_free(ondemand_workers);
+		ondemand_workers = NULL;
+	}
+#ifdef HAVE_LIBCURL
+	if(rtsp_pool != NULL) {
+		/* Queued requests are dropped by the pool threads, since we're stopping */
+		g_thread_pool_free(rtsp_pool, FALSE, TRUE);
+		rtsp_pool = NULL;
+	}
+#endif
 
 	/* Remove all mountpoints */
 	janus_mutex_lock(&mountpoints_mutex);
@@ -2905,6 +3674,8 @@ void janus_streaming_destroy(void) {
 	g_async_queue_unref(messages);
 	messages = NULL;
 
+	janus_config_journal_close(config_journal);
+	config_journal = NULL;
 	janus_config_destroy(config);
 	g_free(admin_key);
 
@@ -2992,6 +3763,39 @@ void janus_streaming_destroy_session(janus_plugin_session *handle, int *error) {
 	return;
 }
 
+/* The Janus instance started or stopped draining: let all users know, so
+ * that they can move to another instance (e.g., with a new handle there) */
+void janus_streaming_drain(gboolean draining) {
+	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
+		return;
+	JANUS_LOG(LOG_INFO, "Notifying users the instance is %s\n", draining ? "draining" : "not draining anymore");
+	/* Take a reference to all sessions first, so that we don't push events with the lock held */
+	GList *list = NULL;
+	GHashTableIter iter;
+	gpointer value;
+	janus_mutex_lock(&sessions_mutex);
+	g_hash_table_iter_init(&iter, sessions);
+	while(g_hash_table_iter_next(&iter, NULL, &value)) {
+		janus_streaming_session *session = (janus_streaming_session *)value;
+		if(session == NULL || g_atomic_int_get(&session->destroyed))
+			continue;
+		janus_refcount_increase(&session->ref);
+		list = g_list_prepend(list, session);
+	}
+	janus_mutex_unlock(&sessions_mutex);
+	while(list != NULL) {
+		janus_streaming_session *session = (janus_streaming_session *)list->data;
+		json_t *event = json_object();
+		json_object_set_new(event, "streaming", json_string("event"));
+		json_object_set_new(event, "draining", draining ? json_true() : json_false());
+		int ret = gateway->push_event(session->handle, &janus_streaming_plugin, NULL, event, NULL);
+		JANUS_LOG(LOG_VERB, "  >> Pushing event: %d (%s)\n", ret, janus_get_api_error(ret));
+		json_decref(event);
+		janus_refcount_decrease(&session->ref);
+		list = g_list_delete_link(list, list);
+	}
+}
+
 json_t *janus_streaming_query_session(janus_plugin_session *handle) {
 	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized)) {
 		return NULL;
@@ -3268,6 +4072,110 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 				json_object_set_new(ml, "collision", json_integer(source->rtp_collision));
 			if(mp->helper_threads > 0)
 				json_object_set_new(ml, "threads", json_integer(mp->helper_threads));
+			if(mp->max_helper_threads > 0) {
+				json_object_set_new(ml, "min_threads", json_integer(mp->min_helper_threads));
+				json_object_set_new(ml, "max_threads", json_integer(mp->max_helper_threads));
+				json_object_set_new(ml, "viewers_per_thread", json_integer(mp->viewers_per_thread));
+			}
+			if(admin && mp->helper_threads > 0) {
+				json_t *helpers = json_array();
+				janus_mutex_lock(&mp->mutex);
+				GList *l = mp->threads;
+				while(l) {
+					janus_streaming_helper *ht = (janus_streaming_helper *)l->data;
+					json_t *hl = json_object();
+					json_object_set_new(hl, "id", json_integer(ht->id));
+					json_object_set_new(hl, "viewers", json_integer(ht->num_viewers));
+					json_object_set_new(hl, "queued", json_integer(g_async_queue_length(ht->queued_packets)));
+					if(g_atomic_int_get(&ht->retired))
+						json_object_set_new(hl, "retired", json_true());
+					json_array_append_new(helpers, hl);
+					l = l->next;
+				}
+				janus_mutex_unlock(&mp->mutex);
+				json_object_set_new(ml, "helpers", helpers);
+			}
+			if(source->ingest_threads > 1)
+				json_object_set_new(ml, "ingest_threads", json_integer(source->ingest_threads));
+			if(source->reorder_ms > 0)
+				json_object_set_new(ml, "reorder_ms", json_integer(source->reorder_ms));
+			if(admin) {
+				json_t *fl = json_object();
+				json_object_set_new(fl, "window_ms", json_integer(source->feedback_window/1000));
+				json_object_set_new(fl, "remb_percentile", json_integer(source->remb_percentile));
+				json_object_set_new(fl, "pli_requests", json_integer(g_atomic_int_get(&source->pli_requests)));
+				json_object_set_new(fl, "plis_sent", json_integer(g_atomic_int_get(&source->plis_sent)));
+				json_object_set_new(fl, "plis_suppressed", json_integer(g_atomic_int_get(&source->plis_suppressed)));
+				json_object_set_new(fl, "rembs_received", json_integer(g_atomic_int_get(&source->rembs_received)));
+				json_object_set_new(fl, "rembs_sent", json_integer(g_atomic_int_get(&source->rembs_sent)));
+				if(source->remb_bitrate > 0)
+					json_object_set_new(fl, "remb_bitrate", json_integer(source->remb_bitrate));
+				json_object_set_new(ml, "feedback", fl);
+			}
+			if(source->edges != NULL) {
+				janus_streaming_edges *edges = source->edges;
+				json_t *el = json_object();
+				json_object_set_new(el, "port", json_integer(edges->port));
+				janus_mutex_lock(&edges->mutex);
+				json_object_set_new(el, "subscribed", json_integer(g_list_length(edges->peers)));
+				if(admin) {
+					json_object_set_new(el, "unauthorized", json_integer(edges->unauthorized));
+					json_t *peers = json_array();
+					gint64 now = janus_get_monotonic_time();
+					GList *l = edges->peers;
+					while(l) {
+						janus_streaming_edge_peer *peer = (janus_streaming_edge_peer *)l->data;
+						json_t *pl = json_object();
+						janus_network_address addr;
+						janus_network_address_string_buffer addr_buf;
+						if(janus_network_address_from_sockaddr((struct sockaddr *)&peer->addr, &addr) == 0 &&
+								janus_network_address_to_string_buffer(&addr, &addr_buf) == 0) {
+							json_object_set_new(pl, "address", json_string(janus_network_address_string_from_buffer(&addr_buf)));
+						}
+						json_object_set_new(pl, "port", json_integer(ntohs(peer->addr.ss_family == AF_INET6 ?
+							((struct sockaddr_in6 *)&peer->addr)->sin6_port : ((struct sockaddr_in *)&peer->addr)->sin_port)));
+						json_object_set_new(pl, "age", json_integer((now - peer->subscribed)/G_USEC_PER_SEC));
+						json_object_set_new(pl, "packets", json_integer(peer->packets));
+						json_object_set_new(pl, "bytes", json_integer(peer->bytes));
+						json_object_set_new(pl, "plis", json_integer(peer->plis));
+						json_array_append_new(peers, pl);
+						l = l->next;
+					}
+					json_object_set_new(el, "peers", peers);
+				}
+				janus_mutex_unlock(&edges->mutex);
+				json_object_set_new(ml, "edges", el);
+			}
+			if(source->origin != NULL) {
+				janus_streaming_origin *origin = source->origin;
+				json_t *ol = json_object();
+				json_object_set_new(ol, "host", json_string(origin->host));
+				json_object_set_new(ol, "port", json_integer(origin->port));
+				json_object_set_new(ol, "subscribed", origin->subscribed ? json_true() : json_false());
+				if(admin) {
+					json_object_set_new(ol, "packets", json_integer(origin->packets));
+					json_object_set_new(ol, "bytes", json_integer(origin->bytes));
+					json_object_set_new(ol, "plis", json_integer(origin->plis));
+				}
+				json_object_set_new(ml, "origin", ol);
+			}
+			janus_mutex_lock(&mp->mutex);
+			janus_streaming_dvr *dvr = source->dvr;
+			if(dvr != NULL) {
+				json_t *info = json_object();
+				json_object_set_new(info, "seconds", json_integer(dvr->max_duration/G_USEC_PER_SEC));
+				json_object_set_new(info, "max_size", json_integer(dvr->max_size));
+				if(admin) {
+					janus_streaming_dvr_packet *oldest = dvr->count > 0 ? dvr->ring[dvr->head] : NULL;
+					json_object_set_new(info, "buffered_ms", json_integer(oldest ?
+						(janus_get_monotonic_time() - oldest->received)/1000 : 0));
+					json_object_set_new(info, "packets", json_integer(dvr->count));
+					json_object_set_new(info, "bytes", json_integer(dvr->size));
+					json_object_set_new(info, "keyframes", json_integer(dvr->seekpoints->len));
+				}
+				json_object_set_new(ml, "dvr", info);
+			}
+			janus_mutex_unlock(&mp->mutex);
 			/* Iterate on media now */
 			GList *temp = source->media;
 			while(temp) {
@@ -3311,6 +4219,26 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 				}
 				if(stream->skew)
 					json_object_set_new(info, "skew_compensation", json_true());
+				if(stream->reorder[0] || stream->reorder[1] || stream->reorder[2]) {
+					/* Add up the stats of all the substreams */
+					guint32 reordered = 0, lost = 0, late = 0, nacks = 0;
+					int i = 0;
+					for(i=0; i<3; i++) {
+						janus_streaming_reorder *reorder = stream->reorder[i];
+						if(reorder == NULL)
+							continue;
+						reordered += reorder->reordered;
+						lost += reorder->lost;
+						late += reorder->late;
+						nacks += reorder->nacks;
+					}
+					json_t *reorder = json_object();
+					json_object_set_new(reorder, "reordered", json_integer(reordered));
+					json_object_set_new(reorder, "lost", json_integer(lost));
+					json_object_set_new(reorder, "late", json_integer(late));
+					json_object_set_new(reorder, "nacks", json_integer(nacks));
+					json_object_set_new(info, "reorder", reorder);
+				}
 				if(admin) {
 					if(stream->host)
 						json_object_set_new(ml, "host", json_string(stream->host));
@@ -3451,6 +4379,7 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 			json_t *is_private = json_object_get(root, "is_private");
 			json_t *rtpcollision = json_object_get(root, "collision");
 			json_t *threads = json_object_get(root, "threads");
+			json_t *ingest = json_object_get(root, "ingest_threads");
 			json_t *ssuite = json_object_get(root, "srtpsuite");
 			json_t *scrypto = json_object_get(root, "srtpcrypto");
 			json_t *e2ee = json_object_get(root, "e2ee");
@@ -3897,6 +4826,7 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 					ssuite ? json_integer_value(ssuite) : 0,
 					scrypto ? (char *)json_string_value(scrypto) : NULL,
 					threads ? json_integer_value(threads) : 0,
+					ingest ? json_integer_value(ingest) : 1,
 					rtpcollision ? json_integer_value(rtpcollision) : 0,
 					e2ee ? json_is_true(e2ee) : FALSE,
 					pd ? json_is_true(pd) : FALSE,
@@ -4217,6 +5147,46 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 		/* Any PIN? */
 		if(pin)
 			mp->pin = g_strdup(json_string_value(pin));
+		/* Any time-shift buffer? */
+		json_t *dvr_seconds = json_object_get(root, "dvr_seconds");
+		if(dvr_seconds && json_integer_value(dvr_seconds) > 0) {
+			json_t *dvr_max_size = json_object_get(root, "dvr_max_size");
+			janus_streaming_dvr_setup(mp, json_integer_value(dvr_seconds),
+				dvr_max_size ? json_integer_value(dvr_max_size) : 0);
+		}
+		/* Any reorder buffer? */
+		json_t *reorder_ms = json_object_get(root, "reorder_ms");
+		if(reorder_ms && json_integer_value(reorder_ms) > 0)
+			janus_streaming_reorder_setup(mp, json_integer_value(reorder_ms));
+		/* How should feedback from viewers be aggregated? */
+		json_t *feedback_ms = json_object_get(root, "feedback_ms");
+		json_t *remb_percentile = json_object_get(root, "remb_percentile");
+		if(feedback_ms || remb_percentile) {
+			janus_streaming_feedback_setup(mp, feedback_ms ? json_integer_value(feedback_ms) : 0,
+				remb_percentile ? json_integer_value(remb_percentile) : 0);
+		}
+		/* Should the helper threads be scaled automatically? */
+		json_t *max_threads = json_object_get(root, "max_threads");
+		if(max_threads && json_integer_value(max_threads) > 0) {
+			json_t *viewers_per_thread = json_object_get(root, "viewers_per_thread");
+			janus_streaming_helpers_setup(mp, json_integer_value(max_threads),
+				viewers_per_thread ? json_integer_value(viewers_per_thread) : 0);
+		}
+		/* Can edges pull from this mountpoint? */
+		json_t *edge_port = json_object_get(root, "edge_port");
+		if(edge_port && json_integer_value(edge_port) > 0) {
+			json_t *edge_secret = json_object_get(root, "edge_secret");
+			janus_streaming_edges_setup(mp, json_integer_value(edge_port),
+				edge_secret ? json_string_value(edge_secret) : NULL);
+		}
+		/* Is this an edge, pulling from an origin mountpoint? */
+		json_t *origin_host = json_object_get(root, "origin_host");
+		json_t *origin_port = json_object_get(root, "origin_port");
+		if(origin_host && origin_port && json_integer_value(origin_port) > 0) {
+			json_t *origin_secret = json_object_get(root, "origin_secret");
+			janus_streaming_origin_setup(mp, json_string_value(origin_host), json_integer_value(origin_port),
+				origin_secret ? json_string_value(origin_secret) : NULL);
+		}
 		if(save) {
 			/* This mountpoint is permanent: save to the configuration file too
 			 * FIXME: We should check if anything fails... */
@@ -4250,10 +5220,16 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 					janus_config_add(config, c, janus_config_item_create("srtpsuite", value));
 					janus_config_add(config, c, janus_config_item_create("srtpcrypto", source->srtpcrypto));
 				}
-				if(mp->helper_threads > 0) {
-					g_snprintf(value, BUFSIZ, "%d", mp->helper_threads);
-					janus_config_add(config, c, janus_config_item_create("threads", value));
+				janus_streaming_helpers_save(config, c, mp);
+				if(source->ingest_threads > 1) {
+					g_snprintf(value, BUFSIZ, "%d", source->ingest_threads);
+					janus_config_add(config, c, janus_config_item_create("ingest_threads", value));
 				}
+				janus_streaming_dvr_save(config, c, mp->source);
+				janus_streaming_reorder_save(config, c, mp->source);
+				janus_streaming_feedback_save(config, c, mp->source);
+				janus_streaming_edges_save(config, c, mp->source);
+				janus_streaming_origin_save(config, c, mp->source);
 				if(source->e2ee)
 					janus_config_add(config, c, janus_config_item_create("e2ee", "true"));
 				if(source->playoutdelay_ext)
@@ -4365,13 +5341,15 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 				json_t *iface = json_object_get(root, "rtspiface");
 				if(iface)
 					janus_config_add(config, c, janus_config_item_create("rtspiface", json_string_value(iface)));
-				if(mp->helper_threads > 0) {
-					g_snprintf(value, BUFSIZ, "%d", mp->helper_threads);
-					janus_config_add(config, c, janus_config_item_create("threads", value));
-				}
+				janus_streaming_helpers_save(config, c, mp);
+				janus_streaming_dvr_save(config, c, mp->source);
+				janus_streaming_reorder_save(config, c, mp->source);
+				janus_streaming_feedback_save(config, c, mp->source);
+				janus_streaming_edges_save(config, c, mp->source);
 			}
 			/* Save modified configuration */
-			if(janus_config_save(config, config_folder, JANUS_STREAMING_PACKAGE) < 0)
+			if((config_journal == NULL || janus_config_journal_put(config_journal, c) < 0) &&
+					janus_config_save(config, config_folder, JANUS_STREAMING_PACKAGE) < 0)
 				save = FALSE;	/* This will notify the user the mountpoint is not permanent */
 			janus_mutex_unlock(&config_mutex);
 		}
@@ -4636,10 +5614,11 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 					json_t *iface = json_object_get(root, "rtspiface");
 					if(iface)
 						janus_config_add(config, c, janus_config_item_create("rtspiface", json_string_value(iface)));
-					if(mp->helper_threads > 0) {
-						g_snprintf(value, BUFSIZ, "%d", mp->helper_threads);
-						janus_config_add(config, c, janus_config_item_create("threads", value));
-					}
+					janus_streaming_helpers_save(config, c, mp);
+					janus_streaming_dvr_save(config, c, mp->source);
+					janus_streaming_reorder_save(config, c, mp->source);
+					janus_streaming_feedback_save(config, c, mp->source);
+					janus_streaming_edges_save(config, c, mp->source);
 				} else {
 					janus_config_add(config, c, janus_config_item_create("type", "rtp"));
 					/* We save using the new format, not the old deprecated one */
@@ -4653,10 +5632,16 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 						janus_config_add(config, c, janus_config_item_create("srtpsuite", value));
 						janus_config_add(config, c, janus_config_item_create("srtpcrypto", source->srtpcrypto));
 					}
-					if(mp->helper_threads > 0) {
-						g_snprintf(value, BUFSIZ, "%d", mp->helper_threads);
-						janus_config_add(config, c, janus_config_item_create("threads", value));
+					janus_streaming_helpers_save(config, c, mp);
+					if(source->ingest_threads > 1) {
+						g_snprintf(value, BUFSIZ, "%d", source->ingest_threads);
+						janus_config_add(config, c, janus_config_item_create("ingest_threads", value));
 					}
+					janus_streaming_dvr_save(config, c, mp->source);
+					janus_streaming_reorder_save(config, c, mp->source);
+					janus_streaming_feedback_save(config, c, mp->source);
+					janus_streaming_edges_save(config, c, mp->source);
+					janus_streaming_origin_save(config, c, mp->source);
 					if(source->e2ee)
 						janus_config_add(config, c, janus_config_item_create("e2ee", "true"));
 					if(source->playoutdelay_ext)
@@ -4738,7 +5723,8 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 				janus_config_add(config, c, janus_config_item_create("audio", "true"));
 			}
 			/* Save modified configuration */
-			if(janus_config_save(config, config_folder, JANUS_STREAMING_PACKAGE) < 0)
+			if((config_journal == NULL || janus_config_journal_put(config_journal, c) < 0) &&
+					janus_config_save(config, config_folder, JANUS_STREAMING_PACKAGE) < 0)
 				save = FALSE;	/* This will notify the user the mountpoint is not permanent */
 			janus_mutex_unlock(&config_mutex);
 		}
@@ -4860,22 +5846,7 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 			gateway->close_pc(s->handle);
 			if(mp->streaming_source == janus_streaming_source_rtp) {
 				/* Remove the viewer from the helper threads too, if any */
-				if(mp->helper_threads > 0) {
-					GList *l = mp->threads;
-					while(l) {
-						janus_streaming_helper *ht = (janus_streaming_helper *)l->data;
-						janus_mutex_lock(&ht->mutex);
-						if(g_list_find(ht->viewers, s) != NULL) {
-							ht->num_viewers--;
-							ht->viewers = g_list_remove_all(ht->viewers, s);
-							janus_mutex_unlock(&ht->mutex);
-							JANUS_LOG(LOG_VERB, "Removing viewer from helper thread #%d (destroy)\n", ht->id);
-							break;
-						}
-						janus_mutex_unlock(&ht->mutex);
-						l = l->next;
-					}
-				}
+				janus_streaming_helper_remove_viewer(mp, s);
 			}
 			mp->viewers = g_list_remove_all(mp->viewers, s);
 			viewer = g_list_first(mp->viewers);
@@ -4988,22 +5959,7 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 			gateway->close_pc(s->handle);
 			if(mp->streaming_source == janus_streaming_source_rtp) {
 				/* Remove the viewer from the helper threads too, if any */
-				if(mp->helper_threads > 0) {
-					GList *l = mp->threads;
-					while(l) {
-						janus_streaming_helper *ht = (janus_streaming_helper *)l->data;
-						janus_mutex_lock(&ht->mutex);
-						if(g_list_find(ht->viewers, s) != NULL) {
-							ht->num_viewers--;
-							ht->viewers = g_list_remove_all(ht->viewers, s);
-							janus_mutex_unlock(&ht->mutex);
-							JANUS_LOG(LOG_VERB, "Removing viewer from helper thread #%d (destroy)\n", ht->id);
-							break;
-						}
-						janus_mutex_unlock(&ht->mutex);
-						l = l->next;
-					}
-				}
+				janus_streaming_helper_remove_viewer(mp, s);
 			}
 			mp->viewers = g_list_remove_all(mp->viewers, s);
 			viewer = g_list_first(mp->viewers);
@@ -5021,7 +5977,8 @@ static json_t *janus_streaming_process_synchronous_request(janus_streaming_sessi
 			/* The category to remove is the mountpoint name */
 			janus_config_remove(config, NULL, mp->name);
 			/* Save modified configuration */
-			if(janus_config_save(config, config_folder, JANUS_STREAMING_PACKAGE) < 0)
+			if((config_journal == NULL || janus_config_journal_remove(config_journal, mp->name) < 0) &&
+					janus_config_save(config, config_folder, JANUS_STREAMING_PACKAGE) < 0)
 				save = FALSE;	/* This will notify the user the mountpoint is not permanent */
 			janus_mutex_unlock(&config_mutex);
 		}
@@ -5566,7 +6523,55 @@ json_t *janus_streaming_handle_admin_message(json_t *message) {
 		goto admin_response;
 	json_t *request = json_object_get(message, "request");
 	const char *request_text = json_string_value(request);
-	if((response = janus_streaming_process_synchronous_request(NULL, message)) != NULL) {
+	if(!strcasecmp(request_text, "usage")) {
+		/* Return the resources each mountpoint (or a specific one) consumed so far */
+		if(!string_ids) {
+			JANUS_VALIDATE_JSON_OBJECT(message, idopt_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_STREAMING_ERROR_MISSING_ELEMENT, JANUS_STREAMING_ERROR_INVALID_ELEMENT);
+		} else {
+			JANUS_VALIDATE_JSON_OBJECT(message, idstropt_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_STREAMING_ERROR_MISSING_ELEMENT, JANUS_STREAMING_ERROR_INVALID_ELEMENT);
+		}
+		if(error_code != 0)
+			goto admin_response;
+		JANUS_VALIDATE_JSON_OBJECT(message, usage_parameters,
+			error_code, error_cause, TRUE,
+			JANUS_STREAMING_ERROR_MISSING_ELEMENT, JANUS_STREAMING_ERROR_INVALID_ELEMENT);
+		if(error_code != 0)
+			goto admin_response;
+		json_t *id = json_object_get(message, "id");
+		gboolean reset = json_is_true(json_object_get(message, "reset"));
+		json_t *list = json_array();
+		janus_mutex_lock(&mountpoints_mutex);
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, mountpoints);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) {
+			janus_streaming_mountpoint *mp = value;
+			if(id != NULL && (string_ids ? strcmp(mp->id_str, json_string_value(id)) :
+					mp->id != json_integer_value(id)))
+				continue;
+			json_t *ml = json_object();
+			json_object_set_new(ml, "id", string_ids ? json_string(mp->id_str) : json_integer(mp->id));
+			if(mp->description)
+				json_object_set_new(ml, "description", json_string(mp->description));
+			janus_mutex_lock(&mp->mutex);
+			json_object_set_new(ml, "viewers", json_integer(mp->viewers ? g_list_length(mp->viewers) : 0));
+			json_object_set_new(ml, "helper_threads", json_integer(mp->helper_threads));
+			janus_mutex_unlock(&mp->mutex);
+			json_object_set_new(ml, "usage", janus_usage_json(&mp->usage));
+			if(reset)
+				janus_usage_init(&mp->usage);
+			json_array_append_new(list, ml);
+		}
+		janus_mutex_unlock(&mountpoints_mutex);
+		response = json_object();
+		json_object_set_new(response, "streaming", json_string("usage"));
+		json_object_set_new(response, "mountpoints", list);
+		goto admin_response;
+	} else if((response = janus_streaming_process_synchronous_request(NULL, message)) != NULL) {
 		/* We got a response, send it back */
 		goto admin_response;
 	} else {
@@ -5616,8 +6621,10 @@ void janus_streaming_setup_media(janus_plugin_session *handle) {
 	}
 	if(mountpoint->streaming_source == janus_streaming_source_rtp) {
 		janus_streaming_rtp_source *source = mountpoint->source;
+		/* If there's a time-shift buffer, we'll start from a keyframe in there instead */
+		gboolean dvr = janus_streaming_dvr_seek_session(session, mountpoint);
 		GList *temp = source->media;
-		while(temp) {
+		while(temp && !dvr) {
 			janus_streaming_rtp_source_stream *stream = (janus_streaming_rtp_source_stream *)temp->data;
 			if(stream->keyframe.enabled) {
 				JANUS_LOG(LOG_HUGE, "Any keyframe to send? (%s)\n", stream->mid);
@@ -5634,7 +6641,7 @@ void janus_streaming_setup_media(janus_plugin_session *handle) {
 			}
 			/* If this mountpoint has RTCP support, send a PLI */
 			if(stream->type == JANUS_STREAMING_MEDIA_VIDEO)
-				janus_streaming_rtcp_pli_send(stream);
+				janus_streaming_rtcp_pli_request(source, stream);
 			temp = temp->next;
 		}
 	}
@@ -5688,21 +6695,25 @@ void janus_streaming_incoming_rtcp(janus_plugin_session *handle, janus_plugin_rt
 		JANUS_LOG(LOG_HUGE, "Got audio RTCP feedback from a viewer: SSRC %"SCNu32"\n",
 			janus_rtcp_get_sender_ssrc(buf, len));
 		/* FIXME We don't forward RR packets, so what should we check here? */
-	} else if(video && (stream->rtcp_fd > -1) && (stream->rtcp_addr.ss_family != 0)) {
+	} else if(video && (stream->from_origin || ((stream->rtcp_fd > -1) && (stream->rtcp_addr.ss_family != 0)))) {
 		JANUS_LOG(LOG_HUGE, "Got video RTCP feedback from a viewer: SSRC %"SCNu32"\n",
 			janus_rtcp_get_sender_ssrc(buf, len));
 		/* We only relay PLI/FIR and REMB packets, but in a selective way */
 		if(janus_rtcp_has_fir(buf, len) || janus_rtcp_has_pli(buf, len)) {
-			/* We got a PLI/FIR, pass it along unless we just sent one */
+			/* We got a PLI/FIR, pass it along unless we sent one in this window */
 			JANUS_LOG(LOG_HUGE, "  -- Keyframe request\n");
-			janus_streaming_rtcp_pli_send(stream);
+			janus_streaming_rtcp_pli_request(source, stream);
 		}
+		if(stream->from_origin)
+			return;
+		/* Keep track of the bandwidth this viewer can receive: if it's not
+		 * sending REMB, we use what the core estimated via transport-wide CC */
 		uint64_t bw = janus_rtcp_get_remb(buf, len);
+		if(bw == 0)
+			bw = gateway->get_bandwidth_estimate(handle);
 		if(bw > 0) {
-			/* Keep track of this value, if this is the lowest right now */
-			JANUS_LOG(LOG_HUGE, "  -- REMB for this PeerConnection: %"SCNu64"\n", bw);
-			if((0 == source->lowest_bitrate) || (source->lowest_bitrate > bw))
-				source->lowest_bitrate = bw;
+			JANUS_LOG(LOG_HUGE, "  -- Estimate for this PeerConnection: %"SCNu64"\n", bw);
+			janus_streaming_feedback_remb(source, session, bw > G_MAXUINT32 ? G_MAXUINT32 : (uint32_t)bw);
 		}
 	}
 }
@@ -5781,22 +6792,7 @@ static void janus_streaming_hangup_media_internal(janus_plugin_session *handle)
 		mp->viewers = g_list_remove_all(mp->viewers, session);
 		if(mp->streaming_source == janus_streaming_source_rtp) {
 			/* Remove the viewer from the helper threads too, if any */
-			if(mp->helper_threads > 0) {
-				GList *l = mp->threads;
-				while(l) {
-					janus_streaming_helper *ht = (janus_streaming_helper *)l->data;
-					janus_mutex_lock(&ht->mutex);
-					if(g_list_find(ht->viewers, session) != NULL) {
-						ht->num_viewers--;
-						ht->viewers = g_list_remove_all(ht->viewers, session);
-						janus_mutex_unlock(&ht->mutex);
-						JANUS_LOG(LOG_VERB, "Removing viewer from helper thread #%d\n", ht->id);
-						break;
-					}
-					janus_mutex_unlock(&ht->mutex);
-					l = l->next;
-				}
-			}
+			janus_streaming_helper_remove_viewer(mp, session);
 		}
 		/* Get rid of streams and streams_byid while holding the mountpoint mutex */
 		g_list_free_full(session->streams, (GDestroyNotify)(janus_streaming_session_stream_free));
@@ -5949,6 +6945,20 @@ static void *janus_streaming_handler(void *data) {
 				janus_mutex_unlock(&sessions_mutex);
 				goto error;
 			}
+			/* Check if the viewer wants to watch the mountpoint with a delay */
+			json_t *timeshift = json_object_get(root, "timeshift");
+			if(timeshift && json_integer_value(timeshift) > 0 && (mp->streaming_source != janus_streaming_source_rtp ||
+					((janus_streaming_rtp_source *)mp->source)->dvr == NULL)) {
+				JANUS_LOG(LOG_ERR, "Mountpoint %s has no time-shift buffer\n", mp->id_str);
+				error_code = JANUS_STREAMING_ERROR_INVALID_REQUEST;
+				g_snprintf(error_cause, 512, "Mountpoint %s has no time-shift buffer", mp->id_str);
+				janus_refcount_decrease(&mp->ref);
+				janus_mutex_unlock(&mountpoints_mutex);
+				janus_mutex_unlock(&sessions_mutex);
+				goto error;
+			}
+			if(!do_restart)
+				session->timeshift = timeshift ? json_integer_value(timeshift)*G_USEC_PER_SEC : 0;
 			janus_mutex_lock(&mp->mutex);
 			janus_mutex_lock(&session->mutex);
 			janus_mutex_unlock(&mountpoints_mutex);
@@ -6095,13 +7105,14 @@ static void *janus_streaming_handler(void *data) {
 				g_hash_table_insert(session->streams_byid, GINT_TO_POINTER(s->mindex), s);
 			}
 			if(mp->streaming_type == janus_streaming_type_on_demand) {
-				/* Spawn a thread */
+				/* Spawn a thread, unless one of the shared ones can serve this viewer */
 				GError *error = NULL;
 				char tname[16];
 				g_snprintf(tname, sizeof(tname), "mp %s", mp->id_str);
 				janus_refcount_increase(&session->ref);
 				janus_refcount_increase(&mp->ref);
-				g_thread_try_new(tname, &janus_streaming_ondemand_thread, session, &error);
+				if(!janus_streaming_ondemand_add_viewer(session, mp))
+					g_thread_try_new(tname, &janus_streaming_ondemand_thread, session, &error);
 				if(error != NULL) {
 					session->mountpoint = NULL;
 					janus_mutex_unlock(&session->mutex);
@@ -6338,25 +7349,7 @@ done:
 				mp->viewers = g_list_append(mp->viewers, session);
 				if(mp->streaming_source == janus_streaming_source_rtp) {
 					/* If we're using helper threads, add the viewer to one of those */
-					if(mp->helper_threads > 0) {
-						int viewers = -1;
-						janus_streaming_helper *helper = NULL;
-						GList *l = mp->threads;
-						while(l) {
-							janus_streaming_helper *ht = (janus_streaming_helper *)l->data;
-							if(viewers == -1 || (helper == NULL && ht->num_viewers == 0) || ht->num_viewers < viewers) {
-								viewers = ht->num_viewers;
-								helper = ht;
-							}
-							l = l->next;
-						}
-						janus_mutex_lock(&helper->mutex);
-						helper->viewers = g_list_append(helper->viewers, session);
-						helper->num_viewers++;
-						janus_mutex_unlock(&helper->mutex);
-						JANUS_LOG(LOG_VERB, "Added viewer to helper thread #%d (%d viewers)\n",
-							helper->id, helper->num_viewers);
-					}
+					janus_streaming_helper_add_viewer(mp, session);
 				}
 			}
 			janus_mutex_unlock(&session->mutex);
@@ -6440,6 +7433,20 @@ done:
 				janus_sdp_destroy(parsed_sdp);
 				goto error;
 			}
+			/* Check if the viewer wants to watch the mountpoint with a delay */
+			json_t *timeshift = json_object_get(root, "timeshift");
+			if(timeshift && json_integer_value(timeshift) > 0 && (mp->streaming_source != janus_streaming_source_rtp ||
+					((janus_streaming_rtp_source *)mp->source)->dvr == NULL)) {
+				JANUS_LOG(LOG_ERR, "Mountpoint %s has no time-shift buffer\n", mp->id_str);
+				error_code = JANUS_STREAMING_ERROR_INVALID_REQUEST;
+				g_snprintf(error_cause, 512, "Mountpoint %s has no time-shift buffer", mp->id_str);
+				janus_refcount_decrease(&mp->ref);
+				janus_mutex_unlock(&mountpoints_mutex);
+				janus_mutex_unlock(&sessions_mutex);
+				janus_sdp_destroy(parsed_sdp);
+				goto error;
+			}
+			session->timeshift = timeshift ? json_integer_value(timeshift)*G_USEC_PER_SEC : 0;
 			janus_mutex_lock(&mp->mutex);
 			janus_mutex_lock(&session->mutex);
 			janus_mutex_unlock(&mountpoints_mutex);
@@ -6614,13 +7621,14 @@ done:
 				/* FIXME Ended up not subscribing to any stream? */
 				JANUS_LOG(LOG_WARN, "Not subscribed to any stream (all m-lines rejected)\n");
 			} else if(mp->streaming_type == janus_streaming_type_on_demand) {
-				/* Spawn a thread */
+				/* Spawn a thread, unless one of the shared ones can serve this viewer */
 				GError *error = NULL;
 				char tname[16];
 				g_snprintf(tname, sizeof(tname), "mp %s", mp->id_str);
 				janus_refcount_increase(&session->ref);
 				janus_refcount_increase(&mp->ref);
-				g_thread_try_new(tname, &janus_streaming_ondemand_thread, session, &error);
+				if(!janus_streaming_ondemand_add_viewer(session, mp))
+					g_thread_try_new(tname, &janus_streaming_ondemand_thread, session, &error);
 				if(error != NULL) {
 					JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the on-demand thread...\n",
 						error->code, error->message ? error->message : "??");
@@ -6643,25 +7651,7 @@ done:
 				mp->viewers = g_list_append(mp->viewers, session);
 				if(mp->streaming_source == janus_streaming_source_rtp) {
 					/* If we're using helper threads, add the viewer to one of those */
-					if(mp->helper_threads > 0) {
-						int viewers = -1;
-						janus_streaming_helper *helper = NULL;
-						GList *l = mp->threads;
-						while(l) {
-							janus_streaming_helper *ht = (janus_streaming_helper *)l->data;
-							if(viewers == -1 || (helper == NULL && ht->num_viewers == 0) || ht->num_viewers < viewers) {
-								viewers = ht->num_viewers;
-								helper = ht;
-							}
-							l = l->next;
-						}
-						janus_mutex_lock(&helper->mutex);
-						helper->viewers = g_list_append(helper->viewers, session);
-						helper->num_viewers++;
-						janus_mutex_unlock(&helper->mutex);
-						JANUS_LOG(LOG_VERB, "Added viewer to helper thread #%d (%d viewers)\n",
-							helper->id, helper->num_viewers);
-					}
+					janus_streaming_helper_add_viewer(mp, session);
 				}
 			}
 			janus_refcount_increase(&session->ref);
@@ -6827,6 +7817,14 @@ done:
 			if(error_code != 0) {
 				goto error;
 			}
+			json_t *timeshift = json_object_get(root, "timeshift");
+			if(timeshift && (mp->streaming_source != janus_streaming_source_rtp ||
+					((janus_streaming_rtp_source *)mp->source)->dvr == NULL)) {
+				JANUS_LOG(LOG_ERR, "Mountpoint %s has no time-shift buffer\n", mp->id_str);
+				error_code = JANUS_STREAMING_ERROR_INVALID_REQUEST;
+				g_snprintf(error_cause, 512, "Mountpoint %s has no time-shift buffer", mp->id_str);
+				goto error;
+			}
 
 			if(mp->streaming_source == janus_streaming_source_rtp) {
 				/* Enforce the requested changes */
@@ -6974,6 +7972,12 @@ done:
 					}
 				}
 			}
+			if(timeshift) {
+				/* Rewind or catch up: if we're already sending media, move to the right keyframe now */
+				session->timeshift = json_integer_value(timeshift)*G_USEC_PER_SEC;
+				if(g_atomic_int_get(&session->started))
+					janus_streaming_dvr_seek_session(session, mp);
+			}
 			/* Done */
 			result = json_object();
 			json_object_set_new(result, "event", json_string("configured"));
@@ -7062,23 +8066,11 @@ done:
 			janus_mutex_unlock(&session->mutex);
 			janus_mutex_lock(&oldmp->mutex);
 			oldmp->viewers = g_list_remove_all(oldmp->viewers, session);
+			/* Any time-shift only made sense for the previous mountpoint */
+			g_atomic_int_set(&session->timeshifted, 0);
+			session->timeshift = 0;
 			/* Remove the viewer from the helper threads too, if any */
-			if(oldmp->helper_threads > 0) {
-				GList *l = oldmp->threads;
-				while(l) {
-					janus_streaming_helper *ht = (janus_streaming_helper *)l->data;
-					janus_mutex_lock(&ht->mutex);
-					if(g_list_find(ht->viewers, session) != NULL) {
-						ht->num_viewers--;
-						ht->viewers = g_list_remove_all(ht->viewers, session);
-						janus_mutex_unlock(&ht->mutex);
-						JANUS_LOG(LOG_VERB, "Removing viewer from helper thread #%d (switching)\n", ht->id);
-						break;
-					}
-					janus_mutex_unlock(&ht->mutex);
-					l = l->next;
-				}
-			}
+			janus_streaming_helper_remove_viewer(oldmp, session);
 			janus_refcount_decrease(&oldmp->ref);	/* This is for the user going away */
 			janus_mutex_unlock(&oldmp->mutex);
 			/* Subscribe to the new one */
@@ -7087,24 +8079,7 @@ done:
 			janus_refcount_increase(&mp->ref);
 			mp->viewers = g_list_append(mp->viewers, session);
 			/* If we're using helper threads, add the viewer to one of those */
-			if(mp->helper_threads > 0) {
-				int viewers = -1;
-				janus_streaming_helper *helper = NULL;
-				GList *l = mp->threads;
-				while(l) {
-					janus_streaming_helper *ht = (janus_streaming_helper *)l->data;
-					if(viewers == -1 || (helper == NULL && ht->num_viewers == 0) || ht->num_viewers < viewers) {
-						viewers = ht->num_viewers;
-						helper = ht;
-					}
-					l = l->next;
-				}
-				JANUS_LOG(LOG_VERB, "Adding viewer to helper thread #%d\n", helper->id);
-				janus_mutex_lock(&helper->mutex);
-				helper->viewers = g_list_append(helper->viewers, session);
-				helper->num_viewers++;
-				janus_mutex_unlock(&helper->mutex);
-			}
+			janus_streaming_helper_add_viewer(mp, session);
 			session->mountpoint = mp;
 			/* Send a PLI too, in case the mountpoint supports video and RTCP */
 			janus_streaming_rtp_source *source = mp->source;
@@ -7112,7 +8087,7 @@ done:
 			while(temp) {
 				janus_streaming_rtp_source_stream *stream = (janus_streaming_rtp_source_stream *)temp->data;
 				if(stream && stream->type == JANUS_STREAMING_MEDIA_VIDEO)
-					janus_streaming_rtcp_pli_send(stream);
+					janus_streaming_rtcp_pli_request(source, stream);
 				temp = temp->next;
 			}
 			g_atomic_int_set(&session->paused, 0);
@@ -7367,6 +8342,16 @@ static int janus_streaming_create_fd(int port, in_addr_t mcast, const janus_netw
 			if(!use_range)	/* Asked for a specific port but it's not available, give up */
 				break;
 		} else {
+#ifdef SO_TIMESTAMPNS
+			if(kernel_timestamps) {
+				/* Have the kernel tell us when packets were actually received */
+				int on = 1;
+				if(setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0) {
+					JANUS_LOG(LOG_WARN, "[%s] %s listener setsockopt SO_TIMESTAMPNS failed... %d (%s)\n",
+						mountpointname, listenername, errno, g_strerror(errno));
+				}
+			}
+#endif
 			if(use_range)
 				rtp_range_slider = port;	/* Update global slider */
 			break;
@@ -7465,6 +8450,9 @@ static void janus_streaming_rtp_source_stream_free(const janus_refcount *st_ref)
 	g_free(stream->mstid);
 	g_free(stream->mcast_str);
 	g_free(stream->iface_str);
+	janus_streaming_reorder_free(stream->reorder[0]);
+	janus_streaming_reorder_free(stream->reorder[1]);
+	janus_streaming_reorder_free(stream->reorder[2]);
 	g_free(stream);
 }
 
@@ -7510,12 +8498,24 @@ static void janus_streaming_rtp_source_free(gpointer data) {
 #endif
 	g_list_free_full(source->media, (GDestroyNotify)(janus_streaming_rtp_source_stream_unref));
 	g_hash_table_unref(source->media_byid);
+	janus_streaming_dvr_free(source->dvr);
+	janus_streaming_edges_free(source->edges);
+	janus_streaming_origin_free(source->origin);
 	g_hash_table_unref(source->media_byfd);
+	if(source->remb_estimates != NULL)
+		g_hash_table_destroy(source->remb_estimates);
+	janus_mutex_destroy(&source->feedback_mutex);
 	g_free(source);
 }
 
 static void janus_streaming_file_source_free(gpointer data) {
 	janus_streaming_file_source *source = (janus_streaming_file_source *)data;
+	if(source->frames != NULL) {
+		g_byte_array_free(source->frames->data, TRUE);
+		g_array_free(source->frames->index, TRUE);
+		g_free(source->frames);
+	}
+	janus_mutex_destroy(&source->frames_mutex);
 	g_free(source->codecs.fmtp);
 	g_free(source->filename);
 	g_free(source);
@@ -7688,7 +8688,7 @@ janus_streaming_rtp_source_stream *janus_streaming_create_rtp_source_stream(
 
 janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 		uint64_t id, char *id_str, char *name, char *desc, char *metadata,
-		GList *media, int srtpsuite, char *srtpcrypto, int threads, int rtp_collision,
+		GList *media, int srtpsuite, char *srtpcrypto, int threads, int ingest_threads, int rtp_collision,
 		gboolean e2ee, gboolean playoutdelay_ext, int abscapturetime_src_ext_id) {
 	char id_num[30];
 	if(!string_ids) {
@@ -7716,6 +8716,7 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 	janus_network_address_nullify(&nil);
 
 	janus_streaming_mountpoint *live_rtp = g_malloc0(sizeof(janus_streaming_mountpoint));
+	janus_usage_init(&live_rtp->usage);
 	live_rtp->id = id;
 	live_rtp->id_str = g_strdup(id_str);
 	live_rtp->name = g_strdup(name ? name : tempname);
@@ -7782,9 +8783,13 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 	live_rtp_source->media = media;
 	live_rtp_source->media_byid = g_hash_table_new(NULL, NULL);
 	live_rtp_source->media_byfd = g_hash_table_new(NULL, NULL);
+	/* Streams are spread across the ingest threads: there's no point in having more threads than streams */
+	live_rtp_source->ingest_threads = MIN(MAX(ingest_threads, 1), (int)g_list_length(media));
+	int position = 0;
 	GList *temp = media;
 	while(temp) {
 		janus_streaming_rtp_source_stream *stream = (janus_streaming_rtp_source_stream *)temp->data;
+		stream->ingest = (position++) % live_rtp_source->ingest_threads;
 		if(stream->type == JANUS_STREAMING_MEDIA_AUDIO)
 			live_rtp->audio = TRUE;
 		else if(stream->type == JANUS_STREAMING_MEDIA_VIDEO)
@@ -7808,6 +8813,7 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 	live_rtp_source->pipefd[1] = -1;
 	pipe(live_rtp_source->pipefd);
 	janus_mutex_init(&live_rtp_source->rec_mutex);
+	janus_streaming_feedback_init(live_rtp_source);
 	live_rtp_source->rtp_collision = rtp_collision;
 	live_rtp_source->e2ee = e2ee;
 	live_rtp_source->playoutdelay_ext = playoutdelay_ext;
@@ -7829,33 +8835,11 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 	if(threads > 0) {
 		int i=0;
 		for(i=0; i<threads; i++) {
-			janus_streaming_helper *helper = g_malloc0(sizeof(janus_streaming_helper));
-			helper->id = i+1;
-			helper->mp = live_rtp;
-			helper->queued_packets = g_async_queue_new_full((GDestroyNotify)janus_streaming_rtp_relay_packet_free);
-			janus_mutex_init(&helper->mutex);
-			janus_refcount_init(&helper->ref, janus_streaming_helper_free);
-			live_rtp->helper_threads++;
-			/* Spawn a thread and add references */
-			g_snprintf(tname, sizeof(tname), "help %u-%"SCNu64, helper->id, live_rtp->id);
-			janus_refcount_increase(&live_rtp->ref);
-			janus_refcount_increase(&helper->ref);
-			helper->thread = g_thread_try_new(tname, &janus_streaming_helper_thread, helper, &error);
-			if(error != NULL) {
-				JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the helper thread...\n",
-					error->code, error->message ? error->message : "??");
-				g_error_free(error);
-				janus_refcount_decrease(&live_rtp->ref);	/* This is for the helper thread */
-				g_async_queue_unref(helper->queued_packets);
-				janus_refcount_decrease(&helper->ref);
-				/* This extra unref is for the init */
-				janus_refcount_decrease(&helper->ref);
+			if(janus_streaming_helper_spawn(live_rtp) == NULL) {
 				janus_mutex_unlock(&mountpoints_mutex);
 				janus_streaming_mountpoint_destroy(live_rtp);
 				return NULL;
 			}
-			janus_refcount_increase(&helper->ref);
-			live_rtp->threads = g_list_append(live_rtp->threads, helper);
 		}
 	}
 	janus_mutex_unlock(&mountpoints_mutex);
@@ -7871,6 +8855,26 @@ janus_streaming_mountpoint *janus_streaming_create_rtp_source(
 		janus_streaming_mountpoint_destroy(live_rtp);
 		return NULL;
 	}
+	/* If the streams are spread across more ingest threads, spawn the others too */
+	int i = 0;
+	for(i=1; i<live_rtp_source->ingest_threads; i++) {
+		janus_streaming_ingest *ingest = g_malloc0(sizeof(janus_streaming_ingest));
+		ingest->mountpoint = live_rtp;
+		ingest->id = i;
+		g_snprintf(tname, sizeof(tname), "mp %d-%s", i, live_rtp->id_str);
+		janus_refcount_increase(&live_rtp->ref);
+		GThread *thread = g_thread_try_new(tname, &janus_streaming_ingest_thread, ingest, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the RTP ingest thread...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			g_free(ingest);
+			janus_refcount_decrease(&live_rtp->ref);	/* This is for the failed thread */
+			janus_streaming_mountpoint_destroy(live_rtp);
+			return NULL;
+		}
+		live_rtp_source->ingest = g_list_append(live_rtp_source->ingest, thread);
+	}
 	return live_rtp;
 }
 
@@ -7917,6 +8921,7 @@ janus_streaming_mountpoint *janus_streaming_create_file_source(
 	}
 #endif
 	janus_streaming_mountpoint *file_source = g_malloc0(sizeof(janus_streaming_mountpoint));
+	janus_usage_init(&file_source->usage);
 	file_source->id = id;
 	file_source->id_str = g_strdup(id_str);
 	char tempname[255];
@@ -7944,6 +8949,7 @@ janus_streaming_mountpoint *janus_streaming_create_file_source(
 	file_source->streaming_type = live ? janus_streaming_type_live : janus_streaming_type_on_demand;
 	file_source->streaming_source = janus_streaming_source_file;
 	janus_streaming_file_source *file_source_source = g_malloc0(sizeof(janus_streaming_file_source));
+	janus_mutex_init(&file_source_source->frames_mutex);
 	file_source_source->filename = g_strdup(filename);
 	file_source->source = file_source_source;
 	file_source->source_destroy = (GDestroyNotify)janus_streaming_file_source_free;
@@ -8833,6 +9839,115 @@ static int janus_streaming_rtsp_play(janus_streaming_rtp_source *source) {
 	return 0;
 }
 
+/* Helper to reconnect to the RTSP server, from the control pool */
+static void janus_streaming_rtsp_reconnect_to_server(janus_streaming_mountpoint *mp) {
+	janus_streaming_rtp_source *source = (janus_streaming_rtp_source *)mp->source;
+	/* Let's clean up the source first */
+	janus_mutex_lock(&source->rtsp_mutex);
+	curl_easy_cleanup(source->curl);
+	source->curl = NULL;
+	g_free(source->curl_errbuf);
+	source->curl_errbuf = NULL;
+	if(source->curldata)
+		g_free(source->curldata->buffer);
+	g_free(source->curldata);
+	source->curldata = NULL;
+	janus_mutex_unlock(&source->rtsp_mutex);
+	/* Now let's try to reconnect */
+	gboolean connected = FALSE;
+	if(janus_streaming_rtsp_connect_to_server(mp) < 0) {
+		/* Reconnection failed? Let's try again later */
+		JANUS_LOG(LOG_WARN, "[%s] Reconnection of the RTSP stream failed\n", mp->name);
+	} else if(janus_streaming_rtsp_play(source) < 0) {
+		/* Error trying to play? Let's try again later */
+		JANUS_LOG(LOG_WARN, "[%s] RTSP PLAY failed\n", mp->name);
+	} else {
+		/* Everything should be back to normal */
+		JANUS_LOG(LOG_INFO, "[%s] Reconnected to the RTSP server, streaming again\n", mp->name);
+		connected = TRUE;
+	}
+	if(connected) {
+		source->reconnect_failures = 0;
+		source->reconnect_backoff = 0;
+	} else {
+		/* Wait exponentially longer after each failure, with some jitter, so
+		 * that cameras that went away together don't all come back together */
+		source->reconnect_failures++;
+		gint64 max_backoff = MAX(source->reconnect_delay, JANUS_STREAMING_RTSP_MAX_BACKOFF);
+		gint64 backoff = source->reconnect_delay;
+		int i = 0;
+		for(i=1; i<source->reconnect_failures && backoff < max_backoff; i++)
+			backoff *= 2;
+		if(backoff > max_backoff)
+			backoff = max_backoff;
+		source->reconnect_backoff = backoff + (gint64)(g_random_double_range(-0.2, 0.2) * backoff);
+		JANUS_LOG(LOG_WARN, "[%s] Trying again in %"SCNi64" ms (%d failures)\n", mp->name,
+			source->reconnect_backoff/1000, source->reconnect_failures);
+	}
+	source->reconnect_timer = janus_get_monotonic_time();
+	g_atomic_int_set(&source->rtsp_connected, connected);
+}
+
+/* Helper to send an RTSP OPTIONS as a keep-alive, from the control pool */
+static void janus_streaming_rtsp_send_keepalive(janus_streaming_mountpoint *mp) {
+	janus_streaming_rtp_source *source = (janus_streaming_rtp_source *)mp->source;
+	janus_mutex_lock(&source->rtsp_mutex);
+	if(source->curl == NULL || source->curldata == NULL) {
+		janus_mutex_unlock(&source->rtsp_mutex);
+		return;
+	}
+	JANUS_LOG(LOG_VERB, "[%s] Sending OPTIONS\n", mp->name);
+	g_free(source->curldata->buffer);
+	source->curldata->buffer = g_malloc0(1);
+	source->curldata->size = 0;
+	curl_easy_setopt(source->curl, CURLOPT_RTSP_STREAM_URI, source->rtsp_url);
+	curl_easy_setopt(source->curl, CURLOPT_RTSP_REQUEST, (long)CURL_RTSPREQ_OPTIONS);
+	int res = curl_easy_perform(source->curl);
+	if(res != CURLE_OK) {
+		JANUS_LOG(LOG_ERR, "[%s] Couldn't send OPTIONS request: %s (%s)\n",
+			mp->name, curl_easy_strerror(res), source->curl_errbuf);
+	}
+	janus_mutex_unlock(&source->rtsp_mutex);
+}
+
+static void janus_streaming_rtsp_task_run(gpointer data, gpointer user_data) {
+	janus_streaming_rtsp_task *task = (janus_streaming_rtsp_task *)data;
+	janus_streaming_mountpoint *mp = task->mp;
+	janus_streaming_rtp_source *source = (janus_streaming_rtp_source *)mp->source;
+	if(!g_atomic_int_get(&stopping) && !g_atomic_int_get(&mp->destroyed)) {
+		if(task->request == janus_streaming_rtsp_reconnect)
+			janus_streaming_rtsp_reconnect_to_server(mp);
+		else
+			janus_streaming_rtsp_send_keepalive(mp);
+	}
+	if(task->request == janus_streaming_rtsp_reconnect)
+		g_atomic_int_set(&source->reconnecting, 0);
+	g_atomic_int_set(&source->rtsp_busy, 0);
+	janus_refcount_decrease(&mp->ref);
+	g_free(task);
+}
+
+/* Helper to queue an RTSP request for a mountpoint: only one request per
+ * mountpoint can be queued at any time, so this fails if there's one already */
+static gboolean janus_streaming_rtsp_schedule(janus_streaming_mountpoint *mp, janus_streaming_rtsp_request request) {
+	janus_streaming_rtp_source *source = (janus_streaming_rtp_source *)mp->source;
+	if(g_atomic_int_get(&stopping) || !g_atomic_int_compare_and_exchange(&source->rtsp_busy, 0, 1))
+		return FALSE;
+	if(request == janus_streaming_rtsp_reconnect)
+		g_atomic_int_set(&source->reconnecting, 1);
+	janus_streaming_rtsp_task *task = g_malloc(sizeof(janus_streaming_rtsp_task));
+	janus_refcount_increase(&mp->ref);
+	task->mp = mp;
+	task->request = request;
+	if(rtsp_pool == NULL) {
+		/* No pool, we'll have to do this ourselves */
+		janus_streaming_rtsp_task_run(task, NULL);
+	} else {
+		g_thread_pool_push(rtsp_pool, task, NULL);
+	}
+	return TRUE;
+}
+
 /* Helper to create an RTSP source */
 janus_streaming_mountpoint *janus_streaming_create_rtsp_source(
 		uint64_t id, char *id_str, char *name, char *desc, char *metadata,
@@ -8895,6 +10010,7 @@ janus_streaming_mountpoint *janus_streaming_create_rtsp_source(
 
 	/* Create the mountpoint and prepare the source */
 	janus_streaming_mountpoint *live_rtsp = g_malloc0(sizeof(janus_streaming_mountpoint));
+	janus_usage_init(&live_rtsp->usage);
 	live_rtsp->id = id;
 	live_rtsp->id_str = g_strdup(id_str);
 	live_rtsp->name = sourcename;
@@ -8928,6 +10044,7 @@ janus_streaming_mountpoint *janus_streaming_create_rtsp_source(
 	live_rtsp_source->rtsp_conn_timeout = rtsp_conn_timeout;
 	live_rtsp_source->reconnect_timer = 0;
 	janus_mutex_init(&live_rtsp_source->rtsp_mutex);
+	janus_streaming_feedback_init(live_rtsp_source);
 	live_rtsp->source = live_rtsp_source;
 	live_rtsp->source_destroy = (GDestroyNotify)janus_streaming_rtp_source_free;
 	live_rtsp->viewers = NULL;
@@ -8959,6 +10076,7 @@ janus_streaming_mountpoint *janus_streaming_create_rtsp_source(
 			janus_refcount_decrease(&live_rtsp->ref);
 			return NULL;
 		}
+		g_atomic_int_set(&live_rtsp_source->rtsp_connected, 1);
 	}
 	/* If we need helper threads, spawn them now */
 	GError *error = NULL;
@@ -8966,32 +10084,10 @@ janus_streaming_mountpoint *janus_streaming_create_rtsp_source(
 	if(threads > 0) {
 		int i=0;
 		for(i=0; i<threads; i++) {
-			janus_streaming_helper *helper = g_malloc0(sizeof(janus_streaming_helper));
-			helper->id = i+1;
-			helper->mp = live_rtsp;
-			helper->queued_packets = g_async_queue_new_full((GDestroyNotify)janus_streaming_rtp_relay_packet_free);
-			janus_mutex_init(&helper->mutex);
-			janus_refcount_init(&helper->ref, janus_streaming_helper_free);
-			live_rtsp->helper_threads++;
-			/* Spawn a thread and add references */
-			g_snprintf(tname, sizeof(tname), "help %u-%"SCNu64, helper->id, live_rtsp->id);
-			janus_refcount_increase(&live_rtsp->ref);
-			janus_refcount_increase(&helper->ref);
-			helper->thread = g_thread_try_new(tname, &janus_streaming_helper_thread, helper, &error);
-			if(error != NULL) {
-				JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the helper thread...\n",
-					error->code, error->message ? error->message : "??");
-				g_error_free(error);
-				janus_refcount_decrease(&live_rtsp->ref);	/* This is for the helper thread */
-				g_async_queue_unref(helper->queued_packets);
-				janus_refcount_decrease(&helper->ref);
-				/* This extra unref is for the init */
-				janus_refcount_decrease(&helper->ref);
+			if(janus_streaming_helper_spawn(live_rtsp) == NULL) {
 				janus_refcount_decrease(&live_rtsp->ref);
 				return NULL;
 			}
-			janus_refcount_increase(&helper->ref);
-			live_rtsp->threads = g_list_append(live_rtsp->threads, helper);
 		}
 	}
 	/* Finally, start the thread that will receive the media packets */
@@ -9198,6 +10294,221 @@ static void *janus_streaming_ondemand_thread(void *data) {
 	return NULL;
 }
 
+/* Helper to split a file in frames, for the shared on-demand playout */
+static janus_streaming_ondemand_frames *janus_streaming_ondemand_load(const char *name, janus_streaming_file_source *source) {
+	FILE *file = fopen(source->filename, "rb");
+	if(file == NULL) {
+		JANUS_LOG(LOG_ERR, "[%s] Ooops, audio file missing!\n", name);
+		return NULL;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if(size <= 0 || size > JANUS_STREAMING_ONDEMAND_MAX_SIZE) {
+		JANUS_LOG(LOG_WARN, "[%s] File too large for the shared on-demand playout (%ld bytes), using a thread per viewer\n", name, size);
+		fclose(file);
+		return NULL;
+	}
+	janus_streaming_ondemand_frames *frames = g_malloc0(sizeof(janus_streaming_ondemand_frames));
+	frames->data = g_byte_array_sized_new(size);
+	frames->index = g_array_new(FALSE, FALSE, sizeof(janus_streaming_ondemand_frame));
+	char buf[1500];
+	janus_streaming_ondemand_frame frame;
+	int read = 0;
+	if(source->opus) {
+#ifdef HAVE_LIBOGG
+		janus_streaming_opus_context opusctx = { 0 };
+		opusctx.name = (char *)name;
+		opusctx.filename = source->filename;
+		opusctx.file = file;
+		if(janus_streaming_opus_context_init(&opusctx) == 0) {
+			/* The context rewinds automatically, so we stop when that happens: frames
+			 * must leave room for the RTP header in the buffer the workers send from */
+			while((read = janus_streaming_opus_context_read(&opusctx, buf, sizeof(buf)-RTP_HEADER_SIZE)) >= 0 && !opusctx.rewound) {
+				frame.offset = frames->data->len;
+				frame.length = read;
+				g_byte_array_append(frames->data, (guint8 *)buf, read);
+				g_array_append_val(frames->index, frame);
+			}
+			if(read < 0) {
+				/* Broken file, or a frame too large to be sent: don't share it */
+				JANUS_LOG(LOG_WARN, "[%s] Error reading frames from %s (%d)\n", name, source->filename, read);
+				g_array_set_size(frames->index, 0);
+			}
+		}
+		janus_streaming_opus_context_cleanup(&opusctx);
+#endif
+	} else {
+		/* Raw mu-Law and a-Law files are sent in 20ms chunks, as the per-viewer thread does */
+		while((read = fread(buf, sizeof(char), 160, file)) == 160 && !feof(file)) {
+			frame.offset = frames->data->len;
+			frame.length = read;
+			g_byte_array_append(frames->data, (guint8 *)buf, read);
+			g_array_append_val(frames->index, frame);
+		}
+	}
+	fclose(file);
+	if(frames->index->len == 0) {
+		JANUS_LOG(LOG_WARN, "[%s] Couldn't get any frame out of %s, using a thread per viewer\n", name, source->filename);
+		g_byte_array_free(frames->data, TRUE);
+		g_array_free(frames->index, TRUE);
+		g_free(frames);
+		return NULL;
+	}
+	JANUS_LOG(LOG_VERB, "[%s] Loaded %u frames (%u bytes) from %s\n", name,
+		frames->index->len, frames->data->len, source->filename);
+	return frames;
+}
+
+/* A viewer served by one of the shared on-demand threads */
+typedef struct janus_streaming_ondemand_viewer {
+	janus_streaming_session *session;
+	janus_streaming_mountpoint *mountpoint;
+	janus_streaming_ondemand_frames *frames;
+	guint next;
+	guint16 seq;
+	guint32 ts;
+	gboolean first;
+} janus_streaming_ondemand_viewer;
+
+/* Helper to have one of the shared threads serve a new viewer of an on-demand
+ * mountpoint: it takes ownership of the session and mountpoint references, and
+ * returns FALSE if the viewer needs its own thread instead */
+static gboolean janus_streaming_ondemand_add_viewer(janus_streaming_session *session, janus_streaming_mountpoint *mp) {
+	if(ondemand_workers == NULL || mp->streaming_source != janus_streaming_source_file)
+		return FALSE;
+	janus_streaming_file_source *source = mp->source;
+	if(source == NULL || source->filename == NULL)
+		return FALSE;
+	/* Pick the least busy thread */
+	janus_streaming_ondemand_worker *worker = NULL;
+	int i = 0;
+	for(i=0; i<ondemand_threads; i++) {
+		if(ondemand_workers[i].thread == NULL)
+			continue;
+		if(worker == NULL || g_atomic_int_get(&ondemand_workers[i].count) < g_atomic_int_get(&worker->count))
+			worker = &ondemand_workers[i];
+	}
+	if(worker == NULL)
+		return FALSE;
+	/* Make sure the file has been split in frames already */
+	janus_mutex_lock(&source->frames_mutex);
+	if(!source->frames_loaded) {
+		source->frames = janus_streaming_ondemand_load(mp->name ? mp->name : "??", source);
+		source->frames_loaded = TRUE;
+	}
+	janus_streaming_ondemand_frames *frames = source->frames;
+	janus_mutex_unlock(&source->frames_mutex);
+	if(frames == NULL)
+		return FALSE;
+	janus_streaming_ondemand_viewer *viewer = g_malloc0(sizeof(janus_streaming_ondemand_viewer));
+	viewer->session = session;
+	viewer->mountpoint = mp;
+	viewer->frames = frames;
+	viewer->seq = 1;
+	viewer->first = TRUE;
+	janus_mutex_lock(&worker->mutex);
+	worker->viewers = g_list_prepend(worker->viewers, viewer);
+	g_atomic_int_inc(&worker->count);
+	janus_mutex_unlock(&worker->mutex);
+	JANUS_LOG(LOG_VERB, "[%s] Serving viewer %p in on-demand thread #%u\n", mp->name, session, worker->id);
+	return TRUE;
+}
+
+static void janus_streaming_ondemand_viewer_free(janus_streaming_ondemand_viewer *viewer) {
+	janus_refcount_decrease(&viewer->session->ref);
+	janus_refcount_decrease(&viewer->mountpoint->ref);
+	g_free(viewer);
+}
+
+/* Thread to serve viewers of on-demand mountpoints: all viewers need a new
+ * packet every 20ms, so a single tick per thread is enough to serve them all */
+static void *janus_streaming_ondemand_worker_thread(void *data) {
+	janus_streaming_ondemand_worker *worker = (janus_streaming_ondemand_worker *)data;
+	JANUS_LOG(LOG_VERB, "Joining on-demand thread #%u\n", worker->id);
+	char buf[1500];
+	memset(buf, 0, sizeof(buf));
+	janus_rtp_header *header = (janus_rtp_header *)buf;
+	janus_streaming_rtp_relay_packet packet;
+	gint64 next = janus_get_monotonic_time();
+	GList *gone = NULL;
+	while(!g_atomic_int_get(&stopping)) {
+		/* Wait for the next tick */
+		gint64 now = janus_get_monotonic_time();
+		next += 20000;
+		if(next > now) {
+			g_usleep(next - now);
+		} else if(now - next > 100000) {
+			/* We're way behind, don't try to catch up */
+			next = now;
+		}
+		janus_mutex_lock(&worker->mutex);
+		GList *temp = worker->viewers;
+		while(temp) {
+			janus_streaming_ondemand_viewer *viewer = (janus_streaming_ondemand_viewer *)temp->data;
+			janus_streaming_session *session = viewer->session;
+			janus_streaming_mountpoint *mountpoint = viewer->mountpoint;
+			if(g_atomic_int_get(&mountpoint->destroyed) || g_atomic_int_get(&session->stopping) ||
+					g_atomic_int_get(&session->destroyed) || session->mountpoint != mountpoint) {
+				/* This viewer is gone: we'll release it when we're done */
+				GList *link = temp;
+				temp = temp->next;
+				worker->viewers = g_list_remove_link(worker->viewers, link);
+				gone = g_list_concat(link, gone);
+				g_atomic_int_dec_and_test(&worker->count);
+				continue;
+			}
+			temp = temp->next;
+			/* If not started or paused, wait some more */
+			if(!g_atomic_int_get(&session->started) || g_atomic_int_get(&session->paused) || !mountpoint->enabled)
+				continue;
+			janus_streaming_file_source *source = mountpoint->source;
+			janus_streaming_ondemand_frame *frame = &g_array_index(viewer->frames->index,
+				janus_streaming_ondemand_frame, viewer->next);
+			viewer->next = (viewer->next + 1) % viewer->frames->index->len;
+			/* Prepare the packet for this viewer */
+			header->version = 2;
+			header->markerbit = viewer->first ? 1 : 0;
+			header->type = source->codecs.pt;
+			header->seq_number = htons(viewer->seq);
+			header->timestamp = htonl(viewer->ts);
+			header->ssrc = htonl(1);	/* The Janus core will fix this anyway */
+			memcpy(buf + RTP_HEADER_SIZE, viewer->frames->data->data + frame->offset, frame->length);
+			if(mountpoint->active == FALSE)
+				mountpoint->active = TRUE;
+			packet.mindex = -1;
+			packet.data = header;
+			packet.length = RTP_HEADER_SIZE + frame->length;
+			packet.is_rtp = TRUE;
+			packet.is_video = FALSE;
+			packet.is_keyframe = FALSE;
+			/* Backup the actual payload type, timestamp and sequence number */
+			packet.ptype = packet.data->type;
+			packet.timestamp = ntohl(packet.data->timestamp);
+			packet.seq_number = ntohs(packet.data->seq_number);
+			/* Go! */
+			janus_streaming_relay_rtp_packet(session, &packet);
+			/* Update the state of this viewer */
+			viewer->first = FALSE;
+			viewer->seq++;
+			viewer->ts += (source->opus ? 960 : 160);
+		}
+		janus_mutex_unlock(&worker->mutex);
+		if(gone != NULL) {
+			g_list_free_full(gone, (GDestroyNotify)janus_streaming_ondemand_viewer_free);
+			gone = NULL;
+		}
+	}
+	/* Get rid of the viewers we were still serving */
+	janus_mutex_lock(&worker->mutex);
+	g_list_free_full(worker->viewers, (GDestroyNotify)janus_streaming_ondemand_viewer_free);
+	worker->viewers = NULL;
+	g_atomic_int_set(&worker->count, 0);
+	janus_mutex_unlock(&worker->mutex);
+	JANUS_LOG(LOG_VERB, "Leaving on-demand thread #%u\n", worker->id);
+	return NULL;
+}
+
 /* Thread to send RTP packets from a file (live) */
 static void *janus_streaming_filesource_thread(void *data) {
 	JANUS_LOG(LOG_VERB, "Filesource (live) thread starting...\n");
@@ -9329,7 +10640,7 @@ static void *janus_streaming_filesource_thread(void *data) {
 		packet.seq_number = ntohs(packet.data->seq_number);
 		/* Go! */
 		janus_mutex_lock_nodebug(&mountpoint->mutex);
-		g_list_foreach(mountpoint->viewers, janus_streaming_relay_rtp_packet, &packet);
+		janus_streaming_relay_to_list(mountpoint->viewers, &packet, FALSE, &mountpoint->usage);
 		janus_mutex_unlock_nodebug(&mountpoint->mutex);
 		/* Update header */
 		seq++;
@@ -9350,9 +10661,992 @@ static void *janus_streaming_filesource_thread(void *data) {
 }
 
 /* Thread to relay RTP frames coming from gstreamer/ffmpeg/others */
+/* Helpers to read RTP packets in batches: when a socket is readable we try
+ * to read as many datagrams as we can (up to recv_batch_size) with a single
+ * recvmmsg call, and then we hand them to the relay thread one at a time,
+ * until there are none left for that socket. If kernel timestamps are
+ * enabled, we use them to figure out when each packet was actually
+ * received, since all packets in a batch are read at the same time */
+typedef struct janus_streaming_recv_batch {
+	int fd;				/* Socket the queued datagrams have been read from */
+	int count, next;	/* How many datagrams we have, and which is next */
+	gint64 offset;		/* Monotonic to real time offset, for kernel timestamps */
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr msgs[JANUS_STREAMING_MAX_RECV_BATCH];
+	struct iovec iovecs[JANUS_STREAMING_MAX_RECV_BATCH];
+	struct sockaddr_storage addrs[JANUS_STREAMING_MAX_RECV_BATCH];
+#ifdef SO_TIMESTAMPNS
+	char controls[JANUS_STREAMING_MAX_RECV_BATCH][CMSG_SPACE(sizeof(struct timespec))];
+#endif
+	char buffers[JANUS_STREAMING_MAX_RECV_BATCH][1500];
+#endif
+} janus_streaming_recv_batch;
+static janus_streaming_recv_batch *janus_streaming_recv_batch_create(void) {
+	if(recv_batch_size < 2 && !kernel_timestamps)
+		return NULL;
+	janus_streaming_recv_batch *batch = g_malloc0(sizeof(janus_streaming_recv_batch));
+	batch->fd = -1;
+#ifdef HAVE_RECVMMSG
+	int i = 0;
+	for(i=0; i<JANUS_STREAMING_MAX_RECV_BATCH; i++) {
+		batch->iovecs[i].iov_base = batch->buffers[i];
+		batch->iovecs[i].iov_len = sizeof(batch->buffers[i]);
+		batch->msgs[i].msg_hdr.msg_iov = &batch->iovecs[i];
+		batch->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+#endif
+	return batch;
+}
+static gboolean janus_streaming_recv_batch_pending(janus_streaming_recv_batch *batch, int fd) {
+	return batch != NULL && batch->fd == fd && batch->next < batch->count;
+}
+static void janus_streaming_recv_batch_reset(janus_streaming_recv_batch *batch) {
+	if(batch == NULL)
+		return;
+	batch->fd = -1;
+	batch->count = 0;
+	batch->next = 0;
+}
+/* Returns the size of the datagram copied in buffer, or -1 in case of errors; if
+ * kernel timestamps are available, when is updated with the receiving time */
+static int janus_streaming_recv(janus_streaming_recv_batch *batch, int fd, char *buffer, int len,
+		struct sockaddr_storage *remote, socklen_t *addrlen, gint64 *when) {
+#ifdef HAVE_RECVMMSG
+	if(batch == NULL)
+#endif
+		return recvfrom(fd, buffer, len, MSG_DONTWAIT, (struct sockaddr *)remote, addrlen);
+#ifdef HAVE_RECVMMSG
+	if(!janus_streaming_recv_batch_pending(batch, fd)) {
+		/* Read as many datagrams as we can */
+		janus_streaming_recv_batch_reset(batch);
+		int i = 0;
+		for(i=0; i<recv_batch_size; i++) {
+			batch->msgs[i].msg_hdr.msg_name = &batch->addrs[i];
+			batch->msgs[i].msg_hdr.msg_namelen = sizeof(batch->addrs[i]);
+#ifdef SO_TIMESTAMPNS
+			batch->msgs[i].msg_hdr.msg_control = kernel_timestamps ? batch->controls[i] : NULL;
+			batch->msgs[i].msg_hdr.msg_controllen = kernel_timestamps ? sizeof(batch->controls[i]) : 0;
+#endif
+			batch->msgs[i].msg_len = 0;
+		}
+		int res = recvmmsg(fd, batch->msgs, recv_batch_size, MSG_DONTWAIT, NULL);
+		if(res <= 0)
+			return -1;
+		batch->fd = fd;
+		batch->count = res;
+		batch->offset = janus_get_monotonic_time() - janus_get_real_time();
+	}
+	struct mmsghdr *msg = &batch->msgs[batch->next];
+	int bytes = msg->msg_len;
+	if(bytes > len)
+		bytes = len;
+	memcpy(buffer, batch->buffers[batch->next], bytes);
+	if(remote != NULL && addrlen != NULL) {
+		if(*addrlen > msg->msg_hdr.msg_namelen)
+			*addrlen = msg->msg_hdr.msg_namelen;
+		memcpy(remote, &batch->addrs[batch->next], *addrlen);
+	}
+#ifdef SO_TIMESTAMPNS
+	if(kernel_timestamps && when != NULL) {
+		struct cmsghdr *cmsg = NULL;
+		for(cmsg = CMSG_FIRSTHDR(&msg->msg_hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg->msg_hdr, cmsg)) {
+			if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+				struct timespec ts;
+				memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+				gint64 received = (gint64)ts.tv_sec*G_USEC_PER_SEC + ts.tv_nsec/1000 + batch->offset;
+				/* Don't trust timestamps in the future */
+				if(received < *when)
+					*when = received;
+				break;
+			}
+		}
+	}
+#endif
+	batch->next++;
+	return bytes;
+#endif
+}
+
+/* Helper to check if an RTP packet contains (the beginning of) a keyframe */
+static gboolean janus_streaming_is_keyframe(janus_videocodec codec, char *buffer, int len) {
+	int plen = 0;
+	char *payload = janus_rtp_payload(buffer, len, &plen);
+	if(payload == NULL)
+		return FALSE;
+	switch(codec) {
+		case JANUS_VIDEOCODEC_VP8:
+			return janus_vp8_is_keyframe(payload, plen);
+		case JANUS_VIDEOCODEC_VP9:
+			return janus_vp9_is_keyframe(payload, plen);
+		case JANUS_VIDEOCODEC_H264:
+			return janus_h264_is_keyframe(payload, plen);
+		case JANUS_VIDEOCODEC_AV1:
+			return janus_av1_is_keyframe(payload, plen);
+		case JANUS_VIDEOCODEC_H265:
+			return janus_h265_is_keyframe(payload, plen);
+		default:
+			break;
+	}
+	return FALSE;
+}
+
+/* Time-shift buffer management */
+static janus_streaming_dvr *janus_streaming_dvr_create(int seconds, guint64 max_size) {
+	janus_streaming_dvr *dvr = g_malloc0(sizeof(janus_streaming_dvr));
+	dvr->max_duration = (gint64)seconds * G_USEC_PER_SEC;
+	dvr->max_size = max_size > 0 ? max_size : JANUS_STREAMING_DVR_DEFAULT_MAX_SIZE;
+	dvr->capacity = 1024;
+	dvr->ring = g_malloc0(dvr->capacity * sizeof(janus_streaming_dvr_packet *));
+	dvr->seekpoints = g_array_new(FALSE, FALSE, sizeof(guint64));
+	dvr->seek_mindex = -1;
+	return dvr;
+}
+
+static void janus_streaming_dvr_packet_free(janus_streaming_dvr_packet *pkt) {
+	if(pkt == NULL)
+		return;
+	g_free(pkt->packet.data);
+	g_free(pkt);
+}
+
+static void janus_streaming_dvr_free(janus_streaming_dvr *dvr) {
+	if(dvr == NULL)
+		return;
+	guint i = 0;
+	for(i=0; i<dvr->count; i++)
+		janus_streaming_dvr_packet_free(dvr->ring[(dvr->head + i) % dvr->capacity]);
+	g_free(dvr->ring);
+	g_array_free(dvr->seekpoints, TRUE);
+	g_free(dvr);
+}
+
+static janus_streaming_dvr_packet *janus_streaming_dvr_get(janus_streaming_dvr *dvr, guint64 index) {
+	if(dvr == NULL || index < dvr->first || index >= dvr->first + dvr->count)
+		return NULL;
+	return dvr->ring[(dvr->head + (guint)(index - dvr->first)) % dvr->capacity];
+}
+
+static void janus_streaming_dvr_evict(janus_streaming_dvr *dvr) {
+	janus_streaming_dvr_packet *pkt = dvr->ring[dvr->head];
+	dvr->ring[dvr->head] = NULL;
+	dvr->head = (dvr->head + 1) % dvr->capacity;
+	dvr->count--;
+	dvr->first++;
+	dvr->size -= sizeof(janus_streaming_dvr_packet) + pkt->packet.length;
+	janus_streaming_dvr_packet_free(pkt);
+	/* Get rid of the seek points we can't use anymore */
+	guint n = 0;
+	while(n < dvr->seekpoints->len && g_array_index(dvr->seekpoints, guint64, n) < dvr->first)
+		n++;
+	if(n > 0)
+		g_array_remove_range(dvr->seekpoints, 0, n);
+}
+
+/* Store a copy of a packet we just relayed: must be called with the mountpoint mutex locked */
+static void janus_streaming_dvr_add(janus_streaming_dvr *dvr, janus_streaming_rtp_relay_packet *packet, gint64 now) {
+	if(dvr == NULL || packet == NULL || packet->data == NULL || packet->length < 1)
+		return;
+	/* Get rid of what's too old, or what doesn't fit anymore */
+	guint64 size = sizeof(janus_streaming_dvr_packet) + packet->length;
+	while(dvr->count > 0) {
+		janus_streaming_dvr_packet *oldest = dvr->ring[dvr->head];
+		if((now - oldest->received) <= dvr->max_duration && (dvr->size + size) <= dvr->max_size)
+			break;
+		janus_streaming_dvr_evict(dvr);
+	}
+	if(dvr->count == dvr->capacity) {
+		/* The ring is full, make it larger */
+		guint capacity = dvr->capacity * 2, i = 0;
+		janus_streaming_dvr_packet **ring = g_malloc0(capacity * sizeof(janus_streaming_dvr_packet *));
+		for(i=0; i<dvr->count; i++)
+			ring[i] = dvr->ring[(dvr->head + i) % dvr->capacity];
+		g_free(dvr->ring);
+		dvr->ring = ring;
+		dvr->capacity = capacity;
+		dvr->head = 0;
+	}
+	janus_streaming_dvr_packet *pkt = g_malloc(sizeof(janus_streaming_dvr_packet));
+	pkt->packet = *packet;
+	pkt->packet.shared = NULL;
+	pkt->packet.data = g_malloc(packet->length);
+	memcpy(pkt->packet.data, packet->data, packet->length);
+	pkt->packet.is_keyframe = FALSE;
+	pkt->packet.timeshifted = TRUE;
+	pkt->received = now;
+	guint64 index = dvr->first + dvr->count;
+	dvr->ring[(dvr->head + dvr->count) % dvr->capacity] = pkt;
+	dvr->count++;
+	dvr->size += size;
+	/* Can viewers start from here? For video, only the first packet of
+	 * a keyframe is: if there's no video at all, any audio packet will do */
+	gboolean seekable = FALSE;
+	if(packet->is_video) {
+		dvr->video = TRUE;
+		if(packet->substream == 0 && !(packet->mindex == dvr->seek_mindex && packet->timestamp == dvr->seek_ts) &&
+				janus_streaming_is_keyframe(packet->codec, (char *)packet->data, packet->length)) {
+			seekable = TRUE;
+			dvr->seek_mindex = packet->mindex;
+			dvr->seek_ts = packet->timestamp;
+		}
+	} else if(!dvr->video) {
+		seekable = TRUE;
+	}
+	if(seekable)
+		g_array_append_val(dvr->seekpoints, index);
+}
+
+/* Find the most recent seek point that's not newer than the provided time */
+static gboolean janus_streaming_dvr_seek(janus_streaming_dvr *dvr, gint64 when, guint64 *index) {
+	if(dvr == NULL || dvr->seekpoints->len == 0)
+		return FALSE;
+	guint i = dvr->seekpoints->len;
+	while(i > 0) {
+		i--;
+		guint64 sp = g_array_index(dvr->seekpoints, guint64, i);
+		janus_streaming_dvr_packet *pkt = janus_streaming_dvr_get(dvr, sp);
+		if(pkt != NULL && pkt->received <= when) {
+			*index = sp;
+			return TRUE;
+		}
+	}
+	/* We don't have that much buffered, start from the oldest one */
+	*index = g_array_index(dvr->seekpoints, guint64, 0);
+	return TRUE;
+}
+
+/* Position a viewer in the time-shift buffer, according to the delay it wants */
+static gboolean janus_streaming_dvr_seek_session(janus_streaming_session *session, janus_streaming_mountpoint *mp) {
+	if(session == NULL || mp == NULL || mp->streaming_source != janus_streaming_source_rtp)
+		return FALSE;
+	janus_streaming_rtp_source *source = mp->source;
+	janus_mutex_lock(&mp->mutex);
+	guint64 index = 0;
+	if(source->dvr == NULL || !janus_streaming_dvr_seek(source->dvr,
+			janus_get_monotonic_time() - session->timeshift, &index)) {
+		/* Nothing we can start from (yet), stick to the live stream */
+		g_atomic_int_set(&session->timeshifted, 0);
+		janus_mutex_unlock(&mp->mutex);
+		return FALSE;
+	}
+	JANUS_LOG(LOG_VERB, "[%s] Viewer starting from the time-shift buffer (%"SCNi64"s behind live)\n",
+		mp->name, session->timeshift/G_USEC_PER_SEC);
+	session->dvr_next = index;
+	/* Make sure the sequence numbers and timestamps the viewer gets stay coherent */
+	GList *temp = session->streams;
+	while(temp) {
+		janus_streaming_session_stream *s = (janus_streaming_session_stream *)temp->data;
+		s->context.seq_reset = TRUE;
+		s->context.ts_reset = TRUE;
+		temp = temp->next;
+	}
+	g_atomic_int_set(&session->timeshifted, 1);
+	janus_mutex_unlock(&mp->mutex);
+	return TRUE;
+}
+
+/* Send time-shifted viewers all the buffered packets they should have
+ * received by now: must be called with the mountpoint mutex locked */
+static void janus_streaming_dvr_serve(janus_streaming_mountpoint *mp, janus_streaming_dvr *dvr, gint64 now) {
+	GList *temp = mp->viewers;
+	while(temp) {
+		janus_streaming_session *session = (janus_streaming_session *)temp->data;
+		temp = temp->next;
+		if(!g_atomic_int_get(&session->timeshifted))
+			continue;
+		if(session->dvr_next < dvr->first) {
+			/* What this viewer needed is gone already (e.g., because
+			 * of the memory cap), skip to the oldest keyframe we have */
+			if(dvr->seekpoints->len == 0)
+				continue;
+			JANUS_LOG(LOG_WARN, "[%s] Viewer fell out of the time-shift buffer, skipping ahead\n", mp->name);
+			session->dvr_next = g_array_index(dvr->seekpoints, guint64, 0);
+			GList *st = session->streams;
+			while(st) {
+				janus_streaming_session_stream *s = (janus_streaming_session_stream *)st->data;
+				s->context.seq_reset = TRUE;
+				s->context.ts_reset = TRUE;
+				st = st->next;
+			}
+		}
+		janus_streaming_dvr_packet *pkt = NULL;
+		while((pkt = janus_streaming_dvr_get(dvr, session->dvr_next)) != NULL) {
+			if(session->timeshift > 0 && pkt->received > (now - session->timeshift))
+				break;
+			janus_streaming_relay_rtp_packet(session, &pkt->packet);
+			session->dvr_next++;
+		}
+		if(session->timeshift == 0 && session->dvr_next == dvr->first + dvr->count) {
+			/* We sent all we had and the viewer wants to be live: from
+			 * now on the packets we receive will be relayed as usual */
+			g_atomic_int_set(&session->timeshifted, 0);
+		}
+	}
+}
+
+/* Enable the time-shift buffer on a newly created RTP/RTSP mountpoint */
+static void janus_streaming_dvr_setup(janus_streaming_mountpoint *mp, int seconds, guint64 max_size) {
+	if(mp == NULL || mp->streaming_source != janus_streaming_source_rtp || seconds < 1)
+		return;
+	janus_streaming_rtp_source *source = mp->source;
+	janus_mutex_lock(&mp->mutex);
+	if(source->dvr == NULL)
+		source->dvr = janus_streaming_dvr_create(seconds, max_size);
+	JANUS_LOG(LOG_INFO, "[%s] Time-shift buffer enabled (%"SCNi64" seconds, up to %"SCNu64" bytes)\n",
+		mp->name, source->dvr->max_duration/G_USEC_PER_SEC, source->dvr->max_size);
+	janus_mutex_unlock(&mp->mutex);
+}
+
+static void janus_streaming_dvr_save(janus_config *config, janus_config_category *c, janus_streaming_rtp_source *source) {
+	if(config == NULL || c == NULL || source == NULL || source->dvr == NULL)
+		return;
+	char value[BUFSIZ];
+	g_snprintf(value, BUFSIZ, "%"SCNi64, source->dvr->max_duration/G_USEC_PER_SEC);
+	janus_config_add(config, c, janus_config_item_create("dvr_seconds", value));
+	g_snprintf(value, BUFSIZ, "%"SCNu64, source->dvr->max_size);
+	janus_config_add(config, c, janus_config_item_create("dvr_max_size", value));
+}
+
+/* Reorder buffer helpers */
+static janus_streaming_reorder *janus_streaming_reorder_create(int ms) {
+	janus_streaming_reorder *reorder = g_malloc0(sizeof(janus_streaming_reorder));
+	reorder->depth = (gint64)ms*1000;
+	reorder->packets = g_queue_new();
+	return reorder;
+}
+
+static void janus_streaming_reorder_free(janus_streaming_reorder *reorder) {
+	if(reorder == NULL)
+		return;
+	g_queue_free_full(reorder->packets, (GDestroyNotify)g_free);
+	g_free(reorder);
+}
+
+/* Returns how long (in ms) we can wait before relaying the next packet we're
+ * holding, 0 if it must be relayed now, or -1 if we're not holding any */
+static int janus_streaming_reorder_wait(janus_streaming_reorder *reorder, gint64 now) {
+	if(reorder == NULL || g_queue_is_empty(reorder->packets))
+		return -1;
+	janus_streaming_reorder_packet *pkt = g_queue_peek_head(reorder->packets);
+	if(pkt->seq == reorder->next_seq || g_queue_get_length(reorder->packets) >= JANUS_STREAMING_REORDER_MAX_PACKETS)
+		return 0;
+	/* We're waiting for a missing packet: the deadline is set by the packet we've been holding the longest */
+	gint64 oldest = pkt->received;
+	GList *l = reorder->packets->head;
+	while(l) {
+		pkt = (janus_streaming_reorder_packet *)l->data;
+		if(pkt->received < oldest)
+			oldest = pkt->received;
+		l = l->next;
+	}
+	gint64 left = oldest + reorder->depth - now;
+	return left <= 0 ? 0 : (int)((left+999)/1000);
+}
+
+/* Helper method to ask the source to retransmit the packets we're missing */
+static void janus_streaming_reorder_nack(janus_streaming_rtp_source_stream *stream, janus_streaming_reorder *reorder,
+		guint16 first, guint16 last) {
+	if(stream->rtcp_fd < 0 || stream->rtcp_addr.ss_family == 0)
+		return;
+	GSList *nacks = NULL;
+	guint16 seq = first;
+	while(seq != (guint16)(last + 1)) {
+		nacks = g_slist_prepend(nacks, GUINT_TO_POINTER(seq));
+		seq++;
+	}
+	nacks = g_slist_reverse(nacks);
+	char rtcp_buf[120];
+	int rtcp_len = janus_rtcp_nacks((char *)&rtcp_buf, sizeof(rtcp_buf), nacks);
+	g_slist_free(nacks);
+	if(rtcp_len <= 0)
+		return;
+	janus_rtcp_fix_ssrc(NULL, rtcp_buf, rtcp_len, 1, 1, reorder->ssrc);
+	socklen_t addrlen = stream->rtcp_addr.ss_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+	if(sendto(stream->rtcp_fd, rtcp_buf, rtcp_len, 0, (struct sockaddr *)&stream->rtcp_addr, addrlen) < 0) {
+		JANUS_LOG(LOG_ERR, "Error in sendto... %d (%s)\n", errno, g_strerror(errno));
+		return;
+	}
+	JANUS_LOG(LOG_HUGE, "Sent NACK for %"SCNu16"-%"SCNu16"\n", first, last);
+	reorder->nacks++;
+}
+
+/* Add a packet to the reorder buffer: returns TRUE if the packet can be
+ * relayed right away (it's the one we expected and we're not holding any),
+ * or FALSE if it was either queued or dropped (duplicate or too late) */
+static gboolean janus_streaming_reorder_push(janus_streaming_rtp_source_stream *stream, janus_streaming_reorder *reorder,
+		char *buffer, int len, gint64 now) {
+	janus_rtp_header *rtp = (janus_rtp_header *)buffer;
+	guint32 ssrc = ntohl(rtp->ssrc);
+	guint16 seq = ntohs(rtp->seq_number);
+	gint16 diff = (gint16)(seq - reorder->next_seq);
+	if(!reorder->started || ssrc != reorder->ssrc ||
+			diff > JANUS_STREAMING_REORDER_MAX_PACKETS || diff < -JANUS_STREAMING_REORDER_MAX_PACKETS) {
+		/* New source, or a big jump in the sequence numbers: start over */
+		if(reorder->started) {
+			JANUS_LOG(LOG_VERB, "Resetting reorder buffer (#%d, ssrc=%"SCNu32", seq=%"SCNu16")\n",
+				stream->mindex, ssrc, seq);
+		}
+		janus_streaming_reorder_packet *pkt = NULL;
+		while((pkt = g_queue_pop_head(reorder->packets)) != NULL)
+			g_free(pkt);
+		reorder->started = TRUE;
+		reorder->ssrc = ssrc;
+		reorder->next_seq = seq;
+		reorder->highest_seq = seq - 1;
+		diff = 0;
+	}
+	if(diff < 0) {
+		/* We already relayed this packet, or gave up on it */
+		reorder->late++;
+		return FALSE;
+	}
+	gint16 ahead = (gint16)(seq - reorder->highest_seq);
+	if(ahead > 0)
+		reorder->highest_seq = seq;
+	if(diff == 0 && g_queue_is_empty(reorder->packets)) {
+		/* In order, nothing to wait for */
+		reorder->next_seq++;
+		return TRUE;
+	}
+	/* Find where this packet belongs, starting from the end */
+	GList *l = reorder->packets->tail;
+	while(l) {
+		janus_streaming_reorder_packet *pkt = (janus_streaming_reorder_packet *)l->data;
+		gint16 delta = (gint16)(seq - pkt->seq);
+		if(delta == 0) {
+			/* Duplicate */
+			reorder->late++;
+			return FALSE;
+		} else if(delta > 0) {
+			break;
+		}
+		l = l->prev;
+	}
+	janus_streaming_reorder_packet *pkt = g_malloc(sizeof(janus_streaming_reorder_packet));
+	pkt->length = MIN(len, (int)sizeof(pkt->data));
+	memcpy(pkt->data, buffer, pkt->length);
+	pkt->seq = seq;
+	pkt->received = now;
+	if(l == NULL)
+		g_queue_push_head(reorder->packets, pkt);
+	else
+		g_queue_insert_after(reorder->packets, l, pkt);
+	if(ahead < 1) {
+		/* This packet filled a gap */
+		reorder->reordered++;
+	} else if(ahead > 1 && ahead <= JANUS_STREAMING_REORDER_MAX_NACKS) {
+		/* We skipped some sequence numbers, ask for them */
+		janus_streaming_reorder_nack(stream, reorder, seq - ahead + 1, seq - 1);
+	}
+	return FALSE;
+}
+
+/* Get the next packet to relay from the reorder buffer, if it's time: returns
+ * the size of the packet copied in buffer, or -1 if there's nothing to relay yet */
+static int janus_streaming_reorder_pop(janus_streaming_reorder *reorder, char *buffer, int len, gint64 now) {
+	if(janus_streaming_reorder_wait(reorder, now) != 0)
+		return -1;
+	janus_streaming_reorder_packet *pkt = g_queue_pop_head(reorder->packets);
+	gint16 gap = (gint16)(pkt->seq - reorder->next_seq);
+	if(gap > 0) {
+		/* We waited long enough for the missing packets, move on */
+		JANUS_LOG(LOG_HUGE, "Giving up on %d packets (ssrc=%"SCNu32", seq=%"SCNu16")\n",
+			gap, reorder->ssrc, reorder->next_seq);
+		reorder->lost += gap;
+	}
+	reorder->next_seq = pkt->seq + 1;
+	int bytes = MIN(pkt->length, len);
+	memcpy(buffer, pkt->data, bytes);
+	g_free(pkt);
+	return bytes;
+}
+
+/* Find the reorder buffer associated to an RTP socket, if any */
+static janus_streaming_reorder *janus_streaming_reorder_find(janus_streaming_rtp_source *source, int fd) {
+	if(source->reorder_ms == 0)
+		return NULL;
+	janus_streaming_rtp_source_stream *stream = g_hash_table_lookup(source->media_byfd, GINT_TO_POINTER(fd));
+	if(stream == NULL)
+		return NULL;
+	int i = 0;
+	for(i=0; i<3; i++) {
+		if(stream->fd[i] == fd)
+			return stream->reorder[i];
+	}
+	return NULL;
+}
+
+/* Same as janus_streaming_recv, but for audio and video RTP sockets: if
+ * the mountpoint has reorder buffers, packets will be returned in order
+ * (or -1 if there's nothing we can relay yet) rather than as they come */
+static int janus_streaming_recv_rtp(janus_streaming_recv_batch *batch, janus_streaming_rtp_source *source,
+		janus_streaming_rtp_source_stream *stream, int index, int fd, char *buffer, int len,
+		struct sockaddr_storage *remote, socklen_t *addrlen, gint64 *when) {
+	if(source->reorder_ms == 0)
+		return janus_streaming_recv(batch, fd, buffer, len, remote, addrlen, when);
+	if(stream->reorder[index] == NULL)
+		stream->reorder[index] = janus_streaming_reorder_create(source->reorder_ms);
+	janus_streaming_reorder *reorder = stream->reorder[index];
+	gint64 now = janus_get_monotonic_time();
+	if(janus_streaming_reorder_wait(reorder, now) != 0) {
+		/* Nothing to relay from the buffer yet, read a new packet */
+		int bytes = janus_streaming_recv(batch, fd, buffer, len, remote, addrlen, when);
+		if(bytes < 0 || !janus_is_rtp(buffer, bytes))
+			return bytes;
+		if(janus_streaming_reorder_push(stream, reorder, buffer, bytes, now))
+			return bytes;
+	}
+	return janus_streaming_reorder_pop(reorder, buffer, len, now);
+}
+
+/* Whether there's more we can relay from a readable socket without polling again */
+static gboolean janus_streaming_recv_pending(janus_streaming_recv_batch *batch, janus_streaming_rtp_source *source, struct pollfd *pfd) {
+	if(janus_streaming_recv_batch_pending(batch, pfd->fd))
+		return TRUE;
+	return (pfd->revents & POLLIN) && janus_streaming_reorder_wait(
+		janus_streaming_reorder_find(source, pfd->fd), janus_get_monotonic_time()) == 0;
+}
+
+/* Enable reorder buffers on a newly created RTP/RTSP mountpoint: the buffers
+ * themselves are created by the ingest threads, when media is received */
+static void janus_streaming_reorder_setup(janus_streaming_mountpoint *mp, int ms) {
+	if(mp == NULL || mp->streaming_source != janus_streaming_source_rtp || ms < 1)
+		return;
+	janus_streaming_rtp_source *source = mp->source;
+	source->reorder_ms = ms;
+	JANUS_LOG(LOG_INFO, "[%s] Reorder buffers enabled (%d ms)\n", mp->name, ms);
+}
+
+static void janus_streaming_reorder_save(janus_config *config, janus_config_category *c, janus_streaming_rtp_source *source) {
+	if(config == NULL || c == NULL || source == NULL || source->reorder_ms == 0)
+		return;
+	char value[BUFSIZ];
+	g_snprintf(value, BUFSIZ, "%d", source->reorder_ms);
+	janus_config_add(config, c, janus_config_item_create("reorder_ms", value));
+}
+
+/* Feedback from viewers is aggregated once per second by default */
+static void janus_streaming_feedback_init(janus_streaming_rtp_source *source) {
+	source->feedback_window = G_USEC_PER_SEC;
+	janus_mutex_init(&source->feedback_mutex);
+	source->remb_estimates = g_hash_table_new(NULL, NULL);
+}
+
+/* Change how feedback from viewers is aggregated on a newly created RTP/RTSP mountpoint */
+static void janus_streaming_feedback_setup(janus_streaming_mountpoint *mp, int ms, int percentile) {
+	if(mp == NULL || mp->streaming_source != janus_streaming_source_rtp)
+		return;
+	janus_streaming_rtp_source *source = mp->source;
+	if(ms > 0)
+		source->feedback_window = (gint64)ms * 1000;
+	if(percentile < 0 || percentile > 100) {
+		JANUS_LOG(LOG_WARN, "[%s] Invalid REMB percentile %d, using the lowest estimate\n", mp->name, percentile);
+		percentile = 0;
+	}
+	source->remb_percentile = percentile;
+	JANUS_LOG(LOG_VERB, "[%s] Aggregating viewers feedback every %"SCNi64" ms (REMB percentile: %d)\n",
+		mp->name, source->feedback_window/1000, source->remb_percentile);
+}
+
+static void janus_streaming_feedback_save(janus_config *config, janus_config_category *c, janus_streaming_rtp_source *source) {
+	if(config == NULL || c == NULL || source == NULL)
+		return;
+	char value[BUFSIZ];
+	if(source->feedback_window != G_USEC_PER_SEC) {
+		g_snprintf(value, BUFSIZ, "%"SCNi64, source->feedback_window/1000);
+		janus_config_add(config, c, janus_config_item_create("feedback_ms", value));
+	}
+	if(source->remb_percentile > 0) {
+		g_snprintf(value, BUFSIZ, "%d", source->remb_percentile);
+		janus_config_add(config, c, janus_config_item_create("remb_percentile", value));
+	}
+}
+
+/* Origin side of the hierarchical relay: bind the socket edges will talk to */
+static void janus_streaming_edges_setup(janus_streaming_mountpoint *mp, int port, const char *secret) {
+	if(mp == NULL || mp->streaming_source != janus_streaming_source_rtp || port < 1 || port > 65535)
+		return;
+	janus_streaming_rtp_source *source = mp->source;
+	int fd = janus_streaming_create_fd(port, INADDR_ANY, NULL, NULL, 0, "Edges", "edges", mp->name, FALSE);
+	if(fd < 0) {
+		JANUS_LOG(LOG_ERR, "[%s] Can't bind to port %d for edges...\n", mp->name, port);
+		return;
+	}
+	janus_streaming_edges *edges = g_malloc0(sizeof(janus_streaming_edges));
+	edges->fd = fd;
+	edges->port = port;
+	edges->secret = secret ? g_strdup(secret) : NULL;
+	janus_mutex_init(&edges->mutex);
+	source->edges = edges;
+	JANUS_LOG(LOG_INFO, "[%s] Edges can pull from this mountpoint on port %d\n", mp->name, port);
+}
+
+static void janus_streaming_edges_free(janus_streaming_edges *edges) {
+	if(edges == NULL)
+		return;
+	if(edges->fd > -1)
+		close(edges->fd);
+	g_list_free_full(edges->peers, (GDestroyNotify)g_free);
+	g_free(edges->secret);
+	g_free(edges);
+}
+
+static void janus_streaming_edges_save(janus_config *config, janus_config_category *c, janus_streaming_rtp_source *source) {
+	if(config == NULL || c == NULL || source == NULL || source->edges == NULL)
+		return;
+	char value[BUFSIZ];
+	g_snprintf(value, BUFSIZ, "%"SCNu16, source->edges->port);
+	janus_config_add(config, c, janus_config_item_create("edge_port", value));
+	if(source->edges->secret)
+		janus_config_add(config, c, janus_config_item_create("edge_secret", source->edges->secret));
+}
+
+static janus_streaming_edge_peer *janus_streaming_edges_find(janus_streaming_edges *edges,
+		struct sockaddr_storage *addr, socklen_t addrlen) {
+	GList *l = edges->peers;
+	while(l) {
+		janus_streaming_edge_peer *peer = (janus_streaming_edge_peer *)l->data;
+		if(peer->addrlen == addrlen && !memcmp(&peer->addr, addr, addrlen))
+			return peer;
+		l = l->next;
+	}
+	return NULL;
+}
+
+/* Handle a message from an edge (only done by the main mountpoint thread) */
+static void janus_streaming_edges_incoming(janus_streaming_mountpoint *mp, janus_streaming_edges *edges, char *buffer, int len) {
+	struct sockaddr_storage remote;
+	socklen_t addrlen = sizeof(remote);
+	int bytes = recvfrom(edges->fd, buffer, len, MSG_DONTWAIT, (struct sockaddr *)&remote, &addrlen);
+	if(bytes < JANUS_STREAMING_EDGE_HEADER_SIZE || (guint8)buffer[0] != JANUS_STREAMING_EDGE_MAGIC)
+		return;
+	char type = buffer[1];
+	int mindex = (guint8)buffer[2];
+	gint64 now = janus_get_monotonic_time();
+	janus_mutex_lock(&edges->mutex);
+	janus_streaming_edge_peer *peer = janus_streaming_edges_find(edges, &remote, addrlen);
+	if(type == JANUS_STREAMING_EDGE_SUBSCRIBE) {
+		/* The payload is the secret, if we need one */
+		int slen = bytes - JANUS_STREAMING_EDGE_HEADER_SIZE;
+		if(edges->secret && ((int)strlen(edges->secret) != slen ||
+				memcmp(edges->secret, buffer + JANUS_STREAMING_EDGE_HEADER_SIZE, slen))) {
+			edges->unauthorized++;
+			janus_mutex_unlock(&edges->mutex);
+			JANUS_LOG(LOG_WARN, "[%s] Unauthorized edge subscription, ignoring\n", mp->name);
+			return;
+		}
+		if(peer == NULL) {
+			peer = g_malloc0(sizeof(janus_streaming_edge_peer));
+			memcpy(&peer->addr, &remote, addrlen);
+			peer->addrlen = addrlen;
+			peer->subscribed = now;
+			edges->peers = g_list_append(edges->peers, peer);
+			JANUS_LOG(LOG_INFO, "[%s] New edge subscribed (%d total)\n", mp->name, g_list_length(edges->peers));
+			/* Make sure it gets a keyframe as soon as possible */
+			GList *temp = ((janus_streaming_rtp_source *)mp->source)->media;
+			while(temp) {
+				janus_streaming_rtp_source_stream *stream = (janus_streaming_rtp_source_stream *)temp->data;
+				if(stream->type == JANUS_STREAMING_MEDIA_VIDEO)
+					g_atomic_int_set(&stream->need_pli, 1);
+				temp = temp->next;
+			}
+		}
+		peer->last_seen = now;
+	} else if(type == JANUS_STREAMING_EDGE_UNSUBSCRIBE) {
+		if(peer != NULL) {
+			edges->peers = g_list_remove(edges->peers, peer);
+			g_free(peer);
+			JANUS_LOG(LOG_INFO, "[%s] Edge unsubscribed (%d left)\n", mp->name, g_list_length(edges->peers));
+		}
+	} else if(type == JANUS_STREAMING_EDGE_PLI && peer != NULL) {
+		/* Keyframe requests from all edges (and our own viewers) are rate limited together */
+		peer->plis++;
+		janus_streaming_rtp_source_stream *stream = g_hash_table_lookup(
+			((janus_streaming_rtp_source *)mp->source)->media_byid, GINT_TO_POINTER(mindex));
+		if(stream != NULL && stream->type == JANUS_STREAMING_MEDIA_VIDEO)
+			janus_streaming_rtcp_pli_request((janus_streaming_rtp_source *)mp->source, stream);
+	}
+	janus_mutex_unlock(&edges->mutex);
+}
+
+/* Get rid of the edges that stopped renewing their subscription */
+static void janus_streaming_edges_check(janus_streaming_edges *edges, gint64 now) {
+	if(edges == NULL || now - edges->last_check < G_USEC_PER_SEC)
+		return;
+	edges->last_check = now;
+	janus_mutex_lock(&edges->mutex);
+	GList *l = edges->peers;
+	while(l) {
+		GList *next = l->next;
+		janus_streaming_edge_peer *peer = (janus_streaming_edge_peer *)l->data;
+		if(now - peer->last_seen >= JANUS_STREAMING_EDGE_TIMEOUT) {
+			JANUS_LOG(LOG_INFO, "Edge subscription expired\n");
+			edges->peers = g_list_delete_link(edges->peers, l);
+			g_free(peer);
+		}
+		l = next;
+	}
+	janus_mutex_unlock(&edges->mutex);
+}
+
+/* Forward a packet we're relaying to our viewers to all the subscribed edges too */
+static void janus_streaming_edges_relay(janus_streaming_rtp_source *source, janus_streaming_rtp_relay_packet *packet, int substream) {
+	janus_streaming_edges *edges = source->edges;
+	if(edges == NULL || edges->peers == NULL || packet == NULL || packet->data == NULL ||
+			packet->length < 1 || packet->length > 1500)
+		return;
+	char buffer[JANUS_STREAMING_EDGE_HEADER_SIZE+1500];
+	buffer[0] = JANUS_STREAMING_EDGE_MAGIC;
+	buffer[1] = JANUS_STREAMING_EDGE_MEDIA;
+	buffer[2] = packet->mindex;
+	buffer[3] = substream;
+	memcpy(buffer + JANUS_STREAMING_EDGE_HEADER_SIZE, packet->data, packet->length);
+	int len = JANUS_STREAMING_EDGE_HEADER_SIZE + packet->length;
+	janus_mutex_lock(&edges->mutex);
+	GList *l = edges->peers;
+	while(l) {
+		janus_streaming_edge_peer *peer = (janus_streaming_edge_peer *)l->data;
+		if(sendto(edges->fd, buffer, len, 0, (struct sockaddr *)&peer->addr, peer->addrlen) > 0) {
+			peer->packets++;
+			peer->bytes += len;
+		}
+		l = l->next;
+	}
+	janus_mutex_unlock(&edges->mutex);
+}
+
+/* Edge side of the hierarchical relay */
+static void *janus_streaming_origin_thread(void *data);
+static void janus_streaming_origin_setup(janus_streaming_mountpoint *mp, const char *host, int port, const char *secret) {
+	if(mp == NULL || mp->streaming_source != janus_streaming_source_rtp || host == NULL || port < 1 || port > 65535)
+		return;
+	janus_streaming_rtp_source *source = mp->source;
+#ifdef HAVE_LIBCURL
+	if(source->rtsp) {
+		JANUS_LOG(LOG_WARN, "[%s] RTSP mountpoints can't pull from an origin, ignoring\n", mp->name);
+		return;
+	}
+#endif
+	struct sockaddr_storage addr = { 0 };
+	if(janus_network_resolve_address(host, &addr) < 0) {
+		JANUS_LOG(LOG_ERR, "[%s] Couldn't resolve origin address '%s'\n", mp->name, host);
+		return;
+	}
+	socklen_t addrlen = sizeof(struct sockaddr_in);
+	if(addr.ss_family == AF_INET6) {
+		((struct sockaddr_in6 *)&addr)->sin6_port = htons(port);
+		addrlen = sizeof(struct sockaddr_in6);
+	} else {
+		((struct sockaddr_in *)&addr)->sin_port = htons(port);
+	}
+	int fd = socket(addr.ss_family, SOCK_DGRAM, IPPROTO_UDP);
+	if(fd < 0 || connect(fd, (struct sockaddr *)&addr, addrlen) < 0) {
+		JANUS_LOG(LOG_ERR, "[%s] Couldn't create socket for origin %s:%d: %d (%s)\n",
+			mp->name, host, port, errno, g_strerror(errno));
+		if(fd > -1)
+			close(fd);
+		return;
+	}
+	janus_streaming_origin *origin = g_malloc0(sizeof(janus_streaming_origin));
+	origin->host = g_strdup(host);
+	origin->port = port;
+	origin->secret = secret ? g_strdup(secret) : NULL;
+	origin->fd = fd;
+	origin->local_fd[0] = -1;
+	origin->local_fd[1] = -1;
+	origin->targets = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)g_free);
+	/* What we get from the origin is delivered to the ports our streams are bound to,
+	 * so that it goes through the same processing as media sent to us directly */
+	GList *temp = source->media;
+	while(temp) {
+		janus_streaming_rtp_source_stream *stream = (janus_streaming_rtp_source_stream *)temp->data;
+		janus_streaming_origin_target *target = g_malloc0(sizeof(janus_streaming_origin_target));
+		int i = 0;
+		for(i=0; i<3; i++) {
+			if(stream->fd[i] < 0)
+				continue;
+			struct sockaddr_storage *local = &target->addr[i];
+			socklen_t len = sizeof(*local);
+			if(getsockname(stream->fd[i], (struct sockaddr *)local, &len) < 0)
+				continue;
+			if(local->ss_family == AF_INET6 &&
+					IN6_IS_ADDR_UNSPECIFIED(&((struct sockaddr_in6 *)local)->sin6_addr)) {
+				/* Bound to all addresses, use IPv4 loopback (sockets are dual stack) */
+				uint16_t lport = ((struct sockaddr_in6 *)local)->sin6_port;
+				memset(local, 0, sizeof(*local));
+				((struct sockaddr_in *)local)->sin_family = AF_INET;
+				((struct sockaddr_in *)local)->sin_port = lport;
+			}
+			if(local->ss_family == AF_INET) {
+				struct sockaddr_in *local4 = (struct sockaddr_in *)local;
+				if(local4->sin_addr.s_addr == INADDR_ANY)
+					local4->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+				target->addrlen[i] = sizeof(struct sockaddr_in);
+			} else {
+				target->addrlen[i] = sizeof(struct sockaddr_in6);
+			}
+			int f = (local->ss_family == AF_INET6);
+			if(origin->local_fd[f] < 0)
+				origin->local_fd[f] = socket(local->ss_family, SOCK_DGRAM, IPPROTO_UDP);
+		}
+		g_hash_table_insert(origin->targets, GINT_TO_POINTER(stream->mindex), target);
+		stream->from_origin = TRUE;
+		temp = temp->next;
+	}
+	source->origin = origin;
+	/* Start the thread pulling from the origin */
+	GError *error = NULL;
+	char tname[16];
+	g_snprintf(tname, sizeof(tname), "mp edge %s", mp->id_str);
+	janus_refcount_increase(&mp->ref);
+	GThread *thread = g_thread_try_new(tname, &janus_streaming_origin_thread, mp, &error);
+	if(error != NULL) {
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the origin thread...\n",
+			error->code, error->message ? error->message : "??");
+		g_error_free(error);
+		janus_refcount_decrease(&mp->ref);
+		return;
+	}
+	g_thread_unref(thread);
+	JANUS_LOG(LOG_INFO, "[%s] Pulling from origin %s:%d\n", mp->name, host, port);
+}
+
+static void janus_streaming_origin_free(janus_streaming_origin *origin) {
+	if(origin == NULL)
+		return;
+	if(origin->fd > -1)
+		close(origin->fd);
+	if(origin->local_fd[0] > -1)
+		close(origin->local_fd[0]);
+	if(origin->local_fd[1] > -1)
+		close(origin->local_fd[1]);
+	g_hash_table_destroy(origin->targets);
+	g_free(origin->host);
+	g_free(origin->secret);
+	g_free(origin);
+}
+
+static void janus_streaming_origin_save(janus_config *config, janus_config_category *c, janus_streaming_rtp_source *source) {
+	if(config == NULL || c == NULL || source == NULL || source->origin == NULL)
+		return;
+	char value[BUFSIZ];
+	janus_config_add(config, c, janus_config_item_create("origin_host", source->origin->host));
+	g_snprintf(value, BUFSIZ, "%"SCNu16, source->origin->port);
+	janus_config_add(config, c, janus_config_item_create("origin_port", value));
+	if(source->origin->secret)
+		janus_config_add(config, c, janus_config_item_create("origin_secret", source->origin->secret));
+}
+
+static void janus_streaming_origin_send(janus_streaming_origin *origin, char type, int mindex, const char *payload) {
+	char buffer[JANUS_STREAMING_EDGE_HEADER_SIZE+256];
+	buffer[0] = JANUS_STREAMING_EDGE_MAGIC;
+	buffer[1] = type;
+	buffer[2] = mindex;
+	buffer[3] = 0;
+	int len = JANUS_STREAMING_EDGE_HEADER_SIZE;
+	if(payload != NULL) {
+		int plen = MIN((int)strlen(payload), 256);
+		memcpy(buffer + len, payload, plen);
+		len += plen;
+	}
+	(void)send(origin->fd, buffer, len, 0);
+}
+
+static void *janus_streaming_origin_thread(void *data) {
+	janus_streaming_mountpoint *mp = (janus_streaming_mountpoint *)data;
+	janus_streaming_rtp_source *source = mp->source;
+	janus_streaming_origin *origin = source->origin;
+	JANUS_LOG(LOG_VERB, "[%s] Joining origin thread\n", mp->name);
+	char buffer[JANUS_STREAMING_EDGE_HEADER_SIZE+1500];
+	gint64 keepalive = 0;
+	struct pollfd pfd;
+	while(!g_atomic_int_get(&stopping) && !g_atomic_int_get(&mp->destroyed)) {
+		gint64 now = janus_get_monotonic_time();
+		/* We only pull from the origin when there's somebody to serve */
+		janus_mutex_lock(&mp->mutex);
+		gboolean needed = (mp->viewers != NULL || source->dvr != NULL);
+		janus_mutex_unlock(&mp->mutex);
+		if(needed && now - keepalive >= JANUS_STREAMING_EDGE_KEEPALIVE) {
+			if(!origin->subscribed)
+				JANUS_LOG(LOG_INFO, "[%s] Subscribing to origin %s:%"SCNu16"\n", mp->name, origin->host, origin->port);
+			janus_streaming_origin_send(origin, JANUS_STREAMING_EDGE_SUBSCRIBE, 0, origin->secret);
+			origin->subscribed = TRUE;
+			keepalive = now;
+		} else if(!needed && origin->subscribed) {
+			JANUS_LOG(LOG_INFO, "[%s] No more viewers, unsubscribing from origin\n", mp->name);
+			janus_streaming_origin_send(origin, JANUS_STREAMING_EDGE_UNSUBSCRIBE, 0, NULL);
+			origin->subscribed = FALSE;
+			keepalive = 0;
+		}
+		if(origin->subscribed) {
+			/* Forward the keyframe requests of our viewers, aggregated */
+			GList *temp = source->media;
+			while(temp) {
+				janus_streaming_rtp_source_stream *stream = (janus_streaming_rtp_source_stream *)temp->data;
+				if(stream->type == JANUS_STREAMING_MEDIA_VIDEO && g_atomic_int_get(&stream->need_pli) &&
+						now - stream->pli_latest >= JANUS_STREAMING_EDGE_PLI_INTERVAL) {
+					g_atomic_int_set(&stream->need_pli, 0);
+					stream->pli_latest = now;
+					janus_streaming_origin_send(origin, JANUS_STREAMING_EDGE_PLI, stream->mindex, NULL);
+					origin->plis++;
+				}
+				temp = temp->next;
+			}
+		}
+		pfd.fd = origin->fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		int res = poll(&pfd, 1, 100);
+		if(res < 0) {
+			if(errno == EINTR)
+				continue;
+			JANUS_LOG(LOG_ERR, "[%s] Error polling origin socket: %d (%s)\n", mp->name, errno, g_strerror(errno));
+			break;
+		}
+		if(res == 0)
+			continue;
+		/* Deliver everything we got to the right streams */
+		int bytes = 0;
+		while((bytes = recv(origin->fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > JANUS_STREAMING_EDGE_HEADER_SIZE) {
+			if((guint8)buffer[0] != JANUS_STREAMING_EDGE_MAGIC || buffer[1] != JANUS_STREAMING_EDGE_MEDIA)
+				continue;
+			int mindex = (guint8)buffer[2], substream = (guint8)buffer[3];
+			janus_streaming_origin_target *target = g_hash_table_lookup(origin->targets, GINT_TO_POINTER(mindex));
+			if(target == NULL || substream > 2 || target->addrlen[substream] == 0)
+				continue;
+			int fd = origin->local_fd[target->addr[substream].ss_family == AF_INET6];
+			if(fd < 0)
+				continue;
+			(void)sendto(fd, buffer + JANUS_STREAMING_EDGE_HEADER_SIZE, bytes - JANUS_STREAMING_EDGE_HEADER_SIZE, 0,
+				(struct sockaddr *)&target->addr[substream], target->addrlen[substream]);
+			origin->packets++;
+			origin->bytes += bytes - JANUS_STREAMING_EDGE_HEADER_SIZE;
+		}
+	}
+	if(origin->subscribed)
+		janus_streaming_origin_send(origin, JANUS_STREAMING_EDGE_UNSUBSCRIBE, 0, NULL);
+	origin->subscribed = FALSE;
+	JANUS_LOG(LOG_VERB, "[%s] Leaving origin thread\n", mp->name);
+	janus_refcount_decrease(&mp->ref);
+	return NULL;
+}
+
+static void *janus_streaming_relay(janus_streaming_mountpoint *mountpoint, int ingest);
 static void *janus_streaming_relay_thread(void *data) {
-	JANUS_LOG(LOG_VERB, "Starting streaming relay thread\n");
-	janus_streaming_mountpoint *mountpoint = (janus_streaming_mountpoint *)data;
+	return janus_streaming_relay((janus_streaming_mountpoint *)data, 0);
+}
+static void *janus_streaming_ingest_thread(void *data) {
+	janus_streaming_ingest *ingest = (janus_streaming_ingest *)data;
+	janus_streaming_mountpoint *mountpoint = ingest->mountpoint;
+	int id = ingest->id;
+	g_free(ingest);
+	return janus_streaming_relay(mountpoint, id);
+}
+
+/* The actual relay loop: the thread with ingest=0 is the mountpoint thread, and
+ * is the one that takes care of the RTSP session and of the viewers at the end,
+ * while the others (if any) only receive and relay the streams assigned to them */
+static void *janus_streaming_relay(janus_streaming_mountpoint *mountpoint, int ingest) {
+	JANUS_LOG(LOG_VERB, "Starting streaming relay thread (ingest #%d)\n", ingest);
 	if(!mountpoint) {
 		JANUS_LOG(LOG_ERR, "Invalid mountpoint!\n");
 		return NULL;
@@ -9375,6 +11669,11 @@ static void *janus_streaming_relay_thread(void *data) {
 	GList *temp = source->media;
 	while(temp) {
 		janus_streaming_rtp_source_stream *stream = (janus_streaming_rtp_source_stream *)temp->data;
+		if(stream->ingest != ingest) {
+			/* Another ingest thread takes care of this stream */
+			temp = temp->next;
+			continue;
+		}
 		if(stream->fd[0] != -1)
 			num++;
 		if(stream->fd[1] != -1)
@@ -9386,16 +11685,8 @@ static void *janus_streaming_relay_thread(void *data) {
 		temp = temp->next;
 	}
 	num++;	/* There's the pipe too */
-
-	/* Add a reference to the helper threads, if needed */
-	if(mountpoint->helper_threads > 0) {
-		GList *l = mountpoint->threads;
-		while(l) {
-			janus_streaming_helper *ht = (janus_streaming_helper *)l->data;
-			janus_refcount_increase(&ht->ref);
-			l = l->next;
-		}
-	}
+	if(ingest == 0)
+		num++;	/* And edges may be talking to us, if we're an origin */
 
 	char *name = g_strdup(mountpoint->name ? mountpoint->name : "??");
 	/* Needed to fix seq and ts */
@@ -9407,29 +11698,36 @@ static void *janus_streaming_relay_thread(void *data) {
 	struct pollfd *fds = g_malloc(num * sizeof(struct pollfd));
 	char buffer[1500];
 	memset(buffer, 0, 1500);
+	janus_streaming_recv_batch *rb = janus_streaming_recv_batch_create();
 	/* We'll have a dynamic number of streams */
 #ifdef HAVE_LIBCURL
 	/* In case this is an RTSP restreamer, we may have to send keep-alive from time to time */
-	gint64 now = janus_get_monotonic_time(), before = now, ka_timeout = 0;
-	if(source->rtsp) {
+	gint64 now = janus_get_monotonic_time(), before = now;
+	if(source->rtsp)
 		source->reconnect_timer = now;
-		ka_timeout = source->ka_timeout;
-	}
-	gboolean connected = TRUE;
 #endif
+	/* This thread only works for this mountpoint, so all its CPU time is accounted to it */
+	gint64 cpu_last = janus_usage_thread_cpu_time();
+	guint cpu_loops = 0;
 	/* Loop */
-	janus_streaming_rtp_relay_packet packet;
+	janus_streaming_rtp_relay_packet packet = { 0 };
 	while(!g_atomic_int_get(&stopping) && !g_atomic_int_get(&mountpoint->destroyed)) {
+		if(++cpu_loops == 64) {
+			cpu_loops = 0;
+			janus_usage_thread_update(&mountpoint->usage, &cpu_last);
+		}
 #ifdef HAVE_LIBCURL
-		/* Let's check regularly if the RTSP server seems to be gone */
+		/* Let's check regularly if the RTSP server seems to be gone: any RTSP
+		 * request is sent by the control pool, so that we never block here */
 		if(source->rtsp) {
-			if(source->reconnecting) {
+			if(g_atomic_int_get(&source->reconnecting)) {
 				/* We're still reconnecting, wait some more */
 				g_usleep(250000);
 				continue;
 			}
 			now = janus_get_monotonic_time();
-			if(!source->reconnecting && (now - source->reconnect_timer > source->reconnect_delay)) {
+			gboolean connected = g_atomic_int_get(&source->rtsp_connected);
+			if(connected && (now - source->reconnect_timer > source->reconnect_delay)) {
 				/*  Assume the RTSP server has gone and schedule a reconnect */
 				JANUS_LOG(LOG_WARN, "[%s] %"SCNi64"s passed with no media, trying to reconnect the RTSP stream\n",
 					name, (now - source->reconnect_timer)/G_USEC_PER_SEC);
@@ -9458,74 +11756,43 @@ static void *janus_streaming_relay_thread(void *data) {
 					stream->rtcp_fd = -1;
 					temp = temp->next;
 				}
-				source->reconnect_timer = now;
+				g_atomic_int_set(&source->rtsp_connected, 0);
 				connected = FALSE;
-				source->reconnecting = TRUE;
-				/* Let's clean up the source first */
-				curl_easy_cleanup(source->curl);
-				source->curl = NULL;
-				g_free(source->curl_errbuf);
-				source->curl_errbuf = NULL;
-				if(source->curldata)
-					g_free(source->curldata->buffer);
-				g_free(source->curldata);
-				source->curldata = NULL;
-				if(g_atomic_int_get(&mountpoint->destroyed))
-					break;
-				/* Now let's try to reconnect */
-				if(janus_streaming_rtsp_connect_to_server(mountpoint) < 0) {
-					/* Reconnection failed? Let's try again later */
-					JANUS_LOG(LOG_WARN, "[%s] Reconnection of the RTSP stream failed, trying again in a few seconds...\n", name);
-				} else {
-					/* We're connected, let's send a PLAY */
-					if(janus_streaming_rtsp_play(source) < 0) {
-						/* Error trying to play? Let's try again later */
-						JANUS_LOG(LOG_WARN, "[%s] RTSP PLAY failed, trying again in a few seconds...\n", name);
-					} else {
-						/* Everything should be back to normal */
-						JANUS_LOG(LOG_INFO, "[%s] Reconnected to the RTSP server, streaming again\n", name);
-						ka_timeout = source->ka_timeout;
-						connected = TRUE;
-					}
-				}
-				source->reconnect_timer = janus_get_monotonic_time();
-				source->reconnecting = FALSE;
+				/* A network glitch may affect many cameras at once: spread the reconnections a bit */
+				source->reconnect_timer = now;
+				source->reconnect_backoff = g_random_int_range(0, G_USEC_PER_SEC);
+			}
+			if(!connected) {
+				/* No socket, we may be waiting to reconnect */
+				if(now - source->reconnect_timer >= source->reconnect_backoff)
+					janus_streaming_rtsp_schedule(mountpoint, janus_streaming_rtsp_reconnect);
+				else
+					g_usleep(250000);
 				continue;
 			}
-		}
-		if(source->reconnecting || !connected) {
-			/* No socket, we may be in the process of reconnecting, or waiting to reconnect */
-			g_usleep(source->reconnect_delay);
-			continue;
-		}
-		/* We may also need to occasionally send a OPTIONS request as a keep-alive */
-		if(ka_timeout > 0) {
-			/* Let's be conservative and send a OPTIONS when half of the timeout has passed */
-			now = janus_get_monotonic_time();
-			if(now-before > ka_timeout && source->curldata) {
-				JANUS_LOG(LOG_VERB, "[%s] %"SCNi64"s passed, sending OPTIONS\n", name, (now-before)/G_USEC_PER_SEC);
+			/* We may also need to occasionally send a OPTIONS request as a keep-alive:
+			 * let's be conservative and send one when half of the timeout has passed */
+			if(source->ka_timeout > 0 && (now - before > source->ka_timeout) &&
+					janus_streaming_rtsp_schedule(mountpoint, janus_streaming_rtsp_keepalive)) {
+				JANUS_LOG(LOG_VERB, "[%s] %"SCNi64"s passed, queueing OPTIONS\n", name, (now-before)/G_USEC_PER_SEC);
 				before = now;
-				/* Send an RTSP OPTIONS */
-				janus_mutex_lock(&source->rtsp_mutex);
-				g_free(source->curldata->buffer);
-				source->curldata->buffer = g_malloc0(1);
-				source->curldata->size = 0;
-				curl_easy_setopt(source->curl, CURLOPT_RTSP_STREAM_URI, source->rtsp_url);
-				curl_easy_setopt(source->curl, CURLOPT_RTSP_REQUEST, (long)CURL_RTSPREQ_OPTIONS);
-				resfd = curl_easy_perform(source->curl);
-				if(resfd != CURLE_OK) {
-					JANUS_LOG(LOG_ERR, "[%s] Couldn't send OPTIONS request: %s (%s)\n",
-						name, curl_easy_strerror(resfd), source->curl_errbuf);
-				}
-				janus_mutex_unlock(&source->rtsp_mutex);
 			}
 		}
 #endif
+		/* Check if we need more or fewer helper threads */
+		if(ingest == 0 && mountpoint->max_helper_threads > 0)
+			janus_streaming_helpers_check(mountpoint, janus_get_monotonic_time());
 		/* Prepare poll */
 		num = 0;
+		int timeout = 1000;
+		gboolean reordering = FALSE;
 		temp = source->media;
 		while(temp) {
 			janus_streaming_rtp_source_stream *stream = (janus_streaming_rtp_source_stream *)temp->data;
+			if(stream->ingest != ingest) {
+				temp = temp->next;
+				continue;
+			}
 			if(stream->fd[0] != -1) {
 				fds[num].fd = stream->fd[0];
 				fds[num].events = POLLIN;
@@ -9550,15 +11817,28 @@ static void *janus_streaming_relay_thread(void *data) {
 				fds[num].revents = 0;
 				num++;
 			}
+			/* If we're holding packets, make sure we don't wait longer than we should */
+			if(source->reorder_ms > 0) {
+				gint64 now = janus_get_monotonic_time();
+				int j = 0;
+				for(j=0; j<3; j++) {
+					int wait = janus_streaming_reorder_wait(stream->reorder[j], now);
+					if(wait < 0)
+						continue;
+					reordering = TRUE;
+					if(wait < timeout)
+						timeout = wait;
+				}
+			}
 			/* Any PLI and/or REMB we should send back to the source? */
 			if(stream->type == JANUS_STREAMING_MEDIA_VIDEO) {
 				if(g_atomic_int_get(&stream->need_pli))
-					janus_streaming_rtcp_pli_send(stream);
-				if(stream->rtcp_fd > -1 && source->lowest_bitrate > 0) {
+					janus_streaming_rtcp_pli_send(source, stream);
+				if(stream->rtcp_fd > -1 && g_atomic_int_get(&source->remb_pending)) {
 					gint64 now = janus_get_monotonic_time();
 					if(source->remb_latest == 0)
 						source->remb_latest = now;
-					else if(now - source->remb_latest >= G_USEC_PER_SEC)
+					else if(now - source->remb_latest >= source->feedback_window)
 						janus_streaming_rtcp_remb_send(source, stream);
 				}
 			}
@@ -9570,8 +11850,15 @@ static void *janus_streaming_relay_thread(void *data) {
 			fds[num].revents = 0;
 			num++;
 		}
+		if(ingest == 0 && source->edges != NULL) {
+			fds[num].fd = source->edges->fd;
+			fds[num].events = POLLIN;
+			fds[num].revents = 0;
+			num++;
+			janus_streaming_edges_check(source->edges, janus_get_monotonic_time());
+		}
 		/* Wait for some data */
-		resfd = poll(fds, num, 1000);
+		resfd = poll(fds, num, timeout);
 		if(resfd < 0) {
 			if(errno == EINTR) {
 				JANUS_LOG(LOG_HUGE, "[%s] Got an EINTR (%s), ignoring...\n", name, g_strerror(errno));
@@ -9593,12 +11880,24 @@ static void *janus_streaming_relay_thread(void *data) {
 			}
 			janus_mutex_unlock(&source->rec_mutex);
 			break;
-		} else if(resfd == 0) {
+		} else if(resfd == 0 && !reordering) {
 			/* No data, keep going */
 			continue;
 		}
 		int i = 0;
-		for(i=0; i<num; i++) {
+		if(reordering) {
+			/* Handle sockets with packets in the reorder buffer we can't hold anymore as readable */
+			gint64 now = janus_get_monotonic_time();
+			for(i=0; i<num; i++) {
+				if(!(fds[i].revents & POLLIN) &&
+						janus_streaming_reorder_wait(janus_streaming_reorder_find(source, fds[i].fd), now) == 0)
+					fds[i].revents |= POLLIN;
+			}
+		}
+		/* Notice that we only move to the next file descriptor when we've
+		 * processed all the datagrams we read in a batch from this one, and
+		 * all the packets in its reorder buffer that can be relayed now */
+		for(i=0; i<num; i = (janus_streaming_recv_pending(rb, source, &fds[i]) ? i : i+1)) {
 			if(fds[i].revents & (POLLERR | POLLHUP)) {
 				/* Socket error? */
 				JANUS_LOG(LOG_ERR, "[%s] Error polling: %s... %d (%s)\n", name,
@@ -9626,12 +11925,17 @@ static void *janus_streaming_relay_thread(void *data) {
 					bytes = read(fds[i].fd, &code, sizeof(int));
 					JANUS_LOG(LOG_VERB, "[%s] Interrupting mountpoint\n", mountpoint->name);
 					break;
+				} else if(source->edges != NULL && fds[i].fd == source->edges->fd) {
+					/* An edge is (un)subscribing, or asking for a keyframe */
+					janus_streaming_edges_incoming(mountpoint, source->edges, buffer, sizeof(buffer));
+					continue;
 				} else {
 					/* Check which stream this file descriptor belongs to */
 					stream = g_hash_table_lookup(source->media_byfd, GINT_TO_POINTER(fds[i].fd));
 				}
 				if(stream == NULL) {
 					/* No stream..? Shouldn't happen, read the bytes and dump them */
+					janus_streaming_recv_batch_reset(rb);
 					addrlen = sizeof(remote);
 					(void)recvfrom(fds[i].fd, buffer, 1500, 0, (struct sockaddr *)&remote, &addrlen);
 					continue;
@@ -9645,11 +11949,12 @@ static void *janus_streaming_relay_thread(void *data) {
 					source->reconnect_timer = now;
 #endif
 					addrlen = sizeof(remote);
-					bytes = recvfrom(fds[i].fd, buffer, 1500, 0, (struct sockaddr *)&remote, &addrlen);
+					bytes = janus_streaming_recv_rtp(rb, source, stream, 0, fds[i].fd, buffer, 1500, &remote, &addrlen, &now);
 					if(bytes < 0 || !janus_is_rtp(buffer, bytes)) {
-						/* Failed to read or not an RTP packet? */
+						/* Failed to read, not an RTP packet, or still in the reorder buffer? */
 						continue;
 					}
+					janus_usage_packets_in(&mountpoint->usage, 1, bytes, source->is_srtp);
 					janus_rtp_header *rtp = (janus_rtp_header *)buffer;
 					ssrc = ntohl(rtp->ssrc);
 					if(source->rtp_collision > 0 && stream->last_ssrc[0] && ssrc != stream->last_ssrc[0] &&
@@ -9713,10 +12018,14 @@ static void *janus_streaming_relay_thread(void *data) {
 						packet.seq_number = ntohs(packet.data->seq_number);
 						/* Go! */
 						janus_mutex_lock(&mountpoint->mutex);
-						g_list_foreach(mountpoint->helper_threads == 0 ? mountpoint->viewers : mountpoint->threads,
-							mountpoint->helper_threads == 0 ? janus_streaming_relay_rtp_packet : janus_streaming_helper_rtprtcp_packet,
-							&packet);
+						if(source->dvr) {
+							/* Serve time-shifted viewers, and then buffer this packet */
+							janus_streaming_dvr_serve(mountpoint, source->dvr, now);
+							janus_streaming_dvr_add(source->dvr, &packet, now);
+						}
+						janus_streaming_relay_to_viewers(mountpoint, &packet, janus_streaming_relay_rtp_packet);
 						janus_mutex_unlock(&mountpoint->mutex);
+						janus_streaming_edges_relay(source, &packet, 0);
 					}
 					continue;
 				} else if(stream->type == JANUS_STREAMING_MEDIA_VIDEO && ((fds[i].fd == stream->fd[0]) ||
@@ -9736,11 +12045,12 @@ static void *janus_streaming_relay_thread(void *data) {
 					source->reconnect_timer = now;
 #endif
 					addrlen = sizeof(remote);
-					bytes = recvfrom(fds[i].fd, buffer, 1500, 0, (struct sockaddr *)&remote, &addrlen);
+					bytes = janus_streaming_recv_rtp(rb, source, stream, index, fds[i].fd, buffer, 1500, &remote, &addrlen, &now);
 					if(bytes < 0 || !janus_is_rtp(buffer, bytes)) {
-						/* Failed to read or not an RTP packet? */
+						/* Failed to read, not an RTP packet, or still in the reorder buffer? */
 						continue;
 					}
+					janus_usage_packets_in(&mountpoint->usage, 1, bytes, source->is_srtp);
 					janus_rtp_header *rtp = (janus_rtp_header *)buffer;
 					ssrc = ntohl(rtp->ssrc);
 					if(source->rtp_collision > 0 && stream->last_ssrc[index] && ssrc != stream->last_ssrc[index] &&
@@ -9804,56 +12114,32 @@ static void *janus_streaming_relay_thread(void *data) {
 							stream->keyframe.temp_keyframe = g_list_append(stream->keyframe.temp_keyframe, pkt);
 							janus_mutex_unlock(&stream->keyframe.mutex);
 						} else {
-							gboolean kf = FALSE;
 							/* Parse RTP header first */
 							janus_rtp_header *header = (janus_rtp_header *)buffer;
 							guint32 timestamp = ntohl(header->timestamp);
 							guint16 seq = ntohs(header->seq_number);
 							JANUS_LOG(LOG_HUGE, "Checking if packet (size=%d, seq=%"SCNu16", ts=%"SCNu32") is a key frame...\n",
 								bytes, seq, timestamp);
-							int plen = 0;
-							char *payload = janus_rtp_payload(buffer, bytes, &plen);
-							if(payload) {
-								switch(stream->codecs.video_codec) {
-									case JANUS_VIDEOCODEC_VP8:
-										kf = janus_vp8_is_keyframe(payload, plen);
-										break;
-									case JANUS_VIDEOCODEC_VP9:
-										kf = janus_vp9_is_keyframe(payload, plen);
-										break;
-									case JANUS_VIDEOCODEC_H264:
-										kf = janus_h264_is_keyframe(payload, plen);
-										break;
-									case JANUS_VIDEOCODEC_AV1:
-										kf = janus_av1_is_keyframe(payload, plen);
-										break;
-									case JANUS_VIDEOCODEC_H265:
-										kf = janus_h265_is_keyframe(payload, plen);
-										break;
-									default:
-										break;
-								}
-								if(kf) {
-									/* New keyframe, start saving it */
-									stream->keyframe.temp_ts = ntohl(rtp->timestamp);
-									JANUS_LOG(LOG_HUGE, "[%s] New keyframe received! ts=%"SCNu32"\n", name, stream->keyframe.temp_ts);
-									janus_mutex_lock(&stream->keyframe.mutex);
-									janus_streaming_rtp_relay_packet *pkt = g_malloc0(sizeof(janus_streaming_rtp_relay_packet));
-									pkt->mindex = stream->mindex;
-									pkt->data = g_malloc(bytes);
-									memcpy(pkt->data, buffer, bytes);
-									pkt->data->ssrc = htons(1);
-									pkt->data->type = stream->codecs.pt;
-									pkt->is_rtp = TRUE;
-									pkt->is_video = TRUE;
-									pkt->is_keyframe = TRUE;
-									pkt->length = bytes;
-									pkt->ptype = rtp->type;
-									pkt->timestamp = stream->keyframe.temp_ts;
-									pkt->seq_number = ntohs(rtp->seq_number);
-									stream->keyframe.temp_keyframe = g_list_append(stream->keyframe.temp_keyframe, pkt);
-									janus_mutex_unlock(&stream->keyframe.mutex);
-								}
+							if(janus_streaming_is_keyframe(stream->codecs.video_codec, buffer, bytes)) {
+								/* New keyframe, start saving it */
+								stream->keyframe.temp_ts = ntohl(rtp->timestamp);
+								JANUS_LOG(LOG_HUGE, "[%s] New keyframe received! ts=%"SCNu32"\n", name, stream->keyframe.temp_ts);
+								janus_mutex_lock(&stream->keyframe.mutex);
+								janus_streaming_rtp_relay_packet *pkt = g_malloc0(sizeof(janus_streaming_rtp_relay_packet));
+								pkt->mindex = stream->mindex;
+								pkt->data = g_malloc(bytes);
+								memcpy(pkt->data, buffer, bytes);
+								pkt->data->ssrc = htons(1);
+								pkt->data->type = stream->codecs.pt;
+								pkt->is_rtp = TRUE;
+								pkt->is_video = TRUE;
+								pkt->is_keyframe = TRUE;
+								pkt->length = bytes;
+								pkt->ptype = rtp->type;
+								pkt->timestamp = stream->keyframe.temp_ts;
+								pkt->seq_number = ntohs(rtp->seq_number);
+								stream->keyframe.temp_keyframe = g_list_append(stream->keyframe.temp_keyframe, pkt);
+								janus_mutex_unlock(&stream->keyframe.mutex);
 							}
 						}
 					}
@@ -9930,10 +12216,9 @@ static void *janus_streaming_relay_thread(void *data) {
 							janus_mutex_lock(&mountpoint->mutex);
 							JANUS_LOG(LOG_HUGE, "[%s] Sending SPS/PPS (seq=%"SCNu16", ts=%"SCNu32")\n", name,
 								ntohs(spspkt.data->seq_number), ntohl(spspkt.data->timestamp));
-							g_list_foreach(mountpoint->helper_threads == 0 ? mountpoint->viewers : mountpoint->threads,
-								mountpoint->helper_threads == 0 ? janus_streaming_relay_rtp_packet : janus_streaming_helper_rtprtcp_packet,
-								&spspkt);
+							janus_streaming_relay_to_viewers(mountpoint, &spspkt, janus_streaming_relay_rtp_packet);
 							janus_mutex_unlock(&mountpoint->mutex);
+							janus_streaming_edges_relay(source, &spspkt, index);
 						}
 					}
 					if(index == 0 && stream->rc) {
@@ -9951,13 +12236,20 @@ static void *janus_streaming_relay_thread(void *data) {
 							packet.ssrc[0] = stream->last_ssrc[0];
 							packet.ssrc[1] = stream->last_ssrc[1];
 							packet.ssrc[2] = stream->last_ssrc[2];
+							/* Classify the packet once, rather than for each viewer */
+							janus_rtp_simulcasting_classify(&packet.sim_info, (char *)packet.data, packet.length,
+								-1, packet.ssrc, NULL, packet.codec, NULL);
 						}
 						/* Go! */
 						janus_mutex_lock(&mountpoint->mutex);
-						g_list_foreach(mountpoint->helper_threads == 0 ? mountpoint->viewers : mountpoint->threads,
-							mountpoint->helper_threads == 0 ? janus_streaming_relay_rtp_packet : janus_streaming_helper_rtprtcp_packet,
-							&packet);
+						if(source->dvr) {
+							/* Serve time-shifted viewers, and then buffer this packet */
+							janus_streaming_dvr_serve(mountpoint, source->dvr, now);
+							janus_streaming_dvr_add(source->dvr, &packet, now);
+						}
+						janus_streaming_relay_to_viewers(mountpoint, &packet, janus_streaming_relay_rtp_packet);
 						janus_mutex_unlock(&mountpoint->mutex);
+						janus_streaming_edges_relay(source, &packet, index);
 					}
 					continue;
 				} else if(stream->type == JANUS_STREAMING_MEDIA_DATA && fds[i].fd == stream->fd[0]) {
@@ -9974,6 +12266,7 @@ static void *janus_streaming_relay_thread(void *data) {
 						/* Failed to read? */
 						continue;
 					}
+					janus_usage_packets_in(&mountpoint->usage, 1, bytes, FALSE);
 					if(!mountpoint->enabled && !stream->rc)
 						continue;
 					/* Copy the data */
@@ -10009,10 +12302,9 @@ static void *janus_streaming_relay_thread(void *data) {
 						}
 						/* Go! */
 						janus_mutex_lock(&mountpoint->mutex);
-						g_list_foreach(mountpoint->helper_threads == 0 ? mountpoint->viewers : mountpoint->threads,
-							mountpoint->helper_threads == 0 ? janus_streaming_relay_rtp_packet : janus_streaming_helper_rtprtcp_packet,
-							&packet);
+						janus_streaming_relay_to_viewers(mountpoint, &packet, janus_streaming_relay_rtp_packet);
 						janus_mutex_unlock(&mountpoint->mutex);
+						janus_streaming_edges_relay(source, &packet, 0);
 					}
 					g_free(packet.data);
 					packet.data = NULL;
@@ -10041,13 +12333,13 @@ static void *janus_streaming_relay_thread(void *data) {
 					packet.length = bytes;
 					/* Go! */
 					janus_mutex_lock(&mountpoint->mutex);
-					g_list_foreach(mountpoint->helper_threads == 0 ? mountpoint->viewers : mountpoint->threads,
-						mountpoint->helper_threads == 0 ? janus_streaming_relay_rtcp_packet : janus_streaming_helper_rtprtcp_packet,
-						&packet);
+					janus_streaming_relay_to_viewers(mountpoint, &packet, janus_streaming_relay_rtcp_packet);
 					janus_mutex_unlock(&mountpoint->mutex);
 				}
 			}
 		}
+		/* If we broke out of the loop, get rid of what we didn't process */
+		janus_streaming_recv_batch_reset(rb);
 	}
 
 	/* Close the ports we bound to */
@@ -10069,6 +12361,16 @@ static void *janus_streaming_relay_thread(void *data) {
 		temp = temp->next;
 	}
 	g_free(fds);
+	g_free(rb);
+	janus_usage_thread_update(&mountpoint->usage, &cpu_last);
+
+	if(ingest > 0) {
+		/* The mountpoint thread will take care of the viewers */
+		JANUS_LOG(LOG_VERB, "[%s] Leaving streaming relay thread (ingest #%d)\n", name, ingest);
+		g_free(name);
+		janus_refcount_decrease(&mountpoint->ref);
+		return NULL;
+	}
 
 	/* Notify users this mountpoint is done */
 	janus_mutex_lock(&mountpoint->mutex);
@@ -10109,16 +12411,6 @@ static void *janus_streaming_relay_thread(void *data) {
 	json_decref(event);
 	janus_mutex_unlock(&mountpoint->mutex);
 
-	/* Unref the helper threads */
-	if(mountpoint->helper_threads > 0) {
-		GList *l = mountpoint->threads;
-		while(l) {
-			janus_streaming_helper *ht = (janus_streaming_helper *)l->data;
-			janus_refcount_decrease(&ht->ref);
-			l = l->next;
-		}
-	}
-
 	JANUS_LOG(LOG_VERB, "[%s] Leaving streaming relay thread\n", name);
 	g_free(name);
 	janus_refcount_decrease(&mountpoint->ref);
@@ -10126,18 +12418,25 @@ static void *janus_streaming_relay_thread(void *data) {
 }
 
 static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data) {
-	janus_streaming_rtp_relay_packet *packet = (janus_streaming_rtp_relay_packet *)user_data;
+	janus_streaming_relay_rtp_packet_batch((janus_streaming_session *)data,
+		(janus_streaming_rtp_relay_packet *)user_data, NULL);
+}
+static void janus_streaming_relay_rtp_packet_batch(janus_streaming_session *session,
+		janus_streaming_rtp_relay_packet *packet, janus_streaming_relay_batch *batch) {
 	if(!packet || !packet->data || packet->length < 1) {
 		JANUS_LOG(LOG_ERR, "Invalid packet...\n");
 		return;
 	}
-	janus_streaming_session *session = (janus_streaming_session *)data;
 	if(!session || !session->handle) {
 		return;
 	}
 	if(!packet->is_keyframe && (!g_atomic_int_get(&session->started) || g_atomic_int_get(&session->paused))) {
 		return;
 	}
+	if(packet->is_rtp && !packet->timeshifted && g_atomic_int_get(&session->timeshifted)) {
+		/* This viewer is being served from the time-shift buffer instead */
+		return;
+	}
 	janus_streaming_session_stream *s = g_hash_table_lookup(session->streams_byid, GINT_TO_POINTER(packet->mindex));
 	if(s == NULL) {
 		/* No session stream for this mindex: maybe the viewer did not subscribe to it */
@@ -10289,14 +12588,18 @@ static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data)
 				 * one of the layers the user wants, as there may be dependencies involved */
 				JANUS_LOG(LOG_HUGE, "Sending packet (spatial=%d, temporal=%d)\n",
 					packet->svc_info.spatial_layer, packet->svc_info.temporal_layer);
-				/* Fix sequence number and timestamp (publisher switching may be involved) */
-				janus_rtp_header_update(packet->data, &s->context, TRUE, 0);
+				/* Fix sequence number and timestamp (publisher switching may be involved):
+				 * we do that on a copy of the header, as the packet may be shared */
+				janus_rtp_header header;
+				memcpy(&header, packet->data, sizeof(header));
+				janus_rtp_header_update(&header, &s->context, TRUE, 0);
 				if(override_mark_bit && !has_marker_bit) {
-					packet->data->markerbit = 1;
+					header.markerbit = 1;
 				}
 				if(s->pt > 0)
-					packet->data->type = s->pt;
-				janus_plugin_rtp rtp = { .mindex = s->mindex, .video = packet->is_video, .buffer = (char *)packet->data, .length = packet->length };
+					header.type = s->pt;
+				janus_plugin_rtp rtp = { .mindex = s->mindex, .video = packet->is_video, .buffer = (char *)packet->data, .length = packet->length,
+					.header = (char *)&header };
 				janus_plugin_rtp_extensions_reset(&rtp.extensions);
 				if(s->min_delay > -1 && s->max_delay > -1) {
 					rtp.extensions.min_delay = s->min_delay;
@@ -10310,14 +12613,7 @@ static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data)
 					}
 				}
 				if(gateway != NULL)
-					gateway->relay_rtp(session->handle, &rtp);
-				if(override_mark_bit && !has_marker_bit) {
-					packet->data->markerbit = 0;
-				}
-				/* Restore the payload type, timestamp and sequence number to what the publisher set them to */
-				packet->data->type = packet->ptype;
-				packet->data->timestamp = htonl(packet->timestamp);
-				packet->data->seq_number = htons(packet->seq_number);
+					janus_streaming_relay_batch_add(batch, session->handle, &rtp);
 			} else if(packet->simulcast) {
 				/* Handle simulcast: don't relay if it's not the substream we wanted to handle */
 				int plen = 0;
@@ -10325,9 +12621,8 @@ static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data)
 				if(payload == NULL)
 					return;
 				/* Process this packet: don't relay if it's not the SSRC/layer we wanted to handle */
-				gboolean relay = janus_rtp_simulcasting_context_process_rtp(&s->sim_context,
-					(char *)packet->data, packet->length, NULL, 0,
-					packet->ssrc, NULL, packet->codec, &s->context, NULL);
+				gboolean relay = janus_rtp_simulcasting_context_process_packet(&s->sim_context,
+					&packet->sim_info, NULL, 0, &s->context);
 				if(!relay) {
 					/* Did a lot of time pass before we could relay a packet? */
 					gint64 now = janus_get_monotonic_time();
@@ -10367,7 +12662,9 @@ static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data)
 					json_decref(event);
 				}
 				/* If we got here, update the RTP header and send the packet */
-				janus_rtp_header_update(packet->data, &s->context, TRUE, 0);
+				janus_rtp_header header;
+				memcpy(&header, packet->data, sizeof(header));
+				janus_rtp_header_update(&header, &s->context, TRUE, 0);
 				char vp8pd[6];
 				if(packet->codec == JANUS_VIDEOCODEC_VP8) {
 					/* For VP8, we save the original payload descriptor, to restore it after */
@@ -10376,9 +12673,10 @@ static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data)
 						s->sim_context.changed_substream);
 				}
 				if(s->pt > 0)
-					packet->data->type = s->pt;
+					header.type = s->pt;
 				/* Send the packet */
-				janus_plugin_rtp rtp = { .mindex = s->mindex, .video = packet->is_video, .buffer = (char *)packet->data, .length = packet->length };
+				janus_plugin_rtp rtp = { .mindex = s->mindex, .video = packet->is_video, .buffer = (char *)packet->data, .length = packet->length,
+					.header = (char *)&header };
 				janus_plugin_rtp_extensions_reset(&rtp.extensions);
 				if(s->min_delay > -1 && s->max_delay > -1) {
 					rtp.extensions.min_delay = s->min_delay;
@@ -10391,22 +12689,27 @@ static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data)
 						rtp.extensions.abs_capture_ts = abs_ts;
 					}
 				}
-				if(gateway != NULL)
-					gateway->relay_rtp(session->handle, &rtp);
-				/* Restore the timestamp and sequence number to what the publisher set them to */
-				packet->data->type = packet->ptype;
-				packet->data->timestamp = htonl(packet->timestamp);
-				packet->data->seq_number = htons(packet->seq_number);
+				if(gateway != NULL) {
+					/* For VP8 we rewrote the payload descriptor too, so we can't batch this */
+					if(packet->codec == JANUS_VIDEOCODEC_VP8)
+						gateway->relay_rtp(session->handle, &rtp);
+					else
+						janus_streaming_relay_batch_add(batch, session->handle, &rtp);
+				}
 				if(packet->codec == JANUS_VIDEOCODEC_VP8) {
 					/* Restore the original payload descriptor as well, as it will be needed by the next viewer */
 					memcpy(payload, vp8pd, sizeof(vp8pd));
 				}
 			} else {
-				/* Fix sequence number and timestamp (switching may be involved) */
-				janus_rtp_header_update(packet->data, &s->context, TRUE, 0);
+				/* Fix sequence number and timestamp (switching may be involved): we
+				 * do that on a copy of the header, as the packet may be shared */
+				janus_rtp_header header;
+				memcpy(&header, packet->data, sizeof(header));
+				janus_rtp_header_update(&header, &s->context, TRUE, 0);
 				if(s->pt > 0)
-					packet->data->type = s->pt;
-				janus_plugin_rtp rtp = { .mindex = s->mindex, .video = packet->is_video, .buffer = (char *)packet->data, .length = packet->length };
+					header.type = s->pt;
+				janus_plugin_rtp rtp = { .mindex = s->mindex, .video = packet->is_video, .buffer = (char *)packet->data, .length = packet->length,
+					.header = (char *)&header };
 				janus_plugin_rtp_extensions_reset(&rtp.extensions);
 				if(s->min_delay > -1 && s->max_delay > -1) {
 					rtp.extensions.min_delay = s->min_delay;
@@ -10420,25 +12723,21 @@ static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data)
 					}
 				}
 				if(gateway != NULL)
-					gateway->relay_rtp(session->handle, &rtp);
-				/* Restore the timestamp and sequence number to what the video source set them to */
-				packet->data->type = packet->ptype;
-				packet->data->timestamp = htonl(packet->timestamp);
-				packet->data->seq_number = htons(packet->seq_number);
+					janus_streaming_relay_batch_add(batch, session->handle, &rtp);
 			}
 		} else {
-			/* Fix sequence number and timestamp (switching may be involved) */
-			janus_rtp_header_update(packet->data, &s->context, FALSE, 0);
+			/* Fix sequence number and timestamp (switching may be involved): we
+			 * do that on a copy of the header, as the packet may be shared */
+			janus_rtp_header header;
+			memcpy(&header, packet->data, sizeof(header));
+			janus_rtp_header_update(&header, &s->context, FALSE, 0);
 			if(s->pt > 0)
-				packet->data->type = s->pt;
-			janus_plugin_rtp rtp = { .mindex = s->mindex, .video = packet->is_video, .buffer = (char *)packet->data, .length = packet->length };
+				header.type = s->pt;
+			janus_plugin_rtp rtp = { .mindex = s->mindex, .video = packet->is_video, .buffer = (char *)packet->data, .length = packet->length,
+				.header = (char *)&header };
 			janus_plugin_rtp_extensions_reset(&rtp.extensions);
 			if(gateway != NULL)
-				gateway->relay_rtp(session->handle, &rtp);
-			/* Restore the timestamp and sequence number to what the video source set them to */
-			packet->data->type = packet->ptype;
-			packet->data->timestamp = htonl(packet->timestamp);
-			packet->data->seq_number = htons(packet->seq_number);
+				janus_streaming_relay_batch_add(batch, session->handle, &rtp);
 		}
 	} else {
 		/* We're broadcasting a data channel message */
@@ -10458,12 +12757,15 @@ static void janus_streaming_relay_rtp_packet(gpointer data, gpointer user_data)
 }
 
 static void janus_streaming_relay_rtcp_packet(gpointer data, gpointer user_data) {
-	janus_streaming_rtp_relay_packet *packet = (janus_streaming_rtp_relay_packet *)user_data;
+	janus_streaming_relay_rtcp_packet_batch((janus_streaming_session *)data,
+		(janus_streaming_rtp_relay_packet *)user_data, NULL);
+}
+static void janus_streaming_relay_rtcp_packet_batch(janus_streaming_session *session,
+		janus_streaming_rtp_relay_packet *packet, janus_streaming_relay_batch *batch) {
 	if(!packet || !packet->data || packet->length < 1) {
 		JANUS_LOG(LOG_ERR, "Invalid packet...\n");
 		return;
 	}
-	janus_streaming_session *session = (janus_streaming_session *)data;
 	if(!session || !session->handle) {
 		return;
 	}
@@ -10478,7 +12780,7 @@ static void janus_streaming_relay_rtcp_packet(gpointer data, gpointer user_data)
 
 	janus_plugin_rtcp rtcp = { .mindex = s->mindex, .video = packet->is_video, .buffer = (char *)packet->data, .length = packet->length };
 	if(gateway != NULL)
-		gateway->relay_rtcp(session->handle, &rtcp);
+		janus_streaming_relay_batch_add_rtcp(batch, session->handle, &rtcp);
 
 	return;
 }
@@ -10490,14 +12792,30 @@ static void janus_streaming_helper_rtprtcp_packet(gpointer data, gpointer user_d
 		return;
 	}
 	janus_streaming_helper *helper = (janus_streaming_helper *)data;
-	if(!helper) {
+	if(!helper || g_atomic_int_get(&helper->retired)) {
 		return;
 	}
-	/* Clone the packet and queue it for delivery on the helper thread */
+	/* Clone the packet and queue it for delivery on the helper thread: the
+	 * buffer is shared by all helpers, unless viewers need to modify it (the
+	 * VP8 payload descriptor is rewritten in place when simulcasting) */
 	janus_streaming_rtp_relay_packet *copy = g_malloc0(sizeof(janus_streaming_rtp_relay_packet));
 	copy->mindex = packet->mindex;
-	copy->data = g_malloc(packet->length);
-	memcpy(copy->data, packet->data, packet->length);
+	if(packet->is_rtp && packet->simulcast && packet->codec == JANUS_VIDEOCODEC_VP8) {
+		copy->data = g_malloc(packet->length);
+		memcpy(copy->data, packet->data, packet->length);
+	} else {
+		if(packet->shared == NULL) {
+			/* First helper for this packet, create the shared buffer */
+			janus_streaming_relay_buffer *shared = g_malloc(sizeof(janus_streaming_relay_buffer));
+			shared->data = g_malloc(packet->length);
+			memcpy(shared->data, packet->data, packet->length);
+			janus_refcount_init(&shared->ref, janus_streaming_relay_buffer_free);
+			packet->shared = shared;
+		}
+		janus_refcount_increase(&packet->shared->ref);
+		copy->shared = packet->shared;
+		copy->data = (janus_rtp_header *)packet->shared->data;
+	}
 	copy->length = packet->length;
 	copy->is_rtp = packet->is_rtp;
 	copy->is_data = packet->is_data;
@@ -10508,6 +12826,7 @@ static void janus_streaming_helper_rtprtcp_packet(gpointer data, gpointer user_d
 	copy->ssrc[0] = packet->ssrc[0];
 	copy->ssrc[1] = packet->ssrc[1];
 	copy->ssrc[2] = packet->ssrc[2];
+	copy->sim_info = packet->sim_info;
 	copy->codec = packet->codec;
 	copy->substream = packet->substream;
 	copy->svc = packet->svc;
@@ -10519,25 +12838,337 @@ static void janus_streaming_helper_rtprtcp_packet(gpointer data, gpointer user_d
 	g_async_queue_push(helper->queued_packets, copy);
 }
 
+/* Relay a packet to all the viewers of a mountpoint, either directly or
+ * via the helper threads, if any (mountpoint mutex locked) */
+static void janus_streaming_relay_to_viewers(janus_streaming_mountpoint *mp, janus_streaming_rtp_relay_packet *packet, GFunc relay) {
+	if(mp->helper_threads == 0) {
+		janus_streaming_relay_to_list(mp->viewers, packet, relay == janus_streaming_relay_rtcp_packet, &mp->usage);
+		return;
+	}
+	g_list_foreach(mp->threads, janus_streaming_helper_rtprtcp_packet, packet);
+	if(packet->shared != NULL) {
+		/* The helpers have their own references now */
+		janus_refcount_decrease(&packet->shared->ref);
+		packet->shared = NULL;
+	}
+}
+
 static void *janus_streaming_helper_thread(void *data) {
 	janus_streaming_helper *helper = (janus_streaming_helper *)data;
 	janus_streaming_mountpoint *mp = helper->mp;
 	JANUS_LOG(LOG_INFO, "[%s/#%d] Joining Streaming helper thread\n", mp->name, helper->id);
+	/* Apply the core scheduling profile for helpers, if any */
+	char tname[64];
+	g_snprintf(tname, sizeof(tname), "shelper %s/#%d", mp->name, helper->id);
+	janus_sched_thread_start(JANUS_SCHED_HELPER, tname);
+	/* This thread only works for this mountpoint, so all its CPU time is accounted to it */
+	gint64 cpu_last = janus_usage_thread_cpu_time();
+	guint cpu_packets = 0;
 	janus_streaming_rtp_relay_packet *pkt = NULL;
 	while(!g_atomic_int_get(&stopping) && !g_atomic_int_get(&mp->destroyed) && !g_atomic_int_get(&helper->destroyed)) {
 		pkt = g_async_queue_pop(helper->queued_packets);
 		if(pkt == &exit_packet)
 			break;
+		if(++cpu_packets == 64) {
+			cpu_packets = 0;
+			janus_usage_thread_update(&mp->usage, &cpu_last);
+		}
 		janus_mutex_lock(&helper->mutex);
-		g_list_foreach(helper->viewers,
-			pkt->is_rtp || pkt->is_data ? janus_streaming_relay_rtp_packet : janus_streaming_relay_rtcp_packet,
-			pkt);
+		if(pkt->viewer != NULL) {
+			/* A viewer was moved to or from this helper: since this message was
+			 * queued with the media, this is exactly where we have to add or remove it */
+			gboolean ours = (g_atomic_pointer_get(&pkt->viewer->helper) == helper);
+			gboolean found = (g_list_find(helper->viewers, pkt->viewer) != NULL);
+			if(ours && !found)
+				helper->viewers = g_list_append(helper->viewers, pkt->viewer);
+			else if(!ours && found)
+				helper->viewers = g_list_remove_all(helper->viewers, pkt->viewer);
+		} else {
+			janus_streaming_relay_to_list(helper->viewers, pkt, !pkt->is_rtp && !pkt->is_data, &mp->usage);
+		}
 		janus_mutex_unlock(&helper->mutex);
-		janus_streaming_rtp_relay_packet_free(pkt);
+		janus_streaming_helper_packet_free(pkt);
+	}
+	if(g_atomic_int_get(&helper->retired) && !g_atomic_int_get(&mp->destroyed)) {
+		/* We were retired, and served all we had: remove ourselves from the mountpoint */
+		janus_mutex_lock(&mp->mutex);
+		if(g_list_find(mp->threads, helper) != NULL) {
+			mp->threads = g_list_remove(mp->threads, helper);
+			janus_refcount_decrease(&helper->ref);
+		}
+		janus_streaming_helper_destroy(helper);
+		janus_mutex_unlock(&mp->mutex);
 	}
+	janus_usage_thread_update(&mp->usage, &cpu_last);
+	janus_sched_thread_stop();
 	JANUS_LOG(LOG_INFO, "[%s/#%d] Leaving Streaming helper thread\n", mp->name, helper->id);
 	janus_refcount_decrease(&helper->ref);
 	janus_refcount_decrease(&mp->ref);
 	g_thread_unref(g_thread_self());
 	return NULL;
 }
+
+static void janus_streaming_helper_packet_free(janus_streaming_rtp_relay_packet *pkt) {
+	if(pkt != NULL && pkt != &exit_packet && pkt->viewer != NULL)
+		janus_refcount_decrease(&pkt->viewer->ref);
+	janus_streaming_rtp_relay_packet_free(pkt);
+}
+
+/* Spawn a new helper thread for a mountpoint (the mountpoint mutex
+ * must be locked, unless the mountpoint is still being created) */
+static janus_streaming_helper *janus_streaming_helper_spawn(janus_streaming_mountpoint *mp) {
+	janus_streaming_helper *helper = g_malloc0(sizeof(janus_streaming_helper));
+	helper->id = ++mp->helper_id;
+	helper->mp = mp;
+	helper->queued_packets = g_async_queue_new_full((GDestroyNotify)janus_streaming_helper_packet_free);
+	janus_mutex_init(&helper->mutex);
+	janus_refcount_init(&helper->ref, janus_streaming_helper_free);
+	/* Spawn a thread and add references */
+	GError *error = NULL;
+	char tname[16];
+	g_snprintf(tname, sizeof(tname), "help %u-%s", helper->id, mp->id_str);
+	janus_refcount_increase(&mp->ref);
+	janus_refcount_increase(&helper->ref);
+	helper->thread = g_thread_try_new(tname, &janus_streaming_helper_thread, helper, &error);
+	if(error != NULL) {
+		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the helper thread...\n",
+			error->code, error->message ? error->message : "??");
+		g_error_free(error);
+		janus_refcount_decrease(&mp->ref);	/* This is for the helper thread */
+		janus_refcount_decrease(&helper->ref);
+		/* This extra unref is for the init */
+		janus_refcount_decrease(&helper->ref);
+		return NULL;
+	}
+	janus_refcount_increase(&helper->ref);
+	mp->threads = g_list_append(mp->threads, helper);
+	mp->helper_threads++;
+	return helper;
+}
+
+/* Add a new viewer to the least loaded helper thread (mountpoint mutex locked) */
+static void janus_streaming_helper_add_viewer(janus_streaming_mountpoint *mp, janus_streaming_session *session) {
+	if(mp->helper_threads == 0)
+		return;
+	int viewers = -1;
+	janus_streaming_helper *helper = NULL;
+	GList *l = mp->threads;
+	while(l) {
+		janus_streaming_helper *ht = (janus_streaming_helper *)l->data;
+		if(!g_atomic_int_get(&ht->retired) && (viewers == -1 || ht->num_viewers < viewers)) {
+			viewers = ht->num_viewers;
+			helper = ht;
+		}
+		l = l->next;
+	}
+	if(helper == NULL)
+		return;
+	janus_mutex_lock(&helper->mutex);
+	g_atomic_pointer_set(&session->helper, helper);
+	if(g_list_find(helper->viewers, session) == NULL)
+		helper->viewers = g_list_append(helper->viewers, session);
+	helper->num_viewers++;
+	janus_mutex_unlock(&helper->mutex);
+	JANUS_LOG(LOG_VERB, "Added viewer to helper thread #%d (%d viewers)\n",
+		helper->id, helper->num_viewers);
+}
+
+/* Remove a viewer from the helper threads (mountpoint mutex locked): since
+ * the viewer may be moving between helpers, we check all of them */
+static void janus_streaming_helper_remove_viewer(janus_streaming_mountpoint *mp, janus_streaming_session *session) {
+	janus_streaming_helper *helper = g_atomic_pointer_get(&session->helper);
+	g_atomic_pointer_set(&session->helper, NULL);
+	GList *l = mp->threads;
+	while(l) {
+		janus_streaming_helper *ht = (janus_streaming_helper *)l->data;
+		janus_mutex_lock(&ht->mutex);
+		if(ht == helper) {
+			ht->num_viewers--;
+			JANUS_LOG(LOG_VERB, "Removing viewer from helper thread #%d\n", ht->id);
+		}
+		ht->viewers = g_list_remove_all(ht->viewers, session);
+		janus_mutex_unlock(&ht->mutex);
+		l = l->next;
+	}
+}
+
+/* Move a viewer from a helper thread to another (mountpoint mutex locked): rather
+ * than changing the lists right away, we queue a message to both helpers, so that
+ * the viewer doesn't miss, or get twice, any of the packets they have queued */
+static void janus_streaming_helper_move_viewer(janus_streaming_session *session,
+		janus_streaming_helper *from, janus_streaming_helper *to) {
+	janus_mutex_lock(&from->mutex);
+	from->num_viewers--;
+	janus_mutex_unlock(&from->mutex);
+	janus_mutex_lock(&to->mutex);
+	to->num_viewers++;
+	janus_mutex_unlock(&to->mutex);
+	g_atomic_pointer_set(&session->helper, to);
+	janus_streaming_helper *helpers[2] = { from, to };
+	int i = 0;
+	for(i=0; i<2; i++) {
+		if(i == 0 && g_atomic_int_get(&from->retired))
+			continue;
+		janus_streaming_rtp_relay_packet *pkt = g_malloc0(sizeof(janus_streaming_rtp_relay_packet));
+		janus_refcount_increase(&session->ref);
+		pkt->viewer = session;
+		g_async_queue_push(helpers[i]->queued_packets, pkt);
+	}
+}
+
+/* Move viewers from the busiest helper threads to the least busy ones (mountpoint mutex locked) */
+static void janus_streaming_helpers_rebalance(janus_streaming_mountpoint *mp) {
+	int total = 0, active = 0;
+	GList *l = mp->threads;
+	while(l) {
+		janus_streaming_helper *ht = (janus_streaming_helper *)l->data;
+		if(!g_atomic_int_get(&ht->retired)) {
+			total += ht->num_viewers;
+			active++;
+		}
+		l = l->next;
+	}
+	if(active < 2)
+		return;
+	int target = (total + active - 1) / active;
+	l = mp->threads;
+	while(l) {
+		janus_streaming_helper *from = (janus_streaming_helper *)l->data;
+		l = l->next;
+		if(g_atomic_int_get(&from->retired) || from->num_viewers <= target)
+			continue;
+		/* Find the viewers this helper is serving: we can only take a snapshot of
+		 * its list, as the helper thread may be updating it in the meanwhile */
+		janus_mutex_lock(&from->mutex);
+		GList *viewers = g_list_copy(from->viewers);
+		janus_mutex_unlock(&from->mutex);
+		GList *v = viewers;
+		while(v && from->num_viewers > target) {
+			janus_streaming_session *session = (janus_streaming_session *)v->data;
+			v = v->next;
+			if(g_atomic_pointer_get(&session->helper) != from)
+				continue;
+			/* Find a helper with room for this viewer */
+			janus_streaming_helper *to = NULL;
+			GList *t = mp->threads;
+			while(t) {
+				janus_streaming_helper *ht = (janus_streaming_helper *)t->data;
+				if(!g_atomic_int_get(&ht->retired) && ht->num_viewers < target &&
+						(to == NULL || ht->num_viewers < to->num_viewers))
+					to = ht;
+				t = t->next;
+			}
+			if(to == NULL)
+				break;
+			janus_streaming_helper_move_viewer(session, from, to);
+		}
+		g_list_free(viewers);
+	}
+}
+
+/* Retire a helper thread after moving its viewers to the other ones (mountpoint mutex
+ * locked): the thread will leave after relaying the packets it has already queued */
+static void janus_streaming_helper_retire(janus_streaming_mountpoint *mp, janus_streaming_helper *helper) {
+	JANUS_LOG(LOG_VERB, "[%s] Retiring helper thread #%d (%d viewers)\n", mp->name, helper->id, helper->num_viewers);
+	g_atomic_int_set(&helper->retired, 1);
+	mp->helper_threads--;
+	janus_mutex_lock(&helper->mutex);
+	GList *viewers = g_list_copy(helper->viewers);
+	janus_mutex_unlock(&helper->mutex);
+	GList *v = viewers;
+	while(v) {
+		janus_streaming_session *session = (janus_streaming_session *)v->data;
+		v = v->next;
+		if(g_atomic_pointer_get(&session->helper) != helper)
+			continue;
+		/* Move the viewer to the least loaded helper */
+		janus_streaming_helper *to = NULL;
+		GList *t = mp->threads;
+		while(t) {
+			janus_streaming_helper *ht = (janus_streaming_helper *)t->data;
+			if(!g_atomic_int_get(&ht->retired) && (to == NULL || ht->num_viewers < to->num_viewers))
+				to = ht;
+			t = t->next;
+		}
+		if(to != NULL)
+			janus_streaming_helper_move_viewer(session, helper, to);
+	}
+	g_list_free(viewers);
+	g_async_queue_push(helper->queued_packets, &exit_packet);
+}
+
+/* Enable the automatic scaling of helper threads on a newly created RTP/RTSP mountpoint */
+static void janus_streaming_helpers_setup(janus_streaming_mountpoint *mp, int max_threads, int viewers_per_thread) {
+	if(mp == NULL || mp->streaming_source != janus_streaming_source_rtp || max_threads < 1)
+		return;
+	janus_mutex_lock(&mp->mutex);
+	/* We need at least a helper thread to start from */
+	if(mp->helper_threads == 0 && janus_streaming_helper_spawn(mp) == NULL) {
+		janus_mutex_unlock(&mp->mutex);
+		return;
+	}
+	mp->min_helper_threads = mp->helper_threads;
+	mp->max_helper_threads = MAX(max_threads, mp->helper_threads);
+	mp->viewers_per_thread = viewers_per_thread > 0 ? viewers_per_thread : JANUS_STREAMING_HELPER_DEFAULT_VIEWERS;
+	JANUS_LOG(LOG_INFO, "[%s] Helper threads will be scaled automatically (%d-%d, %d viewers per thread)\n",
+		mp->name, mp->min_helper_threads, mp->max_helper_threads, mp->viewers_per_thread);
+	janus_mutex_unlock(&mp->mutex);
+}
+
+/* Check if the helper threads of a mountpoint should be scaled up or down:
+ * we look at how many viewers there are, and at how many packets the
+ * helpers are struggling with, which may mean they can't keep up */
+static void janus_streaming_helpers_check(janus_streaming_mountpoint *mp, gint64 now) {
+	if(now - mp->helpers_check < G_USEC_PER_SEC)
+		return;
+	mp->helpers_check = now;
+	janus_mutex_lock(&mp->mutex);
+	int total = 0;
+	gboolean busy = FALSE;
+	janus_streaming_helper *idlest = NULL;
+	GList *l = mp->threads;
+	while(l) {
+		janus_streaming_helper *ht = (janus_streaming_helper *)l->data;
+		l = l->next;
+		if(g_atomic_int_get(&ht->retired))
+			continue;
+		total += ht->num_viewers;
+		if(g_async_queue_length(ht->queued_packets) > JANUS_STREAMING_HELPER_MAX_QUEUE)
+			busy = TRUE;
+		if(idlest == NULL || ht->num_viewers < idlest->num_viewers)
+			idlest = ht;
+	}
+	int needed = (total + mp->viewers_per_thread - 1) / mp->viewers_per_thread;
+	if((needed > mp->helper_threads || busy) && mp->helper_threads < mp->max_helper_threads) {
+		/* Spawn a new helper, and give it part of the viewers */
+		janus_streaming_helper *helper = janus_streaming_helper_spawn(mp);
+		if(helper != NULL) {
+			JANUS_LOG(LOG_VERB, "[%s] Spawned helper thread #%d (%d viewers, %d threads%s)\n",
+				mp->name, helper->id, total, mp->helper_threads, busy ? ", helpers too busy" : "");
+			janus_streaming_helpers_rebalance(mp);
+		}
+	} else if(!busy && mp->helper_threads > mp->min_helper_threads && mp->helper_threads > 1 &&
+			total <= (mp->helper_threads - 1) * mp->viewers_per_thread * 3 / 4) {
+		/* Fewer helpers can take care of these viewers, with some margin to avoid flapping */
+		janus_streaming_helper_retire(mp, idlest);
+		janus_streaming_helpers_rebalance(mp);
+	}
+	janus_mutex_unlock(&mp->mutex);
+}
+
+static void janus_streaming_helpers_save(janus_config *config, janus_config_category *c, janus_streaming_mountpoint *mp) {
+	if(config == NULL || c == NULL || mp == NULL)
+		return;
+	char value[BUFSIZ];
+	int threads = mp->max_helper_threads > 0 ? mp->min_helper_threads : mp->helper_threads;
+	if(threads > 0) {
+		g_snprintf(value, BUFSIZ, "%d", threads);
+		janus_config_add(config, c, janus_config_item_create("threads", value));
+	}
+	if(mp->max_helper_threads > 0) {
+		g_snprintf(value, BUFSIZ, "%d", mp->max_helper_threads);
+		janus_config_add(config, c, janus_config_item_create("max_threads", value));
+		g_snprintf(value, BUFSIZ, "%d", mp->viewers_per_thread);
+		janus_config_add(config, c, janus_config_item_create("viewers_per_thread", value));
+	}
+}
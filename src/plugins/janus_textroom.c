@@ -336,7 +336,22 @@ post = <optional backend to contact via HTTP post for all incoming messages>
 	"username" : "<unique username to have in the room; mandatory>",
 	"display" : "<display name to use in the room; optional>",
 	"token" : "<invitation token, in case the room has an ACL; optional>",
-	"history" : <true|false, whether to retrieve history messages when available (default=true)>
+	"history" : <true|false, whether to retrieve history messages when available (default=true)>,
+	"history_batch" : <true|false, whether history messages should be sent in batches, rather than one by one (default=false)>
+}
+\endverbatim
+ *
+ * When \c history_batch is \c true, past messages are not sent as
+ * individual \c message and \c announcement events, but collected in
+ * as few \c history events as possible, oldest first:
+ *
+\verbatim
+{
+	"textroom" : "history",
+	"room" : <room ID>,
+	"messages" : [
+		// Array of message and announcement events, with the display name of senders
+	]
 }
 \endverbatim
  *
@@ -456,6 +471,25 @@ post = <optional backend to contact via HTTP post for all incoming messages>
  *
  * In case the \c whisper attribute is \c true it means the user actually
  * received a  private message from another participant in the room.
+ *
+ * When the plugin is configured with a \c messages_flush interval (see
+ * the \c general section of the configuration file), public messages sent
+ * to rooms that are busy, that is rooms where messages were already sent
+ * in the last \c messages_flush milliseconds, are not sent right away:
+ * they're collected instead, and sent all together when the interval
+ * expires. Whispers are never delayed. A batch with a single message
+ * is sent as a regular \c message event, while larger batches use a
+ * \c messages event containing all of them, in the order they were sent:
+ *
+\verbatim
+{
+	"textroom" : "messages",
+	"room" : <room ID the messages were sent to>,
+	"messages" : [
+		// Array of message events, formatted as above
+	]
+}
+\endverbatim
  *
  * Another way of injecting text into rooms is by means of announcements.
  * Announcements are basically messages sent by the room itself, rather
@@ -639,7 +673,8 @@ static struct janus_json_parameter join_parameters[] = {
 	{"pin", JSON_STRING, 0},
 	{"token", JSON_STRING, 0},
 	{"display", JSON_STRING, 0},
-	{"history", JANUS_JSON_BOOL, 0}
+	{"history", JANUS_JSON_BOOL, 0},
+	{"history_batch", JANUS_JSON_BOOL, 0}
 };
 static struct janus_json_parameter message_parameters[] = {
 	{"text", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
@@ -669,6 +704,20 @@ static void janus_textroom_hangup_media_internal(janus_plugin_session *handle);
 /* JSON serialization options */
 static size_t json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
 
+/* Public messages in busy rooms can be delayed, and sent in batches */
+static int messages_flush = 0;
+static GAsyncQueue *pending_flushes = NULL;
+static GThread *flush_thread = NULL;
+static void *janus_textroom_flush_thread(void *data);
+typedef struct janus_textroom_pending_flush {
+	struct janus_textroom_room *room;
+	gint64 due;
+} janus_textroom_pending_flush;
+static janus_textroom_pending_flush exit_flush;
+/* Batches are flushed early when they get this large, as a DataChannel
+ * message we relay can't be larger than 64k */
+#define JANUS_TEXTROOM_MAX_BATCH	16384
+
 
 typedef struct janus_textroom_room {
 	guint64 room_id;			/* Unique room ID (when using integers) */
@@ -680,9 +729,15 @@ typedef struct janus_textroom_room {
 	gchar *http_backend;		/* Server to contact via HTTP POST for incoming messages, if any */
 	GHashTable *participants;	/* Map of participants */
 	uint16_t history_size;		/* Number of messages we should store in the history */
-	GQueue *history;			/* History of past messages */
+	struct janus_textroom_history_entry **history;	/* History of past messages, as a ring of history_size records */
+	uint16_t history_start;		/* Index of the oldest message in the history ring */
+	uint16_t history_count;		/* Number of messages currently in the history ring */
 	gboolean check_tokens;		/* Whether to check tokens when participants join (see below) */
 	GHashTable *allowed;		/* Map of participants (as tokens) allowed to join */
+	json_t *pending;			/* Public messages waiting to be sent in a batch, if any */
+	size_t pending_size;		/* Size of the serialized messages waiting to be sent */
+	gboolean flush_scheduled;	/* Whether a flush of the pending messages has been scheduled already */
+	gint64 last_sent;			/* When we last sent public messages to the room */
 	volatile gint destroyed;	/* Whether this room has been destroyed */
 	janus_mutex mutex;			/* Mutex to lock this room instance */
 	janus_refcount ref;
@@ -716,6 +771,57 @@ typedef struct janus_textroom_participant {
 	janus_refcount ref;
 } janus_textroom_participant;
 
+/* Messages in the history are stored as compact records, and only
+ * serialized to JSON when we need to send them to a new participant */
+typedef struct janus_textroom_history_entry {
+	time_t date;				/* When the message was sent */
+	const char *from;			/* Username of the sender, or NULL for announcements */
+	const char *display;		/* Display name of the sender, if any */
+	const char *text;			/* Content of the message */
+	char strings[];				/* Storage for the strings above, in the same allocation */
+} janus_textroom_history_entry;
+
+static void janus_textroom_history_add(janus_textroom_room *textroom,
+		const char *from, const char *display, const char *text, time_t date) {
+	if(textroom->history == NULL || textroom->history_size == 0 || text == NULL)
+		return;
+	size_t from_len = from ? strlen(from)+1 : 0, display_len = display ? strlen(display)+1 : 0,
+		text_len = strlen(text)+1;
+	janus_textroom_history_entry *entry = g_malloc(sizeof(janus_textroom_history_entry) + from_len + display_len + text_len);
+	char *s = entry->strings;
+	entry->date = date;
+	entry->from = from ? memcpy(s, from, from_len) : NULL;
+	s += from_len;
+	entry->display = display ? memcpy(s, display, display_len) : NULL;
+	s += display_len;
+	entry->text = memcpy(s, text, text_len);
+	/* When the ring is full, the new message replaces the oldest one */
+	uint16_t index = (textroom->history_start + textroom->history_count) % textroom->history_size;
+	if(textroom->history_count == textroom->history_size) {
+		g_free(textroom->history[index]);
+		textroom->history_start = (textroom->history_start + 1) % textroom->history_size;
+	} else {
+		textroom->history_count++;
+	}
+	textroom->history[index] = entry;
+}
+
+static json_t *janus_textroom_history_entry_json(janus_textroom_room *textroom, janus_textroom_history_entry *entry) {
+	json_t *msg = json_object();
+	json_object_set_new(msg, "textroom", json_string(entry->from ? "message" : "announcement"));
+	json_object_set_new(msg, "room", string_ids ? json_string(textroom->room_id_str) : json_integer(textroom->room_id));
+	if(entry->from)
+		json_object_set_new(msg, "from", json_string(entry->from));
+	struct tm tm_info;
+	char msgTime[64];
+	strftime(msgTime, sizeof(msgTime), "%FT%T%z", localtime_r(&entry->date, &tm_info));
+	json_object_set_new(msg, "date", json_string(msgTime));
+	json_object_set_new(msg, "text", json_string(entry->text));
+	if(entry->display)
+		json_object_set_new(msg, "display", json_string(entry->display));
+	return msg;
+}
+
 static void janus_textroom_room_destroy(janus_textroom_room *textroom) {
 	if(textroom && g_atomic_int_compare_and_exchange(&textroom->destroyed, 0, 1))
 		janus_refcount_decrease(&textroom->ref);
@@ -730,8 +836,14 @@ static void janus_textroom_room_free(const janus_refcount *textroom_ref) {
 	g_free(textroom->http_backend);
 	g_hash_table_destroy(textroom->participants);
 	g_hash_table_destroy(textroom->allowed);
-	if(textroom->history)
-		g_queue_free_full(textroom->history, (GDestroyNotify)g_free);
+	if(textroom->history) {
+		uint16_t i = 0;
+		for(i=0; i<textroom->history_count; i++)
+			g_free(textroom->history[(textroom->history_start + i) % textroom->history_size]);
+		g_free(textroom->history);
+	}
+	if(textroom->pending)
+		json_decref(textroom->pending);
 	g_free(textroom);
 }
 
@@ -797,6 +909,122 @@ static void janus_textroom_message_free(janus_textroom_message *msg) {
 	g_free(msg);
 }
 
+/* Helpers to send the same text to all the participants in a room, which
+ * must be called with the room mutex locked: the text is only copied once
+ * in the core, no matter how many participants there are */
+static int janus_textroom_relay_all(janus_textroom_room *textroom, const char *text, janus_textroom_participant *skip) {
+	if(textroom->participants == NULL || text == NULL)
+		return 0;
+	GPtrArray *handles = g_ptr_array_sized_new(g_hash_table_size(textroom->participants));
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, textroom->participants);
+	while(g_hash_table_iter_next(&iter, NULL, &value)) {
+		janus_textroom_participant *top = value;
+		if(top == skip || top->session == NULL || top->session->handle == NULL)
+			continue;
+		g_ptr_array_add(handles, top->session->handle);
+	}
+	int ret = 0;
+	if(handles->len > 0) {
+		janus_plugin_data data = { .label = NULL, .protocol = NULL, .binary = FALSE, .buffer = (char *)text, .length = strlen(text) };
+		ret = gateway->relay_data_broadcast((janus_plugin_session **)handles->pdata, handles->len, &data);
+	}
+	g_ptr_array_free(handles, TRUE);
+	return ret;
+}
+static void janus_textroom_flush_pending(janus_textroom_room *textroom) {
+	if(textroom->pending == NULL)
+		return;
+	json_t *pending = textroom->pending;
+	textroom->pending = NULL;
+	textroom->pending_size = 0;
+	textroom->last_sent = janus_get_monotonic_time();
+	char *text = NULL;
+	if(json_array_size(pending) == 1) {
+		/* Just a single message, no need for a batch */
+		text = json_dumps(json_array_get(pending, 0), json_format);
+	} else {
+		json_t *batch = json_object();
+		json_object_set_new(batch, "textroom", json_string("messages"));
+		json_object_set_new(batch, "room", string_ids ? json_string(textroom->room_id_str) : json_integer(textroom->room_id));
+		json_object_set(batch, "messages", pending);
+		text = json_dumps(batch, json_format);
+		json_decref(batch);
+	}
+	if(text == NULL) {
+		JANUS_LOG(LOG_ERR, "Failed to stringify batch of %zu messages...\n", json_array_size(pending));
+	} else {
+		int ret = janus_textroom_relay_all(textroom, text, NULL);
+		JANUS_LOG(LOG_VERB, "  >> Sent %zu messages to %d participants in %s\n",
+			json_array_size(pending), ret, textroom->room_id_str);
+		free(text);
+	}
+	json_decref(pending);
+}
+static int janus_textroom_broadcast(janus_textroom_room *textroom, const char *text, janus_textroom_participant *skip) {
+	/* Make sure messages still waiting in a batch are not overtaken */
+	janus_textroom_flush_pending(textroom);
+	return janus_textroom_relay_all(textroom, text, skip);
+}
+/* Helper to send a public message: if the room has been busy in the last
+ * messages_flush milliseconds, the message is added to a batch instead,
+ * and a flush is scheduled. Must be called with the room mutex locked */
+static void janus_textroom_send_message(janus_textroom_room *textroom, json_t *msg, const char *text) {
+	gint64 now = janus_get_monotonic_time();
+	if(messages_flush == 0 || (textroom->pending == NULL &&
+			now - textroom->last_sent >= (gint64)messages_flush*1000)) {
+		/* Nothing was sent recently, send the message right away */
+		textroom->last_sent = now;
+		janus_textroom_relay_all(textroom, text, NULL);
+		return;
+	}
+	size_t size = strlen(text);
+	if(textroom->pending != NULL && textroom->pending_size + size > JANUS_TEXTROOM_MAX_BATCH)
+		janus_textroom_flush_pending(textroom);
+	if(textroom->pending == NULL)
+		textroom->pending = json_array();
+	json_array_append(textroom->pending, msg);
+	textroom->pending_size += size;
+	if(textroom->flush_scheduled)
+		return;
+	textroom->flush_scheduled = TRUE;
+	janus_refcount_increase(&textroom->ref);
+	janus_textroom_pending_flush *flush = g_malloc(sizeof(janus_textroom_pending_flush));
+	flush->room = textroom;
+	flush->due = now + (gint64)messages_flush*1000;
+	g_async_queue_push(pending_flushes, flush);
+}
+static void *janus_textroom_flush_thread(void *data) {
+	JANUS_LOG(LOG_VERB, "Joining TextRoom flush thread\n");
+	janus_textroom_pending_flush *flush = NULL;
+	while(!g_atomic_int_get(&stopping)) {
+		flush = g_async_queue_pop(pending_flushes);
+		if(flush == &exit_flush)
+			break;
+		gint64 wait = flush->due - janus_get_monotonic_time();
+		if(wait > 0)
+			g_usleep(wait);
+		janus_textroom_room *textroom = flush->room;
+		janus_mutex_lock(&textroom->mutex);
+		textroom->flush_scheduled = FALSE;
+		if(!g_atomic_int_get(&stopping) && !g_atomic_int_get(&textroom->destroyed))
+			janus_textroom_flush_pending(textroom);
+		janus_mutex_unlock(&textroom->mutex);
+		janus_refcount_decrease(&textroom->ref);
+		g_free(flush);
+	}
+	/* Get rid of the flushes we didn't perform */
+	while((flush = g_async_queue_try_pop(pending_flushes)) != NULL) {
+		if(flush == &exit_flush)
+			continue;
+		janus_refcount_decrease(&flush->room->ref);
+		g_free(flush);
+	}
+	JANUS_LOG(LOG_VERB, "Leaving TextRoom flush thread\n");
+	return NULL;
+}
+
 
 /* SDP template: we only offer data channels */
 #define sdp_template \
@@ -915,6 +1143,16 @@ int janus_textroom_init(janus_callbacks *callback, const char *config_path) {
 		if(string_ids) {
 			JANUS_LOG(LOG_INFO, "TextRoom will use alphanumeric IDs, not numeric\n");
 		}
+		janus_config_item *flush = janus_config_get(config, config_general, janus_config_type_item, "messages_flush");
+		if(flush != NULL && flush->value != NULL) {
+			messages_flush = atoi(flush->value);
+			if(messages_flush < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid messages_flush value, disabling\n");
+				messages_flush = 0;
+			} else if(messages_flush > 0) {
+				JANUS_LOG(LOG_INFO, "Public messages in busy rooms will be batched in %d ms windows\n", messages_flush);
+			}
+		}
 	}
 	/* Iterate on all rooms */
 	rooms = g_hash_table_new_full(string_ids ? g_str_hash : g_int64_hash, string_ids ? g_str_equal : g_int64_equal,
@@ -987,7 +1225,7 @@ int janus_textroom_init(janus_callbacks *callback, const char *config_path) {
 					JANUS_LOG(LOG_WARN, "Invalid history size value (%s), disabling history...\n", history->value);
 				} else {
 					if(textroom->history_size > 0)
-						textroom->history = g_queue_new();
+						textroom->history = g_malloc0(textroom->history_size * sizeof(janus_textroom_history_entry *));
 				}
 			}
 			if(post != NULL && post->value != NULL) {
@@ -1045,6 +1283,19 @@ int janus_textroom_init(janus_callbacks *callback, const char *config_path) {
 		g_error_free(error);
 		return -1;
 	}
+	if(messages_flush > 0) {
+		/* Launch the thread that will send batches of public messages */
+		pending_flushes = g_async_queue_new();
+		flush_thread = g_thread_try_new("textroom flush", janus_textroom_flush_thread, NULL, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the TextRoom flush thread, messages won't be batched...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			g_async_queue_unref(pending_flushes);
+			pending_flushes = NULL;
+			messages_flush = 0;
+		}
+	}
 	JANUS_LOG(LOG_INFO, "%s initialized!\n", JANUS_TEXTROOM_NAME);
 	return 0;
 }
@@ -1059,6 +1310,15 @@ void janus_textroom_destroy(void) {
 		g_thread_join(handler_thread);
 		handler_thread = NULL;
 	}
+	if(flush_thread != NULL) {
+		g_async_queue_push(pending_flushes, &exit_flush);
+		g_thread_join(flush_thread);
+		flush_thread = NULL;
+	}
+	if(pending_flushes != NULL) {
+		g_async_queue_unref(pending_flushes);
+		pending_flushes = NULL;
+	}
 
 	/* FIXME We should destroy the sessions cleanly */
 	janus_mutex_lock(&sessions_mutex);
@@ -1546,11 +1806,8 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			g_snprintf(error_cause, 512, "Failed to stringify message");
 			goto msg_response;
 		}
-		char *history_text = NULL;
-		if(textroom->history) {
-			json_object_set_new(msg, "display", json_string(participant->display));
-			history_text = json_dumps(msg, json_format);
-		}
+		/* Public messages may end up in a batch, so we keep the object around */
+		json_t *public_msg = (messages_flush == 0 || username || usernames) ? NULL : json_copy(msg);
 		json_decref(msg);
 		/* Start preparing the response too */
 		reply = json_object();
@@ -1597,27 +1854,9 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 		} else {
 			/* Everybody in the room */
 			JANUS_LOG(LOG_VERB, "To everybody in %s: %s\n", room_id_str, message);
-			if(textroom->participants) {
-				GHashTableIter iter;
-				gpointer value;
-				g_hash_table_iter_init(&iter, textroom->participants);
-				while(g_hash_table_iter_next(&iter, NULL, &value)) {
-					janus_textroom_participant *top = value;
-					JANUS_LOG(LOG_VERB, "  >> To %s in %s: %s\n", top->username, room_id_str, message);
-					janus_refcount_increase(&top->ref);
-					janus_plugin_data data = { .label = NULL, .protocol = NULL, .binary = FALSE, .buffer = msg_text, .length = strlen(msg_text) };
-					gateway->relay_data(top->session->handle, &data);
-					janus_refcount_decrease(&top->ref);
-				}
-			}
-			if(textroom->history && history_text) {
-				/* Store in the history */
-				g_queue_push_tail(textroom->history, history_text);
-				if(g_queue_get_length(textroom->history) > textroom->history_size) {
-					char *text = (char *)g_queue_pop_head(textroom->history);
-					g_free(text);
-				}
-			}
+			janus_textroom_send_message(textroom, public_msg, msg_text);
+			/* Store in the history */
+			janus_textroom_history_add(textroom, participant->username, participant->display, message, timer);
 #ifdef HAVE_LIBCURL
 			/* Is there a backend waiting for this message too? */
 			if(textroom->http_backend) {
@@ -1650,6 +1889,8 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 		}
 		janus_refcount_decrease(&participant->ref);
 		free(msg_text);
+		if(public_msg)
+			json_decref(public_msg);
 		janus_mutex_unlock(&textroom->mutex);
 		janus_refcount_decrease(&textroom->ref);
 		/* By default we send a confirmation back to the user that sent this message:
@@ -1766,18 +2007,60 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 		/* Check if we need to send some history back */
 		json_t *history = json_object_get(root, "history");
 		gboolean send_history = history ? json_is_true(history) : TRUE;
-		if(send_history) {
-			if(textroom->history != NULL && textroom->history->head != NULL) {
-				GList *temp = textroom->history->head;
-				char *text = NULL;
-				janus_plugin_data data = { .label = NULL, .protocol = NULL, .binary = FALSE, .buffer = NULL, .length = 0 };
-				while(temp) {
-					text = (char *)temp->data;
+		if(send_history && textroom->history != NULL && textroom->history_count > 0) {
+			/* Past messages can be sent one by one, or in batches */
+			json_t *history_batch = json_object_get(root, "history_batch");
+			gboolean batch = history_batch ? json_is_true(history_batch) : FALSE;
+			json_t *batched = NULL;
+			size_t batched_size = 0;
+			janus_plugin_data data = { .label = NULL, .protocol = NULL, .binary = FALSE, .buffer = NULL, .length = 0 };
+			guint i = 0;
+			for(i=0; i<=textroom->history_count; i++) {
+				janus_textroom_history_entry *entry = NULL;
+				size_t size = 0;
+				if(i < textroom->history_count) {
+					entry = textroom->history[(textroom->history_start + i) % textroom->history_size];
+					/* Worst case estimate of how large this message will be once serialized */
+					size = 2*strlen(entry->text) + (entry->from ? 2*strlen(entry->from) : 0) +
+						(entry->display ? 2*strlen(entry->display) : 0) + 256;
+				}
+				json_t *msg = entry ? janus_textroom_history_entry_json(textroom, entry) : NULL;
+				if(!batch) {
+					if(msg == NULL)
+						break;
+					char *text = json_dumps(msg, json_format);
+					json_decref(msg);
+					if(text == NULL)
+						continue;
 					data.buffer = text;
 					data.length = strlen(text);
 					gateway->relay_data(handle, &data);
-					temp = temp->next;
+					free(text);
+					continue;
 				}
+				if(batched && (entry == NULL || batched_size + size > JANUS_TEXTROOM_MAX_BATCH)) {
+					/* Send what we have so far */
+					json_t *event = json_object();
+					json_object_set_new(event, "textroom", json_string("history"));
+					json_object_set_new(event, "room", string_ids ? json_string(textroom->room_id_str) : json_integer(textroom->room_id));
+					json_object_set_new(event, "messages", batched);
+					char *text = json_dumps(event, json_format);
+					json_decref(event);
+					if(text != NULL) {
+						data.buffer = text;
+						data.length = strlen(text);
+						gateway->relay_data(handle, &data);
+						free(text);
+					}
+					batched = NULL;
+					batched_size = 0;
+				}
+				if(msg == NULL)
+					break;
+				if(batched == NULL)
+					batched = json_array();
+				json_array_append_new(batched, msg);
+				batched_size += size;
 			}
 		}
 		/* Notify all participants */
@@ -1805,6 +2088,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			janus_plugin_data data = { .label = NULL, .protocol = NULL, .binary = FALSE, .buffer = event_text, .length = strlen(event_text) };
 			gateway->relay_data(handle, &data);
 			/* Broadcast */
+			janus_textroom_broadcast(textroom, event_text, participant);
 			GHashTableIter iter;
 			gpointer value;
 			g_hash_table_iter_init(&iter, textroom->participants);
@@ -1813,8 +2097,6 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 				if(top == participant)
 					continue;	/* Skip us */
 				janus_refcount_increase(&top->ref);
-				JANUS_LOG(LOG_VERB, "  >> To %s in %s\n", top->username, room_id_str);
-				gateway->relay_data(top->session->handle, &data);
 				/* Take note of this user */
 				json_t *p = json_object();
 				json_object_set_new(p, "username", json_string(top->username));
@@ -1920,18 +2202,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			janus_plugin_data data = { .label = NULL, .protocol = NULL, .binary = FALSE, .buffer = event_text, .length = strlen(event_text) };
 			gateway->relay_data(handle, &data);
 			/* Broadcast */
-			GHashTableIter iter;
-			gpointer value;
-			g_hash_table_iter_init(&iter, textroom->participants);
-			while(g_hash_table_iter_next(&iter, NULL, &value)) {
-				janus_textroom_participant *top = value;
-				if(top == participant)
-					continue;	/* Skip us */
-				janus_refcount_increase(&top->ref);
-				JANUS_LOG(LOG_VERB, "  >> To %s in %s\n", top->username, room_id_str);
-				gateway->relay_data(top->session->handle, &data);
-				janus_refcount_decrease(&top->ref);
-			}
+			janus_textroom_broadcast(textroom, event_text, participant);
 			free(event_text);
 		}
 		/* Also notify event handlers */
@@ -2256,15 +2527,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 				goto msg_response;
 			}
 			/* Broadcast */
-			GHashTableIter iter;
-			gpointer value;
-			g_hash_table_iter_init(&iter, textroom->participants);
-			while(g_hash_table_iter_next(&iter, NULL, &value)) {
-				janus_textroom_participant *top = value;
-				JANUS_LOG(LOG_VERB, "  >> To %s in %s\n", top->username, room_id_str);
-				janus_plugin_data data = { .label = NULL, .protocol = NULL, .binary = FALSE, .buffer = event_text, .length = strlen(event_text) };
-				gateway->relay_data(top->session->handle, &data);
-			}
+			janus_textroom_broadcast(textroom, event_text, NULL);
 			free(event_text);
 		}
 		/* Also notify event handlers */
@@ -2364,27 +2627,10 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			goto msg_response;
 		}
 		/* Send the announcement to everybody in the room */
-		if(textroom->participants) {
-			GHashTableIter iter;
-			gpointer value;
-			g_hash_table_iter_init(&iter, textroom->participants);
-			while(g_hash_table_iter_next(&iter, NULL, &value)) {
-				janus_textroom_participant *top = value;
-				JANUS_LOG(LOG_VERB, "  >> To %s in %s: %s\n", top->username, room_id_str, message);
-				janus_refcount_increase(&top->ref);
-				janus_plugin_data data = { .label = NULL, .protocol = NULL, .binary = FALSE, .buffer = msg_text, .length = strlen(msg_text) };
-				gateway->relay_data(top->session->handle, &data);
-				janus_refcount_decrease(&top->ref);
-			}
-		}
-		if(textroom->history) {
-			/* Store in the history */
-			g_queue_push_tail(textroom->history, g_strdup(msg_text));
-			if(g_queue_get_length(textroom->history) > textroom->history_size) {
-				char *text = (char *)g_queue_pop_head(textroom->history);
-				g_free(text);
-			}
-		}
+		JANUS_LOG(LOG_VERB, "Announcement to everybody in %s: %s\n", room_id_str, message);
+		janus_textroom_broadcast(textroom, msg_text, NULL);
+		/* Store in the history */
+		janus_textroom_history_add(textroom, NULL, NULL, message, timer);
 #ifdef HAVE_LIBCURL
 		/* Is there a backend waiting for this message too? */
 		if(textroom->http_backend) {
@@ -2554,7 +2800,7 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 		if(history) {
 			textroom->history_size = json_integer_value(history);
 			if(textroom->history_size > 0)
-				textroom->history = g_queue_new();
+				textroom->history = g_malloc0(textroom->history_size * sizeof(janus_textroom_history_entry *));
 		}
 		if(post) {
 #ifdef HAVE_LIBCURL
@@ -2902,14 +3148,13 @@ janus_plugin_result *janus_textroom_handle_incoming_request(janus_plugin_session
 			janus_plugin_data data = { .label = NULL, .protocol = NULL, .binary = FALSE, .buffer = event_text, .length = strlen(event_text) };
 			gateway->relay_data(handle, &data);
 			/* Broadcast */
+			janus_textroom_broadcast(textroom, event_text, NULL);
 			GHashTableIter iter;
 			gpointer value;
 			g_hash_table_iter_init(&iter, textroom->participants);
 			while(g_hash_table_iter_next(&iter, NULL, &value)) {
 				janus_textroom_participant *top = value;
 				janus_refcount_increase(&top->ref);
-				JANUS_LOG(LOG_VERB, "  >> To %s in %s\n", top->username, room_id_str);
-				gateway->relay_data(top->session->handle, &data);
 				janus_mutex_lock(&top->session->mutex);
 				g_hash_table_remove(top->session->rooms, string_ids ? (gpointer)room_id_str : (gpointer)&room_id);
 				janus_mutex_unlock(&top->session->mutex);
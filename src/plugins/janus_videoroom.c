@@ -89,6 +89,7 @@ room-<unique room ID>: {
 	h264_profile = H.264-specific profile to prefer (e.g., "42e01f" for "profile-level-id=42e01f")
 	opus_fec = true|false (whether inband FEC must be negotiated; only works for Opus, default=true)
 	opus_dtx = true|false (whether DTX must be negotiated; only works for Opus, default=false)
+	opus_red = true|false (whether RED (redundant audio) must be negotiated with publishers; only works for Opus, default=false)
 	audiolevel_ext = true|false (whether the ssrc-audio-level RTP extension must be
 		negotiated/used or not for new publishers, default=true)
 	audiolevel_event = true|false (whether to emit event to other users or not, default=false)
@@ -100,8 +101,26 @@ room-<unique room ID>: {
 		negotiated/used or not for new publishers, default=true)
 	transport_wide_cc_ext = true|false (whether the transport wide CC RTP extension must be
 		negotiated/used or not for new publishers, default=true)
+	bwe = true|false (whether the bandwidth estimated towards subscribers, via the transport
+		wide CC feedback they send, should be used to automatically cap the simulcast
+		substream or SVC layer they receive, default=false)
+	active_speakers = <number of loudest publishers, detected via audio levels, whose video
+		subscribers should receive at the highest simulcast substream or SVC layer: video
+		from all the other publishers is capped to the lowest one; default=0 (disabled)>
+	audio_last_n = <number of publishers, among the ones that talked last as detected
+		via audio levels, whose audio is relayed to subscribers: audio from all the other
+		publishers is dropped until they start talking and get a slot; publishers that are
+		relayed and still talking are never replaced by louder ones; requires audiolevel_ext,
+		default=0 (all audio is relayed)>
+	keyframe_cache = true|false (whether the latest keyframe of each video stream, and the
+		packets that followed it, should be kept in memory and replayed to new subscribers,
+		so that they can start decoding right away rather than waiting for a PLI, default=false)
 	record = true|false (whether this room should be recorded, default=false)
 	rec_dir = <folder where recordings should be stored, when enabled>
+	rec_substream = <simulcast substream (or SVC spatial layer) to record for video streams
+				that have more than one, where 0 is the lowest; default=2 (the highest available)>
+	rec_temporal = <simulcast or SVC temporal layer to record, where 0 is the lowest;
+				default=2 (the highest available)>
 	lock_record = true|false (whether recording can only be started/stopped if the secret
 				is provided, or using the global enable_recording request, default=false)
 	notify_joining = true|false (optional, whether to notify all participants when a new
@@ -121,7 +140,8 @@ room-<unique room ID>: {
 				Notice that the fmtp is parsed, and only a few codecs are supported.
 	threads = number of threads to assist with the relaying of publishers in the room; as
 				in the Streaming plugin, this setting can help if you expect a lot of subscribers
-				that may cause the plugin to slow down and fail to catch up (default=0)
+				that may cause the plugin to slow down and fail to catch up (default=0);
+				in the configuration file, "auto" can be used for one thread per CPU core
 }
 \endverbatim
  *
@@ -165,6 +185,90 @@ room-<unique room ID>: {
  * I want to watch Bob now) without having to create a new handle for
  * that; finally, \c leave allows you to leave a video room for good
  * (or, in the case of viewers, definitely closes a subscription).
+ *
+ * Asynchronous requests are processed by a pool of handler threads, whose
+ * size can be set with the \c handler_threads property in the \c general
+ * section of the configuration file (default is a single thread). Each
+ * handle is bound to one of the threads the first time it sends one of
+ * those requests, picked according to the \c room it refers to, which
+ * means requests from the same handle are always processed in order, and
+ * so are the ones of the participants joining the same room. An Admin API
+ * only \c handler_stats request can be used to check how each thread is
+ * doing, that is how many requests it processed, how deep its queue was
+ * when new requests were added to it, and how long requests waited in
+ * the queue and took to be processed overall (in milliseconds):
+ *
+\verbatim
+{
+	"request" : "handler_stats"
+}
+\endverbatim
+ *
+ * which results in a response like this:
+ *
+\verbatim
+{
+	"videoroom" : "handler_stats",
+	"handlers" : [
+		{
+			"id" : <index of the handler thread>,
+			"queued" : <number of requests currently in the queue>,
+			"processed" : <number of requests processed so far>,
+			"depth" : { "<upper bound of the bucket>" : <how many requests found that many requests in the queue>, ... },
+			"wait" : { "<upper bound of the bucket, in ms>" : <how many requests waited that long in the queue>, ... },
+			"latency" : { "<upper bound of the bucket, in ms>" : <how many requests took that long to be processed overall>, ... }
+		},
+		// Other handler threads
+	]
+}
+\endverbatim
+ *
+ * To help decide where new rooms should be created, the resources each
+ * room consumes are accounted too: packets and bytes received from the
+ * publishers and sent to the subscribers, the SRTP operations the core
+ * performs for them, and the CPU time used for the room. When the room
+ * has helper threads, their CPU time is all accounted to the room; when
+ * it doesn't, the time spent relaying packets in the publishers' threads
+ * is sampled instead. An Admin API only \c usage request can be used to
+ * retrieve these values, optionally for a specific \c room , and
+ * optionally resetting (\c reset=true ) the counters after reading them:
+ *
+\verbatim
+{
+	"request" : "usage",
+	"room" : <unique numeric ID of the room; optional, all rooms if missing>,
+	"reset" : <true|false, whether the counters should start from scratch after this; optional>
+}
+\endverbatim
+ *
+ * which results in a response like this:
+ *
+\verbatim
+{
+	"videoroom" : "usage",
+	"rooms" : [
+		{
+			"room" : <unique numeric ID of the room>,
+			"description" : "<name of the room>",
+			"num_participants" : <number of participants in the room>,
+			"helper_threads" : <number of helper threads of the room>,
+			"usage" : {
+				"packets-in" : <packets received>,
+				"bytes-in" : <bytes received>,
+				"packets-out" : <packets sent>,
+				"bytes-out" : <bytes sent>,
+				"srtp-ops" : <SRTP encryptions and decryptions the core performed for those packets>,
+				"decode-time" : <always 0, as the VideoRoom doesn't decode media>,
+				"encode-time" : <always 0, as the VideoRoom doesn't encode media>,
+				"cpu-time" : <CPU time used for the room, in us>,
+				"elapsed" : <seconds since accounting started (room creation or last reset)>,
+				"cpu-load" : <average CPU load in that time, as a percentage of one core>
+			}
+		},
+		// Other rooms
+	]
+}
+\endverbatim
  *
  * \c create can be used to create a new video room, and has to be
  * formatted as follows:
@@ -420,8 +524,11 @@ room-<unique room ID>: {
 			"videocodec" : "<comma separated list of allowed video codecs>",
 			"opus_fec": <true|false, whether inband FEC must be negotiated (note: only available for Opus) (optional)>,
 			"opus_dtx": <true|false, whether DTX must be negotiated (note: only available for Opus) (optional)>,
+			"opus_red": <true|false, whether RED must be negotiated with publishers (note: only available for Opus) (optional)>,
 			"record" : <true|false, whether the room is being recorded>,
 			"rec_dir" : "<if recording, the path where the .mjr files are being saved>",
+			"rec_substream" : <if lower than 2, the simulcast substream or SVC spatial layer that is recorded>,
+			"rec_temporal" : <if lower than 2, the simulcast or SVC temporal layer that is recorded>,
 			"lock_record" : <true|false, whether the room recording state can only be changed providing the secret>,
 			"num_participants" : <count of the participants (publishers, active or not; not subscribers)>
 			"audiolevel_ext": <true|false, whether the ssrc-audio-level extension must be negotiated or not for new publishers>,
@@ -430,7 +537,11 @@ room-<unique room ID>: {
 			"audio_level_average": <average audio level (optional, only if audiolevel_event is true)>,
 			"videoorient_ext": <true|false, whether the video-orientation extension must be negotiated or not for new publishers>,
 			"playoutdelay_ext": <true|false, whether the playout-delay extension must be negotiated or not for new publishers>,
-			"transport_wide_cc_ext": <true|false, whether the transport wide cc extension must be negotiated or not for new publishers>
+			"transport_wide_cc_ext": <true|false, whether the transport wide cc extension must be negotiated or not for new publishers>,
+			"bwe": <true|false, whether the bandwidth estimated towards subscribers is used to cap the substreams/layers they receive>,
+			"active_speakers": <number of loudest publishers sent at the highest substream/layer, if enabled (all others are capped to the lowest)>,
+			"audio_last_n": <number of last speakers whose audio is relayed, if enabled (audio from all others is dropped)>,
+			"keyframe_cache": <true|false, whether the latest keyframes of publishers are replayed to new subscribers>
 		},
 		// Other rooms
 	]
@@ -605,6 +716,8 @@ room-<unique room ID>: {
 	"bitrate" : <bitrate cap to return via REMB; optional, overrides the global room value if present>,
 	"record" : <true|false, whether this publisher should be recorded or not; optional>,
 	"filename" : "<if recording, the base path/file to use for the recording files; optional>",
+	"rec_substream" : <if recording, simulcast substream or SVC spatial layer to record; optional, overrides the room value if present>,
+	"rec_temporal" : <if recording, simulcast or SVC temporal layer to record; optional, overrides the room value if present>,
 	"display" : "<display name to use in the room; optional>",
 	"metadata" : <valid json object of metadata; optional>,
 	"audio_level_average" : "<if provided, overrides the room audio_level_average for this user; optional>",
@@ -664,7 +777,11 @@ room-<unique room ID>: {
  * However you decided to publish something, as soon as the PeerConnection
  * setup succeeds and the publisher becomes active, an event is sent to
  * all the participants in the room with information on the new feed.
- * The event must contain an array with a single element, and be formatted like this:
+ * The event usually contains an array with a single element, unless the
+ * plugin is configured with a \c publisher_events_delay (see the \c general
+ * section of the configuration file), in which case news about all the
+ * publishers that appeared or changed in that window are sent in a single
+ * event. Either way, it's formatted like this:
  *
 \verbatim
 {
@@ -746,6 +863,8 @@ room-<unique room ID>: {
 	"keyframe" : <true|false, whether we should send this publisher a keyframe request>,
 	"record" : <true|false, whether this publisher should be recorded or not; optional>,
 	"filename" : "<if recording, the base path/file to use for the recording files; optional>",
+	"rec_substream" : <if recording, simulcast substream or SVC spatial layer to record; optional, overrides the room value if present>,
+	"rec_temporal" : <if recording, simulcast or SVC temporal layer to record; optional, overrides the room value if present>,
 	"display" : "<new display name to use in the room; optional>",
 	"metadata" : <new metadata json object; optional>,
 	"audio_active_packets" : "<new audio_active_packets to overwrite in the room one; optional>",
@@ -994,6 +1113,16 @@ room-<unique room ID>: {
  * secret is provided, thus ensuring that only an administrator will normally
  * be able to do that (e.g., using the \c enable_recording just introduced).
  *
+ * Video streams that are simulcast, or that use SVC, are recorded as a
+ * single layer: by default that's the highest substream/spatial layer
+ * and the highest temporal layer available, but a lower one can be
+ * chosen for the whole room (\c rec_substream and \c rec_temporal
+ * when creating it) or for specific publishers (same properties in
+ * \c publish and \c configure requests), which can greatly reduce the
+ * amount of data written to disk and later post-processed. Layers are
+ * switched on keyframes, and sequence numbers and timestamps rewritten
+ * accordingly, so that the recording always looks like a single stream.
+ *
  * To conclude, you can leave a room you previously joined as publisher
  * using the \c leave request. This will also implicitly unpublish you
  * if you were an active publisher in the room. The \c leave request
@@ -1185,6 +1314,11 @@ room-<unique room ID>: {
  * multiple requests to update a subscription at the same time, thus
  * addressing them all in a cumulative way. This means clients should
  * never expect an offer any time they request one.
+ * The same happens when the plugin is configured with a \c renegotiation_delay
+ * (see the \c general section of the configuration file): in that case,
+ * subscription changes (including the ones automatically triggered by
+ * publishers going away) are always collected for that many milliseconds
+ * before a single offer addressing all of them is sent.
  *
  * The syntax of the \c subscribe mirrors the one for new subscriptions,
  * meaning you use the same \c streams array to address the new streams
@@ -1284,6 +1418,21 @@ room-<unique room ID>: {
  * result in SDP changes (e.g., unsubscribing from a data channel stream),
  * you'll simply get an \c updated event back with no \c streams object.
  *
+ * Messages publishers send on their data channel are relayed to all the
+ * subscribers of that stream, using the ID of the publisher as the label
+ * of the channel. The core only copies each message once, however many
+ * subscribers it is relayed to. When publishers send many small messages
+ * (e.g., game state or telemetry updates), the plugin can also be
+ * configured with a \c data_coalesce window (see the \c general section
+ * of the configuration file): in that case, text messages smaller than
+ * 1024 bytes that don't contain any newline are not relayed right away,
+ * but collected for that many milliseconds, and then relayed to each
+ * subscriber as a single text message, in which they're separated by
+ * newlines, which means applications must be prepared to split them.
+ * Binary messages, and text messages that can't be coalesced, are still
+ * relayed as they are, after the messages that were waiting, so that the
+ * order is always preserved.
+ *
  * As anticipated, the \c update request allows you to combine changes
  * to a subscription where you may want to both subscribe to new streams,
  * and unsubscribe from existing ones, which the existing \c subscribe
@@ -1412,6 +1561,35 @@ room-<unique room ID>: {
  * but within the context of SVC publishers, and will have no effect
  * on subscriptions associated to regular publishers.
  *
+ * Changing \c send via \c configure goes through the same queue all other
+ * subscriber requests go through, which may not be ideal when clients
+ * need to frequently toggle many streams, e.g., in large grid layouts
+ * where only some of the subscribed publishers are rendered at any given
+ * time. For this purpose, subscribers can also use the lightweight
+ * \c suspend and \c resume requests, that are handled synchronously
+ * and only toggle whether packets are relayed or not:
+ *
+\verbatim
+{
+	"request" : "suspend",
+	"mids" : [ <array of mids to suspend; optional, all video streams if missing> ]
+}
+\endverbatim
+ *
+ * \c resume uses exactly the same syntax. A successful request will
+ * result in a \c success response, containing the list of mids that
+ * were affected:
+ *
+\verbatim
+{
+	"videoroom" : "success",
+	"suspended" : [ <array of mids that are now suspended (resumed for resume)> ]
+}
+\endverbatim
+ *
+ * Suspended streams are skipped entirely when relaying, while resuming
+ * a video stream automatically sends a keyframe request to the publisher.
+ *
  * As anticipated, \c configure is also the request you use when you want
  * to trigger an ICE restart for a subscriber: in fact, while publishers
  * can force a restart themselves by providing the right JSEP offer, subscribers
@@ -1519,6 +1697,25 @@ room-<unique room ID>: {
 	"left" : "ok",
 }
 \endverbatim
+ *
+ * \subsection vroomdrain Draining
+ *
+ * When the Janus instance is drained via the Admin API (e.g., because
+ * it's about to be scaled down), all users are notified with an event
+ * like the following, with \c draining set to \c false if the drain
+ * is cancelled instead:
+ *
+\verbatim
+{
+	"videoroom" : "event",
+	"draining" : true
+}
+\endverbatim
+ *
+ * The plugin doesn't do anything else: it's up to the application to
+ * migrate its users, e.g., by having them join the same room on another
+ * instance, where the publishers of this instance may have been made
+ * available already as remote publishers (see \ref vroomcasc below).
  *
  * \subsection vroomcasc Remote publishers (room cascading)
  *
@@ -1588,6 +1785,37 @@ room-<unique room ID>: {
  * but only to notify the recipient about what media is on its way, and
  * demultiplexing will be performed automatically.
  *
+ * To make the process on-demand, rather than cascading all rooms to all
+ * nodes in advance, you can set \c directory_events in the plugin
+ * configuration. When enabled, the plugin tells event handlers whenever
+ * a user tries to join a room that doesn't exist on this instance, or
+ * to subscribe (or switch) to a feed that isn't available in a room,
+ * with events like the following:
+ *
+\verbatim
+{
+	"event" : "room_requested",
+	"room" : <unique ID of the room that was asked for>
+}
+\endverbatim
+ *
+\verbatim
+{
+	"event" : "feed_requested",
+	"room" : <unique ID of the room>,
+	"feed" : <unique ID of the publisher that was asked for>
+}
+\endverbatim
+ *
+ * Any event handler can be used to deliver these events to a room
+ * directory (e.g., via one of the broker based event handlers, like
+ * MQTT or RabbitMQ), which can then look up which node hosts the room
+ * or feed, and trigger the cascading accordingly (e.g., creating the
+ * room here and sending \c add_remote_node to the node hosting it),
+ * after which the user can simply retry the request. The plugin
+ * doesn't keep a directory itself, as how nodes are discovered and
+ * addressed (and who's allowed to trigger what) is deployment specific.
+ *
  * Everything else (subscribing to, and unsubscribing from, remote publishers)
  * works exactly the same way as shown in the previous sections. As far as
  * local attendees are concerned, a remote publisher is advertised and looks
@@ -1608,6 +1836,8 @@ room-<unique room ID>: {
 	"mcast" : "<multicast group port for receiving RTP packets, if any>",
 	"iface" : "<network interface or IP address to bind to, if any (binds to all otherwise)>",
 	"port" : <local port for receiving all RTP packets; 0 will bind to a random one (default)>,
+	"node" : "<ID of the source node, when the publisher is cascaded as part of a whole room (see add_remote_node); optional>",
+	"slot" : <slot of the publisher on the source node, mandatory if node is set>,
 	"srtp_suite" : <length of authentication tag (32 or 80); optional>,
 	"srtp_crypto" : "<key to use as crypto (base64 encoded key as in SDES); optional>",
 	"streams" : [
@@ -1647,6 +1877,14 @@ room-<unique room ID>: {
 	"rtcp_port" : <port to latch to in order to receive RTCP feedback from this remote publisher>
 }
 \endverbatim
+ *
+ * When a \c node is provided, all the remote publishers with the same
+ * \c node in the room share the same ports and the same receiving thread:
+ * the first remote publisher for a node allocates them (\c port can be
+ * used to pick it), while all the others will be given the same \c ip ,
+ * \c port and \c rtcp_port in the response. Packets are demultiplexed
+ * using the \c slot the source instance assigned to the publisher, which
+ * is encoded in the SSRCs (see \c add_remote_node below).
  *
  * To update a previously created remote publisher, the \c update_remote_publisher
  * request is used, which must be formatted like the following:
@@ -1803,11 +2041,121 @@ room-<unique room ID>: {
 		// Other remotizations, if any
 	]
 }
+\endverbatim
+ *
+ * Remotizing publishers one by one can be expensive when a whole room
+ * needs to be cascaded to another instance, since each remotization
+ * needs its own ports and threads on both sides. As an alternative, you
+ * can cascade a whole room to a remote node using \c add_remote_node on
+ * the source instance: all local publishers, current and future, will
+ * automatically be remotized to the same address, each one in its own
+ * \c slot (SSRCs are computed as <code>1000 + slot*1000 + mindex*10</code>,
+ * plus the substream in case of simulcast), which means a single port
+ * pair and a single thread can be used for all of them on the target
+ * instance. Notice that the RTCP channel between nodes is only used for
+ * keyframe requests (PLIs): NACKs and retransmissions are not supported,
+ * which means packets lost between the source and the target node will
+ * not be recovered. The request must be formatted as follows:
+ *
+\verbatim
+{
+	"request" : "add_remote_node",
+	"room" : <unique ID of the room to cascade>,
+	"secret" : "<password required to edit the room, mandatory if configured in the room>",
+	"node_id" : "<unique ID of the remote node>",
+	"host" : "<host address to forward all the RTP packets to>",
+	"host_family" : "<ipv4|ipv6, if we need to resolve the host address to an IP; by default, whatever we get>",
+	"port" : <port to forward all the RTP packets to>,
+	"rtcp_port" : <port to contact to receive RTCP feedback from the remote node; optional, and only for video streams>,
+	"srtp_suite" : <length of authentication tag (32 or 80); optional>,
+	"srtp_crypto" : "<key to use as crypto (base64 encoded key as in SDES); optional>"
+}
+\endverbatim
+ *
+ * A successful request will result in a \c success response:
+ *
+\verbatim
+{
+	"videoroom" : "success",
+	"room" : <same as request>,
+	"node_id" : "<same as request>"
+}
+\endverbatim
+ *
+ * Every time a publisher is cascaded to a node, a \c cascaded event
+ * is sent to event handlers, containing the \c room , the publisher
+ * \c id , the \c node_id and the \c slot that was assigned to it:
+ * it's up to you to create the related remote publisher on the target
+ * instance, using \c add_remote_publisher with the same \c node and
+ * \c slot . Publishers leaving the room are not cascaded anymore, and
+ * as for regular remotizations, it's up to you to remove them on the
+ * target instance. To stop cascading a room to a node, the
+ * \c remove_remote_node request is used:
+ *
+\verbatim
+{
+	"request" : "remove_remote_node",
+	"room" : <unique ID of the room>,
+	"secret" : "<password required to edit the room, mandatory if configured in the room>",
+	"node_id" : "<unique ID of the remote node>"
+}
+\endverbatim
+ *
+ * A successful request will result in a \c success response:
+ *
+\verbatim
+{
+	"videoroom" : "success",
+	"room" : <same as request>,
+	"node_id" : "<same as request>"
+}
+\endverbatim
+ *
+ * The nodes a room is cascaded to, and the slots assigned to each
+ * publisher, can be retrieved with \c list_remote_nodes :
+ *
+\verbatim
+{
+	"request" : "list_remote_nodes",
+	"room" : <unique ID of the room>,
+	"secret" : "<password required to edit the room, mandatory if configured in the room>"
+}
+\endverbatim
+ *
+ * A successful request will result in a \c success response:
+ *
+\verbatim
+{
+	"videoroom" : "success",
+	"room" : <same as request>,
+	"list" : [
+		{
+			"node_id" : "<unique ID of the remote node>",
+			"host" : "<address all RTP packets are being sent to>",
+			"port" : <port all RTP packets are being sent to>,
+			"rtcp_port" : <RTCP port, if enabled>,
+			"publishers" : [
+				{
+					"id" : <unique ID of the local publisher>,
+					"slot" : <slot assigned to the publisher on this node>
+				},
+				// Other publishers, if any
+			]
+		},
+		// Other nodes, if any
+	]
+}
 \endverbatim
  *
  *
  */
 
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		/* Needed for CPU affinity */
+#endif
+#endif
+
 #include "plugin.h"
 
 #include <jansson.h>
@@ -1825,9 +2173,14 @@ room-<unique room ID>: {
 #include "../sdp-utils.h"
 #include "../utils.h"
 #include "../ip-utils.h"
+#include "../sched-profile.h"
+#include "../usage.h"
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <poll.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
 
 
 /* Plugin information */
@@ -1861,6 +2214,7 @@ void janus_videoroom_slow_link(janus_plugin_session *handle, int mindex, gboolea
 void janus_videoroom_hangup_media(janus_plugin_session *handle);
 void janus_videoroom_destroy_session(janus_plugin_session *handle, int *error);
 json_t *janus_videoroom_query_session(janus_plugin_session *handle);
+void janus_videoroom_drain(gboolean draining);
 
 /* Plugin setup */
 static janus_plugin janus_videoroom_plugin =
@@ -1888,6 +2242,7 @@ static janus_plugin janus_videoroom_plugin =
 		.hangup_media = janus_videoroom_hangup_media,
 		.destroy_session = janus_videoroom_destroy_session,
 		.query_session = janus_videoroom_query_session,
+		.drain = janus_videoroom_drain,
 	);
 
 /* Plugin creator */
@@ -1921,6 +2276,7 @@ static struct janus_json_parameter create_parameters[] = {
 	{"h264_profile", JSON_STRING, 0},
 	{"opus_fec", JANUS_JSON_BOOL, 0},
 	{"opus_dtx", JANUS_JSON_BOOL, 0},
+	{"opus_red", JANUS_JSON_BOOL, 0},
 	{"audiolevel_ext", JANUS_JSON_BOOL, 0},
 	{"audiolevel_event", JANUS_JSON_BOOL, 0},
 	{"audio_active_packets", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
@@ -1928,8 +2284,14 @@ static struct janus_json_parameter create_parameters[] = {
 	{"videoorient_ext", JANUS_JSON_BOOL, 0},
 	{"playoutdelay_ext", JANUS_JSON_BOOL, 0},
 	{"transport_wide_cc_ext", JANUS_JSON_BOOL, 0},
+	{"bwe", JANUS_JSON_BOOL, 0},
+	{"active_speakers", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"audio_last_n", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"keyframe_cache", JANUS_JSON_BOOL, 0},
 	{"record", JANUS_JSON_BOOL, 0},
 	{"rec_dir", JSON_STRING, 0},
+	{"rec_substream", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"rec_temporal", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"lock_record", JANUS_JSON_BOOL, 0},
 	{"permanent", JANUS_JSON_BOOL, 0},
 	{"notify_joining", JANUS_JSON_BOOL, 0},
@@ -1964,6 +2326,9 @@ static struct janus_json_parameter roomstr_parameters[] = {
 static struct janus_json_parameter roomstropt_parameters[] = {
 	{"room", JSON_STRING, 0}
 };
+static struct janus_json_parameter usage_parameters[] = {
+	{"reset", JANUS_JSON_BOOL, 0}
+};
 static struct janus_json_parameter id_parameters[] = {
 	{"id", JSON_INTEGER, JANUS_JSON_PARAM_REQUIRED | JANUS_JSON_PARAM_POSITIVE}
 };
@@ -2028,6 +2393,8 @@ static struct janus_json_parameter publish_parameters[] = {
 	{"keyframe", JANUS_JSON_BOOL, 0},
 	{"record", JANUS_JSON_BOOL, 0},
 	{"filename", JSON_STRING, 0},
+	{"rec_substream", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"rec_temporal", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"display", JSON_STRING, 0},
 	{"metadata", JSON_OBJECT, 0},
 	{"secret", JSON_STRING, 0},
@@ -2135,6 +2502,9 @@ static struct janus_json_parameter configure_parameters[] = {
 	{"video", JANUS_JSON_BOOL, 0},	/* Deprecated */
 	{"data", JANUS_JSON_BOOL, 0}	/* Deprecated */
 };
+static struct janus_json_parameter suspend_parameters[] = {
+	{"mids", JANUS_JSON_ARRAY, 0}
+};
 static struct janus_json_parameter subscriber_parameters[] = {
 	{"streams", JANUS_JSON_ARRAY, 0},
 	{"private_id", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
@@ -2217,8 +2587,24 @@ static struct janus_json_parameter remote_publisher_parameters[] = {
 	{"streams", JANUS_JSON_ARRAY, JANUS_JSON_PARAM_REQUIRED},
 	{"metadata", JSON_OBJECT, 0},
 	{"srtp_suite", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"srtp_crypto", JSON_STRING, 0},
+	{"node", JANUS_JSON_STRING, 0},
+	{"slot", JANUS_JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE}
+};
+static struct janus_json_parameter remote_node_parameters[] = {
+	{"secret", JSON_STRING, 0},
+	{"node_id", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
+	{"host", JSON_STRING, JANUS_JSON_PARAM_REQUIRED},
+	{"host_family", JSON_STRING, 0},
+	{"port", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE | JANUS_JSON_PARAM_REQUIRED},
+	{"rtcp_port", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
+	{"srtp_suite", JSON_INTEGER, JANUS_JSON_PARAM_POSITIVE},
 	{"srtp_crypto", JSON_STRING, 0}
 };
+static struct janus_json_parameter remove_remote_node_parameters[] = {
+	{"secret", JSON_STRING, 0},
+	{"node_id", JSON_STRING, JANUS_JSON_PARAM_REQUIRED}
+};
 static struct janus_json_parameter remote_publisher_update_parameters[] = {
 	{"secret", JSON_STRING, 0},
 	{"display", JANUS_JSON_STRING, 0},
@@ -2250,17 +2636,48 @@ static struct janus_json_parameter remote_publisher_stream_parameters[] = {
 static janus_config *config = NULL;
 static const char *config_folder = NULL;
 static janus_mutex config_mutex = JANUS_MUTEX_INITIALIZER;
+static janus_config_journal *config_journal = NULL;
 
 /* Useful stuff */
 static volatile gint initialized = 0, stopping = 0;
 static gboolean notify_events = TRUE;
+static gboolean directory_events = FALSE;
 static gboolean string_ids = FALSE;
 static gboolean ipv6_disabled = FALSE;
+static gboolean pin_helper_threads = FALSE;
+static volatile gint helper_threads_cpu = 0;
 static janus_callbacks *gateway = NULL;
-static GThread *handler_thread;
 static void *janus_videoroom_handler(void *data);
+/* Subscriber renegotiations can be delayed, so that multiple changes are coalesced in a single offer */
+static int renegotiation_delay = 0;
+static GAsyncQueue *pending_updates = NULL;
+static GThread *updates_thread = NULL;
+static void *janus_videoroom_updates_thread(void *data);
+/* Events about new or updated publishers can be delayed too, and sent in batches */
+static int publisher_events_delay = 0;
+static GAsyncQueue *pending_events = NULL;
+static GThread *events_thread = NULL;
+static void *janus_videoroom_events_thread(void *data);
+typedef struct janus_videoroom_pending_events {
+	struct janus_videoroom *room;
+	gint64 due;
+} janus_videoroom_pending_events;
+static janus_videoroom_pending_events exit_events;
+/* Small text messages publishers send on data channels can be coalesced
+ * too, and relayed to subscribers as a single (newline separated) message */
+static int data_coalesce = 0;
+static GAsyncQueue *pending_data = NULL;
+static GThread *data_thread = NULL;
+static void *janus_videoroom_data_thread(void *data);
+typedef struct janus_videoroom_pending_data {
+	struct janus_videoroom *room;
+	struct janus_videoroom_publisher_stream *ps;
+	gint64 due;
+} janus_videoroom_pending_data;
+static janus_videoroom_pending_data exit_data;
+#define JANUS_VIDEOROOM_DATA_COALESCE_MAX	1024	/* Larger messages are never coalesced */
+#define JANUS_VIDEOROOM_DATA_COALESCE_SIZE	16384	/* Maximum size of a coalesced message */
 static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data);
-static void janus_videoroom_relay_data_packet(gpointer data, gpointer user_data);
 static void janus_videoroom_hangup_media_internal(gpointer session_data);
 
 typedef enum janus_videoroom_p_type {
@@ -2309,13 +2726,53 @@ static janus_videoroom_media janus_videoroom_media_from_str(const char *type) {
 	return JANUS_VIDEOROOM_MEDIA_NONE;
 }
 
+/* Asynchronous requests are handled by a pool of threads, each with its own
+ * queue: we keep some histograms to figure out whether they're keeping up */
+#define JANUS_VIDEOROOM_HISTOGRAM_BUCKETS	8
+static const int janus_videoroom_depth_buckets[JANUS_VIDEOROOM_HISTOGRAM_BUCKETS-1] = { 0, 1, 5, 10, 50, 100, 500 };
+static const int janus_videoroom_latency_buckets[JANUS_VIDEOROOM_HISTOGRAM_BUCKETS-1] = { 1, 5, 10, 50, 100, 500, 1000 };
+static int janus_videoroom_histogram_bucket(const int *buckets, gint64 value) {
+	int i = 0;
+	for(i=0; i<JANUS_VIDEOROOM_HISTOGRAM_BUCKETS-1; i++) {
+		if(value <= buckets[i])
+			return i;
+	}
+	return JANUS_VIDEOROOM_HISTOGRAM_BUCKETS-1;
+}
+static json_t *janus_videoroom_histogram_json(const int *buckets, volatile gint *counters) {
+	json_t *histogram = json_object();
+	char name[20];
+	int i = 0;
+	for(i=0; i<JANUS_VIDEOROOM_HISTOGRAM_BUCKETS; i++) {
+		if(i < JANUS_VIDEOROOM_HISTOGRAM_BUCKETS-1)
+			g_snprintf(name, sizeof(name), "%d", buckets[i]);
+		else
+			g_snprintf(name, sizeof(name), ">%d", buckets[i-1]);
+		json_object_set_new(histogram, name, json_integer(g_atomic_int_get(&counters[i])));
+	}
+	return histogram;
+}
+
+typedef struct janus_videoroom_worker {
+	guint id;
+	GThread *thread;
+	GAsyncQueue *messages;
+	volatile gint processed;
+	volatile gint depth[JANUS_VIDEOROOM_HISTOGRAM_BUCKETS];
+	volatile gint wait[JANUS_VIDEOROOM_HISTOGRAM_BUCKETS];
+	volatile gint latency[JANUS_VIDEOROOM_HISTOGRAM_BUCKETS];
+} janus_videoroom_worker;
+static int handler_threads = 1;
+static janus_videoroom_worker *workers = NULL;
+
 typedef struct janus_videoroom_message {
 	janus_plugin_session *handle;
 	char *transaction;
 	json_t *message;
 	json_t *jsep;
+	janus_videoroom_worker *worker;
+	gint64 queued, popped;
 } janus_videoroom_message;
-static GAsyncQueue *messages = NULL;
 static janus_videoroom_message exit_message;
 
 
@@ -2340,6 +2797,7 @@ typedef struct janus_videoroom {
 	char *h264_profile;			/* H.264 codec profile to prefer, if more are negotiated */
 	gboolean do_opusfec;		/* Whether inband FEC must be negotiated (note: only available for Opus) */
 	gboolean do_opusdtx;		/* Whether DTX must be negotiated (note: only available for Opus) */
+	gboolean do_opusred;		/* Whether RED must be negotiated with publishers (note: only available for Opus) */
 	gboolean audiolevel_ext;	/* Whether the ssrc-audio-level extension must be negotiated or not for new publishers */
 	gboolean audiolevel_event;	/* Whether to emit event to other users about audiolevel */
 	int audio_active_packets;	/* Amount of packets with audio level for checkup */
@@ -2347,8 +2805,14 @@ typedef struct janus_videoroom {
 	gboolean videoorient_ext;	/* Whether the video-orientation extension must be negotiated or not for new publishers */
 	gboolean playoutdelay_ext;	/* Whether the playout-delay extension must be negotiated or not for new publishers */
 	gboolean transport_wide_cc_ext;	/* Whether the transport wide cc extension must be negotiated or not for new publishers */
+	gboolean bwe;				/* Whether the bandwidth estimated towards subscribers should cap the substreams/layers they get */
+	int active_speakers;		/* How many of the loudest publishers should be relayed at the highest substream/layer (0=disabled) */
+	int audio_last_n;			/* How many of the last speakers should have their audio relayed to subscribers (0=disabled) */
+	gboolean keyframe_cache;	/* Whether the latest keyframe of each video stream should be replayed to new subscribers */
 	gboolean record;			/* Whether the feeds from publishers in this room should be recorded */
 	char *rec_dir;				/* Where to save the recordings of this room, if enabled */
+	int rec_substream;			/* Simulcast substream (or SVC spatial layer) to record, if there's more than one */
+	int rec_temporal;			/* Simulcast or SVC temporal layer to record, if there's more than one */
 	gboolean lock_record;		/* Whether recording state can only be changed providing the room secret */
 	GHashTable *participants;	/* Map of potential publishers (we get subscribers from them) */
 	GHashTable *private_ids;	/* Map of existing private IDs */
@@ -2358,11 +2822,19 @@ typedef struct janus_videoroom {
 	gboolean notify_joining;	/* Whether an event is sent to notify all participants if a new participant joins the room */
 	int helper_threads;			/* Number of helper threads for relaying purposes */
 	GList *threads;				/* List of helper threads, if any */
+	GHashTable *remote_nodes;	/* Remote nodes all local publishers in this room are cascaded to, if any */
+	GHashTable *node_listeners;	/* Shared listeners for publishers cascaded to this room from remote nodes, if any */
+	GHashTable *pending_publishers;	/* Publisher events we're waiting to send, when batching them */
+	gboolean events_scheduled;	/* Whether a batch of publisher events has been scheduled already */
+	janus_usage usage;			/* Resources (bandwidth, CPU) this room consumed so far */
+	struct janus_videoroom_speaker *speakers;	/* Buffer for the snapshots of the audio levels, when ranking speakers */
+	guint speakers_size;		/* How many publishers the speakers buffer can contain */
+	janus_mutex speakers_mutex;	/* Mutex to serialize the updates to the active speakers/last-N ranking */
 	janus_mutex mutex;			/* Mutex to lock this room instance */
 	janus_refcount ref;			/* Reference counter for this room */
 } janus_videoroom;
 static GHashTable *rooms;
-static janus_mutex rooms_mutex = JANUS_MUTEX_INITIALIZER;
+static janus_rwlock rooms_rwlock = JANUS_RWLOCK_INITIALIZER;
 static char *admin_key = NULL;
 static gboolean lock_rtpfwd = FALSE;
 
@@ -2376,9 +2848,11 @@ typedef struct janus_videoroom_session {
 	volatile gint dataready;
 	volatile gint hangingup;
 	volatile gint destroyed;
+	janus_videoroom_worker *worker;	/* Handler thread the asynchronous requests of this session go to */
 	janus_mutex mutex;
 	janus_refcount ref;
 } janus_videoroom_session;
+static janus_videoroom_worker *janus_videoroom_session_get_worker(janus_videoroom_session *session, json_t *root);
 static GHashTable *sessions;
 static janus_mutex sessions_mutex = JANUS_MUTEX_INITIALIZER;
 
@@ -2389,6 +2863,7 @@ typedef struct janus_videoroom_helper {
 	struct janus_videoroom *room;
 	guint id;
 	GThread *thread;
+	int cpu;
 	int num_subscribers;
 	GHashTable *subscribers;
 	GAsyncQueue *queued_packets;
@@ -2410,6 +2885,7 @@ static void janus_videoroom_helper_free(const janus_refcount *helper_ref) {
 }
 static void *janus_videoroom_helper_thread(void *data);
 static void janus_videoroom_helper_rtpdata_packet(gpointer data, gpointer user_data);
+static void janus_videoroom_helpers_spawn(struct janus_videoroom *room, int num);
 
 typedef struct janus_videoroom_publisher {
 	janus_videoroom_session *session;
@@ -2426,6 +2902,12 @@ typedef struct janus_videoroom_publisher {
 	int user_audio_active_packets;	/* Participant's audio_active_packets overwriting global room setting */
 	int user_audio_level_average;	/* Participant's audio_level_average overwriting global room setting */
 	gboolean talking; 	/* Whether this participant is currently talking (uses audio levels extension) */
+	/* Audio activity, in case the room relays the video of the loudest publishers at a higher quality */
+	float speaker_loudness;			/* How loud the publisher was last time (127-dBov, 0 if not talking) */
+	gint64 speaker_last;			/* When this publisher was last detected as talking */
+	volatile gint speaker_active;	/* Whether this publisher is currently one of the active speakers */
+	volatile gint audio_dropped;	/* Whether the audio of this publisher is not relayed, as it's not one of the last N speakers */
+	volatile gint audio_epoch;		/* Incremented any time we start relaying the audio of this publisher again */
 	gboolean firefox;	/* We send Firefox users a different kind of FIR */
 	GList *streams;				/* List of media streams sent by this publisher (audio, video and/or data) */
 	GHashTable *streams_byid;	/* As above, indexed by mindex */
@@ -2437,6 +2919,7 @@ typedef struct janus_videoroom_publisher {
 	gint64 remb_latest;	/* Time of latest sent REMB (to avoid flooding) */
 	gboolean recording_active;	/* Whether this publisher has to be recorded or not */
 	gchar *recording_base;	/* Base name for the recording (e.g., /path/to/filename, will generate /path/to/filename-audio.mjr and/or /path/to/filename-video.mjr) */
+	int rec_substream, rec_temporal;	/* Layers to record, if simulcasting or doing SVC (-1 means the room value) */
 	janus_mutex rec_mutex;	/* Mutex to protect the recorders from race conditions */
 	GSList *subscriptions;	/* Subscriptions this publisher has created (who this publisher is watching) */
 	janus_mutex subscribers_mutex;
@@ -2446,6 +2929,9 @@ typedef struct janus_videoroom_publisher {
 	/* In case this is a remote publisher */
 	gboolean remote;			/* Whether this is a remote publisher */
 	uint32_t remote_ssrc_offset;	/* SSRC offset to apply to the incoming RTP traffic */
+	uint32_t remote_ssrc_base;		/* Base of the SSRCs the remote publisher sends (depends on the slot, when cascaded) */
+	struct janus_videoroom_node_listener *remote_node;	/* Listener shared with other remote publishers from the same node, if any */
+	guint remote_slot;			/* Slot of this remote publisher on the shared listener, if any */
 	int remote_fd, remote_rtcp_fd, pipefd[2];	/* Remote publisher sockets */
 	struct sockaddr_storage rtcp_addr;	/* RTCP address of the remote publisher */
 	GThread *remote_thread;		/* Remote publisher incoming packets thread */
@@ -2462,6 +2948,18 @@ typedef struct janus_videoroom_publisher {
 	janus_refcount ref;
 } janus_videoroom_publisher;
 /* Each VideoRoom publisher can share multiple streams, so each stream is its own structure */
+/* Cache of the latest keyframe of a video stream (or substream), and the packets
+ * that followed it, that we can replay to new subscribers: to keep memory usage
+ * under control, if the GOP gets too long we only keep the keyframe itself */
+#define JANUS_VIDEOROOM_KEYFRAME_CACHE_MAX	300
+typedef struct janus_videoroom_keyframe_cache {
+	GQueue *packets;			/* Cached packets, as janus_videoroom_rtp_relay_packet copies */
+	guint32 keyframe_ts;		/* RTP timestamp of the keyframe */
+	guint keyframe_packets;		/* How many of the cached packets belong to the keyframe itself */
+	gboolean truncated;			/* Whether we stopped caching the GOP as it was too long */
+	gint64 last_added;			/* When we last added a packet (to detect gaps) */
+} janus_videoroom_keyframe_cache;
+
 typedef struct janus_videoroom_publisher_stream {
 	janus_videoroom_publisher *publisher;	/* Publisher instance this stream belongs to */
 	janus_videoroom_media type;				/* Type of this stream (audio, video or data) */
@@ -2482,6 +2980,7 @@ typedef struct janus_videoroom_publisher_stream {
 	gboolean opusfec;						/* Whether this stream is sending inband Opus FEC */
 	gboolean opusdtx;						/* Whether this publisher is using Opus DTX (Discontinuous Transmission) */
 	gboolean opusstereo;					/* Whether this publisher is doing stereo Opus */
+	int opusred_pt;							/* Payload type of RED, if this publisher is sending redundant Opus */
 	gboolean simulcast, svc;				/* Whether this stream uses simulcast or SVC */
 	uint32_t vssrc[3];						/* Only needed in case simulcasting is involved */
 	char *rid[3];							/* Only needed if simulcasting is rid-based */
@@ -2503,6 +3002,7 @@ typedef struct janus_videoroom_publisher_stream {
 	janus_recorder *rc;
 	janus_rtp_switching_context rec_ctx;
 	janus_rtp_simulcasting_context rec_simctx;
+	janus_rtp_svc_context rec_svcctx;
 	/* RTP (or data) forwarders for this stream, if any */
 	GHashTable *rtp_forwarders;
 	janus_mutex rtp_forwarders_mutex;
@@ -2510,6 +3010,15 @@ typedef struct janus_videoroom_publisher_stream {
 	volatile gint need_pli;		/* Whether we need to send a PLI later */
 	volatile gint sending_pli;	/* Whether we're currently sending a PLI */
 	gint64 pli_latest;			/* Time of latest sent PLI (to avoid flooding) */
+	/* Bitrate of each substream (simulcast) or spatial layer (VP9-SVC), if bandwidth estimation is enabled */
+	guint32 layer_bytes[3];
+	volatile gint layer_bitrate[3];
+	gint64 layer_bitrate_ts;
+	/* Latest keyframe of each substream, if the room caches them for new subscribers */
+	janus_videoroom_keyframe_cache keyframe_cache[3];
+	janus_mutex keyframe_mutex;
+	/* AV1 SVC: the Dependency Descriptor is parsed once here, rather than by each subscriber */
+	janus_av1_svc_context dd_context;
 	/* Only needed for SRTP support for remote publisher */
 	gboolean is_srtp;
 	int srtp_suite;
@@ -2518,10 +3027,25 @@ typedef struct janus_videoroom_publisher_stream {
 	srtp_policy_t srtp_policy;
 	/* Subscriptions to this publisher stream (who's receiving it)  */
 	GSList *subscribers;
+	/* Compact array of the subscriptions we can actually relay RTP packets to, which is
+	 * rebuilt from the list above when something changes (protected by subscribers_mutex) */
+	struct janus_videoroom_subscriber_stream **relay_targets;
+	guint relay_targets_num, relay_targets_size;
+	gint relay_targets_generation;
+	gint64 relay_targets_built;
+	/* Text messages waiting to be relayed as a single one, if data_coalesce
+	 * is set, and whether a flush is scheduled (protected by subscribers_mutex) */
+	GString *data_pending;
+	gboolean data_scheduled;
 	janus_mutex subscribers_mutex;
 	volatile gint destroyed;
 	janus_refcount ref;
 } janus_videoroom_publisher_stream;
+/* Helpers to keep the array of subscriptions we relay RTP packets to up to date */
+static void janus_videoroom_relay_targets_changed(void);
+static void janus_videoroom_update_active_speakers(janus_videoroom *videoroom,
+	janus_videoroom_publisher *participant, gboolean talking, float level);
+static void janus_videoroom_publisher_stream_update_relay_targets(janus_videoroom_publisher_stream *ps);
 /* Helper to add a new RTP forwarder for a specific stream sent by publisher */
 static janus_rtp_forwarder *janus_videoroom_rtp_forwarder_add_helper(janus_videoroom_publisher *p,
 	janus_videoroom_publisher_stream *ps,
@@ -2542,12 +3066,20 @@ static uint16_t rtp_range_slider = DEFAULT_RTP_RANGE_MIN;
 static janus_mutex fd_mutex = JANUS_MUTEX_INITIALIZER;
 #define REMOTE_PUBLISHER_BASE_SSRC	1000
 #define REMOTE_PUBLISHER_SSRC_STEP	10
+/* When a whole room is cascaded to a remote node, all its publishers share
+ * the same port, and each of them gets a different slot in the SSRC space */
+#define REMOTE_NODE_SLOT_STEP		1000
+#define REMOTE_NODE_MAX_STREAMS		(REMOTE_NODE_SLOT_STEP/REMOTE_PUBLISHER_SSRC_STEP)
+#define REMOTE_NODE_RECV_BATCH		32
 /* Helpers to create a listener filedescriptor */
 static int janus_videoroom_create_fd(int port, in_addr_t mcast, const janus_network_address *iface, char *host, size_t hostlen);
 /* Helper to return fd port */
 static int janus_videoroom_get_fd_port(int fd);
 /* Thread responsible for a specific remote publisher */
 static void *janus_videoroom_remote_publisher_thread(void *data);
+/* Threads responsible for cascading to (and from) remote nodes */
+static void *janus_videoroom_remote_node_thread(void *data);
+static void *janus_videoroom_node_listener_thread(void *data);
 
 typedef struct janus_videoroom_subscriber {
 	janus_videoroom_session *session;
@@ -2564,7 +3096,9 @@ typedef struct janus_videoroom_subscriber {
 	gboolean paused;
 	gboolean kicked;	/* Whether this subscription belongs to a participant that has been kicked */
 	gboolean e2ee;		/* If media for this subscriber is end-to-end encrypted */
+	volatile gint bwe_streams;	/* How many simulcast/SVC streams are sharing the estimated bandwidth */
 	volatile gint answered, pending_offer, pending_restart, skipped_autoupdate;
+	volatile gint update_scheduled;	/* Whether there's a delayed renegotiation scheduled for this subscriber */
 	volatile gint destroyed;
 	janus_refcount ref;
 } janus_videoroom_subscriber;
@@ -2578,6 +3112,7 @@ typedef struct janus_videoroom_subscriber_stream {
 	char *msid, *mstid;		/* In case msid must be used, the values to use in the SDP */
 	char *crossrefid;		/* An id provided while subscribing to uniquely identify the subscription in the list of subscriptions */
 	gboolean send;			/* Whether this stream media must be sent to this subscriber */
+	volatile gint suspended;	/* Whether relaying has been temporarily suspended (e.g., stream not rendered) */
 	/* The following properties are copied from the source, in case this stream becomes inactive */
 	janus_videoroom_media type;			/* Type of this stream (audio, video or data) */
 	janus_audiocodec acodec;			/* Audio codec this publisher is using (if audio) */
@@ -2586,14 +3121,24 @@ typedef struct janus_videoroom_subscriber_stream {
 	char *vp9_profile;					/* VP9 profile this publisher is using (if video and VP9 codec) */
 	int pt;								/* Payload type of this stream (if audio or video) */
 	gboolean opusfec;					/* Whether this stream is using inband Opus FEC */
+	int opusred_pt;						/* Payload type of RED, if negotiated by this subscriber too */
 	/* RTP and simulcasting contexts */
 	janus_rtp_switching_context context;
 	janus_rtp_simulcasting_context sim_context;
 	janus_vp8_simulcast_context vp8_context;
 	/* SVC context */
 	janus_rtp_svc_context svc_context;
+	/* Bandwidth estimation checks, if enabled */
+	gint64 bwe_checked, bwe_downgraded;
+	gboolean bwe_counted;
+	/* Caps on the substream/layer we relay, as decided by bandwidth estimation and active speakers (-1=none) */
+	int bwe_cap, speaker_cap;
+	/* Last audio epoch of the publisher we relayed, in case the room only relays the last N speakers */
+	gint audio_epoch;
 	/* Playout delays to enforce when relaying this stream, if the extension has been negotiated */
 	int16_t min_delay, max_delay;
+	/* Whether we should replay the cached keyframe of the publisher before relaying live packets */
+	volatile gint keyframe_replay;
 	volatile gint ready, destroyed;
 	janus_refcount ref;
 } janus_videoroom_subscriber_stream;
@@ -2616,21 +3161,86 @@ typedef struct janus_videoroom_rtp_relay_packet {
 	uint16_t seq_number;
 	/* Extensions to add, if any */
 	janus_plugin_rtp_extensions extensions;
-	/* Whether simulcast is involved */
+	/* Whether simulcast is involved, and if so what the publisher side classification of the packet was */
 	gboolean simulcast;
+	janus_rtp_simulcasting_packet sim_info;
 	/* The following are only relevant if we're doing SVC*/
 	gboolean svc;
 	janus_vp9_svc_info svc_info;
 	/* The following is only relevant for datachannels */
 	gboolean textdata;
+	/* In case this is a RED packet, a copy of it with the primary block only,
+	 * for subscribers that didn't negotiate RED (NULL if there's no primary) */
+	gboolean red;
+	janus_rtp_header *primary;
+	gint primary_length;
 } janus_videoroom_rtp_relay_packet;
 static janus_videoroom_rtp_relay_packet exit_packet;
 static void janus_videoroom_rtp_relay_packet_free(janus_videoroom_rtp_relay_packet *pkt) {
 	if(pkt == NULL || pkt == &exit_packet)
 		return;
 	g_free(pkt->data);
+	g_free(pkt->primary);
 	g_free(pkt);
 }
+static void janus_videoroom_keyframe_cache_add(janus_videoroom_publisher_stream *ps, int sc,
+	janus_videoroom_rtp_relay_packet *packet);
+
+/* When fanning out a packet to many subscribers, we don't hand it to the core
+ * once per subscriber, but collect them in a batch we relay all at once: since
+ * the publisher buffer is shared, we take note of the header we rewrote for each */
+#define JANUS_VIDEOROOM_RELAY_BATCH	32
+typedef struct janus_videoroom_relay_batch {
+	guint count;
+	janus_plugin_session *handles[JANUS_VIDEOROOM_RELAY_BATCH];
+	janus_plugin_rtp packets[JANUS_VIDEOROOM_RELAY_BATCH];
+	janus_rtp_header headers[JANUS_VIDEOROOM_RELAY_BATCH];
+	janus_usage *usage;		/* Where to account the packets we relay, if anywhere */
+} janus_videoroom_relay_batch;
+static void janus_videoroom_relay_batch_flush(janus_videoroom_relay_batch *batch) {
+	if(batch == NULL || batch->count == 0)
+		return;
+	if(gateway != NULL)
+		gateway->relay_rtp_batch(batch->handles, batch->packets, batch->count);
+	if(batch->usage != NULL) {
+		/* All of these go to PeerConnections, so the core will encrypt them */
+		gsize bytes = 0;
+		guint i = 0;
+		for(i=0; i<batch->count; i++)
+			bytes += batch->packets[i].length;
+		janus_usage_packets_out(batch->usage, batch->count, bytes, TRUE);
+	}
+	batch->count = 0;
+}
+static void janus_videoroom_relay_batch_add(janus_videoroom_relay_batch *batch, janus_plugin_session *handle, janus_plugin_rtp *rtp) {
+	if(batch == NULL) {
+		/* No batch, relay right away */
+		gateway->relay_rtp(handle, rtp);
+		return;
+	}
+	guint i = batch->count;
+	batch->handles[i] = handle;
+	batch->packets[i] = *rtp;
+	memcpy(&batch->headers[i], rtp->buffer, sizeof(janus_rtp_header));
+	batch->packets[i].header = (char *)&batch->headers[i];
+	batch->count++;
+	if(batch->count == JANUS_VIDEOROOM_RELAY_BATCH)
+		janus_videoroom_relay_batch_flush(batch);
+}
+static void janus_videoroom_relay_rtp_packet_batch(janus_videoroom_subscriber_stream *stream,
+	janus_videoroom_rtp_relay_packet *packet, janus_videoroom_relay_batch *batch);
+/* Data channel messages are fanned out in a similar way: we collect all the
+ * subscribers that should get a message, and then hand it to the core once,
+ * so that it's copied only once rather than for each of them */
+typedef struct janus_videoroom_data_fanout {
+	janus_videoroom_rtp_relay_packet *packet;
+	GPtrArray *handles;
+	janus_usage *usage;		/* Where to account the messages we relay, if anywhere */
+} janus_videoroom_data_fanout;
+static void janus_videoroom_relay_data_collect(gpointer data, gpointer user_data);
+static void janus_videoroom_relay_data_fanout_send(janus_videoroom_data_fanout *fanout);
+static void janus_videoroom_subscriber_stream_request_keyframe(janus_videoroom_subscriber_stream *stream,
+	janus_videoroom_publisher_stream *ps, const char *reason);
 
 /* VideoRoom publishers can be forwarder remotely: we use the following
  * struct to track specific recipients of a local publisher */
@@ -2640,6 +3250,7 @@ typedef struct janus_videoroom_remote_recipient {
 	uint16_t port;			/* Port this publisher is being relayed to */
 	uint16_t rtcp_port;		/* RTCP port this publisher is going to latch to */
 	gboolean rtcp_added;	/* Whether we created an RTCP socket for this remotization */
+	uint32_t ssrc_base;		/* Base of the SSRCs to use when forwarding (depends on the slot, when cascaded) */
 	/* Only needed for SRTP support for remote publisher */
 	int srtp_suite;
 	char *srtp_crypto;
@@ -2653,9 +3264,88 @@ static void janus_videoroom_remote_recipient_free(janus_videoroom_remote_recipie
 	}
 }
 
+/* Rooms can be cascaded to remote VideoRoom instances as a whole: on the
+ * source, a remote node automatically remotizes all the local publishers
+ * in the room to the same address, each with its own slot (and so its own
+ * range of SSRCs), which means one port is enough for all of them */
+typedef struct janus_videoroom_remote_node {
+	char *node_id;			/* ID of this remote node */
+	char *remote_id;		/* ID of the publisher remotizations associated to this node */
+	char *host;				/* Address the publishers are being relayed to */
+	uint16_t port;			/* Port the publishers are being relayed to */
+	uint16_t rtcp_port;		/* RTCP port on the remote node we latch to, to receive feedback */
+	/* Only needed for SRTP support for remote publishers */
+	int srtp_suite;
+	char *srtp_crypto;
+	guint next_slot;		/* Slot to assign to the next publisher */
+	GHashTable *publishers;	/* Local publishers cascaded to this node, indexed by slot */
+	int rtcp_fd;			/* Socket we receive RTCP feedback on, for all publishers */
+	struct sockaddr_storage rtcp_addr;	/* RTCP address of the remote node */
+	GThread *thread;		/* Thread receiving RTCP feedback from the node */
+	volatile gint destroyed;
+	janus_mutex mutex;
+	janus_refcount ref;
+} janus_videoroom_remote_node;
+static void janus_videoroom_remote_node_destroy(janus_videoroom_remote_node *node) {
+	if(node && g_atomic_int_compare_and_exchange(&node->destroyed, 0, 1))
+		janus_refcount_decrease(&node->ref);
+}
+static void janus_videoroom_remote_node_free(const janus_refcount *node_ref) {
+	janus_videoroom_remote_node *node = janus_refcount_containerof(node_ref, janus_videoroom_remote_node, ref);
+	g_free(node->node_id);
+	g_free(node->remote_id);
+	g_free(node->host);
+	g_free(node->srtp_crypto);
+	g_hash_table_destroy(node->publishers);
+	if(node->rtcp_fd > -1)
+		close(node->rtcp_fd);
+	janus_mutex_destroy(&node->mutex);
+	g_free(node);
+}
+
+/* On the target, remote publishers coming from the same node share a
+ * single listener (and so the same ports), and are demultiplexed by slot */
+typedef struct janus_videoroom_node_listener {
+	char *node_id;			/* ID of the node the remote publishers come from */
+	char *room_id_str;		/* ID of the room this listener belongs to (for logging) */
+	int fd, rtcp_fd;		/* Sockets shared by all the remote publishers */
+	uint16_t port, rtcp_port;
+	char host[46];
+	struct sockaddr_storage rtcp_addr;	/* RTCP address of the remote node (protected by mutex, as it's latched by the thread) */
+	GHashTable *publishers;	/* Remote publishers sharing this listener, indexed by slot */
+	GThread *thread;		/* Thread receiving media for all the remote publishers */
+	volatile gint destroyed;
+	janus_mutex mutex;
+	janus_refcount ref;
+} janus_videoroom_node_listener;
+static void janus_videoroom_node_listener_destroy(janus_videoroom_node_listener *listener) {
+	if(listener && g_atomic_int_compare_and_exchange(&listener->destroyed, 0, 1))
+		janus_refcount_decrease(&listener->ref);
+}
+static void janus_videoroom_node_listener_free(const janus_refcount *listener_ref) {
+	janus_videoroom_node_listener *listener = janus_refcount_containerof(listener_ref, janus_videoroom_node_listener, ref);
+	g_free(listener->node_id);
+	g_free(listener->room_id_str);
+	g_hash_table_destroy(listener->publishers);
+	if(listener->fd > -1)
+		close(listener->fd);
+	if(listener->rtcp_fd > -1)
+		close(listener->rtcp_fd);
+	janus_mutex_destroy(&listener->mutex);
+	g_free(listener);
+}
+/* Helpers to cascade publishers to (and from) remote nodes */
+static void janus_videoroom_remote_node_attach(janus_videoroom_remote_node *node, janus_videoroom_publisher *p);
+static void janus_videoroom_remote_node_detach(janus_videoroom_remote_node *node, janus_videoroom_publisher *p);
+static janus_videoroom_node_listener *janus_videoroom_node_listener_create(janus_videoroom *room,
+	const char *node_id, int fd, int rtcp_fd, const char *host);
+static void janus_videoroom_node_listener_remove(janus_videoroom *room, janus_videoroom_publisher *p);
+static uint32_t janus_videoroom_rtcp_pli_ssrc(char *buffer, int len);
+
 /* Start / stop recording */
 static void janus_videoroom_recorder_create(janus_videoroom_publisher_stream *ps);
 static void janus_videoroom_recorder_close(janus_videoroom_publisher *participant);
+static void janus_videoroom_recorder_layers(janus_videoroom_publisher_stream *ps);
 
 /* Freeing stuff */
 static void janus_videoroom_subscriber_stream_destroy(janus_videoroom_subscriber_stream *s) {
@@ -2730,7 +3420,17 @@ static void janus_videoroom_publisher_stream_free(const janus_refcount *ps_ref)
 	ps->rtp_forwarders = NULL;
 	janus_mutex_destroy(&ps->rtp_forwarders_mutex);
 	g_slist_free(ps->subscribers);
+	g_free(ps->relay_targets);
+	if(ps->data_pending != NULL)
+		g_string_free(ps->data_pending, TRUE);
 	janus_mutex_destroy(&ps->subscribers_mutex);
+	int i = 0;
+	for(i=0; i<3; i++) {
+		if(ps->keyframe_cache[i].packets != NULL)
+			g_queue_free_full(ps->keyframe_cache[i].packets, (GDestroyNotify)janus_videoroom_rtp_relay_packet_free);
+	}
+	janus_mutex_destroy(&ps->keyframe_mutex);
+	janus_av1_svc_context_reset(&ps->dd_context);
 	janus_mutex_destroy(&ps->rid_mutex);
 	janus_rtp_simulcasting_cleanup(NULL, NULL, ps->rid, NULL);
 	if(ps->is_srtp) {
@@ -2819,6 +3519,8 @@ static void janus_videoroom_publisher_free(const janus_refcount *p_ref) {
 		close(p->remote_fd);
 	if(p->remote_rtcp_fd > 0)
 		close(p->remote_rtcp_fd);
+	if(p->remote_node != NULL)
+		janus_refcount_decrease(&p->remote_node->ref);
 	if(p->pipefd[0] > 0)
 		close(p->pipefd[0]);
 	if(p->pipefd[1] > 0)
@@ -2879,9 +3581,16 @@ static void janus_videoroom_room_free(const janus_refcount *room_ref) {
 	g_free(room->rec_dir);
 	g_free(room->vp9_profile);
 	g_free(room->h264_profile);
+	g_free(room->speakers);
 	g_hash_table_destroy(room->participants);
 	g_hash_table_destroy(room->private_ids);
 	g_hash_table_destroy(room->allowed);
+	if(room->remote_nodes != NULL)
+		g_hash_table_destroy(room->remote_nodes);
+	if(room->node_listeners != NULL)
+		g_hash_table_destroy(room->node_listeners);
+	if(room->pending_publishers != NULL)
+		g_hash_table_destroy(room->pending_publishers);
 	g_free(room);
 }
 
@@ -2889,6 +3598,12 @@ static void janus_videoroom_message_free(janus_videoroom_message *msg) {
 	if(!msg || msg == &exit_message)
 		return;
 
+	if(msg->worker && msg->popped > 0) {
+		/* We're done processing this request, keep track of how long it took */
+		gint64 latency = (janus_get_monotonic_time() - msg->queued)/1000;
+		g_atomic_int_inc(&msg->worker->latency[janus_videoroom_histogram_bucket(janus_videoroom_latency_buckets, latency)]);
+	}
+
 	if(msg->handle && msg->handle->plugin_handle) {
 		janus_videoroom_session *session = (janus_videoroom_session *)msg->handle->plugin_handle;
 		janus_refcount_decrease(&session->ref);
@@ -2960,7 +3675,10 @@ static void janus_videoroom_reqpli(janus_videoroom_publisher_stream *ps, const c
 		if(ps->publisher == NULL || g_atomic_int_get(&ps->publisher->destroyed))
 			return;
 		remote_publisher = ps->publisher;
-		if(remote_publisher->remote_rtcp_fd < 0 || remote_publisher->rtcp_addr.ss_family == 0)
+		if(remote_publisher->remote_node == NULL &&
+				(remote_publisher->remote_rtcp_fd < 0 || remote_publisher->rtcp_addr.ss_family == 0))
+			return;
+		if(remote_publisher->remote_node != NULL && remote_publisher->remote_node->rtcp_fd < 0)
 			return;
 	}
 	if(!g_atomic_int_compare_and_exchange(&ps->sending_pli, 0, 1))
@@ -2986,13 +3704,29 @@ static void janus_videoroom_reqpli(janus_videoroom_publisher_stream *ps, const c
 		char rtcp_buf[12];
 		int rtcp_len = 12;
 		janus_rtcp_pli((char *)&rtcp_buf, rtcp_len);
-		uint32_t ssrc = REMOTE_PUBLISHER_BASE_SSRC + (ps->mindex*REMOTE_PUBLISHER_SSRC_STEP);
+		uint32_t ssrc = remote_publisher->remote_ssrc_base + (ps->mindex*REMOTE_PUBLISHER_SSRC_STEP);
 		janus_rtcp_fix_ssrc(NULL, rtcp_buf, rtcp_len, 1, 1, ssrc);
-		/* Send the packet */
-		socklen_t addrlen = remote_publisher->rtcp_addr.ss_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+		/* Send the packet (using the shared listener, if this publisher is cascaded,
+		 * whose address we copy, as the listener thread may be latching a new one) */
+		int rtcp_fd = remote_publisher->remote_rtcp_fd;
+		struct sockaddr_storage node_addr;
+		struct sockaddr_storage *rtcp_addr = &remote_publisher->rtcp_addr;
+		if(remote_publisher->remote_node != NULL) {
+			janus_videoroom_node_listener *listener = remote_publisher->remote_node;
+			rtcp_fd = listener->rtcp_fd;
+			janus_mutex_lock(&listener->mutex);
+			memcpy(&node_addr, &listener->rtcp_addr, sizeof(node_addr));
+			janus_mutex_unlock(&listener->mutex);
+			rtcp_addr = &node_addr;
+		}
+		if(rtcp_addr->ss_family == 0) {
+			/* We don't know where to send it yet */
+			g_atomic_int_set(&ps->sending_pli, 0);
+			return;
+		}
+		socklen_t addrlen = rtcp_addr->ss_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
 		int sent = 0;
-		if((sent = sendto(remote_publisher->remote_rtcp_fd, rtcp_buf, rtcp_len, 0,
-				(struct sockaddr *)&remote_publisher->rtcp_addr, addrlen)) < 0) {
+		if((sent = sendto(rtcp_fd, rtcp_buf, rtcp_len, 0, (struct sockaddr *)rtcp_addr, addrlen)) < 0) {
 			JANUS_LOG(LOG_ERR, "Error in sendto... %d (%s)\n", errno, g_strerror(errno));
 		} else {
 			JANUS_LOG(LOG_HUGE, "Sent %d/%d bytes\n", sent, rtcp_len);
@@ -3061,6 +3795,91 @@ static janus_rtp_forwarder *janus_videoroom_rtp_forwarder_add_helper(janus_video
 	return rf;
 }
 
+/* Helper to create the forwarders needed to remotize a publisher stream:
+ * must be called with the publisher streams and forwarders mutexes locked */
+static void janus_videoroom_remote_recipient_add_stream(janus_videoroom_publisher *p,
+		janus_videoroom_publisher_stream *ps, janus_videoroom_remote_recipient *r) {
+	if(p == NULL || ps == NULL || r == NULL || g_atomic_int_get(&ps->destroyed))
+		return;
+	if(r->ssrc_base != REMOTE_PUBLISHER_BASE_SSRC && ps->mindex >= REMOTE_NODE_MAX_STREAMS) {
+		/* This would overlap with the SSRCs of the next slot */
+		JANUS_LOG(LOG_WARN, "[%s] Can't cascade stream #%d, too many streams (max %d)\n",
+			p->user_id_str, ps->mindex, REMOTE_NODE_MAX_STREAMS);
+		return;
+	}
+	uint32_t ssrc = r->ssrc_base + ps->mindex*REMOTE_PUBLISHER_SSRC_STEP;
+	janus_rtp_forwarder *f = NULL;
+	if(ps->type == JANUS_VIDEOROOM_MEDIA_AUDIO) {
+		/* Audio stream */
+		f = janus_videoroom_rtp_forwarder_add_helper(p, ps,
+			r->host, r->port, -1, 0, ssrc,
+			FALSE, r->srtp_suite, r->srtp_crypto, 0, FALSE, FALSE);
+		if(f != NULL)
+			f->metadata = g_strdup(r->remote_id);
+	} else if(ps->type == JANUS_VIDEOROOM_MEDIA_VIDEO) {
+		/* Video stream */
+		gboolean add_rtcp = (!r->rtcp_added && r->rtcp_port > 0);
+		f = janus_videoroom_rtp_forwarder_add_helper(p, ps,
+			r->host, r->port, add_rtcp ? r->rtcp_port : -1, 0, ssrc,
+			FALSE, r->srtp_suite, r->srtp_crypto, 0, TRUE, FALSE);
+		if(f != NULL)
+			f->metadata = g_strdup(r->remote_id);
+		if(add_rtcp)
+			r->rtcp_added = TRUE;
+		/* Check if there's simulcast substreams we need to relay too */
+		if(ps->vssrc[1] || ps->rid[1]) {
+			f = janus_videoroom_rtp_forwarder_add_helper(p, ps,
+				r->host, r->port, -1, 0, ssrc + 1,
+				FALSE, r->srtp_suite, r->srtp_crypto, 1, TRUE, FALSE);
+			if(f != NULL)
+				f->metadata = g_strdup(r->remote_id);
+		}
+		if(ps->vssrc[2] || ps->rid[2]) {
+			f = janus_videoroom_rtp_forwarder_add_helper(p, ps,
+				r->host, r->port, -1, 0, ssrc + 2,
+				FALSE, r->srtp_suite, r->srtp_crypto, 2, TRUE, FALSE);
+			if(f != NULL)
+				f->metadata = g_strdup(r->remote_id);
+		}
+	} else {
+		/* Data stream */
+		f = janus_videoroom_rtp_forwarder_add_helper(p, ps,
+			r->host, r->port, -1, 0, ssrc,
+			FALSE, 0, NULL, 0, FALSE, TRUE);
+		if(f != NULL)
+			f->metadata = g_strdup(r->remote_id);
+	}
+}
+
+/* Helper to get rid of all the forwarders associated to a remotization:
+ * must be called with the publisher streams and forwarders mutexes locked */
+static void janus_videoroom_remote_recipient_remove_forwarders(janus_videoroom_publisher *p, const char *remote_id) {
+	if(p == NULL || remote_id == NULL)
+		return;
+	GList *temp = p->streams;
+	while(temp) {
+		janus_videoroom_publisher_stream *ps = (janus_videoroom_publisher_stream *)temp->data;
+		janus_refcount_increase(&ps->ref);
+		janus_mutex_lock(&ps->rtp_forwarders_mutex);
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, ps->rtp_forwarders);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) {
+			janus_rtp_forwarder *f = (janus_rtp_forwarder *)value;
+			if(f->metadata != NULL && !strcmp((char *)f->metadata, remote_id)) {
+				/* We found one, get rid of it */
+				uint32_t stream_id = f->stream_id;
+				g_hash_table_iter_remove(&iter);
+				/* Remove from global index too */
+				g_hash_table_remove(p->rtp_forwarders, GUINT_TO_POINTER(stream_id));
+			}
+		}
+		janus_mutex_unlock(&ps->rtp_forwarders_mutex);
+		janus_refcount_decrease(&ps->ref);
+		temp = temp->next;
+	}
+}
+
 static json_t *janus_videoroom_rtp_forwarder_summary(janus_rtp_forwarder *f) {
 	if(f == NULL)
 		return NULL;
@@ -3114,6 +3933,7 @@ static void janus_videoroom_create_dummy_publisher(janus_videoroom *room, GHashT
 	session->handle = NULL;
 	session->participant_type = janus_videoroom_p_type_publisher;
 	g_atomic_int_set(&session->started, 1);
+	janus_videoroom_relay_targets_changed();
 	janus_mutex_init(&session->mutex);
 	janus_refcount_init(&session->ref, janus_videoroom_session_free);
 	/* We actually create a publisher instance, which has no associated session but looks like it's publishing */
@@ -3123,6 +3943,8 @@ static void janus_videoroom_create_dummy_publisher(janus_videoroom *room, GHashT
 	publisher->room_id = room->room_id;
 	publisher->room_id_str = room->room_id_str ? g_strdup(room->room_id_str) : NULL;
 	publisher->room = room;
+	publisher->rec_substream = -1;
+	publisher->rec_temporal = -1;
 	janus_refcount_increase(&room->ref);
 	publisher->user_id = janus_random_uint64();
 	char user_id_num[30];
@@ -3189,6 +4011,7 @@ static void janus_videoroom_create_dummy_publisher(janus_videoroom *room, GHashT
 		janus_refcount_increase(&ps->ref);	/* This is for the id-indexed hashtable */
 		janus_refcount_increase(&ps->ref);	/* This is for the mid-indexed hashtable */
 		janus_mutex_init(&ps->subscribers_mutex);
+		janus_mutex_init(&ps->keyframe_mutex);
 		janus_mutex_init(&ps->rtp_forwarders_mutex);
 		janus_mutex_init(&ps->rid_mutex);
 		ps->rtp_forwarders = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_rtp_forwarder_destroy);
@@ -3236,6 +4059,7 @@ static void janus_videoroom_create_dummy_publisher(janus_videoroom *room, GHashT
 		janus_refcount_increase(&ps->ref);	/* This is for the id-indexed hashtable */
 		janus_refcount_increase(&ps->ref);	/* This is for the mid-indexed hashtable */
 		janus_mutex_init(&ps->subscribers_mutex);
+		janus_mutex_init(&ps->keyframe_mutex);
 		janus_mutex_init(&ps->rtp_forwarders_mutex);
 		janus_mutex_init(&ps->rid_mutex);
 		ps->rtp_forwarders = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_rtp_forwarder_destroy);
@@ -3298,6 +4122,7 @@ static janus_videoroom_subscriber_stream *janus_videoroom_subscriber_stream_add(
 	/* Initialize the stream */
 	janus_rtp_switching_context_reset(&stream->context);
 	stream->send = TRUE;
+	janus_videoroom_relay_targets_changed();
 	g_atomic_int_set(&stream->destroyed, 0);
 	janus_refcount_init(&stream->ref, janus_videoroom_subscriber_stream_free);
 	janus_refcount_increase(&stream->ref);	/* This is for the mid-indexed hashtable */
@@ -3305,12 +4130,15 @@ static janus_videoroom_subscriber_stream *janus_videoroom_subscriber_stream_add(
 	stream->sim_context.rid_ext_id = ps->rid_extmap_id;
 	stream->sim_context.substream_target = 2;
 	stream->sim_context.templayer_target = 2;
+	stream->bwe_cap = -1;
+	stream->speaker_cap = -1;
 	janus_vp8_simulcast_context_reset(&stream->vp8_context);
 	janus_rtp_svc_context_reset(&stream->svc_context);
 	stream->svc_context.spatial_target = 2;	/* FIXME Actually depends on the scalabilityMode */
 	stream->svc_context.temporal_target = 2;	/* FIXME Actually depends on the scalabilityMode */
 	janus_mutex_lock(&ps->subscribers_mutex);
 	ps->subscribers = g_slist_append(ps->subscribers, stream);
+	janus_videoroom_relay_targets_changed();
 	/* If we're using helper threads, add the subscriber to one of those */
 	if(subscriber->room && subscriber->room->helper_threads > 0) {
 		int subscribers = -1;
@@ -3356,6 +4184,7 @@ static janus_videoroom_subscriber_stream *janus_videoroom_subscriber_stream_add_
 			/* We already have a datachannel m-line, no need for others: just update the subscribers list */
 			if(g_slist_find(ps->subscribers, stream) == NULL && g_slist_find(stream->publisher_streams, ps) == NULL) {
 				ps->subscribers = g_slist_append(ps->subscribers, stream);
+				janus_videoroom_relay_targets_changed();
 				stream->publisher_streams = g_slist_append(stream->publisher_streams, ps);
 				/* The two streams reference each other */
 				janus_refcount_increase(&stream->ref);
@@ -3402,7 +4231,10 @@ static janus_videoroom_subscriber_stream *janus_videoroom_subscriber_stream_add_
 					g_free(msid);
 				}
 				stream->send = TRUE;
+				janus_videoroom_relay_targets_changed();
 				janus_rtp_simulcasting_context_reset(&stream->sim_context);
+				stream->bwe_cap = -1;
+				stream->speaker_cap = -1;
 				if(ps->simulcast) {
 					stream->sim_context.rid_ext_id = ps->rid_extmap_id;
 					stream->sim_context.substream_target = 2;
@@ -3417,6 +4249,7 @@ static janus_videoroom_subscriber_stream *janus_videoroom_subscriber_stream_add_
 				janus_mutex_lock(&ps->subscribers_mutex);
 				if(g_slist_find(ps->subscribers, stream) == NULL && g_slist_find(stream->publisher_streams, ps) == NULL) {
 					ps->subscribers = g_slist_append(ps->subscribers, stream);
+					janus_videoroom_relay_targets_changed();
 					stream->publisher_streams = g_slist_append(stream->publisher_streams, ps);
 					/* The two streams reference each other */
 					janus_refcount_increase(&stream->ref);
@@ -3474,9 +4307,17 @@ static void janus_videoroom_subscriber_stream_remove(janus_videoroom_subscriber_
 				if(s->publisher_streams == NULL)
 					g_atomic_int_set(&s->ready, 0);
 			}
+			if(s->bwe_counted) {
+				/* This stream doesn't share the estimated bandwidth anymore */
+				s->bwe_counted = FALSE;
+				s->bwe_checked = 0;
+				if(s->subscriber)
+					g_atomic_int_add(&s->subscriber->bwe_streams, -1);
+			}
 			s->opusfec = FALSE;
 			if(g_slist_find(ps->subscribers, s) != NULL) {
 				ps->subscribers = g_slist_remove(ps->subscribers, s);
+				janus_videoroom_relay_targets_changed();
 				unref_ss = TRUE;
 			}
 			/* Remove the subscriber from the helper threads too, if any */
@@ -3534,6 +4375,8 @@ static json_t *janus_videoroom_subscriber_streams_summary(janus_videoroom_subscr
 			json_object_set_new(m, "crossrefid", json_string(stream->crossrefid));
 		json_object_set_new(m, "ready", g_atomic_int_get(&stream->ready) ? json_true() : json_false());
 		json_object_set_new(m, "send", stream->send ? json_true() : json_false());
+		if(g_atomic_int_get(&stream->suspended))
+			json_object_set_new(m, "suspended", json_true());
 		if(ps && stream->type == JANUS_VIDEOROOM_MEDIA_DATA) {
 			json_object_set_new(m, "sources", json_integer(g_slist_length(stream->publisher_streams)));
 			json_t *ids = json_array();
@@ -3649,6 +4492,7 @@ static json_t *janus_videoroom_subscriber_offer(janus_videoroom_subscriber *subs
 			JANUS_SDP_OA_MSID, add_msid ? stream->msid : NULL, add_msid ? stream->mstid : NULL,
 			JANUS_SDP_OA_PT, pt,
 			JANUS_SDP_OA_CODEC, codec,
+			JANUS_SDP_OA_OPUSRED_PT, (stream->type == JANUS_VIDEOROOM_MEDIA_AUDIO && ps && ps->opusred_pt > 0) ? ps->opusred_pt : 0,
 			JANUS_SDP_OA_FMTP, (stream->type == JANUS_VIDEOROOM_MEDIA_AUDIO && strlen(audio_fmtp) ? audio_fmtp : NULL),
 			JANUS_SDP_OA_H264_PROFILE, (stream->type == JANUS_VIDEOROOM_MEDIA_VIDEO ? stream->h264_profile : NULL),
 			JANUS_SDP_OA_VP9_PROFILE, (stream->type == JANUS_VIDEOROOM_MEDIA_VIDEO ? stream->vp9_profile : NULL),
@@ -3681,6 +4525,113 @@ static json_t *janus_videoroom_subscriber_offer(janus_videoroom_subscriber *subs
 	return jsep;
 }
 
+/* Helper to send an updated offer to a subscriber, e.g., because some of the
+ * publishers it was subscribed to went away, or its subscriptions changed:
+ * the transaction is only needed when this is a response to a request.
+ * Returns FALSE if the offer couldn't be sent, e.g., because it was postponed */
+static gboolean janus_videoroom_subscriber_send_update(janus_videoroom_subscriber *subscriber, const char *transaction) {
+	janus_mutex_lock(&subscriber->streams_mutex);
+	if(subscriber->room == NULL || g_atomic_int_get(&subscriber->room->destroyed)) {
+		janus_mutex_unlock(&subscriber->streams_mutex);
+		return FALSE;
+	}
+	if(!g_atomic_int_get(&subscriber->answered)) {
+		/* We're still waiting for an answer to a previous offer, postpone this */
+		g_atomic_int_set(&subscriber->pending_offer, 1);
+		janus_mutex_unlock(&subscriber->streams_mutex);
+		return FALSE;
+	}
+	g_atomic_int_set(&subscriber->pending_offer, 0);
+	json_t *event = json_object();
+	json_object_set_new(event, "videoroom", json_string("updated"));
+	json_object_set_new(event, "room", string_ids ?
+		json_string(subscriber->room_id_str) : json_integer(subscriber->room_id));
+	json_t *media = janus_videoroom_subscriber_streams_summary(subscriber, FALSE, NULL);
+	json_t *media_event = NULL;
+	if(notify_events && gateway->events_is_enabled())
+		media_event = json_deep_copy(media);
+	json_object_set_new(event, "streams", media);
+	/* Generate a new offer */
+	json_t *jsep = janus_videoroom_subscriber_offer(subscriber);
+	/* Do we need an ICE restart as well? */
+	if(g_atomic_int_compare_and_exchange(&subscriber->pending_restart, 1, 0))
+		json_object_set_new(jsep, "restart", json_true());
+	janus_mutex_unlock(&subscriber->streams_mutex);
+	/* How long will the Janus core take to push the event? */
+	gint64 start = janus_get_monotonic_time();
+	int res = gateway->push_event(subscriber->session->handle, &janus_videoroom_plugin, transaction, event, jsep);
+	JANUS_LOG(LOG_VERB, "  >> Pushing event: %d (took %"SCNu64" us)\n", res, janus_get_monotonic_time()-start);
+	json_decref(event);
+	json_decref(jsep);
+	/* Also notify event handlers */
+	if(notify_events && gateway->events_is_enabled()) {
+		json_t *info = json_object();
+		json_object_set_new(info, "event", json_string("updated"));
+		json_object_set_new(info, "room", string_ids ?
+			json_string(subscriber->room_id_str) : json_integer(subscriber->room_id));
+		json_object_set_new(info, "streams", media_event);
+		json_object_set_new(info, "private_id", json_integer(subscriber->pvt_id));
+		gateway->notify_event(&janus_videoroom_plugin, subscriber->session->handle, info);
+	}
+	return TRUE;
+}
+
+/* Delayed renegotiations: rather than sending a new offer to a subscriber any
+ * time something changes, we wait a bit, so that all the changes happening in
+ * the meanwhile (e.g., many publishers leaving at the same time) end up in a
+ * single offer. Since the delay is always the same, a FIFO queue is enough */
+typedef struct janus_videoroom_pending_update {
+	janus_videoroom_subscriber *subscriber;
+	gint64 due;
+} janus_videoroom_pending_update;
+static janus_videoroom_pending_update exit_update;
+/* Returns TRUE if an offer was (or already had been) scheduled for this subscriber */
+static gboolean janus_videoroom_subscriber_schedule_update(janus_videoroom_subscriber *subscriber) {
+	if(renegotiation_delay <= 0 || pending_updates == NULL || g_atomic_int_get(&stopping))
+		return FALSE;
+	if(!g_atomic_int_compare_and_exchange(&subscriber->update_scheduled, 0, 1)) {
+		/* There's an update scheduled already, which will include this change too */
+		return TRUE;
+	}
+	janus_refcount_increase(&subscriber->session->ref);
+	janus_refcount_increase(&subscriber->ref);
+	janus_videoroom_pending_update *update = g_malloc(sizeof(janus_videoroom_pending_update));
+	update->subscriber = subscriber;
+	update->due = janus_get_monotonic_time() + (gint64)renegotiation_delay*1000;
+	g_async_queue_push(pending_updates, update);
+	return TRUE;
+}
+static void *janus_videoroom_updates_thread(void *data) {
+	JANUS_LOG(LOG_VERB, "Joining VideoRoom updates thread\n");
+	janus_videoroom_pending_update *update = NULL;
+	while(!g_atomic_int_get(&stopping)) {
+		update = g_async_queue_pop(pending_updates);
+		if(update == &exit_update)
+			break;
+		gint64 wait = update->due - janus_get_monotonic_time();
+		if(wait > 0)
+			g_usleep(wait);
+		janus_videoroom_subscriber *subscriber = update->subscriber;
+		g_atomic_int_set(&subscriber->update_scheduled, 0);
+		if(!g_atomic_int_get(&stopping) && !g_atomic_int_get(&subscriber->destroyed) &&
+				subscriber->session && !g_atomic_int_get(&subscriber->session->destroyed))
+			janus_videoroom_subscriber_send_update(subscriber, NULL);
+		janus_refcount_decrease(&subscriber->session->ref);
+		janus_refcount_decrease(&subscriber->ref);
+		g_free(update);
+	}
+	/* Get rid of the updates we didn't send */
+	while((update = g_async_queue_try_pop(pending_updates)) != NULL) {
+		if(update == &exit_update)
+			continue;
+		janus_refcount_decrease(&update->subscriber->session->ref);
+		janus_refcount_decrease(&update->subscriber->ref);
+		g_free(update);
+	}
+	JANUS_LOG(LOG_VERB, "Leaving VideoRoom updates thread\n");
+	return NULL;
+}
+
 
 /* Plugin implementation */
 int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
@@ -3709,7 +4660,7 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 		janus_config_print(config);
 
 	sessions = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_videoroom_session_destroy);
-	messages = g_async_queue_new_full((GDestroyNotify) janus_videoroom_message_free);
+	int i = 0;
 
 	/* This is the callback we'll need to invoke to contact the Janus core */
 	gateway = callback;
@@ -3721,6 +4672,19 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 		janus_config_item *key = janus_config_get(config, config_general, janus_config_type_item, "admin_key");
 		if(key != NULL && key->value != NULL)
 			admin_key = g_strdup(key->value);
+		/* Should we journal changes to permanent rooms, rather than saving the whole file? */
+		janus_config_item *journal = janus_config_get(config, config_general, janus_config_type_item, "config_journal");
+		if(journal != NULL && journal->value != NULL && janus_is_true(journal->value)) {
+			int compact_after = 0;
+			janus_config_item *compact = janus_config_get(config, config_general, janus_config_type_item, "config_journal_compact");
+			if(compact != NULL && compact->value != NULL)
+				compact_after = atoi(compact->value);
+			if(compact_after < 0)
+				compact_after = 0;
+			config_journal = janus_config_journal_open(config, &config_mutex, config_folder, JANUS_VIDEOROOM_PACKAGE, compact_after);
+			if(config_journal == NULL)
+				JANUS_LOG(LOG_WARN, "Couldn't open the configuration journal, permanent rooms will be saved to the whole file\n");
+		}
 		janus_config_item *lrf = janus_config_get(config, config_general, janus_config_type_item, "lock_rtp_forward");
 		if(admin_key && lrf != NULL && lrf->value != NULL)
 			lock_rtpfwd = janus_is_true(lrf->value);
@@ -3730,12 +4694,68 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 		if(!notify_events && callback->events_is_enabled()) {
 			JANUS_LOG(LOG_WARN, "Notification of events to handlers disabled for %s\n", JANUS_VIDEOROOM_NAME);
 		}
+		janus_config_item *dir = janus_config_get(config, config_general, janus_config_type_item, "directory_events");
+		if(dir != NULL && dir->value != NULL)
+			directory_events = janus_is_true(dir->value);
+		if(directory_events && !notify_events) {
+			JANUS_LOG(LOG_WARN, "Directory events need events to be enabled, disabling\n");
+			directory_events = FALSE;
+		}
 		janus_config_item *ids = janus_config_get(config, config_general, janus_config_type_item, "string_ids");
 		if(ids != NULL && ids->value != NULL)
 			string_ids = janus_is_true(ids->value);
 		if(string_ids) {
 			JANUS_LOG(LOG_INFO, "VideoRoom will use alphanumeric IDs, not numeric\n");
 		}
+		janus_config_item *reneg = janus_config_get(config, config_general, janus_config_type_item, "renegotiation_delay");
+		if(reneg != NULL && reneg->value != NULL) {
+			renegotiation_delay = atoi(reneg->value);
+			if(renegotiation_delay < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid renegotiation_delay value, disabling\n");
+				renegotiation_delay = 0;
+			} else if(renegotiation_delay > 0) {
+				JANUS_LOG(LOG_INFO, "Subscriber renegotiations will be coalesced in %d ms windows\n", renegotiation_delay);
+			}
+		}
+		janus_config_item *ped = janus_config_get(config, config_general, janus_config_type_item, "publisher_events_delay");
+		if(ped != NULL && ped->value != NULL) {
+			publisher_events_delay = atoi(ped->value);
+			if(publisher_events_delay < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid publisher_events_delay value, disabling\n");
+				publisher_events_delay = 0;
+			} else if(publisher_events_delay > 0) {
+				JANUS_LOG(LOG_INFO, "Publisher events will be batched in %d ms windows\n", publisher_events_delay);
+			}
+		}
+		janus_config_item *dc = janus_config_get(config, config_general, janus_config_type_item, "data_coalesce");
+		if(dc != NULL && dc->value != NULL) {
+			data_coalesce = atoi(dc->value);
+			if(data_coalesce < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid data_coalesce value, disabling\n");
+				data_coalesce = 0;
+			} else if(data_coalesce > 0) {
+				JANUS_LOG(LOG_INFO, "Small text data channel messages will be coalesced in %d ms windows\n", data_coalesce);
+			}
+		}
+		janus_config_item *ht = janus_config_get(config, config_general, janus_config_type_item, "handler_threads");
+		if(ht != NULL && ht->value != NULL) {
+			handler_threads = atoi(ht->value);
+			if(handler_threads < 1) {
+				JANUS_LOG(LOG_WARN, "Invalid handler_threads value, using a single thread\n");
+				handler_threads = 1;
+			} else if(handler_threads > 1) {
+				JANUS_LOG(LOG_INFO, "Asynchronous requests will be handled by %d threads\n", handler_threads);
+			}
+		}
+		janus_config_item *pin = janus_config_get(config, config_general, janus_config_type_item, "pin_helper_threads");
+		if(pin != NULL && pin->value != NULL)
+			pin_helper_threads = janus_is_true(pin->value);
+#ifndef __linux__
+		if(pin_helper_threads) {
+			JANUS_LOG(LOG_WARN, "Pinning helper threads to CPU cores is only supported on Linux, ignoring\n");
+			pin_helper_threads = FALSE;
+		}
+#endif
 	}
 	rooms = g_hash_table_new_full(string_ids ? g_str_hash : g_int64_hash, string_ids ? g_str_equal : g_int64_equal,
 		(GDestroyNotify)g_free, (GDestroyNotify)janus_videoroom_room_destroy);
@@ -3765,6 +4785,7 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 			janus_config_item *h264profile = janus_config_get(config, cat, janus_config_type_item, "h264_profile");
 			janus_config_item *fec = janus_config_get(config, cat, janus_config_type_item, "opus_fec");
 			janus_config_item *dtx = janus_config_get(config, cat, janus_config_type_item, "opus_dtx");
+			janus_config_item *red = janus_config_get(config, cat, janus_config_type_item, "opus_red");
 			janus_config_item *audiolevel_ext = janus_config_get(config, cat, janus_config_type_item, "audiolevel_ext");
 			janus_config_item *audiolevel_event = janus_config_get(config, cat, janus_config_type_item, "audiolevel_event");
 			janus_config_item *audio_active_packets = janus_config_get(config, cat, janus_config_type_item, "audio_active_packets");
@@ -3772,16 +4793,23 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 			janus_config_item *videoorient_ext = janus_config_get(config, cat, janus_config_type_item, "videoorient_ext");
 			janus_config_item *playoutdelay_ext = janus_config_get(config, cat, janus_config_type_item, "playoutdelay_ext");
 			janus_config_item *transport_wide_cc_ext = janus_config_get(config, cat, janus_config_type_item, "transport_wide_cc_ext");
+			janus_config_item *bwe = janus_config_get(config, cat, janus_config_type_item, "bwe");
+			janus_config_item *active_speakers = janus_config_get(config, cat, janus_config_type_item, "active_speakers");
+			janus_config_item *audio_last_n = janus_config_get(config, cat, janus_config_type_item, "audio_last_n");
+			janus_config_item *keyframe_cache = janus_config_get(config, cat, janus_config_type_item, "keyframe_cache");
 			janus_config_item *notify_joining = janus_config_get(config, cat, janus_config_type_item, "notify_joining");
 			janus_config_item *req_e2ee = janus_config_get(config, cat, janus_config_type_item, "require_e2ee");
 			janus_config_item *dummy_pub = janus_config_get(config, cat, janus_config_type_item, "dummy_publisher");
 			janus_config_item *dummy_str = janus_config_get(config, cat, janus_config_type_array, "dummy_streams");
 			janus_config_item *record = janus_config_get(config, cat, janus_config_type_item, "record");
 			janus_config_item *rec_dir = janus_config_get(config, cat, janus_config_type_item, "rec_dir");
+			janus_config_item *rec_substream = janus_config_get(config, cat, janus_config_type_item, "rec_substream");
+			janus_config_item *rec_temporal = janus_config_get(config, cat, janus_config_type_item, "rec_temporal");
 			janus_config_item *lock_record = janus_config_get(config, cat, janus_config_type_item, "lock_record");
 			janus_config_item *threads = janus_config_get(config, cat, janus_config_type_item, "threads");
 			/* Create the video room */
 			janus_videoroom *videoroom = g_malloc0(sizeof(janus_videoroom));
+			janus_usage_init(&videoroom->usage);
 			const char *room_num = cat->name;
 			if(strstr(room_num, "room-") == room_num)
 				room_num += 5;
@@ -3804,16 +4832,16 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 				}
 			}
 			/* Let's make sure the room doesn't exist already */
-			janus_mutex_lock(&rooms_mutex);
+			janus_rwlock_read_lock(&rooms_rwlock);
 			if(g_hash_table_lookup(rooms, string_ids ? (gpointer)room_num : (gpointer)&videoroom->room_id) != NULL) {
 				/* It does... */
-				janus_mutex_unlock(&rooms_mutex);
+				janus_rwlock_read_unlock(&rooms_rwlock);
 				JANUS_LOG(LOG_ERR, "Can't add the VideoRoom room, room %s already exists...\n", room_num);
 				g_free(videoroom);
 				cl = cl->next;
 				continue;
 			}
-			janus_mutex_unlock(&rooms_mutex);
+			janus_rwlock_read_unlock(&rooms_rwlock);
 			videoroom->room_id_str = g_strdup(room_num);
 			char *description = NULL;
 			if(desc != NULL && desc->value != NULL && strlen(desc->value) > 0)
@@ -3938,6 +4966,17 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 					JANUS_LOG(LOG_WARN, "DTX is only supported for rooms that allow Opus: disabling it...\n");
 				}
 			}
+			if(red && red->value) {
+				videoroom->do_opusred = janus_is_true(red->value);
+				if(videoroom->acodec[0] != JANUS_AUDIOCODEC_OPUS &&
+						videoroom->acodec[1] != JANUS_AUDIOCODEC_OPUS &&
+						videoroom->acodec[2] != JANUS_AUDIOCODEC_OPUS &&
+						videoroom->acodec[3] != JANUS_AUDIOCODEC_OPUS &&
+						videoroom->acodec[4] != JANUS_AUDIOCODEC_OPUS) {
+					videoroom->do_opusred = FALSE;
+					JANUS_LOG(LOG_WARN, "RED is only supported for rooms that allow Opus: disabling it...\n");
+				}
+			}
 			videoroom->audiolevel_ext = TRUE;
 			if(audiolevel_ext != NULL && audiolevel_ext->value != NULL)
 				videoroom->audiolevel_ext = janus_is_true(audiolevel_ext->value);
@@ -3971,13 +5010,49 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 			videoroom->transport_wide_cc_ext = TRUE;
 			if(transport_wide_cc_ext != NULL && transport_wide_cc_ext->value != NULL)
 				videoroom->transport_wide_cc_ext = janus_is_true(transport_wide_cc_ext->value);
-			if(record && record->value) {
-				videoroom->record = janus_is_true(record->value);
+			if(bwe != NULL && bwe->value != NULL)
+				videoroom->bwe = janus_is_true(bwe->value);
+			if(active_speakers != NULL && active_speakers->value != NULL) {
+				if(atoi(active_speakers->value) >= 0) {
+					videoroom->active_speakers = atoi(active_speakers->value);
+				} else {
+					JANUS_LOG(LOG_WARN, "Invalid active_speakers value, disabling\n");
+				}
 			}
-			if(rec_dir && rec_dir->value) {
-				videoroom->rec_dir = g_strdup(rec_dir->value);
+			if(audio_last_n != NULL && audio_last_n->value != NULL) {
+				if(atoi(audio_last_n->value) >= 0) {
+					videoroom->audio_last_n = atoi(audio_last_n->value);
+				} else {
+					JANUS_LOG(LOG_WARN, "Invalid audio_last_n value, disabling\n");
+				}
 			}
-			if(lock_record && lock_record->value) {
+			if(keyframe_cache != NULL && keyframe_cache->value != NULL)
+				videoroom->keyframe_cache = janus_is_true(keyframe_cache->value);
+			videoroom->rec_substream = 2;
+			if(rec_substream != NULL && rec_substream->value != NULL) {
+				int value = atoi(rec_substream->value);
+				if(value >= 0 && value <= 2) {
+					videoroom->rec_substream = value;
+				} else {
+					JANUS_LOG(LOG_WARN, "Invalid rec_substream value, recording the highest one\n");
+				}
+			}
+			videoroom->rec_temporal = 2;
+			if(rec_temporal != NULL && rec_temporal->value != NULL) {
+				int value = atoi(rec_temporal->value);
+				if(value >= 0 && value <= 2) {
+					videoroom->rec_temporal = value;
+				} else {
+					JANUS_LOG(LOG_WARN, "Invalid rec_temporal value, recording the highest one\n");
+				}
+			}
+			if(record && record->value) {
+				videoroom->record = janus_is_true(record->value);
+			}
+			if(rec_dir && rec_dir->value) {
+				videoroom->rec_dir = g_strdup(rec_dir->value);
+			}
+			if(lock_record && lock_record->value) {
 				videoroom->lock_record = janus_is_true(lock_record->value);
 			}
 			/* By default, the VideoRoom plugin does not notify about participants simply joining the room.
@@ -3986,6 +5061,7 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 			if(notify_joining != NULL && notify_joining->value != NULL)
 				videoroom->notify_joining = janus_is_true(notify_joining->value);
 			g_atomic_int_set(&videoroom->destroyed, 0);
+			janus_mutex_init(&videoroom->speakers_mutex);
 			janus_mutex_init(&videoroom->mutex);
 			janus_refcount_init(&videoroom->ref, janus_videoroom_room_free);
 			videoroom->participants = g_hash_table_new_full(string_ids ? g_str_hash : g_int64_hash, string_ids ? g_str_equal : g_int64_equal,
@@ -4031,46 +5107,19 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 					g_hash_table_destroy(dummy_streams);
 			}
 			if(threads && threads->value) {
-				int helper_threads = atoi(threads->value);
+				int helper_threads = !strcasecmp(threads->value, "auto") ? (int)g_get_num_processors() : atoi(threads->value);
 				if(helper_threads < 0) {
 					JANUS_LOG(LOG_WARN, "Invalid threads configuration '%d' in room '%s', ignoring...\n", helper_threads, cat->name);
 				} else {
 					/* If we need helper threads, spawn them now */
-					videoroom->helper_threads = helper_threads;
-					if(helper_threads > 0) {
-						GError *error = NULL;
-						char tname[16];
-						int i=0;
-						for(i=0; i<helper_threads; i++) {
-							janus_videoroom_helper *helper = g_malloc0(sizeof(janus_videoroom_helper));
-							helper->id = i+1;
-							helper->room = videoroom;
-							helper->subscribers = g_hash_table_new(NULL, NULL);
-							helper->queued_packets = g_async_queue_new_full((GDestroyNotify)janus_videoroom_rtp_relay_packet_free);
-							janus_mutex_init(&helper->mutex);
-							janus_refcount_init(&helper->ref, janus_videoroom_helper_free);
-							/* Spawn a thread and add references */
-							g_snprintf(tname, sizeof(tname), "vhelp %u-%s", helper->id, videoroom->room_id_str);
-							janus_refcount_increase(&videoroom->ref);
-							janus_refcount_increase(&helper->ref);
-							helper->thread = g_thread_try_new(tname, &janus_videoroom_helper_thread, helper, &error);
-							if(error != NULL) {
-								/* TODO Should this be a hard failure? */
-								JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the helper thread...\n",
-									error->code, error->message ? error->message : "??");
-							} else {
-								janus_refcount_increase(&helper->ref);
-								videoroom->threads = g_list_append(videoroom->threads, helper);
-							}
-						}
-					}
+					janus_videoroom_helpers_spawn(videoroom, helper_threads);
 				}
 			}
-			janus_mutex_lock(&rooms_mutex);
+			janus_rwlock_write_lock(&rooms_rwlock);
 			g_hash_table_insert(rooms,
 				string_ids ? (gpointer)g_strdup(videoroom->room_id_str) : (gpointer)janus_uint64_dup(videoroom->room_id),
 				videoroom);
-			janus_mutex_unlock(&rooms_mutex);
+			janus_rwlock_write_unlock(&rooms_rwlock);
 			/* Compute a list of the supported codecs for the summary */
 			char audio_codecs[100], video_codecs[100];
 			janus_videoroom_codecstr(videoroom, audio_codecs, video_codecs, sizeof(audio_codecs), "|");
@@ -4098,7 +5147,7 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 	}
 
 	/* Show available rooms */
-	janus_mutex_lock(&rooms_mutex);
+	janus_rwlock_read_lock(&rooms_rwlock);
 	GHashTableIter iter;
 	gpointer value;
 	g_hash_table_iter_init(&iter, rooms);
@@ -4111,7 +5160,7 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 			vr->room_id_str, vr->room_name, vr->bitrate, vr->max_publishers, vr->fir_freq,
 			audio_codecs, video_codecs);
 	}
-	janus_mutex_unlock(&rooms_mutex);
+	janus_rwlock_read_unlock(&rooms_rwlock);
 
 	/* Finally, let's check if IPv6 is disabled, as we may need to know for forwarders */
 	int fd = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
@@ -4128,18 +5177,79 @@ int janus_videoroom_init(janus_callbacks *callback, const char *config_path) {
 		JANUS_LOG(LOG_WARN, "IPv6 disabled, will only create VideoRoom forwarders to IPv4 addresses\n");
 	}
 
+	/* Now that we know how many handler threads we need, prepare their queues */
+	workers = g_malloc0(handler_threads * sizeof(janus_videoroom_worker));
+	for(i=0; i<handler_threads; i++) {
+		workers[i].id = i;
+		workers[i].messages = g_async_queue_new_full((GDestroyNotify) janus_videoroom_message_free);
+	}
+
 	g_atomic_int_set(&initialized, 1);
 
-	/* Launch the thread that will handle incoming messages */
+	/* Launch the threads that will handle incoming messages */
 	GError *error = NULL;
-	handler_thread = g_thread_try_new("videoroom handler", janus_videoroom_handler, NULL, &error);
-	if(error != NULL) {
-		g_atomic_int_set(&initialized, 0);
-		JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the VideoRoom handler thread...\n",
-			error->code, error->message ? error->message : "??");
-		g_error_free(error);
-		janus_config_destroy(config);
-		return -1;
+	char tname[32];
+	for(i=0; i<handler_threads; i++) {
+		if(handler_threads == 1)
+			g_snprintf(tname, sizeof(tname), "videoroom handler");
+		else
+			g_snprintf(tname, sizeof(tname), "vroom handler %d", i);
+		workers[i].thread = g_thread_try_new(tname, janus_videoroom_handler, &workers[i], &error);
+		if(error != NULL) {
+			g_atomic_int_set(&initialized, 0);
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the VideoRoom handler thread...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			/* Stop the threads we launched already */
+			int j = 0;
+			for(j=0; j<i; j++) {
+				g_async_queue_push(workers[j].messages, &exit_message);
+				g_thread_join(workers[j].thread);
+			}
+			janus_config_journal_close(config_journal);
+			config_journal = NULL;
+			janus_config_destroy(config);
+			return -1;
+		}
+	}
+	if(renegotiation_delay > 0) {
+		/* Launch the thread that will send delayed subscriber offers */
+		pending_updates = g_async_queue_new();
+		updates_thread = g_thread_try_new("videoroom updates", janus_videoroom_updates_thread, NULL, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the VideoRoom updates thread, renegotiations won't be delayed...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			g_async_queue_unref(pending_updates);
+			pending_updates = NULL;
+			renegotiation_delay = 0;
+		}
+	}
+	if(publisher_events_delay > 0) {
+		/* Launch the thread that will send batches of publisher events */
+		pending_events = g_async_queue_new();
+		events_thread = g_thread_try_new("videoroom events", janus_videoroom_events_thread, NULL, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the VideoRoom events thread, publisher events won't be batched...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			g_async_queue_unref(pending_events);
+			pending_events = NULL;
+			publisher_events_delay = 0;
+		}
+	}
+	if(data_coalesce > 0) {
+		/* Launch the thread that will relay coalesced data channel messages */
+		pending_data = g_async_queue_new();
+		data_thread = g_thread_try_new("videoroom data", janus_videoroom_data_thread, NULL, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the VideoRoom data thread, data channel messages won't be coalesced...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			g_async_queue_unref(pending_data);
+			pending_data = NULL;
+			data_coalesce = 0;
+		}
 	}
 	JANUS_LOG(LOG_INFO, "%s initialized!\n", JANUS_VIDEOROOM_NAME);
 	return 0;
@@ -4150,10 +5260,40 @@ void janus_videoroom_destroy(void) {
 		return;
 	g_atomic_int_set(&stopping, 1);
 
-	g_async_queue_push(messages, &exit_message);
-	if(handler_thread != NULL) {
-		g_thread_join(handler_thread);
-		handler_thread = NULL;
+	int i = 0;
+	for(i=0; i<handler_threads; i++) {
+		g_async_queue_push(workers[i].messages, &exit_message);
+		if(workers[i].thread != NULL) {
+			g_thread_join(workers[i].thread);
+			workers[i].thread = NULL;
+		}
+	}
+	if(updates_thread != NULL) {
+		g_async_queue_push(pending_updates, &exit_update);
+		g_thread_join(updates_thread);
+		updates_thread = NULL;
+	}
+	if(pending_updates != NULL) {
+		g_async_queue_unref(pending_updates);
+		pending_updates = NULL;
+	}
+	if(events_thread != NULL) {
+		g_async_queue_push(pending_events, &exit_events);
+		g_thread_join(events_thread);
+		events_thread = NULL;
+	}
+	if(pending_events != NULL) {
+		g_async_queue_unref(pending_events);
+		pending_events = NULL;
+	}
+	if(data_thread != NULL) {
+		g_async_queue_push(pending_data, &exit_data);
+		g_thread_join(data_thread);
+		data_thread = NULL;
+	}
+	if(pending_data != NULL) {
+		g_async_queue_unref(pending_data);
+		pending_data = NULL;
 	}
 
 	/* FIXME We should destroy the sessions cleanly */
@@ -4162,14 +5302,18 @@ void janus_videoroom_destroy(void) {
 	sessions = NULL;
 	janus_mutex_unlock(&sessions_mutex);
 
-	janus_mutex_lock(&rooms_mutex);
+	janus_rwlock_write_lock(&rooms_rwlock);
 	g_hash_table_destroy(rooms);
 	rooms = NULL;
-	janus_mutex_unlock(&rooms_mutex);
+	janus_rwlock_write_unlock(&rooms_rwlock);
 
-	g_async_queue_unref(messages);
-	messages = NULL;
+	for(i=0; i<handler_threads; i++)
+		g_async_queue_unref(workers[i].messages);
+	g_free(workers);
+	workers = NULL;
 
+	janus_config_journal_close(config_journal);
+	config_journal = NULL;
 	janus_config_destroy(config);
 	g_free(admin_key);
 
@@ -4273,28 +5417,156 @@ static janus_videoroom_subscriber *janus_videoroom_session_get_subscriber_nodebu
 	return subscriber;
 }
 
+/* Let event handlers know a room or feed was asked for but isn't here: an
+ * external room directory can use this to cascade it from the node that
+ * hosts it (e.g., via add_remote_node there), so that a retry succeeds */
+static void janus_videoroom_notify_directory(janus_videoroom_session *session, janus_videoroom *videoroom, json_t *room, json_t *feed) {
+	if(!directory_events || !gateway->events_is_enabled())
+		return;
+	json_t *info = json_object();
+	json_object_set_new(info, "event", json_string(feed ? "feed_requested" : "room_requested"));
+	if(videoroom != NULL)
+		json_object_set_new(info, "room", string_ids ? json_string(videoroom->room_id_str) : json_integer(videoroom->room_id));
+	else if(room != NULL)
+		json_object_set(info, "room", room);
+	if(feed != NULL)
+		json_object_set(info, "feed", feed);
+	gateway->notify_event(&janus_videoroom_plugin, session ? session->handle : NULL, info);
+}
+
 static void janus_videoroom_notify_participants(janus_videoroom_publisher *participant, json_t *msg, gboolean notify_source_participant) {
 	/* participant->room->mutex has to be locked. */
 	if(participant->room == NULL)
 		return;
+	/* We collect all the handles first, and then push the event to all of
+	 * them at once, so that the core only needs to prepare it once */
+	GPtrArray *handles = g_ptr_array_sized_new(g_hash_table_size(participant->room->participants));
 	GHashTableIter iter;
 	gpointer value;
 	g_hash_table_iter_init(&iter, participant->room->participants);
 	while (participant->room && !g_atomic_int_get(&participant->room->destroyed) && g_hash_table_iter_next(&iter, NULL, &value)) {
 		janus_videoroom_publisher *p = value;
-		if(p && !g_atomic_int_get(&p->destroyed) && p->session && (p != participant || notify_source_participant)) {
+		if(p && !g_atomic_int_get(&p->destroyed) && p->session && p->session->handle && (p != participant || notify_source_participant)) {
 			JANUS_LOG(LOG_VERB, "Notifying participant %s (%s)\n", p->user_id_str, p->display ? p->display : "??");
-			int ret = gateway->push_event(p->session->handle, &janus_videoroom_plugin, NULL, msg, NULL);
-			JANUS_LOG(LOG_VERB, "  >> %d (%s)\n", ret, janus_get_api_error(ret));
+			g_ptr_array_add(handles, p->session->handle);
+		}
+	}
+	if(handles->len > 0) {
+		int ret = gateway->push_event_broadcast((janus_plugin_session **)handles->pdata, handles->len, &janus_videoroom_plugin, msg);
+		JANUS_LOG(LOG_VERB, "  >> Notified %d participants\n", ret);
+	}
+	g_ptr_array_free(handles, TRUE);
+}
+
+/* Batched publisher events: rather than notifying participants any time a
+ * publisher appears or changes, we wait a bit, and then send all the news in
+ * a single "publishers" event. Since the delay is always the same, a FIFO
+ * queue is enough, as for delayed renegotiations */
+static void janus_videoroom_schedule_publisher_event(janus_videoroom *room, janus_videoroom_publisher *p, json_t *pl) {
+	/* room->mutex has to be locked: we take ownership of the publisher info */
+	if(room->pending_publishers == NULL) {
+		room->pending_publishers = g_hash_table_new_full(string_ids ? g_str_hash : g_int64_hash,
+			string_ids ? g_str_equal : g_int64_equal, (GDestroyNotify)g_free, (GDestroyNotify)json_decref);
+	}
+	/* If we already had something pending for this publisher, this replaces it */
+	g_hash_table_insert(room->pending_publishers,
+		string_ids ? (gpointer)g_strdup(p->user_id_str) : (gpointer)janus_uint64_dup(p->user_id), pl);
+	if(room->events_scheduled)
+		return;
+	room->events_scheduled = TRUE;
+	janus_refcount_increase(&room->ref);
+	janus_videoroom_pending_events *events = g_malloc(sizeof(janus_videoroom_pending_events));
+	events->room = room;
+	events->due = janus_get_monotonic_time() + (gint64)publisher_events_delay*1000;
+	g_async_queue_push(pending_events, events);
+}
+static void janus_videoroom_flush_publisher_events(janus_videoroom *room) {
+	janus_mutex_lock(&room->mutex);
+	room->events_scheduled = FALSE;
+	if(g_atomic_int_get(&room->destroyed) || room->pending_publishers == NULL ||
+			g_hash_table_size(room->pending_publishers) == 0) {
+		janus_mutex_unlock(&room->mutex);
+		return;
+	}
+	json_t *list = json_array();
+	GHashTableIter iter;
+	gpointer key, value;
+	g_hash_table_iter_init(&iter, room->pending_publishers);
+	while(g_hash_table_iter_next(&iter, NULL, &value))
+		json_array_append(list, (json_t *)value);
+	json_t *pub = json_object();
+	json_object_set_new(pub, "videoroom", json_string("event"));
+	json_object_set_new(pub, "room", string_ids ? json_string(room->room_id_str) : json_integer(room->room_id));
+	json_object_set_new(pub, "publishers", list);
+	/* Publishers in the batch must not be told about themselves, so they get a
+	 * tailored event; everybody else gets the same event, that we broadcast */
+	GPtrArray *handles = g_ptr_array_sized_new(g_hash_table_size(room->participants));
+	g_hash_table_iter_init(&iter, room->participants);
+	while(g_hash_table_iter_next(&iter, &key, &value)) {
+		janus_videoroom_publisher *p = value;
+		if(!p || g_atomic_int_get(&p->destroyed) || !p->session || !p->session->handle)
+			continue;
+		json_t *own = g_hash_table_lookup(room->pending_publishers, key);
+		if(own == NULL) {
+			g_ptr_array_add(handles, p->session->handle);
+			continue;
+		}
+		if(json_array_size(list) == 1)
+			continue;
+		json_t *others = json_array();
+		size_t index = 0;
+		json_t *pl = NULL;
+		json_array_foreach(list, index, pl) {
+			if(pl != own)
+				json_array_append(others, pl);
 		}
+		json_t *event = json_object();
+		json_object_set_new(event, "videoroom", json_string("event"));
+		json_object_set_new(event, "room", string_ids ? json_string(room->room_id_str) : json_integer(room->room_id));
+		json_object_set_new(event, "publishers", others);
+		int ret = gateway->push_event(p->session->handle, &janus_videoroom_plugin, NULL, event, NULL);
+		JANUS_LOG(LOG_VERB, "  >> %d (%s)\n", ret, janus_get_api_error(ret));
+		json_decref(event);
+	}
+	if(handles->len > 0) {
+		int ret = gateway->push_event_broadcast((janus_plugin_session **)handles->pdata, handles->len, &janus_videoroom_plugin, pub);
+		JANUS_LOG(LOG_VERB, "  >> Notified %d participants about %zu publishers\n", ret, json_array_size(list));
+	}
+	g_ptr_array_free(handles, TRUE);
+	json_decref(pub);
+	g_hash_table_remove_all(room->pending_publishers);
+	janus_mutex_unlock(&room->mutex);
+}
+static void *janus_videoroom_events_thread(void *data) {
+	JANUS_LOG(LOG_VERB, "Joining VideoRoom events thread\n");
+	janus_videoroom_pending_events *events = NULL;
+	while(!g_atomic_int_get(&stopping)) {
+		events = g_async_queue_pop(pending_events);
+		if(events == &exit_events)
+			break;
+		gint64 wait = events->due - janus_get_monotonic_time();
+		if(wait > 0)
+			g_usleep(wait);
+		if(!g_atomic_int_get(&stopping))
+			janus_videoroom_flush_publisher_events(events->room);
+		janus_refcount_decrease(&events->room->ref);
+		g_free(events);
+	}
+	/* Get rid of the events we didn't send */
+	while((events = g_async_queue_try_pop(pending_events)) != NULL) {
+		if(events == &exit_events)
+			continue;
+		janus_refcount_decrease(&events->room->ref);
+		g_free(events);
 	}
+	JANUS_LOG(LOG_VERB, "Leaving VideoRoom events thread\n");
+	return NULL;
 }
 
 static void janus_videoroom_notify_about_publisher(janus_videoroom_publisher *p, gboolean update) {
 	if(p == NULL)
 		return;
 	/* Notify all other participants that there's a new boy in town */
-	json_t *list = json_array();
 	json_t *pl = json_object();
 	json_object_set_new(pl, "id", string_ids ? json_string(p->user_id_str) : json_integer(p->user_id));
 	if(p->display)
@@ -4354,18 +5626,24 @@ static void janus_videoroom_notify_about_publisher(janus_videoroom_publisher *p,
 		temp = temp->next;
 	}
 	json_object_set_new(pl, "streams", media);
-	json_array_append_new(list, pl);
-	json_t *pub = json_object();
-	json_object_set_new(pub, "videoroom", json_string("event"));
-	json_object_set_new(pub, "room", string_ids ? json_string(p->room_id_str) : json_integer(p->room_id));
-	json_object_set_new(pub, "publishers", list);
  	janus_videoroom *room = p->room;
- 	if(room && !g_atomic_int_get(&room->destroyed)) {
- 		janus_refcount_increase(&room->ref);
-		janus_videoroom_notify_participants(p, pub, FALSE);
- 		janus_refcount_decrease(&room->ref);
+	if(publisher_events_delay > 0 && room && !g_atomic_int_get(&room->destroyed)) {
+		/* We'll send this later, together with other publisher events */
+		janus_videoroom_schedule_publisher_event(room, p, pl);
+	} else {
+		json_t *list = json_array();
+		json_array_append_new(list, pl);
+		json_t *pub = json_object();
+		json_object_set_new(pub, "videoroom", json_string("event"));
+		json_object_set_new(pub, "room", string_ids ? json_string(p->room_id_str) : json_integer(p->room_id));
+		json_object_set_new(pub, "publishers", list);
+		if(room && !g_atomic_int_get(&room->destroyed)) {
+			janus_refcount_increase(&room->ref);
+			janus_videoroom_notify_participants(p, pub, FALSE);
+			janus_refcount_decrease(&room->ref);
+		}
+		json_decref(pub);
 	}
-	json_decref(pub);
 	/* Also notify event handlers */
 	if(notify_events && gateway->events_is_enabled()) {
 		json_t *info = json_object();
@@ -4436,19 +5714,19 @@ static void janus_videoroom_leave_or_unpublish(janus_videoroom_publisher *partic
 	/* we need to check if the room still exists, may have been destroyed already */
 	if(participant->room == NULL)
 		return;
-	janus_mutex_lock(&rooms_mutex);
+	janus_rwlock_read_lock(&rooms_rwlock);
 	if(!g_hash_table_lookup(rooms, string_ids ? (gpointer)participant->room_id_str : (gpointer)&participant->room_id)) {
 		JANUS_LOG(LOG_ERR, "No such room (%s)\n", participant->room_id_str);
-		janus_mutex_unlock(&rooms_mutex);
+		janus_rwlock_read_unlock(&rooms_rwlock);
 		return;
 	}
 	janus_videoroom *room = participant->room;
 	if(!room || g_atomic_int_get(&room->destroyed)) {
-		janus_mutex_unlock(&rooms_mutex);
+		janus_rwlock_read_unlock(&rooms_rwlock);
 		return;
 	}
 	janus_refcount_increase(&room->ref);
-	janus_mutex_unlock(&rooms_mutex);
+	janus_rwlock_read_unlock(&rooms_rwlock);
 	janus_mutex_lock(&room->mutex);
 	if (!participant->room) {
 		janus_mutex_unlock(&room->mutex);
@@ -4464,6 +5742,11 @@ static void janus_videoroom_leave_or_unpublish(janus_videoroom_publisher *partic
 		json_object_set_new(event, "metadata", json_deep_copy(participant->metadata));
 	json_object_set_new(event, is_leaving ? (kicked ? "kicked" : "leaving") : "unpublished",
 		string_ids ? json_string(participant->user_id_str) : json_integer(participant->user_id));
+	/* If we were still waiting to tell participants about this publisher, don't */
+	if(room->pending_publishers != NULL) {
+		g_hash_table_remove(room->pending_publishers,
+			string_ids ? (gpointer)participant->user_id_str : (gpointer)&participant->user_id);
+	}
 	janus_videoroom_notify_participants(participant, event, FALSE);
 	/* Also notify event handlers */
 	if(notify_events && gateway->events_is_enabled()) {
@@ -4478,6 +5761,14 @@ static void janus_videoroom_leave_or_unpublish(janus_videoroom_publisher *partic
 		gateway->notify_event(&janus_videoroom_plugin, NULL, info);
 	}
 	if(is_leaving) {
+		if(participant->room->remote_nodes != NULL) {
+			/* Stop cascading this publisher to remote nodes */
+			GHashTableIter iter;
+			gpointer value;
+			g_hash_table_iter_init(&iter, participant->room->remote_nodes);
+			while(g_hash_table_iter_next(&iter, NULL, &value))
+				janus_videoroom_remote_node_detach((janus_videoroom_remote_node *)value, participant);
+		}
 		g_hash_table_remove(participant->room->participants,
 			string_ids ? (gpointer)participant->user_id_str : (gpointer)&participant->user_id);
 		g_hash_table_remove(participant->room->private_ids, GUINT_TO_POINTER(participant->pvt_id));
@@ -4557,6 +5848,39 @@ void janus_videoroom_destroy_session(janus_plugin_session *handle, int *error) {
 	return;
 }
 
+/* The Janus instance started or stopped draining: let all users know, so
+ * that they can move to another instance (e.g., with a new handle there) */
+void janus_videoroom_drain(gboolean draining) {
+	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
+		return;
+	JANUS_LOG(LOG_INFO, "Notifying users the instance is %s\n", draining ? "draining" : "not draining anymore");
+	/* Take a reference to all sessions first, so that we don't push events with the lock held */
+	GList *list = NULL;
+	GHashTableIter iter;
+	gpointer value;
+	janus_mutex_lock(&sessions_mutex);
+	g_hash_table_iter_init(&iter, sessions);
+	while(g_hash_table_iter_next(&iter, NULL, &value)) {
+		janus_videoroom_session *session = (janus_videoroom_session *)value;
+		if(session == NULL || g_atomic_int_get(&session->destroyed))
+			continue;
+		janus_refcount_increase(&session->ref);
+		list = g_list_prepend(list, session);
+	}
+	janus_mutex_unlock(&sessions_mutex);
+	while(list != NULL) {
+		janus_videoroom_session *session = (janus_videoroom_session *)list->data;
+		json_t *event = json_object();
+		json_object_set_new(event, "videoroom", json_string("event"));
+		json_object_set_new(event, "draining", draining ? json_true() : json_false());
+		int ret = gateway->push_event(session->handle, &janus_videoroom_plugin, NULL, event, NULL);
+		JANUS_LOG(LOG_VERB, "  >> Pushing event: %d (%s)\n", ret, janus_get_api_error(ret));
+		json_decref(event);
+		janus_refcount_decrease(&session->ref);
+		list = g_list_delete_link(list, list);
+	}
+}
+
 json_t *janus_videoroom_query_session(janus_plugin_session *handle) {
 	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized)) {
 		return NULL;
@@ -4673,7 +5997,7 @@ json_t *janus_videoroom_query_session(janus_plugin_session *handle) {
 }
 
 static int janus_videoroom_access_room(json_t *root, gboolean check_modify, gboolean check_join, janus_videoroom **videoroom, char *error_cause, int error_cause_size) {
-	/* rooms_mutex has to be locked */
+	/* rooms_rwlock has to be locked (at least for reading) */
 	int error_code = 0;
 	json_t *room = json_object_get(root, "room");
 	guint64 room_id = 0;
@@ -4841,6 +6165,7 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		json_t *h264profile = json_object_get(root, "h264_profile");
 		json_t *fec = json_object_get(root, "opus_fec");
 		json_t *dtx = json_object_get(root, "opus_dtx");
+		json_t *red = json_object_get(root, "opus_red");
 		json_t *audiolevel_ext = json_object_get(root, "audiolevel_ext");
 		json_t *audiolevel_event = json_object_get(root, "audiolevel_event");
 		json_t *audio_active_packets = json_object_get(root, "audio_active_packets");
@@ -4848,9 +6173,22 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		json_t *videoorient_ext = json_object_get(root, "videoorient_ext");
 		json_t *playoutdelay_ext = json_object_get(root, "playoutdelay_ext");
 		json_t *transport_wide_cc_ext = json_object_get(root, "transport_wide_cc_ext");
+		json_t *bwe = json_object_get(root, "bwe");
+		json_t *active_speakers = json_object_get(root, "active_speakers");
+		json_t *audio_last_n = json_object_get(root, "audio_last_n");
+		json_t *keyframe_cache = json_object_get(root, "keyframe_cache");
 		json_t *notify_joining = json_object_get(root, "notify_joining");
 		json_t *record = json_object_get(root, "record");
 		json_t *rec_dir = json_object_get(root, "rec_dir");
+		json_t *rec_substream = json_object_get(root, "rec_substream");
+		json_t *rec_temporal = json_object_get(root, "rec_temporal");
+		if((rec_substream && json_integer_value(rec_substream) > 2) ||
+				(rec_temporal && json_integer_value(rec_temporal) > 2)) {
+			JANUS_LOG(LOG_ERR, "Invalid element (rec_substream and rec_temporal must be between 0 and 2)\n");
+			error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
+			g_snprintf(error_cause, 512, "Invalid element (rec_substream and rec_temporal must be between 0 and 2)");
+			goto prepare_response;
+		}
 		json_t *lock_record = json_object_get(root, "lock_record");
 		json_t *permanent = json_object_get(root, "permanent");
 		if(allowed) {
@@ -4893,12 +6231,12 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		if(room_id == 0 && room_id_str == NULL) {
 			JANUS_LOG(LOG_WARN, "Desired room ID is empty, which is not allowed... picking random ID instead\n");
 		}
-		janus_mutex_lock(&rooms_mutex);
+		janus_rwlock_write_lock(&rooms_rwlock);
 		if(room_id > 0 || room_id_str != NULL) {
 			/* Let's make sure the room doesn't exist already */
 			if(g_hash_table_lookup(rooms, string_ids ? (gpointer)room_id_str : (gpointer)&room_id) != NULL) {
 				/* It does... */
-				janus_mutex_unlock(&rooms_mutex);
+				janus_rwlock_write_unlock(&rooms_rwlock);
 				error_code = JANUS_VIDEOROOM_ERROR_ROOM_EXISTS;
 				JANUS_LOG(LOG_ERR, "Room %s already exists!\n", room_id_str);
 				g_snprintf(error_cause, 512, "Room %s already exists", room_id_str);
@@ -4907,6 +6245,7 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		}
 		/* Create the room */
 		janus_videoroom *videoroom = g_malloc0(sizeof(janus_videoroom));
+		janus_usage_init(&videoroom->usage);
 		/* Generate a random ID */
 		gboolean room_id_allocated = FALSE;
 		if(!string_ids && room_id == 0) {
@@ -4971,34 +6310,7 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		if(fir_freq)
 			videoroom->fir_freq = json_integer_value(fir_freq);
 		/* If we need helper threads, spawn them now */
-		videoroom->helper_threads = json_integer_value(threads);;
-		if(videoroom->helper_threads > 0) {
-			GError *error = NULL;
-			char tname[16];
-			int i=0;
-			for(i=0; i<videoroom->helper_threads; i++) {
-				janus_videoroom_helper *helper = g_malloc0(sizeof(janus_videoroom_helper));
-				helper->id = i+1;
-				helper->room = videoroom;
-				helper->subscribers = g_hash_table_new(NULL, NULL);
-				helper->queued_packets = g_async_queue_new_full((GDestroyNotify)janus_videoroom_rtp_relay_packet_free);
-				janus_mutex_init(&helper->mutex);
-				janus_refcount_init(&helper->ref, janus_videoroom_helper_free);
-				/* Spawn a thread and add references */
-				g_snprintf(tname, sizeof(tname), "vhelp %u-%s", helper->id, videoroom->room_id_str);
-				janus_refcount_increase(&videoroom->ref);
-				janus_refcount_increase(&helper->ref);
-				helper->thread = g_thread_try_new(tname, &janus_videoroom_helper_thread, helper, &error);
-				if(error != NULL) {
-					/* TODO Should this be a hard failure? */
-					JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the helper thread...\n",
-						error->code, error->message ? error->message : "??");
-				} else {
-					janus_refcount_increase(&helper->ref);
-					videoroom->threads = g_list_append(videoroom->threads, helper);
-				}
-			}
-		}
+		janus_videoroom_helpers_spawn(videoroom, json_integer_value(threads));
 		/* By default, we force Opus as the only audio codec */
 		videoroom->acodec[0] = JANUS_AUDIOCODEC_OPUS;
 		videoroom->acodec[1] = JANUS_AUDIOCODEC_NONE;
@@ -5090,6 +6402,17 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 				JANUS_LOG(LOG_WARN, "DTX is only supported for rooms that allow Opus: disabling it...\n");
 			}
 		}
+		if(red) {
+			videoroom->do_opusred = json_is_true(red);
+			if(videoroom->acodec[0] != JANUS_AUDIOCODEC_OPUS &&
+					videoroom->acodec[1] != JANUS_AUDIOCODEC_OPUS &&
+					videoroom->acodec[2] != JANUS_AUDIOCODEC_OPUS &&
+					videoroom->acodec[3] != JANUS_AUDIOCODEC_OPUS &&
+					videoroom->acodec[4] != JANUS_AUDIOCODEC_OPUS) {
+				videoroom->do_opusred = FALSE;
+				JANUS_LOG(LOG_WARN, "RED is only supported for rooms that allow Opus: disabling it...\n");
+			}
+		}
 		videoroom->audiolevel_ext = audiolevel_ext ? json_is_true(audiolevel_ext) : TRUE;
 		videoroom->audiolevel_event = audiolevel_event ? json_is_true(audiolevel_event) : FALSE;
 		if(videoroom->audiolevel_event) {
@@ -5109,6 +6432,12 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		videoroom->videoorient_ext = videoorient_ext ? json_is_true(videoorient_ext) : TRUE;
 		videoroom->playoutdelay_ext = playoutdelay_ext ? json_is_true(playoutdelay_ext) : TRUE;
 		videoroom->transport_wide_cc_ext = transport_wide_cc_ext ? json_is_true(transport_wide_cc_ext) : TRUE;
+		videoroom->bwe = bwe ? json_is_true(bwe) : FALSE;
+		videoroom->active_speakers = active_speakers ? json_integer_value(active_speakers) : 0;
+		videoroom->audio_last_n = audio_last_n ? json_integer_value(audio_last_n) : 0;
+		videoroom->keyframe_cache = keyframe_cache ? json_is_true(keyframe_cache) : FALSE;
+		videoroom->rec_substream = rec_substream ? json_integer_value(rec_substream) : 2;
+		videoroom->rec_temporal = rec_temporal ? json_integer_value(rec_temporal) : 2;
 		/* By default, the VideoRoom plugin does not notify about participants simply joining the room.
 		   It only notifies when the participant actually starts publishing media. */
 		videoroom->notify_joining = notify_joining ? json_is_true(notify_joining) : FALSE;
@@ -5122,6 +6451,7 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 			videoroom->lock_record = json_is_true(lock_record);
 		}
 		g_atomic_int_set(&videoroom->destroyed, 0);
+		janus_mutex_init(&videoroom->speakers_mutex);
 		janus_mutex_init(&videoroom->mutex);
 		janus_refcount_init(&videoroom->ref, janus_videoroom_room_free);
 		videoroom->participants = g_hash_table_new_full(string_ids ? g_str_hash : g_int64_hash, string_ids ? g_str_equal : g_int64_equal,
@@ -5236,6 +6566,8 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 				janus_config_add(config, c, janus_config_item_create("opus_fec", "true"));
 			if(videoroom->do_opusdtx)
 				janus_config_add(config, c, janus_config_item_create("opus_dtx", "true"));
+			if(videoroom->do_opusred)
+				janus_config_add(config, c, janus_config_item_create("opus_red", "true"));
 			if(videoroom->room_secret)
 				janus_config_add(config, c, janus_config_item_create("secret", videoroom->room_secret));
 			if(videoroom->room_pin)
@@ -5258,12 +6590,32 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 			janus_config_add(config, c, janus_config_item_create("videoorient_ext", videoroom->videoorient_ext ? "true" : "false"));
 			janus_config_add(config, c, janus_config_item_create("playoutdelay_ext", videoroom->playoutdelay_ext ? "true" : "false"));
 			janus_config_add(config, c, janus_config_item_create("transport_wide_cc_ext", videoroom->transport_wide_cc_ext ? "true" : "false"));
+			if(videoroom->bwe)
+				janus_config_add(config, c, janus_config_item_create("bwe", "true"));
+			if(videoroom->active_speakers > 0) {
+				g_snprintf(value, BUFSIZ, "%d", videoroom->active_speakers);
+				janus_config_add(config, c, janus_config_item_create("active_speakers", value));
+			}
+			if(videoroom->audio_last_n > 0) {
+				g_snprintf(value, BUFSIZ, "%d", videoroom->audio_last_n);
+				janus_config_add(config, c, janus_config_item_create("audio_last_n", value));
+			}
+			if(videoroom->keyframe_cache)
+				janus_config_add(config, c, janus_config_item_create("keyframe_cache", "true"));
 			if(videoroom->notify_joining)
 				janus_config_add(config, c, janus_config_item_create("notify_joining", "true"));
 			if(videoroom->record)
 				janus_config_add(config, c, janus_config_item_create("record", "true"));
 			if(videoroom->rec_dir)
 				janus_config_add(config, c, janus_config_item_create("rec_dir", videoroom->rec_dir));
+			if(videoroom->rec_substream < 2) {
+				g_snprintf(value, BUFSIZ, "%d", videoroom->rec_substream);
+				janus_config_add(config, c, janus_config_item_create("rec_substream", value));
+			}
+			if(videoroom->rec_temporal < 2) {
+				g_snprintf(value, BUFSIZ, "%d", videoroom->rec_temporal);
+				janus_config_add(config, c, janus_config_item_create("rec_temporal", value));
+			}
 			if(videoroom->lock_record)
 				janus_config_add(config, c, janus_config_item_create("lock_record", "true"));
 			if(videoroom->helper_threads > 0) {
@@ -5271,7 +6623,8 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 				janus_config_add(config, c, janus_config_item_create("threads", value));
 			}
 			/* Save modified configuration */
-			if(janus_config_save(config, config_folder, JANUS_VIDEOROOM_PACKAGE) < 0)
+			if((config_journal == NULL || janus_config_journal_put(config_journal, c) < 0) &&
+					janus_config_save(config, config_folder, JANUS_VIDEOROOM_PACKAGE) < 0)
 				save = FALSE;	/* This will notify the user the room is not permanent */
 			janus_mutex_unlock(&config_mutex);
 		}
@@ -5288,7 +6641,7 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 			JANUS_LOG(LOG_VERB, "  ::: [%s][%s] %"SCNu32", max %d publishers, FIR frequency of %d seconds\n",
 				vr->room_id_str, vr->room_name, vr->bitrate, vr->max_publishers, vr->fir_freq);
 		}
-		janus_mutex_unlock(&rooms_mutex);
+		janus_rwlock_write_unlock(&rooms_rwlock);
 		/* Send info back */
 		response = json_object();
 		json_object_set_new(response, "videoroom", json_string("created"));
@@ -5340,11 +6693,11 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 			g_snprintf(error_cause, 512, "No configuration file, can't edit room permanently");
 			goto prepare_response;
 		}
-		janus_mutex_lock(&rooms_mutex);
+		janus_rwlock_write_lock(&rooms_rwlock);
 		janus_videoroom *videoroom = NULL;
 		error_code = janus_videoroom_access_room(root, TRUE, FALSE, &videoroom, error_cause, sizeof(error_cause));
 		if(error_code != 0) {
-			janus_mutex_unlock(&rooms_mutex);
+			janus_rwlock_write_unlock(&rooms_rwlock);
 			goto prepare_response;
 		}
 		/* Edit the room properties that were provided */
@@ -5433,6 +6786,8 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 				janus_config_add(config, c, janus_config_item_create("opus_fec", "true"));
 			if(videoroom->do_opusdtx)
 				janus_config_add(config, c, janus_config_item_create("opus_dtx", "true"));
+			if(videoroom->do_opusred)
+				janus_config_add(config, c, janus_config_item_create("opus_red", "true"));
 			if(videoroom->room_secret)
 				janus_config_add(config, c, janus_config_item_create("secret", videoroom->room_secret));
 			if(videoroom->room_pin)
@@ -5455,12 +6810,32 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 			janus_config_add(config, c, janus_config_item_create("videoorient_ext", videoroom->videoorient_ext ? "true" : "false"));
 			janus_config_add(config, c, janus_config_item_create("playoutdelay_ext", videoroom->playoutdelay_ext ? "true" : "false"));
 			janus_config_add(config, c, janus_config_item_create("transport_wide_cc_ext", videoroom->transport_wide_cc_ext ? "true" : "false"));
+			if(videoroom->bwe)
+				janus_config_add(config, c, janus_config_item_create("bwe", "true"));
+			if(videoroom->active_speakers > 0) {
+				g_snprintf(value, BUFSIZ, "%d", videoroom->active_speakers);
+				janus_config_add(config, c, janus_config_item_create("active_speakers", value));
+			}
+			if(videoroom->audio_last_n > 0) {
+				g_snprintf(value, BUFSIZ, "%d", videoroom->audio_last_n);
+				janus_config_add(config, c, janus_config_item_create("audio_last_n", value));
+			}
+			if(videoroom->keyframe_cache)
+				janus_config_add(config, c, janus_config_item_create("keyframe_cache", "true"));
 			if(videoroom->notify_joining)
 				janus_config_add(config, c, janus_config_item_create("notify_joining", "true"));
 			if(videoroom->record)
 				janus_config_add(config, c, janus_config_item_create("record", "true"));
 			if(videoroom->rec_dir)
 				janus_config_add(config, c, janus_config_item_create("rec_dir", videoroom->rec_dir));
+			if(videoroom->rec_substream < 2) {
+				g_snprintf(value, BUFSIZ, "%d", videoroom->rec_substream);
+				janus_config_add(config, c, janus_config_item_create("rec_substream", value));
+			}
+			if(videoroom->rec_temporal < 2) {
+				g_snprintf(value, BUFSIZ, "%d", videoroom->rec_temporal);
+				janus_config_add(config, c, janus_config_item_create("rec_temporal", value));
+			}
 			if(videoroom->lock_record)
 				janus_config_add(config, c, janus_config_item_create("lock_record", "true"));
 			if(videoroom->helper_threads > 0) {
@@ -5468,11 +6843,12 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 				janus_config_add(config, c, janus_config_item_create("threads", value));
 			}
 			/* Save modified configuration */
-			if(janus_config_save(config, config_folder, JANUS_VIDEOROOM_PACKAGE) < 0)
+			if((config_journal == NULL || janus_config_journal_put(config_journal, c) < 0) &&
+					janus_config_save(config, config_folder, JANUS_VIDEOROOM_PACKAGE) < 0)
 				save = FALSE;	/* This will notify the user the room changes are not permanent */
 			janus_mutex_unlock(&config_mutex);
 		}
-		janus_mutex_unlock(&rooms_mutex);
+		janus_rwlock_write_unlock(&rooms_rwlock);
 		/* Send info back */
 		response = json_object();
 		json_object_set_new(response, "videoroom", json_string("edited"));
@@ -5522,11 +6898,11 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		} else {
 			room_id_str = (char *)json_string_value(room);
 		}
-		janus_mutex_lock(&rooms_mutex);
+		janus_rwlock_write_lock(&rooms_rwlock);
 		janus_videoroom *videoroom = NULL;
 		error_code = janus_videoroom_access_room(root, TRUE, FALSE, &videoroom, error_cause, sizeof(error_cause));
 		if(error_code != 0) {
-			janus_mutex_unlock(&rooms_mutex);
+			janus_rwlock_write_unlock(&rooms_rwlock);
 			goto prepare_response;
 		}
 		/* Remove room, but add a reference until we're done */
@@ -5563,7 +6939,7 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 			json_object_set_new(info, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
 			gateway->notify_event(&janus_videoroom_plugin, session ? session->handle : NULL, info);
 		}
-		janus_mutex_unlock(&rooms_mutex);
+		janus_rwlock_write_unlock(&rooms_rwlock);
 		if(save) {
 			/* This change is permanent: save to the configuration file too
 			 * FIXME: We should check if anything fails... */
@@ -5574,7 +6950,8 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 			g_snprintf(cat, BUFSIZ, "room-%s", room_id_str);
 			janus_config_remove(config, NULL, cat);
 			/* Save modified configuration */
-			if(janus_config_save(config, config_folder, JANUS_VIDEOROOM_PACKAGE) < 0)
+			if((config_journal == NULL || janus_config_journal_remove(config_journal, cat) < 0) &&
+					janus_config_save(config, config_folder, JANUS_VIDEOROOM_PACKAGE) < 0)
 				save = FALSE;	/* This will notify the user the room destruction is not permanent */
 			janus_mutex_unlock(&config_mutex);
 		}
@@ -5603,7 +6980,7 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 			}
 		}
 		json_t *list = json_array();
-		janus_mutex_lock(&rooms_mutex);
+		janus_rwlock_read_lock(&rooms_rwlock);
 		GHashTableIter iter;
 		gpointer value;
 		g_hash_table_iter_init(&iter, rooms);
@@ -5642,8 +7019,14 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 					json_object_set_new(rl, "opus_fec", json_true());
 				if(room->do_opusdtx)
 					json_object_set_new(rl, "opus_dtx", json_true());
+				if(room->do_opusred)
+					json_object_set_new(rl, "opus_red", json_true());
 				json_object_set_new(rl, "record", room->record ? json_true() : json_false());
 				json_object_set_new(rl, "rec_dir", json_string(room->rec_dir));
+				if(room->rec_substream < 2)
+					json_object_set_new(rl, "rec_substream", json_integer(room->rec_substream));
+				if(room->rec_temporal < 2)
+					json_object_set_new(rl, "rec_temporal", json_integer(room->rec_temporal));
 				json_object_set_new(rl, "lock_record", room->lock_record ? json_true() : json_false());
 				json_object_set_new(rl, "num_participants", json_integer(g_hash_table_size(room->participants)));
 				json_object_set_new(rl, "audiolevel_ext", room->audiolevel_ext ? json_true() : json_false());
@@ -5655,11 +7038,17 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 				json_object_set_new(rl, "videoorient_ext", room->videoorient_ext ? json_true() : json_false());
 				json_object_set_new(rl, "playoutdelay_ext", room->playoutdelay_ext ? json_true() : json_false());
 				json_object_set_new(rl, "transport_wide_cc_ext", room->transport_wide_cc_ext ? json_true() : json_false());
+				json_object_set_new(rl, "bwe", room->bwe ? json_true() : json_false());
+				if(room->active_speakers > 0)
+					json_object_set_new(rl, "active_speakers", json_integer(room->active_speakers));
+				if(room->audio_last_n > 0)
+					json_object_set_new(rl, "audio_last_n", json_integer(room->audio_last_n));
+				json_object_set_new(rl, "keyframe_cache", room->keyframe_cache ? json_true() : json_false());
 				json_array_append_new(list, rl);
 			}
 			janus_refcount_decrease(&room->ref);
 		}
-		janus_mutex_unlock(&rooms_mutex);
+		janus_rwlock_read_unlock(&rooms_rwlock);
 		response = json_object();
 		json_object_set_new(response, "videoroom", json_string("success"));
 		json_object_set_new(response, "list", list);
@@ -5863,15 +7252,15 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 			srtp_crypto = json_string_value(s_crypto);
 		}
 		/* Look for room and publisher */
-		janus_mutex_lock(&rooms_mutex);
+		janus_rwlock_read_lock(&rooms_rwlock);
 		janus_videoroom *videoroom = NULL;
 		error_code = janus_videoroom_access_room(root, TRUE, FALSE, &videoroom, error_cause, sizeof(error_cause));
 		if(error_code != 0) {
-			janus_mutex_unlock(&rooms_mutex);
+			janus_rwlock_read_unlock(&rooms_rwlock);
 			goto prepare_response;
 		}
 		janus_refcount_increase(&videoroom->ref);
-		janus_mutex_unlock(&rooms_mutex);
+		janus_rwlock_read_unlock(&rooms_rwlock);
 		janus_mutex_lock(&videoroom->mutex);
 		janus_videoroom_publisher *publisher = g_hash_table_lookup(videoroom->participants,
 			string_ids ? (gpointer)publisher_id_str : (gpointer)&publisher_id);
@@ -6392,15 +7781,15 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 			publisher_id_str = (char *)json_string_value(pub_id);
 		}
 		guint32 stream_id = json_integer_value(id);
-		janus_mutex_lock(&rooms_mutex);
+		janus_rwlock_read_lock(&rooms_rwlock);
 		janus_videoroom *videoroom = NULL;
 		error_code = janus_videoroom_access_room(root, TRUE, FALSE, &videoroom, error_cause, sizeof(error_cause));
 		if(error_code != 0) {
-			janus_mutex_unlock(&rooms_mutex);
+			janus_rwlock_read_unlock(&rooms_rwlock);
 			goto prepare_response;
 		}
 		janus_refcount_increase(&videoroom->ref);
-		janus_mutex_unlock(&rooms_mutex);
+		janus_rwlock_read_unlock(&rooms_rwlock);
 		janus_mutex_lock(&videoroom->mutex);
 		janus_videoroom_publisher *publisher = g_hash_table_lookup(videoroom->participants,
 			string_ids ? (gpointer)publisher_id_str : (gpointer)&publisher_id);
@@ -6491,9 +7880,9 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		} else {
 			room_id_str = (char *)json_string_value(room);
 		}
-		janus_mutex_lock(&rooms_mutex);
+		janus_rwlock_read_lock(&rooms_rwlock);
 		gboolean room_exists = g_hash_table_contains(rooms, string_ids ? (gpointer)room_id_str : (gpointer)&room_id);
-		janus_mutex_unlock(&rooms_mutex);
+		janus_rwlock_read_unlock(&rooms_rwlock);
 		response = json_object();
 		json_object_set_new(response, "videoroom", json_string("success"));
 		json_object_set_new(response, "room", string_ids ? json_string(room_id_str) : json_integer(room_id));
@@ -6537,15 +7926,15 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		} else {
 			room_id_str = (char *)json_string_value(room);
 		}
-		janus_mutex_lock(&rooms_mutex);
+		janus_rwlock_read_lock(&rooms_rwlock);
 		janus_videoroom *videoroom = NULL;
 		error_code = janus_videoroom_access_room(root, TRUE, FALSE, &videoroom, error_cause, sizeof(error_cause));
 		if(error_code != 0) {
-			janus_mutex_unlock(&rooms_mutex);
+			janus_rwlock_read_unlock(&rooms_rwlock);
 			goto prepare_response;
 		}
 		janus_refcount_increase(&videoroom->ref);
-		janus_mutex_unlock(&rooms_mutex);
+		janus_rwlock_read_unlock(&rooms_rwlock);
 		janus_mutex_lock(&videoroom->mutex);
 		if(!strcasecmp(action_text, "enable")) {
 			JANUS_LOG(LOG_VERB, "Enabling the check on allowed authorization tokens for room %s\n", room_id_str);
@@ -6648,15 +8037,15 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		} else {
 			room_id_str = (char *)json_string_value(room);
 		}
-		janus_mutex_lock(&rooms_mutex);
+		janus_rwlock_read_lock(&rooms_rwlock);
 		janus_videoroom *videoroom = NULL;
 		error_code = janus_videoroom_access_room(root, TRUE, FALSE, &videoroom, error_cause, sizeof(error_cause));
 		if(error_code != 0) {
-			janus_mutex_unlock(&rooms_mutex);
+			janus_rwlock_read_unlock(&rooms_rwlock);
 			goto prepare_response;
 		}
 		janus_refcount_increase(&videoroom->ref);
-		janus_mutex_unlock(&rooms_mutex);
+		janus_rwlock_read_unlock(&rooms_rwlock);
 		janus_mutex_lock(&videoroom->mutex);
 		guint64 user_id = 0;
 		char user_id_num[30], *user_id_str = NULL;
@@ -6767,15 +8156,15 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		} else {
 			room_id_str = (char *)json_string_value(room);
 		}
-		janus_mutex_lock(&rooms_mutex);
+		janus_rwlock_read_lock(&rooms_rwlock);
 		janus_videoroom *videoroom = NULL;
 		error_code = janus_videoroom_access_room(root, TRUE, FALSE, &videoroom, error_cause, sizeof(error_cause));
 		if(error_code != 0) {
-			janus_mutex_unlock(&rooms_mutex);
+			janus_rwlock_read_unlock(&rooms_rwlock);
 			goto prepare_response;
 		}
 		janus_refcount_increase(&videoroom->ref);
-		janus_mutex_unlock(&rooms_mutex);
+		janus_rwlock_read_unlock(&rooms_rwlock);
 		janus_mutex_lock(&videoroom->mutex);
 		guint64 user_id = 0;
 		char user_id_num[30], *user_id_str = NULL;
@@ -6881,15 +8270,15 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		} else {
 			room_id_str = (char *)json_string_value(room);
 		}
-		janus_mutex_lock(&rooms_mutex);
+		janus_rwlock_read_lock(&rooms_rwlock);
 		janus_videoroom *videoroom = NULL;
 		error_code = janus_videoroom_access_room(root, FALSE, FALSE, &videoroom, error_cause, sizeof(error_cause));
 		if(error_code != 0) {
-			janus_mutex_unlock(&rooms_mutex);
+			janus_rwlock_read_unlock(&rooms_rwlock);
 			goto prepare_response;
 		}
 		janus_refcount_increase(&videoroom->ref);
-		janus_mutex_unlock(&rooms_mutex);
+		janus_rwlock_read_unlock(&rooms_rwlock);
 		/* Return a list of all participants (whether they're publishing or not) */
 		json_t *list = json_array();
 		GHashTableIter iter;
@@ -6959,15 +8348,15 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		} else {
 			room_id_str = (char *)json_string_value(room);
 		}
-		janus_mutex_lock(&rooms_mutex);
+		janus_rwlock_read_lock(&rooms_rwlock);
 		janus_videoroom *videoroom = NULL;
 		error_code = janus_videoroom_access_room(root, TRUE, FALSE, &videoroom, error_cause, sizeof(error_cause));
 		if(error_code != 0) {
-			janus_mutex_unlock(&rooms_mutex);
+			janus_rwlock_read_unlock(&rooms_rwlock);
 			goto prepare_response;
 		}
 		janus_refcount_increase(&videoroom->ref);
-		janus_mutex_unlock(&rooms_mutex);
+		janus_rwlock_read_unlock(&rooms_rwlock);
 		/* Return a list of all forwarders */
 		json_t *list = json_array();
 		GHashTableIter iter;
@@ -7041,15 +8430,15 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		gboolean recording_active = json_is_true(record);
 		JANUS_LOG(LOG_VERB, "Enable Recording: %d\n", (recording_active ? 1 : 0));
 		/* Lookup room */
-		janus_mutex_lock(&rooms_mutex);
+		janus_rwlock_read_lock(&rooms_rwlock);
 		janus_videoroom *videoroom = NULL;
 		error_code = janus_videoroom_access_room(root, TRUE, FALSE, &videoroom, error_cause, sizeof(error_cause));
 		if(error_code != 0) {
-			janus_mutex_unlock(&rooms_mutex);
+			janus_rwlock_read_unlock(&rooms_rwlock);
 			goto prepare_response;
 		}
 		janus_refcount_increase(&videoroom->ref);
-		janus_mutex_unlock(&rooms_mutex);
+		janus_rwlock_read_unlock(&rooms_rwlock);
 		janus_mutex_lock(&videoroom->mutex);
 		/* Set recording status */
 		gboolean room_new_recording_active = recording_active;
@@ -7227,15 +8616,15 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		}
 		host = resolved_host;
 		/* Look for room and publisher */
-		janus_mutex_lock(&rooms_mutex);
+		janus_rwlock_read_lock(&rooms_rwlock);
 		janus_videoroom *videoroom = NULL;
 		error_code = janus_videoroom_access_room(root, TRUE, FALSE, &videoroom, error_cause, sizeof(error_cause));
 		if(error_code != 0) {
-			janus_mutex_unlock(&rooms_mutex);
+			janus_rwlock_read_unlock(&rooms_rwlock);
 			goto prepare_response;
 		}
 		janus_refcount_increase(&videoroom->ref);
-		janus_mutex_unlock(&rooms_mutex);
+		janus_rwlock_read_unlock(&rooms_rwlock);
 		janus_mutex_lock(&videoroom->mutex);
 		janus_videoroom_publisher *publisher = g_hash_table_lookup(videoroom->participants,
 			string_ids ? (gpointer)publisher_id_str : (gpointer)&publisher_id);
@@ -7290,73 +8679,22 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 				goto prepare_response;
 			}
 		}
-		/* Add a new RTP forwarder for each of the publisher streams */
-		janus_videoroom_publisher_stream *ps = NULL;
-		janus_rtp_forwarder *f = NULL;
-		gboolean rtcp_added = FALSE, add_rtcp = FALSE;
-		GList *temp = publisher->streams;
-		while(temp) {
-			ps = (janus_videoroom_publisher_stream *)temp->data;
-			if(ps == NULL || g_atomic_int_get(&ps->destroyed)) {
-				temp = temp->next;
-				continue;
-			}
-			if(ps->type == JANUS_VIDEOROOM_MEDIA_AUDIO) {
-				/* Audio stream */
-				f = janus_videoroom_rtp_forwarder_add_helper(publisher, ps,
-					host, port, -1, 0,
-					(REMOTE_PUBLISHER_BASE_SSRC + ps->mindex*REMOTE_PUBLISHER_SSRC_STEP),
-					FALSE, srtp_suite, srtp_crypto, 0, FALSE, FALSE);
-				if(f != NULL)
-					f->metadata = g_strdup(remote_id);
-			} else if(ps->type == JANUS_VIDEOROOM_MEDIA_VIDEO) {
-				/* Video stream */
-				add_rtcp = (!rtcp_added && rtcp_port > 0);
-				f = janus_videoroom_rtp_forwarder_add_helper(publisher, ps,
-					host, port, add_rtcp ? rtcp_port : -1, 0,
-					(REMOTE_PUBLISHER_BASE_SSRC + ps->mindex*REMOTE_PUBLISHER_SSRC_STEP),
-					FALSE, srtp_suite, srtp_crypto, 0, TRUE, FALSE);
-				if(f != NULL)
-					f->metadata = g_strdup(remote_id);
-				if(add_rtcp)
-					rtcp_added = TRUE;
-				/* Check if there's simulcast substreams we need to relay too */
-				if(ps->vssrc[1] || ps->rid[1]) {
-					f = janus_videoroom_rtp_forwarder_add_helper(publisher, ps,
-						host, port, -1, 0,
-						(REMOTE_PUBLISHER_BASE_SSRC + ps->mindex*REMOTE_PUBLISHER_SSRC_STEP + 1),
-						FALSE, srtp_suite, srtp_crypto, 1, TRUE, FALSE);
-					if(f != NULL)
-						f->metadata = g_strdup(remote_id);
-				}
-				if(ps->vssrc[2] || ps->rid[2]) {
-					f = janus_videoroom_rtp_forwarder_add_helper(publisher, ps,
-						host, port, -1, 0,
-						(REMOTE_PUBLISHER_BASE_SSRC + ps->mindex*REMOTE_PUBLISHER_SSRC_STEP + 2),
-						FALSE, srtp_suite, srtp_crypto, 2, TRUE, FALSE);
-					if(f != NULL)
-						f->metadata = g_strdup(remote_id);
-				}
-			} else {
-				/* Data stream */
-				f = janus_videoroom_rtp_forwarder_add_helper(publisher, ps,
-					host, port, -1, 0,
-					(REMOTE_PUBLISHER_BASE_SSRC + ps->mindex*REMOTE_PUBLISHER_SSRC_STEP),
-					FALSE, 0, NULL, 0, FALSE, TRUE);
-				if(f != NULL)
-					f->metadata = g_strdup(remote_id);
-			}
-			temp = temp->next;
-		}
 		/* Keep track of this remotization */
-		janus_videoroom_remote_recipient *recipient = g_malloc(sizeof(janus_videoroom_remote_recipient));
+		janus_videoroom_remote_recipient *recipient = g_malloc0(sizeof(janus_videoroom_remote_recipient));
 		recipient->remote_id = g_strdup(remote_id);
 		recipient->host = g_strdup(host);
 		recipient->port = port;
 		recipient->rtcp_port = rtcp_port;
-		recipient->rtcp_added = rtcp_added;
+		recipient->ssrc_base = REMOTE_PUBLISHER_BASE_SSRC;
 		recipient->srtp_suite = srtp_suite;
 		recipient->srtp_crypto = srtp_crypto ? g_strdup(srtp_crypto) : NULL;
+		/* Add a new RTP forwarder for each of the publisher streams */
+		GList *temp = publisher->streams;
+		while(temp) {
+			janus_videoroom_remote_recipient_add_stream(publisher,
+				(janus_videoroom_publisher_stream *)temp->data, recipient);
+			temp = temp->next;
+		}
 		g_hash_table_insert(publisher->remote_recipients, g_strdup(remote_id), recipient);
 		/* Done */
 		janus_mutex_unlock(&publisher->rtp_forwarders_mutex);
@@ -7398,15 +8736,15 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		}
 		if(error_code != 0)
 			goto prepare_response;
-		janus_mutex_lock(&rooms_mutex);
+		janus_rwlock_read_lock(&rooms_rwlock);
 		janus_videoroom *videoroom = NULL;
 		error_code = janus_videoroom_access_room(root, TRUE, FALSE, &videoroom, error_cause, sizeof(error_cause));
 		if(error_code != 0) {
-			janus_mutex_unlock(&rooms_mutex);
+			janus_rwlock_read_unlock(&rooms_rwlock);
 			goto prepare_response;
 		}
 		janus_refcount_increase(&videoroom->ref);
-		janus_mutex_unlock(&rooms_mutex);
+		janus_rwlock_read_unlock(&rooms_rwlock);
 		janus_mutex_lock(&videoroom->mutex);
 		const char *remote_id = json_string_value(json_object_get(root, "remote_id"));
 		json_t *pub_id = json_object_get(root, "publisher_id");
@@ -7445,28 +8783,7 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 			goto prepare_response;
 		}
 		/* Now get rid of all RTP forwarders with that ID */
-		GList *temp = publisher->streams;
-		while(temp) {
-			janus_videoroom_publisher_stream *ps = (janus_videoroom_publisher_stream *)temp->data;
-			janus_refcount_increase(&ps->ref);
-			janus_mutex_lock(&ps->rtp_forwarders_mutex);
-			GHashTableIter iter;
-			gpointer value;
-			g_hash_table_iter_init(&iter, ps->rtp_forwarders);
-			while(g_hash_table_iter_next(&iter, NULL, &value)) {
-				janus_rtp_forwarder *f = (janus_rtp_forwarder *)value;
-				if(f->metadata != NULL && !strcmp((char *)f->metadata, remote_id)) {
-					/* We found one, get rid of it */
-					uint32_t stream_id = f->stream_id;
-					g_hash_table_iter_remove(&iter);
-					/* Remove from global index too */
-					g_hash_table_remove(publisher->rtp_forwarders, GUINT_TO_POINTER(stream_id));
-				}
-			}
-			janus_mutex_unlock(&ps->rtp_forwarders_mutex);
-			janus_refcount_decrease(&ps->ref);
-			temp = temp->next;
-		}
+		janus_videoroom_remote_recipient_remove_forwarders(publisher, remote_id);
 		janus_mutex_unlock(&publisher->rtp_forwarders_mutex);
 		janus_mutex_unlock(&publisher->streams_mutex);
 		/* Done */
@@ -7503,15 +8820,15 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		}
 		if(error_code != 0)
 			goto prepare_response;
-		janus_mutex_lock(&rooms_mutex);
+		janus_rwlock_read_lock(&rooms_rwlock);
 		janus_videoroom *videoroom = NULL;
 		error_code = janus_videoroom_access_room(root, TRUE, FALSE, &videoroom, error_cause, sizeof(error_cause));
 		if(error_code != 0) {
-			janus_mutex_unlock(&rooms_mutex);
+			janus_rwlock_read_unlock(&rooms_rwlock);
 			goto prepare_response;
 		}
 		janus_refcount_increase(&videoroom->ref);
-		janus_mutex_unlock(&rooms_mutex);
+		janus_rwlock_read_unlock(&rooms_rwlock);
 		janus_mutex_lock(&videoroom->mutex);
 		json_t *id = json_object_get(root, "publisher_id");
 		guint64 publisher_id = 0;
@@ -7563,77 +8880,38 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		janus_refcount_decrease(&publisher->ref);
 		janus_refcount_decrease(&videoroom->ref);
 		goto prepare_response;
-	} else if(!strcasecmp(request_text, "add_remote_publisher")) {
-		/* Add a new remote publisher */
-		if(!string_ids) {
-			JANUS_VALIDATE_JSON_OBJECT(root, room_parameters,
-				error_code, error_cause, TRUE,
-				JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
-		} else {
-			JANUS_VALIDATE_JSON_OBJECT(root, roomstr_parameters,
-				error_code, error_cause, TRUE,
-				JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
-		}
+	} else if(!strcasecmp(request_text, "add_remote_node")) {
+		/* Cascade a whole room to a remote VideoRoom instance: all the local
+		 * publishers, current and future, will be remotized automatically */
+		JANUS_VALIDATE_JSON_OBJECT(root, remote_node_parameters,
+			error_code, error_cause, TRUE,
+			JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
 		if(error_code != 0)
 			goto prepare_response;
 		if(!string_ids) {
-			JANUS_VALIDATE_JSON_OBJECT(root, idopt_parameters,
+			JANUS_VALIDATE_JSON_OBJECT(root, room_parameters,
 				error_code, error_cause, TRUE,
 				JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
 		} else {
-			JANUS_VALIDATE_JSON_OBJECT(root, idstropt_parameters,
+			JANUS_VALIDATE_JSON_OBJECT(root, roomstr_parameters,
 				error_code, error_cause, TRUE,
 				JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
 		}
 		if(error_code != 0)
 			goto prepare_response;
-		JANUS_VALIDATE_JSON_OBJECT(root, remote_publisher_parameters,
-			error_code, error_cause, TRUE,
-			JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
-		if(error_code != 0)
-			goto prepare_response;
-		/* Validate the stream parameters too */
-		json_t *streams = json_object_get(root, "streams");
-		if(json_array_size(streams) == 0) {
-			error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
-			JANUS_LOG(LOG_ERR, "Invalid element value (streams can't be empty)\n");
-			g_snprintf(error_cause, 512, "Invalid element value (streams can't be empty)");
-			goto prepare_response;
-		}
-		size_t i = 0;
-		for(i=0; i<json_array_size(streams); i++) {
-			json_t *s = json_array_get(streams, i);
-			JANUS_VALIDATE_JSON_OBJECT(s, remote_publisher_stream_parameters,
+		if(lock_rtpfwd && admin_key != NULL) {
+			/* An admin key was specified: make sure it was provided, and that it's valid */
+			JANUS_VALIDATE_JSON_OBJECT(root, adminkey_parameters,
 				error_code, error_cause, TRUE,
 				JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
 			if(error_code != 0)
-				break;
-			const char *type = json_string_value(json_object_get(s, "type"));
-			janus_videoroom_media mtype = janus_videoroom_media_from_str(type);
-			if(mtype == JANUS_VIDEOROOM_MEDIA_NONE) {
-				error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
-				JANUS_LOG(LOG_ERR, "Invalid element value (type)\n");
-				g_snprintf(error_cause, 512, "Invalid element value (type)");
-				break;
-			}
-			if(mtype == JANUS_VIDEOROOM_MEDIA_AUDIO || mtype == JANUS_VIDEOROOM_MEDIA_VIDEO) {
-				const char *codec = json_string_value(json_object_get(s, "codec"));
-				if(codec == NULL) {
-					error_code = JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT;
-					JANUS_LOG(LOG_ERR, "Missing mandatory element (codec)\n");
-					g_snprintf(error_cause, 512, "Missing mandatory element (codec)");
-					break;
-				}
-				if((mtype == JANUS_VIDEOROOM_MEDIA_AUDIO && janus_audiocodec_from_name(codec) == JANUS_AUDIOCODEC_NONE) ||
-						(mtype == JANUS_VIDEOROOM_MEDIA_VIDEO && janus_videocodec_from_name(codec) == JANUS_VIDEOCODEC_NONE)) {
-					error_code = JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT;
-					JANUS_LOG(LOG_ERR, "Invalid element value (unsupported codec)\n");
-					g_snprintf(error_cause, 512, "Invalid element value (unsupported codec)");
-					break;
-				}
-			}
+				goto prepare_response;
+			JANUS_CHECK_SECRET(admin_key, root, "admin_key", error_code, error_cause,
+				JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT, JANUS_VIDEOROOM_ERROR_UNAUTHORIZED);
+			if(error_code != 0)
+				goto prepare_response;
 		}
-		/* We may need to SRTP-decrypt this stream */
+		/* We may need to SRTP-encrypt the streams */
 		int srtp_suite = 0;
 		const char *srtp_crypto = NULL;
 		json_t *s_suite = json_object_get(root, "srtp_suite");
@@ -7647,20 +8925,391 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 				goto prepare_response;
 			}
 			srtp_crypto = json_string_value(s_crypto);
-			JANUS_LOG(LOG_VERB, "SRTP setting s_suite (%d) and s_crypto (%s) on add_remote_publisher\n", srtp_suite, srtp_crypto);
 		}
-		if(error_code != 0)
+		const char *node_id = json_string_value(json_object_get(root, "node_id"));
+		const char *host = json_string_value(json_object_get(root, "host")), *resolved_host = NULL;
+		const char *host_family = json_string_value(json_object_get(root, "host_family"));
+		uint16_t port = json_integer_value(json_object_get(root, "port"));
+		uint16_t rtcp_port = json_integer_value(json_object_get(root, "rtcp_port"));
+		if(port == 0) {
+			JANUS_LOG(LOG_ERR, "Invalid element (port must be a non-zero positive integer)\n");
+			error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
+			g_snprintf(error_cause, 512, "Invalid element (port must be a non-zero positive integer)");
 			goto prepare_response;
-		/* Now access the room */
-		janus_mutex_lock(&rooms_mutex);
-		janus_videoroom *videoroom = NULL;
-		error_code = janus_videoroom_access_room(root, TRUE, FALSE, &videoroom, error_cause, sizeof(error_cause));
-		if(error_code != 0) {
-			janus_mutex_unlock(&rooms_mutex);
+		}
+		int family = 0;
+		if(host_family) {
+			if(!strcasecmp(host_family, "ipv4")) {
+				family = AF_INET;
+			} else if(!strcasecmp(host_family, "ipv6")) {
+				family = AF_INET6;
+			} else {
+				JANUS_LOG(LOG_ERR, "Unsupported protocol family (%s)\n", host_family);
+				error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
+				g_snprintf(error_cause, 512, "Unsupported protocol family (%s)", host_family);
+				goto prepare_response;
+			}
+		}
+		/* Check if we need to resolve this host address */
+		struct addrinfo *res = NULL, *start = NULL;
+		janus_network_address addr;
+		janus_network_address_string_buffer addr_buf;
+		struct addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		if(family != 0)
+			hints.ai_family = family;
+		if(getaddrinfo(host, NULL, family != 0 ? &hints : NULL, &res) == 0) {
+			start = res;
+			while(res != NULL) {
+				if(janus_network_address_from_sockaddr(res->ai_addr, &addr) == 0 &&
+						janus_network_address_to_string_buffer(&addr, &addr_buf) == 0) {
+					/* Resolved */
+					resolved_host = janus_network_address_string_from_buffer(&addr_buf);
+					freeaddrinfo(start);
+					start = NULL;
+					break;
+				}
+				res = res->ai_next;
+			}
+		}
+		if(resolved_host == NULL) {
+			if(start)
+				freeaddrinfo(start);
+			JANUS_LOG(LOG_ERR, "Could not resolve address (%s)...\n", host);
+			error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
+			g_snprintf(error_cause, 512, "Could not resolve address (%s)...", host);
+			goto prepare_response;
+		}
+		host = resolved_host;
+		/* Now access the room */
+		janus_rwlock_read_lock(&rooms_rwlock);
+		janus_videoroom *videoroom = NULL;
+		error_code = janus_videoroom_access_room(root, TRUE, FALSE, &videoroom, error_cause, sizeof(error_cause));
+		if(error_code != 0) {
+			janus_rwlock_read_unlock(&rooms_rwlock);
+			goto prepare_response;
+		}
+		janus_refcount_increase(&videoroom->ref);
+		janus_rwlock_read_unlock(&rooms_rwlock);
+		janus_mutex_lock(&videoroom->mutex);
+		if(videoroom->remote_nodes != NULL && g_hash_table_lookup(videoroom->remote_nodes, node_id) != NULL) {
+			janus_mutex_unlock(&videoroom->mutex);
+			janus_refcount_decrease(&videoroom->ref);
+			JANUS_LOG(LOG_ERR, "Remote node already exists (%s)\n", node_id);
+			error_code = JANUS_VIDEOROOM_ERROR_ID_EXISTS;
+			g_snprintf(error_cause, 512, "Remote node already exists (%s)", node_id);
+			goto prepare_response;
+		}
+		janus_videoroom_remote_node *node = g_malloc0(sizeof(janus_videoroom_remote_node));
+		node->node_id = g_strdup(node_id);
+		node->remote_id = g_strdup_printf("node-%s", node_id);
+		node->host = g_strdup(host);
+		node->port = port;
+		node->rtcp_port = rtcp_port;
+		node->srtp_suite = srtp_suite;
+		node->srtp_crypto = srtp_crypto ? g_strdup(srtp_crypto) : NULL;
+		node->next_slot = 1;
+		node->publishers = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_videoroom_publisher_dereference);
+		node->rtcp_fd = -1;
+		janus_mutex_init(&node->mutex);
+		janus_refcount_init(&node->ref, janus_videoroom_remote_node_free);
+		if(rtcp_port > 0) {
+			/* We'll receive the RTCP feedback for all publishers on a single socket */
+			janus_network_address iface;
+			janus_network_address_nullify(&iface);
+			char local[46];
+			node->rtcp_fd = janus_videoroom_create_fd(0, INADDR_ANY, &iface, local, sizeof(local));
+			if(node->rtcp_fd < 0) {
+				janus_mutex_unlock(&videoroom->mutex);
+				janus_refcount_decrease(&videoroom->ref);
+				janus_refcount_decrease(&node->ref);
+				JANUS_LOG(LOG_ERR, "Could not open UDP socket for remote node RTCP, %d (%s)\n",
+					errno, g_strerror(errno));
+				error_code = JANUS_VIDEOROOM_ERROR_UNKNOWN_ERROR;
+				g_snprintf(error_cause, 512, "Could not open UDP socket for remote node RTCP");
+				goto prepare_response;
+			}
+			/* Prepare the address we'll latch to */
+			struct sockaddr_storage bound = { 0 };
+			socklen_t boundlen = sizeof(bound);
+			getsockname(node->rtcp_fd, (struct sockaddr *)&bound, &boundlen);
+			if(bound.ss_family == AF_INET6) {
+				struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *)&node->rtcp_addr;
+				addr6->sin6_family = AF_INET6;
+				addr6->sin6_port = htons(rtcp_port);
+				if(strchr(host, ':') != NULL) {
+					inet_pton(AF_INET6, host, &addr6->sin6_addr);
+				} else {
+					/* Use an IPv4-mapped address, since the socket is dual stack */
+					char mapped[64];
+					g_snprintf(mapped, sizeof(mapped), "::ffff:%s", host);
+					inet_pton(AF_INET6, mapped, &addr6->sin6_addr);
+				}
+			} else {
+				struct sockaddr_in *addr4 = (struct sockaddr_in *)&node->rtcp_addr;
+				addr4->sin_family = AF_INET;
+				addr4->sin_port = htons(rtcp_port);
+				inet_pton(AF_INET, host, &addr4->sin_addr);
+			}
+			GError *error = NULL;
+			char tname[16];
+			g_snprintf(tname, sizeof(tname), "vcascade %s", node_id);
+			janus_refcount_increase(&node->ref);
+			node->thread = g_thread_try_new(tname, janus_videoroom_remote_node_thread, node, &error);
+			if(error != NULL) {
+				janus_mutex_unlock(&videoroom->mutex);
+				janus_refcount_decrease(&videoroom->ref);
+				janus_refcount_decrease(&node->ref);
+				janus_refcount_decrease(&node->ref);
+				JANUS_LOG(LOG_ERR, "Could not spawn thread for remote node, %d (%s)\n",
+					error->code, error->message ? error->message : "??");
+				g_error_free(error);
+				error_code = JANUS_VIDEOROOM_ERROR_UNKNOWN_ERROR;
+				g_snprintf(error_cause, 512, "Could not spawn thread for remote node");
+				goto prepare_response;
+			}
+		}
+		if(videoroom->remote_nodes == NULL) {
+			videoroom->remote_nodes = g_hash_table_new_full(g_str_hash, g_str_equal,
+				(GDestroyNotify)g_free, (GDestroyNotify)janus_videoroom_remote_node_destroy);
+		}
+		g_hash_table_insert(videoroom->remote_nodes, g_strdup(node_id), node);
+		/* Cascade all the local publishers we have already */
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, videoroom->participants);
+		while(g_hash_table_iter_next(&iter, NULL, &value))
+			janus_videoroom_remote_node_attach(node, (janus_videoroom_publisher *)value);
+		janus_mutex_unlock(&videoroom->mutex);
+		JANUS_LOG(LOG_INFO, "[%s] Cascading room to remote node %s (%s:%"SCNu16")\n",
+			videoroom->room_id_str, node_id, host, port);
+		/* Done */
+		response = json_object();
+		json_object_set_new(response, "videoroom", json_string("success"));
+		json_object_set_new(response, "room", string_ids ? json_string(videoroom->room_id_str) : json_integer(videoroom->room_id));
+		json_object_set_new(response, "node_id", json_string(node_id));
+		janus_refcount_decrease(&videoroom->ref);
+		goto prepare_response;
+	} else if(!strcasecmp(request_text, "remove_remote_node")) {
+		/* Stop cascading a room to a remote VideoRoom instance */
+		JANUS_VALIDATE_JSON_OBJECT(root, remove_remote_node_parameters,
+			error_code, error_cause, TRUE,
+			JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
+		if(error_code != 0)
+			goto prepare_response;
+		if(!string_ids) {
+			JANUS_VALIDATE_JSON_OBJECT(root, room_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
+		} else {
+			JANUS_VALIDATE_JSON_OBJECT(root, roomstr_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
+		}
+		if(error_code != 0)
+			goto prepare_response;
+		const char *node_id = json_string_value(json_object_get(root, "node_id"));
+		janus_rwlock_read_lock(&rooms_rwlock);
+		janus_videoroom *videoroom = NULL;
+		error_code = janus_videoroom_access_room(root, TRUE, FALSE, &videoroom, error_cause, sizeof(error_cause));
+		if(error_code != 0) {
+			janus_rwlock_read_unlock(&rooms_rwlock);
 			goto prepare_response;
 		}
 		janus_refcount_increase(&videoroom->ref);
-		janus_mutex_unlock(&rooms_mutex);
+		janus_rwlock_read_unlock(&rooms_rwlock);
+		janus_mutex_lock(&videoroom->mutex);
+		janus_videoroom_remote_node *node = videoroom->remote_nodes ?
+			g_hash_table_lookup(videoroom->remote_nodes, node_id) : NULL;
+		if(node == NULL) {
+			janus_mutex_unlock(&videoroom->mutex);
+			janus_refcount_decrease(&videoroom->ref);
+			JANUS_LOG(LOG_ERR, "No such remote node (%s)\n", node_id);
+			error_code = JANUS_VIDEOROOM_ERROR_NO_SUCH_FEED;
+			g_snprintf(error_cause, 512, "No such remote node (%s)", node_id);
+			goto prepare_response;
+		}
+		/* Stop cascading all the publishers, and get rid of the node */
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, videoroom->participants);
+		while(g_hash_table_iter_next(&iter, NULL, &value))
+			janus_videoroom_remote_node_detach(node, (janus_videoroom_publisher *)value);
+		g_hash_table_remove(videoroom->remote_nodes, node_id);
+		janus_mutex_unlock(&videoroom->mutex);
+		/* Done */
+		response = json_object();
+		json_object_set_new(response, "videoroom", json_string("success"));
+		json_object_set_new(response, "room", string_ids ? json_string(videoroom->room_id_str) : json_integer(videoroom->room_id));
+		json_object_set_new(response, "node_id", json_string(node_id));
+		janus_refcount_decrease(&videoroom->ref);
+		goto prepare_response;
+	} else if(!strcasecmp(request_text, "list_remote_nodes")) {
+		/* List all the remote nodes a room is cascaded to, and the slots of the publishers */
+		if(!string_ids) {
+			JANUS_VALIDATE_JSON_OBJECT(root, room_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
+		} else {
+			JANUS_VALIDATE_JSON_OBJECT(root, roomstr_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
+		}
+		if(error_code != 0)
+			goto prepare_response;
+		janus_rwlock_read_lock(&rooms_rwlock);
+		janus_videoroom *videoroom = NULL;
+		error_code = janus_videoroom_access_room(root, TRUE, FALSE, &videoroom, error_cause, sizeof(error_cause));
+		if(error_code != 0) {
+			janus_rwlock_read_unlock(&rooms_rwlock);
+			goto prepare_response;
+		}
+		janus_refcount_increase(&videoroom->ref);
+		janus_rwlock_read_unlock(&rooms_rwlock);
+		janus_mutex_lock(&videoroom->mutex);
+		json_t *list = json_array();
+		if(videoroom->remote_nodes != NULL) {
+			GHashTableIter iter, iter_p;
+			gpointer value, key_p, value_p;
+			g_hash_table_iter_init(&iter, videoroom->remote_nodes);
+			while(g_hash_table_iter_next(&iter, NULL, &value)) {
+				janus_videoroom_remote_node *node = (janus_videoroom_remote_node *)value;
+				json_t *rn = json_object();
+				json_object_set_new(rn, "node_id", json_string(node->node_id));
+				json_object_set_new(rn, "host", json_string(node->host));
+				json_object_set_new(rn, "port", json_integer(node->port));
+				if(node->rtcp_port > 0)
+					json_object_set_new(rn, "rtcp_port", json_integer(node->rtcp_port));
+				json_t *publishers = json_array();
+				janus_mutex_lock(&node->mutex);
+				g_hash_table_iter_init(&iter_p, node->publishers);
+				while(g_hash_table_iter_next(&iter_p, &key_p, &value_p)) {
+					janus_videoroom_publisher *p = (janus_videoroom_publisher *)value_p;
+					json_t *pl = json_object();
+					json_object_set_new(pl, "id", string_ids ? json_string(p->user_id_str) : json_integer(p->user_id));
+					json_object_set_new(pl, "slot", json_integer(GPOINTER_TO_UINT(key_p)));
+					json_array_append_new(publishers, pl);
+				}
+				janus_mutex_unlock(&node->mutex);
+				json_object_set_new(rn, "publishers", publishers);
+				json_array_append_new(list, rn);
+			}
+		}
+		janus_mutex_unlock(&videoroom->mutex);
+		/* Done */
+		response = json_object();
+		json_object_set_new(response, "videoroom", json_string("success"));
+		json_object_set_new(response, "room", string_ids ? json_string(videoroom->room_id_str) : json_integer(videoroom->room_id));
+		json_object_set_new(response, "list", list);
+		janus_refcount_decrease(&videoroom->ref);
+		goto prepare_response;
+	} else if(!strcasecmp(request_text, "add_remote_publisher")) {
+		/* Add a new remote publisher */
+		if(!string_ids) {
+			JANUS_VALIDATE_JSON_OBJECT(root, room_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
+		} else {
+			JANUS_VALIDATE_JSON_OBJECT(root, roomstr_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
+		}
+		if(error_code != 0)
+			goto prepare_response;
+		if(!string_ids) {
+			JANUS_VALIDATE_JSON_OBJECT(root, idopt_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
+		} else {
+			JANUS_VALIDATE_JSON_OBJECT(root, idstropt_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
+		}
+		if(error_code != 0)
+			goto prepare_response;
+		JANUS_VALIDATE_JSON_OBJECT(root, remote_publisher_parameters,
+			error_code, error_cause, TRUE,
+			JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
+		if(error_code != 0)
+			goto prepare_response;
+		/* Validate the stream parameters too */
+		json_t *streams = json_object_get(root, "streams");
+		if(json_array_size(streams) == 0) {
+			error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
+			JANUS_LOG(LOG_ERR, "Invalid element value (streams can't be empty)\n");
+			g_snprintf(error_cause, 512, "Invalid element value (streams can't be empty)");
+			goto prepare_response;
+		}
+		size_t i = 0;
+		for(i=0; i<json_array_size(streams); i++) {
+			json_t *s = json_array_get(streams, i);
+			JANUS_VALIDATE_JSON_OBJECT(s, remote_publisher_stream_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
+			if(error_code != 0)
+				break;
+			const char *type = json_string_value(json_object_get(s, "type"));
+			janus_videoroom_media mtype = janus_videoroom_media_from_str(type);
+			if(mtype == JANUS_VIDEOROOM_MEDIA_NONE) {
+				error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
+				JANUS_LOG(LOG_ERR, "Invalid element value (type)\n");
+				g_snprintf(error_cause, 512, "Invalid element value (type)");
+				break;
+			}
+			if(mtype == JANUS_VIDEOROOM_MEDIA_AUDIO || mtype == JANUS_VIDEOROOM_MEDIA_VIDEO) {
+				const char *codec = json_string_value(json_object_get(s, "codec"));
+				if(codec == NULL) {
+					error_code = JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT;
+					JANUS_LOG(LOG_ERR, "Missing mandatory element (codec)\n");
+					g_snprintf(error_cause, 512, "Missing mandatory element (codec)");
+					break;
+				}
+				if((mtype == JANUS_VIDEOROOM_MEDIA_AUDIO && janus_audiocodec_from_name(codec) == JANUS_AUDIOCODEC_NONE) ||
+						(mtype == JANUS_VIDEOROOM_MEDIA_VIDEO && janus_videocodec_from_name(codec) == JANUS_VIDEOCODEC_NONE)) {
+					error_code = JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT;
+					JANUS_LOG(LOG_ERR, "Invalid element value (unsupported codec)\n");
+					g_snprintf(error_cause, 512, "Invalid element value (unsupported codec)");
+					break;
+				}
+			}
+		}
+		/* We may need to SRTP-decrypt this stream */
+		int srtp_suite = 0;
+		const char *srtp_crypto = NULL;
+		json_t *s_suite = json_object_get(root, "srtp_suite");
+		json_t *s_crypto = json_object_get(root, "srtp_crypto");
+		if(s_suite && s_crypto) {
+			srtp_suite = json_integer_value(s_suite);
+			if(srtp_suite != 32 && srtp_suite != 80) {
+				JANUS_LOG(LOG_ERR, "Invalid SRTP suite (%d)\n", srtp_suite);
+				error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
+				g_snprintf(error_cause, 512, "Invalid SRTP suite (%d)", srtp_suite);
+				goto prepare_response;
+			}
+			srtp_crypto = json_string_value(s_crypto);
+			JANUS_LOG(LOG_VERB, "SRTP setting s_suite (%d) and s_crypto (%s) on add_remote_publisher\n", srtp_suite, srtp_crypto);
+		}
+		if(error_code != 0)
+			goto prepare_response;
+		/* Check if this remote publisher is cascaded from a node, and so shares a listener with others */
+		const char *node_id = json_string_value(json_object_get(root, "node"));
+		guint slot = json_integer_value(json_object_get(root, "slot"));
+		if(node_id != NULL && (slot == 0 || slot > (G_MAXUINT32 - REMOTE_PUBLISHER_BASE_SSRC)/REMOTE_NODE_SLOT_STEP)) {
+			JANUS_LOG(LOG_ERR, "Invalid element (slot must be a valid non-zero positive integer when node is provided)\n");
+			error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
+			g_snprintf(error_cause, 512, "Invalid element (slot must be a valid non-zero positive integer when node is provided)");
+			goto prepare_response;
+		}
+		/* Now access the room */
+		janus_rwlock_read_lock(&rooms_rwlock);
+		janus_videoroom *videoroom = NULL;
+		error_code = janus_videoroom_access_room(root, TRUE, FALSE, &videoroom, error_cause, sizeof(error_cause));
+		if(error_code != 0) {
+			janus_rwlock_read_unlock(&rooms_rwlock);
+			goto prepare_response;
+		}
+		janus_refcount_increase(&videoroom->ref);
+		janus_rwlock_read_unlock(&rooms_rwlock);
 		janus_mutex_lock(&videoroom->mutex);
 		/* Prepare a new fake publisher on behalf of the remote one */
 		json_t *display = json_object_get(root, "display");
@@ -7748,38 +9397,80 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		uint16_t rtcp_port = json_integer_value(json_object_get(root, "rtcp_port"));
 		char host[46];
 		host[0] = '\0';
-		int fd = janus_videoroom_create_fd(port, mcast ? inet_addr(mcast) : INADDR_ANY, &miface, host, sizeof(host));
-		if(fd < 0) {
-			if(user_id_allocated)
-				g_free(user_id_str);
-			janus_mutex_unlock(&videoroom->mutex);
-			janus_refcount_decrease(&videoroom->ref);
-			JANUS_LOG(LOG_ERR, "Could not open UDP socket for RTP stream for remote publisher, %d (%s)\n",
-				errno, g_strerror(errno));
-			error_code = JANUS_VIDEOROOM_ERROR_UNKNOWN_ERROR;
-			g_snprintf(error_cause, 512, "Could not open UDP socket for RTP stream");
-			goto prepare_response;
+		int fd = -1, rtcp_fd = -1;
+		janus_videoroom_node_listener *listener = NULL;
+		if(node_id != NULL && videoroom->node_listeners != NULL) {
+			/* If we have other remote publishers from the same node, reuse their listener */
+			listener = g_hash_table_lookup(videoroom->node_listeners, node_id);
+			if(listener != NULL) {
+				janus_mutex_lock(&listener->mutex);
+				gboolean taken = (g_hash_table_lookup(listener->publishers, GUINT_TO_POINTER(slot)) != NULL);
+				janus_mutex_unlock(&listener->mutex);
+				if(taken) {
+					if(user_id_allocated)
+						g_free(user_id_str);
+					janus_mutex_unlock(&videoroom->mutex);
+					janus_refcount_decrease(&videoroom->ref);
+					JANUS_LOG(LOG_ERR, "Slot %u already taken for remote node %s\n", slot, node_id);
+					error_code = JANUS_VIDEOROOM_ERROR_ID_EXISTS;
+					g_snprintf(error_cause, 512, "Slot %u already taken for remote node %s", slot, node_id);
+					goto prepare_response;
+				}
+				port = listener->port;
+				rtcp_port = listener->rtcp_port;
+				g_strlcpy(host, listener->host, sizeof(host));
+			}
 		}
-		port = janus_videoroom_get_fd_port(fd);
-		int rtcp_fd = janus_videoroom_create_fd(rtcp_port, mcast ? inet_addr(mcast) : INADDR_ANY, &miface, host, sizeof(host));
-		if(rtcp_fd < 0) {
-			close(fd);
-			if(user_id_allocated)
-				g_free(user_id_str);
-			janus_mutex_unlock(&videoroom->mutex);
-			janus_refcount_decrease(&videoroom->ref);
-			JANUS_LOG(LOG_ERR, "Could not open UDP socket for remote publisher RTCP, %d (%s)\n",
-				errno, g_strerror(errno));
-			error_code = JANUS_VIDEOROOM_ERROR_UNKNOWN_ERROR;
-			g_snprintf(error_cause, 512, "Could not open UDP socket for RTP stream");
-			goto prepare_response;
+		if(listener == NULL) {
+			fd = janus_videoroom_create_fd(port, mcast ? inet_addr(mcast) : INADDR_ANY, &miface, host, sizeof(host));
+			if(fd < 0) {
+				if(user_id_allocated)
+					g_free(user_id_str);
+				janus_mutex_unlock(&videoroom->mutex);
+				janus_refcount_decrease(&videoroom->ref);
+				JANUS_LOG(LOG_ERR, "Could not open UDP socket for RTP stream for remote publisher, %d (%s)\n",
+					errno, g_strerror(errno));
+				error_code = JANUS_VIDEOROOM_ERROR_UNKNOWN_ERROR;
+				g_snprintf(error_cause, 512, "Could not open UDP socket for RTP stream");
+				goto prepare_response;
+			}
+			port = janus_videoroom_get_fd_port(fd);
+			rtcp_fd = janus_videoroom_create_fd(rtcp_port, mcast ? inet_addr(mcast) : INADDR_ANY, &miface, host, sizeof(host));
+			if(rtcp_fd < 0) {
+				close(fd);
+				if(user_id_allocated)
+					g_free(user_id_str);
+				janus_mutex_unlock(&videoroom->mutex);
+				janus_refcount_decrease(&videoroom->ref);
+				JANUS_LOG(LOG_ERR, "Could not open UDP socket for remote publisher RTCP, %d (%s)\n",
+					errno, g_strerror(errno));
+				error_code = JANUS_VIDEOROOM_ERROR_UNKNOWN_ERROR;
+				g_snprintf(error_cause, 512, "Could not open UDP socket for RTP stream");
+				goto prepare_response;
+			}
+			rtcp_port = janus_videoroom_get_fd_port(rtcp_fd);
+		}
+		if(node_id != NULL && listener == NULL) {
+			/* First remote publisher from this node, create a listener others will share */
+			listener = janus_videoroom_node_listener_create(videoroom, node_id, fd, rtcp_fd, host);
+			fd = -1;
+			rtcp_fd = -1;
+			if(listener == NULL) {
+				if(user_id_allocated)
+					g_free(user_id_str);
+				janus_mutex_unlock(&videoroom->mutex);
+				janus_refcount_decrease(&videoroom->ref);
+				error_code = JANUS_VIDEOROOM_ERROR_UNKNOWN_ERROR;
+				g_snprintf(error_cause, 512, "Could not create listener for remote node");
+				goto prepare_response;
+			}
 		}
-		rtcp_port = janus_videoroom_get_fd_port(rtcp_fd);
 		/* We create a dummy session first, that's not actually bound to anything */
 		janus_videoroom_session *session = g_malloc0(sizeof(janus_videoroom_session));
 		session->handle = NULL;
 		session->participant_type = janus_videoroom_p_type_publisher;
 		g_atomic_int_set(&session->started, 1);
+		janus_videoroom_relay_targets_changed();
 		janus_mutex_init(&session->mutex);
 		janus_refcount_init(&session->ref, janus_videoroom_session_free);
 		/* We actually create a publisher instance, which has no associated session but looks like it's publishing */
@@ -7789,6 +9480,8 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		publisher->room_id = videoroom->room_id;
 		publisher->room_id_str = videoroom->room_id_str ? g_strdup(videoroom->room_id_str) : NULL;
 		publisher->room = videoroom;
+		publisher->rec_substream = -1;
+		publisher->rec_temporal = -1;
 		janus_refcount_increase(&videoroom->ref);
 		publisher->user_id = user_id;
 		publisher->user_id_str = user_id_allocated ? user_id_str : g_strdup(user_id_str);
@@ -7798,8 +9491,16 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		publisher->data_mindex = -1;
 		publisher->remote = TRUE;
 		publisher->remote_ssrc_offset = janus_random_uint32();
+		publisher->remote_ssrc_base = REMOTE_PUBLISHER_BASE_SSRC;
 		publisher->remote_fd = fd;
 		publisher->remote_rtcp_fd = rtcp_fd;
+		if(listener != NULL) {
+			/* Media for this remote publisher will be received by the shared listener */
+			publisher->remote_ssrc_base += slot*REMOTE_NODE_SLOT_STEP;
+			janus_refcount_increase(&listener->ref);
+			publisher->remote_node = listener;
+			publisher->remote_slot = slot;
+		}
 		publisher->metadata = metadata ? json_deep_copy(metadata) : NULL;
 		pipe(publisher->pipefd);
 		janus_mutex_init(&publisher->subscribers_mutex);
@@ -7935,9 +9636,9 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 					ps->simulcast = json_is_true(json_object_get(s, "simulcast"));
 					ps->svc = json_is_true(json_object_get(s, "svc"));
 					if(ps->simulcast) {
-						ps->vssrc[0] = publisher->remote_ssrc_offset + REMOTE_PUBLISHER_BASE_SSRC + (mindex*REMOTE_PUBLISHER_SSRC_STEP);
-						ps->vssrc[1] = publisher->remote_ssrc_offset + REMOTE_PUBLISHER_BASE_SSRC + (mindex*REMOTE_PUBLISHER_SSRC_STEP) + 1;
-						ps->vssrc[2] = publisher->remote_ssrc_offset + REMOTE_PUBLISHER_BASE_SSRC + (mindex*REMOTE_PUBLISHER_SSRC_STEP) + 2;
+						ps->vssrc[0] = publisher->remote_ssrc_offset + publisher->remote_ssrc_base + (mindex*REMOTE_PUBLISHER_SSRC_STEP);
+						ps->vssrc[1] = publisher->remote_ssrc_offset + publisher->remote_ssrc_base + (mindex*REMOTE_PUBLISHER_SSRC_STEP) + 1;
+						ps->vssrc[2] = publisher->remote_ssrc_offset + publisher->remote_ssrc_base + (mindex*REMOTE_PUBLISHER_SSRC_STEP) + 2;
 					}
 				}
 				int video_orient_extmap_id = json_integer_value(json_object_get(s, "videoorient_ext_id"));
@@ -7958,6 +9659,7 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 			janus_refcount_increase(&ps->ref);	/* This is for the id-indexed hashtable */
 			janus_refcount_increase(&ps->ref);	/* This is for the mid-indexed hashtable */
 			janus_mutex_init(&ps->subscribers_mutex);
+			janus_mutex_init(&ps->keyframe_mutex);
 			janus_mutex_init(&ps->rtp_forwarders_mutex);
 			ps->rtp_forwarders = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_rtp_forwarder_destroy);
 			janus_mutex_lock(&publisher->streams_mutex);
@@ -7967,6 +9669,13 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 			janus_mutex_unlock(&publisher->streams_mutex);
 			mindex++;
 		}
+		if(listener != NULL) {
+			/* Let the shared listener know where to dispatch media for this slot */
+			janus_mutex_lock(&listener->mutex);
+			janus_refcount_increase(&publisher->ref);
+			g_hash_table_insert(listener->publishers, GUINT_TO_POINTER(slot), publisher);
+			janus_mutex_unlock(&listener->mutex);
+		}
 		/* Done, spawn a thread for this remote publisher */
 		GError *error = NULL;
 		char tname[16];
@@ -7975,6 +9684,7 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		if(error != NULL) {
 			/* Something went wrong */
 			janus_mutex_unlock(&videoroom->mutex);
+			janus_videoroom_node_listener_remove(videoroom, publisher);
 			janus_refcount_decrease(&videoroom->ref);
 			janus_mutex_lock(&publisher->streams_mutex);
 			g_list_free_full(publisher->streams, (GDestroyNotify)(janus_videoroom_publisher_stream_unref));
@@ -8105,15 +9815,15 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		if(error_code != 0)
 			goto prepare_response;
 		/* Now access the room */
-		janus_mutex_lock(&rooms_mutex);
+		janus_rwlock_read_lock(&rooms_rwlock);
 		janus_videoroom *videoroom = NULL;
 		error_code = janus_videoroom_access_room(root, TRUE, FALSE, &videoroom, error_cause, sizeof(error_cause));
 		if(error_code != 0) {
-			janus_mutex_unlock(&rooms_mutex);
+			janus_rwlock_read_unlock(&rooms_rwlock);
 			goto prepare_response;
 		}
 		janus_refcount_increase(&videoroom->ref);
-		janus_mutex_unlock(&rooms_mutex);
+		janus_rwlock_read_unlock(&rooms_rwlock);
 		janus_mutex_lock(&videoroom->mutex);
 		json_t *id = json_object_get(root, "id");
 		guint64 publisher_id = 0;
@@ -8296,9 +10006,9 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 					ps->simulcast = json_is_true(json_object_get(s, "simulcast"));
 					ps->svc = json_is_true(json_object_get(s, "svc"));
 					if(ps->simulcast) {
-						ps->vssrc[0] = publisher->remote_ssrc_offset + REMOTE_PUBLISHER_BASE_SSRC + (mindex*REMOTE_PUBLISHER_SSRC_STEP);
-						ps->vssrc[1] = publisher->remote_ssrc_offset + REMOTE_PUBLISHER_BASE_SSRC + (mindex*REMOTE_PUBLISHER_SSRC_STEP) + 1;
-						ps->vssrc[2] = publisher->remote_ssrc_offset + REMOTE_PUBLISHER_BASE_SSRC + (mindex*REMOTE_PUBLISHER_SSRC_STEP) + 2;
+						ps->vssrc[0] = publisher->remote_ssrc_offset + publisher->remote_ssrc_base + (mindex*REMOTE_PUBLISHER_SSRC_STEP);
+						ps->vssrc[1] = publisher->remote_ssrc_offset + publisher->remote_ssrc_base + (mindex*REMOTE_PUBLISHER_SSRC_STEP) + 1;
+						ps->vssrc[2] = publisher->remote_ssrc_offset + publisher->remote_ssrc_base + (mindex*REMOTE_PUBLISHER_SSRC_STEP) + 2;
 					}
 				}
 				int video_orient_extmap_id = json_integer_value(json_object_get(s, "videoorient_ext_id"));
@@ -8319,6 +10029,7 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 			janus_refcount_increase(&ps->ref);	/* This is for the id-indexed hashtable */
 			janus_refcount_increase(&ps->ref);	/* This is for the mid-indexed hashtable */
 			janus_mutex_init(&ps->subscribers_mutex);
+			janus_mutex_init(&ps->keyframe_mutex);
 			janus_mutex_init(&ps->rtp_forwarders_mutex);
 			ps->rtp_forwarders = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_rtp_forwarder_destroy);
 			publisher->streams = g_list_append(publisher->streams, ps);
@@ -8378,15 +10089,15 @@ static json_t *janus_videoroom_process_synchronous_request(janus_videoroom_sessi
 		}
 		if(error_code != 0)
 			goto prepare_response;
-		janus_mutex_lock(&rooms_mutex);
+		janus_rwlock_read_lock(&rooms_rwlock);
 		janus_videoroom *videoroom = NULL;
 		error_code = janus_videoroom_access_room(root, TRUE, FALSE, &videoroom, error_cause, sizeof(error_cause));
 		if(error_code != 0) {
-			janus_mutex_unlock(&rooms_mutex);
+			janus_rwlock_read_unlock(&rooms_rwlock);
 			goto prepare_response;
 		}
 		janus_refcount_increase(&videoroom->ref);
-		janus_mutex_unlock(&rooms_mutex);
+		janus_rwlock_read_unlock(&rooms_rwlock);
 		janus_mutex_lock(&videoroom->mutex);
 		json_t *id = json_object_get(root, "id");
 		guint64 publisher_id = 0;
@@ -8447,6 +10158,83 @@ prepare_response:
 
 }
 
+/* Helper to suspend or resume the relaying of some streams for a subscriber:
+ * this is meant to be cheap, so it's handled synchronously and only updates
+ * a flag that the relay targets are built from */
+static json_t *janus_videoroom_subscriber_suspend(janus_videoroom_session *session, json_t *root, gboolean suspend,
+		int *error_code, char *error_cause, int error_cause_size) {
+	if(session->participant_type != janus_videoroom_p_type_subscriber) {
+		JANUS_LOG(LOG_ERR, "Only subscribers can suspend streams\n");
+		*error_code = JANUS_VIDEOROOM_ERROR_INVALID_REQUEST;
+		g_snprintf(error_cause, error_cause_size, "Only subscribers can suspend streams");
+		return NULL;
+	}
+	json_t *mids = json_object_get(root, "mids");
+	size_t i = 0;
+	for(i=0; i<json_array_size(mids); i++) {
+		if(!json_is_string(json_array_get(mids, i))) {
+			JANUS_LOG(LOG_ERR, "Invalid element (mids should be an array of strings)\n");
+			*error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
+			g_snprintf(error_cause, error_cause_size, "Invalid element (mids should be an array of strings)");
+			return NULL;
+		}
+	}
+	janus_videoroom_subscriber *subscriber = janus_videoroom_session_get_subscriber(session);
+	if(subscriber == NULL || g_atomic_int_get(&subscriber->destroyed)) {
+		if(subscriber != NULL)
+			janus_refcount_decrease(&subscriber->ref);
+		JANUS_LOG(LOG_ERR, "Invalid subscriber instance\n");
+		*error_code = JANUS_VIDEOROOM_ERROR_UNKNOWN_ERROR;
+		g_snprintf(error_cause, error_cause_size, "Invalid subscriber instance");
+		return NULL;
+	}
+	json_t *list = json_array();
+	gboolean changed = FALSE;
+	janus_mutex_lock(&subscriber->streams_mutex);
+	GList *temp = subscriber->streams;
+	while(temp) {
+		janus_videoroom_subscriber_stream *stream = (janus_videoroom_subscriber_stream *)temp->data;
+		temp = temp->next;
+		/* If no mid was provided, we only suspend/resume video streams */
+		gboolean match = FALSE;
+		if(mids == NULL) {
+			match = (stream->type == JANUS_VIDEOROOM_MEDIA_VIDEO);
+		} else {
+			for(i=0; i<json_array_size(mids); i++) {
+				const char *mid = json_string_value(json_array_get(mids, i));
+				if(stream->mid && !strcasecmp(stream->mid, mid)) {
+					match = TRUE;
+					break;
+				}
+			}
+		}
+		if(!match)
+			continue;
+		json_array_append_new(list, json_string(stream->mid));
+		if(g_atomic_int_get(&stream->suspended) == suspend)
+			continue;
+		changed = TRUE;
+		if(!suspend) {
+			/* Resuming: reset the RTP sequence numbers, and ask for a keyframe */
+			stream->context.seq_reset = TRUE;
+			g_atomic_int_set(&stream->suspended, 0);
+			janus_videoroom_publisher_stream *ps = stream->publisher_streams ? stream->publisher_streams->data : NULL;
+			if(ps && stream->type == JANUS_VIDEOROOM_MEDIA_VIDEO)
+				janus_videoroom_reqpli(ps, "Resuming suspended stream");
+		} else {
+			g_atomic_int_set(&stream->suspended, 1);
+		}
+	}
+	janus_mutex_unlock(&subscriber->streams_mutex);
+	if(changed)
+		janus_videoroom_relay_targets_changed();
+	janus_refcount_decrease(&subscriber->ref);
+	json_t *response = json_object();
+	json_object_set_new(response, "videoroom", json_string("success"));
+	json_object_set_new(response, suspend ? "suspended" : "resumed", list);
+	return response;
+}
+
 struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session *handle, char *transaction, json_t *message, json_t *jsep) {
 	if(g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
 		return janus_plugin_result_new(JANUS_PLUGIN_ERROR, g_atomic_int_get(&stopping) ? "Shutting down" : "Plugin not initialized", NULL);
@@ -8503,18 +10291,33 @@ struct janus_plugin_result *janus_videoroom_handle_message(janus_plugin_session
 	if(response != NULL) {
 		/* We got a response, send it back */
 		goto plugin_response;
+	} else if(!strcasecmp(request_text, "suspend") || !strcasecmp(request_text, "resume")) {
+		/* These are handled synchronously too, since they need to be cheap */
+		JANUS_VALIDATE_JSON_OBJECT(root, suspend_parameters,
+			error_code, error_cause, TRUE,
+			JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
+		if(error_code != 0)
+			goto plugin_response;
+		response = janus_videoroom_subscriber_suspend(session, root, !strcasecmp(request_text, "suspend"),
+			&error_code, error_cause, sizeof(error_cause));
+		goto plugin_response;
 	} else if(!strcasecmp(request_text, "join") || !strcasecmp(request_text, "joinandconfigure") || !strcasecmp(request_text, "update")
 			|| !strcasecmp(request_text, "configure") || !strcasecmp(request_text, "publish") || !strcasecmp(request_text, "unpublish")
 			|| !strcasecmp(request_text, "start") || !strcasecmp(request_text, "pause") || !strcasecmp(request_text, "switch")
 			|| !strcasecmp(request_text, "subscribe") || !strcasecmp(request_text, "unsubscribe") || !strcasecmp(request_text, "leave")) {
 		/* These messages are handled asynchronously */
-
+		janus_videoroom_worker *worker = janus_videoroom_session_get_worker(session, root);
 		janus_videoroom_message *msg = g_malloc(sizeof(janus_videoroom_message));
 		msg->handle = handle;
 		msg->transaction = transaction;
 		msg->message = root;
 		msg->jsep = jsep;
-		g_async_queue_push(messages, msg);
+		msg->worker = worker;
+		msg->queued = janus_get_monotonic_time();
+		msg->popped = 0;
+		gint depth = g_async_queue_length(worker->messages);
+		g_atomic_int_inc(&worker->depth[janus_videoroom_histogram_bucket(janus_videoroom_depth_buckets, depth > 0 ? depth : 0)]);
+		g_async_queue_push(worker->messages, msg);
 
 		return janus_plugin_result_new(JANUS_PLUGIN_OK_WAIT, NULL, NULL);
 	} else {
@@ -8550,6 +10353,34 @@ plugin_response:
 
 }
 
+/* Helper to pick the handler thread the asynchronous requests of a session will
+ * go to: once picked, it never changes, so that requests are handled in order */
+static janus_videoroom_worker *janus_videoroom_session_get_worker(janus_videoroom_session *session, json_t *root) {
+	janus_videoroom_worker *worker = g_atomic_pointer_get(&session->worker);
+	if(worker != NULL)
+		return worker;
+	if(handler_threads == 1) {
+		worker = &workers[0];
+	} else {
+		/* Use the room the request is about, if any, so that participants of
+		 * the same room end up on the same thread (and are served in order) */
+		guint hash = 0;
+		json_t *room = json_object_get(root, "room");
+		if(room && json_is_string(room))
+			hash = g_str_hash(json_string_value(room));
+		else if(room && json_is_integer(room)) {
+			guint64 room_id = json_integer_value(room);
+			hash = g_int64_hash(&room_id);
+		} else {
+			hash = g_direct_hash(session->handle);
+		}
+		worker = &workers[hash % handler_threads];
+	}
+	if(!g_atomic_pointer_compare_and_exchange(&session->worker, NULL, worker))
+		worker = g_atomic_pointer_get(&session->worker);
+	return worker;
+}
+
 json_t *janus_videoroom_handle_admin_message(json_t *message) {
 	/* Some requests (e.g., 'create' and 'destroy') can be handled via Admin API */
 	int error_code = 0;
@@ -8563,7 +10394,73 @@ json_t *janus_videoroom_handle_admin_message(json_t *message) {
 		goto admin_response;
 	json_t *request = json_object_get(message, "request");
 	const char *request_text = json_string_value(request);
-	if((response = janus_videoroom_process_synchronous_request(NULL, message)) != NULL) {
+	if(!strcasecmp(request_text, "handler_stats")) {
+		/* Return some info on how the handler threads are doing */
+		response = json_object();
+		json_object_set_new(response, "videoroom", json_string("handler_stats"));
+		json_t *list = json_array();
+		int i = 0;
+		for(i=0; i<handler_threads; i++) {
+			janus_videoroom_worker *worker = &workers[i];
+			json_t *h = json_object();
+			json_object_set_new(h, "id", json_integer(worker->id));
+			json_object_set_new(h, "queued", json_integer(g_async_queue_length(worker->messages)));
+			json_object_set_new(h, "processed", json_integer(g_atomic_int_get(&worker->processed)));
+			json_object_set_new(h, "depth", janus_videoroom_histogram_json(janus_videoroom_depth_buckets, worker->depth));
+			json_object_set_new(h, "wait", janus_videoroom_histogram_json(janus_videoroom_latency_buckets, worker->wait));
+			json_object_set_new(h, "latency", janus_videoroom_histogram_json(janus_videoroom_latency_buckets, worker->latency));
+			json_array_append_new(list, h);
+		}
+		json_object_set_new(response, "handlers", list);
+		goto admin_response;
+	} else if(!strcasecmp(request_text, "usage")) {
+		/* Return the resources each room (or a specific one) consumed so far */
+		if(!string_ids) {
+			JANUS_VALIDATE_JSON_OBJECT(message, roomopt_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
+		} else {
+			JANUS_VALIDATE_JSON_OBJECT(message, roomstropt_parameters,
+				error_code, error_cause, TRUE,
+				JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
+		}
+		if(error_code != 0)
+			goto admin_response;
+		JANUS_VALIDATE_JSON_OBJECT(message, usage_parameters,
+			error_code, error_cause, TRUE,
+			JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
+		if(error_code != 0)
+			goto admin_response;
+		json_t *room = json_object_get(message, "room");
+		gboolean reset = json_is_true(json_object_get(message, "reset"));
+		json_t *list = json_array();
+		janus_rwlock_read_lock(&rooms_rwlock);
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, rooms);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) {
+			janus_videoroom *videoroom = value;
+			if(room != NULL && (string_ids ? strcmp(videoroom->room_id_str, json_string_value(room)) :
+					videoroom->room_id != json_integer_value(room)))
+				continue;
+			json_t *rl = json_object();
+			json_object_set_new(rl, "room", string_ids ? json_string(videoroom->room_id_str) : json_integer(videoroom->room_id));
+			json_object_set_new(rl, "description", json_string(videoroom->room_name));
+			janus_mutex_lock(&videoroom->mutex);
+			json_object_set_new(rl, "num_participants", json_integer(g_hash_table_size(videoroom->participants)));
+			janus_mutex_unlock(&videoroom->mutex);
+			json_object_set_new(rl, "helper_threads", json_integer(videoroom->helper_threads));
+			json_object_set_new(rl, "usage", janus_usage_json(&videoroom->usage));
+			if(reset)
+				janus_usage_init(&videoroom->usage);
+			json_array_append_new(list, rl);
+		}
+		janus_rwlock_read_unlock(&rooms_rwlock);
+		response = json_object();
+		json_object_set_new(response, "videoroom", json_string("usage"));
+		json_object_set_new(response, "rooms", list);
+		goto admin_response;
+	} else if((response = janus_videoroom_process_synchronous_request(NULL, message)) != NULL) {
 		/* We got a response, send it back */
 		goto admin_response;
 	} else {
@@ -8607,6 +10504,7 @@ void janus_videoroom_setup_media(janus_plugin_session *handle) {
 
 	/* Media relaying can start now */
 	g_atomic_int_set(&session->started, 1);
+	janus_videoroom_relay_targets_changed();
 	if(session->participant) {
 		/* If this is a publisher, notify all subscribers about the fact they can
 		 * now subscribe; if this is a subscriber, instead, ask the publisher a FIR */
@@ -8649,7 +10547,7 @@ void janus_videoroom_setup_media(janus_plugin_session *handle) {
 					janus_videoroom_subscriber_stream *ss = (janus_videoroom_subscriber_stream *)temp->data;
 					janus_videoroom_publisher_stream *ps = ss->publisher_streams ? ss->publisher_streams->data : NULL;
 					if(ps && ps->type == JANUS_VIDEOROOM_MEDIA_VIDEO && ps->publisher && ps->publisher->session) {
-						janus_videoroom_reqpli(ps, "New subscriber available");
+						janus_videoroom_subscriber_stream_request_keyframe(ss, ps, "New subscriber available");
 					}
 					temp = temp->next;
 				}
@@ -8715,8 +10613,10 @@ static void janus_videoroom_incoming_rtp_internal(janus_videoroom_session *sessi
 	gboolean video = pkt->video;
 	char *buf = pkt->buffer;
 	uint16_t len = pkt->length;
+	janus_usage_packets_in(&videoroom->usage, 1, len, TRUE);
 	/* In case this is an audio packet and we're doing talk detection, check the audio level extension */
-	if(!video && videoroom->audiolevel_event && ps->active && !ps->muted && ps->audio_level_extmap_id > 0) {
+	if(!video && (videoroom->audiolevel_event || videoroom->active_speakers > 0 || videoroom->audio_last_n > 0) &&
+			ps->active && !ps->muted && ps->audio_level_extmap_id > 0) {
 		int level = pkt->extensions.audio_level;
 		if(level != -1) {
 			ps->audio_dBov_sum += level;
@@ -8740,8 +10640,11 @@ static void janus_videoroom_incoming_rtp_internal(janus_videoroom_session *sessi
 				}
 				ps->audio_active_packets = 0;
 				ps->audio_dBov_sum = 0;
+				/* Check if the active speakers changed, if we're keeping track of them */
+				if(videoroom->active_speakers > 0 || videoroom->audio_last_n > 0)
+					janus_videoroom_update_active_speakers(videoroom, participant, ps->talking, audio_dBov_avg);
 				/* Only notify in case of state changes */
-				if(notify_talk_event) {
+				if(notify_talk_event && videoroom->audiolevel_event) {
 					janus_mutex_lock(&videoroom->mutex);
 					json_t *event = json_object();
 					json_object_set_new(event, "videoroom", json_string(ps->talking ? "talking" : "stopped-talking"));
@@ -8773,57 +10676,44 @@ static void janus_videoroom_incoming_rtp_internal(janus_videoroom_session *sessi
 	if(ps->active && !ps->muted) {
 		janus_rtp_header *rtp = (janus_rtp_header *)buf;
 		int sc = video ? 0 : -1;
-		/* Check if we're simulcasting, and if so, keep track of the "layer" */
+		/* Check if we're simulcasting, and if so, keep track of the "layer": we
+		 * classify the packet (substream, keyframe, temporal layer) only once
+		 * here, so that the recorder and all subscribers can just use that */
+		janus_rtp_simulcasting_packet sim_info = { 0 };
 		if(video && ps->simulcast) {
-			uint32_t ssrc = ntohl(rtp->ssrc);
-			if(ssrc == ps->vssrc[0])
-				sc = 0;
-			else if(ssrc == ps->vssrc[1])
-				sc = 1;
-			else if(ssrc == ps->vssrc[2])
-				sc = 2;
-			else if(ps->rid_extmap_id > 0) {
-				/* We may not know the SSRC yet, try the rid RTP extension */
-				char sdes_item[16];
-				janus_mutex_lock(&ps->rid_mutex);
-				if(janus_rtp_header_extension_parse_rid(buf, len, ps->rid_extmap_id, sdes_item, sizeof(sdes_item)) == 0) {
-					if(ps->rid[0] != NULL && !strcmp(ps->rid[0], sdes_item)) {
-						ps->vssrc[0] = ssrc;
-						sc = 0;
-					} else if(ps->rid[1] != NULL && !strcmp(ps->rid[1], sdes_item)) {
-						ps->vssrc[1] = ssrc;
-						sc = 1;
-					} else if(ps->rid[2] != NULL && !strcmp(ps->rid[2], sdes_item)) {
-						ps->vssrc[2] = ssrc;
-						sc = 2;
-					}
-				}
-				janus_mutex_unlock(&ps->rid_mutex);
-			}
+			janus_rtp_simulcasting_classify(&sim_info, buf, len, ps->rid_extmap_id,
+				ps->vssrc, ps->rid, ps->vcodec, &ps->rid_mutex);
+			if(sim_info.substream != -1)
+				sc = sim_info.substream;
 		}
 		/* Forward RTP to the appropriate port for the rtp_forwarders associated with this publisher, if there are any */
 		janus_mutex_lock(&ps->rtp_forwarders_mutex);
-		GHashTableIter iter;
-		gpointer value;
-		g_hash_table_iter_init(&iter, ps->rtp_forwarders);
-		while(participant->udp_sock > 0 && g_hash_table_iter_next(&iter, NULL, &value)) {
-			janus_rtp_forwarder *rtp_forward = (janus_rtp_forwarder *)value;
-			if(rtp_forward->is_data || (video && !rtp_forward->is_video) || (!video && rtp_forward->is_video))
-				continue;
-			janus_rtp_forwarder_send_rtp_full(rtp_forward, buf, len, sc,
-				ps->vssrc, ps->rid, ps->vcodec, &ps->rid_mutex);
+		if(participant->udp_sock > 0 && g_hash_table_size(ps->rtp_forwarders) > 0) {
+			/* Send the packet to all forwarders at once */
+			janus_rtp_forwarder_batch *batch = janus_rtp_forwarder_batch_new();
+			GHashTableIter iter;
+			gpointer value;
+			g_hash_table_iter_init(&iter, ps->rtp_forwarders);
+			while(g_hash_table_iter_next(&iter, NULL, &value)) {
+				janus_rtp_forwarder *rtp_forward = (janus_rtp_forwarder *)value;
+				if(rtp_forward->is_data || (video && !rtp_forward->is_video) || (!video && rtp_forward->is_video))
+					continue;
+				janus_rtp_forwarder_batch_add(batch, rtp_forward, buf, len, sc,
+					ps->vssrc, ps->rid, ps->vcodec, &ps->rid_mutex);
+			}
+			janus_rtp_forwarder_batch_send(batch);
 		}
 		janus_mutex_unlock(&ps->rtp_forwarders_mutex);
-		/* Set the payload type of the publisher */
-		rtp->type = ps->pt;
-		/* Save the frame if we're recording */
-		if(!video || !ps->simulcast) {
+		/* Set the payload type of the publisher, unless this is a RED packet */
+		gboolean red = (!video && ps->opusred_pt > 0 && rtp->type == ps->opusred_pt);
+		rtp->type = red ? ps->opusred_pt : ps->pt;
+		/* Save the frame if we're recording (SVC is handled later, once parsed) */
+		if(!video || (!ps->simulcast && !ps->svc)) {
 			janus_recorder_save_frame(ps->rc, buf, len);
-		} else {
-			/* We're simulcasting, save the best video quality */
-			gboolean save = janus_rtp_simulcasting_context_process_rtp(&ps->rec_simctx,
-				buf, len, pkt->extensions.dd_content, pkt->extensions.dd_len,
-				ps->vssrc, ps->rid, ps->vcodec, &ps->rec_ctx, &ps->rid_mutex);
+		} else if(ps->simulcast) {
+			/* We're simulcasting, save the substream we've been asked to (the best by default) */
+			gboolean save = janus_rtp_simulcasting_context_process_packet(&ps->rec_simctx,
+				&sim_info, pkt->extensions.dd_content, pkt->extensions.dd_len, &ps->rec_ctx);
 			if(save) {
 				uint32_t seq_number = ntohs(rtp->seq_number);
 				uint32_t timestamp = ntohl(rtp->timestamp);
@@ -8847,6 +10737,30 @@ static void janus_videoroom_incoming_rtp_internal(janus_videoroom_session *sessi
 		packet.is_rtp = TRUE;
 		packet.is_video = video;
 		packet.svc = FALSE;
+		/* If this is RED, we unwrap it once here for all the subscribers that
+		 * didn't negotiate it: they'll get a copy with the primary block only */
+		char primary[1500];
+		if(red) {
+			packet.red = TRUE;
+			int plen = 0;
+			char *payload = janus_rtp_payload(buf, len, &plen);
+			if(payload != NULL && plen > 0) {
+				/* Make sure the blocks all use the payload type subscribers know about */
+				janus_red_replace_block_pt(payload, plen, ps->pt);
+				GList *blocks = janus_red_parse_blocks(payload, plen);
+				GList *last = g_list_last(blocks);
+				janus_red_block *rb = last ? (janus_red_block *)last->data : NULL;
+				int hlen = payload - buf;
+				if(rb != NULL && rb->data != NULL && rb->length > 0 && hlen + rb->length <= (int)sizeof(primary)) {
+					memcpy(primary, buf, hlen);
+					memcpy(primary + hlen, rb->data, rb->length);
+					packet.primary = (janus_rtp_header *)primary;
+					packet.primary->type = ps->pt;
+					packet.primary_length = hlen + rb->length;
+				}
+				g_list_free_full(blocks, (GDestroyNotify)g_free);
+			}
+		}
 		if(video && ps->svc) {
 			/* We're doing SVC: let's parse this packet to see which layers are there */
 			int plen = 0;
@@ -8862,12 +10776,65 @@ static void janus_videoroom_incoming_rtp_internal(janus_videoroom_session *sessi
 				if(janus_vp9_parse_svc(payload, plen, &found, &packet.svc_info) == 0) {
 					packet.svc = found;
 				}
-			} else if(ps->vcodec == JANUS_VIDEOCODEC_AV1) {
-				packet.svc = (pkt->extensions.dd_len > 0);
+			} else if(ps->vcodec == JANUS_VIDEOCODEC_AV1 && pkt->extensions.dd_len > 0) {
+				/* Parse the Dependency Descriptor once for all subscribers: if we
+				 * can't (e.g., no template yet), the packet will be relayed as it is */
+				uint8_t template = 0, ebit = 0;
+				memset(&packet.svc_info, 0, sizeof(packet.svc_info));
+				if(janus_av1_svc_context_process_dd(&ps->dd_context, pkt->extensions.dd_content,
+						pkt->extensions.dd_len, &template, &ebit)) {
+					janus_av1_svc_template *t = g_hash_table_lookup(ps->dd_context.templates, GUINT_TO_POINTER(template));
+					if(t != NULL) {
+						packet.svc_info.spatial_layer = t->spatial;
+						packet.svc_info.temporal_layer = t->temporal;
+						packet.svc_info.ebit = ebit;
+						packet.svc = TRUE;
+					}
+				}
+			}
+		}
+		if(video && ps->svc && ps->rc != NULL) {
+			if(!packet.svc) {
+				/* We couldn't figure out the layers, save the packet as it is */
+				janus_recorder_save_frame(ps->rc, buf, len);
+			} else {
+				/* Only save the SVC layers we've been asked to (all of them by default) */
+				char rtph[12];
+				memcpy(&rtph, buf, sizeof(rtph));
+				gboolean save = janus_rtp_svc_context_process_rtp(&ps->rec_svcctx, buf, len,
+					pkt->extensions.dd_content, pkt->extensions.dd_len, ps->vcodec, &packet.svc_info, &ps->rec_ctx);
+				if(ps->rec_svcctx.need_pli)
+					janus_videoroom_reqpli(ps, "Recording SVC change");
+				if(save) {
+					janus_rtp_header_update(rtp, &ps->rec_ctx, TRUE, 0);
+					janus_recorder_save_frame(ps->rc, buf, len);
+				}
+				/* Restore the header, as it will be needed by subscribers */
+				memcpy(buf, &rtph, sizeof(rtph));
 			}
 		}
-		if(video && ps->simulcast)
+		if(video && ps->simulcast) {
 			packet.simulcast = TRUE;
+			packet.sim_info = sim_info;
+		}
+		if(videoroom->bwe && (packet.simulcast || packet.svc)) {
+			/* Keep track of the bitrate of each substream/layer, to match it against bandwidth estimates */
+			int layer = packet.simulcast ? sc : packet.svc_info.spatial_layer;
+			if(layer >= 0 && layer <= 2)
+				ps->layer_bytes[layer] += len;
+			gint64 now = janus_get_cached_monotonic_time();
+			if(ps->layer_bitrate_ts == 0) {
+				ps->layer_bitrate_ts = now;
+			} else if(now - ps->layer_bitrate_ts >= G_USEC_PER_SEC) {
+				int i = 0;
+				for(i=0; i<3; i++) {
+					g_atomic_int_set(&ps->layer_bitrate[i],
+						((guint64)ps->layer_bytes[i] * 8 * G_USEC_PER_SEC)/(now - ps->layer_bitrate_ts));
+					ps->layer_bytes[i] = 0;
+				}
+				ps->layer_bitrate_ts = now;
+			}
+		}
 		packet.ssrc[0] = (sc != -1 ? ps->vssrc[0] : 0);
 		packet.ssrc[1] = (sc != -1 ? ps->vssrc[1] : 0);
 		packet.ssrc[2] = (sc != -1 ? ps->vssrc[2] : 0);
@@ -8878,12 +10845,25 @@ static void janus_videoroom_incoming_rtp_internal(janus_videoroom_session *sessi
 			packet.extensions.min_delay = ps->min_delay;
 			packet.extensions.max_delay = ps->max_delay;
 		}
+		/* Keep track of the latest keyframe, if we need to replay it to new subscribers */
+		if(video && videoroom->keyframe_cache && sc >= 0)
+			janus_videoroom_keyframe_cache_add(ps, sc, &packet);
 		/* Go: some viewers may decide to drop the packet, but that's up to them */
 		janus_mutex_lock_nodebug(&ps->subscribers_mutex);
 		if(videoroom->helper_threads > 0) {
 			g_list_foreach(videoroom->threads, janus_videoroom_helper_rtpdata_packet, &packet);
 		} else {
-			g_slist_foreach(ps->subscribers, janus_videoroom_relay_rtp_packet, &packet);
+			/* We're in the publisher's thread, so only sample the time we spend relaying */
+			gint64 cpu_start = 0;
+			guint cpu_weight = janus_usage_sample_start(&cpu_start);
+			janus_videoroom_publisher_stream_update_relay_targets(ps);
+			janus_videoroom_relay_batch batch = { 0 };
+			batch.usage = &videoroom->usage;
+			guint i = 0;
+			for(i=0; i<ps->relay_targets_num; i++)
+				janus_videoroom_relay_rtp_packet_batch(ps->relay_targets[i], &packet, &batch);
+			janus_videoroom_relay_batch_flush(&batch);
+			janus_usage_sample_stop(&videoroom->usage, cpu_weight, cpu_start);
 		}
 		janus_mutex_unlock_nodebug(&ps->subscribers_mutex);
 
@@ -9008,6 +10988,65 @@ void janus_videoroom_incoming_rtcp(janus_plugin_session *handle, janus_plugin_rt
 	}
 }
 
+/* Relay a data channel message to all the subscribers of a publisher stream,
+ * either directly or via the helper threads, if any (subscribers_mutex locked) */
+static void janus_videoroom_relay_data_to_subscribers(janus_videoroom *videoroom,
+		janus_videoroom_publisher_stream *ps, janus_videoroom_rtp_relay_packet *pkt) {
+	if(videoroom->helper_threads > 0) {
+		g_list_foreach(videoroom->threads, janus_videoroom_helper_rtpdata_packet, pkt);
+		return;
+	}
+	janus_videoroom_data_fanout fanout = { .packet = pkt, .handles = g_ptr_array_new(), .usage = &videoroom->usage };
+	g_slist_foreach(ps->subscribers, janus_videoroom_relay_data_collect, &fanout);
+	janus_videoroom_relay_data_fanout_send(&fanout);
+}
+/* Relay the text messages we were coalescing, if any (subscribers_mutex locked) */
+static void janus_videoroom_publisher_stream_flush_data(janus_videoroom *videoroom, janus_videoroom_publisher_stream *ps) {
+	if(ps->data_pending == NULL || ps->data_pending->len == 0)
+		return;
+	janus_videoroom_rtp_relay_packet pkt = { 0 };
+	pkt.source = ps;
+	pkt.data = (struct rtp_header *)ps->data_pending->str;
+	pkt.length = ps->data_pending->len;
+	pkt.is_rtp = FALSE;
+	pkt.textdata = TRUE;
+	janus_videoroom_relay_data_to_subscribers(videoroom, ps, &pkt);
+	g_string_truncate(ps->data_pending, 0);
+}
+static void *janus_videoroom_data_thread(void *data) {
+	JANUS_LOG(LOG_VERB, "Joining VideoRoom data thread\n");
+	janus_videoroom_pending_data *pending = NULL;
+	while(!g_atomic_int_get(&stopping)) {
+		pending = g_async_queue_pop(pending_data);
+		if(pending == &exit_data)
+			break;
+		/* The window is the same for all streams, so this queue is ordered by due time */
+		gint64 wait = pending->due - janus_get_monotonic_time();
+		if(wait > 0)
+			g_usleep(wait);
+		janus_videoroom_publisher_stream *ps = pending->ps;
+		janus_mutex_lock_nodebug(&ps->subscribers_mutex);
+		ps->data_scheduled = FALSE;
+		if(!g_atomic_int_get(&stopping) && !g_atomic_int_get(&ps->destroyed) &&
+				!g_atomic_int_get(&pending->room->destroyed))
+			janus_videoroom_publisher_stream_flush_data(pending->room, ps);
+		janus_mutex_unlock_nodebug(&ps->subscribers_mutex);
+		janus_refcount_decrease(&ps->ref);
+		janus_refcount_decrease(&pending->room->ref);
+		g_free(pending);
+	}
+	/* Get rid of the messages we didn't relay */
+	while((pending = g_async_queue_try_pop(pending_data)) != NULL) {
+		if(pending == &exit_data)
+			continue;
+		janus_refcount_decrease(&pending->ps->ref);
+		janus_refcount_decrease(&pending->room->ref);
+		g_free(pending);
+	}
+	JANUS_LOG(LOG_VERB, "Leaving VideoRoom data thread\n");
+	return NULL;
+}
+
 static void janus_videoroom_incoming_data_internal(janus_videoroom_session *session, janus_videoroom_publisher *participant, janus_plugin_data *packet);
 void janus_videoroom_incoming_data(janus_plugin_session *handle, janus_plugin_data *packet) {
 	if(handle == NULL || g_atomic_int_get(&handle->stopped) || g_atomic_int_get(&stopping) || !g_atomic_int_get(&initialized))
@@ -9105,17 +11144,38 @@ static void janus_videoroom_incoming_data_internal(janus_videoroom_session *sess
 	/* Save the message if we're recording */
 	janus_recorder_save_frame(ps->rc, buf, len);
 	/* Relay to all subscribers */
-	janus_videoroom_rtp_relay_packet pkt = { 0 };
-	pkt.source = ps;
-	pkt.data = (struct rtp_header *)buf;
-	pkt.length = len;
-	pkt.is_rtp = FALSE;
-	pkt.textdata = !packet->binary;
+	janus_usage_packets_in(&videoroom->usage, 1, len, FALSE);
 	janus_mutex_lock_nodebug(&ps->subscribers_mutex);
-	if(videoroom->helper_threads > 0) {
-		g_list_foreach(videoroom->threads, janus_videoroom_helper_rtpdata_packet, &pkt);
+	if(data_coalesce > 0 && !packet->binary && len <= JANUS_VIDEOROOM_DATA_COALESCE_MAX &&
+			memchr(buf, '\n', len) == NULL) {
+		/* Small text message, add it to the ones we'll relay together */
+		if(ps->data_pending == NULL)
+			ps->data_pending = g_string_sized_new(JANUS_VIDEOROOM_DATA_COALESCE_SIZE);
+		if(ps->data_pending->len + len + 1 > JANUS_VIDEOROOM_DATA_COALESCE_SIZE)
+			janus_videoroom_publisher_stream_flush_data(videoroom, ps);
+		if(ps->data_pending->len > 0)
+			g_string_append_c(ps->data_pending, '\n');
+		g_string_append_len(ps->data_pending, buf, len);
+		if(!ps->data_scheduled) {
+			ps->data_scheduled = TRUE;
+			janus_refcount_increase(&videoroom->ref);
+			janus_refcount_increase(&ps->ref);
+			janus_videoroom_pending_data *pending = g_malloc(sizeof(janus_videoroom_pending_data));
+			pending->room = videoroom;
+			pending->ps = ps;
+			pending->due = janus_get_monotonic_time() + (gint64)data_coalesce*1000;
+			g_async_queue_push(pending_data, pending);
+		}
 	} else {
-		g_slist_foreach(ps->subscribers, janus_videoroom_relay_data_packet, &pkt);
+		/* Relay this message on its own, but after the ones waiting to be coalesced, if any */
+		janus_videoroom_publisher_stream_flush_data(videoroom, ps);
+		janus_videoroom_rtp_relay_packet pkt = { 0 };
+		pkt.source = ps;
+		pkt.data = (struct rtp_header *)buf;
+		pkt.length = len;
+		pkt.is_rtp = FALSE;
+		pkt.textdata = !packet->binary;
+		janus_videoroom_relay_data_to_subscribers(videoroom, ps, &pkt);
 	}
 	janus_mutex_unlock_nodebug(&ps->subscribers_mutex);
 	janus_refcount_decrease_nodebug(&ps->ref);
@@ -9200,6 +11260,21 @@ void janus_videoroom_slow_link(janus_plugin_session *handle, int mindex, gboolea
 	janus_refcount_decrease(&session->ref);
 }
 
+static void janus_videoroom_recorder_layers(janus_videoroom_publisher_stream *ps) {
+	/* Pick the simulcast substream/SVC layer to record: the publisher can
+	 * override what the room says, and by default we record the best one */
+	janus_videoroom_publisher *participant = ps->publisher;
+	int substream = 2, temporal = 2;
+	if(participant && participant->room) {
+		substream = participant->rec_substream >= 0 ? participant->rec_substream : participant->room->rec_substream;
+		temporal = participant->rec_temporal >= 0 ? participant->rec_temporal : participant->room->rec_temporal;
+	}
+	ps->rec_simctx.substream_target = substream;
+	ps->rec_simctx.templayer_target = temporal;
+	ps->rec_svcctx.spatial_target = substream;
+	ps->rec_svcctx.temporal_target = temporal;
+}
+
 static void janus_videoroom_recorder_create(janus_videoroom_publisher_stream *ps) {
 	char filename[255];
 	janus_recorder *rc = NULL;
@@ -9222,8 +11297,8 @@ static void janus_videoroom_recorder_create(janus_videoroom_publisher_stream *ps
 		}
 		janus_rtp_switching_context_reset(&ps->rec_ctx);
 		janus_rtp_simulcasting_context_reset(&ps->rec_simctx);
-		ps->rec_simctx.substream_target = 2;
-		ps->rec_simctx.templayer_target = 2;
+		janus_rtp_svc_context_reset(&ps->rec_svcctx);
+		janus_videoroom_recorder_layers(ps);
 		memset(filename, 0, 255);
 		if(participant->recording_base) {
 			/* Use the filename and path we have been provided */
@@ -9254,6 +11329,9 @@ static void janus_videoroom_recorder_create(janus_videoroom_publisher_stream *ps
 		/* If media is encrypted, mark it in the recording */
 		if(ps->type != JANUS_VIDEOROOM_MEDIA_DATA && participant->e2ee)
 			janus_recorder_encrypted(rc);
+		/* If the publisher is sending RED, the recording will contain RED packets */
+		if(ps->type == JANUS_VIDEOROOM_MEDIA_AUDIO && ps->opusred_pt > 0)
+			janus_recorder_opusred(rc, ps->opusred_pt);
 		ps->rc = rc;
 	}
 }
@@ -9351,6 +11429,7 @@ static void janus_videoroom_hangup_media_internal(gpointer session_data) {
 			}
 			g_slist_free(ps->subscribers);
 			ps->subscribers = NULL;
+			janus_videoroom_relay_targets_changed();
 			janus_rtp_simulcasting_cleanup(&ps->rid_extmap_id, ps->vssrc, ps->rid, &ps->rid_mutex);
 			g_free(ps->fmtp);
 			ps->fmtp = NULL;
@@ -9404,35 +11483,12 @@ static void janus_videoroom_hangup_media_internal(gpointer session_data) {
 					/* We're still waiting for an answer to a previous offer, postpone this */
 					g_atomic_int_set(&subscriber->pending_offer, 1);
 					janus_mutex_unlock(&subscriber->streams_mutex);
+				} else if(janus_videoroom_subscriber_schedule_update(subscriber)) {
+					/* We'll send a single offer for all the changes in the next few ms */
+					janus_mutex_unlock(&subscriber->streams_mutex);
 				} else {
-					json_t *event = json_object();
-					json_object_set_new(event, "videoroom", json_string("updated"));
-					json_object_set_new(event, "room", string_ids ?
-						json_string(subscriber->room_id_str) : json_integer(subscriber->room_id));
-					json_t *media = janus_videoroom_subscriber_streams_summary(subscriber, FALSE, NULL);
-					json_t *media_event = NULL;
-					if(notify_events && gateway->events_is_enabled())
-						media_event = json_deep_copy(media);
-					json_object_set_new(event, "streams", media);
-					/* Generate a new offer */
-					json_t *jsep = janus_videoroom_subscriber_offer(subscriber);
 					janus_mutex_unlock(&subscriber->streams_mutex);
-					/* How long will the Janus core take to push the event? */
-					gint64 start = janus_get_monotonic_time();
-					int res = gateway->push_event(subscriber->session->handle, &janus_videoroom_plugin, NULL, event, jsep);
-					JANUS_LOG(LOG_VERB, "  >> Pushing event: %d (took %"SCNu64" us)\n", res, janus_get_monotonic_time()-start);
-					json_decref(event);
-					json_decref(jsep);
-					/* Also notify event handlers */
-					if(notify_events && gateway->events_is_enabled()) {
-						json_t *info = json_object();
-						json_object_set_new(info, "event", json_string("updated"));
-						json_object_set_new(info, "room", string_ids ?
-							json_string(subscriber->room_id_str) : json_integer(subscriber->room_id));
-						json_object_set_new(info, "streams", media_event);
-						json_object_set_new(info, "private_id", json_integer(subscriber->pvt_id));
-						gateway->notify_event(&janus_videoroom_plugin, session->handle, info);
-					}
+					janus_videoroom_subscriber_send_update(subscriber, NULL);
 				}
 				janus_refcount_decrease(&subscriber->session->ref);
 				janus_refcount_decrease(&subscriber->ref);
@@ -9500,15 +11556,20 @@ static void janus_videoroom_hangup_media_internal(gpointer session_data) {
 
 /* Thread to handle incoming messages */
 static void *janus_videoroom_handler(void *data) {
-	JANUS_LOG(LOG_VERB, "Joining VideoRoom handler thread\n");
+	janus_videoroom_worker *worker = (janus_videoroom_worker *)data;
+	JANUS_LOG(LOG_VERB, "Joining VideoRoom handler thread #%u\n", worker->id);
 	janus_videoroom_message *msg = NULL;
 	int error_code = 0;
 	char error_cause[512];
 	json_t *root = NULL;
 	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
-		msg = g_async_queue_pop(messages);
+		msg = g_async_queue_pop(worker->messages);
 		if(msg == &exit_message)
 			break;
+		msg->popped = janus_get_monotonic_time();
+		g_atomic_int_inc(&worker->processed);
+		g_atomic_int_inc(&worker->wait[janus_videoroom_histogram_bucket(janus_videoroom_latency_buckets,
+			(msg->popped - msg->queued)/1000)]);
 		if(msg->handle == NULL) {
 			janus_videoroom_message_free(msg);
 			continue;
@@ -9605,14 +11666,16 @@ static void *janus_videoroom_handler(void *data) {
 				JANUS_VIDEOROOM_ERROR_MISSING_ELEMENT, JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT);
 			if(error_code != 0)
 				goto error;
-			janus_mutex_lock(&rooms_mutex);
+			janus_rwlock_read_lock(&rooms_rwlock);
 			error_code = janus_videoroom_access_room(root, FALSE, TRUE, &videoroom, error_cause, sizeof(error_cause));
 			if(error_code != 0) {
-				janus_mutex_unlock(&rooms_mutex);
+				janus_rwlock_read_unlock(&rooms_rwlock);
+				if(error_code == JANUS_VIDEOROOM_ERROR_NO_SUCH_ROOM)
+					janus_videoroom_notify_directory(session, NULL, json_object_get(root, "room"), NULL);
 				goto error;
 			}
 			janus_refcount_increase(&videoroom->ref);
-			janus_mutex_unlock(&rooms_mutex);
+			janus_rwlock_read_unlock(&rooms_rwlock);
 			janus_mutex_lock(&sessions_mutex);
 			janus_mutex_lock(&videoroom->mutex);
 			json_t *ptype = json_object_get(root, "ptype");
@@ -9849,6 +11912,8 @@ static void *janus_videoroom_handler(void *data) {
 					JANUS_LOG(LOG_VERB, "Setting recording basename: %s (room %s, user %s)\n",
 						publisher->recording_base, publisher->room_id_str, publisher->user_id_str);
 				}
+				publisher->rec_substream = -1;
+				publisher->rec_temporal = -1;
 				if(user_audio_active_packets) {
 					publisher->user_audio_active_packets = json_integer_value(user_audio_active_packets);
 					JANUS_LOG(LOG_VERB, "Setting user audio_active_packets: %d (room %s, user %s)\n",
@@ -9893,6 +11958,14 @@ static void *janus_videoroom_handler(void *data) {
 					publisher);
 				g_hash_table_insert(publisher->room->private_ids, GUINT_TO_POINTER(publisher->pvt_id), publisher);
 				janus_mutex_unlock(&session->mutex);
+				if(publisher->room->remote_nodes != NULL) {
+					/* This room is cascaded to remote nodes, remotize the new publisher there too */
+					GHashTableIter iter_n;
+					gpointer value_n;
+					g_hash_table_iter_init(&iter_n, publisher->room->remote_nodes);
+					while(g_hash_table_iter_next(&iter_n, NULL, &value_n))
+						janus_videoroom_remote_node_attach((janus_videoroom_remote_node *)value_n, publisher);
+				}
 				g_hash_table_iter_init(&iter, publisher->room->participants);
 				while (!g_atomic_int_get(&publisher->room->destroyed) && g_hash_table_iter_next(&iter, NULL, &value)) {
 					janus_videoroom_publisher *p = value;
@@ -10176,6 +12249,7 @@ static void *janus_videoroom_handler(void *data) {
 						JANUS_LOG(LOG_ERR, "No such feed (%s)\n", feed_id_str);
 						error_code = JANUS_VIDEOROOM_ERROR_NO_SUCH_FEED;
 						g_snprintf(error_cause, 512, "No such feed (%s)", feed_id_str);
+						janus_videoroom_notify_directory(session, videoroom, NULL, feed);
 						janus_mutex_unlock(&videoroom->mutex);
 						/* Unref publishers we may have taken note of so far */
 						while(publishers) {
@@ -10396,6 +12470,7 @@ static void *janus_videoroom_handler(void *data) {
 							janus_mutex_lock(&ps->subscribers_mutex);
 							if(g_slist_find(ps->subscribers, data_stream) == NULL && g_slist_find(data_stream->publisher_streams, ps) == NULL) {
 								ps->subscribers = g_slist_append(ps->subscribers, data_stream);
+								janus_videoroom_relay_targets_changed();
 								data_stream->publisher_streams = g_slist_append(data_stream->publisher_streams, ps);
 								/* If we're using helper threads, add the subscriber to one of those */
 								if(subscriber->room && subscriber->room->helper_threads > 0) {
@@ -10483,6 +12558,7 @@ static void *janus_videoroom_handler(void *data) {
 								janus_mutex_lock(&ps->subscribers_mutex);
 								if(g_slist_find(ps->subscribers, data_stream) == NULL && g_slist_find(data_stream->publisher_streams, ps) == NULL) {
 									ps->subscribers = g_slist_append(ps->subscribers, data_stream);
+									janus_videoroom_relay_targets_changed();
 									data_stream->publisher_streams = g_slist_append(data_stream->publisher_streams, ps);
 									/* If we're using helper threads, add the subscriber to one of those */
 									if(subscriber->room && subscriber->room->helper_threads > 0) {
@@ -10763,6 +12839,16 @@ static void *janus_videoroom_handler(void *data) {
 				json_t *bitrate = json_object_get(root, "bitrate");
 				json_t *record = json_object_get(root, "record");
 				json_t *recfile = json_object_get(root, "filename");
+				json_t *rec_substream = json_object_get(root, "rec_substream");
+				json_t *rec_temporal = json_object_get(root, "rec_temporal");
+				if((rec_substream && json_integer_value(rec_substream) > 2) ||
+						(rec_temporal && json_integer_value(rec_temporal) > 2)) {
+					JANUS_LOG(LOG_ERR, "Invalid element (rec_substream and rec_temporal must be between 0 and 2)\n");
+					error_code = JANUS_VIDEOROOM_ERROR_INVALID_ELEMENT;
+					g_snprintf(error_cause, 512, "Invalid element (rec_substream and rec_temporal must be between 0 and 2)");
+					janus_refcount_decrease(&participant->ref);
+					goto error;
+				}
 				json_t *display = json_object_get(root, "display");
 				json_t *metadata = json_object_get(root, "metadata");
 				json_t *update = json_object_get(root, "update");
@@ -11015,6 +13101,26 @@ static void *janus_videoroom_handler(void *data) {
 					JANUS_LOG(LOG_VERB, "Setting recording basename: %s (room %s, user %s)\n",
 						participant->recording_base, participant->room_id_str, participant->user_id_str);
 				}
+				if(rec_substream || rec_temporal) {
+					if(rec_substream)
+						participant->rec_substream = json_integer_value(rec_substream);
+					if(rec_temporal)
+						participant->rec_temporal = json_integer_value(rec_temporal);
+					JANUS_LOG(LOG_VERB, "Setting recorded layers: substream %d, temporal %d (room %s, user %s)\n",
+						participant->rec_substream, participant->rec_temporal, participant->room_id_str, participant->user_id_str);
+					/* If we're already recording, switch layer on the next keyframe */
+					janus_mutex_lock(&participant->streams_mutex);
+					GList *temp = participant->streams;
+					while(temp) {
+						janus_videoroom_publisher_stream *ps = (janus_videoroom_publisher_stream *)temp->data;
+						if(ps->type == JANUS_VIDEOROOM_MEDIA_VIDEO && ps->rc != NULL) {
+							janus_videoroom_recorder_layers(ps);
+							janus_videoroom_reqpli(ps, "Recording layer change");
+						}
+						temp = temp->next;
+					}
+					janus_mutex_unlock(&participant->streams_mutex);
+				}
 				/* Do we need to do something with the recordings right now? */
 				if(participant->recording_active != prev_recording_active) {
 					/* Something changed */
@@ -11176,13 +13282,14 @@ static void *janus_videoroom_handler(void *data) {
 						stream->context.seq_reset = TRUE;
 						janus_videoroom_publisher_stream *ps = stream->publisher_streams ? stream->publisher_streams->data : NULL;
 						if(ps && ps->type == JANUS_VIDEOROOM_MEDIA_VIDEO && ps->publisher && ps->publisher->session) {
-							/* Send a PLI */
-							janus_videoroom_reqpli(ps, "Subscriber start");
+							/* Send a PLI (or replay the latest keyframe, if we have it) */
+							janus_videoroom_subscriber_stream_request_keyframe(stream, ps, "Subscriber start");
 						}
 						temp = temp->next;
 					}
 				}
 				subscriber->paused = FALSE;
+				janus_videoroom_relay_targets_changed();
 				event = json_object();
 				json_object_set_new(event, "videoroom", json_string("event"));
 				json_object_set_new(event, "room", string_ids ? json_string(subscriber->room_id_str) : json_integer(subscriber->room_id));
@@ -11323,6 +13430,7 @@ static void *janus_videoroom_handler(void *data) {
 							JANUS_LOG(LOG_ERR, "No such feed (%s)\n", feed_id_str);
 							error_code = JANUS_VIDEOROOM_ERROR_NO_SUCH_FEED;
 							g_snprintf(error_cause, 512, "No such feed (%s)", feed_id_str);
+							janus_videoroom_notify_directory(session, subscriber->room, NULL, feed);
 							/* Unref publishers we may have taken note of so far */
 							while(publishers) {
 								publisher = (janus_videoroom_publisher *)publishers->data;
@@ -11541,6 +13649,7 @@ static void *janus_videoroom_handler(void *data) {
 										stream->context.seq_reset = TRUE;
 									}
 									stream->send = json_is_true(send);
+									janus_videoroom_relay_targets_changed();
 								}
 								if(ps->type == JANUS_VIDEOROOM_MEDIA_VIDEO &&
 										(spatial || sc_substream || temporal || sc_temporal)) {
@@ -11677,12 +13786,18 @@ static void *janus_videoroom_handler(void *data) {
 					janus_videoroom_message_free(msg);
 					continue;
 				}
-				if(!g_atomic_int_get(&subscriber->answered)) {
-					/* We're still waiting for an answer to a previous offer, postpone this */
-					g_atomic_int_set(&subscriber->pending_offer, 1);
-					janus_mutex_unlock(&subscriber->streams_mutex);
-					janus_mutex_unlock(&subscriber->room->mutex);
-					JANUS_LOG(LOG_VERB, "Post-poning new offer, waiting for previous answer\n");
+				gboolean scheduled = FALSE;
+				if(g_atomic_int_get(&subscriber->answered) && janus_videoroom_subscriber_schedule_update(subscriber)) {
+					/* We'll send a single offer for all the changes in the next few ms */
+					scheduled = TRUE;
+				}
+				janus_mutex_unlock(&subscriber->streams_mutex);
+				janus_mutex_unlock(&subscriber->room->mutex);
+				if(scheduled || !janus_videoroom_subscriber_send_update(subscriber, msg->transaction)) {
+					/* We're still waiting for an answer to a previous offer (or
+					 * we're waiting for more changes to come), postpone this */
+					JANUS_LOG(LOG_VERB, "Post-poning new offer, %s\n",
+						scheduled ? "coalescing with other changes" : "waiting for previous answer");
 					/* Send a temporary event */
 					event = json_object();
 					json_object_set_new(event, "videoroom", json_string("updating"));
@@ -11690,45 +13805,6 @@ static void *janus_videoroom_handler(void *data) {
 						json_string(subscriber->room_id_str) : json_integer(subscriber->room_id));
 					gateway->push_event(msg->handle, &janus_videoroom_plugin, msg->transaction, event, NULL);
 					json_decref(event);
-					/* Decrease the references we took before, if any */
-					while(publishers) {
-						janus_videoroom_publisher *publisher = (janus_videoroom_publisher *)publishers->data;
-						janus_refcount_decrease(&publisher->session->ref);
-						janus_refcount_decrease(&publisher->ref);
-						publishers = g_list_remove(publishers, publisher);
-					}
-					janus_refcount_decrease(&subscriber->ref);
-					janus_videoroom_message_free(msg);
-					continue;
-				}
-				event = json_object();
-				json_object_set_new(event, "videoroom", json_string("updated"));
-				json_object_set_new(event, "room", string_ids ?
-					json_string(subscriber->room_id_str) : json_integer(subscriber->room_id));
-				json_t *media = janus_videoroom_subscriber_streams_summary(subscriber, FALSE, NULL);
-				json_t *media_event = NULL;
-				if(notify_events && gateway->events_is_enabled())
-					media_event = json_deep_copy(media);
-				json_object_set_new(event, "streams", media);
-				/* Generate a new offer */
-				json_t *jsep = janus_videoroom_subscriber_offer(subscriber);
-				janus_mutex_unlock(&subscriber->streams_mutex);
-				janus_mutex_unlock(&subscriber->room->mutex);
-				/* How long will the Janus core take to push the event? */
-				gint64 start = janus_get_monotonic_time();
-				int res = gateway->push_event(msg->handle, &janus_videoroom_plugin, msg->transaction, event, jsep);
-				JANUS_LOG(LOG_VERB, "  >> Pushing event: %d (took %"SCNu64" us)\n", res, janus_get_monotonic_time()-start);
-				json_decref(event);
-				json_decref(jsep);
-				/* Also notify event handlers */
-				if(notify_events && gateway->events_is_enabled()) {
-					json_t *info = json_object();
-					json_object_set_new(info, "event", json_string("updated"));
-					json_object_set_new(info, "room", string_ids ?
-						json_string(subscriber->room_id_str) : json_integer(subscriber->room_id));
-					json_object_set_new(info, "streams", media_event);
-					json_object_set_new(info, "private_id", json_integer(subscriber->pvt_id));
-					gateway->notify_event(&janus_videoroom_plugin, session->handle, info);
 				}
 				/* Decrease the references we took before, if any */
 				while(publishers) {
@@ -11884,6 +13960,7 @@ static void *janus_videoroom_handler(void *data) {
 								stream->context.seq_reset = TRUE;
 							}
 							stream->send = newaudio;
+							janus_videoroom_relay_targets_changed();
 						}
 						if(video && stream->type == JANUS_VIDEOROOM_MEDIA_VIDEO) {
 							gboolean oldvideo = stream->send;
@@ -11893,13 +13970,16 @@ static void *janus_videoroom_handler(void *data) {
 								stream->context.seq_reset = TRUE;
 							}
 							stream->send = newvideo;
+							janus_videoroom_relay_targets_changed();
 							if(newvideo) {
 								/* Send a PLI */
 								janus_videoroom_reqpli(ps, "Restoring video for subscriber");
 							}
 						}
-						if(data && stream->type == JANUS_VIDEOROOM_MEDIA_DATA)
+						if(data && stream->type == JANUS_VIDEOROOM_MEDIA_DATA) {
 							stream->send = json_is_true(data);
+							janus_videoroom_relay_targets_changed();
+						}
 						/* Let's also see if this is the right mid */
 						if(mid && strcasecmp(stream->mid, mid)) {
 							temp = temp->next;
@@ -11913,6 +13993,7 @@ static void *janus_videoroom_handler(void *data) {
 								stream->context.seq_reset = TRUE;
 							}
 							stream->send = json_is_true(send);
+							janus_videoroom_relay_targets_changed();
 							if(newsend) {
 								/* Send a PLI */
 								janus_videoroom_reqpli(ps, "Restoring video for subscriber");
@@ -12138,6 +14219,7 @@ static void *janus_videoroom_handler(void *data) {
 						JANUS_LOG(LOG_ERR, "No such feed (%s)\n", feed_id_str);
 						error_code = JANUS_VIDEOROOM_ERROR_NO_SUCH_FEED;
 						g_snprintf(error_cause, 512, "No such feed (%s)", feed_id_str);
+						janus_videoroom_notify_directory(session, subscriber->room, NULL, feed);
 						janus_refcount_decrease(&subscriber->ref);
 						goto error;
 					}
@@ -12245,6 +14327,7 @@ static void *janus_videoroom_handler(void *data) {
 						JANUS_LOG(LOG_ERR, "No such feed (%s)\n", feed_id_str);
 						error_code = JANUS_VIDEOROOM_ERROR_NO_SUCH_FEED;
 						g_snprintf(error_cause, 512, "No such feed (%s)", feed_id_str);
+						janus_videoroom_notify_directory(session, subscriber->room, NULL, feed);
 						/* Unref publishers we may have taken note of so far */
 						while(publishers) {
 							publisher = (janus_videoroom_publisher *)publishers->data;
@@ -12370,6 +14453,7 @@ static void *janus_videoroom_handler(void *data) {
 						janus_videoroom_publisher_stream *stream_ps = stream->publisher_streams->data;
 						janus_mutex_lock(&stream_ps->subscribers_mutex);
 						stream_ps->subscribers = g_slist_remove(stream_ps->subscribers, stream);
+						janus_videoroom_relay_targets_changed();
 						stream->publisher_streams = g_slist_remove(stream->publisher_streams, stream_ps);
 						/* Remove the subscriber from the helper threads too, if any */
 						if(subscriber->room && subscriber->room->helper_threads > 0) {
@@ -12399,6 +14483,7 @@ static void *janus_videoroom_handler(void *data) {
 					janus_mutex_lock(&ps->subscribers_mutex);
 					stream->publisher_streams = g_slist_append(stream->publisher_streams, ps);
 					ps->subscribers = g_slist_append(ps->subscribers, stream);
+					janus_videoroom_relay_targets_changed();
 					/* If we're using helper threads, add the subscriber to one of those */
 					if(subscriber->room && subscriber->room->helper_threads > 0) {
 						int subscribers = -1;
@@ -12429,6 +14514,7 @@ static void *janus_videoroom_handler(void *data) {
 					stream->sim_context.rid_ext_id = ps->rid_extmap_id;
 					janus_mutex_unlock(&ps->rid_mutex);
 					stream->send = TRUE;
+					janus_videoroom_relay_targets_changed();
 					json_t *substream = json_object_get(s, "substream");
 					int substream_target = substream ? json_integer_value(substream) : 2;
 					if(substream_target >= 0 && substream_target <= 2) {
@@ -12467,7 +14553,7 @@ static void *janus_videoroom_handler(void *data) {
 						stream->svc_context.temporal_target = 2;
 					}
 					janus_mutex_unlock(&ps->subscribers_mutex);
-					janus_videoroom_reqpli(ps, "Subscriber switch");
+					janus_videoroom_subscriber_stream_request_keyframe(stream, ps, "Subscriber switch");
 					if(unref)
 						janus_refcount_decrease(&stream->ref);
 					janus_refcount_decrease(&stream->ref);
@@ -12483,6 +14569,7 @@ static void *janus_videoroom_handler(void *data) {
 				}
 				/* Done */
 				subscriber->paused = paused;
+				janus_videoroom_relay_targets_changed();
 				event = json_object();
 				json_object_set_new(event, "videoroom", json_string("event"));
 				json_object_set_new(event, "switched", json_string("ok"));
@@ -12509,43 +14596,8 @@ static void *janus_videoroom_handler(void *data) {
 				/* Check if we need a renegotiation as well */
 				if(update) {
 					/* We do */
-					janus_mutex_lock(&subscriber->streams_mutex);
-					if(!g_atomic_int_get(&subscriber->answered)) {
-						/* We're still waiting for an answer to a previous offer, postpone this */
-						g_atomic_int_set(&subscriber->pending_offer, 1);
-						janus_mutex_unlock(&subscriber->streams_mutex);
+					if(!janus_videoroom_subscriber_send_update(subscriber, msg->transaction))
 						JANUS_LOG(LOG_VERB, "Post-poning new offer, waiting for previous answer\n");
-					} else {
-						json_t *revent = json_object();
-						json_object_set_new(revent, "videoroom", json_string("updated"));
-						json_object_set_new(revent, "room", string_ids ?
-							json_string(subscriber->room_id_str) : json_integer(subscriber->room_id));
-						json_t *media = janus_videoroom_subscriber_streams_summary(subscriber, FALSE, NULL);
-						json_t *media_event = NULL;
-						if(notify_events && gateway->events_is_enabled())
-							media_event = json_deep_copy(media);
-						json_object_set_new(revent, "streams", media);
-						/* Generate a new offer */
-						json_t *jsep = janus_videoroom_subscriber_offer(subscriber);
-						janus_mutex_unlock(&subscriber->streams_mutex);
-						/* How long will the Janus core take to push the event? */
-						gint64 start = janus_get_monotonic_time();
-						int res = gateway->push_event(msg->handle, &janus_videoroom_plugin, msg->transaction, revent, jsep);
-						JANUS_LOG(LOG_VERB, "  >> Pushing event: %d (took %"SCNu64" us)\n", res, janus_get_monotonic_time()-start);
-						json_decref(revent);
-						json_decref(jsep);
-						/* Also notify event handlers */
-						if(notify_events && gateway->events_is_enabled()) {
-							json_t *info = json_object();
-							json_object_set_new(info, "event", json_string("updated"));
-							json_object_set_new(info, "room", string_ids ?
-								json_string(subscriber->room_id_str) : json_integer(subscriber->room_id));
-							json_object_set_new(info, "room", json_integer(subscriber->room_id));
-							json_object_set_new(info, "streams", media_event);
-							json_object_set_new(info, "private_id", json_integer(subscriber->pvt_id));
-							gateway->notify_event(&janus_videoroom_plugin, session->handle, info);
-						}
-					}
 				}
 			} else if(!strcasecmp(request_text, "leave")) {
 				guint64 room_id = subscriber ? subscriber->room_id : 0;
@@ -12620,49 +14672,27 @@ static void *janus_videoroom_handler(void *data) {
 					janus_sdp_mline *m = (janus_sdp_mline *)temp->data;
 					if(m->direction != JANUS_SDP_INACTIVE) {
 						janus_videoroom_subscriber_stream *stream = g_hash_table_lookup(subscriber->streams_byid, GINT_TO_POINTER(m->index));
-						if(stream)
+						if(stream) {
+							/* Check if RED was accepted, or if we'll have to send the primary block only */
+							stream->opusred_pt = 0;
+							if(stream->type == JANUS_VIDEOROOM_MEDIA_AUDIO) {
+								int opusred_pt = janus_sdp_get_opusred_pt(answer, m->index);
+								if(opusred_pt > 0)
+									stream->opusred_pt = opusred_pt;
+							}
 							g_atomic_int_set(&stream->ready, 1);
+							janus_videoroom_relay_targets_changed();
+						}
 					}
 					temp = temp->next;
 				}
 				janus_sdp_destroy(answer);
+				g_atomic_int_set(&subscriber->answered, 1);
+				janus_mutex_unlock(&subscriber->streams_mutex);
 				/* Check if we have other pending offers to send for this subscriber */
 				if(g_atomic_int_compare_and_exchange(&subscriber->pending_offer, 1, 0)) {
 					JANUS_LOG(LOG_VERB, "Pending offer, sending it now\n");
-					event = json_object();
-					json_object_set_new(event, "videoroom", json_string("updated"));
-					json_object_set_new(event, "room", string_ids ?
-						json_string(subscriber->room_id_str) : json_integer(subscriber->room_id));
-					json_t *media = janus_videoroom_subscriber_streams_summary(subscriber, FALSE, NULL);
-					json_t *media_event = NULL;
-					if(notify_events && gateway->events_is_enabled())
-						media_event = json_deep_copy(media);
-					json_object_set_new(event, "streams", media);
-					/* Generate a new offer */
-					json_t *jsep = janus_videoroom_subscriber_offer(subscriber);
-					/* Do we need an ICE restart as well? */
-					if(g_atomic_int_compare_and_exchange(&subscriber->pending_restart, 1, 0))
-						json_object_set_new(jsep, "restart", json_true());
-					janus_mutex_unlock(&subscriber->streams_mutex);
-					/* How long will the Janus core take to push the event? */
-					gint64 start = janus_get_monotonic_time();
-					int res = gateway->push_event(session->handle, &janus_videoroom_plugin, NULL, event, jsep);
-					JANUS_LOG(LOG_VERB, "  >> Pushing event: %d (took %"SCNu64" us)\n", res, janus_get_monotonic_time()-start);
-					json_decref(event);
-					json_decref(jsep);
-					/* Also notify event handlers */
-					if(notify_events && gateway->events_is_enabled()) {
-						json_t *info = json_object();
-						json_object_set_new(info, "event", json_string("updated"));
-						json_object_set_new(info, "room", string_ids ?
-							json_string(subscriber->room_id_str) : json_integer(subscriber->room_id));
-						json_object_set_new(info, "streams", media_event);
-						json_object_set_new(info, "private_id", json_integer(subscriber->pvt_id));
-						gateway->notify_event(&janus_videoroom_plugin, session->handle, info);
-					}
-				} else {
-					g_atomic_int_set(&subscriber->answered, 1);
-					janus_mutex_unlock(&subscriber->streams_mutex);
+					janus_videoroom_subscriber_send_update(subscriber, NULL);
 				}
 				janus_refcount_decrease(&subscriber->ref);
 				janus_videoroom_message_free(msg);
@@ -12796,6 +14826,7 @@ static void *janus_videoroom_handler(void *data) {
 						janus_refcount_init(&ps->ref, janus_videoroom_publisher_stream_free);
 						janus_refcount_increase(&ps->ref);	/* This is for the mid-indexed hashtable */
 						janus_mutex_init(&ps->subscribers_mutex);
+						janus_mutex_init(&ps->keyframe_mutex);
 						janus_mutex_init(&ps->rtp_forwarders_mutex);
 						janus_mutex_init(&ps->rid_mutex);
 						ps->rtp_forwarders = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_rtp_forwarder_destroy);
@@ -13006,7 +15037,15 @@ static void *janus_videoroom_handler(void *data) {
 								JANUS_SDP_OA_ACCEPT_EXTMAP, JANUS_RTP_EXTMAP_RID,
 								JANUS_SDP_OA_ACCEPT_EXTMAP, JANUS_RTP_EXTMAP_REPAIRED_RID,
 								JANUS_SDP_OA_ACCEPT_EXTMAP, videoroom->audiolevel_ext ? JANUS_RTP_EXTMAP_AUDIO_LEVEL : NULL,
+								JANUS_SDP_OA_ACCEPT_OPUSRED, videoroom->do_opusred,
 							JANUS_SDP_OA_DONE);
+						/* Check if we ended up accepting RED for this stream */
+						ps->opusred_pt = 0;
+						if(videoroom->do_opusred && ps->acodec == JANUS_AUDIOCODEC_OPUS) {
+							int opusred_pt = janus_sdp_get_opusred_pt(answer, m->index);
+							if(opusred_pt > 0)
+								ps->opusred_pt = opusred_pt;
+						}
 						janus_sdp_mline *m_answer = janus_sdp_mline_find_by_index(answer, m->index);
 						if(m_answer != NULL) {
 							/* TODO Remove, this is just here for backwards compatibility */
@@ -13096,50 +15135,7 @@ static void *janus_videoroom_handler(void *data) {
 						g_hash_table_iter_init(&iter, participant->remote_recipients);
 						while(g_hash_table_iter_next(&iter, NULL, &value)) {
 							janus_videoroom_remote_recipient *r = (janus_videoroom_remote_recipient *)value;
-							janus_rtp_forwarder *f = NULL;
-							if(r) {
-								if(ps->type == JANUS_VIDEOROOM_MEDIA_AUDIO) {
-									/* Audio stream */
-									f = janus_videoroom_rtp_forwarder_add_helper(participant, ps,
-										r->host, r->port, -1, 0,
-										(REMOTE_PUBLISHER_BASE_SSRC + ps->mindex*REMOTE_PUBLISHER_SSRC_STEP),
-										FALSE, r->srtp_suite, r->srtp_crypto, 0, FALSE, FALSE);
-									if(f != NULL)
-										f->metadata = g_strdup(r->remote_id);
-								} else if(ps->type == JANUS_VIDEOROOM_MEDIA_VIDEO) {
-									/* Video stream */
-									gboolean add_rtcp = (!r->rtcp_added && r->rtcp_port > 0);
-									f = janus_videoroom_rtp_forwarder_add_helper(participant, ps,
-										r->host, r->port, add_rtcp ? r->rtcp_port : -1, 0,
-										(REMOTE_PUBLISHER_BASE_SSRC + ps->mindex*REMOTE_PUBLISHER_SSRC_STEP),
-										FALSE, r->srtp_suite, r->srtp_crypto, 0, TRUE, FALSE);
-									if(f != NULL)
-										f->metadata = g_strdup(r->remote_id);
-									if(add_rtcp)
-										r->rtcp_added = TRUE;
-									/* Check if there's simulcast substreams we need to relay too */
-									if(ps->vssrc[1] || ps->rid[1]) {
-										f = janus_videoroom_rtp_forwarder_add_helper(participant, ps,
-											r->host, r->port, -1, 0,
-											(REMOTE_PUBLISHER_BASE_SSRC + ps->mindex*REMOTE_PUBLISHER_SSRC_STEP + 1),
-											FALSE, r->srtp_suite, r->srtp_crypto, 1, TRUE, FALSE);
-										if(f != NULL)
-											f->metadata = g_strdup(r->remote_id);
-									}
-									if(ps->vssrc[2] || ps->rid[2]) {
-										f = janus_videoroom_rtp_forwarder_add_helper(participant, ps,
-											r->host, r->port, -1, 0,
-											(REMOTE_PUBLISHER_BASE_SSRC + ps->mindex*REMOTE_PUBLISHER_SSRC_STEP + 2),
-											FALSE, r->srtp_suite, r->srtp_crypto, 2, TRUE, FALSE);
-										if(f != NULL)
-											f->metadata = g_strdup(r->remote_id);
-									}
-								} else {
-									/* Data stream */
-									f = janus_videoroom_rtp_forwarder_add_helper(participant, ps,
-										r->host, r->port, 0, 0, 0, FALSE, 0, NULL, 0, FALSE, TRUE);
-								}
-							}
+							janus_videoroom_remote_recipient_add_stream(participant, ps, r);
 						}
 					}
 					temp = temp->next;
@@ -13267,30 +15263,396 @@ error:
 			janus_videoroom_message_free(msg);
 		}
 	}
-	JANUS_LOG(LOG_VERB, "Leaving VideoRoom handler thread\n");
-	return NULL;
+	JANUS_LOG(LOG_VERB, "Leaving VideoRoom handler thread #%u\n", worker->id);
+	return NULL;
+}
+
+/* Helper to enforce the lowest of the caps we have on what a subscriber stream can receive */
+static void janus_videoroom_subscriber_stream_apply_caps(janus_videoroom_subscriber_stream *stream, gboolean svc) {
+	int cap = stream->bwe_cap;
+	if(stream->speaker_cap > -1 && (cap == -1 || stream->speaker_cap < cap))
+		cap = stream->speaker_cap;
+	if(svc)
+		stream->svc_context.spatial_cap = cap;
+	else
+		stream->sim_context.substream_cap = cap;
+}
+
+/* Active speakers: we sort publishers by how loud they are (talking ones first,
+ * then the ones that talked more recently) and mark the first ones as active.
+ * Since this happens for all publishers at the end of each audio level window,
+ * we only take a snapshot of the levels with the room locked (in a buffer we
+ * reuse, and only grow when there are more publishers), and sort later */
+typedef struct janus_videoroom_speaker {
+	janus_videoroom_publisher *publisher;
+	float loudness;
+	gint64 last;
+} janus_videoroom_speaker;
+static int janus_videoroom_speaker_compare(const void *a, const void *b) {
+	const janus_videoroom_speaker *s1 = (const janus_videoroom_speaker *)a;
+	const janus_videoroom_speaker *s2 = (const janus_videoroom_speaker *)b;
+	if(s1->loudness != s2->loudness)
+		return s1->loudness > s2->loudness ? -1 : 1;
+	if(s1->last != s2->last)
+		return s1->last > s2->last ? -1 : 1;
+	return 0;
+}
+static void janus_videoroom_update_active_speakers(janus_videoroom *videoroom,
+		janus_videoroom_publisher *participant, gboolean talking, float level) {
+	/* Different publishers may all get here at the same time: the ranking we
+	 * end up with must come from the latest snapshot, so we serialize them */
+	janus_mutex_lock(&videoroom->speakers_mutex);
+	janus_mutex_lock(&videoroom->mutex);
+	/* Lower dBov values mean louder */
+	participant->speaker_loudness = talking ? (127 - level) : 0;
+	if(talking)
+		participant->speaker_last = janus_get_cached_monotonic_time();
+	guint num = g_hash_table_size(videoroom->participants);
+	if(num == 0) {
+		janus_mutex_unlock(&videoroom->mutex);
+		janus_mutex_unlock(&videoroom->speakers_mutex);
+		return;
+	}
+	if(num > videoroom->speakers_size) {
+		videoroom->speakers = g_realloc(videoroom->speakers, num * sizeof(janus_videoroom_speaker));
+		videoroom->speakers_size = num;
+	}
+	janus_videoroom_speaker *publishers = videoroom->speakers;
+	guint i = 0;
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, videoroom->participants);
+	while(i < num && g_hash_table_iter_next(&iter, NULL, &value)) {
+		janus_videoroom_publisher *p = (janus_videoroom_publisher *)value;
+		janus_refcount_increase(&p->ref);
+		publishers[i].publisher = p;
+		publishers[i].loudness = p->speaker_loudness;
+		publishers[i].last = p->speaker_last;
+		i++;
+	}
+	janus_mutex_unlock(&videoroom->mutex);
+	qsort(publishers, i, sizeof(janus_videoroom_speaker), janus_videoroom_speaker_compare);
+	num = i;
+	for(i=0; videoroom->active_speakers > 0 && i<num; i++) {
+		janus_videoroom_publisher *p = publishers[i].publisher;
+		gint active = (i < (guint)videoroom->active_speakers) ? 1 : 0;
+		if(g_atomic_int_get(&p->speaker_active) != active) {
+			JANUS_LOG(LOG_VERB, "[%s] Publisher %s is %s an active speaker\n",
+				videoroom->room_id_str, p->user_id_str, active ? "now" : "not anymore");
+			g_atomic_int_set(&p->speaker_active, active);
+		}
+	}
+	if(videoroom->audio_last_n > 0) {
+		/* Last-N audio: publishers we relay already keep their slot for as long as
+		 * they're talking, so that louder ones can't make them flap; any slot left
+		 * goes to the others in order (talking first, then the most recent ones) */
+		guint slots = videoroom->audio_last_n, taken = 0;
+		gboolean *relay = g_malloc0(num * sizeof(gboolean));
+		for(i=0; i<num && taken<slots; i++) {
+			if(publishers[i].loudness > 0 && !g_atomic_int_get(&publishers[i].publisher->audio_dropped)) {
+				relay[i] = TRUE;
+				taken++;
+			}
+		}
+		for(i=0; i<num && taken<slots; i++) {
+			if(!relay[i]) {
+				relay[i] = TRUE;
+				taken++;
+			}
+		}
+		for(i=0; i<num; i++) {
+			janus_videoroom_publisher *p = publishers[i].publisher;
+			gint dropped = relay[i] ? 0 : 1;
+			if(g_atomic_int_get(&p->audio_dropped) != dropped) {
+				JANUS_LOG(LOG_VERB, "[%s] %s the audio of publisher %s (last-N)\n",
+					videoroom->room_id_str, dropped ? "Dropping" : "Relaying", p->user_id_str);
+				if(!dropped)
+					g_atomic_int_inc(&p->audio_epoch);
+				g_atomic_int_set(&p->audio_dropped, dropped);
+			}
+		}
+		g_free(relay);
+	}
+	for(i=0; i<num; i++) {
+		janus_refcount_decrease(&publishers[i].publisher->ref);
+		publishers[i].publisher = NULL;
+	}
+	janus_mutex_unlock(&videoroom->speakers_mutex);
+}
+/* Helper to cap the substream/layer relayed to a subscriber stream, depending on
+ * whether the related publisher is one of the active speakers in the room */
+static void janus_videoroom_subscriber_stream_speaker_check(janus_videoroom_subscriber_stream *stream,
+		janus_videoroom_publisher_stream *ps, gboolean svc) {
+	janus_videoroom *room = stream->subscriber->room;
+	int cap = -1;
+	if(room && room->active_speakers > 0 && ps->publisher && !g_atomic_int_get(&ps->publisher->speaker_active))
+		cap = 0;
+	if(cap == stream->speaker_cap)
+		return;
+	JANUS_LOG(LOG_VERB, "%s %s of mid %s (active speakers)\n", cap == -1 ? "Uncapping" : "Capping",
+		svc ? "spatial layer" : "substream", stream->mid);
+	stream->speaker_cap = cap;
+	janus_videoroom_subscriber_stream_apply_caps(stream, svc);
+	/* We'll need a keyframe to switch */
+	janus_videoroom_reqpli(ps, "Active speakers");
+}
+
+/* Helper to cap the substream (simulcast) or spatial layer (SVC) we send a
+ * subscriber stream, according to the bandwidth the core estimated for it */
+static void janus_videoroom_subscriber_stream_bwe_check(janus_videoroom_subscriber_stream *stream,
+		janus_videoroom_publisher_stream *ps, gboolean svc) {
+	gint64 now = janus_get_cached_monotonic_time();
+	if(stream->bwe_checked > 0 && now - stream->bwe_checked < G_USEC_PER_SEC/2)
+		return;
+	stream->bwe_checked = now;
+	janus_videoroom_subscriber *subscriber = stream->subscriber;
+	if(!stream->bwe_counted) {
+		stream->bwe_counted = TRUE;
+		g_atomic_int_inc(&subscriber->bwe_streams);
+	}
+	int *cap = &stream->bwe_cap;
+	guint32 estimate = gateway->get_bandwidth_estimate(subscriber->session->handle);
+	if(estimate == 0) {
+		/* No estimate (yet?), don't cap anything */
+		if(*cap != -1) {
+			*cap = -1;
+			janus_videoroom_subscriber_stream_apply_caps(stream, svc);
+		}
+		return;
+	}
+	/* We split the estimate equally among the streams of this subscriber that can adapt */
+	int streams = g_atomic_int_get(&subscriber->bwe_streams);
+	guint32 budget = estimate / (streams > 0 ? streams : 1);
+	int current = (*cap == -1) ? 2 : *cap;
+	int layer = -1, i = 0;
+	guint32 needed = 0;
+	for(i=0; i<3; i++) {
+		guint32 bitrate = g_atomic_int_get(&ps->layer_bitrate[i]);
+		if(bitrate == 0)
+			continue;
+		/* SVC layers depend on the ones below, so their bitrates add up */
+		needed = svc ? (needed + bitrate) : bitrate;
+		/* Leave some headroom before going up */
+		guint32 required = (i > current) ? (needed + needed*15/100) : needed;
+		if(layer != -1 && required > budget)
+			break;
+		layer = i;
+	}
+	if(layer == -1) {
+		/* We don't know anything about the bitrates yet */
+		return;
+	}
+	if(layer > current && now - stream->bwe_downgraded < 5*G_USEC_PER_SEC) {
+		/* We went down recently, wait a bit before going up again */
+		layer = current;
+	} else if(layer < current) {
+		stream->bwe_downgraded = now;
+	}
+	int new_cap = (layer == 2) ? -1 : layer;
+	if(new_cap != *cap) {
+		JANUS_LOG(LOG_VERB, "Estimated bandwidth is %"SCNu32" (%"SCNu32" per stream), capping %s of mid %s to %d\n",
+			estimate, budget, svc ? "spatial layer" : "substream", stream->mid, layer);
+		*cap = new_cap;
+		janus_videoroom_subscriber_stream_apply_caps(stream, svc);
+		/* We'll need a keyframe to switch */
+		janus_videoroom_reqpli(ps, "Bandwidth estimation");
+	}
+}
+
+/* Subscriptions we relay RTP packets to: rather than walking the list of
+ * subscriptions of a publisher stream for each packet, and checking whether
+ * each of them can receive media, we keep a compact array of the ones that
+ * can, that is rebuilt whenever something that may affect it changes (we
+ * also rebuild it every second anyway, as a safety net). Since subscriptions
+ * may still become unavailable in the meanwhile, the relay still checks them */
+static volatile gint relay_targets_generation = 0;
+static void janus_videoroom_relay_targets_changed(void) {
+	g_atomic_int_inc(&relay_targets_generation);
+}
+static gboolean janus_videoroom_subscriber_stream_is_relayable(janus_videoroom_subscriber_stream *stream,
+		janus_videoroom_publisher_stream *ps) {
+	if(!stream || !g_atomic_int_get(&stream->ready) || g_atomic_int_get(&stream->destroyed) ||
+			!stream->send || g_atomic_int_get(&stream->suspended) || !stream->publisher_streams ||
+			!stream->subscriber || stream->subscriber->paused || stream->subscriber->kicked ||
+			!stream->subscriber->session || !stream->subscriber->session->handle ||
+			!g_atomic_int_get(&stream->subscriber->session->started))
+		return FALSE;
+	return (ps != NULL && stream->publisher_streams->data == ps);
+}
+static void janus_videoroom_publisher_stream_update_relay_targets(janus_videoroom_publisher_stream *ps) {
+	/* Note: must be called with ps->subscribers_mutex locked */
+	gint generation = g_atomic_int_get(&relay_targets_generation);
+	gint64 now = janus_get_cached_monotonic_time();
+	if(ps->relay_targets_built > 0 && ps->relay_targets_generation == generation &&
+			now - ps->relay_targets_built < G_USEC_PER_SEC)
+		return;
+	guint size = g_slist_length(ps->subscribers);
+	if(size > ps->relay_targets_size) {
+		ps->relay_targets_size = size + 16;
+		ps->relay_targets = g_realloc(ps->relay_targets,
+			ps->relay_targets_size * sizeof(janus_videoroom_subscriber_stream *));
+	}
+	ps->relay_targets_num = 0;
+	GSList *l = ps->subscribers;
+	while(l) {
+		janus_videoroom_subscriber_stream *stream = (janus_videoroom_subscriber_stream *)l->data;
+		if(janus_videoroom_subscriber_stream_is_relayable(stream, ps))
+			ps->relay_targets[ps->relay_targets_num++] = stream;
+		l = l->next;
+	}
+	ps->relay_targets_generation = generation;
+	ps->relay_targets_built = now;
+}
+
+/* Keyframe cache: we keep the latest keyframe of each video (sub)stream, and
+ * the packets that followed it, so that we can replay them to new subscribers
+ * and have them start decoding right away, rather than waiting for a PLI */
+static gboolean janus_videoroom_is_keyframe(janus_videocodec vcodec, char *payload, int plen) {
+	if(vcodec == JANUS_VIDEOCODEC_VP8)
+		return janus_vp8_is_keyframe(payload, plen);
+	else if(vcodec == JANUS_VIDEOCODEC_VP9)
+		return janus_vp9_is_keyframe(payload, plen);
+	else if(vcodec == JANUS_VIDEOCODEC_H264)
+		return janus_h264_is_keyframe(payload, plen);
+	else if(vcodec == JANUS_VIDEOCODEC_AV1)
+		return janus_av1_is_keyframe(payload, plen);
+	else if(vcodec == JANUS_VIDEOCODEC_H265)
+		return janus_h265_is_keyframe(payload, plen);
+	return FALSE;
+}
+static void janus_videoroom_keyframe_cache_clear(janus_videoroom_keyframe_cache *kc) {
+	janus_videoroom_rtp_relay_packet *pkt = NULL;
+	while((pkt = g_queue_pop_head(kc->packets)) != NULL)
+		janus_videoroom_rtp_relay_packet_free(pkt);
+}
+static void janus_videoroom_keyframe_cache_add(janus_videoroom_publisher_stream *ps, int sc,
+		janus_videoroom_rtp_relay_packet *packet) {
+	if(sc < 0 || sc > 2)
+		return;
+	int plen = 0;
+	char *payload = janus_rtp_payload((char *)packet->data, packet->length, &plen);
+	if(payload == NULL)
+		return;
+	gboolean keyframe = janus_videoroom_is_keyframe(ps->vcodec, payload, plen);
+	gint64 now = janus_get_cached_monotonic_time();
+	janus_mutex_lock_nodebug(&ps->keyframe_mutex);
+	janus_videoroom_keyframe_cache *kc = &ps->keyframe_cache[sc];
+	if(kc->packets == NULL)
+		kc->packets = g_queue_new();
+	if(!keyframe && !g_queue_is_empty(kc->packets) && now - kc->last_added > G_USEC_PER_SEC) {
+		/* The stream was interrupted, what we have is useless now */
+		janus_videoroom_keyframe_cache_clear(kc);
+	}
+	if(keyframe && (g_queue_is_empty(kc->packets) || packet->timestamp != kc->keyframe_ts)) {
+		/* New keyframe, start from scratch */
+		janus_videoroom_keyframe_cache_clear(kc);
+		kc->keyframe_ts = packet->timestamp;
+		kc->keyframe_packets = 0;
+		kc->truncated = FALSE;
+	} else if(g_queue_is_empty(kc->packets) || (kc->truncated && packet->timestamp != kc->keyframe_ts)) {
+		/* Either we don't have a keyframe yet, or the GOP is too long to cache */
+		janus_mutex_unlock_nodebug(&ps->keyframe_mutex);
+		return;
+	}
+	janus_videoroom_rtp_relay_packet *copy = g_malloc0(sizeof(janus_videoroom_rtp_relay_packet));
+	*copy = *packet;
+	copy->data = g_malloc(packet->length);
+	memcpy(copy->data, packet->data, packet->length);
+	g_queue_push_tail(kc->packets, copy);
+	kc->last_added = now;
+	if(packet->timestamp == kc->keyframe_ts) {
+		kc->keyframe_packets++;
+	} else if(g_queue_get_length(kc->packets) > JANUS_VIDEOROOM_KEYFRAME_CACHE_MAX) {
+		/* The GOP is too long to cache, only keep the keyframe */
+		while(g_queue_get_length(kc->packets) > kc->keyframe_packets)
+			janus_videoroom_rtp_relay_packet_free(g_queue_pop_tail(kc->packets));
+		kc->truncated = TRUE;
+	}
+	janus_mutex_unlock_nodebug(&ps->keyframe_mutex);
+}
+/* Helper to get a new subscriber stream a keyframe: we replay the cached one if
+ * the room is configured to do that, and only send a PLI to the publisher otherwise */
+static void janus_videoroom_subscriber_stream_request_keyframe(janus_videoroom_subscriber_stream *stream,
+		janus_videoroom_publisher_stream *ps, const char *reason) {
+	janus_videoroom *room = stream->subscriber ? stream->subscriber->room : NULL;
+	if(room != NULL && room->keyframe_cache && ps->type == JANUS_VIDEOROOM_MEDIA_VIDEO) {
+		/* We'll check if there's anything to replay when the next packet arrives */
+		g_atomic_int_set(&stream->keyframe_replay, 1);
+		return;
+	}
+	janus_videoroom_reqpli(ps, reason);
+}
+/* Replay the cached keyframe (and the packets that followed it) to a subscriber:
+ * returns TRUE if the live packet that triggered the replay was part of it */
+static gboolean janus_videoroom_keyframe_cache_replay(janus_videoroom_subscriber_stream *stream,
+		janus_videoroom_publisher_stream *ps, janus_videoroom_rtp_relay_packet *packet) {
+	/* Pick the substream closest to what the subscriber wants */
+	int sc = 0;
+	if(packet->simulcast) {
+		sc = stream->sim_context.substream_target;
+		if(stream->sim_context.substream_cap > -1 && sc > stream->sim_context.substream_cap)
+			sc = stream->sim_context.substream_cap;
+		if(sc < 0 || sc > 2)
+			sc = 0;
+	}
+	janus_mutex_lock_nodebug(&ps->keyframe_mutex);
+	while(sc > 0 && (ps->keyframe_cache[sc].packets == NULL || g_queue_is_empty(ps->keyframe_cache[sc].packets)))
+		sc--;
+	janus_videoroom_keyframe_cache *kc = &ps->keyframe_cache[sc];
+	if(kc->packets == NULL || g_queue_is_empty(kc->packets)) {
+		janus_mutex_unlock_nodebug(&ps->keyframe_mutex);
+		janus_videoroom_reqpli(ps, "New subscriber (no cached keyframe)");
+		return FALSE;
+	}
+	JANUS_LOG(LOG_VERB, "Replaying %u cached packets (substream %d) to new subscriber of %s (#%d)\n",
+		g_queue_get_length(kc->packets), sc, ps->publisher->user_id_str, ps->mindex);
+	char buffer[1500];
+	janus_videoroom_rtp_relay_packet copy;
+	janus_videoroom_rtp_relay_packet *cached = NULL;
+	GList *l = kc->packets->head;
+	while(l) {
+		cached = (janus_videoroom_rtp_relay_packet *)l->data;
+		l = l->next;
+		if(cached->length > (gint)sizeof(buffer))
+			continue;
+		/* Relaying may modify the packet, so we use a copy */
+		copy = *cached;
+		memcpy(buffer, cached->data, cached->length);
+		copy.data = (janus_rtp_header *)buffer;
+		janus_videoroom_relay_rtp_packet(stream, &copy);
+	}
+	/* If we couldn't cache the whole GOP, we'll need a fresh keyframe anyway */
+	gboolean truncated = kc->truncated;
+	/* Check if the live packet was replayed already (or is older than the ones we replayed) */
+	gboolean replayed = (cached != NULL && cached->data->ssrc == packet->data->ssrc &&
+		(gint16)(packet->seq_number - cached->seq_number) <= 0);
+	janus_mutex_unlock_nodebug(&ps->keyframe_mutex);
+	if(truncated)
+		janus_videoroom_reqpli(ps, "New subscriber (cached keyframe only)");
+	return replayed;
 }
 
 /* Helper to quickly relay RTP packets from publishers to subscribers */
 static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data) {
-	janus_videoroom_rtp_relay_packet *packet = (janus_videoroom_rtp_relay_packet *)user_data;
+	janus_videoroom_relay_rtp_packet_batch((janus_videoroom_subscriber_stream *)data,
+		(janus_videoroom_rtp_relay_packet *)user_data, NULL);
+}
+static void janus_videoroom_relay_rtp_packet_batch(janus_videoroom_subscriber_stream *stream,
+		janus_videoroom_rtp_relay_packet *packet, janus_videoroom_relay_batch *batch) {
 	if(!packet || !packet->data || packet->length < 1) {
 		JANUS_LOG(LOG_ERR, "Invalid packet...\n");
 		return;
 	}
-	janus_videoroom_subscriber_stream *stream = (janus_videoroom_subscriber_stream *)data;
-	if(!stream || !g_atomic_int_get(&stream->ready) || g_atomic_int_get(&stream->destroyed) ||
-			!stream->send || !stream->publisher_streams ||
-			!stream->subscriber || stream->subscriber->paused || stream->subscriber->kicked ||
-			!stream->subscriber->session || !stream->subscriber->session->handle ||
-			!g_atomic_int_get(&stream->subscriber->session->started))
-		return;
-	janus_videoroom_publisher_stream *ps = stream->publisher_streams ?
-		stream->publisher_streams->data : NULL;
-	if(ps != packet->source || ps == NULL)
+	janus_videoroom_publisher_stream *ps = packet->source;
+	if(!janus_videoroom_subscriber_stream_is_relayable(stream, ps))
 		return;
 	janus_videoroom_subscriber *subscriber = stream->subscriber;
 	janus_videoroom_session *session = subscriber->session;
+	/* If this is a new subscriber, replay the latest keyframe first */
+	if(packet->is_video && g_atomic_int_compare_and_exchange(&stream->keyframe_replay, 1, 0)) {
+		if(janus_videoroom_keyframe_cache_replay(stream, ps, packet))
+			return;
+	}
 
 	/* Make sure there hasn't been a publisher switch by checking the SSRC */
 	if(packet->is_video) {
@@ -13301,6 +15663,11 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 			char *payload = janus_rtp_payload((char *)packet->data, packet->length, &plen);
 			if(payload == NULL)
 				return;
+			/* Check if the estimated bandwidth limits which layer we can send */
+			if(subscriber->room && subscriber->room->bwe)
+				janus_videoroom_subscriber_stream_bwe_check(stream, ps, TRUE);
+			/* Check if we should only send the lowest layer, because this is not an active speaker */
+			janus_videoroom_subscriber_stream_speaker_check(stream, ps, TRUE);
 			/* Process this packet: don't relay if it's not the layer we wanted to handle */
 			char rtph[12];
 			memcpy(&rtph, packet->data, sizeof(rtph));
@@ -13346,7 +15713,7 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 					rtp.extensions.min_delay = stream->min_delay;
 					rtp.extensions.max_delay = stream->max_delay;
 				}
-				gateway->relay_rtp(session->handle, &rtp);
+				janus_videoroom_relay_batch_add(batch, session->handle, &rtp);
 			}
 			/* Restore the timestamp and sequence number to what the publisher set them to */
 			memcpy(packet->data, &rtph, sizeof(rtph));
@@ -13356,13 +15723,17 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 			char *payload = janus_rtp_payload((char *)packet->data, packet->length, &plen);
 			if(payload == NULL)
 				return;
+			/* Check if the estimated bandwidth limits which substream we can send */
+			if(subscriber->room && subscriber->room->bwe)
+				janus_videoroom_subscriber_stream_bwe_check(stream, ps, FALSE);
+			/* Check if we should only send the lowest substream, because this is not an active speaker */
+			janus_videoroom_subscriber_stream_speaker_check(stream, ps, FALSE);
 			/* Process this packet: don't relay if it's not the SSRC/layer we wanted to handle */
-			gboolean relay = janus_rtp_simulcasting_context_process_rtp(&stream->sim_context,
-				(char *)packet->data, packet->length, packet->extensions.dd_content, packet->extensions.dd_len,
-				packet->ssrc, NULL, ps->vcodec, &stream->context, &ps->rid_mutex);
+			gboolean relay = janus_rtp_simulcasting_context_process_packet(&stream->sim_context,
+				&packet->sim_info, packet->extensions.dd_content, packet->extensions.dd_len, &stream->context);
 			if(!relay) {
 				/* Did a lot of time pass before we could relay a packet? */
-				gint64 now = janus_get_monotonic_time();
+				gint64 now = janus_get_cached_monotonic_time();
 				if((now - stream->sim_context.last_relayed) >= G_USEC_PER_SEC) {
 					g_atomic_int_set(&stream->sim_context.need_pli, 1);
 				}
@@ -13413,7 +15784,11 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 					rtp.extensions.min_delay = stream->min_delay;
 					rtp.extensions.max_delay = stream->max_delay;
 				}
-				gateway->relay_rtp(session->handle, &rtp);
+				/* For VP8 we rewrote the payload descriptor too, so we can't batch this */
+				if(ps->vcodec == JANUS_VIDEOCODEC_VP8)
+					gateway->relay_rtp(session->handle, &rtp);
+				else
+					janus_videoroom_relay_batch_add(batch, session->handle, &rtp);
 			}
 			/* Restore the timestamp and sequence number to what the publisher set them to */
 			packet->data->timestamp = htonl(packet->timestamp);
@@ -13433,38 +15808,60 @@ static void janus_videoroom_relay_rtp_packet(gpointer data, gpointer user_data)
 					rtp.extensions.min_delay = stream->min_delay;
 					rtp.extensions.max_delay = stream->max_delay;
 				}
-				gateway->relay_rtp(session->handle, &rtp);
+				janus_videoroom_relay_batch_add(batch, session->handle, &rtp);
 			}
 			/* Restore the timestamp and sequence number to what the publisher set them to */
 			packet->data->timestamp = htonl(packet->timestamp);
 			packet->data->seq_number = htons(packet->seq_number);
 		}
 	} else {
+		/* If the room only relays the audio of the last N speakers, check this one is */
+		janus_videoroom *room = subscriber->room;
+		if(room && room->audio_last_n > 0 && ps->publisher) {
+			if(g_atomic_int_get(&ps->publisher->audio_dropped))
+				return;
+			gint epoch = g_atomic_int_get(&ps->publisher->audio_epoch);
+			if(stream->audio_epoch != epoch) {
+				/* We're relaying this publisher again: make sure there's no gap in sequence numbers */
+				stream->audio_epoch = epoch;
+				stream->context.seq_reset = TRUE;
+			}
+		}
+		/* If this is RED and the subscriber didn't negotiate it, use the unwrapped copy */
+		janus_rtp_header *data = packet->data;
+		gint length = packet->length;
+		if(packet->red && stream->opusred_pt <= 0) {
+			if(packet->primary == NULL)
+				return;
+			data = packet->primary;
+			length = packet->primary_length;
+		}
 		/* Fix sequence number and timestamp (publisher switching may be involved) */
-		janus_rtp_header_update(packet->data, &stream->context, FALSE, 0);
+		janus_rtp_header_update(data, &stream->context, FALSE, 0);
 		/* Send the packet */
 		if(gateway != NULL) {
-			janus_plugin_rtp rtp = { .mindex = stream->mindex, .video = packet->is_video, .buffer = (char *)packet->data, .length = packet->length,
+			janus_plugin_rtp rtp = { .mindex = stream->mindex, .video = packet->is_video, .buffer = (char *)data, .length = length,
 				.extensions = packet->extensions };
-			gateway->relay_rtp(session->handle, &rtp);
+			janus_videoroom_relay_batch_add(batch, session->handle, &rtp);
 		}
 		/* Restore the timestamp and sequence number to what the publisher set them to */
-		packet->data->timestamp = htonl(packet->timestamp);
-		packet->data->seq_number = htons(packet->seq_number);
+		data->timestamp = htonl(packet->timestamp);
+		data->seq_number = htons(packet->seq_number);
 	}
 
 	return;
 }
 
-static void janus_videoroom_relay_data_packet(gpointer data, gpointer user_data) {
-	janus_videoroom_rtp_relay_packet *packet = (janus_videoroom_rtp_relay_packet *)user_data;
+static void janus_videoroom_relay_data_collect(gpointer data, gpointer user_data) {
+	janus_videoroom_data_fanout *fanout = (janus_videoroom_data_fanout *)user_data;
+	janus_videoroom_rtp_relay_packet *packet = fanout->packet;
 	if(!packet || packet->is_rtp || !packet->data || packet->length < 1) {
 		JANUS_LOG(LOG_ERR, "Invalid packet...\n");
 		return;
 	}
 	janus_videoroom_subscriber_stream *stream = (janus_videoroom_subscriber_stream *)data;
 	if(!stream || !g_atomic_int_get(&stream->ready) || g_atomic_int_get(&stream->destroyed) ||
-			!stream->send || !stream->publisher_streams ||
+			!stream->send || g_atomic_int_get(&stream->suspended) || !stream->publisher_streams ||
 			!stream->subscriber || stream->subscriber->paused || stream->subscriber->kicked ||
 			!stream->subscriber->session || !stream->subscriber->session->handle ||
 			!g_atomic_int_get(&stream->subscriber->session->started) ||
@@ -13473,22 +15870,27 @@ static void janus_videoroom_relay_data_packet(gpointer data, gpointer user_data)
 	janus_videoroom_publisher_stream *ps = packet->source;
 	if(ps->publisher == NULL || g_slist_find(stream->publisher_streams, ps) == NULL)
 		return;
-	janus_videoroom_subscriber *subscriber = stream->subscriber;
-	janus_videoroom_session *session = subscriber->session;
-
-	if(gateway != NULL && packet->data != NULL) {
-		JANUS_LOG(LOG_VERB, "Forwarding %s DataChannel message (%d bytes) to viewer\n",
-			packet->textdata ? "text" : "binary", packet->length);
+	/* We'll relay the message to this subscriber, together with the others */
+	g_ptr_array_add(fanout->handles, stream->subscriber->session->handle);
+}
+static void janus_videoroom_relay_data_fanout_send(janus_videoroom_data_fanout *fanout) {
+	janus_videoroom_rtp_relay_packet *packet = fanout->packet;
+	janus_videoroom_publisher *publisher = packet ? packet->source->publisher : NULL;
+	if(gateway != NULL && publisher != NULL && fanout->handles->len > 0) {
+		JANUS_LOG(LOG_VERB, "Forwarding %s DataChannel message (%d bytes) to %u viewers\n",
+			packet->textdata ? "text" : "binary", packet->length, fanout->handles->len);
 		janus_plugin_data data = {
-			.label = ps->publisher->user_id_str,
+			.label = publisher->user_id_str,
 			.protocol = NULL,
 			.binary = !packet->textdata,
 			.buffer = (char *)packet->data,
 			.length = packet->length
 		};
-		gateway->relay_data(session->handle, &data);
+		int sent = gateway->relay_data_broadcast((janus_plugin_session **)fanout->handles->pdata, fanout->handles->len, &data);
+		if(sent > 0)
+			janus_usage_packets_out(fanout->usage, sent, (gsize)sent*packet->length, FALSE);
 	}
-	return;
+	g_ptr_array_free(fanout->handles, TRUE);
 }
 
 /* The following methods are only relevant if RTCP is used for RTP forwarders */
@@ -13505,38 +15907,7 @@ static void janus_videoroom_rtp_forwarder_rtcp_receive(janus_rtp_forwarder *rf,
 		} else {
 			/* Remotization, check the SSRC in the request so that we know
 			 * which publisher video stream we should send the PLI to */
-			uint32_t ssrc = 0;
-			janus_rtcp_header *rtcp = (janus_rtcp_header *)buffer;
-			int total = len;
-			while(rtcp && ssrc == 0) {
-				if(!janus_rtcp_check_len(rtcp, total))
-					return;		/* Invalid RTCP packet */
-				if(rtcp->version != 2)
-					return;		/* Invalid RTCP packet */
-				switch(rtcp->type) {
-					case RTCP_PSFB: {
-						gint fmt = rtcp->rc;
-						if(fmt == 1) {
-							if(!janus_rtcp_check_fci(rtcp, total, 0))
-								return;		/* Invalid RTCP packet */
-							/* TODO */
-							janus_rtcp_fb *rtcpfb = (janus_rtcp_fb *)rtcp;
-							ssrc = ntohl(rtcpfb->media);
-							break;
-						}
-					}
-					default:
-						break;
-				}
-				/* Is this a compound packet? */
-				int length = ntohs(rtcp->length);
-				if(length == 0)
-					break;
-				total -= length*4+4;
-				if(total <= 0)
-					break;
-				rtcp = (janus_rtcp_header *)((uint32_t*)rtcp + length + 1);
-			}
+			uint32_t ssrc = janus_videoroom_rtcp_pli_ssrc(buffer, len);
 			if(ssrc > 0) {
 				/* Look for the right publisher stream instance */
 				char *remote_id = (char *)rf->metadata;
@@ -13753,6 +16124,116 @@ static int janus_videoroom_get_fd_port(int fd) {
 	}
 	return ntohs(server.sin6_port);
 }
+/* Helper to handle an RTP packet (or data envelope) from a remote publisher */
+static void janus_videoroom_remote_publisher_incoming(janus_videoroom_publisher *publisher, char *buffer, int bytes) {
+	janus_rtp_header *rtp = NULL;
+	uint32_t ssrc = 0, diff = 0;
+	int mindex = 0, vindex = 0;
+	janus_videoroom_publisher_stream *ps = NULL;
+	janus_plugin_rtp pkt = { 0 };
+	janus_plugin_data data = { 0 };
+	rtp = (janus_rtp_header *)buffer;
+	ssrc = ntohl(rtp->ssrc);
+	if(ssrc < publisher->remote_ssrc_base) {
+		/* Can't be one of the SSRCs we're waiting for, innore */
+		JANUS_LOG(LOG_WARN, "[%s/%s] Invalid SSRC (%"SCNu32")\n",
+			publisher->room_id_str, publisher->user_id_str, ssrc);
+		return;
+	}
+	diff = ssrc - publisher->remote_ssrc_base;
+	mindex = diff/REMOTE_PUBLISHER_SSRC_STEP;
+	vindex = diff - (mindex*REMOTE_PUBLISHER_SSRC_STEP);
+	janus_mutex_lock(&publisher->streams_mutex);
+	ps = g_hash_table_lookup(publisher->streams_byid, GINT_TO_POINTER(mindex));
+	if(ps == NULL) {
+		janus_mutex_unlock(&publisher->streams_mutex);
+		JANUS_LOG(LOG_WARN, "[%s/%s] Invalid mindex %d\n",
+			publisher->room_id_str, publisher->user_id_str, mindex);
+		return;
+	}
+	if((!ps->simulcast && vindex > 0) || vindex > 2) {
+		janus_mutex_unlock(&publisher->streams_mutex);
+		JANUS_LOG(LOG_WARN, "[%s/%s] Invalid substream %d\n",
+			publisher->room_id_str, publisher->user_id_str, vindex);
+		return;
+	}
+	/* Check if this is an actual RTP packet, or an
+	 * envelope created to relay data channels */
+	if(ps->type == JANUS_VIDEOROOM_MEDIA_DATA) {
+		/* Handle as data channel, stripping the RTP header */
+		janus_refcount_increase_nodebug(&publisher->ref);
+		janus_mutex_unlock(&publisher->streams_mutex);
+		data.label = NULL;
+		data.protocol = NULL;
+		data.binary = rtp->type ? TRUE : FALSE;
+		data.buffer = buffer + 12;
+		data.length = bytes - 12;
+		/* Now handle the packet as if coming from a regular publisher */
+		janus_videoroom_incoming_data_internal(publisher->session, publisher, &data);
+		return;
+	}
+	/* Is this SRTP? */
+	if(ps->is_srtp) {
+		int buflen = bytes;
+		srtp_err_status_t res = srtp_unprotect(ps->srtp_ctx, buffer, &buflen);
+		if(res != srtp_err_status_ok) {
+			janus_mutex_unlock(&publisher->streams_mutex);
+			guint32 timestamp = ntohl(rtp->timestamp);
+			guint16 seq = ntohs(rtp->seq_number);
+			JANUS_LOG(LOG_ERR, "[%s] Publisher stream (#%d) SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
+				publisher->user_id_str, ps->mindex, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
+			return;
+		}
+		bytes = buflen;
+	}
+	/* Prepare the RTP packet */
+	pkt.mindex = mindex;
+	pkt.video = (ps->type == JANUS_VIDEOROOM_MEDIA_VIDEO);
+	pkt.buffer = buffer;
+	pkt.length = bytes;
+	janus_plugin_rtp_extensions_reset(&pkt.extensions);
+	janus_refcount_increase_nodebug(&publisher->ref);
+	janus_mutex_unlock(&publisher->streams_mutex);
+	/* Parse RTP extensions before relaying the packet */
+	if(!pkt.video && ps->audio_level_extmap_id > 0) {
+		gboolean vad = FALSE;
+		int level = -1;
+		if(janus_rtp_header_extension_parse_audio_level(buffer, bytes,
+				ps->audio_level_extmap_id, &vad, &level) == 0) {
+			pkt.extensions.audio_level = level;
+			pkt.extensions.audio_level_vad = vad;
+		}
+	}
+	if(pkt.video && ps->video_orient_extmap_id > 0) {
+		gboolean c = FALSE, f = FALSE, r1 = FALSE, r0 = FALSE;
+		if(janus_rtp_header_extension_parse_video_orientation(buffer, bytes,
+				ps->video_orient_extmap_id, &c, &f, &r1, &r0) == 0) {
+			pkt.extensions.video_rotation = 0;
+			if(r1 && r0)
+				pkt.extensions.video_rotation = 270;
+			else if(r1)
+				pkt.extensions.video_rotation = 180;
+			else if(r0)
+				pkt.extensions.video_rotation = 90;
+			pkt.extensions.video_back_camera = c;
+			pkt.extensions.video_flipped = f;
+		}
+	}
+	if(pkt.video && ps->playout_delay_extmap_id > 0) {
+		uint16_t min = 0, max = 0;
+		if(janus_rtp_header_extension_parse_playout_delay(buffer, bytes,
+				ps->playout_delay_extmap_id, &min, &max) == 0) {
+			pkt.extensions.min_delay = min;
+			pkt.extensions.max_delay = max;
+		}
+	}
+	/* Apply an SSRC offset to avoid issues when switching,
+	 * see https://github.com/meetecho/janus-gateway/issues/3444 */
+	rtp->ssrc = htonl(ntohl(rtp->ssrc) + publisher->remote_ssrc_offset);
+	/* Now handle the packet as if coming from a regular publisher */
+	janus_videoroom_incoming_rtp_internal(publisher->session, publisher, &pkt);
+}
+
 /* Thread responsible for a specific remote publisher */
 static void *janus_videoroom_remote_publisher_thread(void *user_data) {
 	janus_videoroom_publisher *publisher = (janus_videoroom_publisher *)user_data;
@@ -13786,13 +16267,7 @@ static void *janus_videoroom_remote_publisher_thread(void *user_data) {
 		goto cleanup;
 	}
 
-	/* RTP stuff */
-	janus_rtp_header *rtp = NULL;
-	uint32_t ssrc = 0, diff = 0;
-	int mindex = 0, vindex = 0;
 	janus_videoroom_publisher_stream *ps = NULL;
-	janus_plugin_rtp pkt = { 0 };
-	janus_plugin_data data = { 0 };
 	GList *temp = NULL;
 
 	/* As the first thing, we add the remote publisher to the list */
@@ -13897,110 +16372,13 @@ static void *janus_videoroom_remote_publisher_thread(void *user_data) {
 					/* Not RTP, drop the packet */
 					continue;
 				}
-				rtp = (janus_rtp_header *)buffer;
-				ssrc = ntohl(rtp->ssrc);
-				if(ssrc < REMOTE_PUBLISHER_BASE_SSRC) {
-					/* Can't be one of the SSRCs we're waiting for, innore */
-					JANUS_LOG(LOG_WARN, "[%s/%s] Invalid SSRC (%"SCNu32")\n",
-						videoroom->room_id_str, publisher->user_id_str, ssrc);
-					continue;
-				}
-				diff = ssrc - REMOTE_PUBLISHER_BASE_SSRC;
-				mindex = diff/REMOTE_PUBLISHER_SSRC_STEP;
-				vindex = diff - (mindex*REMOTE_PUBLISHER_SSRC_STEP);
-				janus_mutex_lock(&publisher->streams_mutex);
-				ps = g_hash_table_lookup(publisher->streams_byid, GINT_TO_POINTER(mindex));
-				if(ps == NULL) {
-					janus_mutex_unlock(&publisher->streams_mutex);
-					JANUS_LOG(LOG_WARN, "[%s/%s] Invalid mindex %d\n",
-						videoroom->room_id_str, publisher->user_id_str, mindex);
-					continue;
-				}
-				if((!ps->simulcast && vindex > 0) || vindex > 2) {
-					janus_mutex_unlock(&publisher->streams_mutex);
-					JANUS_LOG(LOG_WARN, "[%s/%s] Invalid substream %d\n",
-						videoroom->room_id_str, publisher->user_id_str, vindex);
-					continue;
-				}
-				/* Check if this is an actual RTP packet, or an
-				 * envelope created to relay data channels */
-				if(ps->type == JANUS_VIDEOROOM_MEDIA_DATA) {
-					/* Handle as data channel, stripping the RTP header */
-					janus_refcount_increase_nodebug(&publisher->ref);
-					janus_mutex_unlock(&publisher->streams_mutex);
-					data.label = NULL;
-					data.protocol = NULL;
-					data.binary = rtp->type ? TRUE : FALSE;
-					data.buffer = buffer + 12;
-					data.length = bytes - 12;
-					/* Now handle the packet as if coming from a regular publisher */
-					janus_videoroom_incoming_data_internal(publisher->session, publisher, &data);
-					continue;
-				}
-				/* Is this SRTP? */
-				if(ps->is_srtp) {
-					int buflen = bytes;
-					srtp_err_status_t res = srtp_unprotect(ps->srtp_ctx, buffer, &buflen);
-					if(res != srtp_err_status_ok) {
-						janus_mutex_unlock(&publisher->streams_mutex);
-						guint32 timestamp = ntohl(rtp->timestamp);
-						guint16 seq = ntohs(rtp->seq_number);
-						JANUS_LOG(LOG_ERR, "[%s] Publisher stream (#%d) SRTP unprotect error: %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")\n",
-							publisher->user_id_str, ps->mindex, janus_srtp_error_str(res), bytes, buflen, timestamp, seq);
-						continue;
-					}
-					bytes = buflen;
-				}
-				/* Prepare the RTP packet */
-				pkt.mindex = mindex;
-				pkt.video = (ps->type == JANUS_VIDEOROOM_MEDIA_VIDEO);
-				pkt.buffer = buffer;
-				pkt.length = bytes;
-				janus_plugin_rtp_extensions_reset(&pkt.extensions);
-				janus_refcount_increase_nodebug(&publisher->ref);
-				janus_mutex_unlock(&publisher->streams_mutex);
-				/* Parse RTP extensions before relaying the packet */
-				if(!pkt.video && ps->audio_level_extmap_id > 0) {
-					gboolean vad = FALSE;
-					int level = -1;
-					if(janus_rtp_header_extension_parse_audio_level(buffer, bytes,
-							ps->audio_level_extmap_id, &vad, &level) == 0) {
-						pkt.extensions.audio_level = level;
-						pkt.extensions.audio_level_vad = vad;
-					}
-				}
-				if(pkt.video && ps->video_orient_extmap_id > 0) {
-					gboolean c = FALSE, f = FALSE, r1 = FALSE, r0 = FALSE;
-					if(janus_rtp_header_extension_parse_video_orientation(buffer, bytes,
-							ps->video_orient_extmap_id, &c, &f, &r1, &r0) == 0) {
-						pkt.extensions.video_rotation = 0;
-						if(r1 && r0)
-							pkt.extensions.video_rotation = 270;
-						else if(r1)
-							pkt.extensions.video_rotation = 180;
-						else if(r0)
-							pkt.extensions.video_rotation = 90;
-						pkt.extensions.video_back_camera = c;
-						pkt.extensions.video_flipped = f;
-					}
-				}
-				if(pkt.video && ps->playout_delay_extmap_id > 0) {
-					uint16_t min = 0, max = 0;
-					if(janus_rtp_header_extension_parse_playout_delay(buffer, bytes,
-							ps->playout_delay_extmap_id, &min, &max) == 0) {
-						pkt.extensions.min_delay = min;
-						pkt.extensions.max_delay = max;
-					}
-				}
-				/* Apply an SSRC offset to avoid issues when switching,
-				 * see https://github.com/meetecho/janus-gateway/issues/3444 */
-				rtp->ssrc = htonl(ntohl(rtp->ssrc) + publisher->remote_ssrc_offset);
-				/* Now handle the packet as if coming from a regular publisher */
-				janus_videoroom_incoming_rtp_internal(publisher->session, publisher, &pkt);
+				janus_videoroom_remote_publisher_incoming(publisher, buffer, bytes);
 			}
 		}
 	}
 cleanup:
+	/* If we were sharing a listener with other remote publishers, stop */
+	janus_videoroom_node_listener_remove(videoroom, publisher);
 	/* If we got here, the remote publisher has been removed from the
 	 * room: let's notify all other publishers in the room */
 	janus_mutex_lock(&publisher->rec_mutex);
@@ -14039,6 +16417,7 @@ cleanup:
 		}
 		g_slist_free(ps->subscribers);
 		ps->subscribers = NULL;
+		janus_videoroom_relay_targets_changed();
 		int i=0;
 		for(i=0; i<3; i++) {
 			ps->vssrc[i] = 0;
@@ -14062,35 +16441,12 @@ cleanup:
 				/* We're still waiting for an answer to a previous offer, postpone this */
 				g_atomic_int_set(&subscriber->pending_offer, 1);
 				janus_mutex_unlock(&subscriber->streams_mutex);
+			} else if(janus_videoroom_subscriber_schedule_update(subscriber)) {
+				/* We'll send a single offer for all the changes in the next few ms */
+				janus_mutex_unlock(&subscriber->streams_mutex);
 			} else {
-				json_t *event = json_object();
-				json_object_set_new(event, "videoroom", json_string("updated"));
-				json_object_set_new(event, "room", string_ids ?
-					json_string(subscriber->room_id_str) : json_integer(subscriber->room_id));
-				json_t *media = janus_videoroom_subscriber_streams_summary(subscriber, FALSE, NULL);
-				json_t *media_event = NULL;
-				if(notify_events && gateway->events_is_enabled())
-					media_event = json_deep_copy(media);
-				json_object_set_new(event, "streams", media);
-				/* Generate a new offer */
-				json_t *jsep = janus_videoroom_subscriber_offer(subscriber);
 				janus_mutex_unlock(&subscriber->streams_mutex);
-				/* How long will the Janus core take to push the event? */
-				gint64 start = janus_get_monotonic_time();
-				int res = gateway->push_event(subscriber->session->handle, &janus_videoroom_plugin, NULL, event, jsep);
-				JANUS_LOG(LOG_VERB, "  >> Pushing event: %d (took %"SCNu64" us)\n", res, janus_get_monotonic_time()-start);
-				json_decref(event);
-				json_decref(jsep);
-				/* Also notify event handlers */
-				if(notify_events && gateway->events_is_enabled()) {
-					json_t *info = json_object();
-					json_object_set_new(info, "event", json_string("updated"));
-					json_object_set_new(info, "room", string_ids ?
-						json_string(subscriber->room_id_str) : json_integer(subscriber->room_id));
-					json_object_set_new(info, "streams", media_event);
-					json_object_set_new(info, "private_id", json_integer(subscriber->pvt_id));
-					gateway->notify_event(&janus_videoroom_plugin, NULL, info);
-				}
+				janus_videoroom_subscriber_send_update(subscriber, NULL);
 			}
 			janus_refcount_decrease(&subscriber->session->ref);
 			janus_refcount_decrease(&subscriber->ref);
@@ -14115,6 +16471,380 @@ cleanup:
 	return NULL;
 }
 
+/* Helper to cascade a local publisher to a remote node: must be called with the room mutex locked */
+static void janus_videoroom_remote_node_attach(janus_videoroom_remote_node *node, janus_videoroom_publisher *p) {
+	if(node == NULL || p == NULL || p->remote || p->dummy || g_atomic_int_get(&node->destroyed))
+		return;
+	janus_mutex_lock(&p->rtp_forwarders_mutex);
+	janus_mutex_lock(&p->streams_mutex);
+	if(g_hash_table_lookup(p->remote_recipients, node->remote_id) != NULL) {
+		/* Already cascaded to this node */
+		janus_mutex_unlock(&p->streams_mutex);
+		janus_mutex_unlock(&p->rtp_forwarders_mutex);
+		return;
+	}
+	if(p->udp_sock <= 0) {
+		p->udp_sock = socket(!ipv6_disabled ? AF_INET6 : AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		int v6only = 0;
+		if(p->udp_sock <= 0 ||
+				(!ipv6_disabled && setsockopt(p->udp_sock, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only)) != 0)) {
+			janus_mutex_unlock(&p->streams_mutex);
+			janus_mutex_unlock(&p->rtp_forwarders_mutex);
+			JANUS_LOG(LOG_ERR, "[%s] Could not open UDP socket to cascade publisher to remote node %s, %d (%s)\n",
+				p->user_id_str, node->node_id, errno, g_strerror(errno));
+			return;
+		}
+	}
+	/* Assign a slot to this publisher */
+	janus_mutex_lock(&node->mutex);
+	guint slot = node->next_slot++;
+	janus_refcount_increase(&p->ref);
+	g_hash_table_insert(node->publishers, GUINT_TO_POINTER(slot), p);
+	janus_mutex_unlock(&node->mutex);
+	/* Keep track of this remotization as we'd do for any other */
+	janus_videoroom_remote_recipient *r = g_malloc0(sizeof(janus_videoroom_remote_recipient));
+	r->remote_id = g_strdup(node->remote_id);
+	r->host = g_strdup(node->host);
+	r->port = node->port;
+	r->ssrc_base = REMOTE_PUBLISHER_BASE_SSRC + slot*REMOTE_NODE_SLOT_STEP;
+	r->srtp_suite = node->srtp_suite;
+	r->srtp_crypto = node->srtp_crypto ? g_strdup(node->srtp_crypto) : NULL;
+	g_hash_table_insert(p->remote_recipients, g_strdup(node->remote_id), r);
+	/* Forward the streams we have already, new ones will be added when negotiated */
+	GList *temp = p->streams;
+	while(temp) {
+		janus_videoroom_remote_recipient_add_stream(p, (janus_videoroom_publisher_stream *)temp->data, r);
+		temp = temp->next;
+	}
+	janus_mutex_unlock(&p->streams_mutex);
+	janus_mutex_unlock(&p->rtp_forwarders_mutex);
+	JANUS_LOG(LOG_VERB, "[%s] Cascading publisher %s to remote node %s (slot %u)\n",
+		p->room_id_str, p->user_id_str, node->node_id, slot);
+	/* Notify event handlers, as the remote node will need to know about the slot */
+	if(notify_events && gateway->events_is_enabled()) {
+		json_t *info = json_object();
+		json_object_set_new(info, "event", json_string("cascaded"));
+		json_object_set_new(info, "room", string_ids ? json_string(p->room_id_str) : json_integer(p->room_id));
+		json_object_set_new(info, "id", string_ids ? json_string(p->user_id_str) : json_integer(p->user_id));
+		json_object_set_new(info, "node_id", json_string(node->node_id));
+		json_object_set_new(info, "slot", json_integer(slot));
+		gateway->notify_event(&janus_videoroom_plugin, NULL, info);
+	}
+}
+
+/* Helper to stop cascading a local publisher to a remote node: must be called with the room mutex locked */
+static void janus_videoroom_remote_node_detach(janus_videoroom_remote_node *node, janus_videoroom_publisher *p) {
+	if(node == NULL || p == NULL || p->remote)
+		return;
+	janus_mutex_lock(&p->rtp_forwarders_mutex);
+	janus_mutex_lock(&p->streams_mutex);
+	janus_videoroom_remote_recipient *r = g_hash_table_lookup(p->remote_recipients, node->remote_id);
+	if(r == NULL) {
+		janus_mutex_unlock(&p->streams_mutex);
+		janus_mutex_unlock(&p->rtp_forwarders_mutex);
+		return;
+	}
+	guint slot = (r->ssrc_base - REMOTE_PUBLISHER_BASE_SSRC)/REMOTE_NODE_SLOT_STEP;
+	janus_videoroom_remote_recipient_remove_forwarders(p, node->remote_id);
+	g_hash_table_remove(p->remote_recipients, node->remote_id);
+	janus_mutex_unlock(&p->streams_mutex);
+	janus_mutex_unlock(&p->rtp_forwarders_mutex);
+	janus_mutex_lock(&node->mutex);
+	if(g_hash_table_lookup(node->publishers, GUINT_TO_POINTER(slot)) == p)
+		g_hash_table_remove(node->publishers, GUINT_TO_POINTER(slot));
+	janus_mutex_unlock(&node->mutex);
+	JANUS_LOG(LOG_VERB, "[%s] Stopped cascading publisher %s to remote node %s (slot %u)\n",
+		p->room_id_str, p->user_id_str, node->node_id, slot);
+}
+
+/* Helper to find the media SSRC a PLI in an RTCP compound packet refers to */
+static uint32_t janus_videoroom_rtcp_pli_ssrc(char *buffer, int len) {
+	janus_rtcp_header *rtcp = (janus_rtcp_header *)buffer;
+	int total = len;
+	while(rtcp) {
+		if(!janus_rtcp_check_len(rtcp, total))
+			return 0;		/* Invalid RTCP packet */
+		if(rtcp->version != 2)
+			return 0;		/* Invalid RTCP packet */
+		if(rtcp->type == RTCP_PSFB && rtcp->rc == 1) {
+			if(!janus_rtcp_check_fci(rtcp, total, 0))
+				return 0;		/* Invalid RTCP packet */
+			janus_rtcp_fb *rtcpfb = (janus_rtcp_fb *)rtcp;
+			return ntohl(rtcpfb->media);
+		}
+		/* Is this a compound packet? */
+		int length = ntohs(rtcp->length);
+		if(length == 0)
+			break;
+		total -= length*4+4;
+		if(total <= 0)
+			break;
+		rtcp = (janus_rtcp_header *)((uint32_t*)rtcp + length + 1);
+	}
+	return 0;
+}
+
+/* Thread receiving RTCP feedback from a remote node, for all the publishers cascaded to it */
+static void *janus_videoroom_remote_node_thread(void *data) {
+	janus_videoroom_remote_node *node = (janus_videoroom_remote_node *)data;
+	JANUS_LOG(LOG_VERB, "[%s] Joining remote node thread\n", node->node_id);
+	char buffer[1500];
+	struct pollfd fds[1];
+	int res = 0, len = 0;
+	gint64 now = 0, latched = 0;
+	janus_rtp_header rtp = { 0 };
+	rtp.version = 2;
+	socklen_t addrlen = node->rtcp_addr.ss_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+	while(!g_atomic_int_get(&node->destroyed) && !g_atomic_int_get(&stopping)) {
+		/* Send an empty RTP packet to the remote node every few seconds: this
+		 * allows it to latch to us, and keeps any NAT binding in between alive */
+		now = janus_get_monotonic_time();
+		if(now - latched >= 5*G_USEC_PER_SEC) {
+			(void)sendto(node->rtcp_fd, &rtp, 12, 0, (struct sockaddr *)&node->rtcp_addr, addrlen);
+			latched = now;
+		}
+		fds[0].fd = node->rtcp_fd;
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		res = poll(fds, 1, 1000);
+		if(res < 0) {
+			if(errno == EINTR)
+				continue;
+			JANUS_LOG(LOG_ERR, "[%s] Error polling remote node RTCP socket... %d (%s)\n",
+				node->node_id, errno, g_strerror(errno));
+			break;
+		} else if(res == 0) {
+			/* No data, keep going */
+			continue;
+		}
+		if(fds[0].revents & (POLLERR | POLLHUP)) {
+			JANUS_LOG(LOG_ERR, "[%s] Error polling remote node RTCP socket: %s...\n",
+				node->node_id, fds[0].revents & POLLERR ? "POLLERR" : "POLLHUP");
+			break;
+		}
+		len = recvfrom(node->rtcp_fd, buffer, sizeof(buffer), 0, NULL, NULL);
+		if(len <= 0 || !janus_is_rtcp(buffer, len))
+			continue;
+		/* We only handle incoming video PLIs at the moment */
+		if(!janus_rtcp_has_pli(buffer, len))
+			continue;
+		uint32_t ssrc = janus_videoroom_rtcp_pli_ssrc(buffer, len);
+		if(ssrc < REMOTE_PUBLISHER_BASE_SSRC + REMOTE_NODE_SLOT_STEP)
+			continue;
+		/* The SSRC tells us both the publisher (slot) and the stream (mindex) */
+		uint32_t diff = ssrc - REMOTE_PUBLISHER_BASE_SSRC;
+		guint slot = diff/REMOTE_NODE_SLOT_STEP;
+		int mindex = (diff % REMOTE_NODE_SLOT_STEP)/REMOTE_PUBLISHER_SSRC_STEP;
+		janus_mutex_lock(&node->mutex);
+		janus_videoroom_publisher *p = g_hash_table_lookup(node->publishers, GUINT_TO_POINTER(slot));
+		if(p != NULL)
+			janus_refcount_increase(&p->ref);
+		janus_mutex_unlock(&node->mutex);
+		if(p == NULL)
+			continue;
+		janus_mutex_lock(&p->streams_mutex);
+		janus_videoroom_publisher_stream *ps = g_hash_table_lookup(p->streams_byid, GINT_TO_POINTER(mindex));
+		if(ps != NULL)
+			janus_refcount_increase(&ps->ref);
+		janus_mutex_unlock(&p->streams_mutex);
+		if(ps != NULL) {
+			if(ps->type == JANUS_VIDEOROOM_MEDIA_VIDEO)
+				janus_videoroom_reqpli(ps, "RTCP from remote node");
+			janus_refcount_decrease(&ps->ref);
+		}
+		janus_refcount_decrease(&p->ref);
+	}
+	JANUS_LOG(LOG_VERB, "[%s] Leaving remote node thread\n", node->node_id);
+	janus_refcount_decrease(&node->ref);
+	return NULL;
+}
+
+/* Helper to create a listener shared by the remote publishers coming from the same
+ * node: takes ownership of the sockets, and must be called with the room mutex locked */
+static janus_videoroom_node_listener *janus_videoroom_node_listener_create(janus_videoroom *room,
+		const char *node_id, int fd, int rtcp_fd, const char *host) {
+	janus_videoroom_node_listener *listener = g_malloc0(sizeof(janus_videoroom_node_listener));
+	listener->node_id = g_strdup(node_id);
+	listener->room_id_str = g_strdup(room->room_id_str);
+	listener->fd = fd;
+	listener->rtcp_fd = rtcp_fd;
+	listener->port = janus_videoroom_get_fd_port(fd);
+	listener->rtcp_port = janus_videoroom_get_fd_port(rtcp_fd);
+	g_strlcpy(listener->host, host, sizeof(listener->host));
+	listener->publishers = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_videoroom_publisher_dereference);
+	janus_mutex_init(&listener->mutex);
+	janus_refcount_init(&listener->ref, janus_videoroom_node_listener_free);
+	/* Spawn the thread that will receive media for all remote publishers */
+	GError *error = NULL;
+	char tname[32];
+	g_snprintf(tname, sizeof(tname), "vnode %s", node_id);
+	janus_refcount_increase(&listener->ref);
+	listener->thread = g_thread_try_new(tname, janus_videoroom_node_listener_thread, listener, &error);
+	if(error != NULL) {
+		JANUS_LOG(LOG_ERR, "Could not spawn thread for remote node %s listener, %d (%s)\n",
+			node_id, error->code, error->message ? error->message : "??");
+		g_error_free(error);
+		janus_refcount_decrease(&listener->ref);
+		janus_refcount_decrease(&listener->ref);
+		return NULL;
+	}
+	if(room->node_listeners == NULL) {
+		room->node_listeners = g_hash_table_new_full(g_str_hash, g_str_equal,
+			(GDestroyNotify)g_free, (GDestroyNotify)janus_videoroom_node_listener_destroy);
+	}
+	g_hash_table_insert(room->node_listeners, g_strdup(node_id), listener);
+	JANUS_LOG(LOG_VERB, "[%s] Created listener for remote node %s (ports %"SCNu16"/%"SCNu16")\n",
+		room->room_id_str, node_id, listener->port, listener->rtcp_port);
+	return listener;
+}
+
+/* Helper to remove a remote publisher from the listener it shares with others,
+ * if any: when the last one goes away, the listener is destroyed as well */
+static void janus_videoroom_node_listener_remove(janus_videoroom *room, janus_videoroom_publisher *p) {
+	janus_videoroom_node_listener *listener = p->remote_node;
+	if(room == NULL || listener == NULL)
+		return;
+	janus_mutex_lock(&room->mutex);
+	janus_mutex_lock(&listener->mutex);
+	if(g_hash_table_lookup(listener->publishers, GUINT_TO_POINTER(p->remote_slot)) == p)
+		g_hash_table_remove(listener->publishers, GUINT_TO_POINTER(p->remote_slot));
+	gboolean empty = (g_hash_table_size(listener->publishers) == 0);
+	janus_mutex_unlock(&listener->mutex);
+	if(empty && room->node_listeners != NULL &&
+			g_hash_table_lookup(room->node_listeners, listener->node_id) == listener) {
+		JANUS_LOG(LOG_VERB, "[%s] No more remote publishers from node %s, removing listener\n",
+			room->room_id_str, listener->node_id);
+		g_hash_table_remove(room->node_listeners, listener->node_id);
+	}
+	janus_mutex_unlock(&room->mutex);
+}
+
+/* Helper to dispatch a packet received on a shared listener to the right remote publisher */
+static void janus_videoroom_node_listener_incoming(janus_videoroom_node_listener *listener, char *buffer, int bytes) {
+	if(!janus_is_rtp(buffer, bytes)) {
+		/* Not RTP, drop the packet */
+		return;
+	}
+	janus_rtp_header *rtp = (janus_rtp_header *)buffer;
+	uint32_t ssrc = ntohl(rtp->ssrc);
+	if(ssrc < REMOTE_PUBLISHER_BASE_SSRC)
+		return;
+	guint slot = (ssrc - REMOTE_PUBLISHER_BASE_SSRC)/REMOTE_NODE_SLOT_STEP;
+	janus_mutex_lock(&listener->mutex);
+	janus_videoroom_publisher *p = g_hash_table_lookup(listener->publishers, GUINT_TO_POINTER(slot));
+	if(p != NULL)
+		janus_refcount_increase_nodebug(&p->ref);
+	janus_mutex_unlock(&listener->mutex);
+	if(p == NULL) {
+		JANUS_LOG(LOG_HUGE, "[%s] Dropping packet from remote node %s, unknown slot %u\n",
+			listener->room_id_str, listener->node_id, slot);
+		return;
+	}
+	if(!g_atomic_int_get(&p->remote_leaving) && !g_atomic_int_get(&p->destroyed))
+		janus_videoroom_remote_publisher_incoming(p, buffer, bytes);
+	janus_refcount_decrease_nodebug(&p->ref);
+}
+
+/* Thread receiving media from a remote node, for all the remote publishers sharing its listener */
+static void *janus_videoroom_node_listener_thread(void *data) {
+	janus_videoroom_node_listener *listener = (janus_videoroom_node_listener *)data;
+	JANUS_LOG(LOG_VERB, "[%s] Joining remote node %s listener thread\n",
+		listener->room_id_str, listener->node_id);
+	socklen_t addrlen;
+	struct sockaddr_storage remote = { 0 };
+	struct pollfd fds[2];
+	char buffer[1500];
+	int num = 0, i = 0, res = 0, bytes = 0;
+	/* If the RTCP socket fails we stop polling it, if the media one does we stop */
+	int rtcp_fd = listener->rtcp_fd;
+	gboolean failed = FALSE;
+#ifdef HAVE_RECVMMSG
+	/* Since we're receiving media for many publishers on the same socket,
+	 * we read as many packets as we can with a single recvmmsg call */
+	struct mmsghdr msgs[REMOTE_NODE_RECV_BATCH];
+	struct iovec iovecs[REMOTE_NODE_RECV_BATCH];
+	char buffers[REMOTE_NODE_RECV_BATCH][1500];
+	memset(msgs, 0, sizeof(msgs));
+	for(i=0; i<REMOTE_NODE_RECV_BATCH; i++) {
+		iovecs[i].iov_base = buffers[i];
+		iovecs[i].iov_len = sizeof(buffers[i]);
+		msgs[i].msg_hdr.msg_iov = &iovecs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	int j = 0;
+#endif
+	while(!failed && !g_atomic_int_get(&listener->destroyed) && !g_atomic_int_get(&stopping)) {
+		/* Prepare poll */
+		num = 0;
+		fds[num].fd = listener->fd;
+		fds[num].events = POLLIN;
+		fds[num].revents = 0;
+		num++;
+		if(rtcp_fd != -1) {
+			fds[num].fd = rtcp_fd;
+			fds[num].events = POLLIN;
+			fds[num].revents = 0;
+			num++;
+		}
+		/* Wait for some data */
+		res = poll(fds, num, 1000);
+		if(res < 0) {
+			if(errno == EINTR)
+				continue;
+			JANUS_LOG(LOG_ERR, "[%s] Error polling remote node %s listener... %d (%s)\n",
+				listener->room_id_str, listener->node_id, errno, g_strerror(errno));
+			break;
+		} else if(res == 0) {
+			/* No data, keep going */
+			continue;
+		}
+		for(i=0; i<num; i++) {
+			if(fds[i].revents & (POLLERR | POLLHUP)) {
+				/* Socket error? */
+				JANUS_LOG(LOG_ERR, "[%s] Error polling remote node %s listener %s socket: %s...\n",
+					listener->room_id_str, listener->node_id, fds[i].fd == rtcp_fd ? "RTCP" : "media",
+					fds[i].revents & POLLERR ? "POLLERR" : "POLLHUP");
+				if(fds[i].fd == rtcp_fd) {
+					/* We can still receive media, we just won't latch anymore */
+					rtcp_fd = -1;
+					continue;
+				}
+				failed = TRUE;
+				break;
+			} else if(!(fds[i].revents & POLLIN)) {
+				continue;
+			}
+			if(fds[i].fd == rtcp_fd) {
+				/* Got something on the RTCP socket, we only use this for latching */
+				addrlen = sizeof(remote);
+				bytes = recvfrom(fds[i].fd, buffer, sizeof(buffer), 0, (struct sockaddr *)&remote, &addrlen);
+				if(bytes < 0 || (!janus_is_rtp(buffer, bytes) && !janus_is_rtcp(buffer, bytes))) {
+					/* For latching we need an RTP or RTCP packet */
+					continue;
+				}
+				janus_mutex_lock(&listener->mutex);
+				memcpy(&listener->rtcp_addr, &remote, addrlen);
+				janus_mutex_unlock(&listener->mutex);
+				continue;
+			}
+			/* Got RTP packets (or data envelopes) for one or more remote publishers */
+#ifdef HAVE_RECVMMSG
+			res = recvmmsg(fds[i].fd, msgs, REMOTE_NODE_RECV_BATCH, MSG_DONTWAIT, NULL);
+			for(j=0; j<res; j++)
+				janus_videoroom_node_listener_incoming(listener, buffers[j], msgs[j].msg_len);
+#else
+			bytes = recvfrom(fds[i].fd, buffer, sizeof(buffer), 0, NULL, NULL);
+			if(bytes > 0)
+				janus_videoroom_node_listener_incoming(listener, buffer, bytes);
+#endif
+		}
+	}
+	JANUS_LOG(LOG_VERB, "[%s] Leaving remote node %s listener thread\n",
+		listener->room_id_str, listener->node_id);
+	janus_refcount_decrease(&listener->ref);
+	return NULL;
+}
+
 static void janus_videoroom_helper_rtpdata_packet(gpointer data, gpointer user_data) {
 	janus_videoroom_rtp_relay_packet *packet = (janus_videoroom_rtp_relay_packet *)user_data;
 	if(!packet || !packet->data || packet->length < 1) {
@@ -14126,6 +16856,12 @@ static void janus_videoroom_helper_rtpdata_packet(gpointer data, gpointer user_d
 		//~ JANUS_LOG(LOG_ERR, "Invalid session...\n");
 		return;
 	}
+	/* Only bother this helper if it's serving any subscriber of this stream */
+	janus_mutex_lock(&helper->mutex);
+	gboolean serving = (g_hash_table_lookup(helper->subscribers, packet->source) != NULL);
+	janus_mutex_unlock(&helper->mutex);
+	if(!serving)
+		return;
 	/* Clone the packet and queue it for delivery on the helper thread */
 	janus_videoroom_rtp_relay_packet *copy = g_malloc0(sizeof(janus_videoroom_rtp_relay_packet));
 	copy->source = packet->source;
@@ -14136,6 +16872,7 @@ static void janus_videoroom_helper_rtpdata_packet(gpointer data, gpointer user_d
 	copy->textdata = packet->textdata;
 	copy->is_video = packet->is_video;
 	copy->simulcast = packet->simulcast;
+	copy->sim_info = packet->sim_info;
 	copy->ssrc[0] = packet->ssrc[0];
 	copy->ssrc[1] = packet->ssrc[1];
 	copy->ssrc[2] = packet->ssrc[2];
@@ -14143,32 +16880,108 @@ static void janus_videoroom_helper_rtpdata_packet(gpointer data, gpointer user_d
 	copy->svc_info = packet->svc_info;
 	copy->timestamp = packet->timestamp;
 	copy->seq_number = packet->seq_number;
+	copy->red = packet->red;
+	if(packet->primary != NULL) {
+		copy->primary = g_malloc(packet->primary_length);
+		memcpy(copy->primary, packet->primary, packet->primary_length);
+		copy->primary_length = packet->primary_length;
+	}
 	g_async_queue_push(helper->queued_packets, copy);
 }
 
+static void janus_videoroom_helpers_spawn(janus_videoroom *videoroom, int num) {
+	if(num <= 0)
+		return;
+	videoroom->helper_threads = num;
+	GError *error = NULL;
+	char tname[32];
+	int i=0, cpus = g_get_num_processors();
+	for(i=0; i<num; i++) {
+		janus_videoroom_helper *helper = g_malloc0(sizeof(janus_videoroom_helper));
+		helper->id = i+1;
+		helper->room = videoroom;
+		/* If pinning is enabled, helpers are spread across cores in a round robin way */
+		helper->cpu = pin_helper_threads ? (int)((guint)g_atomic_int_add(&helper_threads_cpu, 1) % cpus) : -1;
+		helper->subscribers = g_hash_table_new(NULL, NULL);
+		helper->queued_packets = g_async_queue_new_full((GDestroyNotify)janus_videoroom_rtp_relay_packet_free);
+		janus_mutex_init(&helper->mutex);
+		janus_refcount_init(&helper->ref, janus_videoroom_helper_free);
+		/* Spawn a thread and add references */
+		g_snprintf(tname, sizeof(tname), "vhelp %u-%s", helper->id, videoroom->room_id_str);
+		janus_refcount_increase(&videoroom->ref);
+		janus_refcount_increase(&helper->ref);
+		helper->thread = g_thread_try_new(tname, &janus_videoroom_helper_thread, helper, &error);
+		if(error != NULL) {
+			/* TODO Should this be a hard failure? */
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the helper thread...\n",
+				error->code, error->message ? error->message : "??");
+			g_clear_error(&error);
+		} else {
+			janus_refcount_increase(&helper->ref);
+			videoroom->threads = g_list_append(videoroom->threads, helper);
+		}
+	}
+}
+
 static void *janus_videoroom_helper_thread(void *data) {
 	janus_videoroom_helper *helper = (janus_videoroom_helper *)data;
 	janus_videoroom *room = helper->room;
 	janus_videoroom_publisher_stream *ps = NULL;
 	GList *subscribers = NULL;
 	JANUS_LOG(LOG_VERB, "[%s/#%d] Joining VideoRoom helper thread\n", room->room_id_str, helper->id);
+	/* If the core has a scheduling profile for helpers, it wins over pin_helper_threads */
+	char tname[64];
+	g_snprintf(tname, sizeof(tname), "vhelper %s/#%d", room->room_id_str, helper->id);
+	gboolean pinned = janus_sched_thread_start(JANUS_SCHED_HELPER, tname);
+#ifdef __linux__
+	if(helper->cpu >= 0 && !pinned) {
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		CPU_SET(helper->cpu, &cpuset);
+		if(sched_setaffinity(0, sizeof(cpuset), &cpuset) < 0) {
+			JANUS_LOG(LOG_WARN, "[%s/#%d] Couldn't pin helper thread to CPU %d: %d (%s)\n",
+				room->room_id_str, helper->id, helper->cpu, errno, g_strerror(errno));
+		} else {
+			JANUS_LOG(LOG_VERB, "[%s/#%d] Helper thread pinned to CPU %d\n", room->room_id_str, helper->id, helper->cpu);
+		}
+	}
+#endif
 	janus_videoroom_rtp_relay_packet *pkt = NULL;
+	janus_videoroom_relay_batch batch = { 0 };
+	batch.usage = &room->usage;
+	/* This thread only works for this room, so all its CPU time is accounted to it */
+	gint64 cpu_last = janus_usage_thread_cpu_time();
+	guint cpu_packets = 0;
 	while(!g_atomic_int_get(&stopping) && !g_atomic_int_get(&room->destroyed) && !g_atomic_int_get(&helper->destroyed)) {
 		pkt = g_async_queue_pop(helper->queued_packets);
 		if(pkt == &exit_packet)
 			break;
+		if(++cpu_packets == 64) {
+			cpu_packets = 0;
+			janus_usage_thread_update(&room->usage, &cpu_last);
+		}
 		janus_mutex_lock(&helper->mutex);
 		/* FIXME */
 		ps = pkt->source;
 		subscribers = g_hash_table_lookup(helper->subscribers, ps);
-		if(subscribers != NULL) {
-			g_list_foreach(subscribers,
-				pkt->is_rtp ? janus_videoroom_relay_rtp_packet : janus_videoroom_relay_data_packet,
-				pkt);
+		if(subscribers != NULL && pkt->is_rtp) {
+			/* Relay the packet to all the subscribers we handle in a single batch */
+			GList *l = subscribers;
+			while(l) {
+				janus_videoroom_relay_rtp_packet_batch((janus_videoroom_subscriber_stream *)l->data, pkt, &batch);
+				l = l->next;
+			}
+			janus_videoroom_relay_batch_flush(&batch);
+		} else if(subscribers != NULL) {
+			janus_videoroom_data_fanout fanout = { .packet = pkt, .handles = g_ptr_array_new(), .usage = &room->usage };
+			g_list_foreach(subscribers, janus_videoroom_relay_data_collect, &fanout);
+			janus_videoroom_relay_data_fanout_send(&fanout);
 		}
 		janus_mutex_unlock(&helper->mutex);
 		janus_videoroom_rtp_relay_packet_free(pkt);
 	}
+	janus_usage_thread_update(&room->usage, &cpu_last);
+	janus_sched_thread_stop();
 	JANUS_LOG(LOG_VERB, "[%s/#%d] Leaving VideoRoom helper thread\n", room->room_id_str, helper->id);
 	janus_refcount_decrease(&helper->ref);
 	janus_refcount_decrease(&room->ref);
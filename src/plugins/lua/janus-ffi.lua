@@ -0,0 +1,93 @@
+-- Helpers for scripts using the incomingRtpFfi() callback, which is only
+-- available when the Lua plugin is built against LuaJIT. The callback
+-- gets a pointer to the janus_plugin_rtp instance the C code received,
+-- rather than a copy of the packet: the declarations here allow scripts
+-- to access it (buffer and parsed extensions) in place via the FFI.
+-- Notice that the pointer is only valid while the callback runs.
+--
+-- Example:
+--
+--   local janusffi = require('janus-ffi')
+--   function incomingRtpFfi(id, video, packet)
+--       local rtp = janusffi.packet(packet)
+--       if video and janusffi.marker(rtp) then
+--           ...
+--       end
+--       relayRtp(peer, video, packet, rtp.length)
+--   end
+
+local ffi = require('ffi')
+
+-- These must match the definitions in plugin.h
+ffi.cdef[[
+typedef struct janus_plugin_rtp_extensions {
+	int8_t audio_level;
+	int audio_level_vad;
+	int16_t video_rotation;
+	int video_back_camera;
+	int video_flipped;
+	int16_t min_delay, max_delay;
+	uint8_t dd_len;
+	uint8_t dd_content[256];
+	uint64_t abs_capture_ts;
+} janus_plugin_rtp_extensions;
+typedef struct janus_plugin_rtp {
+	int mindex;
+	int video;
+	char *buffer;
+	uint16_t length;
+	janus_plugin_rtp_extensions extensions;
+	char *header;
+} janus_plugin_rtp;
+]]
+
+local JANUSFFI = {}
+
+local rtpPtr = ffi.typeof("janus_plugin_rtp *")
+local bytePtr = ffi.typeof("const uint8_t *")
+
+-- Cast the pointer passed to incomingRtpFfi() to a janus_plugin_rtp
+function JANUSFFI.packet(ptr)
+	return ffi.cast(rtpPtr, ptr)
+end
+
+-- Access the packet data as an array of bytes
+function JANUSFFI.bytes(rtp)
+	return ffi.cast(bytePtr, rtp.buffer)
+end
+
+-- Accessors for the fixed RTP header
+function JANUSFFI.marker(rtp)
+	return bit.band(JANUSFFI.bytes(rtp)[1], 0x80) ~= 0
+end
+
+function JANUSFFI.payloadType(rtp)
+	return bit.band(JANUSFFI.bytes(rtp)[1], 0x7F)
+end
+
+function JANUSFFI.seqNumber(rtp)
+	local b = JANUSFFI.bytes(rtp)
+	return bit.bor(bit.lshift(b[2], 8), b[3])
+end
+
+function JANUSFFI.timestamp(rtp)
+	local b = JANUSFFI.bytes(rtp)
+	return bit.tobit(bit.bor(bit.lshift(b[4], 24), bit.lshift(b[5], 16), bit.lshift(b[6], 8), b[7])) % 4294967296
+end
+
+function JANUSFFI.ssrc(rtp)
+	local b = JANUSFFI.bytes(rtp)
+	return bit.tobit(bit.bor(bit.lshift(b[8], 24), bit.lshift(b[9], 16), bit.lshift(b[10], 8), b[11])) % 4294967296
+end
+
+-- Audio level as parsed by the core (-1 if missing)
+function JANUSFFI.audioLevel(rtp)
+	return rtp.extensions.audio_level
+end
+
+-- The data of a packet as a Lua string, for when a copy is needed anyway
+function JANUSFFI.tostring(rtp)
+	return ffi.string(rtp.buffer, rtp.length)
+end
+
+return JANUSFFI
@@ -70,8 +70,12 @@ janus_plugin_rtp *janus_plugin_rtp_duplicate(janus_plugin_rtp *packet) {
 			p->buffer = g_malloc(packet->length);
 			memcpy(p->buffer, packet->buffer, packet->length);
 			p->length = packet->length;
+			/* The copy gets the header it should be sent with */
+			if(packet->header != NULL && packet->length >= 12)
+				memcpy(p->buffer, packet->header, 12);
 		}
 		p->extensions = packet->extensions;
+		p->header = NULL;
 	}
 	return p;
 }
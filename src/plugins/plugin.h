@@ -18,9 +18,18 @@
  * the syntax of the message/event is completely up to you, the only
  * important thing is that it MUST be a JSON object, as it will be included
  * as such within the Janus session/handle protocol;
+ * - \c push_event_broadcast(): to send the same JSON event to many peers
+ * at once (e.g., all the participants of a room), which is cheaper than
+ * invoking \c push_event() for each peer;
  * - \c relay_rtp(): to send/relay the peer an RTP packet;
  * - \c relay_rtcp(): to send/relay the peer an RTCP message.
  * - \c relay_data(): to send/relay the peer a SCTP DataChannel message.
+ * - \c relay_data_broadcast(): to send the same SCTP DataChannel message
+ * to many peers at once, which only copies it once rather than once per peer.
+ * - \c relay_rtp_batch() and \c relay_rtcp_batch(): to send/relay many RTP
+ * packets or RTCP messages at once, either to the same peer or to many peers
+ * (e.g., when fanning out the same packet), which only wakes up the loop of
+ * each peer once per batch rather than once per packet.
  *
  * On the other hand, a plugin that wants to register at the Janus core
  * needs to implement the \c janus_plugin interface. Besides, as a
@@ -65,14 +74,17 @@ janus_plugin *create(void) {
  * - \c incoming_rtp(): a callback to notify you a peer has sent you a RTP packet;
  * - \c incoming_rtcp(): a callback to notify you a peer has sent you a RTCP message;
  * - \c incoming_data(): a callback to notify you a peer has sent you a message on a SCTP DataChannel;
+ * - \c incoming_data_batch(): a callback to notify you about all the DataChannel messages a peer sent you in a single packet;
  * - \c data_ready(): a callback to notify you data can be sent on the SCTP DataChannel;
  * - \c slow_link(): a callback to notify you Janus or the peer have lost packets recently, and the media path may be slow;
  * - \c hangup_media(): a callback to notify you the peer PeerConnection has been closed (e.g., after a DTLS alert);
  * - \c query_session(): this method is called by the core to get plugin-specific info on a session between you and a peer;
- * - \c destroy_session(): this method is called by the core to destroy a session between you and a peer.
+ * - \c destroy_session(): this method is called by the core to destroy a session between you and a peer;
+ * - \c drain(): a callback to notify you the Janus instance started (or stopped) draining, e.g., before being scaled down.
  *
  * All the above methods and callbacks, except for \c incoming_rtp ,
- * \c incoming_rtcp , \c incoming_data and \c slow_link , are mandatory:
+ * \c incoming_rtcp , \c incoming_data , \c incoming_data_batch ,
+ * \c slow_link and \c drain , are mandatory:
  * the Janus core will reject a plugin that doesn't implement any of the
  * mandatory callbacks. The previously mentioned ones, instead, are
  * optional, so you're free to implement only those you care about. If
@@ -80,9 +92,15 @@ janus_plugin *create(void) {
  * sense to not implement the \c incoming_data callback at all. At the
  * same time, if your plugin is ONLY going to use data channels and
  * can't care less about RTP or RTCP, \c incoming_rtp and \c incoming_rtcp
- * can be left out. Finally, \c slow_link is just there as a helper, some
+ * can be left out. Plugins receiving many small messages (e.g., chats or
+ * game state updates) can also implement \c incoming_data_batch , which
+ * is used instead of \c incoming_data when available, to get all the
+ * messages that were in the same DTLS packet at once, e.g., to only take
+ * their own locks once per packet. Finally, \c slow_link is just there as a helper, some
  * additional information you may be interested about, but you're not
- * forced to receive it if you don't care.
+ * forced to receive it if you don't care. The same is true for \c drain ,
+ * which plugins can use to let their users know they should migrate to
+ * another instance, rather than waiting for them to leave on their own.
  *
  * The Janus core \c janus_callbacks interface is provided to a plugin, together
  * with the path to the configurations files folder, in the \c init() method.
@@ -171,7 +189,7 @@ janus_plugin *create(void) {
  * Janus instance or it will crash.
  *
  */
-#define JANUS_PLUGIN_API_VERSION	106
+#define JANUS_PLUGIN_API_VERSION	113
 
 /*! \brief Initialization of all plugin properties to NULL
  *
@@ -206,11 +224,13 @@ static janus_plugin janus_echotest_plugin =
 		.incoming_rtp = NULL,			\
 		.incoming_rtcp = NULL,			\
 		.incoming_data = NULL,			\
+		.incoming_data_batch = NULL,	\
 		.data_ready = NULL,				\
 		.slow_link = NULL,				\
 		.hangup_media = NULL,			\
 		.destroy_session = NULL,		\
 		.query_session = NULL, 			\
+		.drain = NULL,					\
 		## __VA_ARGS__ }
 
 
@@ -316,6 +336,15 @@ struct janus_plugin {
 	 * @param[in] handle The plugin/gateway session used for this peer
 	 * @param[in] packet The message data and related info */
 	void (* const incoming_data)(janus_plugin_session *handle, janus_plugin_data *packet);
+	/*! \brief Method to handle multiple SCTP/DataChannel messages from a peer at once
+	 * \note This is optional: if implemented, the core uses it instead of \c incoming_data for
+	 * all the messages that were in the same DTLS packet (which may be a single one), in order.
+	 * Buffers, labels and protocols are only valid until the callback returns, and the same
+	 * caveats as \c incoming_data (e.g., unterminated strings) apply.
+	 * @param[in] handle The plugin/gateway session used for this peer
+	 * @param[in] packets Array of messages and related info
+	 * @param[in] count Number of messages in the array */
+	void (* const incoming_data_batch)(janus_plugin_session *handle, janus_plugin_data *packets, int count);
 	/*! \brief Method to be notified about the fact that the datachannel is ready to be written
 	 * \note This is not only called when the PeerConnection first becomes available, but also
 	 * when the SCTP socket becomes writable again, e.g., because the internal buffer is empty.
@@ -352,6 +381,12 @@ struct janus_plugin {
 	 * @param[in] handle The plugin/gateway session used for this peer
 	 * @returns A json_t object with the requested info */
 	json_t *(* const query_session)(janus_plugin_session *handle);
+	/*! \brief Method to notify the plugin the Janus instance started or stopped draining
+	 * \note When draining, the core doesn't accept new sessions anymore, but
+	 * existing ones are left alone: plugins may want to tell their users to
+	 * reconnect somewhere else, so that the instance can be shut down sooner
+	 * @param[in] draining Whether the instance is now draining or not */
+	void (* const drain)(gboolean draining);
 
 };
 
@@ -415,8 +450,9 @@ struct janus_callbacks {
 	 * @param[in] handle The plugin/gateway session to get rid of */
 	void (* const end_session)(janus_plugin_session *handle);
 
-	/*! \brief Callback to check whether the event handlers mechanism is enabled
-	 * @returns TRUE if it is, FALSE if it isn't (which means notify_event should NOT be called) */
+	/*! \brief Callback to check whether the event handlers mechanism is enabled, and any handler is interested in plugin events
+	 * @returns TRUE if it is, FALSE if it isn't (which means notify_event should NOT be called)
+	 * \note Handlers can change the events they subscribe to at any time, so this should be checked for each event */
 	gboolean (* const events_is_enabled)(void);
 	/*! \brief Callback to notify an event to the registered and subscribed event handlers
 	 * \note Don't unref the event object, the core will do that for you
@@ -439,6 +475,63 @@ struct janus_callbacks {
 	 * @param[in] desc The descriptor to search for
 	 * @returns TRUE if the token is valid, not expired and contains the descriptor, FALSE otherwise */
 	gboolean (* const auth_signature_contains)(janus_plugin *plugin, const char *token, const char *descriptor);
+
+	/*! \brief Helper to retrieve the bandwidth the core estimated towards a peer
+	 * @note The estimate is based on the transport-wide CC feedback the peer
+	 * sends for the packets we send it: as such, it's only available when the
+	 * transport-wide CC extension has been negotiated, and after the first
+	 * feedback has been received. Plugins can use it to pick what to send
+	 * (e.g., which simulcast substream or SVC layer to relay)
+	 * @param[in] handle The plugin/gateway session associated with the peer
+	 * @returns The estimated bitrate (in bps), or 0 if no estimate is available */
+	guint32 (* const get_bandwidth_estimate)(janus_plugin_session *handle);
+
+	/*! \brief Callback to push the same event/message to multiple peers
+	 * @note This is functionally equivalent to invoking \c push_event on each of
+	 * the handles, with no transaction and no JSEP, but the Janus core wraps the
+	 * message only once and shares it among all the events it sends. As for
+	 * \c push_event, the core increases the references to the \c message, so
+	 * you'll have to decrease your own reference yourself after the call
+	 * @param[in] handles The plugin/gateway sessions of the peers to send the message to
+	 * @param[in] count The number of handles in the array
+	 * @param[in] plugin The plugin instance that is sending the message/event
+	 * @param[in] message The json_t object containing the JSON message
+	 * @returns The number of peers the message was pushed to, or a negative integer in case of errors */
+	int (* const push_event_broadcast)(janus_plugin_session **handles, guint count, janus_plugin *plugin, json_t *message);
+
+	/*! \brief Callback to relay the same SCTP/DataChannel message to multiple peers
+	 * @note This is functionally equivalent to invoking \c relay_data on each of
+	 * the handles, but the Janus core only copies the message (and its label and
+	 * protocol) once, and the packets it queues for each peer all reference it
+	 * @param[in] handles The plugin/gateway sessions of the peers to send the message to
+	 * @param[in] count The number of handles in the array
+	 * @param[in] packet The message data and related info
+	 * @returns The number of peers the message was queued for, or a negative integer in case of errors */
+	int (* const relay_data_broadcast)(janus_plugin_session **handles, guint count, janus_plugin_data *packet);
+
+	/*! \brief Callback to relay a batch of RTP packets to one or more peers
+	 * @note This is functionally equivalent to invoking \c relay_rtp for each
+	 * packet, with \c packets[i] being sent to \c handles[i]: the same handle can
+	 * appear many times (e.g., to send many packets to the same peer), and so
+	 * can the same buffer (e.g., to send the same packet to many peers, using the
+	 * \c header property to change what's different for each of them). The core
+	 * queues consecutive packets addressed to the same peer at once, and only
+	 * wakes up the loop of each peer once per batch. As for \c relay_rtp, the
+	 * packets are copied, so buffers can be reused as soon as this returns
+	 * @param[in] handles The plugin/gateway sessions of the peers to send the packets to
+	 * @param[in] packets The RTP packets and related data
+	 * @param[in] count The number of handles and packets in the arrays
+	 * @returns The number of packets that were queued, or a negative integer in case of errors */
+	int (* const relay_rtp_batch)(janus_plugin_session **handles, janus_plugin_rtp *packets, guint count);
+	/*! \brief Callback to relay a batch of RTCP messages to one or more peers
+	 * @note This is functionally equivalent to invoking \c relay_rtcp for each
+	 * message, with \c packets[i] being sent to \c handles[i], and the same
+	 * considerations made for \c relay_rtp_batch apply
+	 * @param[in] handles The plugin/gateway sessions of the peers to send the messages to
+	 * @param[in] packets The RTCP messages and related data
+	 * @param[in] count The number of handles and messages in the arrays
+	 * @returns The number of messages that were queued, or a negative integer in case of errors */
+	int (* const relay_rtcp_batch)(janus_plugin_session **handles, janus_plugin_rtcp *packets, guint count);
 };
 
 /*! \brief The hook that plugins need to implement to be created from the Janus core */
@@ -607,6 +700,11 @@ struct janus_plugin_rtp {
 	uint16_t length;
 	/*! \brief RTP extensions */
 	janus_plugin_rtp_extensions extensions;
+	/*! \brief If set, the fixed RTP header (12 bytes) to send instead of the one at the beginning of \c buffer
+	 * @note This allows plugins to relay the very same buffer to many recipients, only
+	 * changing what's different for each of them (e.g., sequence number and timestamp),
+	 * without modifying or copying the buffer: the core copies the packet anyway */
+	char *header;
 };
 /*! \brief Helper method to initialise/reset the RTP packet
  * @note The main motivation for this method comes from the presence of the
@@ -46,7 +46,7 @@
  * show something like this:
  *
 \verbatim
-Usage: janus-pp-rec [OPTIONS] source.mjr
+Usage: janus-pp-rec [OPTIONS] source.mjr|-
 [destination.[opus|ogg|mka|wav|webm|mkv|h264|srt]]
 
   -h, --help                    Print help and exit
@@ -93,13 +93,96 @@ Usage: janus-pp-rec [OPTIONS] source.mjr
                                 Minimum latency of moving average to reach
                                   before starting to correct timestamps.
                                   (default=500)
+  -B, --batch                   Process all the .mjr files passed as arguments,
+                                  in parallel  (default=off)
+  -J, --jobs=count              In batch mode, how many recordings to process
+                                  at the same time (default=number of CPUs)
+  -M, --mux                     In batch mode, mux the tracks of the same
+                                  participant in a single file  (default=off)
+  -X, --mix=filename            Mix all the audio recordings passed as
+                                  arguments in a single audio file (.opus,
+                                  .ogg, .mka or .wav), aligning them by when
+                                  they started (implies --batch)
+  -W, --reorder-window=count    Only reorder packets within a window of this
+                                  many packets, dropping the ones arriving
+                                  later  (default=0, disabled)
+  -T, --transcode=codec         Transcode video recordings to this codec
+                                  (h264, h265, vp9 or av1), using a hardware
+                                  encoder if available
+  -E, --encoder=name            When transcoding, use this libavcodec encoder
+                                  instead of picking the first one that works
+  -b, --bitrate=kbps            When transcoding, target bitrate in kbps
+                                  (default=0, encoder default)
+  -V, --hw-device=device        When transcoding, hardware device to use (VAAPI
+                                  render node or NVENC GPU index)
 \endverbatim
  *
- * \note This utility does not do any form of transcoding. It just
- * depacketizes the RTP frames in order to get the payload, and saves
- * the frames in a valid container. Any further post-processing (e.g.,
- * muxing audio and video belonging to the same media session in a single
- * .webm file) is up to third-party applications.
+ * Many recordings can be processed at once in batch mode, in which case
+ * each recording is processed in a separate process, as many at the same
+ * time as the available CPUs (or as specified with \c --jobs ). Targets
+ * get the same name as the sources, with the extension passed via
+ * \c --format or, if missing, the default one for each codec (\c .opus
+ * for Opus, \c .wav for G.711, G.722 and L16, \c .webm for VP8 and VP9,
+ * \c .mp4 for H.264, H.265 and AV1, and \c .srt for text). Passing
+ * \c --mux too will mux the tracks belonging to the same participant, that
+ * is recordings whose names only differ in the \c -audio-N / \c -video-N
+ * suffix (as the VideoRoom plugin names them), in a single .webm (or .mkv,
+ * if the codecs aren't supported in WebM) file, aligned using the time the
+ * first frame of each recording was written at: the individual targets
+ * are removed once muxed:
+ *
+\verbatim
+./janus-pp-rec --batch --mux /path/to/videoroom-1234-*.mjr
+\endverbatim
+ *
+ * A single audio track for a whole session can be obtained with \c --mix
+ * instead: all the audio recordings passed as arguments are processed in
+ * batch mode as before, and then decoded and mixed together (aligned the
+ * same way tracks are when muxing) in the file passed to the option, which
+ * can be either .opus, .ogg or .mka (Opus) or .wav (16-bit PCM). Sources
+ * are mixed at the highest sample rate among them, and the others are
+ * upsampled to that (which works for all the audio codecs Janus records,
+ * since their sample rates are all divisors of 48kHz). Any video or data
+ * recording passed as well is just processed as usual:
+ *
+\verbatim
+./janus-pp-rec --mix=/path/to/videoroom-1234.opus /path/to/videoroom-1234-*-audio-*.mjr
+\endverbatim
+ *
+ * Passing \c - as the source reads the recording from stdin, which
+ * allows you to post-process recordings piped from somewhere else (e.g.,
+ * an object storage) without saving them locally first: notice that the
+ * recording is still kept in memory while it's being processed. For
+ * recordings that are known to be (mostly) in order, \c --reorder-window
+ * avoids sorting all packets once they've been read, and only reorders
+ * them as they're read within a window of the specified size: packets
+ * arriving later than that are dropped.
+ *
+\verbatim
+curl -s https://example.com/rec1234.mjr | ./janus-pp-rec --reorder-window=100 - rec1234.opus
+\endverbatim
+ *
+ * Video recordings can also be transcoded, e.g., to get H.264 files out
+ * of VP8 or VP9 recordings for compatibility, by passing the target codec
+ * to \c --transcode (h264, h265, vp9 or av1) and a target file with an
+ * extension supported for that codec. The recording is processed to its
+ * native container first, as usual, and then decoded and encoded again
+ * frame by frame with libavcodec, with the bitrate passed to \c --bitrate
+ * (in kbps), if any. Hardware encoders (NVENC, QSV and VAAPI, in that
+ * order) are tried first, falling back to software ones if none of
+ * them works: \c --encoder forces a specific encoder instead, while
+ * \c --hw-device selects the VAAPI render node or NVENC GPU to use. Since
+ * frames are not scaled, those with a different resolution than the first
+ * one are cropped or padded to that. Transcoding is not available in batch mode.
+ *
+\verbatim
+./janus-pp-rec --transcode=h264 --encoder=h264_vaapi --hw-device=/dev/dri/renderD128 --bitrate=1000 rec1234.mjr rec1234.mp4
+\endverbatim
+ *
+ * \note Apart from that, this utility does not do any form of transcoding.
+ * It just depacketizes the RTP frames in order to get the payload, and saves
+ * the frames in a valid container. Apart from the muxing and mixing done
+ * in batch mode, any further post-processing is up to third-party applications.
  *
  * \ingroup postprocessing
  * \ref postprocessing
@@ -115,6 +198,8 @@ Usage: janus-pp-rec [OPTIONS] source.mjr
 #include <string.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #include <jansson.h>
 
@@ -132,6 +217,7 @@ Usage: janus-pp-rec [OPTIONS] source.mjr
 #include "pp-l16.h"
 #include "pp-srt.h"
 #include "pp-binary.h"
+#include "pp-avformat.h"
 
 int janus_log_level = 4;
 gboolean janus_log_timestamps = FALSE;
@@ -176,6 +262,313 @@ static gint janus_pp_skew_compensate_audio(janus_pp_frame_packet *pkt, janus_pp_
 static double get_latency(const janus_pp_frame_packet *tmp, int rate);
 static double get_moving_average_of_latency(janus_pp_frame_packet *pkt, int rate, int num_of_packets);
 
+/* Batch mode: each recording is processed in a child process, and then
+ * the tracks of the same participant are muxed together, if needed */
+typedef struct janus_pp_batch_item {
+	char *source, *target;
+	/* Key grouping the tracks of the same participant, if muxing */
+	char *group;
+	/* When the first frame was written (to align tracks) */
+	gint64 written;
+	/* Whether this is an audio track we'll need to mix */
+	gboolean mixed;
+	pid_t pid;
+	gboolean done;
+} janus_pp_batch_item;
+
+static json_t *janus_pp_batch_info(const char *source) {
+	FILE *file = fopen(source, "rb");
+	if(file == NULL)
+		return NULL;
+	json_t *info = NULL;
+	char prebuffer[8];
+	uint16_t len = 0;
+	if(fread(prebuffer, sizeof(char), 8, file) == 8 && !memcmp(prebuffer, "MJR00002", 8) &&
+			fread(&len, sizeof(uint16_t), 1, file) == 1) {
+		len = ntohs(len);
+		char *text = g_malloc0(len+1);
+		if(fread(text, sizeof(char), len, file) == len)
+			info = json_loads(text, 0, NULL);
+		g_free(text);
+	}
+	fclose(file);
+	return info;
+}
+
+static const char *janus_pp_batch_extension(const char *type, const char *codec) {
+	if(type == NULL || codec == NULL)
+		return NULL;
+	if(!strcasecmp(type, "d"))
+		return !strcasecmp(codec, "text") ? "srt" : NULL;
+	if(!strcasecmp(codec, "opus") || !strcasecmp(codec, "multiopus"))
+		return "opus";
+	if(!strcasecmp(codec, "vp8") || !strcasecmp(codec, "vp9"))
+		return "webm";
+	if(!strcasecmp(codec, "h264") || !strcasecmp(codec, "h265") || !strcasecmp(codec, "av1"))
+		return "mp4";
+	if(!strcasecmp(codec, "g711") || !strcasecmp(codec, "pcmu") || !strcasecmp(codec, "pcma") ||
+			!strcasecmp(codec, "g722") || !strcasecmp(codec, "l16") || !strcasecmp(codec, "l16-48"))
+		return "wav";
+	return NULL;
+}
+
+/* Tracks of the same participant only differ in the -audio-N/-video-N suffix */
+static char *janus_pp_batch_group(const char *name) {
+	char *group = g_strdup(name);
+	char *suffix = g_strrstr(group, "-audio");
+	if(suffix == NULL)
+		suffix = g_strrstr(group, "-video");
+	if(suffix == NULL) {
+		g_free(group);
+		return NULL;
+	}
+	const char *c = suffix + strlen("-audio");
+	if(*c == '-')
+		c++;
+	while(g_ascii_isdigit(*c))
+		c++;
+	if(*c != '\0') {
+		/* There's more after the suffix, it's not a track name */
+		g_free(group);
+		return NULL;
+	}
+	*suffix = '\0';
+	return group;
+}
+
+static void janus_pp_batch_wait(janus_pp_batch_item *items, int num, int *failures) {
+	int status = 0, i = 0;
+	pid_t pid = waitpid(-1, &status, 0);
+	if(pid <= 0)
+		return;
+	for(i=0; i<num; i++) {
+		if(items[i].pid != pid)
+			continue;
+		items[i].done = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+		if(!items[i].done) {
+			JANUS_LOG(LOG_ERR, "Error processing %s\n", items[i].source);
+			(*failures)++;
+		}
+		break;
+	}
+}
+
+static void janus_pp_batch_mux(janus_pp_batch_item *items, int num, const char *metadata, int *failures) {
+	int i = 0, j = 0;
+	for(i=0; i<num; i++) {
+		if(!items[i].done || items[i].group == NULL)
+			continue;
+		/* Collect all the processed tracks of this participant */
+		GPtrArray *tracks = g_ptr_array_new();
+		for(j=i; j<num; j++) {
+			if(items[j].done && items[j].group && !strcmp(items[j].group, items[i].group))
+				g_ptr_array_add(tracks, &items[j]);
+		}
+		if(tracks->len < 2) {
+			g_ptr_array_free(tracks, TRUE);
+			continue;
+		}
+		const char **sources = g_malloc0(tracks->len * sizeof(char *));
+		int64_t *offsets = g_malloc0(tracks->len * sizeof(int64_t));
+		gint64 first = 0;
+		gboolean webm = TRUE;
+		guint t = 0;
+		for(t=0; t<tracks->len; t++) {
+			janus_pp_batch_item *item = g_ptr_array_index(tracks, t);
+			if(t == 0 || item->written < first)
+				first = item->written;
+			const char *ext = strrchr(item->target, '.');
+			if(ext == NULL || (strcasecmp(ext, ".webm") && strcasecmp(ext, ".opus")))
+				webm = FALSE;
+		}
+		for(t=0; t<tracks->len; t++) {
+			janus_pp_batch_item *item = g_ptr_array_index(tracks, t);
+			sources[t] = item->target;
+			offsets[t] = item->written - first;
+		}
+		char *destination = g_strdup_printf("%s.%s", items[i].group, webm ? "webm" : "mkv");
+		JANUS_LOG(LOG_INFO, "Muxing %u tracks in %s\n", tracks->len, destination);
+		if(janus_pp_remux(sources, offsets, tracks->len, webm ? "webm" : "matroska", metadata, destination) < 0) {
+			JANUS_LOG(LOG_ERR, "Error muxing %s\n", destination);
+			(*failures)++;
+		} else {
+			/* We don't need the individual tracks anymore */
+			for(t=0; t<tracks->len; t++)
+				unlink(sources[t]);
+		}
+		/* Make sure we don't mux these tracks again */
+		for(t=0; t<tracks->len; t++) {
+			janus_pp_batch_item *item = g_ptr_array_index(tracks, t);
+			g_free(item->group);
+			item->group = NULL;
+		}
+		g_free(destination);
+		g_free(sources);
+		g_free(offsets);
+		g_ptr_array_free(tracks, TRUE);
+	}
+}
+
+/* Mixing: audio tracks are first processed as usual, and then decoded and
+ * mixed together, aligned using the time their first frame was written at */
+static void janus_pp_batch_mix(janus_pp_batch_item *items, int num, const char *mix, const char *metadata, int *failures) {
+	const char *format = strrchr(mix, '.');
+	if(format == NULL) {
+		JANUS_LOG(LOG_ERR, "No extension? Unsupported mix file\n");
+		(*failures)++;
+		return;
+	}
+	format++;
+	const char **sources = g_malloc0(num * sizeof(char *));
+	int64_t *offsets = g_malloc0(num * sizeof(int64_t));
+	gint64 first = 0;
+	int i = 0, tracks = 0;
+	for(i=0; i<num; i++) {
+		if(!items[i].done || !items[i].mixed)
+			continue;
+		if(tracks == 0 || items[i].written < first)
+			first = items[i].written;
+		sources[tracks] = items[i].target;
+		offsets[tracks] = items[i].written;
+		tracks++;
+	}
+	for(i=0; i<tracks; i++)
+		offsets[i] -= first;
+	if(tracks == 0) {
+		JANUS_LOG(LOG_ERR, "No audio recordings to mix\n");
+		(*failures)++;
+	} else {
+		JANUS_LOG(LOG_INFO, "Mixing %d audio tracks in %s\n", tracks, mix);
+		if(janus_pp_mix(sources, offsets, tracks, format, metadata, mix) < 0) {
+			JANUS_LOG(LOG_ERR, "Error mixing %s\n", mix);
+			(*failures)++;
+		} else {
+			/* We don't need the individual tracks anymore */
+			for(i=0; i<tracks; i++)
+				unlink(sources[i]);
+		}
+	}
+	g_free(sources);
+	g_free(offsets);
+}
+
+/* In the parent this never returns, while in children it returns with the
+ * source to process and the target to save to */
+static void janus_pp_batch(char **paths, int jobs, gboolean mux, const char *mix, const char *format, const char *metadata,
+		char **source, char **destination) {
+	int num = g_strv_length(paths), i = 0, running = 0, failures = 0;
+	if(jobs <= 0)
+		jobs = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+	JANUS_LOG(LOG_INFO, "Processing %d recordings, %d at a time\n", num, jobs);
+	janus_pp_batch_item *items = g_malloc0(num * sizeof(janus_pp_batch_item));
+	for(i=0; i<num; i++) {
+		janus_pp_batch_item *item = &items[i];
+		item->source = paths[i];
+		/* Check what's in there, to figure out the target */
+		json_t *info = janus_pp_batch_info(paths[i]);
+		const char *type = json_string_value(json_object_get(info, "t"));
+		/* When mixing, audio tracks always use the default extension, as we only decode them */
+		item->mixed = (mix != NULL && type != NULL && !strcasecmp(type, "a"));
+		const char *ext = (format && !item->mixed) ? format : janus_pp_batch_extension(type, json_string_value(json_object_get(info, "c")));
+		if(ext == NULL) {
+			JANUS_LOG(LOG_ERR, "Unsupported or invalid recording %s, skipping\n", paths[i]);
+			json_decref(info);
+			failures++;
+			continue;
+		}
+		char *name = g_str_has_suffix(paths[i], ".mjr") ? g_strndup(paths[i], strlen(paths[i]) - strlen(".mjr")) : g_strdup(paths[i]);
+		item->target = g_strdup_printf("%s.%s", name, ext);
+		if(mux && !item->mixed && type && strcasecmp(type, "d"))
+			item->group = janus_pp_batch_group(name);
+		item->written = json_integer_value(json_object_get(info, "u"));
+		g_free(name);
+		json_decref(info);
+		/* Wait for a slot, and start processing this recording */
+		while(running >= jobs) {
+			janus_pp_batch_wait(items, num, &failures);
+			running--;
+		}
+		pid_t pid = fork();
+		if(pid < 0) {
+			JANUS_LOG(LOG_ERR, "Error forking to process %s\n", paths[i]);
+			failures++;
+			continue;
+		} else if(pid == 0) {
+			/* We're the child: process this recording as we'd normally do */
+			char *base = g_path_get_basename(paths[i]);
+			janus_log_global_prefix = g_strdup_printf("[%s] ", base);
+			g_free(base);
+			*source = item->source;
+			*destination = item->target;
+			return;
+		}
+		item->pid = pid;
+		running++;
+	}
+	while(running > 0) {
+		janus_pp_batch_wait(items, num, &failures);
+		running--;
+	}
+	if(mux)
+		janus_pp_batch_mux(items, num, metadata, &failures);
+	if(mix)
+		janus_pp_batch_mix(items, num, mix, metadata, &failures);
+	for(i=0; i<num; i++) {
+		g_free(items[i].target);
+		g_free(items[i].group);
+	}
+	g_free(items);
+	JANUS_LOG(LOG_INFO, "Batch processing done (%d errors)\n", failures);
+	janus_pprec_options_destroy();
+	exit(failures > 0 ? 1 : 0);
+}
+
+/* Helper method to order packets by timestamp first, and sequence number then
+ * (taking into account sequence numbers may have wrapped in the meanwhile) */
+static gint janus_pp_frame_packet_compare(gconstpointer a, gconstpointer b) {
+	const janus_pp_frame_packet *p1 = *(janus_pp_frame_packet * const *)a;
+	const janus_pp_frame_packet *p2 = *(janus_pp_frame_packet * const *)b;
+	if(p1->ts != p2->ts)
+		return p1->ts < p2->ts ? -1 : 1;
+	if(p1->seq == p2->seq)
+		return 0;
+	int distance = abs(p1->seq - p2->seq);
+	if((p1->seq < p2->seq && distance < 10000) || (p1->seq > p2->seq && distance > 10000))
+		return -1;
+	return 1;
+}
+
+/* Helper method to read a recording from stdin (e.g., when piped from object
+ * storage): since the packets are read more than once, and the processors
+ * seek to their payloads when writing, the recording is kept in memory */
+static char *janus_pp_read_stdin(size_t *size) {
+	GByteArray *buffer = g_byte_array_new();
+	char chunk[65536];
+	size_t got = 0;
+	while((got = fread(chunk, sizeof(char), sizeof(chunk), stdin)) > 0)
+		g_byte_array_append(buffer, (guint8 *)chunk, got);
+	*size = buffer->len;
+	return (char *)g_byte_array_free(buffer, *size == 0);
+}
+
+/* Helper method to add a packet to an array that's kept ordered as packets are
+ * read: this is only meant for recordings that are mostly in order, so we never
+ * look more than window packets back, and drop the packets that would need to */
+static gboolean janus_pp_frame_packet_insert(GPtrArray *packets, janus_pp_frame_packet *p, int window) {
+	guint pos = packets->len;
+	while(pos > 0 && (int)(packets->len - pos) < window &&
+			janus_pp_frame_packet_compare(&g_ptr_array_index(packets, pos-1), &p) > 0)
+		pos--;
+	if(pos > 0 && janus_pp_frame_packet_compare(&g_ptr_array_index(packets, pos-1), &p) > 0)
+		return FALSE;
+	g_ptr_array_add(packets, p);
+	if(pos < packets->len-1) {
+		memmove(&packets->pdata[pos+1], &packets->pdata[pos], (packets->len-1-pos) * sizeof(gpointer));
+		packets->pdata[pos] = p;
+	}
+	return TRUE;
+}
+
 /* Helper method to check whether a processor accepts a specific extension */
 static gboolean janus_pp_extension_check(const char *extension, const char **allowed) {
 	if(allowed == NULL || extension == NULL)
@@ -205,6 +598,21 @@ static char *janus_pp_extensions_string(const char **allowed, char *supported, s
 	return supported;
 }
 
+/* Helper to get the target extensions we support when transcoding to a codec */
+static const char **janus_pp_transcode_extensions(const char *codec) {
+	if(codec == NULL)
+		return NULL;
+	if(!strcasecmp(codec, "h264"))
+		return janus_pp_h264_get_extensions();
+	else if(!strcasecmp(codec, "h265"))
+		return janus_pp_h265_get_extensions();
+	else if(!strcasecmp(codec, "vp9"))
+		return janus_pp_webm_get_extensions();
+	else if(!strcasecmp(codec, "av1"))
+		return janus_pp_av1_get_extensions();
+	return NULL;
+}
+
 /* Main Code */
 int main(int argc, char *argv[]) {
 	janus_log_init(FALSE, TRUE, NULL, NULL);
@@ -296,6 +704,27 @@ int main(int argc, char *argv[]) {
 	/* Evaluate arguments to find source and target */
 	char *source = options.paths ? options.paths[0] : NULL;
 	char *destination = (options.paths && options.paths[0]) ? options.paths[1] : NULL;
+	gboolean from_stdin = (source != NULL && !strcmp(source, "-"));
+	if(options.mix != NULL)
+		options.batch = TRUE;
+	if(options.batch && from_stdin) {
+		JANUS_LOG(LOG_ERR, "Batch mode can't read recordings from stdin\n");
+		janus_pprec_options_destroy();
+		exit(1);
+	}
+	if(options.batch && options.transcode != NULL) {
+		JANUS_LOG(LOG_ERR, "Transcoding is not supported in batch mode\n");
+		janus_pprec_options_destroy();
+		exit(1);
+	}
+	if(options.batch && source != NULL && !jsonheader_only && !header_only && !parse_only) {
+		/* Batch mode: only child processes get past this point */
+		janus_pp_batch(options.paths, options.jobs, options.mux, options.mix, extension, metadata, &source, &destination);
+		if(extension == NULL) {
+			extension = strrchr(destination, '.');
+			extension = g_strdup(extension+1);
+		}
+	}
 	if(source == NULL || (destination == NULL && !jsonheader_only && !header_only && !parse_only)) {
 		janus_pprec_options_help();
 		janus_pprec_options_destroy();
@@ -313,6 +742,8 @@ int main(int argc, char *argv[]) {
 			JANUS_LOG(LOG_INFO, "Audio skew threshold: %d\n", options.audioskew_th);
 		if(options.ignore_first_packets > 0)
 			JANUS_LOG(LOG_INFO, "Ignoring first packets: %d\n", options.ignore_first_packets);
+		if(options.reorder_window > 0)
+			JANUS_LOG(LOG_INFO, "Reorder window: %d packets\n", options.reorder_window);
 		if(options.audio_level_extmap_id > 0)
 			JANUS_LOG(LOG_INFO, "Audio level extension ID: %d\n", options.audio_level_extmap_id);
 		if(options.video_orient_extmap_id > 0)
@@ -321,7 +752,7 @@ int main(int argc, char *argv[]) {
 			JANUS_LOG(LOG_INFO, "RTP silence suppression distance: %d\n", options.silence_distance);
 		JANUS_LOG(LOG_INFO, "\n");
 		if(source != NULL)
-			JANUS_LOG(LOG_INFO, "Source file: %s\n", source);
+			JANUS_LOG(LOG_INFO, "Source file: %s\n", from_stdin ? "(stdin)" : source);
 		if(header_only)
 			JANUS_LOG(LOG_INFO, "  -- Showing header only\n");
 		if(parse_only)
@@ -350,9 +781,42 @@ int main(int argc, char *argv[]) {
 		exit(1);
 	}
 
-	FILE *file = fopen(source, "rb");
+	/* When transcoding, the extension is the one of the transcoded target:
+	 * the recording is processed to the native format of its codec first */
+	char *transcode_extension = NULL, *transcode_destination = NULL;
+	if(options.transcode != NULL && destination != NULL && !jsonheader_only && !header_only && !parse_only) {
+		const char **allowed = janus_pp_transcode_extensions(options.transcode);
+		if(allowed == NULL) {
+			JANUS_LOG(LOG_ERR, "Unsupported codec for transcoding '%s' (supported: h264, h265, vp9, av1)\n", options.transcode);
+			janus_pprec_options_destroy();
+			exit(1);
+		}
+		if(!janus_pp_extension_check(extension, allowed)) {
+			char supported[100];
+			JANUS_LOG(LOG_ERR, "Can't transcode to %s in this target file (supported formats: %s)\n",
+				options.transcode, janus_pp_extensions_string(allowed, supported, sizeof(supported)));
+			janus_pprec_options_destroy();
+			exit(1);
+		}
+		if(options.bitrate < 0)
+			options.bitrate = 0;
+		transcode_extension = extension;
+		extension = NULL;
+	}
+
+	char *source_data = NULL;
+	size_t source_size = 0;
+	FILE *file = NULL;
+	if(from_stdin) {
+		source_data = janus_pp_read_stdin(&source_size);
+		if(source_data != NULL)
+			file = fmemopen(source_data, source_size, "rb");
+	} else {
+		file = fopen(source, "rb");
+	}
 	if(file == NULL) {
-		JANUS_LOG(LOG_ERR, "Could not open file %s\n", source);
+		JANUS_LOG(LOG_ERR, "Could not open file %s\n", from_stdin ? "(stdin)" : source);
+		g_free(source_data);
 		janus_pprec_options_destroy();
 		exit(1);
 	}
@@ -745,6 +1209,22 @@ int main(int argc, char *argv[]) {
 		exit(0);
 	}
 
+	/* If we're transcoding, process to a temporary file in the native format first */
+	if(transcode_extension != NULL) {
+		if(!video) {
+			JANUS_LOG(LOG_ERR, "Only video recordings can be transcoded\n");
+			if(info)
+				json_decref(info);
+			g_free(metadata);
+			g_free(transcode_extension);
+			janus_pprec_options_destroy();
+			exit(1);
+		}
+		extension = g_strdup((vp8 || vp9) ? "webm" : "mp4");
+		transcode_destination = destination;
+		destination = g_strdup_printf("%s.tmp.%s", transcode_destination, extension);
+	}
+
 	/* Now that we know what we're working with, check the extension */
 	if(extension && strcasecmp(extension, "opus") && strcasecmp(extension, "wav") &&
 			strcasecmp(extension, "ogg") && strcasecmp(extension, "mka") &&
@@ -782,6 +1262,9 @@ int main(int argc, char *argv[]) {
 	/* Extensions, if any */
 	int audiolevel = 0, rotation = 0, last_rotation = -1, rotated = -1;
 	uint16_t rtp_header_len, rtp_read_n;
+	/* Media packets are collected here, and ordered when we're done reading */
+	GPtrArray *packets = g_ptr_array_new();
+	uint64_t first_ts = 0;
 	/* Start loop */
 	while(working && offset < fsize) {
 		/* Read frame header */
@@ -1048,86 +1531,32 @@ int main(int argc, char *argv[]) {
 		p->rotation = rotation;
 		p->next = NULL;
 		p->prev = NULL;
-		if(list == NULL) {
-			/* First element becomes the list itself (and the last item), at least for now */
-			list = p;
-			last = p;
-		} else if(!p->drop) {
-			/* Check where we should insert this, starting from the end */
-			int added = 0;
-			janus_pp_frame_packet *tmp = last;
-			while(tmp) {
-				if(tmp->ts < p->ts) {
-					/* The new timestamp is greater than the last one we have, append */
-					added = 1;
-					if(tmp->next != NULL) {
-						/* We're inserting */
-						tmp->next->prev = p;
-						p->next = tmp->next;
-					} else {
-						/* Update the last packet */
-						last = p;
-					}
-					tmp->next = p;
-					p->prev = tmp;
-					break;
-				} else if(tmp->ts == p->ts) {
-					/* Same timestamp, check the sequence number */
-					if(tmp->seq < p->seq && (abs(tmp->seq - p->seq) < 10000)) {
-						/* The new sequence number is greater than the last one we have, append */
-						added = 1;
-						if(tmp->next != NULL) {
-							/* We're inserting */
-							tmp->next->prev = p;
-							p->next = tmp->next;
-						} else {
-							/* Update the last packet */
-							last = p;
-						}
-						tmp->next = p;
-						p->prev = tmp;
-						break;
-					} else if(tmp->seq > p->seq && (abs(tmp->seq - p->seq) > 10000)) {
-						/* The new sequence number (reset) is greater than the last one we have, append */
-						added = 1;
-						if(tmp->next != NULL) {
-							/* We're inserting */
-							tmp->next->prev = p;
-							p->next = tmp->next;
-						} else {
-							/* Update the last packet */
-							last = p;
-						}
-						tmp->next = p;
-						p->prev = tmp;
-						break;
-					} else if(tmp->seq == p->seq) {
-						/* Maybe a retransmission? Skip */
-						JANUS_LOG(LOG_WARN, "Skipping duplicate packet (seq=%"SCNu16")\n", p->seq);
-						p->drop = 1;
-						break;
-					}
-				}
-				/* If either the timestamp or the sequence number we just got is smaller, keep going back */
-				tmp = tmp->prev;
-			}
-			if(p->drop) {
-				/* We don't need this */
-				g_free(p);
-				p = NULL;
-			} else if(!added) {
-				/* We reached the start */
-				p->next = list;
-				list->prev = p;
-				list = p;
-			}
+		if(options.reorder_window > 0 && packets->len > 0 && !p->drop &&
+				!janus_pp_frame_packet_insert(packets, p, options.reorder_window)) {
+			/* Out of the reorder window, we can't use this */
+			JANUS_LOG(LOG_WARN, "Dropping packet out of the reorder window (seq=%"SCNu16")\n", p->seq);
+			g_free(p);
+			p = NULL;
+		} else if(options.reorder_window > 0 && packets->len > 0 && !p->drop) {
+			/* Already added in the right place */
+			if(p->ts < first_ts)
+				first_ts = p->ts;
+		} else if(packets->len == 0 || !p->drop) {
+			/* Packets are sorted once they've all been read */
+			if(packets->len == 0 || p->ts < first_ts)
+				first_ts = p->ts;
+			g_ptr_array_add(packets, p);
+		} else {
+			/* We don't need this */
+			g_free(p);
+			p = NULL;
 		}
 		/* Add to the extended header, if that's what we're doing */
 		if(extjson_only && p && p->rotation != -1 && p->rotation != last_rotation) {
 			last_rotation = p->rotation;
 			if(rotations == NULL)
 				rotations = json_array();
-			double ts = (double)(p->ts - list->ts)/(double)90000;
+			double ts = (double)(p->ts - first_ts)/(double)90000;
 			json_t *r = json_object();
 			json_object_set_new(r, "ts", json_real(ts));
 			json_object_set_new(r, "rotation", json_integer(p->rotation));
@@ -1137,6 +1566,29 @@ int main(int argc, char *argv[]) {
 		offset += len;
 		count++;
 	}
+	/* Order the packets by timestamp and sequence number (the sort is stable,
+	 * so packets that compare equal keep the order they were read in), drop
+	 * duplicates, and link them in the list the processors expect: with a
+	 * reorder window, the packets are already in order at this point */
+	if(options.reorder_window <= 0)
+		g_ptr_array_sort(packets, janus_pp_frame_packet_compare);
+	guint pi = 0;
+	for(pi=0; pi<packets->len; pi++) {
+		janus_pp_frame_packet *p = g_ptr_array_index(packets, pi);
+		if(last != NULL && last->ts == p->ts && last->seq == p->seq) {
+			/* Maybe a retransmission? Skip */
+			JANUS_LOG(LOG_WARN, "Skipping duplicate packet (seq=%"SCNu16")\n", p->seq);
+			g_free(p);
+			continue;
+		}
+		p->prev = last;
+		if(last != NULL)
+			last->next = p;
+		else
+			list = p;
+		last = p;
+	}
+	g_ptr_array_free(packets, TRUE);
 	if(!working) {
 		if(info)
 			json_decref(info);
@@ -1516,6 +1968,23 @@ int main(int argc, char *argv[]) {
 		}
 	}
 	fclose(file);
+	g_free(source_data);
+
+	int res = 0;
+	if(transcode_destination != NULL) {
+		/* Transcode the file we just created to the actual target */
+		JANUS_LOG(LOG_INFO, "Transcoding to %s (%s)...\n", transcode_destination, options.transcode);
+		if(janus_pp_transcode(destination, options.transcode, options.encoder, options.bitrate,
+				options.hwdevice, transcode_extension, metadata, transcode_destination) < 0) {
+			JANUS_LOG(LOG_ERR, "Error transcoding, the processed recording is still available in %s\n", destination);
+			res = 1;
+		} else {
+			unlink(destination);
+			g_free(destination);
+			destination = transcode_destination;
+		}
+		g_free(transcode_extension);
+	}
 
 	file = fopen(destination, "rb");
 	if(file == NULL) {
@@ -1539,7 +2008,7 @@ int main(int argc, char *argv[]) {
 	janus_pprec_options_destroy();
 
 	JANUS_LOG(LOG_INFO, "Bye!\n");
-	return 0;
+	return res;
 }
 
 /* Static helper to quickly find the extension data */
@@ -7,6 +7,13 @@
 
 #include "pp-avformat.h"
 
+#if defined(USE_CODECPAR) && LIBAVCODEC_VER_AT_LEAST(58, 0)
+#define JANUS_PP_TRANSCODE
+#include <libavutil/hwcontext.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/opt.h>
+#endif
+
 void janus_pp_setup_avformat(void) {
 	/* Setup FFmpeg */
 #if ( LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(58,9,100) )
@@ -77,6 +84,810 @@ AVStream *janus_pp_new_audio_avstream(AVFormatContext *fctx, int codec_id, int s
 	return st;
 }
 
+int janus_pp_remux(const char **sources, const int64_t *offsets, int num, const char *format, const char *metadata, const char *destination) {
+#ifndef USE_CODECPAR
+	JANUS_LOG(LOG_ERR, "Muxing not supported with this version of libavformat\n");
+	return -1;
+#else
+	if(sources == NULL || num < 1 || format == NULL || destination == NULL)
+		return -1;
+	janus_pp_setup_avformat();
+	int res = -1, i = 0;
+	unsigned int s = 0;
+	AVFormatContext **inputs = g_malloc0(num * sizeof(AVFormatContext *));
+	AVPacket **pending = g_malloc0(num * sizeof(AVPacket *));
+	int *first_stream = g_malloc0(num * sizeof(int));
+	AVFormatContext *fctx = NULL;
+	for(i=0; i<num; i++) {
+		if(avformat_open_input(&inputs[i], sources[i], NULL, NULL) < 0 ||
+				avformat_find_stream_info(inputs[i], NULL) < 0) {
+			JANUS_LOG(LOG_ERR, "Error opening %s for muxing\n", sources[i]);
+			goto done;
+		}
+	}
+	fctx = janus_pp_create_avformatcontext(format, metadata, destination);
+	if(fctx == NULL)
+		goto done;
+	/* Each stream of each source gets a stream in the target */
+	for(i=0; i<num; i++) {
+		first_stream[i] = fctx->nb_streams;
+		for(s=0; s<inputs[i]->nb_streams; s++) {
+			AVStream *st = avformat_new_stream(fctx, NULL);
+			if(st == NULL || avcodec_parameters_copy(st->codecpar, inputs[i]->streams[s]->codecpar) < 0) {
+				JANUS_LOG(LOG_ERR, "Error adding stream\n");
+				goto done;
+			}
+			st->codecpar->codec_tag = 0;
+			st->time_base = inputs[i]->streams[s]->time_base;
+		}
+	}
+	if(avformat_write_header(fctx, NULL) < 0) {
+		JANUS_LOG(LOG_ERR, "Error writing header\n");
+		goto done;
+	}
+	/* Read one packet from each source, and always write the oldest one */
+	for(i=0; i<num; i++) {
+		pending[i] = av_packet_alloc();
+		if(av_read_frame(inputs[i], pending[i]) < 0)
+			av_packet_free(&pending[i]);
+	}
+	while(TRUE) {
+		int next = -1;
+		int64_t next_time = 0;
+		for(i=0; i<num; i++) {
+			if(pending[i] == NULL)
+				continue;
+			AVStream *st = inputs[i]->streams[pending[i]->stream_index];
+			int64_t when = (pending[i]->dts != AV_NOPTS_VALUE ? pending[i]->dts : pending[i]->pts);
+			when = av_rescale_q(when, st->time_base, AV_TIME_BASE_Q) + (offsets ? offsets[i] : 0);
+			if(next == -1 || when < next_time) {
+				next = i;
+				next_time = when;
+			}
+		}
+		if(next == -1)
+			break;
+		AVPacket *pkt = pending[next];
+		AVStream *ist = inputs[next]->streams[pkt->stream_index];
+		pkt->stream_index += first_stream[next];
+		AVStream *ost = fctx->streams[pkt->stream_index];
+		int64_t offset = av_rescale_q(offsets ? offsets[next] : 0, AV_TIME_BASE_Q, ost->time_base);
+		av_packet_rescale_ts(pkt, ist->time_base, ost->time_base);
+		if(pkt->pts != AV_NOPTS_VALUE)
+			pkt->pts += offset;
+		if(pkt->dts != AV_NOPTS_VALUE)
+			pkt->dts += offset;
+		pkt->pos = -1;
+		if(av_interleaved_write_frame(fctx, pkt) < 0)
+			JANUS_LOG(LOG_WARN, "Error writing packet to %s\n", destination);
+		if(av_read_frame(inputs[next], pkt) < 0)
+			av_packet_free(&pending[next]);
+	}
+	av_write_trailer(fctx);
+	res = 0;
+
+done:
+	for(i=0; i<num; i++) {
+		if(pending[i] != NULL)
+			av_packet_free(&pending[i]);
+		if(inputs[i] != NULL)
+			avformat_close_input(&inputs[i]);
+	}
+	g_free(inputs);
+	g_free(pending);
+	g_free(first_stream);
+	if(fctx != NULL) {
+		avio_close(fctx->pb);
+		avformat_free_context(fctx);
+	}
+	return res;
+#endif
+}
+
+#if defined(USE_CODECPAR) && LIBAVCODEC_VER_AT_LEAST(57, 37)
+/* Audio of each source we're mixing, decoded as interleaved floats with
+ * the channels and sample rate of the mix */
+typedef struct janus_pp_mix_source {
+	AVFormatContext *fctx;
+	AVCodecContext *dctx;
+	int stream, channels, factor;
+	AVPacket *pkt;
+	AVFrame *frame;
+	float *samples, last[2];
+	int buffered, size;
+	/* Samples of silence to add before this source starts */
+	int64_t delay;
+	gboolean eof;
+} janus_pp_mix_source;
+
+static float janus_pp_mix_sample(AVFrame *frame, int channels, int i, int c) {
+	switch(frame->format) {
+		case AV_SAMPLE_FMT_S16:
+			return (float)((int16_t *)frame->data[0])[i*channels+c] / 32768.0f;
+		case AV_SAMPLE_FMT_S16P:
+			return (float)((int16_t *)frame->data[c])[i] / 32768.0f;
+		case AV_SAMPLE_FMT_S32:
+			return (float)((int32_t *)frame->data[0])[i*channels+c] / 2147483648.0f;
+		case AV_SAMPLE_FMT_S32P:
+			return (float)((int32_t *)frame->data[c])[i] / 2147483648.0f;
+		case AV_SAMPLE_FMT_FLT:
+			return ((float *)frame->data[0])[i*channels+c];
+		case AV_SAMPLE_FMT_FLTP:
+			return ((float *)frame->data[c])[i];
+		default:
+			break;
+	}
+	return 0.0f;
+}
+
+/* Convert a decoded frame to the format of the mix, and buffer it: sources
+ * with a lower sample rate are upsampled with a linear interpolation */
+static void janus_pp_mix_append(janus_pp_mix_source *src, int channels) {
+	AVFrame *frame = src->frame;
+#ifdef NEW_CHANNEL_LAYOUT
+	int src_channels = frame->ch_layout.nb_channels;
+#else
+	int src_channels = frame->channels;
+#endif
+	if(src_channels < 1)
+		src_channels = 1;
+	int needed = (src->buffered + frame->nb_samples * src->factor) * channels;
+	if(needed > src->size) {
+		src->size = needed;
+		src->samples = g_realloc(src->samples, src->size * sizeof(float));
+	}
+	float *dst = src->samples + src->buffered * channels;
+	int i = 0, c = 0, j = 0;
+	for(i=0; i<frame->nb_samples; i++) {
+		for(c=0; c<channels; c++) {
+			/* Mono sources are copied to all channels */
+			float value = janus_pp_mix_sample(frame, src_channels, i, c < src_channels ? c : 0);
+			for(j=0; j<src->factor; j++) {
+				dst[(i*src->factor + j)*channels + c] =
+					src->last[c] + (value - src->last[c]) * (float)(j+1) / (float)src->factor;
+			}
+			src->last[c] = value;
+		}
+	}
+	src->buffered += frame->nb_samples * src->factor;
+}
+
+/* Decode one more frame from a source, if there's any left */
+static void janus_pp_mix_decode(janus_pp_mix_source *src, int channels) {
+	while(!src->eof) {
+		int ret = avcodec_receive_frame(src->dctx, src->frame);
+		if(ret == 0) {
+			janus_pp_mix_append(src, channels);
+			av_frame_unref(src->frame);
+			return;
+		} else if(ret != AVERROR(EAGAIN)) {
+			/* We're done (or something went wrong) */
+			src->eof = TRUE;
+			return;
+		}
+		/* The decoder needs more data */
+		if(av_read_frame(src->fctx, src->pkt) < 0) {
+			/* Drain the decoder */
+			avcodec_send_packet(src->dctx, NULL);
+			continue;
+		}
+		if(src->pkt->stream_index == src->stream && avcodec_send_packet(src->dctx, src->pkt) < 0)
+			JANUS_LOG(LOG_WARN, "Error decoding packet, skipping\n");
+		av_packet_unref(src->pkt);
+	}
+}
+
+/* Add the samples of a source to the mix: this is written so that the
+ * compiler can vectorize it */
+static void janus_pp_mix_add(float * restrict mix, const float * restrict samples, int count) {
+	int i = 0;
+	for(i=0; i<count; i++)
+		mix[i] += samples[i];
+}
+
+/* Encode a frame of the mix, and write the resulting packets, if any */
+static int janus_pp_mix_encode(AVFormatContext *fctx, AVStream *st, AVCodecContext *ectx, AVFrame *frame, AVPacket *pkt) {
+	int ret = avcodec_send_frame(ectx, frame);
+	if(ret < 0)
+		return ret;
+	while((ret = avcodec_receive_packet(ectx, pkt)) == 0) {
+		av_packet_rescale_ts(pkt, ectx->time_base, st->time_base);
+		pkt->stream_index = st->index;
+		if(av_interleaved_write_frame(fctx, pkt) < 0)
+			JANUS_LOG(LOG_WARN, "Error writing mixed packet\n");
+		av_packet_unref(pkt);
+	}
+	return (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) ? 0 : ret;
+}
+#endif
+
+int janus_pp_mix(const char **sources, const int64_t *offsets, int num, const char *format, const char *metadata, const char *destination) {
+#if !defined(USE_CODECPAR) || !LIBAVCODEC_VER_AT_LEAST(57, 37)
+	JANUS_LOG(LOG_ERR, "Mixing not supported with this version of libavcodec\n");
+	return -1;
+#else
+	if(sources == NULL || num < 1 || format == NULL || destination == NULL)
+		return -1;
+	janus_pp_setup_avformat();
+	/* Check what we need to encode to */
+	const char *container = NULL;
+	const AVCodec *encoder = NULL;
+	if(!strcasecmp(format, "wav")) {
+		container = "wav";
+		encoder = avcodec_find_encoder(AV_CODEC_ID_PCM_S16LE);
+	} else if(!strcasecmp(format, "opus") || !strcasecmp(format, "ogg") || !strcasecmp(format, "mka")) {
+		container = strcasecmp(format, "mka") ? "ogg" : "matroska";
+		encoder = avcodec_find_encoder_by_name("libopus");
+		if(encoder == NULL)
+			encoder = avcodec_find_encoder(AV_CODEC_ID_OPUS);
+	} else {
+		JANUS_LOG(LOG_ERR, "Unsupported format for mixing (%s)\n", format);
+		return -1;
+	}
+	if(encoder == NULL) {
+		JANUS_LOG(LOG_ERR, "Encoder for %s not available\n", format);
+		return -1;
+	}
+	int res = -1, i = 0, rate = 0, channels = 1;
+	unsigned int s = 0;
+	janus_pp_mix_source *srcs = g_malloc0(num * sizeof(janus_pp_mix_source));
+	AVFormatContext *fctx = NULL;
+	AVCodecContext *ectx = NULL;
+	AVStream *st = NULL;
+	AVFrame *frame = NULL;
+	AVPacket *pkt = NULL;
+	float *mix = NULL;
+	for(i=0; i<num; i++) {
+		janus_pp_mix_source *src = &srcs[i];
+		src->stream = -1;
+		if(avformat_open_input(&src->fctx, sources[i], NULL, NULL) < 0 ||
+				avformat_find_stream_info(src->fctx, NULL) < 0) {
+			JANUS_LOG(LOG_ERR, "Error opening %s for mixing\n", sources[i]);
+			goto done;
+		}
+		for(s=0; s<src->fctx->nb_streams; s++) {
+			if(src->fctx->streams[s]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
+				src->stream = s;
+				break;
+			}
+		}
+		const AVCodec *decoder = src->stream < 0 ? NULL :
+			avcodec_find_decoder(src->fctx->streams[src->stream]->codecpar->codec_id);
+		if(decoder == NULL) {
+			JANUS_LOG(LOG_ERR, "No audio we can decode in %s\n", sources[i]);
+			goto done;
+		}
+		src->dctx = avcodec_alloc_context3(decoder);
+		if(src->dctx == NULL || avcodec_parameters_to_context(src->dctx, src->fctx->streams[src->stream]->codecpar) < 0 ||
+				avcodec_open2(src->dctx, decoder, NULL) < 0) {
+			JANUS_LOG(LOG_ERR, "Error opening decoder for %s\n", sources[i]);
+			goto done;
+		}
+#ifdef NEW_CHANNEL_LAYOUT
+		src->channels = src->dctx->ch_layout.nb_channels;
+#else
+		src->channels = src->dctx->channels;
+#endif
+		if(src->dctx->sample_rate > rate)
+			rate = src->dctx->sample_rate;
+		if(src->channels > channels)
+			channels = src->channels > 2 ? 2 : src->channels;
+		src->pkt = av_packet_alloc();
+		src->frame = av_frame_alloc();
+	}
+	/* The mix uses the highest sample rate: other sources must be a divisor of that */
+	for(i=0; i<num; i++) {
+		janus_pp_mix_source *src = &srcs[i];
+		if(src->dctx->sample_rate <= 0 || rate % src->dctx->sample_rate) {
+			JANUS_LOG(LOG_ERR, "Can't mix %s, unsupported sample rate (%d, mixing at %d)\n",
+				sources[i], src->dctx->sample_rate, rate);
+			goto done;
+		}
+		src->factor = rate / src->dctx->sample_rate;
+		src->delay = offsets ? av_rescale(offsets[i], rate, AV_TIME_BASE) : 0;
+	}
+	JANUS_LOG(LOG_INFO, "Mixing %d sources (%d Hz, %d channels)\n", num, rate, channels);
+	/* Prepare the encoder and the target */
+	fctx = janus_pp_create_avformatcontext(container, metadata, destination);
+	if(fctx == NULL)
+		goto done;
+	ectx = avcodec_alloc_context3(encoder);
+	if(ectx == NULL)
+		goto done;
+	ectx->sample_rate = rate;
+	ectx->time_base = (AVRational){ 1, rate };
+	ectx->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
+	ectx->sample_fmt = AV_SAMPLE_FMT_S16;
+	if(encoder->sample_fmts != NULL) {
+		/* We prefer floats, if the encoder supports them */
+		const enum AVSampleFormat *fmt = encoder->sample_fmts;
+		ectx->sample_fmt = *fmt;
+		while(*fmt != AV_SAMPLE_FMT_NONE) {
+			if(*fmt == AV_SAMPLE_FMT_FLT)
+				ectx->sample_fmt = *fmt;
+			fmt++;
+		}
+	}
+	if(ectx->sample_fmt != AV_SAMPLE_FMT_FLT && ectx->sample_fmt != AV_SAMPLE_FMT_S16) {
+		JANUS_LOG(LOG_ERR, "Unsupported encoder sample format (%s)\n", av_get_sample_fmt_name(ectx->sample_fmt));
+		goto done;
+	}
+#ifdef NEW_CHANNEL_LAYOUT
+	av_channel_layout_default(&ectx->ch_layout, channels);
+#else
+	ectx->channels = channels;
+	ectx->channel_layout = av_get_default_channel_layout(channels);
+#endif
+	if(fctx->oformat->flags & AVFMT_GLOBALHEADER)
+		ectx->flags |= CODEC_FLAG_GLOBAL_HEADER;
+	if(avcodec_open2(ectx, encoder, NULL) < 0) {
+		JANUS_LOG(LOG_ERR, "Error opening %s encoder (%d Hz, %d channels)\n", encoder->name, rate, channels);
+		goto done;
+	}
+	st = avformat_new_stream(fctx, NULL);
+	if(st == NULL || avcodec_parameters_from_context(st->codecpar, ectx) < 0) {
+		JANUS_LOG(LOG_ERR, "Error adding stream\n");
+		goto done;
+	}
+	st->time_base = ectx->time_base;
+	if(avformat_write_header(fctx, NULL) < 0) {
+		JANUS_LOG(LOG_ERR, "Error writing header\n");
+		goto done;
+	}
+	int frame_size = ectx->frame_size > 0 ? ectx->frame_size : rate/50;
+	frame = av_frame_alloc();
+	pkt = av_packet_alloc();
+	frame->nb_samples = frame_size;
+	frame->format = ectx->sample_fmt;
+	frame->sample_rate = rate;
+#ifdef NEW_CHANNEL_LAYOUT
+	av_channel_layout_copy(&frame->ch_layout, &ectx->ch_layout);
+#else
+	frame->channels = channels;
+	frame->channel_layout = ectx->channel_layout;
+#endif
+	if(av_frame_get_buffer(frame, 0) < 0) {
+		JANUS_LOG(LOG_ERR, "Error allocating frame\n");
+		goto done;
+	}
+	/* Mix a frame at a time, decoding from each source only what we need */
+	int count = frame_size * channels, k = 0;
+	mix = g_malloc(count * sizeof(float));
+	int64_t position = 0;
+	while(TRUE) {
+		memset(mix, 0, count * sizeof(float));
+		int active = 0;
+		for(i=0; i<num; i++) {
+			janus_pp_mix_source *src = &srcs[i];
+			if(src->eof && src->buffered == 0)
+				continue;
+			active++;
+			if(src->delay >= frame_size) {
+				/* This source hasn't started yet */
+				src->delay -= frame_size;
+				continue;
+			}
+			int start = src->delay, needed = frame_size - src->delay;
+			src->delay = 0;
+			while(src->buffered < needed && !src->eof)
+				janus_pp_mix_decode(src, channels);
+			int samples = src->buffered < needed ? src->buffered : needed;
+			janus_pp_mix_add(mix + start*channels, src->samples, samples*channels);
+			src->buffered -= samples;
+			if(src->buffered > 0)
+				memmove(src->samples, src->samples + samples*channels, src->buffered * channels * sizeof(float));
+		}
+		if(active == 0)
+			break;
+		if(av_frame_make_writable(frame) < 0)
+			break;
+		/* Convert to what the encoder expects, clipping as we go */
+		if(ectx->sample_fmt == AV_SAMPLE_FMT_FLT) {
+			float *out = (float *)frame->data[0];
+			for(k=0; k<count; k++)
+				out[k] = mix[k] > 1.0f ? 1.0f : (mix[k] < -1.0f ? -1.0f : mix[k]);
+		} else {
+			int16_t *out = (int16_t *)frame->data[0];
+			for(k=0; k<count; k++) {
+				float value = mix[k] * 32768.0f;
+				out[k] = value > 32767.0f ? 32767 : (value < -32768.0f ? -32768 : (int16_t)value);
+			}
+		}
+		frame->pts = position;
+		position += frame_size;
+		if(janus_pp_mix_encode(fctx, st, ectx, frame, pkt) < 0) {
+			JANUS_LOG(LOG_ERR, "Error encoding mixed frame\n");
+			goto done;
+		}
+	}
+	/* Flush the encoder */
+	janus_pp_mix_encode(fctx, st, ectx, NULL, pkt);
+	av_write_trailer(fctx);
+	JANUS_LOG(LOG_INFO, "Mixed %.2f seconds of audio\n", (double)position/(double)rate);
+	res = 0;
+
+done:
+	for(i=0; i<num; i++) {
+		janus_pp_mix_source *src = &srcs[i];
+		if(src->dctx != NULL)
+			avcodec_free_context(&src->dctx);
+		if(src->fctx != NULL)
+			avformat_close_input(&src->fctx);
+		av_packet_free(&src->pkt);
+		av_frame_free(&src->frame);
+		g_free(src->samples);
+	}
+	g_free(srcs);
+	g_free(mix);
+	av_frame_free(&frame);
+	av_packet_free(&pkt);
+	if(ectx != NULL)
+		avcodec_free_context(&ectx);
+	if(fctx != NULL) {
+		avio_close(fctx->pb);
+		avformat_free_context(fctx);
+	}
+	return res;
+#endif
+}
+
+#ifdef JANUS_PP_TRANSCODE
+/* Encoders we try for each target codec, hardware ones first */
+static const char *janus_pp_transcode_h264[] = { "h264_nvenc", "h264_qsv", "h264_vaapi", "libx264", "libopenh264", NULL };
+static const char *janus_pp_transcode_h265[] = { "hevc_nvenc", "hevc_qsv", "hevc_vaapi", "libx265", NULL };
+static const char *janus_pp_transcode_vp9[] = { "vp9_qsv", "vp9_vaapi", "libvpx-vp9", NULL };
+static const char *janus_pp_transcode_av1[] = { "av1_nvenc", "av1_qsv", "av1_vaapi", "libsvtav1", "libaom-av1", NULL };
+
+/* Transcoder state */
+typedef struct janus_pp_transcoder {
+	AVFormatContext *fctx;
+	AVStream *st;
+	AVCodecContext *ectx;
+	/* The frames we feed the encoder (or upload, for VAAPI) */
+	AVFrame *frame;
+	gboolean hw_frames;
+	AVPacket *pkt;
+	int64_t frames, skipped;
+} janus_pp_transcoder;
+
+/* Open an encoder for frames of the specified size: we feed encoders either
+ * I420 or NV12 frames, uploading the latter to the GPU for VAAPI ones */
+static AVCodecContext *janus_pp_transcode_open(const AVCodec *encoder, int width, int height,
+		AVRational time_base, AVRational framerate, int bitrate, const char *device, gboolean global_header,
+		gboolean *hw_frames) {
+	enum AVPixelFormat sw_format = AV_PIX_FMT_NONE;
+	gboolean vaapi = FALSE;
+	const enum AVPixelFormat *fmt = encoder->pix_fmts;
+	while(fmt != NULL && *fmt != AV_PIX_FMT_NONE) {
+		if(*fmt == AV_PIX_FMT_YUV420P)
+			sw_format = AV_PIX_FMT_YUV420P;
+		else if(*fmt == AV_PIX_FMT_NV12 && sw_format != AV_PIX_FMT_YUV420P)
+			sw_format = AV_PIX_FMT_NV12;
+		else if(*fmt == AV_PIX_FMT_VAAPI)
+			vaapi = TRUE;
+		fmt++;
+	}
+	if(sw_format == AV_PIX_FMT_NONE && !vaapi) {
+		JANUS_LOG(LOG_WARN, "Encoder %s doesn't support any pixel format we can feed it\n", encoder->name);
+		return NULL;
+	}
+	AVCodecContext *ectx = avcodec_alloc_context3(encoder);
+	if(ectx == NULL)
+		return NULL;
+	ectx->width = width;
+	ectx->height = height;
+	ectx->time_base = time_base;
+	if(framerate.num > 0 && framerate.den > 0)
+		ectx->framerate = framerate;
+	ectx->sample_aspect_ratio = (AVRational){ 1, 1 };
+	if(bitrate > 0)
+		ectx->bit_rate = (int64_t)bitrate * 1000;
+	if(global_header)
+		ectx->flags |= CODEC_FLAG_GLOBAL_HEADER;
+	*hw_frames = FALSE;
+	if(sw_format == AV_PIX_FMT_NONE) {
+		/* VAAPI only takes GPU frames: create a device and a pool for them */
+		AVBufferRef *hwdevice = NULL, *hwframes = NULL;
+		if(av_hwdevice_ctx_create(&hwdevice, AV_HWDEVICE_TYPE_VAAPI, device, NULL, 0) < 0 ||
+				(hwframes = av_hwframe_ctx_alloc(hwdevice)) == NULL) {
+			JANUS_LOG(LOG_WARN, "Couldn't open VAAPI device %s for %s\n", device ? device : "(default)", encoder->name);
+			av_buffer_unref(&hwdevice);
+			avcodec_free_context(&ectx);
+			return NULL;
+		}
+		AVHWFramesContext *frames = (AVHWFramesContext *)hwframes->data;
+		frames->format = AV_PIX_FMT_VAAPI;
+		frames->sw_format = AV_PIX_FMT_NV12;
+		frames->width = width;
+		frames->height = height;
+		frames->initial_pool_size = 20;
+		if(av_hwframe_ctx_init(hwframes) < 0) {
+			JANUS_LOG(LOG_WARN, "Couldn't create VAAPI frames for %s\n", encoder->name);
+			av_buffer_unref(&hwframes);
+			av_buffer_unref(&hwdevice);
+			avcodec_free_context(&ectx);
+			return NULL;
+		}
+		ectx->pix_fmt = AV_PIX_FMT_VAAPI;
+		ectx->hw_frames_ctx = hwframes;
+		av_buffer_unref(&hwdevice);
+		*hw_frames = TRUE;
+	} else {
+		ectx->pix_fmt = sw_format;
+		/* NVENC picks the GPU via a private option */
+		if(device != NULL && strstr(encoder->name, "_nvenc") != NULL)
+			av_opt_set(ectx->priv_data, "gpu", device, 0);
+	}
+	if(avcodec_open2(ectx, encoder, NULL) < 0) {
+		/* Hardware encoders may be compiled in, but with no hardware to use */
+		JANUS_LOG(LOG_WARN, "Couldn't open encoder %s (%dx%d)\n", encoder->name, width, height);
+		avcodec_free_context(&ectx);
+		return NULL;
+	}
+	return ectx;
+}
+
+/* Copy a decoded I420 frame to the one we feed the encoder: since we don't
+ * scale, frames with a different resolution than the first one are cropped
+ * or padded (with black) to that */
+static void janus_pp_transcode_copy(const AVFrame *in, AVFrame *out) {
+	int w = in->width < out->width ? in->width : out->width;
+	int h = in->height < out->height ? in->height : out->height;
+	int x = 0, y = 0;
+	for(y=0; y<out->height; y++) {
+		uint8_t *dst = out->data[0] + y*out->linesize[0];
+		if(y < h) {
+			memcpy(dst, in->data[0] + y*in->linesize[0], w);
+			if(w < out->width)
+				memset(dst + w, 16, out->width - w);
+		} else {
+			memset(dst, 16, out->width);
+		}
+	}
+	int cw = (w+1)/2, ch = (h+1)/2, ow = (out->width+1)/2, oh = (out->height+1)/2;
+	for(y=0; y<oh; y++) {
+		const uint8_t *u = in->data[1] + y*in->linesize[1], *v = in->data[2] + y*in->linesize[2];
+		if(out->format == AV_PIX_FMT_NV12) {
+			uint8_t *dst = out->data[1] + y*out->linesize[1];
+			for(x=0; x<ow; x++) {
+				gboolean copy = (y < ch && x < cw);
+				dst[2*x] = copy ? u[x] : 128;
+				dst[2*x+1] = copy ? v[x] : 128;
+			}
+		} else {
+			uint8_t *dst_u = out->data[1] + y*out->linesize[1], *dst_v = out->data[2] + y*out->linesize[2];
+			if(y < ch) {
+				memcpy(dst_u, u, cw);
+				memcpy(dst_v, v, cw);
+				if(cw < ow) {
+					memset(dst_u + cw, 128, ow - cw);
+					memset(dst_v + cw, 128, ow - cw);
+				}
+			} else {
+				memset(dst_u, 128, ow);
+				memset(dst_v, 128, ow);
+			}
+		}
+	}
+}
+
+/* Write the packets the encoder has ready, if any */
+static int janus_pp_transcode_write(janus_pp_transcoder *tc) {
+	int ret = 0;
+	while((ret = avcodec_receive_packet(tc->ectx, tc->pkt)) == 0) {
+		av_packet_rescale_ts(tc->pkt, tc->ectx->time_base, tc->st->time_base);
+		tc->pkt->stream_index = tc->st->index;
+		if(av_interleaved_write_frame(tc->fctx, tc->pkt) < 0)
+			JANUS_LOG(LOG_WARN, "Error writing transcoded packet\n");
+		av_packet_unref(tc->pkt);
+	}
+	return (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) ? 0 : ret;
+}
+
+/* Encode a decoded frame (or flush the encoder, if NULL) */
+static int janus_pp_transcode_encode(janus_pp_transcoder *tc, AVFrame *in, AVRational time_base) {
+	if(in == NULL) {
+		if(avcodec_send_frame(tc->ectx, NULL) < 0)
+			return -1;
+		return janus_pp_transcode_write(tc);
+	}
+	if(in->format != AV_PIX_FMT_YUV420P && in->format != AV_PIX_FMT_YUVJ420P) {
+		/* Without scaling, we can only convert from I420 */
+		if(tc->skipped == 0)
+			JANUS_LOG(LOG_WARN, "Unsupported decoded pixel format (%s), skipping frames\n", av_get_pix_fmt_name(in->format));
+		tc->skipped++;
+		return 0;
+	}
+	if(av_frame_make_writable(tc->frame) < 0)
+		return -1;
+	janus_pp_transcode_copy(in, tc->frame);
+	int64_t pts = in->best_effort_timestamp != AV_NOPTS_VALUE ? in->best_effort_timestamp : in->pts;
+	tc->frame->pts = av_rescale_q(pts, time_base, tc->ectx->time_base);
+	int ret = 0;
+	if(tc->hw_frames) {
+		/* Upload the frame to the GPU first */
+		AVFrame *hwframe = av_frame_alloc();
+		if(hwframe == NULL || av_hwframe_get_buffer(tc->ectx->hw_frames_ctx, hwframe, 0) < 0 ||
+				av_hwframe_transfer_data(hwframe, tc->frame, 0) < 0) {
+			JANUS_LOG(LOG_ERR, "Error uploading frame to the GPU\n");
+			av_frame_free(&hwframe);
+			return -1;
+		}
+		hwframe->pts = tc->frame->pts;
+		ret = avcodec_send_frame(tc->ectx, hwframe);
+		av_frame_free(&hwframe);
+	} else {
+		ret = avcodec_send_frame(tc->ectx, tc->frame);
+	}
+	if(ret < 0)
+		return ret;
+	tc->frames++;
+	return janus_pp_transcode_write(tc);
+}
+
+/* Pick and open an encoder, once we know what the decoded frames look like */
+static int janus_pp_transcode_setup(janus_pp_transcoder *tc, const char **encoders, const char *encoder,
+		AVFrame *first, AVStream *ist, AVRational framerate, int bitrate, const char *device) {
+	gboolean global_header = (tc->fctx->oformat->flags & AVFMT_GLOBALHEADER) != 0;
+	/* Narrow timebases (like WebM's milliseconds) work for any encoder */
+	AVRational time_base = ist->time_base;
+	const char *spec[] = { encoder, NULL };
+	const char **name = encoder ? spec : encoders;
+	while(*name != NULL && tc->ectx == NULL) {
+		const AVCodec *codec = avcodec_find_encoder_by_name(*name);
+		if(codec != NULL) {
+			tc->ectx = janus_pp_transcode_open(codec, first->width, first->height,
+				time_base, framerate, bitrate, device, global_header, &tc->hw_frames);
+			if(tc->ectx != NULL)
+				JANUS_LOG(LOG_INFO, "Transcoding with %s (%dx%d)\n", codec->name, first->width, first->height);
+		} else if(encoder != NULL) {
+			JANUS_LOG(LOG_ERR, "Encoder %s not available\n", encoder);
+		}
+		name++;
+	}
+	if(tc->ectx == NULL) {
+		JANUS_LOG(LOG_ERR, "No usable encoder for transcoding\n");
+		return -1;
+	}
+	tc->st = avformat_new_stream(tc->fctx, NULL);
+	if(tc->st == NULL || avcodec_parameters_from_context(tc->st->codecpar, tc->ectx) < 0) {
+		JANUS_LOG(LOG_ERR, "Error adding stream\n");
+		return -1;
+	}
+	tc->st->time_base = tc->ectx->time_base;
+	if(avformat_write_header(tc->fctx, NULL) < 0) {
+		JANUS_LOG(LOG_ERR, "Error writing header\n");
+		return -1;
+	}
+	tc->frame = av_frame_alloc();
+	if(tc->frame == NULL)
+		return -1;
+	tc->frame->format = tc->hw_frames ? AV_PIX_FMT_NV12 : tc->ectx->pix_fmt;
+	tc->frame->width = first->width;
+	tc->frame->height = first->height;
+	if(av_frame_get_buffer(tc->frame, 0) < 0) {
+		JANUS_LOG(LOG_ERR, "Error allocating frame\n");
+		return -1;
+	}
+	return 0;
+}
+#endif
+
+int janus_pp_transcode(const char *source, const char *codec, const char *encoder, int bitrate,
+		const char *device, const char *format, const char *metadata, const char *destination) {
+#ifndef JANUS_PP_TRANSCODE
+	JANUS_LOG(LOG_ERR, "Transcoding not supported with this version of libavcodec\n");
+	return -1;
+#else
+	if(source == NULL || codec == NULL || format == NULL || destination == NULL)
+		return -1;
+	const char **encoders = NULL;
+	if(!strcasecmp(codec, "h264")) {
+		encoders = janus_pp_transcode_h264;
+	} else if(!strcasecmp(codec, "h265")) {
+		encoders = janus_pp_transcode_h265;
+	} else if(!strcasecmp(codec, "vp9")) {
+		encoders = janus_pp_transcode_vp9;
+	} else if(!strcasecmp(codec, "av1")) {
+		encoders = janus_pp_transcode_av1;
+	} else {
+		JANUS_LOG(LOG_ERR, "Unsupported codec for transcoding (%s)\n", codec);
+		return -1;
+	}
+	janus_pp_setup_avformat();
+	int res = -1, stream = -1;
+	unsigned int s = 0;
+	AVFormatContext *ifctx = NULL;
+	AVCodecContext *dctx = NULL;
+	AVPacket *pkt = NULL;
+	AVFrame *frame = NULL;
+	janus_pp_transcoder tc = { 0 };
+	if(avformat_open_input(&ifctx, source, NULL, NULL) < 0 ||
+			avformat_find_stream_info(ifctx, NULL) < 0) {
+		JANUS_LOG(LOG_ERR, "Error opening %s for transcoding\n", source);
+		goto done;
+	}
+	for(s=0; s<ifctx->nb_streams; s++) {
+		if(ifctx->streams[s]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+			stream = s;
+			break;
+		}
+	}
+	const AVCodec *decoder = stream < 0 ? NULL : avcodec_find_decoder(ifctx->streams[stream]->codecpar->codec_id);
+	if(decoder == NULL) {
+		JANUS_LOG(LOG_ERR, "No video we can decode in %s\n", source);
+		goto done;
+	}
+	AVStream *ist = ifctx->streams[stream];
+	dctx = avcodec_alloc_context3(decoder);
+	if(dctx == NULL || avcodec_parameters_to_context(dctx, ist->codecpar) < 0 ||
+			avcodec_open2(dctx, decoder, NULL) < 0) {
+		JANUS_LOG(LOG_ERR, "Error opening decoder for %s\n", source);
+		goto done;
+	}
+	AVRational framerate = av_guess_frame_rate(ifctx, ist, NULL);
+	tc.fctx = janus_pp_create_avformatcontext(format, metadata, destination);
+	if(tc.fctx == NULL)
+		goto done;
+	tc.pkt = av_packet_alloc();
+	pkt = av_packet_alloc();
+	frame = av_frame_alloc();
+	/* Decode and encode the frames as we read them: the encoder is only
+	 * opened when we get the first frame, as we need to know its size */
+	gboolean eof = FALSE;
+	while(!eof) {
+		if(av_read_frame(ifctx, pkt) < 0) {
+			/* Drain the decoder */
+			eof = TRUE;
+			avcodec_send_packet(dctx, NULL);
+		} else {
+			if(pkt->stream_index == stream && avcodec_send_packet(dctx, pkt) < 0)
+				JANUS_LOG(LOG_WARN, "Error decoding packet, skipping\n");
+			av_packet_unref(pkt);
+		}
+		while(avcodec_receive_frame(dctx, frame) == 0) {
+			if(tc.ectx == NULL && janus_pp_transcode_setup(&tc, encoders, encoder,
+					frame, ist, framerate, bitrate, device) < 0) {
+				av_frame_unref(frame);
+				goto done;
+			}
+			if(janus_pp_transcode_encode(&tc, frame, ist->time_base) < 0) {
+				JANUS_LOG(LOG_ERR, "Error encoding frame\n");
+				av_frame_unref(frame);
+				goto done;
+			}
+			av_frame_unref(frame);
+		}
+	}
+	if(tc.ectx == NULL) {
+		JANUS_LOG(LOG_ERR, "No video frames to transcode in %s\n", source);
+		goto done;
+	}
+	/* Flush the encoder */
+	janus_pp_transcode_encode(&tc, NULL, ist->time_base);
+	av_write_trailer(tc.fctx);
+	JANUS_LOG(LOG_INFO, "Transcoded %"SCNi64" frames (%"SCNi64" skipped)\n", tc.frames, tc.skipped);
+	res = 0;
+
+done:
+	av_packet_free(&pkt);
+	av_frame_free(&frame);
+	av_packet_free(&tc.pkt);
+	av_frame_free(&tc.frame);
+	if(tc.ectx != NULL)
+		avcodec_free_context(&tc.ectx);
+	if(dctx != NULL)
+		avcodec_free_context(&dctx);
+	if(ifctx != NULL)
+		avformat_close_input(&ifctx);
+	if(tc.fctx != NULL) {
+		avio_close(tc.fctx->pb);
+		avformat_free_context(tc.fctx);
+	}
+	return res;
+#endif
+}
+
 AVStream *janus_pp_new_video_avstream(AVFormatContext *fctx, int codec_id, int width, int height) {
 	AVStream *st = avformat_new_stream(fctx, NULL);
 	if(!st)
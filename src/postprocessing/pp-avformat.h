@@ -52,5 +52,23 @@ AVFormatContext *janus_pp_create_avformatcontext(const char *format, const char
 AVStream *janus_pp_new_video_avstream(AVFormatContext *fctx, int codec_id, int width, int height);
 AVStream *janus_pp_new_audio_avstream(AVFormatContext *fctx, int codec_id, int samplerate, int channels, const uint8_t *extradata, int size);
 
+/* Mux the streams of already processed files in a single file, without
+ * transcoding: offsets (in microseconds) delay each source, to align them */
+int janus_pp_remux(const char **sources, const int64_t *offsets, int num, const char *format, const char *metadata, const char *destination);
+
+/* Decode the audio of already processed files, and mix it in a single
+ * track: offsets (in microseconds) delay each source, to align them, while
+ * the format is the target extension (opus, ogg, mka or wav) */
+int janus_pp_mix(const char **sources, const int64_t *offsets, int num, const char *format, const char *metadata, const char *destination);
+
+/* Decode the video of an already processed file, and encode it again in a
+ * single pass to the specified codec (h264, h265, vp9 or av1), with the
+ * specified bitrate (in kbps, 0 for the encoder default): unless a specific
+ * libavcodec encoder is passed, hardware encoders (NVENC, QSV and VAAPI)
+ * are tried first, falling back to software ones. The device is the VAAPI
+ * render node or the NVENC GPU index to use, if not the default one */
+int janus_pp_transcode(const char *source, const char *codec, const char *encoder, int bitrate,
+	const char *device, const char *format, const char *metadata, const char *destination);
+
 
 #endif
@@ -22,6 +22,7 @@
 #include "pp-avformat.h"
 #include "pp-h264.h"
 #include "../debug.h"
+#include "../utils.h"
 
 /* MP4 output */
 static AVFormatContext *fctx;
@@ -428,8 +429,7 @@ int janus_pp_h264_process(FILE *file, janus_pp_frame_packet *list, int *working)
 				JANUS_LOG(LOG_HUGE, "Fragment=%d, NAL=%d, Start=%d (len=%d, frameLen=%d)\n", fragment, nal, start_bit, len, frameLen);
 			else
 				JANUS_LOG(LOG_HUGE, "Fragment=%d (len=%d, frameLen=%d)\n", fragment, len, frameLen);
-			if(fragment == 5 ||
-					((fragment == 28 || fragment == 29) && nal == 5 && start_bit == 128)) {
+			if(janus_h264_is_i_frame((const char *)buffer, len)) {
 				JANUS_LOG(LOG_VERB, "(seq=%"SCNu16", ts=%"SCNu64") Key frame\n", tmp->seq, tmp->ts);
 				keyFrame = 1;
 				/* Is this the first keyframe we find? */
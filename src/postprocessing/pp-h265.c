@@ -22,6 +22,7 @@
 #include "pp-avformat.h"
 #include "pp-h265.h"
 #include "../debug.h"
+#include "../utils.h"
 
 /* MP4 output */
 static AVFormatContext *fctx;
@@ -295,26 +296,7 @@ int janus_pp_h265_preprocess(FILE *file, janus_pp_frame_packet *list, json_t *in
 			/* SPS */
 			JANUS_LOG(LOG_HUGE, "[SPS] %u/%u/%u/%u\n", fbit, type, lid, tid);
 			/* Get rid of the Emulation Prevention code, if present */
-			int i = 0, j = 0, zeros = 0;
-			for(i=0; i<len; i++) {
-				if(zeros == 2 && prebuffer[i] == 0x03) {
-					/* Found, get rid of it */
-					i++;
-					zeros = 0;
-				}
-				/* Update the content of the buffer as we go along */
-				prebuffer[j] = prebuffer[i];
-				if(prebuffer[i] == 0x00) {
-					/* Found a zero, may be part of a start code */
-					zeros++;
-				} else {
-					/* Not a zero, so not the beginning of a start code */
-					zeros = 0;
-				}
-				j++;
-			}
-			/* Update the length of the buffer */
-			len = j;
+			len = janus_h26x_remove_emulation_prevention((uint8_t *)prebuffer, len);
 			/* Parse to get width/height */
 			int width = 0, height = 0;
 			janus_pp_h265_parse_sps(prebuffer, &width, &height);
@@ -363,24 +345,7 @@ int janus_pp_h265_preprocess(FILE *file, janus_pp_frame_packet *list, json_t *in
 					case 33:
 						JANUS_LOG(LOG_HUGE, "[SPS] %u/%u/%u/%u\n", fbit, type, lid, tid);
 						/* Get rid of the Emulation Prevention code, if present */
-						int i = 0, j = 0, zeros = 0;
-						for(i=0; i<payload_len; i++) {
-							if(zeros == 2 && p[i] == 0x03) {
-								/* Found, get rid of it */
-								i++;
-								zeros = 0;
-							}
-							/* Update the content of the buffer as we go along */
-							p[j] = p[i];
-							if(p[i] == 0x00) {
-								/* Found a zero, may be part of a start code */
-								zeros++;
-							} else {
-								/* Not a zero, so not the beginning of a start code */
-								zeros = 0;
-							}
-							j++;
-						}
+						janus_h26x_remove_emulation_prevention(p, payload_len);
 						/* Parse to get width/height */
 						int width = 0, height = 0;
 						janus_pp_h265_parse_sps((char*)p, &width, &height);
@@ -37,13 +37,22 @@ gboolean janus_pprec_options_parse(janus_pprec_options *options, int argc, char
 		{ "restamp", 'r', 0, G_OPTION_ARG_INT, &options->restamp_multiplier, "If the latency of a packet is bigger than the `moving_average_latency * (<restamp>/1000)` the timestamps will be corrected, disabled if 0 (default=0)", NULL },
 		{ "restamp-packets", 'c', 0, G_OPTION_ARG_INT, &options->restamp_packets, "Number of packets used for calculating moving average latency for timestamp correction (default=10)", NULL },
 		{ "restamp-min-th", 'n', 0, G_OPTION_ARG_INT, &options->restamp_min_th, "Minimum latency of moving average to reach before starting to correct timestamps. (default=500)", NULL },
+		{ "batch", 'B', 0, G_OPTION_ARG_NONE, &options->batch, "Process all the .mjr files passed as arguments, in parallel: targets get the name of the source, and the extension from --format or the default one for the codec", NULL },
+		{ "jobs", 'J', 0, G_OPTION_ARG_INT, &options->jobs, "In batch mode, how many recordings to process at the same time (default=number of CPUs)", NULL },
+		{ "mux", 'M', 0, G_OPTION_ARG_NONE, &options->mux, "In batch mode, mux the tracks of the same participant (e.g., name-audio-0.mjr and name-video-1.mjr) in a single file", NULL },
+		{ "mix", 'X', 0, G_OPTION_ARG_STRING, &options->mix, "Mix all the audio recordings passed as arguments in a single audio file (.opus, .ogg, .mka or .wav), aligning them by when they started (implies --batch)", NULL },
+		{ "reorder-window", 'W', 0, G_OPTION_ARG_INT, &options->reorder_window, "Assume packets were recorded (almost) in order, and only reorder them within a window of this many packets, dropping the ones that arrive later than that, instead of sorting them all at the end (default=0, disabled)", NULL },
+		{ "transcode", 'T', 0, G_OPTION_ARG_STRING, &options->transcode, "Transcode video recordings to this codec (h264, h265, vp9 or av1), using a hardware encoder if available: the target extension must be one supported for that codec", NULL },
+		{ "encoder", 'E', 0, G_OPTION_ARG_STRING, &options->encoder, "When transcoding, use this libavcodec encoder (e.g., h264_vaapi, h264_nvenc, h264_qsv or libx264) instead of picking the first one that works", NULL },
+		{ "bitrate", 'b', 0, G_OPTION_ARG_INT, &options->bitrate, "When transcoding, target bitrate in kbps (default=0, encoder default)", NULL },
+		{ "hw-device", 'V', 0, G_OPTION_ARG_STRING, &options->hwdevice, "When transcoding, hardware device to use: a render node (e.g., /dev/dri/renderD128) for VAAPI or a GPU index for NVENC (default=none, the default one)", NULL },
 		{ G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_STRING_ARRAY, &options->paths, NULL, NULL },
 		{ NULL, 0, 0, 0, NULL, NULL, NULL },
 	};
 
 	/* Parse the command-line arguments */
 	GError *error = NULL;
-	opts = g_option_context_new("source.mjr [destination.[opus|ogg|mka|wav|webm|mkv|h264|srt]]");
+	opts = g_option_context_new("source.mjr|- [destination.[opus|ogg|mka|wav|webm|mkv|h264|srt]] | --batch source1.mjr [source2.mjr ...] | --mix=destination.[opus|ogg|mka|wav] source1.mjr [source2.mjr ...]");
 	g_option_context_set_help_enabled(opts, TRUE);
 	g_option_context_add_main_entries(opts, opt_entries, NULL);
 	if(!g_option_context_parse(opts, &argc, &argv, &error)) {
@@ -37,6 +37,15 @@ typedef struct janus_pprec_options {
 	int restamp_multiplier;
 	int restamp_min_th;
 	int restamp_packets;
+	gboolean batch;
+	int jobs;
+	gboolean mux;
+	const char *mix;
+	int reorder_window;
+	const char *transcode;
+	const char *encoder;
+	int bitrate;
+	const char *hwdevice;
 	char **paths;
 } janus_pprec_options;
 
@@ -0,0 +1,40 @@
+/*! \file    probes.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Static tracepoints (USDT probes)
+ * \details  Macros to add USDT probes at key stages of the media and
+ * signalling paths, e.g., to build latency histograms with bpftrace or
+ * other eBPF based tools. Probes are only compiled in when Janus is
+ * configured with \c --enable-usdt (which requires \c sys/sdt.h, as
+ * provided by systemtap-sdt-dev or similar packages): when that's not
+ * the case, all the macros expand to nothing. When compiled in, a probe
+ * that isn't being traced is just a \c nop instruction, so there's no
+ * overhead besides preparing its arguments. All probes belong to the
+ * \c janus provider, and take the handle ID (or the request/transport
+ * instance pointer) as their first argument, so that the entry and exit
+ * probes of the same stage can be matched. Check \ref debug for the list.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef JANUS_PROBES_H
+#define JANUS_PROBES_H
+
+#ifdef HAVE_USDT
+#include <sys/sdt.h>
+
+#define JANUS_PROBE(name) DTRACE_PROBE(janus, name)
+#define JANUS_PROBE1(name, a) DTRACE_PROBE1(janus, name, a)
+#define JANUS_PROBE2(name, a, b) DTRACE_PROBE2(janus, name, a, b)
+#define JANUS_PROBE3(name, a, b, c) DTRACE_PROBE3(janus, name, a, b, c)
+#define JANUS_PROBE4(name, a, b, c, d) DTRACE_PROBE4(janus, name, a, b, c, d)
+#else
+#define JANUS_PROBE(name)
+#define JANUS_PROBE1(name, a)
+#define JANUS_PROBE2(name, a, b)
+#define JANUS_PROBE3(name, a, b, c)
+#define JANUS_PROBE4(name, a, b, c, d)
+#endif
+
+#endif
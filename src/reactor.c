@@ -0,0 +1,233 @@
+/*! \file    reactor.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Shared event loops for plain RTP/RTCP sockets
+ * \details  Implementation of a small pool of event loops, that core and
+ * plugins can use to be notified when data is available on a file
+ * descriptor (e.g., the plain RTP/RTCP sockets of a SIP call), rather
+ * than spawning a thread per session that polls its own sockets. Each
+ * watched file descriptor is assigned to the least loaded loop, and
+ * callbacks are invoked in the thread of that loop until the watch is
+ * removed, or until the callback returns FALSE.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include "reactor.h"
+#include "debug.h"
+#include "mutex.h"
+
+/* Event loops */
+typedef struct janus_reactor_loop {
+	int id;
+	GMainContext *mainctx;
+	GMainLoop *mainloop;
+	GThread *thread;
+	volatile gint watches;
+	GHashTable *sources;	/* The watches attached to this loop (protected by loops_mutex) */
+} janus_reactor_loop;
+static janus_reactor_loop *loops = NULL;
+static int loops_num = 0;
+static janus_mutex loops_mutex = JANUS_MUTEX_INITIALIZER;
+
+static void *janus_reactor_thread(void *data) {
+	janus_reactor_loop *loop = (janus_reactor_loop *)data;
+	JANUS_LOG(LOG_VERB, "[reactor#%d] Reactor thread started\n", loop->id);
+	g_main_loop_run(loop->mainloop);
+	JANUS_LOG(LOG_VERB, "[reactor#%d] Reactor thread ended!\n", loop->id);
+	return NULL;
+}
+
+/* Watched file descriptors */
+struct janus_reactor_watch {
+	GSource parent;
+	int fd;
+	gpointer tag;
+	janus_reactor_loop *loop;
+	janus_reactor_callback callback;
+	void *user_data;
+	GDestroyNotify notify;
+};
+static gboolean janus_reactor_watch_prepare(GSource *source, gint *timeout) {
+	*timeout = -1;
+	return FALSE;
+}
+static gboolean janus_reactor_watch_dispatch(GSource *source, GSourceFunc callback, gpointer user_data) {
+	janus_reactor_watch *watch = (janus_reactor_watch *)source;
+	GIOCondition condition = g_source_query_unix_fd(source, watch->tag);
+	gboolean error = (condition & (G_IO_ERR | G_IO_HUP | G_IO_NVAL)) != 0;
+	if(!error && !(condition & G_IO_IN))
+		return G_SOURCE_CONTINUE;
+	if(watch->callback == NULL || !watch->callback(watch->fd, error, watch->user_data))
+		return G_SOURCE_REMOVE;
+	return G_SOURCE_CONTINUE;
+}
+static void janus_reactor_watch_finalize(GSource *source) {
+	janus_reactor_watch *watch = (janus_reactor_watch *)source;
+	/* If the reactor was de-initialized already, the watch was detached from its loop */
+	janus_mutex_lock(&loops_mutex);
+	if(watch->loop != NULL) {
+		g_atomic_int_add(&watch->loop->watches, -1);
+		g_hash_table_remove(watch->loop->sources, watch);
+		watch->loop = NULL;
+	}
+	janus_mutex_unlock(&loops_mutex);
+	if(watch->notify != NULL && watch->user_data != NULL)
+		watch->notify(watch->user_data);
+}
+static GSourceFuncs janus_reactor_watch_funcs = {
+	janus_reactor_watch_prepare,
+	NULL,
+	janus_reactor_watch_dispatch,
+	janus_reactor_watch_finalize,
+	NULL, NULL
+};
+
+/* Reactor initialization */
+int janus_reactor_init(int threads) {
+	if(threads < 1) {
+		JANUS_LOG(LOG_WARN, "Invalid number of reactor threads (%d), using 1\n", threads);
+		threads = 1;
+	}
+	janus_mutex_lock(&loops_mutex);
+	if(loops != NULL) {
+		janus_mutex_unlock(&loops_mutex);
+		return 0;
+	}
+	loops = g_malloc0(threads * sizeof(janus_reactor_loop));
+	int i = 0;
+	for(i=0; i<threads; i++) {
+		janus_reactor_loop *loop = &loops[loops_num];
+		loop->id = loops_num;
+		loop->mainctx = g_main_context_new();
+		loop->mainloop = g_main_loop_new(loop->mainctx, FALSE);
+		loop->sources = g_hash_table_new(NULL, NULL);
+		GError *error = NULL;
+		char tname[16];
+		g_snprintf(tname, sizeof(tname), "reactor %d", loop->id);
+		loop->thread = g_thread_try_new(tname, &janus_reactor_thread, loop, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch a new reactor thread...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			g_main_loop_unref(loop->mainloop);
+			g_main_context_unref(loop->mainctx);
+			g_hash_table_destroy(loop->sources);
+			memset(loop, 0, sizeof(janus_reactor_loop));
+			continue;
+		}
+		loops_num++;
+	}
+	janus_mutex_unlock(&loops_mutex);
+	if(loops_num == 0) {
+		JANUS_LOG(LOG_FATAL, "Couldn't spawn any reactor thread...\n");
+		return -1;
+	}
+	JANUS_LOG(LOG_INFO, "Spawned %d reactor threads for plain RTP/RTCP sockets\n", loops_num);
+	return 0;
+}
+
+/* Reactor de-initialization */
+void janus_reactor_deinit(void) {
+	/* Detach the watches that are still around from their loops first: whoever
+	 * owns them may unwatch them (or drop the last reference) later on, and
+	 * they must not access the loops we're about to free when that happens */
+	janus_mutex_lock(&loops_mutex);
+	janus_reactor_loop *old_loops = loops;
+	int old_loops_num = loops_num;
+	int i = 0;
+	for(i=0; i<old_loops_num; i++) {
+		janus_reactor_loop *loop = &old_loops[i];
+		GHashTableIter iter;
+		gpointer key;
+		g_hash_table_iter_init(&iter, loop->sources);
+		while(g_hash_table_iter_next(&iter, &key, NULL))
+			((janus_reactor_watch *)key)->loop = NULL;
+		g_hash_table_destroy(loop->sources);
+		loop->sources = NULL;
+	}
+	loops = NULL;
+	loops_num = 0;
+	janus_mutex_unlock(&loops_mutex);
+	/* Now stop the loops: this may finalize watches, so we don't hold the lock */
+	for(i=0; i<old_loops_num; i++) {
+		janus_reactor_loop *loop = &old_loops[i];
+		if(g_main_loop_is_running(loop->mainloop)) {
+			g_main_loop_quit(loop->mainloop);
+			g_main_context_wakeup(loop->mainctx);
+		}
+		g_thread_join(loop->thread);
+		g_main_loop_unref(loop->mainloop);
+		g_main_context_unref(loop->mainctx);
+	}
+	g_free(old_loops);
+}
+
+int janus_reactor_get_threads(void) {
+	return loops_num;
+}
+
+json_t *janus_reactor_info(void) {
+	json_t *list = json_array();
+	janus_mutex_lock(&loops_mutex);
+	int i = 0;
+	for(i=0; i<loops_num; i++) {
+		json_t *info = json_object();
+		json_object_set_new(info, "id", json_integer(loops[i].id));
+		json_object_set_new(info, "fds", json_integer(g_atomic_int_get(&loops[i].watches)));
+		json_array_append_new(list, info);
+	}
+	janus_mutex_unlock(&loops_mutex);
+	return list;
+}
+
+/* Watching file descriptors */
+janus_reactor_watch *janus_reactor_watch_fd(int fd, janus_reactor_callback callback,
+		void *user_data, GDestroyNotify notify) {
+	if(fd < 0 || callback == NULL)
+		return NULL;
+	janus_mutex_lock(&loops_mutex);
+	if(loops_num == 0) {
+		janus_mutex_unlock(&loops_mutex);
+		JANUS_LOG(LOG_ERR, "Reactor not available, can't watch file descriptor %d\n", fd);
+		return NULL;
+	}
+	/* Pick the loop with the fewest file descriptors */
+	janus_reactor_loop *loop = &loops[0];
+	int i = 0;
+	for(i=1; i<loops_num; i++) {
+		if(g_atomic_int_get(&loops[i].watches) < g_atomic_int_get(&loop->watches))
+			loop = &loops[i];
+	}
+	g_atomic_int_inc(&loop->watches);
+	janus_reactor_watch *watch = (janus_reactor_watch *)g_source_new(&janus_reactor_watch_funcs, sizeof(janus_reactor_watch));
+	watch->fd = fd;
+	watch->loop = loop;
+	g_hash_table_insert(loop->sources, watch, watch);
+	watch->callback = callback;
+	watch->user_data = user_data;
+	watch->notify = notify;
+	char name[32];
+	g_snprintf(name, sizeof(name), "reactor fd %d", fd);
+	g_source_set_name((GSource *)watch, name);
+	g_source_set_priority((GSource *)watch, G_PRIORITY_DEFAULT);
+	watch->tag = g_source_add_unix_fd((GSource *)watch, fd, G_IO_IN | G_IO_ERR | G_IO_HUP);
+	g_source_attach((GSource *)watch, loop->mainctx);
+	int id = loop->id;
+	janus_mutex_unlock(&loops_mutex);
+	JANUS_LOG(LOG_HUGE, "[reactor#%d] Watching file descriptor %d\n", id, fd);
+	return watch;
+}
+
+void janus_reactor_unwatch(janus_reactor_watch *watch) {
+	if(watch == NULL)
+		return;
+	janus_mutex_lock(&loops_mutex);
+	int id = watch->loop ? watch->loop->id : -1;
+	janus_mutex_unlock(&loops_mutex);
+	JANUS_LOG(LOG_HUGE, "[reactor#%d] No longer watching file descriptor %d\n", id, watch->fd);
+	/* Destroying a watch whose loop is gone already is harmless */
+	g_source_destroy((GSource *)watch);
+	g_source_unref((GSource *)watch);
+}
@@ -0,0 +1,70 @@
+/*! \file    reactor.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Shared event loops for plain RTP/RTCP sockets (headers)
+ * \details  Implementation of a small pool of event loops, that core and
+ * plugins can use to be notified when data is available on a file
+ * descriptor (e.g., the plain RTP/RTCP sockets of a SIP call), rather
+ * than spawning a thread per session that polls its own sockets. Each
+ * watched file descriptor is assigned to the least loaded loop, and
+ * callbacks are invoked in the thread of that loop until the watch is
+ * removed, or until the callback returns FALSE.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef JANUS_REACTOR_H
+#define JANUS_REACTOR_H
+
+#include <glib.h>
+#include <jansson.h>
+
+
+/*! \brief Opaque reference to a watched file descriptor */
+typedef struct janus_reactor_watch janus_reactor_watch;
+
+/*! \brief Callback invoked when a watched file descriptor is readable
+ * \note The callback is invoked in the thread of the loop the file descriptor
+ * was assigned to, which is shared with other file descriptors: as such, it
+ * should read what's available and return as soon as possible, without blocking
+ * @param[in] fd The file descriptor that triggered the callback
+ * @param[in] error Whether this was triggered by an error (POLLERR/POLLHUP) rather than incoming data
+ * @param[in] user_data The opaque pointer that was passed when adding the watch
+ * @returns TRUE to keep on watching the file descriptor, FALSE to stop (the watch
+ * must still be released with janus_reactor_unwatch) */
+typedef gboolean (*janus_reactor_callback)(int fd, gboolean error, void *user_data);
+
+/*! \brief Reactor initialization
+ * @param[in] threads The number of event loops (and so threads) to spawn
+ * @returns 0 in case of success, a negative integer on errors */
+int janus_reactor_init(int threads);
+/*! \brief Reactor de-initialization */
+void janus_reactor_deinit(void);
+/*! \brief Method to check how many event loops the reactor is using
+ * @returns The number of event loops, or 0 if the reactor is not available */
+int janus_reactor_get_threads(void);
+/*! \brief Helper method to get some info on the reactor loops, for the Admin API
+ * @returns A JSON array with info on each loop */
+json_t *janus_reactor_info(void);
+
+/*! \brief Start watching a file descriptor for incoming data
+ * \note The reactor doesn't take ownership of the file descriptor, which
+ * must not be closed until the watch has been removed; the returned reference
+ * must be released with janus_reactor_unwatch, even if the callback returned FALSE
+ * @param[in] fd The file descriptor to watch
+ * @param[in] callback The function to invoke when the file descriptor is readable
+ * @param[in] user_data An opaque pointer to pass to the callback
+ * @param[in] notify A function to invoke on user_data when the watch is gone, if any
+ * @returns A reference to the watch in case of success, NULL otherwise */
+janus_reactor_watch *janus_reactor_watch_fd(int fd, janus_reactor_callback callback,
+	void *user_data, GDestroyNotify notify);
+/*! \brief Stop watching a file descriptor
+ * \note This can be called from any thread. A callback may still be running
+ * in the loop thread when this returns: the notify function passed when adding
+ * the watch is only invoked when the watch is actually gone, which means that's
+ * where any resource the callback uses should be released
+ * @param[in] watch The watch to remove */
+void janus_reactor_unwatch(janus_reactor_watch *watch);
+
+#endif
@@ -19,6 +19,9 @@
 
 #include <arpa/inet.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <errno.h>
 #include <libgen.h>
 
@@ -35,11 +38,328 @@ static const char *header = "MJR00002";
 /* Frame header in the structured recording */
 static const char *frame_header = "MEET";
 
+/* Index files start with a fixed header (magic[8], size of the recording
+ * the index refers to[8], number of frames[4], reserved[4]), followed by
+ * a fixed size entry per frame (offset[8], time[4], RTP timestamp[4],
+ * length[2], RTP sequence number[2], flags[1], reserved[3]): all values
+ * are in network byte order */
+static const char *index_header = "MJRIDX01";
+#define JANUS_RECORDING_INDEX_HEADER_SIZE	24
+#define JANUS_RECORDING_INDEX_ENTRY_SIZE	24
+#define JANUS_RECORDING_INDEX_KEYFRAME		0x01
+
+/* Recordings currently open for reading, indexed by path */
+static GHashTable *recordings = NULL;
+static janus_mutex recordings_mutex = JANUS_MUTEX_INITIALIZER;
+
 /* Whether the filenames should have a temporary extension, while saving, or not (default=false) */
 static gboolean rec_tempname = FALSE;
 /* Extension to add in case tempnames is true (default="tmp" --> ".tmp") */
 static char *rec_tempext = NULL;
 
+/* Asynchronous writing: frames are copied to single producer (the thread
+ * saving frames) and single consumer (the writer thread) ring buffers,
+ * which the writer threads flush in blocks, or completely on a timer */
+#define JANUS_RECORDER_RING_MIN_SIZE	16384
+#define JANUS_RECORDER_BLOCK_SIZE		65536
+#define JANUS_RECORDER_FLUSH_INTERVAL	(G_USEC_PER_SEC/2)
+struct janus_recorder_ring {
+	guint8 *data;
+	/* Always a power of 2, so that offsets can wrap around */
+	gsize size;
+	/* Only updated by the producer (head) and by the consumer (tail) */
+	volatile gsize head, tail;
+};
+struct janus_recorder_writer {
+	GThread *thread;
+	int id;
+	GList *recorders;
+	janus_mutex mutex;
+	janus_condition cond;
+	volatile gint wake;
+};
+static janus_recorder_writer *rec_writers = NULL;
+static int rec_writers_num = 0;
+static volatile gint rec_writers_next = 0, rec_writers_stopping = 0;
+static gsize rec_ring_size = 0;
+static int rec_fsync_interval = -1;
+static volatile gint rec_overflows = 0;
+/* Memory budget: we keep track of how much is queued in all the ring buffers,
+ * and of how much has been written (to compute the throughput every second) */
+static gsize rec_memory_budget = 0;
+static volatile gsize rec_queued = 0, rec_written = 0, rec_throughput = 0;
+static volatile gint rec_degraded_frames = 0;
+/* Recorders written asynchronously (for the Admin API) */
+static GList *rec_async = NULL;
+static janus_mutex rec_async_mutex = JANUS_MUTEX_INITIALIZER;
+
+static janus_recorder_ring *janus_recorder_ring_create(gsize size) {
+	janus_recorder_ring *ring = g_malloc0(sizeof(janus_recorder_ring));
+	ring->size = JANUS_RECORDER_RING_MIN_SIZE;
+	while(ring->size < size)
+		ring->size <<= 1;
+	ring->data = g_malloc(ring->size);
+	return ring;
+}
+
+static void janus_recorder_ring_destroy(janus_recorder_ring *ring) {
+	if(ring == NULL)
+		return;
+	g_free(ring->data);
+	g_free(ring);
+}
+
+static gsize janus_recorder_ring_used(janus_recorder_ring *ring) {
+	return (gsize)g_atomic_pointer_get(&ring->head) - (gsize)g_atomic_pointer_get(&ring->tail);
+}
+
+/* Producer side: data is copied after the current head, and only becomes
+ * visible to the writer thread when the head is moved with a commit */
+static void janus_recorder_ring_copy(janus_recorder_ring *ring, gsize offset, const void *data, gsize len) {
+	gsize pos = (ring->head + offset) & (ring->size - 1);
+	gsize first = MIN(len, ring->size - pos);
+	memcpy(ring->data + pos, data, first);
+	if(first < len)
+		memcpy(ring->data, (const guint8 *)data + first, len - first);
+}
+
+static void janus_recorder_ring_commit(janus_recorder_ring *ring, gsize len) {
+	g_atomic_pointer_set(&ring->head, ring->head + len);
+	g_atomic_pointer_add(&rec_queued, len);
+}
+
+/* Consumer side: the oldest len bytes are gone, written or not */
+static void janus_recorder_ring_consume(janus_recorder_ring *ring, gsize len) {
+	g_atomic_pointer_set(&ring->tail, ring->tail + len);
+	g_atomic_pointer_add(&rec_queued, -(gssize)len);
+}
+
+/* Consumer side: write the oldest len bytes to the file; in case of errors
+ * the data is dropped anyway, as we can't keep the producer waiting */
+static int janus_recorder_ring_write(janus_recorder_ring *ring, int fd, gsize len) {
+	gsize tail = ring->tail, done = 0;
+	while(done < len) {
+		gsize pos = (tail + done) & (ring->size - 1);
+		ssize_t res = write(fd, ring->data + pos, MIN(len - done, ring->size - pos));
+		if(res < 0 && errno == EINTR)
+			continue;
+		if(res <= 0)
+			break;
+		done += res;
+	}
+	janus_recorder_ring_consume(ring, len);
+	g_atomic_pointer_add(&rec_written, done);
+	return done == len ? 0 : -1;
+}
+
+/* Flush what the recorder queued so far: if all is FALSE, we only write
+ * complete blocks, and leave the rest for later */
+static void janus_recorder_async_flush(janus_recorder *recorder, gboolean all) {
+	gsize block = MIN(JANUS_RECORDER_BLOCK_SIZE, recorder->ring->size/4);
+	gsize used = janus_recorder_ring_used(recorder->ring);
+	if(!all)
+		used -= used % block;
+	if(used > 0 && janus_recorder_ring_write(recorder->ring, fileno(recorder->file), used) < 0 &&
+			g_atomic_int_compare_and_exchange(&recorder->write_failed, 0, 1)) {
+		JANUS_LOG(LOG_ERR, "Error saving frames to %s (%s), expect issues post-processing\n",
+			recorder->filename, g_strerror(errno));
+	}
+	used = janus_recorder_ring_used(recorder->index_ring);
+	if(!all)
+		used -= used % MIN(block, recorder->index_ring->size/4);
+	if(used > 0 && recorder->index != NULL && !g_atomic_int_get(&recorder->index_failed) &&
+			janus_recorder_ring_write(recorder->index_ring, fileno(recorder->index), used) < 0) {
+		JANUS_LOG(LOG_WARN, "Couldn't write to index (%s), playback will have to index the recording\n",
+			g_strerror(errno));
+		g_atomic_int_set(&recorder->index_failed, 1);
+	} else if(used > 0 && (recorder->index == NULL || g_atomic_int_get(&recorder->index_failed))) {
+		/* Nowhere to write this to */
+		janus_recorder_ring_consume(recorder->index_ring, used);
+	}
+	recorder->flushed = janus_get_monotonic_time();
+}
+
+static void janus_recorder_sync(janus_recorder *recorder) {
+	if(recorder->file != NULL && fsync(fileno(recorder->file)) < 0)
+		JANUS_LOG(LOG_WARN, "Couldn't sync %s to storage (%s)\n", recorder->filename, g_strerror(errno));
+	if(recorder->index != NULL)
+		fsync(fileno(recorder->index));
+	recorder->synced = janus_get_monotonic_time();
+}
+
+static void *janus_recorder_writer_thread(void *data) {
+	janus_recorder_writer *writer = (janus_recorder_writer *)data;
+	JANUS_LOG(LOG_VERB, "Joining recorder writer thread #%d\n", writer->id);
+	gint64 now = 0, flushed = janus_get_monotonic_time(), sampled = flushed;
+	gsize written = (gsize)g_atomic_pointer_get(&rec_written);
+	GList *l = NULL;
+	janus_mutex_lock(&writer->mutex);
+	while(!g_atomic_int_get(&rec_writers_stopping)) {
+		/* Recorders only wake us up when they have complete blocks to write,
+		 * otherwise we check what they have queued on a regular basis */
+		if(!g_atomic_int_get(&writer->wake)) {
+			gint64 deadline = janus_get_real_time() + JANUS_RECORDER_FLUSH_INTERVAL/5;
+			janus_condition_wait_until(&writer->cond, &writer->mutex, deadline);
+		}
+		g_atomic_int_set(&writer->wake, 0);
+		now = janus_get_monotonic_time();
+		gboolean all = (now - flushed >= JANUS_RECORDER_FLUSH_INTERVAL);
+		if(all)
+			flushed = now;
+		for(l = writer->recorders; l != NULL; l = l->next) {
+			janus_recorder *recorder = (janus_recorder *)l->data;
+			janus_recorder_async_flush(recorder, all);
+			if(all && rec_fsync_interval > 0 && now - recorder->synced >= rec_fsync_interval*G_USEC_PER_SEC)
+				janus_recorder_sync(recorder);
+		}
+		if(writer->id == 1 && now - sampled >= G_USEC_PER_SEC) {
+			/* The first writer thread keeps track of the overall throughput */
+			gsize total = (gsize)g_atomic_pointer_get(&rec_written);
+			g_atomic_pointer_set(&rec_throughput, (gsize)((total - written) * G_USEC_PER_SEC / (now - sampled)));
+			written = total;
+			sampled = now;
+		}
+	}
+	janus_mutex_unlock(&writer->mutex);
+	JANUS_LOG(LOG_VERB, "Leaving recorder writer thread #%d\n", writer->id);
+	return NULL;
+}
+
+/* Writer threads don't need a reference to the recorders they serve, as
+ * recorders are always detached when they're closed, before being freed */
+static void janus_recorder_async_attach(janus_recorder *recorder) {
+	if(rec_writers == NULL)
+		return;
+	/* When rotating segments, we reuse the ring buffers we already have */
+	if(recorder->ring == NULL)
+		recorder->ring = janus_recorder_ring_create(rec_ring_size);
+	if(recorder->index_ring == NULL)
+		recorder->index_ring = janus_recorder_ring_create(rec_ring_size/8);
+	recorder->synced = janus_get_monotonic_time();
+	recorder->flushed = recorder->synced;
+	janus_mutex_lock(&rec_async_mutex);
+	rec_async = g_list_prepend(rec_async, recorder);
+	janus_mutex_unlock(&rec_async_mutex);
+	janus_recorder_writer *writer = &rec_writers[(guint)g_atomic_int_add(&rec_writers_next, 1) % rec_writers_num];
+	janus_mutex_lock(&writer->mutex);
+	writer->recorders = g_list_prepend(writer->recorders, recorder);
+	janus_mutex_unlock(&writer->mutex);
+	recorder->writer = writer;
+}
+
+static void janus_recorder_async_detach(janus_recorder *recorder) {
+	if(recorder->ring == NULL)
+		return;
+	janus_mutex_lock(&rec_async_mutex);
+	rec_async = g_list_remove(rec_async, recorder);
+	janus_mutex_unlock(&rec_async_mutex);
+	janus_recorder_writer *writer = recorder->writer;
+	if(writer != NULL) {
+		janus_mutex_lock(&writer->mutex);
+		writer->recorders = g_list_remove(writer->recorders, recorder);
+		janus_mutex_unlock(&writer->mutex);
+		recorder->writer = NULL;
+	}
+	/* Now that no writer thread is serving it anymore, write what's left */
+	janus_recorder_async_flush(recorder, TRUE);
+}
+
+int janus_recorder_async_init(int writers, size_t buffer_size, int fsync_interval) {
+	rec_fsync_interval = fsync_interval;
+	if(writers <= 0 || rec_writers != NULL)
+		return 0;
+	rec_ring_size = MAX(buffer_size, JANUS_RECORDER_RING_MIN_SIZE);
+	rec_writers = g_malloc0(writers * sizeof(janus_recorder_writer));
+	g_atomic_int_set(&rec_writers_stopping, 0);
+	int i = 0;
+	char tname[16];
+	GError *error = NULL;
+	for(i=0; i<writers; i++) {
+		janus_recorder_writer *writer = &rec_writers[i];
+		writer->id = i+1;
+		janus_mutex_init(&writer->mutex);
+		janus_condition_init(&writer->cond);
+		g_snprintf(tname, sizeof(tname), "rec writer %d", writer->id);
+		writer->thread = g_thread_try_new(tname, janus_recorder_writer_thread, writer, &error);
+		if(error != NULL) {
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the recorder writer thread...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			break;
+		}
+	}
+	rec_writers_num = i;
+	if(rec_writers_num == 0) {
+		g_free(rec_writers);
+		rec_writers = NULL;
+		return -1;
+	}
+	JANUS_LOG(LOG_INFO, "  -- Writing recordings asynchronously (%d threads, %zu bytes per recorder)\n",
+		rec_writers_num, rec_ring_size);
+	return 0;
+}
+
+guint janus_recorder_async_overflows(void) {
+	return (guint)g_atomic_int_get(&rec_overflows);
+}
+
+void janus_recorder_async_budget(size_t budget) {
+	rec_memory_budget = budget;
+	if(budget > 0 && rec_writers != NULL)
+		JANUS_LOG(LOG_INFO, "  -- Recordings memory budget: %zu bytes\n", budget);
+}
+
+guint janus_recorder_async_degraded(void) {
+	return (guint)g_atomic_int_get(&rec_degraded_frames);
+}
+
+size_t janus_recorder_async_queued(void) {
+	return (gsize)g_atomic_pointer_get(&rec_queued);
+}
+
+guint64 janus_recorder_async_written(void) {
+	return (gsize)g_atomic_pointer_get(&rec_written);
+}
+
+json_t *janus_recorder_async_info(void) {
+	json_t *info = json_object();
+	json_object_set_new(info, "writers", json_integer(rec_writers_num));
+	if(rec_writers == NULL)
+		return info;
+	json_object_set_new(info, "buffer-size", json_integer(rec_ring_size));
+	if(rec_memory_budget > 0)
+		json_object_set_new(info, "budget", json_integer(rec_memory_budget));
+	json_object_set_new(info, "queued", json_integer((gsize)g_atomic_pointer_get(&rec_queued)));
+	json_object_set_new(info, "written", json_integer((gsize)g_atomic_pointer_get(&rec_written)));
+	json_object_set_new(info, "throughput", json_integer((gsize)g_atomic_pointer_get(&rec_throughput)));
+	json_object_set_new(info, "overflows", json_integer(g_atomic_int_get(&rec_overflows)));
+	json_object_set_new(info, "degraded-frames", json_integer(g_atomic_int_get(&rec_degraded_frames)));
+	json_t *list = json_array();
+	gint64 now = janus_get_monotonic_time();
+	janus_mutex_lock(&rec_async_mutex);
+	GList *l = NULL;
+	for(l = rec_async; l != NULL; l = l->next) {
+		janus_recorder *recorder = (janus_recorder *)l->data;
+		json_t *rc = json_object();
+		json_object_set_new(rc, "filename", json_string(recorder->filename));
+		json_object_set_new(rc, "type", json_string(recorder->type == JANUS_RECORDER_AUDIO ? "audio" :
+			(recorder->type == JANUS_RECORDER_VIDEO ? "video" : "data")));
+		gsize queued = janus_recorder_ring_used(recorder->ring);
+		json_object_set_new(rc, "queued", json_integer(queued));
+		/* How long the oldest data in the buffer may have been waiting */
+		json_object_set_new(rc, "lag", json_integer(queued > 0 ? (now - recorder->flushed)/1000 : 0));
+		json_object_set_new(rc, "overflows", json_integer(g_atomic_int_get(&recorder->overflows)));
+		if(recorder->type == JANUS_RECORDER_VIDEO) {
+			json_object_set_new(rc, "degraded", recorder->degraded ? json_true() : json_false());
+			json_object_set_new(rc, "degraded-frames", json_integer(g_atomic_int_get(&recorder->degraded_frames)));
+		}
+		json_array_append_new(list, rc);
+	}
+	janus_mutex_unlock(&rec_async_mutex);
+	json_object_set_new(info, "recorders", list);
+	return info;
+}
+
 void janus_recorder_init(gboolean tempnames, const char *extension) {
 	JANUS_LOG(LOG_INFO, "Initializing recorder code\n");
 	if(tempnames) {
@@ -57,6 +377,628 @@ void janus_recorder_init(gboolean tempnames, const char *extension) {
 void janus_recorder_deinit(void) {
 	rec_tempname = FALSE;
 	g_free(rec_tempext);
+	rec_tempext = NULL;
+	if(rec_writers != NULL) {
+		g_atomic_int_set(&rec_writers_stopping, 1);
+		int i = 0;
+		for(i=0; i<rec_writers_num; i++) {
+			janus_recorder_writer *writer = &rec_writers[i];
+			janus_mutex_lock(&writer->mutex);
+			janus_condition_signal(&writer->cond);
+			janus_mutex_unlock(&writer->mutex);
+			g_thread_join(writer->thread);
+			/* Recorders still open will write what's left when closed */
+			GList *l = NULL;
+			for(l = writer->recorders; l != NULL; l = l->next) {
+				janus_recorder *recorder = (janus_recorder *)l->data;
+				janus_recorder_async_flush(recorder, TRUE);
+				recorder->writer = NULL;
+			}
+			g_list_free(writer->recorders);
+			janus_condition_destroy(&writer->cond);
+			janus_mutex_destroy(&writer->mutex);
+		}
+		g_free(rec_writers);
+		rec_writers = NULL;
+		rec_writers_num = 0;
+	}
+	janus_mutex_lock(&recordings_mutex);
+	if(recordings != NULL)
+		g_hash_table_destroy(recordings);
+	recordings = NULL;
+	janus_mutex_unlock(&recordings_mutex);
+}
+
+/* Index serialization helpers */
+static void janus_recording_index_pack_header(guint8 *buf, guint64 size, guint32 count) {
+	memcpy(buf, index_header, strlen(index_header));
+	guint64 s = htonll(size);
+	memcpy(buf+8, &s, sizeof(s));
+	guint32 c = htonl(count);
+	memcpy(buf+16, &c, sizeof(c));
+	memset(buf+20, 0, 4);
+}
+
+static void janus_recording_index_pack_entry(guint8 *buf, janus_recording_frame *frame) {
+	guint64 offset = htonll(frame->offset);
+	memcpy(buf, &offset, sizeof(offset));
+	guint32 time = htonl(frame->time);
+	memcpy(buf+8, &time, sizeof(time));
+	guint32 timestamp = htonl(frame->timestamp);
+	memcpy(buf+12, &timestamp, sizeof(timestamp));
+	guint16 length = htons(frame->length);
+	memcpy(buf+16, &length, sizeof(length));
+	guint16 seq = htons(frame->seq);
+	memcpy(buf+18, &seq, sizeof(seq));
+	buf[20] = frame->keyframe ? JANUS_RECORDING_INDEX_KEYFRAME : 0;
+	memset(buf+21, 0, 3);
+}
+
+static void janus_recording_index_parse_entry(const guint8 *buf, janus_recording_frame *frame) {
+	guint64 offset = 0;
+	memcpy(&offset, buf, sizeof(offset));
+	frame->offset = ntohll(offset);
+	guint32 time = 0;
+	memcpy(&time, buf+8, sizeof(time));
+	frame->time = ntohl(time);
+	guint32 timestamp = 0;
+	memcpy(&timestamp, buf+12, sizeof(timestamp));
+	frame->timestamp = ntohl(timestamp);
+	guint16 length = 0;
+	memcpy(&length, buf+16, sizeof(length));
+	frame->length = ntohs(length);
+	guint16 seq = 0;
+	memcpy(&seq, buf+18, sizeof(seq));
+	frame->seq = ntohs(seq);
+	frame->keyframe = (buf[20] & JANUS_RECORDING_INDEX_KEYFRAME) != 0;
+}
+
+static gboolean janus_recording_is_keyframe(const char *codec, char *buffer, int length) {
+	if(codec == NULL)
+		return FALSE;
+	int plen = 0;
+	char *payload = janus_rtp_payload(buffer, length, &plen);
+	if(payload == NULL || plen < 1)
+		return FALSE;
+	if(!strcasecmp(codec, "vp8"))
+		return janus_vp8_is_keyframe(payload, plen);
+	else if(!strcasecmp(codec, "vp9"))
+		return janus_vp9_is_keyframe(payload, plen);
+	else if(!strcasecmp(codec, "h264"))
+		return janus_h264_is_keyframe(payload, plen);
+	else if(!strcasecmp(codec, "av1"))
+		return janus_av1_is_keyframe(payload, plen);
+	else if(!strcasecmp(codec, "h265"))
+		return janus_h265_is_keyframe(payload, plen);
+	return FALSE;
+}
+
+static void janus_recorder_path(janus_recorder *recorder, const char *name, char *path, size_t size) {
+	if(recorder->dir)
+		g_snprintf(path, size, "%s/%s", recorder->dir, name);
+	else
+		g_snprintf(path, size, "%s", name);
+}
+
+/* If writing the index fails, we get rid of it: the recording will be indexed when played */
+static void janus_recorder_index_drop(janus_recorder *recorder) {
+	if(recorder->index == NULL)
+		return;
+	fclose(recorder->index);
+	recorder->index = NULL;
+	char path[1024];
+	janus_recorder_path(recorder, recorder->index_filename, path, sizeof(path));
+	if(unlink(path) != 0)
+		JANUS_LOG(LOG_WARN, "Couldn't remove index %s: %s\n", path, g_strerror(errno));
+}
+
+/* Live WebM recordings: Opus, VP8 and VP9 frames are depacketized as they
+ * are saved, and written to a WebM file next to the .mjr one. The segment
+ * and the clusters use unknown sizes, as live WebM streams do, so that the
+ * file is always playable, even while it's still being written */
+#define JANUS_WEBM_EBML				0x1A45DFA3
+#define JANUS_WEBM_EBML_VERSION		0x4286
+#define JANUS_WEBM_EBML_READVERSION	0x42F7
+#define JANUS_WEBM_EBML_MAXIDLENGTH	0x42F2
+#define JANUS_WEBM_EBML_MAXSIZELENGTH	0x42F3
+#define JANUS_WEBM_DOCTYPE			0x4282
+#define JANUS_WEBM_DOCTYPE_VERSION	0x4287
+#define JANUS_WEBM_DOCTYPE_READVERSION	0x4285
+#define JANUS_WEBM_SEGMENT			0x18538067
+#define JANUS_WEBM_INFO				0x1549A966
+#define JANUS_WEBM_TIMECODESCALE	0x2AD7B1
+#define JANUS_WEBM_MUXINGAPP		0x4D80
+#define JANUS_WEBM_WRITINGAPP		0x5741
+#define JANUS_WEBM_TRACKS			0x1654AE6B
+#define JANUS_WEBM_TRACKENTRY		0xAE
+#define JANUS_WEBM_TRACKNUMBER		0xD7
+#define JANUS_WEBM_TRACKUID			0x73C5
+#define JANUS_WEBM_TRACKTYPE		0x83
+#define JANUS_WEBM_CODECID			0x86
+#define JANUS_WEBM_CODECPRIVATE		0x63A2
+#define JANUS_WEBM_VIDEO			0xE0
+#define JANUS_WEBM_PIXELWIDTH		0xB0
+#define JANUS_WEBM_PIXELHEIGHT		0xBA
+#define JANUS_WEBM_AUDIO			0xE1
+#define JANUS_WEBM_SAMPLINGFREQUENCY	0xB5
+#define JANUS_WEBM_CHANNELS			0x9F
+#define JANUS_WEBM_CLUSTER			0x1F43B675
+#define JANUS_WEBM_TIMECODE			0xE7
+#define JANUS_WEBM_SIMPLEBLOCK		0xA3
+#define JANUS_WEBM_UNKNOWN_SIZE		G_GUINT64_CONSTANT(0x00FFFFFFFFFFFFFF)
+/* Audio clusters are split on a regular basis, video ones on keyframes */
+#define JANUS_WEBM_AUDIO_CLUSTER	5000
+#define JANUS_WEBM_MAX_CLUSTER		30000
+#define JANUS_WEBM_MAX_LAYERS		8
+typedef enum janus_recorder_webm_codec {
+	JANUS_RECORDER_WEBM_OPUS,
+	JANUS_RECORDER_WEBM_VP8,
+	JANUS_RECORDER_WEBM_VP9
+} janus_recorder_webm_codec;
+struct janus_recorder_webm {
+	FILE *file;
+	char *filename;
+	janus_recorder_webm_codec codec;
+	/* Elements are serialized here before being written */
+	GByteArray *buffer;
+	/* Video frame we're reassembling, and where each VP9 layer starts */
+	GByteArray *frame;
+	guint32 frame_ts;
+	gboolean frame_started, frame_keyframe;
+	guint layers[JANUS_WEBM_MAX_LAYERS];
+	int num_layers;
+	/* Whether the WebM header has been written already (for video we wait for a keyframe) */
+	gboolean header;
+	int width, height;
+	/* Timing, in milliseconds since the first frame */
+	gboolean ts_started;
+	guint32 last_ts;
+	gint64 ext_ts, cluster;
+};
+
+static gboolean janus_recorder_webm_supported(const char *codec) {
+	return codec && (!strcasecmp(codec, "opus") || !strcasecmp(codec, "vp8") || !strcasecmp(codec, "vp9"));
+}
+
+/* EBML serialization helpers: sizes are always 8 bytes, which makes them easy to patch */
+static void janus_webm_id(GByteArray *b, guint32 id) {
+	guint8 bytes[4];
+	int n = id > 0xFFFFFF ? 4 : (id > 0xFFFF ? 3 : (id > 0xFF ? 2 : 1)), i = 0;
+	for(i=0; i<n; i++)
+		bytes[i] = (id >> (8*(n-1-i))) & 0xFF;
+	g_byte_array_append(b, bytes, n);
+}
+
+static void janus_webm_size(GByteArray *b, guint64 size) {
+	guint8 bytes[8];
+	bytes[0] = 0x01;
+	int i = 0;
+	for(i=1; i<8; i++)
+		bytes[i] = (size >> (8*(7-i))) & 0xFF;
+	g_byte_array_append(b, bytes, sizeof(bytes));
+}
+
+static void janus_webm_binary(GByteArray *b, guint32 id, const void *data, size_t len) {
+	janus_webm_id(b, id);
+	janus_webm_size(b, len);
+	g_byte_array_append(b, (const guint8 *)data, len);
+}
+
+static void janus_webm_string(GByteArray *b, guint32 id, const char *value) {
+	janus_webm_binary(b, id, value, strlen(value));
+}
+
+static void janus_webm_uint(GByteArray *b, guint32 id, guint64 value) {
+	guint8 bytes[8];
+	int n = 1, i = 0;
+	while(n < 8 && (value >> (8*n)) != 0)
+		n++;
+	for(i=0; i<n; i++)
+		bytes[i] = (value >> (8*(n-1-i))) & 0xFF;
+	janus_webm_binary(b, id, bytes, n);
+}
+
+static void janus_webm_float(GByteArray *b, guint32 id, double value) {
+	union { double d; guint64 u; } v = { .d = value };
+	guint64 be = htonll(v.u);
+	janus_webm_binary(b, id, &be, sizeof(be));
+}
+
+static guint janus_webm_master_start(GByteArray *b, guint32 id) {
+	janus_webm_id(b, id);
+	guint offset = b->len;
+	janus_webm_size(b, 0);
+	return offset;
+}
+
+static void janus_webm_master_end(GByteArray *b, guint offset) {
+	guint64 size = b->len - offset - 8;
+	int i = 0;
+	for(i=1; i<8; i++)
+		b->data[offset+i] = (size >> (8*(7-i))) & 0xFF;
+}
+
+static janus_recorder_webm *janus_recorder_webm_create(janus_recorder *recorder) {
+	char base[1024], name[1024], path[1024];
+	if(recorder->segment == 0)
+		g_snprintf(base, sizeof(base), "%s", recorder->basename);
+	else
+		g_snprintf(base, sizeof(base), "%s-%u", recorder->basename, recorder->segment);
+	if(!rec_tempname)
+		g_snprintf(name, sizeof(name), "%s.webm", base);
+	else
+		g_snprintf(name, sizeof(name), "%s.webm.%s", base, rec_tempext);
+	janus_recorder_path(recorder, name, path, sizeof(path));
+	FILE *file = fopen(path, "wb");
+	if(file == NULL) {
+		JANUS_LOG(LOG_ERR, "Couldn't create live WebM recording %s (%s)\n", path, g_strerror(errno));
+		return NULL;
+	}
+	janus_recorder_webm *webm = g_malloc0(sizeof(janus_recorder_webm));
+	webm->file = file;
+	webm->filename = g_strdup(name);
+	if(!strcasecmp(recorder->codec, "vp8"))
+		webm->codec = JANUS_RECORDER_WEBM_VP8;
+	else if(!strcasecmp(recorder->codec, "vp9"))
+		webm->codec = JANUS_RECORDER_WEBM_VP9;
+	else
+		webm->codec = JANUS_RECORDER_WEBM_OPUS;
+	webm->buffer = g_byte_array_new();
+	webm->frame = g_byte_array_new();
+	/* Until we know better (e.g., from a VP8 keyframe or the VP9 scalability structure) */
+	webm->width = 640;
+	webm->height = 480;
+	webm->cluster = -1;
+	return webm;
+}
+
+static void janus_recorder_webm_header(janus_recorder_webm *webm) {
+	GByteArray *b = webm->buffer;
+	guint ebml = janus_webm_master_start(b, JANUS_WEBM_EBML);
+	janus_webm_uint(b, JANUS_WEBM_EBML_VERSION, 1);
+	janus_webm_uint(b, JANUS_WEBM_EBML_READVERSION, 1);
+	janus_webm_uint(b, JANUS_WEBM_EBML_MAXIDLENGTH, 4);
+	janus_webm_uint(b, JANUS_WEBM_EBML_MAXSIZELENGTH, 8);
+	janus_webm_string(b, JANUS_WEBM_DOCTYPE, "webm");
+	janus_webm_uint(b, JANUS_WEBM_DOCTYPE_VERSION, 4);
+	janus_webm_uint(b, JANUS_WEBM_DOCTYPE_READVERSION, 2);
+	janus_webm_master_end(b, ebml);
+	janus_webm_id(b, JANUS_WEBM_SEGMENT);
+	janus_webm_size(b, JANUS_WEBM_UNKNOWN_SIZE);
+	guint info = janus_webm_master_start(b, JANUS_WEBM_INFO);
+	janus_webm_uint(b, JANUS_WEBM_TIMECODESCALE, 1000000);
+	janus_webm_string(b, JANUS_WEBM_MUXINGAPP, "Janus");
+	janus_webm_string(b, JANUS_WEBM_WRITINGAPP, "Janus");
+	janus_webm_master_end(b, info);
+	guint tracks = janus_webm_master_start(b, JANUS_WEBM_TRACKS);
+	guint entry = janus_webm_master_start(b, JANUS_WEBM_TRACKENTRY);
+	janus_webm_uint(b, JANUS_WEBM_TRACKNUMBER, 1);
+	janus_webm_uint(b, JANUS_WEBM_TRACKUID, 1);
+	if(webm->codec == JANUS_RECORDER_WEBM_OPUS) {
+		janus_webm_uint(b, JANUS_WEBM_TRACKTYPE, 2);
+		janus_webm_string(b, JANUS_WEBM_CODECID, "A_OPUS");
+		/* OpusHead: magic[8], version[1], channels[1], pre-skip[2],
+		 * sample rate[4], gain[2], mapping family[1], little endian */
+		guint8 head[19] = { 'O', 'p', 'u', 's', 'H', 'e', 'a', 'd', 1, 2, 0, 0, 0x80, 0xBB, 0, 0, 0, 0, 0 };
+		janus_webm_binary(b, JANUS_WEBM_CODECPRIVATE, head, sizeof(head));
+		guint audio = janus_webm_master_start(b, JANUS_WEBM_AUDIO);
+		janus_webm_float(b, JANUS_WEBM_SAMPLINGFREQUENCY, 48000.0);
+		janus_webm_uint(b, JANUS_WEBM_CHANNELS, 2);
+		janus_webm_master_end(b, audio);
+	} else {
+		janus_webm_uint(b, JANUS_WEBM_TRACKTYPE, 1);
+		janus_webm_string(b, JANUS_WEBM_CODECID, webm->codec == JANUS_RECORDER_WEBM_VP8 ? "V_VP8" : "V_VP9");
+		guint video = janus_webm_master_start(b, JANUS_WEBM_VIDEO);
+		janus_webm_uint(b, JANUS_WEBM_PIXELWIDTH, webm->width);
+		janus_webm_uint(b, JANUS_WEBM_PIXELHEIGHT, webm->height);
+		janus_webm_master_end(b, video);
+	}
+	janus_webm_master_end(b, entry);
+	janus_webm_master_end(b, tracks);
+}
+
+/* Convert an RTP timestamp to milliseconds since the first frame */
+static gint64 janus_recorder_webm_time(janus_recorder_webm *webm, guint32 ts) {
+	if(!webm->ts_started) {
+		webm->ts_started = TRUE;
+		webm->last_ts = ts;
+	}
+	webm->ext_ts += (gint32)(ts - webm->last_ts);
+	webm->last_ts = ts;
+	gint64 when = webm->ext_ts / (webm->codec == JANUS_RECORDER_WEBM_OPUS ? 48 : 90);
+	return when > 0 ? when : 0;
+}
+
+static void janus_recorder_webm_write_frame(janus_recorder_webm *webm, const guint8 *data, size_t len, guint32 ts, gboolean keyframe) {
+	gboolean video = (webm->codec != JANUS_RECORDER_WEBM_OPUS);
+	/* Video can only start with a keyframe */
+	if(!webm->header && video && !keyframe)
+		return;
+	gint64 when = janus_recorder_webm_time(webm, ts);
+	g_byte_array_set_size(webm->buffer, 0);
+	if(!webm->header) {
+		janus_recorder_webm_header(webm);
+		webm->header = TRUE;
+	}
+	if(when < webm->cluster)
+		when = webm->cluster;
+	if(webm->cluster < 0 || (video && keyframe) || when - webm->cluster >= JANUS_WEBM_MAX_CLUSTER ||
+			(!video && when - webm->cluster >= JANUS_WEBM_AUDIO_CLUSTER)) {
+		/* Start a new cluster */
+		janus_webm_id(webm->buffer, JANUS_WEBM_CLUSTER);
+		janus_webm_size(webm->buffer, JANUS_WEBM_UNKNOWN_SIZE);
+		janus_webm_uint(webm->buffer, JANUS_WEBM_TIMECODE, when);
+		webm->cluster = when;
+	}
+	/* SimpleBlock: track number, timecode relative to the cluster, flags */
+	gint16 relative = (gint16)(when - webm->cluster);
+	guint8 block[4] = { 0x81, ((guint16)relative >> 8) & 0xFF, (guint16)relative & 0xFF, keyframe ? 0x80 : 0x00 };
+	janus_webm_id(webm->buffer, JANUS_WEBM_SIMPLEBLOCK);
+	janus_webm_size(webm->buffer, sizeof(block) + len);
+	g_byte_array_append(webm->buffer, block, sizeof(block));
+	g_byte_array_append(webm->buffer, data, len);
+	if(fwrite(webm->buffer->data, 1, webm->buffer->len, webm->file) != webm->buffer->len) {
+		JANUS_LOG(LOG_WARN, "Couldn't write to live WebM recording %s (%s)\n",
+			webm->filename, g_strerror(errno));
+	}
+}
+
+/* Write the video frame we reassembled so far, if any */
+static void janus_recorder_webm_flush(janus_recorder_webm *webm) {
+	if(webm->frame_started && webm->frame->len > 0) {
+		if(webm->num_layers > 1) {
+			/* Spatial layers of the same VP9 picture need a superframe index */
+			guint32 sizes[JANUS_WEBM_MAX_LAYERS], max = 0;
+			int i = 0, j = 0, mag = 1;
+			for(i=0; i<webm->num_layers; i++) {
+				guint end = (i < webm->num_layers-1) ? webm->layers[i+1] : webm->frame->len;
+				sizes[i] = end - webm->layers[i];
+				max = MAX(max, sizes[i]);
+			}
+			while(mag < 4 && (max >> (8*mag)) != 0)
+				mag++;
+			guint8 marker = 0xC0 | ((mag-1) << 3) | (webm->num_layers-1);
+			g_byte_array_append(webm->frame, &marker, 1);
+			for(i=0; i<webm->num_layers; i++) {
+				for(j=0; j<mag; j++) {
+					guint8 byte = (sizes[i] >> (8*j)) & 0xFF;
+					g_byte_array_append(webm->frame, &byte, 1);
+				}
+			}
+			g_byte_array_append(webm->frame, &marker, 1);
+		}
+		janus_recorder_webm_write_frame(webm, webm->frame->data, webm->frame->len, webm->frame_ts, webm->frame_keyframe);
+	}
+	g_byte_array_set_size(webm->frame, 0);
+	webm->frame_started = FALSE;
+	webm->frame_keyframe = FALSE;
+	webm->num_layers = 0;
+}
+
+/* Depacketize an RTP packet (with its header already rewritten by the recorder) */
+static void janus_recorder_webm_save(janus_recorder_webm *webm, char *buffer, int length) {
+	janus_rtp_header *rtp = (janus_rtp_header *)buffer;
+	int plen = 0;
+	char *payload = janus_rtp_payload(buffer, length, &plen);
+	if(payload == NULL || plen < 1)
+		return;
+	guint32 ts = ntohl(rtp->timestamp);
+	if(webm->codec == JANUS_RECORDER_WEBM_OPUS) {
+		janus_recorder_webm_write_frame(webm, (guint8 *)payload, plen, ts, TRUE);
+		return;
+	}
+	/* A different timestamp means a new frame, even if we missed the marker of the previous one */
+	if(webm->frame->len > 0 && ts != webm->frame_ts)
+		janus_recorder_webm_flush(webm);
+	guint8 *p = (guint8 *)payload;
+	int skip = 1;
+	gboolean start = FALSE;
+	if(webm->codec == JANUS_RECORDER_WEBM_VP8) {
+		/* VP8 payload descriptor */
+		if(p[0] & 0x80) {
+			if(plen < 2)
+				return;
+			guint8 x = p[1];
+			skip = 2;
+			if(x & 0x80)
+				skip += (plen > skip && (p[skip] & 0x80)) ? 2 : 1;
+			if(x & 0x40)
+				skip++;
+			if(x & 0x30)
+				skip++;
+		}
+		if(skip >= plen)
+			return;
+		start = (p[0] & 0x10) && (p[0] & 0x0F) == 0;
+		if(start) {
+			janus_recorder_webm_flush(webm);
+			webm->frame_keyframe = janus_vp8_is_keyframe(payload, plen);
+			if(webm->frame_keyframe && plen - skip >= 10) {
+				/* Keyframes tell us the resolution */
+				guint8 *f = p + skip;
+				webm->width = (f[6] | (f[7] << 8)) & 0x3FFF;
+				webm->height = (f[8] | (f[9] << 8)) & 0x3FFF;
+			}
+		}
+	} else {
+		/* VP9 payload descriptor */
+		gboolean i_bit = p[0] & 0x80, p_bit = p[0] & 0x40, l_bit = p[0] & 0x20,
+			f_bit = p[0] & 0x10, b_bit = p[0] & 0x08, v_bit = p[0] & 0x02;
+		if(i_bit) {
+			if(plen < 2)
+				return;
+			skip += (p[1] & 0x80) ? 2 : 1;
+		}
+		if(l_bit)
+			skip += f_bit ? 1 : 2;
+		if(f_bit && p_bit) {
+			int diffs = 0;
+			gboolean more = TRUE;
+			while(more && diffs < 3) {
+				if(skip >= plen)
+					return;
+				more = p[skip] & 0x01;
+				skip++;
+				diffs++;
+			}
+		}
+		if(v_bit) {
+			/* Scalability structure: we may find the resolution there */
+			if(skip >= plen)
+				return;
+			guint8 ss = p[skip++];
+			int n_s = ((ss >> 5) & 0x07) + 1, i = 0;
+			if(ss & 0x10) {
+				for(i=0; i<n_s; i++) {
+					if(skip + 4 > plen)
+						return;
+					webm->width = (p[skip] << 8) | p[skip+1];
+					webm->height = (p[skip+2] << 8) | p[skip+3];
+					skip += 4;
+				}
+			}
+			if(ss & 0x08) {
+				if(skip >= plen)
+					return;
+				int n_g = p[skip++];
+				for(i=0; i<n_g; i++) {
+					if(skip >= plen)
+						return;
+					skip += 1 + ((p[skip] >> 2) & 0x03);
+				}
+			}
+		}
+		if(skip >= plen)
+			return;
+		start = b_bit;
+		if(start) {
+			if(webm->frame->len == 0) {
+				/* New picture */
+				webm->frame_keyframe = janus_vp9_is_keyframe(payload, plen);
+			}
+			/* New layer of this picture */
+			if(webm->num_layers < JANUS_WEBM_MAX_LAYERS)
+				webm->layers[webm->num_layers++] = webm->frame->len;
+		}
+	}
+	if(start) {
+		webm->frame_started = TRUE;
+		webm->frame_ts = ts;
+	} else if(!webm->frame_started) {
+		/* We missed the beginning of this frame */
+		return;
+	}
+	g_byte_array_append(webm->frame, p + skip, plen - skip);
+	/* The marker bit tells us this is the end of the frame */
+	if(rtp->markerbit)
+		janus_recorder_webm_flush(webm);
+}
+
+static void janus_recorder_webm_destroy(janus_recorder *recorder) {
+	janus_recorder_webm *webm = recorder->webm;
+	if(webm == NULL)
+		return;
+	recorder->webm = NULL;
+	janus_recorder_webm_flush(webm);
+	fclose(webm->file);
+	if(rec_tempname) {
+		/* Remove the temporary extension, as we do for the .mjr file */
+		char newname[1024], oldpath[1024], newpath[1024];
+		g_snprintf(newname, strlen(webm->filename)-strlen(rec_tempext), "%s", webm->filename);
+		janus_recorder_path(recorder, webm->filename, oldpath, sizeof(oldpath));
+		janus_recorder_path(recorder, newname, newpath, sizeof(newpath));
+		if(rename(oldpath, newpath) != 0)
+			JANUS_LOG(LOG_ERR, "Error renaming %s to %s...\n", webm->filename, newname);
+		else
+			JANUS_LOG(LOG_INFO, "Live WebM recording renamed: %s\n", newname);
+	}
+	g_byte_array_free(webm->buffer, TRUE);
+	g_byte_array_free(webm->frame, TRUE);
+	g_free(webm->filename);
+	g_free(webm);
+}
+
+/* Name of a recording file (or segment) given its base name: segments after
+ * the first get their number appended to the base name, e.g., name-1.mjr */
+static void janus_recorder_filename(const char *basename, guint segment, char *name, size_t size) {
+	char base[1024];
+	if(segment == 0)
+		g_snprintf(base, sizeof(base), "%s", basename);
+	else
+		g_snprintf(base, sizeof(base), "%s-%u", basename, segment);
+	if(!rec_tempname) {
+		/* Use .mjr as an extension right away */
+		g_snprintf(name, size, "%s.mjr", base);
+	} else {
+		/* Append the temporary extension to .mjr, we'll rename when closing */
+		g_snprintf(name, size, "%s.mjr.%s", base, rec_tempext);
+	}
+}
+
+/* Open a new recording file (and its index), and write the first part of the header */
+static int janus_recorder_open_file(janus_recorder *rc, const char *newname) {
+	char path[1024];
+	janus_recorder_path(rc, newname, path, sizeof(path));
+	/* Make sure folder to save to is not protected */
+	if(janus_is_folder_protected(path)) {
+		JANUS_LOG(LOG_ERR, "Target recording path '%s' is in protected folder...\n", path);
+		return -1;
+	}
+	rc->file = fopen(path, "wb");
+	if(rc->file == NULL) {
+		JANUS_LOG(LOG_ERR, "fopen error: %d\n", errno);
+		return -1;
+	}
+	g_free(rc->filename);
+	rc->filename = g_strdup(newname);
+	/* Write the first part of the header */
+	size_t res = fwrite(header, sizeof(char), strlen(header), rc->file);
+	if(res != strlen(header)) {
+		JANUS_LOG(LOG_ERR, "Couldn't write .mjr header (%zu != %zu, %s)\n",
+			res, strlen(header), g_strerror(errno));
+		return -1;
+	}
+	rc->written = strlen(header);
+	rc->indexed = 0;
+	g_atomic_int_set(&rc->write_failed, 0);
+	g_atomic_int_set(&rc->index_failed, 0);
+	/* Open the index too: it gets the same name, plus the index extension
+	 * (before the temporary extension, if we're using one) */
+	char indexname[1024];
+	if(!rec_tempname) {
+		g_snprintf(indexname, sizeof(indexname), "%s%s", newname, JANUS_RECORDING_INDEX_EXT);
+	} else {
+		g_snprintf(indexname, strlen(newname)-strlen(rec_tempext), "%s", newname);
+		g_strlcat(indexname, JANUS_RECORDING_INDEX_EXT".", sizeof(indexname));
+		g_strlcat(indexname, rec_tempext, sizeof(indexname));
+	}
+	g_free(rc->index_filename);
+	rc->index_filename = g_strdup(indexname);
+	char indexpath[1024];
+	janus_recorder_path(rc, indexname, indexpath, sizeof(indexpath));
+	rc->index = fopen(indexpath, "wb");
+	if(rc->index == NULL) {
+		JANUS_LOG(LOG_WARN, "Couldn't create index %s (%s), playback will have to index the recording\n",
+			indexpath, g_strerror(errno));
+	} else {
+		/* The header will be updated when closing the recording */
+		guint8 index_buf[JANUS_RECORDING_INDEX_HEADER_SIZE];
+		janus_recording_index_pack_header(index_buf, 0, 0);
+		if(fwrite(index_buf, sizeof(index_buf), 1, rc->index) != 1)
+			janus_recorder_index_drop(rc);
+	}
+	if(rec_writers != NULL) {
+		/* Frames will be written by a writer thread: since it will write to the
+		 * file descriptors directly, make sure the headers are there already */
+		fflush(rc->file);
+		if(rc->index != NULL && fflush(rc->index) != 0)
+			janus_recorder_index_drop(rc);
+		janus_recorder_async_attach(rc);
+	}
+	/* If we're writing a live WebM file too, each segment gets its own */
+	if(rc->live)
+		rc->webm = janus_recorder_webm_create(rc);
+	return 0;
 }
 
 static void janus_recorder_free(const janus_refcount *recorder_ref) {
@@ -65,11 +1007,22 @@ static void janus_recorder_free(const janus_refcount *recorder_ref) {
 	janus_recorder_close(recorder);
 	g_free(recorder->dir);
 	recorder->dir = NULL;
+	g_free(recorder->basename);
+	recorder->basename = NULL;
 	g_free(recorder->filename);
 	recorder->filename = NULL;
 	if(recorder->file != NULL)
 		fclose(recorder->file);
 	recorder->file = NULL;
+	if(recorder->index != NULL)
+		fclose(recorder->index);
+	recorder->index = NULL;
+	g_free(recorder->index_filename);
+	recorder->index_filename = NULL;
+	janus_recorder_ring_destroy(recorder->ring);
+	recorder->ring = NULL;
+	janus_recorder_ring_destroy(recorder->index_ring);
+	recorder->index_ring = NULL;
 	g_free(recorder->codec);
 	recorder->codec = NULL;
 	g_free(recorder->fmtp);
@@ -180,68 +1133,21 @@ janus_recorder *janus_recorder_create_full(const char *dir, const char *codec, c
 			}
 		}
 	}
-	char newname[1024];
-	memset(newname, 0, 1024);
-	if(rec_file == NULL) {
-		/* Choose a random username */
-		if(!rec_tempname) {
-			/* Use .mjr as an extension right away */
-			g_snprintf(newname, 1024, "janus-recording-%"SCNu32".mjr", janus_random_uint32());
-		} else {
-			/* Append the temporary extension to .mjr, we'll rename when closing */
-			g_snprintf(newname, 1024, "janus-recording-%"SCNu32".mjr.%s", janus_random_uint32(), rec_tempext);
-		}
-	} else {
-		/* Just append the extension */
-		if(!rec_tempname) {
-			/* Use .mjr as an extension right away */
-			g_snprintf(newname, 1024, "%s.mjr", rec_file);
-		} else {
-			/* Append the temporary extension to .mjr, we'll rename when closing */
-			g_snprintf(newname, 1024, "%s.mjr.%s", rec_file, rec_tempext);
-		}
-	}
-	/* Try opening the file now */
-	if(rec_dir == NULL) {
-		/* Make sure folder to save to is not protected */
-		if(janus_is_folder_protected(newname)) {
-			JANUS_LOG(LOG_ERR, "Target recording path '%s' is in protected folder...\n", newname);
-			janus_recorder_destroy(rc);
-			g_free(copy_for_parent);
-			g_free(copy_for_base);
-			return NULL;
-		}
-		rc->file = fopen(newname, "wb");
-	} else {
-		char path[1024];
-		memset(path, 0, 1024);
-		g_snprintf(path, 1024, "%s/%s", rec_dir, newname);
-		/* Make sure folder to save to is not protected */
-		if(janus_is_folder_protected(path)) {
-			JANUS_LOG(LOG_ERR, "Target recording path '%s' is in protected folder...\n", path);
-			janus_recorder_destroy(rc);
-			g_free(copy_for_parent);
-			g_free(copy_for_base);
-			return NULL;
-		}
-		rc->file = fopen(path, "wb");
-	}
-	if(rc->file == NULL) {
-		JANUS_LOG(LOG_ERR, "fopen error: %d\n", errno);
-		janus_recorder_destroy(rc);
-		g_free(copy_for_parent);
-		g_free(copy_for_base);
-		return NULL;
-	}
+	/* Choose a random filename, if we weren't given one: we keep track of
+	 * the base name, as we'll need it to name segments when rotating */
+	char basename[1024];
+	if(rec_file == NULL)
+		g_snprintf(basename, sizeof(basename), "janus-recording-%"SCNu32, janus_random_uint32());
+	else
+		g_snprintf(basename, sizeof(basename), "%s", rec_file);
+	rc->basename = g_strdup(basename);
 	if(rec_dir)
 		rc->dir = g_strdup(rec_dir);
-	rc->filename = g_strdup(newname);
 	rc->type = type;
-	/* Write the first part of the header */
-	size_t res = fwrite(header, sizeof(char), strlen(header), rc->file);
-	if(res != strlen(header)) {
-		JANUS_LOG(LOG_ERR, "Couldn't write .mjr header (%zu != %zu, %s)\n",
-			res, strlen(header), g_strerror(errno));
+	/* Try opening the file now */
+	char newname[1024];
+	janus_recorder_filename(basename, 0, newname, sizeof(newname));
+	if(janus_recorder_open_file(rc, newname) < 0) {
 		janus_recorder_destroy(rc);
 		g_free(copy_for_parent);
 		g_free(copy_for_base);
@@ -318,16 +1224,147 @@ int janus_recorder_opusred(janus_recorder *recorder, int red_pt) {
 	return -1;
 }
 
+int janus_recorder_segments(janus_recorder *recorder, guint64 max_size, guint max_duration) {
+	if(!recorder)
+		return -1;
+	janus_mutex_lock_nodebug(&recorder->mutex);
+	recorder->segment_size = max_size;
+	recorder->segment_duration = (gint64)max_duration * G_USEC_PER_SEC;
+	janus_mutex_unlock_nodebug(&recorder->mutex);
+	return 0;
+}
+
+int janus_recorder_live_webm(janus_recorder *recorder) {
+	if(!recorder || recorder->encrypted || !janus_recorder_webm_supported(recorder->codec))
+		return -1;
+	janus_mutex_lock_nodebug(&recorder->mutex);
+	if(g_atomic_int_get(&recorder->header) || !g_atomic_int_get(&recorder->writable)) {
+		janus_mutex_unlock_nodebug(&recorder->mutex);
+		return -1;
+	}
+	if(!recorder->live) {
+		recorder->live = TRUE;
+		recorder->webm = janus_recorder_webm_create(recorder);
+	}
+	janus_mutex_unlock_nodebug(&recorder->mutex);
+	return recorder->webm ? 0 : -2;
+}
+
 int janus_recorder_encrypted(janus_recorder *recorder) {
 	if(!recorder)
 		return -1;
-	if(!g_atomic_int_get(&recorder->header)) {
+	if(!g_atomic_int_get(&recorder->header) && !recorder->live) {
 		recorder->encrypted = TRUE;
 		return 0;
 	}
 	return -1;
 }
 
+static int janus_recorder_rotate(janus_recorder *recorder);
+
+/* Same as the final part of janus_recorder_save_frame, but the frame is
+ * queued in the ring buffers: called with the recorder mutex locked */
+static int janus_recorder_async_save_frame(janus_recorder *recorder, char *buffer, uint length, gint64 now) {
+	/* Make sure we have room for the whole frame, or drop it */
+	gsize size = strlen(frame_header) + sizeof(uint32_t) + sizeof(uint16_t) + length;
+	if(recorder->type == JANUS_RECORDER_DATA)
+		size += sizeof(gint64);
+	if(recorder->type == JANUS_RECORDER_VIDEO && rec_memory_budget > 0) {
+		/* When we're over the memory budget, video is dropped until most of the
+		 * backlog has been written, and we can resume from a keyframe */
+		gsize queued = (gsize)g_atomic_pointer_get(&rec_queued);
+		if(!recorder->degraded && queued + size > rec_memory_budget) {
+			recorder->degraded = TRUE;
+			JANUS_LOG(LOG_WARN, "Over the recordings memory budget (%zu bytes queued), dropping video (%s)\n",
+				queued, recorder->filename);
+		} else if(recorder->degraded && queued < rec_memory_budget/4*3 &&
+				janus_recording_is_keyframe(recorder->codec, buffer, length)) {
+			recorder->degraded = FALSE;
+			JANUS_LOG(LOG_INFO, "Back within the recordings memory budget, resuming video (%s)\n",
+				recorder->filename);
+		}
+		if(recorder->degraded) {
+			g_atomic_int_inc(&recorder->degraded_frames);
+			g_atomic_int_inc(&rec_degraded_frames);
+			return -8;
+		}
+	}
+	gboolean indexing = (recorder->index != NULL && !g_atomic_int_get(&recorder->index_failed));
+	if(recorder->ring->size - janus_recorder_ring_used(recorder->ring) < size ||
+			(indexing && recorder->index_ring->size - janus_recorder_ring_used(recorder->index_ring) < JANUS_RECORDING_INDEX_ENTRY_SIZE)) {
+		if(g_atomic_int_add(&recorder->overflows, 1) == 0) {
+			JANUS_LOG(LOG_WARN, "Recorder buffer full, dropping frames (%s)\n", recorder->filename);
+		}
+		g_atomic_int_inc(&rec_overflows);
+		return -7;
+	}
+	/* Frame header (fixed part[4], timestamp[4], length[2]) */
+	gsize offset = 0;
+	janus_recorder_ring_copy(recorder->ring, offset, frame_header, strlen(frame_header));
+	offset += strlen(frame_header);
+	uint32_t timestamp = (uint32_t)(now > recorder->started ? ((now - recorder->started)/1000) : 0);
+	timestamp = htonl(timestamp);
+	janus_recorder_ring_copy(recorder->ring, offset, &timestamp, sizeof(uint32_t));
+	offset += sizeof(uint32_t);
+	uint16_t header_bytes = htons(recorder->type == JANUS_RECORDER_DATA ? (length+sizeof(gint64)) : length);
+	janus_recorder_ring_copy(recorder->ring, offset, &header_bytes, sizeof(uint16_t));
+	offset += sizeof(uint16_t);
+	if(recorder->type == JANUS_RECORDER_DATA) {
+		/* If it's data, then we need to prepend timing related info, as it's not there by itself */
+		gint64 now = htonll((uint64_t)janus_get_real_time());
+		janus_recorder_ring_copy(recorder->ring, offset, &now, sizeof(gint64));
+		offset += sizeof(gint64);
+	}
+	/* Prepare the index entry for this frame */
+	janus_recording_frame frame = { 0 };
+	frame.time = ntohl(timestamp);
+	frame.offset = recorder->written + strlen(frame_header) + sizeof(uint32_t) + sizeof(uint16_t);
+	frame.length = ntohs(header_bytes);
+	recorder->written = frame.offset + frame.length;
+	/* Edit packet header if needed */
+	janus_rtp_header *header = (janus_rtp_header *)buffer;
+	uint32_t ssrc = 0;
+	uint16_t seq = 0;
+	if(recorder->type != JANUS_RECORDER_DATA) {
+		ssrc = ntohl(header->ssrc);
+		seq = ntohs(header->seq_number);
+		timestamp = ntohl(header->timestamp);
+		janus_rtp_header_update(header, &recorder->context, recorder->type == JANUS_RECORDER_VIDEO, 0);
+		frame.timestamp = ntohl(header->timestamp);
+		frame.seq = ntohs(header->seq_number);
+		if(recorder->type == JANUS_RECORDER_VIDEO)
+			frame.keyframe = janus_recording_is_keyframe(recorder->codec, buffer, length);
+		if(recorder->webm != NULL)
+			janus_recorder_webm_save(recorder->webm, buffer, length);
+	}
+	/* Queue the packet */
+	janus_recorder_ring_copy(recorder->ring, offset, buffer, length);
+	janus_recorder_ring_commit(recorder->ring, size);
+	if(recorder->type != JANUS_RECORDER_DATA) {
+		/* Restore packet header data */
+		header->ssrc = htonl(ssrc);
+		header->seq_number = htons(seq);
+		header->timestamp = htonl(timestamp);
+	}
+	if(indexing) {
+		guint8 index_buf[JANUS_RECORDING_INDEX_ENTRY_SIZE];
+		janus_recording_index_pack_entry(index_buf, &frame);
+		janus_recorder_ring_copy(recorder->index_ring, 0, index_buf, sizeof(index_buf));
+		janus_recorder_ring_commit(recorder->index_ring, sizeof(index_buf));
+		recorder->indexed++;
+	}
+	/* Wake the writer thread if there's a complete block to write: we don't
+	 * take the writer mutex, as the writer may be busy writing, which means
+	 * the wake up may be missed, but the writer checks on a timer anyway */
+	janus_recorder_writer *writer = recorder->writer;
+	if(writer != NULL && janus_recorder_ring_used(recorder->ring) >= MIN(JANUS_RECORDER_BLOCK_SIZE, recorder->ring->size/4) &&
+			g_atomic_int_compare_and_exchange(&writer->wake, 0, 1)) {
+		janus_condition_signal(&writer->cond);
+	}
+	/* Done */
+	return 0;
+}
+
 int janus_recorder_save_frame(janus_recorder *recorder, char *buffer, uint length) {
 	if(!recorder)
 		return -1;
@@ -349,6 +1386,18 @@ int janus_recorder_save_frame(janus_recorder *recorder, char *buffer, uint lengt
 		return -5;
 	}
 	gint64 now = janus_get_monotonic_time();
+	if(g_atomic_int_get(&recorder->header) && (recorder->segment_size > 0 || recorder->segment_duration > 0) &&
+			((recorder->segment_size > 0 && recorder->written >= recorder->segment_size) ||
+			(recorder->segment_duration > 0 && now - recorder->started >= recorder->segment_duration))) {
+		/* Time to start a new segment: for video, we wait for a keyframe, so
+		 * that each segment can be post-processed on its own */
+		if(recorder->type != JANUS_RECORDER_VIDEO || janus_recording_is_keyframe(recorder->codec, buffer, length)) {
+			if(janus_recorder_rotate(recorder) < 0) {
+				janus_mutex_unlock_nodebug(&recorder->mutex);
+				return -3;
+			}
+		}
+	}
 	if(!g_atomic_int_get(&recorder->header)) {
 		/* Write info header as a JSON formatted info */
 		json_t *info = json_object();
@@ -394,6 +1443,9 @@ int janus_recorder_save_frame(janus_recorder *recorder, char *buffer, uint lengt
 		/* If media will be end-to-end encrypted, mark it in the recording header */
 		if(recorder->encrypted)
 			json_object_set_new(info, "e", json_true());
+		/* If this is a segment of a longer recording, add its number */
+		if(recorder->segment > 0)
+			json_object_set_new(info, "g", json_integer(recorder->segment));
 		gchar *info_text = json_dumps(info, JSON_PRESERVE_ORDER);
 		json_decref(info);
 		if(info_text == NULL) {
@@ -402,21 +1454,37 @@ int janus_recorder_save_frame(janus_recorder *recorder, char *buffer, uint lengt
 			return -5;
 		}
 		uint16_t info_bytes = htons(strlen(info_text));
-		size_t res = fwrite(&info_bytes, sizeof(uint16_t), 1, recorder->file);
-		if(res != 1) {
-			JANUS_LOG(LOG_WARN, "Couldn't write size of JSON header in .mjr file (%zu != %zu, %s), expect issues post-processing\n",
-				res, sizeof(uint16_t), g_strerror(errno));
-		}
-		res = fwrite(info_text, sizeof(char), strlen(info_text), recorder->file);
-		if(res != strlen(info_text)) {
-			JANUS_LOG(LOG_WARN, "Couldn't write JSON header in .mjr file (%zu != %zu, %s), expect issues post-processing\n",
-				res, strlen(info_text), g_strerror(errno));
+		if(recorder->ring != NULL && sizeof(uint16_t) + strlen(info_text) <= recorder->ring->size) {
+			/* Nothing was queued before the info header, so there's room for it */
+			janus_recorder_ring_copy(recorder->ring, 0, &info_bytes, sizeof(uint16_t));
+			janus_recorder_ring_copy(recorder->ring, sizeof(uint16_t), info_text, strlen(info_text));
+			janus_recorder_ring_commit(recorder->ring, sizeof(uint16_t) + strlen(info_text));
+		} else {
+			size_t res = fwrite(&info_bytes, sizeof(uint16_t), 1, recorder->file);
+			if(res != 1) {
+				JANUS_LOG(LOG_WARN, "Couldn't write size of JSON header in .mjr file (%zu != %zu, %s), expect issues post-processing\n",
+					res, sizeof(uint16_t), g_strerror(errno));
+			}
+			res = fwrite(info_text, sizeof(char), strlen(info_text), recorder->file);
+			if(res != strlen(info_text)) {
+				JANUS_LOG(LOG_WARN, "Couldn't write JSON header in .mjr file (%zu != %zu, %s), expect issues post-processing\n",
+					res, strlen(info_text), g_strerror(errno));
+			}
+			if(recorder->ring != NULL)
+				fflush(recorder->file);
 		}
+		recorder->written += sizeof(uint16_t) + strlen(info_text);
 		free(info_text);
 		/* Done */
 		recorder->started = now;
 		g_atomic_int_set(&recorder->header, 1);
 	}
+	if(recorder->ring != NULL) {
+		/* The frame will be written by a writer thread */
+		int res = janus_recorder_async_save_frame(recorder, buffer, length, now);
+		janus_mutex_unlock_nodebug(&recorder->mutex);
+		return res;
+	}
 	/* Write frame header (fixed part[4], timestamp[4], length[2]) */
 	size_t res = fwrite(frame_header, sizeof(char), strlen(frame_header), recorder->file);
 	if(res != strlen(frame_header)) {
@@ -445,6 +1513,12 @@ int janus_recorder_save_frame(janus_recorder *recorder, char *buffer, uint lengt
 				res, sizeof(gint64), g_strerror(errno));
 		}
 	}
+	/* Prepare the index entry for this frame */
+	janus_recording_frame frame = { 0 };
+	frame.time = ntohl(timestamp);
+	frame.offset = recorder->written + strlen(frame_header) + sizeof(uint32_t) + sizeof(uint16_t);
+	frame.length = ntohs(header_bytes);
+	recorder->written = frame.offset + frame.length;
 	/* Edit packet header if needed */
 	janus_rtp_header *header = (janus_rtp_header *)buffer;
 	uint32_t ssrc = 0;
@@ -454,6 +1528,12 @@ int janus_recorder_save_frame(janus_recorder *recorder, char *buffer, uint lengt
 		seq = ntohs(header->seq_number);
 		timestamp = ntohl(header->timestamp);
 		janus_rtp_header_update(header, &recorder->context, recorder->type == JANUS_RECORDER_VIDEO, 0);
+		frame.timestamp = ntohl(header->timestamp);
+		frame.seq = ntohs(header->seq_number);
+		if(recorder->type == JANUS_RECORDER_VIDEO)
+			frame.keyframe = janus_recording_is_keyframe(recorder->codec, buffer, length);
+		if(recorder->webm != NULL)
+			janus_recorder_webm_save(recorder->webm, buffer, length);
 	}
 	/* Save packet on file */
 	int temp = 0, tot = length;
@@ -461,6 +1541,7 @@ int janus_recorder_save_frame(janus_recorder *recorder, char *buffer, uint lengt
 		temp = fwrite(buffer+length-tot, sizeof(char), tot, recorder->file);
 		if(temp <= 0) {
 			JANUS_LOG(LOG_ERR, "Error saving frame...\n");
+			janus_recorder_index_drop(recorder);
 			if(recorder->type != JANUS_RECORDER_DATA) {
 				/* Restore packet header data */
 				header->ssrc = htonl(ssrc);
@@ -478,21 +1559,58 @@ int janus_recorder_save_frame(janus_recorder *recorder, char *buffer, uint lengt
 		header->seq_number = htons(seq);
 		header->timestamp = htonl(timestamp);
 	}
+	if(recorder->index != NULL) {
+		guint8 index_buf[JANUS_RECORDING_INDEX_ENTRY_SIZE];
+		janus_recording_index_pack_entry(index_buf, &frame);
+		if(fwrite(index_buf, sizeof(index_buf), 1, recorder->index) != 1) {
+			JANUS_LOG(LOG_WARN, "Couldn't write to index (%s), playback will have to index the recording\n",
+				g_strerror(errno));
+			janus_recorder_index_drop(recorder);
+		} else {
+			recorder->indexed++;
+		}
+	}
 	/* Done */
 	janus_mutex_unlock_nodebug(&recorder->mutex);
 	return 0;
 }
 
-int janus_recorder_close(janus_recorder *recorder) {
-	if(!recorder || !g_atomic_int_compare_and_exchange(&recorder->writable, 1, 0))
-		return -1;
-	janus_mutex_lock_nodebug(&recorder->mutex);
+/* Finalize the current file of a recorder (and its index), either because
+ * the recorder is being closed or because we're rotating to a new segment:
+ * called with the recorder mutex locked */
+static void janus_recorder_finalize(janus_recorder *recorder) {
+	janus_recorder_webm_destroy(recorder);
+	/* If a writer thread was taking care of this recorder, write what's left */
+	janus_recorder_async_detach(recorder);
+	if(g_atomic_int_get(&recorder->index_failed))
+		janus_recorder_index_drop(recorder);
 	if(recorder->file) {
 		fseek(recorder->file, 0L, SEEK_END);
 		size_t fsize = ftell(recorder->file);
 		fseek(recorder->file, 0L, SEEK_SET);
 		JANUS_LOG(LOG_INFO, "File is %zu bytes: %s\n", fsize, recorder->filename);
 	}
+	if(recorder->index) {
+		/* Finalize the index header, so that readers can check it matches the recording */
+		guint8 index_buf[JANUS_RECORDING_INDEX_HEADER_SIZE];
+		janus_recording_index_pack_header(index_buf, recorder->written, recorder->indexed);
+		if(fseek(recorder->index, 0L, SEEK_SET) != 0 || fwrite(index_buf, sizeof(index_buf), 1, recorder->index) != 1) {
+			JANUS_LOG(LOG_WARN, "Couldn't finalize index (%s)\n", g_strerror(errno));
+			janus_recorder_index_drop(recorder);
+		} else {
+			if(rec_fsync_interval >= 0) {
+				fflush(recorder->index);
+				fsync(fileno(recorder->index));
+			}
+			fclose(recorder->index);
+			recorder->index = NULL;
+		}
+	}
+	if(recorder->file && rec_fsync_interval >= 0) {
+		/* Make sure the recording is on storage before we rename it */
+		fflush(recorder->file);
+		janus_recorder_sync(recorder);
+	}
 	if(rec_tempname) {
 		/* We need to rename the file, to remove the temporary extension */
 		char newname[1024];
@@ -516,7 +1634,51 @@ int janus_recorder_close(janus_recorder *recorder) {
 			g_free(recorder->filename);
 			recorder->filename = g_strdup(newname);
 		}
+		/* Same thing for the index, if we have one */
+		if(recorder->index_filename) {
+			g_snprintf(newname, strlen(recorder->index_filename)-strlen(rec_tempext), "%s", recorder->index_filename);
+			janus_recorder_path(recorder, newname, newpath, sizeof(newpath));
+			janus_recorder_path(recorder, recorder->index_filename, oldpath, sizeof(oldpath));
+			if(access(oldpath, F_OK) == 0) {
+				if(rename(oldpath, newpath) != 0) {
+					JANUS_LOG(LOG_ERR, "Error renaming %s to %s...\n", recorder->index_filename, newname);
+				} else {
+					g_free(recorder->index_filename);
+					recorder->index_filename = g_strdup(newname);
+				}
+			}
+		}
 	}
+}
+
+/* Close the current segment and open the next one: called with the
+ * recorder mutex locked, when saving a frame */
+static int janus_recorder_rotate(janus_recorder *recorder) {
+	janus_recorder_finalize(recorder);
+	if(recorder->file != NULL)
+		fclose(recorder->file);
+	recorder->file = NULL;
+	recorder->segment++;
+	char newname[1024];
+	janus_recorder_filename(recorder->basename, recorder->segment, newname, sizeof(newname));
+	if(janus_recorder_open_file(recorder, newname) < 0) {
+		JANUS_LOG(LOG_ERR, "Couldn't open next segment of recording %s\n", recorder->basename);
+		if(recorder->file != NULL)
+			fclose(recorder->file);
+		recorder->file = NULL;
+		return -1;
+	}
+	JANUS_LOG(LOG_INFO, "Recording rotated: %s\n", newname);
+	/* The new segment will need its own info header */
+	g_atomic_int_set(&recorder->header, 0);
+	return 0;
+}
+
+int janus_recorder_close(janus_recorder *recorder) {
+	if(!recorder || !g_atomic_int_compare_and_exchange(&recorder->writable, 1, 0))
+		return -1;
+	janus_mutex_lock_nodebug(&recorder->mutex);
+	janus_recorder_finalize(recorder);
 	janus_mutex_unlock_nodebug(&recorder->mutex);
 	return 0;
 }
@@ -526,3 +1688,315 @@ void janus_recorder_destroy(janus_recorder *recorder) {
 		return;
 	janus_refcount_decrease(&recorder->ref);
 }
+
+
+/* Reading recordings */
+static void janus_recording_free(janus_recording *recording) {
+	if(recording == NULL)
+		return;
+	if(recording->data != NULL)
+		munmap((void *)recording->data, recording->size);
+	g_free(recording->path);
+	g_free(recording->codec);
+	g_free(recording->frames);
+	g_free(recording);
+}
+
+/* Parse the info header of a recording, to figure out what's in there */
+static gboolean janus_recording_parse_info(janus_recording *recording, const char *text, uint16_t len) {
+	char *copy = g_strndup(text, len);
+	json_error_t error;
+	json_t *info = json_loads(copy, 0, &error);
+	g_free(copy);
+	if(info == NULL) {
+		JANUS_LOG(LOG_ERR, "JSON error: on line %d: %s\n", error.line, error.text);
+		return FALSE;
+	}
+	const char *t = json_string_value(json_object_get(info, "t"));
+	const char *c = json_string_value(json_object_get(info, "c"));
+	json_t *created = json_object_get(info, "s");
+	if(t == NULL || c == NULL || !json_is_integer(created)) {
+		JANUS_LOG(LOG_ERR, "Missing/invalid info in recording header\n");
+		json_decref(info);
+		return FALSE;
+	}
+	gboolean res = TRUE;
+	if(!strcasecmp(t, "a")) {
+		recording->type = JANUS_RECORDER_AUDIO;
+	} else if(!strcasecmp(t, "v")) {
+		recording->type = JANUS_RECORDER_VIDEO;
+	} else if(!strcasecmp(t, "d")) {
+		recording->type = JANUS_RECORDER_DATA;
+	} else {
+		JANUS_LOG(LOG_ERR, "Unsupported recording type '%s' in info header\n", t);
+		res = FALSE;
+	}
+	recording->codec = g_strdup(c);
+	recording->created = json_integer_value(created);
+	json_decref(info);
+	return res;
+}
+
+/* Go through the whole recording to index it, which is what we do when there's no valid index */
+static gboolean janus_recording_scan(janus_recording *recording) {
+	GArray *frames = g_array_new(FALSE, TRUE, sizeof(janus_recording_frame));
+	gboolean parsed_header = FALSE;
+	size_t offset = 0;
+	uint16_t len = 0;
+	uint32_t time = 0;
+	while(offset + 10 <= recording->size) {
+		const char *buf = recording->data + offset;
+		memcpy(&len, buf+8, sizeof(len));
+		len = ntohs(len);
+		if(buf[0] != 'M' || offset + 10 + len > recording->size) {
+			/* Broken or truncated, e.g., because it's still being written */
+			break;
+		}
+		offset += 10;
+		if(buf[1] == 'J') {
+			/* New .mjr format, with the info header */
+			if(!parsed_header && !janus_recording_parse_info(recording, recording->data + offset, len))
+				break;
+			parsed_header = TRUE;
+			offset += len;
+			continue;
+		} else if(buf[1] != 'E') {
+			break;
+		}
+		if(!memcmp(buf, "MEETECHO", 8)) {
+			/* Old .mjr format, which doesn't have timing info */
+			if(!parsed_header && len == 5) {
+				/* This is the main header: assume the codecs the old format supported */
+				parsed_header = TRUE;
+				char t = recording->data[offset];
+				if(t == 'v') {
+					recording->type = JANUS_RECORDER_VIDEO;
+					recording->codec = g_strdup("vp8");
+				} else if(t == 'a') {
+					recording->type = JANUS_RECORDER_AUDIO;
+					recording->codec = g_strdup("opus");
+				} else if(t == 'd') {
+					recording->type = JANUS_RECORDER_DATA;
+					recording->codec = g_strdup("text");
+				} else {
+					break;
+				}
+				offset += len;
+				continue;
+			}
+			time = 0;
+		} else {
+			memcpy(&time, buf+4, sizeof(time));
+			time = ntohl(time);
+		}
+		if(!parsed_header)
+			break;
+		if(recording->type == JANUS_RECORDER_DATA ? len < sizeof(gint64) : len < 12) {
+			/* Not RTP (or missing the timing info, for data), skip */
+			offset += len;
+			continue;
+		}
+		janus_recording_frame frame = { 0 };
+		frame.offset = offset;
+		frame.length = len;
+		frame.time = time;
+		if(recording->type != JANUS_RECORDER_DATA) {
+			janus_rtp_header *rtp = (janus_rtp_header *)(recording->data + offset);
+			frame.timestamp = ntohl(rtp->timestamp);
+			frame.seq = ntohs(rtp->seq_number);
+			if(recording->type == JANUS_RECORDER_VIDEO)
+				frame.keyframe = janus_recording_is_keyframe(recording->codec, (char *)rtp, len);
+		}
+		g_array_append_val(frames, frame);
+		offset += len;
+	}
+	if(!parsed_header) {
+		g_array_free(frames, TRUE);
+		return FALSE;
+	}
+	recording->count = frames->len;
+	recording->frames = (janus_recording_frame *)g_array_free(frames, FALSE);
+	return TRUE;
+}
+
+/* Load the index of a recording, if there's a valid one */
+static gboolean janus_recording_load_index(janus_recording *recording, const char *indexpath) {
+	gchar *contents = NULL;
+	gsize length = 0;
+	if(!g_file_get_contents(indexpath, &contents, &length, NULL))
+		return FALSE;
+	const guint8 *buf = (const guint8 *)contents;
+	guint64 size = 0;
+	guint32 count = 0;
+	if(length >= JANUS_RECORDING_INDEX_HEADER_SIZE) {
+		memcpy(&size, buf+8, sizeof(size));
+		size = ntohll(size);
+		memcpy(&count, buf+16, sizeof(count));
+		count = ntohl(count);
+	}
+	if(length < JANUS_RECORDING_INDEX_HEADER_SIZE || memcmp(buf, index_header, strlen(index_header)) ||
+			size != recording->size || length != JANUS_RECORDING_INDEX_HEADER_SIZE + (gsize)count*JANUS_RECORDING_INDEX_ENTRY_SIZE) {
+		JANUS_LOG(LOG_VERB, "Index %s is invalid or stale, ignoring it\n", indexpath);
+		g_free(contents);
+		return FALSE;
+	}
+	recording->frames = g_malloc0((count > 0 ? count : 1) * sizeof(janus_recording_frame));
+	recording->count = count;
+	guint32 i = 0;
+	for(i=0; i<count; i++) {
+		janus_recording_frame *frame = &recording->frames[i];
+		janus_recording_index_parse_entry(buf + JANUS_RECORDING_INDEX_HEADER_SIZE + i*JANUS_RECORDING_INDEX_ENTRY_SIZE, frame);
+		if(frame->offset + frame->length > recording->size) {
+			JANUS_LOG(LOG_WARN, "Index %s points outside of the recording, ignoring it\n", indexpath);
+			g_free(recording->frames);
+			recording->frames = NULL;
+			recording->count = 0;
+			g_free(contents);
+			return FALSE;
+		}
+	}
+	g_free(contents);
+	return TRUE;
+}
+
+/* Save the index we built for a recording, so that we won't have to do that again */
+static void janus_recording_save_index(janus_recording *recording, const char *indexpath) {
+	gsize length = JANUS_RECORDING_INDEX_HEADER_SIZE + (gsize)recording->count*JANUS_RECORDING_INDEX_ENTRY_SIZE;
+	guint8 *buf = g_malloc(length);
+	janus_recording_index_pack_header(buf, recording->size, recording->count);
+	guint i = 0;
+	for(i=0; i<recording->count; i++)
+		janus_recording_index_pack_entry(buf + JANUS_RECORDING_INDEX_HEADER_SIZE + i*JANUS_RECORDING_INDEX_ENTRY_SIZE, &recording->frames[i]);
+	GError *error = NULL;
+	if(!g_file_set_contents(indexpath, (const gchar *)buf, length, &error)) {
+		JANUS_LOG(LOG_VERB, "Couldn't save index %s: %s\n", indexpath, error ? error->message : "??");
+		g_clear_error(&error);
+	}
+	g_free(buf);
+}
+
+static janus_recording *janus_recording_load(const char *path, struct stat *st) {
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		JANUS_LOG(LOG_ERR, "Could not open recording %s: %s\n", path, g_strerror(errno));
+		return NULL;
+	}
+	void *data = mmap(NULL, st->st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED) {
+		JANUS_LOG(LOG_ERR, "Could not map recording %s: %s\n", path, g_strerror(errno));
+		return NULL;
+	}
+	janus_recording *recording = g_malloc0(sizeof(janus_recording));
+	recording->path = g_strdup(path);
+	recording->data = data;
+	recording->size = st->st_size;
+	recording->mtime = st->st_mtime;
+#ifdef MADV_WILLNEED
+	madvise(data, recording->size, MADV_WILLNEED);
+#endif
+	/* Parse the info header, which comes right after the magic */
+	uint16_t len = 0;
+	if(recording->size > 10 && !memcmp(recording->data, "MJR", 3)) {
+		memcpy(&len, recording->data+8, sizeof(len));
+		len = ntohs(len);
+		if((size_t)10 + len > recording->size || !janus_recording_parse_info(recording, recording->data+10, len)) {
+			janus_recording_free(recording);
+			return NULL;
+		}
+	}
+	/* Try the index first, and index the recording ourselves otherwise */
+	char indexpath[1024];
+	g_snprintf(indexpath, sizeof(indexpath), "%s%s", path, JANUS_RECORDING_INDEX_EXT);
+	if(recording->codec == NULL || !janus_recording_load_index(recording, indexpath)) {
+		g_free(recording->codec);
+		recording->codec = NULL;
+		gint64 start = janus_get_monotonic_time();
+		if(!janus_recording_scan(recording)) {
+			JANUS_LOG(LOG_ERR, "Invalid recording %s\n", path);
+			janus_recording_free(recording);
+			return NULL;
+		}
+		JANUS_LOG(LOG_VERB, "Indexed %u frames of %s in %"SCNi64"us\n", recording->count,
+			path, janus_get_monotonic_time()-start);
+		janus_recording_save_index(recording, indexpath);
+	}
+	return recording;
+}
+
+janus_recording *janus_recording_open(const char *path) {
+	if(path == NULL)
+		return NULL;
+	struct stat st;
+	if(stat(path, &st) != 0) {
+		JANUS_LOG(LOG_ERR, "Could not access recording %s: %s\n", path, g_strerror(errno));
+		return NULL;
+	}
+	if(st.st_size == 0) {
+		JANUS_LOG(LOG_ERR, "Recording %s is empty\n", path);
+		return NULL;
+	}
+	janus_mutex_lock(&recordings_mutex);
+	if(recordings == NULL)
+		recordings = g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, NULL);
+	janus_recording *recording = g_hash_table_lookup(recordings, path);
+	if(recording != NULL && recording->size == (size_t)st.st_size && recording->mtime == st.st_mtime) {
+		/* Already open, and still up to date */
+		recording->users++;
+		janus_mutex_unlock(&recordings_mutex);
+		return recording;
+	}
+	/* Not open yet, or the file changed: any older instance will be
+	 * freed when the users still reading from it are done */
+	recording = janus_recording_load(path, &st);
+	if(recording != NULL) {
+		recording->users = 1;
+		g_hash_table_insert(recordings, g_strdup(path), recording);
+	}
+	janus_mutex_unlock(&recordings_mutex);
+	return recording;
+}
+
+int janus_recording_seek(janus_recording *recording, guint32 time, gboolean keyframe) {
+	if(recording == NULL || recording->count == 0)
+		return -1;
+	/* Frames are in the order they were saved, so their time is ordered too */
+	guint lo = 0, hi = recording->count;
+	while(lo < hi) {
+		guint mid = lo + (hi-lo)/2;
+		if(recording->frames[mid].time < time)
+			lo = mid+1;
+		else
+			hi = mid;
+	}
+	if(lo == recording->count)
+		return -1;
+	if(keyframe && recording->type == JANUS_RECORDER_VIDEO) {
+		/* Go back to the start of the closest keyframe, if there's one */
+		guint i = lo;
+		while(i > 0 && !recording->frames[i].keyframe)
+			i--;
+		if(recording->frames[i].keyframe) {
+			guint32 ts = recording->frames[i].timestamp;
+			while(i > 0 && recording->frames[i-1].timestamp == ts)
+				i--;
+			lo = i;
+		}
+	}
+	return lo;
+}
+
+void janus_recording_close(janus_recording *recording) {
+	if(recording == NULL)
+		return;
+	janus_mutex_lock(&recordings_mutex);
+	recording->users--;
+	if(recording->users > 0) {
+		janus_mutex_unlock(&recordings_mutex);
+		return;
+	}
+	if(recordings != NULL && g_hash_table_lookup(recordings, recording->path) == recording)
+		g_hash_table_remove(recordings, recording->path);
+	janus_mutex_unlock(&recordings_mutex);
+	janus_recording_free(recording);
+}
@@ -13,6 +13,32 @@
  * two different recorders. Any muxing in the same container will have
  * to be done in the post-processing phase.
  *
+ * While recording, a small sidecar index (same name as the recording,
+ * with an additional \c .idx extension) is written as well, with the
+ * offset, timing and keyframe info of each frame: this allows plugins
+ * that play recordings back to use a \ref janus_recording instance,
+ * which memory maps the file and can seek in it without parsing it
+ * first. Recordings missing the index (e.g., older ones) are indexed
+ * in memory when they're opened the first time.
+ *
+ * Long recordings can also be split in segments, based on their size
+ * or duration (see janus_recorder_segments): each segment is a valid
+ * recording of its own, which means segments can be post-processed in
+ * parallel, and played back independently of each other.
+ *
+ * By default frames are written to the recording from the thread saving
+ * them, which is usually the thread relaying media. When recording to
+ * slow storage (e.g., network mounts) that may cause jitter, so frames
+ * can be written asynchronously instead: in that case, each recorder
+ * copies frames (and index entries) to its own lock-free ring buffers,
+ * and a small pool of writer threads flushes them to the files in large
+ * blocks. Should a ring buffer fill up, frames are dropped, and counted
+ * as overflows, rather than blocking the media threads. A memory budget
+ * can be set for all the ring buffers together as well: when storage
+ * can't keep up and more than that is waiting to be written, video
+ * recordings start dropping frames (until enough of the backlog has been
+ * written and a keyframe comes in), so that audio keeps being recorded.
+ *
  * \ingroup core
  * \ref core
  */
@@ -37,12 +63,21 @@ typedef enum janus_recorder_medium {
 	JANUS_RECORDER_DATA
 } janus_recorder_medium;
 
+/*! \brief Ring buffer frames are queued in, when writing asynchronously */
+typedef struct janus_recorder_ring janus_recorder_ring;
+/*! \brief Writer thread flushing ring buffers, when writing asynchronously */
+typedef struct janus_recorder_writer janus_recorder_writer;
+/*! \brief Live WebM file written next to the recording, if any */
+typedef struct janus_recorder_webm janus_recorder_webm;
+
 /*! \brief Structure that represents a recorder */
 typedef struct janus_recorder {
 	/*! \brief Absolute path to the directory where the recorder file is stored */
 	char *dir;
-	/*! \brief Filename of this recorder file */
+	/*! \brief Filename of this recorder file (the current segment, when rotating segments) */
 	char *filename;
+	/*! \brief Filename of this recorder file, without extensions: used to name segments */
+	char *basename;
 	/*! \brief Recording file */
 	FILE *file;
 	/*! \brief Codec the packets to record are encoded in ("vp8", "vp9", "h264", "opus", "pcma", "pcmu", "g722") */
@@ -69,6 +104,39 @@ typedef struct janus_recorder {
 	volatile int paused;
 	/*! \brief RTP switching context for rewriting RTP headers */
 	janus_rtp_switching_context context;
+	/*! \brief Filename of the index of this recorder file */
+	char *index_filename;
+	/*! \brief Index file */
+	FILE *index;
+	/*! \brief How many bytes have been written to the recording file so far */
+	guint64 written;
+	/*! \brief How many frames have been written to the index so far */
+	guint32 indexed;
+	/*! \brief Ring buffers for the recording and the index, when writing asynchronously */
+	janus_recorder_ring *ring, *index_ring;
+	/*! \brief Writer thread flushing the ring buffers of this recorder, when writing asynchronously */
+	janus_recorder_writer *writer;
+	/*! \brief How many frames have been dropped because the ring buffers were full */
+	volatile gint overflows;
+	/*! \brief Whether the writer thread failed writing to the recording or the index */
+	volatile gint write_failed, index_failed;
+	/*! \brief When the recording was last synced to storage, when writing asynchronously */
+	gint64 synced;
+	/*! \brief When a writer thread last flushed the ring buffers of this recorder */
+	volatile gint64 flushed;
+	/*! \brief Whether video frames are being dropped, because we're over the memory budget */
+	gboolean degraded;
+	/*! \brief How many frames have been dropped because we were over the memory budget */
+	volatile gint degraded_frames;
+	/*! \brief Size (in bytes) and duration (in microseconds) after which a new segment is started, if any */
+	guint64 segment_size;
+	gint64 segment_duration;
+	/*! \brief Number of the current segment (0 is the first one) */
+	guint segment;
+	/*! \brief Whether a live WebM file should be written next to the recording */
+	gboolean live;
+	/*! \brief Live WebM file of the current segment, if any */
+	janus_recorder_webm *webm;
 	/*! \brief Mutex to lock/unlock this recorder instance */
 	janus_mutex mutex;
 	/*! \brief Atomic flag to check if this instance has been destroyed */
@@ -83,6 +151,37 @@ typedef struct janus_recorder {
 void janus_recorder_init(gboolean tempnames, const char *extension);
 /*! \brief De-initialize the recorder code */
 void janus_recorder_deinit(void);
+/*! \brief Configure the recorder code to write frames asynchronously
+ * \note This must be called after janus_recorder_init and before any recorder
+ * is created: recorders created before that keep on writing synchronously
+ * @param[in] writers Number of writer threads to start (0 keeps frames written synchronously)
+ * @param[in] buffer_size Size (in bytes) of the ring buffer of each recorder, rounded up to a power of 2
+ * @param[in] fsync_interval How often (in seconds) the writer threads should sync recordings
+ * to storage: 0 means only when closing a recording, a negative value means never
+ * @returns 0 in case of success, a negative integer otherwise */
+int janus_recorder_async_init(int writers, size_t buffer_size, int fsync_interval);
+/*! \brief Get how many frames were dropped, overall, because the ring buffers were full
+ * @returns The number of dropped frames */
+guint janus_recorder_async_overflows(void);
+/*! \brief Set a budget for the memory used, overall, by the ring buffers of
+ * all the recorders to queue frames, when writing asynchronously: going over
+ * it will make video recorders drop frames, to keep audio recordings going
+ * @param[in] budget Maximum size (in bytes) of the frames waiting to be written (0 disables the budget) */
+void janus_recorder_async_budget(size_t budget);
+/*! \brief Get how many frames video recorders dropped, overall, because we were over the memory budget
+ * @returns The number of dropped frames */
+guint janus_recorder_async_degraded(void);
+/*! \brief Get how many bytes are currently waiting to be written, overall, when writing asynchronously
+ * @returns The number of bytes queued in the ring buffers */
+size_t janus_recorder_async_queued(void);
+/*! \brief Get how many bytes the writer threads wrote, overall, so far
+ * @returns The number of bytes written */
+guint64 janus_recorder_async_written(void);
+/*! \brief Get a summary of the asynchronous writing, that is the budget, the
+ * write throughput and, for each recorder, how much it has queued and how long
+ * ago it was last flushed (e.g., for an Admin API request)
+ * @returns A JSON object with the summary */
+json_t *janus_recorder_async_info(void);
 
 /*! \brief Create a new recorder
  * \note If no target directory is provided, the current directory will be used. If no filename
@@ -139,6 +238,30 @@ int janus_recorder_opusred(janus_recorder *recorder, int red_pt);
  * @param[in] recorder The janus_recorder instance to mark as encrypted
  * @returns 0 in case of success, a negative integer otherwise */
 int janus_recorder_encrypted(janus_recorder *recorder);
+/*! \brief Split this recording in segments, based on their size and/or duration
+ * \note When a segment reaches the limits, the recorder closes it (finalizing its
+ * index, and renaming it if temporary extensions are in use) and starts a new
+ * one, at the next keyframe for video: each segment is a complete .mjr file, with
+ * its own index, that can be post-processed independently of the others. The
+ * first segment uses the filename the recorder was created with, while the
+ * following ones get their number appended to it (e.g., \c name-1.mjr )
+ * @param[in] recorder The janus_recorder instance to split in segments
+ * @param[in] max_size Size (in bytes) after which a new segment should be started (0 means no limit)
+ * @param[in] max_duration Duration (in seconds) after which a new segment should be started (0 means no limit)
+ * @returns 0 in case of success, a negative integer otherwise */
+int janus_recorder_segments(janus_recorder *recorder, guint64 max_size, guint max_duration);
+/*! \brief Also write frames to a WebM file while recording
+ * \note This is only supported for Opus, VP8 and VP9, and will only be possible
+ * BEFORE the first frame is written. The WebM file gets the same name as the
+ * recording (e.g., \c name.webm next to \c name.mjr ), and is written live,
+ * which means it can be played as soon as the recording is closed, with no need
+ * for post-processing. Frames are depacketized as they're saved, so packets
+ * arriving out of order or lost are missing from the WebM file: the .mjr file
+ * is still written as usual, and can still be post-processed in that case.
+ * Not possible for end-to-end encrypted recordings
+ * @param[in] recorder The janus_recorder instance to write a WebM file for
+ * @returns 0 in case of success, a negative integer otherwise */
+int janus_recorder_live_webm(janus_recorder *recorder);
 /*! \brief Save an RTP frame in the recorder
  * @param[in] recorder The janus_recorder instance to save the frame to
  * @param[in] buffer The frame data to save
@@ -153,4 +276,64 @@ int janus_recorder_close(janus_recorder *recorder);
  * @param[in] recorder The janus_recorder instance to destroy */
 void janus_recorder_destroy(janus_recorder *recorder);
 
+
+/*! \brief Extension of the index files written next to recordings */
+#define JANUS_RECORDING_INDEX_EXT	".idx"
+
+/*! \brief Frame in a recording, as described by its index */
+typedef struct janus_recording_frame {
+	/*! \brief Offset of the frame data (RTP packet, or timing plus data) in the file */
+	guint64 offset;
+	/*! \brief When the frame was saved, in milliseconds since the first one */
+	guint32 time;
+	/*! \brief RTP timestamp of the frame, as saved (0 for data) */
+	guint32 timestamp;
+	/*! \brief Length of the frame data */
+	guint16 length;
+	/*! \brief RTP sequence number of the frame, as saved (0 for data) */
+	guint16 seq;
+	/*! \brief Whether the frame is (part of) a video keyframe */
+	gboolean keyframe;
+} janus_recording_frame;
+
+/*! \brief Read-only recording, memory mapped and shared by all the users playing it */
+typedef struct janus_recording {
+	/*! \brief Path of the recording file */
+	char *path;
+	/*! \brief Contents of the recording file */
+	const char *data;
+	/*! \brief Size of the recording file */
+	size_t size;
+	/*! \brief Modification time of the recording file, to detect stale instances */
+	gint64 mtime;
+	/*! \brief Media in this recording */
+	janus_recorder_medium type;
+	/*! \brief Codec of this recording, if known */
+	char *codec;
+	/*! \brief When the recording was created (0 for recordings in the old format) */
+	gint64 created;
+	/*! \brief Frames in this recording, in the order they were saved */
+	janus_recording_frame *frames;
+	/*! \brief Number of frames in this recording */
+	guint count;
+	/*! \brief How many users are currently sharing this instance */
+	int users;
+} janus_recording;
+
+/*! \brief Open a recording for reading
+ * \note Instances are shared: if the same file is already open and
+ * it hasn't changed in the meanwhile, the existing instance is returned.
+ * @param[in] path Path of the .mjr file to open
+ * @returns A janus_recording instance in case of success, NULL otherwise */
+janus_recording *janus_recording_open(const char *path);
+/*! \brief Find the frame to start from to play a recording from a specific time
+ * @param[in] recording The janus_recording instance to seek in
+ * @param[in] time The time to seek to, in milliseconds since the first frame
+ * @param[in] keyframe Whether to move back to the closest keyframe (only meaningful for video)
+ * @returns The index of the frame in the recording, or -1 if there are no frames after that time */
+int janus_recording_seek(janus_recording *recording, guint32 time, gboolean keyframe);
+/*! \brief Release a recording when done reading from it
+ * @param[in] recording The janus_recording instance to release */
+void janus_recording_close(janus_recording *recording);
+
 #endif
@@ -227,19 +227,24 @@ static void janus_rtcp_incoming_sr(janus_rtcp_context *ctx, janus_rtcp_sr *sr) {
 	if(ctx == NULL)
 		return;
 	/* Update the context with info on the monotonic time of last SR received */
-	ctx->lsr_ts = janus_get_monotonic_time();
+	ctx->lsr_ts = janus_get_cached_monotonic_time();
 	/* Compute the last SR received as well */
 	uint64_t ntp = ntohl(sr->si.ntp_ts_msw);
 	ntp = (ntp << 32) | ntohl(sr->si.ntp_ts_lsw);
 	ctx->lsr = (ntp >> 16);
 }
 
-/* Helper to handle an incoming transport-cc feedback: triggered by a call to janus_rtcp_fix_ssrc a valid context pointer */
-static void janus_rtcp_incoming_transport_cc(janus_rtcp_context *ctx, janus_rtcp_fb *twcc, int total) {
-	if(ctx == NULL || twcc == NULL || total < 20)
-		return;
+/* Helper to parse a transport-cc feedback, invoking a callback for each packet it reports */
+static int janus_rtcp_transport_wide_cc_parse(janus_rtcp_fb *twcc, int total,
+		janus_rtcp_transport_wide_cc_callback callback, void *user_data) {
+	if(twcc == NULL || total < 20)
+		return -1;
 	if(!janus_rtcp_check_fci((janus_rtcp_header *)twcc, total, 4))
-		return;
+		return -1;
+	/* Only look at this message, in case it's part of a compound packet */
+	int length = ntohs(twcc->header.length)*4+4;
+	if(length < total)
+		total = length;
 	/* Parse the header first */
 	uint8_t *data = (uint8_t *)twcc->fci;
 	uint16_t base_seq = 0, status_count = 0;
@@ -254,89 +259,89 @@ static void janus_rtcp_incoming_transport_cc(janus_rtcp_context *ctx, janus_rtcp
 	fb_pkt = *(data+7);
 	JANUS_LOG(LOG_HUGE, "[TWCC] seq=%"SCNu16", psc=%"SCNu16", ref=%"SCNu32", fbpc=%"SCNu8"\n",
 		base_seq, status_count, reference, fb_pkt);
-	/* Now traverse the feedback: packet chunks first, and then recv deltas */
 	total -= 20;
 	data += 8;
-	uint16_t psc = status_count;
-	uint16_t chunk = 0;
-	uint8_t t = 0, ss = 0, s = 0, length = 0;
-	/* Iterate on all packet chunks */
-	JANUS_LOG(LOG_HUGE, "[TWCC] Chunks:\n");
-	uint16_t num = 0;
-	GList *list = NULL;
-	while(psc > 0 && total > 1) {
-		num++;
-		memcpy(&chunk, data, sizeof(uint16_t));
+	/* Packet chunks come first, and recv deltas after them: find out where
+	 * the chunks end, so that we can then traverse both at the same time */
+	uint16_t psc = status_count, chunk = 0, count = 0;
+	int chunks_len = 0;
+	while(psc > 0 && total - chunks_len > 1) {
+		memcpy(&chunk, data + chunks_len, sizeof(uint16_t));
+		chunk = ntohs(chunk);
+		if((chunk & 0x8000) == 0)
+			count = (chunk & 0x1FFF);
+		else
+			count = (chunk & 0x4000) ? 7 : 14;
+		psc -= (count < psc ? count : psc);
+		chunks_len += 2;
+	}
+	if(psc > 0) {
+		/* Incomplete feedback? Drop... */
+		return -1;
+	}
+	uint8_t *deltas = data + chunks_len;
+	int deltas_len = total - chunks_len, offset = 0;
+	/* Now traverse the feedback */
+	int64_t arrival = (int64_t)reference * 64000;
+	uint16_t seq = base_seq;
+	uint8_t s = 0, ss = 0;
+	int i = 0, reported = 0;
+	psc = status_count;
+	for(i=0; i<chunks_len && psc > 0; i+=2) {
+		memcpy(&chunk, data + i, sizeof(uint16_t));
 		chunk = ntohs(chunk);
-		t = (chunk & 0x8000) >> 15;
-		if(t == 0) {
+		if((chunk & 0x8000) == 0) {
 			/* Run length */
 			s = (chunk & 0x6000) >> 13;
-			length = (chunk & 0x1FFF);
-			JANUS_LOG(LOG_HUGE, "  [%"SCNu16"] t=run-length, s=%s, l=%"SCNu8"\n", num,
-				janus_rtp_packet_status_description(s), length);
-			while(length > 0 && psc > 0) {
-				list = g_list_prepend(list, GUINT_TO_POINTER(s));
-				length--;
-				psc--;
-			}
+			count = (chunk & 0x1FFF);
+			ss = 0;
 		} else {
 			/* Status vector */
-			ss = (chunk & 0x4000) >> 14;
-			length = (ss ? 7 : 14);
-			JANUS_LOG(LOG_HUGE, "  [%"SCNu16"] t=status-vector, ss=%ss, l=%"SCNu8"\n", num,
-				ss ? "2-bit" : "bit", length);
-			while(length > 0 && psc > 0) {
-				if(!ss)
-					s = (chunk & (1 << (length-1))) ? janus_rtp_packet_status_smalldelta : janus_rtp_packet_status_notreceived;
-				else
-					s = (chunk & (3 << (2*length-2))) >> (2*length-2);
-				list = g_list_prepend(list, GUINT_TO_POINTER(s));
-				length--;
-				psc--;
+			ss = (chunk & 0x4000) ? 2 : 1;
+			count = (ss == 2 ? 7 : 14);
+		}
+		uint16_t j = 0;
+		for(j=0; j<count && psc > 0; j++) {
+			if(ss == 1)
+				s = (chunk & (1 << (13-j))) ? janus_rtp_packet_status_smalldelta : janus_rtp_packet_status_notreceived;
+			else if(ss == 2)
+				s = (chunk >> (12-2*j)) & 0x03;
+			gboolean received = FALSE;
+			if(s == janus_rtp_packet_status_smalldelta) {
+				/* Small delta = 1 byte */
+				if(offset + 1 > deltas_len)
+					return reported;
+				arrival += deltas[offset]*250;
+				offset++;
+				received = TRUE;
+			} else if(s == janus_rtp_packet_status_largeornegativedelta) {
+				/* Large or negative delta = 2 bytes */
+				if(offset + 2 > deltas_len)
+					return reported;
+				int16_t delta = (int16_t)((deltas[offset] << 8) | deltas[offset+1]);
+				arrival += delta*250;
+				offset += 2;
+				received = TRUE;
 			}
+			JANUS_LOG(LOG_HUGE, "  [%"SCNu16"] %s (%"SCNi64"us)\n", seq,
+				janus_rtp_packet_status_description(s), received ? arrival : 0);
+			if(callback != NULL)
+				callback(seq, received, received ? arrival : 0, user_data);
+			seq++;
+			psc--;
+			reported++;
 		}
-		total -= 2;
-		data += 2;
 	}
-	if(psc > 0) {
-		/* Incomplete feedback? Drop... */
-		g_list_free(list);
+	return reported;
+}
+
+/* Helper to handle an incoming transport-cc feedback: triggered by a call to janus_rtcp_fix_ssrc a valid context pointer */
+static void janus_rtcp_incoming_transport_cc(janus_rtcp_context *ctx, janus_rtcp_fb *twcc, int total) {
+	if(ctx == NULL || twcc == NULL || total < 20)
 		return;
-	}
-	list = g_list_reverse(list);
-	/* Iterate on all recv deltas */
-	JANUS_LOG(LOG_HUGE, "[TWCC] Recv Deltas (%d/%"SCNu16"):\n", g_list_length(list), status_count);
-	num = 0;
-	uint16_t delta = 0;
-	uint32_t delta_us = 0;
-	GList *iter = list;
-	while(iter != NULL && total > 0) {
-		num++;
-		delta = 0;
-		s = GPOINTER_TO_UINT(iter->data);
-		if(s == janus_rtp_packet_status_smalldelta) {
-			/* Small delta = 1 byte */
-			delta = *data;
-			total--;
-			data++;
-		} else if(s == janus_rtp_packet_status_largeornegativedelta) {
-			/* Large or negative delta = 2 bytes */
-			if(total < 2)
-				break;
-			memcpy(&delta, data, sizeof(uint16_t));
-			delta = ntohs(delta);
-			total -= 2;
-			data += 2;
-		}
-		delta_us = delta*250;
-		/* Print summary */
-		JANUS_LOG(LOG_HUGE, "  [%02"SCNu16"][%"SCNu16"] %s (%"SCNu32"us)\n", num, (uint16_t)(base_seq+num-1),
-			janus_rtp_packet_status_description(s), delta_us);
-		iter = iter->next;
-	}
-	/* TODO Update the context with the feedback we got */
-	g_list_free(list);
+	/* For now we only parse it (which prints it when debugging): the core feeds
+	 * the feedback to the bandwidth estimator via janus_rtcp_get_transport_wide_cc */
+	janus_rtcp_transport_wide_cc_parse(twcc, total, NULL, NULL);
 }
 
 /* Link quality estimate filter coefficient */
@@ -353,7 +358,7 @@ static double janus_rtcp_link_quality_filter(double last, double in) {
 
 /* Update link quality stats based on RR */
 static void janus_rtcp_rr_update_stats(rtcp_context *ctx, janus_report_block rb) {
-	int64_t ts = janus_get_monotonic_time();
+	int64_t ts = janus_get_cached_monotonic_time();
 	int64_t delta_t = ts - ctx->rr_last_ts;
 	if(delta_t < 2*G_USEC_PER_SEC) {
 		return;
@@ -771,21 +776,28 @@ char *janus_rtcp_filter(char *packet, int len, int *newlen) {
 	if(packet == NULL || len <= 0 || newlen == NULL)
 		return NULL;
 	*newlen = 0;
+	/* We filter a copy in place */
+	char *filtered = g_malloc(len);
+	memcpy(filtered, packet, len);
+	int flen = janus_rtcp_filter_inplace(filtered, len);
+	if(flen <= 0) {
+		g_free(filtered);
+		return NULL;
+	}
+	*newlen = flen;
+	return filtered;
+}
+
+int janus_rtcp_filter_inplace(char *packet, int len) {
+	if(packet == NULL || len <= 0)
+		return -1;
 	janus_rtcp_header *rtcp = (janus_rtcp_header *)packet;
-	char *filtered = NULL;
-	int total = len, length = 0, bytes = 0;
+	int total = len, length = 0, bytes = 0, newlen = 0;
 	/* Iterate on the compound packets */
 	gboolean keep = TRUE;
-	gboolean error = FALSE;
 	while(rtcp) {
-		if (!janus_rtcp_check_len(rtcp, total)) {
-			error = TRUE;
-			break;
-		}
-		if(rtcp->version != 2) {
-			error = TRUE;
-			break;
-		}
+		if(!janus_rtcp_check_len(rtcp, total) || rtcp->version != 2)
+			return -1;
 		keep = TRUE;
 		length = ntohs(rtcp->length);
 		if(length == 0)
@@ -825,37 +837,67 @@ char *janus_rtcp_filter(char *packet, int len, int *newlen) {
 				break;
 		}
 		if(keep) {
-			/* Keep this packet */
-			if(filtered == NULL)
-				filtered = g_malloc0(total);
-			memcpy(filtered+*newlen, (char *)rtcp, bytes);
-			*newlen += bytes;
+			/* Keep this packet, moving it after the ones we kept already if needed */
+			if((char *)rtcp != packet+newlen)
+				memmove(packet+newlen, (char *)rtcp, bytes);
+			newlen += bytes;
 		}
 		total -= bytes;
 		if(total <= 0)
 			break;
 		rtcp = (janus_rtcp_header *)((uint32_t*)rtcp + length + 1);
 	}
-	if (error) {
-		g_free(filtered);
-		filtered = NULL;
-		*newlen = 0;
+	return newlen;
+}
+
+void janus_rtcp_compound_init(janus_rtcp_compound *compound, char *buffer, int size) {
+	if(compound == NULL)
+		return;
+	compound->buffer = buffer;
+	compound->size = buffer ? size : 0;
+	compound->length = 0;
+}
+
+char *janus_rtcp_compound_reserve(janus_rtcp_compound *compound, int len) {
+	if(compound == NULL || compound->buffer == NULL || len <= 0 || len % 4 ||
+			compound->length + len > compound->size)
+		return NULL;
+	char *block = compound->buffer + compound->length;
+	memset(block, 0, len);
+	compound->length += len;
+	return block;
+}
+
+char *janus_rtcp_compound_tail(janus_rtcp_compound *compound, int *available) {
+	if(compound == NULL || compound->buffer == NULL) {
+		if(available)
+			*available = 0;
+		return NULL;
 	}
-	return filtered;
+	if(available)
+		*available = compound->size - compound->length;
+	return compound->buffer + compound->length;
+}
+
+int janus_rtcp_compound_commit(janus_rtcp_compound *compound, int len) {
+	if(compound == NULL || compound->buffer == NULL || len < 0 || len % 4 ||
+			compound->length + len > compound->size)
+		return -1;
+	compound->length += len;
+	return 0;
 }
 
 
 int janus_rtcp_process_incoming_rtp(janus_rtcp_context *ctx, char *packet, int len,
 		gboolean rfc4588_pkt, gboolean rfc4588_enabled, gboolean retransmissions_disabled,
-		GHashTable *clock_rates) {
+		const uint32_t *clock_rates) {
 	if(ctx == NULL || packet == NULL || len < 1)
 		return -1;
 
 	/* First of all, let's check if we need to change the timestamp base */
 	janus_rtp_header *rtp = (janus_rtp_header *)packet;
 	int pt = rtp->type;
-	uint32_t clock_rate = clock_rates ?
-		GPOINTER_TO_UINT(g_hash_table_lookup(clock_rates, GINT_TO_POINTER(pt))) : 0;
+	uint32_t clock_rate = clock_rates ? clock_rates[pt & 0x7F] : 0;
 	if(clock_rate > 0 && ctx->tb != clock_rate)
 		ctx->tb = clock_rate;
 	/* Now parse this RTP packet header and update the rtcp_context instance */
@@ -866,7 +908,7 @@ int janus_rtcp_process_incoming_rtp(janus_rtcp_context *ctx, char *packet, int l
 		first_pkt = TRUE;
 	}
 
-	int64_t now = janus_get_monotonic_time();
+	int64_t now = janus_get_cached_monotonic_time();
 	if (!rfc4588_pkt) {
 		/* Non-RTX packet */
 		if ((int16_t)(seq_number - ctx->max_seq_nr) > 0 || first_pkt) {
@@ -1017,7 +1059,7 @@ static void janus_rtcp_estimate_in_link_quality(janus_rtcp_context *ctx) {
 int janus_rtcp_report_block(janus_rtcp_context *ctx, janus_report_block *rb) {
 	if(ctx == NULL || rb == NULL)
 		return -1;
-	gint64 now = janus_get_monotonic_time();
+	gint64 now = janus_get_cached_monotonic_time();
 	rb->jitter = htonl((uint32_t) ctx->jitter);
 	rb->ehsnr = htonl((((uint32_t) 0x0 + ctx->seq_cycle) << 16) + ctx->max_seq_nr);
 	uint32_t expected_interval = ctx->expected - ctx->expected_prior;
@@ -1368,6 +1410,34 @@ uint32_t janus_rtcp_get_remb(char *packet, int len) {
 	return 0;
 }
 
+int janus_rtcp_get_transport_wide_cc(char *packet, int len, janus_rtcp_transport_wide_cc_callback callback, void *user_data) {
+	if(packet == NULL || len == 0 || callback == NULL)
+		return 0;
+	janus_rtcp_header *rtcp = (janus_rtcp_header *)packet;
+	int total = len, reported = 0;
+	while(rtcp) {
+		if (!janus_rtcp_check_len(rtcp, total))
+			break;
+		if(rtcp->version != 2)
+			break;
+		if(rtcp->type == RTCP_RTPFB && rtcp->rc == 15) {
+			/* Transport-cc feedback */
+			int res = janus_rtcp_transport_wide_cc_parse((janus_rtcp_fb *)rtcp, total, callback, user_data);
+			if(res > 0)
+				reported += res;
+		}
+		/* Is this a compound packet? */
+		int length = ntohs(rtcp->length);
+		if(length == 0)
+			break;
+		total -= length*4+4;
+		if(total <= 0)
+			break;
+		rtcp = (janus_rtcp_header *)((uint32_t*)rtcp + length + 1);
+	}
+	return reported;
+}
+
 /* Change an existing REMB message */
 int janus_rtcp_cap_remb(char *packet, int len, uint32_t bitrate) {
 	if(packet == NULL || len == 0)
@@ -1591,9 +1661,150 @@ int janus_rtcp_nacks(char *packet, int len, GSList *nacks) {
 	return words*4+4;
 }
 
-int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssrc, guint32 media, guint8 feedback_packet_count, GQueue *transport_wide_cc_stats) {
-	if(packet == NULL || size < sizeof(janus_rtcp_header) || transport_wide_cc_stats == NULL || g_queue_is_empty(transport_wide_cc_stats))
+void janus_rtcp_transport_wide_cc_ring_add(janus_rtcp_transport_wide_cc_ring *ring, guint16 transport_seq_num, guint64 timestamp) {
+	if(ring == NULL || timestamp == 0)
+		return;
+	guint32 ext_seq_num = transport_seq_num;
+	if(!ring->started) {
+		ring->started = TRUE;
+		ring->base = ext_seq_num;
+		ring->last = ext_seq_num;
+	} else {
+		/* Get the extended value, relative to the highest we've seen so far */
+		ext_seq_num = ring->last + (gint16)(transport_seq_num - (guint16)ring->last);
+		if((gint32)(ext_seq_num - ring->base) < 0) {
+			/* Too late, it was already reported as lost */
+			return;
+		}
+		if((gint32)(ext_seq_num - ring->last) > 0)
+			ring->last = ext_seq_num;
+	}
+	if(ring->last - ring->base >= JANUS_RTCP_TWCC_RING_SIZE) {
+		/* No feedback for a while, get rid of the oldest packets to make room */
+		guint32 base = ring->last - JANUS_RTCP_TWCC_RING_SIZE + 1;
+		if(base - ring->base >= JANUS_RTCP_TWCC_RING_SIZE) {
+			memset(ring->arrivals, 0, sizeof(ring->arrivals));
+		} else {
+			while(ring->base != base) {
+				ring->arrivals[ring->base & (JANUS_RTCP_TWCC_RING_SIZE-1)] = 0;
+				ring->base++;
+			}
+		}
+		ring->base = base;
+	}
+	ring->arrivals[ext_seq_num & (JANUS_RTCP_TWCC_RING_SIZE-1)] = timestamp;
+}
+
+/* Helper to compute the delta of a received packet from the previous one (in 250us units) */
+static int janus_rtcp_transport_wide_cc_delta(guint64 arrival, guint64 *timestamp) {
+	int delta = 0;
+	if(arrival > *timestamp)
+		delta = (arrival - *timestamp)/250;
+	else
+		delta = -(int)((*timestamp - arrival)/250);
+	*timestamp = arrival;
+	return delta;
+}
+
+/* Incremental encoder of packet status chunks: statuses are added one at a
+ * time, and a chunk is written as soon as the next status doesn't fit in it */
+typedef struct janus_rtcp_transport_wide_cc_chunk {
+	guint8 statuses[14];
+	guint size;
+	gboolean all_same, has_large;
+} janus_rtcp_transport_wide_cc_chunk;
+static gboolean janus_rtcp_transport_wide_cc_chunk_can_add(janus_rtcp_transport_wide_cc_chunk *chunk, janus_rtp_packet_status status) {
+	/* A two bit status vector can always fit 7 statuses */
+	if(chunk->size < 7)
+		return TRUE;
+	/* A one bit status vector can fit 14 of them, if none has a large delta */
+	if(chunk->size < 14 && !chunk->has_large && status != janus_rtp_packet_status_largeornegativedelta)
+		return TRUE;
+	/* A run length chunk can fit up to 8191 of them, if they're all the same */
+	if(chunk->size < 0x1FFF && chunk->all_same && chunk->statuses[0] == status)
+		return TRUE;
+	return FALSE;
+}
+static void janus_rtcp_transport_wide_cc_chunk_add(janus_rtcp_transport_wide_cc_chunk *chunk, janus_rtp_packet_status status) {
+	if(chunk->size < 14)
+		chunk->statuses[chunk->size] = status;
+	chunk->all_same = (chunk->size == 0) || (chunk->all_same && chunk->statuses[0] == status);
+	if(status == janus_rtp_packet_status_largeornegativedelta)
+		chunk->has_large = TRUE;
+	chunk->size++;
+}
+static guint32 janus_rtcp_transport_wide_cc_chunk_encode(janus_rtcp_transport_wide_cc_chunk *chunk, gboolean last) {
+	guint32 word = 0;
+	guint i = 0;
+	if(chunk->all_same) {
+		/*
+			0                   1
+			0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5
+			+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+			|T| S |       Run Length        |
+			+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+			T = 0
+		 */
+		word = janus_push_bits(word, 1, 0);
+		word = janus_push_bits(word, 2, chunk->statuses[0]);
+		word = janus_push_bits(word, 13, chunk->size);
+		chunk->size = 0;
+	} else if(chunk->size == 14 || (last && chunk->size > 7)) {
+		/*
+			0                   1
+			0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5
+			+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+			|T|S|       symbol list         |
+			+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+			T = 1
+			S = 0
+		 */
+		word = janus_push_bits(word, 1, 1);
+		word = janus_push_bits(word, 1, 0);
+		for(i=0; i<chunk->size; i++)
+			word = janus_push_bits(word, 1, chunk->statuses[i]);
+		word = janus_push_bits(word, 14-chunk->size, 0);
+		chunk->size = 0;
+	} else {
+		/*
+			0                   1
+			0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5
+			+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+			|T|S|        Symbols            |
+			+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+			T = 1
+			S = 1
+		 */
+		guint num = chunk->size < 7 ? chunk->size : 7;
+		word = janus_push_bits(word, 1, 1);
+		word = janus_push_bits(word, 1, 1);
+		for(i=0; i<num; i++)
+			word = janus_push_bits(word, 2, chunk->statuses[i]);
+		word = janus_push_bits(word, 14-num*2, 0);
+		/* Keep the statuses that didn't fit for the next chunk */
+		chunk->size -= num;
+		memmove(chunk->statuses, chunk->statuses+num, chunk->size);
+	}
+	chunk->all_same = TRUE;
+	chunk->has_large = FALSE;
+	for(i=0; i<chunk->size; i++) {
+		if(chunk->statuses[i] != chunk->statuses[0])
+			chunk->all_same = FALSE;
+		if(chunk->statuses[i] == janus_rtp_packet_status_largeornegativedelta)
+			chunk->has_large = TRUE;
+	}
+	return word;
+}
+
+int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssrc, guint32 media, guint8 feedback_packet_count,
+		janus_rtcp_transport_wide_cc_ring *ring, guint max_packets) {
+	if(packet == NULL || size < sizeof(janus_rtcp_header) + 16 || ring == NULL || max_packets == 0)
 		return -1;
+	if(!ring->started || (gint32)(ring->last - ring->base) < 0)
+		return 0;
+	guint packet_status_count = ring->last - ring->base + 1;
+	if(packet_status_count > max_packets)
+		packet_status_count = max_packets;
 
 	memset(packet, 0, size);
 	janus_rtcp_header *rtcp = (janus_rtcp_header *)packet;
@@ -1606,14 +1817,6 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 	rtcpfb->ssrc = htonl(ssrc);
 	rtcpfb->media = htonl(media);
 
-	/* Get first packet */
-	janus_rtcp_transport_wide_cc_stats *stat = (janus_rtcp_transport_wide_cc_stats *) g_queue_pop_head (transport_wide_cc_stats);
-	/* Calculate temporal info */
-	guint16 base_seq_num = stat->transport_seq_num;
-	gboolean first_received	= FALSE;
-	guint64 reference_time = 0;
-	guint packet_status_count = g_queue_get_length(transport_wide_cc_stats) + 1;
-
 	/*
 		0                   1                   2                   3
 		0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
@@ -1630,278 +1833,86 @@ int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t size, guint32 ssr
 	size_t len = sizeof(janus_rtcp_header) + 8;
 
 	/* Set header data */
-	janus_set2(data, len, base_seq_num);
+	guint32 base = ring->base;
+	janus_set2(data, len, base & 0xFFFF);
 	janus_set2(data, len+2, packet_status_count);
-	/* Set3 referenceTime when first received */
-	size_t reference_time_pos = len + 4;
+	/* The reference time is the arrival time of the first received packet */
+	guint64 reference_time = 0;
+	guint i = 0;
+	for(i=0; i<packet_status_count; i++) {
+		guint64 arrival = ring->arrivals[(base+i) & (JANUS_RTCP_TWCC_RING_SIZE-1)];
+		if(arrival) {
+			reference_time = arrival / 64000;
+			break;
+		}
+	}
+	/* (use only 23 bits of reference_time) */
+	janus_set3(data, len+4, (reference_time & 0x007FFFFF));
 	janus_set1(data, len+7, feedback_packet_count);
 
 	/* Next byte */
 	len += 8;
 
-	/* Initial time in us */
-	guint64 timestamp = 0;
-
-	/* Store delta array */
-	GQueue *deltas = g_queue_new();
-	GQueue *statuses = g_queue_new();
-	janus_rtp_packet_status last_status = janus_rtp_packet_status_reserved;
-	janus_rtp_packet_status max_status = janus_rtp_packet_status_notreceived;
-	gboolean all_same = TRUE;
-
-	/* For each packet  */
-	while (stat != NULL) {
+	/* First pass: write the packet status chunks */
+	janus_rtcp_transport_wide_cc_chunk chunk = { 0 };
+	guint64 timestamp = reference_time * 64000;
+	size_t deltas_len = 0;
+	for(i=0; i<packet_status_count; i++) {
+		guint64 arrival = ring->arrivals[(base+i) & (JANUS_RTCP_TWCC_RING_SIZE-1)];
 		janus_rtp_packet_status status = janus_rtp_packet_status_notreceived;
-
-		/* If got packet */
-		if (stat->timestamp) {
-			int delta = 0;
-			/* If first received */
-			if (!first_received) {
-				/* Got it  */
-				first_received = TRUE;
-				/* Set it */
-				reference_time = stat->timestamp / 64000;
-				/* Get initial time */
-				timestamp = reference_time * 64000;
-				/* also in buffer */
-				/* (use only 23 bits of reference_time) */
-				janus_set3(data, reference_time_pos, (reference_time & 0x007FFFFF));
-			}
-
-			/* Get delta */
-			if (stat->timestamp>timestamp)
-				delta = (stat->timestamp-timestamp)/250;
-			else
-				delta = -(int)((timestamp-stat->timestamp)/250);
-			/* If it is negative or too big */
-			if (delta<0 || delta> 255) {
-				/* Big one */
-				status = janus_rtp_packet_status_largeornegativedelta;
-			} else {
-				/* Small */
-				status = janus_rtp_packet_status_smalldelta;
-			}
-			/* Store delta */
-			/* Overflows are possible here */
-			g_queue_push_tail(deltas, GINT_TO_POINTER(delta));
-			/* Set last time */
-			timestamp = stat->timestamp;
-		}
-
-		/* Check if all previoues ones were equal and this one the first different */
-		if (all_same && last_status!=janus_rtp_packet_status_reserved && status!=last_status) {
-			/* How big was the same run */
-			if (g_queue_get_length(statuses)>7) {
-				guint32 word = 0;
-				/* Write run! */
-				/*
-					0                   1
-					0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5
-					+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-					|T| S |       Run Length        |
-					+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-					T = 0
-				 */
-				word = janus_push_bits(word, 1, 0);
-				word = janus_push_bits(word, 2, last_status);
-				word = janus_push_bits(word, 13, g_queue_get_length(statuses));
-				/* Write word */
-				janus_set2(data, len, word);
-				len += 2;
-				/* Remove all statuses */
-				g_queue_clear(statuses);
-				/* Reset status */
-				last_status = janus_rtp_packet_status_reserved;
-				max_status = janus_rtp_packet_status_notreceived;
-				all_same = TRUE;
-			} else {
-				/* Not same */
-				all_same = FALSE;
-			}
+		if(arrival) {
+			int delta = janus_rtcp_transport_wide_cc_delta(arrival, &timestamp);
+			status = (delta < 0 || delta > 255) ?
+				janus_rtp_packet_status_largeornegativedelta : janus_rtp_packet_status_smalldelta;
+			deltas_len += (status == janus_rtp_packet_status_smalldelta ? 1 : 2);
 		}
-
-		/* Push back statuses, it will be handled later */
-		g_queue_push_tail(statuses, GUINT_TO_POINTER(status));
-
-		/* If it is bigger */
-		if (status>max_status) {
-			/* Store it */
-			max_status = status;
-		}
-		/* Store las status */
-		last_status = status;
-
-		/* Check if we can still be enqueuing for a run */
-		if (!all_same) {
-			/* Check  */
-			if (!all_same && max_status==janus_rtp_packet_status_largeornegativedelta && g_queue_get_length(statuses)>6) {
-				guint32 word = 0;
-				/*
-					0                   1
-					0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5
-					+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-					|T|S|        Symbols            |
-					+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-					T = 1
-					S = 1
-				 */
-				word = janus_push_bits(word, 1, 1);
-				word = janus_push_bits(word, 1, 1);
-				/* Set next 7 */
-				size_t i = 0;
-				for (i=0;i<7;++i) {
-					/* Get status */
-					janus_rtp_packet_status status = (janus_rtp_packet_status) GPOINTER_TO_UINT(g_queue_pop_head (statuses));
-					/* Write */
-					word = janus_push_bits(word, 2, (guint8)status);
-				}
-				/* Write word */
-				janus_set2(data, len, word);
-				len += 2;
-				/* Reset */
-				last_status = janus_rtp_packet_status_reserved;
-				max_status = janus_rtp_packet_status_notreceived;
-				all_same = TRUE;
-
-				/* We need to restore the values, as there may be more elements on the buffer */
-				for (i=0; i<g_queue_get_length(statuses); ++i) {
-					/* Get status */
-					status = (janus_rtp_packet_status) GPOINTER_TO_UINT(g_queue_peek_nth(statuses, i));
-					/* If it is bigger */
-					if (status>max_status) {
-						/* Store it */
-						max_status = status;
-					}
-					//Check if it is the same */
-					if (all_same && last_status!=janus_rtp_packet_status_reserved && status!=last_status) {
-						/* Not the same */
-						all_same = FALSE;
-					}
-					/* Store las status */
-					last_status = status;
-				}
-			} else if (!all_same && g_queue_get_length(statuses)>13) {
-				guint32 word = 0;
-				/*
-					0                   1
-					0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5
-					+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-					|T|S|       symbol list         |
-					+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-					T = 1
-					S = 0
-				 */
-				word = janus_push_bits(word, 1, 1);
-				word = janus_push_bits(word, 1, 0);
-				/* Set next 7 */
-				guint32 i = 0;
-				for (i=0;i<14;++i) {
-					/* Get status */
-					janus_rtp_packet_status status = (janus_rtp_packet_status) GPOINTER_TO_UINT(g_queue_pop_head (statuses));
-					/* Write */
-					word = janus_push_bits(word, 1, (guint8)status);
-				}
-				/* Write word */
-				janus_set2(data, len, word);
-				len += 2;
-				/* Reset */
-				last_status = janus_rtp_packet_status_reserved;
-				max_status = janus_rtp_packet_status_notreceived;
-				all_same = TRUE;
-			}
-		}
-		/* Free mem */
-		g_free(stat);
-
-		/* Get next packet stat */
-		stat = (janus_rtcp_transport_wide_cc_stats *) g_queue_pop_head (transport_wide_cc_stats);
-	}
-
-	/* Get status len */
-	size_t statuses_len = g_queue_get_length(statuses);
-
-	/* If not finished yet */
-	if (statuses_len>0) {
-		/* How big was the same run */
-		if (all_same) {
-			guint32 word = 0;
-			/* Write run! */
-			word = janus_push_bits(word, 1, 0);
-			word = janus_push_bits(word, 2, last_status);
-			word = janus_push_bits(word, 13, statuses_len);
-			/* Write word */
-			janus_set2(data, len, word);
-			len += 2;
-		} else if (max_status == janus_rtp_packet_status_largeornegativedelta) {
-			guint32 word = 0;
-			/* Write chunk */
-			word = janus_push_bits(word, 1, 1);
-			word = janus_push_bits(word, 1, 1);
-			/* Write all the statuses */
-			unsigned int i = 0;
-			for (i=0;i<statuses_len;i++) {
-				/* Get each status */
-				janus_rtp_packet_status status = (janus_rtp_packet_status) GPOINTER_TO_UINT(g_queue_pop_head (statuses));
-				/* Write */
-				word = janus_push_bits(word, 2, (guint8)status);
-			}
-			/* Write pending */
-			word = janus_push_bits(word, 14-statuses_len*2, 0);
-			/* Write word */
-			janus_set2(data , len, word);
-			len += 2;
-		} else {
-			guint32 word = 0;
-			/* Write chunk */
-			word = janus_push_bits(word, 1, 1);
-			word = janus_push_bits(word, 1, 0);
-			/* Write all the statuses */
-			unsigned int i = 0;
-			for (i=0;i<statuses_len;i++) {
-				/* Get each status */
-				janus_rtp_packet_status status = (janus_rtp_packet_status) GPOINTER_TO_UINT(g_queue_pop_head (statuses));
-				/* Write */
-				word = janus_push_bits(word, 1, (guint8)status);
-			}
-			/* Write pending */
-			word = janus_push_bits(word, 14-statuses_len, 0);
-			/* Write word */
-			janus_set2(data, len, word);
+		if(!janus_rtcp_transport_wide_cc_chunk_can_add(&chunk, status)) {
+			if(len + 2 > size)
+				return -1;
+			janus_set2(data, len, janus_rtcp_transport_wide_cc_chunk_encode(&chunk, FALSE));
 			len += 2;
 		}
+		janus_rtcp_transport_wide_cc_chunk_add(&chunk, status);
 	}
+	while(chunk.size > 0) {
+		if(len + 2 > size)
+			return -1;
+		janus_set2(data, len, janus_rtcp_transport_wide_cc_chunk_encode(&chunk, TRUE));
+		len += 2;
+	}
+
+	/* Make sure the deltas (and the padding) fit too */
+	if(len + deltas_len + 3 > size)
+		return -1;
 
-	/* Write now the deltas */
-	while (!g_queue_is_empty(deltas)) {
-		/* Get next delta */
-		gint delta = GPOINTER_TO_INT(g_queue_pop_head (deltas));
-		/* Check size */
-		if (delta<0 || delta>255) {
+	/* Second pass: write the deltas, and remove the packets from the ring */
+	timestamp = reference_time * 64000;
+	for(i=0; i<packet_status_count; i++) {
+		guint64 *arrival = &ring->arrivals[(base+i) & (JANUS_RTCP_TWCC_RING_SIZE-1)];
+		if(*arrival == 0)
+			continue;
+		int delta = janus_rtcp_transport_wide_cc_delta(*arrival, &timestamp);
+		*arrival = 0;
+		if(delta < 0 || delta > 255) {
 			short reported_delta = (short)delta;
 			/* Overflow */
-			if (reported_delta != delta) {
+			if(reported_delta != delta) {
 				reported_delta = delta > 0 ? SHRT_MAX : SHRT_MIN;
 				JANUS_LOG(LOG_ERR, "Delta value (%d) too large, reporting it as %d\n", delta, reported_delta);
 			}
 			/* 2 bytes */
 			janus_set2(data, len, reported_delta);
-			/* Inc */
 			len += 2;
 		} else {
 			/* 1 byte */
 			janus_set1(data, len, (guint8)delta);
-			/* Inc */
-			len ++;
+			len++;
 		}
 	}
-
-	/* Clean mem */
-	g_queue_free(statuses);
-	g_queue_free(deltas);
+	ring->base = base + packet_status_count;
 
 	/* Add zero padding */
-	while (len%4) {
+	while(len%4) {
 		/* Add padding */
 		janus_set1(data, len++, 0);
 	}
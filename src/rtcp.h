@@ -286,15 +286,20 @@ typedef struct rtcp_context
 } rtcp_context;
 typedef rtcp_context janus_rtcp_context;
 
-/*! \brief Stores transport wide packet reception statistics */
-typedef struct rtcp_transport_wide_cc_stats
-{
-	/*! \brief Transwport wide sequence number */
-	guint32 transport_seq_num;
-	/*! \brief Reception time */
-	guint64 timestamp;
-} rtcp_transport_wide_cc_stats;
-typedef rtcp_transport_wide_cc_stats janus_rtcp_transport_wide_cc_stats;
+/*! \brief Number of packets we can track in a transport wide cc arrival ring (must be a power of 2) */
+#define JANUS_RTCP_TWCC_RING_SIZE	4096
+/*! \brief Ring of arrival times of packets, indexed by transport wide sequence number,
+ * that transport wide cc feedback is generated from */
+typedef struct janus_rtcp_transport_wide_cc_ring {
+	/*! \brief Whether we received any packet yet */
+	gboolean started;
+	/*! \brief Extended transport wide sequence number of the first packet not reported yet */
+	guint32 base;
+	/*! \brief Highest extended transport wide sequence number received so far */
+	guint32 last;
+	/*! \brief Arrival times (in us) of packets, where 0 means the packet wasn't received */
+	guint64 arrivals[JANUS_RTCP_TWCC_RING_SIZE];
+} janus_rtcp_transport_wide_cc_ring;
 
 /*! \brief Method to retrieve the estimated round-trip time from an existing RTCP context
  * @param[in] ctx The RTCP context to query
@@ -411,6 +416,51 @@ int janus_rtcp_fix_ssrc(janus_rtcp_context *ctx, char *packet, int len, int fixs
  * @param[in,out] newlen The data length of the filtered RTCP message
  * @returns A pointer to the new RTCP message data, NULL in case all messages have been filtered out */
 char *janus_rtcp_filter(char *packet, int len, int *newlen);
+/*! \brief Method to filter an outgoing RTCP message in place
+ * \note Same as janus_rtcp_filter, but rather than allocating a new buffer
+ * for the messages to keep, they're moved towards the start of the existing one
+ * @param[in,out] packet The message data, that will be rewritten
+ * @param[in] len The message data length in bytes
+ * @returns The data length of the filtered RTCP message (0 if all messages
+ * have been filtered out), or -1 if the message is invalid */
+int janus_rtcp_filter_inplace(char *packet, int len);
+
+/*! \brief Helper to assemble compound RTCP packets in a buffer that's been allocated already
+ * \note The struct only keeps track of how much of the buffer has been used
+ * so far: messages are written in the buffer itself, by the methods that
+ * create them (e.g., janus_rtcp_pli), using the space the builder reserves */
+typedef struct janus_rtcp_compound {
+	/*! \brief Buffer the compound packet is being assembled in */
+	char *buffer;
+	/*! \brief Size of the buffer */
+	int size;
+	/*! \brief Length of the compound packet so far */
+	int length;
+} janus_rtcp_compound;
+/*! \brief Method to start assembling a new compound RTCP packet
+ * @param[in] compound The compound builder to initialize
+ * @param[in] buffer The buffer to assemble the packet in
+ * @param[in] size The size of the buffer */
+void janus_rtcp_compound_init(janus_rtcp_compound *compound, char *buffer, int size);
+/*! \brief Method to reserve space for a new message at the end of a compound RTCP packet
+ * \note The space is zeroed, and counted in the compound length right away
+ * @param[in] compound The compound builder
+ * @param[in] len The size of the message to add, in bytes (must be a multiple of 4)
+ * @returns A pointer to where the message can be written, or NULL if there's not enough room */
+char *janus_rtcp_compound_reserve(janus_rtcp_compound *compound, int len);
+/*! \brief Method to get how much room is left at the end of a compound RTCP packet
+ * \note Useful for messages whose size is only known after creating them
+ * (e.g., transport-wide CC feedback): once written, they can be accounted
+ * for with janus_rtcp_compound_commit
+ * @param[in] compound The compound builder
+ * @param[out] available How many bytes can still be written
+ * @returns A pointer to the end of the compound packet so far */
+char *janus_rtcp_compound_tail(janus_rtcp_compound *compound, int *available);
+/*! \brief Method to account for a message written at the end of a compound RTCP packet
+ * @param[in] compound The compound builder
+ * @param[in] len The size of the message that was written at the tail
+ * @returns 0 in case of success, -1 on errors */
+int janus_rtcp_compound_commit(janus_rtcp_compound *compound, int len);
 
 /*! \brief Method to quickly process the header of an incoming RTP packet to update the associated RTCP context
  * @param[in] ctx RTCP context to update, if needed (optional)
@@ -419,11 +469,11 @@ char *janus_rtcp_filter(char *packet, int len, int *newlen);
  * @param[in] rfc4588_pkt True if this is a RTX packet
  * @param[in] rfc4588_enabled True if this packet comes from a RTX enabled stream
  * @param[in] retransmissions_disabled True if retransmissions are not supported at all for this stream
- * @param[in] clock_rates Mapping between payload types and clock rates, if available
+ * @param[in] clock_rates Clock rates indexed by payload type (128 values, 0 if unknown), if available
  * @returns 0 in case of success, -1 on errors */
 int janus_rtcp_process_incoming_rtp(janus_rtcp_context *ctx, char *packet, int len,
 	gboolean rfc4588_pkt, gboolean rfc4588_enabled, gboolean retransmissions_disabled,
-	GHashTable *clock_rates);
+	const uint32_t *clock_rates);
 
 /*! \brief Method to fill in a Report Block in a Receiver Report
  * @param[in] ctx The RTCP context to use for the report
@@ -465,6 +515,20 @@ void janus_rtcp_get_nacks(char *packet, int len, GQueue *nacks_queue);
  * have been handled. */
 int janus_rtcp_remove_nacks(char *packet, int len);
 
+/*! \brief Callback invoked for each packet reported in a transport wide cc feedback
+ * @param[in] seq The transport wide sequence number of the packet
+ * @param[in] received Whether the packet was received or not
+ * @param[in] arrival If received, when the packet arrived (in us, relative to an arbitrary reference)
+ * @param[in] user_data The opaque pointer passed to janus_rtcp_get_transport_wide_cc */
+typedef void (*janus_rtcp_transport_wide_cc_callback)(uint16_t seq, gboolean received, int64_t arrival, void *user_data);
+/*! \brief Inspect an RTCP message for transport wide cc feedback, and report each packet it covers
+ * @param[in] packet The message data
+ * @param[in] len The message data length in bytes
+ * @param[in] callback The function to invoke for each reported packet, in order
+ * @param[in] user_data An opaque pointer to pass to the callback
+ * @returns The number of reported packets, 0 if no transport wide cc feedback was available */
+int janus_rtcp_get_transport_wide_cc(char *packet, int len, janus_rtcp_transport_wide_cc_callback callback, void *user_data);
+
 /*! \brief Inspect an existing RTCP REMB message to retrieve the reported bitrate
  * @param[in] packet The message data
  * @param[in] len The message data length in bytes
@@ -529,14 +593,26 @@ int janus_rtcp_pli(char *packet, int len);
  * @returns The message data length in bytes, if successful, -1 on errors */
 int janus_rtcp_nacks(char *packet, int len, GSList *nacks);
 
+/*! \brief Method to track the arrival time of a packet in a transport wide cc ring
+ * @note Packets that arrive after they've already been reported as lost are ignored,
+ * and if the ring is full the oldest packets are dropped without being reported
+ * @param[in] ring The janus_rtcp_transport_wide_cc_ring instance to update
+ * @param[in] transport_seq_num The transport wide sequence number of the packet
+ * @param[in] timestamp The arrival time of the packet (in us) */
+void janus_rtcp_transport_wide_cc_ring_add(janus_rtcp_transport_wide_cc_ring *ring, guint16 transport_seq_num, guint64 timestamp);
 /*! \brief Method to generate a new RTCP transport wide message to report reception stats
+ * @note The message is built in place out of the packets tracked in the ring,
+ * which are then removed from it: in case there are more packets to report
+ * than max_packets, the method can be called again to generate more messages
  * @param[in] packet The buffer data (MUST be at least 16 chars)
  * @param[in] len The message data length in bytes
  * @param[in] ssrc SSRC of the origin stream
  * @param[in] media SSRC of the destination stream
  * @param[in] feedback_packet_count Feedback paccket count
- * @param[in] transport_wide_cc_stats List of rtp packet reception stats
- * @returns The message data length in bytes, if successful, -1 on errors */
-int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t len, guint32 ssrc, guint32 media, guint8 feedback_packet_count, GQueue *transport_wide_cc_stats);
+ * @param[in] ring The janus_rtcp_transport_wide_cc_ring instance to report packets from
+ * @param[in] max_packets The maximum number of packets to report in this message
+ * @returns The message data length in bytes, if successful, 0 if there was nothing to report, -1 on errors */
+int janus_rtcp_transport_wide_cc_feedback(char *packet, size_t len, guint32 ssrc, guint32 media, guint8 feedback_packet_count,
+	janus_rtcp_transport_wide_cc_ring *ring, guint max_packets);
 
 #endif
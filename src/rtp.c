@@ -787,7 +787,7 @@ void janus_rtp_header_update(janus_rtp_header *header, janus_rtp_switching_conte
 		context->base_ts = timestamp;
 		/* How much time since the last audio RTP packet? We compute an offset accordingly */
 		if(context->last_time > 0) {
-			gint64 time_diff = janus_get_monotonic_time() - context->last_time;
+			gint64 time_diff = janus_get_cached_monotonic_time() - context->last_time;
 			/* We're assuming 90khz for video and 48khz for audio, here */
 			int khz = video ? 90 : 48;
 			if(!video && (header->type == 0 || header->type == 8 || header->type == 9))
@@ -816,7 +816,7 @@ void janus_rtp_header_update(janus_rtp_header *header, janus_rtp_switching_conte
 	header->timestamp = htonl(context->last_ts);
 	header->seq_number = htons(context->last_seq);
 	/* Take note of when we last handled this RTP packet */
-	context->last_time = janus_get_monotonic_time();
+	context->last_time = janus_get_cached_monotonic_time();
 }
 
 
@@ -1065,6 +1065,7 @@ void janus_rtp_simulcasting_context_reset(janus_rtp_simulcasting_context *contex
 	context->rid_ext_id = -1;
 	context->substream = -1;
 	context->substream_target_temp = -1;
+	context->substream_cap = -1;
 	context->templayer = -1;
 }
 
@@ -1118,13 +1119,19 @@ void janus_rtp_simulcasting_cleanup(int *rid_ext_id, uint32_t *ssrcs, char **rid
 		janus_mutex_unlock(rid_mutex);
 }
 
-gboolean janus_rtp_simulcasting_context_process_rtp(janus_rtp_simulcasting_context *context,
-		char *buf, int len, uint8_t *dd_content, int dd_len, uint32_t *ssrcs, char **rids,
-		janus_videocodec vcodec, janus_rtp_switching_context *sc, janus_mutex *rid_mutex) {
-	if(!context || !buf || len < 1)
+gboolean janus_rtp_simulcasting_classify(janus_rtp_simulcasting_packet *packet,
+		char *buf, int len, int rid_ext_id, uint32_t *ssrcs, char **rids,
+		janus_videocodec vcodec, janus_mutex *rid_mutex) {
+	if(!packet)
+		return FALSE;
+	memset(packet, 0, sizeof(*packet));
+	packet->substream = -1;
+	packet->temporal = -1;
+	if(!buf || len < 1)
 		return FALSE;
 	janus_rtp_header *header = (janus_rtp_header *)buf;
 	uint32_t ssrc = ntohl(header->ssrc);
+	packet->ssrc = ssrc;
 	int substream = -1;
 	if(ssrc == *(ssrcs)) {
 		substream = 0;
@@ -1134,10 +1141,10 @@ gboolean janus_rtp_simulcasting_context_process_rtp(janus_rtp_simulcasting_conte
 		substream = 2;
 	} else {
 		/* We don't recognize this SSRC, check if rid can help us */
-		if(context->rid_ext_id < 1 || rids == NULL)
+		if(rid_ext_id < 1 || rids == NULL)
 			return FALSE;
 		char sdes_item[16];
-		if(janus_rtp_header_extension_parse_rid(buf, len, context->rid_ext_id, sdes_item, sizeof(sdes_item)) != 0)
+		if(janus_rtp_header_extension_parse_rid(buf, len, rid_ext_id, sdes_item, sizeof(sdes_item)) != 0)
 			return FALSE;
 		if(rid_mutex != NULL)
 			janus_mutex_lock(rid_mutex);
@@ -1161,16 +1168,61 @@ gboolean janus_rtp_simulcasting_context_process_rtp(janus_rtp_simulcasting_conte
 			return FALSE;
 		}
 	}
-	/* Reset the flags */
-	context->changed_substream = FALSE;
-	context->changed_temporal = FALSE;
-	context->need_pli = FALSE;
-	gint64 now = janus_get_monotonic_time();
+	packet->substream = substream;
+	packet->vcodec = vcodec;
 	/* Access the packet payload */
 	int plen = 0;
 	char *payload = janus_rtp_payload(buf, len, &plen);
 	if(payload == NULL)
 		return FALSE;
+	packet->has_payload = TRUE;
+	packet->keyframe = (vcodec == JANUS_VIDEOCODEC_VP8 && janus_vp8_is_keyframe(payload, plen)) ||
+		(vcodec == JANUS_VIDEOCODEC_VP9 && janus_vp9_is_keyframe(payload, plen)) ||
+		(vcodec == JANUS_VIDEOCODEC_H264 && janus_h264_is_keyframe(payload, plen)) ||
+		(vcodec == JANUS_VIDEOCODEC_AV1 && janus_av1_is_keyframe(payload, plen)) ||
+		(vcodec == JANUS_VIDEOCODEC_H265 && janus_h265_is_keyframe(payload, plen));
+	/* Temporal layers are only easily available for some codecs */
+	if(vcodec == JANUS_VIDEOCODEC_VP8) {
+		/* Check if there's any temporal scalability to take into account */
+		gboolean m = FALSE;
+		uint16_t picid = 0;
+		uint8_t tlzi = 0;
+		uint8_t tid = 0;
+		uint8_t ybit = 0;
+		uint8_t keyidx = 0;
+		if(janus_vp8_parse_descriptor(payload, plen, &m, &picid, &tlzi, &tid, &ybit, &keyidx) == 0) {
+			packet->has_temporal = TRUE;
+			packet->temporal = tid;
+		}
+	} else if(vcodec == JANUS_VIDEOCODEC_VP9) {
+		/* We use the VP9 SVC parser to extract info on temporal layers */
+		gboolean found = FALSE;
+		janus_vp9_svc_info svc_info = { 0 };
+		if(janus_vp9_parse_svc(payload, plen, &found, &svc_info) == 0 && found) {
+			packet->has_temporal = TRUE;
+			packet->temporal = svc_info.temporal_layer;
+			packet->ubit = svc_info.ubit;
+			packet->bbit = svc_info.bbit;
+			packet->ebit = svc_info.ebit;
+		}
+	}
+	return TRUE;
+}
+
+gboolean janus_rtp_simulcasting_context_process_packet(janus_rtp_simulcasting_context *context,
+		const janus_rtp_simulcasting_packet *packet, uint8_t *dd_content, int dd_len,
+		janus_rtp_switching_context *sc) {
+	if(!context || !packet || packet->substream == -1)
+		return FALSE;
+	int substream = packet->substream;
+	janus_videocodec vcodec = packet->vcodec;
+	/* Reset the flags */
+	context->changed_substream = FALSE;
+	context->changed_temporal = FALSE;
+	context->need_pli = FALSE;
+	gint64 now = janus_get_cached_monotonic_time();
+	if(!packet->has_payload)
+		return FALSE;
 	/* Check what's our target */
 	if(context->substream_target_temp != -1 && (substream > context->substream_target_temp ||
 			context->substream_target <= context->substream_target_temp)) {
@@ -1180,13 +1232,13 @@ gboolean janus_rtp_simulcasting_context_process_rtp(janus_rtp_simulcasting_conte
 		context->substream_target_temp = -1;
 	}
 	int target = (context->substream_target_temp == -1) ? context->substream_target : context->substream_target_temp;
+	if(context->substream_cap > -1 && target > context->substream_cap) {
+		/* We've been asked not to go higher than this (e.g., because of bandwidth estimation) */
+		target = context->substream_cap;
+	}
 	/* Check what we need to do with the packet */
 	if(context->substream == -1) {
-		if((vcodec == JANUS_VIDEOCODEC_VP8 && janus_vp8_is_keyframe(payload, plen)) ||
-				(vcodec == JANUS_VIDEOCODEC_VP9 && janus_vp9_is_keyframe(payload, plen)) ||
-				(vcodec == JANUS_VIDEOCODEC_H264 && janus_h264_is_keyframe(payload, plen)) ||
-				(vcodec == JANUS_VIDEOCODEC_AV1 && janus_av1_is_keyframe(payload, plen)) ||
-				(vcodec == JANUS_VIDEOCODEC_H265 && janus_h265_is_keyframe(payload, plen))) {
+		if(packet->keyframe) {
 			context->substream = substream;
 			/* Notify the caller that the substream changed */
 			context->changed_substream = TRUE;
@@ -1198,14 +1250,9 @@ gboolean janus_rtp_simulcasting_context_process_rtp(janus_rtp_simulcasting_conte
 	} else if(context->substream != target) {
 		/* We're not on the substream we'd like: let's wait for a keyframe on the target */
 		if(((context->substream < target && substream > context->substream) ||
-				(context->substream > target && substream < context->substream)) &&
-					((vcodec == JANUS_VIDEOCODEC_VP8 && janus_vp8_is_keyframe(payload, plen)) ||
-					(vcodec == JANUS_VIDEOCODEC_VP9 && janus_vp9_is_keyframe(payload, plen)) ||
-					(vcodec == JANUS_VIDEOCODEC_H264 && janus_h264_is_keyframe(payload, plen)) ||
-					(vcodec == JANUS_VIDEOCODEC_AV1 && janus_av1_is_keyframe(payload, plen)) ||
-					(vcodec == JANUS_VIDEOCODEC_H265 && janus_h265_is_keyframe(payload, plen)))) {
-			JANUS_LOG(LOG_VERB, "Received keyframe on #%d (SSRC %"SCNu32"), switching (was #%d/%"SCNu32")\n",
-				substream, ssrc, context->substream, *(ssrcs + context->substream));
+				(context->substream > target && substream < context->substream)) && packet->keyframe) {
+			JANUS_LOG(LOG_VERB, "Received keyframe on #%d (SSRC %"SCNu32"), switching (was #%d)\n",
+				substream, packet->ssrc, context->substream);
 			context->substream = substream;
 			/* Notify the caller that the substream changed */
 			context->changed_substream = TRUE;
@@ -1244,67 +1291,53 @@ gboolean janus_rtp_simulcasting_context_process_rtp(janus_rtp_simulcasting_conte
 	if(context->substream < 0)
 		return FALSE;
 	if(substream != context->substream) {
-		JANUS_LOG(LOG_HUGE, "Dropping packet (it's from SSRC %"SCNu32", but we're only relaying SSRC %"SCNu32" now\n",
-			ssrc, *(ssrcs + context->substream));
+		JANUS_LOG(LOG_HUGE, "Dropping packet (it's from SSRC %"SCNu32", but we're only relaying substream #%d now\n",
+			packet->ssrc, context->substream);
 		return FALSE;
 	}
-	context->last_relayed = janus_get_monotonic_time();
+	context->last_relayed = now;
 	/* Temporal layers are only easily available for some codecs */
-	if(vcodec == JANUS_VIDEOCODEC_VP8) {
-		/* Check if there's any temporal scalability to take into account */
-		gboolean m = FALSE;
-		uint16_t picid = 0;
-		uint8_t tlzi = 0;
-		uint8_t tid = 0;
-		uint8_t ybit = 0;
-		uint8_t keyidx = 0;
-		if(janus_vp8_parse_descriptor(payload, plen, &m, &picid, &tlzi, &tid, &ybit, &keyidx) == 0) {
-			//~ JANUS_LOG(LOG_WARN, "%"SCNu16", %u, %u, %u, %u\n", picid, tlzi, tid, ybit, keyidx);
-			if(context->templayer != context->templayer_target && tid == context->templayer_target) {
-				/* FIXME We should be smarter in deciding when to switch */
-				context->templayer = context->templayer_target;
-				/* Notify the caller that the temporal layer changed */
+	if(vcodec == JANUS_VIDEOCODEC_VP8 && packet->has_temporal) {
+		int tid = packet->temporal;
+		if(context->templayer != context->templayer_target && tid == context->templayer_target) {
+			/* FIXME We should be smarter in deciding when to switch */
+			context->templayer = context->templayer_target;
+			/* Notify the caller that the temporal layer changed */
+			context->changed_temporal = TRUE;
+		}
+		if(context->templayer != -1 && tid > context->templayer) {
+			JANUS_LOG(LOG_HUGE, "Dropping packet (it's temporal layer %d, but we're capping at %d)\n",
+				tid, context->templayer);
+			/* We increase the base sequence number, or there will be gaps when delivering later */
+			if(sc)
+				sc->base_seq++;
+			return FALSE;
+		}
+	} else if(vcodec == JANUS_VIDEOCODEC_VP9 && packet->has_temporal) {
+		int temporal_layer = context->templayer;
+		if(context->templayer_target > context->templayer) {
+			/* We need to upscale */
+			if(packet->ubit && packet->bbit &&
+					packet->temporal > context->templayer &&
+					packet->temporal <= context->templayer_target) {
+				context->templayer = packet->temporal;
+				temporal_layer = context->templayer;
 				context->changed_temporal = TRUE;
 			}
-			if(context->templayer != -1 && tid > context->templayer) {
-				JANUS_LOG(LOG_HUGE, "Dropping packet (it's temporal layer %d, but we're capping at %d)\n",
-					tid, context->templayer);
-				/* We increase the base sequence number, or there will be gaps when delivering later */
-				if(sc)
-					sc->base_seq++;
-				return FALSE;
+		} else if(context->templayer_target < context->templayer) {
+			/* We need to downscale */
+			if(packet->ebit && packet->temporal == context->templayer_target) {
+				context->templayer = context->templayer_target;
+				context->changed_temporal = TRUE;
 			}
 		}
-	} else if(vcodec == JANUS_VIDEOCODEC_VP9) {
-		/* We use the VP9 SVC parser to extract info on temporal layers */
-		gboolean found = FALSE;
-		janus_vp9_svc_info svc_info = { 0 };
-		if(janus_vp9_parse_svc(payload, plen, &found, &svc_info) == 0 && found) {
-			int temporal_layer = context->templayer;
-			if(context->templayer_target > context->templayer) {
-				/* We need to upscale */
-				if(svc_info.ubit && svc_info.bbit &&
-						svc_info.temporal_layer > context->templayer &&
-						svc_info.temporal_layer <= context->templayer_target) {
-					context->templayer = svc_info.temporal_layer;
-					temporal_layer = context->templayer;
-					context->changed_temporal = TRUE;
-				}
-			} else if(context->templayer_target < context->templayer) {
-				/* We need to downscale */
-				if(svc_info.ebit && svc_info.temporal_layer == context->templayer_target) {
-					context->templayer = context->templayer_target;
-					context->changed_temporal = TRUE;
-				}
-			}
-			if(temporal_layer < svc_info.temporal_layer) {
-				JANUS_LOG(LOG_HUGE, "Dropping packet (it's temporal layer %d, but we're capping at %d)\n",
-					svc_info.temporal_layer, context->templayer);
-				/* We increase the base sequence number, or there will be gaps when delivering later */
-				if(sc)
-					sc->base_seq++;
-				return FALSE;
-			}
+		if(temporal_layer < packet->temporal) {
+			JANUS_LOG(LOG_HUGE, "Dropping packet (it's temporal layer %d, but we're capping at %d)\n",
+				packet->temporal, context->templayer);
+			/* We increase the base sequence number, or there will be gaps when delivering later */
+			if(sc)
+				sc->base_seq++;
+			return FALSE;
 		}
 	} else if(vcodec == JANUS_VIDEOCODEC_AV1 && dd_content != NULL && dd_len > 0) {
 		/* Use the Dependency Descriptor to check temporal layers */
@@ -1347,6 +1380,16 @@ gboolean janus_rtp_simulcasting_context_process_rtp(janus_rtp_simulcasting_conte
 	return TRUE;
 }
 
+gboolean janus_rtp_simulcasting_context_process_rtp(janus_rtp_simulcasting_context *context,
+		char *buf, int len, uint8_t *dd_content, int dd_len, uint32_t *ssrcs, char **rids,
+		janus_videocodec vcodec, janus_rtp_switching_context *sc, janus_mutex *rid_mutex) {
+	if(!context || !buf || len < 1)
+		return FALSE;
+	janus_rtp_simulcasting_packet packet;
+	janus_rtp_simulcasting_classify(&packet, buf, len, context->rid_ext_id, ssrcs, rids, vcodec, rid_mutex);
+	return janus_rtp_simulcasting_context_process_packet(context, &packet, dd_content, dd_len, sc);
+}
+
 /* VP9 SVC */
 void janus_rtp_svc_context_reset(janus_rtp_svc_context *context) {
 	if(context == NULL)
@@ -1355,6 +1398,7 @@ void janus_rtp_svc_context_reset(janus_rtp_svc_context *context) {
 	janus_av1_svc_context_reset(&context->dd_context);
 	memset(context, 0, sizeof(*context));
 	context->spatial = -1;
+	context->spatial_cap = -1;
 	context->temporal = -1;
 }
 
@@ -1368,7 +1412,11 @@ gboolean janus_rtp_svc_context_process_rtp(janus_rtp_svc_context *context,
 	context->changed_spatial = FALSE;
 	context->changed_temporal = FALSE;
 	context->need_pli = FALSE;
-	gint64 now = janus_get_monotonic_time();
+	gint64 now = janus_get_cached_monotonic_time();
+	/* Check if we've been asked not to go higher than a specific layer (e.g., because of bandwidth estimation) */
+	int spatial_target = context->spatial_target;
+	if(context->spatial_cap > -1 && spatial_target > context->spatial_cap)
+		spatial_target = context->spatial_cap;
 	/* Access the packet payload */
 	int plen = 0;
 	char *payload = janus_rtp_payload(buf, len, &plen);
@@ -1376,33 +1424,44 @@ gboolean janus_rtp_svc_context_process_rtp(janus_rtp_svc_context *context,
 		return FALSE;
 	/* Check if we should use the Dependency Descriptor */
 	if(vcodec == JANUS_VIDEOCODEC_AV1) {
-		/* We do, make sure the data is there */
-		if(dd_content == NULL || dd_len < 1) {
-			/* No Dependency Descriptor, relay as it is */
-			return TRUE;
-		}
-		uint8_t template = 0, ebit = 0;
-		if(!janus_av1_svc_context_process_dd(&context->dd_context, dd_content, dd_len, &template, &ebit)) {
-			/* We couldn't parse the Dependency Descriptor, relay as it is */
-			return TRUE;
-		}
-		janus_av1_svc_template *t = g_hash_table_lookup(context->dd_context.templates, GUINT_TO_POINTER(template));
-		if(t == NULL) {
-			/* We couldn't find the template, relay as it is */
-			return TRUE;
+		int t_spatial = 0, t_temporal = 0;
+		uint8_t ebit = 0;
+		if(info != NULL) {
+			/* The caller parsed the Dependency Descriptor already */
+			t_spatial = info->spatial_layer;
+			t_temporal = info->temporal_layer;
+			ebit = info->ebit;
+		} else {
+			/* We do, make sure the data is there */
+			if(dd_content == NULL || dd_len < 1) {
+				/* No Dependency Descriptor, relay as it is */
+				return TRUE;
+			}
+			uint8_t template = 0;
+			if(!janus_av1_svc_context_process_dd(&context->dd_context, dd_content, dd_len, &template, &ebit)) {
+				/* We couldn't parse the Dependency Descriptor, relay as it is */
+				return TRUE;
+			}
+			janus_av1_svc_template *t = g_hash_table_lookup(context->dd_context.templates, GUINT_TO_POINTER(template));
+			if(t == NULL) {
+				/* We couldn't find the template, relay as it is */
+				return TRUE;
+			}
+			t_spatial = t->spatial;
+			t_temporal = t->temporal;
 		}
 		/* Now let's check if we should let the packet through or not */
 		gboolean keyframe = janus_av1_is_keyframe((const char *)payload, plen);
 		gboolean override_mark_bit = FALSE, has_marker_bit = header->markerbit;
 		int spatial_layer = context->spatial;
-		if(t->spatial >= 0 && t->spatial <= 2)
-			context->last_spatial_layer[t->spatial] = now;
-		if(context->spatial_target > context->spatial) {
+		if(t_spatial >= 0 && t_spatial <= 2)
+			context->last_spatial_layer[t_spatial] = now;
+		if(spatial_target > context->spatial) {
 			JANUS_LOG(LOG_HUGE, "We need to upscale spatially: (%d < %d)\n",
-				context->spatial, context->spatial_target);
+				context->spatial, spatial_target);
 			/* We need to upscale: wait for a keyframe */
 			if(keyframe) {
-				int new_spatial_layer = context->spatial_target;
+				int new_spatial_layer = spatial_target;
 				while(new_spatial_layer > context->spatial && new_spatial_layer > 0) {
 					if(now - context->last_spatial_layer[new_spatial_layer] >= (context->drop_trigger ? context->drop_trigger : 250000)) {
 						/* We haven't received packets from this layer for a while, try a lower layer */
@@ -1415,52 +1474,52 @@ gboolean janus_rtp_svc_context_process_rtp(janus_rtp_svc_context *context,
 				}
 				if(new_spatial_layer > context->spatial) {
 					JANUS_LOG(LOG_HUGE, "  -- Upscaling spatial layer: %d --> %d (need %d)\n",
-						context->spatial, new_spatial_layer, context->spatial_target);
+						context->spatial, new_spatial_layer, spatial_target);
 					context->spatial = new_spatial_layer;
 					spatial_layer = context->spatial;
 					context->changed_spatial = TRUE;
 				}
 			}
-		} else if(context->spatial_target < context->spatial) {
+		} else if(spatial_target < context->spatial) {
 			/* We need to scale: wait for a keyframe */
 			JANUS_LOG(LOG_HUGE, "We need to downscale spatially: (%d > %d)\n",
-				context->spatial, context->spatial_target);
+				context->spatial, spatial_target);
 			/* Check the E bit to see if this is an end-of-frame */
 			if(ebit) {
 				JANUS_LOG(LOG_HUGE, "  -- Downscaling spatial layer: %d --> %d\n",
-					context->spatial, context->spatial_target);
-				context->spatial = context->spatial_target;
+					context->spatial, spatial_target);
+				context->spatial = spatial_target;
 				context->changed_spatial = TRUE;
 			}
 		}
-		if(spatial_layer < t->spatial) {
+		if(spatial_layer < t_spatial) {
 			/* Drop the packet: update the context to make sure sequence number is increased normally later */
-			JANUS_LOG(LOG_HUGE, "Dropping packet (spatial layer %d < %d)\n", spatial_layer, t->spatial);
+			JANUS_LOG(LOG_HUGE, "Dropping packet (spatial layer %d < %d)\n", spatial_layer, t_spatial);
 			if(sc)
 				sc->base_seq++;
 			return FALSE;
-		} else if(ebit && spatial_layer == t->spatial) {
+		} else if(ebit && spatial_layer == t_spatial) {
 			/* If we stop at layer 0, we need a marker bit now, as the one from layer 1 will not be received */
 			override_mark_bit = TRUE;
 		}
 		int temporal = context->temporal;
 		if(context->temporal_target > context->temporal) {
 			/* We need to upscale */
-			if(t->temporal > context->temporal && t->temporal <= context->temporal_target) {
-				context->temporal = t->temporal;
+			if(t_temporal > context->temporal && t_temporal <= context->temporal_target) {
+				context->temporal = t_temporal;
 				temporal = context->temporal;
 				context->changed_temporal = TRUE;
 			}
 		} else if(context->temporal_target < context->temporal) {
 			/* We need to downscale */
-			if(t->temporal == context->temporal_target) {
+			if(t_temporal == context->temporal_target) {
 				context->temporal = context->temporal_target;
 				context->changed_temporal = TRUE;
 			}
 		}
-		if(temporal < t->temporal) {
+		if(temporal < t_temporal) {
 			JANUS_LOG(LOG_HUGE, "Dropping packet (it's temporal layer %d, but we're capping at %d)\n",
-				t->temporal, context->temporal);
+				t_temporal, context->temporal);
 			/* We increase the base sequence number, or there will be gaps when delivering later */
 			if(sc)
 				sc->base_seq++;
@@ -1469,7 +1528,7 @@ gboolean janus_rtp_svc_context_process_rtp(janus_rtp_svc_context *context,
 		/* If we got here, we can send the frame: this doesn't necessarily mean it's
 		 * one of the layers the user wants, as there may be dependencies involved */
 		JANUS_LOG(LOG_HUGE, "Sending packet (spatial=%d, temporal=%d)\n",
-			t->spatial, t->temporal);
+			t_spatial, t_temporal);
 		if(override_mark_bit && !has_marker_bit)
 			header->markerbit = 1;
 		return TRUE;
@@ -1497,12 +1556,12 @@ gboolean janus_rtp_svc_context_process_rtp(janus_rtp_svc_context *context,
 	int spatial_layer = context->spatial;
 	if(svc_info.spatial_layer >= 0 && svc_info.spatial_layer <= 2)
 		context->last_spatial_layer[svc_info.spatial_layer] = now;
-	if(context->spatial_target > context->spatial) {
+	if(spatial_target > context->spatial) {
 		JANUS_LOG(LOG_HUGE, "We need to upscale spatially: (%d < %d)\n",
-			context->spatial, context->spatial_target);
+			context->spatial, spatial_target);
 		/* We need to upscale: wait for a keyframe */
 		if(keyframe) {
-			int new_spatial_layer = context->spatial_target;
+			int new_spatial_layer = spatial_target;
 			while(new_spatial_layer > context->spatial && new_spatial_layer > 0) {
 				if(now - context->last_spatial_layer[new_spatial_layer] >= (context->drop_trigger ? context->drop_trigger : 250000)) {
 					/* We haven't received packets from this layer for a while, try a lower layer */
@@ -1515,16 +1574,16 @@ gboolean janus_rtp_svc_context_process_rtp(janus_rtp_svc_context *context,
 			}
 			if(new_spatial_layer > context->spatial) {
 				JANUS_LOG(LOG_HUGE, "  -- Upscaling spatial layer: %d --> %d (need %d)\n",
-					context->spatial, new_spatial_layer, context->spatial_target);
+					context->spatial, new_spatial_layer, spatial_target);
 				context->spatial = new_spatial_layer;
 				spatial_layer = context->spatial;
 				context->changed_spatial = TRUE;
 			}
 		}
-	} else if(context->spatial_target < context->spatial) {
+	} else if(spatial_target < context->spatial) {
 		/* We need to downscale */
 		JANUS_LOG(LOG_HUGE, "We need to downscale spatially: (%d > %d)\n",
-			context->spatial, context->spatial_target);
+			context->spatial, spatial_target);
 		gboolean downscaled = FALSE;
 		if(!svc_info.fbit && keyframe) {
 			/* Non-flexible mode: wait for a keyframe */
@@ -1535,8 +1594,8 @@ gboolean janus_rtp_svc_context_process_rtp(janus_rtp_svc_context *context,
 		}
 		if(downscaled) {
 			JANUS_LOG(LOG_HUGE, "  -- Downscaling spatial layer: %d --> %d\n",
-				context->spatial, context->spatial_target);
-			context->spatial = context->spatial_target;
+				context->spatial, spatial_target);
+			context->spatial = spatial_target;
 			context->changed_spatial = TRUE;
 		}
 	}
@@ -392,6 +392,8 @@ typedef struct janus_rtp_simulcasting_context {
 	int substream;
 	/*! \brief As above, but to handle transitions (e.g., wait for keyframe, or get this if available) */
 	int substream_target, substream_target_temp;
+	/*! \brief Highest substream we can forward, no matter the target (e.g., because of bandwidth estimation), or -1 for no cap */
+	int substream_cap;
 	/*! \brief Which simulcast temporal layer we should forward back */
 	int templayer;
 	/*! \brief As above, but to handle transitions (e.g., wait for keyframe) */
@@ -428,8 +430,60 @@ void janus_rtp_simulcasting_prepare(json_t *simulcast, int *rid_ext_id, uint32_t
  * @param[in] rid_mutex A mutex that must be acquired before cleaning up, if any */
 void janus_rtp_simulcasting_cleanup(int *rid_ext_id, uint32_t *ssrcs, char **rids, janus_mutex *rid_mutex);
 
+/*! \brief Info on a simulcast RTP packet that doesn't depend on who it's relayed to
+ * \details When the same packet is processed for many recipients, use
+ * janus_rtp_simulcasting_classify to fill this once per packet, and then
+ * janus_rtp_simulcasting_context_process_packet for each recipient, so
+ * that SSRCs/rids are matched and the payload is inspected only once */
+typedef struct janus_rtp_simulcasting_packet {
+	/*! \brief SSRC of the packet */
+	uint32_t ssrc;
+	/*! \brief Substream the packet belongs to, or -1 if unknown */
+	int substream;
+	/*! \brief Video codec of the RTP payload */
+	janus_videocodec vcodec;
+	/*! \brief Whether the packet has a payload we could inspect */
+	gboolean has_payload;
+	/*! \brief Whether the packet is (the start of) a keyframe */
+	gboolean keyframe;
+	/*! \brief Whether temporal layer info was found in the payload (VP8 and VP9 only) */
+	gboolean has_temporal;
+	/*! \brief Temporal layer of the packet, if known */
+	int temporal;
+	/*! \brief VP9 only: switching up point, start and end of frame bits */
+	gboolean ubit, bbit, ebit;
+} janus_rtp_simulcasting_packet;
+
+/*! \brief Classify a simulcast RTP packet, independently of who it will be relayed to
+ * @param[out] packet The janus_rtp_simulcasting_packet instance to fill
+ * @param[in] buf The RTP packet to classify
+ * @param[in] len The length of the RTP packet (header, extension and payload)
+ * @param[in] rid_ext_id The RTP Stream extension ID, if any (-1 otherwise)
+ * @param[in] ssrcs The simulcast SSRCs to refer to (may be updated if rids are involved)
+ * @param[in] rids The simulcast rids to refer to, if any
+ * @param[in] vcodec Video codec of the RTP payload
+ * @param[in] rid_mutex A mutex that must be acquired before reading the rids array, if any
+ * @returns TRUE if the packet belongs to a known substream and has a payload, FALSE otherwise */
+gboolean janus_rtp_simulcasting_classify(janus_rtp_simulcasting_packet *packet,
+	char *buf, int len, int rid_ext_id, uint32_t *ssrcs, char **rids,
+	janus_videocodec vcodec, janus_mutex *rid_mutex);
+
+/*! \brief Process a classified simulcast packet, and decide whether this should be relayed or not, updating the context accordingly
+ * \note As janus_rtp_simulcasting_context_process_rtp, this resets the \c changed_substream ,
+ * \c changed_temporal and \c need_pli properties, and updates them according to the decisions made
+ * @param[in] context The simulcasting context to use
+ * @param[in] packet The packet info, as filled by janus_rtp_simulcasting_classify
+ * @param[in] dd_content The Dependency Descriptor RTP extension data, if available
+ * @param[in] dd_len Length of the Dependency Descriptor data, if available
+ * @param[in] sc RTP switching context to refer to, if any (only needed for VP8 and dropping temporal layers)
+ * @returns TRUE if the packet should be relayed, FALSE if it should be dropped instead */
+gboolean janus_rtp_simulcasting_context_process_packet(janus_rtp_simulcasting_context *context,
+	const janus_rtp_simulcasting_packet *packet, uint8_t *dd_content, int dd_len,
+	janus_rtp_switching_context *sc);
+
 /*! \brief Process an RTP packet, and decide whether this should be relayed or not, updating the context accordingly
- * \note Calling this method resets the \c changed_substream , \c changed_temporal and \c need_pli
+ * \note This is the same as calling janus_rtp_simulcasting_classify and then
+ * janus_rtp_simulcasting_context_process_packet. Calling this method resets the \c changed_substream , \c changed_temporal and \c need_pli
  * properties, and updates them according to the decisions made after processing the packet
  * @param[in] context The simulcasting context to use
  * @param[in] buf The RTP packet to process
@@ -458,6 +512,8 @@ typedef struct janus_rtp_svc_context {
 	int spatial;
 	/*! \brief As above, but to handle transitions (e.g., wait for keyframe, or get this if available) */
 	int spatial_target;
+	/*! \brief Highest spatial layer we can forward, no matter the target (e.g., because of bandwidth estimation), or -1 for no cap */
+	int spatial_cap;
 	/*! \brief Which SVC temporal layer we should forward back */
 	int temporal;
 	/*! \brief As above, but to handle transitions (e.g., wait for keyframe) */
@@ -487,7 +543,9 @@ void janus_rtp_svc_context_reset(janus_rtp_svc_context *context);
  * @param[in] dd_content The Dependency Descriptor RTP extension data, if available
  * @param[in] dd_len Length of the Dependency Descriptor data, if available
  * @param[in] vcodec Video codec of the RTP payload
- * @param[in] info Parsed info on VP9-SVC, if any
+ * @param[in] info Parsed info on VP9-SVC, or the layers and E bit of the AV1 Dependency Descriptor, if any:
+ * when available, the payload (VP9) or Dependency Descriptor (AV1) is not parsed again, which is
+ * useful when relaying the same packet to many recipients, as it can be parsed only once
  * @param[in] sc RTP switching context to refer to, if any
  * @returns TRUE if the packet should be relayed, FALSE if it should be dropped instead */
 gboolean janus_rtp_svc_context_process_rtp(janus_rtp_svc_context *context,
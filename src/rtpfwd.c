@@ -13,6 +13,14 @@
  * \ref protocols
  */
 
+#ifdef HAVE_SENDMMSG
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		/* Needed for sendmmsg */
+#endif
+#endif
+
+#include <sys/socket.h>
+
 #include "rtpfwd.h"
 #include "rtcp.h"
 #include "utils.h"
@@ -39,13 +47,68 @@ static void janus_rtp_forwarder_unref(janus_rtp_forwarder *rf);
 /* Static helper to free an RTP forwarder instance when the reference goes to 0 */
 static void janus_rtp_forwarder_free(const janus_refcount *f_ref);
 
+/* SRTP contexts are shared by forwarders that send the same stream
+ * (same socket, SSRC and simulcast settings) with the same key: when
+ * the same packet is sent to more than one of them, we only encrypt
+ * it once, and reuse the result for all the other destinations */
+struct janus_rtp_forwarder_srtp {
+	/* Key in the table of shared SRTP contexts */
+	char *id;
+	/* How many forwarders are using this context */
+	int refs;
+	/* SRTP context and policy */
+	srtp_t ctx;
+	srtp_policy_t policy;
+	/* Last packet we encrypted, and its encrypted version */
+	char plain[1500], protected[1500];
+	int plain_len, protected_len;
+	janus_mutex mutex;
+};
+static janus_mutex srtp_shares_mutex = JANUS_MUTEX_INITIALIZER;
+static GHashTable *srtp_shares = NULL;
+static void janus_rtp_forwarder_srtp_release(janus_rtp_forwarder_srtp *srtp);
+
+/* Batches of packets to send at once, possibly via sendmmsg */
+#define JANUS_RTP_FORWARDER_MAX_BATCH	32
+#define JANUS_RTP_FORWARDER_MAX_SPARE	16
+struct janus_rtp_forwarder_batch {
+	int count;
+	janus_rtp_forwarder *rfs[JANUS_RTP_FORWARDER_MAX_BATCH];
+	int lengths[JANUS_RTP_FORWARDER_MAX_BATCH];
+	char buffers[JANUS_RTP_FORWARDER_MAX_BATCH][1500];
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr msgs[JANUS_RTP_FORWARDER_MAX_BATCH];
+	struct iovec iovecs[JANUS_RTP_FORWARDER_MAX_BATCH];
+#endif
+};
+/* Spare batches we can reuse, to avoid allocating them all the time */
+static GAsyncQueue *spare_batches = NULL;
+static void janus_rtp_forwarder_batch_flush(janus_rtp_forwarder_batch *batch);
+static void janus_rtp_forwarder_batch_recycle(janus_rtp_forwarder_batch *batch);
+/* Sender thread, if enabled */
+static GThread *sender_thread = NULL;
+static GAsyncQueue *sender_queue = NULL;
+static janus_rtp_forwarder_batch sender_exit;
+static void *janus_rtp_forwarder_sender_thread(void *data) {
+	JANUS_LOG(LOG_VERB, "Joining sender thread for RTP forwarders...\n");
+	janus_rtp_forwarder_batch *batch = NULL;
+	while((batch = g_async_queue_pop(sender_queue)) != &sender_exit) {
+		janus_rtp_forwarder_batch_flush(batch);
+		janus_rtp_forwarder_batch_recycle(batch);
+	}
+	JANUS_LOG(LOG_VERB, "Leaving sender thread for RTP forwarders...\n");
+	return NULL;
+}
+
 /* \brief RTP forwarders code initialization
  * @returns 0 in case of success, a negative integer on errors */
-int janus_rtp_forwarders_init(void) {
+int janus_rtp_forwarders_init(gboolean use_sender_thread) {
 	/* Initialize the forwarders table and muted */
 	rtpfwds = g_hash_table_new_full(g_str_hash, g_str_equal,
 		(GDestroyNotify)g_free, (GDestroyNotify)janus_rtp_forwarder_unref);
 	janus_mutex_init(&rtpfwds_mutex);
+	srtp_shares = g_hash_table_new(g_str_hash, g_str_equal);
+	spare_batches = g_async_queue_new();
 	/* Let's check if IPv6 is disabled, as we may need to know for forwarders */
 	int fd = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
 	if(fd < 0) {
@@ -72,6 +135,21 @@ int janus_rtp_forwarders_init(void) {
 		g_error_free(error);
 		return -1;
 	}
+	if(use_sender_thread) {
+		/* Spawn the thread that will send packets on behalf of plugins */
+		sender_queue = g_async_queue_new();
+		sender_thread = g_thread_try_new("rtpfwd sender", janus_rtp_forwarder_sender_thread, NULL, &error);
+		if(error != NULL) {
+			/* We show the error but it's not fatal, we'll send packets ourselves */
+			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the sender thread for RTP forwarders...\n",
+				error->code, error->message ? error->message : "??");
+			g_error_free(error);
+			g_async_queue_unref(sender_queue);
+			sender_queue = NULL;
+		} else {
+			JANUS_LOG(LOG_INFO, "RTP forwarders will send packets from a dedicated thread\n");
+		}
+	}
 	/* Donw */
 	return 0;
 }
@@ -87,11 +165,35 @@ void janus_rtp_forwarders_deinit(void) {
 		g_thread_join(rtcpfwd_thread);
 		rtcpfwd_thread = NULL;
 	}
+	/* Stop the sender thread, if any, and send what's left */
+	if(sender_thread != NULL) {
+		g_async_queue_push(sender_queue, &sender_exit);
+		g_thread_join(sender_thread);
+		sender_thread = NULL;
+		janus_rtp_forwarder_batch *batch = NULL;
+		while((batch = g_async_queue_try_pop(sender_queue)) != NULL) {
+			janus_rtp_forwarder_batch_flush(batch);
+			janus_rtp_forwarder_batch_recycle(batch);
+		}
+		g_async_queue_unref(sender_queue);
+		sender_queue = NULL;
+	}
 	/* Get rid of the table */
 	janus_mutex_lock(&rtpfwds_mutex);
 	g_hash_table_destroy(rtpfwds);
 	rtpfwds = NULL;
 	janus_mutex_unlock(&rtpfwds_mutex);
+	janus_mutex_lock(&srtp_shares_mutex);
+	g_hash_table_destroy(srtp_shares);
+	srtp_shares = NULL;
+	janus_mutex_unlock(&srtp_shares_mutex);
+	g_async_queue_lock(spare_batches);
+	janus_rtp_forwarder_batch *batch = NULL;
+	while((batch = g_async_queue_try_pop_unlocked(spare_batches)) != NULL)
+		g_free(batch);
+	g_async_queue_unlock(spare_batches);
+	g_async_queue_unref(spare_batches);
+	spare_batches = NULL;
 }
 
 /* RTCP support in RTP forwarders */
@@ -177,38 +279,59 @@ janus_rtp_forwarder *janus_rtp_forwarder_create(const char *ctx,
 	rf->remote_rtcp_port = 0;
 	/* First of all, let's check if we need to setup an SRTP forwarder */
 	if(!is_data && srtp_suite > 0 && srtp_crypto != NULL) {
-		/* Base64 decode the crypto string and set it as the SRTP context */
-		gsize len = 0;
-		guchar *decoded = g_base64_decode(srtp_crypto, &len);
-		if(len < SRTP_MASTER_LENGTH) {
-			janus_mutex_unlock(&rtpfwds_mutex);
-			JANUS_LOG(LOG_ERR, "Invalid SRTP crypto (%s)\n", srtp_crypto);
-			g_free(decoded);
-			g_free(rf);
-			return NULL;
-		}
-		/* Set SRTP policy */
-		srtp_policy_t *policy = &rf->srtp_policy;
-		srtp_crypto_policy_set_rtp_default(&(policy->rtp));
-		if(srtp_suite == 32) {
-			srtp_crypto_policy_set_aes_cm_128_hmac_sha1_32(&(policy->rtp));
-		} else if(srtp_suite == 80) {
-			srtp_crypto_policy_set_aes_cm_128_hmac_sha1_80(&(policy->rtp));
-		}
-		policy->ssrc.type = ssrc_any_outbound;
-		policy->key = decoded;
-		policy->next = NULL;
-		/* Create SRTP context */
-		srtp_err_status_t res = srtp_create(&rf->srtp_ctx, policy);
-		if(res != srtp_err_status_ok) {
-			/* Something went wrong... */
-			janus_mutex_unlock(&rtpfwds_mutex);
-			JANUS_LOG(LOG_ERR, "Error creating forwarder SRTP session: %d (%s)\n", res, janus_srtp_error_str(res));
-			g_free(decoded);
-			policy->key = NULL;
-			g_free(rf);
-			return NULL;
+		/* Check if there's an SRTP context we can share first */
+		char sid[1024];
+		g_snprintf(sid, sizeof(sid), "%d-%d-%"SCNu32"-%d-%d-%d-%s", udp_fd, srtp_suite, ssrc,
+			is_video, is_video && simulcast, substream, srtp_crypto);
+		janus_mutex_lock(&srtp_shares_mutex);
+		janus_rtp_forwarder_srtp *srtp = g_hash_table_lookup(srtp_shares, sid);
+		if(srtp != NULL) {
+			srtp->refs++;
+		} else {
+			/* Base64 decode the crypto string and set it as the SRTP context */
+			gsize len = 0;
+			guchar *decoded = g_base64_decode(srtp_crypto, &len);
+			if(len < SRTP_MASTER_LENGTH) {
+				janus_mutex_unlock(&srtp_shares_mutex);
+				janus_mutex_unlock(&rtpfwds_mutex);
+				JANUS_LOG(LOG_ERR, "Invalid SRTP crypto (%s)\n", srtp_crypto);
+				g_free(decoded);
+				g_free(rf);
+				return NULL;
+			}
+			srtp = g_malloc0(sizeof(janus_rtp_forwarder_srtp));
+			/* Set SRTP policy */
+			srtp_policy_t *policy = &srtp->policy;
+			srtp_crypto_policy_set_rtp_default(&(policy->rtp));
+			if(srtp_suite == 32) {
+				srtp_crypto_policy_set_aes_cm_128_hmac_sha1_32(&(policy->rtp));
+			} else if(srtp_suite == 80) {
+				srtp_crypto_policy_set_aes_cm_128_hmac_sha1_80(&(policy->rtp));
+			}
+			policy->ssrc.type = ssrc_any_outbound;
+			policy->key = decoded;
+			policy->next = NULL;
+			/* Create SRTP context */
+			srtp_err_status_t res = srtp_create(&srtp->ctx, policy);
+			if(res != srtp_err_status_ok) {
+				/* Something went wrong... */
+				janus_mutex_unlock(&srtp_shares_mutex);
+				janus_mutex_unlock(&rtpfwds_mutex);
+				JANUS_LOG(LOG_ERR, "Error creating forwarder SRTP session: %d (%s)\n", res, janus_srtp_error_str(res));
+				g_free(decoded);
+				g_free(srtp);
+				g_free(rf);
+				return NULL;
+			}
+			srtp->id = g_strdup(sid);
+			srtp->refs = 1;
+			janus_mutex_init(&srtp->mutex);
+			g_hash_table_insert(srtp_shares, srtp->id, srtp);
 		}
+		janus_mutex_unlock(&srtp_shares_mutex);
+		rf->srtp = srtp;
+		rf->srtp_ctx = srtp->ctx;
+		rf->srtp_policy = srtp->policy;
 		rf->is_srtp = TRUE;
 	}
 	rf->is_video = is_video;
@@ -334,11 +457,41 @@ void janus_rtp_forwarder_send_rtp(janus_rtp_forwarder *rf, char *buffer, int len
 	janus_rtp_forwarder_send_rtp_full(rf, buffer, len, substream, NULL, NULL, JANUS_VIDEOCODEC_NONE, NULL);
 }
 
-/* Helper function to forward an RTP packet within the context of a forwarder */
-void janus_rtp_forwarder_send_rtp_full(janus_rtp_forwarder *rf, char *buffer, int len, int substream,
-		uint32_t *ssrcs, char **rids, janus_videocodec vcodec, janus_mutex *rid_mutex) {
-	if(!rf || g_atomic_int_get(&rf->destroyed) || !buffer || !janus_is_rtp(buffer, len))
-		return;
+/* Helper function to encrypt a packet with an SRTP context, reusing the
+ * result of the previous call in case the packet is exactly the same */
+static srtp_err_status_t janus_rtp_forwarder_srtp_protect(janus_rtp_forwarder_srtp *srtp,
+		char *buffer, int len, char *sbuf, int *protected) {
+	janus_mutex_lock(&srtp->mutex);
+	if(srtp->plain_len == len && memcmp(srtp->plain, buffer, len) == 0) {
+		/* We encrypted this very same packet for another forwarder already */
+		memcpy(sbuf, srtp->protected, srtp->protected_len);
+		*protected = srtp->protected_len;
+		janus_mutex_unlock(&srtp->mutex);
+		return srtp_err_status_ok;
+	}
+	memcpy(sbuf, buffer, len);
+	*protected = len;
+	srtp_err_status_t res = srtp_protect(srtp->ctx, sbuf, protected);
+	srtp->plain_len = 0;
+	if(res == srtp_err_status_ok && srtp->refs > 1 && *protected <= (int)sizeof(srtp->protected)) {
+		/* Keep a copy, as other forwarders may need to send the same packet */
+		memcpy(srtp->plain, buffer, len);
+		srtp->plain_len = len;
+		memcpy(srtp->protected, sbuf, *protected);
+		srtp->protected_len = *protected;
+	}
+	janus_mutex_unlock(&srtp->mutex);
+	return res;
+}
+
+/* Helper function to prepare an RTP packet for a forwarder: the packet is
+ * copied in the provided buffer, with the header rewritten as needed and,
+ * if it's an SRTP forwarder, encrypted; returns the size of the packet to
+ * send, or 0 if there's nothing to send */
+static int janus_rtp_forwarder_prepare(janus_rtp_forwarder *rf, char *buffer, int len, int substream,
+		uint32_t *ssrcs, char **rids, janus_videocodec vcodec, janus_mutex *rid_mutex, char *sbuf) {
+	if(!rf || g_atomic_int_get(&rf->destroyed) || !buffer || !janus_is_rtp(buffer, len) || len > 1500)
+		return 0;
 	/* Access the RTP header */
 	janus_rtp_header *rtp = (janus_rtp_header *)buffer;
 	/* Backup the RTP header info, as we may rewrite part of it */
@@ -349,14 +502,14 @@ void janus_rtp_forwarder_send_rtp_full(janus_rtp_forwarder *rf, char *buffer, in
 	/* First of all, check if we're simulcasting and if we need to forward or ignore this frame */
 	if(rf->is_video && !rf->simulcast && rf->substream != substream) {
 		/* We're being asked to forward a specific substream, and it's not it */
-		return;
+		return 0;
 	}
 	if(rf->is_video && rf->simulcast) {
 		/* This is video and we're simulcasting, check if we need to forward this frame */
 		if(!janus_rtp_simulcasting_context_process_rtp(&rf->sim_context,
 				buffer, len, NULL, 0, ssrcs, rids, vcodec, &rf->rtp_context, rid_mutex)) {
 			/* There was an error processing simulcasting for this packet */
-			return;
+			return 0;
 		}
 		janus_rtp_header_update(rtp, &rf->rtp_context, TRUE, 0);
 		/* By default we use a fixed SSRC (it may be overwritten later) */
@@ -368,35 +521,23 @@ void janus_rtp_forwarder_send_rtp_full(janus_rtp_forwarder *rf, char *buffer, in
 	if(rf->ssrc > 0)
 		rtp->ssrc = htonl(rf->ssrc);
 	/* Check if this is an RTP or SRTP forwarder */
+	int size = len;
 	if(!rf->is_srtp) {
 		/* Plain RTP */
-		struct sockaddr *address = (rf->serv_addr.sin_family == AF_INET ?
-			(struct sockaddr *)&rf->serv_addr : (struct sockaddr *)&rf->serv_addr6);
-		size_t addrlen = (rf->serv_addr.sin_family == AF_INET ? sizeof(rf->serv_addr) : sizeof(rf->serv_addr6));
-		if(sendto(rf->udp_fd, buffer, len, 0, address, addrlen) < 0) {
-			JANUS_LOG(LOG_HUGE, "Error forwarding RTP %s packet... %s (len=%d)...\n",
-				(rf->is_video ? "video" : "audio"), g_strerror(errno), len);
-		}
+		memcpy(sbuf, buffer, len);
 	} else {
 		/* SRTP: encrypt the packet before sending it */
-		char sbuf[1500];
-		memcpy(sbuf, buffer, len);
 		int protected = len;
-		int res = srtp_protect(rf->srtp_ctx, sbuf, &protected);
+		int res = janus_rtp_forwarder_srtp_protect(rf->srtp, buffer, len, sbuf, &protected);
 		if(res != srtp_err_status_ok) {
-			janus_rtp_header *header = (janus_rtp_header *)sbuf;
+			janus_rtp_header *header = (janus_rtp_header *)buffer;
 			guint32 timestamp = ntohl(header->timestamp);
 			guint16 seq = ntohs(header->seq_number);
 			JANUS_LOG(LOG_ERR, "Error encrypting %s packet... %s (len=%d-->%d, ts=%"SCNu32", seq=%"SCNu16")...\n",
 				(rf->is_video ? "Video" : "Audio"), janus_srtp_error_str(res), len, protected, timestamp, seq);
+			size = 0;
 		} else {
-			struct sockaddr *address = (rf->serv_addr.sin_family == AF_INET ?
-				(struct sockaddr *)&rf->serv_addr : (struct sockaddr *)&rf->serv_addr6);
-			size_t addrlen = (rf->serv_addr.sin_family == AF_INET ? sizeof(rf->serv_addr) : sizeof(rf->serv_addr6));
-			if(sendto(rf->udp_fd, sbuf, protected, 0, address, addrlen) < 0) {
-				JANUS_LOG(LOG_HUGE, "Error forwarding SRTP %s packet... %s (len=%d)...\n",
-					(rf->is_video ? "video" : "audio"), g_strerror(errno), protected);
-			}
+			size = protected;
 		}
 	}
 	/* Restore original values of the RTP payload before returning */
@@ -404,6 +545,136 @@ void janus_rtp_forwarder_send_rtp_full(janus_rtp_forwarder *rf, char *buffer, in
 	rtp->ssrc = htonl(ssrc);
 	rtp->timestamp = htonl(timestamp);
 	rtp->seq_number = htons(seq_number);
+	return size;
+}
+
+/* Helper function to send a prepared packet to the address of a forwarder */
+static void janus_rtp_forwarder_sendto(janus_rtp_forwarder *rf, char *buffer, int len) {
+	struct sockaddr *address = (rf->serv_addr.sin_family == AF_INET ?
+		(struct sockaddr *)&rf->serv_addr : (struct sockaddr *)&rf->serv_addr6);
+	size_t addrlen = (rf->serv_addr.sin_family == AF_INET ? sizeof(rf->serv_addr) : sizeof(rf->serv_addr6));
+	if(sendto(rf->udp_fd, buffer, len, 0, address, addrlen) < 0) {
+		JANUS_LOG(LOG_HUGE, "Error forwarding %s %s packet... %s (len=%d)...\n",
+			(rf->is_srtp ? "SRTP" : "RTP"), (rf->is_video ? "video" : "audio"), g_strerror(errno), len);
+	}
+}
+
+/* Helper function to forward an RTP packet within the context of a forwarder */
+void janus_rtp_forwarder_send_rtp_full(janus_rtp_forwarder *rf, char *buffer, int len, int substream,
+		uint32_t *ssrcs, char **rids, janus_videocodec vcodec, janus_mutex *rid_mutex) {
+	if(sender_queue != NULL) {
+		/* We have a sender thread, let it send the packet */
+		janus_rtp_forwarder_batch *batch = janus_rtp_forwarder_batch_new();
+		janus_rtp_forwarder_batch_add(batch, rf, buffer, len, substream, ssrcs, rids, vcodec, rid_mutex);
+		janus_rtp_forwarder_batch_send(batch);
+		return;
+	}
+	char sbuf[1500];
+	int size = janus_rtp_forwarder_prepare(rf, buffer, len, substream, ssrcs, rids, vcodec, rid_mutex, sbuf);
+	if(size > 0)
+		janus_rtp_forwarder_sendto(rf, sbuf, size);
+}
+
+/* Batches of packets for multiple forwarders */
+janus_rtp_forwarder_batch *janus_rtp_forwarder_batch_new(void) {
+	janus_rtp_forwarder_batch *batch = spare_batches ? g_async_queue_try_pop(spare_batches) : NULL;
+	if(batch != NULL)
+		return batch;
+	batch = g_malloc(sizeof(janus_rtp_forwarder_batch));
+	batch->count = 0;
+#ifdef HAVE_SENDMMSG
+	memset(batch->msgs, 0, sizeof(batch->msgs));
+	int i = 0;
+	for(i=0; i<JANUS_RTP_FORWARDER_MAX_BATCH; i++) {
+		batch->iovecs[i].iov_base = batch->buffers[i];
+		batch->msgs[i].msg_hdr.msg_iov = &batch->iovecs[i];
+		batch->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+#endif
+	return batch;
+}
+
+void janus_rtp_forwarder_batch_add(janus_rtp_forwarder_batch *batch, janus_rtp_forwarder *rf,
+		char *buffer, int len, int substream, uint32_t *ssrcs, char **rids, janus_videocodec vcodec, janus_mutex *rid_mutex) {
+	if(batch == NULL || rf == NULL)
+		return;
+	if(batch->count == JANUS_RTP_FORWARDER_MAX_BATCH) {
+		/* No room left, send this packet on its own */
+		janus_rtp_forwarder_send_rtp_full(rf, buffer, len, substream, ssrcs, rids, vcodec, rid_mutex);
+		return;
+	}
+	int size = janus_rtp_forwarder_prepare(rf, buffer, len, substream, ssrcs, rids, vcodec, rid_mutex,
+		batch->buffers[batch->count]);
+	if(size == 0)
+		return;
+	janus_refcount_increase(&rf->ref);
+	batch->rfs[batch->count] = rf;
+	batch->lengths[batch->count] = size;
+	batch->count++;
+}
+
+void janus_rtp_forwarder_batch_send(janus_rtp_forwarder_batch *batch) {
+	if(batch == NULL)
+		return;
+	if(batch->count > 0 && sender_queue != NULL) {
+		/* We have a sender thread, let it send the packets */
+		g_async_queue_push(sender_queue, batch);
+		return;
+	}
+	janus_rtp_forwarder_batch_flush(batch);
+	janus_rtp_forwarder_batch_recycle(batch);
+}
+
+/* Static helper to actually send all the packets in a batch */
+static void janus_rtp_forwarder_batch_flush(janus_rtp_forwarder_batch *batch) {
+	int i = 0;
+#ifdef HAVE_SENDMMSG
+	/* Prepare the messages, and send them, one sendmmsg per socket */
+	for(i=0; i<batch->count; i++) {
+		janus_rtp_forwarder *rf = batch->rfs[i];
+		batch->iovecs[i].iov_len = batch->lengths[i];
+		batch->msgs[i].msg_hdr.msg_name = (rf->serv_addr.sin_family == AF_INET ?
+			(void *)&rf->serv_addr : (void *)&rf->serv_addr6);
+		batch->msgs[i].msg_hdr.msg_namelen = (rf->serv_addr.sin_family == AF_INET ?
+			sizeof(rf->serv_addr) : sizeof(rf->serv_addr6));
+	}
+	int start = 0;
+	while(start < batch->count) {
+		int fd = batch->rfs[start]->udp_fd, end = start+1;
+		while(end < batch->count && batch->rfs[end]->udp_fd == fd)
+			end++;
+		while(start < end) {
+			int sent = sendmmsg(fd, &batch->msgs[start], end-start, 0);
+			if(sent < 1) {
+				/* Skip the packet that caused the error, and go on */
+				janus_rtp_forwarder *rf = batch->rfs[start];
+				JANUS_LOG(LOG_HUGE, "Error forwarding %s %s packet... %s (len=%d)...\n",
+					(rf->is_srtp ? "SRTP" : "RTP"), (rf->is_video ? "video" : "audio"),
+					g_strerror(errno), batch->lengths[start]);
+				sent = 1;
+			}
+			start += sent;
+		}
+	}
+#else
+	for(i=0; i<batch->count; i++)
+		janus_rtp_forwarder_sendto(batch->rfs[i], batch->buffers[i], batch->lengths[i]);
+#endif
+	/* Done, get rid of the references */
+	for(i=0; i<batch->count; i++) {
+		janus_refcount_decrease(&batch->rfs[i]->ref);
+		batch->rfs[i] = NULL;
+	}
+	batch->count = 0;
+}
+
+/* Static helper to put a sent batch back in the list of spare ones */
+static void janus_rtp_forwarder_batch_recycle(janus_rtp_forwarder_batch *batch) {
+	if(spare_batches == NULL || g_async_queue_length(spare_batches) >= JANUS_RTP_FORWARDER_MAX_SPARE) {
+		g_free(batch);
+		return;
+	}
+	g_async_queue_push(spare_batches, batch);
 }
 
 /* Mark an RTP forwarder instance as destroyed */
@@ -434,11 +705,29 @@ static void janus_rtp_forwarder_free(const janus_refcount *f_ref) {
 	janus_rtp_forwarder *rf = janus_refcount_containerof(f_ref, janus_rtp_forwarder, ref);
 	if(rf->rtcp_fd > -1)
 		close(rf->rtcp_fd);
-	if(rf->is_srtp) {
-		srtp_dealloc(rf->srtp_ctx);
-		g_free(rf->srtp_policy.key);
-	}
+	if(rf->is_srtp)
+		janus_rtp_forwarder_srtp_release(rf->srtp);
 	g_free(rf->context);
 	g_free(rf->metadata);
 	g_free(rf);
 }
+
+/* Static helper to release a shared SRTP context, and free it when unused */
+static void janus_rtp_forwarder_srtp_release(janus_rtp_forwarder_srtp *srtp) {
+	if(srtp == NULL)
+		return;
+	janus_mutex_lock(&srtp_shares_mutex);
+	srtp->refs--;
+	if(srtp->refs > 0) {
+		janus_mutex_unlock(&srtp_shares_mutex);
+		return;
+	}
+	if(srtp_shares != NULL)
+		g_hash_table_remove(srtp_shares, srtp->id);
+	janus_mutex_unlock(&srtp_shares_mutex);
+	srtp_dealloc(srtp->ctx);
+	g_free(srtp->policy.key);
+	janus_mutex_destroy(&srtp->mutex);
+	g_free(srtp->id);
+	g_free(srtp);
+}
@@ -21,11 +21,16 @@
 
 
 /*! \brief RTP forwarders code initialization
+ * @param[in] use_sender_thread Whether packets should be sent by a dedicated
+ * thread, rather than by the threads of the plugins relaying them
  * @returns 0 in case of success, a negative integer on errors */
-int janus_rtp_forwarders_init(void);
+int janus_rtp_forwarders_init(gboolean use_sender_thread);
 /*! \brief RTP forwarders code de-initialization */
 void janus_rtp_forwarders_deinit(void);
 
+/*! \brief Opaque SRTP context, shared by forwarders sending the same stream with the same key */
+typedef struct janus_rtp_forwarder_srtp janus_rtp_forwarder_srtp;
+
 /*! \brief Helper struct for implementing RTP forwarders */
 typedef struct janus_rtp_forwarder {
 	/* \brief Opaque pointer to the owner of this forwarder */
@@ -70,6 +75,8 @@ typedef struct janus_rtp_forwarder {
 	srtp_t srtp_ctx;
 	/* \brief The SRTP policy, in case SRTP is enabled */
 	srtp_policy_t srtp_policy;
+	/* \brief The shared SRTP context the two properties above refer to */
+	janus_rtp_forwarder_srtp *srtp;
 	/* \brief Opaque metadata property, in case it's useful to the owner
 	 * \note This can be anything (e.g., a string, an allocated struct, etc.),
 	 * as long as it can be freed with a single call to g_free(), as
@@ -132,6 +139,41 @@ void janus_rtp_forwarder_send_rtp(janus_rtp_forwarder *rf, char *buffer, int len
  * @param[in] rid_mutex A mutex that must be acquired before reading the rids array, if any */
 void janus_rtp_forwarder_send_rtp_full(janus_rtp_forwarder *rf, char *buffer, int len, int substream,
 	uint32_t *ssrcs, char **rids, janus_videocodec vcodec, janus_mutex *rid_mutex);
+
+/*! \brief Opaque batch of packets to send to multiple forwarders at once
+ * \details When the same RTP packet must be sent to more than one forwarder,
+ * e.g., because a publisher is forwarded to different recorders, using a
+ * batch allows all packets to be sent with a single \c sendmmsg call per
+ * socket, where available, or by the dedicated sender thread, if enabled.
+ * Packets are prepared (and encrypted, for SRTP forwarders) when they're
+ * added to the batch, which means the original buffer can be reused right
+ * away. Batches are meant to be short lived: they should be obtained with
+ * janus_rtp_forwarder_batch_new right before use, and are always released
+ * by janus_rtp_forwarder_batch_send, which is why they must not be used
+ * anymore after that call. */
+typedef struct janus_rtp_forwarder_batch janus_rtp_forwarder_batch;
+/*! \brief Helper method to get a new (empty) batch of packets
+ * @returns A pointer to a janus_rtp_forwarder_batch instance */
+janus_rtp_forwarder_batch *janus_rtp_forwarder_batch_new(void);
+/*! \brief Helper method to add an RTP packet for a forwarder to a batch
+ * @note This takes the same arguments janus_rtp_forwarder_send_rtp_full
+ * does: if the batch is full, the packet is sent right away instead
+ * @param[in] batch The janus_rtp_forwarder_batch instance to add the packet to
+ * @param[in] rf The janus_rtp_forwarder instance to use
+ * @param[in] buffer The RTP packet buffer
+ * @param[in] len The length of the RTP packet buffer
+ * @param[in] substream In case the forwarder is relaying a single simulcast
+ * 		substream, the substream the packet belongs to (pass -1 to ignore)
+ * @param[in] ssrcs The simulcast SSRCs to refer to (may be updated if rids are involved)
+ * @param[in] rids The simulcast rids to refer to, if any
+ * @param[in] vcodec Video codec of the RTP payload
+ * @param[in] rid_mutex A mutex that must be acquired before reading the rids array, if any */
+void janus_rtp_forwarder_batch_add(janus_rtp_forwarder_batch *batch, janus_rtp_forwarder *rf,
+	char *buffer, int len, int substream, uint32_t *ssrcs, char **rids, janus_videocodec vcodec, janus_mutex *rid_mutex);
+/*! \brief Helper method to send all the packets in a batch, and release it
+ * @param[in] batch The janus_rtp_forwarder_batch instance to send */
+void janus_rtp_forwarder_batch_send(janus_rtp_forwarder_batch *batch);
+
 /*! \brief Helper method to free a janus_rtp_forwarder instance
  * @param[in] rf The janus_rtp_forwarder instance to free */
 void janus_rtp_forwarder_destroy(janus_rtp_forwarder *rf);
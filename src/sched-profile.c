@@ -0,0 +1,336 @@
+/*! \file    sched-profile.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Scheduling profile for media threads
+ * \details  Implementation of the real-time scheduling profile that can be
+ * configured in the \c scheduling section of \c janus.jcfg. Threads that
+ * are sensitive to latency (static ICE event loops, AudioBridge mixers,
+ * VideoRoom and Streaming helpers) belong to a class: each class can be
+ * given a set of CPU cores its threads are pinned to (round robin, one
+ * core per thread), and an optional \c SCHED_FIFO priority. All the other
+ * threads (API, transports, logging, event handlers, etc.) can optionally
+ * be kept away from the cores reserved to media threads, so that bursts
+ * of requests can't preempt the mixers or the event loops.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		/* Needed for CPU affinity */
+#endif
+
+#include <sched.h>
+#include <pthread.h>
+#include <errno.h>
+#include <string.h>
+
+#include "sched-profile.h"
+#include "debug.h"
+#include "mutex.h"
+#include "utils.h"
+
+#ifndef CPU_SETSIZE
+#define CPU_SETSIZE 1024
+#endif
+
+/* Names of the classes, as used in the configuration (e.g., ice_loops_cpus) */
+static const char *janus_sched_class_names[JANUS_SCHED_CLASSES] = {
+	"ice_loops", "mixers", "helpers"
+};
+const char *janus_sched_class_name(janus_sched_class tclass) {
+	if(tclass < 0 || tclass >= JANUS_SCHED_CLASSES)
+		return NULL;
+	return janus_sched_class_names[tclass];
+}
+
+/* Profile of a class */
+typedef struct janus_sched_profile {
+	/* Cores threads of this class are pinned to, round robin */
+	GArray *cpus;
+	/* The next core in the set to assign */
+	volatile gint next;
+	/* SCHED_FIFO priority, or 0 to keep the default policy */
+	int priority;
+} janus_sched_profile;
+static janus_sched_profile profiles[JANUS_SCHED_CLASSES];
+static gboolean isolate = FALSE;
+static GArray *general_cpus = NULL;
+
+/* A thread the profile has been applied to */
+typedef struct janus_sched_thread {
+	char *name;
+	janus_sched_class tclass;
+	int cpu;
+	int priority;
+	gint64 started;
+} janus_sched_thread;
+static void janus_sched_thread_free(janus_sched_thread *thread) {
+	if(thread == NULL)
+		return;
+	g_free(thread->name);
+	g_free(thread);
+}
+static GHashTable *threads = NULL;
+static janus_mutex threads_mutex = JANUS_MUTEX_INITIALIZER;
+static volatile gint initialized = 0;
+
+/* Parse a list of cores, e.g., "2,4-7" */
+static GArray *janus_sched_parse_cpus(const char *value) {
+	if(value == NULL || *value == '\0')
+		return NULL;
+	int max = g_get_num_processors();
+	GArray *cpus = g_array_new(FALSE, FALSE, sizeof(int));
+	gchar **ranges = g_strsplit(value, ",", -1);
+	int i = 0;
+	for(i=0; ranges[i] != NULL; i++) {
+		char *range = g_strstrip(ranges[i]);
+		if(*range == '\0')
+			continue;
+		uint16_t first = 0, last = 0;
+		gboolean ok = FALSE;
+		char *dash = strchr(range, '-');
+		if(dash != NULL) {
+			*dash = '\0';
+			ok = (janus_string_to_uint16(g_strstrip(range), &first) == 0 &&
+				janus_string_to_uint16(g_strstrip(dash+1), &last) == 0);
+		} else {
+			ok = (janus_string_to_uint16(range, &first) == 0);
+			last = first;
+		}
+		if(!ok || last < first || last >= max || last >= CPU_SETSIZE) {
+			JANUS_LOG(LOG_ERR, "Invalid CPU range in '%s' (this machine has %d cores)\n", value, max);
+			g_strfreev(ranges);
+			g_array_free(cpus, TRUE);
+			return NULL;
+		}
+		int cpu = 0;
+		for(cpu=first; cpu<=last; cpu++)
+			g_array_append_val(cpus, cpu);
+	}
+	g_strfreev(ranges);
+	if(cpus->len == 0) {
+		g_array_free(cpus, TRUE);
+		return NULL;
+	}
+	return cpus;
+}
+
+/* Helper to print a list of cores */
+static char *janus_sched_print_cpus(GArray *cpus) {
+	GString *str = g_string_new(NULL);
+	guint i = 0;
+	for(i=0; cpus && i<cpus->len; i++)
+		g_string_append_printf(str, "%s%d", i ? "," : "", g_array_index(cpus, int, i));
+	return g_string_free(str, FALSE);
+}
+
+int janus_sched_init(janus_config *config) {
+	if(!g_atomic_int_compare_and_exchange(&initialized, 0, 1))
+		return 0;
+	threads = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_sched_thread_free);
+	memset(profiles, 0, sizeof(profiles));
+	janus_config_category *category = config ?
+		janus_config_get(config, NULL, janus_config_type_category, "scheduling") : NULL;
+	if(category == NULL)
+		return 0;
+	char key[64];
+	int i = 0;
+	gboolean reserved[CPU_SETSIZE] = { 0 };
+	gboolean any = FALSE;
+	for(i=0; i<JANUS_SCHED_CLASSES; i++) {
+		g_snprintf(key, sizeof(key), "%s_cpus", janus_sched_class_names[i]);
+		janus_config_item *item = janus_config_get(config, category, janus_config_type_item, key);
+		if(item && item->value) {
+			profiles[i].cpus = janus_sched_parse_cpus(item->value);
+			if(profiles[i].cpus == NULL) {
+				JANUS_LOG(LOG_WARN, "Invalid %s value, %s won't be pinned\n", key, janus_sched_class_names[i]);
+			} else {
+				guint j = 0;
+				for(j=0; j<profiles[i].cpus->len; j++)
+					reserved[g_array_index(profiles[i].cpus, int, j)] = TRUE;
+				any = TRUE;
+			}
+		}
+		g_snprintf(key, sizeof(key), "%s_priority", janus_sched_class_names[i]);
+		item = janus_config_get(config, category, janus_config_type_item, key);
+		if(item && item->value) {
+			uint16_t priority = 0;
+			if(janus_string_to_uint16(item->value, &priority) < 0 ||
+					priority > sched_get_priority_max(SCHED_FIFO)) {
+				JANUS_LOG(LOG_WARN, "Invalid %s value, %s will use the default policy\n", key, janus_sched_class_names[i]);
+			} else {
+				profiles[i].priority = priority;
+			}
+		}
+		if(profiles[i].cpus != NULL || profiles[i].priority > 0) {
+			char *cpus = janus_sched_print_cpus(profiles[i].cpus);
+			JANUS_LOG(LOG_INFO, "Scheduling profile for %s: cores [%s], %s priority %d\n",
+				janus_sched_class_names[i], cpus, profiles[i].priority > 0 ? "SCHED_FIFO" : "default",
+				profiles[i].priority);
+			g_free(cpus);
+		}
+	}
+	janus_config_item *item = janus_config_get(config, category, janus_config_type_item, "isolate");
+	isolate = item && item->value && janus_is_true(item->value);
+	if(isolate && any) {
+#ifdef __linux__
+		/* Move ourselves, and so all the threads we'll create, to the other cores */
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		general_cpus = g_array_new(FALSE, FALSE, sizeof(int));
+		int cpu = 0, max = g_get_num_processors();
+		for(cpu=0; cpu<max && cpu<CPU_SETSIZE; cpu++) {
+			if(!reserved[cpu]) {
+				CPU_SET(cpu, &cpuset);
+				g_array_append_val(general_cpus, cpu);
+			}
+		}
+		if(general_cpus->len == 0) {
+			JANUS_LOG(LOG_WARN, "All cores are reserved to media threads, can't isolate them\n");
+			g_array_free(general_cpus, TRUE);
+			general_cpus = NULL;
+		} else if(sched_setaffinity(0, sizeof(cpuset), &cpuset) < 0) {
+			JANUS_LOG(LOG_WARN, "Couldn't isolate the cores reserved to media threads: %d (%s)\n",
+				errno, g_strerror(errno));
+			g_array_free(general_cpus, TRUE);
+			general_cpus = NULL;
+		} else {
+			char *cpus = janus_sched_print_cpus(general_cpus);
+			JANUS_LOG(LOG_INFO, "Other threads will run on cores [%s]\n", cpus);
+			g_free(cpus);
+		}
+#else
+		JANUS_LOG(LOG_WARN, "CPU affinity is not supported on this platform, can't isolate cores\n");
+#endif
+	}
+	return 0;
+}
+
+void janus_sched_deinit(void) {
+	if(!g_atomic_int_compare_and_exchange(&initialized, 1, 0))
+		return;
+	janus_mutex_lock(&threads_mutex);
+	g_hash_table_destroy(threads);
+	threads = NULL;
+	janus_mutex_unlock(&threads_mutex);
+	int i = 0;
+	for(i=0; i<JANUS_SCHED_CLASSES; i++) {
+		if(profiles[i].cpus != NULL)
+			g_array_free(profiles[i].cpus, TRUE);
+		profiles[i].cpus = NULL;
+	}
+	if(general_cpus != NULL)
+		g_array_free(general_cpus, TRUE);
+	general_cpus = NULL;
+}
+
+gboolean janus_sched_thread_start(janus_sched_class tclass, const char *name) {
+	if(!g_atomic_int_get(&initialized) || tclass < 0 || tclass >= JANUS_SCHED_CLASSES)
+		return FALSE;
+	janus_sched_profile *profile = &profiles[tclass];
+	if(profile->cpus == NULL && profile->priority == 0)
+		return FALSE;
+	int cpu = -1;
+#ifdef __linux__
+	if(profile->cpus != NULL) {
+		cpu = g_array_index(profile->cpus, int,
+			(guint)g_atomic_int_add(&profile->next, 1) % profile->cpus->len);
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		CPU_SET(cpu, &cpuset);
+		if(sched_setaffinity(0, sizeof(cpuset), &cpuset) < 0) {
+			JANUS_LOG(LOG_WARN, "Couldn't pin %s thread '%s' to CPU %d: %d (%s)\n",
+				janus_sched_class_names[tclass], name, cpu, errno, g_strerror(errno));
+			cpu = -1;
+		}
+	}
+#endif
+	int priority = 0;
+	if(profile->priority > 0) {
+		struct sched_param param = { 0 };
+		param.sched_priority = profile->priority;
+		int res = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if(res != 0) {
+			/* Most likely, we don't have CAP_SYS_NICE or a high enough RLIMIT_RTPRIO */
+			JANUS_LOG(LOG_WARN, "Couldn't set SCHED_FIFO priority %d for %s thread '%s': %d (%s)\n",
+				profile->priority, janus_sched_class_names[tclass], name, res, g_strerror(res));
+		} else {
+			priority = profile->priority;
+		}
+	}
+	JANUS_LOG(LOG_VERB, "Applied %s profile to thread '%s' (CPU %d, priority %d)\n",
+		janus_sched_class_names[tclass], name, cpu, priority);
+	janus_sched_thread *thread = g_malloc0(sizeof(janus_sched_thread));
+	thread->name = g_strdup(name);
+	thread->tclass = tclass;
+	thread->cpu = cpu;
+	thread->priority = priority;
+	thread->started = janus_get_real_time();
+	janus_mutex_lock(&threads_mutex);
+	if(threads != NULL)
+		g_hash_table_insert(threads, g_thread_self(), thread);
+	else
+		janus_sched_thread_free(thread);
+	janus_mutex_unlock(&threads_mutex);
+	return (cpu >= 0);
+}
+
+void janus_sched_thread_stop(void) {
+	janus_mutex_lock(&threads_mutex);
+	if(threads != NULL)
+		g_hash_table_remove(threads, g_thread_self());
+	janus_mutex_unlock(&threads_mutex);
+}
+
+json_t *janus_sched_info(void) {
+	json_t *info = json_object();
+	json_t *classes = json_object();
+	int i = 0;
+	for(i=0; i<JANUS_SCHED_CLASSES; i++) {
+		if(profiles[i].cpus == NULL && profiles[i].priority == 0)
+			continue;
+		json_t *c = json_object();
+		json_t *cpus = json_array();
+		guint j = 0;
+		for(j=0; profiles[i].cpus && j<profiles[i].cpus->len; j++)
+			json_array_append_new(cpus, json_integer(g_array_index(profiles[i].cpus, int, j)));
+		json_object_set_new(c, "cpus", cpus);
+		json_object_set_new(c, "policy", json_string(profiles[i].priority > 0 ? "fifo" : "default"));
+		if(profiles[i].priority > 0)
+			json_object_set_new(c, "priority", json_integer(profiles[i].priority));
+		json_object_set_new(classes, janus_sched_class_names[i], c);
+	}
+	json_object_set_new(info, "classes", classes);
+	json_object_set_new(info, "isolate", isolate ? json_true() : json_false());
+	if(general_cpus != NULL) {
+		json_t *cpus = json_array();
+		guint j = 0;
+		for(j=0; j<general_cpus->len; j++)
+			json_array_append_new(cpus, json_integer(g_array_index(general_cpus, int, j)));
+		json_object_set_new(info, "general_cpus", cpus);
+	}
+	json_t *list = json_array();
+	janus_mutex_lock(&threads_mutex);
+	if(threads != NULL) {
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, threads);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) {
+			janus_sched_thread *thread = value;
+			json_t *t = json_object();
+			json_object_set_new(t, "name", json_string(thread->name));
+			json_object_set_new(t, "class", json_string(janus_sched_class_names[thread->tclass]));
+			if(thread->cpu >= 0)
+				json_object_set_new(t, "cpu", json_integer(thread->cpu));
+			json_object_set_new(t, "policy", json_string(thread->priority > 0 ? "fifo" : "default"));
+			if(thread->priority > 0)
+				json_object_set_new(t, "priority", json_integer(thread->priority));
+			json_object_set_new(t, "started", json_integer(thread->started));
+			json_array_append_new(list, t);
+		}
+	}
+	janus_mutex_unlock(&threads_mutex);
+	json_object_set_new(info, "threads", list);
+	return info;
+}
@@ -0,0 +1,75 @@
+/*! \file    sched-profile.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Scheduling profile for media threads (headers)
+ * \details  Implementation of the real-time scheduling profile that can be
+ * configured in the \c scheduling section of \c janus.jcfg. Threads that
+ * are sensitive to latency (static ICE event loops, AudioBridge mixers,
+ * VideoRoom and Streaming helpers) belong to a class: each class can be
+ * given a set of CPU cores its threads are pinned to (round robin, one
+ * core per thread), and an optional \c SCHED_FIFO priority. All the other
+ * threads (API, transports, logging, event handlers, etc.) can optionally
+ * be kept away from the cores reserved to media threads, so that bursts
+ * of requests can't preempt the mixers or the event loops.
+ *
+ * Threads apply their profile themselves when they start, by calling
+ * janus_sched_thread_start, and remove it from the list of known threads
+ * with janus_sched_thread_stop when they're done: the resulting mapping
+ * of threads to cores can be queried via the Admin API.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef JANUS_SCHED_PROFILE_H
+#define JANUS_SCHED_PROFILE_H
+
+#include <glib.h>
+#include <jansson.h>
+
+#include "config.h"
+
+
+/*! \brief Classes of threads a scheduling profile can be configured for */
+typedef enum janus_sched_class {
+	/*! \brief Static ICE event loops */
+	JANUS_SCHED_ICE_LOOP = 0,
+	/*! \brief AudioBridge mixer threads */
+	JANUS_SCHED_MIXER,
+	/*! \brief VideoRoom and Streaming helper threads */
+	JANUS_SCHED_HELPER,
+	/*! \brief Number of thread classes */
+	JANUS_SCHED_CLASSES
+} janus_sched_class;
+
+/*! \brief Helper to get the name of a thread class, as used in the configuration
+ * @param[in] tclass The thread class
+ * @returns The name of the class, or NULL if invalid */
+const char *janus_sched_class_name(janus_sched_class tclass);
+
+/*! \brief Initialize the scheduling profile from the \c scheduling category of the configuration
+ * \note If isolation is enabled, the calling thread (and so all the threads
+ * it will create from now on) is moved to the cores that are not reserved
+ * to any class: that's why this should be called as early as possible
+ * @param[in] config The core configuration
+ * @returns 0 in case of success, a negative integer otherwise */
+int janus_sched_init(janus_config *config);
+/*! \brief De-initialize the scheduling profile */
+void janus_sched_deinit(void);
+
+/*! \brief Apply the profile of a class to the calling thread
+ * \note This must be called by the thread itself: it must be paired to a
+ * call to janus_sched_thread_stop when the thread is about to quit
+ * @param[in] tclass The class the thread belongs to
+ * @param[in] name A name for the thread, as it will be shown in the Admin API
+ * @returns TRUE if the thread was pinned to a core, FALSE otherwise
+ * (e.g., because no core was configured for the class) */
+gboolean janus_sched_thread_start(janus_sched_class tclass, const char *name);
+/*! \brief Remove the calling thread from the list of tracked threads */
+void janus_sched_thread_stop(void);
+
+/*! \brief Get a summary of the scheduling profile, and of the threads it's been applied to
+ * @returns A JSON object with the configured classes and the mapping of threads to cores */
+json_t *janus_sched_info(void);
+
+#endif
@@ -37,6 +37,7 @@ cd /path/to/sctp
 #include "janus.h"
 #include "ice.h"
 #include "debug.h"
+#include "plugins/plugin.h"
 
 #ifdef DEBUG_SCTP
 /* If we're debugging the SCTP messaging, save the files here (edit path) */
@@ -120,18 +121,56 @@ void janus_sctp_handle_stream_reset_event(janus_sctp_association *sctp, struct s
 void janus_sctp_handle_remote_error_event(struct sctp_remote_error *sre);
 void janus_sctp_handle_send_failed_event(struct sctp_send_failed_event *ssfe);
 void janus_sctp_handle_notification(janus_sctp_association *sctp, union sctp_notification *notif, size_t n);
+static void janus_sctp_flush_batch(janus_sctp_association *sctp);
 
 /* We need to keep a map of associations with random IDs, as usrsctp will
- * use the pointer to our structures in the actual messages instead */
-static janus_mutex sctp_mutex;
+ * use the pointer to our structures in the actual messages instead: since
+ * we look it up for each incoming and outgoing message, it's a read-write lock */
+static janus_rwlock sctp_rwlock;
 static GHashTable *sctp_ids = NULL;
 static void janus_sctp_association_unref(janus_sctp_association *sctp);
 
+/* When usrsctp has no threads of its own, its timers are handled by the
+ * loops of handles with an association: they're global, though, so we only
+ * let one loop at a time handle them, and only pass the time actually elapsed */
+static gboolean sctp_nothreads = FALSE;
+#define JANUS_SCTP_TIMERS_PERIOD	10
+static janus_mutex timers_mutex = JANUS_MUTEX_INITIALIZER;
+static gint64 timers_last = 0;
+static gboolean janus_sctp_handle_timers(gpointer user_data) {
+	if(!janus_mutex_trylock(&timers_mutex))
+		return G_SOURCE_CONTINUE;
+	gint64 now = janus_get_monotonic_time();
+	if(timers_last == 0)
+		timers_last = now;
+	guint32 elapsed = (now - timers_last)/1000;
+	if(elapsed >= JANUS_SCTP_TIMERS_PERIOD) {
+#ifdef HAVE_USRSCTP_NOTHREADS
+		usrsctp_handle_timers(elapsed);
+#endif
+		timers_last += (gint64)elapsed*1000;
+	}
+	janus_mutex_unlock(&timers_mutex);
+	return G_SOURCE_CONTINUE;
+}
+
 /* SCTP management code */
 static gboolean sctp_running;
-int janus_sctp_init(void) {
+int janus_sctp_init(gboolean nothreads) {
 	/* Initialize the SCTP stack */
+#ifdef HAVE_USRSCTP_NOTHREADS
+	if(nothreads) {
+		usrsctp_init_nothreads(0, janus_sctp_data_to_dtls, NULL);
+		sctp_nothreads = TRUE;
+		JANUS_LOG(LOG_INFO, "SCTP timers will be handled by the handle loops\n");
+	} else {
+		usrsctp_init(0, janus_sctp_data_to_dtls, NULL);
+	}
+#else
+	if(nothreads)
+		JANUS_LOG(LOG_WARN, "This usrsctp library can't be initialized without threads, using the usrsctp threads\n");
 	usrsctp_init(0, janus_sctp_data_to_dtls, NULL);
+#endif
 	sctp_running = TRUE;
 
 #ifdef DEBUG_SCTP
@@ -142,7 +181,7 @@ int janus_sctp_init(void) {
 #endif
 
 	/* Create a map of local IDs too, to map them to our SCTP associations */
-	janus_mutex_init(&sctp_mutex);
+	janus_rwlock_init(&sctp_rwlock);
 	sctp_ids = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)janus_sctp_association_unref);
 
 	return 0;
@@ -151,9 +190,9 @@ int janus_sctp_init(void) {
 void janus_sctp_deinit(void) {
 	usrsctp_finish();
 	sctp_running = FALSE;
-	janus_mutex_lock(&sctp_mutex);
+	janus_rwlock_write_lock(&sctp_rwlock);
 	g_clear_pointer(&sctp_ids, g_hash_table_destroy);
-	janus_mutex_unlock(&sctp_mutex);
+	janus_rwlock_write_unlock(&sctp_rwlock);
 }
 
 static void janus_sctp_association_unref(janus_sctp_association *sctp) {
@@ -168,6 +207,10 @@ static void janus_sctp_association_free(const janus_refcount *sctp_ref) {
 	janus_refcount_decrease(&sctp->dtls->ref);
 	if(sctp->pending_messages != NULL)
 		g_queue_free_full(sctp->pending_messages, (GDestroyNotify)janus_sctp_pending_message_free);
+	if(sctp->batch != NULL)
+		g_array_free(sctp->batch, TRUE);
+	if(sctp->batch_buffers != NULL)
+		g_ptr_array_free(sctp->batch_buffers, TRUE);
 #ifdef DEBUG_SCTP
 	if(sctp->debug_dump != NULL)
 		fclose(sctp->debug_dump);
@@ -200,6 +243,9 @@ janus_sctp_association *janus_sctp_association_create(janus_dtls_srtp *dtls, jan
 	sctp->buflen = 0;
 	sctp->offset = 0;
 	sctp->pending_messages = NULL;
+	/* Buffers for batched messages are allocated once, and reused for each packet */
+	sctp->batch = g_array_sized_new(FALSE, FALSE, sizeof(janus_plugin_data), 8);
+	sctp->batch_buffers = g_ptr_array_new_full(8, free);
 #ifdef DEBUG_SCTP
 	sctp->debug_dump = NULL;
 #endif
@@ -231,7 +277,7 @@ janus_sctp_association *janus_sctp_association_create(janus_dtls_srtp *dtls, jan
 	/* Create a unique ID to map locally: this is what we'll pass to
 	 * usrsctp_socket, which means that's what we'll get in callbacks
 	 * too: we can then use the map to retrieve the actual struct */
-	janus_mutex_lock(&sctp_mutex);
+	janus_rwlock_write_lock(&sctp_rwlock);
 	while(sctp->map_id == 0) {
 		sctp->map_id = janus_random_uint32();
 		if(g_hash_table_lookup(sctp_ids, GUINT_TO_POINTER(sctp->map_id)) != NULL) {
@@ -241,7 +287,7 @@ janus_sctp_association *janus_sctp_association_create(janus_dtls_srtp *dtls, jan
 	}
 	janus_refcount_increase(&sctp->ref);
 	g_hash_table_insert(sctp_ids, GUINT_TO_POINTER(sctp->map_id), sctp);
-	janus_mutex_unlock(&sctp_mutex);
+	janus_rwlock_write_unlock(&sctp_rwlock);
 
 	usrsctp_register_address(GUINT_TO_POINTER(sctp->map_id));
 	usrsctp_sysctl_set_sctp_ecn_enable(0);
@@ -352,6 +398,15 @@ janus_sctp_association *janus_sctp_association_create(janus_dtls_srtp *dtls, jan
 		return NULL;
 	}
 	JANUS_LOG(LOG_VERB, "[%"SCNu64"] Connected to the DataChannel peer\n", sctp->handle_id);
+	if(sctp_nothreads && handle->mainctx != NULL) {
+		/* usrsctp has no thread handling timers, let this handle loop do that */
+		janus_refcount_increase(&sctp->ref);
+		sctp->timers_source = g_timeout_source_new(JANUS_SCTP_TIMERS_PERIOD);
+		g_source_set_priority(sctp->timers_source, G_PRIORITY_DEFAULT);
+		g_source_set_callback(sctp->timers_source, janus_sctp_handle_timers, sctp,
+			(GDestroyNotify)janus_sctp_association_unref);
+		g_source_attach(sctp->timers_source, handle->mainctx);
+	}
 	return sctp;
 }
 
@@ -359,11 +414,17 @@ void janus_sctp_association_destroy(janus_sctp_association *sctp) {
 	if(sctp == NULL || !g_atomic_int_compare_and_exchange(&sctp->destroyed, 0, 1))
 		return;
 
+	if(sctp->timers_source != NULL) {
+		g_source_destroy(sctp->timers_source);
+		g_source_unref(sctp->timers_source);
+		sctp->timers_source = NULL;
+	}
+
 	if(sctp->map_id != 0) {
 		usrsctp_deregister_address(GUINT_TO_POINTER(sctp->map_id));
-		janus_mutex_lock(&sctp_mutex);
+		janus_rwlock_write_lock(&sctp_rwlock);
 		g_hash_table_remove(sctp_ids, GUINT_TO_POINTER(sctp->map_id));
-		janus_mutex_unlock(&sctp_mutex);
+		janus_rwlock_write_unlock(&sctp_rwlock);
 	}
 	if(sctp->sock != NULL) {
 		usrsctp_shutdown(sctp->sock, SHUT_RDWR);
@@ -387,13 +448,28 @@ void janus_sctp_data_from_dtls(janus_sctp_association *sctp, char *buf, int len)
 		}
 	}
 #endif
+	/* All the messages usrsctp gives us while processing this packet are
+	 * batched, and passed to the plugin at once when we're done with it */
+	sctp->batch_thread = g_thread_self();
 	usrsctp_conninput(GUINT_TO_POINTER(sctp->map_id), buf, len, 0);
+	sctp->batch_thread = NULL;
+	janus_sctp_flush_batch(sctp);
+}
+
+static void janus_sctp_flush_batch(janus_sctp_association *sctp) {
+	if(sctp->batch == NULL || sctp->batch->len == 0)
+		return;
+	if(sctp->dtls != NULL)
+		janus_ice_incoming_data_batch(sctp->handle, (janus_plugin_data *)sctp->batch->data, sctp->batch->len);
+	g_array_set_size(sctp->batch, 0);
+	/* This frees the usrsctp buffers the messages pointed to */
+	g_ptr_array_set_size(sctp->batch_buffers, 0);
 }
 
 int janus_sctp_data_to_dtls(void *instance, void *buffer, size_t length, uint8_t tos, uint8_t set_df) {
-	janus_mutex_lock(&sctp_mutex);
+	janus_rwlock_read_lock(&sctp_rwlock);
 	janus_sctp_association *sctp = (janus_sctp_association *)g_hash_table_lookup(sctp_ids, instance);
-	janus_mutex_unlock(&sctp_mutex);
+	janus_rwlock_read_unlock(&sctp_rwlock);
 	if(sctp == NULL || sctp->handle == NULL)
 		return -1;
 	JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Data from SCTP to DTLS stack: %zu bytes\n", sctp->handle_id, length);
@@ -413,9 +489,9 @@ int janus_sctp_data_to_dtls(void *instance, void *buffer, size_t length, uint8_t
 }
 
 static int janus_sctp_incoming_data(struct socket *sock, union sctp_sockstore addr, void *data, size_t datalen, struct sctp_rcvinfo rcv, int flags, void *ulp_info) {
-	janus_mutex_lock(&sctp_mutex);
+	janus_rwlock_read_lock(&sctp_rwlock);
 	janus_sctp_association *sctp = (janus_sctp_association *)g_hash_table_lookup(sctp_ids, ulp_info);
-	janus_mutex_unlock(&sctp_mutex);
+	janus_rwlock_read_unlock(&sctp_rwlock);
 	if(sctp == NULL || sctp->dtls == NULL) {
 		free(data);
 		return 0;
@@ -426,7 +502,13 @@ static int janus_sctp_incoming_data(struct socket *sock, union sctp_sockstore ad
 		} else {
 			janus_sctp_handle_message(sctp, data, datalen, ntohl(rcv.rcv_ppid), rcv.rcv_sid, flags);
 		}
-		free(data);
+		if(sctp->batch_keep) {
+			/* A batched message points to this buffer, we'll free it later */
+			sctp->batch_keep = FALSE;
+			g_ptr_array_add(sctp->batch_buffers, data);
+		} else {
+			free(data);
+		}
 	}
 	return 1;
 }
@@ -1094,6 +1176,23 @@ void janus_sctp_handle_data_message(janus_sctp_association *sctp, gboolean textd
 			sctp->handle_id, length, channel->id);
 		JANUS_LOG(LOG_HUGE, "[%"SCNu64"] Incoming SCTP contents: %.*s\n",
 			sctp->handle_id, (int)length, buffer);
+		if(sctp->batch_thread == g_thread_self() && buffer != sctp->buffer) {
+			/* We're in the middle of a packet: add this message to the batch,
+			 * pointing to the usrsctp buffer (labels are in the association) */
+			janus_plugin_data data = {
+				.label = channel->label,
+				.protocol = strlen(channel->protocol) ? channel->protocol : NULL,
+				.binary = !textdata,
+				.buffer = buffer,
+				.length = (uint16_t)length
+			};
+			g_array_append_val(sctp->batch, data);
+			sctp->batch_keep = TRUE;
+			return;
+		}
+		/* Reassembled messages live in a buffer we reuse, so they can't be
+		 * batched: deliver what we have so far first, to preserve the order */
+		janus_sctp_flush_batch(sctp);
 		/* Pass this to the core */
 		janus_dtls_notify_sctp_data(sctp->dtls, channel->label,
 			strlen(channel->protocol) ? channel->protocol : NULL,
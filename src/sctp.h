@@ -48,8 +48,13 @@
 
 
 /*! \brief SCTP stuff initialization
+ * \note When \c nothreads is TRUE (and the usrsctp library supports it), usrsctp
+ * doesn't spawn its own threads: its timers are instead driven by the loops of
+ * the handles that have an SCTP association, which avoids waking up (and competing
+ * for the usrsctp locks with) a separate thread when there are many associations
+ * \param[in] nothreads Whether usrsctp should be initialized without its own threads
  * \returns 0 on success, a negative integer otherwise */
-int janus_sctp_init(void);
+int janus_sctp_init(gboolean nothreads);
 
 /*! \brief SCTP stuff de-initialization */
 void janus_sctp_deinit(void);
@@ -129,6 +134,16 @@ typedef struct janus_sctp_association {
 	size_t offset;
 	/*! \brief Buffer of pending messages */
 	GQueue *pending_messages;
+	/*! \brief Messages received while feeding a single packet to the SCTP stack, delivered to the plugin all at once */
+	GArray *batch;
+	/*! \brief Buffers (allocated by usrsctp) the batched messages point to */
+	GPtrArray *batch_buffers;
+	/*! \brief Thread feeding a packet to the SCTP stack right now, if any: only messages it gets are batched */
+	GThread *batch_thread;
+	/*! \brief Whether the SCTP stack buffer we're handling is now part of the batch */
+	gboolean batch_keep;
+	/*! \brief Source driving the usrsctp timers from the handle loop, when usrsctp has no threads */
+	GSource *timers_source;
 #ifdef DEBUG_SCTP
 	FILE *debug_dump;
 #endif
@@ -48,6 +48,61 @@ void janus_sdp_attribute_destroy(janus_sdp_attribute *a) {
 	janus_refcount_decrease(&a->ref);
 }
 
+/* When parsing an SDP, we copy it once to a single block of memory, and
+ * tokenize it in place: the name and value of attributes (the bulk of any
+ * SDP) point to that copy, and the attributes themselves are allocated
+ * from the same block, which saves two or three allocations per a= line.
+ * Since attributes can be destroyed and added independently of the SDP
+ * they came from, each parsed attribute holds a reference to the block */
+struct janus_sdp_arena {
+	char *buffer;
+	size_t size, offset;
+	janus_refcount ref;
+};
+
+static void janus_sdp_arena_free(const janus_refcount *arena_ref) {
+	janus_sdp_arena *arena = janus_refcount_containerof(arena_ref, janus_sdp_arena, ref);
+	g_free(arena->buffer);
+	g_free(arena);
+}
+
+static janus_sdp_arena *janus_sdp_arena_create(const char *sdp, char **copy) {
+	/* Each line can result in one attribute at most: count them to size the block */
+	size_t len = strlen(sdp), lines = 1;
+	const char *nl = sdp;
+	while((nl = memchr(nl, '\n', len - (nl - sdp))) != NULL) {
+		lines++;
+		nl++;
+	}
+	size_t text = (len + 1 + 7) & ~((size_t)7);
+	janus_sdp_arena *arena = g_malloc(sizeof(janus_sdp_arena));
+	arena->size = text + lines * sizeof(janus_sdp_attribute);
+	arena->buffer = g_malloc(arena->size);
+	memcpy(arena->buffer, sdp, len + 1);
+	arena->offset = text;
+	janus_refcount_init(&arena->ref, janus_sdp_arena_free);
+	*copy = arena->buffer;
+	return arena;
+}
+
+/* Allocate a parsed attribute: name and value are set by the caller */
+static void janus_sdp_attribute_free(const janus_refcount *attr_ref);
+static janus_sdp_attribute *janus_sdp_attribute_alloc(janus_sdp_arena *arena) {
+	janus_sdp_attribute *a = NULL;
+	if(arena->offset + sizeof(janus_sdp_attribute) <= arena->size) {
+		a = (janus_sdp_attribute *)(arena->buffer + arena->offset);
+		arena->offset += sizeof(janus_sdp_attribute);
+		memset(a, 0, sizeof(janus_sdp_attribute));
+		janus_refcount_increase(&arena->ref);
+		a->arena = arena;
+	} else {
+		/* Shouldn't happen, as we sized the block for one attribute per line */
+		a = g_malloc0(sizeof(janus_sdp_attribute));
+	}
+	janus_refcount_init(&a->ref, janus_sdp_attribute_free);
+	return a;
+}
+
 /* Internal frees */
 static void janus_sdp_free(const janus_refcount *sdp_ref) {
 	janus_sdp *sdp = janus_refcount_containerof(sdp_ref, janus_sdp, ref);
@@ -98,6 +153,11 @@ static void janus_sdp_mline_free(const janus_refcount *mline_ref) {
 
 static void janus_sdp_attribute_free(const janus_refcount *attr_ref) {
 	janus_sdp_attribute *attr = janus_refcount_containerof(attr_ref, janus_sdp_attribute, ref);
+	if(attr->arena != NULL) {
+		/* The attribute and its strings are part of the block it was parsed from */
+		janus_refcount_decrease(&attr->arena->ref);
+		return;
+	}
 	/* This SDP attribute instance can be destroyed, free all the resources */
 	g_free(attr->name);
 	g_free(attr->value);
@@ -176,6 +236,7 @@ janus_sdp_attribute *janus_sdp_attribute_create(const char *name, const char *va
 	a->name = g_strdup(name);
 	a->direction = JANUS_SDP_DEFAULT;
 	a->value = NULL;
+	a->arena = NULL;
 	if(value) {
 		char buffer[2048];
 		va_list ap;
@@ -295,6 +356,32 @@ const char *janus_sdp_oa_type_str(janus_sdp_oa_type type) {
 	return NULL;
 }
 
+/* Parse an a= line (without the a= prefix) in place to an attribute */
+static janus_sdp_attribute *janus_sdp_attribute_parse(janus_sdp_arena *arena, char *line) {
+	char *semicolon = strchr(line, ':');
+	if(semicolon != NULL && *(semicolon+1) == '\0')
+		return NULL;
+	janus_sdp_attribute *a = janus_sdp_attribute_alloc(arena);
+	a->direction = JANUS_SDP_DEFAULT;
+	if(semicolon != NULL) {
+		if(strstr(line, "/sendonly"))
+			a->direction = JANUS_SDP_SENDONLY;
+		else if(strstr(line, "/recvonly"))
+			a->direction = JANUS_SDP_RECVONLY;
+		if(strstr(line, "/inactive"))
+			a->direction = JANUS_SDP_INACTIVE;
+		*semicolon = '\0';
+	}
+	if(a->arena != NULL) {
+		a->name = line;
+		a->value = semicolon ? semicolon+1 : NULL;
+	} else {
+		a->name = g_strdup(line);
+		a->value = semicolon ? g_strdup(semicolon+1) : NULL;
+	}
+	return a;
+}
+
 janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 	if(!sdp)
 		return NULL;
@@ -314,18 +401,18 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 	int mlines = 0;
 	int index = 0;
 	char *line = NULL, *cr = NULL, *rest = NULL;
-	char *sdp_copy = g_strdup(sdp);
+	char *sdp_copy = NULL;
+	janus_sdp_arena *arena = janus_sdp_arena_create(sdp, &sdp_copy);
 	gboolean first = TRUE, mline_ended = FALSE;
 	/* When a m-line has been detected we re-use the previous SDP line */
 	while(success && (mline_ended || (line = strtok_r(!first ? NULL: sdp_copy, "\n", &rest)) != NULL)) {
 		first = FALSE;
 		mline_ended = FALSE;
+		/* The copy is tokenized in place, and not restored, as attributes point to it */
 		cr = strchr(line, '\r');
 		if(cr != NULL)
 			*cr = '\0';
 		if(*line == '\0') {
-			if(cr != NULL)
-				*cr = '\r';
 			index++;
 			continue;
 		}
@@ -430,32 +517,13 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 					break;
 				}
 				case 'a': {
-					janus_sdp_attribute *a = g_malloc0(sizeof(janus_sdp_attribute));
-					janus_refcount_init(&a->ref, janus_sdp_attribute_free);
 					line += 2;
-					char *semicolon = strchr(line, ':');
-					if(semicolon == NULL) {
-						a->name = g_strdup(line);
-						a->value = NULL;
-					} else {
-						if(*(semicolon+1) == '\0') {
-							janus_sdp_attribute_destroy(a);
-							if(error)
-								g_snprintf(error, errlen, "Invalid a= line: %s", line);
-							success = FALSE;
-							break;
-						}
-						*semicolon = '\0';
-						a->name = g_strdup(line);
-						a->value = g_strdup(semicolon+1);
-						a->direction = JANUS_SDP_DEFAULT;
-						*semicolon = ':';
-						if(strstr(line, "/sendonly"))
-							a->direction = JANUS_SDP_SENDONLY;
-						else if(strstr(line, "/recvonly"))
-							a->direction = JANUS_SDP_RECVONLY;
-						if(strstr(line, "/inactive"))
-							a->direction = JANUS_SDP_INACTIVE;
+					janus_sdp_attribute *a = janus_sdp_attribute_parse(arena, line);
+					if(a == NULL) {
+						if(error)
+							g_snprintf(error, errlen, "Invalid a= line: %s", line);
+						success = FALSE;
+						break;
 					}
 					imported->attributes = g_list_prepend(imported->attributes, a);
 					break;
@@ -495,34 +563,28 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 					m->proto = g_strdup(proto);
 					m->direction = JANUS_SDP_SENDRECV;
 					m->c_ipv4 = TRUE;
-					/* Now let's check the payload types/formats */
-					gchar **mline_parts = g_strsplit(line+2, " ", -1);
-					if(!mline_parts && (m->port > 0 || m->type == JANUS_SDP_APPLICATION)) {
-						janus_sdp_mline_destroy(m);
-						if(error)
-							g_snprintf(error, errlen, "Invalid m= line (no payload types/formats): %s", line);
-						success = FALSE;
-						break;
-					} else {
+					/* Now let's check the payload types/formats: we walk the
+					 * line rather than splitting it, skipping what we parsed already */
+					{
+						const char *part = line+2;
 						int mindex = 0;
-						while(mline_parts[mindex]) {
-							if(mindex < 3) {
-								/* We've parsed these before */
-								mindex++;
-								continue;
-							}
-							/* Add string fmt */
-							m->fmts = g_list_prepend(m->fmts, g_strdup(mline_parts[mindex]));
-							/* Add numeric payload type */
-							int ptype = atoi(mline_parts[mindex]);
-							if(ptype < 0) {
-								JANUS_LOG(LOG_ERR, "Invalid payload type (%s)\n", mline_parts[mindex]);
-							} else {
-								m->ptypes = g_list_prepend(m->ptypes, GINT_TO_POINTER(ptype));
+						while(*part != '\0') {
+							size_t partlen = strcspn(part, " ");
+							if(partlen > 0 && mindex++ >= 3) {
+								/* Add string fmt */
+								m->fmts = g_list_prepend(m->fmts, g_strndup(part, partlen));
+								/* Add numeric payload type */
+								int ptype = atoi(part);
+								if(ptype < 0) {
+									JANUS_LOG(LOG_ERR, "Invalid payload type (%.*s)\n", (int)partlen, part);
+								} else {
+									m->ptypes = g_list_prepend(m->ptypes, GINT_TO_POINTER(ptype));
+								}
 							}
-							mindex++;
+							part += partlen;
+							if(*part == ' ')
+								part++;
 						}
-						g_strfreev(mline_parts);
 						if(m->fmts == NULL || m->ptypes == NULL) {
 							janus_sdp_mline_destroy(m);
 							if(error)
@@ -576,8 +638,6 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 				case 'b': {
 					if(mline->b_name) {
 						JANUS_LOG(LOG_WARN, "Ignoring extra m-line b= line: %s\n", line);
-						if(cr != NULL)
-							*cr = '\r';
 						index++;
 						continue;
 					}
@@ -600,39 +660,21 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 					break;
 				}
 				case 'a': {
-					janus_sdp_attribute *a = g_malloc0(sizeof(janus_sdp_attribute));
-					janus_refcount_init(&a->ref, janus_sdp_attribute_free);
 					line += 2;
-					char *semicolon = strchr(line, ':');
-					if(semicolon == NULL) {
+					if(strchr(line, ':') == NULL) {
 						/* Is this a media direction attribute? */
 						janus_sdp_mdirection direction = janus_sdp_parse_mdirection(line);
 						if(direction != JANUS_SDP_INVALID) {
-							janus_sdp_attribute_destroy(a);
 							mline->direction = direction;
 							break;
 						}
-						a->name = g_strdup(line);
-						a->value = NULL;
-					} else {
-						if(*(semicolon+1) == '\0') {
-							janus_sdp_attribute_destroy(a);
-							if(error)
-								g_snprintf(error, errlen, "Invalid a= line: %s", line);
-							success = FALSE;
-							break;
-						}
-						*semicolon = '\0';
-						a->name = g_strdup(line);
-						a->value = g_strdup(semicolon+1);
-						a->direction = JANUS_SDP_DEFAULT;
-						*semicolon = ':';
-						if(strstr(line, "/sendonly"))
-							a->direction = JANUS_SDP_SENDONLY;
-						else if(strstr(line, "/recvonly"))
-							a->direction = JANUS_SDP_RECVONLY;
-						if(strstr(line, "/inactive"))
-							a->direction = JANUS_SDP_INACTIVE;
+					}
+					janus_sdp_attribute *a = janus_sdp_attribute_parse(arena, line);
+					if(a == NULL) {
+						if(error)
+							g_snprintf(error, errlen, "Invalid a= line: %s", line);
+						success = FALSE;
+						break;
 					}
 					mline->attributes = g_list_prepend(mline->attributes, a);
 					break;
@@ -650,13 +692,10 @@ janus_sdp *janus_sdp_parse(const char *sdp, char *error, size_t errlen) {
 					break;
 			}
 		}
-		if(cr != NULL)
-			*cr = '\r';
 		index++;
 	}
-	if(cr != NULL)
-		*cr = '\r';
-	g_free(sdp_copy);
+	/* Parsed attributes hold their own reference to the copy */
+	janus_refcount_decrease(&arena->ref);
 	/* FIXME Do a last check: is all the stuff that's supposed to be there available? */
 	if(success && (imported->o_name == NULL || imported->o_addr == NULL || imported->s_name == NULL || imported->m_lines == NULL)) {
 		success = FALSE;
@@ -1120,55 +1159,116 @@ int janus_sdp_get_opusred_pt(janus_sdp *sdp, int index) {
 	return -1;
 }
 
+/* The writer first computes how large the SDP can be, so that it can be
+ * written to a single buffer without reallocations or size limits: strings
+ * are counted exactly, while numbers and fixed text are given a margin */
+#define JANUS_SDP_LINE_MARGIN	64
+#define JANUS_SDP_PT_MARGIN		12
+
+static size_t janus_sdp_strlen(const char *str) {
+	return str ? strlen(str) : 0;
+}
+
+static size_t janus_sdp_attributes_size(GList *attributes) {
+	size_t size = 0;
+	while(attributes) {
+		janus_sdp_attribute *a = (janus_sdp_attribute *)attributes->data;
+		/* a=name:value\r\n */
+		size += 6 + janus_sdp_strlen(a->name) + janus_sdp_strlen(a->value);
+		attributes = attributes->next;
+	}
+	return size;
+}
+
+static size_t janus_sdp_write_size(janus_sdp *imported) {
+	size_t size = 4*JANUS_SDP_LINE_MARGIN + janus_sdp_strlen(imported->o_name) +
+		janus_sdp_strlen(imported->o_addr) + janus_sdp_strlen(imported->s_name);
+	if(imported->c_addr != NULL)
+		size += JANUS_SDP_LINE_MARGIN + strlen(imported->c_addr);
+	size += janus_sdp_attributes_size(imported->attributes);
+	GList *temp = imported->m_lines;
+	while(temp) {
+		janus_sdp_mline *m = (janus_sdp_mline *)temp->data;
+		/* m=, c=, b= and direction lines */
+		size += 4*JANUS_SDP_LINE_MARGIN + janus_sdp_strlen(m->type_str) + janus_sdp_strlen(m->proto) +
+			janus_sdp_strlen(m->c_addr) + janus_sdp_strlen(m->b_name);
+		size += g_list_length(m->ptypes) * JANUS_SDP_PT_MARGIN;
+		GList *fmts = m->fmts;
+		while(fmts) {
+			size += 1 + janus_sdp_strlen((char *)fmts->data);
+			fmts = fmts->next;
+		}
+		size += janus_sdp_attributes_size(m->attributes);
+		temp = temp->next;
+	}
+	return size + 1;
+}
+
+/* Helpers to append to the SDP we're writing */
+static void janus_sdp_append(char *sdp, size_t size, size_t *offset, const char *str) {
+	size_t len = strlen(str);
+	if(*offset + len >= size)
+		len = size - *offset - 1;
+	memcpy(sdp + *offset, str, len);
+	*offset += len;
+	sdp[*offset] = '\0';
+}
+
+static void janus_sdp_append_printf(char *sdp, size_t size, size_t *offset, const char *format, ...) G_GNUC_PRINTF(4, 5);
+static void janus_sdp_append_printf(char *sdp, size_t size, size_t *offset, const char *format, ...) {
+	va_list ap;
+	va_start(ap, format);
+	int len = g_vsnprintf(sdp + *offset, size - *offset, format, ap);
+	va_end(ap);
+	if(len > 0)
+		*offset += MIN((size_t)len, size - *offset - 1);
+}
+
+static void janus_sdp_append_attribute(char *sdp, size_t size, size_t *offset, janus_sdp_attribute *a) {
+	janus_sdp_append(sdp, size, offset, "a=");
+	janus_sdp_append(sdp, size, offset, a->name);
+	if(a->value != NULL) {
+		janus_sdp_append(sdp, size, offset, ":");
+		janus_sdp_append(sdp, size, offset, a->value);
+	}
+	janus_sdp_append(sdp, size, offset, "\r\n");
+}
+
 char *janus_sdp_write(janus_sdp *imported) {
 	if(!imported)
 		return NULL;
 	janus_refcount_increase(&imported->ref);
-	char *sdp = g_malloc(2560), mline[8192], buffer[2048];
+	size_t sdplen = janus_sdp_write_size(imported), offset = 0;
+	char *sdp = g_malloc(sdplen);
 	*sdp = '\0';
-	size_t sdplen = 2560, mlen = sizeof(mline), offset = 0, moffset = 0;
 	/* v= */
-	g_snprintf(buffer, sizeof(buffer), "v=%d\r\n", imported->version);
-	janus_strlcat_fast(sdp, buffer, sdplen, &offset);
+	janus_sdp_append_printf(sdp, sdplen, &offset, "v=%d\r\n", imported->version);
 	/* o= */
-	g_snprintf(buffer, sizeof(buffer), "o=%s %"SCNu64" %"SCNu64" IN %s %s\r\n",
+	janus_sdp_append_printf(sdp, sdplen, &offset, "o=%s %"SCNu64" %"SCNu64" IN %s %s\r\n",
 		imported->o_name, imported->o_sessid, imported->o_version,
 		imported->o_ipv4 ? "IP4" : "IP6", imported->o_addr);
-	janus_strlcat_fast(sdp, buffer, sdplen, &offset);
 	/* s= */
-	g_snprintf(buffer, sizeof(buffer), "s=%s\r\n", imported->s_name);
-	janus_strlcat_fast(sdp, buffer, sdplen, &offset);
+	janus_sdp_append_printf(sdp, sdplen, &offset, "s=%s\r\n", imported->s_name);
 	/* t= */
-	g_snprintf(buffer, sizeof(buffer), "t=%"SCNu64" %"SCNu64"\r\n", imported->t_start, imported->t_stop);
-	janus_strlcat_fast(sdp, buffer, sdplen, &offset);
+	janus_sdp_append_printf(sdp, sdplen, &offset, "t=%"SCNu64" %"SCNu64"\r\n", imported->t_start, imported->t_stop);
 	/* c= */
 	if(imported->c_addr != NULL) {
 		if(imported->c_ipv4 && imported->c_addr && strstr(imported->c_addr, ":"))
 			imported->c_ipv4 = FALSE;
-		g_snprintf(buffer, sizeof(buffer), "c=IN %s %s\r\n",
+		janus_sdp_append_printf(sdp, sdplen, &offset, "c=IN %s %s\r\n",
 			imported->c_ipv4 ? "IP4" : "IP6", imported->c_addr);
-		janus_strlcat_fast(sdp, buffer, sdplen, &offset);
 	}
 	/* a= */
 	GList *temp = imported->attributes;
 	while(temp) {
-		janus_sdp_attribute *a = (janus_sdp_attribute *)temp->data;
-		if(a->value != NULL) {
-			g_snprintf(buffer, sizeof(buffer), "a=%s:%s\r\n", a->name, a->value);
-		} else {
-			g_snprintf(buffer, sizeof(buffer), "a=%s\r\n", a->name);
-		}
-		janus_strlcat_fast(sdp, buffer, sdplen, &offset);
+		janus_sdp_append_attribute(sdp, sdplen, &offset, (janus_sdp_attribute *)temp->data);
 		temp = temp->next;
 	}
 	/* m= */
 	temp = imported->m_lines;
 	while(temp) {
-		mline[0] = '\0';
-		moffset = 0;
 		janus_sdp_mline *m = (janus_sdp_mline *)temp->data;
-		g_snprintf(buffer, sizeof(buffer), "m=%s %d %s", m->type_str, m->port, m->proto);
-		janus_strlcat_fast(mline, buffer, mlen, &moffset);
+		janus_sdp_append_printf(sdp, sdplen, &offset, "m=%s %d %s", m->type_str, m->port, m->proto);
 		if(m->port == 0 && m->type != JANUS_SDP_APPLICATION) {
 			/* Remove all payload types/formats if we're rejecting the media */
 			g_list_free_full(m->fmts, (GDestroyNotify)g_free);
@@ -1176,74 +1276,50 @@ char *janus_sdp_write(janus_sdp *imported) {
 			g_list_free(m->ptypes);
 			m->ptypes = NULL;
 			m->ptypes = g_list_append(m->ptypes, GINT_TO_POINTER(0));
-			janus_strlcat_fast(mline, " 0", mlen, &moffset);
+			janus_sdp_append(sdp, sdplen, &offset, " 0");
 		} else {
 			if(m->proto != NULL && strstr(m->proto, "RTP") != NULL) {
 				/* RTP profile, use payload types */
 				GList *ptypes = m->ptypes;
 				while(ptypes) {
-					g_snprintf(buffer, sizeof(buffer), " %d", GPOINTER_TO_INT(ptypes->data));
-					janus_strlcat_fast(mline, buffer, mlen, &moffset);
+					janus_sdp_append_printf(sdp, sdplen, &offset, " %d", GPOINTER_TO_INT(ptypes->data));
 					ptypes = ptypes->next;
 				}
 			} else {
 				/* Something else, use formats */
 				GList *fmts = m->fmts;
 				while(fmts) {
-					g_snprintf(buffer, sizeof(buffer), " %s", (char *)(fmts->data));
-					janus_strlcat_fast(mline, buffer, mlen, &moffset);
+					janus_sdp_append(sdp, sdplen, &offset, " ");
+					janus_sdp_append(sdp, sdplen, &offset, (char *)(fmts->data));
 					fmts = fmts->next;
 				}
 			}
 		}
-		janus_strlcat_fast(mline, "\r\n", mlen, &moffset);
+		janus_sdp_append(sdp, sdplen, &offset, "\r\n");
 		/* c= */
 		if(m->c_addr != NULL) {
-			g_snprintf(buffer, sizeof(buffer), "c=IN %s %s\r\n",
+			janus_sdp_append_printf(sdp, sdplen, &offset, "c=IN %s %s\r\n",
 				m->c_ipv4 ? "IP4" : "IP6", m->c_addr);
-			janus_strlcat_fast(mline, buffer, mlen, &moffset);
 		}
 		if(m->port > 0) {
 			/* b= */
-			if(m->b_name != NULL) {
-				g_snprintf(buffer, sizeof(buffer), "b=%s:%"SCNu32"\r\n", m->b_name, m->b_value);
-				janus_strlcat_fast(mline, buffer, mlen, &moffset);
-			}
+			if(m->b_name != NULL)
+				janus_sdp_append_printf(sdp, sdplen, &offset, "b=%s:%"SCNu32"\r\n", m->b_name, m->b_value);
 		}
 		/* a= (note that we don't format the direction if it's JANUS_SDP_DEFAULT) */
 		const char *direction = m->direction != JANUS_SDP_DEFAULT ? janus_sdp_mdirection_str(m->direction) : NULL;
-		if(direction != NULL) {
-			g_snprintf(buffer, sizeof(buffer), "a=%s\r\n", direction);
-			janus_strlcat_fast(mline, buffer, mlen, &moffset);
-		}
+		if(direction != NULL)
+			janus_sdp_append_printf(sdp, sdplen, &offset, "a=%s\r\n", direction);
 		GList *temp2 = m->attributes;
 		while(temp2) {
 			janus_sdp_attribute *a = (janus_sdp_attribute *)temp2->data;
+			temp2 = temp2->next;
 			if(m->port == 0 && strcasecmp(a->name, "mid")) {
 				/* This media has been rejected or disabled: we only add the mid attribute, if available */
-				temp2 = temp2->next;
 				continue;
 			}
-			if(a->value != NULL) {
-				g_snprintf(buffer, sizeof(buffer), "a=%s:%s\r\n", a->name, a->value);
-			} else {
-				g_snprintf(buffer, sizeof(buffer), "a=%s\r\n", a->name);
-			}
-			janus_strlcat_fast(mline, buffer, mlen, &moffset);
-			temp2 = temp2->next;
-		}
-		/* Append the generated m-line to the SDP */
-		size_t cur_sdplen = strlen(sdp);
-		size_t mlinelen = strlen(mline);
-		if(cur_sdplen + mlinelen + 1 > sdplen) {
-			/* Increase the SDP buffer first */
-			if(sdplen < (mlinelen+1))
-				sdplen = cur_sdplen + mlinelen + 1;
-			else
-				sdplen = sdplen*2;
-			sdp = g_realloc(sdp, sdplen);
+			janus_sdp_append_attribute(sdp, sdplen, &offset, a);
 		}
-		janus_strlcat_fast(sdp, mline, sdplen, &offset);
 		/* Move on */
 		temp = temp->next;
 	}
@@ -194,7 +194,14 @@ janus_sdp_mline *janus_sdp_mline_find_by_index(janus_sdp *sdp, int index);
  * @returns 0 if successful, a negative integer otherwise */
 int janus_sdp_mline_remove(janus_sdp *sdp, janus_sdp_mtype type);
 
-/*! \brief SDP a= attribute representation */
+/*! \brief Memory block parsed attributes are allocated from (opaque) */
+typedef struct janus_sdp_arena janus_sdp_arena;
+
+/*! \brief SDP a= attribute representation
+ * \note Attributes created by janus_sdp_parse have their name and value
+ * pointing to memory that is not owned by the attribute itself (see the
+ \c arena property), which means they must be considered read-only: to
+ * change an attribute, replace it with one created via janus_sdp_attribute_create */
 typedef struct janus_sdp_attribute {
 	/*! \brief Attribute name */
 	char *name;
@@ -202,6 +209,8 @@ typedef struct janus_sdp_attribute {
 	char *value;
 	/*! \brief Attribute direction (e.g., for extmap) */
 	janus_sdp_mdirection direction;
+	/*! \brief Block the attribute, its name and its value were allocated from, if it was parsed (NULL otherwise) */
+	janus_sdp_arena *arena;
 	/*! \brief Atomic flag to check if this instance has been destroyed */
 	volatile gint destroyed;
 	/*! \brief Reference counter for this instance */
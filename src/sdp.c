@@ -228,11 +228,9 @@ int janus_sdp_process_remote(void *ice_handle, janus_sdp *remote_sdp, gboolean r
 				if(m->ptypes != NULL) {
 					g_list_free(medium->payload_types);
 					medium->payload_types = g_list_copy(m->ptypes);
-					if(pc->payload_types == NULL)
-						pc->payload_types = g_hash_table_new(NULL, NULL);
 					GList *temp = medium->payload_types;
 					while(temp) {
-						g_hash_table_insert(pc->payload_types, temp->data, temp->data);
+						janus_ice_pt_map_insert(&pc->payload_types, GPOINTER_TO_INT(temp->data), 1);
 						temp = temp->next;
 					}
 				}
@@ -557,6 +555,7 @@ int janus_sdp_process_remote(void *ice_handle, janus_sdp *remote_sdp, gboolean r
 			tempA = tempA->next;
 		}
 		/* Now look for candidates and other info */
+		int fec_ptype = -1;
 		tempA = m->attributes;
 		while(tempA) {
 			janus_sdp_attribute *a = (janus_sdp_attribute *)tempA->data;
@@ -585,20 +584,14 @@ int janus_sdp_process_remote(void *ice_handle, janus_sdp *remote_sdp, gboolean r
 						} else {
 							rtx = TRUE;
 							janus_flags_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RFC4588_RTX);
-							if(pc->rtx_payload_types == NULL)
-								pc->rtx_payload_types = g_hash_table_new(NULL, NULL);
-							if(pc->rtx_payload_types_rev == NULL)
-								pc->rtx_payload_types_rev = g_hash_table_new(NULL, NULL);
-							int map_pt = GPOINTER_TO_INT(g_hash_table_lookup(pc->rtx_payload_types_rev, GINT_TO_POINTER(rtx_ptype)));
+							int map_pt = janus_ice_pt_map_lookup(&pc->rtx_payload_types_rev, rtx_ptype);
 							if(map_pt && map_pt != ptype) {
 								JANUS_LOG(LOG_WARN, "[%"SCNu64"] RTX payload type %d already mapped to %d, skipping fmtp/apt mapping with %d...\n",
 									handle->handle_id, rtx_ptype, map_pt, ptype);
 							} else {
-								g_hash_table_insert(pc->rtx_payload_types, GINT_TO_POINTER(ptype), GINT_TO_POINTER(rtx_ptype));
-								g_hash_table_insert(pc->rtx_payload_types_rev, GINT_TO_POINTER(rtx_ptype), GINT_TO_POINTER(ptype));
-								if(medium->rtx_payload_types == NULL)
-									medium->rtx_payload_types = g_hash_table_new(NULL, NULL);
-								g_hash_table_insert(medium->rtx_payload_types, GINT_TO_POINTER(ptype), GINT_TO_POINTER(rtx_ptype));
+								janus_ice_pt_map_insert(&pc->rtx_payload_types, ptype, rtx_ptype);
+								janus_ice_pt_map_insert(&pc->rtx_payload_types_rev, rtx_ptype, ptype);
+								janus_ice_pt_map_insert(&medium->rtx_payload_types, ptype, rtx_ptype);
 							}
 						}
 					}
@@ -611,20 +604,19 @@ int janus_sdp_process_remote(void *ice_handle, janus_sdp *remote_sdp, gboolean r
 								cr++;
 								uint32_t clock_rate = 0;
 								if(janus_string_to_uint32(cr, &clock_rate) == 0) {
-									if(pc->clock_rates == NULL)
-										pc->clock_rates = g_hash_table_new(NULL, NULL);
-									if(medium->clock_rates == NULL)
-										medium->clock_rates = g_hash_table_new(NULL, NULL);
-									uint32_t map_cr = GPOINTER_TO_UINT(g_hash_table_lookup(pc->clock_rates, GINT_TO_POINTER(ptype)));
+									uint32_t map_cr = janus_ice_pt_map_lookup(&pc->clock_rates, ptype);
 									if(map_cr && map_cr != clock_rate) {
 										JANUS_LOG(LOG_WARN, "[%"SCNu64"] Payload type %d already mapped to clock rate %d, skipping rtpmap mapping with %d...\n",
 											handle->handle_id, ptype, map_cr, clock_rate);
 									} else {
-										g_hash_table_insert(pc->clock_rates, GINT_TO_POINTER(ptype), GUINT_TO_POINTER(clock_rate));
-										g_hash_table_insert(medium->clock_rates, GINT_TO_POINTER(ptype), GUINT_TO_POINTER(clock_rate));
+										janus_ice_pt_map_insert(&pc->clock_rates, ptype, clock_rate);
+										janus_ice_peerconnection_medium_set_clock_rate(medium, ptype, clock_rate);
 										/* Check if opus/red is negotiated */
 										if(strstr(a->value, "red/48000/2"))
 											medium->opusred_pt = ptype;
+										/* Check if FlexFEC is negotiated */
+										if(strstr(a->value, "flexfec-03/"))
+											fec_ptype = ptype;
 									}
 								}
 							}
@@ -659,8 +651,7 @@ int janus_sdp_process_remote(void *ice_handle, janus_sdp *remote_sdp, gboolean r
 							medium->rtcp_ctx[vindex]->out_link_quality = 100;
 							medium->rtcp_ctx[vindex]->out_media_link_quality = 100;
 						}
-						if(medium->last_seqs[vindex])
-							janus_seq_list_free(&medium->last_seqs[vindex]);
+						janus_seq_window_reset(medium->last_seqs[vindex]);
 						janus_mutex_unlock(&medium->mutex);
 					}
 					medium->ssrc_peer[vindex] = medium->ssrc_peer_new[vindex];
@@ -709,24 +700,38 @@ int janus_sdp_process_remote(void *ice_handle, janus_sdp *remote_sdp, gboolean r
 					medium->rtcp_ctx[2]->out_media_link_quality = 100;
 				}
 			}
-			if(m->type == JANUS_SDP_VIDEO && medium->rtx_payload_types && m->ptypes) {
+			if(m->type == JANUS_SDP_VIDEO) {
+				/* Check if FlexFEC was negotiated (and whether we care) */
+				if(fec_ptype > 0 && janus_ice_is_flexfec_enabled()) {
+					medium->fec_payload_type = fec_ptype;
+					if(medium->ssrc_fec == 0 && medium->ssrc > 0) {
+						medium->ssrc_fec = janus_random_uint32();	/* FIXME Should we look for conflicts? */
+						g_hash_table_insert(pc->media_byssrc, GINT_TO_POINTER(medium->ssrc_fec), medium);
+						janus_refcount_increase(&medium->ref);
+					}
+				} else {
+					medium->fec_payload_type = -1;
+					if(medium->ssrc_fec != 0)
+						g_hash_table_remove(pc->media_byssrc, GINT_TO_POINTER(medium->ssrc_fec));
+					medium->ssrc_fec = 0;
+				}
+			}
+			if(m->type == JANUS_SDP_VIDEO && medium->rtx_payload_types.count > 0 && m->ptypes) {
 				/* Check if there are new payload types that conflict with our rtx additions */
 				GList *ptypes = g_list_copy(m->ptypes), *tempP = ptypes;
-				GList *rtx_ptypes = g_hash_table_get_values(medium->rtx_payload_types);
 				while(tempP) {
 					int ptype = GPOINTER_TO_INT(tempP->data);
-					if(g_hash_table_lookup(medium->clock_rates, GINT_TO_POINTER(ptype)) &&
-							g_list_find(rtx_ptypes, GINT_TO_POINTER(ptype))) {
+					if(ptype >= 0 && ptype < 128 && medium->clock_rate_by_pt[ptype] &&
+							janus_ice_pt_map_contains_value(&medium->rtx_payload_types, ptype)) {
 						/* We have a payload type that is both a codec and rtx, get rid of it */
 						JANUS_LOG(LOG_WARN, "[%"SCNu64"] Removing duplicate payload type %d\n", handle->handle_id, ptype);
 						janus_sdp_remove_payload_type(remote_sdp, medium->mindex, ptype);
-						g_hash_table_remove(pc->clock_rates, GINT_TO_POINTER(ptype));
-						g_hash_table_remove(medium->clock_rates, GINT_TO_POINTER(ptype));
+						janus_ice_pt_map_insert(&pc->clock_rates, ptype, 0);
+						janus_ice_peerconnection_medium_set_clock_rate(medium, ptype, 0);
 					}
 					tempP = tempP->next;
 				}
 				g_list_free(ptypes);
-				g_list_free(rtx_ptypes);
 			}
 		}
 		temp = temp->next;
@@ -846,9 +851,7 @@ int janus_sdp_process_local(void *ice_handle, janus_sdp *remote_sdp, gboolean up
 								cr++;
 								uint32_t clock_rate = 0;
 								if(janus_string_to_uint32(cr, &clock_rate) == 0) {
-									if(medium->clock_rates == NULL)
-										medium->clock_rates = g_hash_table_new(NULL, NULL);
-									g_hash_table_insert(medium->clock_rates, GINT_TO_POINTER(ptype), GUINT_TO_POINTER(clock_rate));
+									janus_ice_peerconnection_medium_set_clock_rate(medium, ptype, clock_rate);
 								}
 							}
 						}
@@ -882,6 +885,9 @@ int janus_sdp_process_local(void *ice_handle, janus_sdp *remote_sdp, gboolean up
 			if(medium->ssrc_rtx != 0)
 				g_hash_table_remove(pc->media_byssrc, GINT_TO_POINTER(medium->ssrc_rtx));
 			medium->ssrc_rtx = 0;
+			if(medium->ssrc_fec != 0)
+				g_hash_table_remove(pc->media_byssrc, GINT_TO_POINTER(medium->ssrc_fec));
+			medium->ssrc_fec = 0;
 			int vindex = 0;
 			for(vindex=0; vindex<3; vindex++) {
 				if(medium->rtcp_ctx[vindex]) {
@@ -1510,9 +1516,15 @@ char *janus_sdp_merge(void *ice_handle, janus_sdp *anon, gboolean offer) {
 	a = janus_sdp_attribute_create("ice-options", "trickle");
 	anon->attributes = g_list_insert_before(anon->attributes, first, a);
 	if(janus_is_webrtc_encryption_enabled()) {
-		/* We put the fingerprint in the global attributes */
-		a = janus_sdp_attribute_create("fingerprint", "sha-256 %s", janus_dtls_get_local_fingerprint());
-		anon->attributes = g_list_insert_before(anon->attributes, first, a);
+		/* We put the fingerprints in the global attributes, starting from the preferred one */
+		guint fp_index = 0;
+		const char *fingerprint = pc->dtls ? janus_dtls_srtp_get_fingerprint(pc->dtls, 0) : janus_dtls_get_local_fingerprint();
+		while(fingerprint != NULL) {
+			a = janus_sdp_attribute_create("fingerprint", "sha-256 %s", fingerprint);
+			anon->attributes = g_list_insert_before(anon->attributes, first, a);
+			fp_index++;
+			fingerprint = pc->dtls ? janus_dtls_srtp_get_fingerprint(pc->dtls, fp_index) : NULL;
+		}
 	}
 	/* Notify we support 1-byte and 2-byte extensions
 	 * FIXME We should actually negotiate this, in the future */
@@ -1590,12 +1602,12 @@ char *janus_sdp_merge(void *ice_handle, janus_sdp *anon, gboolean offer) {
 				media_stopped = TRUE;
 			if(medium->do_nacks && janus_flags_is_set(&handle->webrtc_flags, JANUS_ICE_HANDLE_WEBRTC_RFC4588_RTX)) {
 				/* Add RFC4588 stuff */
-				if(medium->rtx_payload_types && g_hash_table_size(medium->rtx_payload_types) > 0) {
+				if(medium->rtx_payload_types.count > 0) {
 					janus_sdp_attribute *a = NULL;
 					GList *ptypes = g_list_copy(m->ptypes), *tempP = ptypes;
 					while(tempP) {
 						int ptype = GPOINTER_TO_INT(tempP->data);
-						int rtx_ptype = GPOINTER_TO_INT(g_hash_table_lookup(medium->rtx_payload_types, GINT_TO_POINTER(ptype)));
+						int rtx_ptype = janus_ice_pt_map_lookup(&medium->rtx_payload_types, ptype);
 						if(rtx_ptype > 0) {
 							m->ptypes = g_list_append(m->ptypes, GINT_TO_POINTER(rtx_ptype));
 							a = janus_sdp_attribute_create("rtpmap", "%d rtx/90000", rtx_ptype);
@@ -1608,6 +1620,20 @@ char *janus_sdp_merge(void *ice_handle, janus_sdp *anon, gboolean offer) {
 					g_list_free(ptypes);
 				}
 			}
+			if(m->type == JANUS_SDP_VIDEO && medium->fec_payload_type > 0 && janus_ice_is_flexfec_enabled() &&
+					!g_list_find(m->ptypes, GINT_TO_POINTER(medium->fec_payload_type))) {
+				/* Add FlexFEC stuff */
+				m->ptypes = g_list_append(m->ptypes, GINT_TO_POINTER(medium->fec_payload_type));
+				janus_sdp_attribute *a = janus_sdp_attribute_create("rtpmap", "%d flexfec-03/90000", medium->fec_payload_type);
+				m->attributes = g_list_append(m->attributes, a);
+				a = janus_sdp_attribute_create("fmtp", "%d repair-window=10000000", medium->fec_payload_type);
+				m->attributes = g_list_append(m->attributes, a);
+				if(medium->ssrc_fec == 0 && medium->ssrc > 0) {
+					medium->ssrc_fec = janus_random_uint32();	/* FIXME Should we look for conflicts? */
+					g_hash_table_insert(pc->media_byssrc, GINT_TO_POINTER(medium->ssrc_fec), medium);
+					janus_refcount_increase(&medium->ref);
+				}
+			}
 		} else if(m->type == JANUS_SDP_APPLICATION) {
 #ifdef HAVE_SCTP
 			/* Is this SCTP for DataChannels? */
@@ -1679,6 +1705,12 @@ char *janus_sdp_merge(void *ice_handle, janus_sdp *anon, gboolean offer) {
 			a = janus_sdp_attribute_create("ssrc-group", "FID %"SCNu32" %"SCNu32, medium->ssrc, medium->ssrc_rtx);
 			m->attributes = g_list_append(m->attributes, a);
 		}
+		if(medium->ssrc_fec > 0 && m->type == JANUS_SDP_VIDEO && medium->fec_payload_type > 0 && janus_ice_is_flexfec_enabled() &&
+				(m->direction == JANUS_SDP_DEFAULT || m->direction == JANUS_SDP_SENDRECV || m->direction == JANUS_SDP_SENDONLY)) {
+			/* Add FEC-FR group to negotiate the FlexFEC stuff */
+			a = janus_sdp_attribute_create("ssrc-group", "FEC-FR %"SCNu32" %"SCNu32, medium->ssrc, medium->ssrc_fec);
+			m->attributes = g_list_append(m->attributes, a);
+		}
 		if(m->type == JANUS_SDP_AUDIO || m->type == JANUS_SDP_VIDEO) {
 			if(m->direction != JANUS_SDP_INACTIVE) {
 				if(medium->msid && medium->mstid) {
@@ -1698,6 +1730,12 @@ char *janus_sdp_merge(void *ice_handle, janus_sdp *anon, gboolean offer) {
 					a = janus_sdp_attribute_create("ssrc", "%"SCNu32" cname:janus", medium->ssrc_rtx);
 					m->attributes = g_list_append(m->attributes, a);
 				}
+				if(medium->ssrc_fec > 0 && m->type == JANUS_SDP_VIDEO && medium->fec_payload_type > 0 && janus_ice_is_flexfec_enabled() &&
+						(m->direction == JANUS_SDP_DEFAULT || m->direction == JANUS_SDP_SENDRECV || m->direction == JANUS_SDP_SENDONLY)) {
+					/* Add the FlexFEC SSRC too */
+					a = janus_sdp_attribute_create("ssrc", "%"SCNu32" cname:janus", medium->ssrc_fec);
+					m->attributes = g_list_append(m->attributes, a);
+				}
 			}
 		}
 		/* FIXME If the peer is Firefox and is negotiating simulcasting, add the rid attributes */
@@ -3,9 +3,15 @@
  * \copyright GNU General Public License v3
  * \brief    Dumping of RTP/RTCP packets to text2pcap or pcap format
  * \details  Implementation of a simple helper utility that can be used
- * to dump incoming and outgoing RTP/RTCP packets to pcap or text2pcap format.
- * Saving to pcap natively can be more efficient but will lack some features,
- * as the target will be a legacy (v2.4) \c .pcap file and not a \c .pcapng one.
+ * to dump incoming and outgoing RTP/RTCP packets to pcap, pcapng or text2pcap
+ * format. Saving to pcap natively can be more efficient but will lack some
+ * features, as the target will be a legacy (v2.4) \c .pcap file. Saving to
+ * pcapng adds the direction of each packet and its type (plus any additional
+ * info) as a comment, and is written asynchronously: packets are copied to a
+ * ring buffer, that a background thread flushes to the file, which makes it
+ * the safest option on a loaded server (packets are dropped, rather than
+ * delaying media, if the thread can't keep up). Captures can be limited
+ * in size and/or duration, after which packets aren't saved anymore.
  * When saving to a text file, instead, the resulting file can be passed to
  * the \c text2pcap application in order to get a \c .pcap or \c .pcapng file
  * that can be analyzed via Wireshark or similar applications, e.g.:
@@ -34,6 +40,7 @@
  */
 
 #include <errno.h>
+#include <unistd.h>
 #include <sys/time.h>
 #include <arpa/inet.h>
 #ifdef __MACH__
@@ -152,11 +159,128 @@ static void janus_text2pcap_udp_header_init(janus_text2pcap_udp_header *udp, gbo
 }
 
 
+/* pcapng blocks (https://www.ietf.org/archive/id/draft-ietf-opsawg-pcapng-02.html) */
+#define JANUS_PCAPNG_SHB		0x0A0D0D0A
+#define JANUS_PCAPNG_IDB		0x00000001
+#define JANUS_PCAPNG_EPB		0x00000006
+#define JANUS_PCAPNG_OPT_END		0
+#define JANUS_PCAPNG_OPT_COMMENT	1
+#define JANUS_PCAPNG_OPT_FLAGS		2
+
+/* pcapng captures are written asynchronously: blocks are copied to a ring
+ * buffer by the thread dumping packets (the mutex of the instance only
+ * serializes producers, and is usually uncontended, as packets of a handle
+ * are dumped from its loop), and a single writer thread flushes the ring
+ * buffers of all captures to their files, without ever taking that mutex */
+#define JANUS_TEXT2PCAP_RING_SIZE		(1024*1024)
+#define JANUS_TEXT2PCAP_FLUSH_INTERVAL	(G_USEC_PER_SEC/10)
+struct janus_text2pcap_ring {
+	guint8 data[JANUS_TEXT2PCAP_RING_SIZE];
+	/* Only updated by the producer (head) and by the consumer (tail) */
+	volatile gsize head, tail;
+};
+static GList *captures = NULL;
+static gboolean writer_running = FALSE;
+static janus_mutex captures_mutex = JANUS_MUTEX_INITIALIZER;
+
+static gsize janus_text2pcap_ring_used(janus_text2pcap_ring *ring) {
+	return (gsize)g_atomic_pointer_get(&ring->head) - (gsize)g_atomic_pointer_get(&ring->tail);
+}
+
+/* Copy data after the current head (at offset), without committing it yet:
+ * a NULL data pointer means we're just padding with zeros */
+static void janus_text2pcap_ring_copy(janus_text2pcap_ring *ring, gsize *offset, const void *data, gsize len) {
+	static const guint8 zeros[4] = { 0 };
+	gsize i = 0;
+	for(i=0; i<len; i++) {
+		gsize pos = (ring->head + *offset + i) & (JANUS_TEXT2PCAP_RING_SIZE - 1);
+		ring->data[pos] = data ? ((const guint8 *)data)[i] : zeros[0];
+	}
+	*offset += len;
+}
+
+static void janus_text2pcap_ring_commit(janus_text2pcap_ring *ring, gsize len) {
+	g_atomic_pointer_set(&ring->head, ring->head + len);
+}
+
+/* Consumer side: write what's been queued so far to the file */
+static void janus_text2pcap_flush(janus_text2pcap *instance) {
+	janus_text2pcap_ring *ring = instance->ring;
+	gsize used = janus_text2pcap_ring_used(ring), done = 0;
+	int fd = fileno(instance->file);
+	while(done < used) {
+		gsize pos = (ring->tail + done) & (JANUS_TEXT2PCAP_RING_SIZE - 1);
+		ssize_t res = write(fd, ring->data + pos, MIN(used - done, JANUS_TEXT2PCAP_RING_SIZE - pos));
+		if(res < 0 && errno == EINTR)
+			continue;
+		if(res <= 0) {
+			JANUS_LOG(LOG_ERR, "Error saving capture to %s (%s)\n", instance->filename, g_strerror(errno));
+			break;
+		}
+		done += res;
+	}
+	/* In case of errors the data is dropped anyway */
+	g_atomic_pointer_set(&ring->tail, ring->tail + used);
+}
+
+static void *janus_text2pcap_writer_thread(void *data) {
+	JANUS_LOG(LOG_VERB, "Joining pcapng writer thread\n");
+	janus_mutex_lock(&captures_mutex);
+	while(captures != NULL) {
+		GList *l = NULL;
+		for(l = captures; l != NULL; l = l->next)
+			janus_text2pcap_flush((janus_text2pcap *)l->data);
+		janus_mutex_unlock(&captures_mutex);
+		g_usleep(JANUS_TEXT2PCAP_FLUSH_INTERVAL);
+		janus_mutex_lock(&captures_mutex);
+	}
+	/* No more captures, a new thread will be started when needed */
+	writer_running = FALSE;
+	janus_mutex_unlock(&captures_mutex);
+	JANUS_LOG(LOG_VERB, "Leaving pcapng writer thread\n");
+	return NULL;
+}
+
+/* Queue a pcapng block: the total length is added before and after the body */
+static int janus_text2pcap_pcapng_block(janus_text2pcap *instance, guint32 type,
+		const void *body, gsize body_len, const void *data, gsize data_len, const void *options, gsize options_len) {
+	janus_text2pcap_ring *ring = instance->ring;
+	gsize padding = (4 - (data_len % 4)) % 4;
+	guint32 total = 12 + body_len + data_len + padding + options_len;
+	if(JANUS_TEXT2PCAP_RING_SIZE - janus_text2pcap_ring_used(ring) < total) {
+		/* The writer thread can't keep up, drop the packet */
+		if(g_atomic_int_add(&instance->dropped, 1) == 0)
+			JANUS_LOG(LOG_WARN, "Capture buffer full, dropping packets (%s)\n", instance->filename);
+		return -3;
+	}
+	gsize offset = 0;
+	janus_text2pcap_ring_copy(ring, &offset, &type, sizeof(type));
+	janus_text2pcap_ring_copy(ring, &offset, &total, sizeof(total));
+	janus_text2pcap_ring_copy(ring, &offset, body, body_len);
+	if(data_len > 0) {
+		janus_text2pcap_ring_copy(ring, &offset, data, data_len);
+		janus_text2pcap_ring_copy(ring, &offset, NULL, padding);
+	}
+	if(options_len > 0)
+		janus_text2pcap_ring_copy(ring, &offset, options, options_len);
+	janus_text2pcap_ring_copy(ring, &offset, &total, sizeof(total));
+	janus_text2pcap_ring_commit(ring, total);
+	instance->written += total;
+	return 0;
+}
+
 janus_text2pcap *janus_text2pcap_create(const char *dir, const char *filename, int truncate, gboolean text) {
+	return janus_text2pcap_create_full(dir, filename, truncate,
+		text ? JANUS_TEXT2PCAP_FORMAT_TEXT : JANUS_TEXT2PCAP_FORMAT_PCAP, 0, 0);
+}
+
+janus_text2pcap *janus_text2pcap_create_full(const char *dir, const char *filename, int truncate,
+		janus_text2pcap_format format, guint64 max_size, guint max_duration) {
 	janus_text2pcap *tp;
 	char newname[1024];
 	char *fname;
 	FILE *f;
+	gboolean text = (format == JANUS_TEXT2PCAP_FORMAT_TEXT);
 
 	if(truncate < 0)
 		return NULL;
@@ -164,7 +288,8 @@ janus_text2pcap *janus_text2pcap_create(const char *dir, const char *filename, i
 	/* Copy given filename or generate a random one */
 	if(filename == NULL) {
 		g_snprintf(newname, sizeof(newname),
-		    "janus-text2pcap-%"SCNu32".%s", janus_random_uint32(), text ? "txt" : "pcap");
+		    "janus-text2pcap-%"SCNu32".%s", janus_random_uint32(),
+			text ? "txt" : (format == JANUS_TEXT2PCAP_FORMAT_PCAPNG ? "pcapng" : "pcap"));
 	} else {
 		g_strlcpy(newname, filename, sizeof(newname));
 	}
@@ -197,11 +322,47 @@ janus_text2pcap *janus_text2pcap_create(const char *dir, const char *filename, i
 	tp->file = f;
 	tp->truncate = truncate;
 	tp->text = text;
+	tp->format = format;
+	tp->ring = NULL;
+	tp->max_size = max_size;
+	tp->max_duration = max_duration;
+	tp->written = 0;
+	tp->started = janus_get_monotonic_time();
+	g_atomic_int_set(&tp->capped, 0);
+	g_atomic_int_set(&tp->dropped, 0);
 	g_atomic_int_set(&tp->writable, 1);
 	janus_mutex_init(&tp->mutex);
 
-	/* If we're saving to .pcap directly, generate a global header */
-	if(!text) {
+	if(format == JANUS_TEXT2PCAP_FORMAT_PCAPNG) {
+		/* Queue a section header and an (Ethernet) interface description */
+		tp->ring = g_malloc(sizeof(janus_text2pcap_ring));
+		tp->ring->head = 0;
+		tp->ring->tail = 0;
+		guint32 shb[4] = { 0x1A2B3C4D, 0x00000001, 0xFFFFFFFF, 0xFFFFFFFF };
+		janus_text2pcap_pcapng_block(tp, JANUS_PCAPNG_SHB, shb, sizeof(shb), NULL, 0, NULL, 0);
+		guint32 idb[2] = { 1, 65535 };
+		janus_text2pcap_pcapng_block(tp, JANUS_PCAPNG_IDB, idb, sizeof(idb), NULL, 0, NULL, 0);
+		/* Make sure there's a writer thread */
+		janus_mutex_lock(&captures_mutex);
+		captures = g_list_prepend(captures, tp);
+		if(!writer_running) {
+			GError *error = NULL;
+			GThread *thread = g_thread_try_new("pcapng writer", janus_text2pcap_writer_thread, NULL, &error);
+			if(error != NULL) {
+				JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the pcapng writer thread...\n",
+					error->code, error->message ? error->message : "??");
+				g_error_free(error);
+				captures = g_list_remove(captures, tp);
+				janus_mutex_unlock(&captures_mutex);
+				janus_text2pcap_free(tp);
+				return NULL;
+			}
+			g_thread_unref(thread);
+			writer_running = TRUE;
+		}
+		janus_mutex_unlock(&captures_mutex);
+	} else if(!text) {
+		/* If we're saving to .pcap directly, generate a global header */
 		janus_text2pcap_global_header header = {
 			0xa1b2c3d4, 2, 4, 0, 0, 65535, 1
 		};
@@ -216,10 +377,72 @@ int janus_text2pcap_dump(janus_text2pcap *instance,
 	if(instance == NULL || buf == NULL || len < 1)
 		return -1;
 	janus_mutex_lock_nodebug(&instance->mutex);
-	if(instance->file == NULL || !g_atomic_int_get(&instance->writable)) {
+	if(instance->file == NULL || !g_atomic_int_get(&instance->writable) || g_atomic_int_get(&instance->capped)) {
 		janus_mutex_unlock_nodebug(&instance->mutex);
 		return -1;
 	}
+	/* Check if we reached the limits of this capture, if any */
+	if((instance->max_size > 0 && instance->written >= instance->max_size) ||
+			(instance->max_duration > 0 && janus_get_monotonic_time() - instance->started >= (gint64)instance->max_duration*G_USEC_PER_SEC)) {
+		JANUS_LOG(LOG_INFO, "Capture limit reached, not saving packets anymore (%s)\n", instance->filename);
+		g_atomic_int_set(&instance->capped, 1);
+		janus_mutex_unlock_nodebug(&instance->mutex);
+		return -1;
+	}
+	/* If we're saving to .pcapng, queue an enhanced packet block */
+	if(instance->format == JANUS_TEXT2PCAP_FORMAT_PCAPNG) {
+		int size = instance->truncate ? (len > instance->truncate ? instance->truncate : len) : len;
+		/* We add the same fake Ethernet/IP/UDP encapsulation we use for .pcap */
+		guint8 packet[sizeof(janus_text2pcap_ethernet_header) + sizeof(janus_text2pcap_ip_header) +
+			sizeof(janus_text2pcap_udp_header) + 1500];
+		janus_text2pcap_ethernet_header *eth = (janus_text2pcap_ethernet_header *)packet;
+		janus_text2pcap_ethernet_header_init(eth);
+		janus_text2pcap_ip_header *ip = (janus_text2pcap_ip_header *)(packet + sizeof(*eth));
+		janus_text2pcap_ip_header_init(ip, incoming, len);
+		janus_text2pcap_udp_header *udp = (janus_text2pcap_udp_header *)(packet + sizeof(*eth) + sizeof(*ip));
+		janus_text2pcap_udp_header_init(udp, incoming, len);
+		int hsize = sizeof(*eth) + sizeof(*ip) + sizeof(*udp);
+		if(size > (int)sizeof(packet) - hsize)
+			size = sizeof(packet) - hsize;
+		memcpy(packet + hsize, buf, size);
+		gint64 now = janus_get_real_time();
+		guint32 epb[5] = { 0, (guint32)((guint64)now >> 32), (guint32)((guint64)now & 0xFFFFFFFF),
+			(guint32)(hsize + size), (guint32)(hsize + len) };
+		/* Options: the direction, and the packet type (plus anything else we got) as a comment */
+		guint8 options[8 + 4 + 516 + 4];
+		gsize options_len = 0;
+		guint16 code = JANUS_PCAPNG_OPT_FLAGS, optlen = 4;
+		guint32 flags = incoming ? 0x1 : 0x2;
+		memcpy(options, &code, sizeof(code));
+		memcpy(options + 2, &optlen, sizeof(optlen));
+		memcpy(options + 4, &flags, sizeof(flags));
+		options_len = 8;
+		char comment[516];
+		g_strlcpy(comment, janus_text2pcap_packet_string(type), sizeof(comment));
+		if(format) {
+			char custom[512];
+			va_list ap;
+			va_start(ap, format);
+			g_vsnprintf(custom, sizeof(custom), format, ap);
+			va_end(ap);
+			janus_strlcat(comment, " ", sizeof(comment));
+			janus_strlcat(comment, custom, sizeof(comment));
+		}
+		code = JANUS_PCAPNG_OPT_COMMENT;
+		optlen = strlen(comment);
+		memcpy(options + options_len, &code, sizeof(code));
+		memcpy(options + options_len + 2, &optlen, sizeof(optlen));
+		memcpy(options + options_len + 4, comment, optlen);
+		options_len += 4 + optlen;
+		while(options_len % 4)
+			options[options_len++] = 0;
+		memset(options + options_len, 0, 4);
+		options_len += 4;
+		int res = janus_text2pcap_pcapng_block(instance, JANUS_PCAPNG_EPB, epb, sizeof(epb),
+			packet, hsize + size, options, options_len);
+		janus_mutex_unlock_nodebug(&instance->mutex);
+		return res;
+	}
 	/* If we're saving to .pcap directly, generate a packet header and save the payload */
 	if(!instance->text) {
 		/* Are we truncating? */
@@ -256,6 +479,7 @@ int janus_text2pcap_dump(janus_text2pcap *instance,
 			}
 			tot -= temp;
 		}
+		instance->written += sizeof(header) + hsize_cut;
 		/* Done */
 		janus_mutex_unlock_nodebug(&instance->mutex);
 		return 0;
@@ -304,6 +528,7 @@ int janus_text2pcap_dump(janus_text2pcap *instance,
 		}
 		tot -= temp;
 	}
+	instance->written += buflen;
 	/* Done */
 	janus_mutex_unlock_nodebug(&instance->mutex);
 	return 0;
@@ -317,6 +542,13 @@ int janus_text2pcap_close(janus_text2pcap *instance) {
 		janus_mutex_unlock_nodebug(&instance->mutex);
 		return 0;
 	}
+	if(instance->ring != NULL) {
+		/* Stop the writer thread from serving this capture, and write what's left */
+		janus_mutex_lock(&captures_mutex);
+		captures = g_list_remove(captures, instance);
+		janus_mutex_unlock(&captures_mutex);
+		janus_text2pcap_flush(instance);
+	}
 	fclose(instance->file);
 	instance->file = NULL;
 	janus_mutex_unlock_nodebug(&instance->mutex);
@@ -327,6 +559,7 @@ void janus_text2pcap_free(janus_text2pcap *instance) {
 	if(instance == NULL)
 		return;
 	janus_text2pcap_close(instance);
+	g_free(instance->ring);
 	g_free(instance->filename);
 	g_free(instance);
 }
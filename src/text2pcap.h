@@ -3,9 +3,15 @@
  * \copyright GNU General Public License v3
  * \brief    Dumping of RTP/RTCP packets to text2pcap or pcap format (headers)
  * \details  Implementation of a simple helper utility that can be used
- * to dump incoming and outgoing RTP/RTCP packets to pcap or text2pcap format.
- * Saving to pcap natively can be more efficient but will lack some features,
- * as the target will be a legacy (v2.4) \c .pcap file and not a \c .pcapng one.
+ * to dump incoming and outgoing RTP/RTCP packets to pcap, pcapng or text2pcap
+ * format. Saving to pcap natively can be more efficient but will lack some
+ * features, as the target will be a legacy (v2.4) \c .pcap file. Saving to
+ * pcapng adds the direction of each packet and its type (plus any additional
+ * info) as a comment, and is written asynchronously: packets are copied to a
+ * ring buffer, that a background thread flushes to the file, which makes it
+ * the safest option on a loaded server (packets are dropped, rather than
+ * delaying media, if the thread can't keep up). Captures can be limited
+ * in size and/or duration, after which packets aren't saved anymore.
  * When saving to a text file, instead, the resulting file can be passed to
  * the \c text2pcap application in order to get a \c .pcap or \c .pcapng file
  * that can be analyzed via Wireshark or similar applications, e.g.:
@@ -45,6 +51,19 @@
 
 #include "mutex.h"
 
+/*! \brief Formats captures can be saved in */
+typedef enum janus_text2pcap_format {
+	/*! \brief Text file, to be fed to \c text2pcap */
+	JANUS_TEXT2PCAP_FORMAT_TEXT = 0,
+	/*! \brief Legacy (v2.4) \c .pcap file */
+	JANUS_TEXT2PCAP_FORMAT_PCAP,
+	/*! \brief \c .pcapng file, written asynchronously */
+	JANUS_TEXT2PCAP_FORMAT_PCAPNG
+} janus_text2pcap_format;
+
+/*! \brief Ring buffer pcapng blocks are queued in */
+typedef struct janus_text2pcap_ring janus_text2pcap_ring;
+
 /*! \brief Instance of a text2pcap recorder */
 typedef struct janus_text2pcap {
 	/*! \brief Absolute path to where the text2pcap file is stored */
@@ -55,6 +74,20 @@ typedef struct janus_text2pcap {
 	int truncate;
 	/*! \brief Whether we'll save as text, or directly to pcap */
 	gboolean text;
+	/*! \brief Format of the capture */
+	janus_text2pcap_format format;
+	/*! \brief Ring buffer blocks are written to, when saving to pcapng */
+	janus_text2pcap_ring *ring;
+	/*! \brief Maximum size (in bytes) and duration (in seconds) of the capture, if limited */
+	guint64 max_size;
+	guint max_duration;
+	/*! \brief How many bytes have been saved so far, and when the capture started */
+	guint64 written;
+	gint64 started;
+	/*! \brief Whether we stopped saving packets because we reached a limit */
+	volatile int capped;
+	/*! \brief How many packets were dropped because the ring buffer was full */
+	volatile gint dropped;
 	/*! \brief Whether we can write to this file or not */
 	volatile int writable;
 	/*! \brief Mutex to lock/unlock this recorder instance */
@@ -78,6 +111,18 @@ const char *janus_text2pcap_packet_string(janus_text2pcap_packet type);
  * @param[in] text Whether we'll save as text, or directly to pcap
  * @returns A valid janus_text2pcap instance in case of success, NULL otherwise */
 janus_text2pcap *janus_text2pcap_create(const char *dir, const char *filename, int truncate, gboolean text);
+/*! \brief Create a capture in a specific format, optionally limited in size and/or duration
+ * \note If no target directory is provided, the current directory will be used. If no filename
+ * is passed, a random filename will be used.
+ * @param[in] dir Path of the directory to save the capture into (will try to create it if it doesn't exist)
+ * @param[in] filename Filename to use for the capture
+ * @param[in] truncate Number of bytes to truncate each packet at (0 to not truncate at all)
+ * @param[in] format Format to save the capture in
+ * @param[in] max_size Maximum size of the capture, in bytes (0 to not limit the size)
+ * @param[in] max_duration Maximum duration of the capture, in seconds (0 to not limit the duration)
+ * @returns A valid janus_text2pcap instance in case of success, NULL otherwise */
+janus_text2pcap *janus_text2pcap_create_full(const char *dir, const char *filename, int truncate,
+	janus_text2pcap_format format, guint64 max_size, guint max_duration);
 
 /*! \brief Dump an RTP or RTCP packet
  * @param[in] instance Instance of the janus_text2pcap recorder to dump the packet to
@@ -0,0 +1,376 @@
+/*! \file    timer-wheel.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Hierarchical timer wheel for event loops
+ * \details  Implementation of a hierarchical timer wheel, that can be
+ * attached to a GMainContext in place of the many GLib timeout sources
+ * handles would otherwise add to it (RTCP, stats, transport-wide CC
+ * feedback, ICE and DTLS checks, cleanup of NACKed packets, etc.). With
+ * static event loops serving thousands of handles, GLib's handling of
+ * all those sources (which are kept in a list ordered by priority, and
+ * all checked on each iteration) becomes measurable: the wheel is a
+ * single source instead, which only wakes up when there's a timer to
+ * fire, and fires all the timers expiring in the same tick in a batch.
+ * Timers have a resolution of 10ms: scheduling and cancelling a timer
+ * are constant time operations, independently of how many there are.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include "timer-wheel.h"
+#include "debug.h"
+#include "mutex.h"
+#include "refcount.h"
+
+/* Duration of a tick, in microseconds */
+#define JANUS_TIMER_TICK		10000
+/* The first level has a slot per tick (2.56s), the other two a slot
+ * per full round of the previous level (163.84s and ~2.9 hours) */
+#define JANUS_TIMER_L0_BITS		8
+#define JANUS_TIMER_L0_SIZE		(1 << JANUS_TIMER_L0_BITS)
+#define JANUS_TIMER_L0_MASK		(JANUS_TIMER_L0_SIZE - 1)
+#define JANUS_TIMER_LN_BITS		6
+#define JANUS_TIMER_LN_SIZE		(1 << JANUS_TIMER_LN_BITS)
+#define JANUS_TIMER_LN_MASK		(JANUS_TIMER_LN_SIZE - 1)
+#define JANUS_TIMER_L1_RANGE	((guint64)1 << (JANUS_TIMER_L0_BITS + JANUS_TIMER_LN_BITS))
+#define JANUS_TIMER_L2_RANGE	((guint64)1 << (JANUS_TIMER_L0_BITS + 2*JANUS_TIMER_LN_BITS))
+
+struct janus_timer {
+	janus_timer_wheel *wheel;
+	/* Slot this timer is linked in, if it's scheduled */
+	janus_timer **slot;
+	janus_timer *prev, *next;
+	int level;
+	guint64 expires, interval;
+	GSourceFunc callback;
+	gpointer user_data;
+	GDestroyNotify notify;
+	volatile gint cancelled;
+	janus_refcount ref;
+};
+
+/* The source we attach to the context */
+typedef struct janus_timer_wheel_source {
+	GSource parent;
+	janus_timer_wheel *wheel;
+} janus_timer_wheel_source;
+
+struct janus_timer_wheel {
+	GSource *source;
+	janus_mutex mutex;
+	/* Last tick we processed */
+	guint64 current;
+	janus_timer *level0[JANUS_TIMER_L0_SIZE];
+	janus_timer *level1[JANUS_TIMER_LN_SIZE];
+	janus_timer *level2[JANUS_TIMER_LN_SIZE];
+	/* How many timers we own, and how many of them are in the upper levels */
+	guint scheduled, upper;
+	/* When the source is currently set to wake up */
+	gint64 ready;
+	gboolean stopped;
+	janus_refcount ref;
+};
+
+static guint64 janus_timer_now(void) {
+	return g_get_monotonic_time() / JANUS_TIMER_TICK;
+}
+
+static void janus_timer_free(const janus_refcount *timer_ref) {
+	janus_timer *timer = janus_refcount_containerof(timer_ref, janus_timer, ref);
+	if(timer->notify != NULL)
+		timer->notify(timer->user_data);
+	janus_timer_wheel_unref(timer->wheel);
+	g_free(timer);
+}
+
+/* Helpers to add timers to and remove them from a slot: the wheel must be locked */
+static void janus_timer_link(janus_timer_wheel *wheel, janus_timer *timer) {
+	if(timer->expires <= wheel->current)
+		timer->expires = wheel->current + 1;
+	guint64 delta = timer->expires - wheel->current;
+	if(delta < JANUS_TIMER_L0_SIZE) {
+		timer->level = 0;
+		timer->slot = &wheel->level0[timer->expires & JANUS_TIMER_L0_MASK];
+	} else if(delta < JANUS_TIMER_L1_RANGE) {
+		timer->level = 1;
+		timer->slot = &wheel->level1[(timer->expires >> JANUS_TIMER_L0_BITS) & JANUS_TIMER_LN_MASK];
+	} else {
+		/* Timers longer than the wheel can handle fire earlier than they should */
+		if(delta >= JANUS_TIMER_L2_RANGE)
+			timer->expires = wheel->current + JANUS_TIMER_L2_RANGE - 1;
+		timer->level = 2;
+		timer->slot = &wheel->level2[(timer->expires >> (JANUS_TIMER_L0_BITS + JANUS_TIMER_LN_BITS)) & JANUS_TIMER_LN_MASK];
+	}
+	if(timer->level > 0)
+		wheel->upper++;
+	timer->prev = NULL;
+	timer->next = *timer->slot;
+	if(timer->next != NULL)
+		timer->next->prev = timer;
+	*timer->slot = timer;
+}
+static void janus_timer_unlink(janus_timer_wheel *wheel, janus_timer *timer) {
+	if(timer->prev != NULL)
+		timer->prev->next = timer->next;
+	else
+		*timer->slot = timer->next;
+	if(timer->next != NULL)
+		timer->next->prev = timer->prev;
+	if(timer->level > 0)
+		wheel->upper--;
+	timer->slot = NULL;
+	timer->prev = NULL;
+	timer->next = NULL;
+}
+
+/* Move the timers of an upper level slot to the lower levels */
+static void janus_timer_cascade(janus_timer_wheel *wheel, janus_timer **slot) {
+	janus_timer *timer = *slot;
+	*slot = NULL;
+	while(timer != NULL) {
+		janus_timer *next = timer->next;
+		wheel->upper--;
+		janus_timer_link(wheel, timer);
+		timer = next;
+	}
+}
+
+/* Advance the wheel up to the provided tick, returning the timers that
+ * expired as a list (linked by their next pointer): the wheel must be locked */
+static janus_timer *janus_timer_wheel_advance(janus_timer_wheel *wheel, guint64 now) {
+	janus_timer *expired = NULL, *last = NULL;
+	if(wheel->scheduled == 0 && now > wheel->current) {
+		/* Nothing to do, just catch up */
+		wheel->current = now;
+		return NULL;
+	}
+	while(wheel->current < now) {
+		wheel->current++;
+		guint index = wheel->current & JANUS_TIMER_L0_MASK;
+		if(index == 0 && wheel->upper > 0) {
+			guint index1 = (wheel->current >> JANUS_TIMER_L0_BITS) & JANUS_TIMER_LN_MASK;
+			if(index1 == 0)
+				janus_timer_cascade(wheel, &wheel->level2[(wheel->current >> (JANUS_TIMER_L0_BITS + JANUS_TIMER_LN_BITS)) & JANUS_TIMER_LN_MASK]);
+			janus_timer_cascade(wheel, &wheel->level1[index1]);
+		}
+		janus_timer *timer = wheel->level0[index];
+		wheel->level0[index] = NULL;
+		while(timer != NULL) {
+			janus_timer *next = timer->next;
+			timer->slot = NULL;
+			timer->prev = NULL;
+			timer->next = NULL;
+			if(last == NULL)
+				expired = timer;
+			else
+				last->next = timer;
+			last = timer;
+			timer = next;
+		}
+	}
+	return expired;
+}
+
+/* Update when the source should wake up next: the wheel must be locked */
+static void janus_timer_wheel_update(janus_timer_wheel *wheel) {
+	if(wheel->stopped)
+		return;
+	gint64 ready = -1;
+	if(wheel->scheduled > 0) {
+		guint64 tick = 0;
+		for(tick = wheel->current+1; tick <= wheel->current + JANUS_TIMER_L0_SIZE; tick++) {
+			if(wheel->level0[tick & JANUS_TIMER_L0_MASK] != NULL ||
+					((tick & JANUS_TIMER_L0_MASK) == 0 && wheel->upper > 0))
+				break;
+		}
+		ready = (gint64)tick * JANUS_TIMER_TICK;
+	}
+	if(ready != wheel->ready) {
+		wheel->ready = ready;
+		g_source_set_ready_time(wheel->source, ready);
+	}
+}
+
+static gboolean janus_timer_wheel_dispatch(GSource *source, GSourceFunc callback, gpointer user_data) {
+	janus_timer_wheel *wheel = ((janus_timer_wheel_source *)source)->wheel;
+	janus_mutex_lock(&wheel->mutex);
+	janus_timer *expired = janus_timer_wheel_advance(wheel, janus_timer_now());
+	janus_mutex_unlock(&wheel->mutex);
+	/* Fire all the timers that expired */
+	while(expired != NULL) {
+		janus_timer *timer = expired;
+		expired = timer->next;
+		timer->next = NULL;
+		gboolean again = FALSE;
+		if(!g_atomic_int_get(&timer->cancelled))
+			again = timer->callback(timer->user_data);
+		janus_mutex_lock(&wheel->mutex);
+		if(again && !g_atomic_int_get(&timer->cancelled) && !wheel->stopped) {
+			timer->expires = wheel->current + timer->interval;
+			janus_timer_link(wheel, timer);
+			janus_mutex_unlock(&wheel->mutex);
+		} else {
+			/* We're done with this timer */
+			wheel->scheduled--;
+			janus_mutex_unlock(&wheel->mutex);
+			janus_refcount_decrease(&timer->ref);
+		}
+	}
+	janus_mutex_lock(&wheel->mutex);
+	janus_timer_wheel_update(wheel);
+	janus_mutex_unlock(&wheel->mutex);
+	return G_SOURCE_CONTINUE;
+}
+static GSourceFuncs janus_timer_wheel_funcs = {
+	NULL,	/* We use the ready time */
+	NULL,
+	janus_timer_wheel_dispatch,
+	NULL,
+	NULL, NULL
+};
+
+static void janus_timer_wheel_free(const janus_refcount *wheel_ref) {
+	janus_timer_wheel *wheel = janus_refcount_containerof(wheel_ref, janus_timer_wheel, ref);
+	if(wheel->source != NULL) {
+		if(!wheel->stopped)
+			g_source_destroy(wheel->source);
+		g_source_unref(wheel->source);
+	}
+	janus_mutex_destroy(&wheel->mutex);
+	g_free(wheel);
+}
+
+janus_timer_wheel *janus_timer_wheel_new(GMainContext *context) {
+	janus_timer_wheel *wheel = g_malloc0(sizeof(janus_timer_wheel));
+	janus_mutex_init(&wheel->mutex);
+	wheel->current = janus_timer_now();
+	wheel->ready = -1;
+	janus_refcount_init(&wheel->ref, janus_timer_wheel_free);
+	wheel->source = g_source_new(&janus_timer_wheel_funcs, sizeof(janus_timer_wheel_source));
+	((janus_timer_wheel_source *)wheel->source)->wheel = wheel;
+	g_source_set_name(wheel->source, "timer wheel");
+	g_source_set_priority(wheel->source, G_PRIORITY_DEFAULT);
+	g_source_set_ready_time(wheel->source, -1);
+	g_source_attach(wheel->source, context);
+	return wheel;
+}
+
+void janus_timer_wheel_stop(janus_timer_wheel *wheel) {
+	if(wheel == NULL)
+		return;
+	janus_mutex_lock(&wheel->mutex);
+	if(wheel->stopped) {
+		janus_mutex_unlock(&wheel->mutex);
+		return;
+	}
+	wheel->stopped = TRUE;
+	g_source_destroy(wheel->source);
+	/* Drop all the timers we still have: the ones that weren't destroyed
+	 * yet will just be freed when their owners release them */
+	GList *timers = NULL;
+	janus_timer **slots[3] = { wheel->level0, wheel->level1, wheel->level2 };
+	guint sizes[3] = { JANUS_TIMER_L0_SIZE, JANUS_TIMER_LN_SIZE, JANUS_TIMER_LN_SIZE };
+	guint level = 0, i = 0;
+	for(level = 0; level < 3; level++) {
+		for(i = 0; i < sizes[level]; i++) {
+			janus_timer *timer = slots[level][i];
+			slots[level][i] = NULL;
+			while(timer != NULL) {
+				timers = g_list_prepend(timers, timer);
+				timer->slot = NULL;
+				timer->prev = NULL;
+				timer = timer->next;
+			}
+		}
+	}
+	wheel->scheduled = 0;
+	wheel->upper = 0;
+	janus_mutex_unlock(&wheel->mutex);
+	GList *l = timers;
+	while(l != NULL) {
+		janus_timer *timer = (janus_timer *)l->data;
+		timer->next = NULL;
+		janus_refcount_decrease(&timer->ref);
+		l = l->next;
+	}
+	g_list_free(timers);
+}
+
+janus_timer_wheel *janus_timer_wheel_ref(janus_timer_wheel *wheel) {
+	if(wheel != NULL)
+		janus_refcount_increase(&wheel->ref);
+	return wheel;
+}
+
+void janus_timer_wheel_unref(janus_timer_wheel *wheel) {
+	if(wheel != NULL)
+		janus_refcount_decrease(&wheel->ref);
+}
+
+guint janus_timer_wheel_count(janus_timer_wheel *wheel) {
+	if(wheel == NULL)
+		return 0;
+	janus_mutex_lock(&wheel->mutex);
+	guint count = wheel->scheduled;
+	janus_mutex_unlock(&wheel->mutex);
+	return count;
+}
+
+janus_timer *janus_timer_add(janus_timer_wheel *wheel, guint interval,
+		GSourceFunc callback, gpointer user_data, GDestroyNotify notify) {
+	if(wheel == NULL || callback == NULL)
+		return NULL;
+	janus_timer *timer = g_malloc0(sizeof(janus_timer));
+	timer->wheel = janus_timer_wheel_ref(wheel);
+	/* Round the interval up to the tick */
+	timer->interval = ((guint64)interval * 1000 + JANUS_TIMER_TICK - 1) / JANUS_TIMER_TICK;
+	if(timer->interval == 0)
+		timer->interval = 1;
+	timer->callback = callback;
+	timer->user_data = user_data;
+	timer->notify = notify;
+	/* One reference is for the caller, the other for the wheel */
+	janus_refcount_init(&timer->ref, janus_timer_free);
+	janus_mutex_lock(&wheel->mutex);
+	if(wheel->stopped) {
+		/* This timer will never fire */
+		janus_mutex_unlock(&wheel->mutex);
+		return timer;
+	}
+	janus_refcount_increase(&timer->ref);
+	if(wheel->scheduled == 0)
+		wheel->current = janus_timer_now();
+	timer->expires = wheel->current + timer->interval;
+	janus_timer_link(wheel, timer);
+	wheel->scheduled++;
+	janus_timer_wheel_update(wheel);
+	janus_mutex_unlock(&wheel->mutex);
+	return timer;
+}
+
+void janus_timer_destroy(janus_timer *timer) {
+	if(timer == NULL)
+		return;
+	if(!g_atomic_int_compare_and_exchange(&timer->cancelled, 0, 1))
+		return;
+	janus_timer_wheel *wheel = timer->wheel;
+	gboolean owned = FALSE;
+	janus_mutex_lock(&wheel->mutex);
+	if(timer->slot != NULL) {
+		/* The timer is scheduled, remove it from the wheel: if it's firing
+		 * right now instead, the wheel will get rid of it when it's done */
+		janus_timer_unlink(wheel, timer);
+		wheel->scheduled--;
+		owned = TRUE;
+	}
+	janus_mutex_unlock(&wheel->mutex);
+	if(owned)
+		janus_refcount_decrease(&timer->ref);
+	janus_refcount_decrease(&timer->ref);
+}
+
+void janus_timer_unref(janus_timer *timer) {
+	if(timer != NULL)
+		janus_refcount_decrease(&timer->ref);
+}
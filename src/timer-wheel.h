@@ -0,0 +1,81 @@
+/*! \file    timer-wheel.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Hierarchical timer wheel for event loops (headers)
+ * \details  Implementation of a hierarchical timer wheel, that can be
+ * attached to a GMainContext in place of the many GLib timeout sources
+ * handles would otherwise add to it (RTCP, stats, transport-wide CC
+ * feedback, ICE and DTLS checks, cleanup of NACKed packets, etc.). With
+ * static event loops serving thousands of handles, GLib's handling of
+ * all those sources (which are kept in a list ordered by priority, and
+ * all checked on each iteration) becomes measurable: the wheel is a
+ * single source instead, which only wakes up when there's a timer to
+ * fire, and fires all the timers expiring in the same tick in a batch.
+ * Timers have a resolution of 10ms: scheduling and cancelling a timer
+ * are constant time operations, independently of how many there are.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef JANUS_TIMER_WHEEL_H
+#define JANUS_TIMER_WHEEL_H
+
+#include <glib.h>
+
+
+/*! \brief Opaque reference to a timer wheel */
+typedef struct janus_timer_wheel janus_timer_wheel;
+/*! \brief Opaque reference to a timer */
+typedef struct janus_timer janus_timer;
+
+/*! \brief Create a new timer wheel, and attach it to a context
+ * @param[in] context The GMainContext the timer callbacks will be invoked in
+ * @returns A new timer wheel, that must be released with janus_timer_wheel_unref */
+janus_timer_wheel *janus_timer_wheel_new(GMainContext *context);
+/*! \brief Stop a timer wheel, detaching it from its context
+ * \note This must be called before the context is released (e.g., when the
+ * loop using it quits): after that, timers can still be added and destroyed,
+ * but they won't fire anymore
+ * @param[in] wheel The timer wheel to stop */
+void janus_timer_wheel_stop(janus_timer_wheel *wheel);
+/*! \brief Add a reference to a timer wheel
+ * @param[in] wheel The timer wheel to reference
+ * @returns The same timer wheel */
+janus_timer_wheel *janus_timer_wheel_ref(janus_timer_wheel *wheel);
+/*! \brief Release a reference to a timer wheel
+ * \note Timers hold a reference to their wheel, so the wheel is only
+ * actually freed when all its timers are gone too
+ * @param[in] wheel The timer wheel to release */
+void janus_timer_wheel_unref(janus_timer_wheel *wheel);
+/*! \brief Get the number of timers currently scheduled in a wheel
+ * @param[in] wheel The timer wheel to query
+ * @returns The number of scheduled timers */
+guint janus_timer_wheel_count(janus_timer_wheel *wheel);
+
+/*! \brief Add a new timer to a wheel
+ * \note The callback has the same semantics as a GSourceFunc: it's invoked
+ * in the thread of the context the wheel is attached to, and the timer is
+ * rescheduled if it returns \c G_SOURCE_CONTINUE, or removed if it returns
+ * \c G_SOURCE_REMOVE. This can be called from any thread.
+ * @param[in] wheel The timer wheel to add the timer to
+ * @param[in] interval How often the timer should fire, in milliseconds
+ * @param[in] callback The function to invoke when the timer fires
+ * @param[in] user_data An opaque pointer to pass to the callback
+ * @param[in] notify A function to invoke on user_data when the timer is freed, if any
+ * @returns A reference to the timer, that must be released with either
+ * janus_timer_destroy or janus_timer_unref */
+janus_timer *janus_timer_add(janus_timer_wheel *wheel, guint interval,
+	GSourceFunc callback, gpointer user_data, GDestroyNotify notify);
+/*! \brief Cancel a timer, and release the reference that was returned when adding it
+ * \note This can be called from any thread, including from within the timer
+ * callback itself. As with g_source_destroy, a callback may still be running
+ * in the thread of the context when this returns, but it won't be invoked again
+ * @param[in] timer The timer to destroy */
+void janus_timer_destroy(janus_timer *timer);
+/*! \brief Release the reference that was returned when adding a timer, without cancelling it
+ * \note The timer keeps on firing until its callback returns \c G_SOURCE_REMOVE
+ * @param[in] timer The timer to release */
+void janus_timer_unref(janus_timer *timer);
+
+#endif
@@ -14,7 +14,25 @@
  * associated to a Janus session (and as such to all its plugin handles
  * and the events plugins push in the session itself), using a long poll
  * approach. A JavaScript library (janus.js) implements all of this on
- * the client side automatically.
+ * the client side automatically. As an alternative to long polls, a GET
+ * on a session path with an \c Accept: \c text/event-stream header (as
+ * an \c EventSource object in browsers does), or with a \c stream=sse
+ * query string argument, opens a Server-Sent Events stream instead: the
+ * response is kept open, and each event is pushed as a \c data: line as
+ * soon as it's available, without the need of a new request per event.
+ * Only one stream per session is kept: opening a new one closes the old.
+ * Comment lines are sent periodically to keep intermediaries from closing
+ * idle streams, and the stream acts as a keepalive for the session too.
+ * \note A limit can be set on the number of events queued for a single
+ * session (\c max_queued), to protect Janus from clients that don't
+ * retrieve them fast enough. Once the limit is reached, depending on the
+ * \c queue_policy setting either new events that are not critical (see
+ * \c droppable_events) are dropped, or the session is destroyed.
+ * \note When \c admin_metrics is enabled, a GET on the \c /metrics path
+ * of the admin/monitor web server returns the metrics of the core in the
+ * OpenMetrics text format, so that tools like Prometheus can scrape it.
+ * There's no Admin API secret involved in this: use \c admin_acl to
+ * limit who can access it.
  * \note There's a well known bug in libmicrohttpd that may cause it to
  * spike to 100% of the CPU when using HTTPS on some distributions. In
  * case you're interested in HTTPS support, it's better to just rely on
@@ -120,7 +138,21 @@ static janus_transport_callbacks *gateway = NULL;
 static gboolean http_janus_api_enabled = FALSE;
 static gboolean http_admin_api_enabled = FALSE;
 static gboolean notify_events = TRUE;
+/* Limits on the events queued for a single session */
+static int http_max_queued = 0;
+static gboolean http_queue_disconnect = FALSE;
+static char **http_droppable_events = NULL;
+static volatile gint http_dropped = 0, http_overflows = 0;
 static enum MHD_FLAG mhd_debug_flag = MHD_NO_FLAG;
+/* How libmicrohttpd should poll the sockets, and with how many threads */
+static unsigned int mhd_poll_flags = MHD_USE_AUTO_INTERNAL_THREAD | MHD_USE_AUTO;
+static unsigned int mhd_threads = 0;
+static struct MHD_OptionItem mhd_pool_options[] = {
+	{ MHD_OPTION_END, 0, NULL },
+	{ MHD_OPTION_END, 0, NULL },
+	{ MHD_OPTION_END, 0, NULL }
+};
+static int mhd_pool_options_num = 0;
 
 /* JSON serialization options */
 static size_t json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
@@ -145,6 +177,7 @@ typedef struct janus_http_msg {
 	struct MHD_Connection *connection;	/* The MHD connection this message came from */
 	volatile int suspended;				/* Whether this connection is currently suspended */
 	volatile void *longpoll;			/* Whether this is a long poll connection for a session */
+	struct janus_http_stream *stream;	/* In case this is a Server-Sent Events connection, the stream it's serving */
 	int max_events;						/* In case this is a long poll, how many events we should send back */
 	char *acro;							/* Value of the Origin HTTP header, if any (needed for CORS) */
 	char *acrh;							/* Value of the Access-Control-Request-Headers HTTP header, if any (needed for CORS) */
@@ -163,6 +196,8 @@ typedef struct janus_http_msg {
 } janus_http_msg;
 static GHashTable *messages = NULL;
 static janus_mutex messages_mutex = JANUS_MUTEX_INITIALIZER;
+/* Helper to release a reference to a Server-Sent Events stream */
+static void janus_http_stream_unref(void *data);
 
 static void janus_http_msg_free(const janus_refcount *msg_ref) {
 	janus_http_msg *request = janus_refcount_containerof(msg_ref, janus_http_msg, ref);
@@ -176,6 +211,8 @@ static void janus_http_msg_free(const janus_refcount *msg_ref) {
 	g_free(request->acrm);
 	g_free(request->xff);
 	g_free(request->response);
+	if(request->stream)
+		janus_http_stream_unref(request->stream);
 	g_free(request);
 }
 
@@ -190,7 +227,10 @@ static void janus_http_msg_destroy(void *msg) {
 typedef struct janus_http_session {
 	guint64 session_id;			/* Core session identifier */
 	GAsyncQueue *events;		/* Events to notify for this session */
-	GList *longpolls;			/* Long poll connection */
+	GHashTable *longpolls;		/* Long poll connections waiting for events (a set of transport sessions) */
+	struct janus_http_stream *stream;	/* Server-Sent Events stream for this session, if any */
+	volatile gint dropped;		/* Number of events dropped because the queue was full */
+	volatile gint overflow;		/* Whether the queue was full and the session is being disconnected */
 	janus_mutex mutex;			/* Mutex to lock this instance */
 	volatile gint destroyed;	/* Whether this session has been destroyed */
 	janus_refcount ref;			/* Reference counter for this session */
@@ -214,10 +254,78 @@ static void janus_http_session_free(const janus_refcount *session_ref) {
 			json_decref(event);
 		g_async_queue_unref(session->events);
 	}
+	if(session->longpolls)
+		g_hash_table_destroy(session->longpolls);
 	g_free(session);
 }
 
 
+/* Helper for Server-Sent Events: a response that's kept open, pushing events for a session as they come */
+#define JANUS_HTTP_SSE_KEEPALIVE	25
+typedef struct janus_http_stream {
+	janus_transport_session *ts;		/* Transport session of the request that opened the stream */
+	struct MHD_Connection *connection;	/* The MHD connection to resume when there's something to send */
+	janus_http_session *session;		/* The session whose events we're streaming */
+	char *secret;						/* API secret to use in the keepalives we send the core, if any */
+	char *token;						/* Token to use in the keepalives we send the core, if any */
+	GString *buffer;					/* Data waiting to be written */
+	size_t offset;						/* How much of the buffer has been written already */
+	gboolean suspended;					/* Whether the connection is suspended waiting for events */
+	gboolean ping;						/* Whether we should send a keepalive comment */
+	GSource *timer;						/* Keepalive timer */
+	volatile gint closed;				/* Whether this stream should be closed */
+	janus_mutex mutex;					/* Mutex to lock this instance */
+	janus_refcount ref;					/* Reference counter for this stream */
+} janus_http_stream;
+
+static void janus_http_stream_free(const janus_refcount *stream_ref) {
+	janus_http_stream *stream = janus_refcount_containerof(stream_ref, janus_http_stream, ref);
+	/* This stream can be destroyed, free all the resources */
+	janus_refcount_decrease(&stream->ts->ref);
+	janus_refcount_decrease(&stream->session->ref);
+	g_free(stream->secret);
+	g_free(stream->token);
+	g_string_free(stream->buffer, TRUE);
+	g_free(stream);
+}
+
+static void janus_http_stream_unref(void *data) {
+	janus_http_stream *stream = (janus_http_stream *)data;
+	janus_refcount_decrease(&stream->ref);
+}
+
+/* Wake a suspended stream up, if it's waiting for something to send */
+static void janus_http_stream_wakeup(janus_http_stream *stream) {
+	janus_mutex_lock(&stream->mutex);
+	if(stream->suspended && stream->connection != NULL) {
+		stream->suspended = FALSE;
+		MHD_resume_connection(stream->connection);
+	}
+	janus_mutex_unlock(&stream->mutex);
+}
+
+/* Close a stream: if the connection is gone already (completed), we just forget about it,
+ * otherwise we wake it up so that the next read ends the response. Detaching the stream
+ * from its session is up to the caller, which may already be holding the session mutex */
+static void janus_http_stream_close(janus_http_stream *stream, gboolean completed) {
+	janus_mutex_lock(&stream->mutex);
+	gboolean first = g_atomic_int_compare_and_exchange(&stream->closed, 0, 1);
+	if(completed)
+		stream->connection = NULL;
+	if(stream->suspended && stream->connection != NULL) {
+		stream->suspended = FALSE;
+		MHD_resume_connection(stream->connection);
+	}
+	GSource *timer = first ? stream->timer : NULL;
+	stream->timer = NULL;
+	janus_mutex_unlock(&stream->mutex);
+	if(timer != NULL) {
+		g_source_destroy(timer);
+		g_source_unref(timer);
+	}
+}
+
+
 /* Custom GSource for tracking request timeouts (including long polls) */
 typedef struct janus_http_request_timeout {
 	GSource source;
@@ -283,6 +391,10 @@ static void janus_http_request_completed(void *cls, struct MHD_Connection *conne
 static ssize_t janus_http_response_callback(void *cls, uint64_t pos, char *buf, size_t max);
 /* Worker to handle requests that are actually long polls */
 static int janus_http_notifier(janus_http_msg *msg);
+/* Callback to send events on a Server-Sent Events stream */
+static ssize_t janus_http_stream_callback(void *cls, uint64_t pos, char *buf, size_t max);
+/* Timer callback to send keepalives on a Server-Sent Events stream */
+static gboolean janus_http_stream_keepalive(gpointer user_data);
 /* Helper to quickly send a success response */
 static janus_MHD_Result janus_http_return_success(janus_transport_session *ts, char *payload);
 /* Helper to quickly send an error response */
@@ -298,6 +410,8 @@ static char *cert_pem_bytes = NULL, *cert_key_bytes = NULL;
 /* Admin/Monitor MHD Web Server */
 static struct MHD_Daemon *admin_ws = NULL, *admin_sws = NULL;
 static char *admin_ws_path = NULL;
+/* Whether the admin/monitor web server exposes a metrics endpoint too */
+static gboolean admin_metrics = FALSE;
 
 /* Custom Access-Control-Allow-Origin value, if specified */
 static char *allow_origin = NULL;
@@ -506,7 +620,7 @@ static struct MHD_Daemon *janus_http_create_daemon(gboolean admin, char *path,
 			JANUS_LOG(LOG_VERB, "Binding to all interfaces for the %s API %s webserver\n",
 				admin ? "Admin" : "Janus", secure ? "HTTPS" : "HTTP");
 			daemon = MHD_start_daemon(
-				MHD_USE_AUTO_INTERNAL_THREAD | MHD_USE_AUTO | MHD_USE_SUSPEND_RESUME | MHD_USE_DUAL_STACK | mhd_debug_flag,
+				mhd_poll_flags | MHD_USE_SUSPEND_RESUME | MHD_USE_DUAL_STACK | mhd_debug_flag,
 				port,
 				admin ? &janus_http_admin_client_connect : &janus_http_client_connect,
 				NULL,
@@ -515,6 +629,7 @@ static struct MHD_Daemon *janus_http_create_daemon(gboolean admin, char *path,
 				MHD_OPTION_NOTIFY_COMPLETED, &janus_http_request_completed, NULL,
 				MHD_OPTION_CONNECTION_TIMEOUT, 120,
 				MHD_OPTION_CONNECTION_LIMIT, connection_limit,
+				MHD_OPTION_ARRAY, mhd_pool_options,
 				MHD_OPTION_END);
 		} else {
 			/* Bind to the interface that was specified */
@@ -522,7 +637,7 @@ static struct MHD_Daemon *janus_http_create_daemon(gboolean admin, char *path,
 				ip ? "IP" : "interface", ip ? ip : interface,
 				admin ? "Admin" : "Janus", secure ? "HTTPS" : "HTTP");
 			daemon = MHD_start_daemon(
-				MHD_USE_AUTO_INTERNAL_THREAD | MHD_USE_AUTO | MHD_USE_SUSPEND_RESUME | (ipv6 ? MHD_USE_IPv6 : 0) | mhd_debug_flag,
+				mhd_poll_flags | MHD_USE_SUSPEND_RESUME | (ipv6 ? MHD_USE_IPv6 : 0) | mhd_debug_flag,
 				port,
 				admin ? &janus_http_admin_client_connect : &janus_http_client_connect,
 				NULL,
@@ -532,6 +647,7 @@ static struct MHD_Daemon *janus_http_create_daemon(gboolean admin, char *path,
 				MHD_OPTION_SOCK_ADDR, ipv6 ? (struct sockaddr *)&addr6 : (struct sockaddr *)&addr,
 				MHD_OPTION_CONNECTION_TIMEOUT, 120,
 				MHD_OPTION_CONNECTION_LIMIT, connection_limit,
+				MHD_OPTION_ARRAY, mhd_pool_options,
 				MHD_OPTION_END);
 		}
 	} else {
@@ -545,7 +661,7 @@ static struct MHD_Daemon *janus_http_create_daemon(gboolean admin, char *path,
 			JANUS_LOG(LOG_VERB, "Binding to all interfaces for the %s API %s webserver\n",
 				admin ? "Admin" : "Janus", secure ? "HTTPS" : "HTTP");
 			daemon = MHD_start_daemon(
-				MHD_USE_SSL | MHD_USE_AUTO_INTERNAL_THREAD | MHD_USE_AUTO | MHD_USE_SUSPEND_RESUME | MHD_USE_DUAL_STACK | mhd_debug_flag,
+				MHD_USE_SSL | mhd_poll_flags | MHD_USE_SUSPEND_RESUME | MHD_USE_DUAL_STACK | mhd_debug_flag,
 				port,
 				admin ? &janus_http_admin_client_connect : &janus_http_client_connect,
 				NULL,
@@ -558,6 +674,7 @@ static struct MHD_Daemon *janus_http_create_daemon(gboolean admin, char *path,
 				MHD_OPTION_HTTPS_KEY_PASSWORD, password,
 				MHD_OPTION_CONNECTION_TIMEOUT, 120,
 				MHD_OPTION_CONNECTION_LIMIT, connection_limit,
+				MHD_OPTION_ARRAY, mhd_pool_options,
 				MHD_OPTION_END);
 		} else {
 			/* Bind to the interface that was specified */
@@ -565,7 +682,7 @@ static struct MHD_Daemon *janus_http_create_daemon(gboolean admin, char *path,
 				ip ? "IP" : "interface", ip ? ip : interface,
 				admin ? "Admin" : "Janus", secure ? "HTTPS" : "HTTP");
 			daemon = MHD_start_daemon(
-				MHD_USE_SSL | MHD_USE_AUTO_INTERNAL_THREAD | MHD_USE_AUTO | MHD_USE_SUSPEND_RESUME | (ipv6 ? MHD_USE_IPv6 : 0) | mhd_debug_flag,
+				MHD_USE_SSL | mhd_poll_flags | MHD_USE_SUSPEND_RESUME | (ipv6 ? MHD_USE_IPv6 : 0) | mhd_debug_flag,
 				port,
 				admin ? &janus_http_admin_client_connect : &janus_http_client_connect,
 				NULL,
@@ -579,6 +696,7 @@ static struct MHD_Daemon *janus_http_create_daemon(gboolean admin, char *path,
 				MHD_OPTION_SOCK_ADDR, ipv6 ? (struct sockaddr *)&addr6 : (struct sockaddr *)&addr,
 				MHD_OPTION_CONNECTION_TIMEOUT, 120,
 				MHD_OPTION_CONNECTION_LIMIT, connection_limit,
+				MHD_OPTION_ARRAY, mhd_pool_options,
 				MHD_OPTION_END);
 		}
 	}
@@ -684,6 +802,33 @@ int janus_http_init(janus_transport_callbacks *callback, const char *config_path
 			JANUS_LOG(LOG_WARN, "Notification of events to handlers disabled for %s\n", JANUS_HTTP_NAME);
 		}
 
+		/* Limits on the events queued for a single session, if any */
+		item = janus_config_get(config, config_general, janus_config_type_item, "max_queued");
+		if(item && item->value) {
+			http_max_queued = atoi(item->value);
+			if(http_max_queued < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid value for max_queued (%s), disabling limit...\n", item->value);
+				http_max_queued = 0;
+			}
+		}
+		item = janus_config_get(config, config_general, janus_config_type_item, "queue_policy");
+		if(item && item->value) {
+			if(!strcasecmp(item->value, "disconnect")) {
+				http_queue_disconnect = TRUE;
+			} else if(strcasecmp(item->value, "drop")) {
+				JANUS_LOG(LOG_WARN, "Unsupported queue_policy '%s', using 'drop'...\n", item->value);
+			}
+		}
+		item = janus_config_get(config, config_general, janus_config_type_item, "droppable_events");
+		http_droppable_events = g_strsplit(item && item->value ? item->value : JANUS_TRANSPORT_DROPPABLE_EVENTS, ",", -1);
+		int e = 0;
+		for(e=0; http_droppable_events[e] != NULL; e++)
+			g_strstrip(http_droppable_events[e]);
+		if(http_max_queued > 0) {
+			JANUS_LOG(LOG_INFO, "HTTP sessions can have up to %d queued events (%s when full)\n",
+				http_max_queued, http_queue_disconnect ? "disconnect" : "drop events");
+		}
+
 		/* Check the base paths */
 		item = janus_config_get(config, config_general, janus_config_type_item, "base_path");
 		if(item && item->value) {
@@ -714,6 +859,9 @@ int janus_http_init(janus_transport_callbacks *callback, const char *config_path
 		} else {
 			admin_ws_path = g_strdup("/admin");
 		}
+		item = janus_config_get(config, config_admin, janus_config_type_item, "admin_metrics");
+		if(item && item->value)
+			admin_metrics = janus_is_true(item->value);
 		/* Check the open connections limit for mhd */
 		item = janus_config_get(config, config_general, janus_config_type_item, "mhd_connection_limit");
 		if(item && item->value && janus_string_to_uint32(item->value, &connection_limit) < 0) {
@@ -724,6 +872,52 @@ int janus_http_init(janus_transport_callbacks *callback, const char *config_path
 		item = janus_config_get(config, config_general, janus_config_type_item, "mhd_debug");
 		if(item && item->value && janus_is_true(item->value))
 			mhd_debug_flag = MHD_USE_DEBUG;
+		/* How should libmicrohttpd poll connections? */
+		item = janus_config_get(config, config_general, janus_config_type_item, "mhd_poll");
+		if(item && item->value) {
+			if(!strcasecmp(item->value, "epoll")) {
+				mhd_poll_flags = MHD_USE_INTERNAL_POLLING_THREAD | MHD_USE_EPOLL;
+			} else if(!strcasecmp(item->value, "poll")) {
+				mhd_poll_flags = MHD_USE_INTERNAL_POLLING_THREAD | MHD_USE_POLL;
+			} else if(!strcasecmp(item->value, "select")) {
+				mhd_poll_flags = MHD_USE_INTERNAL_POLLING_THREAD;
+			} else if(strcasecmp(item->value, "auto")) {
+				JANUS_LOG(LOG_WARN, "Unsupported mhd_poll value '%s', using default (auto)\n", item->value);
+			}
+		}
+		item = janus_config_get(config, config_general, janus_config_type_item, "mhd_turbo");
+		if(item && item->value && janus_is_true(item->value))
+			mhd_poll_flags |= MHD_USE_TURBO;
+		/* Should we use a pool of threads, rather than a single one? */
+		item = janus_config_get(config, config_general, janus_config_type_item, "mhd_threads");
+		if(item && item->value) {
+			if(!strcasecmp(item->value, "auto")) {
+				mhd_threads = g_get_num_processors();
+			} else if(janus_string_to_uint32(item->value, &mhd_threads) < 0) {
+				JANUS_LOG(LOG_ERR, "Invalid mhd_threads (%s), using a single thread\n", item->value);
+				mhd_threads = 0;
+			}
+		}
+		if(mhd_threads > 1) {
+			JANUS_LOG(LOG_INFO, "Using a pool of %u libmicrohttpd threads\n", mhd_threads);
+			mhd_pool_options[mhd_pool_options_num].option = MHD_OPTION_THREAD_POOL_SIZE;
+			mhd_pool_options[mhd_pool_options_num].value = mhd_threads;
+			mhd_pool_options_num++;
+		}
+		/* Should we allow other processes to bind to the same ports? This
+		 * allows a new Janus instance to start while this one still runs,
+		 * so that there's no moment where connections would be refused */
+		item = janus_config_get(config, config_general, janus_config_type_item, "reuse_port");
+		if(item && item->value && janus_is_true(item->value)) {
+#if MHD_VERSION >= 0x00093900
+			JANUS_LOG(LOG_INFO, "Sharing the HTTP ports with other processes (SO_REUSEPORT)\n");
+			mhd_pool_options[mhd_pool_options_num].option = MHD_OPTION_LISTENING_ADDRESS_REUSE;
+			mhd_pool_options[mhd_pool_options_num].value = 1;
+			mhd_pool_options_num++;
+#else
+			JANUS_LOG(LOG_WARN, "libmicrohttpd is too old to share ports, ignoring reuse_port\n");
+#endif
+		}
 
 		/* Any ACL for either the Janus or Admin API? */
 		item = janus_config_get(config, config_general, janus_config_type_item, "acl");
@@ -988,6 +1182,8 @@ void janus_http_destroy(void) {
 	janus_mutex_unlock(&messages_mutex);
 	janus_mutex_lock(&sessions_mutex);
 	g_hash_table_destroy(sessions);
+	g_strfreev(http_droppable_events);
+	http_droppable_events = NULL;
 	sessions = NULL;
 	janus_mutex_unlock(&sessions_mutex);
 
@@ -1033,6 +1229,14 @@ gboolean janus_http_is_admin_api_enabled(void) {
 	return http_admin_api_enabled;
 }
 
+/* Helper to get rid of a session that couldn't keep up with its events from the loop, rather than from the core */
+static gboolean janus_http_session_overflow(gpointer user_data) {
+	janus_transport_session *ts = (janus_transport_session *)user_data;
+	gateway->transport_gone(&janus_http_transport, ts);
+	janus_refcount_decrease(&ts->ref);
+	return G_SOURCE_REMOVE;
+}
+
 int janus_http_send_message(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message) {
 	JANUS_LOG(LOG_HUGE, "Got a %s API %s to send (%p)\n", admin ? "admin" : "Janus", request_id ? "response" : "event", transport);
 	if(message == NULL) {
@@ -1056,14 +1260,45 @@ int janus_http_send_message(janus_transport_session *transport, void *request_id
 			json_decref(message);
 			return -1;
 		}
+		/* Check if the client is keeping up with the events we queue */
+		if(http_max_queued > 0 && (g_atomic_int_get(&session->overflow) ||
+				g_async_queue_length(session->events) >= http_max_queued)) {
+			if(http_queue_disconnect || g_atomic_int_get(&session->overflow)) {
+				if(g_atomic_int_compare_and_exchange(&session->overflow, 0, 1)) {
+					JANUS_LOG(LOG_WARN, "[%"SCNu64"] Too many queued events (%d), getting rid of the session\n", session_id, http_max_queued);
+					g_atomic_int_inc(&http_overflows);
+					if(transport != NULL) {
+						janus_refcount_increase(&transport->ref);
+						GSource *overflow = g_idle_source_new();
+						g_source_set_callback(overflow, janus_http_session_overflow, transport, NULL);
+						g_source_attach(overflow, httpctx);
+						g_source_unref(overflow);
+					}
+				}
+				janus_mutex_unlock(&sessions_mutex);
+				json_decref(message);
+				return -1;
+			}
+			if(janus_transport_message_is_droppable(message, NULL, http_droppable_events)) {
+				/* Not a critical event, drop it */
+				if(g_atomic_int_add(&session->dropped, 1) == 0)
+					JANUS_LOG(LOG_WARN, "[%"SCNu64"] Too many queued events (%d), dropping events\n", session_id, http_max_queued);
+				g_atomic_int_inc(&http_dropped);
+				janus_mutex_unlock(&sessions_mutex);
+				json_decref(message);
+				return 0;
+			}
+		}
 		janus_refcount_increase(&session->ref);
 		g_async_queue_push(session->events, message);
 		janus_mutex_unlock(&sessions_mutex);
 		/* Are there long polls waiting? */
 		janus_mutex_lock(&session->mutex);
 		janus_http_msg *msg = NULL;
-		while(session->longpolls) {
-			transport = (janus_transport_session *)session->longpolls->data;
+		GList *longpolls = g_hash_table_get_values(session->longpolls), *lp = NULL;
+		g_hash_table_remove_all(session->longpolls);
+		for(lp = longpolls; lp != NULL; lp = lp->next) {
+			transport = (janus_transport_session *)lp->data;
 			msg = (janus_http_msg *)(transport ? transport->transport_p : NULL);
 			/* Is this connection ready to send a response back? */
 			if(msg && g_atomic_pointer_compare_and_exchange(&msg->longpoll, (volatile void *)session, NULL)) {
@@ -1077,8 +1312,11 @@ int janus_http_send_message(janus_transport_session *transport, void *request_id
 				janus_http_notifier(msg);
 				janus_refcount_decrease(&msg->ref);
 			}
-			session->longpolls = g_list_remove(session->longpolls, transport);
 		}
+		g_list_free(longpolls);
+		/* Is there a stream waiting? */
+		if(session->stream != NULL)
+			janus_http_stream_wakeup(session->stream);
 		janus_mutex_unlock(&session->mutex);
 		janus_refcount_decrease(&session->ref);
 	} else {
@@ -1145,7 +1383,10 @@ void janus_http_session_created(janus_transport_session *transport, guint64 sess
 	janus_http_session *session = g_malloc(sizeof(janus_http_session));
 	session->session_id = session_id;
 	session->events = g_async_queue_new();
-	session->longpolls = NULL;
+	session->longpolls = g_hash_table_new(NULL, NULL);
+	session->stream = NULL;
+	g_atomic_int_set(&session->dropped, 0);
+	g_atomic_int_set(&session->overflow, 0);
 	janus_mutex_init(&session->mutex);
 	g_atomic_int_set(&session->destroyed, 0);
 	janus_refcount_init(&session->ref, janus_http_session_free);
@@ -1159,6 +1400,18 @@ void janus_http_session_over(janus_transport_session *transport, guint64 session
 		claimed ? "but has been claimed" : "and has not been claimed", session_id);
 	/* Get rid of the session's queue of events */
 	janus_mutex_lock(&sessions_mutex);
+	janus_http_session *session = g_hash_table_lookup(sessions, &session_id);
+	if(session != NULL) {
+		/* If there's a stream for this session, end it */
+		janus_mutex_lock(&session->mutex);
+		janus_http_stream *stream = session->stream;
+		session->stream = NULL;
+		janus_mutex_unlock(&session->mutex);
+		if(stream != NULL) {
+			janus_http_stream_close(stream, FALSE);
+			janus_refcount_decrease(&stream->ref);
+		}
+	}
 	g_hash_table_remove(sessions, &session_id);
 	janus_mutex_unlock(&sessions_mutex);
 }
@@ -1174,7 +1427,10 @@ void janus_http_session_claimed(janus_transport_session *transport, guint64 sess
 	janus_http_session *session = g_malloc(sizeof(janus_http_session));
 	session->session_id = session_id;
 	session->events = g_async_queue_new();
-	session->longpolls = NULL;
+	session->longpolls = g_hash_table_new(NULL, NULL);
+	session->stream = NULL;
+	g_atomic_int_set(&session->dropped, 0);
+	g_atomic_int_set(&session->overflow, 0);
 	janus_mutex_init(&session->mutex);
 	g_atomic_int_set(&session->destroyed, 0);
 	janus_refcount_init(&session->ref, janus_http_session_free);
@@ -1186,8 +1442,10 @@ void janus_http_session_claimed(janus_transport_session *transport, guint64 sess
 	/* Were there long polls waiting? */
 	janus_mutex_lock(&old_session->mutex);
 	janus_http_msg *msg = NULL;
-	while(old_session->longpolls) {
-		transport = (janus_transport_session *)old_session->longpolls->data;
+	GList *longpolls = g_hash_table_get_values(old_session->longpolls), *lp = NULL;
+	g_hash_table_remove_all(old_session->longpolls);
+	for(lp = longpolls; lp != NULL; lp = lp->next) {
+		transport = (janus_transport_session *)lp->data;
 		msg = (janus_http_msg *)(transport ? transport->transport_p : NULL);
 		if(msg != NULL) {
 			janus_refcount_increase(&msg->ref);
@@ -1202,8 +1460,8 @@ void janus_http_session_claimed(janus_transport_session *transport, guint64 sess
 			}
 			janus_refcount_decrease(&msg->ref);
 		}
-		session->longpolls = g_list_remove(old_session->longpolls, transport);
 	}
+	g_list_free(longpolls);
 	janus_mutex_unlock(&old_session->mutex);
 	janus_refcount_decrease(&old_session->ref);
 }
@@ -1302,6 +1560,30 @@ json_t *janus_http_query_transport(json_t *request) {
 		guint count = g_hash_table_size(messages);
 		janus_mutex_unlock(&messages_mutex);
 		json_object_set_new(response, "messages", json_integer(count));
+		/* Check how many events are waiting to be retrieved */
+		guint queued = 0, largest = 0;
+		janus_mutex_lock(&sessions_mutex);
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, sessions);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) {
+			janus_http_session *session = (janus_http_session *)value;
+			gint qlen = g_async_queue_length(session->events);
+			if(qlen < 0)
+				continue;
+			queued += qlen;
+			if((guint)qlen > largest)
+				largest = qlen;
+		}
+		count = g_hash_table_size(sessions);
+		janus_mutex_unlock(&sessions_mutex);
+		json_object_set_new(response, "sessions", json_integer(count));
+		json_object_set_new(response, "queued_events", json_integer(queued));
+		json_object_set_new(response, "largest_queue", json_integer(largest));
+		if(http_max_queued > 0)
+			json_object_set_new(response, "max_queued", json_integer(http_max_queued));
+		json_object_set_new(response, "dropped_events", json_integer(g_atomic_int_get(&http_dropped)));
+		json_object_set_new(response, "overflows", json_integer(g_atomic_int_get(&http_overflows)));
 	} else {
 		JANUS_LOG(LOG_VERB, "Unknown request '%s'\n", request_text);
 		error_code = JANUS_HTTP_ERROR_INVALID_REQUEST;
@@ -1644,6 +1926,62 @@ static janus_MHD_Result janus_http_handler(void *cls, struct MHD_Connection *con
 		}
 		janus_refcount_increase(&session->ref);
 		janus_mutex_unlock(&sessions_mutex);
+		/* Is this a request for a Server-Sent Events stream, rather than a long poll? */
+		const char *accept = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "Accept");
+		const char *sse = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "stream");
+		if((accept && strstr(accept, "text/event-stream")) || (sse && !strcasecmp(sse, "sse"))) {
+			janus_http_stream *stream = g_malloc0(sizeof(janus_http_stream));
+			janus_refcount_increase(&ts->ref);
+			stream->ts = ts;
+			stream->connection = connection;
+			stream->session = session;
+			stream->secret = g_strdup(secret);
+			stream->token = g_strdup(token);
+			stream->buffer = g_string_new(NULL);
+			janus_mutex_init(&stream->mutex);
+			janus_refcount_init(&stream->ref, janus_http_stream_free);
+			/* The stream owns our reference to the session, now: the response gets one to the stream */
+			janus_refcount_increase(&stream->ref);
+			response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN,
+				1024, &janus_http_stream_callback, stream, &janus_http_stream_unref);
+			if(response == NULL) {
+				janus_refcount_decrease(&stream->ref);
+				janus_refcount_decrease(&stream->ref);
+				ret = MHD_NO;
+				goto done;
+			}
+			MHD_add_response_header(response, "Content-Type", "text/event-stream");
+			MHD_add_response_header(response, "Cache-Control", "no-cache");
+			MHD_add_response_header(response, "X-Accel-Buffering", "no");
+			janus_http_add_cors_headers(msg, response);
+			/* Only one stream per session: if there was one already, close it */
+			janus_mutex_lock(&session->mutex);
+			janus_http_stream *old_stream = session->stream;
+			janus_refcount_increase(&stream->ref);
+			session->stream = stream;
+			janus_refcount_increase(&stream->ref);
+			msg->stream = stream;
+			janus_mutex_unlock(&session->mutex);
+			if(old_stream != NULL) {
+				JANUS_LOG(LOG_VERB, "Replacing existing event stream for session %"SCNu64"\n", session_id);
+				janus_http_stream_close(old_stream, FALSE);
+				janus_refcount_decrease(&old_stream->ref);
+			}
+			/* Periodically send a comment, and a keepalive to the core */
+			janus_mutex_lock(&stream->mutex);
+			if(!g_atomic_int_get(&stream->closed)) {
+				stream->timer = g_timeout_source_new_seconds(JANUS_HTTP_SSE_KEEPALIVE);
+				janus_refcount_increase(&stream->ref);
+				g_source_set_callback(stream->timer, janus_http_stream_keepalive, stream, janus_http_stream_unref);
+				g_source_attach(stream->timer, httpctx);
+			}
+			janus_mutex_unlock(&stream->mutex);
+			JANUS_LOG(LOG_VERB, "Session %"SCNu64" found... streaming events\n", session_id);
+			ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+			MHD_destroy_response(response);
+			janus_refcount_decrease(&stream->ref);
+			goto done;
+		}
 		/* How many messages can we send back in a single response? (just one by default) */
 		int max_events = 1;
 		const char *maxev = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "maxev");
@@ -1702,7 +2040,7 @@ static janus_MHD_Result janus_http_handler(void *cls, struct MHD_Connection *con
 				g_source_attach(msg->timeout, httpctx);
 				/* Mark this connection as the long poll for this session */
 				msg->max_events = max_events;
-				session->longpolls = g_list_append(session->longpolls, ts);
+				g_hash_table_insert(session->longpolls, ts, ts);
 				g_atomic_pointer_set(&msg->longpoll, session);
 			}
 		}
@@ -1982,6 +2320,26 @@ static janus_MHD_Result janus_http_admin_handler(void *cls, struct MHD_Connectio
 		goto parsingdone;
 	}
 
+	/* Or a scrape of the metrics */
+	if(admin_metrics && session_path != NULL && !strcmp(session_path, "metrics")) {
+		if(strcasecmp(method, "GET")) {
+			response = MHD_create_response_from_buffer(0, NULL, MHD_RESPMEM_PERSISTENT);
+			janus_http_add_cors_headers(msg, response);
+			ret = MHD_queue_response(connection, MHD_HTTP_BAD_REQUEST, response);
+			MHD_destroy_response(response);
+			goto done;
+		}
+		/* The core renders the metrics for us, no need to go through the Admin API */
+		char *metrics = gateway->get_metrics(&janus_http_transport);
+		response = MHD_create_response_from_buffer(strlen(metrics), (void *)metrics, MHD_RESPMEM_MUST_COPY);
+		g_free(metrics);
+		MHD_add_response_header(response, "Content-Type", "application/openmetrics-text; version=1.0.0; charset=utf-8");
+		janus_http_add_cors_headers(msg, response);
+		ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+		MHD_destroy_response(response);
+		goto done;
+	}
+
 	/* Without a payload we don't know what to do */
 	if(!payload) {
 		ret = janus_http_return_error(ts, 0, NULL, JANUS_ERROR_INVALID_JSON, "Request payload missing");
@@ -2104,10 +2462,22 @@ static void janus_http_request_completed(void *cls, struct MHD_Connection *conne
 		request->timeout = NULL;
 		if(session) {
 			janus_mutex_lock(&session->mutex);
-			session->longpolls = g_list_remove(session->longpolls, ts);
+			g_hash_table_remove(session->longpolls, ts);
 			janus_mutex_unlock(&session->mutex);
 			janus_refcount_decrease(&session->ref);
 		}
+		janus_http_stream *stream = request->stream;
+		if(stream != NULL) {
+			/* This was a Server-Sent Events stream, detach it from the session */
+			janus_http_stream_close(stream, TRUE);
+			session = stream->session;
+			janus_mutex_lock(&session->mutex);
+			if(session->stream == stream) {
+				session->stream = NULL;
+				janus_refcount_decrease(&stream->ref);
+			}
+			janus_mutex_unlock(&session->mutex);
+		}
 		janus_refcount_decrease(&request->ref);
 	}
 	janus_mutex_lock(&messages_mutex);
@@ -2131,6 +2501,78 @@ static ssize_t janus_http_response_callback(void *cls, uint64_t pos, char *buf,
 	return bytes;
 }
 
+static ssize_t janus_http_stream_callback(void *cls, uint64_t pos, char *buf, size_t max) {
+	janus_http_stream *stream = (janus_http_stream *)cls;
+	if(stream == NULL)
+		return MHD_CONTENT_READER_END_WITH_ERROR;
+	janus_mutex_lock(&stream->mutex);
+	if(stream->offset >= stream->buffer->len) {
+		/* Nothing pending, check if there are events to send */
+		g_string_truncate(stream->buffer, 0);
+		stream->offset = 0;
+		if(!g_atomic_int_get(&stream->closed) && !g_atomic_int_get(&stopping)) {
+			json_t *event = NULL;
+			while((event = g_async_queue_try_pop(stream->session->events)) != NULL) {
+				/* Each event must fit in a single data line, so we always send it compact */
+				char *event_text = json_dumps(event, JSON_COMPACT | JSON_PRESERVE_ORDER);
+				json_decref(event);
+				if(event_text != NULL) {
+					g_string_append_printf(stream->buffer, "data: %s\n\n", event_text);
+					free(event_text);
+				}
+				if(stream->buffer->len >= max)
+					break;
+			}
+			if(stream->buffer->len == 0 && stream->ping)
+				g_string_append(stream->buffer, ": keepalive\n\n");
+			stream->ping = FALSE;
+		}
+		if(stream->buffer->len == 0) {
+			if(g_atomic_int_get(&stream->closed) || g_atomic_int_get(&stopping) || stream->connection == NULL) {
+				/* We're done */
+				janus_mutex_unlock(&stream->mutex);
+				return MHD_CONTENT_READER_END_OF_STREAM;
+			}
+			/* Nothing to send yet, wait until we're woken up */
+			stream->suspended = TRUE;
+			MHD_suspend_connection(stream->connection);
+			janus_mutex_unlock(&stream->mutex);
+			return 0;
+		}
+	}
+	size_t bytes = stream->buffer->len - stream->offset;
+	if(bytes > max)
+		bytes = max;
+	memcpy(buf, stream->buffer->str + stream->offset, bytes);
+	stream->offset += bytes;
+	janus_mutex_unlock(&stream->mutex);
+	return bytes;
+}
+
+static gboolean janus_http_stream_keepalive(gpointer user_data) {
+	janus_http_stream *stream = (janus_http_stream *)user_data;
+	if(g_atomic_int_get(&stream->closed) || g_atomic_int_get(&stopping))
+		return G_SOURCE_REMOVE;
+	/* An open stream acts as a keepalive for the session, as long polls do */
+	char tr[12];
+	janus_http_random_string(12, (char *)&tr);
+	json_t *root = json_object();
+	json_object_set_new(root, "janus", json_string("keepalive"));
+	json_object_set_new(root, "session_id", json_integer(stream->session->session_id));
+	json_object_set_new(root, "transaction", json_string(tr));
+	if(stream->secret)
+		json_object_set_new(root, "apisecret", json_string(stream->secret));
+	if(stream->token)
+		json_object_set_new(root, "token", json_string(stream->token));
+	gateway->incoming_request(&janus_http_transport, stream->ts, (void *)keepalive_id, FALSE, root, NULL);
+	/* Send a comment too, in case the stream has been idle */
+	janus_mutex_lock(&stream->mutex);
+	stream->ping = TRUE;
+	janus_mutex_unlock(&stream->mutex);
+	janus_http_stream_wakeup(stream);
+	return G_SOURCE_CONTINUE;
+}
+
 /* Worker to handle notifications */
 static int janus_http_notifier(janus_http_msg *msg) {
 	if(!msg || !msg->connection)
@@ -2315,7 +2757,7 @@ void janus_http_timeout(janus_transport_session *ts, janus_http_session *session
 		MHD_resume_connection(request->connection);
 		if(lock_session)
 			janus_mutex_lock(&session->mutex);
-		session->longpolls = g_list_remove(session->longpolls, ts);
+		g_hash_table_remove(session->longpolls, ts);
 		if(lock_session)
 			janus_mutex_unlock(&session->mutex);
 		janus_refcount_decrease(&session->ref);
@@ -21,6 +21,12 @@
  * \note When you create a session using MQTT, a subscription to the
  * events related to it is done automatically through the outgoing queue,
  * so no need for an explicit request as the GET in the plain HTTP API.
+ * \note Since MQTT limits the number of in-flight messages per connection,
+ * additional connections to the broker can be configured to publish
+ * Janus API responses and events: messages are sharded on these connections
+ * by session ID, which means messages related to the same session are still
+ * published in order. The main connection is still the one used to receive
+ * requests, and to publish Admin API and status messages.
  *
  * \ingroup transports
  * \ref transports
@@ -56,6 +62,7 @@ const char *janus_mqtt_get_package(void);
 gboolean janus_mqtt_is_janus_api_enabled(void);
 gboolean janus_mqtt_is_admin_api_enabled(void);
 int janus_mqtt_send_message(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message);
+int janus_mqtt_send_message_prepared(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message, janus_transport_payload *shared);
 void janus_mqtt_session_created(janus_transport_session *transport, guint64 session_id);
 void janus_mqtt_session_over(janus_transport_session *transport, guint64 session_id, gboolean timeout, gboolean claimed);
 void janus_mqtt_session_claimed(janus_transport_session *transport, guint64 session_id);
@@ -91,6 +98,7 @@ static janus_transport janus_mqtt_transport_ =
 		.session_claimed = janus_mqtt_session_claimed,
 
 		.query_transport = janus_mqtt_query_transport,
+		.send_message_prepared = janus_mqtt_send_message_prepared,
 	);
 
 /* Transport creator */
@@ -137,6 +145,11 @@ typedef struct janus_mqtt_context {
 		int max_inflight;
 		int max_buffered;
 	} connect;
+	/* Additional connections to publish Janus API messages on, if any */
+	struct {
+		int count;
+		MQTTAsync *clients;
+	} pool;
 	struct {
 		int timeout;
 		janus_mutex mutex;
@@ -203,6 +216,8 @@ void janus_mqtt_client_connected(void *context, char *cause);
 void janus_mqtt_client_connection_lost(void *context, char *cause);
 int janus_mqtt_client_message_arrived(void *context, char *topicName, int topicLen, MQTTAsync_message *message);
 int janus_mqtt_client_connect(janus_mqtt_context *ctx);
+int janus_mqtt_client_connect_client(janus_mqtt_context *ctx, MQTTAsync client, gboolean will);
+MQTTAsync janus_mqtt_client_get_publisher(janus_mqtt_context *ctx, gboolean admin, guint64 session_id);
 int janus_mqtt_client_reconnect(janus_mqtt_context *ctx);
 int janus_mqtt_client_disconnect(janus_mqtt_context *ctx);
 int janus_mqtt_client_subscribe(janus_mqtt_context *ctx, gboolean admin);
@@ -224,7 +239,7 @@ void janus_mqtt_client_publish_admin_success(void *context, MQTTAsync_successDat
 void janus_mqtt_client_publish_admin_failure(void *context, MQTTAsync_failureData *response);
 void janus_mqtt_client_publish_status_success(void *context, MQTTAsync_successData *response);
 void janus_mqtt_client_publish_status_failure(void *context, MQTTAsync_failureData *response);
-int janus_mqtt_client_publish_message(janus_mqtt_context *ctx, char *payload, gboolean admin);
+int janus_mqtt_client_publish_message(janus_mqtt_context *ctx, char *payload, gboolean admin, guint64 session_id);
 int janus_mqtt_client_get_response_code(MQTTAsync_failureData *response);
 #ifdef MQTTVERSION_5
 /* MQTT v5 interface callbacks */
@@ -244,7 +259,7 @@ void janus_mqtt_client_publish_admin_success5(void *context, MQTTAsync_successDa
 void janus_mqtt_client_publish_admin_failure5(void *context, MQTTAsync_failureData5 *response);
 void janus_mqtt_client_publish_status_success5(void *context, MQTTAsync_successData5 *response);
 void janus_mqtt_client_publish_status_failure5(void *context, MQTTAsync_failureData5 *response);
-int janus_mqtt_client_publish_message5(janus_mqtt_context *ctx, char *payload, gboolean admin, MQTTProperties *properties, char *custom_topic);
+int janus_mqtt_client_publish_message5(janus_mqtt_context *ctx, char *payload, gboolean admin, guint64 session_id, MQTTProperties *properties, char *custom_topic);
 int janus_mqtt_client_get_response_code5(MQTTAsync_failureData5 *response);
 #endif
 /* MQTT version independent callback implementations */
@@ -462,6 +477,13 @@ int janus_mqtt_init(janus_transport_callbacks *callback, const char *config_path
 		ctx->connect.max_buffered = 100;
 	}
 
+	janus_config_item *publishers_item = janus_config_get(config, config_general, janus_config_type_item, "publishers");
+	ctx->pool.count = (publishers_item && publishers_item->value) ? atoi(publishers_item->value) : 0;
+	if(ctx->pool.count < 0) {
+		JANUS_LOG(LOG_ERR, "Invalid publishers value: %s (falling back to default)\n", publishers_item->value);
+		ctx->pool.count = 0;
+	}
+
 	janus_config_item *enabled_item = janus_config_get(config, config_general, janus_config_type_item, "enabled");
 	if(enabled_item == NULL) {
 		/* Try legacy property */
@@ -739,6 +761,34 @@ int janus_mqtt_init(janus_transport_callbacks *callback, const char *config_path
 		goto error;
 	}
 
+	/* Create and connect the additional publishing clients, if any: they
+	 * don't subscribe to anything, so we don't need any callback from them */
+	if(ctx->pool.count > 0) {
+		JANUS_LOG(LOG_INFO, "Publishing Janus API messages on %d additional MQTT connections\n", ctx->pool.count);
+		ctx->pool.clients = g_malloc0(ctx->pool.count * sizeof(MQTTAsync));
+		int i = 0;
+		for(i=0; i<ctx->pool.count; i++) {
+			char *pool_client_id = g_strdup_printf("%s-pub%d", client_id, i+1);
+			if(MQTTAsync_createWithOptions(
+					&ctx->pool.clients[i],
+					url,
+					pool_client_id,
+					MQTTCLIENT_PERSISTENCE_NONE,
+					NULL,
+					&create_options) != MQTTASYNC_SUCCESS) {
+				JANUS_LOG(LOG_FATAL, "Can't connect to MQTT broker: error creating publishing client %s...\n", pool_client_id);
+				g_free(pool_client_id);
+				goto error;
+			}
+			g_free(pool_client_id);
+			rc = janus_mqtt_client_connect_client(ctx, ctx->pool.clients[i], FALSE);
+			if(rc != MQTTASYNC_SUCCESS) {
+				JANUS_LOG(LOG_FATAL, "Can't connect to MQTT broker (publishing client %d), return code: %d\n", i+1, rc);
+				goto error;
+			}
+		}
+	}
+
 	g_free((char *)url);
 	g_free((char *)client_id);
 	janus_config_destroy(config);
@@ -849,6 +899,10 @@ gboolean janus_mqtt_is_admin_api_enabled(void) {
 }
 
 int janus_mqtt_send_message(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message) {
+	return janus_mqtt_send_message_prepared(transport, request_id, admin, message, NULL);
+}
+
+int janus_mqtt_send_message_prepared(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message, janus_transport_payload *shared) {
 	if(message == NULL || transport == NULL) return -1;
 
 	/* Not really needed as we always only have a single context, but that's fine */
@@ -858,12 +912,15 @@ int janus_mqtt_send_message(janus_transport_session *transport, void *request_id
 		return -1;
 	}
 
-	char *payload = json_dumps(message, json_format);
+	char *payload = janus_transport_payload_dumps(shared, message, json_format);
 	if(payload == NULL) {
 		JANUS_LOG(LOG_ERR, "Failed to stringify message...\n");
 		return -1;
 	}
 	JANUS_LOG(LOG_HUGE, "Sending %s API message via MQTT: %s\n", admin ? "admin" : "Janus", payload);
+	/* The session ID tells us which connection to publish this on, if we have more than one */
+	json_t *s = json_object_get(message, "session_id");
+	guint64 session_id = json_is_integer(s) ? json_integer_value(s) : 0;
 
 	int rc;
 #ifdef MQTTVERSION_5
@@ -886,14 +943,14 @@ int janus_mqtt_send_message(janus_transport_session *transport, void *request_id
 			g_rw_lock_reader_unlock(&janus_mqtt_transaction_states_lock);
 		}
 
-		rc = janus_mqtt_client_publish_message5(ctx, payload, admin, &properties, response_topic);
+		rc = janus_mqtt_client_publish_message5(ctx, payload, admin, session_id, &properties, response_topic);
 		if(response_topic != NULL) g_free(response_topic);
 		MQTTProperties_free(&properties);
 	} else {
-		rc = janus_mqtt_client_publish_message(ctx, payload, admin);
+		rc = janus_mqtt_client_publish_message(ctx, payload, admin, session_id);
 	}
 #else
-	rc = janus_mqtt_client_publish_message(ctx, payload, admin);
+	rc = janus_mqtt_client_publish_message(ctx, payload, admin, session_id);
 #endif
 
 	if(rc != MQTTASYNC_SUCCESS) {
@@ -1174,6 +1231,10 @@ done:
 }
 
 int janus_mqtt_client_connect(janus_mqtt_context *ctx) {
+	return janus_mqtt_client_connect_client(ctx, ctx->client, TRUE);
+}
+
+int janus_mqtt_client_connect_client(janus_mqtt_context *ctx, MQTTAsync client, gboolean will) {
 	MQTTAsync_connectOptions options = MQTTAsync_connectOptions_initializer;
 
 #ifdef MQTTVERSION_5
@@ -1208,7 +1269,7 @@ int janus_mqtt_client_connect(janus_mqtt_context *ctx) {
 	}
 
 	MQTTAsync_willOptions willOptions = MQTTAsync_willOptions_initializer;
-	if(ctx->status.enabled && ctx->status.disconnect_message != NULL) {
+	if(will && ctx->status.enabled && ctx->status.disconnect_message != NULL) {
 		willOptions.topicName = ctx->status.topic;
 		willOptions.message = ctx->status.disconnect_message;
 		willOptions.retained = ctx->status.retain;
@@ -1217,7 +1278,7 @@ int janus_mqtt_client_connect(janus_mqtt_context *ctx) {
 	}
 
 	options.context = ctx;
-	return MQTTAsync_connect(ctx->client, &options);
+	return MQTTAsync_connect(client, &options);
 }
 
 void janus_mqtt_client_connect_failure(void *context, MQTTAsync_failureData *response) {
@@ -1310,6 +1371,14 @@ int janus_mqtt_client_disconnect(janus_mqtt_context *ctx) {
 		}
 	}
 
+	/* Disconnect the additional publishing clients first, if any */
+	int i = 0;
+	for(i=0; i<ctx->pool.count && ctx->pool.clients != NULL; i++) {
+		MQTTAsync_disconnectOptions pool_options = MQTTAsync_disconnectOptions_initializer;
+		pool_options.timeout = ctx->disconnect.timeout;
+		MQTTAsync_disconnect(ctx->pool.clients[i], &pool_options);
+	}
+
 	MQTTAsync_disconnectOptions options = MQTTAsync_disconnectOptions_initializer;
 
 #ifdef MQTTVERSION_5
@@ -1499,7 +1568,14 @@ void janus_mqtt_client_admin_subscribe_failure_impl(void *context, int rc) {
 	}
 }
 
-int janus_mqtt_client_publish_message(janus_mqtt_context *ctx, char *payload, gboolean admin) {
+MQTTAsync janus_mqtt_client_get_publisher(janus_mqtt_context *ctx, gboolean admin, guint64 session_id) {
+	/* Admin API messages, and Janus API ones if there's no pool, go through the main client */
+	if(admin || ctx->pool.count == 0 || ctx->pool.clients == NULL)
+		return ctx->client;
+	return ctx->pool.clients[session_id % ctx->pool.count];
+}
+
+int janus_mqtt_client_publish_message(janus_mqtt_context *ctx, char *payload, gboolean admin, guint64 session_id) {
 	MQTTAsync_message msg = MQTTAsync_message_initializer;
 	msg.payload = payload;
 	msg.payloadlen = strlen(payload);
@@ -1519,11 +1595,11 @@ int janus_mqtt_client_publish_message(janus_mqtt_context *ctx, char *payload, gb
 		options.onFailure = janus_mqtt_client_publish_janus_failure;
 	}
 
-	return MQTTAsync_sendMessage(ctx->client, topic, &msg, &options);
+	return MQTTAsync_sendMessage(janus_mqtt_client_get_publisher(ctx, admin, session_id), topic, &msg, &options);
 }
 
 #ifdef MQTTVERSION_5
-int janus_mqtt_client_publish_message5(janus_mqtt_context *ctx, char *payload, gboolean admin, MQTTProperties *properties, char *custom_topic) {
+int janus_mqtt_client_publish_message5(janus_mqtt_context *ctx, char *payload, gboolean admin, guint64 session_id, MQTTProperties *properties, char *custom_topic) {
 	MQTTAsync_message msg = MQTTAsync_message_initializer;
 	msg.payload = payload;
 	msg.payloadlen = strlen(payload);
@@ -1551,7 +1627,7 @@ int janus_mqtt_client_publish_message5(janus_mqtt_context *ctx, char *payload, g
 		options.onFailure5 = janus_mqtt_client_publish_janus_failure5;
 	}
 
-	return MQTTAsync_sendMessage(ctx->client, topic, &msg, &options);
+	return MQTTAsync_sendMessage(janus_mqtt_client_get_publisher(ctx, admin, session_id), topic, &msg, &options);
 }
 #endif
 
@@ -1675,6 +1751,12 @@ void janus_mqtt_client_destroy_context(janus_mqtt_context **ptr) {
 	janus_mqtt_context *ctx = (janus_mqtt_context *)*ptr;
 	if(ctx) {
 		MQTTAsync_destroy(&ctx->client);
+		int i = 0;
+		for(i=0; i<ctx->pool.count && ctx->pool.clients != NULL; i++) {
+			if(ctx->pool.clients[i] != NULL)
+				MQTTAsync_destroy(&ctx->pool.clients[i]);
+		}
+		g_free(ctx->pool.clients);
 		g_free(ctx->subscribe.topic);
 		g_free(ctx->publish.topic);
 		g_free(ctx->connect.username);
@@ -51,6 +51,7 @@ const char *janus_nanomsg_get_package(void);
 gboolean janus_nanomsg_is_janus_api_enabled(void);
 gboolean janus_nanomsg_is_admin_api_enabled(void);
 int janus_nanomsg_send_message(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message);
+int janus_nanomsg_send_message_prepared(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message, janus_transport_payload *shared);
 void janus_nanomsg_session_created(janus_transport_session *transport, guint64 session_id);
 void janus_nanomsg_session_over(janus_transport_session *transport, guint64 session_id, gboolean timeout, gboolean claimed);
 void janus_nanomsg_session_claimed(janus_transport_session *transport, guint64 session_id);
@@ -80,6 +81,7 @@ static janus_transport janus_nanomsg_transport =
 		.session_claimed = janus_nanomsg_session_claimed,
 
 		.query_transport = janus_nanomsg_query_transport,
+		.send_message_prepared = janus_nanomsg_send_message_prepared,
 	);
 
 /* Transport creator */
@@ -397,10 +399,14 @@ gboolean janus_nanomsg_is_admin_api_enabled(void) {
 }
 
 int janus_nanomsg_send_message(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message) {
+	return janus_nanomsg_send_message_prepared(transport, request_id, admin, message, NULL);
+}
+
+int janus_nanomsg_send_message_prepared(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message, janus_transport_payload *shared) {
 	if(message == NULL)
 		return -1;
 	/* Convert to string */
-	char *payload = json_dumps(message, json_format);
+	char *payload = janus_transport_payload_dumps(shared, message, json_format);
 	json_decref(message);
 	if(payload == NULL) {
 		JANUS_LOG(LOG_ERR, "Failed to stringify message...\n");
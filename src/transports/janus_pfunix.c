@@ -21,6 +21,14 @@
  * the events related to it is done automatically, so no need for an
  * explicit request as the GET in the plain HTTP API. Closing a client
  * Unix Socket will also destroy all the sessions it created.
+ * \note To save on syscalls, a single packet can contain more than one
+ * request: the JSON messages are simply concatenated (optionally with
+ * whitespace, e.g., a new line, in between), and are passed to the core
+ * in order. When the \c pipelining property is enabled, the same is done
+ * for \c SOCK_SEQPACKET clients in the other direction too, that is,
+ * responses and events waiting to be sent are written as concatenated
+ * JSON messages, separated by new lines, in packets no larger than the
+ * configured \c max_packet_size. Clients must be able to split them.
  *
  * \ingroup transports
  * \ref transports
@@ -66,6 +74,7 @@ const char *janus_pfunix_get_package(void);
 gboolean janus_pfunix_is_janus_api_enabled(void);
 gboolean janus_pfunix_is_admin_api_enabled(void);
 int janus_pfunix_send_message(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message);
+int janus_pfunix_send_message_prepared(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message, janus_transport_payload *shared);
 void janus_pfunix_session_created(janus_transport_session *transport, guint64 session_id);
 void janus_pfunix_session_over(janus_transport_session *transport, guint64 session_id, gboolean timeout, gboolean claimed);
 void janus_pfunix_session_claimed(janus_transport_session *transport, guint64 session_id);
@@ -95,6 +104,7 @@ static janus_transport janus_pfunix_transport =
 		.session_claimed = janus_pfunix_session_claimed,
 
 		.query_transport = janus_pfunix_query_transport,
+		.send_message_prepared = janus_pfunix_send_message_prepared,
 	);
 
 /* Transport creator */
@@ -114,6 +124,11 @@ static size_t json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
 
 #define BUFFER_SIZE		8192
 
+/* Size of the buffer for incoming packets, and limit for the outgoing ones */
+static size_t max_packet_size = BUFFER_SIZE;
+/* Whether outgoing messages for SOCK_SEQPACKET clients should be written in batches */
+static gboolean pipelining = FALSE;
+
 /* Parameter validation (for tweaking and queries via Admin API) */
 static struct janus_json_parameter request_parameters[] = {
 	{"request", JSON_STRING, JANUS_JSON_PARAM_REQUIRED}
@@ -273,6 +288,22 @@ int janus_pfunix_init(janus_transport_callbacks *callback, const char *config_pa
 			JANUS_LOG(LOG_WARN, "Notification of events to handlers disabled for %s\n", JANUS_PFUNIX_NAME);
 		}
 
+		/* Check how large packets can be, and if we should pipeline outgoing messages */
+		item = janus_config_get(config, config_general, janus_config_type_item, "max_packet_size");
+		if(item && item->value) {
+			int size = atoi(item->value);
+			if(size < 1024) {
+				JANUS_LOG(LOG_WARN, "Invalid max_packet_size '%s', using default (%d)\n", item->value, BUFFER_SIZE);
+			} else {
+				max_packet_size = size;
+			}
+		}
+		item = janus_config_get(config, config_general, janus_config_type_item, "pipelining");
+		if(item && item->value)
+			pipelining = janus_is_true(item->value);
+		JANUS_LOG(LOG_VERB, "Unix Sockets packets up to %zu bytes, pipelining %s\n",
+			max_packet_size, pipelining ? "enabled" : "disabled");
+
 		/* First of all, initialize the socketpair for writeable notifications */
 		if(socketpair(PF_LOCAL, SOCK_STREAM, 0, write_fd) < 0) {
 			JANUS_LOG(LOG_FATAL, "Error creating socket pair for writeable events: %d, %s\n", errno, g_strerror(errno));
@@ -429,6 +460,10 @@ gboolean janus_pfunix_is_admin_api_enabled(void) {
 }
 
 int janus_pfunix_send_message(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message) {
+	return janus_pfunix_send_message_prepared(transport, request_id, admin, message, NULL);
+}
+
+int janus_pfunix_send_message_prepared(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message, janus_transport_payload *shared) {
 	if(message == NULL)
 		return -1;
 	if(transport == NULL || transport->transport_p == NULL) {
@@ -447,7 +482,7 @@ int janus_pfunix_send_message(janus_transport_session *transport, void *request_
 	}
 	janus_mutex_unlock(&clients_mutex);
 	/* Convert to string */
-	char *payload = json_dumps(message, json_format);
+	char *payload = janus_transport_payload_dumps(shared, message, json_format);
 	json_decref(message);
 	if(payload == NULL) {
 		JANUS_LOG(LOG_ERR, "Failed to stringify message...\n");
@@ -584,19 +619,59 @@ plugin_response:
 }
 
 
+/* Helper to write data to a SOCK_SEQPACKET client */
+static void janus_pfunix_write(janus_pfunix_client *client, const char *data, size_t len) {
+	int res = 0;
+	do {
+		if(client->fd < 0)
+			break;
+		res = write(client->fd, data, len);
+	} while(res == -1 && errno == EINTR);
+	/* FIXME Should we check if sent everything? */
+	JANUS_LOG(LOG_HUGE, "Written %d/%zu bytes on %d\n", res, len, client->fd);
+}
+
+/* Helper to parse the JSON messages in a packet (there may be more than one) and pass them to the core */
+static void janus_pfunix_handle_messages(janus_pfunix_client *client, const char *buffer, size_t len) {
+	const char *curr = buffer, *end = buffer + len;
+	GList *messages = NULL, *m = NULL;
+	do {
+		json_error_t error;
+		json_t *message = json_loads(curr, JSON_DISABLE_EOF_CHECK, &error);
+		if(message == NULL) {
+			/* Release any buffered messages, and notify the core about the error */
+			g_list_free_full(messages, (GDestroyNotify)json_decref);
+			gateway->incoming_request(&janus_pfunix_transport, client->ts, NULL, client->admin, NULL, &error);
+			return;
+		}
+		/* Position is set to bytes read on success when EOF_CHECK is disabled as above */
+		curr += error.position;
+		messages = g_list_prepend(messages, message);
+		/* Skip whitespace between messages, and after the last one */
+		while(curr < end && isspace(*curr))
+			curr++;
+	} while(curr < end);
+	/* Process messages in order, no error since we know there weren't any */
+	messages = g_list_reverse(messages);
+	for(m = messages; m != NULL; m = m->next)
+		gateway->incoming_request(&janus_pfunix_transport, client->ts, NULL, client->admin, (json_t *)m->data, NULL);
+	g_list_free(messages);
+}
+
 /* Thread */
 void *janus_pfunix_thread(void *data) {
 	JANUS_LOG(LOG_INFO, "Unix Sockets thread started\n");
 
 	int fds = 0;
 	struct pollfd poll_fds[1024];	/* FIXME Should we allow for more clients? */
-	char buffer[BUFFER_SIZE];
+	/* We keep room for a terminator */
+	char *buffer = g_malloc(max_packet_size + 1);
 	struct iovec iov[1];
 	struct msghdr msg;
 	memset(&msg, 0, sizeof(msg));
 	memset(iov, 0, sizeof(iov));
 	iov[0].iov_base = buffer;
-	iov[0].iov_len = sizeof(buffer);
+	iov[0].iov_len = max_packet_size;
 	msg.msg_iov = iov;
 	msg.msg_iovlen = 1;
 
@@ -714,17 +789,32 @@ void *janus_pfunix_thread(void *data) {
 				janus_pfunix_client *client = g_hash_table_lookup(clients_by_fd, GINT_TO_POINTER(poll_fds[i].fd));
 				if(client != NULL) {
 					char *payload = NULL;
+					GString *batch = NULL;
 					while((payload = g_async_queue_try_pop(client->messages)) != NULL) {
-						int res = 0;
-						do {
-							if(client->fd < 0)
-								break;
-							res = write(client->fd, payload, strlen(payload));
-						} while(res == -1 && errno == EINTR);
-						/* FIXME Should we check if sent everything? */
-						JANUS_LOG(LOG_HUGE, "Written %d/%zu bytes on %d\n", res, strlen(payload), client->fd);
+						size_t plen = strlen(payload);
+						if(!pipelining) {
+							janus_pfunix_write(client, payload, plen);
+							g_free(payload);
+							continue;
+						}
+						/* Pack as many messages as we can in the same packet */
+						if(batch == NULL)
+							batch = g_string_sized_new(max_packet_size);
+						if(batch->len > 0 && batch->len + 1 + plen > max_packet_size) {
+							/* This one won't fit, send what we have first */
+							janus_pfunix_write(client, batch->str, batch->len);
+							g_string_truncate(batch, 0);
+						}
+						if(batch->len > 0)
+							g_string_append_c(batch, '\n');
+						g_string_append_len(batch, payload, plen);
 						g_free(payload);
 					}
+					if(batch != NULL) {
+						if(batch->len > 0)
+							janus_pfunix_write(client, batch->str, batch->len);
+						g_string_free(batch, TRUE);
+					}
 					if(client->session_timeout) {
 						/* We should actually get rid of this connection, now */
 						shutdown(SHUT_RDWR, poll_fds[i].fd);
@@ -748,7 +838,7 @@ void *janus_pfunix_thread(void *data) {
 			if(poll_fds[i].revents & POLLIN) {
 				if(poll_fds[i].fd == write_fd[0]) {
 					/* Read and ignore: we use this to unlock the poll if there's data to write */
-					(void)read(poll_fds[i].fd, buffer, BUFFER_SIZE);
+					(void)read(poll_fds[i].fd, buffer, max_packet_size);
 				} else if(poll_fds[i].fd == pfd || poll_fds[i].fd == admin_pfd) {
 					/* Janus/Admin API: accept the new client (SOCK_SEQPACKET) or receive data (SOCK_DGRAM) */
 					struct sockaddr_un address;
@@ -785,7 +875,7 @@ void *janus_pfunix_thread(void *data) {
 					} else {
 						/* SOCK_DGRAM */
 						struct sockaddr_storage address;
-						res = recvfrom(poll_fds[i].fd, buffer, sizeof(buffer), 0, (struct sockaddr *)&address, &addrlen);
+						res = recvfrom(poll_fds[i].fd, buffer, max_packet_size, 0, (struct sockaddr *)&address, &addrlen);
 						if(res < 0) {
 							if(errno != EAGAIN && errno != EWOULDBLOCK) {
 								JANUS_LOG(LOG_ERR, "Error reading from client (%s API)...\n",
@@ -831,15 +921,12 @@ void *janus_pfunix_thread(void *data) {
 						janus_mutex_unlock(&clients_mutex);
 						JANUS_LOG(LOG_VERB, "Message from client %s (%d bytes)\n", uaddr->sun_path, res);
 						JANUS_LOG(LOG_HUGE, "%s\n", buffer);
-						/* Parse the JSON payload */
-						json_error_t error;
-						json_t *root = json_loads(buffer, 0, &error);
-						/* Notify the core, passing both the object and, since it may be needed, the error */
-						gateway->incoming_request(&janus_pfunix_transport, client->ts, NULL, client->admin, root, &error);
+						/* Parse the JSON payload(s) and notify the core */
+						janus_pfunix_handle_messages(client, buffer, res);
 					}
 				} else {
 					/* Client data: receive message */
-					iov[0].iov_len = sizeof(buffer);
+					iov[0].iov_len = max_packet_size;
 					res = recvmsg(poll_fds[i].fd, &msg, MSG_WAITALL);
 					if(res < 0) {
 						if(errno != EAGAIN && errno != EWOULDBLOCK) {
@@ -890,11 +977,8 @@ void *janus_pfunix_thread(void *data) {
 					buffer[res] = '\0';
 					JANUS_LOG(LOG_VERB, "Message from client %d (%d bytes)\n", poll_fds[i].fd, res);
 					JANUS_LOG(LOG_HUGE, "%s\n", buffer);
-					/* Parse the JSON payload */
-					json_error_t error;
-					json_t *root = json_loads(buffer, 0, &error);
-					/* Notify the core, passing both the object and, since it may be needed, the error */
-					gateway->incoming_request(&janus_pfunix_transport, client->ts, NULL, client->admin, root, &error);
+					/* Parse the JSON payload(s) and notify the core */
+					janus_pfunix_handle_messages(client, buffer, res);
 				}
 			}
 		}
@@ -936,6 +1020,7 @@ void *janus_pfunix_thread(void *data) {
 	g_hash_table_destroy(clients_by_path);
 	g_hash_table_destroy(clients_by_fd);
 	g_hash_table_destroy(clients);
+	g_free(buffer);
 
 	/* Done */
 	JANUS_LOG(LOG_INFO, "Unix Sockets thread ended\n");
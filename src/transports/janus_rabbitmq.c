@@ -26,6 +26,16 @@
  * \note When you create a session using RabbitMQ, a subscription to the
  * events related to it is done automatically through the outgoing queue,
  * so no need for an explicit request as the GET in the plain HTTP API.
+ * \note By default, incoming messages are consumed without acknowledgements
+ * and responses and events are published on the same connection used
+ * for consuming. Setting \c prefetch enables manual acknowledgements
+ * with the related \c basic.qos limit, while \c dedicated_publisher
+ * moves publishing to a separate connection, so that a slow or blocked
+ * publisher doesn't stall incoming requests. Publisher confirms, which
+ * require a dedicated publisher, can be enabled with \c publisher_confirms:
+ * up to \c confirm_batch messages are kept in flight before waiting for
+ * the broker to confirm them, and messages that are rejected, or still
+ * unconfirmed when the connection goes away, are published again.
  *
  * \ingroup transports
  * \ref transports
@@ -75,6 +85,7 @@ const char *janus_rabbitmq_get_package(void);
 gboolean janus_rabbitmq_is_janus_api_enabled(void);
 gboolean janus_rabbitmq_is_admin_api_enabled(void);
 int janus_rabbitmq_send_message(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message);
+int janus_rabbitmq_send_message_prepared(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message, janus_transport_payload *shared);
 void janus_rabbitmq_session_created(janus_transport_session *transport, guint64 session_id);
 void janus_rabbitmq_session_over(janus_transport_session *transport, guint64 session_id, gboolean timeout, gboolean claimed);
 void janus_rabbitmq_session_claimed(janus_transport_session *transport, guint64 session_id);
@@ -106,6 +117,7 @@ static janus_transport janus_rabbitmq_transport =
 		.session_claimed = janus_rabbitmq_session_claimed,
 
 		.query_transport = janus_rabbitmq_query_transport,
+		.send_message_prepared = janus_rabbitmq_send_message_prepared,
 	);
 
 /* Transport creator */
@@ -149,6 +161,11 @@ static struct janus_json_parameter configure_parameters[] = {
 typedef struct janus_rabbitmq_client {
 	amqp_connection_state_t rmq_conn;		/* AMQP connection state */
 	amqp_channel_t rmq_channel;				/* AMQP channel */
+	amqp_connection_state_t pub_conn;		/* AMQP connection state for publishing, if dedicated */
+	gboolean pub_connected;					/* Whether the dedicated publishing connection is up */
+	uint64_t pub_tag;						/* Delivery tag of the last message published with confirms */
+	GQueue *unconfirmed;					/* Messages published but not confirmed yet */
+	GQueue *pending;						/* Messages to publish again, before any new one */
 	gboolean janus_api_enabled;				/* Whether the Janus API via RabbitMQ is enabled */
 	amqp_bytes_t janus_exchange;			/* AMQP exchange for outgoing messages */
 	amqp_bytes_t to_janus_queue;			/* AMQP outgoing messages queue (Janus API) */
@@ -167,6 +184,7 @@ typedef struct janus_rabbitmq_response {
 	gboolean admin;			/* Whether this is a Janus or Admin API response */
 	char *correlation_id;	/* Correlation ID, if any */
 	char *payload;			/* Payload to send to the client */
+	uint64_t delivery_tag;	/* Delivery tag, when using publisher confirms */
 } janus_rabbitmq_response;
 static janus_rabbitmq_response exit_message;
 
@@ -190,6 +208,10 @@ static gboolean declare_outgoing_queue = FALSE, declare_outgoing_queue_admin = F
 amqp_boolean_t queue_durable = 0, queue_exclusive = 0, queue_autodelete = 0,
 	queue_durable_admin = 0, queue_exclusive_admin = 0, queue_autodelete_admin = 0;
 static uint16_t heartbeat = 0;
+static uint16_t prefetch = 0;
+static gboolean dedicated_publisher = FALSE, publisher_confirms = FALSE;
+#define JANUS_RABBITMQ_CONFIRM_BATCH	50
+static guint confirm_batch = JANUS_RABBITMQ_CONFIRM_BATCH;
 
 /* Transport implementation */
 int janus_rabbitmq_init(janus_transport_callbacks *callback, const char *config_path) {
@@ -312,6 +334,39 @@ int janus_rabbitmq_init(janus_transport_callbacks *callback, const char *config_
 		heartbeat = 0;
 	}
 
+	/* Flow control and publishing */
+	item = janus_config_get(config, config_general, janus_config_type_item, "prefetch");
+	if(item && item->value && janus_string_to_uint16(item->value, &prefetch) < 0) {
+		JANUS_LOG(LOG_ERR, "Invalid prefetch count (%s), falling back to default (0, no acknowledgements)\n", item->value);
+		prefetch = 0;
+	}
+	item = janus_config_get(config, config_general, janus_config_type_item, "dedicated_publisher");
+	if(item && item->value && janus_is_true(item->value))
+		dedicated_publisher = TRUE;
+	item = janus_config_get(config, config_general, janus_config_type_item, "publisher_confirms");
+	if(item && item->value && janus_is_true(item->value)) {
+		publisher_confirms = TRUE;
+		if(!dedicated_publisher) {
+			JANUS_LOG(LOG_WARN, "Publisher confirms need a dedicated publisher, enabling it\n");
+			dedicated_publisher = TRUE;
+		}
+	}
+	item = janus_config_get(config, config_general, janus_config_type_item, "confirm_batch");
+	if(item && item->value) {
+		int batch = atoi(item->value);
+		if(batch < 1) {
+			JANUS_LOG(LOG_WARN, "Invalid confirm batch (%s), falling back to default (%d)\n", item->value, JANUS_RABBITMQ_CONFIRM_BATCH);
+			batch = JANUS_RABBITMQ_CONFIRM_BATCH;
+		}
+		confirm_batch = batch;
+	}
+	if(prefetch > 0)
+		JANUS_LOG(LOG_INFO, "RabbitMQ consumer prefetch: %"SCNu16"\n", prefetch);
+	if(dedicated_publisher) {
+		JANUS_LOG(LOG_INFO, "RabbitMQ dedicated publisher enabled (confirms: %s, batch: %u)\n",
+			publisher_confirms ? "yes" : "no", confirm_batch);
+	}
+
 	/* Now check if the Janus API must be supported */
 	item = janus_config_get(config, config_general, janus_config_type_item, "enabled");
 	if(item == NULL) {
@@ -461,6 +516,8 @@ int janus_rabbitmq_init(janus_transport_callbacks *callback, const char *config_
 		}
 
 		rmq_client->messages = g_async_queue_new();
+		rmq_client->unconfirmed = g_queue_new();
+		rmq_client->pending = g_queue_new();
 		rmq_client->destroy = FALSE;
 		/* Prepare the transport session (again, just one) */
 		rmq_session = janus_transport_session_create(rmq_client, NULL);
@@ -530,16 +587,12 @@ error:
 	return -1;
 }
 
-int janus_rabbitmq_connect(void) {
-	rmq_client->connected = FALSE;
-	/* Connect */
-	rmq_client->rmq_conn = amqp_new_connection();
+static int janus_rabbitmq_open(amqp_connection_state_t conn, amqp_channel_t channel) {
 	amqp_socket_t *socket = NULL;
-	amqp_queue_declare_ok_t *declare = NULL;
 	int status;
 	JANUS_LOG(LOG_VERB, "Creating RabbitMQ socket...\n");
 	if(ssl_enabled) {
-		socket = amqp_ssl_socket_new(rmq_client->rmq_conn);
+		socket = amqp_ssl_socket_new(conn);
 		if(socket == NULL) {
 			JANUS_LOG(LOG_FATAL, "Can't connect to RabbitMQ server: error creating socket...\n");
 			return -1;
@@ -562,7 +615,7 @@ int janus_rabbitmq_connect(void) {
 			}
 		}
 	} else {
-		socket = amqp_tcp_socket_new(rmq_client->rmq_conn);
+		socket = amqp_tcp_socket_new(conn);
 		if(socket == NULL) {
 			JANUS_LOG(LOG_FATAL, "Can't connect to RabbitMQ server: error creating socket...\n");
 			return -1;
@@ -575,19 +628,39 @@ int janus_rabbitmq_connect(void) {
 		return -1;
 	}
 	JANUS_LOG(LOG_VERB, "Logging in...\n");
-	amqp_rpc_reply_t result = amqp_login(rmq_client->rmq_conn, vhost, 0, 131072, heartbeat, AMQP_SASL_METHOD_PLAIN, username, password);
+	amqp_rpc_reply_t result = amqp_login(conn, vhost, 0, 131072, heartbeat, AMQP_SASL_METHOD_PLAIN, username, password);
 	if(result.reply_type != AMQP_RESPONSE_NORMAL) {
 		JANUS_LOG(LOG_FATAL, "Can't connect to RabbitMQ server: error logging in... %s, %s\n", amqp_error_string2(result.library_error), amqp_method_name(result.reply.id));
 		return -1;
 	}
-	rmq_client->rmq_channel = 1;
 	JANUS_LOG(LOG_VERB, "Opening channel...\n");
-	amqp_channel_open(rmq_client->rmq_conn, rmq_client->rmq_channel);
-	result = amqp_get_rpc_reply(rmq_client->rmq_conn);
+	amqp_channel_open(conn, channel);
+	result = amqp_get_rpc_reply(conn);
 	if(result.reply_type != AMQP_RESPONSE_NORMAL) {
 		JANUS_LOG(LOG_FATAL, "Can't connect to RabbitMQ server: error opening channel... %s, %s\n", amqp_error_string2(result.library_error), amqp_method_name(result.reply.id));
 		return -1;
 	}
+	return 0;
+}
+
+int janus_rabbitmq_connect(void) {
+	rmq_client->connected = FALSE;
+	/* Connect */
+	rmq_client->rmq_conn = amqp_new_connection();
+	rmq_client->rmq_channel = 1;
+	if(janus_rabbitmq_open(rmq_client->rmq_conn, rmq_client->rmq_channel) < 0)
+		return -1;
+	amqp_queue_declare_ok_t *declare = NULL;
+	amqp_rpc_reply_t result;
+	if(prefetch > 0) {
+		/* Limit how many unacknowledged messages the broker will push to us */
+		amqp_basic_qos(rmq_client->rmq_conn, rmq_client->rmq_channel, 0, prefetch, 0);
+		result = amqp_get_rpc_reply(rmq_client->rmq_conn);
+		if(result.reply_type != AMQP_RESPONSE_NORMAL) {
+			JANUS_LOG(LOG_FATAL, "Can't connect to RabbitMQ server: error setting prefetch... %s, %s\n", amqp_error_string2(result.library_error), amqp_method_name(result.reply.id));
+			return -1;
+		}
+	}
 	rmq_client->janus_exchange = amqp_empty_bytes;
 	if(janus_exchange != NULL) {
 		JANUS_LOG(LOG_VERB, "Declaring exchange...\n");
@@ -648,7 +721,7 @@ int janus_rabbitmq_connect(void) {
 			}
 		}
 
-		amqp_basic_consume(rmq_client->rmq_conn, rmq_client->rmq_channel, rmq_client->to_janus_queue, amqp_empty_bytes, 0, 1, 0, amqp_empty_table);
+		amqp_basic_consume(rmq_client->rmq_conn, rmq_client->rmq_channel, rmq_client->to_janus_queue, amqp_empty_bytes, 0, prefetch == 0, 0, amqp_empty_table);
 		result = amqp_get_rpc_reply(rmq_client->rmq_conn);
 		if(result.reply_type != AMQP_RESPONSE_NORMAL) {
 			JANUS_LOG(LOG_FATAL, "Can't connect to RabbitMQ server: error consuming... %s, %s\n", amqp_error_string2(result.library_error), amqp_method_name(result.reply.id));
@@ -705,7 +778,7 @@ int janus_rabbitmq_connect(void) {
 			}
 		}
 
-		amqp_basic_consume(rmq_client->rmq_conn, rmq_client->rmq_channel, rmq_client->to_janus_admin_queue, amqp_empty_bytes, 0, 1, 0, amqp_empty_table);
+		amqp_basic_consume(rmq_client->rmq_conn, rmq_client->rmq_channel, rmq_client->to_janus_admin_queue, amqp_empty_bytes, 0, prefetch == 0, 0, amqp_empty_table);
 		result = amqp_get_rpc_reply(rmq_client->rmq_conn);
 		if(result.reply_type != AMQP_RESPONSE_NORMAL) {
 			JANUS_LOG(LOG_FATAL, "Can't connect to RabbitMQ server: error consuming... %s, %s\n", amqp_error_string2(result.library_error), amqp_method_name(result.reply.id));
@@ -720,6 +793,36 @@ int janus_rabbitmq_connect(void) {
 	return 0;
 }
 
+static int janus_rabbitmq_publisher_connect(void) {
+	rmq_client->pub_connected = FALSE;
+	rmq_client->pub_tag = 0;
+	rmq_client->pub_conn = amqp_new_connection();
+	if(janus_rabbitmq_open(rmq_client->pub_conn, 1) < 0)
+		return -1;
+	if(publisher_confirms) {
+		amqp_confirm_select(rmq_client->pub_conn, 1);
+		amqp_rpc_reply_t result = amqp_get_rpc_reply(rmq_client->pub_conn);
+		if(result.reply_type != AMQP_RESPONSE_NORMAL) {
+			JANUS_LOG(LOG_FATAL, "Can't connect to RabbitMQ server: error enabling publisher confirms... %s, %s\n", amqp_error_string2(result.library_error), amqp_method_name(result.reply.id));
+			return -1;
+		}
+	}
+	rmq_client->pub_connected = TRUE;
+	JANUS_LOG(LOG_INFO, "RabbitMQ publisher connected successfully\n");
+	return 0;
+}
+
+static void janus_rabbitmq_response_free(janus_rabbitmq_response *response) {
+	if(response == NULL || response == &exit_message)
+		return;
+	g_free(response->correlation_id);
+	response->correlation_id = NULL;
+	if(response->payload != NULL)
+		free(response->payload);
+	response->payload = NULL;
+	g_free(response);
+}
+
 void janus_rabbitmq_destroy(void) {
 	if(!g_atomic_int_get(&initialized))
 		return;
@@ -735,6 +838,11 @@ void janus_rabbitmq_destroy(void) {
 		if(rmq_client->rmq_conn) {
 			amqp_destroy_connection(rmq_client->rmq_conn);
 		}
+		if(rmq_client->pub_conn) {
+			amqp_destroy_connection(rmq_client->pub_conn);
+		}
+		g_queue_free_full(rmq_client->unconfirmed, (GDestroyNotify)janus_rabbitmq_response_free);
+		g_queue_free_full(rmq_client->pending, (GDestroyNotify)janus_rabbitmq_response_free);
 	}
 	g_free(rmq_client);
 	janus_transport_session_destroy(rmq_session);
@@ -798,6 +906,10 @@ gboolean janus_rabbitmq_is_admin_api_enabled(void) {
 }
 
 int janus_rabbitmq_send_message(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message) {
+	return janus_rabbitmq_send_message_prepared(transport, request_id, admin, message, NULL);
+}
+
+int janus_rabbitmq_send_message_prepared(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message, janus_transport_payload *shared) {
 	if(rmq_client == NULL)
 		return -1;
 	if(message == NULL)
@@ -810,7 +922,7 @@ int janus_rabbitmq_send_message(janus_transport_session *transport, void *reques
 	/* FIXME Add to the queue of outgoing messages */
 	janus_rabbitmq_response *response = g_malloc(sizeof(janus_rabbitmq_response));
 	response->admin = admin;
-	response->payload = json_dumps(message, json_format);
+	response->payload = janus_transport_payload_dumps(shared, message, json_format);
 	json_decref(message);
 	if(response->payload == NULL) {
 		JANUS_LOG(LOG_ERR, "Failed to stringify message...\n");
@@ -818,6 +930,7 @@ int janus_rabbitmq_send_message(janus_transport_session *transport, void *reques
 		return -1;
 	}
 	response->correlation_id = (char *)request_id;
+	response->delivery_tag = 0;
 	g_async_queue_push(rmq_client->messages, response);
 	return 0;
 }
@@ -967,8 +1080,10 @@ void *janus_rmq_in_thread(void *data) {
 			continue;
 		JANUS_LOG(LOG_VERB, "Method %s\n", amqp_method_name(frame.payload.method.id));
 		gboolean admin = FALSE;
+		uint64_t delivery_tag = 0;
 		if(frame.payload.method.id == AMQP_BASIC_DELIVER_METHOD) {
 			amqp_basic_deliver_t *d = (amqp_basic_deliver_t *)frame.payload.method.decoded;
+			delivery_tag = d->delivery_tag;
 			JANUS_LOG(LOG_VERB, "Delivery #%u, %.*s\n", (unsigned) d->delivery_tag, (int) d->routing_key.len, (char *) d->routing_key.bytes);
 			/* Check if this is a Janus or Admin API request */
 			if(rmq_client->admin_api_enabled) {
@@ -1021,11 +1136,88 @@ void *janus_rmq_in_thread(void *data) {
 		/* Notify the core, passing both the object and, since it may be needed, the error
 		 * We also specify the correlation ID as an opaque request identifier: we'll need it later */
 		gateway->incoming_request(&janus_rabbitmq_transport, rmq_session, correlation, admin, root, &error);
+		if(prefetch > 0 && delivery_tag > 0) {
+			/* The core has the request now, acknowledge it so that the broker can send us more */
+			janus_mutex_lock(&rmq_client->mutex);
+			amqp_basic_ack(rmq_client->rmq_conn, rmq_client->rmq_channel, delivery_tag, 0);
+			janus_mutex_unlock(&rmq_client->mutex);
+		}
 	}
 	JANUS_LOG(LOG_INFO, "Leaving RabbitMQ in thread\n");
 	return NULL;
 }
 
+/* Helper to move all the messages still waiting for a confirm back to the
+ * queue of messages to publish again, e.g., when the connection goes away */
+static void janus_rabbitmq_publisher_requeue(void) {
+	janus_rabbitmq_response *response = NULL;
+	while((response = g_queue_pop_tail(rmq_client->unconfirmed)) != NULL) {
+		response->delivery_tag = 0;
+		g_queue_push_head(rmq_client->pending, response);
+	}
+}
+
+/* Helper to handle a basic.ack or basic.nack received on the publishing channel */
+static void janus_rabbitmq_publisher_confirmed(uint64_t delivery_tag, gboolean multiple, gboolean ack) {
+	GList *temp = rmq_client->unconfirmed->head;
+	while(temp) {
+		GList *next = temp->next;
+		janus_rabbitmq_response *response = (janus_rabbitmq_response *)temp->data;
+		if(response->delivery_tag > delivery_tag)
+			break;
+		if(multiple || response->delivery_tag == delivery_tag) {
+			g_queue_delete_link(rmq_client->unconfirmed, temp);
+			if(ack) {
+				janus_rabbitmq_response_free(response);
+			} else {
+				JANUS_LOG(LOG_WARN, "RabbitMQ rejected message #%"SCNu64", publishing it again\n", response->delivery_tag);
+				response->delivery_tag = 0;
+				g_queue_push_tail(rmq_client->pending, response);
+			}
+			if(!multiple)
+				break;
+		}
+		temp = next;
+	}
+}
+
+/* Helper to read whatever the broker sent on the dedicated publishing
+ * connection (confirms, mostly), waiting at most the provided time */
+static int janus_rabbitmq_publisher_poll(struct timeval *timeout) {
+	amqp_frame_t frame;
+	while(rmq_client->pub_connected) {
+		amqp_maybe_release_buffers(rmq_client->pub_conn);
+		int res = amqp_simple_wait_frame_noblock(rmq_client->pub_conn, &frame, timeout);
+		if(res == AMQP_STATUS_TIMEOUT)
+			return 0;
+		if(res != AMQP_STATUS_OK) {
+			JANUS_LOG(LOG_WARN, "Error on RabbitMQ publisher connection: %d (%s)\n", res, amqp_error_string2(res));
+			rmq_client->pub_connected = FALSE;
+			return -1;
+		}
+		if(frame.frame_type != AMQP_FRAME_METHOD)
+			continue;
+		if(frame.payload.method.id == AMQP_BASIC_ACK_METHOD) {
+			amqp_basic_ack_t *a = (amqp_basic_ack_t *)frame.payload.method.decoded;
+			janus_rabbitmq_publisher_confirmed(a->delivery_tag, a->multiple, TRUE);
+		} else if(frame.payload.method.id == AMQP_BASIC_NACK_METHOD) {
+			amqp_basic_nack_t *n = (amqp_basic_nack_t *)frame.payload.method.decoded;
+			janus_rabbitmq_publisher_confirmed(n->delivery_tag, n->multiple, FALSE);
+		} else if(frame.payload.method.id == AMQP_CHANNEL_CLOSE_METHOD ||
+				frame.payload.method.id == AMQP_CONNECTION_CLOSE_METHOD) {
+			JANUS_LOG(LOG_WARN, "RabbitMQ closed the publisher %s (%s)\n",
+				frame.payload.method.id == AMQP_CHANNEL_CLOSE_METHOD ? "channel" : "connection",
+				amqp_method_name(frame.payload.method.id));
+			rmq_client->pub_connected = FALSE;
+			return -1;
+		}
+		/* Only wait for the first frame, anything else is read only if already available */
+		timeout->tv_sec = 0;
+		timeout->tv_usec = 0;
+	}
+	return -1;
+}
+
 void *janus_rmq_out_thread(void *data) {
 	if(rmq_client == NULL) {
 		JANUS_LOG(LOG_ERR, "No RabbitMQ connection??\n");
@@ -1033,9 +1225,26 @@ void *janus_rmq_out_thread(void *data) {
 	}
 	JANUS_LOG(LOG_VERB, "Joining RabbitMQ out thread\n");
 	guint rmq_reconnect_backoff = rmq_reconnect_backoff_initial;
+	struct timeval timeout;
 	while(!rmq_client->destroy && !g_atomic_int_get(&stopping)) {
 
-		if(!rmq_client->connected) {
+		if(dedicated_publisher && !rmq_client->pub_connected) {
+			/* (Re)connect the dedicated publisher */
+			if(rmq_client->pub_conn) {
+				amqp_destroy_connection(rmq_client->pub_conn);
+				rmq_client->pub_conn = NULL;
+			}
+			janus_rabbitmq_publisher_requeue();
+			if(janus_rabbitmq_publisher_connect() < 0) {
+				JANUS_LOG(LOG_WARN, "Failed to connect the RabbitMQ publisher. Retrying in %fs...\n", (gfloat)rmq_reconnect_backoff/1000000);
+				rmq_client->pub_connected = FALSE;
+				g_usleep(rmq_reconnect_backoff);
+				rmq_reconnect_backoff *= rmq_reconnect_backoff_multiplier;
+				if(rmq_reconnect_backoff >= rmq_reconnect_backoff_max)
+					rmq_reconnect_backoff = rmq_reconnect_backoff_max;
+				continue;
+			}
+		} else if(!dedicated_publisher && !rmq_client->connected) {
 			g_usleep(rmq_reconnect_backoff);
 			rmq_reconnect_backoff *= rmq_reconnect_backoff_multiplier;
 			if (rmq_reconnect_backoff >= rmq_reconnect_backoff_max)
@@ -1046,8 +1255,26 @@ void *janus_rmq_out_thread(void *data) {
 
 		rmq_reconnect_backoff = rmq_reconnect_backoff_initial;
 
+		if(dedicated_publisher) {
+			/* Check if there are confirms to read: if too many messages are
+			 * in flight, wait for the broker before publishing anything else */
+			timeout.tv_sec = 0;
+			timeout.tv_usec = g_queue_get_length(rmq_client->unconfirmed) >= confirm_batch ? 20000 : 0;
+			if(janus_rabbitmq_publisher_poll(&timeout) < 0)
+				continue;
+			if(g_queue_get_length(rmq_client->unconfirmed) >= confirm_batch)
+				continue;
+		}
+
 		/* We send messages from here as well, not only notifications */
-		janus_rabbitmq_response *response = g_async_queue_pop(rmq_client->messages);
+		janus_rabbitmq_response *response = g_queue_pop_head(rmq_client->pending);
+		if(response == NULL) {
+			/* With a dedicated publisher we don't block forever, as we need to read from the connection too */
+			response = dedicated_publisher ? g_async_queue_timeout_pop(rmq_client->messages, 20000) :
+				g_async_queue_pop(rmq_client->messages);
+			if(response == NULL)
+				continue;
+		}
 		if(response == &exit_message)
 			break;
 		if(!rmq_client->destroy && !g_atomic_int_get(&stopping) && response->payload) {
@@ -1067,21 +1294,30 @@ void *janus_rmq_out_thread(void *data) {
 			props._flags |= AMQP_BASIC_CONTENT_TYPE_FLAG;
 			props.content_type = amqp_cstring_bytes("application/json");
 			amqp_bytes_t message = amqp_cstring_bytes(payload_text);
-			int status = amqp_basic_publish(rmq_client->rmq_conn, rmq_client->rmq_channel, rmq_client->janus_exchange,
+			int status = amqp_basic_publish(dedicated_publisher ? rmq_client->pub_conn : rmq_client->rmq_conn,
+				dedicated_publisher ? 1 : rmq_client->rmq_channel, rmq_client->janus_exchange,
 				response->admin ? amqp_cstring_bytes(from_janus_admin) : amqp_cstring_bytes(from_janus),
 				0, 0, &props, message);
+			janus_mutex_unlock(&rmq_client->mutex);
 			if(status != AMQP_STATUS_OK) {
 				JANUS_LOG(LOG_ERR, "Error publishing... %d, %s\n", status, amqp_error_string2(status));
+				if(dedicated_publisher)
+					rmq_client->pub_connected = FALSE;
+				if(publisher_confirms) {
+					/* Try again as soon as the publisher is connected again */
+					g_queue_push_head(rmq_client->pending, response);
+					continue;
+				}
+			} else if(publisher_confirms) {
+				/* Keep the message around until the broker confirms it */
+				rmq_client->pub_tag++;
+				response->delivery_tag = rmq_client->pub_tag;
+				g_queue_push_tail(rmq_client->unconfirmed, response);
+				continue;
 			}
-			janus_mutex_unlock(&rmq_client->mutex);
 		}
 		/* Free the message */
-		g_free(response->correlation_id);
-		response->correlation_id = NULL;
-		if(response->payload != NULL)
-			free(response->payload);
-		response->payload = NULL;
-		g_free(response);
+		janus_rabbitmq_response_free(response);
 		response = NULL;
 	}
 	g_async_queue_unref(rmq_client->messages);
@@ -21,6 +21,19 @@
  * the events related to it is done automatically, so no need for an
  * explicit request as the GET in the plain HTTP API. Closing a WebSocket
  * will also destroy all the sessions it created.
+ * \note Clients connecting with the \c janus-protocol-batch sub-protocol,
+ * rather than \c janus-protocol, opt in to event batching: messages
+ * Janus sends them within a few milliseconds of each other (see the
+ * \c batch_window_ms setting) are coalesced and sent as a JSON array in
+ * a single frame, rather than as separate frames. Requests can be sent
+ * the same way as with the plain protocol. Compression (permessage-deflate)
+ * can be negotiated on any connection, if enabled in the configuration.
+ * \note To protect Janus from clients that can't keep up with the
+ * messages sent to them, a limit can be set on the number of messages
+ * queued for a single connection (\c max_queued). Once the limit is
+ * reached, depending on the \c queue_policy setting either new events
+ * that are not critical (see \c droppable_events) are dropped, or the
+ * connection is closed. Responses and events with a JSEP are never dropped.
  *
  * \ingroup transports
  * \ref transports
@@ -63,6 +76,7 @@ const char *janus_websockets_get_package(void);
 gboolean janus_websockets_is_janus_api_enabled(void);
 gboolean janus_websockets_is_admin_api_enabled(void);
 int janus_websockets_send_message(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message);
+int janus_websockets_send_message_prepared(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message, janus_transport_payload *shared);
 void janus_websockets_session_created(janus_transport_session *transport, guint64 session_id);
 void janus_websockets_session_over(janus_transport_session *transport, guint64 session_id, gboolean timeout, gboolean claimed);
 void janus_websockets_session_claimed(janus_transport_session *transport, guint64 session_id);
@@ -93,6 +107,7 @@ static janus_transport janus_websockets_transport =
 		.session_claimed = janus_websockets_session_claimed,
 
 		.query_transport = janus_websockets_query_transport,
+		.send_message_prepared = janus_websockets_send_message_prepared,
 	);
 
 /* Transport creator */
@@ -111,13 +126,38 @@ static gboolean notify_events = TRUE;
 
 /* Clients maps */
 #if (LWS_LIBRARY_VERSION_MAJOR >= 3)
-static GHashTable *clients = NULL, *writable_clients = NULL;
+static GHashTable *clients = NULL;
 #endif
 static janus_mutex writable_mutex;
 
 /* JSON serialization options */
 static size_t json_format = JSON_INDENT(3) | JSON_PRESERVE_ORDER;
 
+/* Compression (permessage-deflate), if enabled */
+static gboolean ws_deflate = FALSE;
+static int ws_deflate_level = 6, ws_deflate_mem_level = 8;
+/* Whether other processes can bind to the same ports (e.g., a new Janus taking over) */
+static gboolean ws_reuse_port = FALSE;
+#ifndef LWS_WITHOUT_EXTENSIONS
+static const struct lws_extension ws_extensions[] = {
+	{ "permessage-deflate", lws_extension_callback_pm_deflate, "permessage-deflate; client_no_context_takeover; client_max_window_bits" },
+	{ NULL, NULL, NULL }
+};
+#endif
+
+/* Event batching, for clients that asked for it */
+#if (LWS_LIBRARY_VERSION_MAJOR == 3 && LWS_LIBRARY_VERSION_MINOR >= 2) || (LWS_LIBRARY_VERSION_MAJOR >= 4)
+#define JANUS_WEBSOCKETS_BATCH_TIMER
+#endif
+static int ws_batch_window = 5;
+/* Maximum number of messages to coalesce in a single frame */
+#define JANUS_WEBSOCKETS_BATCH_MAX	64
+
+/* Limits on the messages queued for a single client */
+static int ws_max_queued = 0;
+static gboolean ws_queue_disconnect = FALSE;
+static char **ws_droppable_events = NULL;
+
 /* Parameter validation (for tweaking and queries via Admin API) */
 static struct janus_json_parameter request_parameters[] = {
 	{"request", JSON_STRING, JANUS_JSON_PARAM_REQUIRED}
@@ -173,8 +213,25 @@ static void janus_websockets_log_emit_function(int level, const char *line) {
 	JANUS_LOG(LOG_INFO, "[libwebsockets][%s] %s", janus_websockets_get_level_str(level), line);
 }
 
-/* WebSockets service thread */
-static GThread *ws_thread = NULL;
+/* WebSockets service threads: libwebsockets spreads new connections
+ * across them, and each thread then only serves its own connections */
+typedef struct janus_websockets_service {
+	int tsi;								/* libwebsockets service thread index */
+	GThread *thread;						/* Thread serving this index */
+#if (LWS_LIBRARY_VERSION_MAJOR >= 3)
+	GHashTable *writable_clients;			/* Clients served by this thread that have messages to send */
+#endif
+	volatile gint connections;				/* Number of connections served by this thread */
+	volatile gint queued;					/* Number of outgoing messages waiting to be sent */
+	volatile gint sent;						/* Number of outgoing messages sent so far */
+	volatile gint wakeups;					/* How many times this thread was woken up to send messages */
+	volatile gint dropped;					/* Number of outgoing messages dropped because a client queue was full */
+	volatile gint overflows;				/* Number of clients disconnected because their queue was full */
+} janus_websockets_service;
+static janus_websockets_service *ws_services = NULL;
+static int ws_threads = 1;
+/* Service instance of the current thread, to find out who's serving new connections */
+static GPrivate ws_service_current = G_PRIVATE_INIT(NULL);
 void *janus_websockets_thread(void *data);
 
 
@@ -189,6 +246,11 @@ typedef struct janus_websockets_client {
 	size_t bufoffset;							/* Offset from where the interrupted previous write should resume */
 	volatile gint destroyed;				/* Whether this libwebsockets client instance has been closed */
 	janus_transport_session *ts;			/* Janus core-transport session */
+	janus_websockets_service *service;		/* Service thread this client is served by */
+	gboolean batch;							/* Whether this client asked for events to be batched */
+	gint64 batch_first;						/* When the oldest message waiting to be batched was queued */
+	volatile gint dropped;					/* Number of outgoing messages dropped because the queue was full */
+	volatile gint overflow;					/* Whether the queue was full and the client must be disconnected */
 } janus_websockets_client;
 
 
@@ -224,11 +286,13 @@ static int janus_websockets_admin_callback_secure(
 static struct lws_protocols ws_protocols[] = {
 	{ "http-only", janus_websockets_callback_http, 0, 0, WS_LIST_TERM },
 	{ "janus-protocol", janus_websockets_callback, sizeof(janus_websockets_client), 0, WS_LIST_TERM },
+	{ "janus-protocol-batch", janus_websockets_callback, sizeof(janus_websockets_client), 0, WS_LIST_TERM },
 	{ NULL, NULL, 0, 0, WS_LIST_TERM }
 };
 static struct lws_protocols sws_protocols[] = {
 	{ "http-only", janus_websockets_callback_https, 0, 0, WS_LIST_TERM },
 	{ "janus-protocol", janus_websockets_callback_secure, sizeof(janus_websockets_client), 0, WS_LIST_TERM },
+	{ "janus-protocol-batch", janus_websockets_callback_secure, sizeof(janus_websockets_client), 0, WS_LIST_TERM },
 	{ NULL, NULL, 0, 0, WS_LIST_TERM }
 };
 static struct lws_protocols admin_ws_protocols[] = {
@@ -470,6 +534,10 @@ static struct lws_vhost* janus_websockets_create_ws_server(
 #endif
 	info.protocols = ws_protocols;
 	info.extensions = NULL;
+#ifndef LWS_WITHOUT_EXTENSIONS
+	if(ws_deflate)
+		info.extensions = ws_extensions;
+#endif
 	info.ssl_cert_filepath = server_pem;
 	info.ssl_private_key_filepath = server_key;
 	info.ssl_private_key_password = password;
@@ -497,6 +565,10 @@ static struct lws_vhost* janus_websockets_create_ws_server(
 #if (LWS_LIBRARY_VERSION_MAJOR == 3 && LWS_LIBRARY_VERSION_MINOR >= 2) || (LWS_LIBRARY_VERSION_MAJOR > 3)
 	info.options |= LWS_SERVER_OPTION_FAIL_UPON_UNABLE_TO_BIND;
 
+#endif
+#ifdef LWS_SERVER_OPTION_ALLOW_LISTEN_SHARE
+	if(ws_reuse_port)
+		info.options |= LWS_SERVER_OPTION_ALLOW_LISTEN_SHARE;
 #endif
 	/* Create the WebSocket context */
 	struct lws_vhost *vhost = lws_create_vhost(wsc, &info);
@@ -737,8 +809,112 @@ int janus_websockets_init(janus_transport_callbacks *callback, const char *confi
 		}
 #endif
 #endif
-		/* Force single-thread server */
-		wscinfo.count_threads = 1;
+		/* Should we negotiate compression? */
+		item = janus_config_get(config, config_general, janus_config_type_item, "deflate");
+		if(item && item->value && janus_is_true(item->value)) {
+#ifndef LWS_WITHOUT_EXTENSIONS
+			ws_deflate = TRUE;
+			item = janus_config_get(config, config_general, janus_config_type_item, "deflate_level");
+			if(item && item->value) {
+				int level = atoi(item->value);
+				if(level < 1 || level > 9) {
+					JANUS_LOG(LOG_WARN, "Invalid value for deflate_level (%s), using %d...\n", item->value, ws_deflate_level);
+				} else {
+					ws_deflate_level = level;
+				}
+			}
+			item = janus_config_get(config, config_general, janus_config_type_item, "deflate_mem_level");
+			if(item && item->value) {
+				int level = atoi(item->value);
+				if(level < 1 || level > 9) {
+					JANUS_LOG(LOG_WARN, "Invalid value for deflate_mem_level (%s), using %d...\n", item->value, ws_deflate_mem_level);
+				} else {
+					ws_deflate_mem_level = level;
+				}
+			}
+			JANUS_LOG(LOG_INFO, "WebSockets compression enabled (level %d, memory level %d)\n",
+				ws_deflate_level, ws_deflate_mem_level);
+#else
+			JANUS_LOG(LOG_WARN, "libwebsockets has been built without extensions, compression disabled\n");
+#endif
+		}
+		/* Should we share the ports with other processes? */
+		item = janus_config_get(config, config_general, janus_config_type_item, "reuse_port");
+		if(item && item->value && janus_is_true(item->value)) {
+#ifdef LWS_SERVER_OPTION_ALLOW_LISTEN_SHARE
+			ws_reuse_port = TRUE;
+			JANUS_LOG(LOG_INFO, "Sharing the WebSockets ports with other processes (SO_REUSEPORT)\n");
+#else
+			JANUS_LOG(LOG_WARN, "libwebsockets is too old to share ports, ignoring reuse_port\n");
+#endif
+		}
+		/* For clients asking for event batching, how long to wait for more events */
+		item = janus_config_get(config, config_general, janus_config_type_item, "batch_window_ms");
+		if(item && item->value) {
+			int window = atoi(item->value);
+			if(window < 0 || window > 1000) {
+				JANUS_LOG(LOG_WARN, "Invalid value for batch_window_ms (%s), using %d...\n", item->value, ws_batch_window);
+			} else {
+				ws_batch_window = window;
+			}
+		}
+#ifndef JANUS_WEBSOCKETS_BATCH_TIMER
+		if(ws_batch_window > 0) {
+			JANUS_LOG(LOG_WARN, "Event batching window only supported in libwebsockets >= 3.2, only coalescing queued events\n");
+			ws_batch_window = 0;
+		}
+#endif
+
+		/* Limits on the messages queued for a single client, if any */
+		item = janus_config_get(config, config_general, janus_config_type_item, "max_queued");
+		if(item && item->value) {
+			ws_max_queued = atoi(item->value);
+			if(ws_max_queued < 0) {
+				JANUS_LOG(LOG_WARN, "Invalid value for max_queued (%s), disabling limit...\n", item->value);
+				ws_max_queued = 0;
+			}
+		}
+		item = janus_config_get(config, config_general, janus_config_type_item, "queue_policy");
+		if(item && item->value) {
+			if(!strcasecmp(item->value, "disconnect")) {
+				ws_queue_disconnect = TRUE;
+			} else if(strcasecmp(item->value, "drop")) {
+				JANUS_LOG(LOG_WARN, "Unsupported queue_policy '%s', using 'drop'...\n", item->value);
+			}
+		}
+		item = janus_config_get(config, config_general, janus_config_type_item, "droppable_events");
+		ws_droppable_events = g_strsplit(item && item->value ? item->value : JANUS_TRANSPORT_DROPPABLE_EVENTS, ",", -1);
+		int e = 0;
+		for(e=0; ws_droppable_events[e] != NULL; e++)
+			g_strstrip(ws_droppable_events[e]);
+		if(ws_max_queued > 0) {
+			JANUS_LOG(LOG_INFO, "WebSockets clients can have up to %d queued messages (%s when full)\n",
+				ws_max_queued, ws_queue_disconnect ? "disconnect" : "drop events");
+		}
+
+		/* How many service threads should we use? */
+		item = janus_config_get(config, config_general, janus_config_type_item, "service_threads");
+		if(item && item->value) {
+			ws_threads = !strcasecmp(item->value, "auto") ? (int)g_get_num_processors() : atoi(item->value);
+			if(ws_threads < 1) {
+				JANUS_LOG(LOG_WARN, "Invalid value for service_threads (%s), using a single thread...\n", item->value);
+				ws_threads = 1;
+			}
+#if (LWS_LIBRARY_VERSION_MAJOR < 3)
+			if(ws_threads > 1) {
+				JANUS_LOG(LOG_WARN, "Multiple WebSockets service threads only supported in libwebsockets >= 3.0\n");
+				ws_threads = 1;
+			}
+#elif defined(LWS_MAX_SMP)
+			if(ws_threads > LWS_MAX_SMP) {
+				JANUS_LOG(LOG_WARN, "libwebsockets was built with support for at most %d service threads, using %d\n",
+					LWS_MAX_SMP, LWS_MAX_SMP);
+				ws_threads = LWS_MAX_SMP;
+			}
+#endif
+		}
+		wscinfo.count_threads = ws_threads;
+		JANUS_LOG(LOG_INFO, "Using %d WebSockets service thread(s)\n", ws_threads);
 
 		/* Create the base context */
 		wsc = lws_create_context(&wscinfo);
@@ -771,22 +947,36 @@ int janus_websockets_init(janus_transport_callbacks *callback, const char *confi
 
 #if (LWS_LIBRARY_VERSION_MAJOR >= 3)
 	clients = g_hash_table_new(NULL, NULL);
-	writable_clients = g_hash_table_new(NULL, NULL);
 #endif
 	janus_mutex_init(&writable_mutex);
+	ws_services = g_malloc0(ws_threads * sizeof(janus_websockets_service));
+	int i = 0;
+	for(i=0; i<ws_threads; i++) {
+		ws_services[i].tsi = i;
+#if (LWS_LIBRARY_VERSION_MAJOR >= 3)
+		ws_services[i].writable_clients = g_hash_table_new(NULL, NULL);
+#endif
+	}
 
 	g_atomic_int_set(&initialized, 1);
 
 	GError *error = NULL;
-	/* Start the WebSocket service thread */
+	/* Start the WebSocket service thread(s) */
 	if(ws_janus_api_enabled || ws_admin_api_enabled) {
-		ws_thread = g_thread_try_new("ws thread", &janus_websockets_thread, wsc, &error);
-		if(error != NULL) {
-			g_atomic_int_set(&initialized, 0);
-			JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the WebSockets thread...\n",
-				error->code, error->message ? error->message : "??");
-			g_error_free(error);
-			return -1;
+		for(i=0; i<ws_threads; i++) {
+			char tname[16];
+			if(ws_threads == 1)
+				g_snprintf(tname, sizeof(tname), "ws thread");
+			else
+				g_snprintf(tname, sizeof(tname), "ws thread %d", i);
+			ws_services[i].thread = g_thread_try_new(tname, &janus_websockets_thread, &ws_services[i], &error);
+			if(error != NULL) {
+				g_atomic_int_set(&initialized, 0);
+				JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the WebSockets thread...\n",
+					error->code, error->message ? error->message : "??");
+				g_error_free(error);
+				return -1;
+			}
 		}
 	}
 
@@ -803,10 +993,13 @@ void janus_websockets_destroy(void) {
 	lws_cancel_service(wsc);
 #endif
 
-	/* Stop the service thread */
-	if(ws_thread != NULL) {
-		g_thread_join(ws_thread);
-		ws_thread = NULL;
+	/* Stop the service threads */
+	int i = 0;
+	for(i=0; i<ws_threads; i++) {
+		if(ws_services[i].thread != NULL) {
+			g_thread_join(ws_services[i].thread);
+			ws_services[i].thread = NULL;
+		}
 	}
 
 	/* Destroy the context */
@@ -819,10 +1012,17 @@ void janus_websockets_destroy(void) {
 	janus_mutex_lock(&writable_mutex);
 	g_hash_table_destroy(clients);
 	clients = NULL;
-	g_hash_table_destroy(writable_clients);
-	writable_clients = NULL;
+	for(i=0; i<ws_threads; i++) {
+		g_hash_table_destroy(ws_services[i].writable_clients);
+		ws_services[i].writable_clients = NULL;
+	}
 	janus_mutex_unlock(&writable_mutex);
 #endif
+	g_free(ws_services);
+	g_strfreev(ws_droppable_events);
+	ws_droppable_events = NULL;
+	ws_services = NULL;
+	ws_threads = 1;
 
 	g_atomic_int_set(&initialized, 0);
 	g_atomic_int_set(&stopping, 0);
@@ -845,9 +1045,10 @@ static void janus_websockets_destroy_client(
 #if (LWS_LIBRARY_VERSION_MAJOR >= 3)
 	janus_mutex_lock(&writable_mutex);
 	g_hash_table_remove(clients, ws_client);
-	g_hash_table_remove(writable_clients, ws_client);
+	g_hash_table_remove(ws_client->service->writable_clients, ws_client);
 	janus_mutex_unlock(&writable_mutex);
 #endif
+	g_atomic_int_add(&ws_client->service->connections, -1);
 	ws_client->wsi = NULL;
 	/* Notify handlers about this transport being gone */
 	if(notify_events && gateway->events_is_enabled()) {
@@ -860,6 +1061,7 @@ static void janus_websockets_destroy_client(
 	if(ws_client->messages != NULL) {
 		char *response = NULL;
 		while((response = g_async_queue_try_pop(ws_client->messages)) != NULL) {
+			g_atomic_int_add(&ws_client->service->queued, -1);
 			g_free(response);
 		}
 		g_async_queue_unref(ws_client->messages);
@@ -916,6 +1118,10 @@ gboolean janus_websockets_is_admin_api_enabled(void) {
 }
 
 int janus_websockets_send_message(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message) {
+	return janus_websockets_send_message_prepared(transport, request_id, admin, message, NULL);
+}
+
+int janus_websockets_send_message_prepared(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message, janus_transport_payload *shared) {
 	if(message == NULL)
 		return -1;
 	if(transport == NULL || g_atomic_int_get(&transport->destroyed)) {
@@ -929,8 +1135,44 @@ int janus_websockets_send_message(janus_transport_session *transport, void *requ
 		janus_mutex_unlock(&transport->mutex);
 		return -1;
 	}
+	/* Check if the client is keeping up with the messages we send */
+	if(ws_max_queued > 0 && g_async_queue_length(client->messages) >= ws_max_queued) {
+		if(ws_queue_disconnect) {
+			if(g_atomic_int_compare_and_exchange(&client->overflow, 0, 1)) {
+				JANUS_LOG(LOG_WARN, "[%p] Too many queued messages (%d), closing the connection\n", client->wsi, ws_max_queued);
+				g_atomic_int_inc(&client->service->overflows);
+				/* Wake up the service thread, so that it closes the connection */
+#if (LWS_LIBRARY_VERSION_MAJOR >= 3)
+				janus_mutex_lock(&writable_mutex);
+				if(g_hash_table_lookup(clients, client) == client)
+					g_hash_table_insert(client->service->writable_clients, client, client);
+				janus_mutex_unlock(&writable_mutex);
+				if(ws_threads > 1)
+					lws_cancel_service_pt(client->wsi);
+				else
+					lws_cancel_service(wsc);
+#else
+				janus_mutex_lock(&writable_mutex);
+				lws_callback_on_writable(client->wsi);
+				janus_mutex_unlock(&writable_mutex);
+#endif
+			}
+			json_decref(message);
+			janus_mutex_unlock(&transport->mutex);
+			return -1;
+		}
+		if(janus_transport_message_is_droppable(message, shared, ws_droppable_events)) {
+			/* Not a critical event, drop it */
+			if(g_atomic_int_add(&client->dropped, 1) == 0)
+				JANUS_LOG(LOG_WARN, "[%p] Too many queued messages (%d), dropping events\n", client->wsi, ws_max_queued);
+			g_atomic_int_inc(&client->service->dropped);
+			json_decref(message);
+			janus_mutex_unlock(&transport->mutex);
+			return 0;
+		}
+	}
 	/* Convert to string and enqueue */
-	char *payload = json_dumps(message, json_format);
+	char *payload = janus_transport_payload_dumps(shared, message, json_format);
 	if(payload == NULL) {
 		JANUS_LOG(LOG_ERR, "Failed to stringify message...\n");
 		json_decref(message);
@@ -938,13 +1180,20 @@ int janus_websockets_send_message(janus_transport_session *transport, void *requ
 		return -1;
 	}
 	g_async_queue_push(client->messages, payload);
+	g_atomic_int_inc(&client->service->queued);
+	if(client->batch && client->batch_first == 0)
+		client->batch_first = janus_get_monotonic_time();
 #if (LWS_LIBRARY_VERSION_MAJOR >= 3)
 	/* On libwebsockets >= 3.x we use lws_cancel_service */
 	janus_mutex_lock(&writable_mutex);
 	if(g_hash_table_lookup(clients, client) == client)
-		g_hash_table_insert(writable_clients, client, client);
+		g_hash_table_insert(client->service->writable_clients, client, client);
 	janus_mutex_unlock(&writable_mutex);
-	lws_cancel_service(wsc);
+	/* Only wake up the thread serving this client, if there's more than one */
+	if(ws_threads > 1)
+		lws_cancel_service_pt(client->wsi);
+	else
+		lws_cancel_service(wsc);
 #else
 	/* On libwebsockets < 3.x we use lws_callback_on_writable */
 	janus_mutex_lock(&writable_mutex);
@@ -1083,8 +1332,38 @@ json_t *janus_websockets_query_transport(json_t *request) {
 #if (LWS_LIBRARY_VERSION_MAJOR >= 3)
 		janus_mutex_lock(&writable_mutex);
 		guint connections = g_hash_table_size(clients);
+		json_t *threads = json_array();
+		int i = 0;
+		for(i=0; i<ws_threads; i++) {
+			janus_websockets_service *service = &ws_services[i];
+			json_t *t = json_object();
+			json_object_set_new(t, "thread", json_integer(service->tsi));
+			json_object_set_new(t, "connections", json_integer(g_atomic_int_get(&service->connections)));
+			json_object_set_new(t, "queued", json_integer(g_atomic_int_get(&service->queued)));
+			json_object_set_new(t, "sent", json_integer(g_atomic_int_get(&service->sent)));
+			json_object_set_new(t, "writable", json_integer(g_hash_table_size(service->writable_clients)));
+			json_object_set_new(t, "wakeups", json_integer(g_atomic_int_get(&service->wakeups)));
+			json_object_set_new(t, "dropped", json_integer(g_atomic_int_get(&service->dropped)));
+			json_object_set_new(t, "overflows", json_integer(g_atomic_int_get(&service->overflows)));
+			json_array_append_new(threads, t);
+		}
+		/* Check which client has the longest queue of outgoing messages */
+		gint largest = 0;
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, clients);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) {
+			janus_websockets_client *client = (janus_websockets_client *)value;
+			gint qlen = client->messages ? g_async_queue_length(client->messages) : 0;
+			if(qlen > largest)
+				largest = qlen;
+		}
 		janus_mutex_unlock(&writable_mutex);
 		json_object_set_new(response, "connections", json_integer(connections));
+		json_object_set_new(response, "largest_queue", json_integer(largest));
+		if(ws_max_queued > 0)
+			json_object_set_new(response, "max_queued", json_integer(ws_max_queued));
+		json_object_set_new(response, "threads", threads);
 #endif
 	} else {
 		JANUS_LOG(LOG_VERB, "Unknown request '%s'\n", request_text);
@@ -1106,23 +1385,24 @@ plugin_response:
 
 /* Thread */
 void *janus_websockets_thread(void *data) {
-	struct lws_context *service = (struct lws_context *)data;
-	if(service == NULL) {
+	janus_websockets_service *service = (janus_websockets_service *)data;
+	if(service == NULL || wsc == NULL) {
 		JANUS_LOG(LOG_ERR, "Invalid service\n");
 		return NULL;
 	}
+	g_private_set(&ws_service_current, service);
 
-	JANUS_LOG(LOG_INFO, "WebSockets thread started\n");
+	JANUS_LOG(LOG_INFO, "WebSockets thread #%d started\n", service->tsi);
 
 	while(g_atomic_int_get(&initialized) && !g_atomic_int_get(&stopping)) {
-		/* libwebsockets is single thread, we cycle through events here */
-		lws_service(service, 50);
+		/* Each thread cycles through the events of its own connections here */
+		lws_service_tsi(wsc, 50, service->tsi);
 	}
 
 	/* Get rid of the WebSockets server */
-	lws_cancel_service(service);
+	lws_cancel_service(wsc);
 	/* Done */
-	JANUS_LOG(LOG_INFO, "WebSockets thread ended\n");
+	JANUS_LOG(LOG_INFO, "WebSockets thread #%d ended\n", service->tsi);
 	return NULL;
 }
 
@@ -1217,6 +1497,24 @@ static int janus_websockets_common_callback(
 			ws_client->bufpending = 0;
 			ws_client->bufoffset = 0;
 			g_atomic_int_set(&ws_client->destroyed, 0);
+			/* This callback is invoked by the thread that will serve this connection */
+			ws_client->service = g_private_get(&ws_service_current);
+			if(ws_client->service == NULL)
+				ws_client->service = &ws_services[0];
+			g_atomic_int_inc(&ws_client->service->connections);
+			const struct lws_protocols *protocol = lws_get_protocol(wsi);
+			ws_client->batch = (!admin && protocol && protocol->name && !strcmp(protocol->name, "janus-protocol-batch"));
+			ws_client->batch_first = 0;
+#ifndef LWS_WITHOUT_EXTENSIONS
+			if(ws_deflate) {
+				/* Tweak the compression, in case it's negotiated */
+				char value[4];
+				g_snprintf(value, sizeof(value), "%d", ws_deflate_level);
+				lws_set_extension_option(wsi, "permessage-deflate", "compression_level", value);
+				g_snprintf(value, sizeof(value), "%d", ws_deflate_mem_level);
+				lws_set_extension_option(wsi, "permessage-deflate", "mem_level", value);
+			}
+#endif
 			ws_client->ts = janus_transport_session_create(ws_client, NULL);
 #if (LWS_LIBRARY_VERSION_MAJOR >= 3)
 			janus_mutex_lock(&writable_mutex);
@@ -1390,18 +1688,27 @@ static int janus_websockets_common_callback(
 #if (LWS_LIBRARY_VERSION_MAJOR >= 3)
 		/* On libwebsockets >= 3.x, we use this event to mark connections as writable in the event loop */
 		case LWS_CALLBACK_EVENT_WAIT_CANCELLED: {
+			/* Each service thread only takes care of its own clients */
+			janus_websockets_service *service = g_private_get(&ws_service_current);
+			if(service == NULL)
+				return 0;
 			janus_mutex_lock(&writable_mutex);
+			if(service->writable_clients == NULL || g_hash_table_size(service->writable_clients) == 0) {
+				janus_mutex_unlock(&writable_mutex);
+				return 0;
+			}
+			g_atomic_int_inc(&service->wakeups);
 			/* We iterate on all the clients we marked as writable and act on them */
 			GHashTableIter iter;
 			gpointer value;
-			g_hash_table_iter_init(&iter, writable_clients);
+			g_hash_table_iter_init(&iter, service->writable_clients);
 			while(g_hash_table_iter_next(&iter, NULL, &value)) {
 				janus_websockets_client *client = value;
 				if(client == NULL || client->wsi == NULL)
 					continue;
 				lws_callback_on_writable(client->wsi);
 			}
-			g_hash_table_remove_all(writable_clients);
+			g_hash_table_remove_all(service->writable_clients);
 			janus_mutex_unlock(&writable_mutex);
 			return 0;
 		}
@@ -1412,6 +1719,12 @@ static int janus_websockets_common_callback(
 				return -1;
 			}
 			if(!g_atomic_int_get(&ws_client->destroyed) && !g_atomic_int_get(&stopping)) {
+				if(g_atomic_int_get(&ws_client->overflow)) {
+					/* This client couldn't keep up, close the connection */
+					JANUS_LOG(LOG_WARN, "[%s-%p] Closing WebSocket connection, too many queued messages\n", log_prefix, wsi);
+					lws_close_reason(wsi, LWS_CLOSE_STATUS_POLICY_VIOLATION, (unsigned char *)"Too many queued messages", 24);
+					return -1;
+				}
 				janus_mutex_lock(&ws_client->ts->mutex);
 
 				/* Check if Websockets send pipe is choked */
@@ -1435,6 +1748,18 @@ static int janus_websockets_common_callback(
 					JANUS_LOG(LOG_HUGE, "[%s-%p] Completing pending WebSocket write (still need to write last %zu bytes)...\n",
 						log_prefix, wsi, ws_client->bufpending);
 				} else {
+#ifdef JANUS_WEBSOCKETS_BATCH_TIMER
+					if(ws_client->batch && ws_client->batch_first > 0 && ws_batch_window > 0 &&
+							g_async_queue_length(ws_client->messages) < JANUS_WEBSOCKETS_BATCH_MAX) {
+						/* Wait a bit more for other events to batch, if needed */
+						gint64 wait = ws_client->batch_first + ws_batch_window*1000 - janus_get_monotonic_time();
+						if(wait > 0) {
+							lws_set_timer_usecs(wsi, wait);
+							janus_mutex_unlock(&ws_client->ts->mutex);
+							return 0;
+						}
+					}
+#endif
 					/* Shoot all the pending messages */
 					char *response = g_async_queue_try_pop(ws_client->messages);
 					if (!response) {
@@ -1442,11 +1767,34 @@ static int janus_websockets_common_callback(
 						janus_mutex_unlock(&ws_client->ts->mutex);
 						return 0;
 					}
+					g_atomic_int_add(&ws_client->service->queued, -1);
+					g_atomic_int_inc(&ws_client->service->sent);
 					if (g_atomic_int_get(&ws_client->destroyed) || g_atomic_int_get(&stopping)) {
 						free(response);
 						janus_mutex_unlock(&ws_client->ts->mutex);
 						return 0;
 					}
+					if(ws_client->batch) {
+						/* Coalesce all the messages we have in a single JSON array */
+						GString *batch = g_string_new("[");
+						g_string_append(batch, response);
+						free(response);
+						int count = 1;
+						while(count < JANUS_WEBSOCKETS_BATCH_MAX &&
+								(response = g_async_queue_try_pop(ws_client->messages)) != NULL) {
+							g_atomic_int_add(&ws_client->service->queued, -1);
+							g_atomic_int_inc(&ws_client->service->sent);
+							g_string_append_c(batch, ',');
+							g_string_append(batch, response);
+							free(response);
+							count++;
+						}
+						g_string_append_c(batch, ']');
+						/* Whatever's left will be sent right away in the next round */
+						ws_client->batch_first = 0;
+						response = g_string_free(batch, FALSE);
+						JANUS_LOG(LOG_HUGE, "[%s-%p] Batched %d messages in a single frame\n", log_prefix, wsi, count);
+					}
 					/* Gotcha! */
 					JANUS_LOG(LOG_HUGE, "[%s-%p] Sending WebSocket message (%zu bytes)...\n", log_prefix, wsi, strlen(response));
 					size_t buflen = LWS_PRE + strlen(response);
@@ -1461,7 +1809,10 @@ static int janus_websockets_common_callback(
 					ws_client->bufpending = strlen(response);
 					ws_client->bufoffset = LWS_PRE;
 					/* We can get rid of the message */
-					free(response);
+					if(ws_client->batch)
+						g_free(response);
+					else
+						free(response);
 				}
 
 				if (g_atomic_int_get(&ws_client->destroyed) || g_atomic_int_get(&stopping)) {
@@ -1498,6 +1849,14 @@ static int janus_websockets_common_callback(
 			}
 			return 0;
 		}
+#ifdef JANUS_WEBSOCKETS_BATCH_TIMER
+		case LWS_CALLBACK_TIMER: {
+			/* The batching window for this client expired, send what we have */
+			if(ws_client != NULL && ws_client->wsi != NULL && !g_atomic_int_get(&ws_client->destroyed))
+				lws_callback_on_writable(wsi);
+			return 0;
+		}
+#endif
 		case LWS_CALLBACK_CLOSED: {
 			JANUS_LOG(LOG_VERB, "[%s-%p] WS connection down, closing\n", log_prefix, wsi);
 			janus_websockets_destroy_client(ws_client, wsi, log_prefix);
@@ -37,3 +37,107 @@ void janus_transport_session_destroy(janus_transport_session *session) {
 	if(session && g_atomic_int_compare_and_exchange(&session->destroyed, 0, 1))
 		janus_refcount_decrease(&session->ref);
 }
+
+
+static void janus_transport_payload_free(const janus_refcount *payload_ref) {
+	janus_transport_payload *payload = janus_refcount_containerof(payload_ref, janus_transport_payload, ref);
+	/* This payload can be destroyed, free all the resources */
+	g_free(payload->name);
+	json_decref(payload->object);
+	g_hash_table_destroy(payload->cache);
+	g_free(payload);
+}
+
+janus_transport_payload *janus_transport_payload_create(const char *name, json_t *object) {
+	if(name == NULL || object == NULL)
+		return NULL;
+	janus_transport_payload *payload = g_malloc0(sizeof(janus_transport_payload));
+	payload->name = g_strdup(name);
+	payload->object = json_incref(object);
+	/* Serialized strings come from Jansson, so they must be freed with free() */
+	payload->cache = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)free);
+	janus_mutex_init(&payload->mutex);
+	janus_refcount_init(&payload->ref, janus_transport_payload_free);
+	return payload;
+}
+
+char *janus_transport_payload_dumps(janus_transport_payload *payload, json_t *message, size_t flags) {
+	if(message == NULL)
+		return NULL;
+	if(payload == NULL)
+		return json_dumps(message, flags);
+	if(!json_is_object(message))
+		return NULL;
+	if((flags & JSON_MAX_INDENT) || (flags & JSON_SORT_KEYS)) {
+		/* We can't splice the shared object in this case, serialize everything */
+		json_t *copy = json_copy(message);
+		json_object_set(copy, payload->name, payload->object);
+		char *text = json_dumps(copy, flags);
+		json_decref(copy);
+		return text;
+	}
+	/* Serialize the shared object, unless we did already with the same flags */
+	janus_mutex_lock(&payload->mutex);
+	char *shared = g_hash_table_lookup(payload->cache, GSIZE_TO_POINTER(flags));
+	if(shared == NULL) {
+		shared = json_dumps(payload->object, flags);
+		if(shared != NULL)
+			g_hash_table_insert(payload->cache, GSIZE_TO_POINTER(flags), shared);
+	}
+	janus_mutex_unlock(&payload->mutex);
+	if(shared == NULL)
+		return NULL;
+	/* Serialize the rest of the message, and add the shared object as its last property */
+	char *text = json_dumps(message, flags);
+	if(text == NULL)
+		return NULL;
+	size_t tlen = strlen(text);
+	if(tlen < 2 || text[tlen-1] != '}') {
+		free(text);
+		return NULL;
+	}
+	gboolean compact = (flags & JSON_COMPACT);
+	gboolean empty = (json_object_size(message) == 0);
+	const char *separator = empty ? "" : (compact ? "," : ", ");
+	const char *colon = compact ? ":" : ": ";
+	size_t nlen = strlen(payload->name), slen = strlen(shared);
+	size_t len = (tlen-1) + strlen(separator) + nlen + 2 + strlen(colon) + slen + 1;
+	char *result = malloc(len+1);
+	if(result == NULL) {
+		free(text);
+		return NULL;
+	}
+	g_snprintf(result, len+1, "%.*s%s\"%s\"%s%s}", (int)(tlen-1), text, separator, payload->name, colon, shared);
+	free(text);
+	return result;
+}
+
+gboolean janus_transport_message_is_droppable(json_t *message, janus_transport_payload *payload, char **events) {
+	if(message == NULL || events == NULL || events[0] == NULL)
+		return FALSE;
+	if(json_object_get(message, "transaction") != NULL || json_object_get(message, "jsep") != NULL)
+		return FALSE;
+	const char *name = json_string_value(json_object_get(message, "janus"));
+	if(name == NULL)
+		return FALSE;
+	if(!strcmp(name, "event")) {
+		/* Plugin event, check what it's about */
+		json_t *plugindata = json_object_get(message, "plugindata");
+		if(plugindata == NULL && payload != NULL && !strcmp(payload->name, "plugindata"))
+			plugindata = payload->object;
+		const char *plugin = json_string_value(json_object_get(plugindata, "plugin"));
+		json_t *data = json_object_get(plugindata, "data");
+		if(plugin == NULL || data == NULL)
+			return FALSE;
+		const char *dot = strrchr(plugin, '.');
+		name = json_string_value(json_object_get(data, dot ? dot+1 : plugin));
+		if(name == NULL)
+			return FALSE;
+	}
+	int i = 0;
+	for(i=0; events[i] != NULL; i++) {
+		if(!strcmp(name, events[i]))
+			return TRUE;
+	}
+	return FALSE;
+}
@@ -61,7 +61,13 @@ janus_transport *create(void) {
  *
  * All the above methods and callbacks are mandatory: the Janus core will
  * reject a transport plugin that doesn't implement any of the
- * mandatory callbacks.
+ * mandatory callbacks. Transport plugins can optionally implement
+ * \c send_message_prepared() too: when the core sends the same content
+ * to many sessions at the same time (e.g., a broadcast event from a
+ * plugin), it wraps that content in a refcounted \c janus_transport_payload
+ * shared by all recipients, which \c janus_transport_payload_dumps()
+ * serializes only once per JSON format; transports that don't implement
+ * the method will get the complete message via \c send_message() instead.
  *
  * The Janus core \c janus_transport_callbacks interface is provided to a
  * transport plugin, together with the path to the configurations files
@@ -97,7 +103,7 @@ janus_transport *create(void) {
 
 
 /*! \brief Version of the API, to match the one transport plugins were compiled against */
-#define JANUS_TRANSPORT_API_VERSION		8
+#define JANUS_TRANSPORT_API_VERSION		10
 
 /*! \brief Initialization of all transport plugin properties to NULL
  *
@@ -130,6 +136,7 @@ static janus_transport janus_http_transport_plugin =
 		.session_over = NULL,			\
 		.session_claimed = NULL,		\
 		.query_transport = NULL,		\
+		.send_message_prepared = NULL,	\
 		## __VA_ARGS__ }
 
 
@@ -171,6 +178,51 @@ janus_transport_session *janus_transport_session_create(void *transport_p, void
 void janus_transport_session_destroy(janus_transport_session *session);
 
 
+/*! \brief Content shared by several messages, serialized only once per JSON format */
+typedef struct janus_transport_payload {
+	/*! \brief Name of the property the shared object must be added as in each message */
+	char *name;
+	/*! \brief The shared object */
+	json_t *object;
+	/*! \brief Serialized versions of the shared object, indexed by the JSON flags that were used */
+	GHashTable *cache;
+	/*! \brief Mutex to protect the cache */
+	janus_mutex mutex;
+	/*! \brief Reference counter for this instance */
+	janus_refcount ref;
+} janus_transport_payload;
+/*! \brief Helper to create a janus_transport_payload instance
+ * @note This helper automatically initializes the reference counter: the
+ * instance will be freed when the counter goes to zero
+ * @param name Name of the property the shared object must be added as (must not need escaping)
+ * @param object The shared object (a reference is added, and the object must not be modified anymore)
+ * @returns Pointer to a valid janus_transport_payload, if successful, NULL otherwise */
+janus_transport_payload *janus_transport_payload_create(const char *name, json_t *object);
+/*! \brief Helper to serialize a message, adding the shared object to it
+ * @note The shared object is only serialized the first time a specific set
+ * of flags is used, and then spliced in the serialized message: since that
+ * only works with single line serializations, if indentation or sorting of
+ * keys are required the whole message is serialized as a fallback
+ * @param payload The janus_transport_payload instance to add (if NULL, this is the same as a json_dumps of the message)
+ * @param message The message to add the shared object to, as a Jansson JSON object (won't be modified)
+ * @param flags The Jansson flags to serialize the message with
+ * @returns A string with the serialized message, to free with free() as for json_dumps, or NULL in case of errors */
+char *janus_transport_payload_dumps(janus_transport_payload *payload, json_t *message, size_t flags);
+
+/*! \brief Events transports drop by default when a client can't keep up (see janus_transport_message_is_droppable) */
+#define JANUS_TRANSPORT_DROPPABLE_EVENTS	"talking,stopped-talking,slowlink"
+/*! \brief Helper to check whether a message is an event that can be dropped, e.g., when a client can't keep up
+ * @note Responses (anything with a \c transaction) and events with a JSEP are never
+ * considered droppable. For other events, the name that is matched is the \c janus
+ * attribute for core events (e.g., \c slowlink), and the value of the property named
+ * after the plugin for plugin events (e.g., \c talking for a \c janus.plugin.videoroom event)
+ * @param message The message to check, as a Jansson JSON object
+ * @param payload The content shared with other messages, if any (may contain the plugin data)
+ * @param events NULL terminated array of the names of the events that can be dropped
+ * @returns TRUE if the message can be dropped, FALSE otherwise */
+gboolean janus_transport_message_is_droppable(json_t *message, janus_transport_payload *payload, char **events);
+
+
 /*! \brief The transport plugin session and callbacks interface */
 struct janus_transport {
 	/*! \brief Transport plugin initialization/constructor
@@ -244,6 +296,19 @@ struct janus_transport {
 	 * @returns A Jansson object containing the response for the client */
 	json_t *(* const query_transport)(json_t *request);
 
+	/*! \brief Method to send a message to a client over a transport session, when part of its content is shared with other messages
+	 * \note This method is optional: if missing, the core will add the shared object to the message
+	 * and use \c send_message() instead. As for \c send_message(), it's the transport plugin's
+	 * responsibility to free the message; the payload, instead, is owned by the core, so a
+	 * transport plugin must increase its reference counter in case it needs it after returning
+	 * @param[in] transport Pointer to the transport session instance
+	 * @param[in] request_id Will be not-NULL in case this is a response to a previous request
+	 * @param[in] admin Whether this is an admin API or a Janus API message
+	 * @param[in] message The message data as a Jansson json_t object, without the shared object
+	 * @param[in] payload The content shared with other messages, to serialize via \c janus_transport_payload_dumps()
+	 * @returns 0 on success, a negative integer otherwise */
+	int (* const send_message_prepared)(janus_transport_session *transport, void *request_id, gboolean admin, json_t *message, janus_transport_payload *payload);
+
 };
 
 /*! \brief Callbacks to contact the Janus core */
@@ -289,14 +354,23 @@ struct janus_transport_callbacks {
 	 * @returns TRUE if the auth token is valid, FALSE otherwise */
 	gboolean (* const is_auth_token_valid)(janus_transport *plugin, const char *token);
 
-	/*! \brief Callback to check whether the event handlers mechanism is enabled
-	 * @returns TRUE if it is, FALSE if it isn't (which means notify_event should NOT be called) */
+	/*! \brief Callback to check whether the event handlers mechanism is enabled, and any handler is interested in transport events
+	 * @returns TRUE if it is, FALSE if it isn't (which means notify_event should NOT be called)
+	 * \note Handlers can change the events they subscribe to at any time, so this should be checked for each event */
 	gboolean (* const events_is_enabled)(void);
 	/*! \brief Callback to notify an event to the registered and subscribed event handlers
 	 * \note Don't unref the event object, the core will do that for you
 	 * @param[in] plugin The transport originating the event
 	 * @param[in] event The event to notify as a Jansson json_t object */
 	void (* const notify_event)(janus_transport *plugin, void *transport, json_t *event);
+
+	/*! \brief Callback to get the current metrics of the core, in OpenMetrics text format
+	 * \note This is meant for transports that want to expose a scraping endpoint
+	 * (e.g., for Prometheus): rendering the metrics doesn't need to iterate on
+	 * sessions and handles, so it's cheap enough to be invoked often
+	 * @param[in] plugin The transport asking for the metrics
+	 * @returns A string containing the metrics, which the transport must free with g_free */
+	char *(* const get_metrics)(janus_transport *plugin);
 };
 
 /*! \brief The hook that transport plugins need to implement to be created from the Janus core */
@@ -56,12 +56,104 @@ static size_t janus_turnrest_callback(void *payload, size_t size, size_t nmemb,
 }
 
 
+/* Credentials we get from the backend are cached, keyed by the request we
+ * send (which includes the API key and username), so that handles that would
+ * send the same request don't all contact the backend: concurrent requests
+ * for the same credentials share the same fetch, and cached credentials are
+ * refreshed in the background before they get too close to their expiration.
+ * Requests are all sent by a dedicated thread using the libcurl multi
+ * interface, which means that many of them can be in flight at the same time */
+#define JANUS_TURNREST_RETRY_INTERVAL	G_USEC_PER_SEC
+#define JANUS_TURNREST_DEFAULT_WAIT		10
+typedef struct janus_turnrest_entry {
+	/* Credentials we got most recently, if any */
+	janus_turnrest_response *response;
+	/* When we got them, when we should refresh them, and when we should stop using them */
+	gint64 fetched_at, refresh_at, expires_at;
+	/* When the latest request failed, if it did */
+	gint64 failed_at;
+	/* Whether a request for these credentials is in flight */
+	gboolean fetching;
+	/* How many requests are waiting for the fetch to complete */
+	guint waiters;
+} janus_turnrest_entry;
+static GHashTable *cache = NULL;
+static janus_mutex cache_mutex = JANUS_MUTEX_INITIALIZER;
+static janus_condition cache_cond;
+
+/* Request to send to the backend */
+typedef struct janus_turnrest_fetch {
+	char *uri;
+	char *query_string;
+	gboolean http_get;
+	uint timeout;
+	CURL *curl;
+	janus_turnrest_buffer data;
+} janus_turnrest_fetch;
+static GAsyncQueue *fetches = NULL;
+static GList *fetches_inflight = NULL;
+static CURLM *multi = NULL;
+static GThread *fetch_thread = NULL;
+static volatile gint fetch_thread_stop = 0;
+static void *janus_turnrest_thread(void *data);
+
+static void janus_turnrest_fetch_destroy(janus_turnrest_fetch *fetch) {
+	if(fetch == NULL)
+		return;
+	if(fetch->curl != NULL)
+		curl_easy_cleanup(fetch->curl);
+	g_free(fetch->uri);
+	g_free(fetch->query_string);
+	g_free(fetch->data.buffer);
+	g_free(fetch);
+}
+
+static void janus_turnrest_entry_destroy(gpointer data) {
+	janus_turnrest_entry *entry = (janus_turnrest_entry *)data;
+	if(entry == NULL)
+		return;
+	janus_turnrest_response_destroy(entry->response);
+	g_free(entry);
+}
+
+/* Wake the thread up, if libcurl allows us to */
+static void janus_turnrest_wakeup(void) {
+#if LIBCURL_VERSION_NUM >= 0x074400
+	if(multi != NULL)
+		curl_multi_wakeup(multi);
+#endif
+}
+
+
 void janus_turnrest_init(void) {
 	/* Initialize libcurl, needed for contacting the TURN REST API backend */
 	curl_global_init(CURL_GLOBAL_ALL);
+	cache = g_hash_table_new_full(g_str_hash, g_str_equal, (GDestroyNotify)g_free, janus_turnrest_entry_destroy);
+	janus_condition_init(&cache_cond);
+	fetches = g_async_queue_new_full((GDestroyNotify)janus_turnrest_fetch_destroy);
+	multi = curl_multi_init();
 }
 
 void janus_turnrest_deinit(void) {
+	/* Stop the thread sending the requests, if it's running */
+	if(fetch_thread != NULL) {
+		g_atomic_int_set(&fetch_thread_stop, 1);
+		janus_turnrest_wakeup();
+		g_thread_join(fetch_thread);
+		fetch_thread = NULL;
+	}
+	if(multi != NULL)
+		curl_multi_cleanup(multi);
+	multi = NULL;
+	if(fetches != NULL)
+		g_async_queue_unref(fetches);
+	fetches = NULL;
+	janus_mutex_lock(&cache_mutex);
+	if(cache != NULL)
+		g_hash_table_destroy(cache);
+	cache = NULL;
+	janus_mutex_unlock(&cache_mutex);
+	janus_condition_destroy(&cache_cond);
 	/* Cleanup the libcurl initialization */
 	curl_global_cleanup();
 	janus_mutex_lock(&api_mutex);
@@ -95,6 +187,18 @@ void janus_turnrest_set_backend(const char *server, const char *key, const char
 			}
 		}
 		api_timeout = timeout;
+		if(fetch_thread == NULL) {
+			/* Start the thread that will send the requests */
+			GError *error = NULL;
+			g_atomic_int_set(&fetch_thread_stop, 0);
+			fetch_thread = g_thread_try_new("turnrest", janus_turnrest_thread, NULL, &error);
+			if(error != NULL) {
+				JANUS_LOG(LOG_ERR, "Got error %d (%s) trying to launch the TURN REST API thread...\n",
+					error->code, error->message ? error->message : "??");
+				g_error_free(error);
+				fetch_thread = NULL;
+			}
+		}
 	}
 	janus_mutex_unlock(&api_mutex);
 }
@@ -120,116 +224,51 @@ void janus_turnrest_response_destroy(janus_turnrest_response *response) {
 	g_free(response);
 }
 
-janus_turnrest_response *janus_turnrest_request(const char *user) {
-	janus_mutex_lock(&api_mutex);
-	if(api_server == NULL) {
-		janus_mutex_unlock(&api_mutex);
-		return NULL;
-	}
-	/* Prepare the libcurl context */
-	CURLcode res;
-	CURL *curl = curl_easy_init();
-	if(curl == NULL) {
-		janus_mutex_unlock(&api_mutex);
-		JANUS_LOG(LOG_ERR, "libcurl error\n");
-		return NULL;
-	}
-	/* Prepare the request URI */
-	char query_string[512];
-	g_snprintf(query_string, 512, "service=turn");
-	if(api_key != NULL) {
-		/* Note: we've been using 'api' as a query string parameter for
-		 * a while, but the expired draft this implementation follows
-		 * suggested 'key' instead: as such, we send them both
-		 * See https://github.com/meetecho/janus-gateway/issues/1416 */
-		char buffer[256];
-		char *encoded_key = curl_easy_escape(curl, api_key, 0);
-		g_snprintf(buffer, 256, "&api=%s", encoded_key);
-		janus_strlcat(query_string, buffer, 512);
-		g_snprintf(buffer, 256, "&key=%s", encoded_key);
-		janus_strlcat(query_string, buffer, 512);
-		curl_free(encoded_key);
-	}
-	if(user != NULL) {
-		/* Note: 'username' is supposedly optional, but a commonly used
-		 * TURN REST API server implementation requires it. As such, we
-		 * now send that too, letting the Janus core tell us what to use
-		 * See https://github.com/meetecho/janus-gateway/issues/2199 */
-		char buffer[256];
-		char *encoded_user = curl_easy_escape(curl, user, 0);
-		g_snprintf(buffer, 256, "&username=%s", encoded_user);
-		janus_strlcat(query_string, buffer, 512);
-		curl_free(encoded_user);
-	}
-	char request_uri[1024];
-	g_snprintf(request_uri, 1024, "%s?%s", api_server, query_string);
-	JANUS_LOG(LOG_VERB, "Sending request: %s\n", request_uri);
-	curl_easy_setopt(curl, CURLOPT_URL, request_uri);
-	curl_easy_setopt(curl, (api_http_get ? CURLOPT_HTTPGET : CURLOPT_POST), 1);
-	if(!api_http_get) {
-		/* FIXME Some servers don't like a POST with no data */
-		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, query_string);
-	}
-	curl_easy_setopt(curl, CURLOPT_TIMEOUT, api_timeout);
-	janus_mutex_unlock(&api_mutex);
-	/* For getting data, we use an helper struct and the libcurl callback */
-	janus_turnrest_buffer data;
-	data.buffer = g_malloc0(1);
-	data.size = 0;
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, janus_turnrest_callback);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&data);
-	curl_easy_setopt(curl, CURLOPT_USERAGENT, "Janus/1.0");
-	/* Send the request */
-	res = curl_easy_perform(curl);
-	if(res != CURLE_OK) {
-		JANUS_LOG(LOG_ERR, "Couldn't send the request: %s\n", curl_easy_strerror(res));
-		g_free(data.buffer);
-		curl_easy_cleanup(curl);
-		return NULL;
-	}
-	/* Cleanup the libcurl context */
-	curl_easy_cleanup(curl);
-	/* Process the response */
-	JANUS_LOG(LOG_VERB, "Got %zu bytes from the TURN REST API server\n", data.size);
-	JANUS_LOG(LOG_VERB, "%s\n", data.buffer);
+/* Helper to parse the response we got from the TURN REST API backend */
+static janus_turnrest_response *janus_turnrest_parse(const char *buffer) {
 	json_error_t error;
-	json_t *root = json_loads(data.buffer, 0, &error);
+	json_t *root = json_loads(buffer, 0, &error);
 	if(!root) {
-		JANUS_LOG(LOG_ERR, "Couldn't parse response: error on line %d: %s", error.line, error.text);
-		g_free(data.buffer);
+		JANUS_LOG(LOG_ERR, "Couldn't parse response: error on line %d: %s\n", error.line, error.text);
 		return NULL;
 	}
-	g_free(data.buffer);
 	json_t *username = json_object_get(root, "username");
 	if(!username) {
 		JANUS_LOG(LOG_ERR, "Invalid response: missing username\n");
+		json_decref(root);
 		return NULL;
 	}
 	if(!json_is_string(username)) {
 		JANUS_LOG(LOG_ERR, "Invalid response: username should be a string\n");
+		json_decref(root);
 		return NULL;
 	}
 	json_t *password = json_object_get(root, "password");
 	if(!password) {
 		JANUS_LOG(LOG_ERR, "Invalid response: missing password\n");
+		json_decref(root);
 		return NULL;
 	}
 	if(!json_is_string(password)) {
 		JANUS_LOG(LOG_ERR, "Invalid response: password should be a string\n");
+		json_decref(root);
 		return NULL;
 	}
 	json_t *ttl = json_object_get(root, "ttl");
 	if(ttl && (!json_is_integer(ttl) || json_integer_value(ttl) < 0)) {
 		JANUS_LOG(LOG_ERR, "Invalid response: ttl should be a positive integer\n");
+		json_decref(root);
 		return NULL;
 	}
 	json_t *uris = json_object_get(root, "uris");
 	if(!uris) {
 		JANUS_LOG(LOG_ERR, "Invalid response: missing uris\n");
+		json_decref(root);
 		return NULL;
 	}
 	if(!json_is_array(uris) || json_array_size(uris) == 0) {
 		JANUS_LOG(LOG_ERR, "Invalid response: uris should be a non-empty array\n");
+		json_decref(root);
 		return NULL;
 	}
 	/* Turn the response into a janus_turnrest_response object we can use */
@@ -294,10 +333,287 @@ janus_turnrest_response *janus_turnrest_request(const char *user) {
 	if(response->servers == NULL) {
 		JANUS_LOG(LOG_ERR, "Couldn't find any valid TURN URI in the response...\n");
 		janus_turnrest_response_destroy(response);
+		json_decref(root);
+		return NULL;
+	}
+	json_decref(root);
+	return response;
+}
+
+/* Helper to prepare a request for the configured backend */
+static janus_turnrest_fetch *janus_turnrest_fetch_new(const char *user) {
+	janus_mutex_lock(&api_mutex);
+	if(api_server == NULL || fetch_thread == NULL) {
+		janus_mutex_unlock(&api_mutex);
+		return NULL;
+	}
+	/* Prepare the request URI */
+	char query_string[512];
+	g_snprintf(query_string, 512, "service=turn");
+	if(api_key != NULL) {
+		/* Note: we've been using 'api' as a query string parameter for
+		 * a while, but the expired draft this implementation follows
+		 * suggested 'key' instead: as such, we send them both
+		 * See https://github.com/meetecho/janus-gateway/issues/1416 */
+		char buffer[256];
+		char *encoded_key = g_uri_escape_string(api_key, NULL, FALSE);
+		g_snprintf(buffer, 256, "&api=%s", encoded_key);
+		janus_strlcat(query_string, buffer, 512);
+		g_snprintf(buffer, 256, "&key=%s", encoded_key);
+		janus_strlcat(query_string, buffer, 512);
+		g_free(encoded_key);
+	}
+	if(user != NULL) {
+		/* Note: 'username' is supposedly optional, but a commonly used
+		 * TURN REST API server implementation requires it. As such, we
+		 * now send that too, letting the Janus core tell us what to use
+		 * See https://github.com/meetecho/janus-gateway/issues/2199 */
+		char buffer[256];
+		char *encoded_user = g_uri_escape_string(user, NULL, FALSE);
+		g_snprintf(buffer, 256, "&username=%s", encoded_user);
+		janus_strlcat(query_string, buffer, 512);
+		g_free(encoded_user);
+	}
+	janus_turnrest_fetch *fetch = g_malloc0(sizeof(janus_turnrest_fetch));
+	fetch->uri = g_strdup_printf("%s?%s", api_server, query_string);
+	fetch->query_string = g_strdup(query_string);
+	fetch->http_get = api_http_get;
+	fetch->timeout = api_timeout;
+	janus_mutex_unlock(&api_mutex);
+	return fetch;
+}
+
+/* Helper to hand a request to the thread, if we need to: returns the request
+ * back if we don't (e.g., because the same request is in flight already) */
+static janus_turnrest_fetch *janus_turnrest_schedule(janus_turnrest_entry *entry, janus_turnrest_fetch *fetch, gint64 now) {
+	if(entry->fetching)
+		return fetch;
+	if(entry->response != NULL && now < entry->refresh_at)
+		return fetch;
+	if((entry->response == NULL || now >= entry->expires_at) &&
+			entry->failed_at > 0 && now - entry->failed_at < JANUS_TURNREST_RETRY_INTERVAL) {
+		/* The backend failed us just now, don't hammer it */
+		return fetch;
+	}
+	entry->fetching = TRUE;
+	g_async_queue_push(fetches, fetch);
+	janus_turnrest_wakeup();
+	return NULL;
+}
+
+/* Helper to find (or create) the cache entry for a request, with the cache mutex locked */
+static janus_turnrest_entry *janus_turnrest_entry_get(const char *key) {
+	janus_turnrest_entry *entry = g_hash_table_lookup(cache, key);
+	if(entry == NULL) {
+		entry = g_malloc0(sizeof(janus_turnrest_entry));
+		g_hash_table_insert(cache, g_strdup(key), entry);
+	}
+	return entry;
+}
+
+/* Helper to copy cached credentials, and update their time-to-live */
+static janus_turnrest_response *janus_turnrest_response_copy(janus_turnrest_entry *entry, gint64 now) {
+	janus_turnrest_response *response = g_malloc(sizeof(janus_turnrest_response));
+	response->username = g_strdup(entry->response->username);
+	response->password = g_strdup(entry->response->password);
+	gint64 elapsed = (now - entry->fetched_at)/G_USEC_PER_SEC;
+	response->ttl = entry->response->ttl > elapsed ? entry->response->ttl - elapsed : 0;
+	response->servers = NULL;
+	GList *temp = entry->response->servers;
+	while(temp) {
+		janus_turnrest_instance *instance = (janus_turnrest_instance *)temp->data;
+		janus_turnrest_instance *copy = g_malloc(sizeof(janus_turnrest_instance));
+		copy->server = g_strdup(instance->server);
+		copy->port = instance->port;
+		copy->transport = instance->transport;
+		response->servers = g_list_prepend(response->servers, copy);
+		temp = temp->next;
+	}
+	response->servers = g_list_reverse(response->servers);
+	return response;
+}
+
+/* Thread context: start sending a request */
+static int janus_turnrest_fetch_start(janus_turnrest_fetch *fetch) {
+	fetch->curl = curl_easy_init();
+	if(fetch->curl == NULL) {
+		JANUS_LOG(LOG_ERR, "libcurl error\n");
+		return -1;
+	}
+	JANUS_LOG(LOG_VERB, "Sending request: %s\n", fetch->uri);
+	curl_easy_setopt(fetch->curl, CURLOPT_URL, fetch->uri);
+	curl_easy_setopt(fetch->curl, (fetch->http_get ? CURLOPT_HTTPGET : CURLOPT_POST), 1);
+	if(!fetch->http_get) {
+		/* FIXME Some servers don't like a POST with no data */
+		curl_easy_setopt(fetch->curl, CURLOPT_POSTFIELDS, fetch->query_string);
+	}
+	curl_easy_setopt(fetch->curl, CURLOPT_TIMEOUT, fetch->timeout);
+	curl_easy_setopt(fetch->curl, CURLOPT_NOSIGNAL, 1L);
+	/* For getting data, we use an helper struct and the libcurl callback */
+	fetch->data.buffer = g_malloc0(1);
+	fetch->data.size = 0;
+	curl_easy_setopt(fetch->curl, CURLOPT_WRITEFUNCTION, janus_turnrest_callback);
+	curl_easy_setopt(fetch->curl, CURLOPT_WRITEDATA, (void *)&fetch->data);
+	curl_easy_setopt(fetch->curl, CURLOPT_USERAGENT, "Janus/1.0");
+	curl_easy_setopt(fetch->curl, CURLOPT_PRIVATE, fetch);
+	if(curl_multi_add_handle(multi, fetch->curl) != CURLM_OK) {
+		JANUS_LOG(LOG_ERR, "Couldn't send the request: libcurl multi error\n");
+		return -1;
+	}
+	fetches_inflight = g_list_prepend(fetches_inflight, fetch);
+	return 0;
+}
+
+/* Thread context: a request is done, update the cache and wake up whoever's waiting */
+static void janus_turnrest_fetch_done(janus_turnrest_fetch *fetch, janus_turnrest_response *response) {
+	gint64 now = janus_get_monotonic_time();
+	janus_mutex_lock(&cache_mutex);
+	janus_turnrest_entry *entry = cache ? g_hash_table_lookup(cache, fetch->uri) : NULL;
+	if(entry != NULL) {
+		entry->fetching = FALSE;
+		if(response != NULL) {
+			janus_turnrest_response_destroy(entry->response);
+			entry->response = response;
+			response = NULL;
+			entry->fetched_at = now;
+			entry->failed_at = 0;
+			/* We refresh credentials once a quarter of their lifetime has passed,
+			 * and stop handing them out after half of it, so that handles always
+			 * get credentials with a reasonable lifetime left: credentials with
+			 * no TTL are only handed to requests that were waiting for them */
+			entry->refresh_at = now + (gint64)entry->response->ttl*G_USEC_PER_SEC/4;
+			entry->expires_at = now + (gint64)entry->response->ttl*G_USEC_PER_SEC/2;
+		} else {
+			entry->failed_at = now;
+		}
+	}
+	janus_condition_broadcast(&cache_cond);
+	janus_mutex_unlock(&cache_mutex);
+	janus_turnrest_response_destroy(response);
+	janus_turnrest_fetch_destroy(fetch);
+}
+
+/* Thread context: get rid of credentials we can't use anymore */
+static void janus_turnrest_purge(gint64 now) {
+	janus_mutex_lock(&cache_mutex);
+	GHashTableIter iter;
+	gpointer value;
+	g_hash_table_iter_init(&iter, cache);
+	while(g_hash_table_iter_next(&iter, NULL, &value)) {
+		janus_turnrest_entry *entry = (janus_turnrest_entry *)value;
+		if(entry->fetching || entry->waiters > 0)
+			continue;
+		if(entry->response != NULL ? (now >= entry->expires_at) :
+				(now - entry->failed_at >= JANUS_TURNREST_RETRY_INTERVAL))
+			g_hash_table_iter_remove(&iter);
+	}
+	janus_mutex_unlock(&cache_mutex);
+}
+
+/* Thread sending all the requests to the backend */
+static void *janus_turnrest_thread(void *data) {
+	JANUS_LOG(LOG_VERB, "Joining TURN REST API thread\n");
+	int running = 0;
+	gint64 now = 0, last_purge = janus_get_monotonic_time();
+	janus_turnrest_fetch *fetch = NULL;
+	while(!g_atomic_int_get(&fetch_thread_stop)) {
+		/* Start sending the new requests, if any */
+		while((fetch = g_async_queue_try_pop(fetches)) != NULL) {
+			if(janus_turnrest_fetch_start(fetch) < 0)
+				janus_turnrest_fetch_done(fetch, NULL);
+		}
+		curl_multi_perform(multi, &running);
+		/* Check which requests are done */
+		CURLMsg *msg = NULL;
+		int left = 0;
+		while((msg = curl_multi_info_read(multi, &left)) != NULL) {
+			if(msg->msg != CURLMSG_DONE)
+				continue;
+			CURL *curl = msg->easy_handle;
+			CURLcode res = msg->data.result;
+			fetch = NULL;
+			curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&fetch);
+			curl_multi_remove_handle(multi, curl);
+			if(fetch == NULL)
+				continue;
+			fetches_inflight = g_list_remove(fetches_inflight, fetch);
+			janus_turnrest_response *response = NULL;
+			if(res != CURLE_OK) {
+				JANUS_LOG(LOG_ERR, "Couldn't send the request: %s\n", curl_easy_strerror(res));
+			} else {
+				/* Process the response */
+				JANUS_LOG(LOG_VERB, "Got %zu bytes from the TURN REST API server\n", fetch->data.size);
+				JANUS_LOG(LOG_VERB, "%s\n", fetch->data.buffer);
+				response = janus_turnrest_parse(fetch->data.buffer);
+			}
+			janus_turnrest_fetch_done(fetch, response);
+		}
+		now = janus_get_monotonic_time();
+		if(now - last_purge >= G_USEC_PER_SEC) {
+			janus_turnrest_purge(now);
+			last_purge = now;
+		}
+		/* Wait for the requests in flight, or for new ones */
+#if LIBCURL_VERSION_NUM >= 0x074400
+		curl_multi_poll(multi, NULL, 0, 1000, NULL);
+#else
+		curl_multi_wait(multi, NULL, 0, 50, NULL);
+#endif
+	}
+	/* We're shutting down, fail the requests that are still in flight */
+	while(fetches_inflight != NULL) {
+		fetch = (janus_turnrest_fetch *)fetches_inflight->data;
+		fetches_inflight = g_list_delete_link(fetches_inflight, fetches_inflight);
+		curl_multi_remove_handle(multi, fetch->curl);
+		janus_turnrest_fetch_done(fetch, NULL);
+	}
+	while((fetch = g_async_queue_try_pop(fetches)) != NULL)
+		janus_turnrest_fetch_done(fetch, NULL);
+	JANUS_LOG(LOG_VERB, "Leaving TURN REST API thread\n");
+	return NULL;
+}
+
+janus_turnrest_response *janus_turnrest_request(const char *user) {
+	janus_turnrest_fetch *fetch = janus_turnrest_fetch_new(user);
+	if(fetch == NULL)
 		return NULL;
+	uint timeout = fetch->timeout ? fetch->timeout : JANUS_TURNREST_DEFAULT_WAIT;
+	char *key = g_strdup(fetch->uri);
+	janus_turnrest_response *response = NULL;
+	gint64 start = janus_get_monotonic_time();
+	janus_mutex_lock(&cache_mutex);
+	janus_turnrest_entry *entry = janus_turnrest_entry_get(key);
+	fetch = janus_turnrest_schedule(entry, fetch, start);
+	if(entry->response != NULL && start < entry->expires_at) {
+		/* We have valid credentials cached (that we may be refreshing already) */
+		response = janus_turnrest_response_copy(entry, start);
+	} else if(entry->fetching) {
+		/* Wait for the request in flight, whether we sent it or not */
+		entry->waiters++;
+		gint64 deadline = start + (gint64)timeout*G_USEC_PER_SEC + G_USEC_PER_SEC/2;
+		while(entry->fetching && janus_get_monotonic_time() < deadline)
+			janus_condition_wait_until(&cache_cond, &cache_mutex, deadline);
+		entry->waiters--;
+		if(entry->response != NULL && entry->fetched_at >= start)
+			response = janus_turnrest_response_copy(entry, janus_get_monotonic_time());
 	}
-	/* Done */
+	janus_mutex_unlock(&cache_mutex);
+	janus_turnrest_fetch_destroy(fetch);
+	g_free(key);
 	return response;
 }
 
+void janus_turnrest_prefetch(const char *user) {
+	janus_turnrest_fetch *fetch = janus_turnrest_fetch_new(user);
+	if(fetch == NULL)
+		return;
+	char *key = g_strdup(fetch->uri);
+	janus_mutex_lock(&cache_mutex);
+	janus_turnrest_entry *entry = janus_turnrest_entry_get(key);
+	fetch = janus_turnrest_schedule(entry, fetch, janus_get_monotonic_time());
+	janus_mutex_unlock(&cache_mutex);
+	janus_turnrest_fetch_destroy(fetch);
+	g_free(key);
+}
+
 #endif
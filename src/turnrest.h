@@ -66,10 +66,19 @@ void janus_turnrest_response_destroy(janus_turnrest_response *response);
 
 
 /*! \brief Retrieve address and credentials for one or more TURN servers
+ * \details Credentials are cached for half of their TTL, and refreshed in
+ * the background before that, so this only waits for the backend when
+ * there are no valid credentials for this user yet: in that case, concurrent
+ * requests for the same user all wait for the same request to the backend
  * @note Use janus_turnrest_response_destroy to get rid of the response, once done
  * @param[in] user Username to provide in the TURN REST API request
  * @returns A valid janus_turnrest_response instance, if successful, NULL otherwise */
 janus_turnrest_response *janus_turnrest_request(const char *user);
+/*! \brief Start retrieving credentials for a user in the background, if they're not cached already
+ * \note This never blocks: a later janus_turnrest_request for the same user will
+ * either find the credentials in the cache, or wait for this request to complete
+ * @param[in] user Username to provide in the TURN REST API request */
+void janus_turnrest_prefetch(const char *user);
 
 #endif
 
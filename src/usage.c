@@ -0,0 +1,113 @@
+/*! \file    usage.c
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Resource accounting
+ * \details  Helpers plugins can use to attribute the resources they
+ * consume to the entities they manage (e.g., VideoRoom rooms, AudioBridge
+ * rooms, Streaming mountpoints), so that an orchestrator can figure out
+ * how heavy each of them is when deciding where new ones should go.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#include <time.h>
+#include <string.h>
+
+#include "usage.h"
+#include "utils.h"
+
+/* When sampling work done in shared threads, we measure one unit of work
+ * out of this many (per thread), and count it that many times */
+#define JANUS_USAGE_SAMPLING	16
+static __thread guint sample_count = 0;
+
+void janus_usage_init(janus_usage *usage) {
+	if(usage == NULL)
+		return;
+	int i = 0;
+	for(i=0; i<JANUS_USAGE_COUNTERS; i++)
+		g_atomic_pointer_set(&usage->counters[i], 0);
+	usage->started = janus_get_monotonic_time();
+}
+
+void janus_usage_add(janus_usage *usage, janus_usage_counter counter, gsize value) {
+	if(usage == NULL || counter >= JANUS_USAGE_COUNTERS || value == 0)
+		return;
+	g_atomic_pointer_add(&usage->counters[counter], value);
+}
+
+void janus_usage_packets_in(janus_usage *usage, guint packets, gsize bytes, gboolean srtp) {
+	if(usage == NULL || packets == 0)
+		return;
+	g_atomic_pointer_add(&usage->counters[JANUS_USAGE_PACKETS_IN], packets);
+	g_atomic_pointer_add(&usage->counters[JANUS_USAGE_BYTES_IN], bytes);
+	if(srtp)
+		g_atomic_pointer_add(&usage->counters[JANUS_USAGE_SRTP_OPS], packets);
+}
+
+void janus_usage_packets_out(janus_usage *usage, guint packets, gsize bytes, gboolean srtp) {
+	if(usage == NULL || packets == 0)
+		return;
+	g_atomic_pointer_add(&usage->counters[JANUS_USAGE_PACKETS_OUT], packets);
+	g_atomic_pointer_add(&usage->counters[JANUS_USAGE_BYTES_OUT], bytes);
+	if(srtp)
+		g_atomic_pointer_add(&usage->counters[JANUS_USAGE_SRTP_OPS], packets);
+}
+
+gint64 janus_usage_thread_cpu_time(void) {
+	struct timespec ts;
+	if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) < 0)
+		return 0;
+	return (ts.tv_sec*G_USEC_PER_SEC) + (ts.tv_nsec/1000);
+}
+
+void janus_usage_thread_update(janus_usage *usage, gint64 *last) {
+	if(usage == NULL || last == NULL)
+		return;
+	gint64 now = janus_usage_thread_cpu_time();
+	if(now > *last)
+		janus_usage_add(usage, JANUS_USAGE_CPU_TIME, now - *last);
+	*last = now;
+}
+
+guint janus_usage_sample_start(gint64 *cpu) {
+	sample_count++;
+	if(sample_count < JANUS_USAGE_SAMPLING)
+		return 0;
+	sample_count = 0;
+	*cpu = janus_usage_thread_cpu_time();
+	return JANUS_USAGE_SAMPLING;
+}
+
+void janus_usage_sample_stop(janus_usage *usage, guint weight, gint64 cpu) {
+	if(usage == NULL || weight == 0)
+		return;
+	gint64 now = janus_usage_thread_cpu_time();
+	if(now > cpu)
+		janus_usage_add(usage, JANUS_USAGE_CPU_TIME, (now - cpu)*weight);
+}
+
+static json_int_t janus_usage_get(janus_usage *usage, janus_usage_counter counter) {
+	return (json_int_t)(gsize)g_atomic_pointer_get(&usage->counters[counter]);
+}
+
+json_t *janus_usage_json(janus_usage *usage) {
+	if(usage == NULL)
+		return NULL;
+	json_t *u = json_object();
+	json_object_set_new(u, "packets-in", json_integer(janus_usage_get(usage, JANUS_USAGE_PACKETS_IN)));
+	json_object_set_new(u, "bytes-in", json_integer(janus_usage_get(usage, JANUS_USAGE_BYTES_IN)));
+	json_object_set_new(u, "packets-out", json_integer(janus_usage_get(usage, JANUS_USAGE_PACKETS_OUT)));
+	json_object_set_new(u, "bytes-out", json_integer(janus_usage_get(usage, JANUS_USAGE_BYTES_OUT)));
+	json_object_set_new(u, "srtp-ops", json_integer(janus_usage_get(usage, JANUS_USAGE_SRTP_OPS)));
+	json_object_set_new(u, "decode-time", json_integer(janus_usage_get(usage, JANUS_USAGE_DECODE_TIME)));
+	json_object_set_new(u, "encode-time", json_integer(janus_usage_get(usage, JANUS_USAGE_ENCODE_TIME)));
+	json_int_t cpu = janus_usage_get(usage, JANUS_USAGE_CPU_TIME);
+	json_object_set_new(u, "cpu-time", json_integer(cpu));
+	gint64 elapsed = janus_get_monotonic_time() - usage->started;
+	json_object_set_new(u, "elapsed", json_integer(elapsed/G_USEC_PER_SEC));
+	/* Average load since accounting started, as a percentage of one core */
+	json_object_set_new(u, "cpu-load", json_real(elapsed > 0 ? ((double)cpu*100.0)/(double)elapsed : 0.0));
+	return u;
+}
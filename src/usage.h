@@ -0,0 +1,113 @@
+/*! \file    usage.h
+ * \author   Lorenzo Miniero <lorenzo@meetecho.com>
+ * \copyright GNU General Public License v3
+ * \brief    Resource accounting (headers)
+ * \details  Helpers plugins can use to attribute the resources they
+ * consume to the entities they manage (e.g., VideoRoom rooms, AudioBridge
+ * rooms, Streaming mountpoints), so that an orchestrator can figure out
+ * how heavy each of them is when deciding where new ones should go. Each
+ * entity embeds a janus_usage instance, which keeps track of packets and
+ * bytes received and sent, SRTP operations the core performed on its
+ * behalf, time spent encoding and decoding media, and CPU time consumed
+ * by the threads that work for it. CPU time is measured per thread via
+ * \c CLOCK_THREAD_CPUTIME_ID : threads dedicated to an entity (e.g., a
+ * mixer or a helper thread) account all of their CPU time, while work
+ * done in shared threads (e.g., the ICE loops relaying media) can be
+ * sampled instead, to keep the cost of measuring it low.
+ *
+ * \ingroup core
+ * \ref core
+ */
+
+#ifndef JANUS_USAGE_H
+#define JANUS_USAGE_H
+
+#include <glib.h>
+#include <jansson.h>
+
+/*! \brief Counters kept for each entity */
+typedef enum janus_usage_counter {
+	/*! \brief Packets received (e.g., from publishers or sources) */
+	JANUS_USAGE_PACKETS_IN = 0,
+	/*! \brief Bytes received */
+	JANUS_USAGE_BYTES_IN,
+	/*! \brief Packets sent (e.g., to subscribers, listeners or viewers) */
+	JANUS_USAGE_PACKETS_OUT,
+	/*! \brief Bytes sent */
+	JANUS_USAGE_BYTES_OUT,
+	/*! \brief SRTP/SRTCP protect and unprotect operations done by the core for the packets above */
+	JANUS_USAGE_SRTP_OPS,
+	/*! \brief Time spent decoding media, in microseconds */
+	JANUS_USAGE_DECODE_TIME,
+	/*! \brief Time spent encoding media, in microseconds */
+	JANUS_USAGE_ENCODE_TIME,
+	/*! \brief CPU time consumed by threads working for the entity, in microseconds */
+	JANUS_USAGE_CPU_TIME,
+	/*! \brief Number of counters (must be last) */
+	JANUS_USAGE_COUNTERS
+} janus_usage_counter;
+
+/*! \brief Resources consumed by an entity */
+typedef struct janus_usage {
+	/*! \brief Counters, updated atomically */
+	volatile gsize counters[JANUS_USAGE_COUNTERS];
+	/*! \brief When accounting started, as a monotonic time */
+	gint64 started;
+} janus_usage;
+
+/*! \brief Initialize (or reset) the accounting of an entity
+ * @param[in] usage The janus_usage instance to initialize */
+void janus_usage_init(janus_usage *usage);
+
+/*! \brief Add a value to a counter
+ * @param[in] usage The janus_usage instance to update
+ * @param[in] counter The counter to update
+ * @param[in] value The value to add */
+void janus_usage_add(janus_usage *usage, janus_usage_counter counter, gsize value);
+
+/*! \brief Account for packets that were received
+ * @param[in] usage The janus_usage instance to update
+ * @param[in] packets How many packets were received
+ * @param[in] bytes How many bytes those packets amounted to
+ * @param[in] srtp Whether the core had to decrypt them (e.g., because they came from a PeerConnection) */
+void janus_usage_packets_in(janus_usage *usage, guint packets, gsize bytes, gboolean srtp);
+
+/*! \brief Account for packets that were sent
+ * @param[in] usage The janus_usage instance to update
+ * @param[in] packets How many packets were sent
+ * @param[in] bytes How many bytes those packets amounted to
+ * @param[in] srtp Whether the core will have to encrypt them (e.g., because they're sent on a PeerConnection) */
+void janus_usage_packets_out(janus_usage *usage, guint packets, gsize bytes, gboolean srtp);
+
+/*! \brief Get the CPU time the calling thread consumed so far
+ * @returns The CPU time of the thread, in microseconds */
+gint64 janus_usage_thread_cpu_time(void);
+
+/*! \brief Account for the CPU time the calling thread consumed since the last time this was called
+ * \note This is meant for threads dedicated to an entity: \c last must be
+ * initialized with janus_usage_thread_cpu_time when the thread starts
+ * @param[in] usage The janus_usage instance to update
+ * @param[in,out] last The CPU time of the thread the last time this was called, which is updated */
+void janus_usage_thread_update(janus_usage *usage, gint64 *last);
+
+/*! \brief Start measuring a unit of work a shared thread does for an entity,
+ * if it's time to sample it: only one out of every few units of work is
+ * measured (per thread), and is then accounted as many times
+ * @param[out] cpu Where to store the CPU time of the thread when the work started
+ * @returns A sampling weight (how many units of work this measurement
+ * counts for), or 0 if this unit of work is not measured */
+guint janus_usage_sample_start(gint64 *cpu);
+
+/*! \brief Account for a unit of work sampled with janus_usage_sample_start
+ * @param[in] usage The janus_usage instance to update
+ * @param[in] weight The weight janus_usage_sample_start returned (nothing is done if 0)
+ * @param[in] cpu The CPU time janus_usage_sample_start returned */
+void janus_usage_sample_stop(janus_usage *usage, guint weight, gint64 cpu);
+
+/*! \brief Get a JSON representation of the resources consumed by an entity
+ * @param[in] usage The janus_usage instance to represent
+ * @returns A JSON object with the counters, how long accounting has been
+ * going on and the average CPU load (as a percentage of one core) */
+json_t *janus_usage_json(janus_usage *usage);
+
+#endif
@@ -47,6 +47,39 @@ gint64 janus_get_monotonic_time(void) {
 	return janus_get_monotonic_time_internal() - janus_started;
 }
 
+/* Per-thread cache of the monotonic time, for hot paths */
+static GPrivate janus_monotonic_time_cache = G_PRIVATE_INIT(g_free);
+gint64 janus_refresh_cached_monotonic_time(void) {
+	gint64 *cache = g_private_get(&janus_monotonic_time_cache);
+	if(cache == NULL) {
+		cache = g_malloc(sizeof(gint64));
+		g_private_set(&janus_monotonic_time_cache, cache);
+	}
+	*cache = janus_get_monotonic_time();
+	return *cache;
+}
+
+void janus_clear_cached_monotonic_time(void) {
+	gint64 *cache = g_private_get(&janus_monotonic_time_cache);
+	if(cache != NULL)
+		*cache = 0;
+}
+
+gint64 janus_get_cached_monotonic_time(void) {
+	gint64 *cache = g_private_get(&janus_monotonic_time_cache);
+	if(cache == NULL || *cache == 0)
+		return janus_get_monotonic_time();
+	return *cache;
+}
+
+char *janus_get_clocksource(void) {
+	char *clocksource = NULL;
+	if(!g_file_get_contents("/sys/devices/system/clocksource/clocksource0/current_clocksource",
+			&clocksource, NULL, NULL))
+		return NULL;
+	return g_strstrip(clocksource);
+}
+
 gint64 janus_get_real_time(void) {
 	struct timespec ts;
 	clock_gettime (CLOCK_REALTIME, &ts);
@@ -863,17 +896,19 @@ gboolean janus_vp9_is_keyframe(const char *buffer, int len) {
 	return FALSE;
 }
 
-static gboolean janus_h264_contains_nal(const char *buffer, int len, int val) {
+guint32 janus_h264_nal_types(const char *buffer, int len) {
 	if(!buffer || len < 6)
-		return FALSE;
-	/* Parse H264 header now */
+		return 0;
+	/* Parse H264 header now: we go through the payload only once, and
+	 * take note of all the NAL types we find (only the start of fragments) */
+	guint32 types = 0;
 	uint8_t fragment = *buffer & 0x1F;
 	uint8_t nal = *(buffer+1) & 0x1F;
-	if(fragment == val || ((fragment == 28 || fragment == 29) && nal == val && (*(buffer+1) & 0x80))) {
-		JANUS_LOG(LOG_HUGE, "Got an H264 NAL %d\n", val);
-		return TRUE;
+	if(fragment == 28 || fragment == 29) {
+		if(*(buffer+1) & 0x80)
+			types |= ((guint32)1 << nal);
 	} else if(fragment == 24) {
-		/* May we find it in this STAP-A? */
+		/* Check the NAL units in this STAP-A */
 		buffer++;
 		len--;
 		uint16_t psize = 0;
@@ -883,29 +918,26 @@ static gboolean janus_h264_contains_nal(const char *buffer, int len, int val) {
 			psize = ntohs(psize);
 			buffer += 2;
 			len -= 2;
-			int nal = *buffer & 0x1F;
-			if(nal == val) {
-				JANUS_LOG(LOG_HUGE, "Got an H264 NAL %d\n", val);
-				return TRUE;
-			}
+			types |= ((guint32)1 << (*buffer & 0x1F));
 			buffer += psize;
 			len -= psize;
 		}
+	} else {
+		types |= ((guint32)1 << fragment);
 	}
-	/* If we got here we didn't find it */
-	return FALSE;
+	return types;
 }
 
 gboolean janus_h264_is_keyframe(const char *buffer, int len) {
-	return janus_h264_contains_nal(buffer, len, 7);
+	return (janus_h264_nal_types(buffer, len) & (1 << 7)) != 0;
 }
 
 gboolean janus_h264_is_i_frame(const char *buffer, int len) {
-	return janus_h264_contains_nal(buffer, len, 5);
+	return (janus_h264_nal_types(buffer, len) & (1 << 5)) != 0;
 }
 
 gboolean janus_h264_is_b_frame(const char *buffer, int len) {
-	return janus_h264_contains_nal(buffer, len, 1);
+	return (janus_h264_nal_types(buffer, len) & (1 << 1)) != 0;
 }
 
 gboolean janus_av1_is_keyframe(const char *buffer, int len) {
@@ -919,20 +951,66 @@ gboolean janus_av1_is_keyframe(const char *buffer, int len) {
 	return (!zbit && nbit);
 }
 
-gboolean janus_h265_is_keyframe(const char *buffer, int len) {
+guint64 janus_h265_nal_types(const char *buffer, int len) {
 	if(!buffer || len < 2)
-		return FALSE;
-	/* Parse the NAL unit */
-	uint16_t unit = 0;
-	memcpy(&unit, buffer, sizeof(uint16_t));
-	unit = ntohs(unit);
-	uint8_t type = (unit & 0x7E00) >> 9;
-	if(type == 32 || type == 33 || type == 34 || type == 16 || type == 17 || type == 18 || type == 19 || type == 20 || type == 21) {
-		/* FIXME We return TRUE for more than just VPS and SPS, as
-		 * suggested in https://github.com/meetecho/janus-gateway/issues/2323 */
-		return TRUE;
+		return 0;
+	/* Parse the NAL unit header: as for H.264, we only go through the
+	 * payload once, and take note of all the NAL types we find */
+	guint64 types = 0;
+	uint8_t type = (*buffer & 0x7E) >> 1;
+	if(type == 48) {
+		/* Aggregation Packet, check the NAL units it contains */
+		const uint8_t *p = (const uint8_t *)buffer + 2, *end = (const uint8_t *)buffer + len;
+		while(end - p > 2) {
+			uint16_t psize = (p[0] << 8) | p[1];
+			p += 2;
+			types |= ((guint64)1 << ((*p & 0x7E) >> 1));
+			p += psize;
+		}
+	} else if(type == 49) {
+		/* Fragmentation Unit, only the start counts */
+		if(len > 2 && (*(buffer+2) & 0x80))
+			types |= ((guint64)1 << (*(buffer+2) & 0x3F));
+	} else {
+		types |= ((guint64)1 << type);
 	}
-	return FALSE;
+	return types;
+}
+
+gboolean janus_h265_is_keyframe(const char *buffer, int len) {
+	/* FIXME We return TRUE for more than just VPS and SPS (IRAP pictures
+	 * too), as suggested in https://github.com/meetecho/janus-gateway/issues/2323 */
+	guint64 keyframe_types = ((guint64)1 << 32) | ((guint64)1 << 33) | ((guint64)1 << 34) |
+		((guint64)1 << 16) | ((guint64)1 << 17) | ((guint64)1 << 18) |
+		((guint64)1 << 19) | ((guint64)1 << 20) | ((guint64)1 << 21);
+	return (janus_h265_nal_types(buffer, len) & keyframe_types) != 0;
+}
+
+int janus_h26x_remove_emulation_prevention(uint8_t *buffer, int len) {
+	if(!buffer || len < 3)
+		return len;
+	/* Rather than going through the buffer byte by byte, we let memchr
+	 * (which libc vectorizes) find the 0x03 bytes, and only then check if
+	 * they're preceded by two zeros: when they are, they're dropped */
+	int read = 0, write = 0, search = 2;
+	while(search < len) {
+		uint8_t *found = memchr(buffer + search, 0x03, len - search);
+		if(found == NULL)
+			break;
+		int index = found - buffer;
+		if(index - 2 >= read && buffer[index-1] == 0x00 && buffer[index-2] == 0x00) {
+			memmove(buffer + write, buffer + read, index - read);
+			write += index - read;
+			read = index + 1;
+			/* The next one will need two new zeros first */
+			search = index + 3;
+		} else {
+			search = index + 1;
+		}
+	}
+	memmove(buffer + write, buffer + read, len - read);
+	write += len - read;
+	return write;
 }
 
 int janus_vp8_parse_descriptor(char *buffer, int len,
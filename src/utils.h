@@ -54,6 +54,33 @@ gint64 janus_get_monotonic_time_internal(void);
  * @returns The system monotonic time */
 gint64 janus_get_monotonic_time(void);
 
+/*! \brief Helper to refresh the monotonic time cached for the current thread
+ * \note This is meant to be used at the beginning of a unit of work (e.g., when
+ * the core dispatches incoming or outgoing packets in an event loop), so
+ * that the code that follows can use janus_get_cached_monotonic_time rather
+ * than querying the clock again: it must be followed by a call to
+ * janus_clear_cached_monotonic_time when that unit of work is over
+ * @returns The system monotonic time, normalized from the Janus start time */
+gint64 janus_refresh_cached_monotonic_time(void);
+
+/*! \brief Helper to invalidate the monotonic time cached for the current thread */
+void janus_clear_cached_monotonic_time(void);
+
+/*! \brief Helper to retrieve the monotonic time cached for the current thread
+ * \note If no time was cached (see janus_refresh_cached_monotonic_time), this
+ * is the same as calling janus_get_monotonic_time, which means it's always
+ * safe to use, e.g., from plugins: it's only cheaper when the core refreshed
+ * the cache first, which it does when handing incoming packets to plugins
+ * @returns The (possibly cached) system monotonic time, normalized from the Janus start time */
+gint64 janus_get_cached_monotonic_time(void);
+
+/*! \brief Helper to find out which clocksource the kernel is using
+ * \note Only available on Linux: on some virtual machines the clocksource
+ * may not support fast reads from user space, which makes each read of
+ * the time a system call
+ * @returns A string with the clocksource name (to be freed by the caller), or NULL if unknown */
+char *janus_get_clocksource(void);
+
 /*! \brief Helper to retrieve the system real time, as Glib's
  * g_get_real_time may not be available (only since 2.28)
  * @returns The system real time */
@@ -341,6 +368,15 @@ gboolean janus_vp8_is_keyframe(const char *buffer, int len);
  * @returns TRUE if it's a keyframe, FALSE otherwise */
 gboolean janus_vp9_is_keyframe(const char *buffer, int len);
 
+/*! \brief Helper method to find which NAL types an H.264 RTP payload contains
+ * \details This goes through the payload only once (looking into STAP-A packets,
+ * and only taking into account the start of FU-A and FU-B fragments), so it's
+ * what should be used when more than one NAL type is of interest
+ * @param[in] buffer The RTP payload to process
+ * @param[in] len The length of the RTP payload
+ * @returns A bitmask of the NAL types found (bit N set means NAL type N is there) */
+guint32 janus_h264_nal_types(const char *buffer, int len);
+
 /*! \brief Helper method to check if an H.264 frame is a keyframe or not
  * @note This checks the presence of an SPS NAL (7), nor an I-Frame (5),
  * since SPS/PPS are what's needed for a browser to actually be able to
@@ -369,12 +405,26 @@ gboolean janus_h264_is_b_frame(const char *buffer, int len);
  * @returns TRUE if it's a keyframe, FALSE otherwise */
 gboolean janus_av1_is_keyframe(const char *buffer, int len);
 
+/*! \brief Helper method to find which NAL types an H.265 RTP payload contains
+ * \details As janus_h264_nal_types, this looks into Aggregation Packets, and
+ * only takes into account the start of Fragmentation Units
+ * @param[in] buffer The RTP payload to process
+ * @param[in] len The length of the RTP payload
+ * @returns A bitmask of the NAL types found (bit N set means NAL type N is there) */
+guint64 janus_h265_nal_types(const char *buffer, int len);
+
 /*! \brief Helper method to check if an H.265 frame is a keyframe or not
  * @param[in] buffer The RTP payload to process
  * @param[in] len The length of the RTP payload
  * @returns TRUE if it's a keyframe, FALSE otherwise */
 gboolean janus_h265_is_keyframe(const char *buffer, int len);
 
+/*! \brief Helper method to remove the emulation prevention bytes from an H.264 or H.265 NAL unit, in place
+ * @param[in,out] buffer The NAL unit to process
+ * @param[in] len The length of the NAL unit
+ * @returns The new length of the NAL unit */
+int janus_h26x_remove_emulation_prevention(uint8_t *buffer, int len);
+
 /*! \brief VP8 simulcasting context, in order to make sure SSRC changes result in coherent picid/temporal level increases */
 typedef struct janus_vp8_simulcast_context {
 	uint16_t last_picid, base_picid, base_picid_prev;
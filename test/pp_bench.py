@@ -0,0 +1,318 @@
+import argparse
+import hashlib
+import json
+import os
+import random
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+
+# How each codec is packetized, and what janus-pp-rec should convert it to
+CODECS = {
+    'opus': {'type': 'a', 'pt': 111, 'rate': 48000, 'period': 20, 'extension': 'opus'},
+    'vp8': {'type': 'v', 'pt': 96, 'rate': 90000, 'period': 33, 'extension': 'webm'},
+    'vp9': {'type': 'v', 'pt': 98, 'rate': 90000, 'period': 33, 'extension': 'webm'},
+    'h264': {'type': 'v', 'pt': 100, 'rate': 90000, 'period': 33, 'extension': 'mp4'},
+    'h265': {'type': 'v', 'pt': 102, 'rate': 90000, 'period': 33, 'extension': 'mp4'},
+    'av1': {'type': 'v', 'pt': 104, 'rate': 90000, 'period': 33, 'extension': 'mp4'},
+}
+
+# Packet level impairments applied to the fixtures
+SCENARIOS = ['clean', 'reordered', 'lossy', 'switches']
+
+WIDTH = 640
+HEIGHT = 480
+MTU = 1200
+KEYFRAME_INTERVAL = 60
+SWITCH_INTERVAL = 4000  # milliseconds
+
+
+class BitWriter():
+
+    def __init__(self):
+        self.bits = []
+
+    def bit(self, value):
+        self.bits.append(value & 1)
+
+    def uint(self, value, count):
+        for i in range(count - 1, -1, -1):
+            self.bit(value >> i)
+
+    def ue(self, value):
+        value += 1
+        count = value.bit_length()
+        self.uint(0, count - 1)
+        self.uint(value, count)
+
+    def rbsp(self):
+        # Trailing bits, and emulation prevention
+        self.bit(1)
+        while len(self.bits) % 8:
+            self.bit(0)
+        data = bytes(int(''.join(str(b) for b in self.bits[i:i + 8]), 2) for i in range(0, len(self.bits), 8))
+        out = bytearray()
+        zeros = 0
+        for b in data:
+            if zeros == 2 and b <= 3:
+                out.append(3)
+                zeros = 0
+            out.append(b)
+            zeros = zeros + 1 if b == 0 else 0
+        return bytes(out)
+
+
+def h264_sps():
+    # Baseline profile, 640x480, no VUI
+    bw = BitWriter()
+    bw.ue(0)        # seq_parameter_set_id
+    bw.ue(0)        # log2_max_frame_num_minus4
+    bw.ue(2)        # pic_order_cnt_type
+    bw.ue(1)        # max_num_ref_frames
+    bw.bit(0)       # gaps_in_frame_num_value_allowed_flag
+    bw.ue(WIDTH // 16 - 1)
+    bw.ue(HEIGHT // 16 - 1)
+    bw.bit(1)       # frame_mbs_only_flag
+    bw.bit(1)       # direct_8x8_inference_flag
+    bw.bit(0)       # frame_cropping_flag
+    bw.bit(0)       # vui_parameters_present_flag
+    return bytes([0x67, 66, 0xc0, 30]) + bw.rbsp()
+
+
+def h264_pps():
+    bw = BitWriter()
+    bw.ue(0)        # pic_parameter_set_id
+    bw.ue(0)        # seq_parameter_set_id
+    bw.uint(0, 2)   # entropy_coding_mode_flag, bottom_field_pic_order_in_frame_present_flag
+    bw.ue(0)        # num_slice_groups_minus1
+    bw.ue(0)        # num_ref_idx_l0_default_active_minus1
+    bw.ue(0)        # num_ref_idx_l1_default_active_minus1
+    bw.uint(0, 3)   # weighted_pred_flag, weighted_bipred_idc
+    bw.ue(0)        # pic_init_qp_minus26 (se)
+    bw.ue(0)        # pic_init_qs_minus26 (se)
+    bw.ue(0)        # chroma_qp_index_offset (se)
+    bw.uint(0b100, 3)
+    return bytes([0x68]) + bw.rbsp()
+
+
+def fragment(data, size):
+    return [data[i:i + size] for i in range(0, len(data), size)] or [b'']
+
+
+def packetize(codec, rng, keyframe):
+    """Return the RTP payloads of a single synthetic frame"""
+    if codec == 'opus':
+        return [bytes([0xfc]) + rng.randbytes(rng.randint(60, 120))]
+    size = rng.randint(6000, 12000) if keyframe else rng.randint(800, 2500)
+    body = rng.randbytes(size)
+    payloads = []
+    if codec == 'vp8':
+        # Frame tag, and start code with the resolution for keyframes
+        first = len(body) & 0x7ffff
+        tag = (0 if keyframe else 1) | 0x10 | (first << 5)
+        frame = struct.pack('<I', tag)[:3]
+        if keyframe:
+            frame += b'\x9d\x01\x2a' + struct.pack('<HH', WIDTH, HEIGHT)
+        frame += body
+        for i, chunk in enumerate(fragment(frame, MTU)):
+            payloads.append(bytes([0x10 if i == 0 else 0x00]) + chunk)
+    elif codec == 'vp9':
+        chunks = fragment(body, MTU)
+        for i, chunk in enumerate(chunks):
+            flags = 0x00 if keyframe else 0x40
+            if i == 0:
+                flags |= 0x08
+                if keyframe:
+                    flags |= 0x02
+            if i == len(chunks) - 1:
+                flags |= 0x04
+            descriptor = bytes([flags])
+            if i == 0 and keyframe:
+                # Scalability structure: one layer, with its resolution
+                descriptor += bytes([0x10]) + struct.pack('>HH', WIDTH, HEIGHT)
+            payloads.append(descriptor + chunk)
+    elif codec == 'h264':
+        if keyframe:
+            payloads += [h264_sps(), h264_pps()]
+        nal = 0x65 if keyframe else 0x41
+        chunks = fragment(body, MTU)
+        for i, chunk in enumerate(chunks):
+            header = (nal & 0x1f) | (0x80 if i == 0 else 0) | (0x40 if i == len(chunks) - 1 else 0)
+            payloads.append(bytes([(nal & 0x60) | 28, header]) + chunk)
+    elif codec == 'h265':
+        nal = 19 if keyframe else 1
+        chunks = fragment(body, MTU)
+        for i, chunk in enumerate(chunks):
+            header = nal | (0x80 if i == 0 else 0) | (0x40 if i == len(chunks) - 1 else 0)
+            payloads.append(bytes([49 << 1, 0x01, header]) + chunk)
+    elif codec == 'av1':
+        obu = bytes([6 << 3]) + body
+        chunks = fragment(obu, MTU)
+        for i, chunk in enumerate(chunks):
+            aggregation = 0x10
+            if i > 0:
+                aggregation |= 0x80
+            if i < len(chunks) - 1:
+                aggregation |= 0x40
+            if i == 0 and keyframe:
+                aggregation |= 0x08
+            payloads.append(bytes([aggregation]) + chunk)
+    return payloads
+
+
+def generate(path, codec, scenario, duration, seed):
+    """Write a synthetic .mjr recording, and return its size"""
+    info = CODECS[codec]
+    rng = random.Random('%s-%s-%d' % (codec, scenario, seed))
+    created = 1700000000000000
+    header = json.dumps({'t': info['type'], 'c': codec, 's': created, 'u': created + 50000},
+                        separators=(',', ':')).encode()
+    ssrc = rng.getrandbits(32)
+    seq = rng.getrandbits(16)
+    ts = rng.getrandbits(32)
+    packets = []
+    frames = duration * 1000 // info['period']
+    next_switch = SWITCH_INTERVAL
+    keyframe_in = 0
+    for n in range(frames):
+        when = n * info['period']
+        if scenario == 'switches' and when >= next_switch:
+            # Simulate a substream switch the recorder didn't smooth out
+            next_switch += SWITCH_INTERVAL
+            seq = (seq + rng.randint(100, 1000)) & 0xffff
+            ts = (ts + rng.randint(1, 10) * info['rate']) & 0xffffffff
+            keyframe_in = 0
+        keyframe = info['type'] == 'v' and keyframe_in == 0
+        keyframe_in = (keyframe_in + 1) % KEYFRAME_INTERVAL
+        payloads = packetize(codec, rng, keyframe)
+        for i, payload in enumerate(payloads):
+            marker = 0x80 if i == len(payloads) - 1 else 0
+            rtp = struct.pack('>BBHII', 0x80, marker | info['pt'], seq, ts, ssrc) + payload
+            packets.append((when, rtp))
+            seq = (seq + 1) & 0xffff
+        ts = (ts + info['period'] * info['rate'] // 1000) & 0xffffffff
+    if scenario == 'reordered':
+        for i in range(len(packets) - 1):
+            if rng.random() < 0.05:
+                packets[i], packets[i + 1] = packets[i + 1], packets[i]
+    elif scenario == 'lossy':
+        packets = [p for p in packets if rng.random() >= 0.03]
+    with open(path, 'wb') as f:
+        f.write(b'MJR00002' + struct.pack('>H', len(header)) + header)
+        for when, rtp in packets:
+            f.write(b'MEET' + struct.pack('>IH', when, len(rtp)) + rtp)
+    return os.path.getsize(path)
+
+
+def run(pprec, source, target):
+    """Process a recording, and return exit code, elapsed time and peak RSS (KB)"""
+    start = time.perf_counter()
+    proc = subprocess.Popen([pprec, source, target], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    _, status, usage = os.wait4(proc.pid, 0)
+    elapsed = time.perf_counter() - start
+    proc.returncode = os.waitstatus_to_exitcode(status)
+    return proc.returncode, elapsed, usage.ru_maxrss
+
+
+def checksum(path):
+    if not os.path.exists(path):
+        return None
+    h = hashlib.sha256()
+    with open(path, 'rb') as f:
+        for chunk in iter(lambda: f.read(65536), b''):
+            h.update(chunk)
+    return h.hexdigest()
+
+
+def compare(results, baseline, tolerance):
+    """Return a list of regressions with respect to a previous run"""
+    previous = {(r['codec'], r['scenario']): r for r in baseline.get('results', [])}
+    problems = []
+    for r in results:
+        old = previous.get((r['codec'], r['scenario']))
+        if old is None:
+            continue
+        name = '%s/%s' % (r['codec'], r['scenario'])
+        if old['sha256'] != r['sha256']:
+            problems.append('%s: output changed (%s -> %s)' % (name, old['sha256'], r['sha256']))
+        if old['mbps'] > 0 and r['mbps'] < old['mbps'] * (1 - tolerance / 100):
+            problems.append('%s: throughput dropped from %.2f to %.2f MB/s' % (name, old['mbps'], r['mbps']))
+        if old['max_rss_kb'] > 0 and r['max_rss_kb'] > old['max_rss_kb'] * (1 + tolerance / 100):
+            problems.append('%s: peak RSS grew from %d to %d KB' % (name, old['max_rss_kb'], r['max_rss_kb']))
+    return problems
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='janus-pp-rec benchmark')
+    parser.add_argument('--janus-pp-rec', default='janus-pp-rec',
+                        help='Path to the janus-pp-rec binary (default=janus-pp-rec)')
+    parser.add_argument('--codecs', default=','.join(CODECS),
+                        help='Comma separated list of codecs to test (default=all)')
+    parser.add_argument('--scenarios', default=','.join(SCENARIOS),
+                        help='Comma separated list of scenarios to test (default=all)')
+    parser.add_argument('--duration', type=int, default=120,
+                        help='Duration of the generated recordings, in seconds (default=120)')
+    parser.add_argument('--repeat', type=int, default=3,
+                        help='How many times to process each recording, keeping the fastest run (default=3)')
+    parser.add_argument('--seed', type=int, default=0,
+                        help='Seed for the generated recordings (default=0)')
+    parser.add_argument('--output',
+                        help='Save the results to this JSON file, besides printing them')
+    parser.add_argument('--baseline',
+                        help='Compare the results to the ones of a previous run, saved with --output')
+    parser.add_argument('--tolerance', type=float, default=10,
+                        help='Percentage of throughput and RSS change tolerated when comparing (default=10)')
+    args = parser.parse_args()
+
+    results = []
+    failed = False
+    with tempfile.TemporaryDirectory(prefix='pp-bench-') as workdir:
+        for codec in args.codecs.split(','):
+            if codec not in CODECS:
+                sys.exit('Unsupported codec %s' % codec)
+            for scenario in args.scenarios.split(','):
+                if scenario not in SCENARIOS:
+                    sys.exit('Unsupported scenario %s' % scenario)
+                source = os.path.join(workdir, '%s-%s.mjr' % (codec, scenario))
+                target = os.path.join(workdir, '%s-%s.%s' % (codec, scenario, CODECS[codec]['extension']))
+                size = generate(source, codec, scenario, args.duration, args.seed)
+                best = None
+                for i in range(max(args.repeat, 1)):
+                    if os.path.exists(target):
+                        os.unlink(target)
+                    res = run(args.janus_pp_rec, source, target)
+                    if best is None or res[0] != 0 or res[1] < best[1]:
+                        best = res
+                    if res[0] != 0:
+                        break
+                code, elapsed, rss = best
+                result = {
+                    'codec': codec,
+                    'scenario': scenario,
+                    'exit': code,
+                    'input_bytes': size,
+                    'output_bytes': os.path.getsize(target) if os.path.exists(target) else 0,
+                    'seconds': round(elapsed, 4),
+                    'mbps': round(size / elapsed / 1e6, 2) if elapsed > 0 else 0,
+                    'max_rss_kb': rss,
+                    'sha256': checksum(target),
+                }
+                if code != 0:
+                    failed = True
+                results.append(result)
+                print(json.dumps(result), flush=True)
+    report = {'duration': args.duration, 'seed': args.seed, 'results': results}
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(report, f, indent=2)
+    if args.baseline:
+        with open(args.baseline) as f:
+            problems = compare(results, json.load(f), args.tolerance)
+        for p in problems:
+            print('REGRESSION: ' + p, file=sys.stderr)
+        if problems:
+            failed = True
+    sys.exit(1 if failed else 0)
@@ -0,0 +1,631 @@
+import argparse
+import asyncio
+import json
+import logging
+import os
+import random
+import socket
+import struct
+import subprocess
+import sys
+import time
+from urllib.parse import urlparse
+
+import av
+from aiortc import RTCPeerConnection, RTCSessionDescription
+from aiortc.codecs import get_encoder
+from aiortc.mediastreams import AudioStreamTrack, MediaStreamError, VideoStreamTrack
+from aiortc.rtcrtpparameters import RTCRtpCodecParameters
+from aiortc.rtp import RTCP_PSFB_PLI, RTCP_RTPFB_NACK, RtcpPsfbPacket, RtcpRtpfbPacket
+
+from echo import JanusSession
+
+
+logger = logging.getLogger('sfu_load')
+
+# Synthetic video frames: each one carries a unique ID, drawn as black and
+# white cells, so that subscribers can figure out when it was sent
+WIDTH = 320
+HEIGHT = 240
+CELL = 40
+ID_BITS = 20
+ID_MASK = (1 << ID_BITS) - 1
+SENT_HISTORY = 4096
+
+# Default values for scenario properties
+SCENARIO_DEFAULTS = {
+    'name': 'unnamed',
+    'plugin': 'videoroom',
+    'publishers': 1,
+    'subscribers': 0,
+    'publishers_subscribe': False,
+    'audio': True,
+    'video': True,
+    'bitrate': 512000,
+    'ramp': 0,
+    'warmup': 5,
+    'duration': 30,
+    'latency_sample': 10,
+    'keyframe_interval': 2,
+}
+
+
+class Metrics():
+
+    def __init__(self):
+        self.api = {}
+        self.failures = 0
+        self.frames_sent = {}
+        self.frame_id = 0
+        self.latencies = []
+        self.nacks = 0
+        self.plis = 0
+
+    def api_call(self, name, elapsed):
+        self.api.setdefault(name, []).append(elapsed * 1000)
+
+    def next_frame_id(self):
+        frame_id = self.frame_id
+        self.frame_id = (self.frame_id + 1) & ID_MASK
+        self.frames_sent[frame_id] = time.monotonic()
+        self.frames_sent.pop((frame_id - SENT_HISTORY) & ID_MASK, None)
+        return frame_id
+
+    def frame_received(self, frame_id):
+        sent = self.frames_sent.get(frame_id)
+        if sent is not None:
+            self.latencies.append((time.monotonic() - sent) * 1000)
+
+
+METRICS = Metrics()
+
+
+def percentiles(values):
+    if not values:
+        return None
+    values = sorted(values)
+
+    def rank(p):
+        return round(values[min(len(values) - 1, int(len(values) * p / 100))], 2)
+    return {'samples': len(values), 'p50': rank(50), 'p90': rank(90), 'p95': rank(95),
+            'p99': rank(99), 'max': round(values[-1], 2)}
+
+
+class MarkerVideoTrack(VideoStreamTrack):
+    """Video track whose frames encode a unique ID, as cells of the luma plane"""
+
+    async def recv(self):
+        pts, time_base = await self.next_timestamp()
+        frame_id = METRICS.next_frame_id()
+        bits = frame_id | ((~frame_id & ID_MASK) << ID_BITS)
+        frame = av.VideoFrame(width=WIDTH, height=HEIGHT, format='yuv420p')
+        luma = frame.planes[0]
+        columns = WIDTH // CELL
+        rows = []
+        for r in range(HEIGHT // CELL):
+            row = bytearray()
+            for c in range(columns):
+                index = r * columns + c
+                white = index < 2 * ID_BITS and (bits >> index) & 1
+                row += (b'\xeb' if white else b'\x10') * CELL
+            row += b'\x80' * (luma.line_size - WIDTH)
+            rows.append(bytes(row) * CELL)
+        luma.update(b''.join(rows))
+        for chroma in frame.planes[1:]:
+            chroma.update(b'\x80' * chroma.buffer_size)
+        frame.pts = pts
+        frame.time_base = time_base
+        return frame
+
+
+def read_frame_id(frame):
+    """Return the ID drawn by MarkerVideoTrack on a decoded frame, if any"""
+    if frame.width != WIDTH or frame.height != HEIGHT:
+        return None
+    luma = frame.planes[0]
+    data = bytes(luma)
+    columns = WIDTH // CELL
+    bits = 0
+    for index in range(2 * ID_BITS):
+        y = (index // columns) * CELL + CELL // 2
+        x = (index % columns) * CELL + CELL // 2
+        level = sum(data[(y + dy) * luma.line_size + x + dx] for dy in (-4, 0, 4) for dx in (-4, 0, 4))
+        if level > 128 * 9:
+            bits |= 1 << index
+    frame_id = bits & ID_MASK
+    if (bits >> ID_BITS) != (~frame_id & ID_MASK):
+        return None
+    return frame_id
+
+
+def count_feedback(sender):
+    """Count the NACKs and PLIs Janus sends us for a track we're publishing"""
+    # This wraps a private aiortc method, as there are no stats for feedback
+    handler = sender._handle_rtcp_packet
+
+    async def wrapped(packet):
+        if isinstance(packet, RtcpRtpfbPacket) and packet.fmt == RTCP_RTPFB_NACK:
+            METRICS.nacks += len(packet.lost)
+        elif isinstance(packet, RtcpPsfbPacket) and packet.fmt == RTCP_PSFB_PLI:
+            METRICS.plis += 1
+        await handler(packet)
+    sender._handle_rtcp_packet = wrapped
+
+
+async def consume(track, measure):
+    """Read all frames from a received track, measuring latency if needed"""
+    while True:
+        try:
+            frame = await track.recv()
+        except MediaStreamError:
+            return
+        if measure and track.kind == 'video':
+            frame_id = read_frame_id(frame)
+            if frame_id is not None:
+                METRICS.frame_received(frame_id)
+
+
+class Client():
+    """A Janus session with a single handle, and the PeerConnection negotiated on it"""
+
+    def __init__(self, url, plugin, label):
+        self.label = label
+        self.plugin_name = plugin
+        self.session = JanusSession(url)
+        self.plugin = None
+        self.pc = RTCPeerConnection()
+        self.tasks = []
+
+    async def timed(self, name, coro):
+        start = time.monotonic()
+        result = await coro
+        METRICS.api_call(name, time.monotonic() - start)
+        return result
+
+    async def start(self):
+        await self.timed('create', self.session.create())
+        self.plugin = await self.timed('attach', self.session.attach(self.plugin_name))
+
+    async def request(self, name, body, jsep=None):
+        message = {'body': body}
+        if jsep is not None:
+            message['jsep'] = jsep
+        response = await self.timed(name, self.plugin.sendMessage(message))
+        if response.get('janus') == 'error':
+            raise Exception('%s: %s failed: %s' % (self.label, name, response['error']['reason']))
+        data = response.get('plugindata', {}).get('data', {})
+        if 'error' in data:
+            raise Exception('%s: %s failed: %s' % (self.label, name, data['error']))
+        return data, response.get('jsep')
+
+    def add_tracks(self, audio, video):
+        if audio:
+            count_feedback(self.pc.addTrack(AudioStreamTrack()))
+        if video:
+            count_feedback(self.pc.addTrack(MarkerVideoTrack()))
+
+    def receive_tracks(self, measure):
+        @self.pc.on('track')
+        def on_track(track):
+            self.tasks.append(asyncio.ensure_future(consume(track, measure)))
+
+    async def offer(self):
+        await self.pc.setLocalDescription(await self.pc.createOffer())
+        return {'type': 'offer', 'sdp': self.pc.localDescription.sdp, 'trickle': False}
+
+    async def answer(self, offer):
+        await self.pc.setRemoteDescription(RTCSessionDescription(sdp=offer['sdp'], type=offer['type']))
+        await self.pc.setLocalDescription(await self.pc.createAnswer())
+        return {'type': 'answer', 'sdp': self.pc.localDescription.sdp, 'trickle': False}
+
+    async def apply_answer(self, answer):
+        if answer is None:
+            raise Exception('%s: no answer received' % self.label)
+        await self.pc.setRemoteDescription(RTCSessionDescription(sdp=answer['sdp'], type=answer['type']))
+
+    async def packets(self):
+        sent = received = lost = 0
+        for stat in (await self.pc.getStats()).values():
+            if stat.type == 'outbound-rtp':
+                sent += stat.packetsSent
+            elif stat.type == 'inbound-rtp':
+                received += stat.packetsReceived
+                lost += max(stat.packetsLost, 0)
+        return sent, received, lost
+
+    async def stop(self):
+        for task in self.tasks:
+            task.cancel()
+        try:
+            await self.pc.close()
+            await self.session.destroy()
+        except Exception:
+            logger.debug('%s: error closing', self.label, exc_info=True)
+
+
+class Scenario():
+    """Base class for the plugin specific scenarios"""
+
+    def __init__(self, url, config, args):
+        self.url = url
+        self.config = config
+        self.args = args
+        self.room = random.randint(1000000, 9999999)
+        self.admin = None
+        self.publishers = []
+        self.subscribers = []
+        self.streams_in = 0
+        self.streams_out = 0
+
+    def media_count(self):
+        return int(self.config['audio']) + int(self.config['video'])
+
+    async def ramp(self, count, factory):
+        """Start clients either all at once (join storm) or at a fixed rate"""
+        rate = self.config['ramp']
+
+        async def delayed(index):
+            if rate > 0:
+                await asyncio.sleep(index / rate)
+            try:
+                return await factory(index)
+            except Exception as e:
+                METRICS.failures += 1
+                logger.warning('Client setup failed: %s', e)
+                return None
+        clients = await asyncio.gather(*[delayed(i) for i in range(count)])
+        return [c for c in clients if c is not None]
+
+    async def setup(self):
+        raise NotImplementedError
+
+    async def teardown(self):
+        await asyncio.gather(*[c.stop() for c in self.subscribers + self.publishers])
+        if self.admin is not None:
+            await self.destroy()
+            await self.admin.stop()
+
+    async def destroy(self):
+        pass
+
+
+class VideoRoomScenario(Scenario):
+
+    async def setup(self):
+        self.admin = Client(self.url, 'janus.plugin.videoroom', 'admin')
+        await self.admin.start()
+        await self.admin.request('create', {
+            'request': 'create', 'room': self.room,
+            'publishers': max(self.config['publishers'], 1),
+            'bitrate': self.config['bitrate'],
+            'audiocodec': 'opus', 'videocodec': 'vp8',
+        })
+        self.publishers = await self.ramp(self.config['publishers'], self.publish)
+        feeds = [p.feed for p in self.publishers]
+        self.streams_in = len(self.publishers) * self.media_count()
+        sample = self.config['latency_sample']
+        if self.config['publishers_subscribe']:
+            others = await self.ramp(len(feeds), lambda i: self.subscribe(i, [f for f in feeds if f != feeds[i]], i < sample))
+            self.subscribers.extend(others)
+            self.streams_out += len(others) * max(len(feeds) - 1, 0) * self.media_count()
+        viewers = await self.ramp(self.config['subscribers'], lambda i: self.subscribe(i, feeds, i < sample))
+        self.subscribers.extend(viewers)
+        self.streams_out += len(viewers) * len(feeds) * self.media_count()
+
+    async def publish(self, index):
+        client = Client(self.url, 'janus.plugin.videoroom', 'publisher-%d' % index)
+        await client.start()
+        data, _ = await client.request('join', {
+            'request': 'join', 'ptype': 'publisher', 'room': self.room, 'display': client.label,
+        })
+        client.feed = data['id']
+        client.add_tracks(self.config['audio'], self.config['video'])
+        _, answer = await client.request('publish', {'request': 'publish'}, await client.offer())
+        await client.apply_answer(answer)
+        return client
+
+    async def subscribe(self, index, feeds, measure):
+        client = Client(self.url, 'janus.plugin.videoroom', 'subscriber-%d' % index)
+        client.receive_tracks(measure)
+        await client.start()
+        _, offer = await client.request('subscribe', {
+            'request': 'join', 'ptype': 'subscriber', 'room': self.room,
+            'streams': [{'feed': f} for f in feeds],
+        })
+        if offer is None:
+            raise Exception('%s: no offer received' % client.label)
+        await client.request('start', {'request': 'start'}, await client.answer(offer))
+        return client
+
+    async def destroy(self):
+        await self.admin.request('destroy', {'request': 'destroy', 'room': self.room})
+
+
+class AudioBridgeScenario(Scenario):
+    """Publishers are unmuted speakers, subscribers are muted listeners"""
+
+    async def setup(self):
+        self.config['video'] = False
+        self.admin = Client(self.url, 'janus.plugin.audiobridge', 'admin')
+        await self.admin.start()
+        await self.admin.request('create', {'request': 'create', 'room': self.room, 'sampling_rate': 48000})
+        self.publishers = await self.ramp(self.config['publishers'], lambda i: self.join(i, False))
+        self.subscribers = await self.ramp(self.config['subscribers'], lambda i: self.join(i, True))
+        # Everybody gets their own mix
+        self.streams_in = len(self.publishers)
+        self.streams_out = len(self.publishers) + len(self.subscribers)
+
+    async def join(self, index, muted):
+        client = Client(self.url, 'janus.plugin.audiobridge', '%s-%d' % ('listener' if muted else 'speaker', index))
+        client.receive_tracks(False)
+        await client.start()
+        await client.request('join', {'request': 'join', 'room': self.room, 'display': client.label, 'muted': muted})
+        client.add_tracks(True, False)
+        _, answer = await client.request('configure', {'request': 'configure', 'muted': muted}, await client.offer())
+        await client.apply_answer(answer)
+        return client
+
+    async def destroy(self):
+        await self.admin.request('destroy', {'request': 'destroy', 'room': self.room})
+
+
+class RtpSource():
+    """Plain RTP source feeding a Streaming mountpoint, encoded with the aiortc codecs"""
+
+    def __init__(self, host, port, track, codec, keyframe_interval):
+        self.address = (host, port)
+        self.track = track
+        self.encoder = get_encoder(codec)
+        self.pt = codec.payloadType
+        self.ssrc = random.randint(1, 0xffffffff)
+        self.seq = random.randint(0, 0xffff)
+        self.keyframe_interval = keyframe_interval
+        self.packets = 0
+
+    async def run(self):
+        loop = asyncio.get_event_loop()
+        sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        sock.setblocking(False)
+        last_keyframe = 0
+        try:
+            while True:
+                frame = await self.track.recv()
+                now = time.monotonic()
+                force = self.keyframe_interval > 0 and now - last_keyframe >= self.keyframe_interval
+                if force:
+                    last_keyframe = now
+                payloads, timestamp = await loop.run_in_executor(None, self.encoder.encode, frame, force)
+                for i, payload in enumerate(payloads):
+                    marker = 0x80 if i == len(payloads) - 1 else 0
+                    header = struct.pack('!BBHII', 0x80, marker | self.pt, self.seq, timestamp & 0xffffffff, self.ssrc)
+                    self.seq = (self.seq + 1) & 0xffff
+                    sock.sendto(header + payload, self.address)
+                    self.packets += 1
+        finally:
+            sock.close()
+
+
+class StreamingScenario(Scenario):
+    """Publishers are RTP mountpoints fed by this script, subscribers watch them round robin"""
+
+    async def setup(self):
+        self.admin = Client(self.url, 'janus.plugin.streaming', 'admin')
+        await self.admin.start()
+        host = self.args.rtp_host or urlparse(self.url).hostname or '127.0.0.1'
+        self.mountpoints = []
+        self.sources = []
+        for i in range(max(self.config['publishers'], 1)):
+            mountpoint = self.room + i
+            media = []
+            if self.config['audio']:
+                media.append({'type': 'audio', 'mid': 'a', 'port': 0, 'pt': 111, 'codec': 'opus'})
+            if self.config['video']:
+                media.append({'type': 'video', 'mid': 'v', 'port': 0, 'pt': 96, 'codec': 'vp8'})
+            data, _ = await self.admin.request('create', {
+                'request': 'create', 'type': 'rtp', 'id': mountpoint, 'media': media,
+            })
+            self.mountpoints.append(mountpoint)
+            for port in data['stream']['ports']:
+                if port['mid'] == 'a':
+                    codec = RTCRtpCodecParameters(mimeType='audio/opus', clockRate=48000, channels=2, payloadType=111)
+                    track = AudioStreamTrack()
+                else:
+                    codec = RTCRtpCodecParameters(mimeType='video/VP8', clockRate=90000, payloadType=96)
+                    track = MarkerVideoTrack()
+                self.sources.append(RtpSource(host, port['port'], track, codec, self.config['keyframe_interval']))
+        self.tasks = [asyncio.ensure_future(s.run()) for s in self.sources]
+        self.streams_in = len(self.sources)
+        sample = self.config['latency_sample']
+        self.subscribers = await self.ramp(self.config['subscribers'], lambda i: self.watch(i, i < sample))
+        self.streams_out = len(self.subscribers) * self.media_count()
+
+    async def watch(self, index, measure):
+        client = Client(self.url, 'janus.plugin.streaming', 'viewer-%d' % index)
+        client.receive_tracks(measure)
+        await client.start()
+        mountpoint = self.mountpoints[index % len(self.mountpoints)]
+        _, offer = await client.request('watch', {'request': 'watch', 'id': mountpoint})
+        if offer is None:
+            raise Exception('%s: no offer received' % client.label)
+        await client.request('start', {'request': 'start'}, await client.answer(offer))
+        return client
+
+    async def destroy(self):
+        for task in self.tasks:
+            task.cancel()
+        for mountpoint in self.mountpoints:
+            await self.admin.request('destroy', {'request': 'destroy', 'id': mountpoint})
+
+
+SCENARIOS = {
+    'videoroom': VideoRoomScenario,
+    'audiobridge': AudioBridgeScenario,
+    'streaming': StreamingScenario,
+}
+
+
+def find_janus_pid():
+    try:
+        return int(subprocess.check_output(['pidof', '-s', 'janus']).split()[0])
+    except Exception:
+        return None
+
+
+def cpu_seconds(pid):
+    """Return the user+system CPU time a process used so far, if it runs locally"""
+    if pid is None:
+        return None
+    try:
+        with open('/proc/%d/stat' % pid) as f:
+            # Skip the command name, which may contain spaces
+            fields = f.read().rsplit(')', 1)[1].split()
+        return (int(fields[11]) + int(fields[12])) / os.sysconf('SC_CLK_TCK')
+    except (OSError, IndexError, ValueError):
+        return None
+
+
+async def snapshot(scenario, pid):
+    counters = await asyncio.gather(*[c.packets() for c in scenario.publishers + scenario.subscribers])
+    ingress = sum(c[0] for c in counters)
+    if isinstance(scenario, StreamingScenario):
+        ingress = sum(s.packets for s in scenario.sources)
+    return {
+        'time': time.monotonic(),
+        'cpu': cpu_seconds(pid),
+        'ingress': ingress,
+        'egress': sum(c[1] for c in counters),
+        'lost': sum(c[2] for c in counters),
+        'nacks': METRICS.nacks,
+        'plis': METRICS.plis,
+    }
+
+
+async def run(url, config, args):
+    scenario = SCENARIOS[config['plugin']](url, config, args)
+    pid = args.janus_pid or find_janus_pid()
+    setup_start = time.monotonic()
+    try:
+        await scenario.setup()
+        setup_time = time.monotonic() - setup_start
+        logger.info('Setup completed in %.2fs, warming up', setup_time)
+        await asyncio.sleep(config['warmup'])
+        before = await snapshot(scenario, pid)
+        METRICS.latencies = []
+        logger.info('Measuring for %ds', config['duration'])
+        await asyncio.sleep(config['duration'])
+        after = await snapshot(scenario, pid)
+    finally:
+        await scenario.teardown()
+    elapsed = after['time'] - before['time']
+    streams = scenario.streams_in + scenario.streams_out
+    received = after['egress'] - before['egress']
+    lost = after['lost'] - before['lost']
+    cpu = None
+    if before['cpu'] is not None and after['cpu'] is not None:
+        percent = (after['cpu'] - before['cpu']) / elapsed * 100
+        cpu = {
+            'percent': round(percent, 2),
+            'percent_per_stream': round(percent / streams, 4) if streams else None,
+        }
+    return {
+        'scenario': config['name'],
+        'plugin': config['plugin'],
+        'publishers': len(scenario.publishers) if not isinstance(scenario, StreamingScenario) else len(scenario.mountpoints),
+        'subscribers': len(scenario.subscribers),
+        'setup_failures': METRICS.failures,
+        'setup_seconds': round(setup_time, 2),
+        'streams_in': scenario.streams_in,
+        'streams_out': scenario.streams_out,
+        'duration': round(elapsed, 2),
+        'server_cpu': cpu,
+        'ingress_pps': round((after['ingress'] - before['ingress']) / elapsed, 1),
+        'egress_pps': round(received / elapsed, 1),
+        'egress_loss_percent': round(lost * 100 / (received + lost), 3) if received + lost else 0,
+        'nacks_per_second': round((after['nacks'] - before['nacks']) / elapsed, 2),
+        'plis_per_second': round((after['plis'] - before['plis']) / elapsed, 2),
+        'latency_ms': percentiles(METRICS.latencies),
+        'api_latency_ms': {name: percentiles(values) for name, values in METRICS.api.items()},
+    }
+
+
+def compare(result, baseline, tolerance):
+    """Return a list of regressions with respect to a previous run"""
+    problems = []
+    grow = 1 + tolerance / 100
+    if result['setup_failures'] > baseline.get('setup_failures', 0):
+        problems.append('setup failures grew from %d to %d' % (baseline.get('setup_failures', 0), result['setup_failures']))
+    old = baseline.get('egress_pps', 0)
+    if old > 0 and result['egress_pps'] < old * (1 - tolerance / 100):
+        problems.append('egress dropped from %.1f to %.1f pps' % (old, result['egress_pps']))
+    old = (baseline.get('server_cpu') or {}).get('percent_per_stream')
+    new = (result['server_cpu'] or {}).get('percent_per_stream')
+    if old and new and new > old * grow:
+        problems.append('CPU per stream grew from %.4f%% to %.4f%%' % (old, new))
+    old = (baseline.get('latency_ms') or {}).get('p95')
+    new = (result['latency_ms'] or {}).get('p95')
+    if old and new and new > old * grow:
+        problems.append('p95 latency grew from %.2fms to %.2fms' % (old, new))
+    for name, stats in result['api_latency_ms'].items():
+        old = (baseline.get('api_latency_ms', {}).get(name) or {}).get('p95')
+        if old and stats and stats['p95'] > old * grow:
+            problems.append('p95 latency of %s requests grew from %.2fms to %.2fms' % (name, old, stats['p95']))
+    return problems
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Janus SFU load generator')
+    parser.add_argument('url',
+                        help='Janus root URL, e.g. ws://localhost:8188/')
+    parser.add_argument('scenario',
+                        help='JSON file describing the scenario to run (see the scenarios folder)')
+    parser.add_argument('--publishers', type=int,
+                        help='Override the number of publishers in the scenario')
+    parser.add_argument('--subscribers', type=int,
+                        help='Override the number of subscribers in the scenario')
+    parser.add_argument('--duration', type=int,
+                        help='Override how long to measure for, in seconds')
+    parser.add_argument('--janus-pid', type=int,
+                        help='PID of the Janus process, to measure its CPU usage (default=look for a local janus process)')
+    parser.add_argument('--rtp-host',
+                        help='Address to send RTP to for Streaming mountpoints (default=the host in the URL)')
+    parser.add_argument('--output',
+                        help='Save the results to this JSON file, besides printing them')
+    parser.add_argument('--baseline',
+                        help='Compare the results to the ones of a previous run, saved with --output')
+    parser.add_argument('--tolerance', type=float, default=10,
+                        help='Percentage of change tolerated when comparing (default=10)')
+    parser.add_argument('--verbose', '-v', action='count')
+    args = parser.parse_args()
+
+    logging.basicConfig(level=logging.DEBUG if args.verbose else logging.WARNING)
+    logger.setLevel(logging.INFO)
+
+    config = dict(SCENARIO_DEFAULTS)
+    with open(args.scenario) as f:
+        config.update(json.load(f))
+    for key in ('publishers', 'subscribers', 'duration'):
+        if getattr(args, key) is not None:
+            config[key] = getattr(args, key)
+    if config['plugin'] not in SCENARIOS:
+        sys.exit('Unsupported plugin %s' % config['plugin'])
+
+    loop = asyncio.new_event_loop()
+    asyncio.set_event_loop(loop)
+    try:
+        result = loop.run_until_complete(run(args.url, config, args))
+    except Exception:
+        logger.exception('Load test failed')
+        sys.exit(1)
+    print(json.dumps(result, indent=2), flush=True)
+    failed = result['setup_failures'] > 0
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(result, f, indent=2)
+    if args.baseline:
+        with open(args.baseline) as f:
+            problems = compare(result, json.load(f), args.tolerance)
+        for p in problems:
+            print('REGRESSION: ' + p, file=sys.stderr)
+        if problems:
+            failed = True
+    sys.exit(1 if failed else 0)